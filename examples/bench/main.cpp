@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <json.hpp>
+
+#include "ggml-backend.h"
+#include "stable-diffusion.h"
+
+#include "common/common.h"
+#include "common/media_io.h"
+#include "common/resource_owners.hpp"
+
+using json = nlohmann::json;
+
+struct SDBenchParams {
+    std::string sizes        = "512x512";
+    std::string steps        = "20";
+    std::string samplers     = "default";
+    std::string batch_counts = "1";
+    std::string cache_modes  = "disabled";
+    int warmup               = 1;
+    int repeat               = 3;
+    std::string format       = "json";
+    std::string output_path;
+
+    bool verbose     = false;
+    bool color       = false;
+    bool normal_exit = false;
+
+    ArgOptions get_options() {
+        ArgOptions options;
+
+        options.string_options = {
+            {"",
+             "--sizes",
+             "comma separated WxH resolutions to sweep (default: 512x512)",
+             0,
+             &sizes},
+            {"",
+             "--steps-list",
+             "comma separated sample step counts to sweep (default: 20)",
+             0,
+             &steps},
+            {"",
+             "--samplers",
+             "comma separated sample methods to sweep, 'default' picks the model default (default: default)",
+             0,
+             &samplers},
+            {"",
+             "--batch-counts",
+             "comma separated batch counts to sweep (default: 1)",
+             0,
+             &batch_counts},
+            {"",
+             "--cache-modes",
+             "comma separated cache modes to sweep, see --cache-mode (default: disabled)",
+             0,
+             &cache_modes},
+            {"",
+             "--format",
+             "report format, one of [json, csv] (default: json)",
+             0,
+             &format},
+            {"-o",
+             "--output",
+             "path to write the report to (default: stdout)",
+             0,
+             &output_path},
+        };
+
+        options.int_options = {
+            {"",
+             "--warmup",
+             "untimed runs per configuration before measuring (default: 1)",
+             &warmup},
+            {"",
+             "--repeat",
+             "timed runs per configuration (default: 3)",
+             &repeat},
+        };
+
+        options.bool_options = {
+            {"-v",
+             "--verbose",
+             "print extra info",
+             true, &verbose},
+            {"",
+             "--color",
+             "colors the logging tags according to level",
+             true, &color},
+        };
+
+        auto on_help_arg = [&](int argc, const char** argv, int index, bool& valid) {
+            normal_exit = true;
+            valid       = true;
+            return -1;
+        };
+
+        options.manual_options = {
+            {"-h",
+             "--help",
+             "show this help message and exit",
+             on_help_arg},
+        };
+
+        return options;
+    }
+
+    bool validate() {
+        if (format != "json" && format != "csv") {
+            LOG_ERROR("error: invalid report format %s, must be one of [json, csv]", format.c_str());
+            return false;
+        }
+        if (warmup < 0 || repeat < 1) {
+            LOG_ERROR("error: --warmup must be >= 0 and --repeat must be >= 1");
+            return false;
+        }
+        return true;
+    }
+};
+
+struct BenchConfig {
+    int width                     = 0;
+    int height                    = 0;
+    int steps                     = 0;
+    sample_method_t sample_method = SAMPLE_METHOD_COUNT;
+    int batch_count               = 1;
+    std::string cache_mode;
+};
+
+// Everything measured for one timed generation. Phase times come from
+// sd_get_perf_stats; text encode includes tokenization.
+struct BenchRun {
+    double total_ms       = 0.0;
+    double text_encode_ms = 0.0;
+    double sampling_ms    = 0.0;
+    double vae_decode_ms  = 0.0;
+    double png_encode_ms  = 0.0;
+    std::vector<double> step_ms;
+    int sample_cache_skipped_steps = 0;
+    size_t peak_vram_bytes         = 0;
+    size_t peak_rss_bytes          = 0;
+    bool success                   = false;
+    json runners                   = json::array();
+};
+
+struct BenchState {
+    SDBenchParams* params = nullptr;
+    BenchRun* run         = nullptr;
+    bool sampling         = false;
+    std::vector<size_t> min_free_vram;
+};
+
+static std::vector<std::string> split_list(const std::string& str) {
+    std::vector<std::string> items;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static size_t current_peak_rss_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Non-CPU devices only report free/total memory, so peak VRAM is approximated by
+// the lowest free memory seen while a run is in flight.
+static void sample_vram(BenchState* state) {
+    size_t dev_count = ggml_backend_dev_count();
+    if (state->min_free_vram.size() != dev_count) {
+        state->min_free_vram.assign(dev_count, SIZE_MAX);
+    }
+    for (size_t i = 0; i < dev_count; ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            continue;
+        }
+        size_t free_mem  = 0;
+        size_t total_mem = 0;
+        ggml_backend_dev_memory(dev, &free_mem, &total_mem);
+        state->min_free_vram[i] = std::min(state->min_free_vram[i], free_mem);
+    }
+}
+
+static size_t peak_vram_used(const BenchState& state) {
+    size_t used = 0;
+    for (size_t i = 0; i < state.min_free_vram.size(); ++i) {
+        if (state.min_free_vram[i] == SIZE_MAX) {
+            continue;
+        }
+        size_t free_mem  = 0;
+        size_t total_mem = 0;
+        ggml_backend_dev_memory(ggml_backend_dev_get(i), &free_mem, &total_mem);
+        used += total_mem - std::min(total_mem, state.min_free_vram[i]);
+    }
+    return used;
+}
+
+static void bench_log_cb(enum sd_log_level_t level, const char* log, void* data) {
+    BenchState* state = (BenchState*)data;
+    log_print(level, log, state->params->verbose, state->params->color);
+    if (state->run == nullptr || log == nullptr) {
+        return;
+    }
+
+    // The progress callback also reports tiled VAE and loading progress; only
+    // count it as diffusion steps between conditioning and the end of sampling.
+    if (strstr(log, " - get_learned_condition completed") != nullptr) {
+        state->sampling = true;
+    } else if (strstr(log, " - sampling completed") != nullptr) {
+        state->sampling = false;
+    }
+    sample_vram(state);
+}
+
+static void bench_progress_cb(int step, int steps, float time, void* data) {
+    BenchState* state = (BenchState*)data;
+    if (state->run == nullptr) {
+        return;
+    }
+    if (state->sampling && step > 0) {
+        state->run->step_ms.push_back(time * 1000.0);
+    }
+    sample_vram(state);
+}
+
+static bool run_once(sd_ctx_t* sd_ctx,
+                     SDGenerationParams& gen_params,
+                     BenchState& state,
+                     BenchRun* run) {
+    state.run      = run;
+    state.sampling = false;
+    state.min_free_vram.clear();
+    sample_vram(&state);
+
+    sd_img_gen_params_t img_gen_params = gen_params.to_sd_img_gen_params_t();
+
+    auto t0 = std::chrono::steady_clock::now();
+    SDImageVec results;
+    results.adopt(generate_image(sd_ctx, &img_gen_params), gen_params.batch_count);
+    auto t1 = std::chrono::steady_clock::now();
+
+    bool success = static_cast<bool>(results);
+    if (success) {
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].data == nullptr) {
+                continue;
+            }
+            std::vector<uint8_t> png = encode_image_to_vector(EncodedImageFormat::PNG,
+                                                              results[i].data,
+                                                              results[i].width,
+                                                              results[i].height,
+                                                              results[i].channel);
+            success = success && !png.empty();
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    sd_perf_stats_t perf_stats;
+    if (sd_get_perf_stats(sd_ctx, &perf_stats)) {
+        run->text_encode_ms             = perf_stats.text_encode_ms;
+        run->sampling_ms                = perf_stats.sampling_ms;
+        run->vae_decode_ms              = perf_stats.vae_decode_ms;
+        run->sample_cache_skipped_steps = perf_stats.sample_cache_skipped_steps;
+        for (int i = 0; i < perf_stats.runner_count; ++i) {
+            const sd_runner_perf_stats_t& runner = perf_stats.runners[i];
+            json runner_json;
+            runner_json["name"]                      = runner.name;
+            runner_json["compute_calls"]             = runner.compute_calls;
+            runner_json["graph_reuses"]              = runner.graph_reuses;
+            runner_json["graph_build_ms"]            = runner.graph_build_ms;
+            runner_json["alloc_ms"]                  = runner.alloc_ms;
+            runner_json["compute_ms"]                = runner.compute_ms;
+            runner_json["uploaded_bytes"]            = runner.uploaded_bytes;
+            runner_json["peak_compute_buffer_bytes"] = runner.peak_compute_buffer_bytes;
+            run->runners.push_back(runner_json);
+        }
+    }
+
+    run->total_ms        = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    run->png_encode_ms   = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    run->peak_vram_bytes = peak_vram_used(state);
+    run->peak_rss_bytes  = current_peak_rss_bytes();
+    run->success         = success;
+    state.run            = nullptr;
+    return success;
+}
+
+static double mean_of(const std::vector<double>& values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (double v : values) {
+        sum += v;
+    }
+    return sum / values.size();
+}
+
+static json run_to_json(const BenchRun& run) {
+    json j;
+    j["success"]         = run.success;
+    j["total_ms"]        = run.total_ms;
+    j["text_encode_ms"]  = run.text_encode_ms;
+    j["sampling_ms"]     = run.sampling_ms;
+    j["step_ms"]         = run.step_ms;
+    j["step_mean_ms"]    = mean_of(run.step_ms);
+    j["vae_decode_ms"]   = run.vae_decode_ms;
+    j["png_encode_ms"]   = run.png_encode_ms;
+    j["peak_vram_bytes"] = run.peak_vram_bytes;
+    j["peak_rss_bytes"]  = run.peak_rss_bytes;
+    j["runners"]         = run.runners;
+
+    j["sample_cache_skipped_steps"] = run.sample_cache_skipped_steps;
+    return j;
+}
+
+static std::string config_csv_prefix(const BenchConfig& config) {
+    std::ostringstream oss;
+    oss << config.width << "," << config.height << "," << config.steps << ","
+        << sd_sample_method_name(config.sample_method) << "," << config.batch_count << ","
+        << config.cache_mode;
+    return oss.str();
+}
+
+void print_usage(int argc, const char* argv[], const std::vector<ArgOptions>& options_list) {
+    std::cout << version_string() << "\n";
+    std::cout << "Usage: " << argv[0] << " [options]\n\n";
+    std::cout << "Bench Options:\n";
+    options_list[0].print();
+    std::cout << "\nContext Options:\n";
+    options_list[1].print();
+    std::cout << "\nGeneration Options:\n";
+    options_list[2].print();
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--version") {
+        std::cout << version_string() << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    SDBenchParams bench_params;
+    SDContextParams ctx_params;
+    SDGenerationParams gen_params;
+
+    std::vector<ArgOptions> options_vec = {bench_params.get_options(), ctx_params.get_options(), gen_params.get_options()};
+    if (!parse_options(argc, argv, options_vec)) {
+        print_usage(argc, argv, options_vec);
+        return bench_params.normal_exit ? 0 : 1;
+    }
+    if (!bench_params.validate() ||
+        !ctx_params.resolve_and_validate(IMG_GEN) ||
+        !gen_params.resolve_and_validate(IMG_GEN, ctx_params.lora_model_dir, ctx_params.hires_upscalers_dir)) {
+        print_usage(argc, argv, options_vec);
+        return 1;
+    }
+
+    BenchState state;
+    state.params = &bench_params;
+    sd_set_log_callback(bench_log_cb, (void*)&state);
+    sd_set_progress_callback(bench_progress_cb, (void*)&state);
+    log_verbose = bench_params.verbose;
+    log_color   = bench_params.color;
+
+    std::vector<BenchConfig> configs;
+    {
+        std::vector<std::string> sizes        = split_list(bench_params.sizes);
+        std::vector<std::string> steps        = split_list(bench_params.steps);
+        std::vector<std::string> samplers     = split_list(bench_params.samplers);
+        std::vector<std::string> batch_counts = split_list(bench_params.batch_counts);
+        std::vector<std::string> cache_modes  = split_list(bench_params.cache_modes);
+        if (sizes.empty() || steps.empty() || samplers.empty() || batch_counts.empty() || cache_modes.empty()) {
+            LOG_ERROR("error: every sweep list needs at least one entry");
+            return 1;
+        }
+
+        for (const auto& size : sizes) {
+            BenchConfig config;
+            if (sscanf(size.c_str(), "%dx%d", &config.width, &config.height) != 2 ||
+                config.width <= 0 || config.height <= 0) {
+                LOG_ERROR("error: invalid size '%s', expected WxH", size.c_str());
+                return 1;
+            }
+            for (const auto& step : steps) {
+                config.steps = atoi(step.c_str());
+                if (config.steps <= 0) {
+                    LOG_ERROR("error: invalid step count '%s'", step.c_str());
+                    return 1;
+                }
+                for (const auto& sampler : samplers) {
+                    config.sample_method = SAMPLE_METHOD_COUNT;
+                    if (sampler != "default") {
+                        config.sample_method = str_to_sample_method(sampler.c_str());
+                        if (config.sample_method == SAMPLE_METHOD_COUNT) {
+                            LOG_ERROR("error: invalid sample method '%s'", sampler.c_str());
+                            return 1;
+                        }
+                    }
+                    for (const auto& batch_count : batch_counts) {
+                        config.batch_count = atoi(batch_count.c_str());
+                        if (config.batch_count <= 0) {
+                            LOG_ERROR("error: invalid batch count '%s'", batch_count.c_str());
+                            return 1;
+                        }
+                        for (const auto& cache_mode : cache_modes) {
+                            config.cache_mode = cache_mode;
+                            configs.push_back(config);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    LOG_DEBUG("version: %s", version_string().c_str());
+    LOG_DEBUG("%s", sd_get_system_info());
+    LOG_DEBUG("%s", ctx_params.to_string().c_str());
+    LOG_DEBUG("%s", gen_params.to_string().c_str());
+
+    sd_ctx_params_t sd_ctx_params = ctx_params.to_sd_ctx_params_t(false);
+
+    auto load_start = std::chrono::steady_clock::now();
+    SDCtxPtr sd_ctx(new_sd_ctx(&sd_ctx_params));
+    auto load_end = std::chrono::steady_clock::now();
+    if (sd_ctx == nullptr) {
+        LOG_ERROR("new_sd_ctx_t failed");
+        return 1;
+    }
+    double load_ms = std::chrono::duration<double, std::milli>(load_end - load_start).count();
+
+    json report;
+    report["version"]       = version_string();
+    report["system_info"]   = sd_get_system_info();
+    report["model_load_ms"] = load_ms;
+    report["results"]       = json::array();
+
+    std::ostringstream csv;
+    csv << "width,height,steps,sampler,batch_count,cache_mode,repeat,success,total_ms,text_encode_ms,"
+           "sampling_ms,step_mean_ms,vae_decode_ms,png_encode_ms,peak_vram_bytes,peak_rss_bytes\n";
+
+    bool all_success = true;
+    for (BenchConfig& config : configs) {
+        SDGenerationParams run_params         = gen_params;
+        run_params.width                      = config.width;
+        run_params.height                     = config.height;
+        run_params.batch_count                = config.batch_count;
+        run_params.cache_mode                 = config.cache_mode;
+        run_params.sample_params.sample_steps = config.steps;
+        if (config.sample_method == SAMPLE_METHOD_COUNT) {
+            config.sample_method = sd_get_default_sample_method(sd_ctx.get());
+        }
+        run_params.sample_params.sample_method = config.sample_method;
+        if (run_params.sample_params.scheduler == SCHEDULER_COUNT) {
+            run_params.sample_params.scheduler = sd_get_default_scheduler(sd_ctx.get(), config.sample_method);
+        }
+        if (!run_params.initialize_cache_params()) {
+            return 1;
+        }
+
+        LOG_INFO("bench %dx%d, %d steps, %s, batch %d, cache %s",
+                 config.width,
+                 config.height,
+                 config.steps,
+                 sd_sample_method_name(config.sample_method),
+                 config.batch_count,
+                 config.cache_mode.c_str());
+
+        for (int i = 0; i < bench_params.warmup; ++i) {
+            BenchRun warmup_run;
+            run_once(sd_ctx.get(), run_params, state, &warmup_run);
+        }
+
+        json entry;
+        entry["width"]       = config.width;
+        entry["height"]      = config.height;
+        entry["steps"]       = config.steps;
+        entry["sampler"]     = sd_sample_method_name(config.sample_method);
+        entry["batch_count"] = config.batch_count;
+        entry["cache_mode"]  = config.cache_mode;
+        entry["runs"]        = json::array();
+
+        std::vector<double> totals;
+        for (int i = 0; i < bench_params.repeat; ++i) {
+            BenchRun run;
+            if (!run_once(sd_ctx.get(), run_params, state, &run)) {
+                LOG_ERROR("generate failed");
+                all_success = false;
+            }
+            totals.push_back(run.total_ms);
+            entry["runs"].push_back(run_to_json(run));
+
+            csv << config_csv_prefix(config) << "," << i << "," << (run.success ? 1 : 0) << ","
+                << run.total_ms << "," << run.text_encode_ms << "," << run.sampling_ms << ","
+                << mean_of(run.step_ms) << "," << run.vae_decode_ms << "," << run.png_encode_ms << ","
+                << run.peak_vram_bytes << "," << run.peak_rss_bytes << "\n";
+        }
+        entry["total_mean_ms"] = mean_of(totals);
+        report["results"].push_back(entry);
+    }
+
+    std::string output = bench_params.format == "csv" ? csv.str() : report.dump(2) + "\n";
+    if (bench_params.output_path.empty()) {
+        std::cout << output;
+    } else {
+        std::ofstream file(bench_params.output_path, std::ios::binary);
+        if (!file) {
+            LOG_ERROR("failed to open '%s' for writing", bench_params.output_path.c_str());
+            return 1;
+        }
+        file << output;
+    }
+
+    return all_success ? 0 : 1;
+}
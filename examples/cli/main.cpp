@@ -2,14 +2,20 @@
 #include <string.h>
 #include <time.h>
 #include <cctype>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <random>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 // #include "preprocessing.hpp"
@@ -41,6 +47,7 @@ struct SDCliParams {
     bool verbose          = false;
     bool canny_preprocess = false;
     bool convert_name     = false;
+    std::string auto_quant;
 
     preview_t preview_method = PREVIEW_NONE;
     int preview_interval     = 1;
@@ -52,6 +59,14 @@ struct SDCliParams {
     bool metadata_raw        = false;
     bool metadata_brief      = false;
     bool metadata_all        = false;
+    bool stream_upscale      = false;
+
+    std::string checkpoint_path;
+    int checkpoint_interval = 5;
+
+    std::string prompt_file;
+    int prompt_file_group = 8;
+    std::string export_conditions_path;
 
     bool normal_exit = false;
 
@@ -79,6 +94,30 @@ struct SDCliParams {
              "path to write preview image to (default: ./preview.png). Multi-frame previews support .avi, .webm, and animated .webp",
              0,
              &preview_path},
+            {"",
+             "--auto-quant",
+             "pick a weight type per tensor in convert mode, key=value list: bpw=<bits per weight> or max_error=<relative weight error>, "
+             "types=<candidates joined by '+'> (default: q4_K+q5_K+q6_K+q8_0+f16). --tensor-type-rules still take precedence",
+             0,
+             &auto_quant},
+            {"",
+             "--checkpoint",
+             "file to keep a sampling checkpoint of video generation in. An existing checkpoint is resumed, and the file is removed once sampling finishes",
+             0,
+             &checkpoint_path},
+            {"",
+             "--prompt-file",
+             "generate every line of this file with one loaded model: a line is a prompt, or a JSON object of generation params "
+             "(as in the server's sd_cpp_extra_args) over the command line ones. Line N is written to --output with N filling a %d, "
+             "or appended to the file name. Finished lines are recorded in <file>.progress and skipped when the file is run again",
+             0,
+             &prompt_file},
+            {"",
+             "--export-conditions",
+             "encode the prompt and negative prompt, or those of every --prompt-file line, into this file instead of generating, "
+             "for later runs with --condition-file",
+             0,
+             &export_conditions_path},
         };
 
         options.int_options = {
@@ -90,6 +129,14 @@ struct SDCliParams {
              "--output-begin-idx",
              "starting index for output image sequence, must be non-negative (default 0 if specified %d in output path, 1 otherwise)",
              &output_begin_idx},
+            {"",
+             "--checkpoint-interval",
+             "sampling steps between checkpoints written to --checkpoint (default: 5)",
+             &checkpoint_interval},
+            {"",
+             "--prompt-file-group",
+             "most consecutive --prompt-file lines that differ only in their seed to generate as one batch (default: 8)",
+             &prompt_file_group},
         };
 
         options.bool_options = {
@@ -129,6 +176,10 @@ struct SDCliParams {
              "--metadata-all",
              "include structural/container entries such as IHDR, IDAT, and non-metadata JPEG segments",
              true, &metadata_all},
+            {"",
+             "--upscale-stream",
+             "write the last upscale repeat to a PNG one band of tile rows at a time instead of holding the whole output in memory",
+             true, &stream_upscale},
 
         };
 
@@ -223,6 +274,22 @@ struct SDCliParams {
                 return false;
             }
         }
+        if (!checkpoint_path.empty() && checkpoint_interval <= 0) {
+            LOG_ERROR("error: --checkpoint-interval must be positive");
+            return false;
+        }
+        if (!prompt_file.empty() && mode != IMG_GEN) {
+            LOG_ERROR("error: --prompt-file needs img_gen mode");
+            return false;
+        }
+        if (!export_conditions_path.empty() && mode != IMG_GEN) {
+            LOG_ERROR("error: --export-conditions needs img_gen mode");
+            return false;
+        }
+        if (prompt_file_group <= 0) {
+            LOG_ERROR("error: --prompt-file-group must be positive");
+            return false;
+        }
         return true;
     }
 
@@ -247,6 +314,7 @@ struct SDCliParams {
             << "  color: " << (color ? "true" : "false") << ",\n"
             << "  canny_preprocess: " << (canny_preprocess ? "true" : "false") << ",\n"
             << "  convert_name: " << (convert_name ? "true" : "false") << ",\n"
+            << "  auto_quant: \"" << auto_quant << "\",\n"
             << "  preview_method: " << previews_str[preview_method] << ",\n"
             << "  preview_interval: " << preview_interval << ",\n"
             << "  preview_path: \"" << preview_path << "\",\n"
@@ -255,7 +323,13 @@ struct SDCliParams {
             << "  preview_noisy: " << (preview_noisy ? "true" : "false") << ",\n"
             << "  metadata_raw: " << (metadata_raw ? "true" : "false") << ",\n"
             << "  metadata_brief: " << (metadata_brief ? "true" : "false") << ",\n"
-            << "  metadata_all: " << (metadata_all ? "true" : "false") << "\n"
+            << "  metadata_all: " << (metadata_all ? "true" : "false") << ",\n"
+            << "  stream_upscale: " << (stream_upscale ? "true" : "false") << ",\n"
+            << "  checkpoint_path: \"" << checkpoint_path << "\",\n"
+            << "  checkpoint_interval: " << checkpoint_interval << ",\n"
+            << "  prompt_file: \"" << prompt_file << "\",\n"
+            << "  prompt_file_group: " << prompt_file_group << ",\n"
+            << "  export_conditions_path: \"" << export_conditions_path << "\"\n"
             << "}";
         return oss.str();
     }
@@ -350,6 +424,21 @@ bool load_images_from_dir(const std::string dir,
     return true;
 }
 
+// an all-white mask of the resolved size, for generations without a mask image
+static bool set_full_mask_image(SDGenerationParams& gen_params) {
+    sd_image_t generated_mask = {0, 0, 1, nullptr};
+    generated_mask.data       = (uint8_t*)malloc(gen_params.get_resolved_width() * gen_params.get_resolved_height());
+    if (generated_mask.data == nullptr) {
+        LOG_ERROR("malloc mask image failed");
+        return false;
+    }
+    generated_mask.width  = gen_params.get_resolved_width();
+    generated_mask.height = gen_params.get_resolved_height();
+    memset(generated_mask.data, 255, gen_params.get_resolved_width() * gen_params.get_resolved_height());
+    gen_params.mask_image.reset(generated_mask);
+    return true;
+}
+
 void step_callback(int step, int frame_count, sd_image_t* image, bool is_noisy, void* data) {
     (void)step;
     (void)is_noisy;
@@ -390,7 +479,7 @@ std::string format_frame_idx(std::string pattern, int frame_idx) {
     return result;
 }
 
-static fs::path get_video_audio_sidecar_path(const SDCliParams& cli_params) {
+static fs::path get_output_base_path(const SDCliParams& cli_params) {
     fs::path out_path     = cli_params.output_path;
     fs::path base_path    = out_path;
     fs::path ext          = out_path.has_extension() ? out_path.extension() : fs::path{};
@@ -406,10 +495,168 @@ static fs::path get_video_audio_sidecar_path(const SDCliParams& cli_params) {
             base_path.replace_extension();
         }
     }
+    return base_path;
+}
+
+static fs::path get_video_audio_sidecar_path(const SDCliParams& cli_params) {
+    fs::path base_path = get_output_base_path(cli_params);
     base_path += ".wav";
     return base_path;
 }
 
+// Multi-frame videos are written while the VAE decodes them rather than after
+// every frame is in memory. Frame sequences, ESRGAN upscaling and animated
+// WebP need the whole result, so those return an empty path and stay buffered.
+static fs::path get_streamed_video_path(const SDCliParams& cli_params,
+                                        const SDContextParams& ctx_params,
+                                        const SDGenerationParams& gen_params) {
+    if (cli_params.mode != VID_GEN ||
+        gen_params.video_frames <= 1 ||
+        std::regex_search(cli_params.output_path, format_specifier_regex) ||
+        (ctx_params.esrgan_path.size() > 0 && gen_params.upscale_repeats > 0)) {
+        return {};
+    }
+    std::string ext_lower = fs::path(cli_params.output_path).extension().string();
+    std::transform(ext_lower.begin(), ext_lower.end(), ext_lower.begin(), ::tolower);
+    if (ext_lower == ".webp") {
+        return {};
+    }
+    fs::path video_path = get_output_base_path(cli_params);
+    video_path += ext_lower == ".webm" ? ".webm" : ".avi";
+    return video_path;
+}
+
+struct StreamedVideo {
+    VideoFileWriter writer;
+    std::string path;
+    int fps = 16;
+};
+
+static bool write_streamed_video_frames(int first_frame,
+                                        int frame_count,
+                                        const sd_image_t* frames,
+                                        const sd_audio_t* audio,
+                                        void* data) {
+    auto* video = static_cast<StreamedVideo*>(data);
+    if (first_frame == 0 && !video->writer.open(video->path, video->fps, 90, audio)) {
+        LOG_ERROR("failed to open '%s' for writing", video->path.c_str());
+        return false;
+    }
+    return video->writer.add_frames(frames, frame_count);
+}
+
+// --upscale-stream writes the final upscale straight to a PNG, so it only
+// applies to a single image with a PNG (or default) output path.
+static fs::path get_streamed_upscale_path(const SDCliParams& cli_params, int num_results) {
+    if (!cli_params.stream_upscale ||
+        num_results != 1 ||
+        std::regex_search(cli_params.output_path, format_specifier_regex)) {
+        return {};
+    }
+    const EncodedImageFormat output_format = encoded_image_format_from_path(cli_params.output_path);
+    if (output_format != EncodedImageFormat::PNG && output_format != EncodedImageFormat::UNKNOWN) {
+        return {};
+    }
+    fs::path png_path = get_output_base_path(cli_params);
+    png_path += output_format == EncodedImageFormat::PNG ? fs::path(cli_params.output_path).extension() : fs::path(".png");
+    return png_path;
+}
+
+struct StreamedUpscale {
+    PngFileWriter writer;
+    std::string path;
+    std::string parameters;
+    int height = 0;
+};
+
+static bool write_streamed_upscale_rows(int first_row, const sd_image_t* rows, void* data) {
+    auto* upscale = static_cast<StreamedUpscale*>(data);
+    if (first_row == 0 && !upscale->writer.open(upscale->path, rows->width, upscale->height, rows->channel, upscale->parameters)) {
+        LOG_ERROR("failed to open '%s' for writing", upscale->path.c_str());
+        return false;
+    }
+    return upscale->writer.add_rows(rows->data, static_cast<int>(rows->height));
+}
+
+// Upscales image in place repeats times; when one fails, image keeps the
+// last good result and false is returned.
+static bool upscale_image_repeats(upscaler_ctx_t* upscaler_ctx, sd_image_t* image, int repeats, int upscale_factor) {
+    SDImageOwner current_image(*image);
+    *image  = {0, 0, 0, nullptr};
+    bool ok = true;
+    for (int u = 0; u < repeats; ++u) {
+        SDImageOwner upscaled_image(upscale(upscaler_ctx, current_image.get(), upscale_factor));
+        if (upscaled_image.get().data == nullptr) {
+            LOG_ERROR("upscale failed");
+            ok = false;
+            break;
+        }
+        current_image = std::move(upscaled_image);
+    }
+    *image = current_image.release();
+    return ok;
+}
+
+static bool stream_upscaled_image(upscaler_ctx_t* upscaler_ctx,
+                                  sd_image_t image,
+                                  int upscale_factor,
+                                  const fs::path& path,
+                                  const SDCliParams& cli_params,
+                                  const SDContextParams& ctx_params,
+                                  const SDGenerationParams& gen_params) {
+    fs::path parent_path = path.parent_path();
+    std::error_code ec;
+    if (!parent_path.empty() && !fs::create_directories(parent_path, ec) && ec) {
+        LOG_ERROR("failed to create directory '%s': %s", parent_path.string().c_str(), ec.message().c_str());
+        return false;
+    }
+    StreamedUpscale streamed;
+    streamed.path       = path.string();
+    streamed.height     = static_cast<int>(image.height) * get_upscale_factor(upscaler_ctx);
+    streamed.parameters = gen_params.embed_image_metadata
+                              ? get_image_params(ctx_params, gen_params, gen_params.seed, cli_params.mode)
+                              : "";
+    const bool ok = upscale_streaming(upscaler_ctx, image, upscale_factor, write_streamed_upscale_rows, &streamed) &&
+                    streamed.writer.finish();
+    LOG_INFO("save result image 0 to '%s' (%s)", streamed.path.c_str(), ok ? "success" : "failure");
+    return ok;
+}
+
+static bool read_sampling_checkpoint(const std::string& path, std::vector<uint8_t>* data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    data->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !data->empty();
+}
+
+// Goes through a temporary file, so a crash while writing leaves the previous
+// checkpoint in place.
+static void write_sampling_checkpoint(int pass,
+                                      int step,
+                                      int steps,
+                                      const uint8_t* data,
+                                      size_t size,
+                                      void* user_data) {
+    const std::string& path = *static_cast<const std::string*>(user_data);
+    std::string tmp_path    = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size))) {
+            LOG_WARN("failed to write sampling checkpoint '%s'", tmp_path.c_str());
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        LOG_WARN("failed to replace sampling checkpoint '%s': %s", path.c_str(), ec.message().c_str());
+        return;
+    }
+    LOG_DEBUG("sampling checkpoint of pass %d written at step %d/%d", pass, step, steps);
+}
+
 bool save_results(const SDCliParams& cli_params,
                   const SDContextParams& ctx_params,
                   const SDGenerationParams& gen_params,
@@ -543,6 +790,361 @@ bool save_results(const SDCliParams& cli_params,
     return sucessful_reults != 0;
 }
 
+// --output of one --prompt-file line: the line number fills a %d of the
+// path, or is appended to its file name
+static std::string get_prompt_line_output_path(const SDCliParams& cli_params, int line) {
+    if (std::regex_search(cli_params.output_path, format_specifier_regex)) {
+        return format_frame_idx(cli_params.output_path, line);
+    }
+    fs::path out_path = cli_params.output_path;
+    fs::path ext      = out_path.extension();
+    out_path.replace_extension();
+    out_path += "_" + std::to_string(line);
+    out_path += ext;
+    return out_path.string();
+}
+
+// Saves --prompt-file results on background threads while the next lines
+// generate. The progress file holds the number of leading lines of the file
+// that are done, so a crash only repeats the lines that were still
+// generating or waiting to be written.
+class PromptFileWriter {
+public:
+    PromptFileWriter(const SDContextParams& ctx_params, std::string progress_path, int done_lines)
+        : ctx_params_(ctx_params), progress_path_(std::move(progress_path)), done_lines_(done_lines) {
+        for (int i = 0; i < WRITER_THREADS; i++) {
+            threads_.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~PromptFileWriter() {
+        finish();
+    }
+
+    void submit(int line, SDCliParams cli_params, SDGenerationParams gen_params, SDImageVec images) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back({line, std::move(cli_params), std::move(gen_params), std::move(images)});
+        cv_.notify_one();
+    }
+
+    // lines that write nothing: blank lines, comments and failed generations
+    void mark_done(int line) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        complete_locked(line);
+    }
+
+    // waits until every submitted line is written
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+    }
+
+    int failed_lines() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failed_lines_;
+    }
+
+private:
+    // PNG encoding takes a while at large sizes; two writers keep up with
+    // generations of a few steps
+    static constexpr int WRITER_THREADS = 2;
+
+    struct Job {
+        int line = 0;
+        SDCliParams cli_params;
+        SDGenerationParams gen_params;
+        SDImageVec images;
+    };
+
+    void run() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            bool ok = save_results(job.cli_params, ctx_params_, job.gen_params, job.images.data(), job.images.count());
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!ok) {
+                failed_lines_++;
+            }
+            complete_locked(job.line);
+        }
+    }
+
+    void complete_locked(int line) {
+        finished_.insert(line);
+        int done = done_lines_;
+        while (finished_.erase(done + 1) > 0) {
+            done++;
+        }
+        if (done == done_lines_) {
+            return;
+        }
+        done_lines_                = done;
+        const std::string tmp_path = progress_path_ + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::trunc);
+            out << done_lines_ << "\n";
+            if (!out) {
+                LOG_WARN("failed to write '%s'", tmp_path.c_str());
+                return;
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp_path, progress_path_, ec);
+        if (ec) {
+            LOG_WARN("failed to update '%s': %s", progress_path_.c_str(), ec.message().c_str());
+        }
+    }
+
+    const SDContextParams& ctx_params_;
+    std::string progress_path_;
+    int done_lines_   = 0;
+    int failed_lines_ = 0;
+    std::set<int> finished_;
+    std::deque<Job> jobs_;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::thread> threads_;
+};
+
+static int read_prompt_file_progress(const std::string& path) {
+    std::ifstream in(path);
+    int done_lines = 0;
+    if (in >> done_lines && done_lines > 0) {
+        return done_lines;
+    }
+    return 0;
+}
+
+// Lines that differ only in their seed can share one generate_image call,
+// which encodes the prompt and applies the LoRAs once.
+static std::string prompt_line_group_key(SDGenerationParams gen_params) {
+    gen_params.seed = 0;
+    return gen_params.to_string();
+}
+
+static int run_prompt_file(sd_ctx_t* sd_ctx,
+                           const sd_ctx_params_t& sd_ctx_params,
+                           const SDCliParams& cli_params,
+                           const SDContextParams& ctx_params,
+                           const SDGenerationParams& base_params) {
+    std::ifstream file(cli_params.prompt_file);
+    if (!file.is_open()) {
+        LOG_ERROR("failed to open prompt file '%s'", cli_params.prompt_file.c_str());
+        return 1;
+    }
+    const std::string progress_path = cli_params.prompt_file + ".progress";
+    const int done_lines            = read_prompt_file_progress(progress_path);
+    if (done_lines > 0) {
+        LOG_INFO("resuming '%s' after line %d (recorded in '%s')", cli_params.prompt_file.c_str(), done_lines, progress_path.c_str());
+    }
+
+    UpscalerCtxPtr upscaler_ctx;
+    if (ctx_params.esrgan_path.size() > 0) {
+        upscaler_ctx.reset(new_upscaler_ctx(ctx_params.esrgan_path.c_str(),
+                                            ctx_params.diffusion_conv_direct,
+                                            ctx_params.n_threads,
+                                            base_params.upscale_tile_size,
+                                            sd_ctx_params.backend,
+                                            sd_ctx_params.params_backend));
+        if (upscaler_ctx == nullptr) {
+            LOG_ERROR("new_upscaler_ctx failed");
+        }
+    }
+
+    struct PromptLine {
+        int number;
+        SDGenerationParams gen_params;
+    };
+
+    PromptFileWriter writer(ctx_params, progress_path, done_lines);
+    std::vector<PromptLine> group;
+    std::string group_key;
+    int generated_lines = 0;
+    int failed_lines    = 0;
+
+    auto flush_group = [&]() {
+        if (group.empty()) {
+            return;
+        }
+        SDGenerationParams batch_params = group[0].gen_params;
+        std::vector<int64_t> seeds;
+        if (group.size() > 1) {
+            batch_params.batch_count = static_cast<int>(group.size());
+            for (const PromptLine& line : group) {
+                seeds.push_back(line.gen_params.seed);
+            }
+        }
+        sd_img_gen_params_t img_gen_params = batch_params.to_sd_img_gen_params_t();
+        if (!seeds.empty()) {
+            img_gen_params.seeds = seeds.data();
+        }
+
+        SDImageVec results;
+        results.adopt(generate_image(sd_ctx, &img_gen_params), batch_params.batch_count);
+        if (!results) {
+            LOG_ERROR("generating line %d of '%s' failed", group[0].number, cli_params.prompt_file.c_str());
+            for (const PromptLine& line : group) {
+                writer.mark_done(line.number);
+            }
+            failed_lines += static_cast<int>(group.size());
+            group.clear();
+            return;
+        }
+        if (upscaler_ctx != nullptr && batch_params.upscale_repeats > 0) {
+            const int upscale_factor = 4;  // unused for RealESRGAN_x4plus_anime_6B.pth
+            for (int i = 0; i < results.count(); i++) {
+                if (results[i].data != nullptr) {
+                    upscale_image_repeats(upscaler_ctx.get(), &results[i], batch_params.upscale_repeats, upscale_factor);
+                }
+            }
+        }
+
+        // grouped lines get one image each, a line of its own all of them
+        const int images_per_line = group.size() > 1 ? 1 : results.count();
+        int next_image            = 0;
+        for (PromptLine& line : group) {
+            SDImageVec images;
+            for (int i = 0; i < images_per_line; i++, next_image++) {
+                images.push_back(results[next_image]);
+                results[next_image] = {0, 0, 0, nullptr};
+            }
+            SDCliParams line_cli_params = cli_params;
+            line_cli_params.output_path = get_prompt_line_output_path(cli_params, line.number);
+            writer.submit(line.number, std::move(line_cli_params), std::move(line.gen_params), std::move(images));
+        }
+        generated_lines += static_cast<int>(group.size());
+        group.clear();
+    };
+
+    std::string text;
+    int number = 0;
+    while (std::getline(file, text)) {
+        number++;
+        if (number <= done_lines) {
+            continue;
+        }
+        size_t begin = text.find_first_not_of(" \t\r");
+        size_t end   = text.find_last_not_of(" \t\r");
+        if (begin == std::string::npos || text[begin] == '#') {
+            writer.mark_done(number);
+            continue;
+        }
+        text = text.substr(begin, end - begin + 1);
+
+        SDGenerationParams line_params = base_params;
+        bool valid                     = true;
+        if (text[0] == '{') {
+            valid = line_params.from_json_str(text);
+        } else {
+            line_params.prompt = text;
+        }
+        valid = valid && line_params.resolve_and_validate(IMG_GEN, ctx_params.lora_model_dir, ctx_params.hires_upscalers_dir);
+        if (valid && line_params.mask_image_path.empty() &&
+            (static_cast<int>(line_params.mask_image.get().width) != line_params.get_resolved_width() ||
+             static_cast<int>(line_params.mask_image.get().height) != line_params.get_resolved_height())) {
+            valid = set_full_mask_image(line_params);
+        }
+        if (!valid) {
+            LOG_ERROR("skipping invalid line %d of '%s'", number, cli_params.prompt_file.c_str());
+            writer.mark_done(number);
+            failed_lines++;
+            continue;
+        }
+
+        std::string key = prompt_line_group_key(line_params);
+        if (!group.empty() &&
+            (key != group_key ||
+             line_params.batch_count != 1 ||
+             group[0].gen_params.batch_count != 1 ||
+             static_cast<int>(group.size()) >= cli_params.prompt_file_group)) {
+            flush_group();
+        }
+        if (group.empty()) {
+            group_key = std::move(key);
+        }
+        group.push_back({number, std::move(line_params)});
+    }
+    flush_group();
+
+    writer.finish();
+    failed_lines += writer.failed_lines();
+    LOG_INFO("prompt file '%s': %d lines generated, %d failed", cli_params.prompt_file.c_str(), generated_lines, failed_lines);
+    return failed_lines == 0 ? 0 : 1;
+}
+
+// Encodes the prompts of the command line, or of every --prompt-file line,
+// into --export-conditions.
+static int run_export_conditions(sd_ctx_t* sd_ctx,
+                                 const SDCliParams& cli_params,
+                                 const SDContextParams& ctx_params,
+                                 const SDGenerationParams& base_params) {
+    std::vector<SDGenerationParams> lines;
+    if (cli_params.prompt_file.empty()) {
+        lines.push_back(base_params);
+    } else {
+        std::ifstream file(cli_params.prompt_file);
+        if (!file.is_open()) {
+            LOG_ERROR("failed to open prompt file '%s'", cli_params.prompt_file.c_str());
+            return 1;
+        }
+        std::string text;
+        int number = 0;
+        while (std::getline(file, text)) {
+            number++;
+            size_t begin = text.find_first_not_of(" \t\r");
+            size_t end   = text.find_last_not_of(" \t\r");
+            if (begin == std::string::npos || text[begin] == '#') {
+                continue;
+            }
+            text = text.substr(begin, end - begin + 1);
+
+            SDGenerationParams line_params = base_params;
+            bool valid                     = true;
+            if (text[0] == '{') {
+                valid = line_params.from_json_str(text);
+            } else {
+                line_params.prompt = text;
+            }
+            if (!valid || !line_params.resolve_and_validate(IMG_GEN, ctx_params.lora_model_dir, ctx_params.hires_upscalers_dir)) {
+                LOG_ERROR("skipping invalid line %d of '%s'", number, cli_params.prompt_file.c_str());
+                continue;
+            }
+            lines.push_back(std::move(line_params));
+        }
+    }
+
+    std::vector<sd_img_gen_params_t> img_gen_params;
+    img_gen_params.reserve(lines.size());
+    for (SDGenerationParams& line_params : lines) {
+        img_gen_params.push_back(line_params.to_sd_img_gen_params_t());
+    }
+    if (img_gen_params.empty() ||
+        !export_image_conditions(sd_ctx,
+                                 img_gen_params.data(),
+                                 static_cast<int>(img_gen_params.size()),
+                                 cli_params.export_conditions_path.c_str())) {
+        LOG_ERROR("exporting conditions to '%s' failed", cli_params.export_conditions_path.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, const char* argv[]) {
     if (argc > 1 && std::string(argv[1]) == "--version") {
         std::cout << version_string() << "\n";
@@ -606,12 +1208,35 @@ int main(int argc, const char* argv[]) {
     LOG_DEBUG("%s", gen_params.to_string().c_str());
 
     if (cli_params.mode == CONVERT) {
+        std::string tensor_type_rules = ctx_params.tensor_type_rules;
+        if (!cli_params.auto_quant.empty()) {
+            std::string auto_rules = sd_auto_tensor_type_rules(ctx_params.model_path.c_str(),
+                                                               ctx_params.vae_path.c_str(),
+                                                               cli_params.auto_quant.c_str(),
+                                                               cli_params.convert_name);
+            if (auto_rules.empty()) {
+                LOG_ERROR("auto quant of '%s' failed", ctx_params.model_path.c_str());
+                return 1;
+            }
+            LOG_DEBUG("auto quant rules: %s", auto_rules.c_str());
+            tensor_type_rules += (tensor_type_rules.empty() ? "" : ",") + auto_rules;
+        }
+        // the <lora:name:multiplier> tags of the prompt are baked into the output
+        std::vector<sd_lora_t> loras;
+        for (const auto& [path, multiplier] : gen_params.lora_map) {
+            loras.push_back({false, multiplier, path.c_str(), nullptr});
+        }
+        for (const auto& [path, multiplier] : gen_params.high_noise_lora_map) {
+            loras.push_back({true, multiplier, path.c_str(), nullptr});
+        }
         bool success = convert(ctx_params.model_path.c_str(),
                                ctx_params.vae_path.c_str(),
                                cli_params.output_path.c_str(),
                                ctx_params.wtype,
-                               ctx_params.tensor_type_rules.c_str(),
-                               cli_params.convert_name);
+                               tensor_type_rules.c_str(),
+                               cli_params.convert_name,
+                               loras.empty() ? nullptr : loras.data(),
+                               static_cast<uint32_t>(loras.size()));
         if (!success) {
             LOG_ERROR("convert '%s'/'%s' to '%s' failed",
                       ctx_params.model_path.c_str(),
@@ -679,17 +1304,8 @@ int main(int argc, const char* argv[]) {
             LOG_ERROR("load image from '%s' failed", gen_params.mask_image_path.c_str());
             return 1;
         }
-    } else {
-        sd_image_t generated_mask = {0, 0, 1, nullptr};
-        generated_mask.data       = (uint8_t*)malloc(gen_params.get_resolved_width() * gen_params.get_resolved_height());
-        if (generated_mask.data == nullptr) {
-            LOG_ERROR("malloc mask image failed");
-            return 1;
-        }
-        generated_mask.width  = gen_params.get_resolved_width();
-        generated_mask.height = gen_params.get_resolved_height();
-        memset(generated_mask.data, 255, gen_params.get_resolved_width() * gen_params.get_resolved_height());
-        gen_params.mask_image.reset(generated_mask);
+    } else if (!set_full_mask_image(gen_params)) {
+        return 1;
     }
 
     if (gen_params.control_image_path.size() > 0) {
@@ -763,6 +1379,14 @@ int main(int argc, const char* argv[]) {
             gen_params.sample_params.scheduler = sd_get_default_scheduler(sd_ctx.get(), gen_params.sample_params.sample_method);
         }
 
+        if (!cli_params.export_conditions_path.empty()) {
+            return run_export_conditions(sd_ctx.get(), cli_params, ctx_params, gen_params);
+        }
+
+        if (!cli_params.prompt_file.empty()) {
+            return run_prompt_file(sd_ctx.get(), sd_ctx_params, cli_params, ctx_params, gen_params);
+        }
+
         if (cli_params.mode == IMG_GEN) {
             sd_img_gen_params_t img_gen_params = gen_params.to_sd_img_gen_params_t();
 
@@ -771,8 +1395,53 @@ int main(int argc, const char* argv[]) {
         } else if (cli_params.mode == VID_GEN) {
             sd_vid_gen_params_t vid_gen_params = gen_params.to_sd_vid_gen_params_t();
             sd_image_t* generated_video        = nullptr;
+
+            StreamedVideo streamed_video;
+            streamed_video.path = get_streamed_video_path(cli_params, ctx_params, gen_params).string();
+            streamed_video.fps  = gen_params.fps;
+            if (!streamed_video.path.empty()) {
+                fs::path parent_path = fs::path(streamed_video.path).parent_path();
+                std::error_code ec;
+                if (!parent_path.empty() && !fs::create_directories(parent_path, ec) && ec) {
+                    LOG_ERROR("failed to create directory '%s': %s", parent_path.string().c_str(), ec.message().c_str());
+                    return 1;
+                }
+                vid_gen_params.frames_cb      = write_streamed_video_frames;
+                vid_gen_params.frames_cb_data = &streamed_video;
+            }
+
+            std::vector<uint8_t> resume_checkpoint;
+            if (!cli_params.checkpoint_path.empty()) {
+                if (read_sampling_checkpoint(cli_params.checkpoint_path, &resume_checkpoint)) {
+                    LOG_INFO("resuming from sampling checkpoint '%s'", cli_params.checkpoint_path.c_str());
+                    vid_gen_params.resume_checkpoint      = resume_checkpoint.data();
+                    vid_gen_params.resume_checkpoint_size = resume_checkpoint.size();
+                }
+                vid_gen_params.checkpoint_cb       = write_sampling_checkpoint;
+                vid_gen_params.checkpoint_cb_data  = &cli_params.checkpoint_path;
+                vid_gen_params.checkpoint_interval = cli_params.checkpoint_interval;
+            }
+
             if (!generate_video(sd_ctx.get(), &vid_gen_params, &generated_video, &num_results, &generated_audio)) {
                 generated_video = nullptr;
+                if (!streamed_video.path.empty()) {
+                    streamed_video.writer.finish();
+                    LOG_ERROR("generate failed");
+                    return 1;
+                }
+            } else if (!cli_params.checkpoint_path.empty()) {
+                std::error_code ec;
+                fs::remove(cli_params.checkpoint_path, ec);
+            }
+            if (!streamed_video.path.empty()) {
+                // audio is muxed into the file, no sidecar needed
+                free_sd_audio(generated_audio);
+                if (!streamed_video.writer.finish()) {
+                    LOG_ERROR("Failed to save result video to '%s'", streamed_video.path.c_str());
+                    return 1;
+                }
+                LOG_INFO("save result video to '%s' (%d frames)", streamed_video.path.c_str(), streamed_video.writer.frame_count());
+                return 0;
             }
             results.adopt(generated_video, num_results);
         }
@@ -795,21 +1464,24 @@ int main(int argc, const char* argv[]) {
         if (upscaler_ctx == nullptr) {
             LOG_ERROR("new_upscaler_ctx failed");
         } else {
+            const fs::path streamed_upscale_path = get_streamed_upscale_path(cli_params, num_results);
             for (int i = 0; i < num_results; i++) {
                 if (results[i].data == nullptr) {
                     continue;
                 }
-                SDImageOwner current_image(results[i]);
-                results[i] = {0, 0, 0, nullptr};
-                for (int u = 0; u < gen_params.upscale_repeats; ++u) {
-                    SDImageOwner upscaled_image(upscale(upscaler_ctx.get(), current_image.get(), upscale_factor));
-                    if (upscaled_image.get().data == nullptr) {
-                        LOG_ERROR("upscale failed");
-                        break;
-                    }
-                    current_image = std::move(upscaled_image);
+                if (streamed_upscale_path.empty()) {
+                    upscale_image_repeats(upscaler_ctx.get(), &results[i], gen_params.upscale_repeats, upscale_factor);
+                    continue;
                 }
-                results[i] = current_image.release();  // Set the final upscaled image as the result
+                // the last repeat streams to the file
+                if (!upscale_image_repeats(upscaler_ctx.get(), &results[i], gen_params.upscale_repeats - 1, upscale_factor)) {
+                    continue;
+                }
+                SDImageOwner current_image(results[i]);
+                results[i]    = {0, 0, 0, nullptr};
+                const bool ok = stream_upscaled_image(upscaler_ctx.get(), current_image.get(), upscale_factor, streamed_upscale_path, cli_params, ctx_params, gen_params);
+                free_sd_audio(generated_audio);
+                return ok ? 0 : 1;
             }
         }
     }
@@ -443,6 +443,56 @@ ArgOptions SDContextParams::get_options() {
          "weight type per tensor pattern (example: \"^vae\\.=f16,model\\.=q8_0\")",
          (int)',',
          &tensor_type_rules},
+        {"",
+         "--model-cache-dir",
+         "directory for runtime-ready GGUF copies of the loaded model files; the first start writes one "
+         "with converted names and weight types, later starts with the same files and options map it directly; "
+         "--max-vram graph cut plans are kept there too",
+         0,
+         &model_cache_dir},
+        {"",
+         "--attn-tune-cache",
+         "file of per-shape attention timings; with flash attention enabled, the first attention of each shape "
+         "times flash attention against the softmax path on its device and later ones use the faster path",
+         0,
+         &attn_tune_cache},
+        {"",
+         "--conv-tune-cache",
+         "file of per-shape conv2d timings; the first conv2d of each shape times the direct kernel against "
+         "im2col + matmul on its device and later ones use the faster path",
+         0,
+         &conv_tune_cache},
+        {"",
+         "--condition-file",
+         "file of prompt conditions written by --export-conditions; prompts found there skip the text encoders, "
+         "whose weights are then only loaded for a prompt the file does not have",
+         0,
+         &condition_file},
+        {"",
+         "--device-probe-cache",
+         "file of device benchmarks (copy rates, matmul throughput per weight type, flash attention support); "
+         "devices are probed at startup and later runs reuse the numbers while the devices stay the same",
+         0,
+         &device_probe_cache},
+        {"",
+         "--resolution-buckets",
+         "','-separated WxH sizes (e.g. \"512x512,768x512\"); txt2img requests sample at the smallest bucket that "
+         "holds them and are cropped back to their size, so new sizes reuse the graphs and buffers of a bucket",
+         0,
+         &resolution_buckets},
+        {"",
+         "--text-encoder-share-key",
+         "name for the text encoder weights of this model; contexts in the process with the same key load the "
+         "encoders once and share them, even when each checkpoint holds its own copy",
+         0,
+         &text_encoder_share_key},
+        {"",
+         "--cpu-threadpool-args",
+         "policy of the persistent threadpool CPU computes run on, comma-separated key=value pairs: poll=0..100 "
+         "(how long idle workers spin, default 50), cpus=0-7+16 (CPUs the workers may use), strict=true (one CPU "
+         "per worker), prio=normal|medium|high|realtime, persistent=false (start threads per graph instead)",
+         0,
+         &cpu_threadpool_args},
         {"",
          "--photo-maker",
          "path to PHOTOMAKER model",
@@ -473,6 +523,29 @@ ArgOptions SDContextParams::get_options() {
          "comma-separated list of RPC servers to connect to for offloading, in the format host:port, e.g. localhost:50052,192.168.1.3:50052",
          (int)',',
          &rpc_servers},
+        {"",
+         "--vae-tile-backends",
+         "extra backends holding VAE copies that encode/decode tiles in parallel with the VAE backend, e.g. cuda1,rpc0",
+         (int)',',
+         &vae_tile_backends},
+        {"",
+         "--pipeline-backends",
+         "extra backends that each hold a slice of the diffusion model and run its graph-cut segments, "
+         "so the model is split over the diffusion backend and these, e.g. cuda1,cuda2",
+         (int)',',
+         &pipeline_backends},
+        {"",
+         "--cfg-backend",
+         "backend holding a second copy of the diffusion model that runs the uncond pass of each step "
+         "concurrently with the cond pass on the diffusion backend, e.g. cuda1",
+         0,
+         &cfg_backend},
+        {"",
+         "--tensor-split",
+         "proportions of the diffusion model's matmul weight rows to put on each device of the diffusion backend, "
+         "so every step runs on all of them at once, e.g. 1,1 for two GPUs (CUDA only)",
+         (int)',',
+         &tensor_split},
         {"",
          "--max-vram",
          "maximum VRAM budget in GiB for graph-cut segmented execution. Accepts a single value or assignments by backend/device, e.g. 6 or cuda0=6,vulkan0=4. 0 disables graph splitting; a negative value auto-detects free VRAM, sparing the specified value",
@@ -490,6 +563,41 @@ ArgOptions SDContextParams::get_options() {
          "--chroma-t5-mask-pad",
          "t5 mask pad size of chroma",
          &chroma_t5_mask_pad},
+        {"",
+         "--condition-cache-mb",
+         "MiB of text encoder and CLIP vision outputs to keep across generations, keyed by prompt or image "
+         "content, clip skip and LoRA set (default: 0, disabled)",
+         &condition_cache_mb},
+        {"",
+         "--vae-encode-cache-mb",
+         "MiB of VAE encoder outputs to keep across generations, keyed by image content, tiling and LoRA set; "
+         "reused init, mask, reference and first/last frame images skip the encoder (default: 0, disabled)",
+         &vae_encode_cache_mb},
+        {"",
+         "--identity-cache-size",
+         "PhotoMaker/PuLID identity embeddings to keep across generations, keyed by the id image set or "
+         "embedding file; a returning identity skips the ID encoder (default: 16, 0 = disabled)",
+         &identity_cache_size},
+        {"",
+         "--mmap-prefault",
+         "with --mmap, threads that fault the mapped weights into the page cache after model load, "
+         "in generation order, so cold starts read the disk in parallel (default: 0, disabled)",
+         &mmap_prefault_threads},
+        {"",
+         "--max-pinned-mb",
+         "MiB of page-locked host memory for params kept off the GPU and uploaded on use; "
+         "params beyond it stay in pageable memory (default: -1, unlimited; 0 never pins)",
+         &max_pinned_mb},
+        {"",
+         "--lora-cache-mb",
+         "MiB of host RAM for the merged weights of recently used LoRA sets, so switching back to one "
+         "skips loading and merging its LoRAs again (default: 0, disabled; immediate LoRA mode only)",
+         &lora_cache_mb},
+        {"",
+         "--lora-model-cache-mb",
+         "MiB of runtime LoRAs kept loaded on their backend across generations, so requests naming a recent "
+         "LoRA skip reading its file (default: 0, disabled; at_runtime LoRA mode only)",
+         &lora_model_cache_mb},
     };
 
     options.bool_options = {
@@ -497,10 +605,77 @@ ArgOptions SDContextParams::get_options() {
          "--stream-layers",
          "enable residency+prefetch streaming on top of --max-vram (no effect without --max-vram; defaults to false)",
          true, &stream_layers},
+        {"",
+         "--hybrid-cpu-segments",
+         "with --stream-layers, compute the streamed diffusion segments on the CPU, where their weights live, when "
+         "the measured CPU and GPU matmul rates and upload bandwidth say that is faster than uploading them "
+         "(defaults to false)",
+         true, &hybrid_cpu_segments},
         {"",
          "--eager-load",
          "load all params into the params backend at model-load time instead of lazily on first use (defaults to false)",
          true, &eager_load},
+        {"",
+         "--background-load",
+         "load params on a background thread, in generation order, while requests already run "
+         "(ignored with --eager-load; defaults to false)",
+         true, &background_load},
+        {"",
+         "--batched-cfg",
+         "run the cond/uncond passes of classifier-free guidance as one batched forward pass "
+         "(UNet, MMDiT and Flux models only; uses more compute memory, defaults to false)",
+         true, &batched_cfg},
+        {"",
+         "--offload-text-encoder",
+         "keep the text encoder weights in RAM and stage them to VRAM only while encoding, prefetched when a "
+         "generation starts, so the diffusion model has that VRAM while sampling (defaults to false)",
+         true, &offload_text_encoder},
+        {"",
+         "--llm-cpu-q8-0",
+         "when the text encoder runs on the CPU, convert the attention and MLP weights of an f16/bf16/f32 --llm "
+         "model to q8_0 at load, so its matmuls use int8 dot kernels (defaults to false)",
+         true, &llm_cpu_q8_0},
+        {"",
+         "--stream-q8-0",
+         "when the diffusion model's weights are kept in RAM for a GPU (--params-backend cpu, --offload-to-cpu), "
+         "convert its f16/bf16/f32 matmul weights to q8_0 at load, so about half the bytes are uploaded per step "
+         "and the GPU runs q8_0 matmuls (defaults to false)",
+         true, &stream_q8_0},
+        {"",
+         "--cpu-repack",
+         "load the quantized matmul weights of modules that run on the CPU into ggml's repacked CPU buffer types "
+         "(interleaved layouts for the AVX2/AVX512/NEON kernels); LoRAs are then applied at runtime (defaults to false)",
+         true, &cpu_repack},
+        {"",
+         "--huge-pages",
+         "ask the kernel for transparent huge pages on host params buffers and memory-mapped model files, "
+         "cutting TLB misses of CPU matmuls over large weights (Linux only, defaults to false)",
+         true, &huge_pages},
+        {"",
+         "--shared-compute-buffer",
+         "give the text encoder, diffusion model, ControlNet and VAE one compute buffer per device, leased in turn and "
+         "kept at the size of the largest, instead of reserving and freeing one each (defaults to false)",
+         true, &shared_compute_buffer},
+        {"",
+         "--dynamic-text-length",
+         "encode Flux/Chroma T5 prompts at the smallest of 64/128/256/512 tokens that holds them instead of the "
+         "full padded length, which speeds up the text encoder and the diffusion text tokens (defaults to false)",
+         true, &dynamic_text_length},
+        {"",
+         "--disable-vae-f32-fallback",
+         "do not re-run VAE tiles whose half precision output has NaN/Inf with f32 convolutions",
+         false, &vae_f32_fallback},
+        {"",
+         "--vae-decode-only",
+         "leave out the VAE and TAE encoder weights for txt2img-only serving, which saves their memory and load "
+         "time; img2img, inpainting, reference and control images then fail (defaults to false)",
+         true, &vae_decode_only},
+        {"",
+         "--auto-placement",
+         "pick the backend, params residency and --max-vram budget of every module from the model sizes, the "
+         "free device memory and a short benchmark of each device, and print the plan (only when --backend, "
+         "--params-backend and --max-vram are not set; defaults to false)",
+         true, &auto_placement},
         {"",
          "--force-sdxl-vae-conv-scale",
          "force use of conv scale on sdxl vae",
@@ -637,6 +812,34 @@ ArgOptions SDContextParams::get_options() {
         return 1;
     };
 
+    auto on_numa_arg = [&](int argc, const char** argv, int index) {
+        if (++index >= argc) {
+            return -1;
+        }
+        const char* arg = argv[index];
+        numa_placement  = str_to_numa_placement(arg);
+        if (numa_placement == NUMA_PLACEMENT_COUNT) {
+            LOG_ERROR("error: invalid numa placement %s",
+                      arg);
+            return -1;
+        }
+        return 1;
+    };
+
+    auto on_compute_buffer_retention_arg = [&](int argc, const char** argv, int index) {
+        if (++index >= argc) {
+            return -1;
+        }
+        const char* arg          = argv[index];
+        compute_buffer_retention = str_to_compute_buffer_retention(arg);
+        if (compute_buffer_retention == COMPUTE_BUFFER_RETENTION_COUNT) {
+            LOG_ERROR("error: invalid compute buffer retention %s",
+                      arg);
+            return -1;
+        }
+        return 1;
+    };
+
     options.manual_options = {
         {"",
          "--type",
@@ -663,6 +866,21 @@ ArgOptions SDContextParams::get_options() {
          "but it usually offers faster inference speed and, in some cases, lower memory usage. "
          "The at_runtime mode, on the other hand, is exactly the opposite.",
          on_lora_apply_mode_arg},
+        {"",
+         "--compute-buffer-retention",
+         "what happens to the diffusion model and ControlNet compute buffers after a generation, "
+         "one of [free, keep, keep_same_shape], default is free. "
+         "keep holds them until the context is freed; keep_same_shape holds them while the latent, "
+         "conditioning and control image shapes stay the same and reallocates when they change. "
+         "Kept buffers stay allocated while the VAE decodes, which raises peak VRAM.",
+         on_compute_buffer_retention_arg},
+        {"",
+         "--numa",
+         "NUMA placement of the CPU compute threads and params buffers, one of [none, distribute, isolate, numactl], "
+         "default is none. distribute spreads threads over all nodes and interleaves params over them; isolate keeps "
+         "threads on the node the process started on and prefers it for params; numactl keeps threads on the CPUs "
+         "numactl set and leaves params to its memory policy. Applies to the whole process.",
+         on_numa_arg},
     };
 
     return options;
@@ -796,6 +1014,14 @@ std::string SDContextParams::to_string() const {
         << "  embeddings: " << embeddings_str << "\n"
         << "  wtype: " << sd_type_name(wtype) << ",\n"
         << "  tensor_type_rules: \"" << tensor_type_rules << "\",\n"
+        << "  model_cache_dir: \"" << model_cache_dir << "\",\n"
+        << "  attn_tune_cache: \"" << attn_tune_cache << "\",\n"
+        << "  conv_tune_cache: \"" << conv_tune_cache << "\",\n"
+        << "  condition_file: \"" << condition_file << "\",\n"
+        << "  device_probe_cache: \"" << device_probe_cache << "\",\n"
+        << "  resolution_buckets: \"" << resolution_buckets << "\",\n"
+        << "  text_encoder_share_key: \"" << text_encoder_share_key << "\",\n"
+        << "  cpu_threadpool_args: \"" << cpu_threadpool_args << "\",\n"
         << "  lora_model_dir: \"" << lora_model_dir << "\",\n"
         << "  hires_upscalers_dir: \"" << hires_upscalers_dir << "\",\n"
         << "  photo_maker_path: \"" << photo_maker_path << "\",\n"
@@ -804,9 +1030,34 @@ std::string SDContextParams::to_string() const {
         << "  offload_params_to_cpu: " << (offload_params_to_cpu ? "true" : "false") << ",\n"
         << "  max_vram: \"" << max_vram << "\",\n"
         << "  stream_layers: " << (stream_layers ? "true" : "false") << ",\n"
+        << "  hybrid_cpu_segments: " << (hybrid_cpu_segments ? "true" : "false") << ",\n"
         << "  eager_load: " << (eager_load ? "true" : "false") << ",\n"
+        << "  background_load: " << (background_load ? "true" : "false") << ",\n"
+        << "  mmap_prefault_threads: " << mmap_prefault_threads << ",\n"
+        << "  batched_cfg: " << (batched_cfg ? "true" : "false") << ",\n"
+        << "  offload_text_encoder: " << (offload_text_encoder ? "true" : "false") << ",\n"
+        << "  llm_cpu_q8_0: " << (llm_cpu_q8_0 ? "true" : "false") << ",\n"
+        << "  stream_q8_0: " << (stream_q8_0 ? "true" : "false") << ",\n"
+        << "  cpu_repack: " << (cpu_repack ? "true" : "false") << ",\n"
+        << "  shared_compute_buffer: " << (shared_compute_buffer ? "true" : "false") << ",\n"
+        << "  dynamic_text_length: " << (dynamic_text_length ? "true" : "false") << ",\n"
+        << "  vae_f32_fallback: " << (vae_f32_fallback ? "true" : "false") << ",\n"
+        << "  vae_decode_only: " << (vae_decode_only ? "true" : "false") << ",\n"
+        << "  auto_placement: " << (auto_placement ? "true" : "false") << ",\n"
+        << "  condition_cache_mb: " << condition_cache_mb << ",\n"
+        << "  vae_encode_cache_mb: " << vae_encode_cache_mb << ",\n"
+        << "  identity_cache_size: " << identity_cache_size << ",\n"
+        << "  max_pinned_mb: " << max_pinned_mb << ",\n"
+        << "  numa_placement: " << sd_numa_placement_name(numa_placement) << ",\n"
+        << "  huge_pages: " << (huge_pages ? "true" : "false") << ",\n"
+        << "  lora_cache_mb: " << lora_cache_mb << ",\n"
+        << "  lora_model_cache_mb: " << lora_model_cache_mb << ",\n"
         << "  backend: \"" << backend << "\",\n"
         << "  params_backend: \"" << params_backend << "\",\n"
+        << "  vae_tile_backends: \"" << vae_tile_backends << "\",\n"
+        << "  pipeline_backends: \"" << pipeline_backends << "\",\n"
+        << "  cfg_backend: \"" << cfg_backend << "\",\n"
+        << "  tensor_split: \"" << tensor_split << "\",\n"
         << "  enable_mmap: " << (enable_mmap ? "true" : "false") << ",\n"
         << "  control_net_cpu: " << (control_net_cpu ? "true" : "false") << ",\n"
         << "  clip_on_cpu: " << (clip_on_cpu ? "true" : "false") << ",\n"
@@ -824,6 +1075,7 @@ std::string SDContextParams::to_string() const {
         << "  chroma_t5_mask_pad: " << chroma_t5_mask_pad << ",\n"
         << "  prediction: " << sd_prediction_name(prediction) << ",\n"
         << "  lora_apply_mode: " << sd_lora_apply_mode_name(lora_apply_mode) << ",\n"
+        << "  compute_buffer_retention: " << sd_compute_buffer_retention_name(compute_buffer_retention) << ",\n"
         << "  force_sdxl_vae_conv_scale: " << (force_sdxl_vae_conv_scale ? "true" : "false") << "\n"
         << "}";
     return oss.str();
@@ -862,12 +1114,21 @@ sd_ctx_params_t SDContextParams::to_sd_ctx_params_t(bool taesd_preview) {
     sd_ctx_params.photo_maker_path                = photo_maker_path.c_str();
     sd_ctx_params.pulid_weights_path              = pulid_weights_path.c_str();
     sd_ctx_params.tensor_type_rules               = tensor_type_rules.c_str();
+    sd_ctx_params.model_cache_dir                 = model_cache_dir.c_str();
+    sd_ctx_params.attn_tune_cache                 = attn_tune_cache.c_str();
+    sd_ctx_params.conv_tune_cache                 = conv_tune_cache.c_str();
+    sd_ctx_params.condition_file                  = condition_file.c_str();
+    sd_ctx_params.device_probe_cache              = device_probe_cache.c_str();
+    sd_ctx_params.resolution_buckets              = resolution_buckets.c_str();
+    sd_ctx_params.text_encoder_share_key          = text_encoder_share_key.c_str();
+    sd_ctx_params.cpu_threadpool_args             = cpu_threadpool_args.c_str();
     sd_ctx_params.n_threads                       = n_threads;
     sd_ctx_params.wtype                           = wtype;
     sd_ctx_params.rng_type                        = rng_type;
     sd_ctx_params.sampler_rng_type                = sampler_rng_type;
     sd_ctx_params.prediction                      = prediction;
     sd_ctx_params.lora_apply_mode                 = lora_apply_mode;
+    sd_ctx_params.compute_buffer_retention        = compute_buffer_retention;
     sd_ctx_params.enable_mmap                     = enable_mmap;
     sd_ctx_params.flash_attn                      = flash_attn;
     sd_ctx_params.diffusion_flash_attn            = diffusion_flash_attn;
@@ -884,10 +1145,35 @@ sd_ctx_params_t SDContextParams::to_sd_ctx_params_t(bool taesd_preview) {
     sd_ctx_params.vae_format                      = str_to_vae_format(vae_format);
     sd_ctx_params.max_vram                        = max_vram.c_str();
     sd_ctx_params.stream_layers                   = stream_layers;
+    sd_ctx_params.hybrid_cpu_segments             = hybrid_cpu_segments;
     sd_ctx_params.eager_load                      = eager_load;
+    sd_ctx_params.background_load                 = background_load;
+    sd_ctx_params.mmap_prefault_threads           = mmap_prefault_threads;
+    sd_ctx_params.batched_cfg                     = batched_cfg;
+    sd_ctx_params.offload_text_encoder            = offload_text_encoder;
+    sd_ctx_params.llm_cpu_q8_0                    = llm_cpu_q8_0;
+    sd_ctx_params.stream_q8_0                     = stream_q8_0;
+    sd_ctx_params.cpu_repack                      = cpu_repack;
+    sd_ctx_params.shared_compute_buffer           = shared_compute_buffer;
+    sd_ctx_params.dynamic_text_length             = dynamic_text_length;
+    sd_ctx_params.vae_f32_fallback                = vae_f32_fallback;
+    sd_ctx_params.vae_decode_only                 = vae_decode_only;
+    sd_ctx_params.auto_placement                  = auto_placement;
+    sd_ctx_params.condition_cache_mb              = condition_cache_mb;
+    sd_ctx_params.vae_encode_cache_mb             = vae_encode_cache_mb;
+    sd_ctx_params.identity_cache_size             = identity_cache_size;
+    sd_ctx_params.max_pinned_mb                   = max_pinned_mb;
+    sd_ctx_params.numa_placement                  = numa_placement;
+    sd_ctx_params.huge_pages                      = huge_pages;
+    sd_ctx_params.lora_cache_mb                   = lora_cache_mb;
+    sd_ctx_params.lora_model_cache_mb             = lora_model_cache_mb;
     sd_ctx_params.backend                         = effective_backend.c_str();
     sd_ctx_params.params_backend                  = effective_params_backend.c_str();
     sd_ctx_params.rpc_servers                     = rpc_servers.c_str();
+    sd_ctx_params.vae_tile_backends               = vae_tile_backends.c_str();
+    sd_ctx_params.pipeline_backends               = pipeline_backends.c_str();
+    sd_ctx_params.cfg_backend                     = cfg_backend.c_str();
+    sd_ctx_params.tensor_split                    = tensor_split.c_str();
     return sd_ctx_params;
 }
 
@@ -919,6 +1205,11 @@ ArgOptions SDGenerationParams::get_options() {
          "path to the end image, required by flf2v",
          0,
          &end_image_path},
+        {"",
+         "--cache-profile",
+         "cache calibration profile JSON; with a matching entry it replaces the --cache-mode thresholds, see the calibrate= and target_error= cache options",
+         0,
+         &cache_profile},
         {"",
          "--mask",
          "path to the mask image",
@@ -946,6 +1237,12 @@ ArgOptions SDGenerationParams::get_options() {
          "path to PHOTOMAKER v2 id embed",
          0,
          &pm_id_embed_path},
+        {"",
+         "--pm-identity-path",
+         "path to a PHOTOMAKER identity embedding; loaded instead of encoding the id images when it exists, "
+         "written after encoding them otherwise",
+         0,
+         &pm_identity_path},
         {"",
          "--pulid-id-embedding",
          "path to PuLID id embedding",
@@ -960,12 +1257,12 @@ ArgOptions SDGenerationParams::get_options() {
          &hires_upscaler},
         {"",
          "--extra-sample-args",
-         "extra sampler/scheduler/guidance args, key=value list. CFG supports guidance_schedule; APG supports apg_eta, apg_momentum, apg_norm_threshold, apg_norm_threshold_smoothing; SLG supports slg_uncond; lcm supports noise_clip_std, noise_scale_start, noise_scale_end; ltx2 supports max_shift, base_shift, stretch, terminal; euler_ge supports gamma;; logit_normal supports mu, std, logsnr_min, logsnr_max, resolution_aware",
+         "extra sampler/scheduler/guidance args, key=value list. CFG supports guidance_schedule, cfg_trunc_sigma, cfg_trunc_tol; APG supports apg_eta, apg_momentum, apg_norm_threshold, apg_norm_threshold_smoothing; SLG supports slg_uncond; ControlNet supports control_reuse_steps; UNet token merging supports tome_ratio, tome_sigma_min, tome_sigma_max, tome_max_downsample; Wan/LTX windowed attention supports vattn_window, vattn_dense_steps; Wan context windows support ctx_window, ctx_overlap; Wan keyframe sampling supports frame_interp; low resolution early steps of flow models support lowres_fraction, lowres_factor; Flux masked-token inpainting supports mask_border; Flux/Qwen-Image/SD3 modulation precompute supports mod_cache; prompt variations support shared_steps; provisional images support provisional_step; step-distilled weights support turbo; op profiling supports profile_trace; buffer tracing supports memory_trace; latency targets support latency_ms, latency_min_steps, latency_cache, latency_cfg_trunc, latency_tiny_vae; Flux CFG block reuse supports cfg_reuse_threshold, cfg_reuse_calibration_steps; Flux reference K/V reuse supports ref_kv_refresh; Flux/Qwen-Image reference downscaling supports ref_scale; UNet/SD3/Flux tiled diffusion supports diffusion_tile, diffusion_tile_overlap, diffusion_tile_batch; lcm supports noise_clip_std, noise_scale_start, noise_scale_end; ltx2 supports max_shift, base_shift, stretch, terminal; euler_ge supports gamma; heun_adaptive supports adaptive_rtol, adaptive_atol, max_nfe; logit_normal supports mu, std, logsnr_min, logsnr_max, resolution_aware",
          (int)',',
          &extra_sample_args},
         {"",
          "--extra-tiling-args",
-         "extra VAE tiling args, key=value list. LTX video VAE supports temporal_tile_frames (default: 4), temporal_tile_overlap (default: 1)",
+         "extra VAE tiling args, key=value list. LTX video VAE supports temporal_tile_frames (default: 4), temporal_tile_overlap (default: 1); TAEHV supports temporal_tile_frames (default: 4); Wan VAE supports temporal_tile_frames (default: 0, fit to free memory)",
          (int)',',
          &extra_tiling_args},
     };
@@ -996,6 +1293,11 @@ ArgOptions SDGenerationParams::get_options() {
          "--batch-count",
          "batch count",
          &batch_count},
+        {"",
+         "--latent-batch-size",
+         "number of latents of a batch sampled together in one batched diffusion pass "
+         "(UNet, SD3 and Flux models only; default: 1)",
+         &latent_batch_size},
         {"",
          "--video-frames",
          "video frames (default: 1)",
@@ -1155,6 +1457,11 @@ ArgOptions SDGenerationParams::get_options() {
          "process vae in tiles to reduce memory usage",
          true,
          &vae_tiling_params.enabled},
+        {"",
+         "--vae-tiling-auto",
+         "decide vae tiling and tile size from the free VRAM or --max-vram budget (overrides --vae-tiling and tile sizes)",
+         true,
+         &vae_tiling_params.auto_tile_size},
         {"",
          "--temporal-tiling",
          "enable temporal tiling for LTX video VAE decode",
@@ -1465,12 +1772,12 @@ ArgOptions SDGenerationParams::get_options() {
          on_seed_arg},
         {"",
          "--sampling-method",
-         "sampling method, one of [euler, euler_a, heun, dpm2, dpm++2s_a, dpm++2m, dpm++2mv2, ipndm, ipndm_v, lcm, ddim_trailing, tcd, res_multistep, res_2s, er_sde, euler_cfg_pp, euler_a_cfg_pp]"
+         "sampling method, one of [euler, euler_a, heun, dpm2, dpm++2s_a, dpm++2m, dpm++2mv2, ipndm, ipndm_v, lcm, ddim_trailing, tcd, res_multistep, res_2s, er_sde, euler_cfg_pp, euler_a_cfg_pp, euler_ge, heun_adaptive]"
          "(default: euler for Flux/SD3/Wan, euler_a otherwise)",
          on_sample_method_arg},
         {"",
          "--high-noise-sampling-method",
-         "(high noise) sampling method, one of [euler, euler_a, heun, dpm2, dpm++2s_a, dpm++2m, dpm++2mv2, ipndm, ipndm_v, lcm, ddim_trailing, tcd, res_multistep, res_2s, er_sde, euler_cfg_pp, euler_a_cfg_pp]"
+         "(high noise) sampling method, one of [euler, euler_a, heun, dpm2, dpm++2s_a, dpm++2m, dpm++2mv2, ipndm, ipndm_v, lcm, ddim_trailing, tcd, res_multistep, res_2s, er_sde, euler_cfg_pp, euler_a_cfg_pp, euler_ge, heun_adaptive]"
          " default: euler for Flux/SD3/Wan, euler_a otherwise",
          on_high_noise_sample_method_arg},
         {"",
@@ -1503,7 +1810,7 @@ ArgOptions SDGenerationParams::get_options() {
          on_cache_mode_arg},
         {"",
          "--cache-option",
-         "named cache params (key=value format, comma-separated). easycache/ucache: threshold=,start=,end=,decay=,relative=,reset=; dbcache/taylorseer/cache-dit: Fn=,Bn=,threshold=,warmup=; spectrum: w=,m=,lam=,window=,flex=,warmup=,stop=. Examples: \"threshold=0.25\" or \"threshold=1.5,reset=0\"",
+         "named cache params (key=value format, comma-separated). easycache/ucache: threshold=,start=,end=,decay=,relative=,reset=; dbcache/taylorseer/cache-dit: Fn=,Bn=,threshold=,warmup=; spectrum: w=,m=,lam=,window=,flex=,warmup=,stop=; with --cache-profile: calibrate=,target_error=. Examples: \"threshold=0.25\" or \"threshold=1.5,reset=0\"",
          on_cache_option_arg},
         {"",
          "--scm-mask",
@@ -1816,6 +2123,7 @@ bool SDGenerationParams::from_json_str(
     load_if_exists("width", width);
     load_if_exists("height", height);
     load_if_exists("batch_count", batch_count);
+    load_if_exists("latent_batch_size", latent_batch_size);
     load_if_exists("video_frames", video_frames);
     load_if_exists("fps", fps);
     load_if_exists("upscale_repeats", upscale_repeats);
@@ -1946,6 +2254,9 @@ bool SDGenerationParams::from_json_str(
         if (tiling_json.contains("temporal_tiling") && tiling_json["temporal_tiling"].is_boolean()) {
             vae_tiling_params.temporal_tiling = tiling_json["temporal_tiling"];
         }
+        if (tiling_json.contains("auto_tile_size") && tiling_json["auto_tile_size"].is_boolean()) {
+            vae_tiling_params.auto_tile_size = tiling_json["auto_tile_size"];
+        }
         if (tiling_json.contains("tile_size_x") && tiling_json["tile_size_x"].is_number_integer()) {
             vae_tiling_params.tile_size_x = tiling_json["tile_size_x"];
         }
@@ -2139,6 +2450,10 @@ bool SDGenerationParams::initialize_cache_params() {
                     cache_params.spectrum_flex_window = std::stof(val);
                 } else if (key == "stop") {
                     cache_params.spectrum_stop_percent = std::stof(val);
+                } else if (key == "calibrate") {
+                    cache_params.profile_calibrate = (std::stof(val) != 0.0f);
+                } else if (key == "target_error") {
+                    cache_params.profile_target_error = std::stof(val);
                 } else {
                     LOG_ERROR("error: unknown cache parameter '%s'", key.c_str());
                     return false;
@@ -2203,6 +2518,7 @@ bool SDGenerationParams::resolve(const std::string& lora_model_dir, const std::s
 
     if (strict) {
         batch_count                = std::clamp(batch_count, 1, 8);
+        latent_batch_size          = std::clamp(latent_batch_size, 1, batch_count);
         sample_params.sample_steps = std::clamp(sample_params.sample_steps, 1, 100);
     }
 
@@ -2240,6 +2556,11 @@ bool SDGenerationParams::validate(SDMode mode) {
         return false;
     }
 
+    if (latent_batch_size <= 0) {
+        LOG_ERROR("error: latent_batch_size must be greater than 0");
+        return false;
+    }
+
     if (sample_params.sample_steps <= 0) {
         LOG_ERROR("error: the sample_steps must be greater than 0\n");
         return false;
@@ -2376,12 +2697,14 @@ sd_img_gen_params_t SDGenerationParams::to_sd_img_gen_params_t() {
     high_noise_sample_params.extra_sample_args        = high_noise_extra_sample_args.empty() ? nullptr : high_noise_extra_sample_args.c_str();
     vae_tiling_params.extra_tiling_args               = extra_tiling_args.empty() ? nullptr : extra_tiling_args.c_str();
     cache_params.scm_mask                             = scm_mask.empty() ? nullptr : scm_mask.c_str();
+    cache_params.profile_path                         = cache_profile.empty() ? nullptr : cache_profile.c_str();
 
     sd_pm_params_t pm_params = {
         pm_id_image_views.empty() ? nullptr : pm_id_image_views.data(),
         static_cast<int>(pm_id_image_views.size()),
         pm_id_embed_path.empty() ? nullptr : pm_id_embed_path.c_str(),
         pm_style_strength,
+        pm_identity_path.empty() ? nullptr : pm_identity_path.c_str(),
     };
 
     sd_pulid_params_t pulid_params = {
@@ -2406,6 +2729,7 @@ sd_img_gen_params_t SDGenerationParams::to_sd_img_gen_params_t() {
     params.strength              = strength;
     params.seed                  = seed;
     params.batch_count           = batch_count;
+    params.latent_batch_size     = latent_batch_size;
     params.control_image         = control_image.get();
     params.control_strength      = control_strength;
     params.pm_params             = pm_params;
@@ -2456,6 +2780,7 @@ sd_vid_gen_params_t SDGenerationParams::to_sd_vid_gen_params_t() {
     high_noise_sample_params.extra_sample_args        = high_noise_extra_sample_args.empty() ? nullptr : high_noise_extra_sample_args.c_str();
     vae_tiling_params.extra_tiling_args               = extra_tiling_args.empty() ? nullptr : extra_tiling_args.c_str();
     cache_params.scm_mask                             = scm_mask.empty() ? nullptr : scm_mask.c_str();
+    cache_params.profile_path                         = cache_profile.empty() ? nullptr : cache_profile.c_str();
 
     params.loras                     = lora_vec.empty() ? nullptr : lora_vec.data();
     params.lora_count                = static_cast<uint32_t>(lora_vec.size());
@@ -2531,6 +2856,7 @@ std::string SDGenerationParams::to_string() const {
         << "  width: " << width << ",\n"
         << "  height: " << height << ",\n"
         << "  batch_count: " << batch_count << ",\n"
+        << "  latent_batch_size: " << latent_batch_size << ",\n"
         << "  init_image_path: \"" << init_image_path << "\",\n"
         << "  end_image_path: \"" << end_image_path << "\",\n"
         << "  mask_image_path: \"" << mask_image_path << "\",\n"
@@ -2541,6 +2867,7 @@ std::string SDGenerationParams::to_string() const {
         << "  increase_ref_index: " << (increase_ref_index ? "true" : "false") << ",\n"
         << "  pm_id_images_dir: \"" << pm_id_images_dir << "\",\n"
         << "  pm_id_embed_path: \"" << pm_id_embed_path << "\",\n"
+        << "  pm_identity_path: \"" << pm_identity_path << "\",\n"
         << "  pm_style_strength: " << pm_style_strength << ",\n"
         << "  skip_layers: " << vec_to_string(skip_layers) << ",\n"
         << "  sample_params: " << SAFE_STR(sample_params_str.get()) << ",\n"
@@ -2581,7 +2908,8 @@ std::string SDGenerationParams::to_string() const {
         << vae_tiling_params.target_overlap << ", "
         << vae_tiling_params.rel_size_x << ", "
         << vae_tiling_params.rel_size_y << ", "
-        << "\"" << extra_tiling_args << "\" },\n"
+        << "\"" << extra_tiling_args << "\", "
+        << vae_tiling_params.auto_tile_size << " },\n"
         << "}";
     return oss.str();
 }
@@ -2758,10 +3086,14 @@ std::string build_sdcpp_image_metadata_json(const SDContextParams& ctx_params,
             {"spectrum_flex_window", gen_params.cache_params.spectrum_flex_window},
             {"spectrum_warmup_steps", gen_params.cache_params.spectrum_warmup_steps},
             {"spectrum_stop_percent", gen_params.cache_params.spectrum_stop_percent},
+            {"profile", gen_params.cache_profile},
+            {"profile_calibrate", gen_params.cache_params.profile_calibrate},
+            {"profile_target_error", gen_params.cache_params.profile_target_error},
         };
     }
 
     if (gen_params.vae_tiling_params.enabled ||
+        gen_params.vae_tiling_params.auto_tile_size ||
         gen_params.vae_tiling_params.temporal_tiling ||
         !gen_params.extra_tiling_args.empty()) {
         root["vae_tiling"] = {
@@ -2773,6 +3105,7 @@ std::string build_sdcpp_image_metadata_json(const SDContextParams& ctx_params,
             {"rel_size_x", gen_params.vae_tiling_params.rel_size_x},
             {"rel_size_y", gen_params.vae_tiling_params.rel_size_y},
             {"extra_tiling_args", gen_params.extra_tiling_args},
+            {"auto_tile_size", gen_params.vae_tiling_params.auto_tile_size},
         };
     }
 
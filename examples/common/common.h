@@ -137,6 +137,14 @@ struct SDContextParams {
     std::string pulid_weights_path;
     sd_type_t wtype = SD_TYPE_COUNT;
     std::string tensor_type_rules;
+    std::string model_cache_dir;
+    std::string attn_tune_cache;
+    std::string conv_tune_cache;
+    std::string condition_file;
+    std::string device_probe_cache;
+    std::string resolution_buckets;
+    std::string text_encoder_share_key;
+    std::string cpu_threadpool_args;
     std::string lora_model_dir = ".";
     std::string hires_upscalers_dir;
 
@@ -148,10 +156,34 @@ struct SDContextParams {
     bool offload_params_to_cpu  = false;
     std::string max_vram        = "0";
     bool stream_layers          = false;
+    bool hybrid_cpu_segments    = false;
     bool eager_load             = false;
+    bool background_load        = false;
+    int mmap_prefault_threads   = 0;
+    bool batched_cfg            = false;
+    bool offload_text_encoder   = false;
+    bool llm_cpu_q8_0           = false;
+    bool stream_q8_0            = false;
+    bool cpu_repack             = false;
+    bool huge_pages             = false;
+    bool shared_compute_buffer  = false;
+    bool dynamic_text_length    = false;
+    bool vae_f32_fallback       = true;
+    bool vae_decode_only        = false;
+    bool auto_placement         = false;
+    int condition_cache_mb      = 0;
+    int vae_encode_cache_mb     = 0;
+    int identity_cache_size     = 16;
+    int max_pinned_mb           = -1;
+    int lora_cache_mb           = 0;
+    int lora_model_cache_mb     = 0;
     std::string backend;
     std::string params_backend;
     std::string rpc_servers;
+    std::string vae_tile_backends;
+    std::string pipeline_backends;
+    std::string cfg_backend;
+    std::string tensor_split;
     std::string effective_backend;
     std::string effective_params_backend;
     bool enable_mmap           = false;
@@ -173,8 +205,10 @@ struct SDContextParams {
 
     bool qwen_image_zero_cond_t = false;
 
-    prediction_t prediction           = PREDICTION_COUNT;
-    lora_apply_mode_t lora_apply_mode = LORA_APPLY_AUTO;
+    prediction_t prediction                             = PREDICTION_COUNT;
+    lora_apply_mode_t lora_apply_mode                   = LORA_APPLY_AUTO;
+    compute_buffer_retention_t compute_buffer_retention = COMPUTE_BUFFER_FREE;
+    numa_placement_t numa_placement                     = NUMA_PLACEMENT_NONE;
 
     bool force_sdxl_vae_conv_scale = false;
 
@@ -197,6 +231,7 @@ struct SDGenerationParams {
     int width                  = -1;
     int height                 = -1;
     int batch_count            = 1;
+    int latent_batch_size      = 1;
     int64_t seed               = 42;
     float strength             = 0.75f;
     float control_strength     = 0.9f;
@@ -223,6 +258,7 @@ struct SDGenerationParams {
     std::string cache_mode;
     std::string cache_option;
     std::string scm_mask;
+    std::string cache_profile;
     bool scm_policy_dynamic = true;
     sd_cache_params_t cache_params{};
 
@@ -230,11 +266,12 @@ struct SDGenerationParams {
     int video_frames                     = 1;
     int fps                              = 16;
     float vace_strength                  = 1.f;
-    sd_tiling_params_t vae_tiling_params = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr};
+    sd_tiling_params_t vae_tiling_params = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr, false};
     std::string extra_tiling_args;
 
     std::string pm_id_images_dir;
     std::string pm_id_embed_path;
+    std::string pm_identity_path;
     float pm_style_strength = 20.f;
 
     std::string pulid_id_embedding_path;
@@ -11,8 +11,12 @@
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+static unsigned char* sd_png_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+#define STBIW_ZLIB_COMPRESS sd_png_zlib_compress
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_STATIC
 #include "stb_image.h"
@@ -38,6 +42,215 @@
 
 namespace fs = std::filesystem;
 
+struct DeflateBitWriter {
+    std::vector<uint8_t> out;
+    uint64_t bitbuf = 0;
+    int bitcount    = 0;
+
+    void add(uint32_t bits, int count) {
+        bitbuf |= static_cast<uint64_t>(bits) << bitcount;
+        bitcount += count;
+        if (bitcount >= 32) {
+            uint8_t bytes[4] = {static_cast<uint8_t>(bitbuf),
+                                static_cast<uint8_t>(bitbuf >> 8),
+                                static_cast<uint8_t>(bitbuf >> 16),
+                                static_cast<uint8_t>(bitbuf >> 24)};
+            out.insert(out.end(), bytes, bytes + 4);
+            bitbuf >>= 32;
+            bitcount -= 32;
+        }
+    }
+
+    static uint32_t reverse_bits(uint32_t code, int len) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < len; ++i) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        return reversed;
+    }
+
+    // Huffman codes go out most significant bit first.
+    void huff(uint32_t code, int len) {
+        add(reverse_bits(code, len), len);
+    }
+
+    // Fixed Huffman code of a literal/length symbol, bit reversed once.
+    void symbol(int v) {
+        struct FixedCodes {
+            uint16_t code[288];
+            uint8_t len[288];
+        };
+        static const FixedCodes codes = []() {
+            FixedCodes table;
+            DeflateBitWriter reverse;
+            for (int s = 0; s < 288; ++s) {
+                uint32_t code = s <= 143 ? 0x30 + s : s <= 255 ? 0x190 + s - 144 : s <= 279 ? s - 256 : 0xC0 + s - 280;
+                int len       = s <= 143 ? 8 : s <= 255 ? 9 : s <= 279 ? 7 : 8;
+                table.code[s] = static_cast<uint16_t>(reverse.reverse_bits(code, len));
+                table.len[s]  = static_cast<uint8_t>(len);
+            }
+            return table;
+        }();
+        add(codes.code[v], codes.len[v]);
+    }
+
+    // Pads to a byte boundary and writes out the pending bits.
+    void align() {
+        while (bitcount > 0) {
+            out.push_back(static_cast<uint8_t>(bitbuf));
+            bitbuf >>= 8;
+            bitcount = std::max(0, bitcount - 8);
+        }
+    }
+};
+
+// One fixed Huffman deflate block of data. stb's own compressor scans a
+// growing list per hash bucket and looks one byte ahead at every match; this
+// one keeps zlib style hash chains, takes the longest match within a chain
+// walk bounded by the compression level and inserts without shifting, which
+// is several times faster at a similar size. Level 1 checks a single
+// candidate, in the spirit of fpng. Matches never reach before data, so a
+// stream can be built from blocks compressed one after another.
+static void deflate_fixed_block(DeflateBitWriter& writer, const uint8_t* data, int data_len, int level, bool final_block) {
+    static const unsigned short length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
+    static const unsigned char length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const unsigned short dist_base[]   = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32768};
+    static const unsigned char dist_extra[]   = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    constexpr int kWindow    = 32768;
+    constexpr int kMaxDist   = 32767;
+    constexpr int kHashBits  = 15;
+    constexpr int kMaxLength = 258;
+
+    level               = std::clamp(level, 1, 9);
+    const int max_chain = level == 1 ? 1 : 2 * (level - 1);
+    const int nice_len  = level <= 3 ? 32 : kMaxLength;
+
+    writer.add(final_block ? 1 : 0, 1);  // BFINAL
+    writer.add(1, 2);                    // BTYPE = 1, fixed Huffman
+
+    std::vector<int> head(1 << kHashBits, -1);
+    std::vector<int> prev(kWindow, -1);
+    auto hash3 = [&](int i) {
+        uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return static_cast<int>((v * 2654435761u) >> (32 - kHashBits));
+    };
+    auto insert = [&](int i) {
+        if (i + 3 <= data_len) {
+            int h                   = hash3(i);
+            prev[i & (kWindow - 1)] = head[h];
+            head[h]                 = i;
+        }
+    };
+
+    int i = 0;
+    while (i < data_len) {
+        int best_len  = 0;
+        int best_dist = 0;
+        if (i + 3 <= data_len) {
+            const int max_len = std::min(kMaxLength, data_len - i);
+            int candidate     = head[hash3(i)];
+            for (int chain = 0; chain < max_chain && candidate >= 0 && i - candidate <= kMaxDist; ++chain) {
+                if (data[candidate + best_len] == data[i + best_len]) {
+                    int len = 0;
+                    while (len < max_len && data[candidate + len] == data[i + len]) {
+                        ++len;
+                    }
+                    if (len > best_len) {
+                        best_len  = len;
+                        best_dist = i - candidate;
+                        if (len >= nice_len || len >= max_len) {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[candidate & (kWindow - 1)];
+            }
+        }
+
+        if (best_len >= 3) {
+            int j = 0;
+            while (best_len > length_base[j + 1] - 1) {
+                ++j;
+            }
+            writer.symbol(257 + j);
+            if (length_extra[j]) {
+                writer.add(best_len - length_base[j], length_extra[j]);
+            }
+            j = 0;
+            while (best_dist > dist_base[j + 1] - 1) {
+                ++j;
+            }
+            writer.huff(j, 5);
+            if (dist_extra[j]) {
+                writer.add(best_dist - dist_base[j], dist_extra[j]);
+            }
+            for (int k = 0; k < best_len; ++k) {
+                insert(i + k);
+            }
+            i += best_len;
+        } else {
+            writer.symbol(data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+    writer.symbol(256);  // end of block
+}
+
+static void adler32_update(uint32_t* s1, uint32_t* s2, const uint8_t* data, size_t len) {
+    for (size_t j = 0; j < len;) {
+        size_t block_end = std::min(len, j + 5552);
+        for (; j < block_end; ++j) {
+            *s1 += data[j];
+            *s2 += *s1;
+        }
+        *s1 %= 65521;
+        *s2 %= 65521;
+    }
+}
+
+// zlib stream for stb's PNG writer (STBIW_ZLIB_COMPRESS). Like stb it emits
+// one fixed Huffman block, or stored blocks when that would be larger.
+static unsigned char* sd_png_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality) {
+    DeflateBitWriter writer;
+    writer.out.reserve(static_cast<size_t>(data_len) / 2 + 64);
+    writer.out.push_back(0x78);  // DEFLATE 32K window
+    writer.out.push_back(0x5e);  // FLEVEL = 1
+    deflate_fixed_block(writer, data, data_len, quality, true);
+    writer.align();
+
+    // store uncompressed instead if compression was worse
+    if (writer.out.size() > static_cast<size_t>(data_len) + 2 + ((data_len + 32766) / 32767) * 5) {
+        writer.out.resize(2);
+        for (int j = 0; j < data_len;) {
+            int block_len = std::min(data_len - j, 32767);
+            writer.out.push_back(data_len - j == block_len ? 1 : 0);  // BFINAL, BTYPE = 0
+            writer.out.push_back(static_cast<uint8_t>(block_len & 0xFF));
+            writer.out.push_back(static_cast<uint8_t>(block_len >> 8));
+            writer.out.push_back(static_cast<uint8_t>(~block_len & 0xFF));
+            writer.out.push_back(static_cast<uint8_t>((~block_len >> 8) & 0xFF));
+            writer.out.insert(writer.out.end(), data + j, data + j + block_len);
+            j += block_len;
+        }
+    }
+
+    uint32_t s1 = 1;
+    uint32_t s2 = 0;
+    adler32_update(&s1, &s2, data, static_cast<size_t>(data_len));
+    writer.out.push_back(static_cast<uint8_t>(s2 >> 8));
+    writer.out.push_back(static_cast<uint8_t>(s2 & 0xFF));
+    writer.out.push_back(static_cast<uint8_t>(s1 >> 8));
+    writer.out.push_back(static_cast<uint8_t>(s1 & 0xFF));
+
+    unsigned char* out = static_cast<unsigned char*>(malloc(writer.out.size()));
+    if (out == nullptr) {
+        return nullptr;
+    }
+    memcpy(out, writer.out.data(), writer.out.size());
+    *out_len = static_cast<int>(writer.out.size());
+    return out;
+}
+
 #ifdef SD_USE_WEBP
 struct WebPFreeDeleter {
     void operator()(void* ptr) const {
@@ -640,6 +853,13 @@ void write_u16_le(std::vector<uint8_t>& data, uint16_t val) {
     data.push_back(static_cast<uint8_t>((val >> 8) & 0xFF));
 }
 
+static void write_u32_be(std::vector<uint8_t>& data, uint32_t val) {
+    data.push_back(static_cast<uint8_t>((val >> 24) & 0xFF));
+    data.push_back(static_cast<uint8_t>((val >> 16) & 0xFF));
+    data.push_back(static_cast<uint8_t>((val >> 8) & 0xFF));
+    data.push_back(static_cast<uint8_t>(val & 0xFF));
+}
+
 void patch_u32_le(std::vector<uint8_t>& data, size_t offset, uint32_t val) {
     if (offset + 4 > data.size()) {
         return;
@@ -751,6 +971,49 @@ std::vector<uint8_t> encode_image_to_vector(EncodedImageFormat format,
     return buffer;
 }
 
+void set_png_compression_level(int level) {
+    stbi_write_png_compression_level = std::clamp(level, 1, 9);
+    stbi_write_force_png_filter      = level <= 3 ? 4 : -1;
+}
+
+std::vector<std::vector<uint8_t>> encode_images_to_vectors(EncodedImageFormat format,
+                                                           const std::vector<ImageEncodeInput>& images,
+                                                           int quality,
+                                                           int max_threads) {
+    std::vector<std::vector<uint8_t>> encoded(images.size());
+    auto encode_one = [&](size_t i) {
+        const ImageEncodeInput& input = images[i];
+        if (input.image != nullptr) {
+            encoded[i] = encode_image_to_vector(format, input.image, input.width, input.height, input.channels, input.parameters, quality);
+        }
+    };
+
+    if (max_threads <= 0) {
+        max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    const size_t n_threads = std::min(images.size(), static_cast<size_t>(max_threads));
+    if (n_threads <= 1) {
+        for (size_t i = 0; i < images.size(); ++i) {
+            encode_one(i);
+        }
+        return encoded;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads);
+    for (size_t t = 0; t < n_threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (size_t i = t; i < images.size(); i += n_threads) {
+                encode_one(i);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return encoded;
+}
+
 bool write_image_to_file(const std::string& path,
                          const uint8_t* image,
                          int width,
@@ -810,36 +1073,21 @@ uint8_t* load_image_from_memory(const char* image_bytes,
     return load_image_common(true, image_bytes, len, width, height, expected_width, expected_height, expected_channel);
 }
 
-std::vector<uint8_t> create_mjpg_avi_from_sd_images_to_vector(sd_image_t* images, int num_images, int fps, int quality, const sd_audio_t* audio) {
-    if (num_images == 0) {
-        fprintf(stderr, "Error: Image array is empty.\n");
-        return {};
-    }
-
-    uint32_t width    = images[0].width;
-    uint32_t height   = images[0].height;
-    uint32_t channels = images[0].channel;
-    if (channels != 3 && channels != 4) {
-        fprintf(stderr, "Error: Unsupported channel count: %u\n", channels);
-        return {};
-    }
-
-    // stb_image_write changes JPEG sampling behavior above quality 90.
-    // MJPG AVI playback is more compatible when we keep the encoder on the
-    // <= 90 path.
-    const int mjpg_quality               = std::clamp(quality, 1, 90);
+// Appends the RIFF/hdrl header up to the "movi" list tag. The RIFF and movi
+// sizes are left zero; the returned offset is where the movi size goes.
+static size_t append_mjpg_avi_header(std::vector<uint8_t>& avi_data,
+                                     uint32_t width,
+                                     uint32_t height,
+                                     int fps,
+                                     int num_images,
+                                     const sd_audio_t* audio) {
     const bool has_audio                 = audio != nullptr && audio->data != nullptr && audio->sample_count > 0 && audio->channels > 0 && audio->sample_rate > 0;
-    const std::vector<uint8_t> audio_pcm = audio_to_pcm16_bytes(audio);
     const uint16_t audio_bits_per_sample = 16;
     const uint16_t audio_block_align     = has_audio ? static_cast<uint16_t>(audio->channels * (audio_bits_per_sample / 8)) : 0;
     const uint32_t audio_byte_rate       = has_audio ? static_cast<uint32_t>(audio->sample_rate * audio_block_align) : 0;
-    const uint32_t audio_data_size       = has_audio ? static_cast<uint32_t>(audio_pcm.size()) : 0;
-
-    std::vector<uint8_t> avi_data;
-    avi_data.reserve(static_cast<size_t>(num_images) * 1024);
+    const uint32_t audio_data_size       = has_audio ? static_cast<uint32_t>(audio->sample_count * audio_block_align) : 0;
 
     write_fourcc(avi_data, "RIFF");
-    const size_t riff_size_pos = avi_data.size();
     write_u32_le(avi_data, 0);
     write_fourcc(avi_data, "AVI ");
 
@@ -945,6 +1193,35 @@ std::vector<uint8_t> create_mjpg_avi_from_sd_images_to_vector(sd_image_t* images
     const size_t movi_size_pos = avi_data.size();
     write_u32_le(avi_data, 0);
     write_fourcc(avi_data, "movi");
+    return movi_size_pos;
+}
+
+std::vector<uint8_t> create_mjpg_avi_from_sd_images_to_vector(sd_image_t* images, int num_images, int fps, int quality, const sd_audio_t* audio) {
+    if (num_images == 0) {
+        fprintf(stderr, "Error: Image array is empty.\n");
+        return {};
+    }
+
+    uint32_t width    = images[0].width;
+    uint32_t height   = images[0].height;
+    uint32_t channels = images[0].channel;
+    if (channels != 3 && channels != 4) {
+        fprintf(stderr, "Error: Unsupported channel count: %u\n", channels);
+        return {};
+    }
+
+    // stb_image_write changes JPEG sampling behavior above quality 90.
+    // MJPG AVI playback is more compatible when we keep the encoder on the
+    // <= 90 path.
+    const int mjpg_quality               = std::clamp(quality, 1, 90);
+    const bool has_audio                 = audio != nullptr && audio->data != nullptr && audio->sample_count > 0 && audio->channels > 0 && audio->sample_rate > 0;
+    const std::vector<uint8_t> audio_pcm = audio_to_pcm16_bytes(audio);
+
+    std::vector<uint8_t> avi_data;
+    avi_data.reserve(static_cast<size_t>(num_images) * 1024);
+
+    const size_t riff_size_pos = 4;
+    const size_t movi_size_pos = append_mjpg_avi_header(avi_data, width, height, fps, num_images, audio);
 
     std::vector<avi_chunk_index_entry> index;
     index.reserve(static_cast<size_t>(num_images) + (has_audio ? 1 : 0));
@@ -1324,6 +1601,510 @@ int create_video_from_sd_images(const char* filename, sd_image_t* images, int nu
     return 0;
 }
 
+struct VideoFileWriter::Impl {
+    std::string path;
+    int fps     = 0;
+    int quality = 90;
+    bool webm   = false;
+    bool opened = false;
+
+    sd_audio_t audio = {};
+    std::vector<float> audio_samples;
+    std::vector<uint8_t> audio_pcm;
+
+    int frames       = 0;
+    uint32_t width   = 0;
+    uint32_t height  = 0;
+    uint32_t channel = 0;
+
+    // MJPG AVI: frames go straight to disk; the header is rewritten at finish
+    // once the frame count is known.
+    FilePtr file;
+    uint64_t file_pos    = 0;
+    size_t movi_size_pos = 0;
+    std::vector<avi_chunk_index_entry> index;
+
+    // JPEG or VP8 frames of the current batch, encoded on all cores
+    std::vector<std::vector<uint8_t>> encoded_frames;
+
+#ifdef SD_USE_WEBM
+    mkvmuxer::MkvWriter mkv_writer;
+    std::unique_ptr<mkvmuxer::Segment> segment;
+    uint64_t video_track    = 0;
+    uint64_t audio_track    = 0;
+    uint64_t audio_written  = 0;
+    uint64_t frame_duration = 0;
+#endif
+
+    const sd_audio_t* audio_or_null() const {
+        return audio_samples.empty() ? nullptr : &audio;
+    }
+
+    bool write_bytes(const void* data, size_t size) {
+        if (size > 0 && fwrite(data, 1, size, file.get()) != size) {
+            fprintf(stderr, "Error: Failed to write video file %s.\n", path.c_str());
+            return false;
+        }
+        file_pos += size;
+        return true;
+    }
+
+    bool write_chunk(const char* fourcc, const uint8_t* data, size_t size, uint32_t flags) {
+        avi_chunk_index_entry entry = {};
+        memcpy(entry.fourcc, fourcc, 4);
+        entry.flags  = flags;
+        entry.offset = static_cast<uint32_t>(file_pos);
+        entry.size   = static_cast<uint32_t>(size);
+
+        std::vector<uint8_t> chunk_header;
+        write_fourcc(chunk_header, fourcc);
+        write_u32_le(chunk_header, entry.size);
+        const uint8_t pad = 0;
+        if (!write_bytes(chunk_header.data(), chunk_header.size()) ||
+            !write_bytes(data, size) ||
+            (size % 2 != 0 && !write_bytes(&pad, 1))) {
+            return false;
+        }
+        index.push_back(entry);
+        return true;
+    }
+
+    bool encode_frame(const sd_image_t& image, std::vector<uint8_t>* encoded) const {
+        encoded->clear();
+#ifdef SD_USE_WEBM
+        if (webm) {
+            return encode_sd_image_to_vp8_frame(image, quality, *encoded);
+        }
+#endif
+        auto write_to_buf = [](void* context, void* data, int size) {
+            auto* buffer       = reinterpret_cast<std::vector<uint8_t>*>(context);
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+            buffer->insert(buffer->end(), src, src + size);
+        };
+        return stbi_write_jpg_to_func(write_to_buf, encoded, image.width, image.height, image.channel, image.data, std::clamp(quality, 1, 90)) != 0;
+    }
+
+    // Frames are independent, so a batch is encoded one frame per core and
+    // muxed in order afterwards.
+    bool encode_frames(const sd_image_t* images, int count) {
+        encoded_frames.resize(static_cast<size_t>(count));
+        std::vector<uint8_t> ok(static_cast<size_t>(count), 0);
+        const int n_threads = std::min(count, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+        auto encode_range   = [&](int t) {
+            for (int i = t; i < count; i += n_threads) {
+                ok[i] = encode_frame(images[i], &encoded_frames[i]) ? 1 : 0;
+            }
+        };
+        if (n_threads <= 1) {
+            encode_range(0);
+        } else {
+            std::vector<std::thread> workers;
+            workers.reserve(n_threads);
+            for (int t = 0; t < n_threads; ++t) {
+                workers.emplace_back(encode_range, t);
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            if (!ok[i]) {
+                fprintf(stderr, "Error: Failed to encode frame %d.\n", frames + i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool add_avi_frame(const std::vector<uint8_t>& jpeg_data) {
+        if (frames == 0) {
+            std::vector<uint8_t> header;
+            movi_size_pos = append_mjpg_avi_header(header, width, height, fps, 0, audio_or_null());
+            if (!write_bytes(header.data(), header.size())) {
+                return false;
+            }
+        }
+        return write_chunk("00dc", jpeg_data.data(), jpeg_data.size(), 0x10);
+    }
+
+    bool finish_avi() {
+        if (!audio_pcm.empty() && !write_chunk("01wb", audio_pcm.data(), audio_pcm.size(), 0)) {
+            return false;
+        }
+        const uint64_t movi_size = file_pos - movi_size_pos - 4;
+
+        std::vector<uint8_t> idx1;
+        write_fourcc(idx1, "idx1");
+        write_u32_le(idx1, static_cast<uint32_t>(index.size() * 16));
+        for (const auto& entry : index) {
+            write_fourcc(idx1, entry.fourcc);
+            write_u32_le(idx1, entry.flags);
+            write_u32_le(idx1, entry.offset);
+            write_u32_le(idx1, entry.size);
+        }
+        if (!write_bytes(idx1.data(), idx1.size())) {
+            return false;
+        }
+
+        std::vector<uint8_t> header;
+        append_mjpg_avi_header(header, width, height, fps, frames, audio_or_null());
+        patch_u32_le(header, 4, static_cast<uint32_t>(file_pos - 8));
+        patch_u32_le(header, movi_size_pos, static_cast<uint32_t>(movi_size));
+        if (fseek(file.get(), 0, SEEK_SET) != 0 || fwrite(header.data(), 1, header.size(), file.get()) != header.size()) {
+            fprintf(stderr, "Error: Failed to rewrite AVI header in %s.\n", path.c_str());
+            return false;
+        }
+        FILE* f = file.release();
+        if (fclose(f) != 0) {
+            fprintf(stderr, "Error: Failed to close video file %s.\n", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+#ifdef SD_USE_WEBM
+    bool add_webm_audio(uint64_t end, uint64_t timestamp_ns) {
+        end = std::min<uint64_t>(end, audio.sample_count);
+        if (audio_track == 0 || end <= audio_written) {
+            return true;
+        }
+        const size_t frame_bytes = static_cast<size_t>(audio.channels) * sizeof(int16_t);
+        const uint8_t* begin_ptr = audio_pcm.data() + audio_written * frame_bytes;
+        if (!segment->AddFrame(begin_ptr, (end - audio_written) * frame_bytes, audio_track, timestamp_ns, true)) {
+            fprintf(stderr, "Error: Failed to mux audio chunk into WebM.\n");
+            return false;
+        }
+        audio_written = end;
+        return true;
+    }
+
+    bool add_webm_frame(const std::vector<uint8_t>& vp8_frame) {
+        if (frames == 0) {
+            segment = std::make_unique<mkvmuxer::Segment>();
+            if (!segment->Init(&mkv_writer)) {
+                fprintf(stderr, "Error: Failed to initialize WebM muxer.\n");
+                return false;
+            }
+            segment->set_mode(mkvmuxer::Segment::kFile);
+            segment->OutputCues(true);
+
+            video_track = segment->AddVideoTrack(static_cast<int>(width), static_cast<int>(height), 0);
+            if (video_track == 0 || !segment->CuesTrack(video_track)) {
+                fprintf(stderr, "Error: Failed to add VP8 video track.\n");
+                return false;
+            }
+            auto* track = static_cast<mkvmuxer::VideoTrack*>(segment->GetTrackByNumber(video_track));
+            if (track != nullptr) {
+                track->set_display_width(width);
+                track->set_display_height(height);
+                track->set_frame_rate(static_cast<double>(fps));
+            }
+            if (!audio_pcm.empty()) {
+                audio_track           = segment->AddAudioTrack(static_cast<int32_t>(audio.sample_rate), static_cast<int32_t>(audio.channels), 0);
+                auto* audio_track_ptr = audio_track == 0 ? nullptr : static_cast<mkvmuxer::AudioTrack*>(segment->GetTrackByNumber(audio_track));
+                if (audio_track_ptr == nullptr) {
+                    fprintf(stderr, "Error: Failed to add audio track.\n");
+                    return false;
+                }
+                audio_track_ptr->set_codec_id("A_PCM/INT/LIT");
+                audio_track_ptr->set_bit_depth(16);
+                audio_track_ptr->set_sample_rate(static_cast<double>(audio.sample_rate));
+                audio_track_ptr->set_channels(audio.channels);
+            }
+            segment->GetSegmentInfo()->set_writing_app("stable-diffusion.cpp");
+            segment->GetSegmentInfo()->set_muxing_app("stable-diffusion.cpp");
+            frame_duration = std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(1000000000.0 / static_cast<double>(fps))));
+        }
+
+        const uint64_t timestamp_ns = static_cast<uint64_t>(frames) * frame_duration;
+        if (!segment->AddFrame(vp8_frame.data(), vp8_frame.size(), video_track, timestamp_ns, true)) {
+            fprintf(stderr, "Error: Failed to mux frame %d into WebM.\n", frames);
+            return false;
+        }
+        // audio for the span this frame covers
+        const uint64_t audio_end = static_cast<uint64_t>(frames + 1) * audio.sample_rate / static_cast<uint64_t>(fps);
+        return add_webm_audio(audio_end, timestamp_ns);
+    }
+
+    bool finish_webm() {
+        if (!add_webm_audio(audio.sample_count, static_cast<uint64_t>(frames) * frame_duration)) {
+            return false;
+        }
+        if (!segment->Finalize()) {
+            fprintf(stderr, "Error: Failed to finalize WebM output.\n");
+            return false;
+        }
+        mkv_writer.Close();
+        return true;
+    }
+#endif
+};
+
+VideoFileWriter::VideoFileWriter()
+    : impl_(std::make_unique<Impl>()) {
+}
+
+VideoFileWriter::~VideoFileWriter() = default;
+
+bool VideoFileWriter::open(const std::string& path, int fps, int quality, const sd_audio_t* audio) {
+    if (fps <= 0) {
+        fprintf(stderr, "Error: FPS must be positive.\n");
+        return false;
+    }
+    impl_          = std::make_unique<Impl>();
+    impl_->path    = path;
+    impl_->fps     = fps;
+    impl_->quality = quality;
+    if (audio != nullptr && audio->data != nullptr && audio->sample_count > 0 && audio->channels > 0 && audio->sample_rate > 0) {
+        impl_->audio_samples.assign(audio->data, audio->data + audio->sample_count * audio->channels);
+        impl_->audio      = *audio;
+        impl_->audio.data = impl_->audio_samples.data();
+        impl_->audio_pcm  = audio_to_pcm16_bytes(&impl_->audio);
+    }
+
+#ifdef SD_USE_WEBM
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    impl_->webm = ext == ".webm";
+    if (impl_->webm) {
+        if (!impl_->mkv_writer.Open(path.c_str())) {
+            fprintf(stderr, "Error: Failed to open %s for writing.\n", path.c_str());
+            return false;
+        }
+        impl_->opened = true;
+        return true;
+    }
+#endif
+
+    impl_->file.reset(fopen(path.c_str(), "wb"));
+    if (impl_->file == nullptr) {
+        perror("Error opening file for writing");
+        return false;
+    }
+    impl_->opened = true;
+    return true;
+}
+
+bool VideoFileWriter::add_frames(const sd_image_t* frames, int count) {
+    if (!impl_->opened) {
+        fprintf(stderr, "Error: Video writer is not open.\n");
+        return false;
+    }
+    if (count <= 0) {
+        return true;
+    }
+    if (impl_->frames == 0) {
+        impl_->width   = frames[0].width;
+        impl_->height  = frames[0].height;
+        impl_->channel = frames[0].channel;
+        if (impl_->channel != 3 && impl_->channel != 4) {
+            fprintf(stderr, "Error: Unsupported channel count: %u\n", impl_->channel);
+            return false;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        const sd_image_t& image = frames[i];
+        if (image.width != impl_->width || image.height != impl_->height || image.channel != impl_->channel) {
+            fprintf(stderr, "Error: Frame dimensions do not match.\n");
+            return false;
+        }
+    }
+    if (!impl_->encode_frames(frames, count)) {
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        bool ok = false;
+#ifdef SD_USE_WEBM
+        if (impl_->webm) {
+            ok = impl_->add_webm_frame(impl_->encoded_frames[i]);
+        } else
+#endif
+        {
+            ok = impl_->add_avi_frame(impl_->encoded_frames[i]);
+        }
+        if (!ok) {
+            return false;
+        }
+        impl_->frames++;
+    }
+    impl_->encoded_frames.clear();
+    return true;
+}
+
+bool VideoFileWriter::finish() {
+    if (!impl_->opened) {
+        return false;
+    }
+    impl_->opened = false;
+    if (impl_->frames == 0) {
+        fprintf(stderr, "Error: No frames were written to %s.\n", impl_->path.c_str());
+        return false;
+    }
+#ifdef SD_USE_WEBM
+    if (impl_->webm) {
+        return impl_->finish_webm();
+    }
+#endif
+    return impl_->finish_avi();
+}
+
+int VideoFileWriter::frame_count() const {
+    return impl_->frames;
+}
+
+struct PngFileWriter::Impl {
+    std::string path;
+    FilePtr file;
+    int width    = 0;
+    int height   = 0;
+    int channels = 0;
+    int level    = 8;
+    int rows     = 0;
+
+    // Paeth needs the row above, kept across batches. The deflate stream is
+    // one fixed Huffman block per batch; pending bits stay in the writer
+    // until the next batch or the final block byte aligns them.
+    std::vector<uint8_t> prev_row;
+    std::vector<uint8_t> filtered;
+    DeflateBitWriter deflate;
+    uint32_t adler_s1 = 1;
+    uint32_t adler_s2 = 0;
+
+    bool write_chunk(const char* type, const uint8_t* data, size_t size) {
+        std::vector<uint8_t> chunk;
+        chunk.reserve(size + 12);
+        write_u32_be(chunk, static_cast<uint32_t>(size));
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data, data + size);
+        write_u32_be(chunk, stbiw__crc32(chunk.data() + 4, static_cast<int>(size + 4)));
+        if (fwrite(chunk.data(), 1, chunk.size(), file.get()) != chunk.size()) {
+            fprintf(stderr, "Error: Failed to write PNG file %s.\n", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool flush_idat() {
+        if (deflate.out.empty()) {
+            return true;
+        }
+        bool ok = write_chunk("IDAT", deflate.out.data(), deflate.out.size());
+        deflate.out.clear();
+        return ok;
+    }
+};
+
+PngFileWriter::PngFileWriter()
+    : impl_(std::make_unique<Impl>()) {
+}
+
+PngFileWriter::~PngFileWriter() = default;
+
+bool PngFileWriter::open(const std::string& path, int width, int height, int channels, const std::string& parameters) {
+    if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        fprintf(stderr, "Error: Invalid PNG dimensions %dx%dx%d.\n", width, height, channels);
+        return false;
+    }
+    impl_           = std::make_unique<Impl>();
+    impl_->path     = path;
+    impl_->width    = width;
+    impl_->height   = height;
+    impl_->channels = channels;
+    impl_->level    = stbi_write_png_compression_level;
+    impl_->prev_row.assign(static_cast<size_t>(width) * channels, 0);
+    impl_->file.reset(fopen(path.c_str(), "wb"));
+    if (impl_->file == nullptr) {
+        perror("Error opening file for writing");
+        return false;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    static const uint8_t color_type[] = {0, 0, 4, 2, 6};
+    if (fwrite(signature, 1, sizeof(signature), impl_->file.get()) != sizeof(signature)) {
+        fprintf(stderr, "Error: Failed to write PNG file %s.\n", path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> ihdr;
+    write_u32_be(ihdr, static_cast<uint32_t>(width));
+    write_u32_be(ihdr, static_cast<uint32_t>(height));
+    ihdr.push_back(8);  // bit depth
+    ihdr.push_back(color_type[channels]);
+    ihdr.push_back(0);  // compression
+    ihdr.push_back(0);  // filter
+    ihdr.push_back(0);  // no interlace
+    if (!impl_->write_chunk("IHDR", ihdr.data(), ihdr.size())) {
+        return false;
+    }
+    if (!parameters.empty()) {
+        std::vector<uint8_t> text(std::begin("parameters"), std::end("parameters"));
+        text.insert(text.end(), parameters.begin(), parameters.end());
+        if (!impl_->write_chunk("tEXt", text.data(), text.size())) {
+            return false;
+        }
+    }
+    impl_->deflate.out.push_back(0x78);  // DEFLATE 32K window
+    impl_->deflate.out.push_back(0x5e);  // FLEVEL = 1
+    return true;
+}
+
+bool PngFileWriter::add_rows(const uint8_t* pixels, int row_count) {
+    if (impl_->file == nullptr) {
+        fprintf(stderr, "Error: PNG writer is not open.\n");
+        return false;
+    }
+    if (row_count <= 0 || impl_->rows + row_count > impl_->height) {
+        fprintf(stderr, "Error: Too many rows for PNG file %s.\n", impl_->path.c_str());
+        return false;
+    }
+    const int n             = impl_->channels;
+    const size_t row_bytes  = static_cast<size_t>(impl_->width) * n;
+    std::vector<uint8_t>& f = impl_->filtered;
+    f.resize((row_bytes + 1) * row_count);
+    for (int y = 0; y < row_count; ++y) {
+        const uint8_t* row   = pixels + row_bytes * y;
+        const uint8_t* above = y == 0 ? impl_->prev_row.data() : row - row_bytes;
+        uint8_t* dst         = f.data() + (row_bytes + 1) * y;
+        dst[0]               = 4;  // Paeth
+        for (size_t x = 0; x < row_bytes; ++x) {
+            const int a = x >= static_cast<size_t>(n) ? row[x - n] : 0;
+            const int b = above[x];
+            const int c = x >= static_cast<size_t>(n) ? above[x - n] : 0;
+            dst[x + 1]  = static_cast<uint8_t>(row[x] - stbiw__paeth(a, b, c));
+        }
+    }
+    memcpy(impl_->prev_row.data(), pixels + row_bytes * (row_count - 1), row_bytes);
+
+    deflate_fixed_block(impl_->deflate, f.data(), static_cast<int>(f.size()), impl_->level, false);
+    adler32_update(&impl_->adler_s1, &impl_->adler_s2, f.data(), f.size());
+    impl_->rows += row_count;
+    return impl_->flush_idat();
+}
+
+bool PngFileWriter::finish() {
+    if (impl_->file == nullptr) {
+        return false;
+    }
+    if (impl_->rows != impl_->height) {
+        fprintf(stderr, "Error: PNG file %s got %d of %d rows.\n", impl_->path.c_str(), impl_->rows, impl_->height);
+        impl_->file.reset();
+        return false;
+    }
+    deflate_fixed_block(impl_->deflate, nullptr, 0, impl_->level, true);
+    impl_->deflate.align();
+    write_u32_be(impl_->deflate.out, (impl_->adler_s2 << 16) | impl_->adler_s1);
+    if (!impl_->flush_idat() || !impl_->write_chunk("IEND", nullptr, 0)) {
+        impl_->file.reset();
+        return false;
+    }
+    FILE* f = impl_->file.release();
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: Failed to close PNG file %s.\n", impl_->path.c_str());
+        return false;
+    }
+    return true;
+}
+
 bool write_wav_to_file(const std::string& path,
                        const float* interleaved_samples,
                        uint64_t sample_count,
@@ -2,6 +2,7 @@
 #define __MEDIA_IO_H__
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,6 +25,26 @@ std::vector<uint8_t> encode_image_to_vector(EncodedImageFormat format,
                                             const std::string& parameters = "",
                                             int quality                   = 90);
 
+// zlib effort of PNG encoding, from 1 (fastest) to 9 (default 8). Levels up
+// to 3 also apply the Paeth filter to every row instead of picking the best
+// of the five filters per row.
+void set_png_compression_level(int level);
+
+struct ImageEncodeInput {
+    const uint8_t* image = nullptr;
+    int width            = 0;
+    int height           = 0;
+    int channels         = 0;
+    std::string parameters;
+};
+
+// Encodes the images in parallel on up to max_threads threads (0 uses one
+// per core). A failed or missing image yields an empty vector.
+std::vector<std::vector<uint8_t>> encode_images_to_vectors(EncodedImageFormat format,
+                                                           const std::vector<ImageEncodeInput>& images,
+                                                           int quality     = 90,
+                                                           int max_threads = 0);
+
 bool write_image_to_file(const std::string& path,
                          const uint8_t* image,
                          int width,
@@ -104,6 +125,43 @@ std::vector<uint8_t> create_video_from_sd_images_to_vector(const std::string& ou
                                                            int quality             = 90,
                                                            const sd_audio_t* audio = nullptr);
 
+// Writes a video one batch of frames at a time so long generations never hold
+// every decoded frame in memory. Produces WebM for a .webm path when built
+// with SD_USE_WEBM, MJPG AVI otherwise. Audio passed to open is copied.
+class VideoFileWriter {
+public:
+    VideoFileWriter();
+    ~VideoFileWriter();
+
+    bool open(const std::string& path, int fps, int quality = 90, const sd_audio_t* audio = nullptr);
+    bool add_frames(const sd_image_t* frames, int count);
+    bool finish();
+    int frame_count() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Writes a PNG a batch of rows at a time, for images too large to hold in
+// memory. Rows are Paeth filtered and each batch becomes one deflate block
+// and one IDAT chunk, so memory is bounded by the batch.
+class PngFileWriter {
+public:
+    PngFileWriter();
+    ~PngFileWriter();
+
+    bool open(const std::string& path, int width, int height, int channels, const std::string& parameters = "");
+    // row_count tightly packed rows of width * channels bytes.
+    bool add_rows(const uint8_t* pixels, int row_count);
+    // Fails unless every row was added.
+    bool finish();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
 bool write_wav_to_file(const std::string& path,
                        const float* interleaved_samples,
                        uint64_t sample_count,
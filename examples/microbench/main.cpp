@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <json.hpp>
+
+#include "core/ggml_extend.hpp"
+#include "core/rng_mt19937.hpp"
+#include "core/rng_philox.hpp"
+#include "core/task_pool.h"
+#include "model_loader.h"
+#include "stable-diffusion.h"
+#include "tokenizers/clip_tokenizer.h"
+#include "tokenizers/gemma_tokenizer.h"
+#include "tokenizers/mistral_tokenizer.h"
+#include "tokenizers/qwen2_tokenizer.h"
+#include "tokenizers/t5_unigram_tokenizer.h"
+
+using json = nlohmann::json;
+
+// Kernel-level counterpart of sd-bench: each benchmark times one hot host
+// routine or ggml graph in isolation, so a slower end-to-end run can be traced
+// to the kernel that regressed. It links the library's internals and is only
+// built against the static library.
+
+struct MicrobenchParams {
+    std::string filter;
+    std::string format = "json";
+    std::string output_path;
+    std::string baseline_path;
+    std::vector<std::string> model_paths;
+    double min_time  = 0.5;
+    int min_runs     = 3;
+    double tolerance = 0.1;
+    int n_threads    = 0;
+    bool cpu         = false;
+    bool list        = false;
+    bool verbose     = false;
+};
+
+// What one benchmark runs: setup happens once, untimed; run is the timed body
+// and returns false when the backend or the routine failed.
+struct BenchCase {
+    std::function<bool()> run;
+    double work = 0.0;  // units of the benchmark's unit one run processes
+};
+
+struct Benchmark {
+    std::string name;
+    std::string unit;
+    std::function<bool(BenchCase*)> setup;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string unit;
+    bool success     = false;
+    int runs         = 0;
+    double min_ms    = 0.0;
+    double mean_ms   = 0.0;
+    double median_ms = 0.0;
+    double rate      = 0.0;  // unit per second, at the median run
+};
+
+static void microbench_log_cb(enum sd_log_level_t level, const char* log, void* data) {
+    const MicrobenchParams* params = static_cast<const MicrobenchParams*>(data);
+    if (level < SD_LOG_WARN && !params->verbose) {
+        return;
+    }
+    fputs(log, stderr);
+}
+
+static void print_usage(const char* argv0) {
+    printf("%s\n", sd_get_system_info());
+    printf("Usage: %s [options]\n\n", argv0);
+    printf("Options:\n");
+    printf("  --filter REGEX        only run benchmarks whose name matches REGEX\n");
+    printf("  --list                print the benchmark names and exit\n");
+    printf("  --min-time SECONDS    time each benchmark for at least this long (default: 0.5)\n");
+    printf("  --min-runs N          and at least this many runs (default: 3)\n");
+    printf("  -t, --threads N       host and CPU backend threads (default: physical cores)\n");
+    printf("  --cpu                 run the graph benchmarks on the CPU backend instead of the best device\n");
+    printf("  -m, --model PATH      model file for the load benchmarks, may be repeated\n");
+    printf("  --format FORMAT       report format, one of [json, csv] (default: json)\n");
+    printf("  -o, --output PATH     path to write the report to (default: stdout)\n");
+    printf("  --baseline PATH       json report to compare against; regressions fail the run\n");
+    printf("  --tolerance FRACTION  slowdown against the baseline counted as a regression (default: 0.1)\n");
+    printf("  -v, --verbose         print library log lines\n");
+    printf("  -h, --help            show this help message and exit\n");
+}
+
+// -1 on an unknown option or missing value, 0 on --help, 1 otherwise.
+static int parse_args(int argc, const char* argv[], MicrobenchParams* params) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value      = [&](const char** out) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for %s\n", arg.c_str());
+                return false;
+            }
+            *out = argv[++i];
+            return true;
+        };
+        const char* v = nullptr;
+        if (arg == "-h" || arg == "--help") {
+            return 0;
+        } else if (arg == "--list") {
+            params->list = true;
+        } else if (arg == "--cpu") {
+            params->cpu = true;
+        } else if (arg == "-v" || arg == "--verbose") {
+            params->verbose = true;
+        } else if (arg == "--filter") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->filter = v;
+        } else if (arg == "--min-time") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->min_time = atof(v);
+        } else if (arg == "--min-runs") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->min_runs = atoi(v);
+        } else if (arg == "-t" || arg == "--threads") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->n_threads = atoi(v);
+        } else if (arg == "-m" || arg == "--model") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->model_paths.push_back(v);
+        } else if (arg == "--format") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->format = v;
+        } else if (arg == "-o" || arg == "--output") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->output_path = v;
+        } else if (arg == "--baseline") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->baseline_path = v;
+        } else if (arg == "--tolerance") {
+            if (!value(&v)) {
+                return -1;
+            }
+            params->tolerance = atof(v);
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            return -1;
+        }
+    }
+    if (params->format != "json" && params->format != "csv") {
+        fprintf(stderr, "error: invalid report format %s, must be one of [json, csv]\n", params->format.c_str());
+        return -1;
+    }
+    if (params->min_time < 0.0 || params->min_runs < 1 || params->tolerance < 0.0) {
+        fprintf(stderr, "error: --min-time and --tolerance must be >= 0 and --min-runs must be >= 1\n");
+        return -1;
+    }
+    if (params->n_threads <= 0) {
+        params->n_threads = sd_get_num_physical_cores();
+    }
+    return 1;
+}
+
+static void fill_uniform(float* data, size_t n, uint32_t seed) {
+    uint32_t state = seed * 2654435761u + 1u;
+    for (size_t i = 0; i < n; ++i) {
+        state   = state * 1664525u + 1013904223u;
+        data[i] = static_cast<float>(state >> 8) / static_cast<float>(1u << 24) - 0.5f;
+    }
+}
+
+static sd::Tensor<float> uniform_tensor(std::vector<int64_t> shape, uint32_t seed) {
+    sd::Tensor<float> tensor(std::move(shape));
+    fill_uniform(tensor.data(), static_cast<size_t>(tensor.numel()), seed);
+    return tensor;
+}
+
+// Owns a graph allocated on a backend; every leaf of its context is an input
+// filled with noise once, so runs time the compute alone.
+struct GraphCase {
+    ggml_backend_t backend = nullptr;
+    ggml_context* ctx      = nullptr;
+    ggml_gallocr_t allocr  = nullptr;
+    ggml_cgraph* gf        = nullptr;
+
+    ~GraphCase() {
+        if (allocr != nullptr) {
+            ggml_gallocr_free(allocr);
+        }
+        if (ctx != nullptr) {
+            ggml_free(ctx);
+        }
+    }
+};
+
+static bool setup_graph_case(ggml_backend_t backend,
+                             int n_threads,
+                             const std::function<ggml_tensor*(ggml_context*)>& build,
+                             double work,
+                             BenchCase* bench_case) {
+    auto graph_case     = std::make_shared<GraphCase>();
+    graph_case->backend = backend;
+
+    ggml_init_params params;
+    params.mem_size   = ggml_tensor_overhead() * 256 + ggml_graph_overhead();
+    params.mem_buffer = nullptr;
+    params.no_alloc   = true;
+    graph_case->ctx   = ggml_init(params);
+    if (graph_case->ctx == nullptr) {
+        return false;
+    }
+    ggml_tensor* out = build(graph_case->ctx);
+    if (out == nullptr) {
+        return false;
+    }
+    std::vector<ggml_tensor*> inputs;
+    for (ggml_tensor* t = ggml_get_first_tensor(graph_case->ctx); t != nullptr; t = ggml_get_next_tensor(graph_case->ctx, t)) {
+        if (t->op == GGML_OP_NONE && t->view_src == nullptr) {
+            ggml_set_input(t);
+            inputs.push_back(t);
+        }
+    }
+    graph_case->gf = ggml_new_graph(graph_case->ctx);
+    ggml_build_forward_expand(graph_case->gf, out);
+
+    graph_case->allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+    if (graph_case->allocr == nullptr || !ggml_gallocr_alloc_graph(graph_case->allocr, graph_case->gf)) {
+        return false;
+    }
+    uint32_t seed = 1;
+    for (ggml_tensor* input : inputs) {
+        std::vector<float> data(static_cast<size_t>(ggml_nelements(input)));
+        fill_uniform(data.data(), data.size(), seed++);
+        if (input->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(input, data.data(), 0, ggml_nbytes(input));
+        } else if (input->type == GGML_TYPE_F16) {
+            std::vector<ggml_fp16_t> half(data.size());
+            ggml_fp32_to_fp16_row(data.data(), half.data(), static_cast<int64_t>(data.size()));
+            ggml_backend_tensor_set(input, half.data(), 0, ggml_nbytes(input));
+        } else {
+            return false;
+        }
+    }
+    if (sd_backend_is_cpu(backend)) {
+        sd_backend_cpu_set_n_threads(backend, n_threads);
+    }
+
+    bench_case->work = work;
+    bench_case->run  = [graph_case]() {
+        if (ggml_backend_graph_compute(graph_case->backend, graph_case->gf) != GGML_STATUS_SUCCESS) {
+            return false;
+        }
+        ggml_backend_synchronize(graph_case->backend);
+        return true;
+    };
+    return true;
+}
+
+static void add_rng_benchmarks(std::vector<Benchmark>& benchmarks) {
+    // 16384 values are drawn on the calling thread; from 65536 on, Philox
+    // generates the next draw of the same size in the background, as it does
+    // between sampling steps
+    for (uint32_t n : {16384u, 262144u}) {
+        benchmarks.push_back({sd_format("randn/philox/%u", n), "Mvalue", [n](BenchCase* bench_case) {
+                                  auto rng = std::make_shared<PhiloxRNG>(42);
+                                  bench_case->work = n / 1e6;
+                                  bench_case->run  = [rng, n]() { return rng->randn(n).size() == n; };
+                                  return true;
+                              }});
+        benchmarks.push_back({sd_format("randn/mt19937/%u", n), "Mvalue", [n](BenchCase* bench_case) {
+                                  auto rng = std::make_shared<MT19937RNG>(42);
+                                  bench_case->work = n / 1e6;
+                                  bench_case->run  = [rng, n]() { return rng->randn(n).size() == n; };
+                                  return true;
+                              }});
+    }
+}
+
+static void add_tokenizer_benchmarks(std::vector<Benchmark>& benchmarks) {
+    static const char* prompt_text =
+        "a photograph of an astronaut riding a horse on the surface of the moon, highly detailed, "
+        "dramatic lighting, 35mm film grain, (masterpiece:1.2), best quality, intricate reflections "
+        "on the visor, Earth rising over the horizon, 8k uhd, award winning photo. ";
+    std::string text;
+    while (text.size() < 4096) {
+        text += prompt_text;
+    }
+
+    using Factory = std::function<std::shared_ptr<Tokenizer>()>;
+    const std::vector<std::pair<const char*, Factory>> tokenizers = {
+        {"clip", []() { return std::make_shared<CLIPTokenizer>(); }},
+        {"t5", []() { return std::make_shared<T5UniGramTokenizer>(false); }},
+        {"umt5", []() { return std::make_shared<T5UniGramTokenizer>(true); }},
+        {"qwen2", []() { return std::make_shared<Qwen2Tokenizer>(); }},
+        {"mistral", []() { return std::make_shared<MistralTokenizer>(); }},
+        {"gemma", []() { return std::make_shared<GemmaTokenizer>(); }},
+    };
+    for (const auto& [name, factory] : tokenizers) {
+        benchmarks.push_back({std::string("tokenize/") + name, "MB", [factory = factory, text](BenchCase* bench_case) {
+                                  std::shared_ptr<Tokenizer> tokenizer = factory();
+                                  bench_case->work                     = text.size() / 1e6;
+                                  bench_case->run                      = [tokenizer, text]() { return !tokenizer->encode(text).empty(); };
+                                  return true;
+                              }});
+    }
+}
+
+static void add_tiling_benchmarks(std::vector<Benchmark>& benchmarks) {
+    // the split and blend of a tiled VAE decode of a 1024x1024 image, with
+    // the decoder replaced by a fixed tile
+    benchmarks.push_back({"tiles/decode_1024x1024", "Mpixel", [](BenchCase* bench_case) {
+                              auto input       = std::make_shared<sd::Tensor<float>>(uniform_tensor({128, 128, 16, 1}, 1));
+                              auto output_tile = std::make_shared<sd::Tensor<float>>(uniform_tensor({256, 256, 3, 1}, 2));
+                              bench_case->work = 1024.0 * 1024.0 / 1e6;
+                              bench_case->run  = [input, output_tile]() {
+                                  sd::Tensor<float> output = process_tiles_2d(*input,
+                                                                              1024,
+                                                                              1024,
+                                                                              8,
+                                                                              32,
+                                                                              32,
+                                                                              0.5f,
+                                                                              false,
+                                                                              false,
+                                                                              [&](const sd::Tensor<float>&) { return *output_tile; },
+                                                                              true);
+                                  return !output.empty();
+                              };
+                              return true;
+                          }});
+}
+
+static void add_tensor_benchmarks(std::vector<Benchmark>& benchmarks) {
+    // a Flux 1024x1024 latent; work is the bytes each op reads and writes
+    const std::vector<int64_t> shape = {128, 128, 16, 1};
+    const double bytes               = 128.0 * 128.0 * 16.0 * sizeof(float) / 1e9;
+
+    struct TensorOp {
+        const char* name;
+        double passes;
+        std::function<bool(sd::Tensor<float>&, const sd::Tensor<float>&, const sd::Tensor<float>&)> run;
+    };
+    const std::vector<TensorOp> ops = {
+        {"add", 3.0, [](sd::Tensor<float>&, const sd::Tensor<float>& x, const sd::Tensor<float>& z) { return !(x + z).empty(); }},
+        {"scale", 2.0, [](sd::Tensor<float>&, const sd::Tensor<float>& x, const sd::Tensor<float>&) { return !(x * 0.5f).empty(); }},
+        {"axpby", 3.0, [](sd::Tensor<float>& y, const sd::Tensor<float>& x, const sd::Tensor<float>&) {
+             sd::ops::axpby(&y, 0.5, x, 0.5);
+             return true;
+         }},
+        {"axpbypcz", 4.0, [](sd::Tensor<float>& y, const sd::Tensor<float>& x, const sd::Tensor<float>& z) {
+             sd::ops::axpbypcz(&y, 0.5, x, 0.25, z, 0.25);
+             return true;
+         }},
+        {"sum", 1.0, [](sd::Tensor<float>&, const sd::Tensor<float>& x, const sd::Tensor<float>&) { return std::isfinite(x.sum()); }},
+    };
+    for (const TensorOp& op : ops) {
+        benchmarks.push_back({std::string("tensor/") + op.name, "GB", [shape, bytes, op](BenchCase* bench_case) {
+                                  auto y           = std::make_shared<sd::Tensor<float>>(uniform_tensor(shape, 1));
+                                  auto x           = std::make_shared<sd::Tensor<float>>(uniform_tensor(shape, 2));
+                                  auto z           = std::make_shared<sd::Tensor<float>>(uniform_tensor(shape, 3));
+                                  bench_case->work = op.passes * bytes;
+                                  bench_case->run  = [y, x, z, run = op.run]() { return run(*y, *x, *z); };
+                                  return true;
+                              }});
+    }
+}
+
+static void add_attention_benchmarks(std::vector<Benchmark>& benchmarks, ggml_backend_t backend, int n_threads) {
+    struct Shape {
+        const char* name;
+        int64_t L;
+        int64_t d_head;
+        int64_t n_head;
+    };
+    // self-attention of the largest blocks at typical sizes
+    const std::vector<Shape> shapes = {
+        {"sd15_512", 4096, 40, 8},
+        {"sdxl_1024", 4096, 64, 10},
+        {"flux_512", 1536, 128, 24},
+        {"flux_1024", 4608, 128, 24},
+    };
+    for (const Shape& shape : shapes) {
+        for (bool flash : {false, true}) {
+            std::string name = sd_format("attention/%s/%s", shape.name, flash ? "flash" : "softmax");
+            benchmarks.push_back({name, "GFLOP", [shape, flash, backend, n_threads](BenchCase* bench_case) {
+                                      double flops = 4.0 * shape.L * shape.L * shape.d_head * shape.n_head;
+                                      return setup_graph_case(
+                                          backend,
+                                          n_threads,
+                                          [&](ggml_context* ctx) {
+                                              ggml_tensor* q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, shape.d_head * shape.n_head, shape.L, 1);
+                                              ggml_tensor* k = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, shape.d_head * shape.n_head, shape.L, 1);
+                                              ggml_tensor* v = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, shape.d_head * shape.n_head, shape.L, 1);
+                                              return ggml_ext_attention_ext(ctx, backend, q, k, v, shape.n_head, nullptr, false, flash);
+                                          },
+                                          flops / 1e9,
+                                          bench_case);
+                                  }});
+        }
+    }
+}
+
+static void add_conv_benchmarks(std::vector<Benchmark>& benchmarks, ggml_backend_t backend, int n_threads) {
+    struct Shape {
+        const char* name;
+        int64_t W;
+        int64_t H;
+        int64_t C_in;
+        int64_t C_out;
+    };
+    // 3x3 convolutions of the UNet's first level and the VAE decoder
+    const std::vector<Shape> shapes = {
+        {"unet_64x64x320", 64, 64, 320, 320},
+        {"vae_128x128x512", 128, 128, 512, 512},
+        {"vae_512x512x256", 512, 512, 256, 256},
+    };
+    for (const Shape& shape : shapes) {
+        for (bool direct : {false, true}) {
+            std::string name = sd_format("conv2d/%s/%s", shape.name, direct ? "direct" : "im2col");
+            benchmarks.push_back({name, "GFLOP", [shape, direct, backend, n_threads](BenchCase* bench_case) {
+                                      double flops = 2.0 * shape.W * shape.H * shape.C_in * shape.C_out * 9.0;
+                                      return setup_graph_case(
+                                          backend,
+                                          n_threads,
+                                          [&](ggml_context* ctx) {
+                                              ggml_tensor* x = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, shape.W, shape.H, shape.C_in, 1);
+                                              ggml_tensor* w = ggml_new_tensor_4d(ctx, GGML_TYPE_F16, 3, 3, shape.C_in, shape.C_out);
+                                              ggml_tensor* b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, shape.C_out);
+                                              return ggml_ext_conv_2d(ctx, x, w, b, 1, 1, 1, 1, 1, 1, direct);
+                                          },
+                                          flops / 1e9,
+                                          bench_case);
+                                  }});
+        }
+    }
+}
+
+// Holds a host tensor for every tensor of a model file, so each run only
+// measures reading the file into them.
+struct LoadCase {
+    ggml_context* ctx            = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+    std::map<std::string, ggml_tensor*> tensors;
+
+    ~LoadCase() {
+        if (buffer != nullptr) {
+            ggml_backend_buffer_free(buffer);
+        }
+        if (ctx != nullptr) {
+            ggml_free(ctx);
+        }
+    }
+};
+
+static void add_load_benchmarks(std::vector<Benchmark>& benchmarks, const std::vector<std::string>& model_paths, int n_threads) {
+    for (const std::string& path : model_paths) {
+        for (bool use_mmap : {false, true}) {
+            std::string file_name = path.substr(path.find_last_of("/\\") + 1);
+            std::string name      = sd_format("load/%s/%s", file_name.c_str(), use_mmap ? "mmap" : "read");
+            benchmarks.push_back({name, "MB", [path, use_mmap, n_threads](BenchCase* bench_case) {
+                                      ModelLoader loader;
+                                      if (!loader.init_from_file(path)) {
+                                          LOG_ERROR("failed to read '%s'", path.c_str());
+                                          return false;
+                                      }
+                                      const auto& storages = loader.get_tensor_storage_map();
+
+                                      auto load_case = std::make_shared<LoadCase>();
+                                      ggml_init_params params;
+                                      params.mem_size   = ggml_tensor_overhead() * (storages.size() + 1);
+                                      params.mem_buffer = nullptr;
+                                      params.no_alloc   = true;
+                                      load_case->ctx    = ggml_init(params);
+                                      if (load_case->ctx == nullptr) {
+                                          return false;
+                                      }
+                                      double bytes = 0.0;
+                                      for (const auto& [tensor_name, storage] : storages) {
+                                          if (storage.n_dims > GGML_MAX_DIMS) {
+                                              continue;
+                                          }
+                                          ggml_tensor* tensor = ggml_new_tensor(load_case->ctx, storage.type, std::max(storage.n_dims, 1), storage.ne);
+                                          load_case->tensors[tensor_name] = tensor;
+                                          bytes += static_cast<double>(storage.nbytes_to_read());
+                                      }
+                                      load_case->buffer = ggml_backend_alloc_ctx_tensors_from_buft(load_case->ctx, ggml_backend_cpu_buffer_type());
+                                      if (load_case->buffer == nullptr) {
+                                          LOG_ERROR("failed to allocate %.2f MB for '%s'", bytes / (1024.0 * 1024.0), path.c_str());
+                                          return false;
+                                      }
+
+                                      bench_case->work = bytes / 1e6;
+                                      bench_case->run  = [load_case, path, use_mmap, n_threads]() {
+                                          ModelLoader run_loader;
+                                          run_loader.set_n_threads(n_threads);
+                                          return run_loader.init_from_file(path) &&
+                                                 run_loader.load_tensors(load_case->tensors, {}, use_mmap);
+                                      };
+                                      return true;
+                                  }});
+        }
+    }
+}
+
+static BenchResult run_benchmark(const Benchmark& benchmark, const MicrobenchParams& params) {
+    BenchResult result;
+    result.name = benchmark.name;
+    result.unit = benchmark.unit;
+
+    BenchCase bench_case;
+    if (!benchmark.setup(&bench_case) || !bench_case.run()) {
+        return result;
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::vector<double> times_ms;
+    double total_ms = 0.0;
+    while (static_cast<int>(times_ms.size()) < params.min_runs || total_ms < params.min_time * 1000.0) {
+        auto start = clock::now();
+        if (!bench_case.run()) {
+            return result;
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        times_ms.push_back(ms);
+        total_ms += ms;
+    }
+
+    std::vector<double> sorted_ms = times_ms;
+    std::sort(sorted_ms.begin(), sorted_ms.end());
+    result.success   = true;
+    result.runs      = static_cast<int>(times_ms.size());
+    result.min_ms    = sorted_ms.front();
+    result.mean_ms   = total_ms / times_ms.size();
+    result.median_ms = sorted_ms[sorted_ms.size() / 2];
+    result.rate      = result.median_ms > 0.0 ? bench_case.work / (result.median_ms / 1000.0) : 0.0;
+    return result;
+}
+
+// Names of the baseline results this run is slower on by more than the
+// tolerance, with the ratio of the rates.
+static std::vector<std::pair<std::string, double>> find_regressions(const std::vector<BenchResult>& results,
+                                                                    const json& baseline,
+                                                                    double tolerance) {
+    std::map<std::string, double> baseline_rates;
+    if (baseline.contains("results") && baseline["results"].is_array()) {
+        for (const json& entry : baseline["results"]) {
+            if (entry.value("success", false)) {
+                baseline_rates[entry.value("name", "")] = entry.value("rate", 0.0);
+            }
+        }
+    }
+    std::vector<std::pair<std::string, double>> regressions;
+    for (const BenchResult& result : results) {
+        auto it = baseline_rates.find(result.name);
+        if (it == baseline_rates.end() || it->second <= 0.0) {
+            continue;
+        }
+        double ratio = result.success ? result.rate / it->second : 0.0;
+        if (ratio < 1.0 - tolerance) {
+            regressions.push_back({result.name, ratio});
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, const char* argv[]) {
+    MicrobenchParams params;
+    int parsed = parse_args(argc, argv, &params);
+    if (parsed <= 0) {
+        print_usage(argv[0]);
+        return parsed == 0 ? 0 : 1;
+    }
+    sd_set_log_callback(microbench_log_cb, &params);
+    sd::TaskPool::instance().reserve_threads(params.n_threads);
+
+    ggml_backend_t backend = params.cpu ? sd_backend_cpu_init() : nullptr;
+    if (backend == nullptr) {
+        ggml_backend_load_all();
+        backend = ggml_backend_init_best();
+    }
+    if (backend == nullptr) {
+        fprintf(stderr, "error: no ggml backend available\n");
+        return 1;
+    }
+
+    std::vector<Benchmark> benchmarks;
+    add_rng_benchmarks(benchmarks);
+    add_tokenizer_benchmarks(benchmarks);
+    add_tiling_benchmarks(benchmarks);
+    add_tensor_benchmarks(benchmarks);
+    add_attention_benchmarks(benchmarks, backend, params.n_threads);
+    add_conv_benchmarks(benchmarks, backend, params.n_threads);
+    add_load_benchmarks(benchmarks, params.model_paths, params.n_threads);
+
+    std::regex filter;
+    try {
+        filter = std::regex(params.filter.empty() ? ".*" : params.filter);
+    } catch (const std::regex_error&) {
+        fprintf(stderr, "error: invalid --filter regex '%s'\n", params.filter.c_str());
+        ggml_backend_free(backend);
+        return 1;
+    }
+
+    json report;
+    report["version"]     = std::string(sd_version()) + ", commit " + sd_commit();
+    report["system_info"] = sd_get_system_info();
+    report["backend"]     = ggml_backend_name(backend);
+    report["n_threads"]   = params.n_threads;
+    report["results"]     = json::array();
+
+    std::ostringstream csv;
+    csv << "name,unit,success,runs,min_ms,mean_ms,median_ms,rate\n";
+
+    std::vector<BenchResult> results;
+    bool all_success = true;
+    for (const Benchmark& benchmark : benchmarks) {
+        if (!std::regex_search(benchmark.name, filter)) {
+            continue;
+        }
+        if (params.list) {
+            printf("%s\n", benchmark.name.c_str());
+            continue;
+        }
+        BenchResult result = run_benchmark(benchmark, params);
+        if (result.success) {
+            fprintf(stderr, "%-40s %10.3f ms %12.2f %s/s (%d runs)\n",
+                    result.name.c_str(),
+                    result.median_ms,
+                    result.rate,
+                    result.unit.c_str(),
+                    result.runs);
+        } else {
+            fprintf(stderr, "%-40s failed\n", result.name.c_str());
+            all_success = false;
+        }
+
+        json entry;
+        entry["name"]      = result.name;
+        entry["unit"]      = result.unit;
+        entry["success"]   = result.success;
+        entry["runs"]      = result.runs;
+        entry["min_ms"]    = result.min_ms;
+        entry["mean_ms"]   = result.mean_ms;
+        entry["median_ms"] = result.median_ms;
+        entry["rate"]      = result.rate;
+        report["results"].push_back(entry);
+
+        csv << result.name << "," << result.unit << "," << (result.success ? 1 : 0) << "," << result.runs << ","
+            << result.min_ms << "," << result.mean_ms << "," << result.median_ms << "," << result.rate << "\n";
+        results.push_back(std::move(result));
+    }
+    ggml_backend_free(backend);
+    if (params.list) {
+        return 0;
+    }
+
+    std::string output = params.format == "csv" ? csv.str() : report.dump(2) + "\n";
+    if (params.output_path.empty()) {
+        std::cout << output;
+    } else {
+        std::ofstream file(params.output_path, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.output_path.c_str());
+            return 1;
+        }
+        file << output;
+    }
+
+    if (!params.baseline_path.empty()) {
+        std::ifstream file(params.baseline_path);
+        json baseline = file ? json::parse(file, nullptr, false) : json();
+        if (baseline.is_discarded() || !baseline.is_object()) {
+            fprintf(stderr, "error: failed to read baseline '%s'\n", params.baseline_path.c_str());
+            return 1;
+        }
+        auto regressions = find_regressions(results, baseline, params.tolerance);
+        for (const auto& [name, ratio] : regressions) {
+            fprintf(stderr, "regression: %s runs at %.1f%% of the baseline rate\n", name.c_str(), ratio * 100.0);
+        }
+        if (!regressions.empty()) {
+            return 2;
+        }
+    }
+
+    return all_success ? 0 : 1;
+}
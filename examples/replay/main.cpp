@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <json.hpp>
+
+#include "stable-diffusion.h"
+
+#include "common/common.h"
+#include "common/media_io.h"
+#include "common/resource_owners.hpp"
+
+namespace fs = std::filesystem;
+using json   = nlohmann::json;
+
+// PSNR of identical images; JSON has no infinity
+static constexpr double IDENTICAL_PSNR = 100.0;
+
+struct SDReplayParams {
+    std::string matrix_path;
+    std::string references_dir = "references";
+    float min_psnr             = 35.f;
+    float min_ssim             = 0.95f;
+    std::string format         = "json";
+    std::string output_path;
+
+    bool update      = false;
+    bool verbose     = false;
+    bool color       = false;
+    bool normal_exit = false;
+
+    ArgOptions get_options() {
+        ArgOptions options;
+
+        options.string_options = {
+            {"",
+             "--matrix",
+             "path to the JSON list of cases to replay",
+             0,
+             &matrix_path},
+            {"",
+             "--references",
+             "directory holding the reference images (default: references)",
+             0,
+             &references_dir},
+            {"",
+             "--format",
+             "report format, one of [json, csv] (default: json)",
+             0,
+             &format},
+            {"-o",
+             "--output",
+             "path to write the report to (default: stdout)",
+             0,
+             &output_path},
+        };
+
+        options.float_options = {
+            {"",
+             "--min-psnr",
+             "lowest PSNR in dB an image may have against its reference (default: 35)",
+             &min_psnr},
+            {"",
+             "--min-ssim",
+             "lowest SSIM an image may have against its reference (default: 0.95)",
+             &min_ssim},
+        };
+
+        options.bool_options = {
+            {"",
+             "--update",
+             "write the outputs as the new references instead of comparing",
+             true, &update},
+            {"-v",
+             "--verbose",
+             "print extra info",
+             true, &verbose},
+            {"",
+             "--color",
+             "colors the logging tags according to level",
+             true, &color},
+        };
+
+        auto on_help_arg = [&](int argc, const char** argv, int index, bool& valid) {
+            normal_exit = true;
+            valid       = true;
+            return -1;
+        };
+
+        options.manual_options = {
+            {"-h",
+             "--help",
+             "show this help message and exit",
+             on_help_arg},
+        };
+
+        return options;
+    }
+
+    bool validate() {
+        if (matrix_path.empty()) {
+            LOG_ERROR("error: the following arguments are required: --matrix");
+            return false;
+        }
+        if (format != "json" && format != "csv") {
+            LOG_ERROR("error: invalid report format %s, must be one of [json, csv]", format.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// One entry of the matrix. params holds generation parameters in the JSON
+// form the server takes (prompt, seed, sample_params, ...); they apply on top
+// of the generation options of the command line. model, when set, replaces
+// --model for the case.
+struct ReplayCase {
+    std::string name;
+    std::string model;
+    json params = json::object();
+};
+
+struct ImageComparison {
+    double psnr  = 0.0;
+    double ssim  = 0.0;
+    bool matched = false;
+    bool missing = false;
+    bool resized = false;
+};
+
+// What one case produced, and how it compares to its references.
+struct ReplayResult {
+    std::string name;
+    bool success        = false;
+    bool params_changed = false;  // the references were made with other parameters
+    double total_ms     = 0.0;
+    double reference_ms = 0.0;  // total_ms recorded with the references
+    std::string params;
+    std::vector<ImageComparison> images;
+
+    bool passed() const {
+        if (!success) {
+            return false;
+        }
+        for (const ImageComparison& image : images) {
+            if (!image.matched) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+static void replay_log_cb(enum sd_log_level_t level, const char* log, void* data) {
+    SDReplayParams* params = (SDReplayParams*)data;
+    log_print(level, log, params->verbose, params->color);
+}
+
+static bool load_matrix(const std::string& path, std::vector<ReplayCase>* cases) {
+    std::ifstream file(path);
+    if (!file) {
+        LOG_ERROR("failed to open matrix '%s'", path.c_str());
+        return false;
+    }
+    json root;
+    try {
+        root = json::parse(file);
+    } catch (const std::exception& e) {
+        LOG_ERROR("failed to parse matrix '%s': %s", path.c_str(), e.what());
+        return false;
+    }
+    const json& entries = root.is_object() && root.contains("cases") ? root["cases"] : root;
+    if (!entries.is_array() || entries.empty()) {
+        LOG_ERROR("matrix '%s' has no cases", path.c_str());
+        return false;
+    }
+    for (const json& entry : entries) {
+        ReplayCase replay_case;
+        if (!entry.is_object() || !entry.contains("name") || !entry["name"].is_string()) {
+            LOG_ERROR("every matrix case needs a name");
+            return false;
+        }
+        replay_case.name = entry["name"];
+        if (replay_case.name.find_first_of("/\\") != std::string::npos) {
+            LOG_ERROR("case name '%s' names the reference files and cannot hold a path", replay_case.name.c_str());
+            return false;
+        }
+        if (entry.contains("model") && entry["model"].is_string()) {
+            replay_case.model = entry["model"];
+        }
+        if (entry.contains("params")) {
+            replay_case.params = entry["params"];
+        }
+        for (const ReplayCase& other : *cases) {
+            if (other.name == replay_case.name) {
+                LOG_ERROR("case name '%s' is used twice", replay_case.name.c_str());
+                return false;
+            }
+        }
+        cases->push_back(std::move(replay_case));
+    }
+    return true;
+}
+
+// Rec. 601 luma of 8-bit RGB pixels, as SSIM is usually taken on
+static std::vector<double> luma_of(const uint8_t* data, int width, int height, int channels) {
+    std::vector<double> luma(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        const uint8_t* px = data + i * channels;
+        luma[i]           = channels >= 3 ? 0.299 * px[0] + 0.587 * px[1] + 0.114 * px[2] : px[0];
+    }
+    return luma;
+}
+
+static double psnr_of(const uint8_t* a, const uint8_t* b, size_t bytes) {
+    double sse = 0.0;
+    for (size_t i = 0; i < bytes; ++i) {
+        double d = static_cast<double>(a[i]) - b[i];
+        sse += d * d;
+    }
+    if (sse == 0.0) {
+        return IDENTICAL_PSNR;
+    }
+    double mse = sse / bytes;
+    return std::min(IDENTICAL_PSNR, 10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+// Mean SSIM over 8x8 windows with a stride of 4, on luma.
+static double ssim_of(const std::vector<double>& a, const std::vector<double>& b, int width, int height) {
+    const int window = 8;
+    const int stride = 4;
+    const double c1  = (0.01 * 255) * (0.01 * 255);
+    const double c2  = (0.03 * 255) * (0.03 * 255);
+    if (width < window || height < window) {
+        return a == b ? 1.0 : 0.0;
+    }
+    double sum  = 0.0;
+    int windows = 0;
+    for (int y = 0; y + window <= height; y += stride) {
+        for (int x = 0; x + window <= width; x += stride) {
+            double mean_a = 0.0;
+            double mean_b = 0.0;
+            for (int wy = 0; wy < window; ++wy) {
+                for (int wx = 0; wx < window; ++wx) {
+                    size_t i = static_cast<size_t>(y + wy) * width + x + wx;
+                    mean_a += a[i];
+                    mean_b += b[i];
+                }
+            }
+            const double n = window * window;
+            mean_a /= n;
+            mean_b /= n;
+            double var_a = 0.0;
+            double var_b = 0.0;
+            double cov   = 0.0;
+            for (int wy = 0; wy < window; ++wy) {
+                for (int wx = 0; wx < window; ++wx) {
+                    size_t i  = static_cast<size_t>(y + wy) * width + x + wx;
+                    double da = a[i] - mean_a;
+                    double db = b[i] - mean_b;
+                    var_a += da * da;
+                    var_b += db * db;
+                    cov += da * db;
+                }
+            }
+            var_a /= n - 1;
+            var_b /= n - 1;
+            cov /= n - 1;
+            sum += ((2 * mean_a * mean_b + c1) * (2 * cov + c2)) /
+                   ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+            windows++;
+        }
+    }
+    return sum / windows;
+}
+
+static std::string reference_image_path(const SDReplayParams& params, const std::string& name, size_t index) {
+    return (fs::path(params.references_dir) / (name + "_" + std::to_string(index) + ".png")).string();
+}
+
+static std::string reference_info_path(const SDReplayParams& params, const std::string& name) {
+    return (fs::path(params.references_dir) / (name + ".json")).string();
+}
+
+static ImageComparison compare_to_reference(const SDReplayParams& params, const sd_image_t& image, const std::string& path) {
+    ImageComparison comparison;
+    if (!fs::exists(path)) {
+        comparison.missing = true;
+        return comparison;
+    }
+    int width  = 0;
+    int height = 0;
+    FreeUniquePtr<uint8_t> reference(load_image_from_file(path.c_str(), width, height, 0, 0, image.channel));
+    if (reference == nullptr) {
+        comparison.missing = true;
+        return comparison;
+    }
+    if (width != static_cast<int>(image.width) || height != static_cast<int>(image.height)) {
+        comparison.resized = true;
+        return comparison;
+    }
+    size_t bytes       = static_cast<size_t>(width) * height * image.channel;
+    comparison.psnr    = psnr_of(image.data, reference.get(), bytes);
+    comparison.ssim    = ssim_of(luma_of(image.data, width, height, image.channel),
+                                 luma_of(reference.get(), width, height, image.channel),
+                                 width,
+                                 height);
+    comparison.matched = comparison.psnr >= params.min_psnr && comparison.ssim >= params.min_ssim;
+    return comparison;
+}
+
+static bool write_references(const SDReplayParams& params, const ReplayResult& result, const SDImageVec& images) {
+    std::error_code ec;
+    fs::create_directories(params.references_dir, ec);
+    for (size_t i = 0; i < images.size(); ++i) {
+        const sd_image_t& image = images[i];
+        std::string path        = reference_image_path(params, result.name, i);
+        if (image.data == nullptr || !write_image_to_file(path, image.data, image.width, image.height, image.channel)) {
+            LOG_ERROR("failed to write reference '%s'", path.c_str());
+            return false;
+        }
+    }
+    json info;
+    info["params"]   = result.params;
+    info["images"]   = images.size();
+    info["total_ms"] = result.total_ms;
+    std::ofstream file(reference_info_path(params, result.name), std::ios::trunc);
+    if (!file) {
+        LOG_ERROR("failed to write '%s'", reference_info_path(params, result.name).c_str());
+        return false;
+    }
+    file << info.dump(2) << "\n";
+    return true;
+}
+
+static void read_reference_info(const SDReplayParams& params, ReplayResult* result) {
+    std::ifstream file(reference_info_path(params, result->name));
+    if (!file) {
+        return;
+    }
+    try {
+        json info = json::parse(file);
+        if (info.contains("params") && info["params"].is_string()) {
+            result->params_changed = info["params"].get<std::string>() != result->params;
+        }
+        if (info.contains("total_ms") && info["total_ms"].is_number()) {
+            result->reference_ms = info["total_ms"];
+        }
+    } catch (const std::exception& e) {
+        LOG_WARN("ignoring unreadable reference info of '%s': %s", result->name.c_str(), e.what());
+    }
+}
+
+static json result_to_json(const ReplayResult& result) {
+    json j;
+    j["name"]           = result.name;
+    j["success"]        = result.success;
+    j["passed"]         = result.passed();
+    j["params_changed"] = result.params_changed;
+    j["total_ms"]       = result.total_ms;
+    j["reference_ms"]   = result.reference_ms;
+    j["params"]         = result.params;
+    j["images"]         = json::array();
+    for (const ImageComparison& image : result.images) {
+        j["images"].push_back({{"psnr", image.psnr},
+                               {"ssim", image.ssim},
+                               {"matched", image.matched},
+                               {"missing", image.missing},
+                               {"resized", image.resized}});
+    }
+    return j;
+}
+
+void print_usage(int argc, const char* argv[], const std::vector<ArgOptions>& options_list) {
+    std::cout << version_string() << "\n";
+    std::cout << "Usage: " << argv[0] << " --matrix cases.json [options]\n\n";
+    std::cout << "Replay Options:\n";
+    options_list[0].print();
+    std::cout << "\nContext Options:\n";
+    options_list[1].print();
+    std::cout << "\nGeneration Options:\n";
+    options_list[2].print();
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--version") {
+        std::cout << version_string() << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    SDReplayParams replay_params;
+    SDContextParams ctx_params;
+    SDGenerationParams gen_params;
+
+    std::vector<ArgOptions> options_vec = {replay_params.get_options(), ctx_params.get_options(), gen_params.get_options()};
+    if (!parse_options(argc, argv, options_vec)) {
+        print_usage(argc, argv, options_vec);
+        return replay_params.normal_exit ? 0 : 1;
+    }
+    if (!replay_params.validate()) {
+        print_usage(argc, argv, options_vec);
+        return 1;
+    }
+
+    sd_set_log_callback(replay_log_cb, (void*)&replay_params);
+    log_verbose = replay_params.verbose;
+    log_color   = replay_params.color;
+
+    std::vector<ReplayCase> cases;
+    if (!load_matrix(replay_params.matrix_path, &cases)) {
+        return 1;
+    }
+
+    LOG_DEBUG("version: %s", version_string().c_str());
+    LOG_DEBUG("%s", sd_get_system_info());
+
+    json report;
+    report["version"]     = version_string();
+    report["system_info"] = sd_get_system_info();
+    report["min_psnr"]    = replay_params.min_psnr;
+    report["min_ssim"]    = replay_params.min_ssim;
+    report["results"]     = json::array();
+
+    std::ostringstream csv;
+    csv << "name,image,success,passed,params_changed,total_ms,reference_ms,psnr,ssim\n";
+
+    // a context is kept while consecutive cases use the same model
+    SDCtxPtr sd_ctx;
+    std::string loaded_model;
+    bool all_success = true;
+    bool all_passed  = true;
+    for (const ReplayCase& replay_case : cases) {
+        ReplayResult result;
+        result.name = replay_case.name;
+
+        SDContextParams case_ctx_params = ctx_params;
+        if (!replay_case.model.empty()) {
+            case_ctx_params.model_path = replay_case.model;
+        }
+        SDGenerationParams case_params = gen_params;
+        if (!case_params.from_json_str(replay_case.params.dump()) ||
+            !case_ctx_params.resolve_and_validate(IMG_GEN) ||
+            !case_params.resolve_and_validate(IMG_GEN, case_ctx_params.lora_model_dir, case_ctx_params.hires_upscalers_dir)) {
+            LOG_ERROR("invalid parameters for case '%s'", replay_case.name.c_str());
+            all_success = false;
+            report["results"].push_back(result_to_json(result));
+            continue;
+        }
+        if (case_params.seed < 0) {
+            LOG_ERROR("case '%s' needs a fixed seed to replay", replay_case.name.c_str());
+            all_success = false;
+            report["results"].push_back(result_to_json(result));
+            continue;
+        }
+
+        std::string ctx_key = case_ctx_params.to_string();
+        if (sd_ctx == nullptr || ctx_key != loaded_model) {
+            sd_ctx.reset();
+            sd_ctx_params_t sd_ctx_params = case_ctx_params.to_sd_ctx_params_t(false);
+            sd_ctx.reset(new_sd_ctx(&sd_ctx_params));
+            loaded_model = ctx_key;
+            if (sd_ctx == nullptr) {
+                LOG_ERROR("new_sd_ctx_t failed for case '%s'", replay_case.name.c_str());
+                all_success = false;
+                report["results"].push_back(result_to_json(result));
+                continue;
+            }
+        }
+        if (case_params.sample_params.sample_method == SAMPLE_METHOD_COUNT) {
+            case_params.sample_params.sample_method = sd_get_default_sample_method(sd_ctx.get());
+        }
+        if (case_params.sample_params.scheduler == SCHEDULER_COUNT) {
+            case_params.sample_params.scheduler = sd_get_default_scheduler(sd_ctx.get(), case_params.sample_params.sample_method);
+        }
+        if (!case_params.initialize_cache_params()) {
+            return 1;
+        }
+
+        sd_img_gen_params_t img_gen_params = case_params.to_sd_img_gen_params_t();
+        FreeUniquePtr<char> params_str(sd_img_gen_params_to_str(&img_gen_params));
+        result.params = params_str != nullptr ? params_str.get() : "";
+        LOG_INFO("replay '%s'", replay_case.name.c_str());
+
+        auto t0 = std::chrono::steady_clock::now();
+        SDImageVec images;
+        images.adopt(generate_image(sd_ctx.get(), &img_gen_params), case_params.batch_count);
+        auto t1 = std::chrono::steady_clock::now();
+
+        result.success  = static_cast<bool>(images);
+        result.total_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (!result.success) {
+            LOG_ERROR("generate failed for case '%s'", replay_case.name.c_str());
+            all_success = false;
+        } else if (replay_params.update) {
+            if (!write_references(replay_params, result, images)) {
+                all_success = false;
+            }
+            LOG_INFO("'%s': %zu references written, %.2f ms", result.name.c_str(), images.size(), result.total_ms);
+        } else {
+            read_reference_info(replay_params, &result);
+            if (result.params_changed) {
+                LOG_WARN("'%s': references were made with other parameters, rerun with --update if that is intended",
+                         result.name.c_str());
+            }
+            for (size_t i = 0; i < images.size(); ++i) {
+                ImageComparison comparison;
+                if (images[i].data != nullptr) {
+                    comparison = compare_to_reference(replay_params, images[i], reference_image_path(replay_params, result.name, i));
+                }
+                if (comparison.missing) {
+                    LOG_ERROR("'%s' image %zu: no reference, create one with --update", result.name.c_str(), i);
+                    all_success = false;
+                } else if (comparison.resized) {
+                    LOG_ERROR("'%s' image %zu: size differs from its reference", result.name.c_str(), i);
+                    all_success = false;
+                } else {
+                    LOG_INFO("'%s' image %zu: PSNR %.2f dB, SSIM %.4f%s",
+                             result.name.c_str(),
+                             i,
+                             comparison.psnr,
+                             comparison.ssim,
+                             comparison.matched ? "" : " (below threshold)");
+                }
+                result.images.push_back(comparison);
+            }
+            if (result.reference_ms > 0.0) {
+                LOG_INFO("'%s': %.2f ms, %.2fx the reference run", result.name.c_str(), result.total_ms, result.reference_ms / result.total_ms);
+            }
+            all_passed = all_passed && result.passed();
+        }
+
+        report["results"].push_back(result_to_json(result));
+        for (size_t i = 0; i < std::max<size_t>(1, result.images.size()); ++i) {
+            const ImageComparison image = i < result.images.size() ? result.images[i] : ImageComparison();
+            csv << result.name << "," << i << "," << (result.success ? 1 : 0) << "," << (result.passed() ? 1 : 0) << ","
+                << (result.params_changed ? 1 : 0) << "," << result.total_ms << "," << result.reference_ms << ","
+                << image.psnr << "," << image.ssim << "\n";
+        }
+    }
+
+    std::string output = replay_params.format == "csv" ? csv.str() : report.dump(2) + "\n";
+    if (replay_params.output_path.empty()) {
+        std::cout << output;
+    } else {
+        std::ofstream file(replay_params.output_path, std::ios::binary);
+        if (!file) {
+            LOG_ERROR("failed to open '%s' for writing", replay_params.output_path.c_str());
+            return 1;
+        }
+        file << output;
+    }
+
+    if (!all_success) {
+        return 1;
+    }
+    return all_passed ? 0 : 2;
+}
@@ -2,8 +2,30 @@
 
 #include "async_jobs.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iomanip>
+#include <map>
 #include <sstream>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // _WIN32
+
+#include "context_pool.h"
+#include "metrics.h"
 
 #include "common/log.h"
 #include "common/media_io.h"
@@ -37,6 +59,346 @@ const char* async_job_status_name(AsyncJobStatus status) {
     }
 }
 
+const char* async_job_priority_name(AsyncJobPriority priority) {
+    return priority == AsyncJobPriority::Batch ? "batch" : "interactive";
+}
+
+bool parse_async_job_priority(const std::string& name, AsyncJobPriority& priority) {
+    if (name == "interactive") {
+        priority = AsyncJobPriority::Interactive;
+        return true;
+    }
+    if (name == "batch") {
+        priority = AsyncJobPriority::Batch;
+        return true;
+    }
+    return false;
+}
+
+AsyncJobResult::~AsyncJobResult() {
+    // unmapped first, since Windows cannot remove a mapped file
+    if (mapped != nullptr) {
+#if defined(_WIN32)
+        UnmapViewOfFile(mapped);
+#else
+        munmap(mapped, size);
+#endif
+    }
+    if (!path.empty()) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+bool AsyncJobResult::read(size_t offset, size_t length, std::vector<uint8_t>& out) const {
+    if (offset > size) {
+        return false;
+    }
+    length = std::min(length, size - offset);
+    if (path.empty()) {
+        out.insert(out.end(), bytes.begin() + offset, bytes.begin() + offset + length);
+        return true;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file || !file.seekg(static_cast<std::streamoff>(offset))) {
+        return false;
+    }
+    size_t start = out.size();
+    out.resize(start + length);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(out.data() + start), static_cast<std::streamsize>(length)));
+}
+
+const uint8_t* AsyncJobResult::data() const {
+    if (path.empty()) {
+        return bytes.data();
+    }
+    std::call_once(map_once, [this]() {
+        if (size == 0) {
+            return;
+        }
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file != INVALID_HANDLE_VALUE) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+            if (mapping != nullptr) {
+                // the view keeps the mapping object alive
+                mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr != MAP_FAILED) {
+                // downloads read the file front to back
+                posix_madvise(addr, size, POSIX_MADV_SEQUENTIAL);
+                mapped = addr;
+            }
+        }
+#endif
+        if (mapped == nullptr) {
+            LOG_WARN("failed to map job result '%s', reading it instead", path.c_str());
+        }
+    });
+    return static_cast<const uint8_t*>(mapped);
+}
+
+static std::string async_job_result_path(const AsyncJobManager& manager,
+                                         const std::string& job_id,
+                                         size_t index,
+                                         const std::string& extension) {
+    return (std::filesystem::path(manager.result_dir) /
+            (job_id + "_" + std::to_string(index) + "." + extension))
+        .string();
+}
+
+AsyncJobResultPtr make_async_job_result(const AsyncJobManager& manager,
+                                        const std::string& job_id,
+                                        size_t index,
+                                        const std::string& extension,
+                                        std::string mime_type,
+                                        std::vector<uint8_t> bytes) {
+    auto result       = std::make_shared<AsyncJobResult>();
+    result->mime_type = std::move(mime_type);
+    result->size      = bytes.size();
+    if (!manager.result_dir.empty()) {
+        std::string path = async_job_result_path(manager, job_id, index, extension);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (file && file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()))) {
+            result->path = std::move(path);
+            return result;
+        }
+        LOG_WARN("failed to write job result '%s', keeping it in memory", path.c_str());
+    }
+    result->bytes = std::move(bytes);
+    return result;
+}
+
+bool AsyncJobResultCache::get(const std::string& key, std::vector<AsyncJobResultPtr>& results) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses++;
+        return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    results = it->second->results;
+    hits++;
+    return true;
+}
+
+void AsyncJobResultCache::put(const std::string& key, const std::vector<AsyncJobResultPtr>& results) {
+    if (!enabled() || results.empty()) {
+        return;
+    }
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    Entry entry;
+    entry.key     = key;
+    entry.results = results;
+    for (const auto& result : results) {
+        entry.bytes += result->size;
+    }
+    if (entry.bytes > budget_bytes) {
+        return;
+    }
+    bytes += entry.bytes;
+    entries.push_front(std::move(entry));
+    index[key] = entries.begin();
+    evict_to_budget();
+}
+
+void AsyncJobResultCache::evict_to_budget() {
+    while (bytes > budget_bytes && !entries.empty()) {
+        bytes -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+// Samples kept per curve. The oldest goes first, so a curve follows changes
+// such as a model reloaded with other options.
+static const size_t MEMORY_CURVE_SAMPLES = 16;
+
+void AsyncJobMemoryEstimator::add_sample(std::vector<Sample>& samples, double pixels, uint64_t bytes) {
+    if (pixels <= 0.0 || bytes == 0) {
+        return;
+    }
+    for (Sample& sample : samples) {
+        if (sample.pixels == pixels) {
+            sample.bytes = bytes;
+            return;
+        }
+    }
+    if (samples.size() >= MEMORY_CURVE_SAMPLES) {
+        samples.erase(samples.begin());
+    }
+    samples.push_back({pixels, bytes});
+}
+
+uint64_t AsyncJobMemoryEstimator::predict(const std::vector<Sample>& samples, double pixels) {
+    if (samples.empty() || pixels <= 0.0) {
+        return 0;
+    }
+    double exponent = 1.0;
+    if (samples.size() >= 2) {
+        double mean_x = 0.0;
+        double mean_y = 0.0;
+        for (const Sample& sample : samples) {
+            mean_x += std::log(sample.pixels);
+            mean_y += std::log(static_cast<double>(sample.bytes));
+        }
+        mean_x /= static_cast<double>(samples.size());
+        mean_y /= static_cast<double>(samples.size());
+        double sxx = 0.0;
+        double sxy = 0.0;
+        for (const Sample& sample : samples) {
+            double dx = std::log(sample.pixels) - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (std::log(static_cast<double>(sample.bytes)) - mean_y);
+        }
+        if (sxx > 1e-6) {
+            exponent = std::min(2.0, std::max(1.0, sxy / sxx));
+        }
+    }
+    // Anchored at the sample nearest in size, so the fixed part of the buffers
+    // only matters for the distance the curve has to extrapolate.
+    const Sample* anchor = &samples[0];
+    for (const Sample& sample : samples) {
+        if (std::fabs(std::log(sample.pixels / pixels)) < std::fabs(std::log(anchor->pixels / pixels))) {
+            anchor = &sample;
+        }
+    }
+    return static_cast<uint64_t>(static_cast<double>(anchor->bytes) * std::pow(pixels / anchor->pixels, exponent));
+}
+
+void AsyncJobMemoryEstimator::observe(const std::string& key, double pixels, uint64_t sampling_bytes, uint64_t vae_bytes) {
+    Curve& curve = curves[key];
+    add_sample(curve.sampling, pixels, sampling_bytes);
+    add_sample(curve.vae, pixels, vae_bytes);
+}
+
+void AsyncJobMemoryEstimator::estimate(const std::string& key, double pixels, uint64_t& sampling_bytes, uint64_t& vae_bytes) const {
+    sampling_bytes = 0;
+    vae_bytes      = 0;
+    auto it        = curves.find(key);
+    if (it == curves.end()) {
+        return;
+    }
+    sampling_bytes = predict(it->second.sampling, pixels);
+    vae_bytes      = predict(it->second.vae, pixels);
+}
+
+static SDGenerationParams& async_job_gen_params(AsyncGenerationJob& job) {
+    return job.kind == AsyncJobKind::VidGen ? job.vid_gen.gen_params : job.img_gen.gen_params;
+}
+
+static const SDGenerationParams& async_job_gen_params(const AsyncGenerationJob& job) {
+    return job.kind == AsyncJobKind::VidGen ? job.vid_gen.gen_params : job.img_gen.gen_params;
+}
+
+static std::string async_job_memory_key(const AsyncGenerationJob& job) {
+    return job.kind == AsyncJobKind::VidGen ? "vid_gen:" + job.vid_gen.model_path : "img_gen:" + job.img_gen.model_path;
+}
+
+// Output pixels over all frames and images, at the upscaled size when hires
+// fix (or the LTX latent upscale) is on, since that pass has the peak.
+static double async_job_memory_pixels(const AsyncGenerationJob& job) {
+    const SDGenerationParams& gen_params = async_job_gen_params(job);
+    double width                         = gen_params.width;
+    double height                        = gen_params.height;
+    if (gen_params.hires_enabled) {
+        if (gen_params.hires_width > 0 && gen_params.hires_height > 0) {
+            width  = gen_params.hires_width;
+            height = gen_params.hires_height;
+        } else {
+            width *= gen_params.hires_scale;
+            height *= gen_params.hires_scale;
+        }
+    }
+    if (width <= 0.0 || height <= 0.0) {
+        return 0.0;
+    }
+    int count = job.kind == AsyncJobKind::VidGen ? gen_params.video_frames : gen_params.batch_count;
+    return width * height * std::max(1, count);
+}
+
+bool admit_async_job_memory(AsyncJobManager& manager, AsyncGenerationJob& job, std::string& error_message) {
+    if (!manager.memory.enabled()) {
+        return true;
+    }
+    SDGenerationParams& gen_params = async_job_gen_params(job);
+    uint64_t sampling_bytes        = 0;
+    uint64_t vae_bytes             = 0;
+    manager.memory.estimate(async_job_memory_key(job), async_job_memory_pixels(job), sampling_bytes, vae_bytes);
+    const uint64_t budget_mb = manager.memory.budget_bytes / (1024 * 1024);
+    if (sampling_bytes > manager.memory.budget_bytes) {
+        error_message = "request needs about " + std::to_string(sampling_bytes / (1024 * 1024)) +
+                        " MiB of compute buffers to sample, over the budget of " + std::to_string(budget_mb) + " MiB";
+        return false;
+    }
+    if (!gen_params.vae_tiling_params.enabled && vae_bytes > manager.memory.budget_bytes) {
+        LOG_INFO("enabling VAE tiling for a job whose decode needs about %llu MiB",
+                 static_cast<unsigned long long>(vae_bytes / (1024 * 1024)));
+        gen_params.vae_tiling_params.enabled = true;
+        job.forced_vae_tiling                = true;
+        if (job.kind == AsyncJobKind::ImgGen && !job.img_gen.result_cache_key.empty()) {
+            job.img_gen.result_cache_key = img_gen_result_cache_key(job.img_gen);
+        }
+    }
+    job.estimated_compute_bytes = gen_params.vae_tiling_params.enabled ? sampling_bytes : std::max(sampling_bytes, vae_bytes);
+    return true;
+}
+
+// Records the peaks of the generation that just ran on sd_ctx for jobs, split
+// into sampling and VAE runners by name. The decode only counts when it ran
+// untiled in that call.
+static void observe_async_job_memory(ServerRuntime& runtime,
+                                     sd_ctx_t* sd_ctx,
+                                     const std::vector<AsyncGenerationJob*>& jobs,
+                                     bool decoded) {
+    AsyncJobManager& manager = *runtime.async_job_manager;
+    sd_perf_stats_t stats;
+    if (jobs.empty() || !manager.memory.enabled() || !sd_get_perf_stats(sd_ctx, &stats)) {
+        return;
+    }
+    uint64_t sampling_bytes = 0;
+    uint64_t vae_bytes      = 0;
+    for (int i = 0; i < stats.runner_count; ++i) {
+        const sd_runner_perf_stats_t& runner = stats.runners[i];
+        const std::string name               = runner.name != nullptr ? runner.name : "";
+        if (name.find("vae") != std::string::npos || name.find("tae") != std::string::npos) {
+            vae_bytes = std::max(vae_bytes, runner.peak_compute_buffer_bytes);
+        } else {
+            sampling_bytes = std::max(sampling_bytes, runner.peak_compute_buffer_bytes);
+        }
+    }
+    double pixels = 0.0;
+    for (const AsyncGenerationJob* job : jobs) {
+        pixels += async_job_memory_pixels(*job);
+    }
+    if (!decoded || async_job_gen_params(*jobs[0]).vae_tiling_params.enabled) {
+        vae_bytes = 0;
+    }
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    manager.memory.observe(async_job_memory_key(*jobs[0]), pixels, sampling_bytes, vae_bytes);
+}
+
+static std::string async_job_result_url(const AsyncGenerationJob& job, size_t index) {
+    return "/sdcpp/v1/jobs/" + job.id + "/result/" + std::to_string(index);
+}
+
+void notify_async_job_event(AsyncJobManager& manager) {
+    ++manager.events_version;
+    manager.events_cv.notify_all();
+}
+
 void purge_expired_jobs(AsyncJobManager& manager) {
     const int64_t now = unix_timestamp_now();
 
@@ -67,6 +429,37 @@ void purge_expired_jobs(AsyncJobManager& manager) {
     }
 }
 
+static uint64_t tenant_fair_starts(const AsyncJobManager& manager, const std::string& tenant) {
+    auto it = manager.tenant_starts.find(tenant);
+    return it == manager.tenant_starts.end() ? manager.fair_clock : std::max(it->second, manager.fair_clock);
+}
+
+std::deque<std::string>::iterator next_queued_job(AsyncJobManager& manager) {
+    auto best                  = manager.queue.end();
+    AsyncJobPriority best_lane = AsyncJobPriority::Batch;
+    uint64_t best_starts       = 0;
+    for (auto queue_it = manager.queue.begin(); queue_it != manager.queue.end(); ++queue_it) {
+        auto it = manager.jobs.find(*queue_it);
+        if (it == manager.jobs.end()) {
+            continue;
+        }
+        const AsyncGenerationJob& job = *it->second;
+        if (manager.memory.enabled() && manager.memory.running_bytes > 0 &&
+            manager.memory.running_bytes + job.estimated_compute_bytes > manager.memory.budget_bytes) {
+            continue;
+        }
+        uint64_t starts = tenant_fair_starts(manager, job.tenant);
+        if (best == manager.queue.end() ||
+            job.priority < best_lane ||
+            (job.priority == best_lane && starts < best_starts)) {
+            best        = queue_it;
+            best_lane   = job.priority;
+            best_starts = starts;
+        }
+    }
+    return best;
+}
+
 size_t count_pending_jobs(const AsyncJobManager& manager) {
     size_t pending = 0;
     for (const auto& entry : manager.jobs) {
@@ -85,59 +478,163 @@ std::string make_async_job_id(AsyncJobManager& manager) {
     return oss.str();
 }
 
+std::shared_ptr<AsyncGenerationJob> find_in_flight_job(AsyncJobManager& manager, const std::string& key) {
+    if (key.empty()) {
+        return nullptr;
+    }
+    auto it = manager.in_flight.find(key);
+    if (it == manager.in_flight.end()) {
+        return nullptr;
+    }
+    auto job_it = manager.jobs.find(it->second);
+    if (job_it == manager.jobs.end() ||
+        (job_it->second->status != AsyncJobStatus::Queued && job_it->second->status != AsyncJobStatus::Generating)) {
+        manager.in_flight.erase(it);
+        return nullptr;
+    }
+    return job_it->second;
+}
+
+static void release_in_flight_job(AsyncJobManager& manager, const AsyncGenerationJob& job) {
+    const std::string& key = job.img_gen.result_cache_key;
+    auto it                = key.empty() ? manager.in_flight.end() : manager.in_flight.find(key);
+    if (it != manager.in_flight.end() && it->second == job.id) {
+        manager.in_flight.erase(it);
+    }
+}
+
+// Makes the oldest queued follower of a job that ends without results the
+// job the others follow, so one of them still runs. Returns it, or null once
+// no follower is left. Called with manager.mutex held.
+static std::shared_ptr<AsyncGenerationJob> promote_async_job_follower(AsyncJobManager& manager, AsyncGenerationJob& job) {
+    release_in_flight_job(manager, job);
+
+    std::shared_ptr<AsyncGenerationJob> promoted;
+    for (const auto& follower_id : job.followers) {
+        auto it = manager.jobs.find(follower_id);
+        if (it == manager.jobs.end() || it->second->status != AsyncJobStatus::Queued) {
+            continue;
+        }
+        if (!promoted) {
+            promoted = it->second;
+            promoted->leader.clear();
+            continue;
+        }
+        it->second->leader = promoted->id;
+        promoted->followers.push_back(follower_id);
+    }
+    job.followers.clear();
+    if (promoted && !job.img_gen.result_cache_key.empty()) {
+        manager.in_flight[job.img_gen.result_cache_key] = promoted->id;
+    }
+    return promoted;
+}
+
 bool cancel_queued_job(AsyncJobManager& manager, AsyncGenerationJob& job) {
-    auto new_end = std::remove(manager.queue.begin(), manager.queue.end(), job.id);
-    if (new_end == manager.queue.end()) {
-        return false;
+    if (!job.leader.empty()) {
+        auto it = manager.jobs.find(job.leader);
+        if (it != manager.jobs.end()) {
+            auto& followers = it->second->followers;
+            followers.erase(std::remove(followers.begin(), followers.end(), job.id), followers.end());
+        }
+        job.leader.clear();
+    } else {
+        auto queue_it = std::find(manager.queue.begin(), manager.queue.end(), job.id);
+        if (queue_it == manager.queue.end()) {
+            return false;
+        }
+        if (std::shared_ptr<AsyncGenerationJob> promoted = promote_async_job_follower(manager, job)) {
+            *queue_it = promoted->id;
+        } else {
+            manager.queue.erase(queue_it);
+        }
     }
 
-    manager.queue.erase(new_end, manager.queue.end());
     job.status       = AsyncJobStatus::Cancelled;
     job.completed_at = unix_timestamp_now();
-    job.result_images_b64.clear();
-    job.result_media_b64.clear();
-    job.result_media_mime_type.clear();
+    job.results.clear();
     job.result_frame_count = 0;
     job.result_fps         = 0;
     job.error_code         = "cancelled";
     job.error_message      = "job cancelled by client";
+    notify_async_job_event(manager);
     return true;
 }
 
+// Jobs ahead of a queued job by lane and arrival. Tenant fairness can reorder
+// jobs within a lane, so this is an estimate there.
+static size_t async_job_queue_position(const AsyncJobManager& manager, const AsyncGenerationJob& job) {
+    size_t position = 1;
+    bool found      = false;
+    for (const auto& queued_id : manager.queue) {
+        if (queued_id == job.id) {
+            found = true;
+            continue;
+        }
+        auto it = manager.jobs.find(queued_id);
+        if (it == manager.jobs.end()) {
+            continue;
+        }
+        if (it->second->priority < job.priority || (it->second->priority == job.priority && !found)) {
+            ++position;
+        }
+    }
+    return found ? position : 0;
+}
+
 json make_async_job_json(const AsyncJobManager& manager, const AsyncGenerationJob& job) {
     json result;
     result["id"]             = job.id;
     result["kind"]           = async_job_kind_name(job.kind);
     result["status"]         = async_job_status_name(job.status);
+    result["priority"]       = async_job_priority_name(job.priority);
     result["created"]        = job.created_at;
     result["started"]        = job.started_at == 0 ? json(nullptr) : json(job.started_at);
     result["completed"]      = job.completed_at == 0 ? json(nullptr) : json(job.completed_at);
     result["queue_position"] = 0;
 
     if (job.status == AsyncJobStatus::Queued) {
-        size_t position = 1;
-        for (const auto& queued_id : manager.queue) {
-            if (queued_id == job.id) {
-                result["queue_position"] = position;
-                break;
-            }
-            ++position;
+        result["queue_position"] = async_job_queue_position(manager, job);
+    }
+    if (!job.leader.empty()) {
+        // waits for an identical job, so it moves up the queue with that one
+        result["follows"] = job.leader;
+        auto it           = manager.jobs.find(job.leader);
+        if (job.status == AsyncJobStatus::Queued && it != manager.jobs.end() &&
+            it->second->status == AsyncJobStatus::Queued) {
+            result["queue_position"] = async_job_queue_position(manager, *it->second);
         }
     }
+    if (job.estimated_compute_bytes > 0) {
+        result["estimated_compute_bytes"] = job.estimated_compute_bytes;
+    }
+    if (job.forced_vae_tiling) {
+        result["forced_vae_tiling"] = true;
+    }
+    if (job.status == AsyncJobStatus::Generating && job.provisional == AsyncJobProvisional::Pending) {
+        result["awaiting_confirmation"] = true;
+    }
 
     if (job.status == AsyncJobStatus::Completed) {
         if (job.kind == AsyncJobKind::VidGen) {
-            result["result"] = {
+            AsyncJobResultPtr media = job.results.empty() ? nullptr : job.results[0];
+            result["result"]        = {
                 {"output_format", job.vid_gen.output_format},
-                {"mime_type", job.result_media_mime_type},
+                {"mime_type", media ? media->mime_type : ""},
                 {"fps", job.result_fps},
                 {"frame_count", job.result_frame_count},
-                {"b64_json", job.result_media_b64},
+                {"size", media ? media->size : 0},
+                {"url", async_job_result_url(job, 0)},
             };
         } else {
             json images = json::array();
-            for (size_t i = 0; i < job.result_images_b64.size(); ++i) {
-                images.push_back({{"index", i}, {"b64_json", job.result_images_b64[i]}});
+            for (size_t i = 0; i < job.results.size(); ++i) {
+                images.push_back({
+                    {"index", i},
+                    {"mime_type", job.results[i]->mime_type},
+                    {"size", job.results[i]->size},
+                    {"url", async_job_result_url(job, i)},
+                });
             }
             result["result"] = {
                 {"output_format", job.img_gen.output_format},
@@ -163,54 +660,314 @@ json make_async_job_json(const AsyncJobManager& manager, const AsyncGenerationJo
     return result;
 }
 
-bool execute_img_gen_job(ServerRuntime& runtime,
-                         AsyncGenerationJob& job,
-                         std::vector<std::string>& output_images,
-                         std::string& error_message) {
-    sd_img_gen_params_t params = job.img_gen.to_sd_img_gen_params_t();
+json make_async_job_progress_json(const AsyncJobManager& manager, const AsyncGenerationJob& job) {
+    json result;
+    result["id"]             = job.id;
+    result["status"]         = async_job_status_name(job.status);
+    result["queue_position"] = 0;
+    if (job.status == AsyncJobStatus::Queued) {
+        result["queue_position"] = async_job_queue_position(manager, job);
+    }
+    result["step"]        = job.progress_step;
+    result["steps"]       = job.progress_steps;
+    result["eta_seconds"] = job.progress_eta_seconds < 0.0 ? json(nullptr) : json(job.progress_eta_seconds);
+    const sd_step_timing_t& timing = job.progress_step_timing;
+    if (timing.step > 0 && timing.step == job.progress_step && timing.steps == job.progress_steps) {
+        const char* cache = timing.cache == SD_STEP_CACHED ? "cached" : (timing.cache == SD_STEP_PREDICTED ? "predicted" : "computed");
+        result["step_timing"] = {{"time_ms", timing.time * 1000.0},
+                                 {"cond_ms", timing.cond_ms},
+                                 {"uncond_ms", timing.uncond_ms},
+                                 {"img_uncond_ms", timing.img_uncond_ms},
+                                 {"slg_ms", timing.slg_ms},
+                                 {"batched", timing.batched},
+                                 {"control_net_ms", timing.control_net_ms},
+                                 {"cache", cache},
+                                 {"streamed_bytes", timing.streamed_bytes},
+                                 {"preview_ms", timing.preview_ms}};
+    }
+    if (job.provisional == AsyncJobProvisional::Pending) {
+        result["awaiting_confirmation"] = true;
+    }
+    return result;
+}
 
-    SDImageVec results;
+void embed_async_job_results_b64(json& job_json, AsyncJobKind kind, const std::vector<AsyncJobResultPtr>& results) {
+    if (!job_json.contains("result") || !job_json["result"].is_object()) {
+        return;
+    }
+    json& result = job_json["result"];
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::vector<uint8_t> bytes;
+        if (!results[i]->read(0, results[i]->size, bytes)) {
+            LOG_WARN("failed to read job result %zu", i);
+            continue;
+        }
+        if (kind == AsyncJobKind::VidGen) {
+            result["b64_json"] = base64_encode(bytes);
+            break;
+        }
+        if (i < result["images"].size()) {
+            result["images"][i]["b64_json"] = base64_encode(bytes);
+        }
+    }
+}
 
-    {
-        std::lock_guard<std::mutex> lock(*runtime.sd_ctx_mutex);
-        sd_image_t* raw_results = generate_image(runtime.sd_ctx, &params);
-        results.adopt(raw_results, params.batch_count);
+// Callback data for the jobs generating on one thread. A merged batch reports
+// its progress to every job in it, and each job previews its own first image.
+// sd_ctx is the context image jobs generate on, for cancelling at their
+// provisional image.
+struct AsyncJobEventScope {
+    AsyncJobManager* manager = nullptr;
+    std::vector<AsyncGenerationJob*> jobs;
+    std::vector<int> preview_frames;
+    sd_ctx_t* sd_ctx = nullptr;
+
+    AsyncJobEventScope(AsyncJobManager& manager, const std::vector<AsyncGenerationJob*>& jobs, sd_ctx_t* sd_ctx = nullptr)
+        : manager(&manager), jobs(jobs), sd_ctx(sd_ctx) {
+        int frame = 0;
+        for (AsyncGenerationJob* job : jobs) {
+            preview_frames.push_back(frame);
+            if (job->kind == AsyncJobKind::ImgGen) {
+                frame += job->img_gen.gen_params.batch_count;
+            }
+        }
+        sd_set_thread_callback_data(this);
     }
+    ~AsyncJobEventScope() {
+        sd_set_thread_callback_data(nullptr);
+    }
+    AsyncJobEventScope(const AsyncJobEventScope&)            = delete;
+    AsyncJobEventScope& operator=(const AsyncJobEventScope&) = delete;
+};
 
-    const int num_results = results.count();
-    if (num_results <= 0) {
-        error_message = "generate_image returned no results";
-        return false;
+static void on_async_job_progress(int step, int steps, float time, void* data) {
+    if (step <= 0) {
+        return;
+    }
+    // keeps the console progress the library prints without a callback
+    printf("\r%i/%i - %.2fs/it\033[K%s", step, steps, time, step == steps ? "\n" : "");
+    fflush(stdout);
+    if (data == nullptr) {
+        return;
     }
+    AsyncJobEventScope& scope = *static_cast<AsyncJobEventScope*>(data);
+    auto now                  = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(scope.manager->mutex);
+    for (AsyncGenerationJob* job : scope.jobs) {
+        // a new pass (hires, a second sampler stage) restarts the ETA
+        if (steps != job->progress_steps || step <= job->progress_step) {
+            job->progress_first_step = step;
+            job->progress_pass_start = now;
+        }
+        job->progress_step        = step;
+        job->progress_steps       = steps;
+        job->progress_eta_seconds = -1.0;
+        if (step > job->progress_first_step) {
+            double elapsed            = std::chrono::duration<double>(now - job->progress_pass_start).count();
+            job->progress_eta_seconds = elapsed / (step - job->progress_first_step) * (steps - step);
+        }
+    }
+    notify_async_job_event(*scope.manager);
+}
 
-    EncodedImageFormat encoded_format = EncodedImageFormat::PNG;
-    if (job.img_gen.output_format == "jpeg") {
-        encoded_format = EncodedImageFormat::JPEG;
-    } else if (job.img_gen.output_format == "webp") {
-        encoded_format = EncodedImageFormat::WEBP;
+static void on_async_job_step_timing(const sd_step_timing_t* timing, void* data) {
+    if (data == nullptr || timing == nullptr) {
+        return;
     }
+    // the progress callback right after it sends the event
+    AsyncJobEventScope& scope = *static_cast<AsyncJobEventScope*>(data);
+    std::lock_guard<std::mutex> lock(scope.manager->mutex);
+    for (AsyncGenerationJob* job : scope.jobs) {
+        job->progress_step_timing = *timing;
+    }
+}
 
-    for (int i = 0; i < num_results; ++i) {
-        if (results[i].data == nullptr) {
+static void on_async_job_preview(int step, int frame_count, sd_image_t* frames, bool, void* data) {
+    if (data == nullptr || frames == nullptr || frame_count <= 0) {
+        return;
+    }
+    AsyncJobEventScope& scope = *static_cast<AsyncJobEventScope*>(data);
+    std::vector<size_t> listening;
+    EncodedImageFormat format;
+    {
+        std::lock_guard<std::mutex> lock(scope.manager->mutex);
+        for (size_t i = 0; i < scope.jobs.size(); ++i) {
+            if (scope.jobs[i]->event_subscribers > 0) {
+                listening.push_back(i);
+            }
+        }
+        format = scope.manager->preview_format;
+    }
+    if (listening.empty()) {
+        return;
+    }
+
+    std::vector<std::vector<uint8_t>> encoded;
+    for (size_t i : listening) {
+        const sd_image_t& frame = frames[std::min(scope.preview_frames[i], frame_count - 1)];
+        encoded.push_back(encode_image_to_vector(format,
+                                                 frame.data,
+                                                 static_cast<int>(frame.width),
+                                                 static_cast<int>(frame.height),
+                                                 static_cast<int>(frame.channel),
+                                                 "",
+                                                 75));
+    }
+
+    std::lock_guard<std::mutex> lock(scope.manager->mutex);
+    for (size_t k = 0; k < listening.size(); ++k) {
+        if (encoded[k].empty()) {
             continue;
         }
+        AsyncGenerationJob& job = *scope.jobs[listening[k]];
+        job.preview_step        = step;
+        job.preview_mime_type   = format == EncodedImageFormat::WEBP ? "image/webp" : "image/jpeg";
+        job.preview_bytes       = std::move(encoded[k]);
+        ++job.preview_version;
+    }
+    notify_async_job_event(*scope.manager);
+}
+
+// Publishes the provisional image to the jobs and holds the sampler until
+// every job answers or the timeout passes; the generation is cancelled when
+// all of them reject it.
+static void on_async_job_provisional(int step, int, const sd_image_t* image, void* data) {
+    if (data == nullptr || image == nullptr || image->data == nullptr) {
+        return;
+    }
+    AsyncJobEventScope& scope = *static_cast<AsyncJobEventScope*>(data);
+    AsyncJobManager& manager  = *scope.manager;
+    EncodedImageFormat format;
+    {
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        format = manager.preview_format;
+    }
+    std::vector<uint8_t> encoded = encode_image_to_vector(format,
+                                                          image->data,
+                                                          static_cast<int>(image->width),
+                                                          static_cast<int>(image->height),
+                                                          static_cast<int>(image->channel),
+                                                          "",
+                                                          75);
+    if (encoded.empty()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(manager.mutex);
+    for (AsyncGenerationJob* job : scope.jobs) {
+        job->provisional           = AsyncJobProvisional::Pending;
+        job->provisional_step      = step;
+        job->provisional_mime_type = format == EncodedImageFormat::WEBP ? "image/webp" : "image/jpeg";
+        job->provisional_bytes     = encoded;
+        ++job->provisional_version;
+    }
+    notify_async_job_event(manager);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(manager.provisional_timeout_seconds);
+    manager.events_cv.wait_until(lock, deadline, [&]() {
+        if (manager.stop) {
+            return true;
+        }
+        for (AsyncGenerationJob* job : scope.jobs) {
+            if (job->provisional == AsyncJobProvisional::Pending) {
+                return false;
+            }
+        }
+        return true;
+    });
+    bool rejected = !scope.jobs.empty();
+    for (AsyncGenerationJob* job : scope.jobs) {
+        if (job->provisional == AsyncJobProvisional::Pending) {
+            job->provisional = AsyncJobProvisional::Confirmed;
+        }
+        rejected = rejected && job->provisional == AsyncJobProvisional::Rejected;
+        job->provisional_bytes.clear();
+    }
+    notify_async_job_event(manager);
+    if ((rejected || manager.stop) && scope.sd_ctx != nullptr) {
+        sd_cancel_generation(scope.sd_ctx, SD_CANCEL_ALL);
+    }
+}
+
+bool answer_provisional_job(AsyncJobManager& manager, AsyncGenerationJob& job, bool confirm) {
+    if (job.status != AsyncJobStatus::Generating || job.provisional != AsyncJobProvisional::Pending) {
+        return false;
+    }
+    job.provisional = confirm ? AsyncJobProvisional::Confirmed : AsyncJobProvisional::Rejected;
+    notify_async_job_event(manager);
+    return true;
+}
+
+void install_async_job_callbacks(preview_t preview_mode, int preview_interval) {
+    sd_set_progress_callback(on_async_job_progress, nullptr);
+    sd_set_step_timing_callback(on_async_job_step_timing, nullptr);
+    sd_set_provisional_callback(on_async_job_provisional, nullptr);
+    if (preview_mode != PREVIEW_NONE) {
+        sd_set_preview_callback(on_async_job_preview, preview_mode, preview_interval, true, false, nullptr);
+    }
+}
+
+static void start_async_job(AsyncJobManager& manager, AsyncGenerationJob& job) {
+    uint64_t starts                   = tenant_fair_starts(manager, job.tenant);
+    manager.fair_clock                = std::max(manager.fair_clock, starts);
+    manager.tenant_starts[job.tenant] = starts + 1;
+    manager.memory.running_bytes += job.estimated_compute_bytes;
+
+    job.status       = AsyncJobStatus::Generating;
+    job.started_at   = unix_timestamp_now();
+    job.started_time = std::chrono::steady_clock::now();
+    notify_async_job_event(manager);
+}
+
+static const char* img_gen_mime_type(EncodedImageFormat format) {
+    switch (format) {
+        case EncodedImageFormat::JPEG:
+            return "image/jpeg";
+        case EncodedImageFormat::WEBP:
+            return "image/webp";
+        default:
+            return "image/png";
+    }
+}
+
+static EncodedImageFormat img_gen_encoded_format(const ImgGenJobRequest& request) {
+    if (request.output_format == "jpeg") {
+        return EncodedImageFormat::JPEG;
+    }
+    if (request.output_format == "webp") {
+        return EncodedImageFormat::WEBP;
+    }
+    return EncodedImageFormat::PNG;
+}
+
+static bool encode_img_gen_results(ServerRuntime& runtime,
+                                   AsyncGenerationJob& job,
+                                   const sd_image_t* results,
+                                   int num_results,
+                                   std::vector<AsyncJobResultPtr>& output_images,
+                                   std::string& error_message) {
+    if (num_results <= 0) {
+        error_message = "generate_image returned no results";
+        return false;
+    }
 
-        const std::string metadata = job.img_gen.gen_params.embed_image_metadata
-                                         ? get_image_params(*runtime.ctx_params,
-                                                            job.img_gen.gen_params,
-                                                            job.img_gen.gen_params.seed + i)
-                                         : "";
-        auto image_bytes           = encode_image_to_vector(encoded_format,
-                                                            results[i].data,
-                                                            results[i].width,
-                                                            results[i].height,
-                                                            results[i].channel,
-                                                            metadata,
-                                                            job.img_gen.output_compression);
+    const EncodedImageFormat encoded_format = img_gen_encoded_format(job.img_gen);
+    std::vector<std::vector<uint8_t>> encoded = encode_generated_images(runtime,
+                                                                        job.img_gen.gen_params,
+                                                                        results,
+                                                                        num_results,
+                                                                        encoded_format,
+                                                                        job.img_gen.output_compression);
+    for (auto& image_bytes : encoded) {
         if (image_bytes.empty()) {
             continue;
         }
-        output_images.push_back(base64_encode(image_bytes));
+        output_images.push_back(make_async_job_result(*runtime.async_job_manager,
+                                                      job.id,
+                                                      output_images.size(),
+                                                      job.img_gen.output_format,
+                                                      img_gen_mime_type(encoded_format),
+                                                      std::move(image_bytes)));
     }
 
     if (output_images.empty()) {
@@ -221,29 +978,239 @@ bool execute_img_gen_job(ServerRuntime& runtime,
     return true;
 }
 
-bool execute_vid_gen_job(ServerRuntime& runtime,
-                         AsyncGenerationJob& job,
-                         std::string& output_media_b64,
-                         std::string& output_media_mime_type,
-                         int& output_frame_count,
-                         int& output_fps,
-                         std::string& error_message) {
-    sd_vid_gen_params_t params = job.vid_gen.to_sd_vid_gen_params_t();
+std::string img_gen_batch_key(const ImgGenJobRequest& request) {
+    const SDGenerationParams& gen_params = request.gen_params;
+    if (gen_params.init_image.get().data != nullptr ||
+        gen_params.mask_image.get().data != nullptr ||
+        gen_params.control_image.get().data != nullptr ||
+        !gen_params.ref_images.empty() ||
+        !gen_params.pm_id_images.empty() ||
+        gen_params.extra_sample_args.find("provisional_step") != std::string::npos) {
+        return "";
+    }
+
+    SDGenerationParams key_params   = gen_params;
+    key_params.seed                 = 0;
+    key_params.batch_count          = 1;
+    key_params.latent_batch_size    = 1;
+    key_params.embed_image_metadata = false;
+    return key_params.to_string() +
+           "\nmodel: " + request.model_path +
+           "\nextra_sample_args: " + gen_params.extra_sample_args +
+           "\nhigh_noise_extra_sample_args: " + gen_params.high_noise_extra_sample_args +
+           "\nscm_mask: " + gen_params.scm_mask +
+           "\npulid: " + gen_params.pulid_id_embedding_path + " " + std::to_string(gen_params.pulid_id_weight);
+}
+
+// FNV-1a over the pixels, chained over all input images of a request.
+static uint64_t hash_sd_image(const sd_image_t& image, uint64_t hash) {
+    const uint64_t dims[3] = {image.width, image.height, image.channel};
+    for (uint64_t dim : dims) {
+        hash ^= dim;
+        hash *= 1099511628211ULL;
+    }
+    if (image.data == nullptr) {
+        return hash;
+    }
+    const size_t size = static_cast<size_t>(image.width) * image.height * image.channel;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= image.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string img_gen_result_cache_key(const ImgGenJobRequest& request) {
+    const SDGenerationParams& gen_params = request.gen_params;
+    uint64_t images_hash                 = 14695981039346656037ULL;
+    images_hash                          = hash_sd_image(gen_params.init_image.get(), images_hash);
+    images_hash                          = hash_sd_image(gen_params.end_image.get(), images_hash);
+    images_hash                          = hash_sd_image(gen_params.mask_image.get(), images_hash);
+    images_hash                          = hash_sd_image(gen_params.control_image.get(), images_hash);
+    for (const auto& image : gen_params.ref_images) {
+        images_hash = hash_sd_image(image.get(), images_hash);
+    }
+    for (const auto& image : gen_params.pm_id_images) {
+        images_hash = hash_sd_image(image.get(), images_hash);
+    }
+    return gen_params.to_string() +
+           "\nmodel: " + request.model_path +
+           "\noutput: " + request.output_format + " " + std::to_string(request.output_compression) +
+           "\nembed_image_metadata: " + std::to_string(gen_params.embed_image_metadata) +
+           "\nextra_sample_args: " + gen_params.extra_sample_args +
+           "\nhigh_noise_extra_sample_args: " + gen_params.high_noise_extra_sample_args +
+           "\nscm_mask: " + gen_params.scm_mask + " " + std::to_string(gen_params.scm_policy_dynamic) +
+           "\ncache_profile: " + gen_params.cache_profile +
+           "\npulid: " + gen_params.pulid_id_embedding_path + " " + std::to_string(gen_params.pulid_id_weight) +
+           "\nimages: " + std::to_string(images_hash);
+}
+
+bool execute_merged_img_gen_jobs(ServerRuntime& runtime,
+                                 const std::vector<std::shared_ptr<AsyncGenerationJob>>& jobs,
+                                 std::vector<std::vector<AsyncJobResultPtr>>& output_images,
+                                 std::vector<std::string>& error_messages) {
+    output_images.assign(jobs.size(), {});
+    error_messages.assign(jobs.size(), "");
+
+    // every job keeps the seeds it would have used on its own
+    std::vector<int64_t> seeds;
+    for (const auto& job : jobs) {
+        const SDGenerationParams& gen_params = job->img_gen.gen_params;
+        for (int i = 0; i < gen_params.batch_count; ++i) {
+            seeds.push_back(gen_params.seed + i);
+        }
+    }
+
+    sd_img_gen_params_t params = jobs[0]->img_gen.to_sd_img_gen_params_t();
+    params.batch_count         = static_cast<int>(seeds.size());
+    params.latent_batch_size   = params.batch_count;
+    params.seeds               = seeds.data();
 
     SDImageVec results;
-    int num_results             = 0;
-    sd_audio_t* generated_audio = nullptr;
 
     {
-        std::lock_guard<std::mutex> lock(*runtime.sd_ctx_mutex);
-        sd_image_t* raw_results = nullptr;
-        if (!generate_video(runtime.sd_ctx, &params, &raw_results, &num_results, &generated_audio)) {
-            raw_results = nullptr;
+        SDContextLease lease = runtime.context_pool->acquire(IMG_GEN, jobs[0]->img_gen.model_path);
+        if (!lease) {
+            error_messages.assign(jobs.size(), unsupported_generation_mode_error(IMG_GEN));
+            return false;
+        }
+        std::vector<AsyncGenerationJob*> batch_jobs;
+        for (const auto& job : jobs) {
+            batch_jobs.push_back(job.get());
+        }
+        AsyncJobEventScope events(*runtime.async_job_manager, batch_jobs, lease.get());
+        sd_image_t* raw_results = generate_image(lease.get(), &params);
+        runtime.metrics->record_generation(lease.get(), raw_results != nullptr);
+        if (raw_results != nullptr) {
+            observe_async_job_memory(runtime, lease.get(), batch_jobs, true);
+        }
+        results.adopt(raw_results, params.batch_count);
+    }
+
+    bool any_ok             = false;
+    int offset              = 0;
+    const int results_count = results.count();
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const int batch_count = jobs[i]->img_gen.gen_params.batch_count;
+        const int available   = std::max(0, std::min(batch_count, results_count - offset));
+        if (encode_img_gen_results(runtime,
+                                   *jobs[i],
+                                   available > 0 ? results.data() + offset : nullptr,
+                                   available,
+                                   output_images[i],
+                                   error_messages[i])) {
+            any_ok = true;
+        }
+        offset += batch_count;
+    }
+    return any_ok;
+}
+
+struct StreamedJobVideo {
+    VideoFileWriter writer;
+    std::string path;
+    int fps     = 16;
+    int quality = 90;
+};
+
+static bool write_streamed_job_video_frames(int first_frame,
+                                            int frame_count,
+                                            const sd_image_t* frames,
+                                            const sd_audio_t* audio,
+                                            void* data) {
+    auto* video = static_cast<StreamedJobVideo*>(data);
+    if (first_frame == 0 && !video->writer.open(video->path, video->fps, video->quality, audio)) {
+        LOG_ERROR("failed to open '%s' for writing", video->path.c_str());
+        return false;
+    }
+    return video->writer.add_frames(frames, frame_count);
+}
+
+// With a result_dir, WebM and AVI results are muxed into their result file
+// while the VAE decodes, so no decoded frame outlives its batch.
+static bool streams_vid_gen_results(ServerRuntime& runtime, const AsyncGenerationJob& job) {
+    return !runtime.async_job_manager->result_dir.empty() &&
+           (job.vid_gen.output_format == "webm" || job.vid_gen.output_format == "avi");
+}
+
+static void start_streamed_job_video(ServerRuntime& runtime,
+                                     const AsyncGenerationJob& job,
+                                     sd_vid_gen_params_t& params,
+                                     StreamedJobVideo& streamed) {
+    streamed.path         = async_job_result_path(*runtime.async_job_manager, job.id, 0, job.vid_gen.output_format);
+    streamed.fps          = job.vid_gen.gen_params.fps;
+    streamed.quality      = job.vid_gen.output_compression;
+    params.frames_cb      = write_streamed_job_video_frames;
+    params.frames_cb_data = &streamed;
+}
+
+static bool finish_streamed_job_video(AsyncGenerationJob& job,
+                                      StreamedJobVideo& streamed,
+                                      bool generated,
+                                      int num_frames,
+                                      AsyncJobResultPtr& output_media,
+                                      int& output_frame_count,
+                                      int& output_fps,
+                                      std::string& error_message) {
+    if (!generated || !streamed.writer.finish()) {
+        std::error_code ec;
+        std::filesystem::remove(streamed.path, ec);
+        error_message = generated ? "failed to encode generated video container" : "generate_video returned no results";
+        return false;
+    }
+
+    auto result       = std::make_shared<AsyncJobResult>();
+    result->mime_type = video_mime_type(job.vid_gen.output_format);
+    std::error_code ec;
+    result->size = static_cast<size_t>(std::filesystem::file_size(streamed.path, ec));
+    result->path = streamed.path;
+    if (ec) {
+        error_message = "failed to encode generated video container";
+        return false;
+    }
+    output_media       = std::move(result);
+    output_frame_count = num_frames;
+    output_fps         = job.vid_gen.gen_params.fps;
+    return true;
+}
+
+static bool execute_streamed_vid_gen_job(ServerRuntime& runtime,
+                                         AsyncGenerationJob& job,
+                                         sd_vid_gen_params_t& params,
+                                         AsyncJobResultPtr& output_media,
+                                         int& output_frame_count,
+                                         int& output_fps,
+                                         std::string& error_message) {
+    StreamedJobVideo streamed;
+    start_streamed_job_video(runtime, job, params, streamed);
+    int num_frames = 0;
+    bool generated = false;
+    {
+        SDContextLease lease = runtime.context_pool->acquire(VID_GEN, job.vid_gen.model_path);
+        if (!lease) {
+            error_message = unsupported_generation_mode_error(VID_GEN);
+            return false;
+        }
+        AsyncJobEventScope events(*runtime.async_job_manager, {&job});
+        generated = generate_video(lease.get(), &params, nullptr, &num_frames, nullptr);
+        runtime.metrics->record_generation(lease.get(), generated);
+        if (generated) {
+            observe_async_job_memory(runtime, lease.get(), {&job}, true);
         }
-        results.adopt(raw_results, num_results);
     }
+    return finish_streamed_job_video(job, streamed, generated, num_frames, output_media, output_frame_count, output_fps, error_message);
+}
 
-    num_results = results.count();
+// Encodes the frames and audio of a video job into its result container.
+static bool encode_vid_gen_results(ServerRuntime& runtime,
+                                   AsyncGenerationJob& job,
+                                   SDImageVec& results,
+                                   sd_audio_t* generated_audio,
+                                   AsyncJobResultPtr& output_media,
+                                   int& output_frame_count,
+                                   int& output_fps,
+                                   std::string& error_message) {
+    const int num_results = results.count();
     if (num_results <= 0) {
         free_sd_audio(generated_audio);
         error_message = "generate_video returned no results";
@@ -262,18 +1229,564 @@ bool execute_vid_gen_job(ServerRuntime& runtime,
         return false;
     }
 
-    output_media_b64       = base64_encode(video_bytes);
-    output_media_mime_type = video_mime_type(job.vid_gen.output_format);
-    output_frame_count     = num_results;
-    output_fps             = job.vid_gen.gen_params.fps;
+    output_media       = make_async_job_result(*runtime.async_job_manager,
+                                               job.id,
+                                               0,
+                                               job.vid_gen.output_format,
+                                               video_mime_type(job.vid_gen.output_format),
+                                               std::move(video_bytes));
+    output_frame_count = num_results;
+    output_fps         = job.vid_gen.gen_params.fps;
     return true;
 }
 
+bool execute_vid_gen_job(ServerRuntime& runtime,
+                         AsyncGenerationJob& job,
+                         AsyncJobResultPtr& output_media,
+                         int& output_frame_count,
+                         int& output_fps,
+                         std::string& error_message) {
+    sd_vid_gen_params_t params = job.vid_gen.to_sd_vid_gen_params_t();
+    if (streams_vid_gen_results(runtime, job)) {
+        return execute_streamed_vid_gen_job(runtime, job, params, output_media, output_frame_count, output_fps, error_message);
+    }
+
+    SDImageVec results;
+    int num_results             = 0;
+    sd_audio_t* generated_audio = nullptr;
+
+    {
+        SDContextLease lease = runtime.context_pool->acquire(VID_GEN, job.vid_gen.model_path);
+        if (!lease) {
+            error_message = unsupported_generation_mode_error(VID_GEN);
+            return false;
+        }
+        AsyncJobEventScope events(*runtime.async_job_manager, {&job});
+        sd_image_t* raw_results = nullptr;
+        if (!generate_video(lease.get(), &params, &raw_results, &num_results, &generated_audio)) {
+            raw_results = nullptr;
+        }
+        runtime.metrics->record_generation(lease.get(), raw_results != nullptr);
+        if (raw_results != nullptr) {
+            observe_async_job_memory(runtime, lease.get(), {&job}, true);
+        }
+        results.adopt(raw_results, num_results);
+    }
+    return encode_vid_gen_results(runtime, job, results, generated_audio, output_media, output_frame_count, output_fps, error_message);
+}
+
+static void finish_async_job(ServerRuntime& runtime,
+                             AsyncGenerationJob& job,
+                             bool ok,
+                             std::vector<AsyncJobResultPtr> results,
+                             int output_frame_count,
+                             int output_fps,
+                             const std::string& error_message) {
+    AsyncJobManager& manager = *runtime.async_job_manager;
+    if (job.estimated_compute_bytes > 0) {
+        manager.memory.running_bytes -= std::min(manager.memory.running_bytes, job.estimated_compute_bytes);
+        // jobs held back by the compute budget may fit now
+        manager.cv.notify_all();
+    }
+    if (manager.jobs.find(job.id) == manager.jobs.end()) {
+        return;
+    }
+
+    job.completed_at = unix_timestamp_now();
+    auto now         = std::chrono::steady_clock::now();
+    runtime.metrics->observe_job(job.kind,
+                                 ok,
+                                 std::chrono::duration<double>(job.started_time - job.queued_time).count(),
+                                 std::chrono::duration<double>(now - job.started_time).count());
+    if (ok) {
+        job.status             = AsyncJobStatus::Completed;
+        job.results            = std::move(results);
+        job.result_frame_count = output_frame_count;
+        job.result_fps         = output_fps;
+        job.error_code.clear();
+        job.error_message.clear();
+        if (job.kind == AsyncJobKind::ImgGen && !job.img_gen.result_cache_key.empty()) {
+            manager.result_cache.put(job.img_gen.result_cache_key, job.results);
+        }
+        if (!job.followers.empty()) {
+            LOG_INFO("job %s finished for %zu identical jobs", job.id.c_str(), job.followers.size());
+        }
+    } else if (job.provisional == AsyncJobProvisional::Rejected) {
+        job.status        = AsyncJobStatus::Cancelled;
+        job.error_code    = "cancelled";
+        job.error_message = "provisional image rejected by client";
+        job.results.clear();
+        job.result_frame_count = 0;
+        job.result_fps         = 0;
+    } else {
+        job.status        = AsyncJobStatus::Failed;
+        job.error_code    = "generation_failed";
+        job.error_message = error_message.empty() ? "unknown generation error" : error_message;
+        job.results.clear();
+        job.result_frame_count = 0;
+        job.result_fps         = 0;
+    }
+    job.preview_bytes.clear();
+    job.provisional_bytes.clear();
+
+    if (job.status == AsyncJobStatus::Cancelled) {
+        // the rejection was only of this client, so a follower runs instead
+        if (std::shared_ptr<AsyncGenerationJob> promoted = promote_async_job_follower(manager, job)) {
+            manager.queue.push_back(promoted->id);
+            manager.cv.notify_one();
+        }
+    } else {
+        // a failed run of a fixed seed would fail again, so followers share it
+        for (const auto& follower_id : job.followers) {
+            auto it = manager.jobs.find(follower_id);
+            if (it == manager.jobs.end() || it->second->status != AsyncJobStatus::Queued) {
+                continue;
+            }
+            AsyncGenerationJob& follower = *it->second;
+            follower.status              = job.status;
+            follower.started_at          = job.started_at;
+            follower.completed_at        = job.completed_at;
+            follower.results             = job.results;
+            follower.result_frame_count  = job.result_frame_count;
+            follower.result_fps          = job.result_fps;
+            follower.error_code          = job.error_code;
+            follower.error_message       = job.error_message;
+        }
+        job.followers.clear();
+        release_in_flight_job(manager, job);
+    }
+    notify_async_job_event(manager);
+}
+
+// Pulls queued image jobs that can share the sampler batch of `primary` out of
+// the queue. Called with manager.mutex held.
+static void take_mergeable_jobs(AsyncJobManager& manager,
+                                const std::shared_ptr<AsyncGenerationJob>& primary,
+                                std::vector<std::shared_ptr<AsyncGenerationJob>>& batch) {
+    int total_images       = primary->img_gen.gen_params.batch_count;
+    uint64_t compute_bytes = primary->estimated_compute_bytes;
+    if (manager.max_merged_images <= total_images) {
+        return;
+    }
+
+    const std::string key = img_gen_batch_key(primary->img_gen);
+    if (key.empty()) {
+        return;
+    }
+
+    for (auto queue_it = manager.queue.begin(); queue_it != manager.queue.end();) {
+        auto it = manager.jobs.find(*queue_it);
+        if (it == manager.jobs.end()) {
+            ++queue_it;
+            continue;
+        }
+
+        const auto& candidate = it->second;
+        const int batch_count = candidate->img_gen.gen_params.batch_count;
+        if (candidate->kind != AsyncJobKind::ImgGen ||
+            total_images + batch_count > manager.max_merged_images ||
+            img_gen_batch_key(candidate->img_gen) != key ||
+            (manager.memory.enabled() && compute_bytes + candidate->estimated_compute_bytes > manager.memory.budget_bytes)) {
+            ++queue_it;
+            continue;
+        }
+
+        start_async_job(manager, *candidate);
+        batch.push_back(candidate);
+        total_images += batch_count;
+        compute_bytes += candidate->estimated_compute_bytes;
+        queue_it = manager.queue.erase(queue_it);
+    }
+}
+
+static bool same_vae_tiling_params(const sd_tiling_params_t& a, const sd_tiling_params_t& b) {
+    return a.enabled == b.enabled &&
+           a.temporal_tiling == b.temporal_tiling &&
+           a.tile_size_x == b.tile_size_x &&
+           a.tile_size_y == b.tile_size_y &&
+           a.target_overlap == b.target_overlap &&
+           a.rel_size_x == b.rel_size_x &&
+           a.rel_size_y == b.rel_size_y &&
+           a.auto_tile_size == b.auto_tile_size &&
+           std::string(a.extra_tiling_args ? a.extra_tiling_args : "") ==
+               std::string(b.extra_tiling_args ? b.extra_tiling_args : "");
+}
+
+// Whether `next` may sample while the latents of `current` decode on the same
+// context; see sample_image_latents for what the library requires.
+static bool can_pipeline_img_gen_jobs(const AsyncGenerationJob& current, const AsyncGenerationJob& next) {
+    const SDGenerationParams& current_params = current.img_gen.gen_params;
+    const SDGenerationParams& next_params    = next.img_gen.gen_params;
+    return next.kind == AsyncJobKind::ImgGen &&
+           next.img_gen.model_path == current.img_gen.model_path &&
+           !img_gen_batch_key(next.img_gen).empty() &&
+           !next_params.hires_enabled &&
+           current_params.lora_map.empty() && current_params.high_noise_lora_map.empty() &&
+           next_params.lora_map.empty() && next_params.high_noise_lora_map.empty() &&
+           same_vae_tiling_params(current_params.vae_tiling_params, next_params.vae_tiling_params);
+}
+
+// Takes the job that would start next when it can follow `current` through
+// the pipeline.
+static std::shared_ptr<AsyncGenerationJob> take_pipelined_job(AsyncJobManager& manager,
+                                                              const AsyncGenerationJob& current,
+                                                              bool (*can_follow)(const AsyncGenerationJob&, const AsyncGenerationJob&)) {
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    if (manager.stop) {
+        return nullptr;
+    }
+    auto queue_it = next_queued_job(manager);
+    if (queue_it == manager.queue.end()) {
+        return nullptr;
+    }
+    auto it = manager.jobs.find(*queue_it);
+    if (it == manager.jobs.end() || !can_follow(current, *it->second)) {
+        return nullptr;
+    }
+
+    std::shared_ptr<AsyncGenerationJob> next = it->second;
+    manager.queue.erase(queue_it);
+    start_async_job(manager, *next);
+    return next;
+}
+
+static void finish_img_gen_job(ServerRuntime& runtime,
+                               AsyncGenerationJob& job,
+                               bool ok,
+                               std::vector<AsyncJobResultPtr> output_images,
+                               const std::string& error_message) {
+    std::lock_guard<std::mutex> lock(runtime.async_job_manager->mutex);
+    finish_async_job(runtime, job, ok, std::move(output_images), 0, 0, error_message);
+    purge_expired_jobs(*runtime.async_job_manager);
+}
+
+// The images of a job, each encoded on a thread of its own as soon as the VAE
+// decoded it, so encoding overlaps the decodes of the rest of the batch.
+struct StreamedJobImages {
+    ServerRuntime* runtime  = nullptr;
+    AsyncGenerationJob* job = nullptr;
+    std::map<int, std::future<std::vector<uint8_t>>> encoded;  // by batch index
+};
+
+static void encode_streamed_job_image(int index, const sd_image_t* image, void* data) {
+    auto* streamed = static_cast<StreamedJobImages*>(data);
+    // the image is only valid during the call
+    size_t size              = static_cast<size_t>(image->width) * image->height * image->channel;
+    auto pixels              = std::make_shared<std::vector<uint8_t>>(image->data, image->data + size);
+    sd_image_t copy          = *image;
+    streamed->encoded[index] = std::async(std::launch::async, [streamed, index, copy, pixels]() mutable {
+        const ImgGenJobRequest& request           = streamed->job->img_gen;
+        copy.data                                 = pixels->data();
+        std::vector<std::vector<uint8_t>> encoded = encode_generated_images(*streamed->runtime,
+                                                                            request.gen_params,
+                                                                            &copy,
+                                                                            1,
+                                                                            img_gen_encoded_format(request),
+                                                                            request.output_compression,
+                                                                            index);
+        return encoded.empty() ? std::vector<uint8_t>() : std::move(encoded[0]);
+    });
+}
+
+static bool collect_streamed_job_images(ServerRuntime& runtime,
+                                        StreamedJobImages& streamed,
+                                        std::vector<AsyncJobResultPtr>& output_images,
+                                        std::string& error_message) {
+    AsyncGenerationJob& job                 = *streamed.job;
+    const EncodedImageFormat encoded_format = img_gen_encoded_format(job.img_gen);
+    for (auto& [index, future] : streamed.encoded) {
+        std::vector<uint8_t> image_bytes = future.get();
+        if (image_bytes.empty()) {
+            continue;
+        }
+        output_images.push_back(make_async_job_result(*runtime.async_job_manager,
+                                                      job.id,
+                                                      output_images.size(),
+                                                      job.img_gen.output_format,
+                                                      img_gen_mime_type(encoded_format),
+                                                      std::move(image_bytes)));
+    }
+    streamed.encoded.clear();
+    if (output_images.empty()) {
+        error_message = "generate_image returned empty encoded outputs";
+        return false;
+    }
+    return true;
+}
+
+static void decode_img_gen_job(ServerRuntime& runtime,
+                               sd_ctx_t* sd_ctx,
+                               AsyncGenerationJob& job,
+                               sd_image_latents_t* latents,
+                               StreamedJobImages& streamed) {
+    auto decode_start       = std::chrono::steady_clock::now();
+    int num_images          = 0;
+    sd_image_t* raw_results = decode_image_latents(sd_ctx, latents, &num_images);
+    free_sd_image_latents(latents);
+    runtime.metrics->add_vae_decode_seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count());
+
+    SDImageVec results;
+    results.adopt(raw_results, num_images);
+    std::vector<AsyncJobResultPtr> output_images;
+    std::string error_message;
+    bool ok = false;
+    if (raw_results == nullptr) {
+        error_message = "generate_image returned no results";
+    } else if (!streamed.encoded.empty()) {
+        ok = collect_streamed_job_images(runtime, streamed, output_images, error_message);
+    } else {
+        ok = encode_img_gen_results(runtime, job, results.data(), results.count(), output_images, error_message);
+    }
+    finish_img_gen_job(runtime, job, ok, std::move(output_images), error_message);
+}
+
+static bool prepare_img_gen_job_conditions(sd_ctx_t* sd_ctx, AsyncGenerationJob& job) {
+    sd_img_gen_params_t params = job.img_gen.to_sd_img_gen_params_t();
+    return prepare_image_conditions(sd_ctx, &params);
+}
+
+// Runs an image job and keeps its context leased for the queued jobs that can
+// follow it. When the VAE has a backend of its own, job N decodes and encodes
+// its images on a second thread while job N+1 samples. When the text encoder
+// has one, job N+1 encodes its prompts on another thread while job N samples.
+// Jobs still finish in queue order.
+static void run_img_gen_pipeline(ServerRuntime& runtime, std::shared_ptr<AsyncGenerationJob> job) {
+    SDContextLease lease = runtime.context_pool->acquire(IMG_GEN, job->img_gen.model_path);
+    if (!lease) {
+        finish_img_gen_job(runtime, *job, false, {}, unsupported_generation_mode_error(IMG_GEN));
+        return;
+    }
+    const bool overlap             = sd_ctx_can_overlap_vae_decode(lease.get());
+    const bool overlap_text_encode = sd_ctx_can_overlap_text_encode(lease.get());
+
+    std::thread decode_thread;
+    bool job_prepared = false;
+    while (job != nullptr) {
+        std::shared_ptr<AsyncGenerationJob> next;
+        std::thread encode_thread;
+        if (overlap_text_encode) {
+            next = take_pipelined_job(*runtime.async_job_manager, *job, can_pipeline_img_gen_jobs);
+        }
+        if (next != nullptr) {
+            // encode this job first, so its sampling does not wait on the
+            // encoder while the next job uses it
+            if (!job_prepared) {
+                prepare_img_gen_job_conditions(lease.get(), *job);
+            }
+            LOG_DEBUG("encoding the prompts of job %s while job %s samples", next->id.c_str(), job->id.c_str());
+            encode_thread = std::thread([sd_ctx = lease.get(), encoding = next, &job_prepared]() {
+                job_prepared = prepare_img_gen_job_conditions(sd_ctx, *encoding);
+            });
+        }
+
+        auto streamed               = std::make_shared<StreamedJobImages>();
+        streamed->runtime           = &runtime;
+        streamed->job               = job.get();
+        sd_img_gen_params_t params  = job->img_gen.to_sd_img_gen_params_t();
+        params.image_cb             = encode_streamed_job_image;
+        params.image_cb_data        = streamed.get();
+        sd_image_latents_t* latents = nullptr;
+        {
+            AsyncJobEventScope events(*runtime.async_job_manager, {job.get()}, lease.get());
+            latents = sample_image_latents(lease.get(), &params);
+        }
+        runtime.metrics->record_generation(lease.get(), latents != nullptr);
+        if (latents != nullptr) {
+            // the decode runs in a later call, only sampling is measured here
+            observe_async_job_memory(runtime, lease.get(), {job.get()}, false);
+        }
+        if (encode_thread.joinable()) {
+            encode_thread.join();
+        } else {
+            job_prepared = false;
+        }
+        if (decode_thread.joinable()) {
+            decode_thread.join();
+        }
+        if (latents == nullptr) {
+            finish_img_gen_job(runtime, *job, false, {}, "generate_image returned no results");
+            job = std::move(next);
+            continue;
+        }
+
+        if (next == nullptr && overlap) {
+            next = take_pipelined_job(*runtime.async_job_manager, *job, can_pipeline_img_gen_jobs);
+        }
+        if (next == nullptr) {
+            decode_img_gen_job(runtime, lease.get(), *job, latents, *streamed);
+            break;
+        }
+        if (overlap) {
+            LOG_DEBUG("decoding job %s while job %s samples", job->id.c_str(), next->id.c_str());
+            decode_thread = std::thread([&runtime, sd_ctx = lease.get(), decoding = job, latents, streamed]() {
+                decode_img_gen_job(runtime, sd_ctx, *decoding, latents, *streamed);
+            });
+        } else {
+            decode_img_gen_job(runtime, lease.get(), *job, latents, *streamed);
+        }
+        job = std::move(next);
+    }
+    if (decode_thread.joinable()) {
+        decode_thread.join();
+    }
+}
+
+// LTX video jobs with a latent upscale: a first pass, the latent upsampler,
+// then a refinement pass.
+static bool is_two_stage_vid_gen_job(const AsyncGenerationJob& job) {
+    const SDGenerationParams& params = job.vid_gen.gen_params;
+    return job.kind == AsyncJobKind::VidGen &&
+           params.hires_enabled &&
+           params.resolved_hires_upscaler == SD_HIRES_UPSCALER_MODEL;
+}
+
+// Whether `next` may sample while the latents of `current` upscale on the
+// same context, without a LoRA switch between the stages of either.
+static bool can_pipeline_vid_gen_jobs(const AsyncGenerationJob& current, const AsyncGenerationJob& next) {
+    const SDGenerationParams& current_params = current.vid_gen.gen_params;
+    const SDGenerationParams& next_params    = next.vid_gen.gen_params;
+    return is_two_stage_vid_gen_job(next) &&
+           next.vid_gen.model_path == current.vid_gen.model_path &&
+           next_params.lora_map == current_params.lora_map &&
+           next_params.high_noise_lora_map == current_params.high_noise_lora_map;
+}
+
+// A video job between the stages of run_vid_gen_pipeline.
+struct PipelinedVidGenJob {
+    std::shared_ptr<AsyncGenerationJob> job;
+    sd_vid_gen_params_t params;
+    std::unique_ptr<StreamedJobVideo> streamed;  // see streams_vid_gen_results
+    sd_video_latents_t* latents = nullptr;
+    bool upscaled               = false;
+
+    ~PipelinedVidGenJob() {
+        free_sd_video_latents(latents);
+    }
+};
+
+static std::unique_ptr<PipelinedVidGenJob> sample_pipelined_vid_gen_job(ServerRuntime& runtime,
+                                                                        sd_ctx_t* sd_ctx,
+                                                                        std::shared_ptr<AsyncGenerationJob> job) {
+    auto stage    = std::make_unique<PipelinedVidGenJob>();
+    stage->job    = std::move(job);
+    stage->params = stage->job->vid_gen.to_sd_vid_gen_params_t();
+    if (streams_vid_gen_results(runtime, *stage->job)) {
+        stage->streamed = std::make_unique<StreamedJobVideo>();
+        start_streamed_job_video(runtime, *stage->job, stage->params, *stage->streamed);
+    }
+    AsyncJobEventScope events(*runtime.async_job_manager, {stage->job.get()}, sd_ctx);
+    stage->latents = sample_video_latents(sd_ctx, &stage->params);
+    return stage;
+}
+
+static void finish_pipelined_vid_gen_job(ServerRuntime& runtime,
+                                         sd_ctx_t* sd_ctx,
+                                         PipelinedVidGenJob& stage,
+                                         bool observe_memory) {
+    AsyncGenerationJob& job = *stage.job;
+    AsyncJobResultPtr output_media;
+    int output_frame_count = 0;
+    int output_fps         = 0;
+    std::string error_message;
+    bool ok = false;
+
+    SDImageVec results;
+    int num_frames              = 0;
+    sd_audio_t* generated_audio = nullptr;
+    bool generated              = false;
+    if (stage.latents != nullptr && stage.upscaled) {
+        AsyncJobEventScope events(*runtime.async_job_manager, {&job}, sd_ctx);
+        if (stage.streamed != nullptr) {
+            generated = finish_video_latents(sd_ctx, stage.latents, nullptr, &num_frames, nullptr);
+        } else {
+            sd_image_t* raw_results = nullptr;
+            if (!finish_video_latents(sd_ctx, stage.latents, &raw_results, &num_frames, &generated_audio)) {
+                raw_results = nullptr;
+            }
+            generated = raw_results != nullptr;
+            results.adopt(raw_results, num_frames);
+        }
+    }
+    free_sd_video_latents(stage.latents);
+    stage.latents = nullptr;
+    runtime.metrics->record_generation(sd_ctx, generated);
+    if (generated && observe_memory) {
+        observe_async_job_memory(runtime, sd_ctx, {&job}, true);
+    }
+
+    if (stage.streamed != nullptr) {
+        ok = finish_streamed_job_video(job, *stage.streamed, generated, num_frames, output_media, output_frame_count, output_fps, error_message);
+    } else {
+        ok = encode_vid_gen_results(runtime, job, results, generated_audio, output_media, output_frame_count, output_fps, error_message);
+    }
+
+    std::lock_guard<std::mutex> lock(runtime.async_job_manager->mutex);
+    finish_async_job(runtime,
+                     job,
+                     ok,
+                     output_media ? std::vector<AsyncJobResultPtr>{output_media} : std::vector<AsyncJobResultPtr>{},
+                     output_frame_count,
+                     output_fps,
+                     error_message);
+    purge_expired_jobs(*runtime.async_job_manager);
+}
+
+// Runs a two-stage video job and keeps its context leased for the queued jobs
+// that can follow it. When the upscaler has a backend of its own, the latents
+// of job N upscale on a second thread while job N+1 samples its first pass and
+// job N-1 its refinement pass, so the diffusion backend does not wait on the
+// upsampler. Jobs still finish in queue order.
+static void run_vid_gen_pipeline(ServerRuntime& runtime, std::shared_ptr<AsyncGenerationJob> job) {
+    SDContextLease lease = runtime.context_pool->acquire(VID_GEN, job->vid_gen.model_path);
+    if (!lease) {
+        std::lock_guard<std::mutex> lock(runtime.async_job_manager->mutex);
+        finish_async_job(runtime, *job, false, {}, 0, 0, unsupported_generation_mode_error(VID_GEN));
+        purge_expired_jobs(*runtime.async_job_manager);
+        return;
+    }
+    const bool overlap = sd_ctx_can_overlap_latent_upscale(lease.get());
+
+    std::unique_ptr<PipelinedVidGenJob> upscaling;  // on upscale_thread
+    std::thread upscale_thread;
+    while (job != nullptr) {
+        std::unique_ptr<PipelinedVidGenJob> current = sample_pipelined_vid_gen_job(runtime, lease.get(), job);
+        if (upscale_thread.joinable()) {
+            upscale_thread.join();
+        }
+        std::unique_ptr<PipelinedVidGenJob> previous = std::move(upscaling);
+        if (overlap && current->latents != nullptr) {
+            // the stages of other jobs run in the same call, only the first
+            // pass is measured here
+            observe_async_job_memory(runtime, lease.get(), {job.get()}, false);
+            LOG_DEBUG("upscaling the latents of job %s on a second thread", job->id.c_str());
+            upscaling      = std::move(current);
+            upscale_thread = std::thread([sd_ctx = lease.get(), stage = upscaling.get()]() {
+                stage->upscaled = upscale_video_latents(sd_ctx, stage->latents);
+            });
+        }
+        if (previous != nullptr) {
+            finish_pipelined_vid_gen_job(runtime, lease.get(), *previous, false);
+        }
+        if (current != nullptr) {
+            if (current->latents != nullptr) {
+                current->upscaled = upscale_video_latents(lease.get(), current->latents);
+            }
+            finish_pipelined_vid_gen_job(runtime, lease.get(), *current, true);
+        }
+        job = overlap ? take_pipelined_job(*runtime.async_job_manager, *job, can_pipeline_vid_gen_jobs) : nullptr;
+    }
+    if (upscale_thread.joinable()) {
+        upscale_thread.join();
+        finish_pipelined_vid_gen_job(runtime, lease.get(), *upscaling, false);
+    }
+}
+
 void async_job_worker(ServerRuntime& runtime) {
     AsyncJobManager& manager = *runtime.async_job_manager;
 
     while (true) {
         std::shared_ptr<AsyncGenerationJob> job;
+        std::vector<std::shared_ptr<AsyncGenerationJob>> batch;
         {
             std::unique_lock<std::mutex> lock(manager.mutex);
             manager.cv.wait(lock, [&]() { return manager.stop || !manager.queue.empty(); });
@@ -283,38 +1796,76 @@ void async_job_worker(ServerRuntime& runtime) {
             }
 
             purge_expired_jobs(manager);
-            if (manager.queue.empty()) {
+            auto queue_it = next_queued_job(manager);
+            if (queue_it == manager.queue.end()) {
+                bool held_back = std::any_of(manager.queue.begin(), manager.queue.end(), [&](const std::string& id) {
+                    return manager.jobs.find(id) != manager.jobs.end();
+                });
+                if (held_back) {
+                    // over the compute budget until a running job finishes
+                    manager.cv.wait(lock);
+                } else {
+                    manager.queue.clear();
+                }
                 continue;
             }
 
-            const std::string job_id = manager.queue.front();
-            manager.queue.pop_front();
+            const std::string job_id = *queue_it;
+            manager.queue.erase(queue_it);
 
             auto it = manager.jobs.find(job_id);
             if (it == manager.jobs.end()) {
                 continue;
             }
 
-            job             = it->second;
-            job->status     = AsyncJobStatus::Generating;
-            job->started_at = unix_timestamp_now();
+            job = it->second;
+            start_async_job(manager, *job);
+
+            if (job->kind == AsyncJobKind::ImgGen) {
+                batch.push_back(job);
+                take_mergeable_jobs(manager, job, batch);
+            }
         }
 
-        std::vector<std::string> output_images;
-        std::string output_media_b64;
-        std::string output_media_mime_type;
+        if (batch.size() > 1) {
+            LOG_INFO("merging %zu queued image jobs into one sampler batch", batch.size());
+            std::vector<std::vector<AsyncJobResultPtr>> batch_images;
+            std::vector<std::string> batch_errors;
+            execute_merged_img_gen_jobs(runtime, batch, batch_images, batch_errors);
+
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            for (size_t i = 0; i < batch.size(); ++i) {
+                finish_async_job(runtime,
+                                 *batch[i],
+                                 batch_errors[i].empty(),
+                                 std::move(batch_images[i]),
+                                 0,
+                                 0,
+                                 batch_errors[i]);
+            }
+            purge_expired_jobs(manager);
+            continue;
+        }
+
+        if (job->kind == AsyncJobKind::ImgGen) {
+            run_img_gen_pipeline(runtime, job);
+            continue;
+        }
+        if (is_two_stage_vid_gen_job(*job)) {
+            run_vid_gen_pipeline(runtime, job);
+            continue;
+        }
+
+        AsyncJobResultPtr output_media;
         int output_frame_count = 0;
         int output_fps         = 0;
         std::string error_message;
         bool ok = false;
 
-        if (job->kind == AsyncJobKind::ImgGen) {
-            ok = execute_img_gen_job(runtime, *job, output_images, error_message);
-        } else if (job->kind == AsyncJobKind::VidGen) {
+        if (job->kind == AsyncJobKind::VidGen) {
             ok = execute_vid_gen_job(runtime,
                                      *job,
-                                     output_media_b64,
-                                     output_media_mime_type,
+                                     output_media,
                                      output_frame_count,
                                      output_fps,
                                      error_message);
@@ -324,32 +1875,13 @@ void async_job_worker(ServerRuntime& runtime) {
 
         {
             std::lock_guard<std::mutex> lock(manager.mutex);
-            auto it = manager.jobs.find(job->id);
-            if (it == manager.jobs.end()) {
-                continue;
-            }
-
-            job->completed_at = unix_timestamp_now();
-            if (ok) {
-                job->status                 = AsyncJobStatus::Completed;
-                job->result_images_b64      = std::move(output_images);
-                job->result_media_b64       = std::move(output_media_b64);
-                job->result_media_mime_type = std::move(output_media_mime_type);
-                job->result_frame_count     = output_frame_count;
-                job->result_fps             = output_fps;
-                job->error_code.clear();
-                job->error_message.clear();
-            } else {
-                job->status        = AsyncJobStatus::Failed;
-                job->error_code    = "generation_failed";
-                job->error_message = error_message.empty() ? "unknown generation error" : error_message;
-                job->result_images_b64.clear();
-                job->result_media_b64.clear();
-                job->result_media_mime_type.clear();
-                job->result_frame_count = 0;
-                job->result_fps         = 0;
-            }
-
+            finish_async_job(runtime,
+                             *job,
+                             ok,
+                             output_media ? std::vector<AsyncJobResultPtr>{output_media} : std::vector<AsyncJobResultPtr>{},
+                             output_frame_count,
+                             output_fps,
+                             error_message);
             purge_expired_jobs(manager);
         }
     }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -25,25 +27,169 @@ enum class AsyncJobStatus {
     Cancelled,
 };
 
+// Answer to the provisional image of a job generating with provisional_step;
+// Pending while the sampler waits for it.
+enum class AsyncJobProvisional {
+    None,
+    Pending,
+    Confirmed,
+    Rejected,
+};
+
+// Queued interactive jobs always start before queued batch jobs.
+enum class AsyncJobPriority {
+    Interactive,
+    Batch,
+};
+
 const char* async_job_kind_name(AsyncJobKind kind);
 const char* async_job_status_name(AsyncJobStatus status);
+const char* async_job_priority_name(AsyncJobPriority priority);
+bool parse_async_job_priority(const std::string& name, AsyncJobPriority& priority);
+
+// One encoded output (an image or a video container), kept once in binary.
+// With a result directory the bytes live in a file there instead, removed
+// with the last reference, so a download in flight outlives the job TTL.
+struct AsyncJobResult {
+    std::string mime_type;
+    std::vector<uint8_t> bytes;  // empty when spilled to path
+    std::string path;
+    size_t size = 0;
+
+    AsyncJobResult()                                 = default;
+    AsyncJobResult(const AsyncJobResult&)            = delete;
+    AsyncJobResult& operator=(const AsyncJobResult&) = delete;
+    ~AsyncJobResult();
+
+    // Appends up to length bytes starting at offset to out.
+    bool read(size_t offset, size_t length, std::vector<uint8_t>& out) const;
+    // All size bytes. A spilled file is mapped read-only on the first call,
+    // so downloads are written to the socket from the page cache without a
+    // copy and RAM use does not grow with the results kept. Null when the
+    // file cannot be mapped; read() still works then.
+    const uint8_t* data() const;
+
+private:
+    mutable std::once_flag map_once;
+    mutable void* mapped = nullptr;
+};
+
+using AsyncJobResultPtr = std::shared_ptr<const AsyncJobResult>;
+
+// Results of finished image jobs by request key, so an identical request with
+// a fixed seed completes without generating. The seeded RNGs make the output
+// deterministic, so a hit returns exactly what a new run would. Entries share
+// the results with their jobs, and spilled results stay in result_dir while
+// cached. Guarded by AsyncJobManager::mutex.
+struct AsyncJobResultCache {
+    size_t budget_bytes = 0;  // 0 disables the cache
+    size_t bytes        = 0;
+    uint64_t hits       = 0;
+    uint64_t misses     = 0;
+
+    bool enabled() const {
+        return budget_bytes > 0;
+    }
+    bool get(const std::string& key, std::vector<AsyncJobResultPtr>& results);
+    void put(const std::string& key, const std::vector<AsyncJobResultPtr>& results);
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<AsyncJobResultPtr> results;
+        size_t bytes = 0;
+    };
+
+    void evict_to_budget();
+
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+// Predicts the peak compute buffer of a job from the peaks sd_get_perf_stats
+// reported for earlier jobs of the same kind and model. Buffers grow with the
+// number of output pixels, linearly for convolutions and up to quadratically
+// for attention, so each curve is a power law fitted to the samples in log
+// space with the exponent kept in [1, 2]. Sampling and VAE decode have curves
+// of their own, since VAE tiling only bounds the decode. Guarded by
+// AsyncJobManager::mutex.
+struct AsyncJobMemoryEstimator {
+    uint64_t budget_bytes  = 0;  // 0 disables admission by memory
+    uint64_t running_bytes = 0;  // estimates of the jobs generating now
+
+    bool enabled() const {
+        return budget_bytes > 0;
+    }
+    // pixels counts every output pixel of every frame and image; vae_bytes is
+    // 0 when the decode was tiled or not measured.
+    void observe(const std::string& key, double pixels, uint64_t sampling_bytes, uint64_t vae_bytes);
+    // Parts no earlier job of key has measured are 0.
+    void estimate(const std::string& key, double pixels, uint64_t& sampling_bytes, uint64_t& vae_bytes) const;
+
+private:
+    struct Sample {
+        double pixels  = 0.0;
+        uint64_t bytes = 0;
+    };
+    struct Curve {
+        std::vector<Sample> sampling;
+        std::vector<Sample> vae;
+    };
+
+    static void add_sample(std::vector<Sample>& samples, double pixels, uint64_t bytes);
+    static uint64_t predict(const std::vector<Sample>& samples, double pixels);
+
+    std::unordered_map<std::string, Curve> curves;
+};
 
 struct AsyncGenerationJob {
     std::string id;
-    AsyncJobKind kind     = AsyncJobKind::ImgGen;
-    AsyncJobStatus status = AsyncJobStatus::Queued;
-    int64_t created_at    = unix_timestamp_now();
-    int64_t started_at    = 0;
-    int64_t completed_at  = 0;
+    AsyncJobKind kind         = AsyncJobKind::ImgGen;
+    AsyncJobStatus status     = AsyncJobStatus::Queued;
+    AsyncJobPriority priority = AsyncJobPriority::Interactive;
+    std::string tenant;  // jobs of one lane are shared fairly between tenants
+    int64_t created_at   = unix_timestamp_now();
+    int64_t started_at   = 0;
+    int64_t completed_at = 0;
+    std::chrono::steady_clock::time_point queued_time = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point started_time;
     ImgGenJobRequest img_gen;
     VidGenJobRequest vid_gen;
-    std::vector<std::string> result_images_b64;
-    std::string result_media_b64;
-    std::string result_media_mime_type;
+    std::vector<AsyncJobResultPtr> results;  // images, or the one video container
     int result_frame_count = 0;
     int result_fps         = 0;
     std::string error_code;
     std::string error_message;
+
+    // Live state streamed by /sdcpp/v1/jobs/{id}/events.
+    int progress_step           = 0;
+    int progress_steps          = 0;
+    double progress_eta_seconds = -1.0;  // negative until two steps of the pass are timed
+    int progress_first_step     = 0;
+    std::chrono::steady_clock::time_point progress_pass_start;
+    sd_step_timing_t progress_step_timing = {};  // of the last step, when its step matches progress_step
+    int preview_step         = 0;
+    uint64_t preview_version = 0;
+    std::string preview_mime_type;
+    std::vector<uint8_t> preview_bytes;
+    int event_subscribers = 0;  // previews are only encoded while someone listens
+    // The provisional image of the step set by provisional_step, kept until answered.
+    AsyncJobProvisional provisional = AsyncJobProvisional::None;
+    int provisional_step            = 0;
+    uint64_t provisional_version    = 0;
+    std::string provisional_mime_type;
+    std::vector<uint8_t> provisional_bytes;
+
+    uint64_t estimated_compute_bytes = 0;  // 0 when nothing like it has run yet
+    bool forced_vae_tiling           = false;
+    // Identical image jobs submitted while this one was queued or running.
+    // They wait outside the queue and finish with its results; a follower
+    // names the job it waits for in leader.
+    std::vector<std::string> followers;
+    std::string leader;
 };
 
 struct AsyncJobManager {
@@ -51,27 +197,80 @@ struct AsyncJobManager {
     std::condition_variable cv;
     std::unordered_map<std::string, std::shared_ptr<AsyncGenerationJob>> jobs;
     std::unordered_map<std::string, int64_t> expired_jobs;
-    std::deque<std::string> queue;
+    std::deque<std::string> queue;  // arrival order; next_queued_job picks from it
+    // Jobs started per tenant, with tenants that were idle caught up to
+    // fair_clock, so a tenant cannot bank turns while it queues nothing.
+    std::unordered_map<std::string, uint64_t> tenant_starts;
+    uint64_t fair_clock = 0;
     uint64_t next_id              = 0;
     bool stop                     = false;
     size_t max_pending_jobs       = 64;
-    int64_t completed_ttl_seconds = 600;
+    int max_merged_images         = 1;  // images per merged sampler batch, 1 disables merging
+    int64_t completed_ttl_seconds = 600;  // --result-ttl
     int64_t failed_ttl_seconds    = 600;
+    std::string result_dir;  // results are written here instead of kept in RAM, empty keeps them in RAM
+    // an unanswered provisional image is confirmed after this
+    int64_t provisional_timeout_seconds = 60;
+    std::condition_variable events_cv;  // signalled with events_version bumped on any job change
+    uint64_t events_version           = 0;
+    EncodedImageFormat preview_format = EncodedImageFormat::JPEG;
+    AsyncJobResultCache result_cache;
+    // The queued or running job of each fixed-seed image request, by its
+    // result cache key, which identical requests follow instead of queueing.
+    std::unordered_map<std::string, std::string> in_flight;
+    uint64_t coalesced_jobs = 0;
+    AsyncJobMemoryEstimator memory;
 };
 
 void purge_expired_jobs(AsyncJobManager& manager);
+// The queued job to start next: the interactive lane first, then within the
+// lane the job of the tenant with the fewest starts, oldest first. Jobs that
+// would push the running jobs over the compute budget wait. Called with
+// manager.mutex held; queue.end() when nothing can start.
+std::deque<std::string>::iterator next_queued_job(AsyncJobManager& manager);
+// Wakes the event streams; called with manager.mutex held.
+void notify_async_job_event(AsyncJobManager& manager);
+// Registers the library progress and preview callbacks that feed the event
+// streams of the jobs generating on each worker thread.
+void install_async_job_callbacks(preview_t preview_mode, int preview_interval);
 size_t count_pending_jobs(const AsyncJobManager& manager);
+// Answers the pending provisional image of a generating job; false when the
+// job is not waiting for one. Called with manager.mutex held.
+bool answer_provisional_job(AsyncJobManager& manager, AsyncGenerationJob& job, bool confirm);
+// Checks a new job against the compute budget. Turns on VAE tiling when only
+// the decode is predicted over it, and fails with the prediction in
+// error_message when sampling is. Called with manager.mutex held.
+bool admit_async_job_memory(AsyncJobManager& manager, AsyncGenerationJob& job, std::string& error_message);
 std::string make_async_job_id(AsyncJobManager& manager);
+// Cancels a queued job or a follower. A cancelled job with followers hands
+// its place in the queue to the oldest of them.
 bool cancel_queued_job(AsyncJobManager& manager, AsyncGenerationJob& job);
+// The queued or running image job an identical request can follow, or null.
+std::shared_ptr<AsyncGenerationJob> find_in_flight_job(AsyncJobManager& manager, const std::string& key);
+// Stores bytes under result_dir when one is set, in memory otherwise.
+AsyncJobResultPtr make_async_job_result(const AsyncJobManager& manager,
+                                        const std::string& job_id,
+                                        size_t index,
+                                        const std::string& extension,
+                                        std::string mime_type,
+                                        std::vector<uint8_t> bytes);
+// Results are listed by download url; embed_async_job_results_b64 adds the
+// inline base64 copies, and is meant to run without manager.mutex held.
 json make_async_job_json(const AsyncJobManager& manager, const AsyncGenerationJob& job);
-bool execute_img_gen_job(ServerRuntime& runtime,
-                         AsyncGenerationJob& job,
-                         std::vector<std::string>& output_images,
-                         std::string& error_message);
+json make_async_job_progress_json(const AsyncJobManager& manager, const AsyncGenerationJob& job);
+void embed_async_job_results_b64(json& job_json, AsyncJobKind kind, const std::vector<AsyncJobResultPtr>& results);
+// Empty when the request cannot share a sampler batch with other jobs.
+std::string img_gen_batch_key(const ImgGenJobRequest& request);
+// Key of everything that determines the encoded output, input images by content.
+// Only meaningful for requests that chose their seed.
+std::string img_gen_result_cache_key(const ImgGenJobRequest& request);
+bool execute_merged_img_gen_jobs(ServerRuntime& runtime,
+                                 const std::vector<std::shared_ptr<AsyncGenerationJob>>& jobs,
+                                 std::vector<std::vector<AsyncJobResultPtr>>& output_images,
+                                 std::vector<std::string>& error_messages);
 bool execute_vid_gen_job(ServerRuntime& runtime,
                          AsyncGenerationJob& job,
-                         std::string& output_media_b64,
-                         std::string& output_media_mime_type,
+                         AsyncJobResultPtr& output_media,
                          int& output_frame_count,
                          int& output_fps,
                          std::string& error_message);
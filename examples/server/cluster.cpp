@@ -0,0 +1,414 @@
+#include "cluster.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+
+#include "async_jobs.h"
+#include "common/common.h"
+#include "common/log.h"
+#include "context_pool.h"
+
+// Reports older than this leave a worker out of routing, as stopped or
+// unreachable.
+static constexpr auto k_worker_stale_after = std::chrono::seconds(10);
+static constexpr auto k_report_interval    = std::chrono::seconds(2);
+
+// What a cache miss on a worker costs, in queued jobs.
+static constexpr double k_model_load_cost  = 4.0;
+static constexpr double k_lora_miss_cost   = 1.0;
+static constexpr double k_prompt_miss_cost = 0.5;
+
+void RecentKeys::add(const std::string& key) {
+    if (!keys_.insert(key).second) {
+        return;
+    }
+    order_.push_back(key);
+    while (order_.size() > capacity_) {
+        keys_.erase(order_.front());
+        order_.pop_front();
+    }
+}
+
+bool ClusterCoordinator::accepts_worker(const std::string& url) const {
+    std::string trimmed = url;
+    trimmed.erase(trimmed.find_last_not_of('/') + 1);
+    return allowed_urls_.count(trimmed) > 0;
+}
+
+bool ClusterCoordinator::update_worker(const json& report) {
+    if (!report.is_object() || !report.contains("url") || !report["url"].is_string() ||
+        !report.contains("models") || !report["models"].is_array()) {
+        return false;
+    }
+    const std::string url = report["url"].get<std::string>();
+    if (url.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(workers_.begin(), workers_.end(), [&](const std::unique_ptr<ClusterWorker>& worker) {
+        return worker->url == url;
+    });
+    if (it == workers_.end()) {
+        LOG_INFO("worker %s joined the cluster", url.c_str());
+        auto added = std::make_unique<ClusterWorker>();
+        added->url = url;
+        workers_.push_back(std::move(added));
+        it = workers_.end() - 1;
+    }
+    ClusterWorker& worker = **it;
+    worker.models.clear();
+    worker.loaded_models.clear();
+    for (const auto& model : report["models"]) {
+        if (!model.is_object()) {
+            continue;
+        }
+        for (const char* field : {"name", "path"}) {
+            std::string value = model.value(field, "");
+            if (value.empty()) {
+                continue;
+            }
+            worker.models.insert(value);
+            if (model.value("loaded", false)) {
+                worker.loaded_models.insert(value);
+            }
+        }
+    }
+    worker.pending_jobs     = report.value("pending_jobs", static_cast<size_t>(0));
+    worker.max_pending_jobs = report.value("max_pending_jobs", static_cast<size_t>(0));
+    worker.ready            = report.value("ready", false);
+    worker.routed_jobs      = 0;
+    worker.reported_at      = std::chrono::steady_clock::now();
+    return true;
+}
+
+int ClusterCoordinator::choose_worker(const std::string& model,
+                                      const std::string& lora_key,
+                                      const std::string& prompt_key,
+                                      const std::set<int>& excluded) const {
+    const auto now   = std::chrono::steady_clock::now();
+    int best         = -1;
+    double best_cost = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        const ClusterWorker& worker = *workers_[i];
+        if (!worker.ready || now - worker.reported_at > k_worker_stale_after ||
+            excluded.count(static_cast<int>(i)) > 0) {
+            continue;
+        }
+        // an empty model is each worker's startup model
+        if (!model.empty() && worker.models.count(model) == 0) {
+            continue;
+        }
+        const size_t pending = worker.pending_jobs + worker.routed_jobs;
+        if (worker.max_pending_jobs > 0 && pending >= worker.max_pending_jobs) {
+            continue;
+        }
+        double cost = static_cast<double>(pending);
+        if (!model.empty() && worker.loaded_models.count(model) == 0) {
+            cost += k_model_load_cost;
+        }
+        if (!lora_key.empty() && !worker.loras.contains(lora_key)) {
+            cost += k_lora_miss_cost;
+        }
+        if (!worker.prompts.contains(prompt_key)) {
+            cost += k_prompt_miss_cost;
+        }
+        if (cost < best_cost) {
+            best      = static_cast<int>(i);
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+// The LoRAs of a job, as the worker's LoRA cache tells them apart.
+static std::string job_lora_key(const json& body) {
+    if (!body.contains("lora") || !body["lora"].is_array()) {
+        return "";
+    }
+    std::vector<std::string> loras;
+    for (const auto& item : body["lora"]) {
+        if (item.is_object()) {
+            loras.push_back(item.value("path", "") + ":" + std::to_string(item.value("multiplier", 1.0f)) +
+                            (item.value("is_high_noise", false) ? ":high_noise" : ""));
+        }
+    }
+    std::sort(loras.begin(), loras.end());
+    std::string key;
+    for (const std::string& lora : loras) {
+        key += lora + "|";
+    }
+    return key;
+}
+
+void ClusterCoordinator::route_job(const std::string& path, const httplib::Request& req, httplib::Response& res) {
+    json body;
+    try {
+        body = json::parse(req.body);
+    } catch (const json::parse_error& e) {
+        res.status = 400;
+        res.set_content(json({{"error", "invalid json"}, {"message", e.what()}}).dump(), "application/json");
+        return;
+    }
+    if (!body.is_object()) {
+        res.status = 400;
+        res.set_content(R"({"error":"invalid json"})", "application/json");
+        return;
+    }
+    const std::string model      = body.value("model", "");
+    const std::string lora_key   = job_lora_key(body);
+    const std::string prompt_key = body.value("prompt", "") + "\x1f" + body.value("negative_prompt", "");
+
+    httplib::Headers headers;
+    if (req.has_header("X-Tenant")) {
+        headers.emplace("X-Tenant", req.get_header_value("X-Tenant"));
+    }
+
+    std::set<int> excluded;
+    while (true) {
+        int index = -1;
+        std::string url;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            index = choose_worker(model, lora_key, prompt_key, excluded);
+            if (index >= 0) {
+                url = workers_[index]->url;
+            }
+        }
+        if (index < 0) {
+            res.status = 503;
+            res.set_content(R"({"error":"no worker can take the job"})", "application/json");
+            return;
+        }
+
+        httplib::Client client(url);
+        client.set_connection_timeout(5);
+        client.set_read_timeout(60);
+        auto result = client.Post(path, headers, req.body, "application/json");
+        if (!result) {
+            LOG_WARN("worker %s is unreachable", url.c_str());
+            std::lock_guard<std::mutex> lock(mutex_);
+            workers_[index]->ready = false;
+            excluded.insert(index);
+            continue;
+        }
+        if (result->status == 429 || result->status == 503) {
+            // its queue filled since its last report
+            excluded.insert(index);
+            continue;
+        }
+        if (result->status != 202) {
+            res.status = result->status;
+            res.set_content(result->body, "application/json");
+            return;
+        }
+
+        json out;
+        try {
+            out = json::parse(result->body);
+        } catch (const json::parse_error&) {
+            out = json::object();
+        }
+        if (!out.contains("id") || !out["id"].is_string()) {
+            res.status = 502;
+            res.set_content(R"({"error":"invalid worker response"})", "application/json");
+            return;
+        }
+        const std::string job_id = "w" + std::to_string(index) + "-" + out["id"].get<std::string>();
+        out["id"]                = job_id;
+        out["poll_url"]          = "/sdcpp/v1/jobs/" + job_id;
+        out["worker"]            = url;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ClusterWorker& worker = *workers_[index];
+            worker.routed_jobs++;
+            if (!model.empty()) {
+                // it loads the model for this job
+                worker.loaded_models.insert(model);
+            }
+            if (!lora_key.empty()) {
+                worker.loras.add(lora_key);
+            }
+            worker.prompts.add(prompt_key);
+        }
+        res.status = 202;
+        res.set_content(out.dump(), "application/json");
+        return;
+    }
+}
+
+bool ClusterCoordinator::worker_job_url(const std::string& job_id, std::string* url) const {
+    size_t dash = job_id.find('-');
+    if (job_id.size() < 2 || job_id[0] != 'w' || dash == std::string::npos || dash + 1 >= job_id.size()) {
+        return false;
+    }
+    const size_t index = static_cast<size_t>(strtoull(job_id.c_str() + 1, nullptr, 10));
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= workers_.size()) {
+        return false;
+    }
+    *url = workers_[index]->url + "/sdcpp/v1/jobs/" + job_id.substr(dash + 1);
+    return true;
+}
+
+json ClusterCoordinator::workers_json() const {
+    const auto now = std::chrono::steady_clock::now();
+    json workers   = json::array();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& worker : workers_) {
+        workers.push_back({
+            {"url", worker->url},
+            {"ready", worker->ready && now - worker->reported_at <= k_worker_stale_after},
+            {"pending_jobs", worker->pending_jobs + worker->routed_jobs},
+            {"max_pending_jobs", worker->max_pending_jobs},
+            {"models", worker->models},
+            {"loaded_models", worker->loaded_models},
+            {"reported_seconds_ago", std::chrono::duration_cast<std::chrono::seconds>(now - worker->reported_at).count()},
+        });
+    }
+    return workers;
+}
+
+void register_cluster_coordinator_endpoints(httplib::Server& svr, ClusterCoordinator& coordinator) {
+    ClusterCoordinator* cluster = &coordinator;
+
+    svr.Post("/sdcpp/v1/cluster/workers", [cluster](const httplib::Request& req, httplib::Response& res) {
+        json report;
+        try {
+            report = json::parse(req.body);
+        } catch (const json::parse_error&) {
+        }
+        if (report.is_object() && report.contains("url") && report["url"].is_string() &&
+            !cluster->accepts_worker(report["url"].get<std::string>())) {
+            LOG_WARN("refused a report from %s for %s, which is not in --cluster-workers",
+                     req.remote_addr.c_str(),
+                     report["url"].get<std::string>().c_str());
+            res.status = 403;
+            res.set_content(R"({"error":"worker is not in --cluster-workers"})", "application/json");
+            return;
+        }
+        if (!cluster->update_worker(report)) {
+            res.status = 400;
+            res.set_content(R"({"error":"invalid worker report"})", "application/json");
+            return;
+        }
+        res.status = 200;
+        res.set_content(R"({"status":"ok"})", "application/json");
+    });
+
+    svr.Get("/sdcpp/v1/cluster/workers", [cluster](const httplib::Request&, httplib::Response& res) {
+        res.status = 200;
+        res.set_content(json({{"workers", cluster->workers_json()}}).dump(), "application/json");
+    });
+
+    svr.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+        res.status = 200;
+        res.set_content(R"({"status":"ok"})", "application/json");
+    });
+
+    for (const char* path : {"/sdcpp/v1/img_gen", "/sdcpp/v1/vid_gen"}) {
+        std::string route = path;
+        svr.Post(route, [cluster, route](const httplib::Request& req, httplib::Response& res) {
+            cluster->route_job(route, req, res);
+        });
+    }
+
+    // status, results, events, cancel and confirm are served by the worker
+    auto redirect = [cluster](const httplib::Request& req, httplib::Response& res) {
+        std::string url;
+        if (!cluster->worker_job_url(req.matches[1], &url)) {
+            res.status = 404;
+            res.set_content(R"({"error":"job not found"})", "application/json");
+            return;
+        }
+        url += req.matches[2].str();
+        size_t query = req.target.find('?');
+        if (query != std::string::npos) {
+            url += req.target.substr(query);
+        }
+        res.set_redirect(url, httplib::StatusCode::TemporaryRedirect_307);
+    };
+    svr.Get(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)(/.*)?)", redirect);
+    svr.Post(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)(/.*)?)", redirect);
+}
+
+static json make_worker_report(ServerRuntime& rt, const std::string& url) {
+    const std::set<std::string> loaded = rt.context_pool->loaded_model_paths();
+    json models                        = json::array();
+    models.push_back({{"name", default_model_name(rt)}, {"path", ""}, {"loaded", true}});
+    {
+        std::lock_guard<std::mutex> lock(*rt.model_mutex);
+        for (const ModelEntry& entry : *rt.model_cache) {
+            models.push_back({{"name", entry.name}, {"path", entry.path}, {"loaded", loaded.count(entry.fullpath) > 0}});
+        }
+    }
+
+    size_t pending_jobs     = 0;
+    size_t max_pending_jobs = 0;
+    {
+        std::lock_guard<std::mutex> lock(rt.async_job_manager->mutex);
+        pending_jobs     = count_pending_jobs(*rt.async_job_manager);
+        max_pending_jobs = rt.async_job_manager->max_pending_jobs;
+    }
+    return {
+        {"url", url},
+        {"models", models},
+        {"pending_jobs", pending_jobs},
+        {"max_pending_jobs", max_pending_jobs},
+        {"contexts", rt.context_pool->size()},
+        {"ready", rt.pending_warmups->load() == 0},
+    };
+}
+
+void ClusterReporter::start(ServerRuntime& rt) {
+    stop_   = false;
+    thread_ = std::thread(&ClusterReporter::run, this, &rt);
+}
+
+void ClusterReporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ClusterReporter::run(ServerRuntime* rt) {
+    const SDSvrParams& params = *rt->svr_params;
+    const std::string url     = !params.advertise_url.empty()
+                                    ? params.advertise_url
+                                    : "http://" + params.listen_ip + ":" + std::to_string(params.listen_port);
+    httplib::Client client(params.coordinator);
+    client.set_connection_timeout(2);
+    client.set_read_timeout(5);
+
+    bool reported = false;
+    bool refused  = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        lock.unlock();
+        auto result = client.Post("/sdcpp/v1/cluster/workers", make_worker_report(*rt, url).dump(), "application/json");
+        bool ok     = result && result->status == 200;
+        if (ok != reported) {
+            if (ok) {
+                LOG_INFO("reporting to coordinator %s as %s", params.coordinator.c_str(), url.c_str());
+            } else {
+                LOG_WARN("coordinator %s does not take reports", params.coordinator.c_str());
+            }
+            reported = ok;
+        }
+        if (result && result->status == 403 && !refused) {
+            LOG_WARN("coordinator %s refuses %s, which is not in its --cluster-workers",
+                     params.coordinator.c_str(),
+                     url.c_str());
+        }
+        refused = result && result->status == 403;
+        lock.lock();
+        cv_.wait_for(lock, k_report_interval, [this]() { return stop_; });
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "httplib.h"
+#include "runtime.h"
+
+// Cluster mode. A server started with --coordinator reports its models and
+// queue length to a --coordinator-mode server every few seconds. The
+// coordinator loads no model and routes /sdcpp/v1/img_gen and vid_gen jobs
+// to the reporting servers: to one that has the job's model loaded and was
+// recently sent its LoRAs and prompts, so the worker's LoRA and condition
+// caches keep hitting, and among those to the shortest queue. The job ids it
+// hands out name the worker, and the job endpoints redirect there. Only the
+// worker URLs given with --cluster-workers may report, so a client cannot
+// make the coordinator forward jobs or redirect to a host of its choosing.
+
+// The keys seen lately; past capacity the oldest are forgotten.
+class RecentKeys {
+public:
+    explicit RecentKeys(size_t capacity)
+        : capacity_(capacity) {}
+
+    bool contains(const std::string& key) const {
+        return keys_.count(key) > 0;
+    }
+
+    void add(const std::string& key);
+
+private:
+    size_t capacity_;
+    std::deque<std::string> order_;
+    std::unordered_set<std::string> keys_;
+};
+
+struct ClusterWorker {
+    std::string url;
+    std::set<std::string> models;         // names and --models-dir paths requests may select
+    std::set<std::string> loaded_models;  // of those, the ones a context has loaded
+    size_t pending_jobs     = 0;          // as last reported
+    size_t routed_jobs      = 0;          // sent since the last report
+    size_t max_pending_jobs = 0;
+    bool ready              = false;
+    std::chrono::steady_clock::time_point reported_at;
+    RecentKeys loras{256};
+    RecentKeys prompts{4096};
+};
+
+class ClusterCoordinator {
+public:
+    explicit ClusterCoordinator(const std::vector<std::string>& allowed_urls)
+        : allowed_urls_(allowed_urls.begin(), allowed_urls.end()) {}
+
+    // Whether a worker reporting itself at url may join.
+    bool accepts_worker(const std::string& url) const;
+    // Adds or refreshes the worker of a report; false when it does not parse.
+    bool update_worker(const json& report);
+    // Forwards a job submitted to path to the best worker that accepts it,
+    // answering with the worker's response under a coordinator job id.
+    void route_job(const std::string& path, const httplib::Request& req, httplib::Response& res);
+    // The worker URL of a coordinator job id's job; false for an unknown id.
+    bool worker_job_url(const std::string& job_id, std::string* url) const;
+    json workers_json() const;
+
+private:
+    // The worker a job goes to, or -1 when none can take it.
+    int choose_worker(const std::string& model,
+                      const std::string& lora_key,
+                      const std::string& prompt_key,
+                      const std::set<int>& excluded) const;
+
+    const std::set<std::string> allowed_urls_;  // without trailing slashes
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ClusterWorker>> workers_;  // an index is part of job ids, so never reused
+};
+
+void register_cluster_coordinator_endpoints(httplib::Server& svr, ClusterCoordinator& coordinator);
+
+// Reports this server to --coordinator until stopped.
+class ClusterReporter {
+public:
+    ~ClusterReporter() {
+        stop();
+    }
+
+    void start(ServerRuntime& rt);
+    void stop();
+
+private:
+    void run(ServerRuntime* rt);
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,264 @@
+#include "context_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "common/log.h"
+
+SDContextLease::SDContextLease(SDContextPool* pool, size_t index, sd_ctx_t* sd_ctx)
+    : pool_(pool), index_(index), sd_ctx_(sd_ctx) {
+}
+
+SDContextLease::SDContextLease(SDContextLease&& other) noexcept
+    : pool_(other.pool_), index_(other.index_), sd_ctx_(other.sd_ctx_) {
+    other.pool_ = nullptr;
+}
+
+SDContextLease& SDContextLease::operator=(SDContextLease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_       = other.pool_;
+        index_      = other.index_;
+        sd_ctx_     = other.sd_ctx_;
+        other.pool_ = nullptr;
+    }
+    return *this;
+}
+
+SDContextLease::~SDContextLease() {
+    release();
+}
+
+sd_ctx_t* SDContextLease::get() const {
+    return pool_ != nullptr ? sd_ctx_ : nullptr;
+}
+
+void SDContextLease::release() {
+    if (pool_ != nullptr) {
+        pool_->release(index_);
+        pool_ = nullptr;
+    }
+}
+
+std::unique_ptr<SDContextSlot> SDContextPool::create_slot(const std::string& backend,
+                                                          const std::string& model_path) const {
+    SDContextParams slot_params = ctx_params_;
+    slot_params.backend         = backend;
+    if (!model_path.empty()) {
+        // the named file takes the place of whichever model the server was started with
+        if (!slot_params.model_path.empty() || slot_params.diffusion_model_path.empty()) {
+            slot_params.model_path = model_path;
+        } else {
+            slot_params.diffusion_model_path = model_path;
+        }
+    }
+
+    sd_ctx_params_t sd_ctx_params = slot_params.to_sd_ctx_params_t(false);
+    auto slot                     = std::make_unique<SDContextSlot>();
+    slot->sd_ctx.reset(new_sd_ctx(&sd_ctx_params));
+    if (slot->sd_ctx == nullptr) {
+        LOG_ERROR("new_sd_ctx_t failed for backend '%s'", backend.c_str());
+        return nullptr;
+    }
+    slot->backend          = backend;
+    slot->model_path       = model_path;
+    slot->supports_img_gen = sd_ctx_supports_image_generation(slot->sd_ctx.get());
+    slot->supports_vid_gen = sd_ctx_supports_video_generation(slot->sd_ctx.get());
+    return slot;
+}
+
+bool SDContextPool::init(const SDContextParams& ctx_params, const std::vector<std::string>& backends) {
+    ctx_params_ = ctx_params;
+    backends_   = backends;
+    if (backends_.empty()) {
+        backends_.push_back(ctx_params.backend);
+    }
+
+    for (const std::string& backend : backends_) {
+        std::unique_ptr<SDContextSlot> slot = create_slot(backend, "");
+        if (slot == nullptr) {
+            return false;
+        }
+        LOG_INFO("context %zu ready (backend: '%s')", slots_.size(), backend.c_str());
+        slots_.push_back(std::move(slot));
+    }
+    return true;
+}
+
+size_t SDContextPool::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slots_.size();
+}
+
+bool SDContextPool::slot_supports_mode(const SDContextSlot& slot, SDMode mode) {
+    if (mode == VID_GEN) {
+        return slot.supports_vid_gen;
+    }
+    if (mode == IMG_GEN) {
+        return slot.supports_img_gen;
+    }
+    return true;
+}
+
+bool SDContextPool::supports_generation_mode(SDMode mode) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& slot : slots_) {
+        if (slot_supports_mode(*slot, mode)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::set<std::string> SDContextPool::loaded_model_paths() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::set<std::string> paths;
+    for (const auto& slot : slots_) {
+        paths.insert(slot->model_path);
+    }
+    return paths;
+}
+
+SDContextLease SDContextPool::acquire(SDMode mode, const std::string& model_path) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        bool model_loaded   = false;
+        bool mode_supported = false;
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            SDContextSlot& slot = *slots_[i];
+            if (slot.model_path != model_path) {
+                continue;
+            }
+            model_loaded = true;
+            if (!slot_supports_mode(slot, mode)) {
+                continue;
+            }
+            mode_supported = true;
+            if (!slot.busy) {
+                slot.busy = true;
+                return SDContextLease(this, i, slot.sd_ctx.get());
+            }
+        }
+        if (model_loaded && !mode_supported) {
+            return {};
+        }
+
+        if (!model_loaded && loading_models_.find(model_path) == loading_models_.end()) {
+            if (model_path.empty()) {
+                return {};
+            }
+            loading_models_.insert(model_path);
+            lock.unlock();
+            LOG_INFO("loading model '%s'", model_path.c_str());
+            std::unique_ptr<SDContextSlot> slot = create_slot(backends_.front(), model_path);
+            lock.lock();
+            loading_models_.erase(model_path);
+            cv_.notify_all();
+            if (slot == nullptr) {
+                return {};
+            }
+            const bool supported = slot_supports_mode(*slot, mode);
+            slot->busy           = supported;
+            slots_.push_back(std::move(slot));
+            LOG_INFO("context %zu ready (model: '%s')", slots_.size() - 1, model_path.c_str());
+            if (!supported) {
+                return {};
+            }
+            return SDContextLease(this, slots_.size() - 1, slots_.back()->sd_ctx.get());
+        }
+        cv_.wait(lock);
+    }
+}
+
+SDContextLease SDContextPool::acquire_index(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (index >= slots_.size()) {
+        return {};
+    }
+    cv_.wait(lock, [&]() { return !slots_[index]->busy; });
+    slots_[index]->busy = true;
+    return SDContextLease(this, index, slots_[index]->sd_ctx.get());
+}
+
+void SDContextPool::release(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[index]->busy      = false;
+        slots_[index]->last_used = ++use_counter_;
+    }
+    cv_.notify_all();
+    enforce_params_budget(index);
+}
+
+void SDContextPool::enforce_params_budget(size_t keep_index) {
+    if (params_budget_bytes_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> budget_lock(budget_mutex_);
+
+    struct Candidate {
+        size_t index;
+        sd_ctx_t* sd_ctx;
+        uint64_t last_used;
+        uint64_t resident_bytes;
+    };
+    std::vector<Candidate> candidates;
+    uint64_t total_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            candidates.push_back({i, slots_[i]->sd_ctx.get(), slots_[i]->last_used, 0});
+        }
+    }
+    auto resident_bytes = [](sd_ctx_t* sd_ctx) -> uint64_t {
+        uint64_t ram_bytes  = 0;
+        uint64_t vram_bytes = 0;
+        sd_get_params_memory(sd_ctx, &ram_bytes, &vram_bytes);
+        return ram_bytes + vram_bytes;
+    };
+    for (Candidate& candidate : candidates) {
+        candidate.resident_bytes = resident_bytes(candidate.sd_ctx);
+        total_bytes += candidate.resident_bytes;
+    }
+    if (total_bytes <= params_budget_bytes_) {
+        return;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.last_used < b.last_used;
+    });
+    for (const Candidate& candidate : candidates) {
+        if (total_bytes <= params_budget_bytes_) {
+            break;
+        }
+        if (candidate.index == keep_index || candidate.resident_bytes == 0) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (slots_[candidate.index]->busy) {
+                continue;
+            }
+            slots_[candidate.index]->busy = true;
+        }
+
+        // compute backend copies first; params backend storage only if still over budget
+        auto freed_bytes = [&]() {
+            return candidate.resident_bytes - std::min(resident_bytes(candidate.sd_ctx), candidate.resident_bytes);
+        };
+        sd_release_params(candidate.sd_ctx, false);
+        uint64_t freed = freed_bytes();
+        if (total_bytes - freed > params_budget_bytes_) {
+            sd_release_params(candidate.sd_ctx, true);
+            freed = freed_bytes();
+        }
+        total_bytes -= freed;
+        LOG_INFO("evicted params of context %zu (%.2f MB freed)", candidate.index, freed / (1024.0 * 1024.0));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_[candidate.index]->busy = false;
+        }
+        cv_.notify_all();
+    }
+}
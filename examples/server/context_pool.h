@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common/common.h"
+#include "common/resource_owners.hpp"
+#include "stable-diffusion.h"
+
+struct SDContextSlot {
+    SDCtxPtr sd_ctx;
+    std::string backend;
+    std::string model_path;  // empty for the model the server was started with
+    bool supports_img_gen = false;
+    bool supports_vid_gen = false;
+    bool busy             = false;
+    uint64_t last_used    = 0;
+};
+
+class SDContextPool;
+
+// Exclusive use of one pooled context; the context goes back to the pool on destruction.
+class SDContextLease {
+public:
+    SDContextLease() = default;
+    SDContextLease(SDContextPool* pool, size_t index, sd_ctx_t* sd_ctx);
+    SDContextLease(SDContextLease&& other) noexcept;
+    SDContextLease& operator=(SDContextLease&& other) noexcept;
+    SDContextLease(const SDContextLease&)            = delete;
+    SDContextLease& operator=(const SDContextLease&) = delete;
+    ~SDContextLease();
+
+    sd_ctx_t* get() const;
+    size_t index() const {
+        return index_;
+    }
+    explicit operator bool() const {
+        return pool_ != nullptr;
+    }
+
+private:
+    void release();
+
+    SDContextPool* pool_ = nullptr;
+    size_t index_        = 0;
+    sd_ctx_t* sd_ctx_    = nullptr;
+};
+
+// Owns one sd_ctx_t per configured backend. Generation requests lease whichever
+// context is idle and can serve the requested mode, so several GPUs work on
+// different jobs concurrently instead of serializing on a single context.
+//
+// Requests may also name another model file. Its context is created on first
+// use, on the first configured backend, and then kept. With a params budget,
+// finishing a generation evicts the params of idle contexts, least recently
+// used first, until the contexts fit the budget again; an evicted context
+// keeps its graph state and reloads its weights on the next request.
+class SDContextPool {
+public:
+    bool init(const SDContextParams& ctx_params, const std::vector<std::string>& backends);
+    // Bytes of params RAM + VRAM the contexts may keep resident; 0 disables eviction.
+    void set_params_budget(uint64_t budget_bytes) {
+        params_budget_bytes_ = budget_bytes;
+    }
+
+    size_t size() const;
+    bool supports_generation_mode(SDMode mode) const;
+    // The model file of every context, empty for the startup model.
+    std::set<std::string> loaded_model_paths() const;
+
+    // Blocks until a context of `model_path` (empty for the startup model) that
+    // supports `mode` is idle, creating the context first when the model is not
+    // loaded yet. Returns an empty lease when that model cannot serve `mode` or
+    // fails to load.
+    SDContextLease acquire(SDMode mode, const std::string& model_path = "");
+    // Blocks until the context at `index` is idle, whatever it serves.
+    SDContextLease acquire_index(size_t index);
+
+private:
+    friend class SDContextLease;
+
+    static bool slot_supports_mode(const SDContextSlot& slot, SDMode mode);
+    std::unique_ptr<SDContextSlot> create_slot(const std::string& backend, const std::string& model_path) const;
+    void release(size_t index);
+    void enforce_params_budget(size_t keep_index);
+
+    SDContextParams ctx_params_;
+    std::vector<std::string> backends_;
+    uint64_t params_budget_bytes_ = 0;
+    uint64_t use_counter_         = 0;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<SDContextSlot>> slots_;
+    std::set<std::string> loading_models_;
+    std::mutex budget_mutex_;  // serializes evictions
+};
@@ -1,15 +1,20 @@
+#include <atomic>
 #include <cstdlib>
 #include <iostream>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "httplib.h"
 
 #include "async_jobs.h"
+#include "cluster.h"
 #include "common/common.h"
 #include "common/resource_owners.hpp"
+#include "context_pool.h"
+#include "metrics.h"
 #include "routes.h"
 #include "runtime.h"
 
@@ -46,11 +51,16 @@ static void parse_args(int argc,
 
     const bool random_seed_requested = default_gen_params.seed < 0;
 
-    if (!svr_params.resolve_and_validate() ||
-        !ctx_params.resolve_and_validate(IMG_GEN) ||
-        !default_gen_params.resolve_and_validate(IMG_GEN,
-                                                 ctx_params.lora_model_dir,
-                                                 ctx_params.hires_upscalers_dir)) {
+    if (!svr_params.resolve_and_validate()) {
+        print_usage(argv[0], options_vec);
+        exit(1);
+    }
+    // a coordinator loads no model
+    if (!svr_params.coordinator_mode &&
+        (!ctx_params.resolve_and_validate(IMG_GEN) ||
+         !default_gen_params.resolve_and_validate(IMG_GEN,
+                                                  ctx_params.lora_model_dir,
+                                                  ctx_params.hires_upscalers_dir))) {
         print_usage(argv[0], options_vec);
         exit(1);
     }
@@ -60,6 +70,48 @@ static void parse_args(int argc,
     }
 }
 
+// Runs the --warmup sizes on one startup context, then counts it as ready.
+static void warmup_context(ServerRuntime& rt, size_t index, std::vector<std::pair<int, int>> sizes) {
+    {
+        SDContextLease lease = rt.context_pool->acquire_index(index);
+        if (lease) {
+            for (const auto& size : sizes) {
+                sd_warmup(lease.get(), size.first, size.second);
+            }
+        }
+    }
+    rt.pending_warmups->fetch_sub(1);
+}
+
+static httplib::Server::HandlerResponse handle_cors(const httplib::Request& req, httplib::Response& res) {
+    std::string origin = req.get_header_value("Origin");
+    if (origin.empty()) {
+        origin = "*";
+    }
+    res.set_header("Access-Control-Allow-Origin", origin);
+    res.set_header("Access-Control-Allow-Credentials", "true");
+    res.set_header("Access-Control-Allow-Methods", "*");
+    res.set_header("Access-Control-Allow-Headers", "*");
+
+    if (req.method == "OPTIONS") {
+        res.status = 204;
+        return httplib::Server::HandlerResponse::Handled;
+    }
+    return httplib::Server::HandlerResponse::Unhandled;
+}
+
+// --coordinator-mode: routes jobs to the servers that report to it.
+static int run_coordinator(const SDSvrParams& svr_params) {
+    ClusterCoordinator coordinator(svr_params.get_cluster_workers());
+    httplib::Server svr;
+    svr.set_pre_routing_handler(handle_cors);
+    register_cluster_coordinator_endpoints(svr, coordinator);
+
+    LOG_INFO("coordinating on: http://%s:%d\n", svr_params.listen_ip.c_str(), svr_params.listen_port);
+    svr.listen(svr_params.listen_ip, svr_params.listen_port);
+    return 0;
+}
+
 void sd_log_cb(enum sd_log_level_t level, const char* log, void* data) {
     SDSvrParams* svr_params = (SDSvrParams*)data;
     log_print(level, log, svr_params->verbose, svr_params->color);
@@ -85,24 +137,41 @@ int main(int argc, const char** argv) {
     LOG_DEBUG("%s", ctx_params.to_string().c_str());
     LOG_DEBUG("%s", default_gen_params.to_string().c_str());
 
-    sd_ctx_params_t sd_ctx_params = ctx_params.to_sd_ctx_params_t(false);
-    SDCtxPtr sd_ctx(new_sd_ctx(&sd_ctx_params));
+    if (svr_params.coordinator_mode) {
+        return run_coordinator(svr_params);
+    }
 
-    if (sd_ctx == nullptr) {
+    SDContextPool context_pool;
+    if (!context_pool.init(ctx_params, svr_params.get_context_backends())) {
         LOG_ERROR("new_sd_ctx_t failed");
         return 1;
     }
-
-    std::mutex sd_ctx_mutex;
+    context_pool.set_params_budget(static_cast<uint64_t>(svr_params.models_budget_mb) * 1024 * 1024);
 
     std::vector<LoraEntry> lora_cache;
     std::mutex lora_mutex;
     std::vector<UpscalerEntry> upscaler_cache;
     std::mutex upscaler_mutex;
+    std::vector<ModelEntry> model_cache;
+    std::unordered_map<std::string, std::string> model_index;
+    std::mutex model_mutex;
     AsyncJobManager async_job_manager;
+    async_job_manager.max_merged_images           = svr_params.max_merged_images;
+    async_job_manager.result_dir                  = svr_params.result_dir;
+    async_job_manager.result_cache.budget_bytes   = static_cast<size_t>(svr_params.result_cache_mb) * 1024 * 1024;
+    async_job_manager.memory.budget_bytes         = static_cast<uint64_t>(svr_params.compute_budget_mb) * 1024 * 1024;
+    async_job_manager.preview_format              = svr_params.preview_format == "webp" ? EncodedImageFormat::WEBP : EncodedImageFormat::JPEG;
+    async_job_manager.provisional_timeout_seconds = svr_params.provisional_timeout;
+    async_job_manager.completed_ttl_seconds       = svr_params.result_ttl;
+    set_png_compression_level(svr_params.png_compression_level);
+    install_async_job_callbacks(svr_params.get_preview_mode(), svr_params.preview_interval);
+    ServerMetrics metrics;
+    metrics.set_model_loads(context_pool.size());
+    std::vector<std::pair<int, int>> warmup_sizes;
+    svr_params.get_warmup_sizes(&warmup_sizes);
+    std::atomic<int> pending_warmups(warmup_sizes.empty() ? 0 : static_cast<int>(context_pool.size()));
     ServerRuntime runtime = {
-        sd_ctx.get(),
-        &sd_ctx_mutex,
+        &context_pool,
         &svr_params,
         &ctx_params,
         &default_gen_params,
@@ -111,28 +180,32 @@ int main(int argc, const char** argv) {
         &upscaler_cache,
         &upscaler_mutex,
         &async_job_manager,
+        &metrics,
+        &model_cache,
+        &model_index,
+        &model_mutex,
+        &pending_warmups,
     };
+    refresh_model_cache(runtime);
+
+    // warm-up holds each context while it runs, so jobs submitted meanwhile
+    // queue until their context is warm
+    std::vector<std::thread> warmup_threads;
+    if (!warmup_sizes.empty()) {
+        for (size_t i = 0; i < context_pool.size(); ++i) {
+            warmup_threads.emplace_back(warmup_context, std::ref(runtime), i, warmup_sizes);
+        }
+    }
 
-    std::thread async_worker(async_job_worker, std::ref(runtime));
+    // one worker per context so queued jobs run concurrently on idle contexts
+    std::vector<std::thread> async_workers;
+    for (size_t i = 0; i < context_pool.size(); ++i) {
+        async_workers.emplace_back(async_job_worker, std::ref(runtime));
+    }
 
     httplib::Server svr;
 
-    svr.set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
-        std::string origin = req.get_header_value("Origin");
-        if (origin.empty()) {
-            origin = "*";
-        }
-        res.set_header("Access-Control-Allow-Origin", origin);
-        res.set_header("Access-Control-Allow-Credentials", "true");
-        res.set_header("Access-Control-Allow-Methods", "*");
-        res.set_header("Access-Control-Allow-Headers", "*");
-
-        if (req.method == "OPTIONS") {
-            res.status = 204;
-            return httplib::Server::HandlerResponse::Handled;
-        }
-        return httplib::Server::HandlerResponse::Unhandled;
-    });
+    svr.set_pre_routing_handler(handle_cors);
 
     std::string index_html;
 #ifdef HAVE_INDEX_HTML
@@ -145,14 +218,26 @@ int main(int argc, const char** argv) {
     register_sdapi_endpoints(svr, runtime);
     register_sdcpp_api_endpoints(svr, runtime);
 
+    ClusterReporter cluster_reporter;
+    if (!svr_params.coordinator.empty()) {
+        cluster_reporter.start(runtime);
+    }
+
     LOG_INFO("listening on: http://%s:%d\n", svr_params.listen_ip.c_str(), svr_params.listen_port);
     svr.listen(svr_params.listen_ip, svr_params.listen_port);
+    cluster_reporter.stop();
 
     {
         std::lock_guard<std::mutex> lock(async_job_manager.mutex);
         async_job_manager.stop = true;
     }
     async_job_manager.cv.notify_all();
-    async_worker.join();
+    async_job_manager.events_cv.notify_all();
+    for (auto& async_worker : async_workers) {
+        async_worker.join();
+    }
+    for (auto& warmup_thread : warmup_threads) {
+        warmup_thread.join();
+    }
     return 0;
 }
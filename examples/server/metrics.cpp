@@ -0,0 +1,207 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "ggml-backend.h"
+
+#include "async_jobs.h"
+#include "context_pool.h"
+
+static const char* prometheus_job_kind_label(size_t index) {
+    return async_job_kind_name(static_cast<AsyncJobKind>(index));
+}
+
+void ServerMetrics::Histogram::observe(double value) {
+    for (size_t i = 0; i < kLatencyBuckets.size(); ++i) {
+        if (value <= kLatencyBuckets[i]) {
+            buckets[i]++;
+        }
+    }
+    count++;
+    sum += value;
+}
+
+void ServerMetrics::set_model_loads(uint64_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_loads_ = count;
+}
+
+void ServerMetrics::record_generation(sd_ctx_t* sd_ctx, bool ok) {
+    sd_perf_stats_t stats;
+    bool have_stats = sd_get_perf_stats(sd_ctx, &stats);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    generations_++;
+    if (!ok) {
+        failed_generations_++;
+    }
+    if (!have_stats) {
+        return;
+    }
+    sampling_steps_ += static_cast<uint64_t>(stats.sampling_steps);
+    sampling_seconds_ += stats.sampling_ms / 1000.0;
+    text_encode_seconds_ += stats.text_encode_ms / 1000.0;
+    vae_decode_seconds_ += stats.vae_decode_ms / 1000.0;
+    condition_cache_hits_ += static_cast<uint64_t>(stats.condition_cache_hits);
+    condition_cache_misses_ += static_cast<uint64_t>(stats.condition_cache_misses);
+    vae_encode_cache_hits_ += static_cast<uint64_t>(stats.vae_encode_cache_hits);
+    vae_encode_cache_misses_ += static_cast<uint64_t>(stats.vae_encode_cache_misses);
+    lora_cache_hits_ += static_cast<uint64_t>(stats.lora_cache_hits);
+    lora_cache_misses_ += static_cast<uint64_t>(stats.lora_cache_misses);
+    lora_model_cache_hits_ += static_cast<uint64_t>(stats.lora_model_cache_hits);
+    lora_model_cache_misses_ += static_cast<uint64_t>(stats.lora_model_cache_misses);
+    lora_model_cache_evictions_ += static_cast<uint64_t>(stats.lora_model_cache_evictions);
+    sample_cache_skipped_steps_ += static_cast<uint64_t>(stats.sample_cache_skipped_steps);
+}
+
+void ServerMetrics::add_vae_decode_seconds(double seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    vae_decode_seconds_ += seconds;
+}
+
+void ServerMetrics::observe_job(AsyncJobKind kind, bool ok, double queue_seconds, double run_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    JobKindMetrics& metrics = jobs_[static_cast<size_t>(kind)];
+    metrics.queue_seconds.observe(queue_seconds);
+    metrics.run_seconds.observe(run_seconds);
+    if (ok) {
+        metrics.completed++;
+    } else {
+        metrics.failed++;
+    }
+}
+
+void ServerMetrics::observe_cancelled_job(AsyncJobKind kind) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_[static_cast<size_t>(kind)].cancelled++;
+}
+
+static void write_metric_header(std::ostringstream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+std::string ServerMetrics::render(ServerRuntime& runtime) {
+    size_t pending_jobs          = 0;
+    uint64_t result_cache_hits   = 0;
+    uint64_t result_cache_misses = 0;
+    size_t result_cache_bytes    = 0;
+    size_t result_cache_entries  = 0;
+    uint64_t coalesced_jobs      = 0;
+    {
+        std::lock_guard<std::mutex> lock(runtime.async_job_manager->mutex);
+        const AsyncJobResultCache& result_cache = runtime.async_job_manager->result_cache;
+        pending_jobs                            = count_pending_jobs(*runtime.async_job_manager);
+        result_cache_hits                       = result_cache.hits;
+        result_cache_misses                     = result_cache.misses;
+        result_cache_bytes                      = result_cache.bytes;
+        result_cache_entries                    = result_cache.size();
+        coalesced_jobs                          = runtime.async_job_manager->coalesced_jobs;
+    }
+
+    std::ostringstream out;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    write_metric_header(out, "sdcpp_queue_depth", "gauge", "Async jobs queued or generating.");
+    out << "sdcpp_queue_depth " << pending_jobs << "\n";
+
+    write_metric_header(out, "sdcpp_contexts", "gauge", "Model contexts in the pool.");
+    out << "sdcpp_contexts " << runtime.context_pool->size() << "\n";
+
+    write_metric_header(out, "sdcpp_model_loads_total", "counter", "Model contexts loaded since start.");
+    out << "sdcpp_model_loads_total " << model_loads_ << "\n";
+
+    write_metric_header(out, "sdcpp_jobs_total", "counter", "Finished async jobs by kind and status.");
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+        const char* kind = prometheus_job_kind_label(i);
+        out << "sdcpp_jobs_total{kind=\"" << kind << "\",status=\"completed\"} " << jobs_[i].completed << "\n";
+        out << "sdcpp_jobs_total{kind=\"" << kind << "\",status=\"failed\"} " << jobs_[i].failed << "\n";
+        out << "sdcpp_jobs_total{kind=\"" << kind << "\",status=\"cancelled\"} " << jobs_[i].cancelled << "\n";
+    }
+
+    auto write_histogram = [&](const char* name, const char* help, Histogram JobKindMetrics::*member) {
+        write_metric_header(out, name, "histogram", help);
+        for (size_t i = 0; i < jobs_.size(); ++i) {
+            const char* kind           = prometheus_job_kind_label(i);
+            const Histogram& histogram = jobs_[i].*member;
+            for (size_t b = 0; b < kLatencyBuckets.size(); ++b) {
+                out << name << "_bucket{kind=\"" << kind << "\",le=\"" << kLatencyBuckets[b] << "\"} "
+                    << histogram.buckets[b] << "\n";
+            }
+            out << name << "_bucket{kind=\"" << kind << "\",le=\"+Inf\"} " << histogram.count << "\n";
+            out << name << "_sum{kind=\"" << kind << "\"} " << histogram.sum << "\n";
+            out << name << "_count{kind=\"" << kind << "\"} " << histogram.count << "\n";
+        }
+    };
+    write_histogram("sdcpp_job_queue_seconds", "Time async jobs spent queued.", &JobKindMetrics::queue_seconds);
+    write_histogram("sdcpp_job_run_seconds", "Time async jobs spent generating.", &JobKindMetrics::run_seconds);
+
+    write_metric_header(out, "sdcpp_generations_total", "counter", "Generation calls across all APIs.");
+    out << "sdcpp_generations_total " << generations_ << "\n";
+    write_metric_header(out, "sdcpp_generation_failures_total", "counter", "Generation calls that failed.");
+    out << "sdcpp_generation_failures_total " << failed_generations_ << "\n";
+
+    write_metric_header(out, "sdcpp_sampling_steps_total", "counter", "Denoising steps run.");
+    out << "sdcpp_sampling_steps_total " << sampling_steps_ << "\n";
+    write_metric_header(out, "sdcpp_sampling_seconds_total", "counter", "Time spent sampling; steps per second is the ratio of the two rates.");
+    out << "sdcpp_sampling_seconds_total " << sampling_seconds_ << "\n";
+    write_metric_header(out, "sdcpp_text_encode_seconds_total", "counter", "Time spent in text encoders.");
+    out << "sdcpp_text_encode_seconds_total " << text_encode_seconds_ << "\n";
+    write_metric_header(out, "sdcpp_vae_decode_seconds_total", "counter", "Time spent decoding latents.");
+    out << "sdcpp_vae_decode_seconds_total " << vae_decode_seconds_ << "\n";
+
+    write_metric_header(out, "sdcpp_condition_cache_requests_total", "counter", "Text encoder cache lookups by result.");
+    out << "sdcpp_condition_cache_requests_total{result=\"hit\"} " << condition_cache_hits_ << "\n";
+    out << "sdcpp_condition_cache_requests_total{result=\"miss\"} " << condition_cache_misses_ << "\n";
+    write_metric_header(out, "sdcpp_vae_encode_cache_requests_total", "counter", "VAE encoder cache lookups by result.");
+    out << "sdcpp_vae_encode_cache_requests_total{result=\"hit\"} " << vae_encode_cache_hits_ << "\n";
+    out << "sdcpp_vae_encode_cache_requests_total{result=\"miss\"} " << vae_encode_cache_misses_ << "\n";
+    write_metric_header(out, "sdcpp_lora_cache_requests_total", "counter", "Generations with LoRAs by whether the applied set was reused.");
+    out << "sdcpp_lora_cache_requests_total{result=\"hit\"} " << lora_cache_hits_ << "\n";
+    out << "sdcpp_lora_cache_requests_total{result=\"miss\"} " << lora_cache_misses_ << "\n";
+    write_metric_header(out, "sdcpp_lora_model_cache_requests_total", "counter", "Runtime LoRA loads by whether the loaded LoRA was cached.");
+    out << "sdcpp_lora_model_cache_requests_total{result=\"hit\"} " << lora_model_cache_hits_ << "\n";
+    out << "sdcpp_lora_model_cache_requests_total{result=\"miss\"} " << lora_model_cache_misses_ << "\n";
+    write_metric_header(out, "sdcpp_lora_model_cache_evictions_total", "counter", "Loaded runtime LoRAs evicted from the cache.");
+    out << "sdcpp_lora_model_cache_evictions_total " << lora_model_cache_evictions_ << "\n";
+    write_metric_header(out, "sdcpp_sample_cache_skipped_steps_total", "counter", "Steps skipped by step caches.");
+    out << "sdcpp_sample_cache_skipped_steps_total " << sample_cache_skipped_steps_ << "\n";
+    write_metric_header(out, "sdcpp_result_cache_requests_total", "counter", "Fixed-seed image jobs by whether a cached result served them.");
+    out << "sdcpp_result_cache_requests_total{result=\"hit\"} " << result_cache_hits << "\n";
+    out << "sdcpp_result_cache_requests_total{result=\"miss\"} " << result_cache_misses << "\n";
+    write_metric_header(out, "sdcpp_result_cache_bytes", "gauge", "Encoded results held by the result cache.");
+    out << "sdcpp_result_cache_bytes " << result_cache_bytes << "\n";
+    write_metric_header(out, "sdcpp_result_cache_entries", "gauge", "Requests held by the result cache.");
+    out << "sdcpp_result_cache_entries " << result_cache_entries << "\n";
+    write_metric_header(out, "sdcpp_coalesced_jobs_total", "counter", "Fixed-seed image jobs that followed an identical queued or running job.");
+    out << "sdcpp_coalesced_jobs_total " << coalesced_jobs << "\n";
+
+    struct DeviceMemory {
+        const char* name = nullptr;
+        size_t used      = 0;
+        size_t total     = 0;
+    };
+    std::vector<DeviceMemory> devices;
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            continue;
+        }
+        size_t free_mem  = 0;
+        size_t total_mem = 0;
+        ggml_backend_dev_memory(dev, &free_mem, &total_mem);
+        devices.push_back({ggml_backend_dev_name(dev), total_mem - std::min(free_mem, total_mem), total_mem});
+    }
+    write_metric_header(out, "sdcpp_device_memory_used_bytes", "gauge", "Memory in use per non-CPU backend device.");
+    for (const auto& device : devices) {
+        out << "sdcpp_device_memory_used_bytes{device=\"" << device.name << "\"} " << device.used << "\n";
+    }
+    write_metric_header(out, "sdcpp_device_memory_total_bytes", "gauge", "Memory per non-CPU backend device.");
+    for (const auto& device : devices) {
+        out << "sdcpp_device_memory_total_bytes{device=\"" << device.name << "\"} " << device.total << "\n";
+    }
+
+    return out.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "stable-diffusion.h"
+
+enum class AsyncJobKind;
+struct ServerRuntime;
+
+// Counters and histograms served as Prometheus text on /metrics. Generation
+// routes report through record_generation while they still hold the context
+// lease; the async job worker reports finished jobs through observe_job.
+class ServerMetrics {
+public:
+    static constexpr size_t kJobKindCount = 2;
+    static constexpr std::array<double, 11> kLatencyBuckets = {0.5, 1, 2, 5, 10, 20, 30, 60, 120, 300, 600};
+
+    void set_model_loads(uint64_t count);
+    void record_generation(sd_ctx_t* sd_ctx, bool ok);
+    // For decodes that run outside the generation call, see decode_image_latents.
+    void add_vae_decode_seconds(double seconds);
+    void observe_job(AsyncJobKind kind, bool ok, double queue_seconds, double run_seconds);
+    void observe_cancelled_job(AsyncJobKind kind);
+
+    std::string render(ServerRuntime& runtime);
+
+private:
+    struct Histogram {
+        std::array<uint64_t, kLatencyBuckets.size()> buckets{};
+        uint64_t count = 0;
+        double sum     = 0.0;
+
+        void observe(double value);
+    };
+
+    struct JobKindMetrics {
+        Histogram queue_seconds;
+        Histogram run_seconds;
+        uint64_t completed = 0;
+        uint64_t failed    = 0;
+        uint64_t cancelled = 0;
+    };
+
+    std::mutex mutex_;
+    std::array<JobKindMetrics, kJobKindCount> jobs_;
+    uint64_t model_loads_                = 0;
+    uint64_t generations_                = 0;
+    uint64_t failed_generations_         = 0;
+    uint64_t sampling_steps_             = 0;
+    double sampling_seconds_             = 0.0;
+    double text_encode_seconds_          = 0.0;
+    double vae_decode_seconds_           = 0.0;
+    uint64_t condition_cache_hits_       = 0;
+    uint64_t condition_cache_misses_     = 0;
+    uint64_t vae_encode_cache_hits_      = 0;
+    uint64_t vae_encode_cache_misses_    = 0;
+    uint64_t lora_cache_hits_            = 0;
+    uint64_t lora_cache_misses_          = 0;
+    uint64_t lora_model_cache_hits_      = 0;
+    uint64_t lora_model_cache_misses_    = 0;
+    uint64_t lora_model_cache_evictions_ = 0;
+    uint64_t sample_cache_skipped_steps_ = 0;
+};
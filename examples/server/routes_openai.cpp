@@ -7,6 +7,8 @@
 #include "common/common.h"
 #include "common/media_io.h"
 #include "common/resource_owners.hpp"
+#include "context_pool.h"
+#include "metrics.h"
 
 static std::string extract_and_remove_sd_cpp_extra_args(std::string& text) {
     std::regex re("<sd_cpp_extra_args>(.*?)</sd_cpp_extra_args>");
@@ -20,6 +22,18 @@ static std::string extract_and_remove_sd_cpp_extra_args(std::string& text) {
     return extracted;
 }
 
+// OpenAI clients often send a fixed model id such as "dall-e-3", so names that
+// are not known fall back to the startup model instead of failing the request.
+static std::string resolve_openai_model(ServerRuntime& runtime, const std::string& name) {
+    std::string model_path;
+    std::string error_message;
+    if (!resolve_request_model(runtime, name == "sd-cpp-local" ? "" : name, model_path, error_message)) {
+        LOG_DEBUG("%s, using the startup model", error_message.c_str());
+        model_path.clear();
+    }
+    return model_path;
+}
+
 static bool build_openai_generation_request(const httplib::Request& req,
                                             ServerRuntime& runtime,
                                             ImgGenJobRequest& request,
@@ -62,6 +76,7 @@ static bool build_openai_generation_request(const httplib::Request& req,
     request.gen_params.width       = width;
     request.gen_params.height      = height;
     request.gen_params.batch_count = n;
+    request.model_path             = resolve_openai_model(runtime, j.value("model", ""));
 
     std::string sd_cpp_extra_args_str = extract_and_remove_sd_cpp_extra_args(request.gen_params.prompt);
     if (!sd_cpp_extra_args_str.empty() && !request.gen_params.from_json_str(sd_cpp_extra_args_str)) {
@@ -204,6 +219,9 @@ static bool build_openai_edit_request(const httplib::Request& req,
             nullptr,
         });
     }
+    if (req.form.has_field("model")) {
+        request.model_path = resolve_openai_model(runtime, req.form.get_field("model"));
+    }
 
     std::string sd_cpp_extra_args_str = extract_and_remove_sd_cpp_extra_args(request.gen_params.prompt);
     if (!sd_cpp_extra_args_str.empty() && !request.gen_params.from_json_str(sd_cpp_extra_args_str)) {
@@ -228,9 +246,14 @@ static bool execute_sync_img_gen_request(ServerRuntime& runtime,
     int num_results                    = 0;
 
     {
-        std::lock_guard<std::mutex> lock(*runtime.sd_ctx_mutex);
-        sd_image_t* raw_results = generate_image(runtime.sd_ctx, &img_gen_params);
-        num_results             = request.gen_params.batch_count;
+        SDContextLease lease = runtime.context_pool->acquire(IMG_GEN, request.model_path);
+        if (!lease) {
+            error_message = unsupported_generation_mode_error(IMG_GEN);
+            return false;
+        }
+        sd_image_t* raw_results = generate_image(lease.get(), &img_gen_params);
+        runtime.metrics->record_generation(lease.get(), raw_results != nullptr);
+        num_results = request.gen_params.batch_count;
         results.adopt(raw_results, num_results);
     }
 
@@ -248,6 +271,10 @@ void register_openai_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
         json r;
         r["data"] = json::array();
         r["data"].push_back({{"id", "sd-cpp-local"}, {"object", "model"}, {"owned_by", "local"}});
+        std::lock_guard<std::mutex> lock(*runtime->model_mutex);
+        for (const auto& entry : *runtime->model_cache) {
+            r["data"].push_back({{"id", entry.path}, {"object", "model"}, {"owned_by", "local"}});
+        }
         res.set_content(r.dump(), "application/json");
     });
 
@@ -281,26 +308,21 @@ void register_openai_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             out["data"]          = json::array();
             out["output_format"] = request.output_format;
 
+            std::vector<std::vector<uint8_t>> encoded = encode_generated_images(*runtime,
+                                                                                request.gen_params,
+                                                                                results.data(),
+                                                                                request.gen_params.batch_count,
+                                                                                request.output_format == "jpeg"
+                                                                                    ? EncodedImageFormat::JPEG
+                                                                                : request.output_format == "webp"
+                                                                                    ? EncodedImageFormat::WEBP
+                                                                                    : EncodedImageFormat::PNG,
+                                                                                request.output_compression);
             for (int i = 0; i < request.gen_params.batch_count; ++i) {
                 if (results[i].data == nullptr) {
                     continue;
                 }
-                std::string params = request.gen_params.embed_image_metadata
-                                         ? get_image_params(*runtime->ctx_params,
-                                                            request.gen_params,
-                                                            request.gen_params.seed + i)
-                                         : "";
-                auto image_bytes   = encode_image_to_vector(request.output_format == "jpeg"
-                                                                ? EncodedImageFormat::JPEG
-                                                            : request.output_format == "webp"
-                                                                ? EncodedImageFormat::WEBP
-                                                                : EncodedImageFormat::PNG,
-                                                          results[i].data,
-                                                          results[i].width,
-                                                          results[i].height,
-                                                          results[i].channel,
-                                                          params,
-                                                          request.output_compression);
+                const std::vector<uint8_t>& image_bytes = encoded[i];
                 if (image_bytes.empty()) {
                     LOG_ERROR("write image to mem failed");
                     continue;
@@ -353,24 +375,18 @@ void register_openai_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             out["data"]          = json::array();
             out["output_format"] = request.output_format;
 
+            std::vector<std::vector<uint8_t>> encoded = encode_generated_images(*runtime,
+                                                                                request.gen_params,
+                                                                                results.data(),
+                                                                                request.gen_params.batch_count,
+                                                                                request.output_format == "jpeg" ? EncodedImageFormat::JPEG : EncodedImageFormat::PNG,
+                                                                                request.output_compression);
             for (int i = 0; i < request.gen_params.batch_count; ++i) {
                 if (results[i].data == nullptr) {
                     continue;
                 }
-                std::string params = request.gen_params.embed_image_metadata
-                                         ? get_image_params(*runtime->ctx_params,
-                                                            request.gen_params,
-                                                            request.gen_params.seed + i)
-                                         : "";
-                auto image_bytes   = encode_image_to_vector(request.output_format == "jpeg" ? EncodedImageFormat::JPEG : EncodedImageFormat::PNG,
-                                                          results[i].data,
-                                                          results[i].width,
-                                                          results[i].height,
-                                                          results[i].channel,
-                                                          params,
-                                                          request.output_compression);
                 json item;
-                item["b64_json"] = base64_encode(image_bytes);
+                item["b64_json"] = base64_encode(encoded[i]);
                 out["data"].push_back(item);
             }
 
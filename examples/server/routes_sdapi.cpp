@@ -10,6 +10,8 @@
 #include "common/common.h"
 #include "common/media_io.h"
 #include "common/resource_owners.hpp"
+#include "context_pool.h"
+#include "metrics.h"
 
 namespace fs = std::filesystem;
 
@@ -67,6 +69,7 @@ static enum sample_method_t get_sdapi_sample_method(std::string name) {
         {"k_res_multistep", RES_MULTISTEP_SAMPLE_METHOD},
         {"res 2s", RES_2S_SAMPLE_METHOD},
         {"k_res_2s", RES_2S_SAMPLE_METHOD},
+        {"heun adaptive", HEUN_ADAPTIVE_SAMPLE_METHOD},
         {"euler_cfg_pp", EULER_CFG_PP_SAMPLE_METHOD},
         {"k_euler_cfg_pp", EULER_CFG_PP_SAMPLE_METHOD},
         {"euler_a_cfg_pp", EULER_CFG_PP_SAMPLE_METHOD},
@@ -116,6 +119,16 @@ static bool build_sdapi_img_gen_request(const json& j,
 
     request.gen_params = *runtime.default_gen_params;
 
+    if (j.contains("override_settings") && j["override_settings"].is_object()) {
+        // A1111 clients pass back a title from /sdapi/v1/sd-models; unknown ones keep the startup model
+        std::string checkpoint = j["override_settings"].value("sd_model_checkpoint", "");
+        std::string model_error;
+        if (!resolve_request_model(runtime, checkpoint, request.model_path, model_error)) {
+            LOG_WARN("%s, using the startup model", model_error.c_str());
+            request.model_path.clear();
+        }
+    }
+
     request.gen_params.prompt                         = prompt;
     request.gen_params.negative_prompt                = negative_prompt;
     request.gen_params.seed                           = seed;
@@ -291,9 +304,15 @@ void register_sdapi_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             int num_results = 0;
 
             {
-                std::lock_guard<std::mutex> lock(*runtime->sd_ctx_mutex);
-                sd_image_t* raw_results = generate_image(runtime->sd_ctx, &img_gen_params);
-                num_results             = request.gen_params.batch_count;
+                SDContextLease lease = runtime->context_pool->acquire(IMG_GEN, request.model_path);
+                if (!lease) {
+                    res.status = 400;
+                    res.set_content(json({{"error", unsupported_generation_mode_error(IMG_GEN)}}).dump(), "application/json");
+                    return;
+                }
+                sd_image_t* raw_results = generate_image(lease.get(), &img_gen_params);
+                runtime->metrics->record_generation(lease.get(), raw_results != nullptr);
+                num_results = request.gen_params.batch_count;
                 results.adopt(raw_results, num_results);
             }
 
@@ -308,23 +327,18 @@ void register_sdapi_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             out["parameters"] = j;
             out["info"]       = "";
 
+            std::vector<std::vector<uint8_t>> encoded = encode_generated_images(*runtime,
+                                                                                request.gen_params,
+                                                                                results.data(),
+                                                                                num_results,
+                                                                                EncodedImageFormat::PNG,
+                                                                                90);
             for (int i = 0; i < num_results; ++i) {
                 if (results[i].data == nullptr) {
                     continue;
                 }
 
-                std::string params = request.gen_params.embed_image_metadata
-                                         ? get_image_params(*runtime->ctx_params,
-                                                            request.gen_params,
-                                                            request.gen_params.seed + i)
-                                         : "";
-                auto image_bytes   = encode_image_to_vector(EncodedImageFormat::PNG,
-                                                            results[i].data,
-                                                            results[i].width,
-                                                            results[i].height,
-                                                            results[i].channel,
-                                                            params);
-
+                const std::vector<uint8_t>& image_bytes = encoded[i];
                 if (image_bytes.empty()) {
                     LOG_ERROR("write image to mem failed");
                     continue;
@@ -460,9 +474,26 @@ void register_sdapi_endpoints(httplib::Server& svr, ServerRuntime& rt) {
         entry["config"]     = nullptr;
         json r              = json::array();
         r.push_back(entry);
+
+        std::lock_guard<std::mutex> lock(*runtime->model_mutex);
+        for (const auto& model : *runtime->model_cache) {
+            json model_entry;
+            model_entry["title"]      = model.name;
+            model_entry["model_name"] = model.name;
+            model_entry["filename"]   = model.path;
+            model_entry["hash"]       = "8888888888";
+            model_entry["sha256"]     = "8888888888888888888888888888888888888888888888888888888888888888";
+            model_entry["config"]     = nullptr;
+            r.push_back(model_entry);
+        }
         res.set_content(r.dump(), "application/json");
     });
 
+    svr.Post("/sdapi/v1/refresh-checkpoints", [runtime](const httplib::Request&, httplib::Response& res) {
+        refresh_model_cache(*runtime);
+        res.set_content("null", "application/json");
+    });
+
     svr.Get("/sdapi/v1/options", [runtime](const httplib::Request&, httplib::Response& res) {
         fs::path model_path = resolve_display_model_path(*runtime);
         json r;
@@ -2,10 +2,12 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <filesystem>
 
 #include "async_jobs.h"
 #include "common/common.h"
+#include "metrics.h"
 
 namespace fs = std::filesystem;
 
@@ -63,6 +65,7 @@ static json make_vae_tiling_json(const sd_tiling_params_t& params) {
         {"rel_size_x", params.rel_size_x},
         {"rel_size_y", params.rel_size_y},
         {"extra_tiling_args", params.extra_tiling_args ? params.extra_tiling_args : ""},
+        {"auto_tile_size", params.auto_tile_size},
     };
 }
 
@@ -126,6 +129,7 @@ static json make_img_gen_defaults_json(const SDGenerationParams& defaults, const
         {"strength", defaults.strength},
         {"seed", defaults.seed},
         {"batch_count", defaults.batch_count},
+        {"latent_batch_size", defaults.latent_batch_size},
         {"auto_resize_ref_image", defaults.auto_resize_ref_image},
         {"increase_ref_index", defaults.increase_ref_index},
         {"control_strength", defaults.control_strength},
@@ -179,6 +183,7 @@ static json make_img_gen_features_json() {
         {"cache", true},
         {"cancel_queued", true},
         {"cancel_generating", false},
+        {"provisional", true},
     };
 }
 
@@ -211,6 +216,7 @@ static json make_capabilities_json(ServerRuntime& runtime) {
     json video_output_formats = supported_vid_output_formats();
     json available_loras      = json::array();
     json available_upscalers  = json::array();
+    json available_models     = json::array();
     json supported_modes      = json::array();
 
     for (int i = 0; i < SAMPLE_METHOD_COUNT; ++i) {
@@ -231,6 +237,16 @@ static json make_capabilities_json(ServerRuntime& runtime) {
         }
     }
 
+    {
+        std::lock_guard<std::mutex> lock(*runtime.model_mutex);
+        for (const auto& entry : *runtime.model_cache) {
+            available_models.push_back({
+                {"name", entry.name},
+                {"path", entry.path},
+            });
+        }
+    }
+
     available_upscalers.push_back({
         {"name", "None"},
     });
@@ -341,6 +357,7 @@ static json make_capabilities_json(ServerRuntime& runtime) {
     result["features"]               = top_level_features;
     result["features_by_mode"]       = features_by_mode;
     result["loras"]                  = available_loras;
+    result["models"]                 = available_models;
     result["upscalers"]              = available_upscalers;
     return result;
 }
@@ -358,17 +375,26 @@ static bool parse_img_gen_request(const json& body,
         error_message = "invalid generation parameters";
         return false;
     }
+    if (!resolve_request_model(runtime, body.value("model", ""), request.model_path, error_message)) {
+        return false;
+    }
 
     std::string output_format = body.value("output_format", "png");
     int output_compression    = body.value("output_compression", 100);
     if (!assign_output_options(request, output_format, output_compression, true, error_message)) {
         return false;
     }
+    // resolve replaces a random seed with a drawn one
+    const bool fixed_seed = request.gen_params.seed >= 0;
     // Intentionally disable prompt-embedded LoRA tag parsing for server APIs.
     if (!request.gen_params.resolve_and_validate(IMG_GEN, "", runtime.ctx_params->hires_upscalers_dir, true)) {
         error_message = "invalid generation parameters";
         return false;
     }
+    // also keys the identical requests that follow a queued or running one
+    if (fixed_seed) {
+        request.result_cache_key = img_gen_result_cache_key(request);
+    }
     return true;
 }
 
@@ -385,6 +411,9 @@ static bool parse_vid_gen_request(const json& body,
         error_message = "invalid generation parameters";
         return false;
     }
+    if (!resolve_request_model(runtime, body.value("model", ""), request.model_path, error_message)) {
+        return false;
+    }
 
     std::string output_format = body.value("output_format", "webm");
     int output_compression    = body.value("output_compression", 100);
@@ -399,6 +428,23 @@ static bool parse_vid_gen_request(const json& body,
     return true;
 }
 
+// "priority" picks the queue lane; "tenant", or an X-Tenant header, groups jobs
+// for fair sharing within the lane.
+static bool parse_job_scheduling(const json& body,
+                                 const httplib::Request& req,
+                                 AsyncJobPriority default_priority,
+                                 AsyncGenerationJob& job,
+                                 std::string& error_message) {
+    job.priority = default_priority;
+    if (body.contains("priority") &&
+        (!body["priority"].is_string() || !parse_async_job_priority(body["priority"].get<std::string>(), job.priority))) {
+        error_message = "priority must be interactive or batch";
+        return false;
+    }
+    job.tenant = body.value("tenant", req.get_header_value("X-Tenant"));
+    return true;
+}
+
 void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
     ServerRuntime* runtime = &rt;
 
@@ -407,6 +453,21 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
         res.set_content(make_capabilities_json(*runtime).dump(), "application/json");
     });
 
+    svr.Get("/health", [runtime](const httplib::Request&, httplib::Response& res) {
+        if (runtime->pending_warmups->load() > 0) {
+            res.status = 503;
+            res.set_content(R"({"status":"warming_up"})", "application/json");
+            return;
+        }
+        res.status = 200;
+        res.set_content(R"({"status":"ok"})", "application/json");
+    });
+
+    svr.Get("/metrics", [runtime](const httplib::Request&, httplib::Response& res) {
+        res.status = 200;
+        res.set_content(runtime->metrics->render(*runtime), "text/plain; version=0.0.4");
+    });
+
     svr.Post("/sdcpp/v1/img_gen", [runtime](const httplib::Request& req, httplib::Response& res) {
         try {
             if (req.body.empty()) {
@@ -435,21 +496,53 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             job->status                             = AsyncJobStatus::Queued;
             job->created_at                         = unix_timestamp_now();
             job->img_gen                            = std::move(request);
+            if (!parse_job_scheduling(body, req, AsyncJobPriority::Interactive, *job, error_message)) {
+                res.status = 400;
+                res.set_content(json({{"error", error_message}}).dump(), "application/json");
+                return;
+            }
 
             {
                 std::lock_guard<std::mutex> lock(manager.mutex);
                 purge_expired_jobs(manager);
-                if (count_pending_jobs(manager) >= manager.max_pending_jobs) {
+                // admitted first, a forced VAE tiling is part of the cache key
+                const bool admitted          = admit_async_job_memory(manager, *job, error_message);
+                const std::string& cache_key = job->img_gen.result_cache_key;
+                std::shared_ptr<AsyncGenerationJob> in_flight;
+                if (!cache_key.empty() && manager.result_cache.enabled() &&
+                    manager.result_cache.get(cache_key, job->results)) {
+                    job->status       = AsyncJobStatus::Completed;
+                    job->started_at   = job->created_at;
+                    job->completed_at = job->created_at;
+                    job->started_time = job->queued_time;
+                } else if ((in_flight = find_in_flight_job(manager, cache_key)) != nullptr) {
+                    // runs once, with the results shared when that job finishes
+                    job->leader = in_flight->id;
+                } else if (!admitted) {
+                    res.status = 413;
+                    res.set_content(json({{"error", error_message}}).dump(), "application/json");
+                    return;
+                } else if (count_pending_jobs(manager) >= manager.max_pending_jobs) {
                     res.status = 429;
                     res.set_content(R"({"error":"job queue is full"})", "application/json");
                     return;
                 }
                 job->id               = make_async_job_id(manager);
                 manager.jobs[job->id] = job;
-                manager.queue.push_back(job->id);
+                if (in_flight) {
+                    in_flight->followers.push_back(job->id);
+                    manager.coalesced_jobs++;
+                } else if (job->status == AsyncJobStatus::Queued) {
+                    manager.queue.push_back(job->id);
+                    if (!cache_key.empty()) {
+                        manager.in_flight[cache_key] = job->id;
+                    }
+                }
             }
 
-            manager.cv.notify_one();
+            if (job->status == AsyncJobStatus::Queued && job->leader.empty()) {
+                manager.cv.notify_one();
+            }
 
             json out;
             out["id"]       = job->id;
@@ -497,10 +590,20 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
             job->status                             = AsyncJobStatus::Queued;
             job->created_at                         = unix_timestamp_now();
             job->vid_gen                            = std::move(request);
+            if (!parse_job_scheduling(body, req, AsyncJobPriority::Batch, *job, error_message)) {
+                res.status = 400;
+                res.set_content(json({{"error", error_message}}).dump(), "application/json");
+                return;
+            }
 
             {
                 std::lock_guard<std::mutex> lock(manager.mutex);
                 purge_expired_jobs(manager);
+                if (!admit_async_job_memory(manager, *job, error_message)) {
+                    res.status = 413;
+                    res.set_content(json({{"error", error_message}}).dump(), "application/json");
+                    return;
+                }
                 if (count_pending_jobs(manager) >= manager.max_pending_jobs) {
                     res.status = 429;
                     res.set_content(R"({"error":"job queue is full"})", "application/json");
@@ -533,24 +636,208 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
 
     svr.Get(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+))", [runtime](const httplib::Request& req, httplib::Response& res) {
         AsyncJobManager& manager = *runtime->async_job_manager;
-        std::lock_guard<std::mutex> lock(manager.mutex);
-        purge_expired_jobs(manager);
+        json out;
+        AsyncJobKind kind = AsyncJobKind::ImgGen;
+        std::vector<AsyncJobResultPtr> results;
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            purge_expired_jobs(manager);
+
+            std::string job_id = req.matches[1];
+            auto it            = manager.jobs.find(job_id);
+            if (it == manager.jobs.end()) {
+                if (manager.expired_jobs.find(job_id) != manager.expired_jobs.end()) {
+                    res.status = 410;
+                    res.set_content(R"({"error":"job expired"})", "application/json");
+                } else {
+                    res.status = 404;
+                    res.set_content(R"({"error":"job not found"})", "application/json");
+                }
+                return;
+            }
 
-        std::string job_id = req.matches[1];
-        auto it            = manager.jobs.find(job_id);
-        if (it == manager.jobs.end()) {
-            if (manager.expired_jobs.find(job_id) != manager.expired_jobs.end()) {
-                res.status = 410;
-                res.set_content(R"({"error":"job expired"})", "application/json");
-            } else {
+            out  = make_async_job_json(manager, *it->second);
+            kind = it->second->kind;
+            if (it->second->status == AsyncJobStatus::Completed) {
+                results = it->second->results;
+            }
+        }
+
+        // ?b64_json=false leaves the results to /result/{index} downloads
+        const std::string b64_json = req.get_param_value("b64_json");
+        if (b64_json != "false" && b64_json != "0") {
+            embed_async_job_results_b64(out, kind, results);
+        }
+        res.status = 200;
+        res.set_content(out.dump(), "application/json");
+    });
+
+    svr.Get(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)/result/([0-9]+))", [runtime](const httplib::Request& req, httplib::Response& res) {
+        AsyncJobManager& manager = *runtime->async_job_manager;
+        AsyncJobResultPtr result;
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            purge_expired_jobs(manager);
+
+            std::string job_id = req.matches[1];
+            auto it            = manager.jobs.find(job_id);
+            if (it == manager.jobs.end()) {
+                if (manager.expired_jobs.find(job_id) != manager.expired_jobs.end()) {
+                    res.status = 410;
+                    res.set_content(R"({"error":"job expired"})", "application/json");
+                } else {
+                    res.status = 404;
+                    res.set_content(R"({"error":"job not found"})", "application/json");
+                }
+                return;
+            }
+            if (it->second->status != AsyncJobStatus::Completed) {
+                res.status = 409;
+                res.set_content(R"({"error":"job has no result"})", "application/json");
+                return;
+            }
+            size_t index = std::strtoull(req.matches[2].str().c_str(), nullptr, 10);
+            if (index >= it->second->results.size()) {
                 res.status = 404;
-                res.set_content(R"({"error":"job not found"})", "application/json");
+                res.set_content(R"({"error":"result not found"})", "application/json");
+                return;
             }
-            return;
+            result = it->second->results[index];
+        }
+
+        // httplib serves Range requests from a sized content provider; the
+        // provider holds the result, so it outlives the job being purged.
+        // Mapped results are written straight from the page cache.
+        res.status = 200;
+        res.set_content_provider(
+            result->size,
+            result->mime_type,
+            [result](size_t offset, size_t length, httplib::DataSink& sink) {
+                constexpr size_t chunk_size = 1 << 20;
+                if (const uint8_t* data = result->data()) {
+                    return sink.write(reinterpret_cast<const char*>(data + offset), std::min(length, chunk_size));
+                }
+                std::vector<uint8_t> chunk;
+                if (!result->read(offset, std::min(length, chunk_size), chunk)) {
+                    return false;
+                }
+                return sink.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+            });
+    });
+
+    // Server-sent events: "progress" on every status, queue position or step
+    // change, "preview" with each new preview image, then "done" with the job
+    // object (results by url) before the stream closes.
+    svr.Get(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)/events)", [runtime](const httplib::Request& req, httplib::Response& res) {
+        AsyncJobManager& manager = *runtime->async_job_manager;
+        std::shared_ptr<AsyncGenerationJob> job;
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            purge_expired_jobs(manager);
+
+            std::string job_id = req.matches[1];
+            auto it            = manager.jobs.find(job_id);
+            if (it == manager.jobs.end()) {
+                if (manager.expired_jobs.find(job_id) != manager.expired_jobs.end()) {
+                    res.status = 410;
+                    res.set_content(R"({"error":"job expired"})", "application/json");
+                } else {
+                    res.status = 404;
+                    res.set_content(R"({"error":"job not found"})", "application/json");
+                }
+                return;
+            }
+            job = it->second;
+            ++job->event_subscribers;
         }
 
+        struct EventStreamState {
+            std::string last_progress;
+            uint64_t preview_version     = 0;
+            uint64_t provisional_version = 0;
+        };
+        auto state = std::make_shared<EventStreamState>();
         res.status = 200;
-        res.set_content(make_async_job_json(manager, *it->second).dump(), "application/json");
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider(
+            "text/event-stream",
+            [runtime, job, state](size_t, httplib::DataSink& sink) {
+                AsyncJobManager& manager = *runtime->async_job_manager;
+                std::string events;
+                std::vector<uint8_t> preview_bytes;
+                std::vector<uint8_t> provisional_bytes;
+                json preview;
+                json provisional;
+                bool finished = false;
+                {
+                    std::unique_lock<std::mutex> lock(manager.mutex);
+                    // comment lines keep idle proxies from closing the stream
+                    auto keepalive_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(15);
+                    while (true) {
+                        std::string progress = make_async_job_progress_json(manager, *job).dump();
+                        if (progress != state->last_progress) {
+                            events += "event: progress\ndata: " + progress + "\n\n";
+                            state->last_progress = std::move(progress);
+                        }
+                        finished = job->completed_at != 0;
+                        if (!finished && job->preview_version != state->preview_version) {
+                            state->preview_version = job->preview_version;
+                            preview_bytes          = job->preview_bytes;
+                            preview                = {
+                                {"step", job->preview_step},
+                                {"mime_type", job->preview_mime_type},
+                            };
+                        }
+                        if (!finished && job->provisional == AsyncJobProvisional::Pending &&
+                            job->provisional_version != state->provisional_version) {
+                            state->provisional_version = job->provisional_version;
+                            provisional_bytes          = job->provisional_bytes;
+                            provisional                = {
+                                {"step", job->provisional_step},
+                                {"mime_type", job->provisional_mime_type},
+                            };
+                        }
+                        if (finished) {
+                            events += "event: done\ndata: " + make_async_job_json(manager, *job).dump() + "\n\n";
+                        }
+                        if (finished || !events.empty() || !preview_bytes.empty() || !provisional_bytes.empty() || manager.stop) {
+                            break;
+                        }
+                        uint64_t version = manager.events_version;
+                        if (!manager.events_cv.wait_until(lock, keepalive_deadline, [&]() {
+                                return manager.events_version != version || manager.stop;
+                            })) {
+                            break;
+                        }
+                    }
+                    if (manager.stop && !finished) {
+                        return false;
+                    }
+                }
+
+                if (!preview_bytes.empty()) {
+                    preview["b64_json"] = base64_encode(preview_bytes);
+                    events += "event: preview\ndata: " + preview.dump() + "\n\n";
+                }
+                if (!provisional_bytes.empty()) {
+                    provisional["b64_json"] = base64_encode(provisional_bytes);
+                    events += "event: provisional\ndata: " + provisional.dump() + "\n\n";
+                }
+                if (events.empty()) {
+                    events = ": keepalive\n\n";
+                }
+                if (!sink.write(events.data(), events.size())) {
+                    return false;
+                }
+                if (finished) {
+                    sink.done();
+                }
+                return true;
+            },
+            [runtime, job](bool) {
+                std::lock_guard<std::mutex> lock(runtime->async_job_manager->mutex);
+                --job->event_subscribers;
+            });
     });
 
     svr.Post(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)/cancel)", [runtime](const httplib::Request& req, httplib::Response& res) {
@@ -578,6 +865,14 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
                 res.set_content(R"({"error":"job queue state changed before cancellation"})", "application/json");
                 return;
             }
+            runtime->metrics->observe_cancelled_job(job.kind);
+            res.status = 200;
+            res.set_content(make_async_job_json(manager, job).dump(), "application/json");
+            return;
+        }
+
+        if (answer_provisional_job(manager, job, false)) {
+            // the job ends as cancelled once the sampler stops
             res.status = 200;
             res.set_content(make_async_job_json(manager, job).dump(), "application/json");
             return;
@@ -592,4 +887,32 @@ void register_sdcpp_api_endpoints(httplib::Server& svr, ServerRuntime& rt) {
         res.status = 200;
         res.set_content(make_async_job_json(manager, job).dump(), "application/json");
     });
+
+    svr.Post(R"(/sdcpp/v1/jobs/([A-Za-z0-9_\-]+)/confirm)", [runtime](const httplib::Request& req, httplib::Response& res) {
+        AsyncJobManager& manager = *runtime->async_job_manager;
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        purge_expired_jobs(manager);
+
+        std::string job_id = req.matches[1];
+        auto it            = manager.jobs.find(job_id);
+        if (it == manager.jobs.end()) {
+            if (manager.expired_jobs.find(job_id) != manager.expired_jobs.end()) {
+                res.status = 410;
+                res.set_content(R"({"error":"job expired"})", "application/json");
+            } else {
+                res.status = 404;
+                res.set_content(R"({"error":"job not found"})", "application/json");
+            }
+            return;
+        }
+
+        auto& job = *it->second;
+        if (!answer_provisional_job(manager, job, true)) {
+            res.status = 409;
+            res.set_content(R"({"error":"job is not waiting for a provisional image answer"})", "application/json");
+            return;
+        }
+        res.status = 200;
+        res.set_content(make_async_job_json(manager, job).dump(), "application/json");
+    });
 }
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <cctype>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
 #include <mutex>
@@ -11,6 +12,7 @@
 
 #include "common/common.h"
 #include "common/log.h"
+#include "context_pool.h"
 
 namespace fs = std::filesystem;
 
@@ -52,6 +54,26 @@ std::string base64_encode(const std::vector<uint8_t>& bytes) {
     return ret;
 }
 
+std::vector<std::vector<uint8_t>> encode_generated_images(const ServerRuntime& runtime,
+                                                          const SDGenerationParams& gen_params,
+                                                          const sd_image_t* images,
+                                                          int num_images,
+                                                          EncodedImageFormat format,
+                                                          int quality,
+                                                          int first_index) {
+    std::vector<ImageEncodeInput> inputs(std::max(num_images, 0));
+    for (int i = 0; i < num_images; ++i) {
+        inputs[i].image      = images[i].data;
+        inputs[i].width      = static_cast<int>(images[i].width);
+        inputs[i].height     = static_cast<int>(images[i].height);
+        inputs[i].channels   = static_cast<int>(images[i].channel);
+        inputs[i].parameters = gen_params.embed_image_metadata && images[i].data != nullptr
+                                   ? get_image_params(*runtime.ctx_params, gen_params, gen_params.seed + first_index + i)
+                                   : "";
+    }
+    return encode_images_to_vectors(format, inputs, quality);
+}
+
 std::string normalize_output_format(std::string output_format) {
     std::transform(output_format.begin(), output_format.end(), output_format.begin(),
                    [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
@@ -167,13 +189,7 @@ std::string video_mime_type(const std::string& output_format) {
 }
 
 bool runtime_supports_generation_mode(const ServerRuntime& runtime, SDMode mode) {
-    if (mode == VID_GEN) {
-        return sd_ctx_supports_video_generation(runtime.sd_ctx);
-    }
-    if (mode == IMG_GEN) {
-        return sd_ctx_supports_image_generation(runtime.sd_ctx);
-    }
-    return true;
+    return runtime.context_pool->supports_generation_mode(mode);
 }
 
 std::string unsupported_generation_mode_error(SDMode mode) {
@@ -192,15 +208,112 @@ ArgOptions SDSvrParams::get_options() {
     options.string_options = {
         {"-l", "--listen-ip", "server listen ip (default: 127.0.0.1)", 0, &listen_ip},
         {"", "--serve-html-path", "path to HTML file to serve at root (optional)", 0, &serve_html_path},
+        {"",
+         "--context-backends",
+         "';'-separated backend specs, one model context per entry (e.g. \"cuda0;cuda1\"). "
+         "Requests are served by whichever context is idle (default: one context on --backend)",
+         0,
+         &context_backends},
+        {"",
+         "--models-dir",
+         "directory of further models requests can select by name; each is loaded on first use (default: none)",
+         0,
+         &models_dir},
+        {"",
+         "--result-dir",
+         "directory async job results are written to instead of being kept in RAM until they expire (default: none)",
+         0,
+         &result_dir},
+        {"",
+         "--preview",
+         "preview method streamed to /sdcpp/v1/jobs/{id}/events subscribers, one of [none, proj, tae, vae]; "
+         "tae needs --taesd (default: none)",
+         0,
+         &preview},
+        {"",
+         "--preview-format",
+         "image format of streamed previews, jpeg or webp (default: jpeg)",
+         0,
+         &preview_format},
+        {"",
+         "--warmup",
+         "','-separated WxH sizes (e.g. \"512x512,1024x1024\") each startup context generates once with one "
+         "step before /health reports ready, so first requests at those sizes skip loading and kernel setup "
+         "(default: none)",
+         0,
+         &warmup},
+        {"",
+         "--coordinator",
+         "URL of a --coordinator-mode server this server reports its models and queue to every few seconds, "
+         "so the coordinator can route jobs to it (default: none)",
+         0,
+         &coordinator},
+        {"",
+         "--advertise-url",
+         "URL the coordinator reaches this server at (default: http://<listen-ip>:<listen-port>)",
+         0,
+         &advertise_url},
+        {"",
+         "--cluster-workers",
+         "','-separated URLs of the workers a --coordinator-mode server accepts reports from, as they "
+         "advertise themselves; reports naming any other URL are refused (required with --coordinator-mode)",
+         0,
+         &cluster_workers},
     };
 
     options.int_options = {
         {"", "--listen-port", "server listen port (default: 1234)", &listen_port},
+        {"",
+         "--max-merged-images",
+         "max images per sampler batch when merging compatible queued async image jobs "
+         "(same params except seed and batch count, no input images). 1 disables merging (default: 1)",
+         &max_merged_images},
+        {"",
+         "--models-budget-mb",
+         "MiB of params RAM + VRAM all loaded models may keep resident; idle models beyond it have their "
+         "params evicted, least recently used first (0 = unlimited, default: 0)",
+         &models_budget_mb},
+        {"",
+         "--png-compression-level",
+         "zlib effort of PNG results from 1 (fastest, largest) to 9; levels up to 3 also use a single "
+         "PNG row filter (default: 8)",
+         &png_compression_level},
+        {"",
+         "--result-cache-mb",
+         "MiB of encoded async image results kept for reuse by identical requests with a fixed seed, "
+         "in RAM or in --result-dir (0 = disabled, default: 0)",
+         &result_cache_mb},
+        {"",
+         "--compute-budget-mb",
+         "MiB of compute buffers a job may need, predicted from the peaks earlier jobs of the same model "
+         "reached; jobs over it are rejected, or get VAE tiling when only the decode is over, and queued "
+         "jobs wait while running ones would push the total over it (0 = disabled, default: 0)",
+         &compute_budget_mb},
+        {"",
+         "--preview-interval",
+         "denoising steps between streamed previews (default: 1)",
+         &preview_interval},
+        {"",
+         "--provisional-timeout",
+         "seconds a job holds at its provisional image (extra sample arg provisional_step) for the client "
+         "to confirm or cancel it; an unanswered image counts as confirmed (default: 60)",
+         &provisional_timeout},
+        {"",
+         "--result-ttl",
+         "seconds completed async jobs keep their results; results in --result-dir hold no RAM, so they "
+         "can be kept much longer (default: 600)",
+         &result_ttl},
     };
 
     options.bool_options = {
         {"-v", "--verbose", "print extra info", true, &verbose},
         {"", "--color", "colors the logging tags according to level", true, &color},
+        {"",
+         "--coordinator-mode",
+         "load no model and route /sdcpp/v1/img_gen and vid_gen jobs to the servers reporting with --coordinator, "
+         "by model, LoRA and prompt affinity, then by queue length",
+         true,
+         &coordinator_mode},
     };
 
     auto on_help_arg = [&](int, const char**, int, bool& valid) {
@@ -226,10 +339,92 @@ bool SDSvrParams::validate() {
         return false;
     }
 
+    if (max_merged_images < 1) {
+        LOG_ERROR("error: max_merged_images must be at least 1");
+        return false;
+    }
+
+    if (models_budget_mb < 0) {
+        LOG_ERROR("error: models_budget_mb must not be negative");
+        return false;
+    }
+
+    if (compute_budget_mb < 0) {
+        LOG_ERROR("error: compute_budget_mb must not be negative");
+        return false;
+    }
+
+    if (result_cache_mb < 0) {
+        LOG_ERROR("error: result_cache_mb must not be negative");
+        return false;
+    }
+
+    if (png_compression_level < 1 || png_compression_level > 9) {
+        LOG_ERROR("error: png_compression_level must be in the range [1, 9]");
+        return false;
+    }
+
+    if (preview != "none" && preview != "proj" && preview != "tae" && preview != "vae") {
+        LOG_ERROR("error: preview must be one of none, proj, tae, vae");
+        return false;
+    }
+
+    if (preview_format != "jpeg" && preview_format != "webp") {
+        LOG_ERROR("error: preview_format must be jpeg or webp");
+        return false;
+    }
+#ifndef SD_USE_WEBP
+    if (preview_format == "webp") {
+        LOG_ERROR("error: webp previews need a build with WebP support");
+        return false;
+    }
+#endif
+
+    if (preview_interval < 1) {
+        LOG_ERROR("error: preview_interval must be at least 1");
+        return false;
+    }
+
+    if (provisional_timeout < 1) {
+        LOG_ERROR("error: provisional_timeout must be at least 1");
+        return false;
+    }
+
+    if (result_ttl < 1) {
+        LOG_ERROR("error: result_ttl must be at least 1");
+        return false;
+    }
+
+    std::vector<std::pair<int, int>> warmup_sizes;
+    if (!get_warmup_sizes(&warmup_sizes)) {
+        LOG_ERROR("error: warmup must be a ','-separated list of WxH sizes, got '%s'", warmup.c_str());
+        return false;
+    }
+
+    if (!models_dir.empty() && !fs::is_directory(models_dir)) {
+        LOG_ERROR("error: models_dir is not a directory: %s", models_dir.c_str());
+        return false;
+    }
+
+    if (!result_dir.empty() && !fs::is_directory(result_dir)) {
+        LOG_ERROR("error: result_dir is not a directory: %s", result_dir.c_str());
+        return false;
+    }
+
     if (!serve_html_path.empty() && !fs::exists(serve_html_path)) {
         LOG_ERROR("error: serve_html_path file does not exist: %s", serve_html_path.c_str());
         return false;
     }
+
+    if (coordinator_mode && !coordinator.empty()) {
+        LOG_ERROR("error: a coordinator does not report to another coordinator");
+        return false;
+    }
+
+    if (coordinator_mode && get_cluster_workers().empty()) {
+        LOG_ERROR("error: --coordinator-mode needs --cluster-workers, the URLs of the workers it may route to");
+        return false;
+    }
     return true;
 }
 
@@ -246,10 +441,90 @@ std::string SDSvrParams::to_string() const {
         << "  listen_ip: " << listen_ip << ",\n"
         << "  listen_port: \"" << listen_port << "\",\n"
         << "  serve_html_path: \"" << serve_html_path << "\",\n"
+        << "  context_backends: \"" << context_backends << "\",\n"
+        << "  models_dir: \"" << models_dir << "\",\n"
+        << "  result_dir: \"" << result_dir << "\",\n"
+        << "  max_merged_images: " << max_merged_images << ",\n"
+        << "  models_budget_mb: " << models_budget_mb << ",\n"
+        << "  png_compression_level: " << png_compression_level << ",\n"
+        << "  result_cache_mb: " << result_cache_mb << ",\n"
+        << "  compute_budget_mb: " << compute_budget_mb << ",\n"
+        << "  preview: " << preview << ",\n"
+        << "  preview_format: " << preview_format << ",\n"
+        << "  preview_interval: " << preview_interval << ",\n"
+        << "  provisional_timeout: " << provisional_timeout << ",\n"
+        << "  result_ttl: " << result_ttl << ",\n"
+        << "  warmup: \"" << warmup << "\",\n"
+        << "  coordinator_mode: " << (coordinator_mode ? "true" : "false") << ",\n"
+        << "  coordinator: \"" << coordinator << "\",\n"
+        << "  advertise_url: \"" << advertise_url << "\",\n"
+        << "  cluster_workers: \"" << cluster_workers << "\",\n"
         << "}";
     return oss.str();
 }
 
+preview_t SDSvrParams::get_preview_mode() const {
+    if (preview == "proj") {
+        return PREVIEW_PROJ;
+    }
+    if (preview == "tae") {
+        return PREVIEW_TAE;
+    }
+    if (preview == "vae") {
+        return PREVIEW_VAE;
+    }
+    return PREVIEW_NONE;
+}
+
+std::vector<std::string> SDSvrParams::get_context_backends() const {
+    std::vector<std::string> backends;
+    std::stringstream ss(context_backends);
+    std::string item;
+    while (std::getline(ss, item, ';')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (!item.empty()) {
+            backends.push_back(item);
+        }
+    }
+    return backends;
+}
+
+std::vector<std::string> SDSvrParams::get_cluster_workers() const {
+    std::vector<std::string> urls;
+    std::stringstream ss(cluster_workers);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t/") + 1);
+        if (!item.empty()) {
+            urls.push_back(item);
+        }
+    }
+    return urls;
+}
+
+bool SDSvrParams::get_warmup_sizes(std::vector<std::pair<int, int>>* sizes) const {
+    sizes->clear();
+    std::stringstream ss(warmup);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (item.empty()) {
+            continue;
+        }
+        int width  = 0;
+        int height = 0;
+        char tail  = 0;
+        if (sscanf(item.c_str(), "%dx%d%c", &width, &height, &tail) != 2 || width <= 0 || height <= 0) {
+            return false;
+        }
+        sizes->emplace_back(width, height);
+    }
+    return true;
+}
+
 void refresh_lora_cache(ServerRuntime& rt) {
     std::vector<LoraEntry> new_cache;
 
@@ -326,6 +601,76 @@ void refresh_upscaler_cache(ServerRuntime& rt) {
     }
 }
 
+void refresh_model_cache(ServerRuntime& rt) {
+    std::vector<ModelEntry> new_cache;
+
+    fs::path models_dir = rt.svr_params->models_dir;
+    if (!models_dir.empty() && fs::is_directory(models_dir)) {
+        for (auto& entry : fs::recursive_directory_iterator(models_dir, fs::directory_options::skip_permission_denied)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            const fs::path& p = entry.path();
+            if (!is_supported_model_ext(p)) {
+                continue;
+            }
+
+            ModelEntry model_entry;
+            model_entry.name     = p.stem().u8string();
+            model_entry.fullpath = fs::absolute(p).lexically_normal().u8string();
+            std::string rel      = p.lexically_relative(models_dir).u8string();
+            std::replace(rel.begin(), rel.end(), '\\', '/');
+            model_entry.path = rel;
+
+            new_cache.push_back(std::move(model_entry));
+        }
+    }
+
+    std::sort(new_cache.begin(), new_cache.end(), [](const ModelEntry& a, const ModelEntry& b) {
+        return a.path < b.path;
+    });
+
+    // paths win over names, and the first path in order over later files of the same name
+    std::unordered_map<std::string, std::string> new_index;
+    for (const ModelEntry& entry : new_cache) {
+        new_index[entry.path] = entry.fullpath;
+    }
+    for (const ModelEntry& entry : new_cache) {
+        new_index.emplace(entry.name, entry.fullpath);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(*rt.model_mutex);
+        *rt.model_cache = std::move(new_cache);
+        *rt.model_index = std::move(new_index);
+    }
+}
+
+std::string default_model_name(const ServerRuntime& rt) {
+    const auto& ctx         = *rt.ctx_params;
+    const std::string& path = !ctx.model_path.empty() ? ctx.model_path : ctx.diffusion_model_path;
+    return fs::path(path).stem().u8string();
+}
+
+bool resolve_request_model(ServerRuntime& rt,
+                           const std::string& name,
+                           std::string& model_path,
+                           std::string& error_message) {
+    model_path.clear();
+    if (name.empty() || name == default_model_name(rt)) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(*rt.model_mutex);
+    auto it = rt.model_index->find(name);
+    if (it == rt.model_index->end()) {
+        error_message = "unknown model '" + name + "'";
+        return false;
+    }
+    model_path = it->second;
+    return true;
+}
+
 int64_t unix_timestamp_now() {
     return std::chrono::duration_cast<std::chrono::seconds>(
                std::chrono::system_clock::now().time_since_epoch())
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <json.hpp>
 #include "common/common.h"
+#include "common/media_io.h"
 #include "common/resource_owners.hpp"
 #include "stable-diffusion.h"
 
@@ -16,12 +20,32 @@ using json = nlohmann::json;
 struct ArgOptions;
 struct SDContextParams;
 struct AsyncJobManager;
+class SDContextPool;
+class ServerMetrics;
 
 struct SDSvrParams {
     std::string listen_ip = "127.0.0.1";
     int listen_port       = 1234;
     std::string serve_html_path;
-    bool normal_exit = false;
+    std::string context_backends;
+    std::string models_dir;
+    std::string result_dir;
+    int max_merged_images      = 1;
+    int models_budget_mb       = 0;
+    int png_compression_level  = 8;
+    int result_cache_mb        = 0;
+    int compute_budget_mb      = 0;
+    std::string preview        = "none";
+    std::string preview_format = "jpeg";
+    int preview_interval       = 1;
+    int provisional_timeout    = 60;
+    int result_ttl             = 600;
+    bool coordinator_mode      = false;
+    std::string warmup;
+    std::string coordinator;
+    std::string advertise_url;
+    std::string cluster_workers;
+    bool normal_exit      = false;
     bool verbose     = false;
     bool color       = false;
 
@@ -29,6 +53,13 @@ struct SDSvrParams {
     bool validate();
     bool resolve_and_validate();
     std::string to_string() const;
+    preview_t get_preview_mode() const;
+    // One backend spec per pooled context; empty means a single context on --backend.
+    std::vector<std::string> get_context_backends() const;
+    // URLs of --cluster-workers, without trailing slashes.
+    std::vector<std::string> get_cluster_workers() const;
+    // WxH sizes of --warmup; false when an entry does not parse.
+    bool get_warmup_sizes(std::vector<std::pair<int, int>>* sizes) const;
 };
 
 struct LoraEntry {
@@ -37,6 +68,12 @@ struct LoraEntry {
     std::string fullpath;
 };
 
+struct ModelEntry {
+    std::string name;
+    std::string path;
+    std::string fullpath;
+};
+
 struct UpscalerEntry {
     std::string name;
     std::string path;
@@ -46,8 +83,7 @@ struct UpscalerEntry {
 };
 
 struct ServerRuntime {
-    sd_ctx_t* sd_ctx;
-    std::mutex* sd_ctx_mutex;
+    SDContextPool* context_pool;
     const SDSvrParams* svr_params;
     const SDContextParams* ctx_params;
     const SDGenerationParams* default_gen_params;
@@ -56,12 +92,19 @@ struct ServerRuntime {
     std::vector<UpscalerEntry>* upscaler_cache;
     std::mutex* upscaler_mutex;
     AsyncJobManager* async_job_manager;
+    ServerMetrics* metrics;
+    std::vector<ModelEntry>* model_cache;
+    std::unordered_map<std::string, std::string>* model_index;  // name or relative path -> fullpath of model_cache
+    std::mutex* model_mutex;
+    std::atomic<int>* pending_warmups;  // contexts still warming up; /health reports ready at 0
 };
 
 struct ImgGenJobRequest {
     SDGenerationParams gen_params;
+    std::string model_path;  // empty for the model the server was started with
     std::string output_format = "png";
     int output_compression    = 100;
+    std::string result_cache_key;  // empty when the result may not be reused
 
     sd_img_gen_params_t to_sd_img_gen_params_t() {
         return gen_params.to_sd_img_gen_params_t();
@@ -70,6 +113,7 @@ struct ImgGenJobRequest {
 
 struct VidGenJobRequest {
     SDGenerationParams gen_params;
+    std::string model_path;
     std::string output_format = "webm";
     int output_compression    = 100;
 
@@ -79,6 +123,16 @@ struct VidGenJobRequest {
 };
 
 std::string base64_encode(const std::vector<uint8_t>& bytes);
+// Encodes generated images in parallel, with their parameters embedded when
+// gen_params asks for it. Entries of failed or missing images are empty.
+// first_index is the batch position of images[0], which picks its seed.
+std::vector<std::vector<uint8_t>> encode_generated_images(const ServerRuntime& runtime,
+                                                          const SDGenerationParams& gen_params,
+                                                          const sd_image_t* images,
+                                                          int num_images,
+                                                          EncodedImageFormat format,
+                                                          int quality,
+                                                          int first_index = 0);
 std::string normalize_output_format(std::string output_format);
 std::vector<std::string> supported_img_output_formats(bool allow_webp = true);
 std::vector<std::string> supported_vid_output_formats();
@@ -97,4 +151,15 @@ std::string unsupported_generation_mode_error(SDMode mode);
 void refresh_lora_cache(ServerRuntime& rt);
 std::string get_lora_full_path(ServerRuntime& rt, const std::string& path);
 void refresh_upscaler_cache(ServerRuntime& rt);
+// Rescans --models-dir. Runs at startup and on POST /sdapi/v1/refresh-checkpoints;
+// requests only look names up in the result.
+void refresh_model_cache(ServerRuntime& rt);
+// Name of the model the server was started with.
+std::string default_model_name(const ServerRuntime& rt);
+// Maps a requested model name or --models-dir relative path to the file to
+// load; an empty name or the startup model's name yields an empty path.
+bool resolve_request_model(ServerRuntime& rt,
+                           const std::string& name,
+                           std::string& model_path,
+                           std::string& error_message);
 int64_t unix_timestamp_now();
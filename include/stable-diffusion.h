@@ -54,6 +54,7 @@ enum sample_method_t {
     EULER_CFG_PP_SAMPLE_METHOD,
     EULER_A_CFG_PP_SAMPLE_METHOD,
     EULER_GE_SAMPLE_METHOD,
+    HEUN_ADAPTIVE_SAMPLE_METHOD,
     SAMPLE_METHOD_COUNT
 };
 
@@ -154,6 +155,24 @@ enum lora_apply_mode_t {
     LORA_APPLY_MODE_COUNT,
 };
 
+// What the diffusion model and ControlNet do with their compute buffers
+// when a generation ends.
+enum compute_buffer_retention_t {
+    COMPUTE_BUFFER_FREE,             // free them
+    COMPUTE_BUFFER_KEEP,             // keep them, grown to the largest generation so far
+    COMPUTE_BUFFER_KEEP_SAME_SHAPE,  // keep them while generations keep the same size and prompt length
+    COMPUTE_BUFFER_RETENTION_COUNT,
+};
+
+// Placement of CPU compute threads and params memory on multi-socket hosts.
+enum numa_placement_t {
+    NUMA_PLACEMENT_NONE,        // leave both to the OS
+    NUMA_PLACEMENT_DISTRIBUTE,  // spread threads over all nodes; interleave params over them
+    NUMA_PLACEMENT_ISOLATE,     // keep threads on the node the process started on; prefer it for params
+    NUMA_PLACEMENT_NUMACTL,     // keep threads on the CPUs numactl gave the process; params follow its policy
+    NUMA_PLACEMENT_COUNT,
+};
+
 typedef struct {
     bool enabled;
     bool temporal_tiling;
@@ -163,6 +182,7 @@ typedef struct {
     float rel_size_x;
     float rel_size_y;
     const char* extra_tiling_args;
+    bool auto_tile_size;  // Decide tiling and tile size from the VRAM budget (image VAEs on GPU); overrides enabled and tile sizes
 } sd_tiling_params_t;
 
 typedef struct {
@@ -199,6 +219,14 @@ typedef struct {
     const char* photo_maker_path;
     const char* pulid_weights_path;
     const char* tensor_type_rules;
+    const char* model_cache_dir;  // Directory of runtime-ready GGUF copies of the loaded model files (NULL/empty = disabled)
+    const char* attn_tune_cache;  // File of per-shape flash vs. softmax attention winners, enables attention tuning (NULL/empty = disabled)
+    const char* conv_tune_cache;  // File of per-shape direct vs. im2col conv2d winners, enables conv2d tuning (NULL/empty = disabled)
+    const char* condition_file;  // File of conditions written by export_image_conditions, looked up before the text encoders run (NULL/empty = disabled)
+    const char* device_probe_cache;  // File of device benchmarks, probed at context creation and reused while the devices match (NULL/empty = probe only for auto_placement)
+    const char* resolution_buckets;  // Comma-separated WxH sizes txt2img requests are padded up to and cropped back from, e.g. "512x512,768x512" (NULL/empty = disabled)
+    const char* text_encoder_share_key;  // Contexts of the process with the same key share their text encoder weights, whichever files hold them (NULL/empty = share by file)
+    const char* cpu_threadpool_args;     // Comma-separated key=value policy of the persistent CPU threadpool: poll=0..100, cpus=0-7+16, strict, prio, persistent (NULL/empty = defaults)
     int n_threads;
     enum sd_type_t wtype;
     enum rng_type_t rng_type;
@@ -221,10 +249,36 @@ typedef struct {
     enum sd_vae_format_t vae_format;
     const char* max_vram;  // GiB budget or backend assignment spec for graph-cut segmented param offload (0 = disabled, -1 = auto)
     bool stream_layers;  // Enable residency+prefetch streaming on top of --max-vram (no effect without --max-vram)
+    bool hybrid_cpu_segments;  // With stream_layers, compute streamed diffusion segments on the CPU next to their params when the device probe says that beats uploading them
     bool eager_load;  // Load all params into the params backend at model-load time instead of lazily on first use
+    bool background_load;  // Load params on a background thread after model load while requests already run (ignored with eager_load)
+    int mmap_prefault_threads;  // With enable_mmap, threads faulting the mapped weights into the page cache in load order after model load (0 = off)
+    bool batched_cfg;  // Run cond/uncond (and img_uncond) as one batched diffusion forward pass when the model supports it
+    bool offload_text_encoder;   // Keep text encoder params in RAM between encodes, staged to its device only while encoding
+    bool llm_cpu_q8_0;           // Convert f16/bf16/f32 LLM text encoder projection weights to q8_0 when the encoder runs on CPU
+    bool stream_q8_0;            // Convert f16/bf16/f32 diffusion matmul weights to q8_0 when they are kept in RAM for a GPU, halving the bytes streamed
+    bool cpu_repack;             // Load quantized matmul weights that run on the CPU into ggml's repacked (interleaved) CPU buffer types; LoRAs then apply at runtime
+    bool shared_compute_buffer;  // Lease one compute buffer per device to the text encoder, diffusion model and VAE in turn instead of one each
+    enum compute_buffer_retention_t compute_buffer_retention;  // Keep the diffusion model and ControlNet compute buffers between generations
+    bool dynamic_text_length;    // Cut the padded T5 prompt of Flux/Chroma to the smallest 64/128/256/512 token bucket that holds it
+    bool vae_f32_fallback;  // Re-run VAE tiles whose output has NaN/Inf with f32 convolutions
+    bool vae_decode_only;   // Build the VAE and TAE without their encoders and never load those weights; img2img and other VAE encodes then fail
+    bool auto_placement;    // Pick backend, params_backend and max_vram per module from the model sizes and a device benchmark (only when those are unset)
+    int condition_cache_mb;   // MiB budget of the LRU cache of text encoder outputs kept across requests (0 = disabled)
+    int vae_encode_cache_mb;  // MiB budget of the LRU cache of VAE encoder outputs for repeated source images (0 = disabled)
+    int identity_cache_size;  // PhotoMaker/PuLID identity embeddings kept across requests, keyed by id image set (0 = disabled)
+    int max_pinned_mb;        // MiB cap on page-locked host memory for params streamed to the GPU (-1 = unlimited, 0 = never pin)
+    enum numa_placement_t numa_placement;  // Process-wide NUMA placement of CPU compute threads and params buffers
+    bool huge_pages;                       // Ask for transparent huge pages on host params buffers and model file mappings
+    int lora_cache_mb;        // MiB of host RAM for merged weights of recently used LoRA sets (0 = disabled)
+    int lora_model_cache_mb;  // MiB of loaded runtime LoRA tensors kept on their backend across generations (0 = disabled)
     const char* backend;
     const char* params_backend;
     const char* rpc_servers;
+    const char* vae_tile_backends;  // Comma-separated extra backends holding VAE copies that process tiles in parallel, e.g. "cuda1,rpc0"
+    const char* pipeline_backends;  // Comma-separated extra backends that each hold and run a slice of the diffusion model's graph-cut segments, e.g. "cuda1,cuda2"
+    const char* cfg_backend;        // Backend holding a copy of the diffusion model that runs the uncond passes concurrently with the cond passes, e.g. "cuda1"
+    const char* tensor_split;       // Comma-separated proportions of the diffusion model's matmul weight rows per device of its backend, e.g. "1,1" (CUDA only)
 } sd_ctx_params_t;
 
 typedef struct {
@@ -274,6 +328,7 @@ typedef struct {
     int id_images_count;
     const char* id_embed_path;
     float style_strength;
+    const char* identity_path;  // Identity embedding file: loaded instead of encoding id_images when it exists, written after encoding otherwise
 } sd_pm_params_t;  // photo maker
 
 typedef struct {
@@ -316,12 +371,20 @@ typedef struct {
     float spectrum_flex_window;
     int spectrum_warmup_steps;
     float spectrum_stop_percent;
+    const char* profile_path;    // calibration profile JSON, replaces the mode's thresholds when it has an entry
+    bool profile_calibrate;      // sample without skipping and record the profile entry
+    float profile_target_error;  // summed per-step error budget when applying a profile
 } sd_cache_params_t;
 
 typedef struct {
     bool is_high_noise;
     float multiplier;
     const char* path;
+    // Optional batch_count multipliers, one per generated image, that replace
+    // `multiplier` in the diffusion model so images of one batch can use
+    // different LoRAs (0 = not applied). Needs LORA_APPLY_AT_RUNTIME; text
+    // encoders and the VAE keep using `multiplier`. NULL = `multiplier` for all.
+    const float* image_multipliers;
 } sd_lora_t;
 
 enum sd_hires_upscaler_t {
@@ -352,6 +415,27 @@ typedef struct {
     int custom_sigmas_count;
 } sd_hires_params_t;
 
+// A latent image in the latent space a model samples in, so a chain of
+// generations (txt2img, then an img2img refine) can skip the VAE decode and
+// encode between them and the 8-bit rounding of the pixels. data holds
+// width * height * channels floats, one channel plane after another, each
+// row by row. version names the model version whose latent space it is in,
+// as logged at load; scale_factor is how many image pixels one latent pixel
+// covers.
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t scale_factor;
+    const char* version;
+    float* data;
+} sd_latent_t;
+
+// Receives each image of a batch as soon as the VAE decoded it, while the
+// rest of the batch still decodes. image is owned by the library and valid
+// only during the call; index is its position in the batch.
+typedef void (*sd_image_cb_t)(int index, const sd_image_t* image, void* data);
+
 typedef struct {
     const sd_lora_t* loras;
     uint32_t lora_count;
@@ -359,6 +443,7 @@ typedef struct {
     const char* negative_prompt;
     int clip_skip;
     sd_image_t init_image;
+    const sd_latent_t* init_latent;  // Optional; img2img from this latent instead of init_image, skipping its VAE encode
     sd_image_t* ref_images;
     int ref_images_count;
     bool auto_resize_ref_image;
@@ -370,6 +455,8 @@ typedef struct {
     float strength;
     int64_t seed;
     int batch_count;
+    int latent_batch_size;  // Latents sampled together per batched diffusion pass (<= 1 samples one latent at a time)
+    const int64_t* seeds;   // Optional per-image seeds (batch_count entries); nullptr uses seed + image index
     sd_image_t control_image;
     float control_strength;
     sd_pm_params_t pm_params;
@@ -377,8 +464,31 @@ typedef struct {
     sd_tiling_params_t vae_tiling_params;
     sd_cache_params_t cache;
     sd_hires_params_t hires;
+    sd_image_cb_t image_cb;  // Optional; images also go here as they are decoded, generate_image still returns them all
+    void* image_cb_data;
 } sd_img_gen_params_t;
 
+// Receives decoded video frames in order while the VAE decodes. frames are
+// owned by the library and valid only during the call; audio is the generated
+// audio (nullptr without) and the same on every call. Return false to stop.
+typedef bool (*sd_video_frames_cb_t)(int first_frame,
+                                     int frame_count,
+                                     const sd_image_t* frames,
+                                     const sd_audio_t* audio,
+                                     void* data);
+
+// Receives a snapshot of the sampling state of video generation every
+// checkpoint_interval steps of a sampling pass. data is owned by the library
+// and valid only during the call; handing the same bytes back as
+// resume_checkpoint of an identical request continues sampling from that
+// step instead of step 0.
+typedef void (*sd_sample_checkpoint_cb_t)(int pass,
+                                          int step,
+                                          int steps,
+                                          const uint8_t* data,
+                                          size_t size,
+                                          void* user_data);
+
 typedef struct {
     const sd_lora_t* loras;
     uint32_t lora_count;
@@ -402,19 +512,105 @@ typedef struct {
     sd_tiling_params_t vae_tiling_params;
     sd_cache_params_t cache;
     sd_hires_params_t hires;
+    sd_video_frames_cb_t frames_cb;  // Optional; frames go here as they are decoded and generate_video returns none
+    void* frames_cb_data;
+    sd_sample_checkpoint_cb_t checkpoint_cb;  // Optional; snapshots for resume_checkpoint
+    void* checkpoint_cb_data;
+    int checkpoint_interval;           // Sampling steps between snapshots
+    const uint8_t* resume_checkpoint;  // Optional; a snapshot from checkpoint_cb to continue from
+    size_t resume_checkpoint_size;
 } sd_vid_gen_params_t;
 
 typedef struct sd_ctx_t sd_ctx_t;
 
 typedef void (*sd_log_cb_t)(enum sd_log_level_t level, const char* text, void* data);
 typedef void (*sd_progress_cb_t)(int step, int steps, float time, void* data);
+// Previews that cannot slow down sampling (latent projection, or a VAE/TAE on a
+// backend the diffusion model does not use) are called from a preview thread;
+// steps are skipped while the previous preview is still running. All previews
+// of a sampling pass are delivered before it returns.
 typedef void (*sd_preview_cb_t)(int step, int frame_count, sd_image_t* frames, bool is_noisy, void* data);
+// Receives a provisional image of an image generation: the denoised
+// prediction at the step set by the extra sample arg provisional_step,
+// decoded with the preview decoder (the TAE when one is loaded). It is called
+// on the sampling thread before sampling goes on and may block while the user
+// decides; sd_cancel_generation with SD_CANCEL_ALL, from any thread, before
+// it returns skips the remaining steps and the VAE decode.
+typedef void (*sd_provisional_cb_t)(int step, int steps, const sd_image_t* image, void* data);
+
+enum sd_step_cache_t {
+    SD_STEP_COMPUTED,   // the diffusion model ran for at least one condition
+    SD_STEP_CACHED,     // every condition reused a cached output (--cache-mode)
+    SD_STEP_PREDICTED,  // the prediction was extrapolated without the model (spectrum)
+};
+
+// Where one sampling step's time went. Pass times are the diffusion compute of
+// each condition, 0 when it did not run; an uncond pass on the CFG backend
+// runs alongside the cond pass, so the times can add up to more than the step.
+typedef struct {
+    int step;
+    int steps;
+    float time;  // seconds since the previous step, as sd_progress_cb_t gets them
+    float cond_ms;
+    float uncond_ms;
+    float img_uncond_ms;
+    float slg_ms;  // the skip-layer guidance pass
+    bool batched;  // one forward pass ran every condition, timed in cond_ms
+    float control_net_ms;
+    enum sd_step_cache_t cache;
+    uint64_t streamed_bytes;  // weight bytes uploaded to the compute backends
+    float preview_ms;         // previews decoded on the sampling thread, and queuing the others
+} sd_step_timing_t;
+// Called on the sampling thread after each step, next to the progress callback.
+typedef void (*sd_step_timing_cb_t)(const sd_step_timing_t* timing, void* data);
+
+// Ways a generation gave up speed to finish after running out of device
+// memory, in the order they are tried.
+enum sd_degradation_t {
+    SD_DEGRADATION_RELEASED_BUFFERS,  // idle staged params and shared compute buffers were freed
+    SD_DEGRADATION_SEGMENTED_GRAPH,   // the model now runs in graph-cut segments under a derived VRAM budget
+    SD_DEGRADATION_TILED_VAE,         // the VAE decode or encode was retried with tiling
+    SD_DEGRADATION_COUNT,
+};
+// Called on the computing thread, before the generation goes on; component is
+// the runner that ran out of memory.
+typedef void (*sd_degradation_cb_t)(enum sd_degradation_t degradation, const char* component, const char* detail, void* data);
 
 SD_API void sd_set_log_callback(sd_log_cb_t sd_log_cb, void* data);
 SD_API void sd_set_progress_callback(sd_progress_cb_t cb, void* data);
 SD_API void sd_set_preview_callback(sd_preview_cb_t cb, enum preview_t mode, int interval, bool denoised, bool noisy, void* data);
+SD_API void sd_set_provisional_callback(sd_provisional_cb_t cb, void* data);
+SD_API void sd_set_step_timing_callback(sd_step_timing_cb_t cb, void* data);
+// Progress, preview, provisional and step timing callbacks for work started on the calling thread get
+// data instead of the pointer they were registered with, so concurrent
+// generations can tell their callbacks apart. nullptr restores the default.
+SD_API void sd_set_thread_callback_data(void* data);
+SD_API void sd_set_degradation_callback(sd_degradation_cb_t cb, void* data);
+// Callbacks of one context: its generations, including the threads they
+// start, use these instead of the process-wide ones, so contexts generating
+// concurrently from different threads report separately. A null callback
+// falls back to the process-wide one; thread callback data still replaces
+// data. Set them while the context is idle.
+SD_API void sd_ctx_set_log_callback(sd_ctx_t* sd_ctx, sd_log_cb_t cb, void* data);
+SD_API void sd_ctx_set_progress_callback(sd_ctx_t* sd_ctx, sd_progress_cb_t cb, void* data);
+SD_API void sd_ctx_set_preview_callback(sd_ctx_t* sd_ctx,
+                                        sd_preview_cb_t cb,
+                                        enum preview_t mode,
+                                        int interval,
+                                        bool denoised,
+                                        bool noisy,
+                                        void* data);
+SD_API void sd_ctx_set_provisional_callback(sd_ctx_t* sd_ctx, sd_provisional_cb_t cb, void* data);
+SD_API void sd_ctx_set_step_timing_callback(sd_ctx_t* sd_ctx, sd_step_timing_cb_t cb, void* data);
+SD_API void sd_ctx_set_degradation_callback(sd_ctx_t* sd_ctx, sd_degradation_cb_t cb, void* data);
+SD_API const char* sd_degradation_name(enum sd_degradation_t degradation);
 SD_API int32_t sd_get_num_physical_cores();
 SD_API const char* sd_get_system_info();
+// Copy rates, matmul throughput per weight type, flash attention support and
+// free memory of every device, measured on the first call or read from the
+// device_probe_cache of a context. The string is valid until the next call.
+// n_threads <= 0 uses the physical core count.
+SD_API const char* sd_get_device_probe_info(int n_threads);
 SD_API bool sd_ctx_supports_image_generation(const sd_ctx_t* sd_ctx);
 SD_API bool sd_ctx_supports_video_generation(const sd_ctx_t* sd_ctx);
 
@@ -432,6 +628,10 @@ SD_API const char* sd_preview_name(enum preview_t preview);
 SD_API enum preview_t str_to_preview(const char* str);
 SD_API const char* sd_lora_apply_mode_name(enum lora_apply_mode_t mode);
 SD_API enum lora_apply_mode_t str_to_lora_apply_mode(const char* str);
+SD_API const char* sd_compute_buffer_retention_name(enum compute_buffer_retention_t retention);
+SD_API enum compute_buffer_retention_t str_to_compute_buffer_retention(const char* str);
+SD_API const char* sd_numa_placement_name(enum numa_placement_t placement);
+SD_API enum numa_placement_t str_to_numa_placement(const char* str);
 SD_API const char* sd_hires_upscaler_name(enum sd_hires_upscaler_t upscaler);
 SD_API enum sd_hires_upscaler_t str_to_sd_hires_upscaler(const char* str);
 
@@ -451,10 +651,83 @@ SD_API char* sd_sample_params_to_str(const sd_sample_params_t* sample_params);
 SD_API enum sample_method_t sd_get_default_sample_method(const sd_ctx_t* sd_ctx);
 SD_API enum scheduler_t sd_get_default_scheduler(const sd_ctx_t* sd_ctx, enum sample_method_t sample_method);
 
+// Few-step settings for step-distilled weights: LCM, TCD, Hyper-SD,
+// Lightning and Turbo LoRAs or checkpoints, and Flux schnell. kind names the
+// distillation ("lcm", "tcd", "hyper", "lightning", "turbo", "schnell") and
+// stays valid for the life of the process; scheduler is SCHEDULER_COUNT when
+// the model's default fits.
+typedef struct {
+    const char* kind;
+    enum sample_method_t sample_method;
+    enum scheduler_t scheduler;
+    int sample_steps;
+    float cfg_scale;
+} sd_turbo_preset_t;
+
+// Looks for a step distillation in the applied LoRAs (file names and
+// safetensors metadata, high noise LoRAs excepted) and then in the context's
+// model. Returns false when there is none.
+SD_API bool sd_get_turbo_preset(const sd_ctx_t* sd_ctx,
+                                const sd_lora_t* loras,
+                                uint32_t lora_count,
+                                sd_turbo_preset_t* preset);
+// Sets sample_params to the preset: its sampler, scheduler and steps, and
+// cfg 1 without skip-layer guidance, so no step runs an uncond pass. Leaves
+// sample_params unchanged and returns false when there is no preset. The
+// extra sample arg turbo=1 does the same inside generate_image.
+SD_API bool sd_apply_turbo_preset(const sd_ctx_t* sd_ctx,
+                                  const sd_lora_t* loras,
+                                  uint32_t lora_count,
+                                  sd_sample_params_t* sample_params);
+
 SD_API void sd_img_gen_params_init(sd_img_gen_params_t* sd_img_gen_params);
 SD_API char* sd_img_gen_params_to_str(const sd_img_gen_params_t* sd_img_gen_params);
 SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params);
 
+// generate_image in two steps: sample_image_latents stops before the VAE and
+// decode_image_latents turns the result into batch_count images. When
+// sd_ctx_can_overlap_vae_decode is true, one decode may run on another thread
+// while the next sample_image_latents samples on the same context, provided
+// that generation encodes nothing with the VAE (no init, mask, control or
+// reference images, no hires fix), applies the same LoRAs and uses the same
+// VAE tiling params.
+typedef struct sd_image_latents_t sd_image_latents_t;
+
+SD_API bool sd_ctx_can_overlap_vae_decode(sd_ctx_t* sd_ctx);
+SD_API sd_image_latents_t* sample_image_latents(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params);
+SD_API sd_image_t* decode_image_latents(sd_ctx_t* sd_ctx, const sd_image_latents_t* latents, int* num_images);
+SD_API void free_sd_image_latents(sd_image_latents_t* latents);
+
+// generate_image without the VAE decode: returns batch_count latents for a
+// later generation's init_latent, or for decode_latents, to free with
+// free_sd_latents. An entry whose data is NULL was not sampled.
+SD_API sd_latent_t* generate_latents(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params, int* num_latents);
+// Decodes latents made by a context of the same model version into
+// num_latents images, to free with free_sd_images.
+SD_API sd_image_t* decode_latents(sd_ctx_t* sd_ctx, const sd_latent_t* latents, int num_latents);
+SD_API void free_sd_latents(sd_latent_t* latents, int num_latents);
+
+// Text encoding of a queued generation while this context samples another.
+// When sd_ctx_can_overlap_text_encode is true, prepare_image_conditions may
+// run on another thread during generate_image or sample_image_latents; it
+// encodes the prompts of a later generation on the text encoder backend and
+// hands the conditions over to that generation when it runs. It returns
+// false, encoding nothing, for generations with LoRAs or with reference,
+// PhotoMaker or PuLID inputs; those encode their prompts themselves.
+SD_API bool sd_ctx_can_overlap_text_encode(sd_ctx_t* sd_ctx);
+SD_API bool prepare_image_conditions(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params);
+
+// Encodes the prompts and negative prompts of count generations into a
+// condition file at path. A context created with condition_file set to it
+// takes the conditions of those prompts from the file and loads its text
+// encoders only for a prompt the file does not have. Conditions are keyed by
+// prompt, clip skip and image size, and are not used while LoRAs are applied;
+// generations prepare_image_conditions would not encode are skipped.
+SD_API bool export_image_conditions(sd_ctx_t* sd_ctx,
+                                    const sd_img_gen_params_t* sd_img_gen_params,
+                                    int count,
+                                    const char* path);
+
 enum sd_cancel_mode_t {
     // Stop the current generation as soon as possible.
     SD_CANCEL_ALL,
@@ -473,6 +746,178 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                            int* num_frames_out,
                            sd_audio_t** audio_out);
 
+// generate_video in three steps: sample_video_latents samples at the first
+// resolution, upscale_video_latents runs the LTX latent upsampler of a hires
+// fix with the MODEL upscaler and finish_video_latents runs the refinement
+// pass and the decode; the upscale does nothing for other generations. When
+// sd_ctx_can_overlap_latent_upscale is true, the upscaler has a backend no
+// other step uses, and one upscale may run on another thread while the next
+// sample_video_latents or finish_video_latents runs on the same context.
+// sd_vid_gen_params must outlive its latents.
+typedef struct sd_video_latents_t sd_video_latents_t;
+
+SD_API bool sd_ctx_can_overlap_latent_upscale(sd_ctx_t* sd_ctx);
+SD_API sd_video_latents_t* sample_video_latents(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params);
+SD_API bool upscale_video_latents(sd_ctx_t* sd_ctx, sd_video_latents_t* latents);
+SD_API bool finish_video_latents(sd_ctx_t* sd_ctx,
+                                 sd_video_latents_t* latents,
+                                 sd_image_t** frames_out,
+                                 int* num_frames_out,
+                                 sd_audio_t** audio_out);
+SD_API void free_sd_video_latents(sd_video_latents_t* latents);
+
+// generate_image and generate_video without blocking the caller. Each context
+// runs its async generations on a thread of its own, one at a time in the
+// order they were submitted; the context's callbacks fire on that thread.
+// The params, and everything they point to, must stay valid until the
+// generation is done. A generation still queued when its context is freed
+// is cancelled.
+typedef struct sd_generation_t sd_generation_t;
+
+enum sd_generation_state_t {
+    SD_GENERATION_QUEUED,
+    SD_GENERATION_RUNNING,
+    SD_GENERATION_DONE,
+    SD_GENERATION_FAILED,
+    SD_GENERATION_CANCELLED,
+};
+
+// Called once per generation when it is done, failed or was cancelled: on the
+// context's thread, or on the cancelling thread for a generation that never
+// started. It may take the results but must not free the generation.
+typedef void (*sd_generation_done_cb_t)(sd_generation_t* generation, void* data);
+
+// NULL when sd_ctx or the params are NULL, or sd_ctx is being freed.
+SD_API sd_generation_t* sd_generate_image_async(sd_ctx_t* sd_ctx,
+                                                const sd_img_gen_params_t* sd_img_gen_params,
+                                                sd_generation_done_cb_t on_done,
+                                                void* data);
+SD_API sd_generation_t* sd_generate_video_async(sd_ctx_t* sd_ctx,
+                                                const sd_vid_gen_params_t* sd_vid_gen_params,
+                                                sd_generation_done_cb_t on_done,
+                                                void* data);
+SD_API enum sd_generation_state_t sd_generation_get_state(sd_generation_t* generation);
+// Waits up to timeout_ms, or without limit when negative, for the generation
+// and its on_done to finish; true once they did.
+SD_API bool sd_generation_wait(sd_generation_t* generation, int timeout_ms);
+// A queued generation is dropped; a running one is cancelled as
+// sd_cancel_generation would with the mode.
+SD_API void sd_generation_cancel(sd_generation_t* generation, enum sd_cancel_mode_t mode);
+// Hands the images, or video frames, over to the caller to free with
+// free_sd_images; NULL until the generation is done and after they were
+// taken.
+SD_API sd_image_t* sd_generation_take_images(sd_generation_t* generation, int* num_images);
+// The audio of a video generation, to free with free_sd_audio; taken like the images.
+SD_API sd_audio_t* sd_generation_take_audio(sd_generation_t* generation);
+// Cancels the generation unless it is done, waits for it and frees the
+// results that were not taken.
+SD_API void sd_free_generation(sd_generation_t* generation);
+
+typedef struct {
+    const char* name;  // runner description, e.g. "unet" or "vae"
+    int compute_calls;
+    int graph_reuses;        // compute calls that reused the previous graph
+    int graph_cut_segments;  // segments executed when the graph was cut for streaming
+    double graph_build_ms;
+    double alloc_ms;  // compute buffer reservation and graph allocation
+    double compute_ms;
+    uint64_t loaded_bytes;    // params read from the model files
+    uint64_t uploaded_bytes;  // params copied from the params backend to the compute backend
+    uint64_t peak_compute_buffer_bytes;
+} sd_runner_perf_stats_t;
+
+typedef struct {
+    int runner;  // index into sd_perf_stats_t.runners
+    int segment;
+    const char* group_name;
+    int executions;
+    uint64_t uploaded_bytes;  // loaded + uploaded params, including prefetches
+    double upload_ms;         // time the prefetch worker spent on this segment
+    double wait_ms;           // time compute waited for that prefetch
+    double compute_ms;
+} sd_segment_perf_stats_t;
+
+typedef struct {
+    double total_ms;
+    double text_encode_ms;
+    double vae_encode_ms;
+    double sampling_ms;
+    double vae_decode_ms;
+    int sampling_steps;  // denoising steps run, counting hires and high noise passes
+    int condition_cache_hits;
+    int condition_cache_misses;
+    int vae_encode_cache_hits;    // source images whose VAE encode was reused
+    int vae_encode_cache_misses;
+    int lora_cache_hits;             // LoRA set already applied by the previous generation
+    int lora_cache_misses;           // LoRA set changed and had to be (re)applied
+    int lora_model_cache_hits;       // runtime LoRAs attached from the loaded LoRA cache
+    int lora_model_cache_misses;     // runtime LoRAs loaded from their file
+    int lora_model_cache_evictions;  // cached runtime LoRAs dropped to stay within the budget
+    int sample_cache_hits;           // diffusion calls answered by EasyCache/UCache/CacheDIT
+    int sample_cache_skipped_steps;
+    uint64_t peak_compute_buffer_bytes;
+    int runner_count;
+    const sd_runner_perf_stats_t* runners;
+    int segment_count;
+    const sd_segment_perf_stats_t* segments;
+} sd_perf_stats_t;
+
+// Stats of the last generate_image/generate_video call on sd_ctx. The runner and
+// segment arrays are owned by sd_ctx and stay valid until its next generation.
+SD_API bool sd_get_perf_stats(sd_ctx_t* sd_ctx, sd_perf_stats_t* stats);
+
+// Bytes of params buffers sd_ctx holds in host memory and in device memory.
+// Buffers shared with other contexts count for each of them; mmapped files
+// are not counted.
+SD_API bool sd_get_params_memory(sd_ctx_t* sd_ctx, uint64_t* ram_bytes, uint64_t* vram_bytes);
+// Frees the params of sd_ctx that no generation is using: copies staged on the
+// compute backend and, with release_params_backend, the params backend buffers.
+// The next generation loads whatever it needs again.
+SD_API void sd_release_params(sd_ctx_t* sd_ctx, bool release_params_backend);
+// Replace the VAE or the TAE of sd_ctx with the one in a file, e.g. an fp16
+// fixed SDXL VAE, keeping the text encoders and the diffusion model loaded.
+// sd_ctx_set_taesd replaces the preview TAE when sd_ctx was created with
+// tae_preview_only and the VAE otherwise. A NULL or empty path restores the
+// VAE sd_ctx was created with. Call between generations, never beside one.
+// Returns false, leaving the current VAE in place, when the file cannot be
+// loaded or does not fit the model.
+SD_API bool sd_ctx_set_vae(sd_ctx_t* sd_ctx, const char* vae_path);
+SD_API bool sd_ctx_set_taesd(sd_ctx_t* sd_ctx, const char* taesd_path);
+
+typedef struct {
+    const char* name;  // runner description, as in sd_runner_perf_stats_t
+    bool on_cpu;       // the runner computes on the CPU, so its buffers are host memory
+    uint64_t params_bytes;
+    uint64_t compute_buffer_bytes;  // largest graph of the runner, uncut
+    int graph_cut_segments;         // segments max_vram cuts that graph into, 0 when it runs whole
+    uint64_t segment_buffer_bytes;  // largest of those segments
+} sd_module_memory_estimate_t;
+
+typedef struct {
+    uint64_t params_bytes;               // params of all modules
+    uint64_t peak_compute_buffer_bytes;  // largest compute buffer any module holds, after graph cuts
+    int module_count;
+    const sd_module_memory_estimate_t* modules;
+} sd_memory_estimate_t;
+
+// Memory a generate_image/generate_video call with these params would need.
+// Every graph the call runs is built and measured under the current max_vram,
+// without loading weights or computing; encoders see zeros instead of their
+// inputs' real outputs, which only matters for models whose graphs depend on
+// values. LoRAs, PhotoMaker/PuLID and hires model upscalers are not counted.
+// The module array is owned by sd_ctx and stays valid until its next estimate.
+// Not safe to call while sd_ctx generates.
+SD_API bool sd_estimate_memory(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params, sd_memory_estimate_t* estimate);
+SD_API bool sd_estimate_video_memory(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params, sd_memory_estimate_t* estimate);
+
+// Runs a throwaway generation at width x height with the default sampler, so
+// the weights are loaded, the compute buffers of that resolution are
+// reserved and the backend has built its kernels before the first real
+// request. Video-only contexts generate a single frame over two steps, which
+// runs both experts of high/low noise models. Not safe to call while sd_ctx
+// generates.
+SD_API bool sd_warmup(sd_ctx_t* sd_ctx, int width, int height);
+
 typedef struct upscaler_ctx_t upscaler_ctx_t;
 
 SD_API upscaler_ctx_t* new_upscaler_ctx(const char* esrgan_path,
@@ -487,14 +932,53 @@ SD_API sd_image_t upscale(upscaler_ctx_t* upscaler_ctx,
                           sd_image_t input_image,
                           uint32_t upscale_factor);
 
+// Upscales image_count images. Images of the same size that fit in one tile
+// run batched in shared graphs. Returns image_count results, free them with
+// free_sd_images; an entry whose data is NULL failed.
+SD_API sd_image_t* upscale_batch(upscaler_ctx_t* upscaler_ctx,
+                                 const sd_image_t* input_images,
+                                 int image_count,
+                                 uint32_t upscale_factor);
+
+// Receives upscaled rows top to bottom from upscale_streaming; rows holds
+// rows->height final rows starting at output row first_row. rows is owned by
+// the library and valid only during the call. Return false to stop.
+typedef bool (*sd_upscale_rows_cb_t)(int first_row, const sd_image_t* rows, void* data);
+
+// Upscales input_image one band of tile rows at a time and hands the output
+// to rows_cb as soon as it is final, so only a band of the output is ever
+// held in memory. Returns false if the upscale failed or rows_cb stopped it.
+SD_API bool upscale_streaming(upscaler_ctx_t* upscaler_ctx,
+                              sd_image_t input_image,
+                              uint32_t upscale_factor,
+                              sd_upscale_rows_cb_t rows_cb,
+                              void* data);
+
 SD_API int get_upscale_factor(upscaler_ctx_t* upscaler_ctx);
 
+// Writes input_path (and vae_path) to output_path in output_type, with the
+// loras merged into the weights they patch. Patched weights are merged in f32
+// and converted to their output type once. image_multipliers are ignored.
 SD_API bool convert(const char* input_path,
                     const char* vae_path,
                     const char* output_path,
                     enum sd_type_t output_type,
                     const char* tensor_type_rules,
-                    bool convert_name);
+                    bool convert_name,
+                    const sd_lora_t* loras,
+                    uint32_t lora_count);
+
+// Picks a weight type per tensor of input_path (and vae_path) for convert and
+// returns them as tensor_type_rules. auto_quant_args is a key=value list:
+// bpw (target average bits per weight) or max_error (relative squared weight
+// error allowed per tensor), and types (candidates joined by '+', default
+// q4_K+q5_K+q6_K+q8_0+f16). Every candidate is measured on a sample of rows
+// of every tensor. The string stays valid until the next call on the same
+// thread and is empty on failure.
+SD_API const char* sd_auto_tensor_type_rules(const char* input_path,
+                                             const char* vae_path,
+                                             const char* auto_quant_args,
+                                             bool convert_name);
 
 SD_API bool preprocess_canny(sd_image_t image,
                              float high_threshold,
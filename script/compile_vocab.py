@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Pre-compile the embedded tokenizer vocabularies into compact binary blobs.
+
+The tokenizers used to parse a HF tokenizer.json (T5/UMT5) or a vocab.json
+(Mistral, Gemma, Gemma2, GPT-OSS) with nlohmann json every time one was
+constructed; UMT5 alone is a 9 MB JSON document with 256k pieces. This script
+writes the same data as a little-endian binary blob that
+src/tokenizers/vocab/vocab.cpp reads without a JSON parser:
+
+    unigram (magic "SDUG"):
+        u32 version, i32 unk_id (-1 when absent), u8 add_prefix_space,
+        u32 len + bytes replacement, u32 n_pieces,
+        n_pieces x (f32 score, u32 len + bytes piece)   in id order,
+        n_pieces x u32 id                               in byte order of piece
+
+    bpe vocab (magic "SDBV"):
+        u32 version, u32 n_tokens,
+        n_tokens x (i32 id, u32 len + bytes token)      in byte order of token
+
+The byte-ordered id table lets the unigram tokenizer hand its pieces to the
+double-array trie builder without sorting them. BPE merges stay as text, one
+merge per line in rank order, since that is already what the tokenizers index.
+
+The input is either the original JSON file or one of the existing vocab
+headers, so the checked-in headers can be converted in place.
+
+Usage:
+    python3 script/compile_vocab.py unigram <tokenizer.json|header.hpp> <out.hpp> <array_name>
+    python3 script/compile_vocab.py bpe-vocab <vocab.json|header.hpp> <out.hpp> <array_name>
+    python3 script/compile_vocab.py all <src/tokenizers/vocab>
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+BLOB_VERSION = 1
+
+UNIGRAM_HEADERS = [
+    ("t5.hpp", "t5_tokenizer_json_str"),
+    ("umt5.hpp", "umt5_tokenizer_json_str"),
+]
+
+BPE_VOCAB_HEADERS = [
+    ("mistral_vocab.hpp", "mistral_vocab_json_utf8_c_str"),
+    ("gemma_vocab.hpp", "gemma_vocab_json_utf8_c_str"),
+    ("gemma2_vocab.hpp", "gemma2_vocab_json_utf8_c_str"),
+    ("gpt_oss_vocab.hpp", "gpt_oss_vocab_json_utf8_c_str"),
+]
+
+
+def read_input(path: str) -> bytes:
+    with open(path, "rb") as f:
+        data = f.read()
+    if not path.endswith((".hpp", ".h")):
+        return data
+    text = data.decode("ascii")
+    body = text[text.index("{") + 1:text.rindex("}")]
+    return bytes(int(x, 16) for x in re.findall(r"0x([0-9a-fA-F]{2})", body))
+
+
+def pack_bytes(value: bytes) -> bytes:
+    return struct.pack("<I", len(value)) + value
+
+
+def compile_unigram(data: bytes) -> bytes:
+    if data.startswith(b"SDUG"):
+        return data
+    root = json.loads(data.decode("utf-8"))
+    model = root["model"]
+    pre_tokenizer = root["pre_tokenizer"]
+    unk_id = model.get("unk_id")
+
+    pieces = []
+    for piece, score in model["vocab"]:
+        # Same substitution the JSON loader made, so the trie never sees an
+        # empty key.
+        pieces.append(((piece or "<empty_token>").encode("utf-8"), float(score)))
+
+    out = bytearray(b"SDUG")
+    out += struct.pack("<Ii", BLOB_VERSION, -1 if unk_id is None else int(unk_id))
+    out += struct.pack("<B", 1 if pre_tokenizer["add_prefix_space"] else 0)
+    out += pack_bytes(pre_tokenizer["replacement"].encode("utf-8"))
+    out += struct.pack("<I", len(pieces))
+    for piece, score in pieces:
+        out += struct.pack("<f", score)
+        out += pack_bytes(piece)
+    order = sorted(range(len(pieces)), key=lambda i: (pieces[i][0], i))
+    out += struct.pack("<%dI" % len(order), *order)
+    return bytes(out)
+
+
+def compile_bpe_vocab(data: bytes) -> bytes:
+    if data.startswith(b"SDBV"):
+        return data
+    vocab = json.loads(data.decode("utf-8"))
+    # nlohmann json iterates objects in key byte order; keep that order so a
+    # token id shared by two keys resolves the same way it did before.
+    items = sorted((key.encode("utf-8"), int(value)) for key, value in vocab.items())
+
+    out = bytearray(b"SDBV")
+    out += struct.pack("<II", BLOB_VERSION, len(items))
+    for token, token_id in items:
+        out += struct.pack("<i", token_id)
+        out += pack_bytes(token)
+    return bytes(out)
+
+
+def write_header(path: str, array_name: str, blob: bytes):
+    with open(path, "w", newline="\n") as f:
+        f.write("static const unsigned char %s[] = {\n" % array_name)
+        f.write("".join("0x%02x," % b for b in blob))
+        f.write("\n};\n")
+    print("%s: %d bytes" % (path, len(blob)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("kind", choices=["unigram", "bpe-vocab", "all"])
+    parser.add_argument("input")
+    parser.add_argument("output", nargs="?")
+    parser.add_argument("array_name", nargs="?")
+    args = parser.parse_args()
+
+    if args.kind == "all":
+        for name, array_name in UNIGRAM_HEADERS:
+            path = os.path.join(args.input, name)
+            write_header(path, array_name, compile_unigram(read_input(path)))
+        for name, array_name in BPE_VOCAB_HEADERS:
+            path = os.path.join(args.input, name)
+            write_header(path, array_name, compile_bpe_vocab(read_input(path)))
+        return 0
+
+    if not args.output or not args.array_name:
+        parser.error("output and array_name are required")
+    data = read_input(args.input)
+    blob = compile_unigram(data) if args.kind == "unigram" else compile_bpe_vocab(data)
+    write_header(args.output, args.array_name, blob)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,221 @@
+#ifndef __SD_CONDITIONING_CONDITION_CACHE_HPP__
+#define __SD_CONDITIONING_CONDITION_CACHE_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "conditioning/conditioner.hpp"
+#include "core/perf_stats.h"
+
+// LRU cache of text encoder outputs, so prompts that repeat across requests
+// (fixed negative prompts, retried seeds) skip CLIP/T5/LLM. One cache belongs to
+// one context, which pins the encoder weights; the LoRA epoch changes whenever
+// a different set of LoRAs is applied, so stale conditions never match.
+// CLIP vision embeddings of init/reference images, and the LLM vision tower
+// tokens of edit references, share the same budget; they are stored in
+// SDCondition::c_vector under their own key prefixes.
+class ConditionCache {
+public:
+    void set_budget_bytes(size_t budget_bytes) {
+        budget_bytes_ = budget_bytes;
+        evict_to_budget();
+    }
+
+    bool enabled() const {
+        return budget_bytes_ > 0;
+    }
+
+    // Only text-only conditions can be cached; reference images (qwen image edit)
+    // feed the encoder too.
+    static bool is_cacheable(const ConditionerParams& params) {
+        return params.ref_images == nullptr || params.ref_images->empty();
+    }
+
+    static std::string make_key(const ConditionerParams& params, uint64_t lora_epoch) {
+        return std::to_string(lora_epoch) + ":" +
+               std::to_string(params.clip_skip) + ":" +
+               std::to_string(params.width) + "x" + std::to_string(params.height) + ":" +
+               (params.zero_out_masked ? "1" : "0") + ":" +
+               params.text;
+    }
+
+    static std::string make_clip_vision_key(const sd::Tensor<float>& image,
+                                            bool return_pooled,
+                                            int clip_skip,
+                                            uint64_t lora_epoch) {
+        std::string key = "clip_vision:" + std::to_string(lora_epoch) + ":" +
+                          std::to_string(clip_skip) + ":" + (return_pooled ? "1" : "0") + ":";
+        for (int64_t dim : image.shape()) {
+            key += std::to_string(dim) + "x";
+        }
+        return key + sd_format(":%016llx", (unsigned long long)content_hash(image));
+    }
+
+    static std::string make_vision_embed_key(const std::string& encoder,
+                                             const sd::Tensor<float>& image,
+                                             uint64_t lora_epoch) {
+        std::string key = "vision_embed:" + encoder + ":" + std::to_string(lora_epoch) + ":";
+        for (int64_t dim : image.shape()) {
+            key += std::to_string(dim) + "x";
+        }
+        return key + sd_format(":%016llx", (unsigned long long)content_hash(image));
+    }
+
+    bool get(const std::string& key, SDCondition* condition) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        *condition = it->second->condition;
+        return true;
+    }
+
+    void put(const std::string& key, const SDCondition& condition) {
+        size_t bytes = condition_bytes(condition) + key.size();
+        if (bytes > budget_bytes_) {
+            return;
+        }
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            used_bytes_ -= it->second->bytes;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+
+        entries_.push_front({key, condition, bytes});
+        index_[key] = entries_.begin();
+        used_bytes_ += bytes;
+        evict_to_budget();
+    }
+
+    void clear() {
+        entries_.clear();
+        index_.clear();
+        used_bytes_ = 0;
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    size_t used_bytes() const {
+        return used_bytes_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        SDCondition condition;
+        size_t bytes = 0;
+    };
+
+    // FNV-1a over 64-bit words, as in VaeEncodeCache.
+    static uint64_t content_hash(const sd::Tensor<float>& x) {
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(x.data());
+        size_t size               = static_cast<size_t>(x.numel()) * sizeof(float);
+        uint64_t hash             = 14695981039346656037ULL;
+        size_t i                  = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            hash ^= word;
+            hash *= 1099511628211ULL;
+        }
+        for (; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    static size_t tensor_bytes(const sd::Tensor<T>& tensor) {
+        return static_cast<size_t>(tensor.numel()) * sizeof(T);
+    }
+
+    static size_t condition_bytes(const SDCondition& condition) {
+        size_t bytes = tensor_bytes(condition.c_crossattn) +
+                       tensor_bytes(condition.c_vector) +
+                       tensor_bytes(condition.c_concat) +
+                       tensor_bytes(condition.c_t5_ids) +
+                       tensor_bytes(condition.c_t5_weights) +
+                       tensor_bytes(condition.c_input_ids) +
+                       tensor_bytes(condition.c_position_ids) +
+                       tensor_bytes(condition.c_token_types) +
+                       tensor_bytes(condition.c_vinput_mask);
+        for (const auto& image_embed : condition.c_image_embeds) {
+            bytes += tensor_bytes(image_embed.second);
+        }
+        for (const auto& tensor : condition.c_ref_images) {
+            bytes += tensor_bytes(tensor);
+        }
+        for (const auto& tensor : condition.extra_c_crossattns) {
+            bytes += tensor_bytes(tensor);
+        }
+        return bytes;
+    }
+
+    void evict_to_budget() {
+        while (used_bytes_ > budget_bytes_ && !entries_.empty()) {
+            used_bytes_ -= entries_.back().bytes;
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+    }
+
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t budget_bytes_ = 0;
+    size_t used_bytes_   = 0;
+};
+
+// The VisionEmbedCache of a context, in its ConditionCache under its
+// current LoRA epoch.
+class ConditionVisionEmbedCache : public VisionEmbedCache {
+public:
+    ConditionVisionEmbedCache(ConditionCache* cache, const uint64_t* lora_epoch)
+        : cache_(cache), lora_epoch_(lora_epoch) {}
+
+    bool get(const std::string& encoder, const sd::Tensor<float>& image, sd::Tensor<float>* embed) override {
+        if (!cache_->enabled()) {
+            return false;
+        }
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+        SDCondition cached;
+        if (!cache_->get(ConditionCache::make_vision_embed_key(encoder, image, *lora_epoch_), &cached)) {
+            if (perf != nullptr) {
+                perf->condition_cache_misses++;
+            }
+            return false;
+        }
+        LOG_DEBUG("%s vision cache hit (%zu entries, %.2f MB)",
+                  encoder.c_str(),
+                  cache_->size(),
+                  cache_->used_bytes() / 1024.f / 1024.f);
+        if (perf != nullptr) {
+            perf->condition_cache_hits++;
+        }
+        *embed = std::move(cached.c_vector);
+        return true;
+    }
+
+    void put(const std::string& encoder, const sd::Tensor<float>& image, const sd::Tensor<float>& embed) override {
+        if (!cache_->enabled()) {
+            return;
+        }
+        SDCondition cached;
+        cached.c_vector = embed;
+        cache_->put(ConditionCache::make_vision_embed_key(encoder, image, *lora_epoch_), cached);
+    }
+
+private:
+    ConditionCache* cache_;
+    const uint64_t* lora_epoch_;
+};
+
+#endif  // __SD_CONDITIONING_CONDITION_CACHE_HPP__
@@ -0,0 +1,403 @@
+#ifndef __SD_CONDITIONING_CONDITION_FILE_HPP__
+#define __SD_CONDITIONING_CONDITION_FILE_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "conditioning/condition_cache.hpp"
+#include "core/util.h"
+#include "model_io/safetensors_io.h"
+
+// Text encoder outputs of a prompt list precomputed into one safetensors file
+// (export_image_conditions), so diffusion-only jobs look their prompts up
+// instead of running CLIP/T5/LLM. An entry is stored under a hash of its
+// ConditionCache key taken without LoRAs; the header metadata maps the hash
+// back to the key and gives each tensor, stored flat, its shape. Lookups copy
+// the entry out of the mapped file, so only the pages of the prompts a job
+// uses are read.
+namespace sd::condition_file {
+
+    constexpr const char* VERSION = "1";
+
+    inline const std::pair<const char*, sd::Tensor<float> SDCondition::*> FLOAT_FIELDS[] = {
+        {"crossattn", &SDCondition::c_crossattn},
+        {"vector", &SDCondition::c_vector},
+        {"concat", &SDCondition::c_concat},
+        {"t5_weights", &SDCondition::c_t5_weights},
+    };
+
+    inline const std::pair<const char*, sd::Tensor<int32_t> SDCondition::*> INT_FIELDS[] = {
+        {"t5_ids", &SDCondition::c_t5_ids},
+        {"input_ids", &SDCondition::c_input_ids},
+        {"position_ids", &SDCondition::c_position_ids},
+        {"token_types", &SDCondition::c_token_types},
+        {"vinput_mask", &SDCondition::c_vinput_mask},
+    };
+
+    // The key of a prompt's condition, the same in every process.
+    inline std::string make_key(const ConditionerParams& params) {
+        return ConditionCache::make_key(params, 0);
+    }
+
+    // FNV-1a of the key, the tensor name prefix of its entry.
+    inline std::string key_hash(const std::string& key) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return sd_format("%016llx", (unsigned long long)hash);
+    }
+
+    inline std::string shape_to_string(const std::vector<int64_t>& shape) {
+        std::string text;
+        for (size_t i = 0; i < shape.size(); i++) {
+            text += (i == 0 ? "" : ",") + std::to_string(shape[i]);
+        }
+        return text;
+    }
+
+    inline bool parse_shape(const std::string& text, std::vector<int64_t>* shape) {
+        shape->clear();
+        const char* p = text.c_str();
+        while (*p != '\0') {
+            char* end     = nullptr;
+            long long dim = strtoll(p, &end, 10);
+            if (end == p || dim < 0 || (*end != ',' && *end != '\0')) {
+                return false;
+            }
+            shape->push_back(dim);
+            p = *end == ',' ? end + 1 : end;
+        }
+        return !shape->empty();
+    }
+
+    // Collects conditions in a spill file next to path, so an export of many
+    // prompts holds one condition at a time, and writes path from it once all
+    // are in.
+    class Writer {
+    public:
+        ~Writer() {
+            if (spill_.is_open()) {
+                spill_.close();
+            }
+            if (!spill_path_.empty()) {
+                std::error_code ec;
+                std::filesystem::remove(spill_path_, ec);
+            }
+        }
+
+        bool open(const std::string& path, std::string* error) {
+            path_       = path;
+            spill_path_ = path + ".part";
+            spill_.open(spill_path_, std::ios::binary | std::ios::trunc);
+            if (!spill_.is_open()) {
+                *error = "failed to open '" + spill_path_ + "' for writing";
+                return false;
+            }
+            return true;
+        }
+
+        bool contains(const std::string& key) const {
+            return keys_.count(key) > 0;
+        }
+
+        size_t size() const {
+            return keys_.size();
+        }
+
+        bool add(const std::string& key, const SDCondition& condition, std::string* error) {
+            if (!keys_.insert(key).second) {
+                return true;
+            }
+            const std::string hash = key_hash(key);
+            metadata_.emplace_back(hash, key);
+            for (const auto& [field, member] : FLOAT_FIELDS) {
+                if (!add_tensor(hash + "." + field, condition.*member, GGML_TYPE_F32, error)) {
+                    return false;
+                }
+            }
+            for (const auto& [field, member] : INT_FIELDS) {
+                if (!add_tensor(hash + "." + field, condition.*member, GGML_TYPE_I32, error)) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < condition.c_image_embeds.size(); i++) {
+                const std::string name = hash + ".image_embed." + std::to_string(i);
+                metadata_.emplace_back(name + ".position", std::to_string(condition.c_image_embeds[i].first));
+                if (!add_tensor(name, condition.c_image_embeds[i].second, GGML_TYPE_F32, error)) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < condition.c_ref_images.size(); i++) {
+                if (!add_tensor(hash + ".ref_image." + std::to_string(i), condition.c_ref_images[i], GGML_TYPE_F32, error)) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < condition.extra_c_crossattns.size(); i++) {
+                if (!add_tensor(hash + ".extra_crossattn." + std::to_string(i), condition.extra_c_crossattns[i], GGML_TYPE_F32, error)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Writes path, tagged with the model version the conditions were
+        // encoded for.
+        bool finish(const std::string& sd_version, std::string* error) {
+            spill_.close();
+            if (!spill_) {
+                *error = "failed to write '" + spill_path_ + "'";
+                return false;
+            }
+            std::ifstream spill(spill_path_, std::ios::binary);
+            if (!spill.is_open()) {
+                *error = "failed to open '" + spill_path_ + "'";
+                return false;
+            }
+
+            ggml_init_params params = {tensors_.size() * ggml_tensor_overhead() + 1024, nullptr, true};
+            ggml_context* ctx       = ggml_init(params);
+            if (ctx == nullptr) {
+                *error = "failed to create a ggml context for the condition file";
+                return false;
+            }
+            std::vector<TensorWriteInfo> write_tensors;
+            write_tensors.reserve(tensors_.size());
+            for (const Stored& stored : tensors_) {
+                TensorWriteInfo info;
+                info.tensor = ggml_new_tensor_1d(ctx, stored.type, stored.numel);
+                info.ne[0]  = stored.numel;
+                info.n_dims = 1;
+                ggml_set_name(info.tensor, stored.name.c_str());
+                write_tensors.push_back(info);
+            }
+
+            // a batch stays valid while the next one loads, so two buffers
+            // take turns
+            std::vector<uint8_t> buffers[2];
+            size_t batch = 0;
+            TensorWriteStream stream;
+            stream.batch_bytes = 64 * 1024 * 1024;
+            stream.load        = [&](size_t begin, size_t end) {
+                std::vector<uint8_t>& buffer = buffers[batch++ % 2];
+                size_t bytes                 = 0;
+                for (size_t i = begin; i < end; i++) {
+                    bytes += ggml_nbytes(write_tensors[i].tensor);
+                }
+                buffer.resize(bytes);
+                spill.seekg(static_cast<std::streamoff>(tensors_[begin].offset));
+                if (!spill.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(bytes))) {
+                    return false;
+                }
+                size_t offset = 0;
+                for (size_t i = begin; i < end; i++) {
+                    write_tensors[i].tensor->data = buffer.data() + offset;
+                    offset += ggml_nbytes(write_tensors[i].tensor);
+                }
+                return true;
+            };
+
+            std::vector<std::pair<std::string, std::string>> metadata = {
+                {"sdcpp.conditions.version", VERSION},
+                {"sdcpp.conditions.sd_version", sd_version},
+            };
+            metadata.insert(metadata.end(), metadata_.begin(), metadata_.end());
+            bool ok = write_safetensors_file(path_, write_tensors, error, &stream, &metadata);
+            ggml_free(ctx);
+            return ok;
+        }
+
+    private:
+        // one flat tensor of the spill file, in spill order
+        struct Stored {
+            std::string name;
+            ggml_type type  = GGML_TYPE_F32;
+            int64_t numel   = 0;
+            uint64_t offset = 0;
+        };
+
+        template <typename T>
+        bool add_tensor(const std::string& name, const sd::Tensor<T>& tensor, ggml_type type, std::string* error) {
+            if (tensor.empty()) {
+                return true;
+            }
+            size_t bytes = static_cast<size_t>(tensor.numel()) * sizeof(T);
+            spill_.write(reinterpret_cast<const char*>(tensor.data()), static_cast<std::streamsize>(bytes));
+            if (!spill_) {
+                *error = "failed to write '" + spill_path_ + "'";
+                return false;
+            }
+            tensors_.push_back({name, type, tensor.numel(), spill_bytes_});
+            metadata_.emplace_back(name, shape_to_string(tensor.shape()));
+            spill_bytes_ += bytes;
+            return true;
+        }
+
+        std::string path_;
+        std::string spill_path_;
+        std::ofstream spill_;
+        uint64_t spill_bytes_ = 0;
+        std::vector<Stored> tensors_;
+        std::vector<std::pair<std::string, std::string>> metadata_;
+        std::unordered_set<std::string> keys_;
+    };
+
+    // A condition file opened for lookups.
+    class File {
+    public:
+        bool open(const std::string& path, std::string* error) {
+            std::vector<std::pair<std::string, std::string>> metadata_list;
+            std::vector<TensorStorage> storages;
+            if (!read_safetensors_metadata(path, metadata_list, error) ||
+                !read_safetensors_file(path, storages, error)) {
+                return false;
+            }
+            std::unordered_map<std::string, std::string> metadata(metadata_list.begin(), metadata_list.end());
+            if (metadata["sdcpp.conditions.version"] != VERSION) {
+                *error = "'" + path + "' is not a condition file of this version";
+                return false;
+            }
+            sd_version_ = metadata["sdcpp.conditions.sd_version"];
+
+            mmap_ = MmapWrapper::create(path);
+            if (mmap_ == nullptr) {
+                *error = "failed to map '" + path + "'";
+                return false;
+            }
+
+            for (const TensorStorage& storage : storages) {
+                size_t dot = storage.name.find('.');
+                if (dot == std::string::npos) {
+                    continue;
+                }
+                Stored stored;
+                stored.field = storage.name.substr(dot + 1);
+                stored.type  = storage.type;
+                size_t last  = stored.field.rfind('.');
+                if (last != std::string::npos) {
+                    stored.index = atoi(stored.field.c_str() + last + 1);
+                    stored.field = stored.field.substr(0, last);
+                }
+                auto position = metadata.find(storage.name + ".position");
+                if (position != metadata.end()) {
+                    stored.position = atoi(position->second.c_str());
+                }
+                auto shape = metadata.find(storage.name);
+                if (shape == metadata.end() || !parse_shape(shape->second, &stored.shape) ||
+                    tensor_numel(stored.shape) != storage.nelements() ||
+                    storage.offset + storage.nbytes() > mmap_->size()) {
+                    *error = "invalid tensor '" + storage.name + "' in '" + path + "'";
+                    return false;
+                }
+                stored.offset = storage.offset;
+
+                const std::string hash = storage.name.substr(0, dot);
+                Entry& entry           = entries_[hash];
+                entry.key              = metadata[hash];
+                entry.tensors.push_back(std::move(stored));
+            }
+            return true;
+        }
+
+        size_t size() const {
+            return entries_.size();
+        }
+
+        const std::string& sd_version() const {
+            return sd_version_;
+        }
+
+        bool get(const std::string& key, SDCondition* condition) const {
+            auto it = entries_.find(key_hash(key));
+            if (it == entries_.end() || it->second.key != key) {
+                return false;
+            }
+            SDCondition result;
+            for (const Stored& stored : it->second.tensors) {
+                if (!read_field(stored, &result)) {
+                    return false;
+                }
+            }
+            *condition = std::move(result);
+            return true;
+        }
+
+    private:
+        struct Stored {
+            std::string field;
+            int index      = -1;
+            int position   = 0;
+            ggml_type type = GGML_TYPE_F32;
+            std::vector<int64_t> shape;
+            uint64_t offset = 0;
+        };
+
+        struct Entry {
+            std::string key;
+            std::vector<Stored> tensors;
+        };
+
+        template <typename T>
+        bool read_tensor(const Stored& stored, ggml_type type, sd::Tensor<T>* tensor) const {
+            if (stored.type != type) {
+                return false;
+            }
+            *tensor = sd::Tensor<T>(stored.shape);
+            memcpy(tensor->data(), mmap_->data() + stored.offset, static_cast<size_t>(tensor->numel()) * sizeof(T));
+            return true;
+        }
+
+        bool read_field(const Stored& stored, SDCondition* condition) const {
+            for (const auto& [field, member] : FLOAT_FIELDS) {
+                if (stored.field == field) {
+                    return read_tensor(stored, GGML_TYPE_F32, &(condition->*member));
+                }
+            }
+            for (const auto& [field, member] : INT_FIELDS) {
+                if (stored.field == field) {
+                    return read_tensor(stored, GGML_TYPE_I32, &(condition->*member));
+                }
+            }
+            if (stored.index < 0) {
+                return false;
+            }
+            size_t index = static_cast<size_t>(stored.index);
+            if (stored.field == "image_embed") {
+                if (condition->c_image_embeds.size() <= index) {
+                    condition->c_image_embeds.resize(index + 1);
+                }
+                condition->c_image_embeds[index].first = stored.position;
+                return read_tensor(stored, GGML_TYPE_F32, &condition->c_image_embeds[index].second);
+            }
+            std::vector<sd::Tensor<float>>* tensors = nullptr;
+            if (stored.field == "ref_image") {
+                tensors = &condition->c_ref_images;
+            } else if (stored.field == "extra_crossattn") {
+                tensors = &condition->extra_c_crossattns;
+            } else {
+                return false;
+            }
+            if (tensors->size() <= index) {
+                tensors->resize(index + 1);
+            }
+            return read_tensor(stored, GGML_TYPE_F32, &(*tensors)[index]);
+        }
+
+        std::unique_ptr<MmapWrapper> mmap_;
+        std::unordered_map<std::string, Entry> entries_;  // by key hash
+        std::string sd_version_;
+    };
+
+}  // namespace sd::condition_file
+
+#endif  // __SD_CONDITIONING_CONDITION_FILE_HPP__
@@ -1,10 +1,12 @@
 ﻿#ifndef __SD_CONDITIONING_CONDITIONER_HPP__
 #define __SD_CONDITIONING_CONDITIONER_HPP__
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <optional>
 
+#include "conditioning/embedding_table.h"
 #include "core/tensor_ggml.hpp"
 #include "model/te/clip.hpp"
 #include "model/te/llm.hpp"
@@ -98,6 +100,17 @@ static inline sd::Tensor<float> apply_token_weights(sd::Tensor<float> hidden_sta
     return hidden_states;
 }
 
+// Shortest of 64, 128, 256, ... (capped at max_len) tokens that holds
+// valid_len. Few distinct lengths keep the encoder graphs and the cached T5
+// position bias reusable across prompts.
+static inline size_t dynamic_text_length_bucket(size_t valid_len, size_t max_len) {
+    size_t len = 64;
+    while (len < valid_len && len < max_len) {
+        len *= 2;
+    }
+    return std::min(len, max_len);
+}
+
 struct ConditionerParams {
     std::string text;
     int clip_skip                                    = -1;
@@ -107,18 +120,71 @@ struct ConditionerParams {
     const std::vector<sd::Tensor<float>>* ref_images = nullptr;  // for qwen image edit
 };
 
+// Vision tower outputs of reference images that outlive a request, so an
+// edit of the same image with a new prompt skips the vision encoder. The key
+// is the encoder and the preprocessed image, whose shape carries its
+// resolution; the context backs it with its ConditionCache.
+struct VisionEmbedCache {
+    virtual ~VisionEmbedCache() = default;
+
+    virtual bool get(const std::string& encoder, const sd::Tensor<float>& image, sd::Tensor<float>* embed) = 0;
+    virtual void put(const std::string& encoder, const sd::Tensor<float>& image, const sd::Tensor<float>& embed) = 0;
+};
+
 struct Conditioner {
     virtual ~Conditioner() = default;
 
 public:
     virtual SDCondition get_learned_condition(int n_threads,
                                               const ConditionerParams& conditioner_params) = 0;
-    virtual void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors)           = 0;
+    // Encodes several prompts; conditioners that can stack them into one
+    // graph per encoder override this.
+    virtual std::vector<SDCondition> get_learned_conditions(int n_threads,
+                                                            const std::vector<ConditionerParams>& params_list) {
+        std::vector<SDCondition> conditions;
+        for (const auto& params : params_list) {
+            conditions.push_back(get_learned_condition(n_threads, params));
+        }
+        return conditions;
+    }
+    virtual void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors) = 0;
     virtual void set_max_graph_vram_bytes(size_t max_vram_bytes) {}
     virtual void set_stream_layers_enabled(bool enabled) {}
     virtual void set_flash_attention_enabled(bool enabled) = 0;
     virtual void set_weight_adapter(const std::shared_ptr<WeightAdapter>& adapter) {}
+    // Cut a single padded prompt chunk to dynamic_text_length_bucket()
+    // instead of the full padded length, for models that tolerate it.
+    virtual void set_dynamic_text_length_enabled(bool enabled) {}
+    // Params no prompt ever reads, such as text model layers past the
+    // deepest hidden state the conditioner takes; they are never loaded.
+    virtual void add_ignore_tensors(std::set<std::string>& ignore_tensors) const {}
     virtual void runner_done() {}
+    // Called when the applied LoRA set changes, for state derived from the
+    // encoder weights that outlives a request.
+    virtual void weights_changed() {}
+
+    void set_vision_embed_cache(VisionEmbedCache* cache) {
+        vision_embed_cache = cache;
+    }
+
+protected:
+    VisionEmbedCache* vision_embed_cache = nullptr;
+
+    // encode() of a preprocessed reference image, or its output from an
+    // earlier request
+    sd::Tensor<float> encode_vision_cached(const std::string& encoder,
+                                           const sd::Tensor<float>& image,
+                                           const std::function<sd::Tensor<float>()>& encode) {
+        sd::Tensor<float> embed;
+        if (vision_embed_cache != nullptr && vision_embed_cache->get(encoder, image, &embed)) {
+            return embed;
+        }
+        embed = encode();
+        if (vision_embed_cache != nullptr && !embed.empty()) {
+            vision_embed_cache->put(encoder, image, embed);
+        }
+        return embed;
+    }
 };
 
 // ldm.modules.encoders.modules.FrozenCLIPEmbedder
@@ -147,6 +213,11 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
             tokenizer.add_special_token(name);
         }
         bool force_clip_f32 = !embedding_map.empty();
+        std::vector<std::string> embedding_paths;
+        for (const auto& kv : embedding_map) {
+            embedding_paths.push_back(kv.second);
+        }
+        sd::embedding_table::preload(embedding_paths);
         if (sd_version_is_sd1(version)) {
             text_model = std::make_shared<CLIPTextModelRunner>(backend, tensor_storage_map, "cond_stage_model.transformer.text_model", OPENAI_CLIP_VIT_L_14, true, force_clip_f32, weight_manager);
         } else if (sd_version_is_sd2(version)) {
@@ -200,11 +271,6 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
     }
 
     bool load_embedding(std::string embd_name, std::string embd_path, std::vector<int32_t>& bpe_tokens) {
-        ModelLoader model_loader;
-        if (!model_loader.init_from_file_and_convert_name(embd_path)) {
-            LOG_ERROR("embedding '%s' failed", embd_name.c_str());
-            return false;
-        }
         auto iter = embedding_pos_map.find(embd_name);
         if (iter != embedding_pos_map.end()) {
             LOG_DEBUG("embedding already read in: %s", embd_name.c_str());
@@ -213,43 +279,34 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
             }
             return true;
         }
-        ggml_init_params params;
-        params.mem_size        = 100 * 1024 * 1024;  // max for custom embeddings 100 MB
-        params.mem_buffer      = nullptr;
-        params.no_alloc        = false;
-        ggml_context* embd_ctx = ggml_init(params);
-        ggml_tensor* embd      = nullptr;
-        ggml_tensor* embd2     = nullptr;
-        auto on_load           = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) {
-            if (tensor_storage.ne[0] != text_model->model.hidden_size) {
-                if (text_model2) {
-                    if (tensor_storage.ne[0] == text_model2->model.hidden_size) {
-                        embd2       = ggml_new_tensor_2d(embd_ctx, tensor_storage.type, text_model2->model.hidden_size, tensor_storage.n_dims > 1 ? tensor_storage.ne[1] : 1);
-                        *dst_tensor = embd2;
-                    } else {
-                        LOG_DEBUG("embedding wrong hidden size, got %i, expected %i or %i", tensor_storage.ne[0], text_model->model.hidden_size, text_model2->model.hidden_size);
-                        return false;
-                    }
-                } else {
-                    LOG_DEBUG("embedding wrong hidden size, got %i, expected %i", tensor_storage.ne[0], text_model->model.hidden_size);
-                    return false;
-                }
+        std::shared_ptr<const sd::embedding_table::Embedding> embedding = sd::embedding_table::get(embd_path);
+        if (embedding == nullptr) {
+            LOG_ERROR("embedding '%s' failed", embd_name.c_str());
+            return false;
+        }
+        // the last tensor of each text encoder's hidden size, as loading
+        // them into one slot each kept
+        const sd::embedding_table::Vectors* embd  = nullptr;
+        const sd::embedding_table::Vectors* embd2 = nullptr;
+        for (const auto& vectors : *embedding) {
+            if (vectors.hidden_size == text_model->model.hidden_size) {
+                embd = &vectors;
+            } else if (text_model2 && vectors.hidden_size == text_model2->model.hidden_size) {
+                embd2 = &vectors;
+            } else if (text_model2) {
+                LOG_DEBUG("embedding wrong hidden size, got %i, expected %i or %i", (int)vectors.hidden_size, text_model->model.hidden_size, text_model2->model.hidden_size);
             } else {
-                embd        = ggml_new_tensor_2d(embd_ctx, tensor_storage.type, text_model->model.hidden_size, tensor_storage.n_dims > 1 ? tensor_storage.ne[1] : 1);
-                *dst_tensor = embd;
+                LOG_DEBUG("embedding wrong hidden size, got %i, expected %i", (int)vectors.hidden_size, text_model->model.hidden_size);
             }
-            return true;
-        };
-        model_loader.set_n_threads(1);
-        model_loader.load_tensors(on_load);
+        }
         int pos_start = num_custom_embeddings;
         if (embd) {
             int64_t hidden_size = text_model->model.hidden_size;
-            token_embed_custom.resize(token_embed_custom.size() + ggml_nbytes(embd));
+            token_embed_custom.resize(token_embed_custom.size() + embd->data.size());
             memcpy((void*)(token_embed_custom.data() + num_custom_embeddings * hidden_size * ggml_type_size(embd->type)),
-                   embd->data,
-                   ggml_nbytes(embd));
-            for (int i = 0; i < embd->ne[1]; i++) {
+                   embd->data.data(),
+                   embd->data.size());
+            for (int i = 0; i < embd->rows; i++) {
                 bpe_tokens.push_back(text_model->model.vocab_size + num_custom_embeddings);
                 // LOG_DEBUG("new custom token: %i", text_model.vocab_size + num_custom_embeddings);
                 num_custom_embeddings++;
@@ -258,11 +315,11 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
         }
         if (embd2) {
             int64_t hidden_size = text_model2->model.hidden_size;
-            token_embed_custom.resize(token_embed_custom.size() + ggml_nbytes(embd2));
+            token_embed_custom.resize(token_embed_custom.size() + embd2->data.size());
             memcpy((void*)(token_embed_custom.data() + num_custom_embeddings_2 * hidden_size * ggml_type_size(embd2->type)),
-                   embd2->data,
-                   ggml_nbytes(embd2));
-            for (int i = 0; i < embd2->ne[1]; i++) {
+                   embd2->data.data(),
+                   embd2->data.size());
+            for (int i = 0; i < embd2->rows; i++) {
                 bpe_tokens.push_back(text_model2->model.vocab_size + num_custom_embeddings_2);
                 // LOG_DEBUG("new custom token: %i", text_model.vocab_size + num_custom_embeddings);
                 num_custom_embeddings_2++;
@@ -359,110 +416,124 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
         return {tokens, weights};
     }
 
-    SDCondition get_learned_condition_common(int n_threads,
-                                             std::vector<int>& tokens,
-                                             std::vector<float>& weights,
-                                             int clip_skip,
-                                             int width,
-                                             int height,
-                                             bool zero_out_masked = false) {
-        int64_t t0 = ggml_time_ms();
-        sd::Tensor<float> hidden_states;  // [n_token, hidden_size] or [n_token, hidden_size + hidden_size2]
-        sd::Tensor<float> pooled;
-
+    int resolve_clip_skip(int clip_skip) const {
         if (clip_skip <= 0) {
             clip_skip = (sd_version_is_sd2(version) || sd_version_is_sdxl(version)) ? 2 : 1;
         }
+        return clip_skip;
+    }
 
-        size_t chunk_len   = 77;
-        size_t chunk_count = tokens.size() / chunk_len;
-        for (int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
-            std::vector<int> chunk_tokens(tokens.begin() + chunk_idx * chunk_len,
-                                          tokens.begin() + (chunk_idx + 1) * chunk_len);
-            std::vector<float> chunk_weights(weights.begin() + chunk_idx * chunk_len,
-                                             weights.begin() + (chunk_idx + 1) * chunk_len);
-
-            sd::Tensor<int32_t> input_ids({static_cast<int64_t>(chunk_tokens.size())}, chunk_tokens);
-            sd::Tensor<int32_t> input_ids2;
-            size_t max_token_idx = 0;
-            if (sd_version_is_sdxl(version)) {
-                auto it = std::find(chunk_tokens.begin(), chunk_tokens.end(), tokenizer.EOS_TOKEN_ID);
-                if (it != chunk_tokens.end()) {
-                    std::fill(std::next(it), chunk_tokens.end(), 0);
-                }
+    std::vector<int> whole_chunks(const std::vector<int>& tokens) const {
+        const size_t chunk_len = text_model->model.n_token;
+        return std::vector<int>(tokens.begin(), tokens.begin() + tokens.size() / chunk_len * chunk_len);
+    }
 
-                max_token_idx = std::min<size_t>(std::distance(chunk_tokens.begin(), it), chunk_tokens.size() - 1);
+    // The second text model of SDXL sees every token after EOS as 0.
+    std::vector<int> sdxl_chunk_tokens(std::vector<int> chunk_tokens, size_t* max_token_idx) const {
+        auto it = std::find(chunk_tokens.begin(), chunk_tokens.end(), tokenizer.EOS_TOKEN_ID);
+        if (it != chunk_tokens.end()) {
+            std::fill(std::next(it), chunk_tokens.end(), 0);
+        }
+        *max_token_idx = std::min<size_t>(std::distance(chunk_tokens.begin(), it), chunk_tokens.size() - 1);
+        return chunk_tokens;
+    }
 
-                input_ids2 = sd::Tensor<int32_t>({static_cast<int64_t>(chunk_tokens.size())}, chunk_tokens);
+    // Runs whole 77-token chunks, of one prompt or of several, through the
+    // text models as one batch: [hidden_size (+ hidden_size2), 77, n_chunks].
+    sd::Tensor<float> compute_chunk_hidden_states(int n_threads, const std::vector<int>& tokens, int clip_skip) {
+        const size_t chunk_len = text_model->model.n_token;
+        GGML_ASSERT(!tokens.empty() && tokens.size() % chunk_len == 0);
 
-                // for (int i = 0; i < chunk_tokens.size(); i++) {
-                //     printf("%d ", chunk_tokens[i]);
-                // }
-                // printf("\n");
+        sd::Tensor<int32_t> input_ids({static_cast<int64_t>(tokens.size())}, tokens);
+        auto hidden_states = text_model->compute(n_threads,
+                                                 input_ids,
+                                                 num_custom_embeddings,
+                                                 token_embed_custom.data(),
+                                                 0,
+                                                 false,
+                                                 clip_skip,
+                                                 false,
+                                                 true,
+                                                 true);
+        GGML_ASSERT(!hidden_states.empty());
+        if (sd_version_is_sdxl(version)) {
+            std::vector<int> tokens2;
+            tokens2.reserve(tokens.size());
+            for (size_t offset = 0; offset < tokens.size(); offset += chunk_len) {
+                size_t max_token_idx = 0;
+                auto chunk_tokens    = sdxl_chunk_tokens(std::vector<int>(tokens.begin() + offset, tokens.begin() + offset + chunk_len),
+                                                         &max_token_idx);
+                tokens2.insert(tokens2.end(), chunk_tokens.begin(), chunk_tokens.end());
             }
+            sd::Tensor<int32_t> input_ids2({static_cast<int64_t>(tokens2.size())}, tokens2);
+            auto hidden_states2 = text_model2->compute(n_threads,
+                                                       input_ids2,
+                                                       num_custom_embeddings,
+                                                       token_embed_custom.data(),
+                                                       0,
+                                                       false,
+                                                       clip_skip,
+                                                       false,
+                                                       true,
+                                                       true);
+            GGML_ASSERT(!hidden_states2.empty());
+            hidden_states = sd::ops::concat(hidden_states, hidden_states2, 0);
+        }
+        return hidden_states;
+    }
 
-            {
-                auto chunk_hidden_states = text_model->compute(n_threads,
-                                                               input_ids,
-                                                               num_custom_embeddings,
-                                                               token_embed_custom.data(),
-                                                               max_token_idx,
-                                                               false,
-                                                               clip_skip,
-                                                               false,
-                                                               true,
-                                                               true);
-                GGML_ASSERT(!chunk_hidden_states.empty());
-                if (sd_version_is_sdxl(version)) {
-                    auto chunk_hidden_states2 = text_model2->compute(n_threads,
-                                                                     input_ids2,
-                                                                     num_custom_embeddings,
-                                                                     token_embed_custom.data(),
-                                                                     max_token_idx,
-                                                                     false,
-                                                                     clip_skip,
-                                                                     false,
-                                                                     true,
-                                                                     true);
-                    GGML_ASSERT(!chunk_hidden_states2.empty());
-                    chunk_hidden_states = sd::ops::concat(chunk_hidden_states, chunk_hidden_states2, 0);
-
-                    if (chunk_idx == 0) {
-                        pooled = text_model2->compute(n_threads,
-                                                      input_ids2,
-                                                      num_custom_embeddings,
-                                                      token_embed_custom.data(),
-                                                      max_token_idx,
-                                                      true,
-                                                      clip_skip,
-                                                      false,
-                                                      true,
-                                                      true);
-                        GGML_ASSERT(!pooled.empty());
-                    }
-                }
-                int64_t t1 = ggml_time_ms();
-                LOG_DEBUG("computing condition graph completed, taking %" PRId64 " ms", t1 - t0);
+    // Builds the condition of one prompt from its chunks, starting at
+    // first_chunk, in the output of compute_chunk_hidden_states.
+    SDCondition make_condition(int n_threads,
+                               const sd::Tensor<float>& chunk_hidden_states,
+                               int64_t first_chunk,
+                               const std::vector<int>& tokens,
+                               const std::vector<float>& weights,
+                               int clip_skip,
+                               int width,
+                               int height,
+                               bool zero_out_masked) {
+        const size_t chunk_len   = text_model->model.n_token;
+        const size_t chunk_count = tokens.size() / chunk_len;
 
-                chunk_hidden_states = apply_token_weights(std::move(chunk_hidden_states), chunk_weights);
+        sd::Tensor<float> hidden_states;  // [n_token, hidden_size] or [n_token, hidden_size + hidden_size2]
+        for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
+            std::vector<float> chunk_weights(weights.begin() + chunk_idx * chunk_len,
+                                             weights.begin() + (chunk_idx + 1) * chunk_len);
+            int64_t chunk              = first_chunk + static_cast<int64_t>(chunk_idx);
+            auto chunk_hidden_states_i = sd::ops::slice(chunk_hidden_states, 2, chunk, chunk + 1);
+            chunk_hidden_states_i      = apply_token_weights(std::move(chunk_hidden_states_i), chunk_weights);
 
-                if (zero_out_masked) {
-                    chunk_hidden_states.fill_(0.0f);
-                }
-                if (!hidden_states.empty()) {
-                    hidden_states = sd::ops::concat(hidden_states, chunk_hidden_states, 1);
-                } else {
-                    hidden_states = std::move(chunk_hidden_states);
-                }
+            if (zero_out_masked) {
+                chunk_hidden_states_i.fill_(0.0f);
+            }
+            if (!hidden_states.empty()) {
+                hidden_states = sd::ops::concat(hidden_states, chunk_hidden_states_i, 1);
+            } else {
+                hidden_states = std::move(chunk_hidden_states_i);
             }
         }
 
         sd::Tensor<float> vec;
         if (sd_version_is_sdxl(version)) {
+            size_t max_token_idx = 0;
+            auto chunk_tokens    = sdxl_chunk_tokens(std::vector<int>(tokens.begin(), tokens.begin() + chunk_len), &max_token_idx);
+            sd::Tensor<int32_t> input_ids2({static_cast<int64_t>(chunk_tokens.size())}, chunk_tokens);
+            auto pooled = text_model2->compute(n_threads,
+                                               input_ids2,
+                                               num_custom_embeddings,
+                                               token_embed_custom.data(),
+                                               max_token_idx,
+                                               true,
+                                               clip_skip,
+                                               false,
+                                               true,
+                                               true);
+            GGML_ASSERT(!pooled.empty());
+
             int out_dim         = 256;
             int adm_in_channels = 2816;
-            GGML_ASSERT(!pooled.empty());
-            vec = sd::Tensor<float>({adm_in_channels});
+            vec                 = sd::Tensor<float>({adm_in_channels});
             vec.fill_(0.0f);
             size_t offset = 0;
             std::copy(pooled.values().begin(), pooled.values().end(), vec.values().begin());
@@ -491,6 +562,65 @@ struct FrozenCLIPEmbedderWithCustomWords : public Conditioner {
         return result;
     }
 
+    SDCondition get_learned_condition_common(int n_threads,
+                                             std::vector<int>& tokens,
+                                             std::vector<float>& weights,
+                                             int clip_skip,
+                                             int width,
+                                             int height,
+                                             bool zero_out_masked = false) {
+        int64_t t0         = ggml_time_ms();
+        clip_skip          = resolve_clip_skip(clip_skip);
+        auto hidden_states = compute_chunk_hidden_states(n_threads, whole_chunks(tokens), clip_skip);
+        int64_t t1         = ggml_time_ms();
+        LOG_DEBUG("computing condition graph completed, taking %" PRId64 " ms", t1 - t0);
+        return make_condition(n_threads, hidden_states, 0, tokens, weights, clip_skip, width, height, zero_out_masked);
+    }
+
+    // Prompts that share clip_skip, typically cond and uncond, are encoded in
+    // one batch per text model.
+    std::vector<SDCondition> get_learned_conditions(int n_threads,
+                                                    const std::vector<ConditionerParams>& params_list) override {
+        for (const auto& params : params_list) {
+            if (params.clip_skip != params_list[0].clip_skip) {
+                return Conditioner::get_learned_conditions(n_threads, params_list);
+            }
+        }
+        if (params_list.empty()) {
+            return {};
+        }
+
+        int64_t t0 = ggml_time_ms();
+        std::vector<std::pair<std::vector<int>, std::vector<float>>> tokens_and_weights;
+        std::vector<int> all_tokens;
+        for (const auto& params : params_list) {
+            tokens_and_weights.push_back(tokenize(params.text, text_model->model.n_token, text_model->model.n_token, true));
+            auto tokens = whole_chunks(tokens_and_weights.back().first);
+            all_tokens.insert(all_tokens.end(), tokens.begin(), tokens.end());
+        }
+        int clip_skip      = resolve_clip_skip(params_list[0].clip_skip);
+        auto hidden_states = compute_chunk_hidden_states(n_threads, all_tokens, clip_skip);
+        int64_t t1         = ggml_time_ms();
+        LOG_DEBUG("computing condition graph for %zu prompts completed, taking %" PRId64 " ms", params_list.size(), t1 - t0);
+
+        std::vector<SDCondition> conditions;
+        int64_t first_chunk = 0;
+        for (size_t i = 0; i < params_list.size(); i++) {
+            const auto& [tokens, weights] = tokens_and_weights[i];
+            conditions.push_back(make_condition(n_threads,
+                                                hidden_states,
+                                                first_chunk,
+                                                tokens,
+                                                weights,
+                                                clip_skip,
+                                                params_list[i].width,
+                                                params_list[i].height,
+                                                params_list[i].zero_out_masked));
+            first_chunk += static_cast<int64_t>(tokens.size() / text_model->model.n_token);
+        }
+        return conditions;
+    }
+
     SDCondition get_learned_condition(int n_threads,
                                       const ConditionerParams& conditioner_params) override {
         auto tokens_and_weights     = tokenize(conditioner_params.text, text_model->model.n_token, text_model->model.n_token, true);
@@ -671,6 +801,12 @@ struct SD3CLIPEmbedder : public Conditioner {
         }
     }
 
+    void weights_changed() override {
+        if (t5) {
+            t5->clear_position_bias_cache();
+        }
+    }
+
     std::vector<std::pair<std::vector<int>, std::vector<float>>> tokenize(std::string text,
                                                                           size_t min_length          = 0,
                                                                           size_t max_length          = 0,
@@ -935,7 +1071,8 @@ struct FluxCLIPEmbedder : public Conditioner {
     T5UniGramTokenizer t5_tokenizer;
     std::shared_ptr<CLIPTextModelRunner> clip_l;
     std::shared_ptr<T5Runner> t5;
-    size_t chunk_len = 256;
+    size_t chunk_len         = 256;
+    bool dynamic_text_length = false;
 
     FluxCLIPEmbedder(ggml_backend_t backend,
                      const String2TensorStorage& tensor_storage_map      = {},
@@ -1021,6 +1158,16 @@ struct FluxCLIPEmbedder : public Conditioner {
         }
     }
 
+    void weights_changed() override {
+        if (t5) {
+            t5->clear_position_bias_cache();
+        }
+    }
+
+    void set_dynamic_text_length_enabled(bool enabled) override {
+        dynamic_text_length = enabled;
+    }
+
     std::vector<std::pair<std::vector<int>, std::vector<float>>> tokenize(std::string text,
                                                                           size_t min_length = 0,
                                                                           size_t max_length = 0) {
@@ -1096,7 +1243,9 @@ struct FluxCLIPEmbedder : public Conditioner {
         sd::Tensor<float> hidden_states;  // [N, n_token, 4096]
         sd::Tensor<float> pooled;         // [768,]
 
-        size_t chunk_count = std::max(clip_l_tokens.size() > 0 ? chunk_len : 0, t5_tokens.size()) / chunk_len;
+        // A dynamic length prompt is a single chunk shorter than chunk_len.
+        size_t t5_chunk_len = (t5_tokens.empty() || t5_tokens.size() >= chunk_len) ? chunk_len : t5_tokens.size();
+        size_t chunk_count  = std::max(clip_l_tokens.size() > 0 ? t5_chunk_len : 0, t5_tokens.size()) / t5_chunk_len;
         for (int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
             // clip_l
             if (chunk_idx == 0) {
@@ -1132,10 +1281,10 @@ struct FluxCLIPEmbedder : public Conditioner {
             // t5
             sd::Tensor<float> chunk_hidden_states;
             if (t5) {
-                std::vector<int> chunk_tokens(t5_tokens.begin() + chunk_idx * chunk_len,
-                                              t5_tokens.begin() + (chunk_idx + 1) * chunk_len);
-                std::vector<float> chunk_weights(t5_weights.begin() + chunk_idx * chunk_len,
-                                                 t5_weights.begin() + (chunk_idx + 1) * chunk_len);
+                std::vector<int> chunk_tokens(t5_tokens.begin() + chunk_idx * t5_chunk_len,
+                                              t5_tokens.begin() + (chunk_idx + 1) * t5_chunk_len);
+                std::vector<float> chunk_weights(t5_weights.begin() + chunk_idx * t5_chunk_len,
+                                                 t5_weights.begin() + (chunk_idx + 1) * t5_chunk_len);
 
                 sd::Tensor<int32_t> input_ids({static_cast<int64_t>(chunk_tokens.size())}, chunk_tokens);
                 chunk_hidden_states = t5->compute(n_threads,
@@ -1150,7 +1299,7 @@ struct FluxCLIPEmbedder : public Conditioner {
                     chunk_hidden_states.fill_(0.0f);
                 }
             } else {
-                chunk_hidden_states = sd::Tensor<float>::zeros({4096, static_cast<int64_t>(chunk_len)});
+                chunk_hidden_states = sd::Tensor<float>::zeros({4096, static_cast<int64_t>(t5_chunk_len)});
             }
 
             int64_t t1 = ggml_time_ms();
@@ -1171,6 +1320,16 @@ struct FluxCLIPEmbedder : public Conditioner {
     SDCondition get_learned_condition(int n_threads,
                                       const ConditionerParams& conditioner_params) override {
         auto tokens_and_weights = tokenize(conditioner_params.text, chunk_len, chunk_len);
+        auto& t5_tokens         = tokens_and_weights[1].first;
+        if (dynamic_text_length && t5_tokens.size() == chunk_len) {
+            size_t valid_len = t5_tokens.size();
+            while (valid_len > 0 && t5_tokens[valid_len - 1] == t5_tokenizer.PAD_TOKEN_ID) {
+                valid_len--;
+            }
+            size_t text_len = dynamic_text_length_bucket(valid_len, chunk_len);
+            t5_tokens.resize(text_len);
+            tokens_and_weights[1].second.resize(text_len);
+        }
         return get_learned_condition_common(n_threads,
                                             tokens_and_weights,
                                             conditioner_params.clip_skip,
@@ -1181,10 +1340,11 @@ struct FluxCLIPEmbedder : public Conditioner {
 struct T5CLIPEmbedder : public Conditioner {
     T5UniGramTokenizer t5_tokenizer;
     std::shared_ptr<T5Runner> t5;
-    size_t chunk_len = 512;
-    bool use_mask    = false;
-    int mask_pad     = 0;
-    bool is_umt5     = false;
+    size_t chunk_len         = 512;
+    bool use_mask            = false;
+    int mask_pad             = 0;
+    bool is_umt5             = false;
+    bool dynamic_text_length = false;
 
     T5CLIPEmbedder(ggml_backend_t backend,
                    const String2TensorStorage& tensor_storage_map      = {},
@@ -1244,6 +1404,16 @@ struct T5CLIPEmbedder : public Conditioner {
         }
     }
 
+    void weights_changed() override {
+        if (t5) {
+            t5->clear_position_bias_cache();
+        }
+    }
+
+    void set_dynamic_text_length_enabled(bool enabled) override {
+        dynamic_text_length = enabled;
+    }
+
     std::tuple<std::vector<int>, std::vector<float>, std::vector<float>> tokenize(std::string text,
                                                                                   size_t min_length = 0,
                                                                                   size_t max_length = 0) {
@@ -1318,21 +1488,42 @@ struct T5CLIPEmbedder : public Conditioner {
         sd::Tensor<float> t5_attn_mask = sd::Tensor<float>::from_vector(t5_attn_mask_vec);
         sd::Tensor<float> hidden_states;
 
-        size_t chunk_count = t5_tokens.size() / chunk_len;
+        // A dynamic length prompt is a single chunk shorter than chunk_len.
+        size_t t5_chunk_len = (t5_tokens.empty() || t5_tokens.size() >= chunk_len) ? chunk_len : t5_tokens.size();
+        size_t chunk_count  = t5_tokens.size() / t5_chunk_len;
 
         for (int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
             // t5
-            std::vector<int> chunk_tokens(t5_tokens.begin() + chunk_idx * chunk_len,
-                                          t5_tokens.begin() + (chunk_idx + 1) * chunk_len);
-            std::vector<float> chunk_weights(t5_weights.begin() + chunk_idx * chunk_len,
-                                             t5_weights.begin() + (chunk_idx + 1) * chunk_len);
-            std::vector<float> chunk_mask(t5_attn_mask_vec.begin() + chunk_idx * chunk_len,
-                                          t5_attn_mask_vec.begin() + (chunk_idx + 1) * chunk_len);
-
-            sd::Tensor<int32_t> input_ids({static_cast<int64_t>(chunk_tokens.size())}, chunk_tokens);
+            std::vector<int> chunk_tokens(t5_tokens.begin() + chunk_idx * t5_chunk_len,
+                                          t5_tokens.begin() + (chunk_idx + 1) * t5_chunk_len);
+            std::vector<float> chunk_weights(t5_weights.begin() + chunk_idx * t5_chunk_len,
+                                             t5_weights.begin() + (chunk_idx + 1) * t5_chunk_len);
+            std::vector<float> chunk_mask(t5_attn_mask_vec.begin() + chunk_idx * t5_chunk_len,
+                                          t5_attn_mask_vec.begin() + (chunk_idx + 1) * t5_chunk_len);
+
+            // The encoder is bidirectional and masked keys get no attention,
+            // so with a fully masked padding tail the valid tokens come out
+            // the same from a shorter sequence; the tail outputs are zeroed
+            // below anyway. The length is rounded up to 64 so prompts of
+            // similar length share the cached position bias.
+            size_t run_len = t5_chunk_len;
+            if (use_mask && zero_out_masked &&
+                std::all_of(chunk_weights.begin(), chunk_weights.end(), [](float w) { return w == 1.0f; })) {
+                size_t valid_len = chunk_mask.size();
+                while (valid_len > 0 && std::isinf(chunk_mask[valid_len - 1])) {
+                    valid_len--;
+                }
+                if (valid_len > 0) {
+                    run_len = std::min(t5_chunk_len, (valid_len + 63) / 64 * 64);
+                }
+            }
+
+            sd::Tensor<int32_t> input_ids({static_cast<int64_t>(run_len)},
+                                          std::vector<int>(chunk_tokens.begin(), chunk_tokens.begin() + run_len));
             sd::Tensor<float> t5_attn_mask_chunk;
             if (use_mask) {
-                t5_attn_mask_chunk = sd::Tensor<float>({static_cast<int64_t>(chunk_mask.size())}, chunk_mask);
+                t5_attn_mask_chunk = sd::Tensor<float>({static_cast<int64_t>(run_len)},
+                                                       std::vector<float>(chunk_mask.begin(), chunk_mask.begin() + run_len));
             }
 
             auto chunk_hidden_states = t5->compute(n_threads,
@@ -1342,6 +1533,11 @@ struct T5CLIPEmbedder : public Conditioner {
                                                    true,
                                                    true);
             GGML_ASSERT(!chunk_hidden_states.empty());
+            if (run_len < t5_chunk_len) {
+                std::vector<int64_t> pad_shape = chunk_hidden_states.shape();
+                pad_shape[1]                   = static_cast<int64_t>(t5_chunk_len - run_len);
+                chunk_hidden_states            = sd::ops::concat(chunk_hidden_states, sd::Tensor<float>::zeros(pad_shape), 1);
+            }
             chunk_hidden_states = apply_token_weights(std::move(chunk_hidden_states), chunk_weights);
 
             if (zero_out_masked) {
@@ -1371,6 +1567,20 @@ struct T5CLIPEmbedder : public Conditioner {
     SDCondition get_learned_condition(int n_threads,
                                       const ConditionerParams& conditioner_params) override {
         auto tokens_and_weights = tokenize(conditioner_params.text, chunk_len, chunk_len);
+        auto& t5_tokens         = std::get<0>(tokens_and_weights);
+        auto& t5_mask           = std::get<2>(tokens_and_weights);
+        if (dynamic_text_length && t5_tokens.size() == chunk_len) {
+            // Keep the padding the mask later unmasks (mask_pad) in the
+            // cut prompt.
+            size_t valid_len = t5_mask.size();
+            while (valid_len > 0 && std::isinf(t5_mask[valid_len - 1])) {
+                valid_len--;
+            }
+            size_t text_len = dynamic_text_length_bucket(valid_len + std::max(mask_pad, 0), chunk_len);
+            t5_tokens.resize(text_len);
+            std::get<1>(tokens_and_weights).resize(text_len);
+            t5_mask.resize(text_len);
+        }
         return get_learned_condition_common(n_threads,
                                             tokens_and_weights,
                                             conditioner_params.clip_skip,
@@ -1544,6 +1754,40 @@ struct LLMEmbedder : public Conditioner {
         llm->get_param_tensors(tensors, "text_encoders.llm");
     }
 
+    // Hidden states the conditioner of `version` takes, counted like
+    // LLM::TextModel::forward_embeds does: 1..num_layers are the outputs of
+    // the layers, num_layers + 1 the final norm; empty means the final norm.
+    static std::set<int> out_layers_for(SDVersion version) {
+        if (sd_version_is_krea2(version)) {
+            return {2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 32, 35};
+        } else if (version == VERSION_FLUX2) {
+            return {10, 20, 30};
+        } else if (sd_version_is_ideogram4(version)) {
+            return {1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 34, 36};
+        } else if (sd_version_is_ernie_image(version)) {
+            return {25};  // -2
+        } else if (sd_version_is_lens(version)) {
+            return {6, 12, 18, 24};
+        } else if (sd_version_is_z_image(version)) {
+            return {35};  // -2
+        } else if (version == VERSION_FLUX2_KLEIN || sd_version_is_sefi_image(version)) {
+            return {9, 18, 27};
+        }
+        return {};
+    }
+
+    void add_ignore_tensors(std::set<std::string>& ignore_tensors) const override {
+        std::set<int> out_layers = out_layers_for(version);
+        int64_t num_layers       = llm->config.num_layers;
+        if (out_layers.empty() || *out_layers.begin() < 1 || *out_layers.rbegin() > num_layers) {
+            return;
+        }
+        for (int64_t i = *out_layers.rbegin(); i < num_layers; i++) {
+            ignore_tensors.insert("text_encoders.llm.model.layers." + std::to_string(i) + ".");
+        }
+        ignore_tensors.insert("text_encoders.llm.model.norm.");
+    }
+
     void set_max_graph_vram_bytes(size_t max_vram_bytes) override {
         llm->set_max_graph_vram_bytes(max_vram_bytes);
     }
@@ -1568,6 +1812,12 @@ struct LLMEmbedder : public Conditioner {
         }
     }
 
+    void weights_changed() override {
+        if (llm) {
+            llm->clear_prefix_cache();
+        }
+    }
+
     std::tuple<std::vector<int>, std::vector<float>, std::vector<float>> tokenize(std::string text,
                                                                                   const std::pair<int, int>& attn_range,
                                                                                   size_t min_length = 0,
@@ -1659,15 +1909,33 @@ struct LLMEmbedder : public Conditioner {
             }
         }
 
-        auto hidden_states = llm->compute(n_threads,
-                                          input_ids,
-                                          attention_mask,
-                                          image_embeds,
-                                          out_layers,
-                                          false,
-                                          false,
-                                          true,
-                                          true);
+        // The template text in front of the user prompt is tokenized on its own,
+        // so its tokens are a fixed prefix of every prompt using that template.
+        int64_t prefix_len = 0;
+        if (image_embeds.empty() && prompt_attn_range.first > 0 && prompt_attn_range.second > 0) {
+            std::vector<int> prefix_tokens = tokenizer->encode(prompt.substr(0, prompt_attn_range.first), nullptr);
+            for (size_t offset = 0; offset <= 1 && prefix_len == 0; offset++) {  // after an optional BOS
+                if (offset + prefix_tokens.size() < tokens.size() &&
+                    std::equal(prefix_tokens.begin(), prefix_tokens.end(), tokens.begin() + offset)) {
+                    prefix_len = static_cast<int64_t>(offset + prefix_tokens.size());
+                }
+            }
+        }
+
+        sd::Tensor<float> hidden_states;
+        if (prefix_len > 0) {
+            hidden_states = llm->compute_with_prefix_cache(n_threads, input_ids, attention_mask, out_layers, prefix_len);
+        } else {
+            hidden_states = llm->compute(n_threads,
+                                         input_ids,
+                                         attention_mask,
+                                         image_embeds,
+                                         out_layers,
+                                         false,
+                                         false,
+                                         true,
+                                         true);
+        }
         GGML_ASSERT(!hidden_states.empty());
         hidden_states = apply_token_weights(std::move(hidden_states), weights);
         GGML_ASSERT(hidden_states.shape()[1] > prompt_template_encode_start_idx);
@@ -1706,7 +1974,7 @@ struct LLMEmbedder : public Conditioner {
         int max_length                       = 100000000;
         int hidden_states_min_length         = 0;  // zero pad hidden_states
         bool spell_quotes                    = false;
-        std::set<int> out_layers;
+        std::set<int> out_layers             = out_layers_for(version);
 
         int64_t t0 = ggml_time_ms();
 
@@ -1745,7 +2013,9 @@ struct LLMEmbedder : public Conditioner {
 
                     auto resized_image = clip_preprocess(image, w_bar, h_bar);
 
-                    auto image_embed = llm->encode_image(n_threads, resized_image, false, true, true);
+                    auto image_embed = encode_vision_cached("llm", resized_image, [&]() {
+                        return llm->encode_image(n_threads, resized_image, false, true, true);
+                    });
                     GGML_ASSERT(!image_embed.empty());
                     image_embeds.emplace_back(image_embed_idx, image_embed);
                     image_embed_idx += 1 + static_cast<int>(image_embed.shape()[1]) + 6;
@@ -1808,7 +2078,9 @@ struct LLMEmbedder : public Conditioner {
                     LOG_DEBUG("resize conditioner ref image %d from %dx%d to %dx%d", i, height, width, h_bar, w_bar);
 
                     auto resized_image = clip_preprocess(image, w_bar, h_bar);
-                    auto image_embed   = llm->encode_image(n_threads, resized_image, false, true, true);
+                    auto image_embed   = encode_vision_cached("llm", resized_image, [&]() {
+                        return llm->encode_image(n_threads, resized_image, false, true, true);
+                    });
                     GGML_ASSERT(!image_embed.empty());
 
                     std::string image_prefix = prompt_prefix + img_prompt + "<|vision_start|>";
@@ -1839,7 +2111,6 @@ struct LLMEmbedder : public Conditioner {
             }
         } else if (sd_version_is_krea2(version)) {
             prompt_template_encode_start_idx = 34;
-            out_layers                       = {2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 32, 35};
 
             prompt = "<|im_start|>system\nDescribe the image by detailing the color, shape, size, texture, quantity, text, spatial relationships of the objects and background:<|im_end|>\n<|im_start|>user\n";
 
@@ -1885,7 +2156,9 @@ struct LLMEmbedder : public Conditioner {
                     LOG_DEBUG("resize conditioner ref image %d from %dx%d to %dx%d", i, height, width, h_bar, w_bar);
 
                     auto resized_image = clip_preprocess(image, w_bar, h_bar);
-                    auto image_embed   = llm->encode_image(n_threads, resized_image, false, true, true);
+                    auto image_embed   = encode_vision_cached("llm", resized_image, [&]() {
+                        return llm->encode_image(n_threads, resized_image, false, true, true);
+                    });
                     GGML_ASSERT(!image_embed.empty());
                     image_embeds.emplace_back(image_embed_idx, image_embed);
                     image_embed_idx += 1 + static_cast<int>(image_embed.shape()[1]) + 6;
@@ -1916,7 +2189,6 @@ struct LLMEmbedder : public Conditioner {
         } else if (version == VERSION_FLUX2) {
             prompt_template_encode_start_idx = 0;
             hidden_states_min_length         = 512;
-            out_layers                       = {10, 20, 30};
 
             prompt = "[SYSTEM_PROMPT]You are an AI that reasons about image descriptions. You give structured responses focusing on object relationships, object\nattribution and actions without speculation.[/SYSTEM_PROMPT][INST]";
 
@@ -1927,7 +2199,6 @@ struct LLMEmbedder : public Conditioner {
             prompt += "[/INST]";
         } else if (sd_version_is_ideogram4(version)) {
             prompt_template_encode_start_idx = 0;
-            out_layers                       = {1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 34, 36};
 
             prompt = "<|im_start|>user\n";
             prompt += conditioner_params.text;
@@ -1935,7 +2206,6 @@ struct LLMEmbedder : public Conditioner {
             prompt_attn_range = {0, 0};
         } else if (sd_version_is_ernie_image(version)) {
             prompt_template_encode_start_idx = 0;
-            out_layers                       = {25};  // -2
 
             prompt_attn_range.first = 0;
             prompt += conditioner_params.text;
@@ -1944,7 +2214,6 @@ struct LLMEmbedder : public Conditioner {
             prompt_template_encode_start_idx = 97;
             min_length                       = 0;
             max_length                       = 512;
-            out_layers                       = {6, 12, 18, 24};
 
             prompt =
                 "<|start|>system<|message|>You are ChatGPT, a large language model trained by OpenAI.\n"
@@ -1966,7 +2235,6 @@ struct LLMEmbedder : public Conditioner {
             prompt += "<|end|><|start|>assistant<|channel|>analysis<|message|>Need to generate one image according to the description.<|end|><|start|>assistant<|channel|>final<|message|>";
         } else if (sd_version_is_z_image(version)) {
             prompt_template_encode_start_idx = 0;
-            out_layers                       = {35};  // -2
 
             if (conditioner_params.ref_images != nullptr && !conditioner_params.ref_images->empty()) {
                 LOG_INFO("ZImageOmniPipeline");
@@ -1988,7 +2256,6 @@ struct LLMEmbedder : public Conditioner {
         } else if (version == VERSION_FLUX2_KLEIN) {
             prompt_template_encode_start_idx = 0;
             min_length                       = 512;
-            out_layers                       = {9, 18, 27};
 
             prompt = "<|im_start|>user\n";
 
@@ -2000,7 +2267,6 @@ struct LLMEmbedder : public Conditioner {
         } else if (sd_version_is_sefi_image(version)) {
             prompt_template_encode_start_idx = 0;
             min_length                       = 1024;
-            out_layers                       = {9, 18, 27};
 
             prompt = "<|im_start|>user\n";
 
@@ -2270,7 +2536,7 @@ struct LTXAVEmbedder : public Conditioner {
         auto& weights            = std::get<1>(tokens_weights_mask);
         auto& mask               = std::get<2>(tokens_weights_mask);
 
-        sd::Tensor<int32_t> input_ids({static_cast<int64_t>(tokens.size())}, std::vector<int32_t>(tokens.begin(), tokens.end()));
+        sd::Tensor<int32_t> input_ids({static_cast<int64_t>(tokens.size())}, tokens);
         sd::Tensor<float> attention_mask;
         if (!mask.empty()) {
             const float mask_min = std::numeric_limits<float>::lowest() / 4.0f;
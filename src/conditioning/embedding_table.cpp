@@ -0,0 +1,113 @@
+#include "conditioning/embedding_table.h"
+
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+
+#include "core/util.h"
+#include "model_loader.h"
+
+namespace sd::embedding_table {
+
+    namespace {
+
+        struct Entry {
+            uintmax_t file_size = 0;
+            std::filesystem::file_time_type mtime;
+            std::shared_ptr<const Embedding> embedding;  // null for a file that failed
+        };
+
+        std::mutex table_mutex;
+        std::map<std::string, Entry> table;  // by path
+
+        bool file_stamp(const std::string& path, uintmax_t& file_size, std::filesystem::file_time_type& mtime) {
+            std::error_code ec;
+            file_size = std::filesystem::file_size(path, ec);
+            if (ec) {
+                return false;
+            }
+            mtime = std::filesystem::last_write_time(path, ec);
+            return !ec;
+        }
+
+        std::shared_ptr<const Embedding> read_embedding(const std::string& path) {
+            ModelLoader model_loader;
+            if (!model_loader.init_from_file_and_convert_name(path)) {
+                return nullptr;
+            }
+
+            size_t mem_size = ggml_tensor_overhead();
+            for (const auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+                mem_size += ggml_tensor_overhead() + static_cast<size_t>(tensor_storage.nbytes());
+            }
+            ggml_init_params params;
+            params.mem_size        = mem_size;
+            params.mem_buffer      = nullptr;
+            params.no_alloc        = false;
+            ggml_context* embd_ctx = ggml_init(params);
+            if (embd_ctx == nullptr) {
+                return nullptr;
+            }
+
+            std::vector<ggml_tensor*> tensors;
+            auto on_load = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) {
+                *dst_tensor = ggml_new_tensor_2d(embd_ctx, tensor_storage.type, tensor_storage.ne[0], tensor_storage.n_dims > 1 ? tensor_storage.ne[1] : 1);
+                tensors.push_back(*dst_tensor);
+                return true;
+            };
+            model_loader.set_n_threads(1);
+            bool ok = model_loader.load_tensors(on_load);
+
+            auto embedding = std::make_shared<Embedding>();
+            for (ggml_tensor* tensor : tensors) {
+                Vectors vectors;
+                vectors.hidden_size = tensor->ne[0];
+                vectors.rows        = tensor->ne[1];
+                vectors.type        = tensor->type;
+                vectors.data.resize(ggml_nbytes(tensor));
+                memcpy(vectors.data.data(), tensor->data, vectors.data.size());
+                embedding->push_back(std::move(vectors));
+            }
+            ggml_free(embd_ctx);
+            if (!ok || embedding->empty()) {
+                return nullptr;
+            }
+            return embedding;
+        }
+
+    }  // namespace
+
+    std::shared_ptr<const Embedding> get(const std::string& path) {
+        uintmax_t file_size = 0;
+        std::filesystem::file_time_type mtime;
+        if (!file_stamp(path, file_size, mtime)) {
+            return nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> lock(table_mutex);
+            auto it = table.find(path);
+            if (it != table.end() && it->second.file_size == file_size && it->second.mtime == mtime) {
+                return it->second.embedding;
+            }
+        }
+
+        // read outside the lock; two contexts may read one file at once, and
+        // either copy is the same
+        std::shared_ptr<const Embedding> embedding = read_embedding(path);
+        std::lock_guard<std::mutex> lock(table_mutex);
+        table[path] = {file_size, mtime, embedding};
+        return embedding;
+    }
+
+    void preload(const std::vector<std::string>& paths) {
+        int64_t t0 = ggml_time_ms();
+        for (const auto& path : paths) {
+            get(path);
+        }
+        if (!paths.empty()) {
+            LOG_DEBUG("embedding table ready for %zu embeddings in %lld ms", paths.size(), static_cast<long long>(ggml_time_ms() - t0));
+        }
+    }
+
+}  // namespace sd::embedding_table
@@ -0,0 +1,39 @@
+#ifndef __SD_CONDITIONING_EMBEDDING_TABLE_H__
+#define __SD_CONDITIONING_EMBEDDING_TABLE_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ggml.h"
+
+// Textual inversion embeddings read once per process and shared by every
+// context, so a server with many embeddings and models opens each file once
+// instead of on its first prompt in every context. A file is read again
+// after its size or modification time changed.
+namespace sd::embedding_table {
+
+    // One tensor of an embedding file: rows token vectors of hidden_size
+    // values of type, as stored.
+    struct Vectors {
+        int64_t hidden_size = 0;
+        int64_t rows        = 0;
+        ggml_type type      = GGML_TYPE_F32;
+        std::vector<uint8_t> data;
+    };
+
+    // The tensors of one file in load order; SDXL files hold one for each
+    // text encoder.
+    using Embedding = std::vector<Vectors>;
+
+    // The embedding in path, read now when the table does not have it; null
+    // when the file cannot be read.
+    std::shared_ptr<const Embedding> get(const std::string& path);
+
+    // Reads the files the table does not have yet.
+    void preload(const std::vector<std::string>& paths);
+
+}  // namespace sd::embedding_table
+
+#endif  // __SD_CONDITIONING_EMBEDDING_TABLE_H__
@@ -1,27 +1,45 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <regex>
+#include <set>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "core/task_pool.h"
+#include "model/adapter/lora.hpp"
 #include "model_io/gguf_io.h"
 #include "model_io/safetensors_io.h"
 #include "model_loader.h"
+#include "model_manager.h"
+#include "name_conversion.h"
 #include "util.h"
 
 #include "ggml_extend_backend.h"
 
+using CompiledTensorTypeRules = std::vector<std::pair<std::regex, ggml_type>>;
+
+// data converted and held per batch; with the batch being written that is
+// about twice this much
+static constexpr size_t CONVERT_BATCH_BYTES = 512ull * 1024 * 1024;
+
 static ggml_type get_export_tensor_type(ModelLoader& model_loader,
                                         const TensorStorage& tensor_storage,
                                         ggml_type type,
-                                        const TensorTypeRules& tensor_type_rules) {
+                                        const CompiledTensorTypeRules& tensor_type_rules) {
     const std::string& name = tensor_storage.name;
     ggml_type tensor_type   = tensor_storage.type;
     ggml_type dst_type      = type;
 
-    for (const auto& tensor_type_rule : tensor_type_rules) {
-        std::regex pattern(tensor_type_rule.first);
+    for (const auto& [pattern, rule_type] : tensor_type_rules) {
         if (std::regex_search(name, pattern)) {
-            dst_type = tensor_type_rule.second;
+            dst_type = rule_type;
             break;
         }
     }
@@ -33,15 +51,156 @@ static ggml_type get_export_tensor_type(ModelLoader& model_loader,
     return tensor_type;
 }
 
+static bool is_skipped_tensor(const std::string& name, const std::vector<std::string>& skip_prefixes) {
+    for (const auto& prefix : skip_prefixes) {
+        if (starts_with(name, prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// LoRAs merged into the exported weights. A tensor some LoRA patches loads in
+// f32, gets the diffs added by LoraModel on the CPU and is converted to its
+// export type after that, so a quantized weight is rounded once.
+struct BakedLoras {
+    ggml_backend_t backend = nullptr;
+    SDVersion version      = VERSION_COUNT;
+    int n_threads          = 1;
+    std::vector<std::pair<ModelManager::LoraSpec, std::shared_ptr<LoraModel>>> loras;
+    std::set<std::string> lora_tensor_names;                  // of every LoRA, sorted for prefix lookups
+    std::set<std::string> model_tensor_names;                 // the converted names LoRAs refer to
+    std::unordered_map<std::string, std::string> lora_names;  // file tensor name -> converted name
+    size_t patched_count = 0;
+
+    ~BakedLoras() {
+        loras.clear();
+        if (backend != nullptr) {
+            ggml_backend_free(backend);
+        }
+    }
+
+    bool patches(const std::string& name) const {
+        auto name_it = lora_names.find(name);
+        if (name_it == lora_names.end()) {
+            return false;
+        }
+        std::string prefix = "lora." + name_it->second + ".";
+        auto it            = lora_tensor_names.lower_bound(prefix);
+        return it != lora_tensor_names.end() && starts_with(*it, prefix);
+    }
+};
+
+static bool load_baked_loras(ModelLoader& model_loader,
+                             const sd_lora_t* loras,
+                             uint32_t lora_count,
+                             bool names_converted,
+                             BakedLoras* baked) {
+    baked->version   = model_loader.get_sd_version();
+    baked->n_threads = std::max(1, sd_get_num_physical_cores());
+    baked->backend   = sd_backend_cpu_init();
+    if (baked->backend == nullptr) {
+        LOG_ERROR("CPU backend init failed for baking LoRAs");
+        return false;
+    }
+    for (const auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+        std::string lora_name = names_converted ? name : convert_tensor_name(name, baked->version);
+        baked->model_tensor_names.insert(lora_name);
+        baked->lora_names[name] = std::move(lora_name);
+    }
+    for (uint32_t i = 0; i < lora_count; ++i) {
+        ModelManager::LoraSpec spec;
+        spec.path          = SAFE_STR(loras[i].path);
+        spec.multiplier    = loras[i].multiplier;
+        spec.is_high_noise = loras[i].is_high_noise;
+        spec.required      = true;
+        auto lora          = std::make_shared<LoraModel>(spec.path,
+                                                baked->backend,
+                                                baked->backend,
+                                                spec.path,
+                                                spec.is_high_noise ? "model.high_noise_" : "",
+                                                baked->version);
+        if (!lora->load_from_file(baked->n_threads)) {
+            LOG_ERROR("load lora tensors from '%s' failed", spec.path.c_str());
+            return false;
+        }
+        lora->preprocess_lora_tensors(baked->model_tensor_names);
+        for (const auto& [name, _] : lora->lora_tensors) {
+            baked->lora_tensor_names.insert(name);
+        }
+        lora->multiplier = spec.multiplier;
+        baked->loras.emplace_back(std::move(spec), std::move(lora));
+    }
+    return true;
+}
+
+// Loads the targets in f32, merges every LoRA into them and writes them back
+// in the type of each target, whose data is already allocated.
+static bool bake_lora_tensors(ModelLoader& model_loader,
+                              BakedLoras& baked,
+                              const std::vector<ggml_tensor*>& targets) {
+    if (targets.empty()) {
+        return true;
+    }
+    ggml_context* ctx = ggml_init({targets.size() * ggml_tensor_overhead(), nullptr, true});
+    if (ctx == nullptr) {
+        LOG_ERROR("ggml_init failed for baking LoRAs");
+        return false;
+    }
+    std::unordered_map<std::string, ggml_tensor*> f32_by_name;
+    std::map<std::string, ggml_tensor*> model_tensors;
+    std::set<std::string> names;
+    for (ggml_tensor* target : targets) {
+        std::string name  = ggml_get_name(target);
+        ggml_tensor* f32  = ggml_new_tensor(ctx, GGML_TYPE_F32, GGML_MAX_DIMS, target->ne);
+        f32_by_name[name] = f32;
+        names.insert(name);
+        model_tensors[baked.lora_names[name]] = f32;
+    }
+    ggml_backend_buffer_t buffer = ggml_backend_alloc_ctx_tensors(ctx, baked.backend);
+    if (buffer == nullptr) {
+        LOG_ERROR("allocating %zu f32 tensors for baking LoRAs failed", targets.size());
+        ggml_free(ctx);
+        return false;
+    }
+    auto on_new_tensor_cb = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) -> bool {
+        auto it = f32_by_name.find(tensor_storage.name);
+        if (it == f32_by_name.end()) {
+            LOG_ERROR("unexpected tensor '%s' while baking LoRAs", tensor_storage.name.c_str());
+            return false;
+        }
+        *dst_tensor = it->second;
+        return true;
+    };
+    bool success = model_loader.load_tensors(on_new_tensor_cb, false, &names, false, false);
+    for (size_t i = 0; success && i < baked.loras.size(); ++i) {
+        baked.loras[i].second->apply(model_tensors, baked.model_tensor_names, baked.version, baked.n_threads, false);
+    }
+    if (success) {
+        for (ggml_tensor* target : targets) {
+            ggml_tensor* f32 = f32_by_name[ggml_get_name(target)];
+            convert_tensor(f32->data, GGML_TYPE_F32, target->data, target->type, ggml_nrows(f32), f32->ne[0]);
+        }
+        baked.patched_count += targets.size();
+    }
+    ggml_backend_buffer_free(buffer);
+    ggml_free(ctx);
+    return success;
+}
+
 static bool load_tensors_for_export(ModelLoader& model_loader,
                                     ggml_context* ggml_ctx,
-                                    ggml_type type,
-                                    const TensorTypeRules& tensor_type_rules,
-                                    std::vector<TensorWriteInfo>& tensors) {
+                                    const std::function<ggml_type(const TensorStorage&)>& get_tensor_type,
+                                    std::vector<TensorWriteInfo>& tensors,
+                                    const std::vector<std::string>& skip_prefixes = {}) {
     std::mutex tensor_mutex;
     auto on_new_tensor_cb = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) -> bool {
         const std::string& name = tensor_storage.name;
-        ggml_type tensor_type   = get_export_tensor_type(model_loader, tensor_storage, type, tensor_type_rules);
+        if (is_skipped_tensor(name, skip_prefixes)) {
+            *dst_tensor = nullptr;
+            return true;
+        }
+        ggml_type tensor_type = get_tensor_type(tensor_storage);
 
         std::lock_guard<std::mutex> lock(tensor_mutex);
         ggml_tensor* tensor = ggml_new_tensor(ggml_ctx, tensor_type, tensor_storage.n_dims, tensor_storage.ne);
@@ -81,7 +240,9 @@ bool convert(const char* input_path,
              const char* output_path,
              sd_type_t output_type,
              const char* tensor_type_rules,
-             bool convert_name) {
+             bool convert_name,
+             const sd_lora_t* loras,
+             uint32_t lora_count) {
     ModelLoader model_loader;
 
     if (!model_loader.init_from_file(input_path)) {
@@ -99,33 +260,120 @@ bool convert(const char* input_path,
         model_loader.convert_tensors_name();
     }
 
+    BakedLoras baked_loras;
+    if (lora_count > 0 && !load_baked_loras(model_loader, loras, lora_count, convert_name, &baked_loras)) {
+        return false;
+    }
+
     ggml_type type             = sd_type_to_ggml_type(output_type);
     bool output_is_safetensors = ends_with(output_path, ".safetensors");
-    TensorTypeRules type_rules = parse_tensor_type_rules(tensor_type_rules);
-
-    auto backend    = sd_backend_cpu_init();
-    size_t mem_size = 1 * 1024 * 1024;  // for padding
-    mem_size += model_loader.get_tensor_storage_map().size() * ggml_tensor_overhead();
-    mem_size += model_loader.get_params_mem_size(backend, type);
-    LOG_INFO("model tensors mem size: %.2fMB", mem_size / 1024.f / 1024.f);
-    ggml_context* ggml_ctx = ggml_init({mem_size, nullptr, false});
+    // compiled once: auto quantization rules name every tensor, so
+    // compiling them per tensor would be quadratic in the tensor count
+    CompiledTensorTypeRules type_rules;
+    for (const auto& [pattern, rule_type] : parse_tensor_type_rules(tensor_type_rules)) {
+        type_rules.emplace_back(std::regex(pattern), rule_type);
+    }
 
+    // only the tensor descriptions live in the context; the data is loaded
+    // and converted batch by batch while the output is written
+    auto& tensor_storage_map = model_loader.get_tensor_storage_map();
+    size_t mem_size          = 1 * 1024 * 1024 + tensor_storage_map.size() * ggml_tensor_overhead();
+    ggml_context* ggml_ctx   = ggml_init({mem_size, nullptr, true});
     if (ggml_ctx == nullptr) {
         LOG_ERROR("ggml_init failed for converter");
-        ggml_backend_free(backend);
         return false;
     }
 
     std::vector<TensorWriteInfo> tensors;
-    bool success = load_tensors_for_export(model_loader, ggml_ctx, type, type_rules, tensors);
-    ggml_backend_free(backend);
+    std::unordered_map<std::string, size_t> tensor_index;
+    uint64_t total_bytes = 0;
+    for (const auto& [name, tensor_storage] : tensor_storage_map) {
+        ggml_type tensor_type = get_export_tensor_type(model_loader, tensor_storage, type, type_rules);
+        ggml_tensor* tensor   = ggml_new_tensor(ggml_ctx, tensor_type, tensor_storage.n_dims, tensor_storage.ne);
+        ggml_set_name(tensor, name.c_str());
+
+        TensorWriteInfo write_info;
+        write_info.tensor = tensor;
+        write_info.n_dims = tensor_storage.n_dims;
+        for (int i = 0; i < tensor_storage.n_dims; ++i) {
+            write_info.ne[i] = tensor_storage.ne[i];
+        }
+        tensor_index[name] = tensors.size();
+        tensors.push_back(std::move(write_info));
+        total_bytes += ggml_nbytes(tensor);
+    }
+    LOG_INFO("converting %zu tensors (%.2fMB) in batches of up to %.2fMB",
+             tensors.size(),
+             total_bytes / 1024.f / 1024.f,
+             CONVERT_BATCH_BYTES / 1024.f / 1024.f);
+
+    // two batches are held at once: the one being written and the one
+    // being loaded
+    std::vector<uint8_t> batch_data[2];
+    size_t batch_count    = 0;
+    size_t tensors_done   = 0;
+    uint64_t bytes_done   = 0;
+    const int64_t t_start = ggml_time_ms();
+    TensorWriteStream stream;
+    stream.batch_bytes = CONVERT_BATCH_BYTES;
+    stream.load        = [&](size_t begin, size_t end) {
+        const size_t alignment = 64;
+        size_t batch_size      = alignment;
+        for (size_t i = begin; i < end; ++i) {
+            batch_size += GGML_PAD(ggml_nbytes(tensors[i].tensor), alignment);
+        }
+        std::vector<uint8_t>& data = batch_data[batch_count++ % 2];
+        data.resize(batch_size);
+        uint8_t* base = (uint8_t*)GGML_PAD((uintptr_t)data.data(), alignment);
+
+        std::set<std::string> names;
+        std::vector<ggml_tensor*> lora_targets;
+        size_t offset = 0;
+        for (size_t i = begin; i < end; ++i) {
+            ggml_tensor* tensor = tensors[i].tensor;
+            tensor->data        = base + offset;
+            offset += GGML_PAD(ggml_nbytes(tensor), alignment);
+            bytes_done += ggml_nbytes(tensor);
+            if (!baked_loras.loras.empty() && baked_loras.patches(ggml_get_name(tensor))) {
+                lora_targets.push_back(tensor);
+            } else {
+                names.insert(ggml_get_name(tensor));
+            }
+        }
+        auto on_new_tensor_cb = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) -> bool {
+            auto it = tensor_index.find(tensor_storage.name);
+            if (it == tensor_index.end()) {
+                LOG_ERROR("unexpected tensor '%s' while converting", tensor_storage.name.c_str());
+                return false;
+            }
+            *dst_tensor = tensors[it->second].tensor;
+            return true;
+        };
+        if (!names.empty() && !model_loader.load_tensors(on_new_tensor_cb, false, &names, false, false)) {
+            return false;
+        }
+        if (!bake_lora_tensors(model_loader, baked_loras, lora_targets)) {
+            return false;
+        }
+        tensors_done += end - begin;
+        pretty_bytes_progress(static_cast<int>(tensors_done),
+                              static_cast<int>(tensors.size()),
+                              bytes_done,
+                              (ggml_time_ms() - t_start) / 1000.0f);
+        return true;
+    };
 
     std::string error;
+    bool success = false;
+    if (output_is_safetensors) {
+        success = write_safetensors_file(output_path, tensors, &error, &stream);
+    } else {
+        success = write_gguf_file(output_path, tensors, &error, nullptr, &stream);
+    }
     if (success) {
-        if (output_is_safetensors) {
-            success = write_safetensors_file(output_path, tensors, &error);
-        } else {
-            success = write_gguf_file(output_path, tensors, &error);
+        LOG_INFO("converting tensors completed, taking %.2fs", (ggml_time_ms() - t_start) / 1000.f);
+        if (!baked_loras.loras.empty()) {
+            LOG_INFO("baked %zu LoRAs into %zu tensors", baked_loras.loras.size(), baked_loras.patched_count);
         }
     }
 
@@ -136,3 +384,332 @@ bool convert(const char* input_path,
     ggml_free(ggml_ctx);
     return success;
 }
+
+// --auto-quant: picks a weight type per tensor from how far each candidate
+// type moves the weights of that tensor. The relative squared error of the
+// dequantized weights stands in for the error of the layer output.
+struct AutoQuantTarget {
+    float bpw       = 0.f;  // average bits per weight over the quantized tensors
+    float max_error = 0.f;  // relative squared error allowed per tensor
+    std::vector<ggml_type> types;
+};
+
+struct TensorQuantCandidates {
+    std::string name;
+    int64_t n_elements = 0;
+    std::vector<ggml_type> types;  // by increasing size
+    std::vector<uint64_t> bytes;
+    std::vector<double> errors;
+};
+
+static bool parse_auto_quant_args(const char* auto_quant_args, AutoQuantTarget* target) {
+    for (const auto& [key, value] : parse_key_value_args(auto_quant_args, "auto quant arg")) {
+        if (key == "bpw" || key == "max_error") {
+            float parsed = 0.f;
+            if (!parse_strict_float(value, parsed) || parsed <= 0.f) {
+                LOG_ERROR("invalid auto quant arg '%s=%s'", key.c_str(), value.c_str());
+                return false;
+            }
+            if (key == "bpw") {
+                target->bpw = parsed;
+            } else {
+                target->max_error = parsed;
+            }
+        } else if (key == "types") {
+            for (const auto& type_name : split_string(value, '+')) {
+                ggml_type type = parse_ggml_type_name(type_name);
+                if (type == GGML_TYPE_COUNT || ggml_quantize_requires_imatrix(type)) {
+                    LOG_ERROR("unsupported auto quant type '%s'", type_name.c_str());
+                    return false;
+                }
+                target->types.push_back(type);
+            }
+        } else {
+            LOG_WARN("ignoring unknown auto quant arg '%s'", key.c_str());
+        }
+    }
+    if ((target->bpw > 0.f) == (target->max_error > 0.f)) {
+        LOG_ERROR("auto quant needs exactly one of bpw and max_error");
+        return false;
+    }
+    if (target->types.empty()) {
+        target->types = {GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_Q8_0, GGML_TYPE_F16};
+    }
+    return true;
+}
+
+// Quantizes up to 512 evenly spaced rows of the tensor with every candidate
+// type; the error of the sample stands for the whole tensor.
+static bool measure_quant_candidates(ModelLoader& model_loader,
+                                     const TensorStorage& tensor_storage,
+                                     const std::vector<ggml_type>& types,
+                                     int n_threads,
+                                     TensorQuantCandidates* candidates) {
+    std::vector<float> data;
+    if (!model_loader.load_float_tensor(tensor_storage.name, data, n_threads)) {
+        LOG_ERROR("failed to load tensor '%s'", tensor_storage.name.c_str());
+        return false;
+    }
+    const int64_t n_per_row   = tensor_storage.ne[0];
+    const int64_t n_rows      = tensor_storage.nelements() / n_per_row;
+    const int64_t row_stride  = std::max<int64_t>(1, n_rows / 512);
+    const int64_t sample_rows = (n_rows + row_stride - 1) / row_stride;
+    std::vector<float> sample(static_cast<size_t>(sample_rows * n_per_row));
+    for (int64_t r = 0; r < sample_rows; ++r) {
+        std::copy_n(data.begin() + r * row_stride * n_per_row, n_per_row, sample.begin() + r * n_per_row);
+    }
+    double norm = 0.0;
+    for (float v : sample) {
+        norm += static_cast<double>(v) * v;
+    }
+
+    candidates->name       = tensor_storage.name;
+    candidates->n_elements = tensor_storage.nelements();
+    candidates->types      = types;
+    candidates->bytes.assign(types.size(), 0);
+    candidates->errors.assign(types.size(), 0.0);
+    sd::parallel_for(static_cast<int64_t>(types.size()), 1, [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+            const ggml_type type = types[i];
+            std::vector<uint8_t> quantized(ggml_row_size(type, n_per_row) * sample_rows);
+            std::vector<float> restored(sample.size());
+            ggml_quantize_chunk(type, sample.data(), quantized.data(), 0, sample_rows, n_per_row, nullptr);
+            ggml_get_type_traits(type)->to_float(quantized.data(), restored.data(), static_cast<int64_t>(restored.size()));
+            double diff = 0.0;
+            for (size_t j = 0; j < sample.size(); ++j) {
+                const double d = static_cast<double>(sample[j]) - restored[j];
+                diff += d * d;
+            }
+            candidates->bytes[i]  = ggml_row_size(type, n_per_row) * n_rows;
+            candidates->errors[i] = norm > 0.0 ? diff / norm : 0.0;
+        }
+    });
+    return true;
+}
+
+// Index of the chosen type of every tensor. With a bpw target, all tensors
+// start at their smallest type and the upgrade that removes the most
+// element-weighted error per added byte is taken until the budget runs out.
+static std::vector<size_t> choose_quant_types(const std::vector<TensorQuantCandidates>& tensors,
+                                              const AutoQuantTarget& target) {
+    std::vector<size_t> chosen(tensors.size(), 0);
+    if (target.max_error > 0.f) {
+        for (size_t t = 0; t < tensors.size(); ++t) {
+            const auto& errors = tensors[t].errors;
+            size_t best        = 0;
+            for (size_t i = 0; i < errors.size(); ++i) {
+                if (errors[i] <= target.max_error) {
+                    best = i;
+                    break;
+                }
+                if (errors[i] < errors[best]) {
+                    best = i;
+                }
+            }
+            chosen[t] = best;
+        }
+        return chosen;
+    }
+
+    double total_elements = 0.0;
+    double used_bytes     = 0.0;
+    for (const auto& tensor : tensors) {
+        total_elements += static_cast<double>(tensor.n_elements);
+        used_bytes += static_cast<double>(tensor.bytes[0]);
+    }
+    const double budget_bytes = total_elements * target.bpw / 8.0;
+    if (used_bytes > budget_bytes) {
+        LOG_WARN("auto quant: the smallest candidate types already take %.2f bits per weight", used_bytes * 8.0 / total_elements);
+    }
+    while (true) {
+        size_t best_tensor = tensors.size();
+        size_t best_type   = 0;
+        double best_gain   = 0.0;
+        for (size_t t = 0; t < tensors.size(); ++t) {
+            const auto& tensor = tensors[t];
+            for (size_t i = chosen[t] + 1; i < tensor.types.size(); ++i) {
+                const double added   = static_cast<double>(tensor.bytes[i]) - static_cast<double>(tensor.bytes[chosen[t]]);
+                const double removed = (tensor.errors[chosen[t]] - tensor.errors[i]) * static_cast<double>(tensor.n_elements);
+                if (removed <= 0.0 || used_bytes + added > budget_bytes) {
+                    continue;
+                }
+                const double gain = removed / std::max(added, 1.0);
+                if (gain > best_gain) {
+                    best_gain   = gain;
+                    best_tensor = t;
+                    best_type   = i;
+                }
+            }
+        }
+        if (best_tensor == tensors.size()) {
+            break;
+        }
+        used_bytes += static_cast<double>(tensors[best_tensor].bytes[best_type]) -
+                      static_cast<double>(tensors[best_tensor].bytes[chosen[best_tensor]]);
+        chosen[best_tensor] = best_type;
+    }
+    return chosen;
+}
+
+static std::string escape_regex(const std::string& text) {
+    static const std::string special = "\\^$.|?*+()[]{}";
+    std::string result;
+    for (char c : text) {
+        if (special.find(c) != std::string::npos) {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+const char* sd_auto_tensor_type_rules(const char* input_path,
+                                      const char* vae_path,
+                                      const char* auto_quant_args,
+                                      bool convert_name) {
+    thread_local std::string rules;
+    rules.clear();
+
+    AutoQuantTarget target;
+    if (!parse_auto_quant_args(auto_quant_args, &target)) {
+        return rules.c_str();
+    }
+
+    ModelLoader model_loader;
+    if (!model_loader.init_from_file(input_path)) {
+        LOG_ERROR("init model loader from file failed: '%s'", input_path);
+        return rules.c_str();
+    }
+    if (vae_path != nullptr && strlen(vae_path) > 0) {
+        if (!model_loader.init_from_file(vae_path, "vae.")) {
+            LOG_ERROR("init model loader from file failed: '%s'", vae_path);
+            return rules.c_str();
+        }
+    }
+    if (convert_name) {
+        model_loader.convert_tensors_name();
+    }
+
+    const int n_threads = sd_get_num_physical_cores();
+    sd::TaskPool::instance().reserve_threads(n_threads);
+
+    // rank the candidates of every tensor by size, so an upgrade always adds bytes
+    std::vector<ggml_type> types = target.types;
+    std::sort(types.begin(), types.end(), [](ggml_type a, ggml_type b) {
+        return ggml_type_size(a) * ggml_blck_size(b) < ggml_type_size(b) * ggml_blck_size(a);
+    });
+
+    std::vector<TensorQuantCandidates> tensors;
+    auto& tensor_storage_map = model_loader.get_tensor_storage_map();
+    size_t index             = 0;
+    for (const auto& [name, tensor_storage] : tensor_storage_map) {
+        ++index;
+        if (tensor_storage.n_dims < 2) {
+            continue;
+        }
+        std::vector<ggml_type> tensor_types;
+        for (ggml_type type : types) {
+            if (model_loader.tensor_should_be_converted(tensor_storage, type)) {
+                tensor_types.push_back(type);
+            }
+        }
+        if (tensor_types.empty()) {
+            continue;
+        }
+        TensorQuantCandidates candidates;
+        if (!measure_quant_candidates(model_loader, tensor_storage, tensor_types, n_threads, &candidates)) {
+            return rules.c_str();
+        }
+        tensors.push_back(std::move(candidates));
+        LOG_DEBUG("auto quant: measured %zu/%zu '%s'", index, tensor_storage_map.size(), name.c_str());
+    }
+    if (tensors.empty()) {
+        LOG_ERROR("auto quant: no tensor can take the candidate types");
+        return rules.c_str();
+    }
+
+    std::vector<size_t> chosen = choose_quant_types(tensors, target);
+    double total_elements      = 0.0;
+    double total_bytes         = 0.0;
+    double weighted_error      = 0.0;
+    std::map<ggml_type, int> type_counts;
+    for (size_t t = 0; t < tensors.size(); ++t) {
+        const auto& tensor   = tensors[t];
+        const ggml_type type = tensor.types[chosen[t]];
+        total_elements += static_cast<double>(tensor.n_elements);
+        total_bytes += static_cast<double>(tensor.bytes[chosen[t]]);
+        weighted_error += tensor.errors[chosen[t]] * static_cast<double>(tensor.n_elements);
+        type_counts[type]++;
+        if (!rules.empty()) {
+            rules += ',';
+        }
+        rules += "^" + escape_regex(tensor.name) + "$=" + ggml_type_name(type);
+    }
+    LOG_INFO("auto quant: %zu tensors at %.2f bits per weight, mean relative error %.3g",
+             tensors.size(),
+             total_bytes * 8.0 / total_elements,
+             weighted_error / total_elements);
+    for (const auto& [type, count] : type_counts) {
+        LOG_INFO("auto quant:   %-6s %d tensors", ggml_type_name(type), count);
+    }
+    return rules.c_str();
+}
+
+bool write_model_cache(ModelLoader& model_loader,
+                       const std::string& file_path,
+                       const std::vector<std::pair<std::string, std::string>>& metadata,
+                       const std::vector<std::string>& skip_prefixes) {
+    // tensors keep the type they will be loaded as, whether it came from
+    // wtype/tensor_type_rules or from a runner
+    auto get_tensor_type = [](const TensorStorage& tensor_storage) {
+        return tensor_storage.expected_type != GGML_TYPE_COUNT ? tensor_storage.expected_type : tensor_storage.type;
+    };
+
+    const size_t alignment = 64;
+    size_t mem_size        = 1 * 1024 * 1024;  // for padding
+    for (const auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+        if (is_skipped_tensor(name, skip_prefixes)) {
+            continue;
+        }
+        TensorStorage cached = tensor_storage;
+        cached.type          = get_tensor_type(tensor_storage);
+        mem_size += ggml_tensor_overhead() + cached.nbytes() + alignment;
+    }
+    LOG_INFO("writing model cache '%s' (%.2fMB)", file_path.c_str(), mem_size / 1024.f / 1024.f);
+
+    ggml_context* ggml_ctx = ggml_init({mem_size, nullptr, false});
+    if (ggml_ctx == nullptr) {
+        LOG_ERROR("ggml_init failed for model cache");
+        return false;
+    }
+
+    std::vector<TensorWriteInfo> tensors;
+    bool success = load_tensors_for_export(model_loader, ggml_ctx, get_tensor_type, tensors, skip_prefixes);
+
+    // write next to the final path and rename, so a crash never leaves a
+    // truncated cache behind for the next start to map
+    std::string tmp_path = file_path + ".tmp";
+    std::string error;
+    if (success) {
+        GGUFWriteOptions options;
+        options.alignment = (uint32_t)alignment;
+        options.metadata  = metadata;
+        success           = write_gguf_file(tmp_path, tensors, &error, &options);
+    }
+    ggml_free(ggml_ctx);
+
+    if (success) {
+        std::remove(file_path.c_str());
+        if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+            error   = "failed to rename '" + tmp_path + "' to '" + file_path + "'";
+            success = false;
+        }
+    }
+    if (!success) {
+        std::remove(tmp_path.c_str());
+        if (!error.empty()) {
+            LOG_ERROR("%s", error.c_str());
+        }
+    }
+    return success;
+}
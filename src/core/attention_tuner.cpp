@@ -0,0 +1,219 @@
+#include "core/attention_tuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include "core/ggml_extend.hpp"
+#include "core/util.h"
+
+namespace sd::attention_tuner {
+
+    namespace {
+
+        using Key = std::tuple<std::string, int64_t, int64_t, int64_t, bool>;  // device, L_q, L_k, d_head, mask
+
+        // Shapes whose softmax path would need a larger kq matrix always use
+        // flash attention; they are not timed.
+        constexpr size_t MAX_SOFTMAX_KQ_BYTES = 512ull * 1024 * 1024;
+        constexpr int64_t MAX_TIMED_BATCH     = 16;
+        constexpr int TIMED_RUNS              = 3;
+
+        std::mutex tuner_mutex;
+        std::string cache_path;
+        std::map<Key, bool> winners;
+        thread_local bool timing = false;
+
+        // Sequence lengths are timed at the next power of two.
+        int64_t bucket_length(int64_t length) {
+            int64_t bucket = 64;
+            while (bucket < length) {
+                bucket *= 2;
+            }
+            return bucket;
+        }
+
+        std::string device_name(ggml_backend_t backend) {
+            std::string name       = ggml_backend_name(backend);
+            ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+            if (dev != nullptr) {
+                name += "/";
+                name += ggml_backend_dev_description(dev);
+            }
+            std::replace(name.begin(), name.end(), '\t', ' ');
+            std::replace(name.begin(), name.end(), '\n', ' ');
+            return name;
+        }
+
+        void load_cache_file() {
+            std::ifstream file(cache_path);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::vector<std::string> fields;
+                std::stringstream stream(line);
+                std::string field;
+                while (std::getline(stream, field, '\t')) {
+                    fields.push_back(field);
+                }
+                if (fields.size() != 6 || (fields[5] != "flash" && fields[5] != "softmax")) {
+                    continue;
+                }
+                int L_q = 0, L_k = 0, d_head = 0, mask = 0;
+                if (!parse_strict_int(fields[1], L_q) || !parse_strict_int(fields[2], L_k) ||
+                    !parse_strict_int(fields[3], d_head) || !parse_strict_int(fields[4], mask)) {
+                    continue;
+                }
+                winners[Key(fields[0], L_q, L_k, d_head, mask != 0)] = fields[5] == "flash";
+            }
+        }
+
+        void append_cache_file(const Key& key, bool flash) {
+            std::ofstream file(cache_path, std::ios::app);
+            if (!file) {
+                LOG_WARN("failed to write attention tuning cache '%s'", cache_path.c_str());
+                return;
+            }
+            file << std::get<0>(key) << "\t" << std::get<1>(key) << "\t" << std::get<2>(key) << "\t"
+                 << std::get<3>(key) << "\t" << (std::get<4>(key) ? 1 : 0) << "\t"
+                 << (flash ? "flash" : "softmax") << "\n";
+        }
+
+        // Best of TIMED_RUNS computes in ms after a warm-up, infinity on failure.
+        double time_attention(ggml_backend_t backend, const Key& key, int64_t n_batch, bool flash) {
+            int64_t L_q    = std::get<1>(key);
+            int64_t L_k    = std::get<2>(key);
+            int64_t d_head = std::get<3>(key);
+            bool has_mask  = std::get<4>(key);
+
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead() * 256 + ggml_graph_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            if (ctx == nullptr) {
+                return std::numeric_limits<double>::infinity();
+            }
+
+            ggml_tensor* q    = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head * n_batch, L_q, 1);
+            ggml_tensor* k    = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head * n_batch, L_k, 1);
+            ggml_tensor* v    = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head * n_batch, L_k, 1);
+            ggml_tensor* mask = has_mask ? ggml_new_tensor_2d(ctx, GGML_TYPE_F32, L_k, L_q) : nullptr;
+            for (ggml_tensor* input : {q, k, v, mask}) {
+                if (input != nullptr) {
+                    ggml_set_input(input);
+                }
+            }
+            ggml_tensor* out = ggml_ext_attention_ext(ctx, backend, q, k, v, n_batch, mask, false, flash);
+            ggml_cgraph* gf  = ggml_new_graph(ctx);
+            ggml_build_forward_expand(gf, out);
+
+            double best_ms        = std::numeric_limits<double>::infinity();
+            ggml_gallocr_t allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+            if (allocr != nullptr && ggml_gallocr_alloc_graph(allocr, gf)) {
+                uint32_t state = 0x9e3779b9u;
+                for (ggml_tensor* input : {q, k, v, mask}) {
+                    if (input == nullptr) {
+                        continue;
+                    }
+                    std::vector<float> data(ggml_nelements(input), 0.0f);
+                    if (input != mask) {
+                        for (float& value : data) {
+                            state = state * 1664525u + 1013904223u;
+                            value = static_cast<float>(state >> 8) / static_cast<float>(1u << 24) - 0.5f;
+                        }
+                    }
+                    ggml_backend_tensor_set(input, data.data(), 0, ggml_nbytes(input));
+                }
+                for (int run = 0; run <= TIMED_RUNS; ++run) {
+                    auto start = std::chrono::steady_clock::now();
+                    if (ggml_backend_graph_compute(backend, gf) != GGML_STATUS_SUCCESS) {
+                        best_ms = std::numeric_limits<double>::infinity();
+                        break;
+                    }
+                    ggml_backend_synchronize(backend);
+                    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    if (run > 0) {
+                        best_ms = std::min(best_ms, ms);
+                    }
+                }
+            }
+            if (allocr != nullptr) {
+                ggml_gallocr_free(allocr);
+            }
+            ggml_free(ctx);
+            return best_ms;
+        }
+
+    }  // namespace
+
+    void set_cache_path(const std::string& path) {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        if (path == cache_path) {
+            return;
+        }
+        cache_path = path;
+        winners.clear();
+        if (!cache_path.empty()) {
+            load_cache_file();
+            LOG_INFO("attention tuning enabled, %zu cached shapes in '%s'", winners.size(), cache_path.c_str());
+        }
+    }
+
+    bool enabled() {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        return !cache_path.empty();
+    }
+
+    bool prefer_flash(ggml_backend_t backend,
+                      int64_t L_q,
+                      int64_t L_k,
+                      int64_t d_head,
+                      int64_t n_batch,
+                      bool has_mask) {
+        if (backend == nullptr || timing) {
+            return true;
+        }
+        int64_t bucket_q = bucket_length(L_q);
+        int64_t bucket_k = bucket_length(L_k);
+        n_batch          = std::min(n_batch, MAX_TIMED_BATCH);
+        if (static_cast<size_t>(bucket_q) * static_cast<size_t>(bucket_k) * static_cast<size_t>(n_batch) * sizeof(float) > MAX_SOFTMAX_KQ_BYTES) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        if (cache_path.empty()) {
+            return true;
+        }
+        Key key(device_name(backend), bucket_q, bucket_k, d_head, has_mask);
+        auto it = winners.find(key);
+        if (it != winners.end()) {
+            return it->second;
+        }
+
+        timing            = true;
+        double flash_ms   = time_attention(backend, key, n_batch, true);
+        double softmax_ms = time_attention(backend, key, n_batch, false);
+        timing            = false;
+
+        bool flash = !(softmax_ms < flash_ms);
+        LOG_INFO("attention tuning %s L_q=%" PRId64 " L_k=%" PRId64 " d_head=%" PRId64 "%s: flash %.3f ms, softmax %.3f ms, using %s",
+                 std::get<0>(key).c_str(),
+                 bucket_q,
+                 bucket_k,
+                 d_head,
+                 has_mask ? " masked" : "",
+                 flash_ms,
+                 softmax_ms,
+                 flash ? "flash" : "softmax");
+        winners[key] = flash;
+        append_cache_file(key, flash);
+        return flash;
+    }
+
+}  // namespace sd::attention_tuner
@@ -0,0 +1,30 @@
+#ifndef __SD_CORE_ATTENTION_TUNER_H__
+#define __SD_CORE_ATTENTION_TUNER_H__
+
+#include <cstdint>
+#include <string>
+
+#include "ggml-backend.h"
+
+// Picks between flash attention and the explicit softmax path per shape and
+// device. The first attention of a (L_q, L_k, d_head, mask) bucket on a device
+// times both paths on that device; winners are kept in memory and appended
+// to the cache file, so later processes only look them up.
+namespace sd::attention_tuner {
+
+    // Enables tuning with winners stored in path, an empty path disables it.
+    void set_cache_path(const std::string& path);
+    bool enabled();
+
+    // Whether an attention that would use flash attention should keep it.
+    // n_batch is heads times batch size.
+    bool prefer_flash(ggml_backend_t backend,
+                      int64_t L_q,
+                      int64_t L_k,
+                      int64_t d_head,
+                      int64_t n_batch,
+                      bool has_mask);
+
+}  // namespace sd::attention_tuner
+
+#endif  // __SD_CORE_ATTENTION_TUNER_H__
@@ -0,0 +1,218 @@
+#include "core/backend_placement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "core/util.h"
+
+namespace sd::placement {
+
+    namespace {
+
+        constexpr double GIB                 = 1024.0 * 1024.0 * 1024.0;
+        constexpr uint64_t RESERVE_BYTES     = 512ull * 1024 * 1024;  // kept free on every GPU
+        constexpr uint64_t MIN_SEGMENT_BYTES = 512ull * 1024 * 1024;  // smallest useful --max-vram budget left for streamed params
+
+        double module_ms(const ModuleDemand& demand, const Device& device, bool params_resident) {
+            double ms = demand.flops / (std::max(device.matmul_gflops(demand.weight_type), 1e-3) * 1e6);
+            if (!params_resident) {
+                ms += demand.params_bytes / (std::max(device.upload_gbps, 1e-3) * 1e6);
+            }
+            return ms * demand.runs;
+        }
+
+        struct Search {
+            const std::vector<ModuleDemand>& demands;
+            const std::vector<Device>& devices;
+            size_t cpu_device;
+            std::vector<ModulePlacement> current;
+            Plan best;
+            bool found = false;
+
+            // Resident params and the largest compute buffer must fit each
+            // device; a streamed module also needs room for one segment.
+            // Host RAM holds the params of CPU modules and of streamed ones.
+            bool fits(std::vector<uint64_t>* budgets) const {
+                budgets->assign(devices.size(), 0);
+                uint64_t host_params = 0;
+                for (size_t d = 0; d < devices.size(); d++) {
+                    uint64_t resident = 0;
+                    uint64_t compute  = 0;
+                    for (size_t i = 0; i < current.size(); i++) {
+                        if (current[i].device != d) {
+                            continue;
+                        }
+                        compute = std::max(compute, demands[i].compute_bytes);
+                        if (current[i].params_resident) {
+                            resident += demands[i].params_bytes;
+                        } else {
+                            host_params += demands[i].params_bytes;
+                        }
+                    }
+                    if (devices[d].is_cpu) {
+                        host_params += resident;
+                        continue;
+                    }
+                    const uint64_t free_bytes = devices[d].free_bytes;
+                    if (resident + compute + RESERVE_BYTES > free_bytes) {
+                        return false;
+                    }
+                    const uint64_t room = free_bytes - resident - RESERVE_BYTES;
+                    for (size_t i = 0; i < current.size(); i++) {
+                        if (current[i].device != d || current[i].params_resident) {
+                            continue;
+                        }
+                        if (demands[i].compute_bytes + std::min(demands[i].params_bytes, MIN_SEGMENT_BYTES) > room) {
+                            return false;
+                        }
+                        if (demands[i].compute_bytes + demands[i].params_bytes > room) {
+                            (*budgets)[d] = room;
+                        }
+                    }
+                }
+                const Device& cpu = devices[cpu_device];
+                return cpu.free_bytes == 0 || host_params + RESERVE_BYTES <= cpu.free_bytes;
+            }
+
+            void evaluate() {
+                std::vector<uint64_t> budgets;
+                if (!fits(&budgets)) {
+                    return;
+                }
+                double total = 0;
+                for (const ModulePlacement& placement : current) {
+                    total += placement.predicted_ms;
+                }
+                if (found && total >= best.predicted_ms) {
+                    return;
+                }
+                found               = true;
+                best.modules        = current;
+                best.max_vram_bytes = budgets;
+                best.predicted_ms   = total;
+            }
+
+            void visit(size_t i) {
+                if (i == demands.size()) {
+                    evaluate();
+                    return;
+                }
+                for (size_t d = 0; d < devices.size(); d++) {
+                    for (bool resident : {true, false}) {
+                        if (!resident && devices[d].is_cpu) {
+                            continue;
+                        }
+                        current.push_back({demands[i].module, d, resident, module_ms(demands[i], devices[d], resident)});
+                        visit(i + 1);
+                        current.pop_back();
+                    }
+                }
+            }
+        };
+
+        std::string append_assignment(const std::string& spec, const std::string& key, const std::string& value) {
+            return spec.empty() ? key + "=" + value : spec + "," + key + "=" + value;
+        }
+
+    }  // namespace
+
+    // Work is taken as two flops per param per token, with params counted
+    // at the size of the weight type, and a nominal token count per module. The VAE does far more
+    // work per param than the transformer modules, which its token count
+    // stands in for.
+    ModuleDemand make_demand(SDBackendModule module, uint64_t params_bytes, ggml_type weight_type) {
+        ModuleDemand demand;
+        demand.module       = module;
+        demand.params_bytes = params_bytes;
+        demand.weight_type  = weight_type;
+        double tokens       = 4096;
+        switch (module) {
+            case SDBackendModule::DIFFUSION:
+            case SDBackendModule::CONTROL_NET:
+                demand.runs          = 40;
+                demand.compute_bytes = module == SDBackendModule::DIFFUSION ? 2048ull * 1024 * 1024 : 1024ull * 1024 * 1024;
+                break;
+            case SDBackendModule::TE:
+                tokens               = 256;
+                demand.runs          = 2;
+                demand.compute_bytes = 512ull * 1024 * 1024;
+                break;
+            case SDBackendModule::VAE:
+                tokens               = 65536;
+                demand.compute_bytes = 3072ull * 1024 * 1024;
+                break;
+            default:
+                demand.compute_bytes = 512ull * 1024 * 1024;
+                break;
+        }
+        double param_bytes = static_cast<double>(ggml_type_size(weight_type)) / ggml_blck_size(weight_type);
+        demand.flops       = 2.0 * (params_bytes / param_bytes) * tokens;
+        return demand;
+    }
+
+    bool plan(const std::vector<ModuleDemand>& demands, const std::vector<Device>& devices, Plan* out) {
+        size_t cpu_device = devices.size();
+        for (size_t d = 0; d < devices.size(); d++) {
+            if (devices[d].is_cpu) {
+                cpu_device = d;
+                break;
+            }
+        }
+        if (cpu_device == devices.size()) {
+            LOG_ERROR("auto placement needs the CPU device");
+            return false;
+        }
+
+        Search search{demands, devices, cpu_device};
+        search.visit(0);
+        if (!search.found) {
+            return false;
+        }
+
+        Plan result = search.best;
+        for (const ModulePlacement& placement : result.modules) {
+            const char* module = sd_backend_module_name(placement.module);
+            result.backend_spec = append_assignment(result.backend_spec, module, devices[placement.device].name);
+            if (!placement.params_resident) {
+                result.params_backend_spec = append_assignment(result.params_backend_spec, module, devices[cpu_device].name);
+            }
+        }
+        for (size_t d = 0; d < devices.size(); d++) {
+            if (result.max_vram_bytes[d] > 0) {
+                char gib[32];
+                snprintf(gib, sizeof(gib), "%.2f", result.max_vram_bytes[d] / GIB);
+                result.max_vram_spec = append_assignment(result.max_vram_spec, devices[d].name, gib);
+            }
+        }
+        *out = std::move(result);
+        return true;
+    }
+
+    std::string plan_to_string(const Plan& plan, const std::vector<Device>& devices) {
+        std::string out;
+        char line[256];
+        for (const ModulePlacement& placement : plan.modules) {
+            const Device& device = devices[placement.device];
+            snprintf(line,
+                     sizeof(line),
+                     "  %-10s on %-10s params %-9s %8.0f ms\n",
+                     sd_backend_module_name(placement.module),
+                     device.name.c_str(),
+                     placement.params_resident ? "resident" : "streamed",
+                     placement.predicted_ms);
+            out += line;
+        }
+        snprintf(line,
+                 sizeof(line),
+                 "  --backend %s --params-backend %s --max-vram %s\n  predicted %.0f ms per generation",
+                 plan.backend_spec.c_str(),
+                 plan.params_backend_spec.empty() ? "(same)" : plan.params_backend_spec.c_str(),
+                 plan.max_vram_spec.empty() ? "0" : plan.max_vram_spec.c_str(),
+                 plan.predicted_ms);
+        out += line;
+        return out;
+    }
+
+}  // namespace sd::placement
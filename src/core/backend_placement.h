@@ -0,0 +1,56 @@
+#ifndef __SD_CORE_BACKEND_PLACEMENT_H__
+#define __SD_CORE_BACKEND_PLACEMENT_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/device_probe.h"
+#include "core/ggml_extend_backend.h"
+
+// Picks the runtime backend, the params residency and a --max-vram budget per
+// module from the model sizes, the device memory and the matmul and upload
+// rates of sd::device_probe. Latency is predicted with a nominal
+// workload (a 20 step CFG generation at about 1024x1024), so the plan ranks
+// placements rather than predicting a run.
+namespace sd::placement {
+
+    struct ModuleDemand {
+        SDBackendModule module;
+        uint64_t params_bytes  = 0;
+        uint64_t compute_bytes = 0;  // estimated compute buffer of one forward pass
+        double flops           = 0;  // of one forward pass
+        int runs               = 1;  // forward passes per generation
+        ggml_type weight_type  = GGML_TYPE_F16;  // of most matmul weights, picks the measured throughput
+    };
+
+    using Device = sd::device_probe::Device;
+
+    struct ModulePlacement {
+        SDBackendModule module;
+        size_t device        = 0;  // index into the device list
+        bool params_resident = true;
+        double predicted_ms  = 0;
+    };
+
+    struct Plan {
+        std::vector<ModulePlacement> modules;
+        std::vector<uint64_t> max_vram_bytes;  // per device, 0 = no budget
+        double predicted_ms = 0;
+        std::string backend_spec;
+        std::string params_backend_spec;
+        std::string max_vram_spec;
+    };
+
+    // Nominal demand of a module from its params size and weight type.
+    ModuleDemand make_demand(SDBackendModule module, uint64_t params_bytes, ggml_type weight_type = GGML_TYPE_F16);
+
+    // The placement with the lowest predicted latency that fits every
+    // device; false when nothing fits, not even the CPU.
+    bool plan(const std::vector<ModuleDemand>& demands, const std::vector<Device>& devices, Plan* out);
+
+    std::string plan_to_string(const Plan& plan, const std::vector<Device>& devices);
+
+}  // namespace sd::placement
+
+#endif  // __SD_CORE_BACKEND_PLACEMENT_H__
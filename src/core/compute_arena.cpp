@@ -0,0 +1,56 @@
+#include "core/compute_arena.h"
+
+#include "core/memory_timeline.h"
+
+namespace sd {
+
+    ComputeArena::ComputeArena(ggml_backend_buffer_type_t buft)
+        : buft_(buft) {}
+
+    ComputeArena::~ComputeArena() {
+        if (allocr_ != nullptr) {
+            sd_perf::untrace_buffer(allocr_);
+            ggml_gallocr_free(allocr_);
+        }
+    }
+
+    ggml_gallocr_t ComputeArena::lease(const void* owner) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owner_ != nullptr && owner_ != owner) {
+            return nullptr;
+        }
+        if (allocr_ == nullptr) {
+            allocr_ = ggml_gallocr_new(buft_);
+            if (allocr_ == nullptr) {
+                return nullptr;
+            }
+        }
+        owner_ = owner;
+        return allocr_;
+    }
+
+    void ComputeArena::release(const void* owner) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owner_ == owner) {
+            owner_ = nullptr;
+        }
+    }
+
+    size_t ComputeArena::trim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owner_ != nullptr || allocr_ == nullptr) {
+            return 0;
+        }
+        size_t size = ggml_gallocr_get_buffer_size(allocr_, 0);
+        sd_perf::untrace_buffer(allocr_);
+        ggml_gallocr_free(allocr_);
+        allocr_ = nullptr;
+        return size;
+    }
+
+    size_t ComputeArena::buffer_size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return allocr_ != nullptr ? ggml_gallocr_get_buffer_size(allocr_, 0) : 0;
+    }
+
+}  // namespace sd
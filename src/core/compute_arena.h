@@ -0,0 +1,44 @@
+#ifndef __SD_CORE_COMPUTE_ARENA_H__
+#define __SD_CORE_COMPUTE_ARENA_H__
+
+#include <cstddef>
+#include <mutex>
+
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+
+namespace sd {
+
+    // One compute buffer for the runners of a context that compute on the
+    // same buffer type. A runner leases it from its first compute until it
+    // frees its compute buffer, and allocates a private one while another
+    // runner holds the lease. The gallocr only grows, so phases that run in
+    // turn (text encoder, diffusion model, VAE) end up sharing a buffer the
+    // size of the largest of them instead of freeing and reserving their own.
+    class ComputeArena {
+    public:
+        explicit ComputeArena(ggml_backend_buffer_type_t buft);
+        ~ComputeArena();
+
+        // The shared gallocr for owner, or nullptr while another owner holds
+        // the lease.
+        ggml_gallocr_t lease(const void* owner);
+        void release(const void* owner);
+
+        size_t buffer_size();
+        // Frees the buffer unless it is leased; returns the bytes freed.
+        size_t trim();
+
+        ComputeArena(const ComputeArena&)            = delete;
+        ComputeArena& operator=(const ComputeArena&) = delete;
+
+    private:
+        ggml_backend_buffer_type_t buft_ = nullptr;
+        ggml_gallocr_t allocr_           = nullptr;
+        const void* owner_               = nullptr;
+        std::mutex mutex_;
+    };
+
+}  // namespace sd
+
+#endif  // __SD_CORE_COMPUTE_ARENA_H__
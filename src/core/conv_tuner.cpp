@@ -0,0 +1,204 @@
+#include "core/conv_tuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "core/ggml_extend.hpp"
+#include "core/util.h"
+
+namespace sd::conv_tuner {
+
+    namespace {
+
+        using Key = std::pair<std::string, std::string>;  // device, shape
+
+        // Inputs and outputs are timed on at most this many bytes, fewer
+        // rows of a large layer; the choice follows the time per row.
+        constexpr size_t MAX_TIMED_BYTES = 256ull * 1024 * 1024;
+        constexpr int TIMED_RUNS         = 3;
+
+        std::mutex tuner_mutex;
+        std::string cache_path;
+        std::map<Key, bool> winners;
+
+        // Input sizes are timed at the next power of two.
+        int64_t bucket_size(int64_t size) {
+            int64_t bucket = 8;
+            while (bucket < size) {
+                bucket *= 2;
+            }
+            return bucket;
+        }
+
+        std::string device_name(ggml_backend_t backend) {
+            std::string name       = ggml_backend_name(backend);
+            ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+            if (dev != nullptr) {
+                name += "/";
+                name += ggml_backend_dev_description(dev);
+            }
+            std::replace(name.begin(), name.end(), '\t', ' ');
+            std::replace(name.begin(), name.end(), '\n', ' ');
+            return name;
+        }
+
+        std::string shape_name(const Conv2dShape& shape) {
+            std::stringstream name;
+            name << shape.in_channels << "->" << shape.out_channels
+                 << " k" << shape.kernel_w << "x" << shape.kernel_h
+                 << " s" << shape.s0 << "x" << shape.s1
+                 << " p" << shape.p0 << "x" << shape.p1
+                 << " d" << shape.d0 << "x" << shape.d1
+                 << " " << shape.width << "x" << shape.height
+                 << " " << ggml_type_name(shape.weight_type);
+            return name.str();
+        }
+
+        void load_cache_file() {
+            std::ifstream file(cache_path);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::vector<std::string> fields;
+                std::stringstream stream(line);
+                std::string field;
+                while (std::getline(stream, field, '\t')) {
+                    fields.push_back(field);
+                }
+                if (fields.size() != 3 || (fields[2] != "direct" && fields[2] != "im2col")) {
+                    continue;
+                }
+                winners[Key(fields[0], fields[1])] = fields[2] == "direct";
+            }
+        }
+
+        void append_cache_file(const Key& key, bool direct) {
+            std::ofstream file(cache_path, std::ios::app);
+            if (!file) {
+                LOG_WARN("failed to write conv2d tuning cache '%s'", cache_path.c_str());
+                return;
+            }
+            file << key.first << "\t" << key.second << "\t" << (direct ? "direct" : "im2col") << "\n";
+        }
+
+        // Best of TIMED_RUNS computes in ms after a warm-up, infinity when the
+        // backend cannot run or allocate the path.
+        double time_conv(ggml_backend_t backend, const Conv2dShape& shape, bool direct) {
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead() * 256 + ggml_graph_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            if (ctx == nullptr) {
+                return std::numeric_limits<double>::infinity();
+            }
+
+            ggml_tensor* x = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, shape.width, shape.height, shape.in_channels, 1);
+            ggml_tensor* w = ggml_new_tensor_4d(ctx, shape.weight_type, shape.kernel_w, shape.kernel_h, shape.in_channels, shape.out_channels);
+            ggml_set_input(x);
+            ggml_set_input(w);
+            ggml_tensor* out = ggml_ext_conv_2d(ctx, x, w, nullptr, shape.s0, shape.s1, shape.p0, shape.p1, shape.d0, shape.d1, direct);
+            ggml_cgraph* gf  = ggml_new_graph(ctx);
+            ggml_build_forward_expand(gf, out);
+
+            double best_ms = std::numeric_limits<double>::infinity();
+            for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+                if (!ggml_backend_supports_op(backend, ggml_graph_node(gf, i))) {
+                    ggml_free(ctx);
+                    return best_ms;
+                }
+            }
+            ggml_gallocr_t allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+            if (allocr != nullptr && ggml_gallocr_alloc_graph(allocr, gf)) {
+                // the time of a conv does not depend on the values
+                ggml_backend_tensor_memset(x, 0, 0, ggml_nbytes(x));
+                ggml_backend_tensor_memset(w, 0, 0, ggml_nbytes(w));
+                for (int run = 0; run <= TIMED_RUNS; ++run) {
+                    auto start = std::chrono::steady_clock::now();
+                    if (ggml_backend_graph_compute(backend, gf) != GGML_STATUS_SUCCESS) {
+                        best_ms = std::numeric_limits<double>::infinity();
+                        break;
+                    }
+                    ggml_backend_synchronize(backend);
+                    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    if (run > 0) {
+                        best_ms = std::min(best_ms, ms);
+                    }
+                }
+            }
+            if (allocr != nullptr) {
+                ggml_gallocr_free(allocr);
+            }
+            ggml_free(ctx);
+            return best_ms;
+        }
+
+    }  // namespace
+
+    void set_cache_path(const std::string& path) {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        if (path == cache_path) {
+            return;
+        }
+        cache_path = path;
+        winners.clear();
+        if (!cache_path.empty()) {
+            load_cache_file();
+            LOG_INFO("conv2d tuning enabled, %zu cached shapes in '%s'", winners.size(), cache_path.c_str());
+        }
+    }
+
+    bool enabled() {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        return !cache_path.empty();
+    }
+
+    bool prefer_direct(ggml_backend_t backend, const Conv2dShape& shape, bool fallback) {
+        if (backend == nullptr) {
+            return fallback;
+        }
+        Conv2dShape bucket = shape;
+        bucket.width       = bucket_size(shape.width);
+        bucket.height      = bucket_size(shape.height);
+
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        if (cache_path.empty()) {
+            return fallback;
+        }
+        Key key(device_name(backend), shape_name(bucket));
+        auto it = winners.find(key);
+        if (it != winners.end()) {
+            return it->second;
+        }
+
+        Conv2dShape timed = bucket;
+        size_t row_bytes  = static_cast<size_t>(timed.width) * std::max(timed.in_channels, timed.out_channels) * sizeof(float);
+        int64_t max_rows  = static_cast<int64_t>(MAX_TIMED_BYTES / std::max<size_t>(1, row_bytes));
+        int64_t min_rows  = static_cast<int64_t>(timed.d1) * (timed.kernel_h - 1) + 1;
+        timed.height      = std::max(min_rows, std::min(timed.height, max_rows));
+        double direct_ms  = time_conv(backend, timed, true);
+        double im2col_ms  = time_conv(backend, timed, false);
+        if (direct_ms == std::numeric_limits<double>::infinity() && im2col_ms == std::numeric_limits<double>::infinity()) {
+            // not kept, the shape may fit once memory frees up
+            return fallback;
+        }
+
+        bool direct = direct_ms < im2col_ms;
+        LOG_INFO("conv2d tuning %s %s: direct %.3f ms, im2col %.3f ms, using %s",
+                 key.first.c_str(),
+                 key.second.c_str(),
+                 direct_ms,
+                 im2col_ms,
+                 direct ? "direct" : "im2col");
+        winners[key] = direct;
+        append_cache_file(key, direct);
+        return direct;
+    }
+
+}  // namespace sd::conv_tuner
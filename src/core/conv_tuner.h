@@ -0,0 +1,42 @@
+#ifndef __SD_CORE_CONV_TUNER_H__
+#define __SD_CORE_CONV_TUNER_H__
+
+#include <cstdint>
+#include <string>
+
+#include "ggml-backend.h"
+
+// Picks between ggml_conv_2d_direct and the im2col path per layer shape and
+// device. The first conv2d of a shape on a device times both paths on that
+// device at the input size rounded up to a power of two; winners are kept in
+// memory and appended to the cache file, so later processes only look them
+// up.
+namespace sd::conv_tuner {
+
+    struct Conv2dShape {
+        int64_t width;  // of the input
+        int64_t height;
+        int64_t in_channels;
+        int64_t out_channels;
+        int kernel_w;
+        int kernel_h;
+        int s0;
+        int s1;
+        int p0;
+        int p1;
+        int d0;
+        int d1;
+        ggml_type weight_type;
+    };
+
+    // Enables tuning with winners stored in path, an empty path disables it.
+    void set_cache_path(const std::string& path);
+    bool enabled();
+
+    // Whether the conv2d should run direct; `fallback` when tuning is off or
+    // neither path can be timed.
+    bool prefer_direct(ggml_backend_t backend, const Conv2dShape& shape, bool fallback);
+
+}  // namespace sd::conv_tuner
+
+#endif  // __SD_CORE_CONV_TUNER_H__
@@ -0,0 +1,325 @@
+#include "core/device_probe.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "core/ggml_extend_backend.h"
+#include "core/util.h"
+#include "json.hpp"
+
+namespace sd::device_probe {
+
+    namespace {
+
+        constexpr double GIB                = 1024.0 * 1024.0 * 1024.0;
+        constexpr int64_t BENCH_K           = 2048;
+        constexpr int64_t BENCH_N           = 2048;
+        constexpr int64_t BENCH_M           = 512;
+        constexpr size_t BENCH_COPY_BYTES   = 32ull * 1024 * 1024;
+        constexpr int64_t FLASH_ATTN_D_HEAD = 64;
+        constexpr int64_t FLASH_ATTN_L      = 1024;
+        constexpr int64_t FLASH_ATTN_HEADS  = 8;
+        constexpr int TIMED_RUNS            = 2;
+
+        std::mutex probe_mutex;
+        std::string cache_path;
+        bool cache_loaded = false;
+        std::map<std::string, Device> probes;  // by device_key
+
+        template <typename F>
+        double best_ms(ggml_backend_t backend, F&& run) {
+            double best = std::numeric_limits<double>::infinity();
+            for (int i = 0; i <= TIMED_RUNS; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                if (!run()) {
+                    return std::numeric_limits<double>::infinity();
+                }
+                ggml_backend_synchronize(backend);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (i > 0) {
+                    best = std::min(best, ms);
+                }
+            }
+            return best;
+        }
+
+        // weights of the type times f32 activations, the shape of a
+        // diffusion matmul; 0 when the device cannot run it
+        double bench_gflops(ggml_backend_t backend, ggml_type type) {
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead() * 8 + ggml_graph_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            if (ctx == nullptr) {
+                return 0;
+            }
+            ggml_tensor* w = ggml_new_tensor_2d(ctx, type, BENCH_K, BENCH_N);
+            ggml_tensor* x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, BENCH_K, BENCH_M);
+            ggml_tensor* y = ggml_mul_mat(ctx, w, x);
+            if (!ggml_backend_supports_op(backend, y)) {
+                ggml_free(ctx);
+                return 0;
+            }
+            ggml_cgraph* gf = ggml_new_graph(ctx);
+            ggml_build_forward_expand(gf, y);
+
+            double ms                     = std::numeric_limits<double>::infinity();
+            ggml_backend_buffer_t weights = ggml_backend_alloc_ctx_tensors(ctx, backend);
+            if (weights != nullptr) {
+                // zeroed blocks are valid for every type, their scales are 0
+                ggml_backend_buffer_clear(weights, 0);
+                ms = best_ms(backend, [&]() { return ggml_backend_graph_compute(backend, gf) == GGML_STATUS_SUCCESS; });
+                ggml_backend_buffer_free(weights);
+            }
+            ggml_free(ctx);
+            return 2.0 * BENCH_K * BENCH_N * BENCH_M / (ms * 1e6);
+        }
+
+        void bench_copy_gbps(ggml_backend_t backend, double* upload_gbps, double* download_gbps) {
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            if (ctx == nullptr) {
+                return;
+            }
+            ggml_tensor* t               = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, BENCH_COPY_BYTES);
+            ggml_backend_buffer_t buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
+            if (buffer != nullptr) {
+                std::vector<uint8_t> host(BENCH_COPY_BYTES, 0);
+                double upload_ms = best_ms(backend, [&]() {
+                    ggml_backend_tensor_set(t, host.data(), 0, host.size());
+                    return true;
+                });
+
+                double download_ms = best_ms(backend, [&]() {
+                    ggml_backend_tensor_get(t, host.data(), 0, host.size());
+                    return true;
+                });
+                *upload_gbps   = BENCH_COPY_BYTES / (upload_ms * 1e6);
+                *download_gbps = BENCH_COPY_BYTES / (download_ms * 1e6);
+                ggml_backend_buffer_free(buffer);
+            }
+            ggml_free(ctx);
+        }
+
+        // the flash attention of ggml_ext_attention_ext: f16 K and V, f32
+        // precision
+        bool supports_flash_attn(ggml_backend_dev_t dev) {
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead() * 8;
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            if (ctx == nullptr) {
+                return false;
+            }
+            ggml_tensor* q   = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, FLASH_ATTN_D_HEAD, FLASH_ATTN_L, FLASH_ATTN_HEADS);
+            ggml_tensor* k   = ggml_new_tensor_3d(ctx, GGML_TYPE_F16, FLASH_ATTN_D_HEAD, FLASH_ATTN_L, FLASH_ATTN_HEADS);
+            ggml_tensor* v   = ggml_new_tensor_3d(ctx, GGML_TYPE_F16, FLASH_ATTN_D_HEAD, FLASH_ATTN_L, FLASH_ATTN_HEADS);
+            ggml_tensor* out = ggml_flash_attn_ext(ctx, q, k, v, nullptr, 1.0f / std::sqrt(static_cast<float>(FLASH_ATTN_D_HEAD)), 0, 0);
+            ggml_flash_attn_ext_set_prec(out, GGML_PREC_F32);
+            bool supported = ggml_backend_dev_supports_op(dev, out);
+            ggml_free(ctx);
+            return supported;
+        }
+
+        // Devices keep their probe while they keep their identity; the CPU
+        // is timed per thread count.
+        std::string device_key(const Device& device, int n_threads) {
+            std::string key = device.backend + "/" + device.name + "/" + device.description + "/" + std::to_string(device.total_bytes);
+            if (device.is_cpu) {
+                key += "/" + std::to_string(n_threads) + " threads";
+            }
+            return key;
+        }
+
+        // with probe_mutex held
+        void load_cache_file() {
+            cache_loaded = true;
+            std::ifstream file(cache_path);
+            if (!file) {
+                return;
+            }
+            nlohmann::json root = nlohmann::json::parse(file, nullptr, false);
+            if (!root.is_object() || !root.contains("devices") || !root["devices"].is_array()) {
+                LOG_WARN("ignoring invalid device probe cache '%s'", cache_path.c_str());
+                return;
+            }
+            for (const nlohmann::json& entry : root["devices"]) {
+                if (!entry.is_object() || !entry.value("key", nlohmann::json()).is_string()) {
+                    continue;
+                }
+                Device device;
+                device.upload_gbps   = entry.value("upload_gbps", 0.0);
+                device.download_gbps = entry.value("download_gbps", 0.0);
+                device.flash_attn    = entry.value("flash_attn", false);
+                if (entry.contains("gflops") && entry["gflops"].is_object()) {
+                    for (ggml_type type : MATMUL_TYPES) {
+                        const char* name = ggml_type_name(type);
+                        if (entry["gflops"].contains(name) && entry["gflops"][name].is_number()) {
+                            device.gflops[type] = entry["gflops"][name].get<double>();
+                        }
+                    }
+                }
+                probes[entry["key"].get<std::string>()] = device;
+            }
+        }
+
+        // with probe_mutex held
+        void write_cache_file() {
+            nlohmann::json root;
+            root["devices"] = nlohmann::json::array();
+            for (const auto& [key, device] : probes) {
+                nlohmann::json gflops = nlohmann::json::object();
+                for (const auto& [type, value] : device.gflops) {
+                    gflops[ggml_type_name(type)] = value;
+                }
+                root["devices"].push_back({{"key", key},
+                                           {"upload_gbps", device.upload_gbps},
+                                           {"download_gbps", device.download_gbps},
+                                           {"flash_attn", device.flash_attn},
+                                           {"gflops", std::move(gflops)}});
+            }
+            std::ofstream file(cache_path, std::ios::trunc);
+            if (!file) {
+                LOG_WARN("failed to write device probe cache '%s'", cache_path.c_str());
+                return;
+            }
+            file << root.dump(2) << "\n";
+        }
+
+        void measure(ggml_backend_dev_t dev, int n_threads, Device* device) {
+            device->flash_attn     = supports_flash_attn(dev);
+            ggml_backend_t backend = ggml_backend_dev_init(dev, nullptr);
+            if (backend == nullptr) {
+                LOG_WARN("device probe: failed to initialize %s", device->name.c_str());
+                return;
+            }
+            if (device->is_cpu) {
+                sd_backend_cpu_set_n_threads(backend, n_threads);
+            }
+            for (ggml_type type : MATMUL_TYPES) {
+                double gflops = bench_gflops(backend, type);
+                if (gflops > 0) {
+                    device->gflops[type] = gflops;
+                }
+            }
+            if (!device->is_cpu) {
+                bench_copy_gbps(backend, &device->upload_gbps, &device->download_gbps);
+            }
+            ggml_backend_free(backend);
+        }
+
+    }  // namespace
+
+    double Device::matmul_gflops(ggml_type type) const {
+        auto it = gflops.find(type);
+        if (it != gflops.end()) {
+            return it->second;
+        }
+        it = gflops.find(GGML_TYPE_F16);
+        return it != gflops.end() ? it->second : 0;
+    }
+
+    void set_cache_path(const std::string& path) {
+        std::lock_guard<std::mutex> lock(probe_mutex);
+        if (path == cache_path) {
+            return;
+        }
+        cache_path   = path;
+        cache_loaded = false;
+    }
+
+    std::vector<Device> probe(int n_threads) {
+        std::lock_guard<std::mutex> lock(probe_mutex);
+        if (!cache_path.empty() && !cache_loaded) {
+            load_cache_file();
+        }
+
+        std::vector<Device> devices;
+        bool measured = false;
+        for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+            ggml_backend_dev_t dev              = ggml_backend_dev_get(i);
+            enum ggml_backend_dev_type dev_type = ggml_backend_dev_type(dev);
+            if (dev_type != GGML_BACKEND_DEVICE_TYPE_CPU &&
+                dev_type != GGML_BACKEND_DEVICE_TYPE_GPU &&
+                dev_type != GGML_BACKEND_DEVICE_TYPE_IGPU) {
+                continue;
+            }
+            Device device;
+            device.name        = ggml_backend_dev_name(dev);
+            device.backend     = ggml_backend_reg_name(ggml_backend_dev_backend_reg(dev));
+            device.description = ggml_backend_dev_description(dev);
+            device.is_cpu      = dev_type == GGML_BACKEND_DEVICE_TYPE_CPU;
+            ggml_backend_dev_memory(dev, &device.free_bytes, &device.total_bytes);
+
+            const std::string key = device_key(device, n_threads);
+            auto it               = probes.find(key);
+            if (it == probes.end()) {
+                Device measurement;
+                measurement.name   = device.name;
+                measurement.is_cpu = device.is_cpu;
+                measure(dev, n_threads, &measurement);
+                if (measurement.gflops.empty()) {
+                    // not kept, so a device that failed to start is retried
+                    LOG_WARN("device probe: skipping %s", device.name.c_str());
+                    continue;
+                }
+                it       = probes.emplace(key, measurement).first;
+                measured = true;
+            }
+            device.upload_gbps   = it->second.upload_gbps;
+            device.download_gbps = it->second.download_gbps;
+            device.flash_attn    = it->second.flash_attn;
+            device.gflops        = it->second.gflops;
+            devices.push_back(std::move(device));
+        }
+        if (measured && !cache_path.empty()) {
+            write_cache_file();
+        }
+        return devices;
+    }
+
+    std::string to_string(const std::vector<Device>& devices) {
+        std::string out;
+        char line[256];
+        for (const Device& device : devices) {
+            snprintf(line,
+                     sizeof(line),
+                     "  %-10s %-8s %s, %.2f of %.2f GiB free, flash attention %s",
+                     device.name.c_str(),
+                     device.backend.c_str(),
+                     device.description.c_str(),
+                     device.free_bytes / GIB,
+                     device.total_bytes / GIB,
+                     device.flash_attn ? "yes" : "no");
+            out += line;
+            if (!device.is_cpu) {
+                snprintf(line, sizeof(line), ", %.1f GB/s up, %.1f GB/s down", device.upload_gbps, device.download_gbps);
+                out += line;
+            }
+            out += "\n   ";
+            for (ggml_type type : MATMUL_TYPES) {
+                auto it = device.gflops.find(type);
+                if (it == device.gflops.end()) {
+                    snprintf(line, sizeof(line), " %s -", ggml_type_name(type));
+                } else {
+                    snprintf(line, sizeof(line), " %s %.0f GFLOPS", ggml_type_name(type), it->second);
+                }
+                out += line;
+            }
+            out += "\n";
+        }
+        return out;
+    }
+
+}  // namespace sd::device_probe
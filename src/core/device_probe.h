@@ -0,0 +1,52 @@
+#ifndef __SD_CORE_DEVICE_PROBE_H__
+#define __SD_CORE_DEVICE_PROBE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ggml.h"
+
+// Measures what each CPU and GPU device (RPC servers included) can do: the
+// host to device and device to host copy rates, the matmul throughput per
+// weight type and whether it runs flash attention. Measurements are kept for
+// the process and, with a cache file, for later processes while a device
+// keeps its name, description and memory size; free memory is always read
+// live.
+namespace sd::device_probe {
+
+    // The weight types matmuls are timed with, the common checkpoint types.
+    constexpr ggml_type MATMUL_TYPES[] = {GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0, GGML_TYPE_Q4_K};
+
+    struct Device {
+        std::string name;         // ggml device name, as --backend takes it
+        std::string backend;      // backend registry: CPU, CUDA, Vulkan, Metal, RPC, ...
+        std::string description;  // of the hardware
+        bool is_cpu          = false;
+        size_t free_bytes    = 0;
+        size_t total_bytes   = 0;
+        double upload_gbps   = 0;  // host to device copy rate, 0 on the CPU
+        double download_gbps = 0;  // device to host copy rate, 0 on the CPU
+        bool flash_attn      = false;
+        // f32 activations times weights of the type; a type the device
+        // cannot multiply is missing
+        std::map<ggml_type, double> gflops;
+
+        // The throughput of a weight type, or of f16 when the type was not
+        // timed.
+        double matmul_gflops(ggml_type type) const;
+    };
+
+    // Reads and extends the probes in path, an empty path keeps them in the
+    // process only.
+    void set_cache_path(const std::string& path);
+
+    // Every CPU and GPU device; devices without a probe yet are timed now.
+    // n_threads is used for the CPU.
+    std::vector<Device> probe(int n_threads);
+
+    std::string to_string(const std::vector<Device>& devices);
+
+}  // namespace sd::device_probe
+
+#endif  // __SD_CORE_DEVICE_PROBE_H__
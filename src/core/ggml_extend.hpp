@@ -6,25 +6,36 @@
 #include <stdarg.h>
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <random>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "core/attention_tuner.h"
+#include "core/compute_arena.h"
+#include "core/conv_tuner.h"
 #include "core/ggml_extend_backend.h"
 #include "core/ggml_graph_cut.h"
+#include "core/memory_timeline.h"
+#include "core/op_profiler.h"
+#include "core/perf_stats.h"
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
 #include "ggml.h"
@@ -387,6 +398,19 @@ __STATIC_INLINE__ float sigmoid(float x) {
 
 // SPECIAL OPERATIONS WITH TENSORS
 
+// Host bytes of tensor: its data when that is host memory, else a copy in
+// staging (fetched from the device when fetch is set).
+__STATIC_INLINE__ char* ggml_ext_host_bytes(const ggml_tensor* tensor, std::vector<char>* staging, bool fetch) {
+    if (tensor->buffer == nullptr || ggml_backend_buffer_is_host(tensor->buffer)) {
+        return (char*)tensor->data;
+    }
+    staging->resize(ggml_nbytes(tensor));
+    if (fetch) {
+        ggml_backend_tensor_get(tensor, staging->data(), 0, staging->size());
+    }
+    return staging->data();
+}
+
 __STATIC_INLINE__ uint8_t* ggml_tensor_to_sd_image(ggml_tensor* input, uint8_t* image_data = nullptr) {
     int64_t width    = input->ne[0];
     int64_t height   = input->ne[1];
@@ -395,11 +419,14 @@ __STATIC_INLINE__ uint8_t* ggml_tensor_to_sd_image(ggml_tensor* input, uint8_t*
     if (image_data == nullptr) {
         image_data = (uint8_t*)malloc(width * height * channels);
     }
+    std::vector<char> staging;
+    const char* data = ggml_ext_host_bytes(input, &staging, true);
     for (int iy = 0; iy < height; iy++) {
-        for (int ix = 0; ix < width; ix++) {
-            for (int k = 0; k < channels; k++) {
-                float value                                               = ggml_ext_tensor_get_f32(input, ix, iy, k);
-                *(image_data + iy * width * channels + ix * channels + k) = (uint8_t)(value * 255.0f);
+        uint8_t* dst = image_data + iy * width * channels;
+        for (int k = 0; k < channels; k++) {
+            const float* src = (const float*)(data + iy * input->nb[1] + k * input->nb[2]);
+            for (int ix = 0; ix < width; ix++) {
+                dst[ix * channels + k] = (uint8_t)(src[ix] * 255.0f);
             }
         }
     }
@@ -417,16 +444,15 @@ __STATIC_INLINE__ uint8_t* ggml_tensor_to_sd_image(ggml_tensor* input, int idx,
     }
     GGML_ASSERT(channels == 3 && input->type == GGML_TYPE_F32);
     uint8_t* image_data = (uint8_t*)malloc(width * height * channels);
+    std::vector<char> staging;
+    const char* data = ggml_ext_host_bytes(input, &staging, true);
     for (int ih = 0; ih < height; ih++) {
-        for (int iw = 0; iw < width; iw++) {
-            for (int ic = 0; ic < channels; ic++) {
-                float value;
-                if (video) {
-                    value = ggml_ext_tensor_get_f32(input, iw, ih, idx, ic);
-                } else {
-                    value = ggml_ext_tensor_get_f32(input, iw, ih, ic, idx);
-                }
-                *(image_data + ih * width * channels + iw * channels + ic) = (uint8_t)(value * 255.0f);
+        uint8_t* dst = image_data + ih * width * channels;
+        for (int ic = 0; ic < channels; ic++) {
+            const size_t offset = video ? idx * input->nb[2] + ic * input->nb[3] : ic * input->nb[2] + idx * input->nb[3];
+            const float* src    = (const float*)(data + ih * input->nb[1] + offset);
+            for (int iw = 0; iw < width; iw++) {
+                dst[iw * channels + ic] = (uint8_t)(src[iw] * 255.0f);
             }
         }
     }
@@ -441,10 +467,21 @@ __STATIC_INLINE__ void sd_image_to_ggml_tensor(sd_image_t image,
     GGML_ASSERT(image.channel == tensor->ne[2]);
     GGML_ASSERT(1 == tensor->ne[3]);
     GGML_ASSERT(tensor->type == GGML_TYPE_F32);
-    ggml_ext_tensor_iter(tensor, [&](ggml_tensor* tensor, int64_t i0, int64_t i1, int64_t i2, int64_t i3) {
-        float value = sd_image_get_f32(image, i0, i1, i2, scale);
-        ggml_ext_tensor_set_f32(tensor, value, i0, i1, i2, i3);
-    });
+    std::vector<char> staging;
+    char* data          = ggml_ext_host_bytes(tensor, &staging, false);
+    const float divisor = scale ? 255.f : 1.f;
+    for (uint32_t ih = 0; ih < image.height; ih++) {
+        const uint8_t* src = image.data + ih * image.width * image.channel;
+        for (uint32_t ic = 0; ic < image.channel; ic++) {
+            float* dst = (float*)(data + ih * tensor->nb[1] + ic * tensor->nb[2]);
+            for (uint32_t iw = 0; iw < image.width; iw++) {
+                dst[iw] = src[iw * image.channel + ic] / divisor;
+            }
+        }
+    }
+    if (!staging.empty()) {
+        ggml_backend_tensor_set(tensor, staging.data(), 0, staging.size());
+    }
 }
 
 __STATIC_INLINE__ void ggml_ext_tensor_apply_mask(ggml_tensor* image_data,
@@ -474,13 +511,16 @@ __STATIC_INLINE__ void ggml_ext_tensor_apply_mask(ggml_tensor* image_data,
 }
 
 __STATIC_INLINE__ float ggml_ext_tensor_mean(ggml_tensor* src) {
-    float mean        = 0.0f;
     int64_t nelements = ggml_nelements(src);
-    float* data       = (float*)src->data;
-    for (int i = 0; i < nelements; i++) {
-        mean += data[i] / nelements * 1.0f;
-    }
-    return mean;
+    const float* data = (const float*)src->data;
+    double sum        = sd::parallel_reduce(nelements, sd::kTensorParallelChunk, 0.0, [&](int64_t begin, int64_t end) {
+        double partial = 0.0;
+        for (int64_t i = begin; i < end; i++) {
+            partial += data[i];
+        }
+        return partial;
+    });
+    return static_cast<float>(sum / nelements);
 }
 
 // a = a+b
@@ -754,15 +794,18 @@ __STATIC_INLINE__ sd::Tensor<float> sd_tensor_split_2d(const sd::Tensor<float>&
     int64_t input_plane  = sd_tensor_plane_size(input);
     int64_t output_plane = sd_tensor_plane_size(output);
     int64_t plane_count  = input.numel() / input_plane;
-    for (int iy = 0; iy < height; iy++) {
-        for (int ix = 0; ix < width; ix++) {
-            int64_t src_xy = (ix + x) % input_width + input_width * ((iy + y) % input_height);
-            int64_t dst_xy = ix + width * iy;
-            for (int64_t plane = 0; plane < plane_count; ++plane) {
-                output[plane * output_plane + dst_xy] = input[plane * input_plane + src_xy];
+    int64_t row_chunk    = std::max<int64_t>(1, sd::kTensorParallelChunk / std::max<int64_t>(1, width * plane_count));
+    sd::parallel_for(height, row_chunk, [&](int64_t row_begin, int64_t row_end) {
+        for (int64_t iy = row_begin; iy < row_end; iy++) {
+            for (int ix = 0; ix < width; ix++) {
+                int64_t src_xy = (ix + x) % input_width + input_width * ((iy + y) % input_height);
+                int64_t dst_xy = ix + width * iy;
+                for (int64_t plane = 0; plane < plane_count; ++plane) {
+                    output[plane * output_plane + dst_xy] = input[plane * input_plane + src_xy];
+                }
             }
         }
-    }
+    });
     return output;
 }
 
@@ -792,44 +835,56 @@ __STATIC_INLINE__ void sd_tensor_merge_2d(const sd::Tensor<float>& input,
         return x * x * x * (x * (6.0f * x - 15.0f) + 10.0f);
     };
 
-    for (int iy = y_skip; iy < height; iy++) {
-        for (int ix = x_skip; ix < width; ix++) {
-            int64_t src_xy = ix + width * iy;
-            int64_t ox     = (x + ix) % img_width;
-            int64_t oy     = (y + iy) % img_height;
-            int64_t dst_xy = ox + img_width * oy;
-            for (int64_t plane = 0; plane < plane_count; ++plane) {
-                float new_value = input[plane * input_plane + src_xy];
-                if (overlap_x > 0 || overlap_y > 0) {
-                    float old_value   = (*output)[plane * output_plane + dst_xy];
-                    const float x_f_0 = (circular_x || (overlap_x > 0 && x > 0)) ? (ix - x_skip) / float(overlap_x) : 1.f;
-                    const float x_f_1 = (circular_x || (overlap_x > 0 && x < (img_width - width))) ? (width - ix) / float(overlap_x) : 1.f;
-                    const float y_f_0 = (circular_y || (overlap_y > 0 && y > 0)) ? (iy - y_skip) / float(overlap_y) : 1.f;
-                    const float y_f_1 = (circular_y || (overlap_y > 0 && y < (img_height - height))) ? (height - iy) / float(overlap_y) : 1.f;
-                    const float x_f   = std::min(std::min(x_f_0, x_f_1), 1.f);
-                    const float y_f   = std::min(std::min(y_f_0, y_f_1), 1.f);
-                    (*output)[plane * output_plane + dst_xy] =
-                        old_value + new_value * smootherstep_f32(y_f) * smootherstep_f32(x_f);
-                } else {
-                    (*output)[plane * output_plane + dst_xy] = new_value;
+    // a tile is never taller than the image, so distinct rows of the tile land
+    // on distinct output rows and can be merged in parallel
+    GGML_ASSERT(height <= img_height);
+    int64_t row_chunk = std::max<int64_t>(1, sd::kTensorParallelChunk / std::max<int64_t>(1, width * plane_count));
+    sd::parallel_for(height - y_skip, row_chunk, [&](int64_t row_begin, int64_t row_end) {
+        for (int64_t iy = y_skip + row_begin; iy < y_skip + row_end; iy++) {
+            for (int ix = x_skip; ix < width; ix++) {
+                int64_t src_xy = ix + width * iy;
+                int64_t ox     = (x + ix) % img_width;
+                int64_t oy     = (y + iy) % img_height;
+                int64_t dst_xy = ox + img_width * oy;
+                for (int64_t plane = 0; plane < plane_count; ++plane) {
+                    float new_value = input[plane * input_plane + src_xy];
+                    if (overlap_x > 0 || overlap_y > 0) {
+                        float old_value   = (*output)[plane * output_plane + dst_xy];
+                        const float x_f_0 = (circular_x || (overlap_x > 0 && x > 0)) ? (ix - x_skip) / float(overlap_x) : 1.f;
+                        const float x_f_1 = (circular_x || (overlap_x > 0 && x < (img_width - width))) ? (width - ix) / float(overlap_x) : 1.f;
+                        const float y_f_0 = (circular_y || (overlap_y > 0 && y > 0)) ? (iy - y_skip) / float(overlap_y) : 1.f;
+                        const float y_f_1 = (circular_y || (overlap_y > 0 && y < (img_height - height))) ? (height - iy) / float(overlap_y) : 1.f;
+                        const float x_f   = std::min(std::min(x_f_0, x_f_1), 1.f);
+                        const float y_f   = std::min(std::min(y_f_0, y_f_1), 1.f);
+                        (*output)[plane * output_plane + dst_xy] =
+                            old_value + new_value * smootherstep_f32(y_f) * smootherstep_f32(x_f);
+                    } else {
+                        (*output)[plane * output_plane + dst_xy] = new_value;
+                    }
                 }
             }
         }
-    }
+    });
 }
 
-template <typename Fn>
-__STATIC_INLINE__ sd::Tensor<float> process_tiles_2d(const sd::Tensor<float>& input,
-                                                     int output_width,
-                                                     int output_height,
-                                                     int scale,
-                                                     int p_tile_size_x,
-                                                     int p_tile_size_y,
-                                                     float tile_overlap_factor,
-                                                     bool circular_x,
-                                                     bool circular_y,
-                                                     Fn&& on_processing,
-                                                     bool silent = false) {
+// Runs on_processing(worker, tiles) over tiles of input stacked along dim 3.
+// Tiles all have the same shape, so a batch is one graph with a larger batch
+// dim; next_batch_size(worker) is asked before each batch. With n_workers > 1,
+// on_processing runs on that many threads at once, worker 0 being the caller.
+template <typename Fn, typename BatchFn>
+__STATIC_INLINE__ sd::Tensor<float> process_tiles_2d_batched(const sd::Tensor<float>& input,
+                                                             int output_width,
+                                                             int output_height,
+                                                             int scale,
+                                                             int p_tile_size_x,
+                                                             int p_tile_size_y,
+                                                             float tile_overlap_factor,
+                                                             bool circular_x,
+                                                             bool circular_y,
+                                                             Fn&& on_processing,
+                                                             BatchFn&& next_batch_size,
+                                                             int n_workers = 1,
+                                                             bool silent   = false) {
     sd::Tensor<float> output;
     int input_width  = static_cast<int>(input.shape()[0]);
     int input_height = static_cast<int>(input.shape()[1]);
@@ -872,18 +927,23 @@ __STATIC_INLINE__ sd::Tensor<float> process_tiles_2d(const sd::Tensor<float>& in
         input_tile_size_x *= scale;
         input_tile_size_y *= scale;
     }
-
-    int num_tiles   = num_tiles_x * num_tiles_y;
-    int tile_count  = 1;
-    bool last_y     = false;
-    bool last_x     = false;
-    float last_time = 0.0f;
-    if (!silent) {
-        LOG_DEBUG("num tiles : %d, %d ", num_tiles_x, num_tiles_y);
-        LOG_DEBUG("optimal overlap : %f, %f (targeting %f)", tile_overlap_factor_x, tile_overlap_factor_y, tile_overlap_factor);
-        LOG_DEBUG("processing %i tiles", num_tiles);
-        pretty_progress(0, num_tiles, 0.0f);
-    }
+    int overlap_x_out = decode ? tile_overlap_x * scale : tile_overlap_x;
+    int overlap_y_out = decode ? tile_overlap_y * scale : tile_overlap_y;
+
+    // the last row and column are shifted back inside the image rather than
+    // padded, so every tile has the same shape; dx/dy skip the part already
+    // covered by the previous tile
+    struct Tile {
+        int x_in;
+        int y_in;
+        int x_out;
+        int y_out;
+        int dx;
+        int dy;
+    };
+    std::vector<Tile> tiles;
+    bool last_y = false;
+    bool last_x = false;
     for (int y = 0; y < small_height && !last_y; y += non_tile_overlap_y) {
         int dy = 0;
         if (!circular_y && y + tile_size_y >= small_height) {
@@ -906,38 +966,166 @@ __STATIC_INLINE__ sd::Tensor<float> process_tiles_2d(const sd::Tensor<float>& in
                 }
                 last_x = true;
             }
+            tiles.push_back({decode ? x : scale * x,
+                             decode ? y : scale * y,
+                             decode ? x * scale : x,
+                             decode ? y * scale : y,
+                             dx,
+                             dy});
+        }
+        last_x = false;
+    }
 
-            int x_in  = decode ? x : scale * x;
-            int y_in  = decode ? y : scale * y;
-            int x_out = decode ? x * scale : x;
-            int y_out = decode ? y * scale : y;
-
-            int overlap_x_out = decode ? tile_overlap_x * scale : tile_overlap_x;
-            int overlap_y_out = decode ? tile_overlap_y * scale : tile_overlap_y;
+    int num_tiles   = num_tiles_x * num_tiles_y;
+    int tile_count  = 0;
+    float last_time = 0.0f;
+    if (!silent) {
+        LOG_DEBUG("num tiles : %d, %d ", num_tiles_x, num_tiles_y);
+        LOG_DEBUG("optimal overlap : %f, %f (targeting %f)", tile_overlap_factor_x, tile_overlap_factor_y, tile_overlap_factor);
+        LOG_DEBUG("processing %i tiles", num_tiles);
+        pretty_progress(0, num_tiles, 0.0f);
+    }
+    // tiles are numbered in the memory timeline phase, "vae decode tile 3"
+    const std::string base_phase = sd_perf::memory_phase();
+    sd_perf::ScopedMemoryPhase tile_phase(base_phase);
+    auto make_batch = [&](size_t first, size_t batch_size) {
+        if (!base_phase.empty()) {
+            sd_perf::set_memory_phase(sd_format("%s tile %zu", base_phase.c_str(), first));
+        }
+        sd::Tensor<float> input_tiles;
+        for (size_t i = 0; i < batch_size; ++i) {
+            const Tile& tile = tiles[first + i];
+            auto input_tile  = sd_tensor_split_2d(input, input_tile_size_x, input_tile_size_y, tile.x_in, tile.y_in);
+            if (batch_size == 1) {
+                return input_tile;
+            }
+            if (input_tiles.empty()) {
+                GGML_ASSERT(input_tile.dim() == 4 && input_tile.shape()[3] == 1);
+                std::vector<int64_t> batch_shape = input_tile.shape();
+                batch_shape[3]                   = static_cast<int64_t>(batch_size);
+                input_tiles                      = sd::Tensor<float>(std::move(batch_shape));
+            }
+            std::copy(input_tile.data(), input_tile.data() + input_tile.numel(), input_tiles.data() + i * input_tile.numel());
+        }
+        return input_tiles;
+    };
+    auto merge_batch = [&](size_t first, size_t batch_size, const sd::Tensor<float>& output_tiles) {
+        GGML_ASSERT(output_tiles.shape()[0] == output_tile_size_x && output_tiles.shape()[1] == output_tile_size_y);
+        if (output.empty()) {
+            std::vector<int64_t> output_shape = output_tiles.shape();
+            output_shape[0]                   = output_width;
+            output_shape[1]                   = output_height;
+            if (batch_size > 1) {
+                output_shape[3] = 1;
+            }
+            output = sd::Tensor<float>::zeros(std::move(output_shape));
+        }
+        for (size_t i = 0; i < batch_size; ++i) {
+            const Tile& tile = tiles[first + i];
+            if (batch_size == 1) {
+                sd_tensor_merge_2d(output_tiles, &output, tile.x_out, tile.y_out, overlap_x_out, overlap_y_out, circular_x, circular_y, tile.dx, tile.dy);
+                break;
+            }
+            GGML_ASSERT(output_tiles.dim() == 4 && output_tiles.shape()[3] == static_cast<int64_t>(batch_size));
+            std::vector<int64_t> tile_shape = output_tiles.shape();
+            tile_shape[3]                   = 1;
+            sd::Tensor<float> output_tile(std::move(tile_shape));
+            const float* src = output_tiles.data() + i * output_tile.numel();
+            std::copy(src, src + output_tile.numel(), output_tile.data());
+            sd_tensor_merge_2d(output_tile, &output, tile.x_out, tile.y_out, overlap_x_out, overlap_y_out, circular_x, circular_y, tile.dx, tile.dy);
+        }
+        tile_count += static_cast<int>(batch_size);
+    };
 
-            int64_t t1       = ggml_time_ms();
-            auto input_tile  = sd_tensor_split_2d(input, input_tile_size_x, input_tile_size_y, x_in, y_in);
-            auto output_tile = on_processing(input_tile);
-            if (output_tile.empty()) {
+    if (n_workers <= 1) {
+        // a batch is blended on a helper thread while the next batch computes,
+        // so the device does not idle during the host-side merge; the last
+        // batch is merged here
+        std::future<void> pending_merge;
+        for (size_t first = 0; first < tiles.size();) {
+            int64_t t1        = ggml_time_ms();
+            size_t batch_size = static_cast<size_t>(std::max(1, static_cast<int>(next_batch_size(0))));
+            batch_size        = std::min(batch_size, tiles.size() - first);
+
+            auto output_tiles = on_processing(0, make_batch(first, batch_size));
+            if (pending_merge.valid()) {
+                pending_merge.get();
+            }
+            if (output_tiles.empty()) {
                 return {};
             }
-            GGML_ASSERT(output_tile.shape()[0] == output_tile_size_x && output_tile.shape()[1] == output_tile_size_y);
-            if (output.empty()) {
-                std::vector<int64_t> output_shape = output_tile.shape();
-                output_shape[0]                   = output_width;
-                output_shape[1]                   = output_height;
-                output                            = sd::Tensor<float>::zeros(std::move(output_shape));
+            if (first + batch_size < tiles.size()) {
+                pending_merge = std::async(std::launch::async, [&merge_batch, first, batch_size, output_tiles = std::move(output_tiles)]() {
+                    merge_batch(first, batch_size, output_tiles);
+                });
+            } else {
+                merge_batch(first, batch_size, output_tiles);
             }
-            sd_tensor_merge_2d(output_tile, &output, x_out, y_out, overlap_x_out, overlap_y_out, circular_x, circular_y, dx, dy);
-
+            first += batch_size;
             if (!silent) {
                 int64_t t2 = ggml_time_ms();
-                last_time  = (t2 - t1) / 1000.0f;
-                pretty_progress(tile_count, num_tiles, last_time);
+                last_time  = (t2 - t1) / 1000.0f / batch_size;
+                pretty_progress(static_cast<int>(first), num_tiles, last_time);
             }
-            tile_count++;
         }
-        last_x = false;
+    } else {
+        // workers take batches in tile order; finished batches are merged in
+        // the same order, so the blend does not depend on which worker is faster
+        std::mutex mutex;
+        size_t next_tile  = 0;
+        size_t next_merge = 0;
+        bool failed       = false;
+        std::map<size_t, std::pair<size_t, sd::Tensor<float>>> finished;
+        auto run_worker = [&](int worker) {
+            while (true) {
+                size_t first      = 0;
+                size_t batch_size = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (failed || next_tile >= tiles.size()) {
+                        return;
+                    }
+                    first      = next_tile;
+                    batch_size = static_cast<size_t>(std::max(1, static_cast<int>(next_batch_size(worker))));
+                    batch_size = std::min(batch_size, tiles.size() - first);
+                    next_tile += batch_size;
+                }
+                int64_t t1        = ggml_time_ms();
+                auto output_tiles = on_processing(worker, make_batch(first, batch_size));
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (output_tiles.empty()) {
+                    failed = true;
+                    return;
+                }
+                finished[first] = {batch_size, std::move(output_tiles)};
+                while (!failed && !finished.empty() && finished.begin()->first == next_merge) {
+                    auto batch = std::move(finished.begin()->second);
+                    finished.erase(finished.begin());
+                    merge_batch(next_merge, batch.first, batch.second);
+                    next_merge += batch.first;
+                }
+                if (!silent) {
+                    int64_t t2 = ggml_time_ms();
+                    last_time  = (t2 - t1) / 1000.0f / batch_size;
+                    pretty_progress(tile_count, num_tiles, last_time);
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int worker = 1; worker < n_workers; ++worker) {
+            threads.emplace_back([&run_worker, worker, thread_callbacks = sd_current_thread_callbacks()]() {
+                ScopedThreadCallbacks callback_scope(thread_callbacks);
+                run_worker(worker);
+            });
+        }
+        run_worker(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (failed) {
+            return {};
+        }
     }
     if (!silent && tile_count < num_tiles) {
         pretty_progress(num_tiles, num_tiles, last_time);
@@ -948,6 +1136,33 @@ __STATIC_INLINE__ sd::Tensor<float> process_tiles_2d(const sd::Tensor<float>& in
     return output;
 }
 
+template <typename Fn>
+__STATIC_INLINE__ sd::Tensor<float> process_tiles_2d(const sd::Tensor<float>& input,
+                                                     int output_width,
+                                                     int output_height,
+                                                     int scale,
+                                                     int p_tile_size_x,
+                                                     int p_tile_size_y,
+                                                     float tile_overlap_factor,
+                                                     bool circular_x,
+                                                     bool circular_y,
+                                                     Fn&& on_processing,
+                                                     bool silent = false) {
+    return process_tiles_2d_batched(input,
+                                    output_width,
+                                    output_height,
+                                    scale,
+                                    p_tile_size_x,
+                                    p_tile_size_y,
+                                    tile_overlap_factor,
+                                    circular_x,
+                                    circular_y,
+                                    [&](int, const sd::Tensor<float>& input_tile) { return on_processing(input_tile); },
+                                    [](int) { return 1; },
+                                    1,
+                                    silent);
+}
+
 __STATIC_INLINE__ ggml_tensor* ggml_ext_group_norm_32(ggml_context* ctx,
                                                       ggml_tensor* a) {
     const float eps = 1e-6f;  // default eps parameter
@@ -1079,6 +1294,42 @@ __STATIC_INLINE__ ggml_tensor* ggml_ext_pad(ggml_context* ctx,
     return ggml_ext_pad_ext(ctx, x, 0, p0, 0, p1, 0, p2, 0, p3, circular_x, circular_y);
 }
 
+// ggml_conv_2d with its im2col buffer capped at max_im2col_bytes: larger
+// convs run over bands of output rows, each band reading only the input rows
+// under it. The first and last layers of a VAE at high resolution otherwise
+// need gigabytes for one im2col.
+__STATIC_INLINE__ ggml_tensor* ggml_ext_conv_2d_im2col(ggml_context* ctx,
+                                                       ggml_tensor* w,
+                                                       ggml_tensor* x,
+                                                       int s0,
+                                                       int s1,
+                                                       int p0,
+                                                       int p1,
+                                                       int d0,
+                                                       int d1,
+                                                       size_t max_im2col_bytes = 512ull * 1024 * 1024) {
+    const int64_t OW = (x->ne[0] + 2 * p0 - d0 * (w->ne[0] - 1) - 1) / s0 + 1;
+    const int64_t OH = (x->ne[1] + 2 * p1 - d1 * (w->ne[1] - 1) - 1) / s1 + 1;
+    // im2col is in the weight type, one row of OW * KW * KH * IC per image
+    const size_t row_bytes = static_cast<size_t>(OW) * w->ne[0] * w->ne[1] * w->ne[2] * x->ne[3] *
+                             ggml_type_size(w->type) / ggml_blck_size(w->type);
+    if (OH <= 1 || row_bytes * OH <= max_im2col_bytes) {
+        return ggml_conv_2d(ctx, w, x, s0, s1, p0, p1, d0, d1);
+    }
+    const int64_t band_rows = std::max<int64_t>(1, static_cast<int64_t>(max_im2col_bytes / row_bytes));
+    if (p1 != 0) {
+        x = ggml_pad_ext(ctx, x, 0, 0, p1, p1, 0, 0, 0, 0);
+    }
+    ggml_tensor* out = nullptr;
+    for (int64_t oh = 0; oh < OH; oh += band_rows) {
+        const int64_t oh_end = std::min(OH, oh + band_rows);
+        ggml_tensor* band    = ggml_ext_slice(ctx, x, 1, oh * s1, (oh_end - 1) * s1 + d1 * (w->ne[1] - 1) + 1);
+        band                 = ggml_conv_2d(ctx, w, band, s0, s1, p0, 0, d0, d1);
+        out                  = out == nullptr ? band : ggml_concat(ctx, out, band, 1);
+    }
+    return out;
+}
+
 // w: [OC，IC, KH, KW]
 // x: [N, IC, IH, IW]
 // b: [OC,]
@@ -1113,7 +1364,7 @@ __STATIC_INLINE__ ggml_tensor* ggml_ext_conv_2d(ggml_context* ctx,
     if (direct) {
         x = ggml_conv_2d_direct(ctx, w, x, s0, s1, p0, p1, d0, d1);
     } else {
-        x = ggml_conv_2d(ctx, w, x, s0, s1, p0, p1, d0, d1);
+        x = ggml_ext_conv_2d_im2col(ctx, w, x, s0, s1, p0, p1, d0, d1);
     }
     if (scale != 1.f) {
         x = ggml_ext_scale(ctx, x, 1.f / scale);
@@ -1328,6 +1579,10 @@ __STATIC_INLINE__ ggml_tensor* ggml_ext_attention_ext(ggml_context* ctx,
         C         = d_head * n_head;
     }
 
+    if (flash_attn && sd::attention_tuner::enabled()) {
+        flash_attn = sd::attention_tuner::prefer_flash(backend, L_q, L_k, d_head, n_head * N, mask != nullptr);
+    }
+
     float scale = (1.0f / sqrt((float)d_head));
 
     ggml_tensor* kqv = nullptr;
@@ -1423,6 +1678,67 @@ __STATIC_INLINE__ ggml_tensor* ggml_ext_attention_ext(ggml_context* ctx,
     return kqv;
 }
 
+// Frames per attention window when window_frames are asked for over n_frames:
+// the largest divisor of n_frames not above the request, 0 (full attention)
+// when that leaves a single window or one-frame windows.
+__STATIC_INLINE__ int64_t ggml_ext_attention_window_frames(int64_t n_frames, int64_t window_frames) {
+    if (window_frames <= 0 || n_frames <= window_frames) {
+        return 0;
+    }
+    for (int64_t frames = window_frames; frames >= 2; --frames) {
+        if (n_frames % frames == 0) {
+            return frames;
+        }
+    }
+    return 0;
+}
+
+// Rotates x [N, L, C] along L, token i + shift moves to i.
+__STATIC_INLINE__ ggml_tensor* ggml_ext_roll_tokens(ggml_context* ctx,
+                                                    ggml_tensor* x,
+                                                    int64_t shift) {
+    int64_t L = x->ne[1];
+    shift     = ((shift % L) + L) % L;
+    if (shift == 0) {
+        return x;
+    }
+    auto head = ggml_view_3d(ctx, x, x->ne[0], shift, x->ne[2], x->nb[1], x->nb[2], 0);
+    auto tail = ggml_view_3d(ctx, x, x->ne[0], L - shift, x->ne[2], x->nb[1], x->nb[2], x->nb[1] * shift);
+    return ggml_concat(ctx, tail, head, 1);
+}
+
+// Self-attention restricted to windows of window_tokens consecutive tokens,
+// for frame-major video sequences where a window is a run of whole frames.
+// Windows start window_shift tokens later (wrapping around), which blocks
+// alternate so information crosses window borders. Attention cost drops
+// from L^2 to L * window_tokens; other window sizes fall back to full attention.
+__STATIC_INLINE__ ggml_tensor* ggml_ext_window_attention(ggml_context* ctx,
+                                                         ggml_backend_t backend,
+                                                         ggml_tensor* q,
+                                                         ggml_tensor* k,
+                                                         ggml_tensor* v,
+                                                         int64_t n_head,
+                                                         int64_t window_tokens,
+                                                         int64_t window_shift = 0,
+                                                         bool flash_attn      = false) {
+    // q, k, v: [N, L, C]
+    // return [N, L, C]
+    int64_t L = q->ne[1];
+    int64_t N = q->ne[2];
+    if (window_tokens <= 0 || window_tokens >= L || L % window_tokens != 0) {
+        return ggml_ext_attention_ext(ctx, backend, q, k, v, n_head, nullptr, false, flash_attn);
+    }
+    int64_t n_windows = N * (L / window_tokens);
+
+    auto to_windows = [&](ggml_tensor* x) {
+        x = ggml_ext_cont(ctx, ggml_ext_roll_tokens(ctx, x, window_shift));
+        return ggml_reshape_3d(ctx, x, x->ne[0], window_tokens, n_windows);  // [N*n_windows, window_tokens, C]
+    };
+    auto out = ggml_ext_attention_ext(ctx, backend, to_windows(q), to_windows(k), to_windows(v), n_head, nullptr, false, flash_attn);
+    out      = ggml_reshape_3d(ctx, out, out->ne[0], L, N);
+    return ggml_ext_roll_tokens(ctx, out, -window_shift);
+}
+
 __STATIC_INLINE__ ggml_tensor* ggml_ext_layer_norm(ggml_context* ctx,
                                                    ggml_tensor* x,
                                                    ggml_tensor* w,
@@ -1458,6 +1774,85 @@ __STATIC_INLINE__ ggml_tensor* ggml_ext_group_norm(ggml_context* ctx,
     return x;
 }
 
+// CPU kernel for ggml_ext_group_norm_silu. userdata carries the group count,
+// shifted left by one, and whether to apply SiLU in the low bit.
+__STATIC_INLINE__ void ggml_ext_group_norm_silu_cpu(ggml_tensor* dst,
+                                                    const ggml_tensor* x,
+                                                    const ggml_tensor* w,
+                                                    const ggml_tensor* b,
+                                                    int ith,
+                                                    int nth,
+                                                    void* userdata) {
+    const intptr_t config      = reinterpret_cast<intptr_t>(userdata);
+    const int num_groups       = static_cast<int>(config >> 1);
+    const bool silu            = (config & 1) != 0;
+    const float eps            = 1e-6f;
+    const int64_t spatial      = x->ne[0] * x->ne[1];
+    const int64_t channels     = x->ne[2];
+    const int64_t group_size   = channels / num_groups;
+    const int64_t group_values = group_size * spatial;
+    const float* w_data        = static_cast<const float*>(w->data);
+    const float* b_data        = static_cast<const float*>(b->data);
+
+    for (int64_t task = ith; task < x->ne[3] * num_groups; task += nth) {
+        const int64_t n   = task / num_groups;
+        const int64_t g   = task % num_groups;
+        const int64_t c0  = g * group_size;
+        const float* src  = static_cast<const float*>(x->data) + (n * channels + c0) * spatial;
+        float* out        = static_cast<float*>(dst->data) + (n * channels + c0) * spatial;
+        double sum        = 0.0;
+        for (int64_t i = 0; i < group_values; ++i) {
+            sum += src[i];
+        }
+        const float mean = static_cast<float>(sum / group_values);
+        double sq_sum    = 0.0;
+        for (int64_t i = 0; i < group_values; ++i) {
+            const float d = src[i] - mean;
+            sq_sum += static_cast<double>(d) * d;
+        }
+        const float inv_std = 1.0f / std::sqrt(static_cast<float>(sq_sum / group_values) + eps);
+        for (int64_t c = 0; c < group_size; ++c) {
+            const float scale = inv_std * w_data[c0 + c];
+            const float shift = b_data[c0 + c] - mean * scale;
+            const float* row  = src + c * spatial;
+            float* out_row    = out + c * spatial;
+            for (int64_t i = 0; i < spatial; ++i) {
+                float v    = row[i] * scale + shift;
+                out_row[i] = silu ? v / (1.0f + std::exp(-v)) : v;
+            }
+        }
+    }
+}
+
+// GroupNorm with its affine transform and, with silu, the activation that
+// follows it in ResNet blocks. On the CPU this is one custom op that reads
+// the activations twice for the statistics and writes them once, where the
+// separate ggml ops make four to five full passes. Other backends, and inputs
+// the kernel does not cover, take the ggml ops.
+__STATIC_INLINE__ ggml_tensor* ggml_ext_group_norm_silu(ggml_context* ctx,
+                                                        ggml_backend_t backend,
+                                                        ggml_tensor* x,
+                                                        ggml_tensor* w,
+                                                        ggml_tensor* b,
+                                                        int num_groups = 32,
+                                                        bool silu      = true) {
+    bool fused = backend != nullptr && sd_backend_is_cpu(backend) &&
+                 w != nullptr && b != nullptr &&
+                 x->type == GGML_TYPE_F32 && w->type == GGML_TYPE_F32 && b->type == GGML_TYPE_F32 &&
+                 ggml_is_contiguous(x) && ggml_is_contiguous(w) && ggml_is_contiguous(b) &&
+                 ggml_nelements(w) == x->ne[2] && ggml_nelements(b) == x->ne[2] &&
+                 x->ne[2] % num_groups == 0;
+    if (fused) {
+        intptr_t config = (static_cast<intptr_t>(num_groups) << 1) | (silu ? 1 : 0);
+        return ggml_map_custom3(ctx, x, w, b, ggml_ext_group_norm_silu_cpu, GGML_N_TASKS_MAX, reinterpret_cast<void*>(config));
+    }
+    x = ggml_ext_group_norm(ctx, x, w, b, num_groups);
+    if (silu) {
+        x = ggml_silu_inplace(ctx, x);
+    }
+    return x;
+}
+
 __STATIC_INLINE__ void ggml_ext_backend_tensor_get_and_sync(ggml_backend_t backend, const ggml_tensor* tensor, void* data, size_t offset, size_t size) {
     if ((sd_backend_is(backend, "ROCm") || sd_backend_is(backend, "CUDA") || sd_backend_is(backend, "SYCL")) &&
         !sd_backend_is_cpu(backend)) {
@@ -1658,6 +2053,7 @@ struct GGMLRunnerContext {
     ggml_context* ggml_ctx                                           = nullptr;
     bool flash_attn_enabled                                          = false;
     bool conv2d_direct_enabled                                       = false;
+    bool conv_f32_enabled                                            = false;
     bool circular_x_enabled                                          = false;
     bool circular_y_enabled                                          = false;
     std::shared_ptr<WeightAdapter> weight_adapter                    = nullptr;
@@ -1705,20 +2101,68 @@ protected:
     using GraphCutSegment = sd::ggml_graph_cut::Segment;
     using GraphCutPlan    = sd::ggml_graph_cut::Plan;
 
+    // Opt-in description of a graph that stays valid across computes: `key`
+    // holds every shape and option the graph was built from and `inputs` the
+    // host data bound with make_input, in a fixed order. Only runners whose
+    // build_graph derives nothing else from input values may pass one.
+    struct GraphReuse {
+        std::string key;
+        std::vector<const void*> inputs;
+
+        template <typename T>
+        void add_input(const sd::Tensor<T>& tensor) {
+            key += "[";
+            for (int64_t dim : tensor.shape()) {
+                key += std::to_string(dim) + ",";
+            }
+            key += "]";
+            inputs.push_back(tensor.empty() ? nullptr : tensor.data());
+        }
+    };
+
     ggml_backend_t runtime_backend = nullptr;
 
     ggml_context* params_ctx = nullptr;
 
     ggml_context* cache_ctx            = nullptr;
     ggml_backend_buffer_t cache_buffer = nullptr;
+    // Runners whose cache tensors outlive a request (e.g. a prompt-prefix
+    // KV cache) set this; they free the cache themselves when it goes stale.
+    bool keep_cache_on_runner_done = false;
 
     ggml_context* compute_ctx    = nullptr;
     ggml_gallocr* compute_allocr = nullptr;
+    // Set while compute_allocr is the leased gallocr of a shared arena.
+    std::shared_ptr<sd::ComputeArena> compute_arena_;
+    // What end_request_compute_buffer does with the buffer, and the shape key
+    // of the request it was kept for.
+    compute_buffer_retention_t compute_buffer_retention_ = COMPUTE_BUFFER_FREE;
+    std::string retained_shape_key_;
+    bool compute_out_of_memory_ = false;  // the last compute ran out of device memory
 
     size_t max_graph_vram_bytes           = 0;
     bool stream_layers_enabled            = false;
     size_t observed_max_effective_budget_ = 0;
 
+    // Streamed segment use over the first computes of a generation; after
+    // those, residency is chosen from it instead of by graph order.
+    static constexpr uint64_t SEGMENT_USAGE_WARMUP_COMPUTES = 4;
+    std::unordered_map<std::string, sd::ggml_graph_cut::SegmentUsage> segment_usage_;
+    uint64_t segment_usage_computes_ = 0;
+    std::unordered_set<std::string> resident_segment_groups_;
+    // Hybrid streaming: streamed segments that compute faster on the host,
+    // where their params live, than on this backend after their upload.
+    ggml_backend_t host_backend_ = nullptr;
+    sd::ggml_graph_cut::HostExecutionRates host_execution_rates_;
+    size_t host_segment_count_   = 0;
+    double measured_upload_gbps_ = 0.0;    // of the prefetches, once measured
+    bool host_params_refused_    = false;  // until runner_done, e.g. while LoRAs are merged on staging
+    // segment of the cut graph being computed, for the op profiler
+    int profile_segment_ = -1;
+    // run once execute_graph has prepared its params; the next segment's
+    // prefetch starts there, so it never holds the manager while they load
+    std::function<void()> on_params_prepared_;
+
     std::shared_ptr<WeightAdapter> weight_adapter = nullptr;
     std::weak_ptr<RunnerWeightManager> weight_manager;
     std::unordered_set<const ggml_tensor*> kept_compute_param_tensor_set;
@@ -1732,19 +2176,97 @@ protected:
     std::vector<int> zero_int_vec = {0};
     ggml_tensor* zero_int_tensor  = nullptr;
 
-    std::map<ggml_tensor*, const void*> backend_tensor_data_map;
-    std::map<std::string, ggml_tensor*> cache_tensor_map;  // name -> tensor
+    std::unordered_map<ggml_tensor*, const void*> backend_tensor_data_map;
+    std::unordered_map<std::string, ggml_tensor*> cache_tensor_map;  // name -> tensor
     std::vector<std::pair<ggml_tensor*, std::string>> debug_tensors;
+
+    // Shape-only tables (RoPE frequencies), most recently used first.
+    struct PositionalTable {
+        std::string key;
+        std::vector<float> data;  // host copy, dropped once resident
+        ggml_context* ctx            = nullptr;
+        ggml_backend_buffer_t buffer = nullptr;
+        ggml_tensor* tensor          = nullptr;
+    };
+    static constexpr size_t MAX_POSITIONAL_TABLES = 4;
+    std::list<PositionalTable> positional_tables;
+
+    // Conditioning inputs uploaded once per request, most recently used first.
+    struct ConstantInput {
+        const void* data = nullptr;
+        std::vector<int64_t> shape;
+        uint64_t fingerprint         = 0;
+        ggml_context* ctx            = nullptr;
+        ggml_backend_buffer_t buffer = nullptr;
+        ggml_tensor* tensor          = nullptr;
+    };
+    static constexpr size_t MAX_CONSTANT_INPUTS = 8;
+    std::list<ConstantInput> constant_inputs;
+
+    // A sampler latent kept on the runtime backend between steps, see
+    // begin_resident_latent.
+    struct ResidentLatent {
+        std::vector<int64_t> shape;
+        ggml_context* ctx            = nullptr;
+        ggml_backend_buffer_t buffer = nullptr;
+        ggml_tensor* tensor          = nullptr;
+        const void* input_data       = nullptr;  // the model input the armed step takes from the latent
+        float input_scale            = 1.f;
+        float keep_scale             = 1.f;
+        float out_scale              = 0.f;
+        bool armed                   = false;  // the next build may read the latent
+        bool must_step               = false;  // input_data is stale, so only a fused build may run
+        bool consumed                = false;  // the build read it in place of input_data
+        bool fused                   = false;  // the build writes the step into it
+        bool stepped                 = false;  // the last compute updated it
+        bool step_skipped            = false;  // the last compute was not run, see must_step
+    };
+    ResidentLatent resident_latent_;
+
     const std::string final_result_name = "ggml_runner_final_result_tensor";
 
     bool flash_attn_enabled    = false;
     bool conv2d_direct_enabled = false;
+    bool conv_f32_enabled      = false;
     bool circular_x_enabled    = false;
     bool circular_y_enabled    = false;
 
     sd::ggml_graph_cut::PlanCache graph_cut_plan_cache_;
     std::unordered_set<const ggml_tensor*> params_tensor_set_;
 
+    // Extra backends for pipeline parallel compute. Each runs a contiguous
+    // range of graph-cut segments with its own copy of that range's params, so
+    // only the activations at the cuts move between backends.
+    struct PipelineStage {
+        ggml_backend_t backend = nullptr;
+        std::vector<ggml_context*> params_ctxs;                // one per load
+        std::unordered_map<std::string, ggml_tensor*> params;  // by param name
+    };
+    using PipelineParamsLoader = std::function<bool(ggml_backend_t backend, std::map<std::string, ggml_tensor*> tensors)>;
+    std::vector<PipelineStage> pipeline_stages_;
+    PipelineParamsLoader load_pipeline_params_;
+    bool pipeline_enabled_ = true;
+
+    // Tensor parallel compute: the matmul weights of whole-graph computes
+    // are held a second time in a split buffer type, whose rows the backend
+    // spreads over several devices and whose results it gathers on this
+    // runner's device.
+    ggml_backend_buffer_type_t tensor_split_buft_ = nullptr;
+    bool tensor_split_enabled_                    = true;
+    std::vector<ggml_context*> tensor_split_ctxs_;
+    std::vector<ggml_backend_buffer_t> tensor_split_buffers_;
+    std::unordered_map<const ggml_tensor*, ggml_tensor*> tensor_split_copies_;  // param -> split copy
+
+    // Last graph built with a GraphReuse; it lives in compute_ctx and keeps
+    // the tensor addresses compute_allocr gave it.
+    ggml_cgraph* reusable_graph_ = nullptr;
+    std::string reusable_graph_key_;
+    size_t reusable_graph_input_count_ = 0;
+    std::unordered_map<ggml_tensor*, const void*> reusable_graph_data_;
+    std::vector<std::pair<ggml_tensor*, size_t>> reusable_graph_inputs_;  // tensor, index into GraphReuse::inputs
+    std::vector<ggml_tensor*> reusable_graph_params_;                     // its param leafs, collected once
+    bool reusable_graph_params_valid_ = false;
+
     template <typename T>
     static sd::Tensor<T> take_or_empty(std::optional<sd::Tensor<T>> tensor) {
         if (!tensor.has_value()) {
@@ -1779,15 +2301,40 @@ protected:
 
         params_ctx = ggml_init(params);
         GGML_ASSERT(params_ctx != nullptr);
+        invalidate_reusable_graph();
         params_tensor_set_.clear();
         params_tensor_set_dirty_ = true;
     }
 
+    void free_pipeline_stages() {
+        for (PipelineStage& stage : pipeline_stages_) {
+            for (ggml_context* ctx : stage.params_ctxs) {
+                ggml_free(ctx);
+            }
+        }
+        pipeline_stages_.clear();
+    }
+
+    void free_tensor_split_copies() {
+        for (ggml_backend_buffer_t buffer : tensor_split_buffers_) {
+            sd_perf::untrace_buffer(buffer);
+            ggml_backend_buffer_free(buffer);
+        }
+        for (ggml_context* ctx : tensor_split_ctxs_) {
+            ggml_free(ctx);
+        }
+        tensor_split_buffers_.clear();
+        tensor_split_ctxs_.clear();
+        tensor_split_copies_.clear();
+    }
+
     void free_params_ctx() {
+        free_tensor_split_copies();
         if (params_ctx != nullptr) {
             ggml_free(params_ctx);
             params_ctx = nullptr;
         }
+        invalidate_reusable_graph();
         params_tensor_set_.clear();
         params_tensor_set_dirty_ = true;
     }
@@ -1820,6 +2367,7 @@ protected:
     }
 
     void free_compute_ctx() {
+        invalidate_reusable_graph();
         debug_tensors.clear();
         if (compute_ctx != nullptr) {
             ggml_free(compute_ctx);
@@ -1843,6 +2391,10 @@ protected:
     }
 
     std::vector<ggml_tensor*> collect_used_param_tensors(ggml_cgraph* gf) {
+        // a kept graph has the same leafs every step
+        if (gf != nullptr && gf == reusable_graph_ && reusable_graph_params_valid_) {
+            return reusable_graph_params_;
+        }
         std::vector<ggml_tensor*> used_params;
         rebuild_params_tensor_set();
         if (gf == nullptr || params_tensor_set_.empty()) {
@@ -1864,6 +2416,10 @@ protected:
                 used_params.push_back(param_leaf);
             }
         }
+        if (gf == reusable_graph_) {
+            reusable_graph_params_       = used_params;
+            reusable_graph_params_valid_ = true;
+        }
         return used_params;
     }
 
@@ -1897,6 +2453,11 @@ protected:
             LOG_ERROR("%s prepare graph weights failed", get_desc().c_str());
             return false;
         }
+        if (on_params_prepared_) {
+            std::function<void()> on_prepared = std::move(on_params_prepared_);
+            on_params_prepared_               = nullptr;
+            on_prepared();
+        }
         for (ggml_tensor* param : params_to_prepare) {
             if (param == nullptr) {
                 continue;
@@ -1952,10 +2513,16 @@ protected:
 
     ggml_cgraph* get_compute_graph(get_graph_cb_t get_graph) {
         prepare_build_in_tensor_before();
-        ggml_cgraph* gf = get_graph();
+        resident_latent_.consumed = false;
+        resident_latent_.fused    = false;
+        ggml_cgraph* gf           = get_graph();
+        resident_latent_.armed    = false;
         if (ggml_graph_n_nodes(gf) > 0) {
             auto result = ggml_graph_node(gf, -1);
             ggml_set_name(result, final_result_name.c_str());
+            if (resident_latent_.consumed) {
+                fuse_resident_latent_step(gf, result);
+            }
         }
         for (const auto& entry : debug_tensors) {
             if (entry.first != nullptr) {
@@ -1971,6 +2538,22 @@ protected:
         return gf;
     }
 
+    // x = keep_scale * x + out_scale * result, written back into the latent
+    // by the graph's last node. Outputs not shaped like the latent are read
+    // back as usual.
+    void fuse_resident_latent_step(ggml_cgraph* gf, ggml_tensor* result) {
+        ResidentLatent& latent = resident_latent_;
+        if (result->type != GGML_TYPE_F32 || !ggml_is_contiguous(result) ||
+            !ggml_are_same_shape(result, latent.tensor) || ggml_graph_n_nodes(gf) + 4 > ggml_graph_size(gf)) {
+            return;
+        }
+        ggml_tensor* x = ggml_add(compute_ctx,
+                                  ggml_scale(compute_ctx, latent.tensor, latent.keep_scale),
+                                  ggml_scale(compute_ctx, result, latent.out_scale));
+        ggml_build_forward_expand(gf, ggml_cpy(compute_ctx, x, latent.tensor));
+        latent.fused = true;
+    }
+
     bool prepare_compute_graph(get_graph_cb_t get_graph,
                                ggml_cgraph** gf_out) {
         GGML_ASSERT(gf_out != nullptr);
@@ -1986,30 +2569,130 @@ protected:
         return true;
     }
 
-    bool alloc_compute_buffer(ggml_cgraph* gf) {
-        if (compute_allocr != nullptr) {
-            return true;
+    void invalidate_reusable_graph() {
+        reusable_graph_             = nullptr;
+        reusable_graph_input_count_ = 0;
+        reusable_graph_key_.clear();
+        reusable_graph_data_.clear();
+        reusable_graph_inputs_.clear();
+        reusable_graph_params_.clear();
+        reusable_graph_params_valid_ = false;
+    }
+
+    // Returns the kept graph with the new inputs bound when `reuse` matches it.
+    ggml_cgraph* find_reusable_graph(const GraphReuse* reuse) {
+        if (reuse == nullptr || reusable_graph_ == nullptr || compute_allocr == nullptr ||
+            reuse->key != reusable_graph_key_ || reuse->inputs.size() != reusable_graph_input_count_) {
+            return nullptr;
         }
-        compute_allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(runtime_backend));
+        backend_tensor_data_map = reusable_graph_data_;
+        for (const auto& input : reusable_graph_inputs_) {
+            backend_tensor_data_map[input.first] = reuse->inputs[input.second];
+        }
+        return reusable_graph_;
+    }
 
+    void keep_reusable_graph(ggml_cgraph* gf, const GraphReuse* reuse) {
+        // Runtime LoRAs bake multipliers into the graph, graph cuts rewrite it
+        // per segment and cache/debug tensors are collected per build.
+        if (reuse == nullptr || weight_adapter != nullptr || can_attempt_graph_cut_segmented_compute() ||
+            !cache_tensor_map.empty() || !debug_tensors.empty() || resident_latent_.fused) {
+            return;
+        }
+        std::unordered_map<const void*, size_t> input_index;
+        for (size_t i = 0; i < reuse->inputs.size(); i++) {
+            if (reuse->inputs[i] != nullptr && !input_index.emplace(reuse->inputs[i], i).second) {
+                return;
+            }
+        }
+        std::vector<std::pair<ggml_tensor*, size_t>> inputs;
+        std::unordered_set<size_t> bound;
+        for (const auto& kv : backend_tensor_data_map) {
+            auto it = input_index.find(kv.second);
+            if (it != input_index.end()) {
+                inputs.push_back({kv.first, it->second});
+                bound.insert(it->second);
+            }
+        }
+        if (bound.size() != input_index.size()) {
+            // an input was copied before binding, so its new data would be missed
+            return;
+        }
+        reusable_graph_             = gf;
+        reusable_graph_key_         = reuse->key;
+        reusable_graph_input_count_ = reuse->inputs.size();
+        reusable_graph_data_        = backend_tensor_data_map;
+        reusable_graph_inputs_      = std::move(inputs);
+    }
+
+    bool reserve_compute_buffer(ggml_cgraph* gf) {
+        ggml_backend_buffer_type_t compute_buft = ggml_backend_get_default_buffer_type(runtime_backend);
+        if (auto manager = weight_manager.lock()) {
+            std::shared_ptr<sd::ComputeArena> arena = manager->compute_arena(compute_buft);
+            if (arena != nullptr) {
+                compute_allocr = arena->lease(this);
+                if (compute_allocr != nullptr) {
+                    compute_arena_ = std::move(arena);
+                }
+            }
+        }
+        if (compute_allocr == nullptr) {
+            compute_allocr = ggml_gallocr_new(compute_buft);
+        }
         if (!ggml_gallocr_reserve(compute_allocr, gf)) {
-            // failed to allocate the compute buffer
-            LOG_ERROR("%s: failed to allocate the compute buffer\n", get_desc().c_str());
             free_compute_buffer();
             return false;
         }
+        trace_compute_buffer();
+        return true;
+    }
+
+    void trace_compute_buffer() {
+        sd_perf::trace_buffer(compute_allocr,
+                              sd_perf::BufferKind::COMPUTE,
+                              get_desc(),
+                              ggml_backend_get_default_buffer_type(runtime_backend),
+                              ggml_gallocr_get_buffer_size(compute_allocr, 0));
+    }
+
+    bool alloc_compute_buffer(ggml_cgraph* gf) {
+        if (compute_allocr != nullptr) {
+            return true;
+        }
+
+        if (!reserve_compute_buffer(gf)) {
+            // First rung of the out of memory ladder: buffers the weight
+            // manager only keeps to save time are dropped and the reserve is
+            // tried once more. compute() takes the next rung.
+            size_t released = 0;
+            if (auto manager = weight_manager.lock()) {
+                released = manager->release_idle_memory();
+            }
+            if (released == 0 || !reserve_compute_buffer(gf)) {
+                LOG_ERROR("%s: failed to allocate the compute buffer\n", get_desc().c_str());
+                compute_out_of_memory_ = true;
+                return false;
+            }
+            sd_report_degradation(SD_DEGRADATION_RELEASED_BUFFERS,
+                                  get_desc().c_str(),
+                                  sd_format("released %.2f MB of idle buffers to fit the compute buffer",
+                                            released / (1024.0 * 1024.0))
+                                      .c_str());
+        }
 
         // compute the required memory
         size_t compute_buffer_size = ggml_gallocr_get_buffer_size(compute_allocr, 0);
-        LOG_DEBUG("%s compute buffer size: %.2f MB(%s)",
+        LOG_DEBUG("%s compute buffer size: %.2f MB(%s%s)",
                   get_desc().c_str(),
                   compute_buffer_size / 1024.0 / 1024.0,
-                  sd_backend_is_cpu(runtime_backend) ? "RAM" : "VRAM");
+                  sd_backend_is_cpu(runtime_backend) ? "RAM" : "VRAM",
+                  compute_arena_ != nullptr ? ", shared" : "");
         return true;
     }
 
     void free_cache_buffer() {
         if (cache_buffer != nullptr) {
+            sd_perf::untrace_buffer(cache_buffer);
             ggml_backend_buffer_free(cache_buffer);
             cache_buffer = nullptr;
         }
@@ -2042,6 +2725,7 @@ protected:
         cache_tensor_map.clear();
         if (merged_cache_sources.empty()) {
             if (old_cache_buffer != nullptr) {
+                sd_perf::untrace_buffer(old_cache_buffer);
                 ggml_backend_buffer_free(old_cache_buffer);
             }
             if (old_cache_ctx != nullptr) {
@@ -2062,6 +2746,7 @@ protected:
         size_t num_tensors = ggml_tensor_num(cache_ctx);
         cache_buffer       = ggml_backend_alloc_ctx_tensors(cache_ctx, runtime_backend);
         GGML_ASSERT(cache_buffer != nullptr);
+        sd_perf::trace_buffer(cache_buffer, sd_perf::BufferKind::CACHE, get_desc());
         for (const auto& kv : source_to_cache_tensors) {
             ggml_tensor* src              = kv.first;
             ggml_tensor* dst              = kv.second;
@@ -2098,6 +2783,7 @@ protected:
                   sd_backend_is_cpu(runtime_backend) ? "RAM" : "VRAM",
                   num_tensors);
         if (old_cache_buffer != nullptr) {
+            sd_perf::untrace_buffer(old_cache_buffer);
             ggml_backend_buffer_free(old_cache_buffer);
         }
         if (old_cache_ctx != nullptr) {
@@ -2200,16 +2886,26 @@ protected:
     bool should_use_graph_cut_segmented_compute(const GraphCutPlan& plan) {
         return plan.has_cuts &&
                plan.valid &&
-               max_graph_vram_bytes > 0 &&
+               (max_graph_vram_bytes > 0 || pipeline_active()) &&
                plan.segments.size() > 1 &&
                !sd_backend_is_cpu(runtime_backend);
     }
 
     bool can_attempt_graph_cut_segmented_compute() const {
-        return max_graph_vram_bytes > 0 &&
+        return (max_graph_vram_bytes > 0 || pipeline_active()) &&
                !sd_backend_is_cpu(runtime_backend);
     }
 
+    // Runtime LoRAs patch the graph with weights only this backend holds.
+    bool pipeline_active() const {
+        return pipeline_enabled_ && !pipeline_stages_.empty() && weight_adapter == nullptr;
+    }
+
+    bool host_execution_active() const {
+        return host_backend_ != nullptr && !host_params_refused_ && stream_layers_enabled &&
+               weight_adapter == nullptr && !pipeline_active();
+    }
+
     bool resolve_graph_cut_plan(ggml_cgraph* gf,
                                 GraphCutPlan* plan_out,
                                 size_t* effective_budget_out = nullptr) {
@@ -2251,16 +2947,24 @@ protected:
         // When streaming and the model dwarfs the budget, cap the planner at
         // a quarter so it builds smaller merged segments and chunk-K can fit
         // alongside. Without streaming the cap only adds dispatch overhead.
-        size_t planner_budget = effective_budget;
-        if (stream_layers_enabled) {
-            size_t total_params_bytes = 0;
+        size_t planner_budget     = effective_budget;
+        size_t total_params_bytes = 0;
+        if (stream_layers_enabled || pipeline_active()) {
             for (const ggml_tensor* t : params_tensor_set_) {
                 if (t != nullptr) {
                     total_params_bytes += ggml_nbytes(t);
                 }
             }
-            if (total_params_bytes * 4 > effective_budget * 3) {
-                planner_budget = effective_budget / 4;
+        }
+        if (stream_layers_enabled && total_params_bytes * 4 > effective_budget * 3) {
+            planner_budget = effective_budget / 4;
+        }
+        if (pipeline_active()) {
+            // at least one segment per stage, so the stages can split the params
+            const std::vector<double> shares = pipeline_stage_shares();
+            size_t stage_budget              = static_cast<size_t>(total_params_bytes * *std::min_element(shares.begin(), shares.end()));
+            if (stage_budget > 0 && (planner_budget == 0 || stage_budget < planner_budget)) {
+                planner_budget = stage_budget;
             }
         }
 
@@ -2271,7 +2975,31 @@ protected:
                                                      params_tensor_set_,
                                                      get_desc().c_str());
         if (stream_layers_enabled) {
-            sd::ggml_graph_cut::annotate_residency(*plan_out, effective_budget);
+            const bool measured = segment_usage_computes_ >= SEGMENT_USAGE_WARMUP_COMPUTES;
+            sd::ggml_graph_cut::annotate_residency(*plan_out, effective_budget, measured ? &segment_usage_ : nullptr);
+            update_resident_segment_groups(gf, *plan_out, measured);
+        }
+        if (host_execution_active()) {
+            sd::ggml_graph_cut::HostExecutionRates rates = host_execution_rates_;
+            if (measured_upload_gbps_ > 0.0) {
+                rates.upload_gbps = measured_upload_gbps_;
+            }
+            const size_t n_host = sd::ggml_graph_cut::annotate_host_execution(gf, *plan_out, rates);
+            if (n_host != host_segment_count_) {
+                LOG_INFO("%s computes %zu of %zu segments on %s at %.1f GB/s upload",
+                         get_desc().c_str(),
+                         n_host,
+                         plan_out->segments.size(),
+                         ggml_backend_name(host_backend_),
+                         rates.upload_gbps);
+                host_segment_count_ = n_host;
+            }
+        }
+        if (pipeline_active() && max_graph_vram_bytes == 0) {
+            // cut only for the pipeline: the params of this backend's range stay staged
+            for (GraphCutSegment& segment : plan_out->segments) {
+                segment.residency = sd::ggml_graph_cut::SegmentResidency::RESIDENT;
+            }
         }
         if (stream_layers_enabled) {
             if (budget_increased) {
@@ -2405,6 +3133,142 @@ protected:
         return true;
     }
 
+    bool tensor_split_active() const {
+        return tensor_split_buft_ != nullptr && tensor_split_enabled_ && weight_adapter == nullptr;
+    }
+
+    // Params of `gf` that the split buffer can hold: 2D contiguous weights
+    // used only as the first operand of matmuls. Small ones stay on this
+    // device, where splitting would cost more in syncs than it saves.
+    std::vector<ggml_tensor*> tensor_split_candidates(ggml_cgraph* gf) const {
+        static const size_t TENSOR_SPLIT_MIN_BYTES = 1024 * 1024;
+        std::unordered_map<ggml_tensor*, bool> usable;
+        std::vector<ggml_tensor*> order;
+        const int n_nodes = ggml_graph_n_nodes(gf);
+        for (int i = 0; i < n_nodes; ++i) {
+            ggml_tensor* node = ggml_graph_node(gf, i);
+            for (int j = 0; j < GGML_MAX_SRC; ++j) {
+                ggml_tensor* src = node->src[j];
+                if (src == nullptr || params_tensor_set_.find(src) == params_tensor_set_.end()) {
+                    continue;
+                }
+                bool ok = node->op == GGML_OP_MUL_MAT && j == 0 &&
+                          ggml_n_dims(src) == 2 && ggml_is_contiguous(src) &&
+                          ggml_nbytes(src) >= TENSOR_SPLIT_MIN_BYTES;
+                auto it = usable.find(src);
+                if (it == usable.end()) {
+                    usable[src] = ok;
+                    order.push_back(src);
+                } else if (!ok) {
+                    it->second = false;
+                }
+            }
+        }
+        std::vector<ggml_tensor*> candidates;
+        for (ggml_tensor* param : order) {
+            if (usable[param]) {
+                candidates.push_back(param);
+            }
+        }
+        return candidates;
+    }
+
+    // Copies the params that have no split copy yet into a new split buffer.
+    // They must already hold their data; a failed allocation turns the split
+    // off for this runner.
+    bool load_tensor_split_copies(const std::vector<ggml_tensor*>& params) {
+        std::vector<ggml_tensor*> missing;
+        for (ggml_tensor* param : params) {
+            if (tensor_split_copies_.find(param) == tensor_split_copies_.end()) {
+                missing.push_back(param);
+            }
+        }
+        if (missing.empty()) {
+            return true;
+        }
+        ggml_init_params params_init;
+        params_init.mem_size   = missing.size() * ggml_tensor_overhead();
+        params_init.mem_buffer = nullptr;
+        params_init.no_alloc   = true;
+        ggml_context* ctx      = ggml_init(params_init);
+        GGML_ASSERT(ctx != nullptr);
+        std::vector<ggml_tensor*> copies;
+        for (ggml_tensor* param : missing) {
+            copies.push_back(ggml_dup_tensor(ctx, param));
+        }
+        ggml_backend_buffer_t buffer = ggml_backend_alloc_ctx_tensors_from_buft(ctx, tensor_split_buft_);
+        if (buffer == nullptr) {
+            LOG_WARN("%s alloc tensor split buffer failed, computing on %s only",
+                     get_desc().c_str(),
+                     ggml_backend_name(runtime_backend));
+            ggml_free(ctx);
+            tensor_split_buft_ = nullptr;
+            return false;
+        }
+        ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+        sd_perf::trace_buffer(buffer, sd_perf::BufferKind::PARAMS, get_desc());
+        std::vector<uint8_t> host_data;
+        size_t bytes = 0;
+        for (size_t i = 0; i < missing.size(); ++i) {
+            host_data.resize(ggml_nbytes(missing[i]));
+            ggml_backend_tensor_get(missing[i], host_data.data(), 0, host_data.size());
+            ggml_backend_tensor_set(copies[i], host_data.data(), 0, host_data.size());
+            tensor_split_copies_[missing[i]] = copies[i];
+            bytes += host_data.size();
+        }
+        tensor_split_ctxs_.push_back(ctx);
+        tensor_split_buffers_.push_back(buffer);
+        LOG_INFO("%s split %zu matmul weights (%.2f MB) over %s",
+                 get_desc().c_str(),
+                 missing.size(),
+                 bytes / (1024.0 * 1024.0),
+                 ggml_backend_buft_name(tensor_split_buft_));
+        return true;
+    }
+
+    // With a profiler, runs gf one op at a time, each with the view ops
+    // feeding it, and waits for the backend after each so the op's span
+    // covers its own kernels only.
+    ggml_status compute_backend_graph(ggml_backend_t backend, ggml_cgraph* gf, sd_perf::OpProfiler* profiler) {
+        if (profiler == nullptr) {
+            return ggml_backend_graph_compute(backend, gf);
+        }
+        const std::string desc  = get_desc();
+        const int n_nodes       = ggml_graph_n_nodes(gf);
+        ggml_init_params params = {
+            /*.mem_size   =*/ggml_graph_overhead_custom(n_nodes, false) + 1024,
+            /*.mem_buffer =*/nullptr,
+            /*.no_alloc   =*/true,
+        };
+        ggml_context* run_ctx = ggml_init(params);
+        GGML_ASSERT(run_ctx != nullptr);
+        ggml_cgraph* run = ggml_new_graph_custom(run_ctx, n_nodes, false);
+        std::string block;
+        ggml_status status = GGML_STATUS_SUCCESS;
+        for (int i = 0; i < n_nodes && status == GGML_STATUS_SUCCESS; ++i) {
+            ggml_tensor* node = ggml_graph_node(gf, i);
+            ggml_graph_add_node(run, node);
+            if (sd_perf::is_view_op(node) && i + 1 < n_nodes) {
+                continue;
+            }
+            int64_t start_us = ggml_time_us();
+            status           = ggml_backend_graph_compute(backend, run);
+            ggml_backend_synchronize(backend);
+            ggml_graph_clear(run);
+            if (status != GGML_STATUS_SUCCESS) {
+                break;
+            }
+            // ops reading no weight belong to the block of the op before them
+            std::string node_block = sd_perf::op_block_name(node);
+            if (!node_block.empty()) {
+                block = std::move(node_block);
+            }
+            profiler->add_op(desc, profile_segment_, node, block, start_us, ggml_time_us());
+        }
+        ggml_free(run_ctx);
+        return status;
+    }
+
     template <typename T>
     std::optional<sd::Tensor<T>> execute_graph(ggml_cgraph* gf,
                                                int n_threads,
@@ -2413,11 +3277,33 @@ protected:
                                                bool preserve_backend_tensor_data_map,
                                                bool no_return                                          = false,
                                                const std::unordered_set<std::string>* cache_keep_names = nullptr) {
+        sd_perf::PerfRecorder* perf   = sd_perf::current_recorder();
+        sd_perf::OpProfiler* profiler = sd_perf::current_op_profiler();
+        uint64_t loaded_bytes_start   = sd_perf::thread_loaded_bytes();
+        uint64_t uploaded_bytes_start = sd_perf::thread_uploaded_bytes();
+        int64_t weights_start_us      = ggml_time_us();
+
         std::vector<ggml_tensor*> graph_param_tensors;
         std::vector<ggml_tensor*> params_to_prepare;
         if (!prepare_execute_graph_weights(gf, graph_param_tensors, params_to_prepare, !free_compute_params)) {
             return std::nullopt;
         }
+        uint64_t prepared_bytes = sd_perf::thread_loaded_bytes() - loaded_bytes_start +
+                                  sd_perf::thread_uploaded_bytes() - uploaded_bytes_start;
+        if (perf != nullptr) {
+            sd_perf::RunnerStats& stats = perf->runner(get_desc());
+            stats.loaded_bytes += sd_perf::thread_loaded_bytes() - loaded_bytes_start;
+            stats.uploaded_bytes += sd_perf::thread_uploaded_bytes() - uploaded_bytes_start;
+        }
+        if (profiler != nullptr && prepared_bytes > 0) {
+            profiler->add_transfer(get_desc(),
+                                   profile_segment_,
+                                   "params",
+                                   prepared_bytes,
+                                   sd_perf::OpProfiler::COMPUTE_TRACK,
+                                   weights_start_us,
+                                   ggml_time_us());
+        }
         struct GraphWeightDoneGuard {
             GraphWeightDoneGuard(GGMLRunner* runner, const std::vector<ggml_tensor*>* tensors)
                 : runner(runner),
@@ -2440,6 +3326,39 @@ protected:
         };
         GraphWeightDoneGuard graph_weight_done_guard(this, &params_to_prepare);
 
+        // Whole-graph computes only: graph-cut segments keep streaming their
+        // params within the VRAM budget.
+        struct TensorSplitBindings {
+            struct Saved {
+                ggml_tensor* tensor;
+                ggml_backend_buffer_t buffer;
+                void* data;
+                void* extra;
+            };
+            std::vector<Saved> saved;
+
+            ~TensorSplitBindings() {
+                for (const Saved& s : saved) {
+                    s.tensor->buffer = s.buffer;
+                    s.tensor->data   = s.data;
+                    s.tensor->extra  = s.extra;
+                }
+            }
+        } tensor_split_bindings;
+        if (cache_keep_names == nullptr && tensor_split_active()) {
+            std::vector<ggml_tensor*> split_params = tensor_split_candidates(gf);
+            if (load_tensor_split_copies(split_params)) {
+                for (ggml_tensor* param : split_params) {
+                    ggml_tensor* copy = tensor_split_copies_[param];
+                    tensor_split_bindings.saved.push_back({param, param->buffer, param->data, param->extra});
+                    param->buffer = copy->buffer;
+                    param->data   = copy->data;
+                    param->extra  = copy->extra;
+                }
+            }
+        }
+
+        int64_t alloc_start_us = ggml_time_us();
         if (!alloc_compute_buffer(gf)) {
             LOG_ERROR("%s alloc compute buffer failed", get_desc().c_str());
             return std::nullopt;
@@ -2465,19 +3384,33 @@ protected:
 
         if (!ggml_gallocr_alloc_graph(compute_allocr, gf)) {
             LOG_ERROR("%s alloc compute graph failed", get_desc().c_str());
+            compute_out_of_memory_ = true;
             return std::nullopt;
         }
+        trace_compute_buffer();
+        int64_t alloc_end_us = ggml_time_us();
 
         copy_data_to_backend_tensor(gf, !preserve_backend_tensor_data_map);
+        if (profiler != nullptr) {
+            profiler->add_transfer(get_desc(), profile_segment_, "inputs", 0, sd_perf::OpProfiler::COMPUTE_TRACK, alloc_end_us, ggml_time_us());
+        }
         if (sd_backend_is_cpu(runtime_backend)) {
             sd_backend_cpu_set_n_threads(runtime_backend, n_threads);
         }
 
-        ggml_status status = ggml_backend_graph_compute(runtime_backend, gf);
+        int64_t compute_start_us = ggml_time_us();
+        ggml_status status       = compute_backend_graph(runtime_backend, gf, profiler);
         if (status != GGML_STATUS_SUCCESS) {
             LOG_ERROR("%s compute failed: %s", get_desc().c_str(), ggml_status_to_string(status));
             return std::nullopt;
         }
+        if (perf != nullptr) {
+            sd_perf::RunnerStats& stats = perf->runner(get_desc());
+            stats.alloc_ms += (alloc_end_us - alloc_start_us) / 1000.0;
+            stats.compute_ms += (ggml_time_us() - compute_start_us) / 1000.0;
+            stats.peak_compute_buffer_bytes = std::max(stats.peak_compute_buffer_bytes,
+                                                       ggml_gallocr_get_buffer_size(compute_allocr, 0));
+        }
 
         if (!debug_tensors.empty()) {
             std::unordered_set<const ggml_tensor*> debug_graph_tensor_set;
@@ -2523,11 +3456,23 @@ protected:
         }
         auto result = ggml_get_tensor(compute_ctx, final_result_name.c_str());
         std::optional<sd::Tensor<T>> output;
-        if (!no_return) {
-            output = read_graph_tensor<T>(result, "output");
+        // a fused sampler step leaves its result in the resident latent
+        resident_latent_.stepped = resident_latent_.fused;
+        if (!no_return && !resident_latent_.fused) {
+            int64_t read_start_us = ggml_time_us();
+            output                = read_graph_tensor<T>(result, "output");
             if (!output.has_value()) {
                 return std::nullopt;
             }
+            if (profiler != nullptr) {
+                profiler->add_transfer(get_desc(),
+                                       profile_segment_,
+                                       "output",
+                                       ggml_nbytes(result),
+                                       sd_perf::OpProfiler::COMPUTE_TRACK,
+                                       read_start_us,
+                                       ggml_time_us());
+            }
         } else {
             output = sd::Tensor<T>();
         }
@@ -2544,24 +3489,536 @@ protected:
         return output;
     }
 
-    template <typename T>
-    std::optional<sd::Tensor<T>> compute_graph_cut_segments(ggml_cgraph* gf,
-                                                            const GraphCutPlan& plan,
-                                                            int n_threads,
-                                                            bool log_residency,
-                                                            bool no_return = false) {
-        GGML_ASSERT(gf != nullptr);
-
-        free_compute_buffer();
-        free_cache_ctx_and_buffer();
-
+    // Params of `segment` that execute_graph will hand to prepare_params.
+    std::vector<ggml_tensor*> collect_segment_prefetch_params(ggml_cgraph* gf, const GraphCutSegment& segment) {
+        const bool keep_segment_params = segment.residency == sd::ggml_graph_cut::SegmentResidency::RESIDENT;
+        std::vector<ggml_tensor*> tensors;
+        for (ggml_tensor* tensor : sd::ggml_graph_cut::param_tensors(gf, segment)) {
+            if (params_tensor_set_.find(tensor) == params_tensor_set_.end()) {
+                tensor = tensor->view_src;
+            }
+            if (tensor == nullptr || params_tensor_set_.find(tensor) == params_tensor_set_.end()) {
+                continue;
+            }
+            if (keep_segment_params &&
+                kept_compute_param_tensor_set.find(tensor) != kept_compute_param_tensor_set.end()) {
+                continue;
+            }
+            tensors.push_back(tensor);
+        }
+        return tensors;
+    }
+
+    struct SegmentTiming {
+        double upload_ms        = 0.0;  // time the prefetch worker spent loading/staging params
+        double wait_ms          = 0.0;  // time compute waited for that prefetch to finish
+        double compute_ms       = 0.0;  // prepare + compute of the segment on this thread
+        uint64_t prefetch_bytes = 0;    // bytes the prefetch worker loaded/staged
+        uint64_t compute_bytes  = 0;    // bytes loaded/staged on demand by this thread
+    };
+
+    void record_segment_timeline(const GraphCutPlan& plan, const std::vector<SegmentTiming>& timings) {
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+        if (perf == nullptr) {
+            return;
+        }
+        const std::string desc      = get_desc();
+        sd_perf::RunnerStats& stats = perf->runner(desc);
+        stats.graph_cut_segments += static_cast<int>(timings.size());
+        for (size_t i = 0; i < timings.size(); ++i) {
+            // compute_bytes already went into the runner totals via execute_graph
+            stats.uploaded_bytes += timings[i].prefetch_bytes;
+            perf->add_segment(desc,
+                              static_cast<int>(i),
+                              plan.segments[i].group_name,
+                              timings[i].prefetch_bytes + timings[i].compute_bytes,
+                              timings[i].upload_ms,
+                              timings[i].wait_ms,
+                              timings[i].compute_ms);
+        }
+    }
+
+    // Params loaded on demand hold compute up for their whole transfer, at the
+    // rate the prefetches reached (10 GB/s without any). Resident and host
+    // segments are counted at what streaming their params would take, so
+    // they keep their place unless others cost more.
+    void record_segment_usage(const GraphCutPlan& plan, const std::vector<SegmentTiming>& timings) {
+        if (segment_usage_computes_ >= SEGMENT_USAGE_WARMUP_COMPUTES) {
+            return;
+        }
+        double prefetch_bytes = 0.0;
+        double upload_ms      = 0.0;
+        for (const SegmentTiming& timing : timings) {
+            prefetch_bytes += timing.prefetch_bytes;
+            upload_ms += timing.upload_ms;
+        }
+        const double bytes_per_ms = prefetch_bytes > 0.0 && upload_ms > 0.0 ? prefetch_bytes / upload_ms : 1e7;
+        if (prefetch_bytes > 0.0 && upload_ms > 0.0) {
+            measured_upload_gbps_ = bytes_per_ms / 1e6;
+        }
+        for (size_t i = 0; i < timings.size(); ++i) {
+            const GraphCutSegment& segment          = plan.segments[i];
+            sd::ggml_graph_cut::SegmentUsage& usage = segment_usage_[segment.group_name];
+            usage.runs++;
+            if (segment.residency != sd::ggml_graph_cut::SegmentResidency::STREAMED) {
+                usage.transfer_ms += segment.input_param_bytes / bytes_per_ms;
+            } else {
+                usage.transfer_ms += timings[i].wait_ms + timings[i].compute_bytes / bytes_per_ms;
+            }
+        }
+        segment_usage_computes_++;
+    }
+
+    // Releases the kept params of segments that stopped being resident before
+    // the newly resident ones load, so both sets are never on the device.
+    void update_resident_segment_groups(ggml_cgraph* gf, const GraphCutPlan& plan, bool measured) {
+        std::vector<ggml_tensor*> released;
+        size_t n_resident = 0;
+        bool changed      = false;
+        for (const GraphCutSegment& segment : plan.segments) {
+            if (segment.residency == sd::ggml_graph_cut::SegmentResidency::RESIDENT) {
+                changed |= resident_segment_groups_.insert(segment.group_name).second;
+                n_resident++;
+                continue;
+            }
+            if (resident_segment_groups_.erase(segment.group_name) == 0) {
+                continue;
+            }
+            changed = true;
+            for (ggml_tensor* tensor : collect_segment_prefetch_params(gf, segment)) {
+                if (kept_compute_param_tensor_set.erase(tensor) > 0) {
+                    released.push_back(tensor);
+                }
+            }
+        }
+        free_compute_backend_param_tensors(released);
+        if (measured && changed) {
+            LOG_INFO("%s residency re-planned from %llu measured computes: %zu of %zu segments resident",
+                     get_desc().c_str(),
+                     (unsigned long long)segment_usage_computes_,
+                     n_resident,
+                     plan.segments.size());
+        }
+    }
+
+    void log_segment_timeline(const GraphCutPlan& plan, const std::vector<SegmentTiming>& timings) {
+        double upload_ms  = 0.0;
+        double wait_ms    = 0.0;
+        double compute_ms = 0.0;
+        for (size_t i = 0; i < timings.size(); ++i) {
+            LOG_DEBUG("%s segment %zu/%zu %s: upload %.2fms, waited %.2fms, compute %.2fms",
+                      get_desc().c_str(),
+                      i + 1,
+                      timings.size(),
+                      plan.segments[i].group_name.c_str(),
+                      timings[i].upload_ms,
+                      timings[i].wait_ms,
+                      timings[i].compute_ms);
+            upload_ms += timings[i].upload_ms;
+            wait_ms += timings[i].wait_ms;
+            compute_ms += timings[i].compute_ms;
+        }
+        LOG_DEBUG("%s streamed %zu segments: prefetch upload %.2fs (%.2fs overlapped with compute), compute %.2fs",
+                  get_desc().c_str(),
+                  timings.size(),
+                  upload_ms / 1000.0,
+                  std::max(0.0, upload_ms - wait_ms) / 1000.0,
+                  compute_ms / 1000.0);
+    }
+
+    // Total memory of the device behind `backend`, 0 for CPU and for devices
+    // that do not report it. RPC devices report the memory of the remote one.
+    static size_t pipeline_device_memory(ggml_backend_t backend) {
+        ggml_backend_dev_t dev = backend != nullptr ? ggml_backend_get_device(backend) : nullptr;
+        if (dev == nullptr || ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            return 0;
+        }
+        size_t free_mem  = 0;
+        size_t total_mem = 0;
+        ggml_backend_dev_memory(dev, &free_mem, &total_mem);
+        return total_mem;
+    }
+
+    // Fraction of the params each stage runs, this runner's backend first: in
+    // proportion to device memory when every device reports it, so a smaller
+    // card or remote node gets a smaller range, and equal shares otherwise.
+    std::vector<double> pipeline_stage_shares() const {
+        const size_t n_stages = pipeline_stages_.size() + 1;
+        std::vector<double> shares(n_stages, 1.0 / n_stages);
+        std::vector<size_t> memory(n_stages, 0);
+        size_t total_memory = 0;
+        for (size_t k = 0; k < n_stages; ++k) {
+            memory[k] = pipeline_device_memory(k == 0 ? runtime_backend : pipeline_stages_[k - 1].backend);
+            if (memory[k] == 0) {
+                return shares;
+            }
+            total_memory += memory[k];
+        }
+        for (size_t k = 0; k < n_stages; ++k) {
+            shares[k] = static_cast<double>(memory[k]) / total_memory;
+        }
+        return shares;
+    }
+
+    // Stage of every segment, 0 for this runner's backend: segments go to the
+    // stages in order, in runs of about each stage's share of params bytes.
+    std::vector<size_t> assign_pipeline_stages(const GraphCutPlan& plan) const {
+        std::vector<size_t> segment_stages(plan.segments.size(), 0);
+        size_t total_bytes = 0;
+        for (const GraphCutSegment& segment : plan.segments) {
+            total_bytes += segment.input_param_bytes;
+        }
+        if (total_bytes == 0) {
+            return segment_stages;
+        }
+        const std::vector<double> shares = pipeline_stage_shares();
+        size_t bytes_before              = 0;
+        size_t stage                     = 0;
+        double stage_end                 = shares[0];
+        for (size_t i = 0; i < plan.segments.size(); ++i) {
+            double middle = (bytes_before + plan.segments[i].input_param_bytes / 2.0) / total_bytes;
+            while (middle > stage_end && stage + 1 < shares.size()) {
+                stage++;
+                stage_end += shares[stage];
+            }
+            segment_stages[i] = stage;
+            bytes_before += plan.segments[i].input_param_bytes;
+        }
+        return segment_stages;
+    }
+
+    // Loads the params each stage lacks for the segments assigned to it; a
+    // stage keeps them for every later compute.
+    bool load_pipeline_stage_params(ggml_cgraph* gf,
+                                    const GraphCutPlan& plan,
+                                    const std::vector<size_t>& segment_stages) {
+        std::vector<std::map<std::string, ggml_tensor*>> missing(pipeline_stages_.size());
+        for (size_t i = 0; i < plan.segments.size(); ++i) {
+            if (segment_stages[i] == 0) {
+                continue;
+            }
+            const PipelineStage& stage = pipeline_stages_[segment_stages[i] - 1];
+            for (ggml_tensor* tensor : sd::ggml_graph_cut::param_tensors(gf, plan.segments[i])) {
+                ggml_tensor* param = tensor->view_src != nullptr ? tensor->view_src : tensor;
+                if (stage.params.find(param->name) == stage.params.end()) {
+                    missing[segment_stages[i] - 1][param->name] = param;
+                }
+            }
+        }
+        for (size_t k = 0; k < pipeline_stages_.size(); ++k) {
+            if (missing[k].empty()) {
+                continue;
+            }
+            PipelineStage& stage = pipeline_stages_[k];
+            ggml_init_params params;
+            params.mem_size   = missing[k].size() * ggml_tensor_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            ggml_context* ctx = ggml_init(params);
+            GGML_ASSERT(ctx != nullptr);
+            std::map<std::string, ggml_tensor*> copies;
+            size_t bytes = 0;
+            for (const auto& [name, param] : missing[k]) {
+                copies[name] = ggml_dup_tensor(ctx, param);
+                bytes += ggml_nbytes(param);
+            }
+            if (!load_pipeline_params_ || !load_pipeline_params_(stage.backend, copies)) {
+                LOG_WARN("%s loading pipeline params on %s failed, computing on %s only",
+                         get_desc().c_str(),
+                         ggml_backend_name(stage.backend),
+                         ggml_backend_name(runtime_backend));
+                ggml_free(ctx);
+                return false;
+            }
+            stage.params_ctxs.push_back(ctx);
+            for (const auto& [name, copy] : copies) {
+                stage.params[name] = copy;
+            }
+            LOG_INFO("%s pipeline stage %zu loaded %zu params (%.2f MB) on %s",
+                     get_desc().c_str(),
+                     k + 1,
+                     copies.size(),
+                     bytes / (1024.0 * 1024.0),
+                     ggml_backend_name(stage.backend));
+        }
+        return true;
+    }
+
+    // Runs one segment on another backend, a pipeline stage or the host. Its
+    // params are rebound to the copies in `stage_params` for the duration, or
+    // read in place from host memory without them; any other input held by
+    // another backend is copied over. Cut outputs go to the cache buffer as
+    // with the other segments.
+    template <typename T>
+    std::optional<sd::Tensor<T>> execute_segment_on_backend(ggml_backend_t backend,
+                                                            const std::unordered_map<std::string, ggml_tensor*>* stage_params,
+                                                            ggml_cgraph* gf,
+                                                            const GraphCutSegment& segment,
+                                                            ggml_cgraph* segment_graph,
+                                                            int n_threads,
+                                                            bool no_return,
+                                                            const std::unordered_set<std::string>* cache_keep_names) {
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+
+        struct StageBindings {
+            struct Saved {
+                ggml_tensor* tensor;
+                ggml_tensor* view_src;
+                ggml_backend_buffer_t buffer;
+                void* data;
+                void* extra;
+            };
+            std::vector<Saved> saved;
+            ggml_context* input_ctx            = nullptr;
+            ggml_backend_buffer_t input_buffer = nullptr;
+            ggml_gallocr* allocr               = nullptr;
+
+            void rebind(ggml_tensor* tensor, ggml_tensor* source) {
+                saved.push_back({tensor, tensor->view_src, tensor->buffer, tensor->data, tensor->extra});
+                if (tensor->view_src != nullptr) {
+                    tensor->view_src = source;
+                    tensor->data     = static_cast<char*>(source->data) + tensor->view_offs;
+                } else {
+                    tensor->data = source->data;
+                }
+                tensor->buffer = source->buffer;
+                tensor->extra  = source->extra;
+            }
+
+            ~StageBindings() {
+                for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+                    it->tensor->view_src = it->view_src;
+                    it->tensor->buffer   = it->buffer;
+                    it->tensor->data     = it->data;
+                    it->tensor->extra    = it->extra;
+                }
+                if (allocr != nullptr) {
+                    sd_perf::untrace_buffer(allocr);
+                    ggml_gallocr_free(allocr);
+                }
+                if (input_buffer != nullptr) {
+                    sd_perf::untrace_buffer(input_buffer);
+                    ggml_backend_buffer_free(input_buffer);
+                }
+                if (input_ctx != nullptr) {
+                    ggml_free(input_ctx);
+                }
+            }
+        };
+        StageBindings bindings;
+
+        ggml_backend_buffer_type_t stage_buft = ggml_backend_get_default_buffer_type(backend);
+        std::vector<std::pair<ggml_tensor*, ggml_tensor*>> foreign_inputs;  // input, tensor holding its data
+        for (const auto& input : segment.input_refs) {
+            ggml_tensor* tensor = sd::ggml_graph_cut::input_tensor(gf, input);
+            if (tensor == nullptr) {
+                continue;
+            }
+            ggml_tensor* source = tensor->view_src != nullptr ? tensor->view_src : tensor;
+            if (input.type == GraphCutSegment::INPUT_PARAM) {
+                if (stage_params == nullptr) {
+                    continue;
+                }
+                auto it = stage_params->find(source->name);
+                if (it == stage_params->end()) {
+                    LOG_ERROR("%s pipeline param '%s' is not loaded on %s",
+                              get_desc().c_str(),
+                              source->name,
+                              ggml_backend_name(backend));
+                    return std::nullopt;
+                }
+                bindings.rebind(tensor, it->second);
+                continue;
+            }
+            // unbound inputs are allocated on the stage and set from host data below
+            if (source->buffer != nullptr && ggml_backend_buffer_get_type(source->buffer) != stage_buft) {
+                if (!ggml_is_contiguous(source)) {
+                    LOG_ERROR("%s segment input '%s' is not contiguous", get_desc().c_str(), source->name);
+                    return std::nullopt;
+                }
+                foreign_inputs.push_back({tensor, source});
+            }
+        }
+        if (!foreign_inputs.empty()) {
+            ggml_init_params params;
+            params.mem_size    = foreign_inputs.size() * ggml_tensor_overhead();
+            params.mem_buffer  = nullptr;
+            params.no_alloc    = true;
+            bindings.input_ctx = ggml_init(params);
+            GGML_ASSERT(bindings.input_ctx != nullptr);
+            std::unordered_map<ggml_tensor*, ggml_tensor*> copies;
+            for (const auto& [tensor, source] : foreign_inputs) {
+                if (copies.find(source) == copies.end()) {
+                    copies[source] = ggml_dup_tensor(bindings.input_ctx, source);
+                }
+            }
+            bindings.input_buffer = ggml_backend_alloc_ctx_tensors(bindings.input_ctx, backend);
+            if (bindings.input_buffer == nullptr) {
+                LOG_ERROR("%s alloc segment inputs on %s failed", get_desc().c_str(), ggml_backend_name(backend));
+                return std::nullopt;
+            }
+            sd_perf::trace_buffer(bindings.input_buffer, sd_perf::BufferKind::INPUT, get_desc());
+            for (const auto& [source, copy] : copies) {
+                ggml_backend_tensor_copy(source, copy);
+            }
+            for (const auto& [tensor, source] : foreign_inputs) {
+                bindings.rebind(tensor, copies[source]);
+            }
+        }
+
+        int64_t alloc_start_us = ggml_time_us();
+        bindings.allocr        = ggml_gallocr_new(stage_buft);
+        if (!ggml_gallocr_alloc_graph(bindings.allocr, segment_graph)) {
+            LOG_ERROR("%s alloc segment graph on %s failed", get_desc().c_str(), ggml_backend_name(backend));
+            return std::nullopt;
+        }
+        sd_perf::trace_buffer(bindings.allocr,
+                              sd_perf::BufferKind::COMPUTE,
+                              get_desc(),
+                              stage_buft,
+                              ggml_gallocr_get_buffer_size(bindings.allocr, 0));
+        int64_t alloc_end_us = ggml_time_us();
+
+        copy_data_to_backend_tensor(segment_graph, false);
+        if (sd_backend_is_cpu(backend)) {
+            sd_backend_cpu_set_n_threads(backend, n_threads);
+        }
+        int64_t compute_start_us = ggml_time_us();
+        ggml_status status       = compute_backend_graph(backend, segment_graph, sd_perf::current_op_profiler());
+        if (status != GGML_STATUS_SUCCESS) {
+            LOG_ERROR("%s compute on %s failed: %s",
+                      get_desc().c_str(),
+                      ggml_backend_name(backend),
+                      ggml_status_to_string(status));
+            return std::nullopt;
+        }
+        if (perf != nullptr) {
+            sd_perf::RunnerStats& stats = perf->runner(get_desc());
+            stats.alloc_ms += (alloc_end_us - alloc_start_us) / 1000.0;
+            stats.compute_ms += (ggml_time_us() - compute_start_us) / 1000.0;
+        }
+
+        if (!copy_cache_tensors_to_cache_buffer(cache_keep_names)) {
+            return std::nullopt;
+        }
+        if (no_return) {
+            return sd::Tensor<T>();
+        }
+        return read_graph_tensor<T>(ggml_get_tensor(compute_ctx, final_result_name.c_str()), "output");
+    }
+
+    template <typename T>
+    std::optional<sd::Tensor<T>> compute_graph_cut_segments(ggml_cgraph* gf,
+                                                            const GraphCutPlan& plan,
+                                                            int n_threads,
+                                                            bool log_residency,
+                                                            bool no_return = false) {
+        GGML_ASSERT(gf != nullptr);
+
+        free_compute_buffer();
+        free_cache_ctx_and_buffer();
+
         std::unordered_map<ggml_tensor*, PersistentExternalBinding> persistent_externals;
         snapshot_persistent_externals(plan, gf, persistent_externals);
 
+        std::vector<size_t> segment_stages(plan.segments.size(), 0);
+        if (pipeline_active()) {
+            segment_stages = assign_pipeline_stages(plan);
+            if (!load_pipeline_stage_params(gf, plan, segment_stages)) {
+                free_pipeline_stages();
+                segment_stages.assign(plan.segments.size(), 0);
+            }
+        }
+
+        // With streaming, the params of segment k+1 are loaded and uploaded on a
+        // worker thread while segment k computes (double buffering).
+        using clock = std::chrono::steady_clock;
+        auto elapsed_ms = [](clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        };
+
+        auto manager                  = weight_manager.lock();
+        const bool prefetch           = stream_layers_enabled && manager != nullptr && manager->supports_prefetch();
+        sd_perf::OpProfiler* profiler = sd_perf::current_op_profiler();
+        const std::string desc        = get_desc();
+        std::vector<SegmentTiming> timings(plan.segments.size());
+        std::future<bool> pending_prefetch;
+        std::vector<ggml_tensor*> pending_prefetch_params;
+        size_t pending_prefetch_index = 0;
+
+        auto start_prefetch = [&](size_t seg_idx) {
+            if (segment_stages[seg_idx] != 0 ||
+                plan.segments[seg_idx].residency == sd::ggml_graph_cut::SegmentResidency::HOST) {
+                pending_prefetch_params.clear();
+                return;
+            }
+            pending_prefetch_params = collect_segment_prefetch_params(gf, plan.segments[seg_idx]);
+            pending_prefetch_index  = seg_idx;
+            if (pending_prefetch_params.empty()) {
+                return;
+            }
+            // the segment after it is only read ahead, so the disk keeps
+            // working while the prefetched one uploads and computes
+            std::vector<ggml_tensor*> advise_params;
+            if (seg_idx + 1 < plan.segments.size() && segment_stages[seg_idx + 1] == 0) {
+                advise_params = collect_segment_prefetch_params(gf, plan.segments[seg_idx + 1]);
+            }
+            SegmentTiming* timing = &timings[seg_idx];
+            pending_prefetch      = std::async(std::launch::async, [manager, timing, elapsed_ms, profiler, desc, seg_idx, params = pending_prefetch_params, advise_params = std::move(advise_params), thread_callbacks = sd_current_thread_callbacks()]() {
+                ScopedThreadCallbacks callback_scope(thread_callbacks);
+                auto start             = clock::now();
+                int64_t start_us       = ggml_time_us();
+                uint64_t bytes_start   = sd_perf::thread_loaded_bytes() + sd_perf::thread_uploaded_bytes();
+                bool ok                = manager->prefetch_params(params);
+                timing->prefetch_bytes = sd_perf::thread_loaded_bytes() + sd_perf::thread_uploaded_bytes() - bytes_start;
+                timing->upload_ms      = elapsed_ms(start);
+                if (profiler != nullptr) {
+                    profiler->add_transfer(desc,
+                                           static_cast<int>(seg_idx),
+                                           "prefetch",
+                                           timing->prefetch_bytes,
+                                           sd_perf::OpProfiler::TRANSFER_TRACK,
+                                           start_us,
+                                           ggml_time_us());
+                }
+                manager->advise_params(advise_params);
+                return ok;
+            });
+        };
+        auto finish_prefetch = [&]() {
+            if (pending_prefetch.valid()) {
+                auto start       = clock::now();
+                int64_t start_us = ggml_time_us();
+                if (!pending_prefetch.get()) {
+                    LOG_WARN("%s prefetch of segment %zu failed, loading it on demand",
+                             get_desc().c_str(),
+                             pending_prefetch_index + 1);
+                }
+                timings[pending_prefetch_index].wait_ms = elapsed_ms(start);
+                if (profiler != nullptr) {
+                    profiler->add_transfer(desc,
+                                           static_cast<int>(pending_prefetch_index),
+                                           "prefetch wait",
+                                           0,
+                                           sd_perf::OpProfiler::COMPUTE_TRACK,
+                                           start_us,
+                                           ggml_time_us());
+                }
+            }
+        };
+        auto drop_prefetch = [&]() {
+            finish_prefetch();
+            manager->release_prefetched_params(pending_prefetch_params);
+            pending_prefetch_params.clear();
+        };
+
         std::optional<sd::Tensor<T>> output = sd::Tensor<T>();
         for (size_t seg_idx = 0; seg_idx < plan.segments.size(); ++seg_idx) {
             const auto& segment   = plan.segments[seg_idx];
             const bool is_last    = seg_idx + 1 == plan.segments.size();
+            if (prefetch) {
+                finish_prefetch();
+            }
             auto future_cut_names = sd::ggml_graph_cut::collect_future_input_names(gf, plan, seg_idx);
             if (log_residency) {
                 LOG_DEBUG("%s graph cut executing segment %zu/%zu: %s (residency=%s)",
@@ -2569,7 +4026,9 @@ protected:
                           seg_idx + 1,
                           plan.segments.size(),
                           segment.group_name.c_str(),
-                          segment.residency == sd::ggml_graph_cut::SegmentResidency::RESIDENT ? "RESIDENT" : "STREAMED");
+                          segment.residency == sd::ggml_graph_cut::SegmentResidency::RESIDENT ? "RESIDENT"
+                          : segment.residency == sd::ggml_graph_cut::SegmentResidency::HOST   ? "HOST"
+                                                                                              : "STREAMED");
             } else {
                 LOG_DEBUG("%s graph cut executing segment %zu/%zu: %s",
                           get_desc().c_str(),
@@ -2577,9 +4036,20 @@ protected:
                           plan.segments.size(),
                           segment.group_name.c_str());
             }
+            const PipelineStage* stage = segment_stages[seg_idx] > 0 ? &pipeline_stages_[segment_stages[seg_idx] - 1] : nullptr;
+            if (stage != nullptr) {
+                LOG_DEBUG("%s segment %zu/%zu runs on %s",
+                          get_desc().c_str(),
+                          seg_idx + 1,
+                          plan.segments.size(),
+                          ggml_backend_name(stage->backend));
+            }
 
             reset_segment_runtime_tensors(segment, gf, &persistent_externals);
             if (!bind_segment_cached_inputs(gf, segment)) {
+                if (prefetch) {
+                    drop_prefetch();
+                }
                 free_cache_ctx_and_buffer();
                 free_compute_buffer();
                 free_compute_ctx();
@@ -2600,15 +4070,84 @@ protected:
             ggml_context* segment_graph_ctx = nullptr;
             ggml_cgraph* segment_graph      = sd::ggml_graph_cut::build_segment_graph(gf, segment, &segment_graph_ctx);
             const bool keep_segment_params  = segment.residency == sd::ggml_graph_cut::SegmentResidency::RESIDENT;
-            auto segment_output             = execute_graph<T>(segment_graph,
-                                                   n_threads,
-                                                   true,
-                                                   !keep_segment_params,
-                                                   true,
-                                                   !is_last || no_return,
-                                                   &future_cut_names);
+            auto compute_start              = clock::now();
+            int64_t compute_start_us        = ggml_time_us();
+            uint64_t compute_bytes_start    = sd_perf::thread_loaded_bytes() + sd_perf::thread_uploaded_bytes();
+            profile_segment_                = static_cast<int>(seg_idx);
+            std::vector<ggml_tensor*> segment_prefetched_params;
+            // The next prefetch holds the manager while it loads, so it starts
+            // only after this segment's params are prepared.
+            bool prefetch_next = false;
+            if (prefetch) {
+                segment_prefetched_params = std::move(pending_prefetch_params);
+                pending_prefetch_params.clear();
+                prefetch_next = !is_last;
+            }
+            auto start_next_prefetch = [&]() {
+                if (prefetch_next) {
+                    prefetch_next = false;
+                    start_prefetch(seg_idx + 1);
+                }
+            };
+            std::vector<ggml_tensor*> host_params;
+            bool on_host = host_execution_active() && segment.residency == sd::ggml_graph_cut::SegmentResidency::HOST;
+            if (on_host) {
+                host_params = collect_segment_prefetch_params(gf, segment);
+                if (manager == nullptr || !manager->prepare_host_params(host_params)) {
+                    LOG_INFO("%s cannot compute segment %zu with its params in place, streaming every segment",
+                             get_desc().c_str(),
+                             seg_idx + 1);
+                    host_params_refused_ = true;
+                    on_host              = false;
+                }
+            }
+            std::optional<sd::Tensor<T>> segment_output;
+            if (on_host) {
+                start_next_prefetch();
+                segment_output = execute_segment_on_backend<T>(host_backend_,
+                                                               nullptr,
+                                                               gf,
+                                                               segment,
+                                                               segment_graph,
+                                                               n_threads,
+                                                               !is_last || no_return,
+                                                               &future_cut_names);
+                manager->release_compute_backend_params(host_params);
+            } else if (stage != nullptr) {
+                start_next_prefetch();
+                segment_output = execute_segment_on_backend<T>(stage->backend,
+                                                               &stage->params,
+                                                               gf,
+                                                               segment,
+                                                               segment_graph,
+                                                               n_threads,
+                                                               !is_last || no_return,
+                                                               &future_cut_names);
+            } else {
+                on_params_prepared_ = start_next_prefetch;
+                segment_output      = execute_graph<T>(segment_graph,
+                                                        n_threads,
+                                                        true,
+                                                        !keep_segment_params,
+                                                        true,
+                                                        !is_last || no_return,
+                                                        &future_cut_names);
+                on_params_prepared_ = nullptr;
+            }
             ggml_free(segment_graph_ctx);
+            profile_segment_ = -1;
+            if (profiler != nullptr) {
+                profiler->add_segment(desc, static_cast<int>(seg_idx), segment.group_name, compute_start_us, ggml_time_us());
+            }
+            if (prefetch) {
+                manager->release_prefetched_params(segment_prefetched_params);
+            }
+            timings[seg_idx].compute_ms    = elapsed_ms(compute_start);
+            timings[seg_idx].compute_bytes = sd_perf::thread_loaded_bytes() + sd_perf::thread_uploaded_bytes() - compute_bytes_start;
             if (!segment_output.has_value()) {
+                if (prefetch) {
+                    drop_prefetch();
+                }
                 free_cache_ctx_and_buffer();
                 free_compute_buffer();
                 free_compute_ctx();
@@ -2616,6 +4155,13 @@ protected:
             }
             output = std::move(segment_output);
         }
+        if (prefetch) {
+            log_segment_timeline(plan, timings);
+        }
+        record_segment_timeline(plan, timings);
+        if (stream_layers_enabled) {
+            record_segment_usage(plan, timings);
+        }
 
         backend_tensor_data_map.clear();
         free_cache_ctx_and_buffer();
@@ -2625,11 +4171,20 @@ protected:
 
 public:
     void runner_done() {
-        free_compute_buffer();
+        end_request_compute_buffer();
+        if (!keep_cache_on_runner_done) {
+            free_cache_ctx_and_buffer();
+        }
+        free_positional_tables();
+        free_constant_inputs();
         std::vector<ggml_tensor*> tensors_to_release = std::move(this->runner_param_tensors);
         this->runner_param_tensors.clear();
         runner_param_tensor_set.clear();
         kept_compute_param_tensor_set.clear();
+        resident_segment_groups_.clear();
+        segment_usage_.clear();
+        segment_usage_computes_ = 0;
+        host_params_refused_    = false;
         free_compute_backend_param_tensors(tensors_to_release);
         free_params_backend_param_tensors(tensors_to_release);
     }
@@ -2647,9 +4202,13 @@ public:
 
     virtual ~GGMLRunner() {
         free_compute_buffer();
+        free_pipeline_stages();
         free_params_ctx();
         free_compute_ctx();
         free_cache_ctx_and_buffer();
+        free_positional_tables();
+        free_constant_inputs();
+        free_resident_latent();
     }
 
     virtual GGMLRunnerContext get_context() {
@@ -2658,6 +4217,7 @@ public:
         runner_ctx.backend               = runtime_backend;
         runner_ctx.flash_attn_enabled    = flash_attn_enabled;
         runner_ctx.conv2d_direct_enabled = conv2d_direct_enabled;
+        runner_ctx.conv_f32_enabled      = conv_f32_enabled;
         runner_ctx.circular_x_enabled    = circular_x_enabled;
         runner_ctx.circular_y_enabled    = circular_y_enabled;
         runner_ctx.weight_adapter        = weight_adapter;
@@ -2685,8 +4245,41 @@ public:
         free_cache_ctx();
     }
 
+    // Start of a request with graphs of shape_key. A buffer the last request
+    // kept is freed unless `retention` keeps it for this request; gallocr
+    // only grows a kept buffer, so under COMPUTE_BUFFER_KEEP it stays at the
+    // high-water mark of every shape seen.
+    void begin_request_compute_buffer(compute_buffer_retention_t retention, const std::string& shape_key) {
+        if (compute_allocr != nullptr &&
+            (retention == COMPUTE_BUFFER_FREE ||
+             (retention == COMPUTE_BUFFER_KEEP_SAME_SHAPE && shape_key != retained_shape_key_))) {
+            free_compute_buffer();
+        }
+        compute_buffer_retention_ = retention;
+        retained_shape_key_       = shape_key;
+    }
+
+    // End of a request: frees the compute buffer unless the retention of
+    // begin_request_compute_buffer keeps it for the next one.
+    void end_request_compute_buffer() {
+        if (compute_buffer_retention_ == COMPUTE_BUFFER_FREE) {
+            free_compute_buffer();
+            return;
+        }
+        // params can move before the next request; only the buffer is kept
+        invalidate_reusable_graph();
+    }
+
     void free_compute_buffer() {
-        if (compute_allocr != nullptr) {
+        // graph tensors keep their addresses in the freed buffer
+        invalidate_reusable_graph();
+        if (compute_arena_ != nullptr) {
+            // the arena keeps its buffer for the next runner
+            compute_arena_->release(this);
+            compute_arena_.reset();
+            compute_allocr = nullptr;
+        } else if (compute_allocr != nullptr) {
+            sd_perf::untrace_buffer(compute_allocr);
             ggml_gallocr_free(compute_allocr);
             compute_allocr = nullptr;
         }
@@ -2699,6 +4292,13 @@ public:
 
     template <typename T>
     ggml_tensor* make_input(const sd::Tensor<T>& tensor) {
+        if constexpr (std::is_same_v<T, float>) {
+            ResidentLatent& latent = resident_latent_;
+            if (latent.armed && tensor.data() == latent.input_data && tensor.shape() == latent.shape) {
+                latent.consumed = true;
+                return ggml_scale(compute_ctx, latent.tensor, latent.input_scale);
+            }
+        }
         ggml_tensor* input = sd::make_ggml_tensor(compute_ctx, tensor, false);
         set_backend_tensor_data(input, tensor.data());
         return input;
@@ -2720,6 +4320,270 @@ public:
         return make_input(*tensor);
     }
 
+    // Samples of the values, so a new tensor that reuses a freed host buffer
+    // of the same shape is not taken for the uploaded one.
+    static uint64_t constant_input_fingerprint(const sd::Tensor<float>& tensor) {
+        constexpr int64_t samples = 64;
+        const int64_t numel       = tensor.numel();
+        const int64_t stride      = std::max<int64_t>(1, numel / samples);
+        uint64_t hash             = 1469598103934665603ull;
+        for (int64_t i = 0; i < numel; i += stride) {
+            uint32_t bits = 0;
+            std::memcpy(&bits, tensor.data() + i, sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Inputs that stay the same for every compute of a request: text
+    // embeddings, concat latents, reference latents. Like positional tables,
+    // they are uploaded once into their own buffer on the runtime backend and
+    // stay there until runner_done, instead of being copied before every
+    // step. Only for tensors that outlive the request and are not changed in
+    // it; the host data pointer and shape identify them. Segmented runs and
+    // memory probes take the per-step path of make_input.
+    ggml_tensor* make_constant_input(const sd::Tensor<float>& tensor) {
+        if (can_attempt_graph_cut_segmented_compute() || sd_perf::current_memory_probe() != nullptr) {
+            return make_input(tensor);
+        }
+        const uint64_t fingerprint = constant_input_fingerprint(tensor);
+        auto it                    = std::find_if(constant_inputs.begin(), constant_inputs.end(), [&](const ConstantInput& input) {
+            return input.data == tensor.data() && input.shape == tensor.shape() && input.fingerprint == fingerprint;
+        });
+        if (it != constant_inputs.end()) {
+            constant_inputs.splice(constant_inputs.begin(), constant_inputs, it);
+            return constant_inputs.front().tensor;
+        }
+
+        ConstantInput input;
+        input.data        = tensor.data();
+        input.shape       = tensor.shape();
+        input.fingerprint = fingerprint;
+        ggml_init_params params;
+        params.mem_size   = ggml_tensor_overhead();
+        params.mem_buffer = nullptr;
+        params.no_alloc   = true;
+        input.ctx         = ggml_init(params);
+        input.tensor      = sd::make_ggml_tensor(input.ctx, tensor, false);
+        input.buffer      = ggml_backend_alloc_ctx_tensors(input.ctx, runtime_backend);
+        if (input.buffer == nullptr) {
+            LOG_WARN("%s failed to allocate a constant input, uploading it per step", get_desc().c_str());
+            free_constant_input(input);
+            return make_input(tensor);
+        }
+        sd_perf::trace_buffer(input.buffer, sd_perf::BufferKind::INPUT, get_desc());
+        ggml_backend_tensor_set(input.tensor, tensor.data(), 0, ggml_nbytes(input.tensor));
+        constant_inputs.push_front(input);
+        while (constant_inputs.size() > MAX_CONSTANT_INPUTS) {
+            free_constant_input(constant_inputs.back());
+            constant_inputs.pop_back();
+        }
+        return constant_inputs.front().tensor;
+    }
+
+    ggml_tensor* make_optional_constant_input(const sd::Tensor<float>& tensor) {
+        if (tensor.empty()) {
+            return nullptr;
+        }
+        return make_constant_input(tensor);
+    }
+
+    static void free_constant_input(ConstantInput& input) {
+        if (input.buffer != nullptr) {
+            sd_perf::untrace_buffer(input.buffer);
+            ggml_backend_buffer_free(input.buffer);
+            input.buffer = nullptr;
+        }
+        if (input.ctx != nullptr) {
+            ggml_free(input.ctx);
+            input.ctx = nullptr;
+        }
+        input.tensor = nullptr;
+    }
+
+    void free_constant_inputs() {
+        for (ConstantInput& input : constant_inputs) {
+            free_constant_input(input);
+        }
+        constant_inputs.clear();
+    }
+
+    // Keeps a sampler's latent x on the runtime backend between the steps of
+    // a sampler whose step is x = keep_scale * x + out_scale * model(input_scale * x).
+    // arm_resident_latent_step names the host tensor the next compute passes
+    // as the model input: make_input reads the latent in its place and the
+    // graph ends by writing the step into the latent, so the step uploads,
+    // reads back and touches on the host nothing of x. A build that does not
+    // take that tensor as is, or whose output is not shaped like x, runs
+    // normally and leaves the latent as it was; resident_latent_stepped
+    // tells which happened. Once the caller's x is behind the latent it arms
+    // with must_step, and a build that would not step the latent is dropped
+    // before it runs, see resident_latent_step_skipped. end_resident_latent
+    // reads x back once. Segmented runs and memory probes keep the latent on
+    // the host.
+    bool begin_resident_latent(const sd::Tensor<float>& x) {
+        free_resident_latent();
+        if (x.empty() || can_attempt_graph_cut_segmented_compute() || sd_perf::current_memory_probe() != nullptr) {
+            return false;
+        }
+        ResidentLatent& latent = resident_latent_;
+        ggml_init_params params;
+        params.mem_size   = ggml_tensor_overhead();
+        params.mem_buffer = nullptr;
+        params.no_alloc   = true;
+        latent.ctx        = ggml_init(params);
+        latent.tensor     = sd::make_ggml_tensor(latent.ctx, x, false);
+        latent.buffer     = ggml_backend_alloc_ctx_tensors(latent.ctx, runtime_backend);
+        if (latent.buffer == nullptr) {
+            LOG_WARN("%s failed to allocate the resident latent, keeping it on the host", get_desc().c_str());
+            free_resident_latent();
+            return false;
+        }
+        sd_perf::trace_buffer(latent.buffer, sd_perf::BufferKind::INPUT, get_desc());
+        ggml_backend_tensor_set(latent.tensor, x.data(), 0, ggml_nbytes(latent.tensor));
+        latent.shape = x.shape();
+        return true;
+    }
+
+    void arm_resident_latent_step(const sd::Tensor<float>& input,
+                                  float input_scale,
+                                  float keep_scale,
+                                  float out_scale,
+                                  bool must_step) {
+        reset_resident_latent_step();
+        ResidentLatent& latent = resident_latent_;
+        latent.input_data      = input.data();
+        latent.input_scale     = input_scale;
+        latent.keep_scale      = keep_scale;
+        latent.out_scale       = out_scale;
+        latent.armed           = latent.tensor != nullptr;
+        latent.must_step       = latent.armed && must_step;
+    }
+
+    // Clears what the last compute left, for a step that may not arm at all.
+    void reset_resident_latent_step() {
+        ResidentLatent& latent = resident_latent_;
+        latent.armed           = false;
+        latent.must_step       = false;
+        latent.stepped         = false;
+        latent.step_skipped    = false;
+    }
+
+    bool resident_latent_stepped() const {
+        return resident_latent_.stepped;
+    }
+
+    bool resident_latent_step_skipped() const {
+        return resident_latent_.step_skipped;
+    }
+
+    sd::Tensor<float> end_resident_latent() {
+        sd::Tensor<float> x;
+        if (resident_latent_.tensor != nullptr) {
+            x = sd::make_sd_tensor_from_ggml<float>(resident_latent_.tensor);
+            x.reshape_(resident_latent_.shape);
+        }
+        free_resident_latent();
+        return x;
+    }
+
+    void free_resident_latent() {
+        ResidentLatent& latent = resident_latent_;
+        if (latent.buffer != nullptr) {
+            sd_perf::untrace_buffer(latent.buffer);
+            ggml_backend_buffer_free(latent.buffer);
+        }
+        if (latent.ctx != nullptr) {
+            ggml_free(latent.ctx);
+        }
+        latent = ResidentLatent();
+    }
+
+    static std::string tensor_shape_key(const ggml_tensor* tensor) {
+        if (tensor == nullptr) {
+            return "-";
+        }
+        return sd_format("%" PRId64 "x%" PRId64 "x%" PRId64 "x%" PRId64,
+                         tensor->ne[0], tensor->ne[1], tensor->ne[2], tensor->ne[3]);
+    }
+
+    // Input tables that only depend on shapes, such as RoPE frequencies. key
+    // must cover every argument of generate that can change between calls; the
+    // last dimension follows from the generated size. A table is generated once
+    // per key and, when the graph runs in one piece, stays resident on the
+    // runtime backend until runner_done, so later steps skip both the
+    // generation and the upload. Segmented runs upload the host copy per step.
+    ggml_tensor* make_positional_table(const std::string& key,
+                                       int64_t ne0,
+                                       int64_t ne1,
+                                       int64_t ne2,
+                                       const std::function<std::vector<float>()>& generate) {
+        auto it = std::find_if(positional_tables.begin(), positional_tables.end(), [&](const PositionalTable& table) {
+            return table.key == key;
+        });
+        if (it == positional_tables.end()) {
+            positional_tables.push_front({key, generate()});
+            while (positional_tables.size() > MAX_POSITIONAL_TABLES) {
+                free_positional_table(positional_tables.back());
+                positional_tables.pop_back();
+            }
+        } else {
+            positional_tables.splice(positional_tables.begin(), positional_tables, it);
+        }
+        PositionalTable& table = positional_tables.front();
+
+        bool resident = !can_attempt_graph_cut_segmented_compute();
+        if (resident && table.tensor != nullptr) {
+            return table.tensor;
+        }
+        if (table.data.empty()) {
+            table.data = generate();
+        }
+        int64_t ne3 = static_cast<int64_t>(table.data.size()) / (ne0 * ne1 * ne2);
+        GGML_ASSERT(ne3 * ne0 * ne1 * ne2 == static_cast<int64_t>(table.data.size()));
+        if (resident) {
+            ggml_init_params params;
+            params.mem_size   = ggml_tensor_overhead();
+            params.mem_buffer = nullptr;
+            params.no_alloc   = true;
+            table.ctx         = ggml_init(params);
+            table.tensor      = ggml_new_tensor_4d(table.ctx, GGML_TYPE_F32, ne0, ne1, ne2, ne3);
+            table.buffer      = ggml_backend_alloc_ctx_tensors(table.ctx, runtime_backend);
+            if (table.buffer != nullptr) {
+                sd_perf::trace_buffer(table.buffer, sd_perf::BufferKind::INPUT, get_desc());
+                ggml_backend_tensor_set(table.tensor, table.data.data(), 0, ggml_nbytes(table.tensor));
+                table.data.clear();
+                table.data.shrink_to_fit();
+                return table.tensor;
+            }
+            LOG_WARN("%s failed to allocate positional table, uploading it per step", get_desc().c_str());
+            free_positional_table(table);
+        }
+        ggml_tensor* tensor = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, ne0, ne1, ne2, ne3);
+        set_backend_tensor_data(tensor, table.data.data());
+        return tensor;
+    }
+
+    static void free_positional_table(PositionalTable& table) {
+        if (table.buffer != nullptr) {
+            sd_perf::untrace_buffer(table.buffer);
+            ggml_backend_buffer_free(table.buffer);
+            table.buffer = nullptr;
+        }
+        if (table.ctx != nullptr) {
+            ggml_free(table.ctx);
+            table.ctx = nullptr;
+        }
+        table.tensor = nullptr;
+    }
+
+    void free_positional_tables() {
+        for (PositionalTable& table : positional_tables) {
+            free_positional_table(table);
+        }
+        positional_tables.clear();
+    }
+
     ggml_tensor* to_backend(ggml_tensor* tensor) {
         GGML_ASSERT(compute_ctx != nullptr);
         if (tensor == nullptr) {
@@ -2751,13 +4615,56 @@ public:
         return ggml_get_tensor(cache_ctx, name.c_str());
     }
 
+    // Records what gf needs into the probe and stands zeros of the result
+    // shape in for its output, see sd_perf::MemoryProbe.
+    template <typename T>
+    std::optional<sd::Tensor<T>> probe_graph(ggml_cgraph* gf, sd_perf::MemoryProbe* probe, bool no_return) {
+        size_t params_bytes = 0;
+        for (const ggml_tensor* param : params_tensor_set_) {
+            params_bytes += ggml_nbytes(param);
+        }
+        size_t compute_bytes = measure_graph_compute_buffer(gf);
+        int segments         = 0;
+        size_t segment_bytes = 0;
+        GraphCutPlan plan;
+        if (can_attempt_graph_cut_segmented_compute() &&
+            resolve_graph_cut_plan(gf, &plan) &&
+            should_use_graph_cut_segmented_compute(plan)) {
+            segments = static_cast<int>(plan.segments.size());
+            for (const GraphCutSegment& segment : plan.segments) {
+                segment_bytes = std::max(segment_bytes, segment.compute_buffer_size);
+            }
+        }
+
+        sd_perf::RunnerMemory& memory = probe->runner(get_desc());
+        memory.on_cpu                 = sd_backend_is_cpu(runtime_backend);
+        memory.graphs++;
+        if (compute_bytes >= memory.compute_buffer_bytes) {
+            memory.params_bytes         = params_bytes;
+            memory.compute_buffer_bytes = compute_bytes;
+            memory.graph_cut_segments   = segments;
+            memory.segment_buffer_bytes = segment_bytes;
+        }
+
+        std::optional<sd::Tensor<T>> output = sd::Tensor<T>();
+        ggml_tensor* result                 = ggml_get_tensor(compute_ctx, final_result_name.c_str());
+        if (!no_return && result != nullptr) {
+            output = sd::Tensor<T>::zeros(sd::shape_from_ggml(result));
+        }
+        // cache tensors of this build live in compute_ctx
+        cache_tensor_map.clear();
+        free_compute_ctx();
+        return output;
+    }
+
     template <typename T>
     std::optional<sd::Tensor<T>> compute(get_graph_cb_t get_graph,
                                          int n_threads,
                                          bool auto_free           = true,
                                          bool free_compute_buffer = true,
                                          bool free_compute_params = true,
-                                         bool no_return           = false) {
+                                         bool no_return           = false,
+                                         const GraphReuse* reuse  = nullptr) {
         struct RunnerDoneGuard {
             RunnerDoneGuard(GGMLRunner* runner, bool enabled)
                 : runner(runner),
@@ -2776,13 +4683,48 @@ public:
             bool enabled       = false;
         };
         RunnerDoneGuard runner_done_guard(this, auto_free);
+        compute_out_of_memory_     = false;
+        const bool must_step       = resident_latent_.must_step;
+        resident_latent_.must_step = false;
+
+        sd_perf::MemoryProbe* probe = sd_perf::current_memory_probe();
+        if (probe != nullptr) {
+            ggml_cgraph* gf = nullptr;
+            if (!prepare_compute_graph(get_graph, &gf)) {
+                return std::nullopt;
+            }
+            rebuild_params_tensor_set();
+            return probe_graph<T>(gf, probe, no_return);
+        }
 
-        ggml_cgraph* gf = nullptr;
-        if (!prepare_compute_graph(get_graph, &gf)) {
+        int64_t build_start_us = ggml_time_us();
+        ggml_cgraph* gf        = find_reusable_graph(reuse);
+        bool graph_reused      = gf != nullptr;
+        if (graph_reused) {
+            resident_latent_.armed = false;
+            resident_latent_.fused = false;
+        } else {
+            if (!prepare_compute_graph(get_graph, &gf)) {
+                return std::nullopt;
+            }
+            GGML_ASSERT(gf != nullptr);
+            keep_reusable_graph(gf, reuse);
+        }
+        if (must_step && !resident_latent_.fused) {
+            // run on the stale input it would only be redone by the caller
+            resident_latent_.step_skipped = true;
+            if (!graph_reused) {
+                free_compute_ctx();
+            }
             return std::nullopt;
         }
-        GGML_ASSERT(gf != nullptr);
         rebuild_params_tensor_set();
+        if (sd_perf::PerfRecorder* perf = sd_perf::current_recorder()) {
+            sd_perf::RunnerStats& stats = perf->runner(get_desc());
+            stats.compute_calls++;
+            stats.graph_reuses += graph_reused ? 1 : 0;
+            stats.graph_build_ms += (ggml_time_us() - build_start_us) / 1000.0;
+        }
 
         if (can_attempt_graph_cut_segmented_compute()) {
             GraphCutPlan plan;
@@ -2798,39 +4740,243 @@ public:
                                                      no_return);
             }
         }
-        return execute_graph<T>(gf,
-                                n_threads,
-                                free_compute_buffer,
-                                free_compute_params,
-                                false,
-                                no_return,
-                                nullptr);
+        std::optional<sd::Tensor<T>> output = execute_graph<T>(gf,
+                                                               n_threads,
+                                                               free_compute_buffer,
+                                                               free_compute_params,
+                                                               false,
+                                                               no_return,
+                                                               nullptr);
+        // a fused step writes the latent in place, so it is not rerun in segments
+        if (output.has_value() || !compute_out_of_memory_ || resident_latent_.fused) {
+            return output;
+        }
+        return compute_segmented_after_oom<T>(gf, n_threads, no_return);
+    }
+
+    // Second rung of the out of memory ladder: a whole graph that does not
+    // fit is run again in graph-cut segments under a budget taken from the
+    // free device memory. The budget stays for the runner's later computes.
+    template <typename T>
+    std::optional<sd::Tensor<T>> compute_segmented_after_oom(ggml_cgraph* gf, int n_threads, bool no_return) {
+        if (max_graph_vram_bytes > 0 || pipeline_active() || sd_backend_is_cpu(runtime_backend)) {
+            return std::nullopt;
+        }
+        ggml_backend_dev_t dev = ggml_backend_get_device(runtime_backend);
+        if (dev == nullptr) {
+            return std::nullopt;
+        }
+        free_compute_buffer();
+        size_t free_vram = 0, total_vram = 0;
+        ggml_backend_dev_memory(dev, &free_vram, &total_vram);
+        constexpr size_t safety_margin = 512ull * 1024 * 1024;
+        constexpr size_t min_budget    = 256ull * 1024 * 1024;
+        size_t budget                  = free_vram > safety_margin + min_budget ? free_vram - safety_margin : min_budget;
+
+        set_max_graph_vram_bytes(budget);
+        GraphCutPlan plan;
+        if (!resolve_graph_cut_plan(gf, &plan) || !should_use_graph_cut_segmented_compute(plan)) {
+            set_max_graph_vram_bytes(0);
+            return std::nullopt;
+        }
+        sd_report_degradation(SD_DEGRADATION_SEGMENTED_GRAPH,
+                              get_desc().c_str(),
+                              sd_format("graph did not fit, running it in %zu segments under a %.2f MB budget",
+                                        plan.segments.size(),
+                                        budget / (1024.0 * 1024.0))
+                                  .c_str());
+        compute_out_of_memory_ = false;
+        return compute_graph_cut_segments<T>(gf,
+                                             plan,
+                                             n_threads,
+                                             stream_layers_enabled,
+                                             no_return);
+    }
+
+    // Whether the last compute failed because its compute buffer did not fit,
+    // after the runner's own recovery; callers may retry in smaller pieces.
+    bool last_compute_out_of_memory() const {
+        return compute_out_of_memory_;
+    }
+
+    // Frees a compute buffer kept across requests by the retention of
+    // begin_request_compute_buffer; false when none is held.
+    bool release_retained_compute_buffer() {
+        if (compute_allocr == nullptr || compute_buffer_retention_ == COMPUTE_BUFFER_FREE) {
+            return false;
+        }
+        free_compute_buffer();
+        return true;
     }
 
     void set_flash_attention_enabled(bool enabled) {
+        if (flash_attn_enabled != enabled) {
+            invalidate_reusable_graph();
+        }
         flash_attn_enabled = enabled;
     }
 
     void set_conv2d_direct_enabled(bool enabled) {
+        if (conv2d_direct_enabled != enabled) {
+            invalidate_reusable_graph();
+        }
         conv2d_direct_enabled = enabled;
     }
 
+    // Convolutions cast their weights to f32 and accumulate in f32, for
+    // graphs whose activations overflow half precision.
+    void set_conv_f32_enabled(bool enabled) {
+        if (conv_f32_enabled != enabled) {
+            invalidate_reusable_graph();
+        }
+        conv_f32_enabled = enabled;
+    }
+
     void set_circular_axes(bool circular_x, bool circular_y) {
+        if (circular_x_enabled != circular_x || circular_y_enabled != circular_y) {
+            invalidate_reusable_graph();
+        }
         circular_x_enabled = circular_x;
         circular_y_enabled = circular_y;
     }
 
     void set_weight_adapter(const std::shared_ptr<WeightAdapter>& adapter) {
+        if (weight_adapter != adapter) {
+            invalidate_reusable_graph();
+        }
         weight_adapter = adapter;
     }
 
     void set_max_graph_vram_bytes(size_t max_vram_bytes) {
+        if (max_graph_vram_bytes != max_vram_bytes) {
+            invalidate_reusable_graph();
+        }
         max_graph_vram_bytes = max_vram_bytes;
     }
 
     void set_stream_layers_enabled(bool enabled) {
         stream_layers_enabled = enabled;
     }
+
+    // Spreads the graph-cut segments of this runner over its own backend and
+    // `backends`, in that order. `load_params` allocates the given copies of
+    // params on a stage backend and reads them from the model files; a stage
+    // loads the params of its segments on first use and keeps them.
+    void set_pipeline_backends(const std::vector<ggml_backend_t>& backends, PipelineParamsLoader load_params) {
+        free_pipeline_stages();
+        for (ggml_backend_t backend : backends) {
+            PipelineStage stage;
+            stage.backend = backend;
+            pipeline_stages_.push_back(std::move(stage));
+        }
+        load_pipeline_params_ = std::move(load_params);
+        pipeline_enabled_     = true;
+        invalidate_reusable_graph();
+        if (!pipeline_stages_.empty()) {
+            const std::vector<double> shares = pipeline_stage_shares();
+            for (size_t k = 0; k < shares.size(); ++k) {
+                LOG_INFO("%s pipeline stage %zu on %s runs %.0f%% of the params",
+                         get_desc().c_str(),
+                         k,
+                         ggml_backend_name(k == 0 ? runtime_backend : pipeline_stages_[k - 1].backend),
+                         shares[k] * 100.0);
+            }
+        }
+    }
+
+    // Lets streamed segments compute on `host_backend`, a CPU backend that
+    // reads their params where the params backend holds them, when `rates`
+    // say that beats uploading them; once prefetches ran, their measured
+    // rate replaces the upload rate. Only with streaming on a device backend;
+    // nullptr streams every segment.
+    void set_host_execution(ggml_backend_t host_backend, const sd::ggml_graph_cut::HostExecutionRates& rates) {
+        if (host_backend != nullptr && (!sd_backend_is_cpu(host_backend) || sd_backend_is_cpu(runtime_backend))) {
+            host_backend = nullptr;
+        }
+        host_backend_         = host_backend;
+        host_execution_rates_ = rates;
+        measured_upload_gbps_ = 0.0;
+        host_segment_count_   = 0;
+    }
+
+    // The stages hold params as loaded from the model files, so LoRAs merged
+    // into this runner's params turn the pipeline off.
+    void set_pipeline_enabled(bool enabled) {
+        if (!pipeline_stages_.empty() && pipeline_enabled_ != enabled) {
+            invalidate_reusable_graph();
+        }
+        pipeline_enabled_ = enabled;
+    }
+
+    // Runs the matmuls of whole-graph computes with their weights in `buft`,
+    // a split buffer type of this runner's backend that spreads weight rows
+    // over several devices. The weights are copied there on first use.
+    void set_tensor_split_buffer_type(ggml_backend_buffer_type_t buft) {
+        free_tensor_split_copies();
+        tensor_split_buft_    = buft;
+        tensor_split_enabled_ = true;
+    }
+
+    // The copies are taken from this runner's params, so they are dropped
+    // when LoRAs merged into the params turn the split off.
+    void set_tensor_split_enabled(bool enabled) {
+        if (!enabled) {
+            free_tensor_split_copies();
+        }
+        tensor_split_enabled_ = enabled;
+    }
+
+    size_t get_compute_buffer_size() const {
+        return compute_allocr != nullptr ? ggml_gallocr_get_buffer_size(compute_allocr, 0) : 0;
+    }
+
+    // Compute buffer the graph of get_graph needs, measured without
+    // allocating it or loading weights; 0 when there is no backend.
+    size_t measure_compute_buffer(get_graph_cb_t get_graph) {
+        ggml_cgraph* gf = nullptr;
+        if (runtime_backend == nullptr || !prepare_compute_graph(get_graph, &gf)) {
+            return 0;
+        }
+        rebuild_params_tensor_set();
+        size_t size = measure_graph_compute_buffer(gf);
+        free_compute_ctx();
+        return size;
+    }
+
+    size_t measure_graph_compute_buffer(ggml_cgraph* gf) {
+        // weights sit in their own buffers at compute time, so gallocr must
+        // not count the ones that are not loaded yet
+        std::vector<ggml_tensor*> unbound_params;
+        for (const ggml_tensor* param : params_tensor_set_) {
+            if (param->data == nullptr) {
+                ggml_tensor* tensor = const_cast<ggml_tensor*>(param);
+                tensor->data        = reinterpret_cast<void*>(static_cast<uintptr_t>(1));
+                unbound_params.push_back(tensor);
+            }
+        }
+        ggml_gallocr_t allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(runtime_backend));
+        size_t sizes[1]       = {0};
+        ggml_gallocr_reserve_n_size(allocr, gf, nullptr, nullptr, sizes);
+        ggml_gallocr_free(allocr);
+        for (ggml_tensor* tensor : unbound_params) {
+            tensor->data = nullptr;
+        }
+        return sizes[0];
+    }
+
+    // free memory of the runtime device, 0 when running on the CPU
+    size_t get_runtime_free_memory() const {
+        if (runtime_backend == nullptr || sd_backend_is_cpu(runtime_backend)) {
+            return 0;
+        }
+        ggml_backend_dev_t dev = ggml_backend_get_device(runtime_backend);
+        if (dev == nullptr) {
+            return 0;
+        }
+        size_t free_mem = 0, total_mem = 0;
+        ggml_backend_dev_memory(dev, &free_mem, &total_mem);
+        return free_mem;
+    }
 };
 
 class GGMLBlock {
@@ -3065,6 +5211,37 @@ public:
     }
 };
 
+// Whether a conv2d of x by w runs ggml_conv_2d_direct: timed per shape and
+// device with conv tuning on, else the runner's conv2d_direct setting.
+__STATIC_INLINE__ bool ggml_ext_conv_2d_direct_for(GGMLRunnerContext* ctx,
+                                                   ggml_tensor* x,
+                                                   ggml_tensor* w,
+                                                   int s0,
+                                                   int s1,
+                                                   int p0,
+                                                   int p1,
+                                                   int d0,
+                                                   int d1) {
+    if (!sd::conv_tuner::enabled()) {
+        return ctx->conv2d_direct_enabled;
+    }
+    sd::conv_tuner::Conv2dShape shape;
+    shape.width        = x->ne[0];
+    shape.height       = x->ne[1];
+    shape.in_channels  = w->ne[2];
+    shape.out_channels = w->ne[3];
+    shape.kernel_w     = static_cast<int>(w->ne[0]);
+    shape.kernel_h     = static_cast<int>(w->ne[1]);
+    shape.s0           = s0;
+    shape.s1           = s1;
+    shape.p0           = p0;
+    shape.p1           = p1;
+    shape.d0           = d0;
+    shape.d1           = d1;
+    shape.weight_type  = w->type;
+    return sd::conv_tuner::prefer_direct(ctx->backend, shape, ctx->conv2d_direct_enabled);
+}
+
 class Conv2d : public UnaryBlock {
 protected:
     int64_t in_channels;
@@ -3117,6 +5294,10 @@ public:
         if (bias) {
             b = params["bias"];
         }
+        if (ctx->conv_f32_enabled && w->type != GGML_TYPE_F32) {
+            w = ggml_cast(ctx->ggml_ctx, w, GGML_TYPE_F32);
+        }
+        bool direct = ggml_ext_conv_2d_direct_for(ctx, x, w, stride.second, stride.first, padding.second, padding.first, dilation.second, dilation.first);
         if (ctx->weight_adapter) {
             WeightAdapter::ForwardParams forward_params;
             forward_params.op_type           = WeightAdapter::ForwardParams::op_type_t::OP_CONV2D;
@@ -3126,7 +5307,7 @@ public:
             forward_params.conv2d.p1         = padding.first;
             forward_params.conv2d.d0         = dilation.second;
             forward_params.conv2d.d1         = dilation.first;
-            forward_params.conv2d.direct     = ctx->conv2d_direct_enabled;
+            forward_params.conv2d.direct     = direct;
             forward_params.conv2d.circular_x = ctx->circular_x_enabled;
             forward_params.conv2d.circular_y = ctx->circular_y_enabled;
             forward_params.conv2d.scale      = scale;
@@ -3142,7 +5323,7 @@ public:
                                 padding.first,
                                 dilation.second,
                                 dilation.first,
-                                ctx->conv2d_direct_enabled,
+                                direct,
                                 ctx->circular_x_enabled,
                                 ctx->circular_y_enabled,
                                 scale);
@@ -3204,8 +5385,12 @@ public:
         if (bias) {
             b = params["bias"];
         }
+        if (ctx->conv_f32_enabled && w->type != GGML_TYPE_F32) {
+            w = ggml_cast(ctx->ggml_ctx, w, GGML_TYPE_F32);
+        }
 
         if (groups == 1) {
+            bool direct = ggml_ext_conv_2d_direct_for(ctx, x, w, stride.second, stride.first, padding.second, padding.first, dilation.second, dilation.first);
             if (ctx->weight_adapter) {
                 WeightAdapter::ForwardParams forward_params;
                 forward_params.op_type           = WeightAdapter::ForwardParams::op_type_t::OP_CONV2D;
@@ -3215,7 +5400,7 @@ public:
                 forward_params.conv2d.p1         = padding.first;
                 forward_params.conv2d.d0         = dilation.second;
                 forward_params.conv2d.d1         = dilation.first;
-                forward_params.conv2d.direct     = ctx->conv2d_direct_enabled;
+                forward_params.conv2d.direct     = direct;
                 forward_params.conv2d.circular_x = ctx->circular_x_enabled;
                 forward_params.conv2d.circular_y = ctx->circular_y_enabled;
                 forward_params.conv2d.scale      = scale;
@@ -3225,7 +5410,7 @@ public:
                                     stride.second, stride.first,
                                     padding.second, padding.first,
                                     dilation.second, dilation.first,
-                                    ctx->conv2d_direct_enabled,
+                                    direct,
                                     ctx->circular_x_enabled,
                                     ctx->circular_y_enabled,
                                     scale);
@@ -3273,6 +5458,7 @@ public:
                 size_t b_offset = i * oc_g * b->nb[0];
                 b_i             = ggml_view_1d(ctx->ggml_ctx, b, oc_g, b_offset);
             }
+            bool direct = ggml_ext_conv_2d_direct_for(ctx, x_i, w_i, stride.second, stride.first, padding.second, padding.first, dilation.second, dilation.first);
 
             if (ctx->weight_adapter) {
                 WeightAdapter::ForwardParams forward_params;
@@ -3283,7 +5469,7 @@ public:
                 forward_params.conv2d.p1         = padding.first;
                 forward_params.conv2d.d0         = dilation.second;
                 forward_params.conv2d.d1         = dilation.first;
-                forward_params.conv2d.direct     = ctx->conv2d_direct_enabled;
+                forward_params.conv2d.direct     = direct;
                 forward_params.conv2d.circular_x = ctx->circular_x_enabled;
                 forward_params.conv2d.circular_y = ctx->circular_y_enabled;
                 forward_params.conv2d.scale      = scale;
@@ -3293,7 +5479,7 @@ public:
                                                  stride.second, stride.first,
                                                  padding.second, padding.first,
                                                  dilation.second, dilation.first,
-                                                 ctx->conv2d_direct_enabled,
+                                                 direct,
                                                  ctx->circular_x_enabled,
                                                  ctx->circular_y_enabled,
                                                  scale);
@@ -3359,6 +5545,9 @@ public:
                 w = ggml_cast(ctx->ggml_ctx, w, GGML_TYPE_F16);
             }
         }
+        if (ctx->conv_f32_enabled && w->type != GGML_TYPE_F32) {
+            w = ggml_cast(ctx->ggml_ctx, w, GGML_TYPE_F32);
+        }
         if (bias) {
             b = params["bias"];
             if (ctx->weight_adapter) {
@@ -3369,7 +5558,7 @@ public:
                                 std::get<2>(stride), std::get<1>(stride), std::get<0>(stride),
                                 std::get<2>(padding), std::get<1>(padding), std::get<0>(padding),
                                 std::get<2>(dilation), std::get<1>(dilation), std::get<0>(dilation),
-                                force_prec_f32);
+                                force_prec_f32 || ctx->conv_f32_enabled);
     }
 };
 
@@ -3464,6 +5653,21 @@ public:
         }
         return ggml_ext_group_norm(ctx->ggml_ctx, x, w, b, num_groups);
     }
+
+    // forward() followed by SiLU, fused into one op where the backend allows
+    ggml_tensor* forward_silu(GGMLRunnerContext* ctx, ggml_tensor* x) {
+        ggml_tensor* w = nullptr;
+        ggml_tensor* b = nullptr;
+        if (affine) {
+            w = params["weight"];
+            b = params["bias"];
+            if (ctx->weight_adapter) {
+                w = ctx->weight_adapter->patch_weight(ctx->ggml_ctx, ctx->backend, w, prefix + "weight");
+                b = ctx->weight_adapter->patch_weight(ctx->ggml_ctx, ctx->backend, b, prefix + "bias");
+            }
+        }
+        return ggml_ext_group_norm_silu(ctx->ggml_ctx, ctx->backend, x, w, b, num_groups);
+    }
 };
 
 class GroupNorm32 : public GroupNorm {
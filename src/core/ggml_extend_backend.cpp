@@ -8,9 +8,26 @@
 #include <stdexcept>
 #include <vector>
 
+#include "core/device_probe.h"
 #include "core/util.h"
+#include "ggml-cpu.h"
 #include "stable-diffusion.h"
 
+typedef void (*ggml_backend_cpu_numa_init_t)(enum ggml_numa_strategy numa);
+typedef bool (*ggml_backend_cpu_is_numa_t)(void);
+typedef struct ggml_threadpool* (*ggml_threadpool_new_t)(struct ggml_threadpool_params* params);
+typedef void (*ggml_threadpool_free_t)(struct ggml_threadpool* threadpool);
+typedef void (*ggml_backend_cpu_set_threadpool_t)(ggml_backend_t backend, struct ggml_threadpool* threadpool);
+
+static void* cpu_backend_proc_address(const char* name) {
+    ggml_backend_load_all_once();
+    auto dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (dev == nullptr) {
+        return nullptr;
+    }
+    return ggml_backend_reg_get_proc_address(ggml_backend_dev_backend_reg(dev), name);
+}
+
 static std::string trim_copy(const std::string& value) {
     size_t begin = 0;
     while (begin < value.size() && std::isspace(static_cast<unsigned char>(value[begin]))) {
@@ -82,6 +99,10 @@ static bool parse_backend_module(const std::string& raw_name, SDBackendModule* m
         *module = SDBackendModule::UPSCALER;
         return true;
     }
+    if (name == "audiovae" || name == "audio" || name == "vocoder") {
+        *module = SDBackendModule::AUDIO_VAE;
+        return true;
+    }
     return false;
 }
 
@@ -90,6 +111,9 @@ static std::string module_assignment_name(const SDBackendAssignment& assignment,
     if (it != assignment.module_names.end()) {
         return it->second;
     }
+    if (module == SDBackendModule::AUDIO_VAE) {
+        return module_assignment_name(assignment, SDBackendModule::VAE);
+    }
     return assignment.default_name;
 }
 
@@ -234,6 +258,47 @@ bool add_rpc_devices(const std::string& servers) {
     return true;
 }
 
+ggml_backend_buffer_type_t sd_backend_split_buffer_type(ggml_backend_t backend, const std::vector<float>& proportions) {
+    ggml_backend_dev_t dev = backend != nullptr ? ggml_backend_get_device(backend) : nullptr;
+    if (dev == nullptr) {
+        return nullptr;
+    }
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    auto split_buft_fn     = (ggml_backend_split_buffer_type_t)ggml_backend_reg_get_proc_address(reg, "ggml_backend_split_buffer_type");
+    if (split_buft_fn == nullptr) {
+        LOG_WARN("%s has no split buffer type, tensor split is off", ggml_backend_name(backend));
+        return nullptr;
+    }
+    const size_t n_devices = ggml_backend_reg_dev_count(reg);
+    int main_device        = -1;
+    for (size_t i = 0; i < n_devices; ++i) {
+        if (ggml_backend_reg_dev_get(reg, i) == dev) {
+            main_device = static_cast<int>(i);
+        }
+    }
+    if (main_device < 0) {
+        return nullptr;
+    }
+    if (proportions.size() > n_devices) {
+        LOG_WARN("tensor split lists %zu devices, but %s has %zu; ignoring the rest",
+                 proportions.size(),
+                 ggml_backend_reg_name(reg),
+                 n_devices);
+    }
+    // the backend reads one entry per device it knows of, up to its own maximum
+    std::vector<float> split(std::max<size_t>(n_devices, 64), 0.0f);
+    size_t n_used = 0;
+    for (size_t i = 0; i < std::min(proportions.size(), n_devices); ++i) {
+        split[i] = std::max(proportions[i], 0.0f);
+        n_used += split[i] > 0.0f ? 1 : 0;
+    }
+    if (n_used < 2) {
+        LOG_WARN("tensor split needs rows on at least two devices, tensor split is off");
+        return nullptr;
+    }
+    return split_buft_fn(main_device, split.data());
+}
+
 static void ggml_backend_load_all_once() {
     // If the registry already has devices and the CPU backend is present,
     // assume either static registration or explicit host-side preloading has
@@ -364,6 +429,82 @@ bool sd_backend_cpu_set_n_threads(ggml_backend_t backend, int n_threads) {
     return false;
 }
 
+bool sd_backend_cpu_numa_init(numa_placement_t placement) {
+    ggml_backend_load_all_once();
+    auto dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (dev == nullptr || placement == NUMA_PLACEMENT_NONE || placement >= NUMA_PLACEMENT_COUNT) {
+        return false;
+    }
+    auto reg     = ggml_backend_dev_backend_reg(dev);
+    auto init_fn = (ggml_backend_cpu_numa_init_t)ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_numa_init");
+    auto is_fn   = (ggml_backend_cpu_is_numa_t)ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_is_numa");
+    if (init_fn == nullptr || is_fn == nullptr) {
+        return false;
+    }
+    ggml_numa_strategy strategy = GGML_NUMA_STRATEGY_DISTRIBUTE;
+    if (placement == NUMA_PLACEMENT_ISOLATE) {
+        strategy = GGML_NUMA_STRATEGY_ISOLATE;
+    } else if (placement == NUMA_PLACEMENT_NUMACTL) {
+        strategy = GGML_NUMA_STRATEGY_NUMACTL;
+    }
+    init_fn(strategy);
+    return is_fn();
+}
+
+bool sd_parse_cpu_threadpool_args(const char* args, SDCpuThreadpoolConfig* config, std::string* error) {
+    auto fail = [&](const std::string& key, const std::string& value) {
+        if (error != nullptr) {
+            *error = "invalid cpu threadpool arg '" + key + "=" + value + "'";
+        }
+        return false;
+    };
+    for (const auto& [key, value] : parse_key_value_args(args, "cpu threadpool arg")) {
+        if (key == "poll") {
+            if (!parse_strict_int(value, config->poll) || config->poll < 0 || config->poll > 100) {
+                return fail(key, value);
+            }
+        } else if (key == "cpus") {
+            config->cpus.clear();
+            for (const auto& item : split_string(value, '+')) {
+                size_t dash = item.find('-');
+                int first   = 0;
+                int last    = 0;
+                if (!parse_strict_int(item.substr(0, dash), first) ||
+                    !parse_strict_int(dash == std::string::npos ? item : item.substr(dash + 1), last) ||
+                    first < 0 || last < first || last >= GGML_MAX_N_THREADS) {
+                    return fail(key, value);
+                }
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    config->cpus.push_back(cpu);
+                }
+            }
+        } else if (key == "strict") {
+            if (!parse_strict_bool(value, config->strict_cpu)) {
+                return fail(key, value);
+            }
+        } else if (key == "persistent") {
+            if (!parse_strict_bool(value, config->persistent)) {
+                return fail(key, value);
+            }
+        } else if (key == "prio") {
+            if (value == "normal") {
+                config->prio = GGML_SCHED_PRIO_NORMAL;
+            } else if (value == "medium") {
+                config->prio = GGML_SCHED_PRIO_MEDIUM;
+            } else if (value == "high") {
+                config->prio = GGML_SCHED_PRIO_HIGH;
+            } else if (value == "realtime") {
+                config->prio = GGML_SCHED_PRIO_REALTIME;
+            } else {
+                return fail(key, value);
+            }
+        } else {
+            LOG_WARN("ignoring unknown cpu threadpool arg '%s'", key.c_str());
+        }
+    }
+    return true;
+}
+
 const char* sd_get_system_info() {
     static std::string cache_info = []() -> std::string {
         ggml_backend_load_all_once();
@@ -390,6 +531,18 @@ const char* sd_get_system_info() {
     return cache_info.c_str();
 }
 
+const char* sd_get_device_probe_info(int n_threads) {
+    static std::mutex info_mutex;
+    static std::string info;
+    ggml_backend_load_all_once();
+    if (n_threads <= 0) {
+        n_threads = sd_get_num_physical_cores();
+    }
+    std::lock_guard<std::mutex> lock(info_mutex);
+    info = "Device Probe: \n" + sd::device_probe::to_string(sd::device_probe::probe(n_threads));
+    return info.c_str();
+}
+
 static ggml_backend_t sd_get_default_backend() {
     ggml_backend_load_all_once();
     static std::once_flag once;
@@ -525,6 +678,13 @@ SDBackendManager::~SDBackendManager() {
 
 void SDBackendManager::reset() {
     backends_.clear();
+    if (cpu_threadpool_ != nullptr) {
+        auto free_fn = (ggml_threadpool_free_t)cpu_backend_proc_address("ggml_threadpool_free");
+        if (free_fn != nullptr) {
+            free_fn(cpu_threadpool_);
+        }
+        cpu_threadpool_ = nullptr;
+    }
     runtime_assignment_ = {};
     params_assignment_  = {};
 }
@@ -544,6 +704,51 @@ ggml_backend_t SDBackendManager::params_backend(SDBackendModule module) {
     return init_cached_backend(name);
 }
 
+ggml_backend_t SDBackendManager::named_backend(const std::string& name) {
+    return init_cached_backend(name);
+}
+
+bool SDBackendManager::set_cpu_threadpool(const SDCpuThreadpoolConfig& config) {
+    if (!config.persistent || cpu_threadpool_ != nullptr) {
+        return true;
+    }
+    auto new_fn = (ggml_threadpool_new_t)cpu_backend_proc_address("ggml_threadpool_new");
+    if (new_fn == nullptr || cpu_backend_proc_address("ggml_backend_cpu_set_threadpool") == nullptr) {
+        LOG_WARN("the CPU backend has no threadpools, computes start their own threads");
+        return false;
+    }
+    ggml_threadpool_params params = ggml_threadpool_params_default(std::max(1, config.n_threads));
+    params.poll                   = static_cast<uint32_t>(config.poll);
+    params.prio                   = config.prio;
+    params.strict_cpu             = config.strict_cpu;
+    for (int cpu : config.cpus) {
+        params.cpumask[cpu] = true;
+    }
+    cpu_threadpool_ = new_fn(&params);
+    if (cpu_threadpool_ == nullptr) {
+        LOG_WARN("creating the CPU threadpool failed, computes start their own threads");
+        return false;
+    }
+    LOG_INFO("CPU backends compute on a persistent threadpool of %d threads (poll %d%s)",
+             params.n_threads,
+             config.poll,
+             config.cpus.empty() ? "" : sd_format(", %zu CPUs", config.cpus.size()).c_str());
+    for (const auto& [_, backend] : backends_) {
+        attach_cpu_threadpool(backend.get());
+    }
+    return true;
+}
+
+void SDBackendManager::attach_cpu_threadpool(ggml_backend_t backend) {
+    if (cpu_threadpool_ == nullptr || !sd_backend_is_cpu(backend)) {
+        return;
+    }
+    auto set_fn = (ggml_backend_cpu_set_threadpool_t)cpu_backend_proc_address("ggml_backend_cpu_set_threadpool");
+    if (set_fn != nullptr) {
+        set_fn(backend, cpu_threadpool_);
+    }
+}
+
 bool SDBackendManager::runtime_backend_is_cpu(SDBackendModule module) {
     return sd_backend_is_cpu(runtime_backend(module));
 }
@@ -573,6 +778,17 @@ bool SDBackendManager::runtime_backend_supports_host_buffer(SDBackendModule modu
     return props.caps.buffer_from_host_ptr;
 }
 
+bool SDBackendManager::offload_params_to_cpu(SDBackendModule module) {
+    if (params_assignment_.module_names.count(module) > 0 ||
+        params_backend_is_disk(module) ||
+        runtime_backend_is_cpu(module) ||
+        params_backend_is_cpu(module)) {
+        return false;
+    }
+    params_assignment_.set_module(module, "cpu");
+    return true;
+}
+
 bool SDBackendManager::init(const char* backend_spec,
                             const char* params_backend_spec,
                             std::string* error) {
@@ -665,6 +881,7 @@ ggml_backend_t SDBackendManager::init_cached_backend(const std::string& name) {
 
     SDBackendHandle handle(backend);
     backends_.emplace(actual_key, std::move(handle));
+    attach_cpu_threadpool(backend);
     return backend;
 }
 
@@ -684,6 +901,8 @@ const char* sd_backend_module_name(SDBackendModule module) {
             return "photomaker";
         case SDBackendModule::UPSCALER:
             return "upscaler";
+        case SDBackendModule::AUDIO_VAE:
+            return "audio_vae";
     }
     return "unknown";
 }
@@ -6,9 +6,11 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "ggml-backend.h"
 #include "ggml.h"
+#include "stable-diffusion.h"
 
 enum class SDBackendModule {
     DIFFUSION,
@@ -18,6 +20,7 @@ enum class SDBackendModule {
     CONTROL_NET,
     PHOTOMAKER,
     UPSCALER,
+    AUDIO_VAE,  // follows VAE unless assigned
 };
 
 struct SDBackendAssignment {
@@ -36,11 +39,27 @@ struct SDBackendHandleDeleter {
 
 using SDBackendHandle = std::unique_ptr<struct ggml_backend, SDBackendHandleDeleter>;
 
+// The ggml threadpool the CPU backends of a context compute with.
+struct SDCpuThreadpoolConfig {
+    bool persistent          = true;   // false: ggml starts and joins workers per graph
+    int poll                 = 50;     // 0..100, how long idle workers spin before they sleep
+    bool strict_cpu          = false;  // one CPU of `cpus` per worker
+    int n_threads            = 0;
+    ggml_sched_priority prio = GGML_SCHED_PRIO_NORMAL;
+    std::vector<int> cpus;  // CPUs the workers may run on, any when empty
+};
+
+// Reads a key=value list: poll=0..100, cpus=0-7+16 ('+'-joined CPUs and
+// ranges), strict=true|false, prio=normal|medium|high|realtime and
+// persistent=true|false. Unknown keys are warned about and ignored.
+bool sd_parse_cpu_threadpool_args(const char* args, SDCpuThreadpoolConfig* config, std::string* error);
+
 class SDBackendManager {
 private:
     SDBackendAssignment runtime_assignment_;
     SDBackendAssignment params_assignment_;
     std::unordered_map<std::string, SDBackendHandle> backends_;
+    struct ggml_threadpool* cpu_threadpool_ = nullptr;  // freed by reset, after the backends
 
 public:
     SDBackendManager() = default;
@@ -61,8 +80,21 @@ public:
     bool params_backend_is_cpu(SDBackendModule module);
     bool params_backend_is_disk(SDBackendModule module) const;
     bool runtime_backend_supports_host_buffer(SDBackendModule module);
+    // Moves the params of `module` to the CPU backend unless a params
+    // backend was assigned to it explicitly or it already computes there.
+    // Returns whether the assignment changed.
+    bool offload_params_to_cpu(SDBackendModule module);
+    // Backend for a device name outside the module assignment, initialized
+    // once and owned by the manager.
+    ggml_backend_t named_backend(const std::string& name);
+    // Gives the CPU backends of the manager, current and later ones, one
+    // ggml threadpool kept until reset, so every graph computes on the same
+    // workers instead of starting and joining threads of its own. Returns
+    // false when the CPU backend lacks threadpools.
+    bool set_cpu_threadpool(const SDCpuThreadpoolConfig& config);
 
 private:
+    void attach_cpu_threadpool(ggml_backend_t backend);
     bool validate(std::string* error) const;
     ggml_backend_t init_cached_backend(const std::string& name);
 };
@@ -71,8 +103,17 @@ bool sd_backend_is(ggml_backend_t backend, const std::string& name);
 bool sd_backend_is_cpu(ggml_backend_t backend);
 ggml_backend_t sd_backend_cpu_init();
 bool sd_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads);
+// Has the CPU backend place its compute threads for `placement` (ggml's NUMA
+// strategies). Process-wide and only honoured the first time; false when the
+// backend lacks it or the system is not NUMA.
+bool sd_backend_cpu_numa_init(numa_placement_t placement);
 std::string sd_backend_resolve_name(const std::string& name);
 const char* sd_backend_module_name(SDBackendModule module);
 void ggml_ext_im_set_f32_1d(const struct ggml_tensor* tensor, int i, float value);
 bool add_rpc_devices(const std::string& servers);
+// Split buffer type that spreads matmul weight rows over the devices of
+// `backend`'s registry in the given proportions, one per device index; null
+// when the backend has none (only CUDA does) or fewer than two devices get
+// rows.
+ggml_backend_buffer_type_t sd_backend_split_buffer_type(ggml_backend_t backend, const std::vector<float>& proportions);
 #endif  // __SD_CORE_GGML_EXTEND_BACKEND_H__
@@ -3,8 +3,12 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iterator>
 #include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <stack>
@@ -914,6 +918,335 @@ namespace sd::ggml_graph_cut {
         return merged_plan;
     }
 
+    // Plans kept across processes, one file per key. The key hashes what a
+    // plan is derived from: the op, type, shape, name and sources of every
+    // graph tensor, which params are, the backend device and the budget.
+    static const char PLAN_FILE_MAGIC[4]    = {'S', 'D', 'G', 'P'};
+    static const uint32_t PLAN_FILE_VERSION = 1;
+
+    static std::mutex plan_cache_mutex;
+    static std::string plan_cache_dir;
+
+    void set_plan_cache_dir(const std::string& dir) {
+        std::lock_guard<std::mutex> lock(plan_cache_mutex);
+        plan_cache_dir = dir;
+    }
+
+    static std::string get_plan_cache_dir() {
+        std::lock_guard<std::mutex> lock(plan_cache_mutex);
+        return plan_cache_dir;
+    }
+
+    static void hash_bytes(uint64_t* hash, const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            *hash ^= bytes[i];
+            *hash *= 1099511628211ULL;
+        }
+    }
+
+    template <typename T>
+    static void hash_pod(uint64_t* hash, const T& value) {
+        hash_bytes(hash, &value, sizeof(T));
+    }
+
+    static uint64_t plan_cache_key(ggml_backend_t backend,
+                                   ggml_cgraph* gf,
+                                   const std::unordered_set<const ggml_tensor*>& params_tensor_set,
+                                   size_t max_graph_vram_bytes) {
+        uint64_t hash          = 14695981039346656037ULL;
+        std::string device     = ggml_backend_name(backend);
+        ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+        if (dev != nullptr) {
+            device += "/";
+            device += ggml_backend_dev_description(dev);
+        }
+        hash_bytes(&hash, device.data(), device.size());
+        hash_pod(&hash, static_cast<uint64_t>(max_graph_vram_bytes));
+
+        const int n_nodes = ggml_graph_n_nodes(gf);
+        std::unordered_map<const ggml_tensor*, int> tensor_index;
+        tensor_index.reserve(static_cast<size_t>(gf->n_leafs + n_nodes));
+        auto hash_tensor = [&](const ggml_tensor* tensor) {
+            hash_pod(&hash, static_cast<int32_t>(tensor->op));
+            hash_pod(&hash, static_cast<int32_t>(tensor->type));
+            hash_bytes(&hash, tensor->ne, sizeof(tensor->ne));
+            hash_bytes(&hash, tensor->name, strnlen(tensor->name, sizeof(tensor->name)));
+            for (int s = 0; s < GGML_MAX_SRC; ++s) {
+                auto it = tensor->src[s] != nullptr ? tensor_index.find(tensor->src[s]) : tensor_index.end();
+                hash_pod(&hash, static_cast<int32_t>(it != tensor_index.end() ? it->second : -1));
+            }
+        };
+        hash_pod(&hash, static_cast<int32_t>(gf->n_leafs));
+        for (int i = 0; i < gf->n_leafs; ++i) {
+            const ggml_tensor* leaf = gf->leafs[i];
+            hash_tensor(leaf);
+            hash_pod(&hash, static_cast<uint8_t>(is_params_tensor(params_tensor_set, leaf) ? 1 : 0));
+            tensor_index[leaf] = i;
+        }
+        hash_pod(&hash, static_cast<int32_t>(n_nodes));
+        for (int i = 0; i < n_nodes; ++i) {
+            const ggml_tensor* node = ggml_graph_node(gf, i);
+            hash_tensor(node);
+            tensor_index[node] = gf->n_leafs + i;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    static void write_pod(std::string* out, const T& value) {
+        out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void write_string(std::string* out, const std::string& value) {
+        write_pod(out, static_cast<uint32_t>(value.size()));
+        out->append(value);
+    }
+
+    static void write_indices(std::string* out, const std::vector<int>& indices) {
+        write_pod(out, static_cast<uint32_t>(indices.size()));
+        for (int index : indices) {
+            write_pod(out, static_cast<int32_t>(index));
+        }
+    }
+
+    struct PlanReader {
+        const std::string& data;
+        size_t offset = 0;
+
+        template <typename T>
+        bool read_pod(T* value) {
+            if (sizeof(T) > data.size() - offset) {
+                return false;
+            }
+            memcpy(value, data.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return true;
+        }
+
+        bool read_count(uint32_t* n, size_t min_item_bytes) {
+            return read_pod(n) && static_cast<uint64_t>(*n) * min_item_bytes <= data.size() - offset;
+        }
+
+        bool read_string(std::string* value) {
+            uint32_t n = 0;
+            if (!read_count(&n, 1)) {
+                return false;
+            }
+            value->assign(data, offset, n);
+            offset += n;
+            return true;
+        }
+
+        bool read_indices(std::vector<int>* indices) {
+            uint32_t n = 0;
+            if (!read_count(&n, sizeof(int32_t))) {
+                return false;
+            }
+            indices->resize(n);
+            for (uint32_t i = 0; i < n; ++i) {
+                int32_t index = 0;
+                read_pod(&index);
+                (*indices)[i] = index;
+            }
+            return true;
+        }
+    };
+
+    static std::string serialize_plan(uint64_t key, const Plan& plan) {
+        std::string out(PLAN_FILE_MAGIC, sizeof(PLAN_FILE_MAGIC));
+        write_pod(&out, PLAN_FILE_VERSION);
+        write_pod(&out, key);
+        write_pod(&out, static_cast<uint8_t>(plan.available));
+        write_pod(&out, static_cast<uint8_t>(plan.has_cuts));
+        write_pod(&out, static_cast<uint8_t>(plan.valid));
+        write_pod(&out, static_cast<int32_t>(plan.n_nodes));
+        write_pod(&out, static_cast<int32_t>(plan.n_leafs));
+        write_pod(&out, static_cast<uint32_t>(plan.input_shapes.size()));
+        for (const auto& shape : plan.input_shapes) {
+            write_pod(&out, static_cast<int32_t>(shape.leaf_index));
+            write_pod(&out, static_cast<int32_t>(shape.type));
+            for (int64_t ne : shape.ne) {
+                write_pod(&out, ne);
+            }
+        }
+        write_pod(&out, static_cast<uint32_t>(plan.segments.size()));
+        for (const auto& segment : plan.segments) {
+            write_pod(&out, static_cast<uint64_t>(segment.compute_buffer_size));
+            write_pod(&out, static_cast<uint64_t>(segment.output_bytes));
+            write_pod(&out, static_cast<uint64_t>(segment.input_external_bytes));
+            write_pod(&out, static_cast<uint64_t>(segment.input_previous_cut_bytes));
+            write_pod(&out, static_cast<uint64_t>(segment.input_param_bytes));
+            write_string(&out, segment.group_name);
+            write_indices(&out, segment.internal_node_indices);
+            write_indices(&out, segment.output_node_indices);
+            write_pod(&out, static_cast<uint32_t>(segment.input_refs.size()));
+            for (const auto& input_ref : segment.input_refs) {
+                write_pod(&out, static_cast<int32_t>(input_ref.type));
+                write_string(&out, input_ref.display_name);
+                write_pod(&out, static_cast<int32_t>(input_ref.leaf_index));
+                write_pod(&out, static_cast<int32_t>(input_ref.node_index));
+            }
+            write_pod(&out, static_cast<uint8_t>(segment.residency));
+        }
+        return out;
+    }
+
+    static bool deserialize_plan(const std::string& data, uint64_t key, Plan* plan) {
+        if (data.size() < sizeof(PLAN_FILE_MAGIC) || memcmp(data.data(), PLAN_FILE_MAGIC, sizeof(PLAN_FILE_MAGIC)) != 0) {
+            return false;
+        }
+        PlanReader reader{data, sizeof(PLAN_FILE_MAGIC)};
+        uint32_t version  = 0;
+        uint64_t file_key = 0;
+        uint8_t flags[3]  = {0, 0, 0};
+        int32_t n_nodes   = 0;
+        int32_t n_leafs   = 0;
+        uint32_t n_shapes = 0;
+        if (!reader.read_pod(&version) || version != PLAN_FILE_VERSION ||
+            !reader.read_pod(&file_key) || file_key != key ||
+            !reader.read_pod(&flags[0]) || !reader.read_pod(&flags[1]) || !reader.read_pod(&flags[2]) ||
+            !reader.read_pod(&n_nodes) || !reader.read_pod(&n_leafs) ||
+            !reader.read_count(&n_shapes, 2 * sizeof(int32_t) + GGML_MAX_DIMS * sizeof(int64_t))) {
+            return false;
+        }
+        plan->available = flags[0] != 0;
+        plan->has_cuts  = flags[1] != 0;
+        plan->valid     = flags[2] != 0;
+        plan->n_nodes   = n_nodes;
+        plan->n_leafs   = n_leafs;
+        plan->input_shapes.resize(n_shapes);
+        for (auto& shape : plan->input_shapes) {
+            int32_t leaf_index = 0;
+            int32_t type       = 0;
+            reader.read_pod(&leaf_index);
+            reader.read_pod(&type);
+            for (int64_t& ne : shape.ne) {
+                reader.read_pod(&ne);
+            }
+            shape.leaf_index = leaf_index;
+            shape.type       = static_cast<ggml_type>(type);
+        }
+
+        uint32_t n_segments = 0;
+        if (!reader.read_count(&n_segments, 5 * sizeof(uint64_t))) {
+            return false;
+        }
+        plan->segments.resize(n_segments);
+        for (auto& segment : plan->segments) {
+            uint64_t sizes[5] = {0, 0, 0, 0, 0};
+            uint32_t n_refs   = 0;
+            uint8_t residency = 0;
+            for (uint64_t& size : sizes) {
+                if (!reader.read_pod(&size)) {
+                    return false;
+                }
+            }
+            if (!reader.read_string(&segment.group_name) ||
+                !reader.read_indices(&segment.internal_node_indices) ||
+                !reader.read_indices(&segment.output_node_indices) ||
+                !reader.read_count(&n_refs, 3 * sizeof(int32_t))) {
+                return false;
+            }
+            segment.input_refs.resize(n_refs);
+            for (auto& input_ref : segment.input_refs) {
+                int32_t type       = 0;
+                int32_t leaf_index = 0;
+                int32_t node_index = 0;
+                if (!reader.read_pod(&type) || type < Segment::INPUT_EXTERNAL || type > Segment::INPUT_PARAM ||
+                    !reader.read_string(&input_ref.display_name) ||
+                    !reader.read_pod(&leaf_index) ||
+                    !reader.read_pod(&node_index)) {
+                    return false;
+                }
+                input_ref.type       = static_cast<Segment::InputType>(type);
+                input_ref.leaf_index = leaf_index;
+                input_ref.node_index = node_index;
+            }
+            if (!reader.read_pod(&residency)) {
+                return false;
+            }
+            segment.compute_buffer_size      = static_cast<size_t>(sizes[0]);
+            segment.output_bytes             = static_cast<size_t>(sizes[1]);
+            segment.input_external_bytes     = static_cast<size_t>(sizes[2]);
+            segment.input_previous_cut_bytes = static_cast<size_t>(sizes[3]);
+            segment.input_param_bytes        = static_cast<size_t>(sizes[4]);
+            segment.residency                = residency != 0 ? SegmentResidency::RESIDENT : SegmentResidency::STREAMED;
+        }
+        return reader.offset == data.size();
+    }
+
+    // A loaded plan must describe this graph and index only into it.
+    static bool plan_fits_graph(ggml_cgraph* gf, const Plan& plan) {
+        if (!plan_matches_graph(gf, plan)) {
+            return false;
+        }
+        const int n_nodes = ggml_graph_n_nodes(gf);
+        for (const auto& segment : plan.segments) {
+            for (const std::vector<int>* indices : {&segment.internal_node_indices, &segment.output_node_indices}) {
+                for (int index : *indices) {
+                    if (index < 0 || index >= n_nodes) {
+                        return false;
+                    }
+                }
+            }
+            for (const auto& input_ref : segment.input_refs) {
+                const bool in_range = input_ref.type == Segment::INPUT_PREVIOUS_CUT
+                                          ? input_ref.node_index >= 0 && input_ref.node_index < n_nodes
+                                          : input_ref.leaf_index >= 0 && input_ref.leaf_index < gf->n_leafs;
+                if (!in_range) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The plan for max_graph_vram_bytes from the plan cache directory, or
+    // the one make() measures, which is then written there.
+    template <typename F>
+    static Plan load_or_make_plan(ggml_backend_t backend,
+                                  ggml_cgraph* gf,
+                                  const std::unordered_set<const ggml_tensor*>& params_tensor_set,
+                                  size_t max_graph_vram_bytes,
+                                  const char* log_desc,
+                                  F&& make) {
+        const std::string dir = get_plan_cache_dir();
+        if (dir.empty()) {
+            return make();
+        }
+        const uint64_t key     = plan_cache_key(backend, gf, params_tensor_set, max_graph_vram_bytes);
+        const std::string path = path_join(dir, sd_format("graph-cut-%016llx.bin", (unsigned long long)key));
+
+        Plan plan;
+        std::ifstream in(path, std::ios::binary);
+        if (in) {
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (deserialize_plan(data, key, &plan) && plan_fits_graph(gf, plan)) {
+                LOG_DEBUG("%s loaded graph cut plan from '%s'", log_desc != nullptr ? log_desc : "", path.c_str());
+                return plan;
+            }
+            LOG_WARN("graph cut plan '%s' does not match the graph, measuring it again", path.c_str());
+        }
+
+        plan = make();
+        const std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            const std::string data = serialize_plan(key, plan);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!out) {
+                LOG_WARN("failed to write graph cut plan '%s'", tmp_path.c_str());
+                return plan;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            LOG_WARN("failed to write graph cut plan '%s'", path.c_str());
+        }
+        return plan;
+    }
+
     Plan resolve_plan(ggml_backend_t backend,
                       ggml_cgraph* gf,
                       PlanCache* cache,
@@ -930,13 +1263,17 @@ namespace sd::ggml_graph_cut {
         if (cache->graph_cut_plan.available && plan_matches_graph(gf, cache->graph_cut_plan)) {
             base_plan = cache->graph_cut_plan;
         } else {
-            base_plan                                = build_plan(backend, gf, params_tensor_set, log_desc);
+            base_plan = load_or_make_plan(backend, gf, params_tensor_set, 0, log_desc, [&]() {
+                Plan plan = build_plan(backend, gf, params_tensor_set, log_desc);
+                if (log_desc != nullptr) {
+                    LOG_INFO("%s build cached graph cut plan done (taking %lld ms)", log_desc, ggml_time_ms() - t_plan_begin);
+                }
+                return plan;
+            });
+
             cache->graph_cut_plan                    = base_plan;
             cache->graph_cut_plan.available          = true;
             cache->budgeted_graph_cut_plan.available = false;
-            if (log_desc != nullptr) {
-                LOG_INFO("%s build cached graph cut plan done (taking %lld ms)", log_desc, ggml_time_ms() - t_plan_begin);
-            }
         }
 
         Plan resolved_plan = base_plan;
@@ -946,12 +1283,10 @@ namespace sd::ggml_graph_cut {
                 plan_matches_graph(gf, cache->budgeted_graph_cut_plan)) {
                 resolved_plan = cache->budgeted_graph_cut_plan;
             } else {
-                resolved_plan                                 = apply_max_vram_budget(gf,
-                                                                                      base_plan,
-                                                                                      max_graph_vram_bytes,
-                                                                                      backend,
-                                                                                      params_tensor_set,
-                                                                                      log_desc);
+                resolved_plan = load_or_make_plan(backend, gf, params_tensor_set, max_graph_vram_bytes, log_desc, [&]() {
+                    return apply_max_vram_budget(gf, base_plan, max_graph_vram_bytes, backend, params_tensor_set, log_desc);
+                });
+
                 cache->budgeted_graph_cut_plan                = resolved_plan;
                 cache->budgeted_graph_cut_plan.available      = true;
                 cache->budgeted_graph_cut_plan_max_vram_bytes = max_graph_vram_bytes;
@@ -960,7 +1295,9 @@ namespace sd::ggml_graph_cut {
         return resolved_plan;
     }
 
-    void annotate_residency(Plan& plan, size_t max_graph_vram_bytes) {
+    void annotate_residency(Plan& plan,
+                            size_t max_graph_vram_bytes,
+                            const std::unordered_map<std::string, SegmentUsage>* usage) {
         // Cached plans may be reused with a smaller live budget.
         for (auto& seg : plan.segments) {
             seg.residency = SegmentResidency::STREAMED;
@@ -1000,14 +1337,103 @@ namespace sd::ggml_graph_cut {
         }
         const size_t available = max_graph_vram_bytes - reserved;
 
+        if (usage == nullptr || usage->empty()) {
+            size_t cumulative = 0;
+            for (auto& seg : plan.segments) {
+                if (cumulative + seg.input_param_bytes > available) {
+                    break;
+                }
+                seg.residency = SegmentResidency::RESIDENT;
+                cumulative += seg.input_param_bytes;
+            }
+            return;
+        }
+
+        // Greedy knapsack: the transfer time a segment costs per byte it would
+        // pin. Segments that ran less often (skipped by a step cache) or whose
+        // prefetch hid behind compute rank lower; ties keep graph order.
+        auto transfer_per_byte = [&](const Segment& seg) {
+            auto it = usage->find(seg.group_name);
+            if (it == usage->end() || seg.input_param_bytes == 0) {
+                return 0.0;
+            }
+            return it->second.transfer_ms / static_cast<double>(seg.input_param_bytes);
+        };
+        std::vector<size_t> order(plan.segments.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return transfer_per_byte(plan.segments[a]) > transfer_per_byte(plan.segments[b]);
+        });
         size_t cumulative = 0;
-        for (auto& seg : plan.segments) {
+        for (size_t index : order) {
+            Segment& seg = plan.segments[index];
             if (cumulative + seg.input_param_bytes > available) {
-                break;
+                continue;
             }
             seg.residency = SegmentResidency::RESIDENT;
             cumulative += seg.input_param_bytes;
         }
     }
 
+    std::map<ggml_type, double> segment_gflop(ggml_cgraph* gf, const Segment& segment) {
+        std::map<ggml_type, double> gflop;
+        for (int node_index : segment.internal_node_indices) {
+            if (node_index < 0 || node_index >= gf->n_nodes) {
+                continue;
+            }
+            const ggml_tensor* node = gf->nodes[node_index];
+            if (node->op == GGML_OP_MUL_MAT) {
+                const ggml_tensor* a = node->src[0];
+                const ggml_tensor* b = node->src[1];
+                gflop[a->type] += 2.0 * a->ne[0] * a->ne[1] * (b->ne[1] * b->ne[2] * b->ne[3]) / 1e9;
+            } else if (node->op == GGML_OP_FLASH_ATTN_EXT) {
+                const ggml_tensor* q = node->src[0];
+                const ggml_tensor* k = node->src[1];
+                gflop[k->type] += 4.0 * q->ne[0] * q->ne[1] * q->ne[2] * q->ne[3] * k->ne[1] / 1e9;
+            }
+        }
+        return gflop;
+    }
+
+    size_t annotate_host_execution(ggml_cgraph* gf, Plan& plan, const HostExecutionRates& rates) {
+        if (gf == nullptr || rates.upload_gbps <= 0.0) {
+            return 0;
+        }
+        auto compute_ms = [](const std::map<ggml_type, double>& gflop, const std::map<ggml_type, double>& rate) -> double {
+            auto f16  = rate.find(GGML_TYPE_F16);
+            double ms = 0.0;
+            for (const auto& [type, amount] : gflop) {
+                auto it = rate.find(type);
+                if (it == rate.end()) {
+                    it = f16;
+                }
+                if (it == rate.end() || it->second <= 0.0) {
+                    return INFINITY;
+                }
+                ms += amount / it->second * 1000.0;
+            }
+            return ms;
+        };
+        const double bytes_per_ms = rates.upload_gbps * 1e6;
+        size_t moved              = 0;
+        for (Segment& seg : plan.segments) {
+            if (seg.residency != SegmentResidency::STREAMED || seg.input_param_bytes == 0) {
+                continue;
+            }
+            const std::map<ggml_type, double> gflop = segment_gflop(gf, seg);
+
+            const double upload_ms     = seg.input_param_bytes / bytes_per_ms;
+            const double activation_ms = (seg.input_previous_cut_bytes + seg.output_bytes) / bytes_per_ms;
+            const double device_ms     = std::max(upload_ms, compute_ms(gflop, rates.device_gflops));
+            const double host_ms       = compute_ms(gflop, rates.host_gflops) + activation_ms;
+            if (host_ms < device_ms) {
+                seg.residency = SegmentResidency::HOST;
+                moved++;
+            }
+        }
+        return moved;
+    }
+
 }  // namespace sd::ggml_graph_cut
@@ -3,6 +3,7 @@
 
 #include <array>
 #include <cstdint>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -17,6 +18,7 @@ namespace sd::ggml_graph_cut {
     enum class SegmentResidency : uint8_t {
         STREAMED = 0,
         RESIDENT = 1,
+        HOST     = 2,  // computed on the host backend, where the params live
     };
 
     struct Segment {
@@ -114,6 +116,9 @@ namespace sd::ggml_graph_cut {
                                ggml_backend_t backend,
                                const std::unordered_set<const ggml_tensor*>& params_tensor_set,
                                const char* log_desc);
+    // Directory where resolve_plan keeps plans across processes, so a restart
+    // skips measuring the segments; empty keeps them in memory only.
+    void set_plan_cache_dir(const std::string& dir);
     Plan resolve_plan(ggml_backend_t backend,
                       ggml_cgraph* gf,
                       PlanCache* cache,
@@ -121,8 +126,38 @@ namespace sd::ggml_graph_cut {
                       const std::unordered_set<const ggml_tensor*>& params_tensor_set,
                       const char* log_desc);
 
-    // Mark leading segments resident when they fit after streamed-segment headroom.
-    void annotate_residency(Plan& plan, size_t max_graph_vram_bytes);
+    // Measured use of the segments of a group across computes: how often it
+    // ran and how long compute was held up by the transfer of its params.
+    struct SegmentUsage {
+        uint64_t runs      = 0;
+        double transfer_ms = 0.0;
+    };
+
+    // Mark segments resident when they fit after streamed-segment headroom.
+    // Without usage the leading segments are taken; with it, the segments
+    // whose transfers held compute up longest per param byte.
+    void annotate_residency(Plan& plan,
+                            size_t max_graph_vram_bytes,
+                            const std::unordered_map<std::string, SegmentUsage>* usage = nullptr);
+
+    // Measured rates of the device a runner streams to and of the host its
+    // params live on; a weight type missing from a map runs at its f16 rate.
+    struct HostExecutionRates {
+        double upload_gbps = 0.0;  // host to device copy rate
+        std::map<ggml_type, double> device_gflops;
+        std::map<ggml_type, double> host_gflops;
+    };
+
+    // Matmul and attention flops of a segment, in GFLOP per weight type of
+    // the left operand.
+    std::map<ggml_type, double> segment_gflop(ggml_cgraph* gf, const Segment& segment);
+
+    // Moves streamed segments to the host when computing them there, next to
+    // their params, takes less time than the device does with their upload:
+    // the longer of upload and device compute, as prefetching overlaps the
+    // two, against host compute plus moving the activations both ways.
+    // Returns the number of segments moved.
+    size_t annotate_host_execution(ggml_cgraph* gf, Plan& plan, const HostExecutionRates& rates);
 }  // namespace sd::ggml_graph_cut
 
 #endif  // __SD_CORE_GGML_GRAPH_CUT_H__
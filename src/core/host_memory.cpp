@@ -0,0 +1,123 @@
+#include "core/host_memory.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "core/ggml_extend_backend.h"
+#include "core/util.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace sd {
+
+#ifdef __linux__
+    // numaif.h values, so libnuma is not needed to build or run
+    static constexpr int SD_MPOL_PREFERRED                = 1;
+    static constexpr int SD_MPOL_INTERLEAVE               = 3;
+    static constexpr unsigned long SD_MPOL_F_MEMS_ALLOWED = 1UL << 2;
+    static constexpr unsigned long SD_MAX_NUMA_NODES      = 1024;
+    static constexpr size_t SD_NODE_MASK_WORDS            = SD_MAX_NUMA_NODES / (8 * sizeof(unsigned long));
+#endif
+
+    namespace {
+        struct HostMemoryPolicy {
+            std::atomic<int> placement{NUMA_PLACEMENT_NONE};
+            std::atomic<bool> huge_pages{false};
+            std::atomic<int> local_node{-1};
+#ifdef __linux__
+            unsigned long allowed_nodes[SD_NODE_MASK_WORDS] = {};
+            int allowed_node_count                           = 0;
+#endif
+            std::once_flag numa_once;
+        };
+
+        HostMemoryPolicy& host_memory_policy() {
+            static HostMemoryPolicy policy;
+            return policy;
+        }
+    }  // namespace
+
+    void set_host_memory_policy(numa_placement_t placement, bool huge_pages) {
+        HostMemoryPolicy& policy = host_memory_policy();
+        if (placement >= NUMA_PLACEMENT_COUNT) {
+            placement = NUMA_PLACEMENT_NONE;
+        }
+        policy.huge_pages = huge_pages;
+        if (placement == NUMA_PLACEMENT_NONE) {
+            return;
+        }
+
+        std::call_once(policy.numa_once, [&]() {
+            if (!sd_backend_cpu_numa_init(placement)) {
+                LOG_WARN("NUMA placement '%s' is ignored: the CPU backend does not support it or the system has one node",
+                         sd_numa_placement_name(placement));
+                return;
+            }
+#ifdef __linux__
+            if (syscall(SYS_get_mempolicy, nullptr, policy.allowed_nodes, SD_MAX_NUMA_NODES, nullptr, SD_MPOL_F_MEMS_ALLOWED) == 0) {
+                for (unsigned long word : policy.allowed_nodes) {
+                    policy.allowed_node_count += __builtin_popcountl(word);
+                }
+            }
+            unsigned int cpu  = 0;
+            unsigned int node = 0;
+            if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+                policy.local_node = static_cast<int>(node);
+            }
+            LOG_INFO("NUMA placement '%s' over %d nodes, compute threads pinned by the CPU backend",
+                     sd_numa_placement_name(placement),
+                     policy.allowed_node_count);
+#endif
+            policy.placement = placement;
+        });
+    }
+
+    void advise_host_params(void* data, size_t size) {
+#ifdef __linux__
+        HostMemoryPolicy& policy = host_memory_policy();
+        const size_t page        = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t begin          = (reinterpret_cast<uintptr_t>(data) + page - 1) / page * page;
+        uintptr_t end            = (reinterpret_cast<uintptr_t>(data) + size) / page * page;
+        if (data == nullptr || end <= begin) {
+            return;
+        }
+        void* range  = reinterpret_cast<void*>(begin);
+        size_t bytes = end - begin;
+
+        if (policy.huge_pages) {
+            madvise(range, bytes, MADV_HUGEPAGE);
+        }
+        // only pages not touched yet are placed; callers advise before loading
+        int placement = policy.placement;
+        if (placement == NUMA_PLACEMENT_DISTRIBUTE && policy.allowed_node_count > 1) {
+            syscall(SYS_mbind, range, bytes, SD_MPOL_INTERLEAVE, policy.allowed_nodes, SD_MAX_NUMA_NODES, 0);
+        } else if (placement == NUMA_PLACEMENT_ISOLATE && policy.local_node >= 0 &&
+                   policy.local_node < static_cast<int>(SD_MAX_NUMA_NODES)) {
+            unsigned long node_mask[SD_NODE_MASK_WORDS] = {};
+            const size_t bits_per_word                  = 8 * sizeof(unsigned long);
+            node_mask[policy.local_node / bits_per_word] |= 1UL << (policy.local_node % bits_per_word);
+            syscall(SYS_mbind, range, bytes, SD_MPOL_PREFERRED, node_mask, SD_MAX_NUMA_NODES, 0);
+        }
+#else
+        (void)data;
+        (void)size;
+#endif
+    }
+
+    void advise_host_mapping(void* data, size_t size) {
+#ifdef __linux__
+        if (data != nullptr && size > 0 && host_memory_policy().huge_pages) {
+            madvise(data, size, MADV_HUGEPAGE);
+        }
+#else
+        (void)data;
+        (void)size;
+#endif
+    }
+
+}  // namespace sd
@@ -0,0 +1,27 @@
+#ifndef __SD_CORE_HOST_MEMORY_H__
+#define __SD_CORE_HOST_MEMORY_H__
+
+#include <cstddef>
+
+#include "stable-diffusion.h"
+
+namespace sd {
+
+    // Where large host allocations should land and whether they ask for
+    // transparent huge pages. The policy is process-wide: the CPU backend's
+    // thread placement it matches is process-wide too. Calling it with a NUMA
+    // placement also pins ggml's CPU compute threads to match, once per process.
+    void set_host_memory_policy(numa_placement_t placement, bool huge_pages);
+
+    // Applies the policy to a freshly allocated, not yet touched host range:
+    // huge page advice, and NUMA interleave (distribute) or preference for
+    // the compute threads' node (isolate). A hint only; does nothing off Linux.
+    void advise_host_params(void* data, size_t size);
+
+    // Huge page advice for a file mapping. Page cache placement follows the
+    // kernel's policy, so mappings get no NUMA binding.
+    void advise_host_mapping(void* data, size_t size);
+
+}  // namespace sd
+
+#endif  // __SD_CORE_HOST_MEMORY_H__
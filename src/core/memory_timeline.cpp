@@ -0,0 +1,269 @@
+#include "core/memory_timeline.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#include "core/util.h"
+#include "ggml.h"
+#include "json.hpp"
+
+namespace sd_perf {
+
+    namespace {
+
+        struct LiveBuffer {
+            std::string device;
+            BufferKind kind = BufferKind::PARAMS;
+            std::string owner;
+            size_t bytes = 0;
+        };
+
+        // The bookings and the installed timeline; one mutex keeps the
+        // timeline's events in booking order.
+        struct Ledger {
+            std::mutex mutex;
+            std::unordered_map<const void*, LiveBuffer> live;
+            std::map<std::string, uint64_t> device_bytes;
+            MemoryTimeline* timeline = nullptr;
+            std::string phase;
+
+            // never destroyed: buffers of other singletons are unbooked
+            // during static destruction
+            static Ledger& instance() {
+                static Ledger* ledger = new Ledger();
+                return *ledger;
+            }
+
+            // with the mutex held
+            void record(const LiveBuffer& buffer, int64_t delta_bytes) {
+                uint64_t& total = device_bytes[buffer.device];
+                total           = delta_bytes < 0 ? total - std::min<uint64_t>(total, static_cast<uint64_t>(-delta_bytes))
+                                                  : total + static_cast<uint64_t>(delta_bytes);
+                if (timeline == nullptr || delta_bytes == 0) {
+                    return;
+                }
+                MemoryTimeline::Event event;
+                event.time_us      = ggml_time_us();
+                event.device       = buffer.device;
+                event.kind         = buffer.kind;
+                event.owner        = buffer.owner;
+                event.delta_bytes  = delta_bytes;
+                event.device_bytes = total;
+                event.phase        = phase;
+                timeline->add(std::move(event));
+            }
+        };
+
+    }  // namespace
+
+    const char* buffer_kind_name(BufferKind kind) {
+        switch (kind) {
+            case BufferKind::PARAMS:
+                return "params";
+            case BufferKind::STAGING:
+                return "staging";
+            case BufferKind::COMPUTE:
+                return "compute";
+            case BufferKind::CACHE:
+                return "cache";
+            case BufferKind::INPUT:
+                return "input";
+            case BufferKind::COUNT:
+                break;
+        }
+        return "unknown";
+    }
+
+    void trace_buffer(const void* key, BufferKind kind, const std::string& owner, ggml_backend_buffer_type_t buft, size_t bytes) {
+        if (key == nullptr) {
+            return;
+        }
+        if (bytes == 0 || buft == nullptr) {
+            untrace_buffer(key);
+            return;
+        }
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        auto it = ledger.live.find(key);
+        if (it != ledger.live.end()) {
+            if (it->second.bytes == bytes) {
+                return;
+            }
+            // a grown gallocr, or a key reused by the allocator
+            LiveBuffer old = std::move(it->second);
+            ledger.live.erase(it);
+            ledger.record(old, -static_cast<int64_t>(old.bytes));
+        }
+        LiveBuffer& buffer = ledger.live[key];
+        buffer.device      = ggml_backend_buft_name(buft);
+        buffer.kind        = kind;
+        buffer.owner       = owner;
+        buffer.bytes       = bytes;
+        ledger.record(buffer, static_cast<int64_t>(bytes));
+    }
+
+    void trace_buffer(ggml_backend_buffer_t buffer, BufferKind kind, const std::string& owner) {
+        if (buffer == nullptr) {
+            return;
+        }
+        trace_buffer(buffer, kind, owner, ggml_backend_buffer_get_type(buffer), ggml_backend_buffer_get_size(buffer));
+    }
+
+    void untrace_buffer(const void* key) {
+        if (key == nullptr) {
+            return;
+        }
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        auto it = ledger.live.find(key);
+        if (it == ledger.live.end()) {
+            return;
+        }
+        LiveBuffer buffer = std::move(it->second);
+        ledger.live.erase(it);
+        ledger.record(buffer, -static_cast<int64_t>(buffer.bytes));
+    }
+
+    void set_memory_phase(const std::string& phase) {
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        ledger.phase = phase;
+    }
+
+    std::string memory_phase() {
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        return ledger.phase;
+    }
+
+    MemoryTimeline::MemoryTimeline()
+        : origin_us_(ggml_time_us()) {
+    }
+
+    void MemoryTimeline::add(Event event) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Device& device  = devices_[event.device];
+        uint64_t& bytes = device.kind_bytes[static_cast<int>(event.kind)];
+        bytes           = event.delta_bytes < 0 ? bytes - std::min<uint64_t>(bytes, static_cast<uint64_t>(-event.delta_bytes))
+                                                : bytes + static_cast<uint64_t>(event.delta_bytes);
+        if (event.device_bytes > device.peak.bytes) {
+            device.peak.device  = event.device;
+            device.peak.bytes   = event.device_bytes;
+            device.peak.time_us = event.time_us;
+            device.peak.phase   = event.phase;
+            std::copy(std::begin(device.kind_bytes), std::end(device.kind_bytes), std::begin(device.peak.kind_bytes));
+        }
+        events_.push_back(std::move(event));
+    }
+
+    std::vector<MemoryTimeline::Peak> MemoryTimeline::peaks() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Peak> result;
+        for (const auto& [name, device] : devices_) {
+            result.push_back(device.peak);
+        }
+        std::stable_sort(result.begin(), result.end(), [](const Peak& a, const Peak& b) {
+            return a.bytes > b.bytes;
+        });
+        return result;
+    }
+
+    void MemoryTimeline::log_summary() const {
+        for (const Peak& peak : peaks()) {
+            std::string split;
+            for (int kind = 0; kind < static_cast<int>(BufferKind::COUNT); ++kind) {
+                if (peak.kind_bytes[kind] > 0) {
+                    split += sd_format("%s%s %.2f MB",
+                                       split.empty() ? "" : ", ",
+                                       buffer_kind_name(static_cast<BufferKind>(kind)),
+                                       peak.kind_bytes[kind] / (1024.0 * 1024.0));
+                }
+            }
+            LOG_INFO("memory peak on %s: %.2f MB at %s (%s)",
+                     peak.device.c_str(),
+                     peak.bytes / (1024.0 * 1024.0),
+                     peak.phase.empty() ? "start" : peak.phase.c_str(),
+                     split.c_str());
+        }
+    }
+
+    bool MemoryTimeline::write_json(const std::string& path) const {
+        nlohmann::json root;
+        root["peaks"] = nlohmann::json::array();
+        for (const Peak& peak : peaks()) {
+            nlohmann::json kinds = nlohmann::json::object();
+            for (int kind = 0; kind < static_cast<int>(BufferKind::COUNT); ++kind) {
+                kinds[buffer_kind_name(static_cast<BufferKind>(kind))] = peak.kind_bytes[kind];
+            }
+            root["peaks"].push_back({{"device", peak.device},
+                                     {"bytes", peak.bytes},
+                                     {"time_ms", (peak.time_us - origin_us_) / 1000.0},
+                                     {"phase", peak.phase},
+                                     {"kinds", std::move(kinds)}});
+        }
+        root["events"] = nlohmann::json::array();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Event& event : events_) {
+                root["events"].push_back({{"time_ms", (event.time_us - origin_us_) / 1000.0},
+                                          {"device", event.device},
+                                          {"kind", buffer_kind_name(event.kind)},
+                                          {"owner", event.owner},
+                                          {"delta_bytes", event.delta_bytes},
+                                          {"device_bytes", event.device_bytes},
+                                          {"phase", event.phase}});
+            }
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            LOG_WARN("failed to write memory trace '%s'", path.c_str());
+            return false;
+        }
+        file << root.dump() << "\n";
+        LOG_INFO("memory trace saved to '%s'", path.c_str());
+        return true;
+    }
+
+    ScopedMemoryTimeline::ScopedMemoryTimeline(MemoryTimeline* timeline) {
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        previous_       = ledger.timeline;
+        ledger.timeline = timeline;
+        if (timeline == nullptr) {
+            return;
+        }
+        // the resident baseline, as if each live buffer was allocated now;
+        // device totals are rebuilt in the order the events are added
+        std::map<std::string, uint64_t> totals;
+        int64_t now = ggml_time_us();
+        for (const auto& [key, buffer] : ledger.live) {
+            MemoryTimeline::Event event;
+            event.time_us      = now;
+            event.device       = buffer.device;
+            event.kind         = buffer.kind;
+            event.owner        = buffer.owner;
+            event.delta_bytes  = static_cast<int64_t>(buffer.bytes);
+            event.device_bytes = totals[buffer.device] += buffer.bytes;
+            event.phase        = "resident";
+            timeline->add(std::move(event));
+        }
+    }
+
+    ScopedMemoryTimeline::~ScopedMemoryTimeline() {
+        Ledger& ledger = Ledger::instance();
+        std::lock_guard<std::mutex> lock(ledger.mutex);
+        ledger.timeline = previous_;
+    }
+
+    ScopedMemoryPhase::ScopedMemoryPhase(const std::string& phase)
+        : previous_(memory_phase()) {
+        set_memory_phase(phase);
+    }
+
+    ScopedMemoryPhase::~ScopedMemoryPhase() {
+        set_memory_phase(previous_);
+    }
+
+}  // namespace sd_perf
@@ -0,0 +1,114 @@
+#ifndef __SD_CORE_MEMORY_TIMELINE_H__
+#define __SD_CORE_MEMORY_TIMELINE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ggml-backend.h"
+
+namespace sd_perf {
+
+    enum class BufferKind {
+        PARAMS,   // weights on their params backend
+        STAGING,  // weights staged on the compute backend
+        COMPUTE,  // gallocr compute buffers
+        CACHE,    // tensors runners keep between graphs
+        INPUT,    // resident inputs, positional tables and pipeline inputs
+        COUNT,
+    };
+
+    const char* buffer_kind_name(BufferKind kind);
+
+    // Backend buffers are booked process-wide while they live, by device
+    // (buffer type name) and kind: a device fills up with the buffers of every
+    // context on it, and prefetch, tile and pipeline workers allocate on
+    // threads of their own. key is the buffer, or the gallocr owning one;
+    // booking a key again replaces its size, 0 bytes unbooks it.
+    void trace_buffer(const void* key, BufferKind kind, const std::string& owner, ggml_backend_buffer_type_t buft, size_t bytes);
+    void trace_buffer(ggml_backend_buffer_t buffer, BufferKind kind, const std::string& owner);
+    void untrace_buffer(const void* key);
+
+    // What the process is doing, such as "text encode", "step 3" or
+    // "vae decode tile 12"; recorded with every event of the timeline.
+    void set_memory_phase(const std::string& phase);
+    std::string memory_phase();
+
+    // Every booking change while the timeline is installed, with the bytes
+    // of the device after it. Installing it records the buffers already live,
+    // so the first events give the resident baseline.
+    class MemoryTimeline {
+    public:
+        struct Event {
+            int64_t time_us = 0;
+            std::string device;
+            BufferKind kind = BufferKind::PARAMS;
+            std::string owner;
+            int64_t delta_bytes   = 0;
+            uint64_t device_bytes = 0;
+            std::string phase;
+        };
+
+        struct Peak {
+            std::string device;
+            uint64_t bytes  = 0;
+            int64_t time_us = 0;
+            std::string phase;
+            uint64_t kind_bytes[static_cast<int>(BufferKind::COUNT)] = {};
+        };
+
+        MemoryTimeline();
+
+        void add(Event event);
+
+        // highest bytes each device reached, with the split at that moment
+        std::vector<Peak> peaks() const;
+
+        void log_summary() const;
+        bool write_json(const std::string& path) const;
+
+    private:
+        struct Device {
+            uint64_t kind_bytes[static_cast<int>(BufferKind::COUNT)] = {};
+            Peak peak;
+        };
+
+        int64_t origin_us_ = 0;
+        mutable std::mutex mutex_;
+        std::vector<Event> events_;
+        std::map<std::string, Device> devices_;
+    };
+
+    // Installs a timeline for the whole process; buffers booked on any
+    // thread land in it until the scope ends.
+    class ScopedMemoryTimeline {
+    public:
+        explicit ScopedMemoryTimeline(MemoryTimeline* timeline);
+        ~ScopedMemoryTimeline();
+
+        ScopedMemoryTimeline(const ScopedMemoryTimeline&)            = delete;
+        ScopedMemoryTimeline& operator=(const ScopedMemoryTimeline&) = delete;
+
+    private:
+        MemoryTimeline* previous_ = nullptr;
+    };
+
+    // Sets the phase for its lifetime and restores the previous one.
+    class ScopedMemoryPhase {
+    public:
+        explicit ScopedMemoryPhase(const std::string& phase);
+        ~ScopedMemoryPhase();
+
+        ScopedMemoryPhase(const ScopedMemoryPhase&)            = delete;
+        ScopedMemoryPhase& operator=(const ScopedMemoryPhase&) = delete;
+
+    private:
+        std::string previous_;
+    };
+
+}  // namespace sd_perf
+
+#endif  // __SD_CORE_MEMORY_TIMELINE_H__
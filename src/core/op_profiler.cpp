@@ -0,0 +1,259 @@
+#include "core/op_profiler.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "core/ggml_graph_cut.h"
+#include "core/util.h"
+#include "json.hpp"
+
+namespace sd_perf {
+
+    static thread_local OpProfiler* tls_op_profiler = nullptr;
+
+    OpProfiler::OpProfiler()
+        : origin_us_(ggml_time_us()) {
+    }
+
+    void OpProfiler::add_event(Event event, std::map<std::string, Total>& totals, const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Total& total = totals[key];
+        total.name   = key;
+        total.count++;
+        total.ms += (event.end_us - event.start_us) / 1000.0;
+        total.bytes += event.bytes;
+        events_.push_back(std::move(event));
+    }
+
+    void OpProfiler::add_op(const std::string& runner,
+                            int segment,
+                            const ggml_tensor* node,
+                            const std::string& block,
+                            int64_t start_us,
+                            int64_t end_us) {
+        Event event;
+        event.name     = ggml_op_desc(node);
+        event.category = "op";
+        event.start_us = start_us;
+        event.end_us   = end_us;
+        event.runner   = runner;
+        event.segment  = segment;
+        event.block    = block.empty() ? "(no weights)" : block;
+        event.node     = node->name;
+        {
+            // an op is booked to its block as well as to its type
+            std::lock_guard<std::mutex> lock(mutex_);
+            Total& total = blocks_[runner + ":" + event.block];
+            total.name   = runner + ":" + event.block;
+            total.count++;
+            total.ms += (end_us - start_us) / 1000.0;
+        }
+        std::string key = event.name;
+        add_event(std::move(event), ops_, key);
+    }
+
+    void OpProfiler::add_segment(const std::string& runner,
+                                 int segment,
+                                 const std::string& group_name,
+                                 int64_t start_us,
+                                 int64_t end_us) {
+        Event event;
+        event.name      = group_name;
+        event.category  = "segment";
+        event.start_us  = start_us;
+        event.end_us    = end_us;
+        event.runner    = runner;
+        event.segment   = segment;
+        std::string key = sd_format("%s#%d %s", runner.c_str(), segment, group_name.c_str());
+        add_event(std::move(event), segments_, key);
+    }
+
+    void OpProfiler::add_transfer(const std::string& runner,
+                                  int segment,
+                                  const char* what,
+                                  uint64_t bytes,
+                                  int track,
+                                  int64_t start_us,
+                                  int64_t end_us) {
+        Event event;
+        event.name      = what;
+        event.category  = "transfer";
+        event.track     = track;
+        event.start_us  = start_us;
+        event.end_us    = end_us;
+        event.runner    = runner;
+        event.segment   = segment;
+        event.bytes     = bytes;
+        std::string key = runner + ":" + what;
+        add_event(std::move(event), transfers_, key);
+    }
+
+    std::vector<OpProfiler::Total> OpProfiler::sorted(const std::map<std::string, Total>& totals) {
+        std::vector<Total> result;
+        result.reserve(totals.size());
+        for (const auto& [key, total] : totals) {
+            result.push_back(total);
+        }
+        std::stable_sort(result.begin(), result.end(), [](const Total& a, const Total& b) {
+            return a.ms > b.ms;
+        });
+        return result;
+    }
+
+    std::vector<OpProfiler::Total> OpProfiler::block_totals() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sorted(blocks_);
+    }
+
+    std::vector<OpProfiler::Total> OpProfiler::op_totals() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sorted(ops_);
+    }
+
+    std::vector<OpProfiler::Total> OpProfiler::segment_totals() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sorted(segments_);
+    }
+
+    std::vector<OpProfiler::Total> OpProfiler::transfer_totals() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sorted(transfers_);
+    }
+
+    void OpProfiler::log_summary(size_t max_rows) const {
+        auto log_totals = [max_rows](const char* title, const std::vector<Total>& totals) {
+            if (totals.empty()) {
+                return;
+            }
+            double sum_ms = 0.0;
+            for (const Total& total : totals) {
+                sum_ms += total.ms;
+            }
+            LOG_INFO("profile by %s (%.2f ms):", title, sum_ms);
+            for (size_t i = 0; i < totals.size() && i < max_rows; ++i) {
+                const Total& total = totals[i];
+                if (total.bytes > 0) {
+                    LOG_INFO("  %10.2f ms %5.1f%% %7dx %9.2f MB  %s",
+                             total.ms,
+                             sum_ms > 0.0 ? 100.0 * total.ms / sum_ms : 0.0,
+                             total.count,
+                             total.bytes / (1024.0 * 1024.0),
+                             total.name.c_str());
+                } else {
+                    LOG_INFO("  %10.2f ms %5.1f%% %7dx  %s",
+                             total.ms,
+                             sum_ms > 0.0 ? 100.0 * total.ms / sum_ms : 0.0,
+                             total.count,
+                             total.name.c_str());
+                }
+            }
+            if (totals.size() > max_rows) {
+                LOG_INFO("  ... %zu more", totals.size() - max_rows);
+            }
+        };
+        log_totals("block", block_totals());
+        log_totals("op", op_totals());
+        log_totals("segment", segment_totals());
+        log_totals("transfer", transfer_totals());
+    }
+
+    bool OpProfiler::write_chrome_trace(const std::string& path) const {
+        nlohmann::json events = nlohmann::json::array();
+        events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", COMPUTE_TRACK}, {"args", {{"name", "compute"}}}});
+        events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", TRANSFER_TRACK}, {"args", {{"name", "prefetch"}}}});
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Event& event : events_) {
+                nlohmann::json args = {{"runner", event.runner}};
+                if (event.segment >= 0) {
+                    args["segment"] = event.segment;
+                }
+                if (!event.block.empty()) {
+                    args["block"] = event.block;
+                }
+                if (!event.node.empty()) {
+                    args["node"] = event.node;
+                }
+                if (event.bytes > 0) {
+                    args["bytes"] = event.bytes;
+                }
+                events.push_back({{"name", event.name},
+                                  {"cat", event.category},
+                                  {"ph", "X"},
+                                  {"pid", 1},
+                                  {"tid", event.track},
+                                  {"ts", event.start_us - origin_us_},
+                                  {"dur", event.end_us - event.start_us},
+                                  {"args", std::move(args)}});
+            }
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            LOG_WARN("failed to write profile trace '%s'", path.c_str());
+            return false;
+        }
+        nlohmann::json root = {{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}};
+        file << root.dump() << "\n";
+        LOG_INFO("profile trace saved to '%s'", path.c_str());
+        return true;
+    }
+
+    OpProfiler* current_op_profiler() {
+        return tls_op_profiler;
+    }
+
+    ScopedOpProfiler::ScopedOpProfiler(OpProfiler* profiler)
+        : previous_(tls_op_profiler) {
+        tls_op_profiler = profiler;
+    }
+
+    ScopedOpProfiler::~ScopedOpProfiler() {
+        tls_op_profiler = previous_;
+    }
+
+    std::string op_block_name(const ggml_tensor* node) {
+        for (int i = 0; i < GGML_MAX_SRC; ++i) {
+            const ggml_tensor* src = node->src[i];
+            while (src != nullptr && src->view_src != nullptr) {
+                src = src->view_src;
+            }
+            if (src == nullptr || src->op != GGML_OP_NONE || sd::ggml_graph_cut::is_graph_cut_tensor(src)) {
+                continue;
+            }
+            std::string name = src->name;
+            // drop the weight, then the layer holding it
+            for (int k = 0; k < 2; ++k) {
+                size_t dot = name.find_last_of('.');
+                if (dot == std::string::npos) {
+                    name.clear();
+                    break;
+                }
+                name.resize(dot);
+            }
+            if (name.empty()) {
+                continue;
+            }
+            static const std::string runner_prefix = "model.diffusion_model.";
+            if (starts_with(name, runner_prefix)) {
+                name = name.substr(runner_prefix.size());
+            }
+            return name;
+        }
+        return "";
+    }
+
+    bool is_view_op(const ggml_tensor* node) {
+        switch (node->op) {
+            case GGML_OP_NONE:
+            case GGML_OP_VIEW:
+            case GGML_OP_RESHAPE:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+}  // namespace sd_perf
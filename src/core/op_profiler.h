@@ -0,0 +1,117 @@
+#ifndef __SD_CORE_OP_PROFILER_H__
+#define __SD_CORE_OP_PROFILER_H__
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ggml.h"
+
+namespace sd_perf {
+
+    // Where the time of the graphs computed under it goes. While a profiler
+    // is current on a thread, runners computing on that thread run their
+    // graphs a few nodes at a time and wait for the backend after each, so
+    // every op gets its own span; segments of cut graphs and the host/device
+    // transfers around them get spans too. The waits keep the backend from
+    // overlapping ops, so totals run above an unprofiled compute; the split
+    // between blocks and ops is what it is meant for.
+    class OpProfiler {
+    public:
+        // trace rows, as Chrome trace thread ids
+        static constexpr int COMPUTE_TRACK  = 1;
+        static constexpr int TRANSFER_TRACK = 2;
+
+        struct Total {
+            std::string name;
+            int count      = 0;
+            double ms      = 0.0;
+            uint64_t bytes = 0;
+        };
+
+        OpProfiler();
+
+        // segment: index in the cut graph, -1 when the graph runs whole
+        void add_op(const std::string& runner,
+                    int segment,
+                    const ggml_tensor* node,
+                    const std::string& block,
+                    int64_t start_us,
+                    int64_t end_us);
+        void add_segment(const std::string& runner,
+                         int segment,
+                         const std::string& group_name,
+                         int64_t start_us,
+                         int64_t end_us);
+        // what: "params", "inputs" or "output"; track: the thread it ran on
+        void add_transfer(const std::string& runner,
+                          int segment,
+                          const char* what,
+                          uint64_t bytes,
+                          int track,
+                          int64_t start_us,
+                          int64_t end_us);
+
+        // sorted by time, longest first
+        std::vector<Total> block_totals() const;
+        std::vector<Total> op_totals() const;
+        std::vector<Total> segment_totals() const;
+        std::vector<Total> transfer_totals() const;
+
+        void log_summary(size_t max_rows) const;
+        bool write_chrome_trace(const std::string& path) const;
+
+    private:
+        struct Event {
+            std::string name;
+            const char* category = "";
+            int track            = COMPUTE_TRACK;
+            int64_t start_us     = 0;
+            int64_t end_us       = 0;
+            std::string runner;
+            int segment = -1;
+            std::string block;
+            std::string node;
+            uint64_t bytes = 0;
+        };
+
+        void add_event(Event event, std::map<std::string, Total>& totals, const std::string& key);
+        static std::vector<Total> sorted(const std::map<std::string, Total>& totals);
+
+        int64_t origin_us_ = 0;
+        mutable std::mutex mutex_;
+        std::vector<Event> events_;
+        std::map<std::string, Total> blocks_;
+        std::map<std::string, Total> ops_;
+        std::map<std::string, Total> segments_;
+        std::map<std::string, Total> transfers_;
+    };
+
+    OpProfiler* current_op_profiler();
+
+    class ScopedOpProfiler {
+    public:
+        explicit ScopedOpProfiler(OpProfiler* profiler);
+        ~ScopedOpProfiler();
+
+        ScopedOpProfiler(const ScopedOpProfiler&)            = delete;
+        ScopedOpProfiler& operator=(const ScopedOpProfiler&) = delete;
+
+    private:
+        OpProfiler* previous_ = nullptr;
+    };
+
+    // The module of the first weight `node` reads, without the layer the
+    // weight belongs to: "double_blocks.12.img_attn" for
+    // "model.diffusion_model.double_blocks.12.img_attn.qkv.weight". Empty
+    // when the node reads no weight.
+    std::string op_block_name(const ggml_tensor* node);
+
+    // Ops backends run without computing anything.
+    bool is_view_op(const ggml_tensor* node);
+
+}  // namespace sd_perf
+
+#endif  // __SD_CORE_OP_PROFILER_H__
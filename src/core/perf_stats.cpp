@@ -0,0 +1,223 @@
+#include "core/perf_stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sd_perf {
+
+    static thread_local PerfRecorder* tls_recorder  = nullptr;
+    static thread_local uint64_t tls_loaded_bytes   = 0;
+    static thread_local uint64_t tls_uploaded_bytes = 0;
+    static thread_local MemoryProbe* tls_probe   = nullptr;
+
+    void PerfRecorder::reset() {
+        *this = PerfRecorder();
+    }
+
+    RunnerStats& PerfRecorder::runner(const std::string& name) {
+        auto it = runner_index_.find(name);
+        if (it != runner_index_.end()) {
+            return runners_[it->second];
+        }
+        runner_index_[name] = runners_.size();
+        runners_.emplace_back();
+        runners_.back().name = name;
+        return runners_.back();
+    }
+
+    void PerfRecorder::add_segment(const std::string& runner_name,
+                                   int segment_index,
+                                   const std::string& group_name,
+                                   uint64_t uploaded_bytes,
+                                   double upload_ms,
+                                   double wait_ms,
+                                   double compute_ms) {
+        runner(runner_name);
+        size_t runner_idx = runner_index_[runner_name];
+        std::string key   = runner_name + "#" + std::to_string(segment_index);
+
+        auto it = segment_index_.find(key);
+        if (it == segment_index_.end()) {
+            it = segment_index_.emplace(key, segments_.size()).first;
+            segments_.emplace_back();
+            segments_.back().runner_index  = runner_idx;
+            segments_.back().segment_index = segment_index;
+            segments_.back().group_name    = group_name;
+        }
+
+        SegmentStats& segment = segments_[it->second];
+        segment.executions++;
+        segment.uploaded_bytes += uploaded_bytes;
+        segment.upload_ms += upload_ms;
+        segment.wait_ms += wait_ms;
+        segment.compute_ms += compute_ms;
+    }
+
+    uint64_t PerfRecorder::uploaded_bytes() const {
+        uint64_t bytes = 0;
+        for (const RunnerStats& stats : runners_) {
+            bytes += stats.uploaded_bytes;
+        }
+        return bytes;
+    }
+
+    void PerfRecorder::export_stats(sd_perf_stats_t* stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->total_ms                   = total_ms;
+        stats->text_encode_ms             = text_encode_ms;
+        stats->vae_encode_ms              = vae_encode_ms;
+        stats->sampling_ms                = sampling_ms;
+        stats->vae_decode_ms              = vae_decode_ms;
+        stats->sampling_steps             = sampling_steps;
+        stats->condition_cache_hits       = condition_cache_hits;
+        stats->condition_cache_misses     = condition_cache_misses;
+        stats->vae_encode_cache_hits      = vae_encode_cache_hits;
+        stats->vae_encode_cache_misses    = vae_encode_cache_misses;
+        stats->lora_cache_hits            = lora_cache_hits;
+        stats->lora_cache_misses          = lora_cache_misses;
+        stats->lora_model_cache_hits      = lora_model_cache_hits;
+        stats->lora_model_cache_misses    = lora_model_cache_misses;
+        stats->lora_model_cache_evictions = lora_model_cache_evictions;
+        stats->sample_cache_hits          = sample_cache_hits;
+        stats->sample_cache_skipped_steps = sample_cache_skipped_steps;
+
+        runner_views_.clear();
+        for (const RunnerStats& runner : runners_) {
+            sd_runner_perf_stats_t view;
+            view.name                      = runner.name.c_str();
+            view.compute_calls             = runner.compute_calls;
+            view.graph_reuses              = runner.graph_reuses;
+            view.graph_cut_segments        = runner.graph_cut_segments;
+            view.graph_build_ms            = runner.graph_build_ms;
+            view.alloc_ms                  = runner.alloc_ms;
+            view.compute_ms                = runner.compute_ms;
+            view.loaded_bytes              = runner.loaded_bytes;
+            view.uploaded_bytes            = runner.uploaded_bytes;
+            view.peak_compute_buffer_bytes = runner.peak_compute_buffer_bytes;
+            runner_views_.push_back(view);
+
+            stats->peak_compute_buffer_bytes = std::max<uint64_t>(stats->peak_compute_buffer_bytes,
+                                                                  runner.peak_compute_buffer_bytes);
+        }
+
+        segment_views_.clear();
+        for (const SegmentStats& segment : segments_) {
+            sd_segment_perf_stats_t view;
+            view.runner         = static_cast<int>(segment.runner_index);
+            view.segment        = segment.segment_index;
+            view.group_name     = segment.group_name.c_str();
+            view.executions     = segment.executions;
+            view.uploaded_bytes = segment.uploaded_bytes;
+            view.upload_ms      = segment.upload_ms;
+            view.wait_ms        = segment.wait_ms;
+            view.compute_ms     = segment.compute_ms;
+            segment_views_.push_back(view);
+        }
+
+        stats->runner_count  = static_cast<int>(runner_views_.size());
+        stats->runners       = runner_views_.empty() ? nullptr : runner_views_.data();
+        stats->segment_count = static_cast<int>(segment_views_.size());
+        stats->segments      = segment_views_.empty() ? nullptr : segment_views_.data();
+    }
+
+    PerfRecorder* current_recorder() {
+        return tls_recorder;
+    }
+
+    void add_phase_ms(Phase phase, double ms) {
+        PerfRecorder* recorder = tls_recorder;
+        if (recorder == nullptr) {
+            return;
+        }
+        switch (phase) {
+            case Phase::TEXT_ENCODE:
+                recorder->text_encode_ms += ms;
+                break;
+            case Phase::VAE_ENCODE:
+                recorder->vae_encode_ms += ms;
+                break;
+            case Phase::SAMPLING:
+                recorder->sampling_ms += ms;
+                break;
+            case Phase::VAE_DECODE:
+                recorder->vae_decode_ms += ms;
+                break;
+        }
+    }
+
+    ScopedPerfRecorder::ScopedPerfRecorder(PerfRecorder* recorder)
+        : previous_(tls_recorder) {
+        tls_recorder = recorder;
+    }
+
+    ScopedPerfRecorder::~ScopedPerfRecorder() {
+        tls_recorder = previous_;
+    }
+
+    void MemoryProbe::reset() {
+        *this = MemoryProbe();
+    }
+
+    RunnerMemory& MemoryProbe::runner(const std::string& name) {
+        auto it = runner_index_.find(name);
+        if (it != runner_index_.end()) {
+            return runners_[it->second];
+        }
+        runner_index_[name] = runners_.size();
+        runners_.emplace_back();
+        runners_.back().name = name;
+        return runners_.back();
+    }
+
+    void MemoryProbe::export_estimate(sd_memory_estimate_t* estimate) {
+        memset(estimate, 0, sizeof(*estimate));
+        module_views_.clear();
+        for (const RunnerMemory& runner : runners_) {
+            sd_module_memory_estimate_t view;
+            view.name                 = runner.name.c_str();
+            view.on_cpu               = runner.on_cpu;
+            view.params_bytes         = runner.params_bytes;
+            view.compute_buffer_bytes = runner.compute_buffer_bytes;
+            view.graph_cut_segments   = runner.graph_cut_segments;
+            view.segment_buffer_bytes = runner.segment_buffer_bytes;
+            module_views_.push_back(view);
+
+            // a cut graph only ever holds one segment's buffer
+            size_t compute_bytes = runner.graph_cut_segments > 0 ? runner.segment_buffer_bytes : runner.compute_buffer_bytes;
+            estimate->params_bytes += runner.params_bytes;
+            estimate->peak_compute_buffer_bytes = std::max<uint64_t>(estimate->peak_compute_buffer_bytes, compute_bytes);
+        }
+        estimate->module_count = static_cast<int>(module_views_.size());
+        estimate->modules      = module_views_.empty() ? nullptr : module_views_.data();
+    }
+
+    MemoryProbe* current_memory_probe() {
+        return tls_probe;
+    }
+
+    ScopedMemoryProbe::ScopedMemoryProbe(MemoryProbe* probe)
+        : previous_(tls_probe) {
+        tls_probe = probe;
+    }
+
+    ScopedMemoryProbe::~ScopedMemoryProbe() {
+        tls_probe = previous_;
+    }
+
+    void add_loaded_bytes(uint64_t bytes) {
+        tls_loaded_bytes += bytes;
+    }
+
+    void add_uploaded_bytes(uint64_t bytes) {
+        tls_uploaded_bytes += bytes;
+    }
+
+    uint64_t thread_loaded_bytes() {
+        return tls_loaded_bytes;
+    }
+
+    uint64_t thread_uploaded_bytes() {
+        return tls_uploaded_bytes;
+    }
+
+}  // namespace sd_perf
@@ -0,0 +1,170 @@
+#ifndef __SD_CORE_PERF_STATS_H__
+#define __SD_CORE_PERF_STATS_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stable-diffusion.h"
+
+namespace sd_perf {
+
+    struct RunnerStats {
+        std::string name;
+        int compute_calls                = 0;
+        int graph_reuses                 = 0;
+        int graph_cut_segments           = 0;
+        double graph_build_ms            = 0.0;
+        double alloc_ms                  = 0.0;
+        double compute_ms                = 0.0;
+        uint64_t loaded_bytes            = 0;
+        uint64_t uploaded_bytes          = 0;
+        size_t peak_compute_buffer_bytes = 0;
+    };
+
+    struct SegmentStats {
+        size_t runner_index = 0;
+        int segment_index   = 0;
+        std::string group_name;
+        int executions          = 0;
+        uint64_t uploaded_bytes = 0;
+        double upload_ms        = 0.0;
+        double wait_ms          = 0.0;
+        double compute_ms       = 0.0;
+    };
+
+    // What one generate_image/generate_video call spent where. The context owns
+    // the recorder and installs it on the generating thread; runners and the
+    // sampler report into whichever recorder is current, so contexts generating
+    // concurrently on different threads never mix their numbers.
+    class PerfRecorder {
+    public:
+        void reset();
+
+        RunnerStats& runner(const std::string& name);
+        void add_segment(const std::string& runner_name,
+                         int segment_index,
+                         const std::string& group_name,
+                         uint64_t uploaded_bytes,
+                         double upload_ms,
+                         double wait_ms,
+                         double compute_ms);
+
+        // Fills `stats` with views into this recorder; they stay valid until the
+        // next reset().
+        void export_stats(sd_perf_stats_t* stats);
+
+        // weight bytes uploaded by every runner so far
+        uint64_t uploaded_bytes() const;
+
+        double total_ms                = 0.0;
+        double text_encode_ms          = 0.0;
+        double vae_encode_ms           = 0.0;
+        double sampling_ms             = 0.0;
+        double vae_decode_ms           = 0.0;
+        int sampling_steps             = 0;
+        int condition_cache_hits       = 0;
+        int condition_cache_misses     = 0;
+        int vae_encode_cache_hits      = 0;
+        int vae_encode_cache_misses    = 0;
+        int lora_cache_hits            = 0;
+        int lora_cache_misses          = 0;
+        int lora_model_cache_hits      = 0;
+        int lora_model_cache_misses    = 0;
+        int lora_model_cache_evictions = 0;
+        int sample_cache_hits          = 0;
+        int sample_cache_skipped_steps = 0;
+
+    private:
+        std::vector<RunnerStats> runners_;
+        std::unordered_map<std::string, size_t> runner_index_;
+        std::vector<SegmentStats> segments_;
+        std::unordered_map<std::string, size_t> segment_index_;
+
+        std::vector<sd_runner_perf_stats_t> runner_views_;
+        std::vector<sd_segment_perf_stats_t> segment_views_;
+    };
+
+    enum class Phase {
+        TEXT_ENCODE,
+        VAE_ENCODE,
+        SAMPLING,
+        VAE_DECODE,
+    };
+
+    PerfRecorder* current_recorder();
+
+    // Adds `ms` to `phase` of the current recorder; a no-op outside a generation.
+    void add_phase_ms(Phase phase, double ms);
+
+    class ScopedPerfRecorder {
+    public:
+        explicit ScopedPerfRecorder(PerfRecorder* recorder);
+        ~ScopedPerfRecorder();
+
+        ScopedPerfRecorder(const ScopedPerfRecorder&)            = delete;
+        ScopedPerfRecorder& operator=(const ScopedPerfRecorder&) = delete;
+
+    private:
+        PerfRecorder* previous_ = nullptr;
+    };
+
+    // Memory one runner's graphs need, see MemoryProbe. The fields describe the
+    // graph with the largest compute buffer the runner was asked for.
+    struct RunnerMemory {
+        std::string name;
+        bool on_cpu                 = false;
+        size_t params_bytes         = 0;
+        size_t compute_buffer_bytes = 0;  // the whole graph, as gallocr reserves it
+        int graph_cut_segments      = 0;  // segments max_vram cuts it into, 0 when it runs whole
+        size_t segment_buffer_bytes = 0;  // largest of those segments
+        int graphs                  = 0;
+    };
+
+    // While a probe is current on a thread, runners computing on that thread
+    // build and measure each graph, then hand back zeros of the result shape
+    // without loading weights or running it. Walking the generation path under
+    // a probe tells what it needs before it is run for real.
+    class MemoryProbe {
+    public:
+        void reset();
+
+        RunnerMemory& runner(const std::string& name);
+
+        // Fills `estimate` with views into this probe; they stay valid until the
+        // next reset().
+        void export_estimate(sd_memory_estimate_t* estimate);
+
+    private:
+        std::vector<RunnerMemory> runners_;
+        std::unordered_map<std::string, size_t> runner_index_;
+
+        std::vector<sd_module_memory_estimate_t> module_views_;
+    };
+
+    MemoryProbe* current_memory_probe();
+
+    class ScopedMemoryProbe {
+    public:
+        explicit ScopedMemoryProbe(MemoryProbe* probe);
+        ~ScopedMemoryProbe();
+
+        ScopedMemoryProbe(const ScopedMemoryProbe&)            = delete;
+        ScopedMemoryProbe& operator=(const ScopedMemoryProbe&) = delete;
+
+    private:
+        MemoryProbe* previous_ = nullptr;
+    };
+
+    // Weight bytes moved by the calling thread. Counting per thread lets the
+    // graph-cut prefetch worker and the compute thread attribute their own
+    // transfers by taking deltas around the work they do.
+    void add_loaded_bytes(uint64_t bytes);
+    void add_uploaded_bytes(uint64_t bytes);
+    uint64_t thread_loaded_bytes();
+    uint64_t thread_uploaded_bytes();
+
+}  // namespace sd_perf
+
+#endif  // __SD_CORE_PERF_STATS_H__
@@ -1,13 +1,25 @@
 #ifndef __SD_CORE_RNG_HPP__
 #define __SD_CORE_RNG_HPP__
 
+#include <cstdint>
 #include <random>
+#include <sstream>
+#include <string>
 #include <vector>
 
 class RNG {
 public:
     virtual void manual_seed(uint64_t seed)      = 0;
     virtual std::vector<float> randn(uint32_t n) = 0;
+
+    // Set while a sampler draws noise of the same size every step, so a
+    // generator may produce the next draw ahead of the call.
+    virtual void set_prefetch(bool enabled) {}
+
+    // Generator state as opaque bytes, for sampling checkpoints. load_state
+    // only accepts what save_state of the same generator type returned.
+    virtual std::vector<uint8_t> save_state() const           = 0;
+    virtual bool load_state(const std::vector<uint8_t>& state) = 0;
 };
 
 class STDDefaultRNG : public RNG {
@@ -30,6 +42,19 @@ public:
         }
         return result;
     }
+
+    std::vector<uint8_t> save_state() const override {
+        std::ostringstream out;
+        out << generator;
+        std::string text = out.str();
+        return std::vector<uint8_t>(text.begin(), text.end());
+    }
+
+    bool load_state(const std::vector<uint8_t>& state) override {
+        std::istringstream in(std::string(state.begin(), state.end()));
+        in >> generator;
+        return !in.fail();
+    }
 };
 
 #endif  // __SD_CORE_RNG_HPP__
\ No newline at end of file
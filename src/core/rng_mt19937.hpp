@@ -1,7 +1,9 @@
 #ifndef __SD_CORE_RNG_MT19937_HPP__
 #define __SD_CORE_RNG_MT19937_HPP__
 
+#include <array>
 #include <cmath>
+#include <cstring>
 #include <vector>
 
 #include "core/rng.hpp"
@@ -142,6 +144,20 @@ public:
         randn((float*)out.data(), out.size());
         return out;
     }
+
+    std::vector<uint8_t> save_state() const override {
+        std::vector<uint8_t> state(sizeof(s));
+        memcpy(state.data(), &s, sizeof(s));
+        return state;
+    }
+
+    bool load_state(const std::vector<uint8_t>& state) override {
+        if (state.size() != sizeof(s)) {
+            return false;
+        }
+        memcpy(&s, state.data(), sizeof(s));
+        return true;
+    }
 };
 
 #endif  // __SD_CORE_RNG_MT19937_HPP__
\ No newline at end of file
@@ -1,10 +1,14 @@
 #ifndef __SD_CORE_RNG_PHILOX_HPP__
 #define __SD_CORE_RNG_PHILOX_HPP__
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <future>
 #include <vector>
 
 #include "core/rng.hpp"
+#include "core/task_pool.h"
 
 // RNG imitiating torch cuda randn on CPU.
 // Port from: https://github.com/AUTOMATIC1111/stable-diffusion-webui/blob/5ef669de080814067961f28357256e8fe27544f4/modules/rng_philox.py
@@ -14,70 +18,76 @@ private:
     uint32_t offset;
 
 private:
-    std::vector<uint32_t> philox_m = {0xD2511F53, 0xCD9E8D57};
-    std::vector<uint32_t> philox_w = {0x9E3779B9, 0xBB67AE85};
-    float two_pow32_inv            = 2.3283064e-10f;
-    float two_pow32_inv_2pi        = 2.3283064e-10f * 6.2831855f;
-
-    std::vector<uint32_t> uint32(uint64_t x) {
-        std::vector<uint32_t> result(2);
-        result[0] = static_cast<uint32_t>(x & 0xFFFFFFFF);
-        result[1] = static_cast<uint32_t>(x >> 32);
-        return result;
-    }
-
-    std::vector<std::vector<uint32_t>> uint32(const std::vector<uint64_t>& x) {
-        uint32_t N = (uint32_t)x.size();
-        std::vector<std::vector<uint32_t>> result(2, std::vector<uint32_t>(N));
-
-        for (uint32_t i = 0; i < N; ++i) {
-            result[0][i] = static_cast<uint32_t>(x[i] & 0xFFFFFFFF);
-            result[1][i] = static_cast<uint32_t>(x[i] >> 32);
+    static constexpr uint32_t philox_m[2]    = {0xD2511F53, 0xCD9E8D57};
+    static constexpr uint32_t philox_w[2]    = {0x9E3779B9, 0xBB67AE85};
+    static constexpr float two_pow32_inv     = 2.3283064e-10f;
+    static constexpr float two_pow32_inv_2pi = 2.3283064e-10f * 6.2831855f;
+
+    // Elements generated side by side; the lane loops below have no
+    // dependencies between lanes, so the compiler vectorizes them.
+    static constexpr int lanes = 8;
+
+    // Philox 4x32-10 for the elements [begin, begin + count), count <= lanes.
+    // Element i uses the counter {offset, 0, i, 0} and the key {seed low,
+    // seed high}; the first two output words feed box_muller.
+    static void philox4_32(uint64_t seed, uint32_t offset, uint32_t begin, int count, uint32_t* out0, uint32_t* out1) {
+        uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+        for (int l = 0; l < lanes; ++l) {
+            c0[l] = offset;
+            c1[l] = 0;
+            c2[l] = begin + static_cast<uint32_t>(l < count ? l : 0);
+            c3[l] = 0;
         }
-
-        return result;
-    }
-
-    //  A single round of the Philox 4x32 random number generator.
-    void philox4_round(std::vector<std::vector<uint32_t>>& counter,
-                       const std::vector<std::vector<uint32_t>>& key) {
-        uint32_t N = (uint32_t)counter[0].size();
-        for (uint32_t i = 0; i < N; i++) {
-            std::vector<uint32_t> v1 = uint32(static_cast<uint64_t>(counter[0][i]) * static_cast<uint64_t>(philox_m[0]));
-            std::vector<uint32_t> v2 = uint32(static_cast<uint64_t>(counter[2][i]) * static_cast<uint64_t>(philox_m[1]));
-
-            counter[0][i] = v2[1] ^ counter[1][i] ^ key[0][i];
-            counter[1][i] = v2[0];
-            counter[2][i] = v1[1] ^ counter[3][i] ^ key[1][i];
-            counter[3][i] = v1[0];
+        uint32_t k0 = static_cast<uint32_t>(seed & 0xFFFFFFFF);
+        uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+        for (int round = 0; round < 10; ++round) {
+            if (round > 0) {
+                k0 += philox_w[0];
+                k1 += philox_w[1];
+            }
+            for (int l = 0; l < lanes; ++l) {
+                uint64_t v1 = static_cast<uint64_t>(c0[l]) * philox_m[0];
+                uint64_t v2 = static_cast<uint64_t>(c2[l]) * philox_m[1];
+                c0[l]       = static_cast<uint32_t>(v2 >> 32) ^ c1[l] ^ k0;
+                c1[l]       = static_cast<uint32_t>(v2);
+                c2[l]       = static_cast<uint32_t>(v1 >> 32) ^ c3[l] ^ k1;
+                c3[l]       = static_cast<uint32_t>(v1);
+            }
+        }
+        for (int l = 0; l < count; ++l) {
+            out0[l] = c0[l];
+            out1[l] = c1[l];
         }
     }
 
-    // Generates 32-bit random numbers using the Philox 4x32 random number generator.
-    // Parameters:
-    //     counter : A 4xN array of 32-bit integers representing the counter values (offset into generation).
-    //     key : A 2xN array of 32-bit integers representing the key values (seed).
-    //     rounds : The number of rounds to perform.
-    // Returns:
-    //     std::vector<std::vector<uint32_t>>: A 4xN array of 32-bit integers containing the generated random numbers.
-    std::vector<std::vector<uint32_t>> philox4_32(std::vector<std::vector<uint32_t>>& counter,
-                                                  std::vector<std::vector<uint32_t>>& key,
-                                                  int rounds = 10) {
-        uint32_t N = (uint32_t)counter[0].size();
-        for (int i = 0; i < rounds - 1; ++i) {
-            philox4_round(counter, key);
-
-            for (uint32_t j = 0; j < N; ++j) {
-                key[0][j] += philox_w[0];
-                key[1][j] += philox_w[1];
+    // Draws with fewer elements are generated on demand.
+    static constexpr uint32_t min_prefetch_elements = 1 << 16;
+
+    bool prefetch = false;
+    std::future<std::vector<float>> pending;
+    uint64_t pending_seed   = 0;
+    uint32_t pending_offset = 0;
+    uint32_t pending_n      = 0;
+
+    // The n values of the draw at (seed, offset). Every element only depends
+    // on its index, so chunks of at least min_chunk elements run on the task
+    // pool and the output matches a serial run.
+    static std::vector<float> generate(uint64_t seed, uint32_t offset, uint32_t n, int64_t min_chunk) {
+        std::vector<float> result(n);
+        sd::parallel_for(n, std::max<int64_t>(min_chunk, 1), [&](int64_t begin, int64_t end) {
+            uint32_t g0[lanes], g1[lanes];
+            for (int64_t i = begin; i < end; i += lanes) {
+                const int count = static_cast<int>(std::min<int64_t>(lanes, end - i));
+                philox4_32(seed, offset, static_cast<uint32_t>(i), count, g0, g1);
+                for (int l = 0; l < count; ++l) {
+                    result[i + l] = box_muller((float)g0[l], (float)g1[l]);
+                }
             }
-        }
-
-        philox4_round(counter, key);
-        return counter;
+        });
+        return result;
     }
 
-    float box_muller(float x, float y) {
+    static float box_muller(float x, float y) {
         float u = x * two_pow32_inv + two_pow32_inv / 2;
         float v = y * two_pow32_inv_2pi + two_pow32_inv_2pi / 2;
 
@@ -98,27 +108,56 @@ public:
         this->offset = 0;
     }
 
-    std::vector<float> randn(uint32_t n) override {
-        std::vector<std::vector<uint32_t>> counter(4, std::vector<uint32_t>(n, 0));
-        for (uint32_t i = 0; i < n; i++) {
-            counter[0][i] = this->offset;
+    void set_prefetch(bool enabled) override {
+        prefetch = enabled;
+        if (!enabled && pending.valid()) {
+            pending.wait();
+            pending = {};
         }
+    }
 
-        for (uint32_t i = 0; i < n; i++) {
-            counter[2][i] = i;
+    std::vector<float> randn(uint32_t n) override {
+        std::vector<float> result;
+        if (pending.valid() && pending_seed == seed && pending_offset == offset && pending_n == n) {
+            result = pending.get();
+        } else {
+            if (pending.valid()) {
+                pending.wait();
+                pending = {};
+            }
+            result = generate(seed, offset, n, 1 << 14);
         }
         this->offset += 1;
 
-        std::vector<uint64_t> key(n, this->seed);
-        std::vector<std::vector<uint32_t>> key_uint32 = uint32(key);
+        // A draw only depends on (seed, offset, n), and samplers with
+        // per-step noise draw the same size again on their next step, so the
+        // next draw is generated on a thread of its own while the caller runs
+        // the model.
+        if (prefetch && n >= min_prefetch_elements) {
+            pending_seed   = seed;
+            pending_offset = offset;
+            pending_n      = n;
+            pending        = std::async(std::launch::async, [seed_ = seed, offset_ = offset, n]() {
+                return generate(seed_, offset_, n, n);
+            });
+        }
+        return result;
+    }
 
-        std::vector<std::vector<uint32_t>> g = philox4_32(counter, key_uint32);
+    std::vector<uint8_t> save_state() const override {
+        std::vector<uint8_t> state(sizeof(seed) + sizeof(offset));
+        memcpy(state.data(), &seed, sizeof(seed));
+        memcpy(state.data() + sizeof(seed), &offset, sizeof(offset));
+        return state;
+    }
 
-        std::vector<float> result;
-        for (uint32_t i = 0; i < n; ++i) {
-            result.push_back(box_muller((float)g[0][i], (float)g[1][i]));
+    bool load_state(const std::vector<uint8_t>& state) override {
+        if (state.size() != sizeof(seed) + sizeof(offset)) {
+            return false;
         }
-        return result;
+        memcpy(&seed, state.data(), sizeof(seed));
+        memcpy(&offset, state.data() + sizeof(seed), sizeof(offset));
+        return true;
     }
 };
 
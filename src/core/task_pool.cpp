@@ -0,0 +1,111 @@
+#include "core/task_pool.h"
+
+namespace sd {
+
+    struct TaskPool::Job {
+        const ChunkFn* fn = nullptr;
+        int64_t n         = 0;
+        int64_t chunk     = 0;
+        int64_t n_chunks  = 0;
+        std::atomic<int64_t> next{0};
+        std::atomic<int64_t> done{0};
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    TaskPool& TaskPool::instance() {
+        // never destroyed: joining workers from static destructors can hang
+        // at process exit on some platforms
+        static TaskPool* pool = new TaskPool();
+        return *pool;
+    }
+
+    TaskPool::~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void TaskPool::reserve_threads(int n_threads) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (static_cast<int>(workers_.size()) + 1 < n_threads) {
+            workers_.emplace_back(&TaskPool::worker_loop, this);
+        }
+        thread_count_ = static_cast<int>(workers_.size()) + 1;
+    }
+
+    int TaskPool::thread_count() const {
+        return thread_count_.load();
+    }
+
+    void TaskPool::run_chunks(Job& job) {
+        for (int64_t c = job.next.fetch_add(1); c < job.n_chunks; c = job.next.fetch_add(1)) {
+            int64_t begin = c * job.chunk;
+            (*job.fn)(begin, std::min(job.n, begin + job.chunk));
+            if (job.done.fetch_add(1) + 1 == job.n_chunks) {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.cv.notify_all();
+            }
+        }
+    }
+
+    void TaskPool::worker_loop() {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                job = jobs_.front();
+                if (job->next.load() >= job->n_chunks) {
+                    jobs_.pop_front();
+                    continue;
+                }
+            }
+            run_chunks(*job);
+        }
+    }
+
+    void TaskPool::parallel_for(int64_t n, int64_t min_chunk, const ChunkFn& fn) {
+        if (n <= 0) {
+            return;
+        }
+        min_chunk         = std::max<int64_t>(min_chunk, 1);
+        int64_t n_threads = std::min<int64_t>(thread_count(), n / min_chunk);
+        if (n_threads <= 1) {
+            fn(0, n);
+            return;
+        }
+
+        // a few chunks per thread so uneven rows still balance
+        auto job      = std::make_shared<Job>();
+        job->fn       = &fn;
+        job->n        = n;
+        job->chunk    = std::max(min_chunk, (n + n_threads * 4 - 1) / (n_threads * 4));
+        job->n_chunks = (n + job->chunk - 1) / job->chunk;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(job);
+        }
+        cv_.notify_all();
+
+        run_chunks(*job);
+        {
+            std::unique_lock<std::mutex> lock(job->mutex);
+            job->cv.wait(lock, [&] { return job->done.load() == job->n_chunks; });
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find(jobs_.begin(), jobs_.end(), job);
+        if (it != jobs_.end()) {
+            jobs_.erase(it);
+        }
+    }
+
+}  // namespace sd
@@ -0,0 +1,81 @@
+#ifndef __SD_CORE_TASK_POOL_H__
+#define __SD_CORE_TASK_POOL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sd {
+
+    // Process-wide worker pool for the host-side loops between backend phases
+    // (tensor arithmetic, tile split/merge, previews). Contexts grow it to
+    // their n_threads; it never shrinks. Callers work on their own job while
+    // they wait, so concurrent and nested parallel_for calls cannot deadlock.
+    class TaskPool {
+    public:
+        using ChunkFn = std::function<void(int64_t begin, int64_t end)>;
+
+        static TaskPool& instance();
+
+        ~TaskPool();
+
+        // Grows the pool so a parallel_for can use n_threads threads, the
+        // calling one included.
+        void reserve_threads(int n_threads);
+        int thread_count() const;
+
+        // Runs fn over [0, n) in chunks of at least min_chunk elements. fn must
+        // not throw and chunks must touch disjoint data.
+        void parallel_for(int64_t n, int64_t min_chunk, const ChunkFn& fn);
+
+    private:
+        struct Job;
+
+        TaskPool() = default;
+
+        void worker_loop();
+        static void run_chunks(Job& job);
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::shared_ptr<Job>> jobs_;
+        std::vector<std::thread> workers_;
+        std::atomic<int> thread_count_{1};
+        bool stop_ = false;
+    };
+
+    inline void parallel_for(int64_t n, int64_t min_chunk, const TaskPool::ChunkFn& fn) {
+        TaskPool::instance().parallel_for(n, min_chunk, fn);
+    }
+
+    // Sums chunk_fn(begin, end) over fixed-size chunks of [0, n). Chunking and
+    // the order partials are added in do not depend on the thread count, so
+    // results are reproducible across machines.
+    template <typename T, typename Fn>
+    inline T parallel_reduce(int64_t n, int64_t chunk, T init, Fn&& chunk_fn) {
+        if (n <= chunk) {
+            return init + chunk_fn(int64_t(0), n);
+        }
+        const int64_t n_chunks = (n + chunk - 1) / chunk;
+        std::vector<T> partials(static_cast<size_t>(n_chunks), T{});
+        parallel_for(n_chunks, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t c = begin; c < end; ++c) {
+                partials[static_cast<size_t>(c)] = chunk_fn(c * chunk, std::min(n, (c + 1) * chunk));
+            }
+        });
+        for (const T& partial : partials) {
+            init += partial;
+        }
+        return init;
+    }
+
+}  // namespace sd
+
+#endif  // __SD_CORE_TASK_POOL_H__
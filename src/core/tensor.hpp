@@ -5,8 +5,11 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <atomic>
 #include <initializer_list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <sstream>
@@ -17,6 +20,7 @@
 #include <vector>
 
 #include "core/rng.hpp"
+#include "core/task_pool.h"
 
 namespace sd {
 
@@ -59,13 +63,146 @@ namespace sd {
         return numel;
     }
 
+    // Keeps the storage of large float tensors dropped while a
+    // TensorPoolScope is open and hands it to the next tensor of about the
+    // same size. The latent-sized temporaries of a sampling step (noised
+    // inputs, model outputs, guidance terms) then reuse buffers that are
+    // already allocated and faulted in, instead of going through the
+    // allocator and fresh pages on every step. Idle buffers are freed when
+    // the last scope closes.
+    class TensorBufferPool {
+    public:
+        static constexpr size_t MIN_POOLED_ELEMENTS = 16 * 1024;  // smaller buffers are cheap to malloc
+        static constexpr size_t MAX_IDLE_BYTES      = size_t(1) << 30;
+
+        static TensorBufferPool& instance() {
+            // never destroyed, tensors may outlive static destruction order
+            static TensorBufferPool* pool = new TensorBufferPool();
+            return *pool;
+        }
+
+        bool active() const {
+            return scopes_.load(std::memory_order_relaxed) > 0;
+        }
+
+        void enter() {
+            scopes_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void leave() {
+            if (scopes_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                idle_.clear();
+                idle_bytes_ = 0;
+            }
+        }
+
+        // n zero-initialized elements
+        std::vector<float> acquire(size_t n) {
+            std::vector<float> buffer = take(n);
+            buffer.assign(n, 0.f);
+            return buffer;
+        }
+
+        std::vector<float> acquire_copy(const float* src, size_t n) {
+            std::vector<float> buffer = take(n);
+            buffer.assign(src, src + n);
+            return buffer;
+        }
+
+        void release(std::vector<float>& buffer) {
+            const size_t capacity = buffer.capacity();
+            if (capacity < MIN_POOLED_ELEMENTS || !active()) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!active() || idle_bytes_ + capacity * sizeof(float) > MAX_IDLE_BYTES) {
+                return;
+            }
+            idle_bytes_ += capacity * sizeof(float);
+            idle_.emplace(capacity, std::move(buffer));
+        }
+
+    private:
+        TensorBufferPool() = default;
+
+        std::vector<float> take(size_t n) {
+            if (n < MIN_POOLED_ELEMENTS || !active()) {
+                return {};
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            // a buffer more than twice the request would hold memory a
+            // later large tensor could use
+            auto it = idle_.lower_bound(n);
+            if (it == idle_.end() || it->first > n * 2) {
+                return {};
+            }
+            std::vector<float> buffer = std::move(it->second);
+            idle_bytes_ -= it->first * sizeof(float);
+            idle_.erase(it);
+            return buffer;
+        }
+
+        std::atomic<int> scopes_{0};
+        std::mutex mutex_;
+        std::multimap<size_t, std::vector<float>> idle_;  // keyed by capacity
+        size_t idle_bytes_ = 0;
+    };
+
+    class TensorPoolScope {
+    public:
+        TensorPoolScope() {
+            TensorBufferPool::instance().enter();
+        }
+
+        ~TensorPoolScope() {
+            TensorBufferPool::instance().leave();
+        }
+
+        TensorPoolScope(const TensorPoolScope&)            = delete;
+        TensorPoolScope& operator=(const TensorPoolScope&) = delete;
+    };
+
     template <typename T>
     class Tensor {
     public:
         Tensor() = default;
 
+        ~Tensor() {
+            recycle();
+        }
+
+        Tensor(const Tensor& other)
+            : data_(copy_storage(other.data_)), shape_(other.shape_) {
+        }
+
+        Tensor(Tensor&& other) noexcept = default;
+
+        Tensor& operator=(const Tensor& other) {
+            if (this == &other) {
+                return *this;
+            }
+            if (data_.capacity() < other.data_.size()) {
+                recycle();
+                data_ = copy_storage(other.data_);
+            } else {
+                data_.assign(other.data_.begin(), other.data_.end());
+            }
+            shape_ = other.shape_;
+            return *this;
+        }
+
+        Tensor& operator=(Tensor&& other) noexcept {
+            if (this != &other) {
+                recycle();
+                data_  = std::move(other.data_);
+                shape_ = std::move(other.shape_);
+            }
+            return *this;
+        }
+
         explicit Tensor(std::vector<int64_t> shape)
-            : data_(static_cast<size_t>(tensor_numel(shape))), shape_(std::move(shape)) {
+            : data_(allocate_storage(static_cast<size_t>(tensor_numel(shape)))), shape_(std::move(shape)) {
         }
 
         Tensor(std::vector<int64_t> shape, std::vector<T> data)
@@ -305,6 +442,28 @@ namespace sd {
         }
 
     private:
+        static std::vector<T> allocate_storage(size_t n) {
+            if constexpr (std::is_same_v<T, float>) {
+                return TensorBufferPool::instance().acquire(n);
+            } else {
+                return std::vector<T>(n);
+            }
+        }
+
+        static std::vector<T> copy_storage(const std::vector<T>& src) {
+            if constexpr (std::is_same_v<T, float>) {
+                return TensorBufferPool::instance().acquire_copy(src.data(), src.size());
+            } else {
+                return src;
+            }
+        }
+
+        void recycle() {
+            if constexpr (std::is_same_v<T, float>) {
+                TensorBufferPool::instance().release(data_);
+            }
+        }
+
         size_t offset_of(const std::vector<int64_t>& coord) const {
             if (coord.size() != shape_.size()) {
                 tensor_throw_invalid_argument("Tensor index rank mismatch: coord_rank=" +
@@ -339,10 +498,14 @@ namespace sd {
 
     template <>
     inline float Tensor<float>::sum() const {
-        double total = 0.0;
-        for (float value : data_) {
-            total += static_cast<double>(value);
-        }
+        const float* values = data_.data();
+        double total        = parallel_reduce(numel(), int64_t(1) << 15, 0.0, [&](int64_t begin, int64_t end) {
+            double partial = 0.0;
+            for (int64_t i = begin; i < end; ++i) {
+                partial += static_cast<double>(values[i]);
+            }
+            return partial;
+        });
         return static_cast<float>(total);
     }
 
@@ -363,11 +526,7 @@ namespace sd {
         if (empty()) {
             return 0.0f;
         }
-        double sum = 0.0;
-        for (float value : data_) {
-            sum += static_cast<double>(value);
-        }
-        return static_cast<float>(sum / static_cast<double>(numel()));
+        return static_cast<float>(static_cast<double>(sum()) / static_cast<double>(numel()));
     }
 
     template <typename T>
@@ -379,6 +538,19 @@ namespace sd {
         }
     }
 
+    // Elementwise passes and reductions go through the shared TaskPool once a
+    // tensor has a few chunks of this many elements.
+    constexpr int64_t kTensorParallelChunk = 1 << 15;
+
+    template <typename Fn>
+    inline void tensor_parallel_for(int64_t n, Fn&& fn) {
+        if (n < 2 * kTensorParallelChunk) {
+            fn(int64_t(0), n);
+            return;
+        }
+        parallel_for(n, kTensorParallelChunk, fn);
+    }
+
     inline std::vector<int64_t> tensor_broadcast_shape(const std::vector<int64_t>& lhs, const std::vector<int64_t>& rhs) {
         size_t ndim = std::max(lhs.size(), rhs.size());
         std::vector<int64_t> shape(ndim, 1);
@@ -524,9 +696,13 @@ namespace sd {
     template <typename T>
     inline Tensor<T>& operator+=(Tensor<T>& lhs, const Tensor<T>& rhs) {
         if (lhs.shape() == rhs.shape()) {
-            for (int64_t i = 0; i < lhs.numel(); ++i) {
-                lhs[i] += rhs[i];
-            }
+            T* lhs_data       = lhs.data();
+            const T* rhs_data = rhs.data();
+            tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    lhs_data[i] += rhs_data[i];
+                }
+            });
             return lhs;
         }
         tensor_broadcast_shape(lhs.shape(), rhs.shape());
@@ -547,18 +723,25 @@ namespace sd {
     template <typename T, typename Scalar, typename = std::enable_if_t<std::is_arithmetic<Scalar>::value>>
     inline Tensor<T>& operator+=(Tensor<T>& lhs, Scalar rhs) {
         const T value = static_cast<T>(rhs);
-        for (int64_t i = 0; i < lhs.numel(); ++i) {
-            lhs[i] += value;
-        }
+        T* lhs_data   = lhs.data();
+        tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                lhs_data[i] += value;
+            }
+        });
         return lhs;
     }
 
     template <typename T>
     inline Tensor<T>& operator-=(Tensor<T>& lhs, const Tensor<T>& rhs) {
         if (lhs.shape() == rhs.shape()) {
-            for (int64_t i = 0; i < lhs.numel(); ++i) {
-                lhs[i] -= rhs[i];
-            }
+            T* lhs_data       = lhs.data();
+            const T* rhs_data = rhs.data();
+            tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    lhs_data[i] -= rhs_data[i];
+                }
+            });
             return lhs;
         }
         tensor_broadcast_shape(lhs.shape(), rhs.shape());
@@ -579,18 +762,25 @@ namespace sd {
     template <typename T, typename Scalar, typename = std::enable_if_t<std::is_arithmetic<Scalar>::value>>
     inline Tensor<T>& operator-=(Tensor<T>& lhs, Scalar rhs) {
         const T value = static_cast<T>(rhs);
-        for (int64_t i = 0; i < lhs.numel(); ++i) {
-            lhs[i] -= value;
-        }
+        T* lhs_data   = lhs.data();
+        tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                lhs_data[i] -= value;
+            }
+        });
         return lhs;
     }
 
     template <typename T>
     inline Tensor<T>& operator*=(Tensor<T>& lhs, const Tensor<T>& rhs) {
         if (lhs.shape() == rhs.shape()) {
-            for (int64_t i = 0; i < lhs.numel(); ++i) {
-                lhs[i] *= rhs[i];
-            }
+            T* lhs_data       = lhs.data();
+            const T* rhs_data = rhs.data();
+            tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    lhs_data[i] *= rhs_data[i];
+                }
+            });
             return lhs;
         }
         tensor_broadcast_shape(lhs.shape(), rhs.shape());
@@ -611,18 +801,25 @@ namespace sd {
     template <typename T, typename Scalar, typename = std::enable_if_t<std::is_arithmetic<Scalar>::value>>
     inline Tensor<T>& operator*=(Tensor<T>& lhs, Scalar rhs) {
         const T value = static_cast<T>(rhs);
-        for (int64_t i = 0; i < lhs.numel(); ++i) {
-            lhs[i] *= value;
-        }
+        T* lhs_data   = lhs.data();
+        tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                lhs_data[i] *= value;
+            }
+        });
         return lhs;
     }
 
     template <typename T>
     inline Tensor<T>& operator/=(Tensor<T>& lhs, const Tensor<T>& rhs) {
         if (lhs.shape() == rhs.shape()) {
-            for (int64_t i = 0; i < lhs.numel(); ++i) {
-                lhs[i] /= rhs[i];
-            }
+            T* lhs_data       = lhs.data();
+            const T* rhs_data = rhs.data();
+            tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    lhs_data[i] /= rhs_data[i];
+                }
+            });
             return lhs;
         }
         tensor_broadcast_shape(lhs.shape(), rhs.shape());
@@ -643,9 +840,12 @@ namespace sd {
     template <typename T, typename Scalar, typename = std::enable_if_t<std::is_arithmetic<Scalar>::value>>
     inline Tensor<T>& operator/=(Tensor<T>& lhs, Scalar rhs) {
         const T value = static_cast<T>(rhs);
-        for (int64_t i = 0; i < lhs.numel(); ++i) {
-            lhs[i] /= value;
-        }
+        T* lhs_data   = lhs.data();
+        tensor_parallel_for(lhs.numel(), [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                lhs_data[i] /= value;
+            }
+        });
         return lhs;
     }
 
@@ -1007,26 +1207,83 @@ namespace sd {
             auto x_contributors = make_interpolate_contributors(input_width, output_width, mode, antialias);
             auto y_contributors = make_interpolate_contributors(input_height, output_height, mode, antialias);
 
-            for (int64_t plane = 0; plane < plane_count; ++plane) {
-                const int64_t input_plane_offset  = plane * input_plane;
-                const int64_t output_plane_offset = plane * output_plane;
-                for (int64_t y = 0; y < output_height; ++y) {
-                    const auto& y_axis = y_contributors[static_cast<size_t>(y)];
-                    for (int64_t x = 0; x < output_width; ++x) {
-                        const auto& x_axis = x_contributors[static_cast<size_t>(x)];
-                        double value       = 0.0;
-                        for (const auto& yc : y_axis) {
-                            const int64_t input_row_offset = input_plane_offset + yc.index * input_width;
-                            for (const auto& xc : x_axis) {
-                                value += static_cast<double>(input.data()[input_row_offset + xc.index]) *
-                                         xc.weight * yc.weight;
+            auto count_taps = [](const std::vector<std::vector<InterpolateContributor>>& axis) {
+                size_t taps = 0;
+                for (const auto& contributors : axis) {
+                    taps += contributors.size();
+                }
+                return static_cast<double>(taps);
+            };
+            const double x_taps = count_taps(x_contributors);
+            const double y_taps = count_taps(y_contributors);
+
+            const int64_t min_rows = std::max<int64_t>(1, kTensorParallelChunk / (output_width * 4));  // 4+ taps per output
+            auto run_rows          = [&](int64_t rows, const TaskPool::ChunkFn& pass) {
+                if (rows < 2 * min_rows) {
+                    pass(0, rows);
+                } else {
+                    parallel_for(rows, min_rows, pass);
+                }
+            };
+
+            // Wide filters (antialiased downscales, bicubic, lanczos) run
+            // separably: along x into double rows, then along y, so an output
+            // costs the taps of both axes added instead of multiplied. Narrow
+            // ones are not worth the intermediate buffer.
+            const double direct_cost    = x_taps * y_taps;
+            const double separable_cost = x_taps * input_height + y_taps * output_width;
+            if (separable_cost * 2 >= direct_cost) {
+                run_rows(plane_count * output_height, [&](int64_t begin, int64_t end) {
+                    for (int64_t row = begin; row < end; ++row) {
+                        const int64_t plane = row / output_height;
+                        const int64_t y     = row % output_height;
+                        const T* in         = input.data() + plane * input_plane;
+                        T* out              = output.data() + plane * output_plane + y * output_width;
+                        for (int64_t x = 0; x < output_width; ++x) {
+                            double value = 0.0;
+                            for (const auto& yc : y_contributors[static_cast<size_t>(y)]) {
+                                const T* in_row = in + yc.index * input_width;
+                                for (const auto& xc : x_contributors[static_cast<size_t>(x)]) {
+                                    value += static_cast<double>(in_row[xc.index]) * xc.weight * yc.weight;
+                                }
                             }
+                            out[x] = static_cast<T>(value);
                         }
-                        output.data()[output_plane_offset + y * output_width + x] = static_cast<T>(value);
                     }
-                }
+                });
+                return output;
             }
 
+            std::vector<double> horizontal(static_cast<size_t>(plane_count * input_height * output_width));
+            run_rows(plane_count * input_height, [&](int64_t begin, int64_t end) {
+                for (int64_t row = begin; row < end; ++row) {
+                    const T* in = input.data() + row * input_width;
+                    double* out = horizontal.data() + row * output_width;
+                    for (int64_t x = 0; x < output_width; ++x) {
+                        double value = 0.0;
+                        for (const auto& xc : x_contributors[static_cast<size_t>(x)]) {
+                            value += static_cast<double>(in[xc.index]) * xc.weight;
+                        }
+                        out[x] = value;
+                    }
+                }
+            });
+            run_rows(plane_count * output_height, [&](int64_t begin, int64_t end) {
+                for (int64_t row = begin; row < end; ++row) {
+                    const int64_t plane = row / output_height;
+                    const int64_t y     = row % output_height;
+                    const double* in    = horizontal.data() + plane * input_height * output_width;
+                    T* out              = output.data() + plane * output_plane + y * output_width;
+                    for (int64_t x = 0; x < output_width; ++x) {
+                        double value = 0.0;
+                        for (const auto& yc : y_contributors[static_cast<size_t>(y)]) {
+                            value += in[yc.index * output_width + x] * yc.weight;
+                        }
+                        out[x] = static_cast<T>(value);
+                    }
+                }
+            });
+
             return output;
         }
 
@@ -1280,19 +1537,48 @@ namespace sd {
             if (mode == InterpolateMode::Nearest ||
                 mode == InterpolateMode::NearestExact ||
                 !has_downsampling) {
-                for (int64_t flat = 0; flat < output.numel(); ++flat) {
-                    std::vector<int64_t> output_coord = tensor_unravel_index(flat, output.shape());
-                    std::vector<int64_t> input_coord(static_cast<size_t>(input.dim()), 0);
-                    for (size_t i = 0; i < static_cast<size_t>(input.dim()); ++i) {
+                // Source offset of every output coordinate, per dimension, so
+                // each output row is a gather along dim 0.
+                const size_t rank                        = static_cast<size_t>(input.dim());
+                const std::vector<int64_t> input_strides = tensor_compute_strides(input.shape());
+                std::vector<std::vector<int64_t>> src_offsets(rank);
+                for (size_t i = 0; i < rank; ++i) {
+                    src_offsets[i].resize(static_cast<size_t>(output.shape()[i]));
+                    for (int64_t o = 0; o < output.shape()[i]; ++o) {
+                        int64_t src = 0;
                         if (mode == InterpolateMode::NearestExact) {
-                            input_coord[i] = nearest_exact_interpolate_index(output_coord[i],
-                                                                             input.shape()[i],
-                                                                             output.shape()[i]);
+                            src = nearest_exact_interpolate_index(o, input.shape()[i], output.shape()[i]);
                         } else {
-                            input_coord[i] = output_coord[i] * input.shape()[i] / output.shape()[i];
+                            src = o * input.shape()[i] / output.shape()[i];
                         }
+                        src_offsets[i][static_cast<size_t>(o)] = src * input_strides[i];
                     }
-                    output[flat] = input.index(input_coord);
+                }
+
+                const int64_t output_width = output.shape()[0];
+                const int64_t rows         = output.numel() / output_width;
+                const int64_t min_rows     = std::max<int64_t>(1, kTensorParallelChunk / output_width);
+                const T* src               = input.data();
+                T* dst                     = output.data();
+                auto gather_rows           = [&](int64_t begin, int64_t end) {
+                    for (int64_t row = begin; row < end; ++row) {
+                        int64_t row_offset = 0;
+                        int64_t rest       = row;
+                        for (size_t i = 1; i < rank; ++i) {
+                            row_offset += src_offsets[i][static_cast<size_t>(rest % output.shape()[i])];
+                            rest /= output.shape()[i];
+                        }
+                        const T* src_row = src + row_offset;
+                        T* dst_row       = dst + row * output_width;
+                        for (int64_t x = 0; x < output_width; ++x) {
+                            dst_row[x] = src_row[src_offsets[0][static_cast<size_t>(x)]];
+                        }
+                    }
+                };
+                if (rows < 2 * min_rows) {
+                    gather_rows(0, rows);
+                } else {
+                    parallel_for(rows, min_rows, gather_rows);
                 }
 
                 return output;
@@ -1657,6 +1943,55 @@ namespace sd {
             return parts;
         }
 
+        // Fused in-place linear updates for sampler steps. Each makes a single
+        // pass over same-shape tensors, split across cores for large latents,
+        // instead of allocating a temporary per operator.
+
+        // y = a * y + b * x
+        template <typename T>
+        inline void axpby(Tensor<T>* y, double a, const Tensor<T>& x, double b) {
+            if (y == nullptr) {
+                tensor_throw_invalid_argument("Tensor axpby requires non-null y");
+            }
+            tensor_check_same_shape(*y, x);
+            const T a_value = static_cast<T>(a);
+            const T b_value = static_cast<T>(b);
+            T* y_data       = y->data();
+            const T* x_data = x.data();
+            tensor_parallel_for(y->numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    y_data[i] = a_value * y_data[i] + b_value * x_data[i];
+                }
+            });
+        }
+
+        // y = a * y + b * x + c * z
+        template <typename T>
+        inline void axpbypcz(Tensor<T>* y, double a, const Tensor<T>& x, double b, const Tensor<T>& z, double c) {
+            if (y == nullptr) {
+                tensor_throw_invalid_argument("Tensor axpbypcz requires non-null y");
+            }
+            tensor_check_same_shape(*y, x);
+            tensor_check_same_shape(*y, z);
+            const T a_value = static_cast<T>(a);
+            const T b_value = static_cast<T>(b);
+            const T c_value = static_cast<T>(c);
+            T* y_data       = y->data();
+            const T* x_data = x.data();
+            const T* z_data = z.data();
+            tensor_parallel_for(y->numel(), [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    y_data[i] = a_value * y_data[i] + b_value * x_data[i] + c_value * z_data[i];
+                }
+            });
+        }
+
+        // y = y + w * (x - y)
+        template <typename T>
+        inline void lerp(Tensor<T>* y, const Tensor<T>& x, double w) {
+            axpby(y, 1.0 - w, x, w);
+        }
+
     }  // namespace ops
 
 }  // namespace sd
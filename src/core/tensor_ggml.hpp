@@ -122,6 +122,31 @@ namespace sd {
         return tensor;
     }
 
+    // Writes the format load_tensor_from_file_as_tensor reads.
+    template <typename T>
+    inline void save_tensor_to_file(const std::string& file_path, const Tensor<T>& tensor, const std::string& name = "") {
+        std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open tensor file for writing: " + file_path);
+        }
+
+        int32_t n_dims = static_cast<int32_t>(tensor.dim());
+        int32_t length = static_cast<int32_t>(name.size());
+        int32_t ttype  = static_cast<int32_t>(GGMLTypeTraits<T>::type);
+        file.write(reinterpret_cast<const char*>(&n_dims), sizeof(n_dims));
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(reinterpret_cast<const char*>(&ttype), sizeof(ttype));
+        for (int64_t dim : tensor.shape()) {
+            int32_t value = static_cast<int32_t>(dim);
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+        file.write(name.data(), length);
+        file.write(reinterpret_cast<const char*>(tensor.data()), static_cast<std::streamsize>(tensor.numel() * sizeof(T)));
+        if (!file.good()) {
+            throw std::runtime_error("failed to write tensor file: " + file_path);
+        }
+    }
+
 }  // namespace sd
 
 #endif  // __SD_CORE_TENSOR_GGML_HPP__
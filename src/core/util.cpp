@@ -1,6 +1,8 @@
 #include "core/util.h"
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <climits>
 #include <cmath>
 #include <codecvt>
 #include <cstdarg>
@@ -13,6 +15,7 @@
 #include <thread>
 #include <unordered_set>
 #include <vector>
+#include "core/host_memory.h"
 #include "runtime/preprocessing.hpp"
 
 #if defined(__APPLE__) && defined(__MACH__)
@@ -159,6 +162,56 @@ std::unique_ptr<MmapWrapper> MmapWrapper::create(const std::string& filename, bo
     return std::make_unique<MmapWrapperImpl>(mapped_data, file_size, file_handle, mapping_handle);
 }
 
+class PositionalFileReaderImpl : public PositionalFileReader {
+public:
+    explicit PositionalFileReaderImpl(HANDLE hfile)
+        : hfile_(hfile) {}
+
+    ~PositionalFileReaderImpl() override {
+        CloseHandle(hfile_);
+    }
+
+    bool read(void* buf, size_t n, uint64_t offset) const override {
+        uint8_t* dst = static_cast<uint8_t*>(buf);
+        while (n > 0) {
+            DWORD chunk      = static_cast<DWORD>(std::min<size_t>(n, 1u << 30));
+            DWORD bytes_read = 0;
+            OVERLAPPED ov    = {};
+            ov.Offset        = static_cast<DWORD>(offset & 0xFFFFFFFF);
+            ov.OffsetHigh    = static_cast<DWORD>(offset >> 32);
+            if (!ReadFile(hfile_, dst, chunk, &bytes_read, &ov) || bytes_read == 0) {
+                return false;
+            }
+            dst += bytes_read;
+            offset += bytes_read;
+            n -= bytes_read;
+        }
+        return true;
+    }
+
+    void prefetch(uint64_t, size_t) const override {}
+    void release(uint64_t, size_t) const override {}
+
+private:
+    HANDLE hfile_;
+};
+
+std::unique_ptr<PositionalFileReader> PositionalFileReader::create(const std::string& filename) {
+    HANDLE file_handle = CreateFileA(
+        filename.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    return std::make_unique<PositionalFileReaderImpl>(file_handle);
+}
+
 #else  // Unix
 #include <dirent.h>
 #include <fcntl.h>
@@ -166,6 +219,10 @@ std::unique_ptr<MmapWrapper> MmapWrapper::create(const std::string& filename, bo
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__linux__) && !defined(MADV_POPULATE_READ)
+#define MADV_POPULATE_READ 22
+#endif
+
 bool file_exists(const std::string& filename) {
     struct stat buffer;
     return (stat(filename.c_str(), &buffer) == 0 && S_ISREG(buffer.st_mode));
@@ -208,8 +265,8 @@ static MmapFlags get_mmap_flags() {
 
 class MmapWrapperImpl : public MmapWrapper {
 public:
-    MmapWrapperImpl(void* data, size_t size, int fd)
-        : MmapWrapper(data, size), fd_(fd) {}
+    MmapWrapperImpl(void* data, size_t size, int fd, bool writable)
+        : MmapWrapper(data, size), fd_(fd), writable_(writable) {}
 
     ~MmapWrapperImpl() override {
 #ifdef __linux__
@@ -231,8 +288,62 @@ public:
         close(fd_);
     }
 
+    void prefetch(size_t offset, size_t n) const override {
+#ifdef __linux__
+        uint8_t* begin = nullptr;
+        size_t length  = 0;
+        if (page_range(offset, n, &begin, &length)) {
+            posix_madvise(begin, length, POSIX_MADV_WILLNEED);
+        }
+#else
+        (void)offset;
+        (void)n;
+#endif
+    }
+
+    void release(size_t offset, size_t n) const override {
+#ifdef __linux__
+        // a writable private mapping may hold changed pages that DONTNEED would discard
+        uint8_t* begin = nullptr;
+        size_t length  = 0;
+        if (!writable_ && page_range(offset, n, &begin, &length)) {
+            madvise(begin, length, MADV_DONTNEED);
+            posix_fadvise(fd_, static_cast<off_t>(begin - static_cast<uint8_t*>(data_)), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+        }
+#else
+        (void)offset;
+        (void)n;
+#endif
+    }
+
+    void populate(size_t offset, size_t n) const override {
+#ifdef __linux__
+        uint8_t* begin = nullptr;
+        size_t length  = 0;
+        if (page_range(offset, n, &begin, &length) && madvise(begin, length, MADV_POPULATE_READ) == 0) {
+            return;
+        }
+        // kernels before 5.14 reject MADV_POPULATE_READ
+#endif
+        MmapWrapper::populate(offset, n);
+    }
+
 private:
+    // [offset, offset + n) widened to whole pages and clamped to the mapping
+    bool page_range(size_t offset, size_t n, uint8_t** begin, size_t* length) const {
+        if (offset >= size_ || n == 0) {
+            return false;
+        }
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t first      = offset / page * page;
+        size_t last       = std::min(size_, offset + std::min(n, size_ - offset));
+        *begin            = static_cast<uint8_t*>(data_) + first;
+        *length           = last - first;
+        return true;
+    }
+
     int fd_;
+    bool writable_;
 };
 
 std::unique_ptr<MmapWrapper> MmapWrapper::create(const std::string& filename, bool writable) {
@@ -284,8 +395,73 @@ std::unique_ptr<MmapWrapper> MmapWrapper::create(const std::string& filename, bo
         posix_madvise(mapped_data, file_size, POSIX_MADV_WILLNEED);
     }
 #endif
+    sd::advise_host_mapping(mapped_data, file_size);
 
-    return std::make_unique<MmapWrapperImpl>(mapped_data, file_size, file_descriptor);
+    return std::make_unique<MmapWrapperImpl>(mapped_data, file_size, file_descriptor, writable);
+}
+
+class PositionalFileReaderImpl : public PositionalFileReader {
+public:
+    explicit PositionalFileReaderImpl(int fd)
+        : fd_(fd) {}
+
+    ~PositionalFileReaderImpl() override {
+        close(fd_);
+    }
+
+    bool read(void* buf, size_t n, uint64_t offset) const override {
+        uint8_t* dst = static_cast<uint8_t*>(buf);
+        while (n > 0) {
+            ssize_t bytes_read = pread(fd_, dst, n, static_cast<off_t>(offset));
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_read <= 0) {
+                return false;
+            }
+            dst += bytes_read;
+            offset += bytes_read;
+            n -= bytes_read;
+        }
+        return true;
+    }
+
+    void prefetch(uint64_t offset, size_t n) const override {
+#ifdef __linux__
+        posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(n), POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+        struct radvisory advice;
+        advice.ra_offset = static_cast<off_t>(offset);
+        advice.ra_count  = static_cast<int>(std::min<size_t>(n, INT_MAX));
+        fcntl(fd_, F_RDADVISE, &advice);
+#else
+        (void)offset;
+        (void)n;
+#endif
+    }
+
+    void release(uint64_t offset, size_t n) const override {
+#ifdef __linux__
+        posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(n), POSIX_FADV_DONTNEED);
+#else
+        (void)offset;
+        (void)n;
+#endif
+    }
+
+private:
+    int fd_;
+};
+
+std::unique_ptr<PositionalFileReader> PositionalFileReader::create(const std::string& filename) {
+    int file_descriptor = open(filename.c_str(), O_RDONLY);
+    if (file_descriptor == -1) {
+        return nullptr;
+    }
+#ifdef __linux__
+    posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return std::make_unique<PositionalFileReaderImpl>(file_descriptor);
 }
 
 #endif
@@ -298,6 +474,23 @@ bool MmapWrapper::copy_data(void* buf, size_t n, size_t offset) const {
     return true;
 }
 
+void MmapWrapper::populate(size_t offset, size_t n) const {
+    if (offset >= size_) {
+        return;
+    }
+    const size_t end             = offset + std::min(n, size_ - offset);
+    const volatile uint8_t* base = data();
+    uint8_t sink                 = 0;
+    // one read per 4 KiB, the smallest page size
+    for (size_t i = offset; i < end; i += 4096) {
+        sink ^= base[i];
+    }
+    if (end > offset) {
+        sink ^= base[end - 1];
+    }
+    (void)sink;
+}
+
 // get_num_physical_cores is copy from
 // https://github.com/ggerganov/llama.cpp/blob/master/examples/common.cpp
 // LICENSE: https://github.com/ggerganov/llama.cpp/blob/master/LICENSE
@@ -336,8 +529,17 @@ int32_t sd_get_num_physical_cores() {
     return n_threads > 0 ? (n_threads <= 4 ? n_threads : n_threads / 2) : 4;
 }
 
-static sd_progress_cb_t sd_progress_cb = nullptr;
-void* sd_progress_cb_data              = nullptr;
+static sd_progress_cb_t sd_progress_cb      = nullptr;
+void* sd_progress_cb_data                   = nullptr;
+static thread_local void* sd_thread_cb_data = nullptr;
+// the callbacks of the context whose work runs on this thread
+static thread_local const SDCallbacks* sd_thread_callbacks = nullptr;
+
+static sd_step_timing_cb_t sd_step_timing_cb = nullptr;
+static void* sd_step_timing_cb_data          = nullptr;
+
+static sd_degradation_cb_t sd_degradation_cb = nullptr;
+static void* sd_degradation_cb_data          = nullptr;
 
 static sd_preview_cb_t sd_preview_cb = nullptr;
 static void* sd_preview_cb_data      = nullptr;
@@ -346,6 +548,9 @@ int sd_preview_interval              = 1;
 bool sd_preview_denoised             = true;
 bool sd_preview_noisy                = false;
 
+static sd_provisional_cb_t sd_provisional_cb = nullptr;
+static void* sd_provisional_cb_data          = nullptr;
+
 std::u32string utf8_to_utf32(const std::string& utf8_str) {
     std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
     return converter.from_bytes(utf8_str);
@@ -528,8 +733,8 @@ static void print_progress_line(int step, int steps, const std::string& speed_te
 }
 
 void pretty_progress(int step, int steps, float time) {
-    if (sd_progress_cb) {
-        sd_progress_cb(step, steps, time, sd_progress_cb_data);
+    if (sd_progress_cb_t progress_cb = sd_get_progress_callback()) {
+        progress_cb(step, steps, time, sd_get_progress_callback_data());
         return;
     }
     if (step == 0) {
@@ -545,9 +750,9 @@ void pretty_progress(int step, int steps, float time) {
 }
 
 void pretty_bytes_progress(int step, int steps, uint64_t bytes_processed, float elapsed_seconds) {
-    if (sd_progress_cb) {
+    if (sd_progress_cb_t progress_cb = sd_get_progress_callback()) {
         float time = elapsed_seconds / (step + 1e-6f);
-        sd_progress_cb(step, steps, time, sd_progress_cb_data);
+        progress_cb(step, steps, time, sd_get_progress_callback_data());
         return;
     }
     if (step == 0) {
@@ -594,7 +799,8 @@ void log_printf(sd_log_level_t level, const char* file, int line, const char* fo
     va_list args;
     va_start(args, format);
 
-    static char log_buffer[LOG_BUFFER_SIZE + 1];
+    // per thread, since contexts may log from several at once
+    static thread_local char log_buffer[LOG_BUFFER_SIZE + 1];
     int written = snprintf(log_buffer, LOG_BUFFER_SIZE, "%s:%-4d - ", sd_basename(file).c_str(), line);
 
     if (written >= 0 && written < LOG_BUFFER_SIZE) {
@@ -605,7 +811,10 @@ void log_printf(sd_log_level_t level, const char* file, int line, const char* fo
         strncat(log_buffer, "\n", LOG_BUFFER_SIZE - len);
     }
 
-    if (sd_log_cb) {
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    if (callbacks != nullptr && callbacks->log != nullptr) {
+        callbacks->log(level, log_buffer, callbacks->log_data);
+    } else if (sd_log_cb) {
         sd_log_cb(level, log_buffer, sd_log_cb_data);
     }
 
@@ -628,32 +837,112 @@ void sd_set_preview_callback(sd_preview_cb_t cb, preview_t mode, int interval, b
     sd_preview_denoised = denoised;
     sd_preview_noisy    = noisy;
 }
+void sd_set_provisional_callback(sd_provisional_cb_t cb, void* data) {
+    sd_provisional_cb      = cb;
+    sd_provisional_cb_data = data;
+}
+void sd_set_thread_callback_data(void* data) {
+    sd_thread_cb_data = data;
+}
+void sd_set_degradation_callback(sd_degradation_cb_t cb, void* data) {
+    sd_degradation_cb      = cb;
+    sd_degradation_cb_data = data;
+}
+
+// The context's callback when it set one, with its data; thread data
+// replaces either.
+template <typename Cb>
+static Cb thread_callback(Cb SDCallbacks::*cb, Cb fallback) {
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->*cb != nullptr ? callbacks->*cb : fallback;
+}
+template <typename Cb>
+static void* thread_callback_data(Cb SDCallbacks::*cb, void* SDCallbacks::*data, void* fallback) {
+    if (sd_thread_cb_data != nullptr) {
+        return sd_thread_cb_data;
+    }
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->*cb != nullptr ? callbacks->*data : fallback;
+}
+
+void sd_report_degradation(sd_degradation_t degradation, const char* component, const char* detail) {
+    LOG_WARN("%s: %s (%s)", component, detail, sd_degradation_name(degradation));
+    if (sd_degradation_cb_t degradation_cb = thread_callback(&SDCallbacks::degradation, sd_degradation_cb)) {
+        degradation_cb(degradation,
+                       component,
+                       detail,
+                       thread_callback_data(&SDCallbacks::degradation, &SDCallbacks::degradation_data, sd_degradation_cb_data));
+    }
+}
 
 sd_preview_cb_t sd_get_preview_callback() {
-    return sd_preview_cb;
+    return thread_callback(&SDCallbacks::preview, sd_preview_cb);
 }
 void* sd_get_preview_callback_data() {
-    return sd_preview_cb_data;
+    return thread_callback_data(&SDCallbacks::preview, &SDCallbacks::preview_data, sd_preview_cb_data);
 }
 
+// the preview settings go with the preview callback they were set with
 preview_t sd_get_preview_mode() {
-    return sd_preview_mode;
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->preview != nullptr ? callbacks->preview_mode : sd_preview_mode;
 }
 int sd_get_preview_interval() {
-    return sd_preview_interval;
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->preview != nullptr ? callbacks->preview_interval : sd_preview_interval;
 }
 bool sd_should_preview_denoised() {
-    return sd_preview_denoised;
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->preview != nullptr ? callbacks->preview_denoised : sd_preview_denoised;
 }
 bool sd_should_preview_noisy() {
-    return sd_preview_noisy;
+    const SDCallbacks* callbacks = sd_thread_callbacks;
+    return callbacks != nullptr && callbacks->preview != nullptr ? callbacks->preview_noisy : sd_preview_noisy;
+}
+
+sd_provisional_cb_t sd_get_provisional_callback() {
+    return thread_callback(&SDCallbacks::provisional, sd_provisional_cb);
+}
+void* sd_get_provisional_callback_data() {
+    return thread_callback_data(&SDCallbacks::provisional, &SDCallbacks::provisional_data, sd_provisional_cb_data);
+}
+
+void sd_set_step_timing_callback(sd_step_timing_cb_t cb, void* data) {
+    sd_step_timing_cb      = cb;
+    sd_step_timing_cb_data = data;
+}
+sd_step_timing_cb_t sd_get_step_timing_callback() {
+    return thread_callback(&SDCallbacks::step_timing, sd_step_timing_cb);
+}
+void* sd_get_step_timing_callback_data() {
+    return thread_callback_data(&SDCallbacks::step_timing, &SDCallbacks::step_timing_data, sd_step_timing_cb_data);
 }
 
 sd_progress_cb_t sd_get_progress_callback() {
-    return sd_progress_cb;
+    return thread_callback(&SDCallbacks::progress, sd_progress_cb);
 }
 void* sd_get_progress_callback_data() {
-    return sd_progress_cb_data;
+    return thread_callback_data(&SDCallbacks::progress, &SDCallbacks::progress_data, sd_progress_cb_data);
+}
+
+SDThreadCallbacks sd_current_thread_callbacks() {
+    return {sd_thread_callbacks, sd_thread_cb_data};
+}
+
+ScopedThreadCallbacks::ScopedThreadCallbacks(const SDThreadCallbacks& callbacks)
+    : previous_(sd_current_thread_callbacks()) {
+    sd_thread_callbacks = callbacks.callbacks;
+    sd_thread_cb_data   = callbacks.data;
+}
+
+ScopedThreadCallbacks::ScopedThreadCallbacks(const SDCallbacks* callbacks)
+    : previous_(sd_current_thread_callbacks()) {
+    sd_thread_callbacks = callbacks;
+}
+
+ScopedThreadCallbacks::~ScopedThreadCallbacks() {
+    sd_thread_callbacks = previous_.callbacks;
+    sd_thread_cb_data   = previous_.data;
 }
 
 sd_image_t tensor_to_sd_image(const sd::Tensor<float>& tensor, int frame_index) {
@@ -681,13 +970,21 @@ sd::Tensor<float> sd_image_to_tensor(sd_image_t image,
                                                  static_cast<int64_t>(image.height),
                                                  static_cast<int64_t>(image.channel),
                                                  1});
-    for (uint32_t iw = 0; iw < image.width; ++iw) {
-        for (uint32_t ih = 0; ih < image.height; ++ih) {
-            for (uint32_t ic = 0; ic < image.channel; ++ic) {
-                tensor.index(iw, ih, ic, 0) = sd_image_get_f32(image, iw, ih, ic, scale);
+    // Interleaved u8 pixels to planar floats, one channel plane at a time so
+    // the inner loop is a strided load and a contiguous store.
+    const size_t pixels  = static_cast<size_t>(image.width) * image.height;
+    const size_t channel = image.channel;
+    const float divisor  = scale ? 255.f : 1.f;
+    const uint8_t* src   = image.data;
+    float* dst           = tensor.data();
+    sd::tensor_parallel_for(static_cast<int64_t>(pixels), [&](int64_t begin, int64_t end) {
+        for (size_t c = 0; c < channel; ++c) {
+            float* plane = dst + c * pixels;
+            for (int64_t i = begin; i < end; ++i) {
+                plane[i] = src[static_cast<size_t>(i) * channel + c] / divisor;
             }
         }
-    }
+    });
     if (target_width >= 0 && target_height >= 0 &&
         (tensor.shape()[0] != target_width || tensor.shape()[1] != target_height)) {
         tensor = sd::ops::interpolate(tensor,
@@ -713,8 +1010,9 @@ sd::Tensor<float> clip_preprocess(const sd::Tensor<float>& image, int target_wid
     float height_scale = static_cast<float>(target_height) / static_cast<float>(image.shape()[1]);
     float scale        = std::fmax(width_scale, height_scale);
 
-    int64_t resized_width  = static_cast<int64_t>(scale * static_cast<float>(image.shape()[0]));
-    int64_t resized_height = static_cast<int64_t>(scale * static_cast<float>(image.shape()[1]));
+    // At least the target size, which the truncation can fall just short of.
+    int64_t resized_width  = std::max<int64_t>(target_width, static_cast<int64_t>(scale * static_cast<float>(image.shape()[0])));
+    int64_t resized_height = std::max<int64_t>(target_height, static_cast<int64_t>(scale * static_cast<float>(image.shape()[1])));
 
     sd::Tensor<float> resized = sd::ops::interpolate(
         image,
@@ -723,19 +1021,18 @@ sd::Tensor<float> clip_preprocess(const sd::Tensor<float>& image, int target_wid
     int64_t h_offset = std::max<int64_t>((resized_height - target_height) / 2, 0);
     int64_t w_offset = std::max<int64_t>((resized_width - target_width) / 2, 0);
 
-    sd::Tensor<float> cropped({target_width, target_height, image.shape()[2], image.shape()[3]});
-    for (int64_t y = 0; y < target_height; ++y) {
-        for (int64_t x = 0; x < target_width; ++x) {
-            for (int64_t c = 0; c < image.shape()[2]; ++c) {
-                cropped.index(x, y, c, 0) = resized.index(x + w_offset, y + h_offset, c, 0);
+    // Crop, clamp and normalize in one pass over the output rows.
+    sd::Tensor<float> normalized({target_width, target_height, image.shape()[2], image.shape()[3]});
+    for (int64_t c = 0; c < image.shape()[2]; ++c) {
+        for (int64_t y = 0; y < target_height; ++y) {
+            const float* src = resized.data() + (c * resized_height + y + h_offset) * resized_width + w_offset;
+            float* dst       = normalized.data() + (c * target_height + y) * target_width;
+            for (int64_t x = 0; x < target_width; ++x) {
+                dst[x] = (std::clamp(src[x], 0.0f, 1.0f) - means[c]) / stds[c];
             }
         }
     }
-
-    sd::Tensor<float> normalized = sd::ops::clamp(cropped, 0.0f, 1.0f);
-    sd::Tensor<float> mean({1, 1, 3, 1}, {means[0], means[1], means[2]});
-    sd::Tensor<float> std({1, 1, 3, 1}, {stds[0], stds[1], stds[2]});
-    return (normalized - mean) / std;
+    return normalized;
 }
 
 // Ref: https://github.com/AUTOMATIC1111/stable-diffusion-webui/blob/cad87bf4e3e0b0a759afa94e933527c3123d59bc/modules/prompt_parser.py#L345
@@ -56,6 +56,13 @@ public:
     uint8_t* writable_data() { return static_cast<uint8_t*>(data_); }
     size_t size() const { return size_; }
     bool copy_data(void* buf, size_t n, size_t offset) const;
+    // Page cache hints for [offset, offset + n): prefetch starts reading it in
+    // the background, release drops it once it has been copied elsewhere.
+    virtual void prefetch(size_t offset, size_t n) const {}
+    virtual void release(size_t offset, size_t n) const {}
+    // Faults [offset, offset + n) into the mapping and waits for it, so a
+    // later copy finds the pages resident.
+    virtual void populate(size_t offset, size_t n) const;
 
 protected:
     MmapWrapper(void* data, size_t size)
@@ -64,6 +71,31 @@ protected:
     size_t size_ = 0;
 };
 
+// Reads at explicit offsets (pread / ReadFile with an offset), so loader
+// threads share one handle without seeking, and can ask the kernel to start
+// reading ranges they will need next while they convert the current one.
+class PositionalFileReader {
+public:
+    static std::unique_ptr<PositionalFileReader> create(const std::string& filename);
+
+    virtual ~PositionalFileReader() = default;
+
+    PositionalFileReader(const PositionalFileReader&)            = delete;
+    PositionalFileReader& operator=(const PositionalFileReader&) = delete;
+
+    virtual bool read(void* buf, size_t n, uint64_t offset) const = 0;
+    // Queues a read of [offset, offset + n) into the page cache without
+    // waiting for it. A hint only; may do nothing.
+    virtual void prefetch(uint64_t offset, size_t n) const = 0;
+    // Drops [offset, offset + n) from the page cache after it was read, so
+    // streaming a file larger than RAM does not fill memory with pages that
+    // are not read again. A hint only; may do nothing.
+    virtual void release(uint64_t offset, size_t n) const = 0;
+
+protected:
+    PositionalFileReader() = default;
+};
+
 std::string path_join(const std::string& p1, const std::string& p2);
 std::vector<std::string> split_string(const std::string& str, char delimiter);
 
@@ -90,6 +122,12 @@ std::vector<std::pair<std::string, float>> split_quotation_attention(
 
 sd_progress_cb_t sd_get_progress_callback();
 void* sd_get_progress_callback_data();
+sd_step_timing_cb_t sd_get_step_timing_callback();
+void* sd_get_step_timing_callback_data();
+
+// Logs a degradation and hands it to the callback set with
+// sd_set_degradation_callback.
+void sd_report_degradation(sd_degradation_t degradation, const char* component, const char* detail);
 
 sd_preview_cb_t sd_get_preview_callback();
 void* sd_get_preview_callback_data();
@@ -98,6 +136,55 @@ int sd_get_preview_interval();
 bool sd_should_preview_denoised();
 bool sd_should_preview_noisy();
 
+sd_provisional_cb_t sd_get_provisional_callback();
+void* sd_get_provisional_callback_data();
+
+// Callbacks a context sets for its own work, see sd_ctx_set_progress_callback.
+// A null callback defers to the process-wide one.
+struct SDCallbacks {
+    sd_log_cb_t log                 = nullptr;
+    void* log_data                  = nullptr;
+    sd_progress_cb_t progress       = nullptr;
+    void* progress_data             = nullptr;
+    sd_preview_cb_t preview         = nullptr;
+    void* preview_data              = nullptr;
+    preview_t preview_mode          = PREVIEW_NONE;
+    int preview_interval            = 1;
+    bool preview_denoised           = true;
+    bool preview_noisy              = false;
+    sd_provisional_cb_t provisional = nullptr;
+    void* provisional_data          = nullptr;
+    sd_step_timing_cb_t step_timing = nullptr;
+    void* step_timing_data          = nullptr;
+    sd_degradation_cb_t degradation = nullptr;
+    void* degradation_data          = nullptr;
+};
+
+// Where the calling thread reports to: the callbacks of the context it works
+// for and the data of sd_set_thread_callback_data. Threads a generation
+// starts adopt it with ScopedThreadCallbacks, so their progress and logs go
+// where the generation's do.
+struct SDThreadCallbacks {
+    const SDCallbacks* callbacks = nullptr;
+    void* data                   = nullptr;
+};
+
+SDThreadCallbacks sd_current_thread_callbacks();
+
+class ScopedThreadCallbacks {
+public:
+    explicit ScopedThreadCallbacks(const SDThreadCallbacks& callbacks);
+    // the callbacks of a context, keeping the thread's data
+    explicit ScopedThreadCallbacks(const SDCallbacks* callbacks);
+    ~ScopedThreadCallbacks();
+
+    ScopedThreadCallbacks(const ScopedThreadCallbacks&)            = delete;
+    ScopedThreadCallbacks& operator=(const ScopedThreadCallbacks&) = delete;
+
+private:
+    SDThreadCallbacks previous_;
+};
+
 // test if the backend is a specific one, e.g. "CUDA", "ROCm", "Vulkan" etc.
 bool sd_backend_is(ggml_backend_t backend, const std::string& name);
 
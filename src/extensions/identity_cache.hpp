@@ -0,0 +1,96 @@
+#ifndef __SD_EXTENSIONS_IDENTITY_CACHE_HPP__
+#define __SD_EXTENSIONS_IDENTITY_CACHE_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "core/tensor.hpp"
+
+// LRU cache of identity embeddings, so an identity that comes back across
+// requests (the same id images, or the same embedding file) skips the ID
+// encoder. Entries are small (a few KiB per image), so the budget is a count
+// of identities rather than bytes. One cache belongs to one extension.
+class IdentityCache {
+public:
+    void set_capacity(size_t capacity) {
+        capacity_ = capacity;
+        evict_to_capacity();
+    }
+
+    bool enabled() const {
+        return capacity_ > 0;
+    }
+
+    // FNV-1a over 64-bit words, chained so several tensors (the preprocessed
+    // id images and their face embeddings) make one key.
+    static uint64_t content_hash(const sd::Tensor<float>& x, uint64_t hash = 14695981039346656037ULL) {
+        for (int64_t dim : x.shape()) {
+            hash ^= static_cast<uint64_t>(dim);
+            hash *= 1099511628211ULL;
+        }
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(x.data());
+        size_t size               = static_cast<size_t>(x.numel()) * sizeof(float);
+        size_t i                  = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            hash ^= word;
+            hash *= 1099511628211ULL;
+        }
+        for (; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    bool get(const std::string& key, sd::Tensor<float>* embedding) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        *embedding = it->second->embedding;
+        return true;
+    }
+
+    void put(const std::string& key, const sd::Tensor<float>& embedding) {
+        if (!enabled()) {
+            return;
+        }
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+        entries_.push_front({key, embedding});
+        index_[key] = entries_.begin();
+        evict_to_capacity();
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        sd::Tensor<float> embedding;
+    };
+
+    void evict_to_capacity() {
+        while (entries_.size() > capacity_) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+    }
+
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t capacity_ = 0;
+};
+
+#endif  // __SD_EXTENSIONS_IDENTITY_CACHE_HPP__
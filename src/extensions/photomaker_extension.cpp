@@ -2,11 +2,13 @@
 
 #include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <tuple>
 #include <utility>
 
 #include "core/tensor_ggml.hpp"
 #include "core/util.h"
+#include "extensions/identity_cache.hpp"
 #include "model/adapter/pmid.hpp"
 
 static std::tuple<std::vector<int>, std::vector<float>, std::vector<bool>>
@@ -107,6 +109,7 @@ struct PhotoMakerExtension : public GenerationExtension {
     std::string trigger_word = "img";
     SDCondition id_condition;
     int start_merge_step = -1;
+    IdentityCache identity_cache;
 
     const char* name() const override {
         return "photomaker";
@@ -133,6 +136,7 @@ struct PhotoMakerExtension : public GenerationExtension {
             return true;
         }
 
+        identity_cache.set_capacity(static_cast<size_t>(std::max(0, ctx.params->identity_cache_size)));
         pmid_model = std::make_shared<PhotoMakerIDEncoder>(ctx.backend_for(SDBackendModule::PHOTOMAKER),
                                                            ctx.tensor_storage_map,
                                                            "pmid",
@@ -186,27 +190,34 @@ struct PhotoMakerExtension : public GenerationExtension {
         start_merge_step = -1;
     }
 
-    bool prepare_condition(GenerationExtensionConditionContext& ctx) override {
-        reset_runtime_condition();
-        if (!enabled || pmid_model == nullptr) {
-            return false;
+    // Identity embedding for the request: from pm_params.identity_path when
+    // that file exists, else from the cache or the ID encoder run over the id
+    // images (and written to identity_path when one is set).
+    sd::Tensor<float> get_identity(GenerationExtensionConditionContext& ctx) {
+        bool pmv2                 = pmid_model->get_version() == PM_VERSION_2;
+        std::string identity_path = SAFE_STR(ctx.pm_params.identity_path);
+        sd::Tensor<float> identity;
+        if (!identity_path.empty() && std::filesystem::exists(identity_path)) {
+            try {
+                identity = sd::load_tensor_from_file_as_tensor<float>(identity_path);
+            } catch (const std::exception& e) {
+                LOG_WARN("cannot read PhotoMaker identity '%s': %s", identity_path.c_str(), e.what());
+                return {};
+            }
+            if (identity.dim() < 2 || identity.shape()[0] != 2048) {
+                LOG_WARN("PhotoMaker identity '%s' has an unexpected shape", identity_path.c_str());
+                return {};
+            }
+            LOG_INFO("PhotoMaker identity loaded from '%s'", identity_path.c_str());
+            return identity;
         }
 
-        bool pmv2 = pmid_model->get_version() == PM_VERSION_2;
         if (ctx.pm_params.id_images_count <= 0 || ctx.pm_params.id_images == nullptr) {
             LOG_WARN("Provided PhotoMaker model file, but NO input ID images");
-            LOG_WARN("Turn off PhotoMaker for this request");
-            return false;
-        }
-        auto* clip_conditioner = dynamic_cast<FrozenCLIPEmbedderWithCustomWords*>(ctx.conditioner);
-        if (clip_conditioner == nullptr) {
-            LOG_WARN("PhotoMaker requires FrozenCLIPEmbedderWithCustomWords conditioner");
-            LOG_WARN("Turn off PhotoMaker for this request");
-            return false;
+            return {};
         }
 
-        int clip_image_size        = 224;
-        pmid_model->style_strength = ctx.pm_params.style_strength;
+        int clip_image_size = 224;
         sd::Tensor<float> id_image_tensor;
         for (int i = 0; i < ctx.pm_params.id_images_count; i++) {
             auto id_image           = sd_image_to_tensor(ctx.pm_params.id_images[i]);
@@ -218,21 +229,6 @@ struct PhotoMakerExtension : public GenerationExtension {
             }
         }
 
-        int64_t t0                        = ggml_time_ms();
-        int trigger_token_count           = pmv2 ? 2 * ctx.pm_params.id_images_count : ctx.pm_params.id_images_count;
-        auto cond_tup                     = get_photomaker_condition_with_trigger(*clip_conditioner,
-                                                                                  ctx.n_threads,
-                                                                                  ctx.condition_params,
-                                                                                  trigger_word,
-                                                                                  trigger_token_count);
-        SDCondition prepared_id_condition = std::get<0>(cond_tup);
-        auto class_tokens_mask            = std::get<1>(cond_tup);
-        if (std::find(class_tokens_mask.begin(), class_tokens_mask.end(), true) == class_tokens_mask.end()) {
-            LOG_WARN("PhotoMaker trigger word '%s' was not found in prompt", trigger_word.c_str());
-            LOG_WARN("Turn off PhotoMaker for this request");
-            return false;
-        }
-
         sd::Tensor<float> id_embeds;
         if (pmv2 && ctx.pm_params.id_embed_path != nullptr) {
             try {
@@ -243,21 +239,83 @@ struct PhotoMakerExtension : public GenerationExtension {
         }
         if (pmv2 && id_embeds.empty()) {
             LOG_WARN("Provided PhotoMaker images, but NO valid ID embeds file for PM v2");
-            LOG_WARN("Turn off PhotoMaker for this request");
-            return false;
+            return {};
         }
         if (pmv2 && ctx.pm_params.id_images_count != id_embeds.shape()[1]) {
             LOG_WARN("PhotoMaker image count (%d) does NOT match ID embeds (%d). You should run face_detect.py again.",
                      ctx.pm_params.id_images_count,
                      static_cast<int>(id_embeds.shape()[1]));
+            return {};
+        }
+
+        uint64_t hash = IdentityCache::content_hash(id_image_tensor);
+        if (pmv2) {
+            hash = IdentityCache::content_hash(id_embeds, hash);
+        }
+        std::string key = sd_format("%d:%016llx", pmv2 ? 2 : 1, (unsigned long long)hash);
+        if (identity_cache.get(key, &identity)) {
+            LOG_DEBUG("PhotoMaker identity cache hit (%zu entries)", identity_cache.size());
+        } else {
+            int64_t t0 = ggml_time_ms();
+            identity   = pmid_model->encode_identity(ctx.n_threads, id_image_tensor, id_embeds);
+            if (identity.empty()) {
+                LOG_ERROR("Photomaker ID encoding failed");
+                return {};
+            }
+            identity_cache.put(key, identity);
+            LOG_INFO("Photomaker ID encoding, taking %" PRId64 " ms", ggml_time_ms() - t0);
+        }
+
+        if (!identity_path.empty()) {
+            try {
+                sd::save_tensor_to_file(identity_path, identity, "pmid.identity");
+                LOG_INFO("PhotoMaker identity saved to '%s'", identity_path.c_str());
+            } catch (const std::exception& e) {
+                LOG_WARN("cannot write PhotoMaker identity '%s': %s", identity_path.c_str(), e.what());
+            }
+        }
+        return identity;
+    }
+
+    bool prepare_condition(GenerationExtensionConditionContext& ctx) override {
+        reset_runtime_condition();
+        if (!enabled || pmid_model == nullptr) {
+            return false;
+        }
+
+        auto* clip_conditioner = dynamic_cast<FrozenCLIPEmbedderWithCustomWords*>(ctx.conditioner);
+        if (clip_conditioner == nullptr) {
+            LOG_WARN("PhotoMaker requires FrozenCLIPEmbedderWithCustomWords conditioner");
+            LOG_WARN("Turn off PhotoMaker for this request");
+            return false;
+        }
+
+        pmid_model->style_strength = ctx.pm_params.style_strength;
+        sd::Tensor<float> identity = get_identity(ctx);
+        if (identity.empty()) {
+            LOG_WARN("Turn off PhotoMaker for this request");
+            return false;
+        }
+
+        // One class token per identity row: an image for v1, two for v2.
+        int64_t t0                        = ggml_time_ms();
+        int trigger_token_count           = static_cast<int>(identity.numel() / identity.shape()[0]);
+        auto cond_tup                     = get_photomaker_condition_with_trigger(*clip_conditioner,
+                                                                                  ctx.n_threads,
+                                                                                  ctx.condition_params,
+                                                                                  trigger_word,
+                                                                                  trigger_token_count);
+        SDCondition prepared_id_condition = std::get<0>(cond_tup);
+        auto class_tokens_mask            = std::get<1>(cond_tup);
+        if (std::find(class_tokens_mask.begin(), class_tokens_mask.end(), true) == class_tokens_mask.end()) {
+            LOG_WARN("PhotoMaker trigger word '%s' was not found in prompt", trigger_word.c_str());
             LOG_WARN("Turn off PhotoMaker for this request");
             return false;
         }
 
         auto res = pmid_model->compute(ctx.n_threads,
-                                       id_image_tensor,
+                                       identity,
                                        prepared_id_condition.c_crossattn,
-                                       id_embeds,
                                        class_tokens_mask);
         if (res.empty()) {
             LOG_ERROR("Photomaker ID Stacking failed");
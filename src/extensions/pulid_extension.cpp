@@ -1,10 +1,14 @@
 #include "extensions/generation_extension.h"
 
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
+#include <system_error>
 #include <variant>
 
 #include "core/tensor_ggml.hpp"
 #include "core/util.h"
+#include "extensions/identity_cache.hpp"
 #include "gguf.h"
 
 static sd::Tensor<float> load_pulid_id_embedding(const char* path) {
@@ -78,6 +82,7 @@ struct PuLIDExtension : public GenerationExtension {
     bool enabled = false;
     sd::Tensor<float> id_embedding;
     float id_weight = 1.0f;
+    IdentityCache identity_cache;
 
     const char* name() const override {
         return "pulid";
@@ -89,6 +94,7 @@ struct PuLIDExtension : public GenerationExtension {
 
     bool init(const GenerationExtensionInitContext& ctx) override {
         enabled = strlen(SAFE_STR(ctx.params->pulid_weights_path)) > 0;
+        identity_cache.set_capacity(static_cast<size_t>(std::max(0, ctx.params->identity_cache_size)));
         return true;
     }
 
@@ -102,11 +108,33 @@ struct PuLIDExtension : public GenerationExtension {
         if (!enabled) {
             return false;
         }
-        id_embedding = load_pulid_id_embedding(ctx.pulid_params.id_embedding_path);
+        id_embedding = load_id_embedding(SAFE_STR(ctx.pulid_params.id_embedding_path));
         id_weight    = ctx.pulid_params.id_weight;
         return false;  // PuLID does not modify the conditioning
     }
 
+    // The embedding file is the exported identity (the insightface/EVA-CLIP
+    // encoders run offline), so repeated requests only skip the gguf read;
+    // the key includes the file time so a rewritten file is picked up.
+    sd::Tensor<float> load_id_embedding(const std::string& path) {
+        if (path.empty()) {
+            return {};
+        }
+        std::error_code ec;
+        auto mtime      = std::filesystem::last_write_time(path, ec);
+        std::string key = ec ? "" : sd_format("%lld:%s", (long long)mtime.time_since_epoch().count(), path.c_str());
+        sd::Tensor<float> embedding;
+        if (!key.empty() && identity_cache.get(key, &embedding)) {
+            LOG_DEBUG("PuLID id-embedding cache hit for '%s'", path.c_str());
+            return embedding;
+        }
+        embedding = load_pulid_id_embedding(path.c_str());
+        if (!key.empty() && !embedding.empty()) {
+            identity_cache.put(key, embedding);
+        }
+        return embedding;
+    }
+
     void before_diffusion(DiffusionParams& params, int /*step*/) const override {
         if (!enabled || id_embedding.empty()) {
             return;
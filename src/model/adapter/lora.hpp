@@ -1,7 +1,9 @@
 #ifndef __SD_MODEL_ADAPTER_LORA_HPP__
 #define __SD_MODEL_ADAPTER_LORA_HPP__
 
+#include <atomic>
 #include <mutex>
+#include <thread>
 #include "core/ggml_extend.hpp"
 #include "model_loader.h"
 #include "model_manager.h"
@@ -11,9 +13,12 @@
 struct LoraModel : public GGMLRunner {
     std::string lora_id;
     float multiplier = 1.0f;
+    std::vector<float> image_multipliers;  // per generated image, used instead of multiplier when set
     std::unordered_map<std::string, ggml_tensor*> lora_tensors;
     std::map<ggml_tensor*, ggml_tensor*> original_tensor_to_final_tensor;
+    std::vector<std::pair<ggml_tensor*, ggml_tensor*>> quantized_tensor_diffs;  // merged on the CPU after compute
     std::set<std::string> applied_lora_tensors;
+    std::set<std::string> patched_tensors;  // model tensors the last apply() changed
     std::string file_path;
     std::shared_ptr<ModelManager> model_manager;
     ggml_backend_t params_backend = nullptr;
@@ -133,6 +138,7 @@ struct LoraModel : public GGMLRunner {
         lora_tensors.clear();
         original_tensor_to_final_tensor.clear();
         applied_lora_tensors.clear();
+        patched_tensors.clear();
         applied             = false;
         tensor_preprocessed = false;
     }
@@ -552,6 +558,52 @@ struct LoraModel : public GGMLRunner {
         return diff;
     }
 
+    // Plain down/up factors of a linear layer and their scale, for adapters that
+    // fuse several LoRAs into one matmul pair. Returns false without marking
+    // anything applied when the layer uses LoKr, a mid factor or split keys, so
+    // the caller can fall back to get_out_diff().
+    bool get_linear_factors(const std::string& model_tensor_name,
+                            ggml_tensor** down,
+                            ggml_tensor** up,
+                            float* scale) {
+        const std::string key            = "lora." + model_tensor_name;
+        const std::string lora_down_name = key + ".lora_down";
+        const std::string lora_up_name   = key + ".lora_up";
+        if (lora_tensors.count(key + ".lokr_w1") || lora_tensors.count(key + ".lokr_w1_a") ||
+            lora_tensors.count(key + ".lora_mid") || lora_tensors.count(key + ".1.lora_up") ||
+            lora_tensors.count(key + ".1.lokr_w1") || lora_tensors.count(key + ".1.lokr_w1_a")) {
+            return false;
+        }
+
+        auto down_iter = lora_tensors.find(lora_down_name);
+        auto up_iter   = lora_tensors.find(lora_up_name);
+        if (down_iter == lora_tensors.end() || up_iter == lora_tensors.end() ||
+            ggml_n_dims(down_iter->second) > 2 || ggml_n_dims(up_iter->second) > 2) {
+            return false;
+        }
+        *down = down_iter->second;
+        *up   = up_iter->second;
+        applied_lora_tensors.insert(lora_down_name);
+        applied_lora_tensors.insert(lora_up_name);
+
+        float scale_value = 1.0f;
+        int64_t rank      = (*down)->ne[ggml_n_dims(*down) - 1];
+        auto iter         = lora_tensors.find(key + ".scale");
+        if (iter != lora_tensors.end()) {
+            scale_value = ggml_ext_backend_tensor_get_f32(iter->second);
+            applied_lora_tensors.insert(key + ".scale");
+        } else {
+            iter = lora_tensors.find(key + ".alpha");
+            if (iter != lora_tensors.end()) {
+                float alpha = ggml_ext_backend_tensor_get_f32(iter->second);
+                scale_value = alpha / rank;
+                applied_lora_tensors.insert(key + ".alpha");
+            }
+        }
+        *scale = scale_value * multiplier;
+        return true;
+    }
+
     ggml_tensor* get_out_diff(ggml_context* ctx,
                               ggml_backend_t backend,
                               ggml_tensor* x,
@@ -808,7 +860,9 @@ struct LoraModel : public GGMLRunner {
         preprocess_lora_tensors(model_tensor_names);
 
         original_tensor_to_final_tensor.clear();
+        quantized_tensor_diffs.clear();
         applied_lora_tensors.clear();
+        patched_tensors.clear();
 
         for (auto it : model_tensors) {
             std::string model_tensor_name = it.first;
@@ -819,6 +873,21 @@ struct LoraModel : public GGMLRunner {
             if (diff == nullptr) {
                 continue;
             }
+            patched_tensors.insert(model_tensor_name);
+
+            if (can_merge_quantized_on_cpu(model_tensor) && ggml_nelements(diff) == ggml_nelements(model_tensor)) {
+                // the graph only yields the f32 diff; casting and requantizing
+                // in the graph would hold an f32 copy of every weight at once
+                // and needs a backend copy kernel for the quant type
+                if (diff->type != GGML_TYPE_F32) {
+                    diff = ggml_ext_cast_f32(compute_ctx, runtime_backend, diff);
+                }
+                diff = ggml_cont(compute_ctx, diff);
+                ggml_set_output(diff);
+                ggml_build_forward_expand(gf, diff);
+                quantized_tensor_diffs.push_back({model_tensor, diff});
+                continue;
+            }
 
             ggml_tensor* original_tensor = model_tensor;
             if (!sd_backend_is_cpu(runtime_backend) && ggml_backend_buffer_is_host(original_tensor->buffer)) {
@@ -859,9 +928,79 @@ struct LoraModel : public GGMLRunner {
             ggml_backend_tensor_copy(final_tensor, original_tensor);
         }
         original_tensor_to_final_tensor.clear();
+        merge_quantized_tensor_diffs(n_threads);
         GGMLRunner::free_compute_buffer();
     }
 
+    static bool can_merge_quantized_on_cpu(const ggml_tensor* tensor) {
+        return ggml_is_quantized(tensor->type) &&
+               ggml_get_type_traits(tensor->type)->to_float != nullptr &&
+               !ggml_quantize_requires_imatrix(tensor->type) &&
+               ggml_is_contiguous(tensor) &&
+               tensor->ne[0] % ggml_blck_size(tensor->type) == 0;
+    }
+
+    // Dequantizes each quantized weight, adds its diff and quantizes it back,
+    // one tensor per worker at a time. Only the transfers to and from device
+    // buffers are serialized.
+    void merge_quantized_tensor_diffs(int n_threads) {
+        if (quantized_tensor_diffs.empty()) {
+            return;
+        }
+        int64_t t0 = ggml_time_ms();
+        std::atomic<size_t> next_tensor{0};
+        std::mutex transfer_mutex;
+        auto worker = [&]() {
+            std::vector<uint8_t> data;
+            std::vector<float> weight_f32;
+            std::vector<float> diff_f32;
+            for (size_t i = next_tensor++; i < quantized_tensor_diffs.size(); i = next_tensor++) {
+                ggml_tensor* weight = quantized_tensor_diffs[i].first;
+                ggml_tensor* diff   = quantized_tensor_diffs[i].second;
+                const int64_t n     = ggml_nelements(weight);
+                const size_t nbytes = ggml_nbytes(weight);
+                const bool is_host  = ggml_backend_buffer_is_host(weight->buffer);
+
+                weight_f32.resize(n);
+                diff_f32.resize(n);
+                {
+                    std::lock_guard<std::mutex> lock(transfer_mutex);
+                    if (!is_host) {
+                        data.resize(nbytes);
+                        ggml_backend_tensor_get(weight, data.data(), 0, nbytes);
+                    }
+                    ggml_backend_tensor_get(diff, diff_f32.data(), 0, n * sizeof(float));
+                }
+                const void* src = is_host ? weight->data : data.data();
+                ggml_get_type_traits(weight->type)->to_float(src, weight_f32.data(), n);
+                for (int64_t j = 0; j < n; j++) {
+                    weight_f32[j] += diff_f32[j];
+                }
+                if (is_host) {
+                    ggml_quantize_chunk(weight->type, weight_f32.data(), weight->data, 0, n / weight->ne[0], weight->ne[0], nullptr);
+                } else {
+                    ggml_quantize_chunk(weight->type, weight_f32.data(), data.data(), 0, n / weight->ne[0], weight->ne[0], nullptr);
+                    std::lock_guard<std::mutex> lock(transfer_mutex);
+                    ggml_backend_tensor_set(weight, data.data(), 0, nbytes);
+                }
+            }
+        };
+        int n_workers = std::max(1, std::min<int>(n_threads, static_cast<int>(quantized_tensor_diffs.size())));
+        std::vector<std::thread> workers;
+        for (int i = 1; i < n_workers; i++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+        LOG_DEBUG("requantized %zu lora target tensors on %d threads, taking %.2fs",
+                  quantized_tensor_diffs.size(),
+                  n_workers,
+                  (ggml_time_ms() - t0) / 1000.f);
+        quantized_tensor_diffs.clear();
+    }
+
     void apply(std::map<std::string, ggml_tensor*> model_tensors, SDVersion version, int n_threads, bool warn_unused = true) {
         apply(model_tensors, tensor_names(model_tensors), version, n_threads, warn_unused);
     }
@@ -897,14 +1036,125 @@ struct LoraModel : public GGMLRunner {
 struct MultiLoraAdapter : public WeightAdapter {
 protected:
     std::vector<std::shared_ptr<LoraModel>> lora_models;
+    int first_image_    = 0;
+    int image_count_    = 1;
+    int64_t batch_size_ = 1;
+
+    float image_multiplier(const LoraModel* lora_model, int64_t sample) const {
+        size_t image = static_cast<size_t>(first_image_ + sample % image_count_);
+        return image < lora_model->image_multipliers.size() ? lora_model->image_multipliers[image] : 0.0f;
+    }
+
+    ggml_tensor* add_scaled_out_diffs(ggml_context* ctx,
+                                      ggml_backend_t backend,
+                                      ggml_tensor* x,
+                                      ggml_tensor* out,
+                                      const std::vector<LoraModel*>& loras,
+                                      const std::vector<float>& multipliers,
+                                      WeightAdapter::ForwardParams forward_params,
+                                      const std::string& prefix) {
+        for (size_t i = 0; i < loras.size(); i++) {
+            if (multipliers[i] == 0.0f) {
+                continue;
+            }
+            ggml_tensor* out_diff = loras[i]->get_out_diff(ctx, backend, x, forward_params, prefix + "weight");
+            if (out_diff == nullptr) {
+                continue;
+            }
+            out = ggml_add_inplace(ctx, out, ggml_ext_scale(ctx, out_diff, multipliers[i], true));
+        }
+        return out;
+    }
+
+    // Samples of the batch sit back to back along the last dim of x and out,
+    // one condition's images after another. Runs of samples whose images use
+    // the same multipliers are sliced out and get their own low-rank deltas,
+    // so every sample only sees the LoRAs of its own request.
+    ggml_tensor* add_per_image_out_diffs(ggml_context* ctx,
+                                         ggml_backend_t backend,
+                                         ggml_tensor* x,
+                                         ggml_tensor* out,
+                                         const std::vector<LoraModel*>& loras,
+                                         WeightAdapter::ForwardParams forward_params,
+                                         const std::string& prefix) {
+        auto multipliers_for = [&](int64_t sample) {
+            std::vector<float> multipliers;
+            for (const LoraModel* lora_model : loras) {
+                multipliers.push_back(image_multiplier(lora_model, sample));
+            }
+            return multipliers;
+        };
+
+        int dim = forward_params.op_type == ForwardParams::op_type_t::OP_CONV2D ? 3 : ggml_n_dims(x) - 1;
+        if (x->ne[dim] % batch_size_ != 0 || out->ne[dim] != x->ne[dim]) {
+            // the layer does not carry the batch in its last dim, so it only
+            // gets LoRAs all images use alike
+            std::vector<float> multipliers = multipliers_for(0);
+            for (int64_t sample = 1; sample < image_count_; sample++) {
+                if (multipliers_for(sample) != multipliers) {
+                    LOG_DEBUG("skipping per-image loras on '%s', its input is not split by sample", prefix.c_str());
+                    return out;
+                }
+            }
+            return add_scaled_out_diffs(ctx, backend, x, out, loras, multipliers, forward_params, prefix);
+        }
+
+        int64_t sample_len = x->ne[dim] / batch_size_;
+        std::vector<ggml_tensor*> parts;
+        for (int64_t begin = 0; begin < batch_size_;) {
+            std::vector<float> multipliers = multipliers_for(begin);
+            int64_t end                    = begin + 1;
+            while (end < batch_size_ && multipliers_for(end) == multipliers) {
+                end++;
+            }
+            if (begin == 0 && end == batch_size_) {
+                return add_scaled_out_diffs(ctx, backend, x, out, loras, multipliers, forward_params, prefix);
+            }
+            ggml_tensor* x_part   = ggml_ext_slice(ctx, x, dim, begin * sample_len, end * sample_len);
+            ggml_tensor* out_part = ggml_ext_slice(ctx, out, dim, begin * sample_len, end * sample_len);
+            parts.push_back(add_scaled_out_diffs(ctx, backend, x_part, out_part, loras, multipliers, forward_params, prefix));
+            begin = end;
+        }
+        out = parts[0];
+        for (size_t i = 1; i < parts.size(); i++) {
+            out = ggml_concat(ctx, out, parts[i], dim);
+        }
+        return out;
+    }
 
 public:
     explicit MultiLoraAdapter(const std::vector<std::shared_ptr<LoraModel>>& lora_models)
         : lora_models(lora_models) {
     }
 
+    // Generated images the next forward passes compute, for LoRAs with
+    // per-image multipliers.
+    void set_images(int first_image, int image_count) {
+        first_image_ = std::max(0, first_image);
+        image_count_ = std::max(1, image_count);
+    }
+
+    // Samples per forward pass: the images times the conditions stacked with them.
+    void set_batch_size(int64_t batch_size) {
+        batch_size_ = std::max<int64_t>(1, batch_size);
+    }
+
+    // Whether a LoRA weighs the rows of a batch by the image they belong to.
+    bool has_image_multipliers() const {
+        for (const auto& lora_model : lora_models) {
+            if (!lora_model->image_multipliers.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     ggml_tensor* patch_weight(ggml_context* ctx, ggml_backend_t backend, ggml_tensor* weight, const std::string& weight_name, bool with_lora_and_lokr) {
         for (auto& lora_model : lora_models) {
+            if (!lora_model->image_multipliers.empty()) {
+                // a patched weight is shared by the whole batch
+                continue;
+            }
             ggml_tensor* diff = lora_model->get_weight_diff(weight_name, backend, ctx, weight, with_lora_and_lokr);
             if (diff == nullptr) {
                 continue;
@@ -952,20 +1202,70 @@ public:
                                    forward_params.conv2d.circular_y,
                                    forward_params.conv2d.scale);
         }
+        // With several LoRAs on a linear layer, their plain factors are joined
+        // along the rank dim so the layer gets one down/up matmul pair on the
+        // activations instead of one per LoRA; each scale is folded into its
+        // (small) up factor. LoKr, mid factors and conv layers keep their own path.
+        bool fuse = forward_params.op_type == ForwardParams::op_type_t::OP_LINEAR && lora_models.size() > 1;
+        std::vector<ggml_tensor*> downs;
+        std::vector<ggml_tensor*> ups;
+        std::vector<float> scales;
+        std::vector<LoraModel*> per_image_loras;
         for (auto& lora_model : lora_models) {
+            if (!lora_model->image_multipliers.empty()) {
+                per_image_loras.push_back(lora_model.get());
+                continue;
+            }
+            ggml_tensor* down = nullptr;
+            ggml_tensor* up   = nullptr;
+            float scale       = 1.0f;
+            if (fuse && lora_model->get_linear_factors(prefix + "weight", &down, &up, &scale)) {
+                downs.push_back(down);
+                ups.push_back(up);
+                scales.push_back(scale);
+                continue;
+            }
             ggml_tensor* out_diff = lora_model->get_out_diff(ctx, backend, x, forward_params, prefix + "weight");
             if (out_diff == nullptr) {
                 continue;
             }
             out = ggml_add_inplace(ctx, out, out_diff);
         }
+        if (!downs.empty()) {
+            ggml_tensor* down = nullptr;
+            ggml_tensor* up   = nullptr;
+            if (downs.size() == 1) {
+                down = downs[0];
+                up   = ups[0];
+            } else {
+                auto to_f32 = [&](ggml_tensor* t) {
+                    return t->type == GGML_TYPE_F32 ? t : ggml_ext_cast_f32(ctx, backend, t);
+                };
+                for (size_t i = 0; i < downs.size(); i++) {
+                    ggml_tensor* down_i = to_f32(downs[i]);
+                    ggml_tensor* up_i   = ggml_ext_scale(ctx, to_f32(ups[i]), scales[i]);
+                    down                = down == nullptr ? down_i : ggml_concat(ctx, down, down_i, 1);
+                    up                  = up == nullptr ? up_i : ggml_concat(ctx, up, up_i, 0);
+                }
+            }
+            ggml_tensor* lx = ggml_ext_linear(ctx, x, down, nullptr, forward_params.linear.force_prec_f32, forward_params.linear.scale);
+            lx              = ggml_ext_linear(ctx, lx, up, nullptr, forward_params.linear.force_prec_f32, forward_params.linear.scale);
+            if (downs.size() == 1) {
+                lx = ggml_ext_scale(ctx, lx, scales[0], true);
+            }
+            out = ggml_add_inplace(ctx, out, lx);
+        }
+        if (!per_image_loras.empty()) {
+            out = add_per_image_out_diffs(ctx, backend, x, out, per_image_loras, forward_params, prefix);
+        }
         return out;
     }
 
     size_t get_extra_graph_size() override {
         size_t lora_tensor_num = 0;
         for (auto& lora_model : lora_models) {
-            lora_tensor_num += lora_model->lora_tensors.size();
+            size_t runs = lora_model->image_multipliers.empty() ? 1 : static_cast<size_t>(batch_size_);
+            lora_tensor_num += lora_model->lora_tensors.size() * runs;
         }
         return LORA_GRAPH_BASE_SIZE + lora_tensor_num * 10;
     }
@@ -0,0 +1,107 @@
+#ifndef __SD_MODEL_ADAPTER_LORA_CACHE_HPP__
+#define __SD_MODEL_ADAPTER_LORA_CACHE_HPP__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "model/adapter/lora.hpp"
+
+// LRU cache of runtime LoRAs whose tensors are already loaded on the backend
+// of the module they patch, so requests that name a hot LoRA attach it without
+// reopening and parsing the file. Entries are keyed by LoRA, module and tensor
+// filter; multipliers are set per request on the shared instance. The file is
+// not re-read while it stays cached, so changes on disk need a new context.
+class LoraModelCache {
+public:
+    void set_budget_bytes(size_t budget_bytes) {
+        budget_bytes_ = budget_bytes;
+        evict_to_budget();
+    }
+
+    bool enabled() const {
+        return budget_bytes_ > 0;
+    }
+
+    static std::string make_key(const std::string& lora_id, int module, const std::string& tensor_name_prefix_filter) {
+        return std::to_string(module) + ":" + tensor_name_prefix_filter + ":" + lora_id;
+    }
+
+    std::shared_ptr<LoraModel> get(const std::string& key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->lora;
+    }
+
+    // Returns how many entries were evicted to make room.
+    int put(const std::string& key, std::shared_ptr<LoraModel> lora) {
+        size_t bytes = lora_bytes(*lora);
+        if (bytes > budget_bytes_) {
+            return 0;
+        }
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            used_bytes_ -= it->second->bytes;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+
+        entries_.push_front({key, std::move(lora), bytes});
+        index_[key] = entries_.begin();
+        used_bytes_ += bytes;
+        return evict_to_budget();
+    }
+
+    void clear() {
+        entries_.clear();
+        index_.clear();
+        used_bytes_ = 0;
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    size_t used_bytes() const {
+        return used_bytes_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<LoraModel> lora;
+        size_t bytes = 0;
+    };
+
+    static size_t lora_bytes(const LoraModel& lora) {
+        size_t bytes = 0;
+        for (const auto& pair : lora.lora_tensors) {
+            bytes += ggml_nbytes(pair.second);
+        }
+        return bytes;
+    }
+
+    int evict_to_budget() {
+        int evicted = 0;
+        while (used_bytes_ > budget_bytes_ && !entries_.empty()) {
+            used_bytes_ -= entries_.back().bytes;
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+            evicted++;
+        }
+        return evicted;
+    }
+
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t budget_bytes_ = 0;
+    size_t used_bytes_   = 0;
+};
+
+#endif  // __SD_MODEL_ADAPTER_LORA_CACHE_HPP__
@@ -319,18 +319,14 @@ struct PhotoMakerIDEncoderBlock : public CLIPVisionModelProjection {
         blocks["fuse_module"]         = std::shared_ptr<GGMLBlock>(new FuseModule(2048));
     }
 
-    ggml_tensor* forward(GGMLRunnerContext* ctx,
-                         ggml_tensor* id_pixel_values,
-                         ggml_tensor* prompt_embeds,
-                         ggml_tensor* class_tokens_mask,
-                         ggml_tensor* class_tokens_mask_pos,
-                         ggml_tensor* left,
-                         ggml_tensor* right) {
+    // Identity embedding of the id images, independent of the prompt:
+    // [2048, N, 1] with one row per image.
+    ggml_tensor* encode_identity(GGMLRunnerContext* ctx,
+                                 ggml_tensor* id_pixel_values) {
         // x: [N, channels, h, w]
         auto vision_model        = std::dynamic_pointer_cast<CLIPVisionModel>(blocks["vision_model"]);
         auto visual_projection   = std::dynamic_pointer_cast<CLIPProjection>(blocks["visual_projection"]);
         auto visual_projection_2 = std::dynamic_pointer_cast<Linear>(blocks["visual_projection_2"]);
-        auto fuse_module         = std::dynamic_pointer_cast<FuseModule>(blocks["fuse_module"]);
 
         ggml_tensor* shared_id_embeds = vision_model->forward(ctx, id_pixel_values);          // [N, hidden_size]
         ggml_tensor* id_embeds        = visual_projection->forward(ctx, shared_id_embeds);    // [N, proj_dim(768)]
@@ -341,10 +337,21 @@ struct PhotoMakerIDEncoderBlock : public CLIPVisionModelProjection {
 
         id_embeds = ggml_concat(ctx->ggml_ctx, id_embeds, id_embeds_2, 2);  // [batch_size, seq_length, 1, 2048] check whether concat at dim 2 is right
         id_embeds = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, id_embeds, 1, 2, 0, 3));
+        return id_embeds;
+    }
+
+    ggml_tensor* forward(GGMLRunnerContext* ctx,
+                         ggml_tensor* identity_embeds,
+                         ggml_tensor* prompt_embeds,
+                         ggml_tensor* class_tokens_mask,
+                         ggml_tensor* class_tokens_mask_pos,
+                         ggml_tensor* left,
+                         ggml_tensor* right) {
+        auto fuse_module = std::dynamic_pointer_cast<FuseModule>(blocks["fuse_module"]);
 
         ggml_tensor* updated_prompt_embeds = fuse_module->forward(ctx,
                                                                   prompt_embeds,
-                                                                  id_embeds,
+                                                                  identity_embeds,
                                                                   class_tokens_mask,
                                                                   class_tokens_mask_pos,
                                                                   left, right);
@@ -367,26 +374,32 @@ struct PhotoMakerIDEncoder_CLIPInsightfaceExtendtokenBlock : public CLIPVisionMo
                                                                                         num_tokens));
     }
 
-    ggml_tensor* forward(GGMLRunnerContext* ctx,
-                         ggml_tensor* id_pixel_values,
-                         ggml_tensor* prompt_embeds,
-                         ggml_tensor* class_tokens_mask,
-                         ggml_tensor* class_tokens_mask_pos,
-                         ggml_tensor* id_embeds,
-                         ggml_tensor* left,
-                         ggml_tensor* right) {
+    // Identity embedding of the id images and their face embeddings,
+    // independent of the prompt: num_tokens rows of 2048 per image.
+    ggml_tensor* encode_identity(GGMLRunnerContext* ctx,
+                                 ggml_tensor* id_pixel_values,
+                                 ggml_tensor* id_embeds) {
         // x: [N, channels, h, w]
         auto vision_model      = std::dynamic_pointer_cast<CLIPVisionModel>(blocks["vision_model"]);
-        auto fuse_module       = std::dynamic_pointer_cast<FuseModule>(blocks["fuse_module"]);
         auto qformer_perceiver = std::dynamic_pointer_cast<QFormerPerceiver>(blocks["qformer_perceiver"]);
 
         // ggml_tensor* last_hidden_state = vision_model->forward(ctx, id_pixel_values);          // [N, hidden_size]
         ggml_tensor* last_hidden_state = vision_model->forward(ctx, id_pixel_values, false);  // [N, hidden_size]
-        id_embeds                      = qformer_perceiver->forward(ctx, id_embeds, last_hidden_state);
+        return qformer_perceiver->forward(ctx, id_embeds, last_hidden_state);
+    }
+
+    ggml_tensor* forward(GGMLRunnerContext* ctx,
+                         ggml_tensor* identity_embeds,
+                         ggml_tensor* prompt_embeds,
+                         ggml_tensor* class_tokens_mask,
+                         ggml_tensor* class_tokens_mask_pos,
+                         ggml_tensor* left,
+                         ggml_tensor* right) {
+        auto fuse_module = std::dynamic_pointer_cast<FuseModule>(blocks["fuse_module"]);
 
         ggml_tensor* updated_prompt_embeds = fuse_module->forward(ctx,
                                                                   prompt_embeds,
-                                                                  id_embeds,
+                                                                  identity_embeds,
                                                                   class_tokens_mask,
                                                                   class_tokens_mask_pos,
                                                                   left, right);
@@ -445,10 +458,29 @@ public:
             id_encoder2.get_param_tensors(tensors, prefix);
     }
 
-    ggml_cgraph* build_graph(const sd::Tensor<float>& id_pixel_values_tensor,
+    ggml_cgraph* build_identity_graph(const sd::Tensor<float>& id_pixel_values_tensor,
+                                      const sd::Tensor<float>& id_embeds_tensor = {}) {
+        auto runner_ctx = get_context();
+
+        ggml_cgraph* gf = ggml_new_graph(compute_ctx);
+
+        ggml_tensor* id_pixel_values = make_input(id_pixel_values_tensor);
+        ggml_tensor* id_embeds       = make_optional_input(id_embeds_tensor);
+
+        ggml_tensor* identity_embeds = nullptr;
+        if (pm_version == PM_VERSION_1)
+            identity_embeds = id_encoder.encode_identity(&runner_ctx, id_pixel_values);
+        else if (pm_version == PM_VERSION_2)
+            identity_embeds = id_encoder2.encode_identity(&runner_ctx, id_pixel_values, id_embeds);
+
+        ggml_build_forward_expand(gf, identity_embeds);
+
+        return gf;
+    }
+
+    ggml_cgraph* build_graph(const sd::Tensor<float>& identity_embeds_tensor,
                              const sd::Tensor<float>& prompt_embeds_tensor,
-                             std::vector<bool>& class_tokens_mask,
-                             const sd::Tensor<float>& id_embeds_tensor = {}) {
+                             std::vector<bool>& class_tokens_mask) {
         ctm.clear();
         ctmf16.clear();
         ctmpos.clear();
@@ -461,9 +493,8 @@ public:
 
         ggml_cgraph* gf = ggml_new_graph(compute_ctx);
 
-        ggml_tensor* id_pixel_values = make_input(id_pixel_values_tensor);
+        ggml_tensor* identity_embeds = make_input(identity_embeds_tensor);
         ggml_tensor* prompt_embeds   = make_input(prompt_embeds_tensor);
-        ggml_tensor* id_embeds       = make_optional_input(id_embeds_tensor);
 
         int64_t hidden_size = prompt_embeds->ne[0];
         int64_t seq_length  = prompt_embeds->ne[1];
@@ -530,18 +561,17 @@ public:
         ggml_tensor* updated_prompt_embeds = nullptr;
         if (pm_version == PM_VERSION_1)
             updated_prompt_embeds = id_encoder.forward(&runner_ctx,
-                                                       id_pixel_values,
+                                                       identity_embeds,
                                                        prompt_embeds,
                                                        class_tokens_mask_d,
                                                        class_tokens_mask_pos,
                                                        left, right);
         else if (pm_version == PM_VERSION_2)
             updated_prompt_embeds = id_encoder2.forward(&runner_ctx,
-                                                        id_pixel_values,
+                                                        identity_embeds,
                                                         prompt_embeds,
                                                         class_tokens_mask_d,
                                                         class_tokens_mask_pos,
-                                                        id_embeds,
                                                         left, right);
 
         ggml_build_forward_expand(gf, updated_prompt_embeds);
@@ -549,13 +579,25 @@ public:
         return gf;
     }
 
+    // Runs the vision side once per identity; the result only depends on the
+    // id images (and the face embeddings for v2), so callers can cache it.
+    sd::Tensor<float> encode_identity(const int n_threads,
+                                      const sd::Tensor<float>& id_pixel_values,
+                                      const sd::Tensor<float>& id_embeds) {
+        auto get_graph = [&]() -> ggml_cgraph* {
+            return build_identity_graph(id_pixel_values, id_embeds);
+        };
+        return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true));
+    }
+
+    // Fuses an identity embedding into the prompt embeddings at the class
+    // tokens.
     sd::Tensor<float> compute(const int n_threads,
-                              const sd::Tensor<float>& id_pixel_values,
+                              const sd::Tensor<float>& identity_embeds,
                               const sd::Tensor<float>& prompt_embeds,
-                              const sd::Tensor<float>& id_embeds,
                               std::vector<bool>& class_tokens_mask) {
         auto get_graph = [&]() -> ggml_cgraph* {
-            return build_graph(id_pixel_values, prompt_embeds, class_tokens_mask, id_embeds);
+            return build_graph(identity_embeds, prompt_embeds, class_tokens_mask);
         };
 
         return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true));
@@ -138,8 +138,7 @@ public:
         }
 
         // in_layers
-        auto h = in_layers_0->forward(ctx, x);
-        h      = ggml_silu_inplace(ctx->ggml_ctx, h);
+        auto h = in_layers_0->forward_silu(ctx, x);
         h      = in_layers_2->forward(ctx, h);  // [N, out_channels, h, w] if dims == 2 else [N, out_channels, t, h, w]
 
         // emb_layers
@@ -163,8 +162,7 @@ public:
         }
 
         // out_layers
-        h = out_layers_0->forward(ctx, h);
-        h = ggml_silu_inplace(ctx->ggml_ctx, h);
+        h = out_layers_0->forward_silu(ctx, h);
         // dropout, skip for inference
         h = out_layers_3->forward(ctx, h);
 
@@ -368,6 +366,31 @@ public:
     }
 };
 
+// Token merging for self-attention keys/values: averages the tokens of each
+// 2x1 (factor 2) or 2x2 (factor 4) cell of the w x h token grid. Queries keep
+// full resolution, so nothing has to be unmerged after attention.
+// x: [N, h * w, C]
+// return: [N, h/k1 * w/k0, C]
+__STATIC_INLINE__ ggml_tensor* merge_attention_tokens(ggml_context* ctx,
+                                                      ggml_tensor* x,
+                                                      int64_t w,
+                                                      int64_t h,
+                                                      int factor) {
+    const int k0 = 2;
+    const int k1 = factor >= 4 ? 2 : 1;
+    if (factor <= 1 || w < k0 || h < k1 || x->ne[1] != w * h) {
+        return x;
+    }
+    int64_t c = x->ne[0];
+    int64_t n = x->ne[2];
+    x         = ggml_reshape_4d(ctx, x, c, w, h, n);
+    x         = ggml_cont(ctx, ggml_permute(ctx, x, 2, 0, 1, 3));                   // [N, C, h, w]
+    x         = ggml_pool_2d(ctx, x, GGML_OP_POOL_AVG, k0, k1, k0, k1, 0.f, 0.f);  // [N, C, h/k1, w/k0]
+    int64_t m = x->ne[0] * x->ne[1];
+    x         = ggml_cont(ctx, ggml_permute(ctx, x, 1, 2, 0, 3));  // [N, h/k1, w/k0, C]
+    return ggml_reshape_3d(ctx, x, c, m, n);
+}
+
 class BasicTransformerBlock : public GGMLBlock {
 protected:
     int64_t n_head;
@@ -399,9 +422,14 @@ public:
         }
     }
 
+    // token_merge > 1 merges the self-attention keys/values of the w x h
+    // token grid, see merge_attention_tokens
     ggml_tensor* forward(GGMLRunnerContext* ctx,
                          ggml_tensor* x,
-                         ggml_tensor* context) {
+                         ggml_tensor* context,
+                         int64_t w       = 0,
+                         int64_t h       = 0,
+                         int token_merge = 1) {
         // x: [N, n_token, query_dim]
         // context: [N, n_context, context_dim]
         // return: [N, n_token, query_dim]
@@ -426,7 +454,7 @@ public:
 
         auto r = x;
         x      = norm1->forward(ctx, x);
-        x      = attn1->forward(ctx, x, x);  // self-attention
+        x      = attn1->forward(ctx, x, merge_attention_tokens(ctx->ggml_ctx, x, w, h, token_merge));  // self-attention
         x      = ggml_add(ctx->ggml_ctx, x, r);
         r      = x;
         x      = norm2->forward(ctx, x);
@@ -502,7 +530,8 @@ public:
 
     virtual ggml_tensor* forward(GGMLRunnerContext* ctx,
                                  ggml_tensor* x,
-                                 ggml_tensor* context) {
+                                 ggml_tensor* context,
+                                 int token_merge = 1) {
         // x: [N, in_channels, h, w]
         // context: [N, max_position(aka n_token), hidden_size(aka context_dim)]
         auto norm     = std::dynamic_pointer_cast<GroupNorm32>(blocks["norm"]);
@@ -530,7 +559,7 @@ public:
             std::string name       = "transformer_blocks." + std::to_string(i);
             auto transformer_block = std::dynamic_pointer_cast<BasicTransformerBlock>(blocks[name]);
 
-            x = transformer_block->forward(ctx, x, context);
+            x = transformer_block->forward(ctx, x, context, w, h, token_merge);
         }
 
         if (use_linear) {
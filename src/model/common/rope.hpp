@@ -129,21 +129,27 @@ namespace Rope {
                                                                        int index       = 0,
                                                                        int h_offset    = 0,
                                                                        int w_offset    = 0,
-                                                                       bool scale_rope = false) {
+                                                                       bool scale_rope = false,
+                                                                       float pos_scale = 1.f) {
+        // pos_scale > 1 spreads the tokens over the positions of a grid that
+        // many times larger, for latents encoded below their resolution
         int h_len = (h + (patch_size / 2)) / patch_size;
         int w_len = (w + (patch_size / 2)) / patch_size;
         std::vector<std::vector<float>> img_ids(h_len * w_len, std::vector<float>(axes_dim_num, 0.0));
 
+        int h_span = std::max(h_len, static_cast<int>(std::lround(h_len * pos_scale)));
+        int w_span = std::max(w_len, static_cast<int>(std::lround(w_len * pos_scale)));
+
         int h_start = h_offset;
         int w_start = w_offset;
 
         if (scale_rope) {
-            h_start -= h_len / 2;
-            w_start -= w_len / 2;
+            h_start -= h_span / 2;
+            w_start -= w_span / 2;
         }
 
-        std::vector<float> row_ids = linspace<float>(1.f * h_start, 1.f * h_start + h_len - 1, h_len);
-        std::vector<float> col_ids = linspace<float>(1.f * w_start, 1.f * w_start + w_len - 1, w_len);
+        std::vector<float> row_ids = linspace<float>(1.f * h_start, 1.f * h_start + h_span - 1, h_len);
+        std::vector<float> col_ids = linspace<float>(1.f * w_start, 1.f * w_start + w_span - 1, w_len);
         for (int i = 0; i < h_len; ++i) {
             for (int j = 0; j < w_len; ++j) {
                 img_ids[i * w_len + j][0] = 1.f * index;
@@ -349,7 +355,8 @@ namespace Rope {
                                                                    bool increase_ref_index,
                                                                    float ref_index_scale,
                                                                    bool scale_rope,
-                                                                   int base_offset = 0) {
+                                                                   int base_offset     = 0,
+                                                                   float ref_pos_scale = 1.f) {
         std::vector<std::vector<float>> ids;
         int curr_h_offset = 0;
         int curr_w_offset = 0;
@@ -357,8 +364,10 @@ namespace Rope {
         for (ggml_tensor* ref : ref_latents) {
             int h_offset = 0;
             int w_offset = 0;
+            int ref_h    = static_cast<int>(std::lround(ref->ne[1] * ref_pos_scale));
+            int ref_w    = static_cast<int>(std::lround(ref->ne[0] * ref_pos_scale));
             if (!increase_ref_index) {
-                if (ref->ne[1] + curr_h_offset > ref->ne[0] + curr_w_offset) {
+                if (ref_h + curr_h_offset > ref_w + curr_w_offset) {
                     w_offset = curr_w_offset;
                 } else {
                     h_offset = curr_h_offset;
@@ -374,15 +383,16 @@ namespace Rope {
                                             static_cast<int>(index * ref_index_scale),
                                             h_offset + base_offset,
                                             w_offset + base_offset,
-                                            scale_rope);
+                                            scale_rope,
+                                            ref_pos_scale);
             ids          = concat_ids(ids, ref_ids, bs);
 
             if (increase_ref_index) {
                 index++;
             }
 
-            curr_h_offset = std::max(curr_h_offset, static_cast<int>(ref->ne[1]) + h_offset);
-            curr_w_offset = std::max(curr_w_offset, static_cast<int>(ref->ne[0]) + w_offset);
+            curr_h_offset = std::max(curr_h_offset, ref_h + h_offset);
+            curr_w_offset = std::max(curr_w_offset, ref_w + w_offset);
         }
         return ids;
     }
@@ -397,7 +407,8 @@ namespace Rope {
                                                                    const std::vector<ggml_tensor*>& ref_latents,
                                                                    bool increase_ref_index,
                                                                    float ref_index_scale,
-                                                                   bool is_longcat) {
+                                                                   bool is_longcat,
+                                                                   float ref_pos_scale = 1.f) {
         int x_index = is_longcat ? 1 : 0;
 
         auto txt_ids = is_longcat ? gen_longcat_txt_ids(bs, context_len, axes_dim_num) : gen_flux_txt_ids(bs, context_len, axes_dim_num, txt_arange_dims);
@@ -406,7 +417,7 @@ namespace Rope {
 
         auto ids = concat_ids(txt_ids, img_ids, bs);
         if (ref_latents.size() > 0) {
-            auto refs_ids = gen_refs_ids(patch_size, bs, axes_dim_num, x_index + 1, ref_latents, increase_ref_index, ref_index_scale, false, offset);
+            auto refs_ids = gen_refs_ids(patch_size, bs, axes_dim_num, x_index + 1, ref_latents, increase_ref_index, ref_index_scale, false, offset, ref_pos_scale);
             ids           = concat_ids(ids, refs_ids, bs);
         }
         return ids;
@@ -426,7 +437,8 @@ namespace Rope {
                                                      bool circular_h,
                                                      bool circular_w,
                                                      const std::vector<int>& axes_dim,
-                                                     bool is_longcat) {
+                                                     bool is_longcat,
+                                                     float ref_pos_scale = 1.f) {
         std::vector<std::vector<float>> ids = gen_flux_ids(h,
                                                            w,
                                                            patch_size,
@@ -437,7 +449,8 @@ namespace Rope {
                                                            ref_latents,
                                                            increase_ref_index,
                                                            ref_index_scale,
-                                                           is_longcat);
+                                                           is_longcat,
+                                                           ref_pos_scale);
         std::vector<std::vector<int>> wrap_dims;
         if ((circular_h || circular_w) && bs > 0 && axes_dim.size() >= 3) {
             int h_len = (h + (patch_size / 2)) / patch_size;
@@ -487,7 +500,8 @@ namespace Rope {
                                                                          int bs,
                                                                          int context_len,
                                                                          const std::vector<ggml_tensor*>& ref_latents,
-                                                                         bool increase_ref_index) {
+                                                                         bool increase_ref_index,
+                                                                         float ref_pos_scale = 1.f) {
         int h_len        = (h + (patch_size / 2)) / patch_size;
         int w_len        = (w + (patch_size / 2)) / patch_size;
         int txt_id_start = std::max(h_len, w_len);
@@ -502,7 +516,7 @@ namespace Rope {
         auto img_ids     = gen_flux_img_ids(h, w, patch_size, bs, axes_dim_num, 0, 0, 0, true);
         auto ids         = concat_ids(txt_ids_repeated, img_ids, bs);
         if (ref_latents.size() > 0) {
-            auto refs_ids = gen_refs_ids(patch_size, bs, axes_dim_num, 1, ref_latents, increase_ref_index, 1.f, true);
+            auto refs_ids = gen_refs_ids(patch_size, bs, axes_dim_num, 1, ref_latents, increase_ref_index, 1.f, true, 0, ref_pos_scale);
             ids           = concat_ids(ids, refs_ids, bs);
         }
         return ids;
@@ -519,8 +533,9 @@ namespace Rope {
                                                            int theta,
                                                            bool circular_h,
                                                            bool circular_w,
-                                                           const std::vector<int>& axes_dim) {
-        std::vector<std::vector<float>> ids = gen_qwen_image_ids(h, w, patch_size, bs, context_len, ref_latents, increase_ref_index);
+                                                           const std::vector<int>& axes_dim,
+                                                           float ref_pos_scale = 1.f) {
+        std::vector<std::vector<float>> ids = gen_qwen_image_ids(h, w, patch_size, bs, context_len, ref_latents, increase_ref_index, ref_pos_scale);
         std::vector<std::vector<int>> wrap_dims;
         // This logic simply stores the (pad and patch_adjusted) sizes of images so we can make sure rope correctly tiles
         if ((circular_h || circular_w) && bs > 0 && axes_dim.size() >= 3) {
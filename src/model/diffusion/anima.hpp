@@ -554,7 +554,6 @@ namespace Anima {
 
     struct AnimaRunner : public DiffusionModelRunner {
     public:
-        std::vector<float> image_pe_vec;
         std::vector<float> adapter_q_pe_vec;
         std::vector<float> adapter_k_pe_vec;
         AnimaConfig config;
@@ -642,18 +641,18 @@ namespace Anima {
             int64_t h_pad = x->ne[1] + pad_h;
             int64_t w_pad = x->ne[0] + pad_w;
 
-            image_pe_vec          = gen_anima_image_pe_vec(1,
-                                                           static_cast<int>(h_pad),
-                                                           static_cast<int>(w_pad),
-                                                           static_cast<int>(config.patch_size),
-                                                           config.theta,
-                                                           config.axes_dim,
-                                                           4.0f,
-                                                           4.0f,
-                                                           1.0f);
-            int64_t image_pos_len = static_cast<int64_t>(image_pe_vec.size()) / (2 * 2 * (config.head_dim / 2));
-            auto image_pe         = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, 2, 2, config.head_dim / 2, image_pos_len);
-            set_backend_tensor_data(image_pe, image_pe_vec.data());
+            std::string image_pe_key = sd_format("image:%" PRId64 "x%" PRId64, h_pad, w_pad);
+            auto image_pe            = make_positional_table(image_pe_key, 2, 2, config.head_dim / 2, [&]() {
+                return gen_anima_image_pe_vec(1,
+                                              static_cast<int>(h_pad),
+                                              static_cast<int>(w_pad),
+                                              static_cast<int>(config.patch_size),
+                                              config.theta,
+                                              config.axes_dim,
+                                              4.0f,
+                                              4.0f,
+                                              1.0f);
+            });
 
             ggml_tensor* adapter_q_pe = nullptr;
             ggml_tensor* adapter_k_pe = nullptr;
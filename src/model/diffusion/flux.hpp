@@ -389,13 +389,17 @@ namespace Flux {
             blocks["lin"] = std::shared_ptr<GGMLBlock>(new Linear(dim, dim * multiplier, bias));
         }
 
+        ggml_tensor* project(GGMLRunnerContext* ctx, ggml_tensor* vec) {
+            // vec: [N, dim]
+            // return: [N, multiplier*dim]
+            auto lin = std::dynamic_pointer_cast<Linear>(blocks["lin"]);
+            return lin->forward(ctx, ggml_silu(ctx->ggml_ctx, vec));
+        }
+
         std::vector<ModulationOut> forward(GGMLRunnerContext* ctx, ggml_tensor* vec) {
             // x: [N, dim]
             // return: [ModulationOut, ModulationOut]
-            auto lin = std::dynamic_pointer_cast<Linear>(blocks["lin"]);
-
-            auto out = ggml_silu(ctx->ggml_ctx, vec);
-            out      = lin->forward(ctx, out);  // [N, multiplier*dim]
+            auto out = project(ctx, vec);  // [N, multiplier*dim]
 
             auto m = ggml_reshape_3d(ctx->ggml_ctx, out, vec->ne[0], multiplier, vec->ne[1]);  // [N, multiplier, dim]
             m      = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, m, 0, 2, 1, 3));     // [multiplier, N, dim]
@@ -426,6 +430,52 @@ namespace Flux {
         return x;
     }
 
+    __STATIC_INLINE__ std::string ref_kv_cache_name(int slot, const std::string& block, const char* what) {
+        return "flux.ref_kv." + std::to_string(slot) + "." + block + "." + what;
+    }
+
+    // Rope::attention under a RefKVCachePlan. RECORD caches, in f16, the roped
+    // keys and the values of the ref_tokens reference tokens that end the
+    // sequence; REUSE appends the cached ones to the keys and values of a
+    // sequence without them, pe covering only the tokens that are left.
+    __STATIC_INLINE__ ggml_tensor* ref_kv_attention(GGMLRunnerContext* ctx,
+                                                    ggml_tensor* q,
+                                                    ggml_tensor* k,
+                                                    ggml_tensor* v,
+                                                    ggml_tensor* pe,
+                                                    ggml_tensor* mask,
+                                                    const RefKVCachePlan* ref_kv,
+                                                    int64_t ref_tokens,
+                                                    const std::string& block) {
+        // q,k,v: [N, L, n_head, d_head]
+        // return: [N, L, n_head*d_head]
+        if (ref_kv == nullptr) {
+            return Rope::attention(ctx, q, k, v, pe, mask);
+        }
+        int64_t n_head = q->ne[1];
+
+        q = Rope::apply_rope(ctx->ggml_ctx, q, pe);  // [N*n_head, L, d_head]
+        k = Rope::apply_rope(ctx->ggml_ctx, k, pe);  // [N*n_head, L, d_head]
+
+        const std::string k_name = ref_kv_cache_name(ref_kv->slot, block, "k");
+        const std::string v_name = ref_kv_cache_name(ref_kv->slot, block, "v");
+        if (ref_kv->pass == RefKVCachePlan::RECORD) {
+            auto ref_k = ggml_view_3d(ctx->ggml_ctx, k, k->ne[0], ref_tokens, k->ne[2], k->nb[1], k->nb[2],
+                                      (k->ne[1] - ref_tokens) * k->nb[1]);  // [N*n_head, ref_tokens, d_head]
+            auto ref_v = ggml_view_4d(ctx->ggml_ctx, v, v->ne[0], v->ne[1], ref_tokens, v->ne[3], v->nb[1], v->nb[2], v->nb[3],
+                                      (v->ne[2] - ref_tokens) * v->nb[2]);  // [N, ref_tokens, n_head, d_head]
+            ctx->persist_cache_tensor(k_name, ggml_cast(ctx->ggml_ctx, ref_k, GGML_TYPE_F16));
+            ctx->persist_cache_tensor(v_name, ggml_cast(ctx->ggml_ctx, ref_v, GGML_TYPE_F16));
+        } else {
+            ggml_tensor* ref_k = ctx->load_cache_tensor(k_name);
+            ggml_tensor* ref_v = ctx->load_cache_tensor(v_name);
+            GGML_ASSERT(ref_k != nullptr && ref_v != nullptr);
+            k = ggml_concat(ctx->ggml_ctx, k, ggml_cast(ctx->ggml_ctx, ref_k, k->type), 1);
+            v = ggml_concat(ctx->ggml_ctx, ggml_cont(ctx->ggml_ctx, v), ggml_cast(ctx->ggml_ctx, ref_v, v->type), 2);
+        }
+        return ggml_ext_attention_ext(ctx->ggml_ctx, ctx->backend, q, k, v, n_head, mask, true, ctx->flash_attn_enabled);  // [N, L, n_head*d_head]
+    }
+
     struct DoubleStreamBlock : public GGMLBlock {
         bool prune_mod;
         int idx = 0;
@@ -489,6 +539,13 @@ namespace Flux {
             return {ModulationOut(ctx, vec, offset), ModulationOut(ctx, vec, offset + 3)};
         }
 
+        // the img and txt modulation before it is split, [N, 6*hidden_size] each
+        std::pair<ggml_tensor*, ggml_tensor*> project_modulation(GGMLRunnerContext* ctx, ggml_tensor* vec) {
+            auto img_mod = std::dynamic_pointer_cast<Modulation>(blocks["img_mod"]);
+            auto txt_mod = std::dynamic_pointer_cast<Modulation>(blocks["txt_mod"]);
+            return {img_mod->project(ctx, vec), txt_mod->project(ctx, vec)};
+        }
+
         std::pair<ggml_tensor*, ggml_tensor*> forward(GGMLRunnerContext* ctx,
                                                       ggml_tensor* img,
                                                       ggml_tensor* txt,
@@ -496,7 +553,9 @@ namespace Flux {
                                                       ggml_tensor* pe,
                                                       ggml_tensor* mask                   = nullptr,
                                                       std::vector<ModulationOut> img_mods = {},
-                                                      std::vector<ModulationOut> txt_mods = {}) {
+                                                      std::vector<ModulationOut> txt_mods = {},
+                                                      const RefKVCachePlan* ref_kv        = nullptr,
+                                                      int64_t ref_tokens                  = 0) {
             // img: [N, n_img_token, hidden_size]
             // txt: [N, n_txt_token, hidden_size]
             // pe: [n_img_token + n_txt_token, d_head/2, 2, 2]
@@ -555,7 +614,8 @@ namespace Flux {
             auto k = ggml_concat(ctx->ggml_ctx, txt_k, img_k, 2);  // [N, n_txt_token + n_img_token, n_head, d_head]
             auto v = ggml_concat(ctx->ggml_ctx, txt_v, img_v, 2);  // [N, n_txt_token + n_img_token, n_head, d_head]
 
-            auto attn         = Rope::attention(ctx, q, k, v, pe, mask);  // [N, n_txt_token + n_img_token, n_head*d_head]
+            auto attn         = ref_kv_attention(ctx, q, k, v, pe, mask, ref_kv, ref_tokens,
+                                                 "double_blocks." + std::to_string(idx));  // [N, n_txt_token + n_img_token, n_head*d_head]
             auto txt_attn_out = ggml_view_3d(ctx->ggml_ctx,
                                              attn,
                                              attn->ne[0],
@@ -638,12 +698,20 @@ namespace Flux {
             return ModulationOut(ctx, vec, offset);
         }
 
+        // the modulation before it is split, [N, 3*hidden_size]
+        ggml_tensor* project_modulation(GGMLRunnerContext* ctx, ggml_tensor* vec) {
+            auto modulation = std::dynamic_pointer_cast<Modulation>(blocks["modulation"]);
+            return modulation->project(ctx, vec);
+        }
+
         ggml_tensor* forward(GGMLRunnerContext* ctx,
                              ggml_tensor* x,
                              ggml_tensor* vec,
                              ggml_tensor* pe,
                              ggml_tensor* mask               = nullptr,
-                             std::vector<ModulationOut> mods = {}) {
+                             std::vector<ModulationOut> mods = {},
+                             const RefKVCachePlan* ref_kv    = nullptr,
+                             int64_t ref_tokens              = 0) {
             // x: [N, n_token, hidden_size]
             // pe: [n_token, d_head/2, 2, 2]
             // return: [N, n_token, hidden_size]
@@ -680,7 +748,8 @@ namespace Flux {
 
             q         = norm->query_norm(ctx, q);
             k         = norm->key_norm(ctx, k);
-            auto attn = Rope::attention(ctx, q, k, v, pe, mask);  // [N, n_token, hidden_size]
+            auto attn = ref_kv_attention(ctx, q, k, v, pe, mask, ref_kv, ref_tokens,
+                                         "single_blocks." + std::to_string(idx));  // [N, n_token, hidden_size]
 
             auto mlp = ggml_view_3d(ctx->ggml_ctx, qkv_mlp, mlp_hidden_dim * mlp_mult_factor, qkv_mlp->ne[1], qkv_mlp->ne[2], qkv_mlp->nb[1], qkv_mlp->nb[2], hidden_size * 3 * qkv_mlp->nb[0]);
             if (use_yak_mlp) {
@@ -1002,6 +1071,106 @@ namespace Flux {
             }
         }
 
+        bool supports_modulation_cache() const {
+            // Chroma's approximator and Sefi's dual timestep embedding modulate differently
+            return !config.is_chroma && !config.is_sefi;
+        }
+
+        bool supports_ref_kv_cache() const {
+            // Chroma masks the keys by padding, Chroma Radiance runs its own forward
+            return !config.is_chroma && config.version != VERSION_CHROMA_RADIANCE;
+        }
+
+        // the tokens ref_latents add to the end of the sequence
+        int64_t ref_token_count(const std::vector<ggml_tensor*>& ref_latents) const {
+            int64_t p      = config.patch_size;
+            int64_t tokens = 0;
+            for (ggml_tensor* ref : ref_latents) {
+                tokens += ((ref->ne[0] + p - 1) / p) * ((ref->ne[1] + p - 1) / p);
+            }
+            return tokens;
+        }
+
+        // floats in a ModulationCache row: the time vector, then every
+        // modulation in block order
+        int64_t modulation_row_size() const {
+            int64_t size = config.hidden_size;
+            if (config.share_modulation) {
+                return size + (6 + 6 + 3) * config.hidden_size;
+            }
+            return size + (12 * static_cast<int64_t>(config.depth) + 3 * static_cast<int64_t>(config.depth_single_blocks)) * config.hidden_size;
+        }
+
+        ggml_tensor* embed_time_vector(GGMLRunnerContext* ctx,
+                                       ggml_tensor* timesteps,
+                                       ggml_tensor* y,
+                                       ggml_tensor* guidance) {
+            auto time_in     = std::dynamic_pointer_cast<MLPEmbedder>(blocks["time_in"]);
+            ggml_tensor* vec = time_in->forward(ctx, ggml_ext_timestep_embedding(ctx->ggml_ctx, timesteps, 256, 10000, 1000.f));
+            if (config.guidance_embed) {
+                GGML_ASSERT(guidance != nullptr);
+                auto guidance_in = std::dynamic_pointer_cast<MLPEmbedder>(blocks["guidance_in"]);
+                // bf16 and fp16 result is different
+                auto g_in = ggml_ext_timestep_embedding(ctx->ggml_ctx, guidance, 256, 10000, 1000.f);
+                vec       = ggml_add(ctx->ggml_ctx, vec, guidance_in->forward(ctx, g_in));
+            }
+
+            if (config.vec_in_dim > 0) {
+                auto vector_in = std::dynamic_pointer_cast<MLPEmbedder>(blocks["vector_in"]);
+                vec            = ggml_add(ctx->ggml_ctx, vec, vector_in->forward(ctx, y));
+            }
+            return vec;
+        }
+
+        // ModulationCache rows of every timestep, [N, modulation_row_size()];
+        // y is one pooled text vector shared by all of them
+        ggml_tensor* forward_modulation(GGMLRunnerContext* ctx,
+                                        ggml_tensor* timesteps,
+                                        ggml_tensor* y,
+                                        ggml_tensor* guidance) {
+            ggml_tensor* vec = embed_time_vector(ctx, timesteps, y, guidance);  // [N, hidden_size]
+
+            std::vector<ggml_tensor*> parts = {vec};
+            if (config.share_modulation) {
+                auto double_stream_modulation_img = std::dynamic_pointer_cast<Modulation>(blocks["double_stream_modulation_img"]);
+                auto double_stream_modulation_txt = std::dynamic_pointer_cast<Modulation>(blocks["double_stream_modulation_txt"]);
+                auto single_stream_modulation     = std::dynamic_pointer_cast<Modulation>(blocks["single_stream_modulation"]);
+
+                parts.push_back(double_stream_modulation_img->project(ctx, vec));
+                parts.push_back(double_stream_modulation_txt->project(ctx, vec));
+                parts.push_back(single_stream_modulation->project(ctx, vec));
+            } else {
+                for (int i = 0; i < config.depth; i++) {
+                    auto block   = std::dynamic_pointer_cast<DoubleStreamBlock>(blocks["double_blocks." + std::to_string(i)]);
+                    auto img_txt = block->project_modulation(ctx, vec);
+                    parts.push_back(img_txt.first);
+                    parts.push_back(img_txt.second);
+                }
+                for (int i = 0; i < config.depth_single_blocks; i++) {
+                    auto block = std::dynamic_pointer_cast<SingleStreamBlock>(blocks["single_blocks." + std::to_string(i)]);
+                    parts.push_back(block->project_modulation(ctx, vec));
+                }
+            }
+
+            return ModulationCache::concat_rows(ctx->ggml_ctx, std::move(parts));
+        }
+
+        // the modulation starting offset floats into a ModulationCache row
+        std::vector<ModulationOut> modulation_from_row(GGMLRunnerContext* ctx,
+                                                       ggml_tensor* row,
+                                                       int64_t* offset,
+                                                       bool is_double) {
+            const int64_t dim        = config.hidden_size;
+            const int64_t multiplier = is_double ? 6 : 3;
+            const size_t element     = ggml_element_size(row);
+            auto m                   = ggml_view_3d(ctx->ggml_ctx, row, dim, 1, multiplier, dim * element, dim * element, *offset * element);  // [multiplier, 1, dim]
+            *offset += multiplier * dim;
+            if (is_double) {
+                return {ModulationOut(ctx, m, 0), ModulationOut(ctx, m, 3)};
+            }
+            return {ModulationOut(ctx, m, 0), ModulationOut()};
+        }
+
         ggml_tensor* forward_orig(GGMLRunnerContext* ctx,
                                   ggml_tensor* img,
                                   ggml_tensor* txt,
@@ -1009,10 +1178,15 @@ namespace Flux {
                                   ggml_tensor* y,
                                   ggml_tensor* guidance,
                                   ggml_tensor* pe,
-                                  ggml_tensor* mod_index_arange = nullptr,
-                                  std::vector<int> skip_layers  = {},
-                                  ggml_tensor* pulid_id         = nullptr,
-                                  float pulid_id_weight         = 1.0f) {
+                                  ggml_tensor* mod_index_arange         = nullptr,
+                                  std::vector<int> skip_layers          = {},
+                                  ggml_tensor* pulid_id                 = nullptr,
+                                  float pulid_id_weight                 = 1.0f,
+                                  const CfgBlockReusePlan* cfg_reuse    = nullptr,
+                                  const SkipLayerPrefixPlan* slg_prefix = nullptr,
+                                  ggml_tensor* modulation_row           = nullptr,
+                                  const RefKVCachePlan* ref_kv          = nullptr,
+                                  int64_t ref_tokens                    = 0) {
             auto img_in      = std::dynamic_pointer_cast<Linear>(blocks["img_in"]);
             auto txt_in      = std::dynamic_pointer_cast<Linear>(blocks["txt_in"]);
             auto final_layer = std::dynamic_pointer_cast<LastLayer>(blocks["final_layer"]);
@@ -1053,27 +1227,35 @@ namespace Flux {
                 auto timestep_sem    = ggml_view_1d(ctx->ggml_ctx, timesteps, 1, 0);
                 auto timestep_tex    = ggml_view_1d(ctx->ggml_ctx, timesteps, 1, ggml_element_size(timesteps));
                 vec                  = dual_time_embed->forward(ctx, timestep_sem, timestep_tex);
+            } else if (modulation_row != nullptr) {
+                vec = ggml_view_2d(ctx->ggml_ctx, modulation_row, config.hidden_size, 1, config.hidden_size * ggml_element_size(modulation_row), 0);  // [1, hidden_size]
             } else {
-                auto time_in = std::dynamic_pointer_cast<MLPEmbedder>(blocks["time_in"]);
-                vec          = time_in->forward(ctx, ggml_ext_timestep_embedding(ctx->ggml_ctx, timesteps, 256, 10000, 1000.f));
-                if (config.guidance_embed) {
-                    GGML_ASSERT(guidance != nullptr);
-                    auto guidance_in = std::dynamic_pointer_cast<MLPEmbedder>(blocks["guidance_in"]);
-                    // bf16 and fp16 result is different
-                    auto g_in = ggml_ext_timestep_embedding(ctx->ggml_ctx, guidance, 256, 10000, 1000.f);
-                    vec       = ggml_add(ctx->ggml_ctx, vec, guidance_in->forward(ctx, g_in));
-                }
-
-                if (config.vec_in_dim > 0) {
-                    auto vector_in = std::dynamic_pointer_cast<MLPEmbedder>(blocks["vector_in"]);
-                    vec            = ggml_add(ctx->ggml_ctx, vec, vector_in->forward(ctx, y));
-                }
+                vec = embed_time_vector(ctx, timesteps, y, guidance);
             }
 
             std::vector<ModulationOut> ds_img_mods;
             std::vector<ModulationOut> ds_txt_mods;
             std::vector<ModulationOut> ss_mods;
-            if (config.share_modulation) {
+            // per block, when they come from a ModulationCache row
+            std::vector<std::vector<ModulationOut>> row_img_mods;
+            std::vector<std::vector<ModulationOut>> row_txt_mods;
+            std::vector<std::vector<ModulationOut>> row_ss_mods;
+            if (modulation_row != nullptr) {
+                int64_t offset = config.hidden_size;
+                if (config.share_modulation) {
+                    ds_img_mods = modulation_from_row(ctx, modulation_row, &offset, true);
+                    ds_txt_mods = modulation_from_row(ctx, modulation_row, &offset, true);
+                    ss_mods     = modulation_from_row(ctx, modulation_row, &offset, false);
+                } else {
+                    for (int i = 0; i < config.depth; i++) {
+                        row_img_mods.push_back(modulation_from_row(ctx, modulation_row, &offset, true));
+                        row_txt_mods.push_back(modulation_from_row(ctx, modulation_row, &offset, true));
+                    }
+                    for (int i = 0; i < config.depth_single_blocks; i++) {
+                        row_ss_mods.push_back(modulation_from_row(ctx, modulation_row, &offset, false));
+                    }
+                }
+            } else if (config.share_modulation) {
                 auto double_stream_modulation_img = std::dynamic_pointer_cast<Modulation>(blocks["double_stream_modulation_img"]);
                 auto double_stream_modulation_txt = std::dynamic_pointer_cast<Modulation>(blocks["double_stream_modulation_txt"]);
                 auto single_stream_modulation     = std::dynamic_pointer_cast<Modulation>(blocks["single_stream_modulation"]);
@@ -1101,16 +1283,86 @@ namespace Flux {
             const bool pulid_run = pulid_active && skip_layers.empty();
             int ca_idx           = 0;
 
-            for (int i = 0; i < config.depth; i++) {
+            // PuLID runs on the cond pass but not with skipped layers, so the prefixes differ
+            int slg_first_layer = -1;
+            if (slg_prefix != nullptr && !pulid_active &&
+                slg_prefix->first_layer > 0 && slg_prefix->first_layer < config.depth + config.depth_single_blocks &&
+                (slg_prefix->pass == SkipLayerPrefixPlan::RESUME || skip_layers.empty())) {
+                slg_first_layer = slg_prefix->first_layer;
+            }
+            const bool slg_record        = slg_first_layer >= 0 && slg_prefix->pass == SkipLayerPrefixPlan::RECORD;
+            int first_double_block       = 0;
+            ggml_tensor* resumed_txt_img = nullptr;
+            if (slg_first_layer >= 0 && slg_prefix->pass == SkipLayerPrefixPlan::RESUME) {
+                if (slg_first_layer < config.depth) {
+                    ggml_tensor* cached_img = ctx->load_cache_tensor("flux.slg_prefix.img");
+                    ggml_tensor* cached_txt = ctx->load_cache_tensor("flux.slg_prefix.txt");
+                    if (cached_img != nullptr && cached_txt != nullptr &&
+                        ggml_are_same_shape(cached_img, img) && ggml_are_same_shape(cached_txt, txt)) {
+                        img                = cached_img;
+                        txt                = cached_txt;
+                        first_double_block = slg_first_layer;
+                    }
+                } else {
+                    ggml_tensor* cached_txt_img = ctx->load_cache_tensor("flux.slg_prefix.txt_img");
+                    if (cached_txt_img != nullptr &&
+                        cached_txt_img->ne[0] == img->ne[0] &&
+                        cached_txt_img->ne[1] == txt->ne[1] + img->ne[1] &&
+                        cached_txt_img->ne[2] == img->ne[2] &&
+                        cached_txt_img->ne[3] == img->ne[3]) {
+                        resumed_txt_img    = cached_txt_img;
+                        first_double_block = config.depth;
+                    }
+                }
+            }
+
+            for (int i = first_double_block; i < config.depth; i++) {
+                if (slg_record && i == slg_first_layer) {
+                    ctx->persist_cache_tensor("flux.slg_prefix.img", ggml_cont(ctx->ggml_ctx, img));
+                    ctx->persist_cache_tensor("flux.slg_prefix.txt", ggml_cont(ctx->ggml_ctx, txt));
+                }
                 if (skip_layers.size() > 0 && std::find(skip_layers.begin(), skip_layers.end(), i) != skip_layers.end()) {
                     continue;
                 }
 
                 auto block = std::dynamic_pointer_cast<DoubleStreamBlock>(blocks["double_blocks." + std::to_string(i)]);
 
-                auto img_txt = block->forward(ctx, img, txt, vec, pe, txt_img_mask, ds_img_mods, ds_txt_mods);
-                img          = img_txt.first;   // [N, n_img_token, hidden_size]
-                txt          = img_txt.second;  // [N, n_txt_token, hidden_size]
+                const bool cfg_reuse_block       = cfg_reuse != nullptr && cfg_reuse->applies_to(i);
+                const std::string cfg_reuse_name = "flux.cfg_reuse.double_blocks." + std::to_string(i);
+                ggml_tensor* cond_residual       = nullptr;
+                if (cfg_reuse_block && cfg_reuse->pass != CfgBlockReusePlan::RECORD) {
+                    cond_residual = ctx->load_cache_tensor(cfg_reuse_name);
+                    if (cond_residual != nullptr && !ggml_are_same_shape(cond_residual, img)) {
+                        cond_residual = nullptr;
+                    }
+                }
+
+                if (cond_residual != nullptr && cfg_reuse->pass == CfgBlockReusePlan::REUSE) {
+                    // txt passes through unchanged; single blocks only see it next to img
+                    img = ggml_add(ctx->ggml_ctx, img, cond_residual);
+                } else {
+                    ggml_tensor* img_before = img;
+                    auto img_txt            = block->forward(ctx,
+                                                         img,
+                                                         txt,
+                                                         vec,
+                                                         pe,
+                                                         txt_img_mask,
+                                                         row_img_mods.empty() ? ds_img_mods : row_img_mods[i],
+                                                         row_txt_mods.empty() ? ds_txt_mods : row_txt_mods[i],
+                                                         ref_kv,
+                                                         ref_tokens);
+                    img                     = img_txt.first;   // [N, n_img_token, hidden_size]
+                    txt                     = img_txt.second;  // [N, n_txt_token, hidden_size]
+                    if (cfg_reuse_block && cfg_reuse->pass == CfgBlockReusePlan::RECORD) {
+                        ctx->persist_cache_tensor(cfg_reuse_name, ggml_sub(ctx->ggml_ctx, img, img_before));
+                    } else if (cond_residual != nullptr) {
+                        auto residual = ggml_sub(ctx->ggml_ctx, img, img_before);
+                        auto sum_diff = ggml_sum(ctx->ggml_ctx, ggml_abs(ctx->ggml_ctx, ggml_sub(ctx->ggml_ctx, residual, cond_residual)));
+                        auto sum_abs  = ggml_sum(ctx->ggml_ctx, ggml_abs(ctx->ggml_ctx, cond_residual));
+                        ctx->persist_cache_tensor("flux.cfg_reuse.stats." + std::to_string(i), ggml_concat(ctx->ggml_ctx, sum_diff, sum_abs, 0));
+                    }
+                }
                 sd::ggml_graph_cut::mark_graph_cut(img, "flux.double_blocks." + std::to_string(i), "img");
                 sd::ggml_graph_cut::mark_graph_cut(txt, "flux.double_blocks." + std::to_string(i), "txt");
 
@@ -1126,13 +1378,21 @@ namespace Flux {
 
             auto txt_img            = ggml_concat(ctx->ggml_ctx, txt, img, 1);  // [N, n_txt_token + n_img_token, hidden_size]
             const int64_t n_txt_tok = txt->ne[1];
-            for (int i = 0; i < config.depth_single_blocks; i++) {
+            int first_single_block  = 0;
+            if (resumed_txt_img != nullptr) {
+                txt_img            = resumed_txt_img;
+                first_single_block = slg_first_layer - config.depth;
+            }
+            for (int i = first_single_block; i < config.depth_single_blocks; i++) {
+                if (slg_record && i + config.depth == slg_first_layer) {
+                    ctx->persist_cache_tensor("flux.slg_prefix.txt_img", ggml_cont(ctx->ggml_ctx, txt_img));
+                }
                 if (skip_layers.size() > 0 && std::find(skip_layers.begin(), skip_layers.end(), i + config.depth) != skip_layers.end()) {
                     continue;
                 }
                 auto block = std::dynamic_pointer_cast<SingleStreamBlock>(blocks["single_blocks." + std::to_string(i)]);
 
-                txt_img = block->forward(ctx, txt_img, vec, pe, txt_img_mask, ss_mods);
+                txt_img = block->forward(ctx, txt_img, vec, pe, txt_img_mask, row_ss_mods.empty() ? ss_mods : row_ss_mods[i], ref_kv, ref_tokens);
                 sd::ggml_graph_cut::mark_graph_cut(txt_img, "flux.single_blocks." + std::to_string(i), "txt_img");
 
                 if (pulid_run && (i % config.pulid_single_interval == 0)) {
@@ -1197,7 +1457,9 @@ namespace Flux {
                                              std::vector<ggml_tensor*> ref_latents = {},
                                              std::vector<int> skip_layers          = {},
                                              ggml_tensor* pulid_id                 = nullptr,
-                                             float pulid_id_weight                 = 1.0f) {
+                                             float pulid_id_weight                 = 1.0f,
+                                             const CfgBlockReusePlan* cfg_reuse    = nullptr,
+                                             const SkipLayerPrefixPlan* slg_prefix = nullptr) {
             GGML_ASSERT(x->ne[3] == 1);
 
             int64_t W      = x->ne[0];
@@ -1224,7 +1486,7 @@ namespace Flux {
             img = ggml_cont(ctx->ggml_ctx, ggml_ext_torch_permute(ctx->ggml_ctx, img, 1, 0, 2, 3));      // [N, H/patch_size*W/patch_size, hidden_size]
 
             auto out = forward_orig(ctx, img, context, timestep, y, guidance, pe, mod_index_arange, skip_layers,
-                                    pulid_id, pulid_id_weight);  // [N, n_img_token, hidden_size]
+                                    pulid_id, pulid_id_weight, cfg_reuse, slg_prefix);  // [N, n_img_token, hidden_size]
 
             // nerf decode
             auto nerf_image_embedder   = std::dynamic_pointer_cast<NerfEmbedder>(blocks["nerf_image_embedder"]);
@@ -1261,6 +1523,16 @@ namespace Flux {
             return out;
         }
 
+        bool supports_batched_conditions() const {
+            // Chroma modulation, the packed c_concat variants and Sefi's dual timestep
+            // embedding all assume a single sample, everything else batches cleanly.
+            return !config.is_chroma &&
+                   !config.is_sefi &&
+                   config.version != VERSION_FLUX_FILL &&
+                   config.version != VERSION_FLUX_CONTROLS &&
+                   config.version != VERSION_FLEX_2;
+        }
+
         ggml_tensor* forward_flux_chroma(GGMLRunnerContext* ctx,
                                          ggml_tensor* x,
                                          ggml_tensor* timestep,
@@ -1274,8 +1546,14 @@ namespace Flux {
                                          std::vector<ggml_tensor*> ref_latents = {},
                                          std::vector<int> skip_layers          = {},
                                          ggml_tensor* pulid_id                 = nullptr,
-                                         float pulid_id_weight                 = 1.0f) {
-            GGML_ASSERT(x->ne[3] == 1);
+                                         float pulid_id_weight                 = 1.0f,
+                                         const CfgBlockReusePlan* cfg_reuse    = nullptr,
+                                         const SkipLayerPrefixPlan* slg_prefix = nullptr,
+                                         ggml_tensor* kept_tokens              = nullptr,
+                                         ggml_tensor* token_scatter            = nullptr,
+                                         ggml_tensor* modulation_row           = nullptr,
+                                         const RefKVCachePlan* ref_kv          = nullptr) {
+            GGML_ASSERT(x->ne[3] == 1 || (supports_batched_conditions() && ref_latents.empty()));
 
             int64_t W      = x->ne[0];
             int64_t H      = x->ne[1];
@@ -1314,17 +1592,31 @@ namespace Flux {
                 img          = ggml_concat(ctx->ggml_ctx, img, control, 0);
             }
 
-            if (ref_latents.size() > 0) {
+            int64_t ref_tokens = ref_kv != nullptr ? ref_token_count(ref_latents) : 0;
+            if (ref_kv != nullptr && ref_kv->pass == RefKVCachePlan::REUSE) {
+                // the reference tokens come from the cache; they end the sequence, so pe drops its tail
+                pe = ggml_view_4d(ctx->ggml_ctx, pe, pe->ne[0], pe->ne[1], pe->ne[2], pe->ne[3] - ref_tokens,
+                                  pe->nb[1], pe->nb[2], pe->nb[3], 0);
+            } else if (ref_latents.size() > 0) {
                 for (ggml_tensor* ref : ref_latents) {
                     ref = DiT::pad_and_patchify(ctx, ref, patch_size, patch_size);
                     img = ggml_concat(ctx->ggml_ctx, img, ref, 1);
                 }
             }
 
+            if (kept_tokens != nullptr) {
+                // masked inpainting: only the image tokens near the mask, pe is gathered to match
+                GGML_ASSERT(x->ne[3] == 1 && ref_latents.empty() && token_scatter->ne[0] == img_tokens);
+                img = ggml_get_rows(ctx->ggml_ctx, img, kept_tokens);
+            }
+
             auto out = forward_orig(ctx, img, context, timestep, y, guidance, pe, mod_index_arange, skip_layers,
-                                    pulid_id, pulid_id_weight);  // [N, num_tokens, C * patch_size * patch_size]
+                                    pulid_id, pulid_id_weight, cfg_reuse, slg_prefix, modulation_row,
+                                    ref_kv, ref_tokens);  // [N, num_tokens, C * patch_size * patch_size]
 
-            if (out->ne[1] > img_tokens) {
+            if (token_scatter != nullptr) {
+                out = ggml_get_rows(ctx->ggml_ctx, out, token_scatter);  // [N, img_tokens, C * patch_size * patch_size]
+            } else if (out->ne[1] > img_tokens) {
                 out = ggml_view_3d(ctx->ggml_ctx, out, out->ne[0], img_tokens, out->ne[2], out->nb[1], out->nb[2], 0);
                 out = ggml_cont(ctx->ggml_ctx, out);
             }
@@ -1346,7 +1638,13 @@ namespace Flux {
                              std::vector<ggml_tensor*> ref_latents = {},
                              std::vector<int> skip_layers          = {},
                              ggml_tensor* pulid_id                 = nullptr,
-                             float pulid_id_weight                 = 1.0f) {
+                             float pulid_id_weight                 = 1.0f,
+                             const CfgBlockReusePlan* cfg_reuse    = nullptr,
+                             const SkipLayerPrefixPlan* slg_prefix = nullptr,
+                             ggml_tensor* kept_tokens              = nullptr,
+                             ggml_tensor* token_scatter            = nullptr,
+                             ggml_tensor* modulation_row           = nullptr,
+                             const RefKVCachePlan* ref_kv          = nullptr) {
             // Forward pass of DiT.
             // x: (N, C, H, W) tensor of spatial inputs (images or latent representations of images)
             // timestep: (N,) tensor of diffusion timesteps
@@ -1355,6 +1653,9 @@ namespace Flux {
             // y: (N, adm_in_channels) tensor of class labels
             // guidance: (N,)
             // pe: (L, d_head/2, 2, 2)
+            // kept_tokens, token_scatter: nullptr, or the image token gather and scatter indices of MaskedTokenPlan
+            // modulation_row: nullptr, or this step's ModulationCache row, [modulation_row_size()]
+            // ref_kv: nullptr, or the RefKVCachePlan pass; REUSE needs the cache of a RECORD pass
             // return: (N, C, H, W)
 
             if (config.version == VERSION_CHROMA_RADIANCE) {
@@ -1371,7 +1672,9 @@ namespace Flux {
                                                ref_latents,
                                                skip_layers,
                                                pulid_id,
-                                               pulid_id_weight);
+                                               pulid_id_weight,
+                                               cfg_reuse,
+                                               slg_prefix);
             } else {
                 return forward_flux_chroma(ctx,
                                            x,
@@ -1386,7 +1689,13 @@ namespace Flux {
                                            ref_latents,
                                            skip_layers,
                                            pulid_id,
-                                           pulid_id_weight);
+                                           pulid_id_weight,
+                                           cfg_reuse,
+                                           slg_prefix,
+                                           kept_tokens,
+                                           token_scatter,
+                                           modulation_row,
+                                           ref_kv);
             }
         }
     };
@@ -1395,9 +1704,11 @@ namespace Flux {
     public:
         FluxConfig config;
         Flux flux;
-        std::vector<float> pe_vec;
         std::vector<float> mod_index_arange_vec;
         std::vector<float> dct_vec;
+        std::vector<int32_t> kept_tokens_vec;
+        std::vector<int32_t> token_scatter_vec;
+        std::vector<int32_t> kept_pe_index_vec;
         sd::Tensor<float> guidance_tensor;
         SDVersion version;
         bool use_mask = false;
@@ -1424,6 +1735,10 @@ namespace Flux {
             return "flux";
         }
 
+        bool supports_batched_conditions() const override {
+            return flux.supports_batched_conditions();
+        }
+
         void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors, const std::string& prefix) override {
             flux.get_param_tensors(tensors, prefix);
         }
@@ -1488,12 +1803,18 @@ namespace Flux {
                                  bool increase_ref_index                                  = false,
                                  std::vector<int> skip_layers                             = {},
                                  const sd::Tensor<float>& pulid_id_tensor                 = {},
-                                 float pulid_id_weight                                    = 1.0f) {
+                                 float pulid_id_weight                                    = 1.0f,
+                                 const CfgBlockReusePlan* cfg_reuse                       = nullptr,
+                                 const SkipLayerPrefixPlan* slg_prefix                    = nullptr,
+                                 const MaskedTokenPlan* masked_tokens                     = nullptr,
+                                 const sd::Tensor<float>& modulation_row_tensor           = {},
+                                 const RefKVCachePlan* ref_kv                             = nullptr,
+                                 float ref_position_scale                                 = 1.f) {
             ggml_tensor* x         = make_input(x_tensor);
             ggml_tensor* timesteps = make_input(timesteps_tensor);
-            ggml_tensor* context   = make_optional_input(context_tensor);
-            ggml_tensor* c_concat  = make_optional_input(c_concat_tensor);
-            ggml_tensor* y         = make_optional_input(y_tensor);
+            ggml_tensor* context   = make_optional_constant_input(context_tensor);
+            ggml_tensor* c_concat  = make_optional_constant_input(c_concat_tensor);
+            ggml_tensor* y         = make_optional_constant_input(y_tensor);
             if (config.guidance_embed || config.is_chroma) {
                 if (!guidance_tensor.empty()) {
                     this->guidance_tensor = guidance_tensor;
@@ -1506,10 +1827,10 @@ namespace Flux {
             std::vector<ggml_tensor*> ref_latents;
             ref_latents.reserve(ref_latents_tensor.size());
             for (const auto& ref_latent_tensor : ref_latents_tensor) {
-                ref_latents.push_back(make_input(ref_latent_tensor));
+                ref_latents.push_back(make_constant_input(ref_latent_tensor));
             }
 
-            GGML_ASSERT(x->ne[3] == 1);
+            GGML_ASSERT(x->ne[3] == 1 || (supports_batched_conditions() && ref_latents.empty()));
             ggml_cgraph* gf = new_graph_custom(FLUX_GRAPH_SIZE);
 
             ggml_tensor* mod_index_arange = nullptr;
@@ -1532,27 +1853,33 @@ namespace Flux {
             } else if (version == VERSION_OVIS_IMAGE) {
                 txt_arange_dims = {1, 2};
             }
-            pe_vec      = Rope::gen_flux_pe(static_cast<int>(x->ne[1]),
-                                            static_cast<int>(x->ne[0]),
-                                            config.patch_size,
-                                            static_cast<int>(x->ne[3]),
-                                            static_cast<int>(context->ne[1]),
-                                            txt_arange_dims,
-                                            ref_latents,
-                                            increase_ref_index,
-                                            config.ref_index_scale,
-                                            config.theta,
-                                            circular_y_enabled,
-                                            circular_x_enabled,
-                                            config.axes_dim,
-                                            sd_version_is_longcat(version));
-            int pos_len = static_cast<int>(pe_vec.size() / config.axes_dim_sum / 2);
-            // LOG_DEBUG("pos_len %d", pos_len);
-            auto pe = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, 2, 2, config.axes_dim_sum / 2, pos_len);
-            // pe->data = pe_vec.data();
-            // print_ggml_tensor(pe);
-            // pe->data = nullptr;
-            set_backend_tensor_data(pe, pe_vec.data());
+            std::string pe_key = sd_format("%s:%" PRId64 ":%d%d%d:%g",
+                                           tensor_shape_key(x).c_str(),
+                                           context->ne[1],
+                                           increase_ref_index ? 1 : 0,
+                                           circular_y_enabled ? 1 : 0,
+                                           circular_x_enabled ? 1 : 0,
+                                           ref_position_scale);
+            for (ggml_tensor* ref_latent : ref_latents) {
+                pe_key += ":" + tensor_shape_key(ref_latent);
+            }
+            auto pe = make_positional_table(pe_key, 2, 2, config.axes_dim_sum / 2, [&]() {
+                return Rope::gen_flux_pe(static_cast<int>(x->ne[1]),
+                                         static_cast<int>(x->ne[0]),
+                                         config.patch_size,
+                                         1,  // pe is shared by every sample in the batch
+                                         static_cast<int>(context->ne[1]),
+                                         txt_arange_dims,
+                                         ref_latents,
+                                         increase_ref_index,
+                                         config.ref_index_scale,
+                                         config.theta,
+                                         circular_y_enabled,
+                                         circular_x_enabled,
+                                         config.axes_dim,
+                                         sd_version_is_longcat(version),
+                                         ref_position_scale);
+            });
 
             if (version == VERSION_CHROMA_RADIANCE) {
                 int patch_size     = config.patch_size;
@@ -1569,6 +1896,33 @@ namespace Flux {
                                         ? nullptr
                                         : make_input(pulid_id_tensor);
 
+            ggml_tensor* kept_tokens   = nullptr;
+            ggml_tensor* token_scatter = nullptr;
+            int64_t context_len        = context->ne[1];
+            if (masked_tokens != nullptr && version != VERSION_CHROMA_RADIANCE && ref_latents.empty() && x->ne[3] == 1 &&
+                masked_tokens->build(x->ne[0], x->ne[1], config.patch_size, &kept_tokens_vec, &token_scatter_vec) &&
+                pe->ne[3] == context_len + static_cast<int64_t>(token_scatter_vec.size())) {
+                kept_pe_index_vec.resize(static_cast<size_t>(context_len) + kept_tokens_vec.size());
+                for (int64_t i = 0; i < context_len; i++) {
+                    kept_pe_index_vec[i] = static_cast<int32_t>(i);
+                }
+                for (size_t i = 0; i < kept_tokens_vec.size(); i++) {
+                    kept_pe_index_vec[context_len + i] = static_cast<int32_t>(context_len) + kept_tokens_vec[i];
+                }
+                kept_tokens   = ggml_new_tensor_1d(compute_ctx, GGML_TYPE_I32, kept_tokens_vec.size());
+                token_scatter = ggml_new_tensor_1d(compute_ctx, GGML_TYPE_I32, token_scatter_vec.size());
+                auto pe_index = ggml_new_tensor_1d(compute_ctx, GGML_TYPE_I32, kept_pe_index_vec.size());
+                set_backend_tensor_data(kept_tokens, kept_tokens_vec.data());
+                set_backend_tensor_data(token_scatter, token_scatter_vec.data());
+                set_backend_tensor_data(pe_index, kept_pe_index_vec.data());
+
+                pe = ggml_reshape_2d(compute_ctx, pe, pe->ne[0] * pe->ne[1] * pe->ne[2], pe->ne[3]);
+                pe = ggml_get_rows(compute_ctx, pe, pe_index);
+                pe = ggml_reshape_4d(compute_ctx, pe, 2, 2, config.axes_dim_sum / 2, pe_index->ne[0]);
+            }
+
+            ggml_tensor* modulation_row = make_optional_input(modulation_row_tensor);
+
             auto runner_ctx = get_context();
 
             ggml_tensor* out = flux.forward(&runner_ctx,
@@ -1584,13 +1938,88 @@ namespace Flux {
                                             ref_latents,
                                             skip_layers,
                                             pulid_id,
-                                            pulid_id_weight);
+                                            pulid_id_weight,
+                                            cfg_reuse,
+                                            slg_prefix,
+                                            kept_tokens,
+                                            token_scatter,
+                                            modulation_row,
+                                            ref_latents.empty() ? nullptr : ref_kv);
 
             ggml_build_forward_expand(gf, out);
 
             return gf;
         }
 
+        // Whether a RECORD pass of slot cached the keys and values of as many
+        // reference tokens as ref_latents has.
+        bool has_ref_kv_cache(int slot, const std::vector<sd::Tensor<float>>& ref_latents) {
+            int64_t p          = config.patch_size;
+            int64_t ref_tokens = 0;
+            for (const auto& ref : ref_latents) {
+                ref_tokens += ((ref.shape()[0] + p - 1) / p) * ((ref.shape()[1] + p - 1) / p);
+            }
+            std::string block = config.depth > 0 ? "double_blocks.0" : "single_blocks.0";
+            ggml_tensor* k    = get_cache_tensor_by_name(ref_kv_cache_name(slot, block, "k"));
+            return k != nullptr && k->ne[1] == ref_tokens;
+        }
+
+        // Rows of a new ModulationCache group, one per listed timestep, in one
+        // graph; empty on failure.
+        sd::Tensor<float> compute_modulation_rows(int n_threads,
+                                                  const std::vector<float>& timesteps,
+                                                  float guidance,
+                                                  const sd::Tensor<float>& y) {
+            const int64_t n = static_cast<int64_t>(timesteps.size());
+            sd::Tensor<float> timesteps_tensor({n}, timesteps);
+            sd::Tensor<float> guidance_tensor;
+            if (config.guidance_embed) {
+                guidance_tensor = sd::Tensor<float>({n}, std::vector<float>(static_cast<size_t>(n), guidance));
+            }
+            auto get_graph = [&]() -> ggml_cgraph* {
+                ggml_cgraph* gf  = new_graph_custom(FLUX_GRAPH_SIZE);
+                auto runner_ctx  = get_context();
+                ggml_tensor* out = flux.forward_modulation(&runner_ctx,
+                                                           make_input(timesteps_tensor),
+                                                           make_optional_input(y),
+                                                           make_optional_input(guidance_tensor));
+                ggml_build_forward_expand(gf, out);
+                return gf;
+            };
+            return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false));
+        }
+
+        // This step's ModulationCache row, after computing the rows of its
+        // group when the group is new; empty when the step graph computes
+        // its own modulation.
+        sd::Tensor<float> modulation_row_for(int n_threads,
+                                             ModulationCache* cache,
+                                             const sd::Tensor<float>& x,
+                                             const sd::Tensor<float>& timesteps,
+                                             const sd::Tensor<float>& y,
+                                             const sd::Tensor<float>& guidance) {
+            if (!flux.supports_modulation_cache() || timesteps.numel() != 1 || (x.dim() >= 4 && x.shape()[3] != 1)) {
+                return {};
+            }
+            float guidance_value = 0.0f;
+            if (config.guidance_embed) {
+                if (guidance.numel() != 1) {
+                    return {};
+                }
+                guidance_value = guidance.data()[0];
+            }
+            sd::Tensor<float> pooled;
+            if (config.vec_in_dim > 0) {
+                if (y.numel() != config.vec_in_dim) {
+                    return {};
+                }
+                pooled = y;
+            }
+            return cache->row_for(timesteps.data()[0], guidance_value, pooled, flux.modulation_row_size(), [&](const std::vector<float>& row_timesteps) {
+                return compute_modulation_rows(n_threads, row_timesteps, guidance_value, pooled);
+            });
+        }
+
         sd::Tensor<float> compute(int n_threads,
                                   const sd::Tensor<float>& x,
                                   const sd::Tensor<float>& timesteps,
@@ -1602,7 +2031,13 @@ namespace Flux {
                                   bool increase_ref_index                           = false,
                                   std::vector<int> skip_layers                      = std::vector<int>(),
                                   const sd::Tensor<float>& pulid_id                 = {},
-                                  float pulid_id_weight                             = 1.0f) {
+                                  float pulid_id_weight                             = 1.0f,
+                                  const CfgBlockReusePlan* cfg_reuse                = nullptr,
+                                  const SkipLayerPrefixPlan* slg_prefix             = nullptr,
+                                  const MaskedTokenPlan* masked_tokens              = nullptr,
+                                  const sd::Tensor<float>& modulation_row           = {},
+                                  const RefKVCachePlan* ref_kv                      = nullptr,
+                                  float ref_position_scale                          = 1.f) {
             // x: [N, in_channels, h, w]
             // timesteps: [N, ]
             // context: [N, max_position, hidden_size]
@@ -1610,7 +2045,7 @@ namespace Flux {
             // guidance: [N, ]
             // pulid_id: empty (no injection) or [N, num_id_tokens=32, kv_dim=2048]
             auto get_graph = [&]() -> ggml_cgraph* {
-                return build_graph(x, timesteps, context, c_concat, y, guidance, ref_latents, increase_ref_index, skip_layers, pulid_id, pulid_id_weight);
+                return build_graph(x, timesteps, context, c_concat, y, guidance, ref_latents, increase_ref_index, skip_layers, pulid_id, pulid_id_weight, cfg_reuse, slg_prefix, masked_tokens, modulation_row, ref_kv, ref_position_scale);
             };
 
             auto result = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
@@ -1624,18 +2059,81 @@ namespace Flux {
             const auto* extra = diffusion_extra_as<FluxDiffusionExtra>(diffusion_params);
             static const std::vector<sd::Tensor<float>> empty_ref_latents;
             static const std::vector<int> empty_skip_layers;
-            return compute(n_threads,
-                           *diffusion_params.x,
-                           *diffusion_params.timesteps,
-                           tensor_or_empty(diffusion_params.context),
-                           tensor_or_empty(diffusion_params.c_concat),
-                           tensor_or_empty(diffusion_params.y),
-                           tensor_or_empty(extra->guidance),
-                           diffusion_params.ref_latents ? *diffusion_params.ref_latents : empty_ref_latents,
-                           diffusion_params.increase_ref_index,
-                           extra->skip_layers ? *extra->skip_layers : empty_skip_layers,
-                           tensor_or_empty(extra->pulid_id),
-                           extra->pulid_id_weight);
+            const CfgBlockReusePlan* cfg_reuse    = extra->cfg_reuse;
+            const SkipLayerPrefixPlan* slg_prefix = extra->slg_prefix;
+            if (can_attempt_graph_cut_segmented_compute()) {
+                // segmented compute drops cache tensors, and with them the cond residuals and prefix
+                cfg_reuse  = nullptr;
+                slg_prefix = nullptr;
+            }
+            if ((cfg_reuse != nullptr && cfg_reuse->pass == CfgBlockReusePlan::RECORD) ||
+                (slg_prefix != nullptr && slg_prefix->pass == SkipLayerPrefixPlan::RECORD)) {
+                // cond-pass caches from the previous step are replaced, or no longer reused
+                free_cache_ctx_and_buffer();
+            }
+            RefKVCachePlan ref_kv;
+            bool use_ref_kv = extra->ref_kv != nullptr && diffusion_params.ref_latents != nullptr &&
+                              !diffusion_params.ref_latents->empty() && flux.supports_ref_kv_cache() &&
+                              cfg_reuse == nullptr && slg_prefix == nullptr && !can_attempt_graph_cut_segmented_compute();
+            if (use_ref_kv) {
+                ref_kv = *extra->ref_kv;
+                if (ref_kv.pass == RefKVCachePlan::REUSE && !has_ref_kv_cache(ref_kv.slot, *diffusion_params.ref_latents)) {
+                    // nothing recorded for this condition yet, or for other references
+                    ref_kv.pass = RefKVCachePlan::RECORD;
+                }
+            }
+            sd::Tensor<float> modulation_row;
+            if (extra->modulation_cache != nullptr) {
+                modulation_row = modulation_row_for(n_threads,
+                                                    extra->modulation_cache,
+                                                    *diffusion_params.x,
+                                                    *diffusion_params.timesteps,
+                                                    tensor_or_empty(diffusion_params.y),
+                                                    tensor_or_empty(extra->guidance));
+            }
+            auto out = compute(n_threads,
+                               *diffusion_params.x,
+                               *diffusion_params.timesteps,
+                               tensor_or_empty(diffusion_params.context),
+                               tensor_or_empty(diffusion_params.c_concat),
+                               tensor_or_empty(diffusion_params.y),
+                               tensor_or_empty(extra->guidance),
+                               diffusion_params.ref_latents ? *diffusion_params.ref_latents : empty_ref_latents,
+                               diffusion_params.increase_ref_index,
+                               extra->skip_layers ? *extra->skip_layers : empty_skip_layers,
+                               tensor_or_empty(extra->pulid_id),
+                               extra->pulid_id_weight,
+                               cfg_reuse,
+                               slg_prefix,
+                               extra->masked_tokens,
+                               modulation_row,
+                               use_ref_kv ? &ref_kv : nullptr,
+                               diffusion_params.ref_position_scale);
+            if (extra->cfg_reuse != nullptr && extra->cfg_reuse->pass == CfgBlockReusePlan::MEASURE && extra->cfg_reuse->stats != nullptr) {
+                read_cfg_reuse_stats(cfg_reuse != nullptr && !out.empty(), extra->cfg_reuse->stats);
+            }
+            return out;
+        }
+
+        // Leaves stats empty when nothing was measured, e.g. under graph cut.
+        void read_cfg_reuse_stats(bool measured, std::vector<float>* stats) {
+            stats->clear();
+            if (!measured) {
+                return;
+            }
+            stats->assign(static_cast<size_t>(config.depth) * 2, 0.0f);
+            bool any = false;
+            for (int i = 0; i < config.depth; i++) {
+                ggml_tensor* tensor = get_cache_tensor_by_name("flux.cfg_reuse.stats." + std::to_string(i));
+                if (tensor == nullptr) {
+                    continue;
+                }
+                ggml_backend_tensor_get(tensor, stats->data() + static_cast<size_t>(i) * 2, 0, 2 * sizeof(float));
+                any = true;
+            }
+            if (!any) {
+                stats->clear();
+            }
         }
 
         void test() {
@@ -657,12 +657,17 @@ namespace LTXV {
             blocks["to_out.0"] = std::make_shared<Linear>(inner_dim, query_dim, true);
         }
 
+        // window_tokens, window_shift: see ggml_ext_window_attention, only
+        // used for unmasked self-attention
         ggml_tensor* forward(GGMLRunnerContext* ctx,
                              ggml_tensor* x,
-                             ggml_tensor* context = nullptr,
-                             ggml_tensor* mask    = nullptr,
-                             ggml_tensor* pe      = nullptr,
-                             ggml_tensor* k_pe    = nullptr) {
+                             ggml_tensor* context  = nullptr,
+                             ggml_tensor* mask     = nullptr,
+                             ggml_tensor* pe       = nullptr,
+                             ggml_tensor* k_pe     = nullptr,
+                             int64_t window_tokens = 0,
+                             int64_t window_shift  = 0) {
+            bool windowed = window_tokens > 0 && context == nullptr && mask == nullptr;
             if (context == nullptr) {
                 context = x;
             }
@@ -689,15 +694,28 @@ namespace LTXV {
                 k = apply_hidden_rope(ctx->ggml_ctx, k, k_pe, heads, dim_head, rope_interleaved);
             }
 
-            auto out = ggml_ext_attention_ext(ctx->ggml_ctx,
-                                              ctx->backend,
-                                              q,
-                                              k,
-                                              v,
-                                              heads,
-                                              mask,
-                                              false,
-                                              ctx->flash_attn_enabled);
+            ggml_tensor* out = nullptr;
+            if (windowed && q->ne[0] == heads * dim_head && k->ne[0] == heads * dim_head) {
+                out = ggml_ext_window_attention(ctx->ggml_ctx,
+                                                ctx->backend,
+                                                q,
+                                                k,
+                                                v,
+                                                heads,
+                                                window_tokens,
+                                                window_shift,
+                                                ctx->flash_attn_enabled);
+            } else {
+                out = ggml_ext_attention_ext(ctx->ggml_ctx,
+                                             ctx->backend,
+                                             q,
+                                             k,
+                                             v,
+                                             heads,
+                                             mask,
+                                             false,
+                                             ctx->flash_attn_enabled);
+            }
 
             if (blocks.count("to_gate_logits") > 0) {
                 auto to_gate_logits = std::dynamic_pointer_cast<Linear>(blocks["to_gate_logits"]);
@@ -1209,7 +1227,9 @@ namespace LTXV {
                                                       ggml_tensor* a_cross_gate_timestep,
                                                       ggml_tensor* v_prompt_timestep,
                                                       ggml_tensor* a_prompt_timestep,
-                                                      ggml_tensor* self_attention_mask = nullptr) {
+                                                      ggml_tensor* self_attention_mask = nullptr,
+                                                      int64_t window_tokens            = 0,
+                                                      int64_t window_shift             = 0) {
             auto attn1               = std::dynamic_pointer_cast<CrossAttention>(blocks["attn1"]);
             auto audio_attn1         = std::dynamic_pointer_cast<CrossAttention>(blocks["audio_attn1"]);
             auto attn2               = std::dynamic_pointer_cast<CrossAttention>(blocks["attn2"]);
@@ -1229,7 +1249,7 @@ namespace LTXV {
             auto v_mods = get_ada_values(ctx, v_table, v_timestep, v_dim, cross_attention_adaln ? 9 : 6);
             auto v_norm = rms_norm(ctx->ggml_ctx, vx);
             v_norm      = modulate(ctx->ggml_ctx, v_norm, v_mods[0], v_mods[1]);
-            auto v_sa   = attn1->forward(ctx, v_norm, nullptr, self_attention_mask, v_pe);
+            auto v_sa   = attn1->forward(ctx, v_norm, nullptr, self_attention_mask, v_pe, nullptr, window_tokens, window_shift);
             vx          = ggml_add(ctx->ggml_ctx, vx, apply_gate(ctx->ggml_ctx, v_sa, v_mods[2]));
             auto v_txt  = apply_text_cross_attention(ctx,
                                                      vx,
@@ -1556,7 +1576,9 @@ namespace LTXV {
                                                       ggml_tensor* v_cross_pe,
                                                       ggml_tensor* a_cross_pe,
                                                       ggml_tensor* video_connector_pe,
-                                                      ggml_tensor* audio_connector_pe) {
+                                                      ggml_tensor* audio_connector_pe,
+                                                      int attention_window = 0) {
+            // attention_window: latent frames per video self-attention window, 0 for full attention
             auto patchify_proj       = std::dynamic_pointer_cast<Linear>(blocks["patchify_proj"]);
             auto audio_patchify_proj = std::dynamic_pointer_cast<Linear>(blocks["audio_patchify_proj"]);
             auto adaln_single        = std::dynamic_pointer_cast<AdaLayerNormSingle>(blocks["adaln_single"]);
@@ -1573,6 +1595,8 @@ namespace LTXV {
             int64_t frames     = vx->ne[2];
             int64_t audio_time = ax != nullptr ? ax->ne[1] : 0;
 
+            int64_t window_frames = ggml_ext_attention_window_frames(frames, attention_window);
+
             vx = patchify_video(ctx, vx, n);
             vx = patchify_proj->forward(ctx, vx);
             if (ax != nullptr && ggml_nelements(ax) > 0 && audio_time > 0) {
@@ -1629,6 +1653,7 @@ namespace LTXV {
             sd::ggml_graph_cut::mark_graph_cut(vx, "ltxav.prelude", "vx");
             sd::ggml_graph_cut::mark_graph_cut(ax, "ltxav.prelude", "ax");
 
+            // odd blocks shift the video attention windows by half a window
             for (int i = 0; i < config.num_layers; i++) {
                 auto block = std::dynamic_pointer_cast<BasicAVTransformerBlock>(blocks["transformer_blocks." + std::to_string(i)]);
                 auto out   = block->forward(ctx,
@@ -1648,7 +1673,10 @@ namespace LTXV {
                                             av_ca_a2v_gate_noise_timestep,
                                             av_ca_v2a_gate_noise_timestep,
                                             v_prompt_timestep_mod,
-                                            a_prompt_timestep_mod);
+                                            a_prompt_timestep_mod,
+                                            nullptr,
+                                            window_frames * width * height,
+                                            (i % 2) * (window_frames / 2) * width * height);
                 vx         = out.first;
                 ax         = out.second;
                 sd::ggml_graph_cut::mark_graph_cut(vx, "ltxav.transformer_blocks." + std::to_string(i), "vx");
@@ -1771,7 +1799,8 @@ namespace LTXV {
                                  const sd::Tensor<float>& audio_timesteps_tensor = {},
                                  int audio_length                                = 0,
                                  float frame_rate                                = 24.f,
-                                 const sd::Tensor<float>& video_positions_tensor = {}) {
+                                 const sd::Tensor<float>& video_positions_tensor = {},
+                                 int attention_window                            = 0) {
             auto split_inputs = split_av_latents(x_tensor, audio_length);
             vx_input_cache    = split_inputs.first;
             if (!audio_x_tensor.empty()) {
@@ -1784,7 +1813,7 @@ namespace LTXV {
             ggml_tensor* ax         = make_optional_input(ax_input_cache);
             ggml_tensor* timesteps  = make_input(timesteps_tensor);
             ggml_tensor* a_timestep = make_optional_input(audio_timesteps_tensor);
-            ggml_tensor* context    = make_optional_input(context_tensor);
+            ggml_tensor* context    = make_optional_constant_input(context_tensor);
 
             ggml_cgraph* gf = new_graph_custom(LTXAV_GRAPH_SIZE);
 
@@ -1921,7 +1950,8 @@ namespace LTXV {
                                             video_cross_pe,
                                             audio_cross_pe,
                                             video_connector_pe,
-                                            audio_connector_pe);
+                                            audio_connector_pe,
+                                            has_video_positions ? 0 : attention_window);  // keyframe tokens need full attention
             auto out        = merge_av_latents(compute_ctx, out_pair.first, out_pair.second);
             ggml_build_forward_expand(gf, out);
             return gf;
@@ -1935,9 +1965,10 @@ namespace LTXV {
                                   const sd::Tensor<float>& audio_timesteps = {},
                                   int audio_length                         = 0,
                                   float frame_rate                         = 24.f,
-                                  const sd::Tensor<float>& video_positions = {}) {
+                                  const sd::Tensor<float>& video_positions = {},
+                                  int attention_window                     = 0) {
             auto get_graph = [&]() -> ggml_cgraph* {
-                return build_graph(x, timesteps, context, audio_x, audio_timesteps, audio_length, frame_rate, video_positions);
+                return build_graph(x, timesteps, context, audio_x, audio_timesteps, audio_length, frame_rate, video_positions, attention_window);
             };
             auto out = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
             return out;
@@ -1956,7 +1987,8 @@ namespace LTXV {
                            tensor_or_empty(extra->audio_timesteps),
                            extra->audio_length,
                            extra->frame_rate,
-                           tensor_or_empty(extra->video_positions));
+                           tensor_or_empty(extra->video_positions),
+                           extra->attention_window);
         }
 
         void test(const std::string& x_path,
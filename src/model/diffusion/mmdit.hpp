@@ -369,19 +369,32 @@ public:
         blocks["adaLN_modulation.1"] = std::shared_ptr<GGMLBlock>(new Linear(hidden_size, n_mods * hidden_size));
     }
 
+    int64_t modulation_count() const {
+        return self_attn ? 9 : (pre_only ? 2 : 6);
+    }
+
+    // the modulation before it is split, [N, modulation_count() * hidden_size]
+    ggml_tensor* project_modulation(GGMLRunnerContext* ctx, ggml_tensor* c) {
+        auto adaLN_modulation_1 = std::dynamic_pointer_cast<Linear>(blocks["adaLN_modulation.1"]);
+        return adaLN_modulation_1->forward(ctx, ggml_silu(ctx->ggml_ctx, c));
+    }
+
     std::tuple<std::vector<ggml_tensor*>, std::vector<ggml_tensor*>, std::vector<ggml_tensor*>> pre_attention_x(GGMLRunnerContext* ctx,
                                                                                                                 ggml_tensor* x,
-                                                                                                                ggml_tensor* c) {
+                                                                                                                ggml_tensor* c,
+                                                                                                                ggml_tensor* m = nullptr) {
         GGML_ASSERT(self_attn);
         // x: [N, n_token, hidden_size]
         // c: [N, hidden_size]
-        auto norm1              = std::dynamic_pointer_cast<LayerNorm>(blocks["norm1"]);
-        auto attn               = std::dynamic_pointer_cast<SelfAttention>(blocks["attn"]);
-        auto attn2              = std::dynamic_pointer_cast<SelfAttention>(blocks["attn2"]);
-        auto adaLN_modulation_1 = std::dynamic_pointer_cast<Linear>(blocks["adaLN_modulation.1"]);
+        // m: nullptr, or project_modulation(c) from a ModulationCache row
+        auto norm1 = std::dynamic_pointer_cast<LayerNorm>(blocks["norm1"]);
+        auto attn  = std::dynamic_pointer_cast<SelfAttention>(blocks["attn"]);
+        auto attn2 = std::dynamic_pointer_cast<SelfAttention>(blocks["attn2"]);
 
         int n_mods = 9;
-        auto m     = adaLN_modulation_1->forward(ctx, ggml_silu(ctx->ggml_ctx, c));  // [N, n_mods * hidden_size]
+        if (m == nullptr) {
+            m = project_modulation(ctx, c);  // [N, n_mods * hidden_size]
+        }
         auto m_vec = ggml_ext_chunk(ctx->ggml_ctx, m, n_mods, 0);
 
         auto shift_msa  = m_vec[0];  // [N, hidden_size]
@@ -407,18 +420,21 @@ public:
 
     std::pair<std::vector<ggml_tensor*>, std::vector<ggml_tensor*>> pre_attention(GGMLRunnerContext* ctx,
                                                                                   ggml_tensor* x,
-                                                                                  ggml_tensor* c) {
+                                                                                  ggml_tensor* c,
+                                                                                  ggml_tensor* m = nullptr) {
         // x: [N, n_token, hidden_size]
         // c: [N, hidden_size]
-        auto norm1              = std::dynamic_pointer_cast<LayerNorm>(blocks["norm1"]);
-        auto attn               = std::dynamic_pointer_cast<SelfAttention>(blocks["attn"]);
-        auto adaLN_modulation_1 = std::dynamic_pointer_cast<Linear>(blocks["adaLN_modulation.1"]);
+        // m: nullptr, or project_modulation(c) from a ModulationCache row
+        auto norm1 = std::dynamic_pointer_cast<LayerNorm>(blocks["norm1"]);
+        auto attn  = std::dynamic_pointer_cast<SelfAttention>(blocks["attn"]);
 
         int n_mods = 6;
         if (pre_only) {
             n_mods = 2;
         }
-        auto m     = adaLN_modulation_1->forward(ctx, ggml_silu(ctx->ggml_ctx, c));  // [N, n_mods * hidden_size]
+        if (m == nullptr) {
+            m = project_modulation(ctx, c);  // [N, n_mods * hidden_size]
+        }
         auto m_vec = ggml_ext_chunk(ctx->ggml_ctx, m, n_mods, 0);
 
         auto shift_msa = m_vec[0];  // [N, hidden_size]
@@ -565,23 +581,26 @@ block_mixing(GGMLRunnerContext* ctx,
              ggml_tensor* x,
              ggml_tensor* c,
              std::shared_ptr<DismantledBlock> context_block,
-             std::shared_ptr<DismantledBlock> x_block) {
+             std::shared_ptr<DismantledBlock> x_block,
+             ggml_tensor* context_mod = nullptr,
+             ggml_tensor* x_mod       = nullptr) {
     // context: [N, n_context, hidden_size]
     // x: [N, n_token, hidden_size]
     // c: [N, hidden_size]
-    auto context_qkv_intermediates = context_block->pre_attention(ctx, context, c);
+    // context_mod, x_mod: nullptr, or the modulation of each block from a ModulationCache row
+    auto context_qkv_intermediates = context_block->pre_attention(ctx, context, c, context_mod);
     auto context_qkv               = context_qkv_intermediates.first;
     auto context_intermediates     = context_qkv_intermediates.second;
 
     std::vector<ggml_tensor*> x_qkv, x_qkv2, x_intermediates;
 
     if (x_block->self_attn) {
-        auto x_qkv_intermediates = x_block->pre_attention_x(ctx, x, c);
+        auto x_qkv_intermediates = x_block->pre_attention_x(ctx, x, c, x_mod);
         x_qkv                    = std::get<0>(x_qkv_intermediates);
         x_qkv2                   = std::get<1>(x_qkv_intermediates);
         x_intermediates          = std::get<2>(x_qkv_intermediates);
     } else {
-        auto x_qkv_intermediates = x_block->pre_attention(ctx, x, c);
+        auto x_qkv_intermediates = x_block->pre_attention(ctx, x, c, x_mod);
         x_qkv                    = x_qkv_intermediates.first;
         x_intermediates          = x_qkv_intermediates.second;
     }
@@ -659,14 +678,24 @@ public:
         blocks["x_block"]       = std::shared_ptr<GGMLBlock>(new DismantledBlock(hidden_size, num_heads, mlp_ratio, qk_norm, qkv_bias, false, self_attn_x));
     }
 
+    std::shared_ptr<DismantledBlock> context_block() const {
+        return std::dynamic_pointer_cast<DismantledBlock>(blocks.at("context_block"));
+    }
+
+    std::shared_ptr<DismantledBlock> x_block() const {
+        return std::dynamic_pointer_cast<DismantledBlock>(blocks.at("x_block"));
+    }
+
     std::pair<ggml_tensor*, ggml_tensor*> forward(GGMLRunnerContext* ctx,
                                                   ggml_tensor* context,
                                                   ggml_tensor* x,
-                                                  ggml_tensor* c) {
+                                                  ggml_tensor* c,
+                                                  ggml_tensor* context_mod = nullptr,
+                                                  ggml_tensor* x_mod       = nullptr) {
         auto context_block = std::dynamic_pointer_cast<DismantledBlock>(blocks["context_block"]);
         auto x_block       = std::dynamic_pointer_cast<DismantledBlock>(blocks["x_block"]);
 
-        return block_mixing(ctx, context, x, c, context_block, x_block);
+        return block_mixing(ctx, context, x, c, context_block, x_block, context_mod, x_mod);
     }
 };
 
@@ -682,17 +711,26 @@ public:
         blocks["adaLN_modulation.1"] = std::shared_ptr<GGMLBlock>(new Linear(hidden_size, 2 * hidden_size));
     }
 
+    // the modulation before it is split, [N, 2 * hidden_size]
+    ggml_tensor* project_modulation(GGMLRunnerContext* ctx, ggml_tensor* c) {
+        auto adaLN_modulation_1 = std::dynamic_pointer_cast<Linear>(blocks["adaLN_modulation.1"]);
+        return adaLN_modulation_1->forward(ctx, ggml_silu(ctx->ggml_ctx, c));
+    }
+
     ggml_tensor* forward(GGMLRunnerContext* ctx,
                          ggml_tensor* x,
-                         ggml_tensor* c) {
+                         ggml_tensor* c,
+                         ggml_tensor* m = nullptr) {
         // x: [N, n_token, hidden_size]
         // c: [N, hidden_size]
+        // m: nullptr, or project_modulation(c) from a ModulationCache row
         // return: [N, n_token, patch_size * patch_size * out_channels]
-        auto norm_final         = std::dynamic_pointer_cast<LayerNorm>(blocks["norm_final"]);
-        auto linear             = std::dynamic_pointer_cast<Linear>(blocks["linear"]);
-        auto adaLN_modulation_1 = std::dynamic_pointer_cast<Linear>(blocks["adaLN_modulation.1"]);
+        auto norm_final = std::dynamic_pointer_cast<LayerNorm>(blocks["norm_final"]);
+        auto linear     = std::dynamic_pointer_cast<Linear>(blocks["linear"]);
 
-        auto m     = adaLN_modulation_1->forward(ctx, ggml_silu(ctx->ggml_ctx, c));  // [N, 2 * hidden_size]
+        if (m == nullptr) {
+            m = project_modulation(ctx, c);  // [N, 2 * hidden_size]
+        }
         auto m_vec = ggml_ext_chunk(ctx->ggml_ctx, m, 2, 0);
         auto shift = m_vec[0];  // [N, hidden_size]
         auto scale = m_vec[1];  // [N, hidden_size]
@@ -795,18 +833,107 @@ public:
         return spatial_pos_embed;
     }
 
+    // floats in a ModulationCache row: the context and x block modulation
+    // of every joint block, then the final layer's
+    int64_t modulation_row_size() const {
+        int64_t size = 2;
+        for (int i = 0; i < config.depth; i++) {
+            auto block = std::dynamic_pointer_cast<JointBlock>(blocks.at("joint_blocks." + std::to_string(i)));
+            size += block->context_block()->modulation_count() + block->x_block()->modulation_count();
+        }
+        return size * config.hidden_size;
+    }
+
+    ggml_tensor* embed_conditioning(GGMLRunnerContext* ctx, ggml_tensor* t, ggml_tensor* y) {
+        auto t_embedder = std::dynamic_pointer_cast<TimestepEmbedder>(blocks["t_embedder"]);
+
+        auto c = t_embedder->forward(ctx, t);  // [N, hidden_size]
+        if (y != nullptr && config.adm_in_channels != -1) {
+            auto y_embedder = std::dynamic_pointer_cast<VectorEmbedder>(blocks["y_embedder"]);
+
+            y = y_embedder->forward(ctx, y);  // [N, hidden_size]
+            c = ggml_add(ctx->ggml_ctx, c, y);
+        }
+        return c;
+    }
+
+    // ModulationCache rows of every timestep, [N, modulation_row_size()];
+    // y is one pooled text vector shared by all of them
+    ggml_tensor* forward_modulation(GGMLRunnerContext* ctx, ggml_tensor* t, ggml_tensor* y) {
+        auto final_layer = std::dynamic_pointer_cast<FinalLayer>(blocks["final_layer"]);
+
+        auto c = embed_conditioning(ctx, t, y);  // [N, hidden_size]
+
+        std::vector<ggml_tensor*> parts;
+        for (int i = 0; i < config.depth; i++) {
+            auto block = std::dynamic_pointer_cast<JointBlock>(blocks["joint_blocks." + std::to_string(i)]);
+            parts.push_back(block->context_block()->project_modulation(ctx, c));
+            parts.push_back(block->x_block()->project_modulation(ctx, c));
+        }
+        parts.push_back(final_layer->project_modulation(ctx, c));
+        return ModulationCache::concat_rows(ctx->ggml_ctx, std::move(parts));
+    }
+
+    // the next n_mods modulations of a ModulationCache row, [1, n_mods * hidden_size]
+    ggml_tensor* modulation_from_row(GGMLRunnerContext* ctx, ggml_tensor* row, int64_t* offset, int64_t n_mods) {
+        const int64_t size   = n_mods * config.hidden_size;
+        const size_t element = ggml_element_size(row);
+        auto m               = ggml_view_2d(ctx->ggml_ctx, row, size, 1, size * element, *offset * element);
+        *offset += size;
+        return m;
+    }
+
     ggml_tensor* forward_core_with_concat(GGMLRunnerContext* ctx,
                                           ggml_tensor* x,
                                           ggml_tensor* c_mod,
                                           ggml_tensor* context,
-                                          std::vector<int> skip_layers = std::vector<int>()) {
+                                          std::vector<int> skip_layers          = std::vector<int>(),
+                                          const SkipLayerPrefixPlan* slg_prefix = nullptr,
+                                          ggml_tensor* modulation_row           = nullptr) {
         // x: [N, H*W, hidden_size]
         // context: [N, n_context, d_context]
-        // c: [N, hidden_size]
+        // c: [N, hidden_size], nullptr with modulation_row
+        // modulation_row: nullptr, or this step's ModulationCache row, [modulation_row_size()]
         // return: [N, N*W, patch_size * patch_size * out_channels]
         auto final_layer = std::dynamic_pointer_cast<FinalLayer>(blocks["final_layer"]);
 
-        for (int i = 0; i < config.depth; i++) {
+        // per block, when they come from a ModulationCache row
+        std::vector<std::pair<ggml_tensor*, ggml_tensor*>> row_mods(config.depth, {nullptr, nullptr});
+        ggml_tensor* final_mod = nullptr;
+        if (modulation_row != nullptr) {
+            int64_t offset = 0;
+            for (int i = 0; i < config.depth; i++) {
+                auto block       = std::dynamic_pointer_cast<JointBlock>(blocks["joint_blocks." + std::to_string(i)]);
+                auto context_mod = modulation_from_row(ctx, modulation_row, &offset, block->context_block()->modulation_count());
+                auto x_mod       = modulation_from_row(ctx, modulation_row, &offset, block->x_block()->modulation_count());
+                row_mods[i]      = {context_mod, x_mod};
+            }
+            final_mod = modulation_from_row(ctx, modulation_row, &offset, 2);
+        }
+
+        int slg_first_layer = -1;
+        if (slg_prefix != nullptr && context != nullptr &&
+            slg_prefix->first_layer > 0 && slg_prefix->first_layer < config.depth &&
+            (slg_prefix->pass == SkipLayerPrefixPlan::RESUME || skip_layers.empty())) {
+            slg_first_layer = slg_prefix->first_layer;
+        }
+        int first_block = 0;
+        if (slg_first_layer >= 0 && slg_prefix->pass == SkipLayerPrefixPlan::RESUME) {
+            ggml_tensor* cached_x       = ctx->load_cache_tensor("mmdit.slg_prefix.x");
+            ggml_tensor* cached_context = ctx->load_cache_tensor("mmdit.slg_prefix.context");
+            if (cached_x != nullptr && cached_context != nullptr &&
+                ggml_are_same_shape(cached_x, x) && ggml_are_same_shape(cached_context, context)) {
+                x           = cached_x;
+                context     = cached_context;
+                first_block = slg_first_layer;
+            }
+        }
+
+        for (int i = first_block; i < config.depth; i++) {
+            if (slg_first_layer >= 0 && slg_prefix->pass == SkipLayerPrefixPlan::RECORD && i == slg_first_layer) {
+                ctx->persist_cache_tensor("mmdit.slg_prefix.x", ggml_cont(ctx->ggml_ctx, x));
+                ctx->persist_cache_tensor("mmdit.slg_prefix.context", ggml_cont(ctx->ggml_ctx, context));
+            }
             // skip iteration if i is in skip_layers
             if (skip_layers.size() > 0 && std::find(skip_layers.begin(), skip_layers.end(), i) != skip_layers.end()) {
                 continue;
@@ -814,14 +941,14 @@ public:
 
             auto block = std::dynamic_pointer_cast<JointBlock>(blocks["joint_blocks." + std::to_string(i)]);
 
-            auto context_x = block->forward(ctx, context, x, c_mod);
+            auto context_x = block->forward(ctx, context, x, c_mod, row_mods[i].first, row_mods[i].second);
             context        = context_x.first;
             x              = context_x.second;
             sd::ggml_graph_cut::mark_graph_cut(context, "mmdit.joint_blocks." + std::to_string(i), "context");
             sd::ggml_graph_cut::mark_graph_cut(x, "mmdit.joint_blocks." + std::to_string(i), "x");
         }
 
-        x = final_layer->forward(ctx, x, c_mod);  // (N, T, patch_size ** 2 * out_channels)
+        x = final_layer->forward(ctx, x, c_mod, final_mod);  // (N, T, patch_size ** 2 * out_channels)
 
         return x;
     }
@@ -829,17 +956,19 @@ public:
     ggml_tensor* forward(GGMLRunnerContext* ctx,
                          ggml_tensor* x,
                          ggml_tensor* t,
-                         ggml_tensor* y               = nullptr,
-                         ggml_tensor* context         = nullptr,
-                         std::vector<int> skip_layers = std::vector<int>()) {
+                         ggml_tensor* y                        = nullptr,
+                         ggml_tensor* context                  = nullptr,
+                         std::vector<int> skip_layers          = std::vector<int>(),
+                         const SkipLayerPrefixPlan* slg_prefix = nullptr,
+                         ggml_tensor* modulation_row           = nullptr) {
         // Forward pass of DiT.
         // x: (N, C, H, W) tensor of spatial inputs (images or latent representations of images)
         // t: (N,) tensor of diffusion timesteps
         // y: (N, adm_in_channels) tensor of class labels
         // context: (N, L, D)
+        // modulation_row: nullptr, or this step's ModulationCache row, [modulation_row_size()]
         // return: (N, C, H, W)
         auto x_embedder = std::dynamic_pointer_cast<PatchEmbed>(blocks["x_embedder"]);
-        auto t_embedder = std::dynamic_pointer_cast<TimestepEmbedder>(blocks["t_embedder"]);
 
         int64_t W = x->ne[0];
         int64_t H = x->ne[1];
@@ -848,12 +977,10 @@ public:
         auto pos_embed   = cropped_pos_embed(ctx->ggml_ctx, H, W);           // [1, H*W, hidden_size]
         x                = ggml_add(ctx->ggml_ctx, patch_embed, pos_embed);  // [N, H*W, hidden_size]
 
-        auto c = t_embedder->forward(ctx, t);  // [N, hidden_size]
-        if (y != nullptr && config.adm_in_channels != -1) {
-            auto y_embedder = std::dynamic_pointer_cast<VectorEmbedder>(blocks["y_embedder"]);
-
-            y = y_embedder->forward(ctx, y);  // [N, hidden_size]
-            c = ggml_add(ctx->ggml_ctx, c, y);
+        // the blocks only read c through their modulation
+        ggml_tensor* c = nullptr;
+        if (modulation_row == nullptr) {
+            c = embed_conditioning(ctx, t, y);  // [N, hidden_size]
         }
 
         if (context != nullptr) {
@@ -862,12 +989,14 @@ public:
             context = context_embedder->forward(ctx, context);  // [N, L, D] aka [N, L, 1536]
         }
         sd::ggml_graph_cut::mark_graph_cut(x, "mmdit.prelude", "x");
-        sd::ggml_graph_cut::mark_graph_cut(c, "mmdit.prelude", "c");
+        if (c != nullptr) {
+            sd::ggml_graph_cut::mark_graph_cut(c, "mmdit.prelude", "c");
+        }
         if (context != nullptr) {
             sd::ggml_graph_cut::mark_graph_cut(context, "mmdit.prelude", "context");
         }
 
-        x = forward_core_with_concat(ctx, x, c, context, skip_layers);  // (N, H*W, patch_size ** 2 * out_channels)
+        x = forward_core_with_concat(ctx, x, c, context, skip_layers, slg_prefix, modulation_row);  // (N, H*W, patch_size ** 2 * out_channels)
 
         x = DiT::unpatchify_and_crop(ctx->ggml_ctx, x, H, W, config.patch_size, config.patch_size, /*patch_last*/ false);  // [N, C, H, W]
 
@@ -892,21 +1021,28 @@ struct MMDiTRunner : public DiffusionModelRunner {
         return "mmdit";
     }
 
+    bool supports_batched_conditions() const override {
+        return true;
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors, const std::string& prefix) override {
         mmdit.get_param_tensors(tensors, prefix);
     }
 
     ggml_cgraph* build_graph(const sd::Tensor<float>& x_tensor,
                              const sd::Tensor<float>& timesteps_tensor,
-                             const sd::Tensor<float>& context_tensor = {},
-                             const sd::Tensor<float>& y_tensor       = {},
-                             std::vector<int> skip_layers            = std::vector<int>()) {
+                             const sd::Tensor<float>& context_tensor        = {},
+                             const sd::Tensor<float>& y_tensor              = {},
+                             std::vector<int> skip_layers                   = std::vector<int>(),
+                             const SkipLayerPrefixPlan* slg_prefix          = nullptr,
+                             const sd::Tensor<float>& modulation_row_tensor = {}) {
         ggml_cgraph* gf = new_graph_custom(MMDIT_GRAPH_SIZE);
 
-        ggml_tensor* x         = make_input(x_tensor);
-        ggml_tensor* timesteps = make_input(timesteps_tensor);
-        ggml_tensor* context   = make_optional_input(context_tensor);
-        ggml_tensor* y         = make_optional_input(y_tensor);
+        ggml_tensor* x              = make_input(x_tensor);
+        ggml_tensor* timesteps      = make_input(timesteps_tensor);
+        ggml_tensor* context        = make_optional_input(context_tensor);
+        ggml_tensor* y              = make_optional_input(y_tensor);
+        ggml_tensor* modulation_row = make_optional_input(modulation_row_tensor);
 
         auto runner_ctx  = get_context();
         ggml_tensor* out = mmdit.forward(&runner_ctx,
@@ -914,7 +1050,9 @@ struct MMDiTRunner : public DiffusionModelRunner {
                                          timesteps,
                                          y,
                                          context,
-                                         skip_layers);
+                                         skip_layers,
+                                         slg_prefix,
+                                         modulation_row);
 
         ggml_build_forward_expand(gf, out);
 
@@ -924,32 +1062,93 @@ struct MMDiTRunner : public DiffusionModelRunner {
     sd::Tensor<float> compute(int n_threads,
                               const sd::Tensor<float>& x,
                               const sd::Tensor<float>& timesteps,
-                              const sd::Tensor<float>& context = {},
-                              const sd::Tensor<float>& y       = {},
-                              std::vector<int> skip_layers     = std::vector<int>()) {
+                              const sd::Tensor<float>& context        = {},
+                              const sd::Tensor<float>& y              = {},
+                              std::vector<int> skip_layers            = std::vector<int>(),
+                              const SkipLayerPrefixPlan* slg_prefix   = nullptr,
+                              const sd::Tensor<float>& modulation_row = {}) {
         // x: [N, in_channels, h, w]
         // timesteps: [N, ]
         // context: [N, max_position, hidden_size]([N, 154, 4096]) or [1, max_position, hidden_size]
         // y: [N, adm_in_channels] or [1, adm_in_channels]
         auto get_graph = [&]() -> ggml_cgraph* {
-            return build_graph(x, timesteps, context, y, skip_layers);
+            return build_graph(x, timesteps, context, y, skip_layers, slg_prefix, modulation_row);
         };
 
         return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
     }
 
+    // Rows of a new ModulationCache group, one per listed timestep, in one
+    // graph; empty on failure.
+    sd::Tensor<float> compute_modulation_rows(int n_threads,
+                                              const std::vector<float>& timesteps,
+                                              const sd::Tensor<float>& y) {
+        sd::Tensor<float> timesteps_tensor({static_cast<int64_t>(timesteps.size())}, timesteps);
+        auto get_graph = [&]() -> ggml_cgraph* {
+            ggml_cgraph* gf  = new_graph_custom(MMDIT_GRAPH_SIZE);
+            auto runner_ctx  = get_context();
+            ggml_tensor* out = mmdit.forward_modulation(&runner_ctx,
+                                                        make_input(timesteps_tensor),
+                                                        make_optional_input(y));
+            ggml_build_forward_expand(gf, out);
+            return gf;
+        };
+        return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false));
+    }
+
+    // This step's ModulationCache row, after computing the rows of its
+    // group when the group is new; empty when the step graph computes its
+    // own modulation. The groups are keyed by the pooled text vector.
+    sd::Tensor<float> modulation_row_for(int n_threads,
+                                         ModulationCache* cache,
+                                         const sd::Tensor<float>& x,
+                                         const sd::Tensor<float>& timesteps,
+                                         const sd::Tensor<float>& y) {
+        if (timesteps.numel() != 1 || (x.dim() >= 4 && x.shape()[3] != 1)) {
+            return {};
+        }
+        sd::Tensor<float> pooled;
+        if (config.adm_in_channels != -1) {
+            if (y.numel() != config.adm_in_channels) {
+                return {};
+            }
+            pooled = y;
+        }
+        return cache->row_for(timesteps.data()[0], 0.0f, pooled, mmdit.modulation_row_size(), [&](const std::vector<float>& row_timesteps) {
+            return compute_modulation_rows(n_threads, row_timesteps, pooled);
+        });
+    }
+
     sd::Tensor<float> compute(int n_threads,
                               const DiffusionParams& diffusion_params) override {
         GGML_ASSERT(diffusion_params.x != nullptr);
         GGML_ASSERT(diffusion_params.timesteps != nullptr);
         const auto* extra = diffusion_extra_as<SkipLayerDiffusionExtra>(diffusion_params);
         static const std::vector<int> empty_skip_layers;
+        const SkipLayerPrefixPlan* slg_prefix = extra->slg_prefix;
+        if (slg_prefix != nullptr && can_attempt_graph_cut_segmented_compute()) {
+            // segmented compute drops cache tensors, and with them the prefix
+            slg_prefix = nullptr;
+        }
+        if (slg_prefix != nullptr && slg_prefix->pass == SkipLayerPrefixPlan::RECORD) {
+            free_cache_ctx_and_buffer();
+        }
+        sd::Tensor<float> modulation_row;
+        if (extra->modulation_cache != nullptr) {
+            modulation_row = modulation_row_for(n_threads,
+                                                extra->modulation_cache,
+                                                *diffusion_params.x,
+                                                *diffusion_params.timesteps,
+                                                tensor_or_empty(diffusion_params.y));
+        }
         return compute(n_threads,
                        *diffusion_params.x,
                        *diffusion_params.timesteps,
                        tensor_or_empty(diffusion_params.context),
                        tensor_or_empty(diffusion_params.y),
-                       extra->skip_layers ? *extra->skip_layers : empty_skip_layers);
+                       extra->skip_layers ? *extra->skip_layers : empty_skip_layers,
+                       slg_prefix,
+                       modulation_row);
     }
 
     void test() {
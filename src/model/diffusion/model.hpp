@@ -1,9 +1,12 @@
 ﻿#ifndef __SD_MODEL_DIFFUSION_MODEL_HPP__
 #define __SD_MODEL_DIFFUSION_MODEL_HPP__
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include "core/ggml_extend.hpp"
 #include "core/tensor_ggml.hpp"
@@ -13,17 +16,235 @@ struct UNetDiffusionExtra {
     int num_video_frames                           = -1;
     const std::vector<sd::Tensor<float>>* controls = nullptr;
     float control_strength                         = 0.f;
+    int token_merge                                = 1;  // see merge_attention_tokens
+    int token_merge_max_downsample                 = 1;
 };
 
+// Per-call part of starting the skip-layer guidance pass from the cond pass.
+// Every layer before the first skipped one sees the same input in both
+// passes, so RECORD caches the hidden state entering first_layer on the cond
+// pass and RESUME starts the skip-layer pass from it instead of running the
+// prefix again. A cache that does not match the graph falls back to the full
+// forward.
+struct SkipLayerPrefixPlan {
+    enum Pass {
+        RECORD,
+        RESUME,
+    };
+    Pass pass       = RECORD;
+    int first_layer = -1;
+};
+
+struct ModulationCache;
+
 struct SkipLayerDiffusionExtra {
-    const std::vector<int>* skip_layers = nullptr;
+    const std::vector<int>* skip_layers   = nullptr;
+    const SkipLayerPrefixPlan* slg_prefix = nullptr;
+    ModulationCache* modulation_cache     = nullptr;
+};
+
+// Per-call part of reusing cond-pass double-block residuals in the uncond
+// pass, see CfgBlockReuseState. RECORD runs on the cond pass and caches the
+// image residual of each listed block; MEASURE runs the uncond pass in full
+// and fills stats with the |r_uncond - r_cond| and |r_cond| sums of each
+// block (zeros when unmeasured); REUSE adds the cached cond residual in place
+// of the listed blocks. An empty block list means every block.
+struct CfgBlockReusePlan {
+    enum Pass {
+        RECORD,
+        MEASURE,
+        REUSE,
+    };
+    Pass pass = RECORD;
+    std::vector<bool> blocks;
+    std::vector<float>* stats = nullptr;
+
+    bool applies_to(int block) const {
+        return blocks.empty() || (block < static_cast<int>(blocks.size()) && blocks[block]);
+    }
+};
+
+// Image tokens an inpainting pass has to compute. The sampler keeps the
+// latent outside the denoise mask, so a DiT can leave the tokens far from it
+// out of the sequence: a token is kept when any latent pixel of its patch,
+// or of a patch within border tokens of it, has mask weight. Dropped tokens
+// get a kept token's output, which the mask then discards. mask is the
+// denoise mask at latent resolution, [W, H(, 1, 1)].
+struct MaskedTokenPlan {
+    const sd::Tensor<float>* mask = nullptr;
+    int border                    = 0;
+    float max_kept_ratio          = 0.75f;  // above it the full sequence is computed
+
+    // kept: ascending token indices; scatter: per image token, its row in
+    // kept, or 0 when dropped. False when the mask does not match or would
+    // not drop enough tokens to pay off.
+    bool build(int64_t W, int64_t H, int patch_size, std::vector<int32_t>* kept, std::vector<int32_t>* scatter) const {
+        if (mask == nullptr || mask->dim() < 2 || mask->shape()[0] != W || mask->shape()[1] != H ||
+            mask->numel() != W * H || patch_size <= 0) {
+            return false;
+        }
+        const int64_t w = (W + patch_size - 1) / patch_size;
+        const int64_t h = (H + patch_size - 1) / patch_size;
+        std::vector<uint8_t> active(static_cast<size_t>(w * h), 0);
+        const float* data = mask->data();
+        for (int64_t y = 0; y < H; y++) {
+            for (int64_t x = 0; x < W; x++) {
+                if (data[y * W + x] > 0.0f) {
+                    active[(y / patch_size) * w + x / patch_size] = 1;
+                }
+            }
+        }
+        // separable square dilation by border tokens
+        std::vector<uint8_t> rows(active.size(), 0);
+        for (int64_t y = 0; y < h; y++) {
+            for (int64_t x = 0; x < w; x++) {
+                for (int64_t dx = std::max<int64_t>(0, x - border); dx <= std::min<int64_t>(w - 1, x + border) && !rows[y * w + x]; dx++) {
+                    rows[y * w + x] = active[y * w + dx];
+                }
+            }
+        }
+        kept->clear();
+        scatter->assign(active.size(), 0);
+        for (int64_t y = 0; y < h; y++) {
+            for (int64_t x = 0; x < w; x++) {
+                bool keep = false;
+                for (int64_t dy = std::max<int64_t>(0, y - border); dy <= std::min<int64_t>(h - 1, y + border) && !keep; dy++) {
+                    keep = rows[dy * w + x] != 0;
+                }
+                if (keep) {
+                    (*scatter)[y * w + x] = static_cast<int32_t>(kept->size());
+                    kept->push_back(static_cast<int32_t>(y * w + x));
+                }
+            }
+        }
+        return !kept->empty() && static_cast<float>(kept->size()) <= max_kept_ratio * static_cast<float>(active.size());
+    }
+};
+
+// Block modulation of an adaLN DiT (Flux, Qwen-Image, MMDiT) for every
+// timestep of one sampling run. It only depends on the timestep, the
+// guidance and the pooled text vector, all known before sampling, so the first step of a (guidance,
+// pooled text) group computes the rows of every listed timestep in one
+// batched graph, and later steps read their row instead of running the
+// modulation matmuls. Timesteps not listed, and groups past MAX_GROUPS,
+// compute modulation in the step graph. The cache lives for one sampling
+// run, so the weights do not change under it.
+struct ModulationCache {
+    static constexpr size_t MAX_GROUPS = 4;
+
+    struct Group {
+        float guidance = 0.0f;
+        std::vector<float> y;
+        sd::Tensor<float> rows;  // [row size, timesteps]; empty when the precompute failed
+    };
+
+    std::vector<float> timesteps;
+    std::vector<Group> groups;
+
+    int row_of(float timestep) const {
+        auto it = std::find(timesteps.begin(), timesteps.end(), timestep);
+        return it == timesteps.end() ? -1 : static_cast<int>(it - timesteps.begin());
+    }
+
+    // created is set when the group is new and its rows still have to be
+    // computed; nullptr when the cache is full
+    Group* group_for(float guidance, const sd::Tensor<float>& y, bool* created) {
+        *created = false;
+        for (Group& group : groups) {
+            if (group.guidance == guidance && group.y.size() == static_cast<size_t>(y.numel()) &&
+                std::equal(group.y.begin(), group.y.end(), y.data())) {
+                return &group;
+            }
+        }
+        if (groups.size() >= MAX_GROUPS) {
+            return nullptr;
+        }
+        Group group;
+        group.guidance = guidance;
+        group.y.assign(y.data(), y.data() + y.numel());
+        groups.push_back(std::move(group));
+        *created = true;
+        return &groups.back();
+    }
+
+    // This step's row, [row_size], after computing the rows of its group
+    // with compute_rows(timesteps) when the group is new; empty when the
+    // step graph computes its own modulation.
+    template <typename ComputeRows>
+    sd::Tensor<float> row_for(float timestep,
+                              float guidance,
+                              const sd::Tensor<float>& y,
+                              int64_t row_size,
+                              ComputeRows&& compute_rows) {
+        int row = row_of(timestep);
+        if (row < 0) {
+            return {};
+        }
+        bool created = false;
+        Group* group = group_for(guidance, y, &created);
+        if (group == nullptr) {
+            return {};
+        }
+        if (created) {
+            int64_t start = ggml_time_ms();
+            group->rows   = compute_rows(timesteps);
+            LOG_DEBUG("modulation of %zu timesteps precomputed in %" PRId64 " ms", timesteps.size(), ggml_time_ms() - start);
+        }
+        if (group->rows.numel() != row_size * static_cast<int64_t>(timesteps.size())) {
+            return {};
+        }
+        const float* data = group->rows.data() + static_cast<int64_t>(row) * row_size;
+        return sd::Tensor<float>({row_size}, std::vector<float>(data, data + row_size));
+    }
+
+    // the concatenation of parts along dim 0, pairwise, so each level
+    // copies the rows once
+    static ggml_tensor* concat_rows(ggml_context* ctx, std::vector<ggml_tensor*> parts) {
+        while (parts.size() > 1) {
+            std::vector<ggml_tensor*> merged;
+            for (size_t i = 0; i + 1 < parts.size(); i += 2) {
+                merged.push_back(ggml_concat(ctx, parts[i], parts[i + 1], 0));
+            }
+            if (parts.size() % 2 == 1) {
+                merged.push_back(parts.back());
+            }
+            parts = std::move(merged);
+        }
+        return parts[0];
+    }
+};
+
+// Per-call part of reusing the keys and values of reference image tokens
+// across sampling steps. The reference tokens are fixed, so their keys and
+// values only drift with the timestep modulation and the noisy image tokens
+// they attend to. RECORD runs the full sequence and caches the roped keys and
+// the values of the reference tokens of every block; REUSE leaves the
+// reference tokens out of the sequence and lets the image and text tokens
+// attend to the cached ones. slot keeps one cache per condition, the
+// reference tokens attend to its text.
+struct RefKVCachePlan {
+    enum Pass {
+        RECORD,
+        REUSE,
+    };
+    Pass pass = RECORD;
+    int slot  = 0;
 };
 
 struct FluxDiffusionExtra {
-    const sd::Tensor<float>* guidance   = nullptr;
-    const std::vector<int>* skip_layers = nullptr;
-    const sd::Tensor<float>* pulid_id   = nullptr;
-    float pulid_id_weight               = 1.0f;
+    const sd::Tensor<float>* guidance     = nullptr;
+    const std::vector<int>* skip_layers   = nullptr;
+    const sd::Tensor<float>* pulid_id     = nullptr;
+    float pulid_id_weight                 = 1.0f;
+    const CfgBlockReusePlan* cfg_reuse    = nullptr;
+    const SkipLayerPrefixPlan* slg_prefix = nullptr;
+    const MaskedTokenPlan* masked_tokens  = nullptr;
+    ModulationCache* modulation_cache     = nullptr;
+    const RefKVCachePlan* ref_kv          = nullptr;
+};
+
+struct QwenImageDiffusionExtra {
+    ModulationCache* modulation_cache = nullptr;
 };
 
 struct AnimaDiffusionExtra {
@@ -34,6 +255,7 @@ struct AnimaDiffusionExtra {
 struct WanDiffusionExtra {
     const sd::Tensor<float>* vace_context = nullptr;
     float vace_strength                   = 1.f;
+    int attention_window                  = 0;  // latent frames, see ggml_ext_window_attention
 };
 
 struct HiDreamO1DiffusionExtra {
@@ -50,12 +272,14 @@ struct LTXAVDiffusionExtra {
     int audio_length                         = 0;
     float frame_rate                         = 24.f;
     const sd::Tensor<float>* video_positions = nullptr;
+    int attention_window                     = 0;  // latent frames, see ggml_ext_window_attention
 };
 
 using DiffusionExtraParams = std::variant<std::monostate,
                                           UNetDiffusionExtra,
                                           SkipLayerDiffusionExtra,
                                           FluxDiffusionExtra,
+                                          QwenImageDiffusionExtra,
                                           AnimaDiffusionExtra,
                                           WanDiffusionExtra,
                                           HiDreamO1DiffusionExtra,
@@ -69,6 +293,7 @@ struct DiffusionParams {
     const sd::Tensor<float>* y                        = nullptr;
     const std::vector<sd::Tensor<float>>* ref_latents = nullptr;
     bool increase_ref_index                           = false;
+    float ref_position_scale                          = 1.f;  // above 1 for refs encoded below their resolution, see ref_scale
     DiffusionExtraParams extra                        = std::monostate{};
 };
 
@@ -99,6 +324,12 @@ public:
     virtual sd::Tensor<float> compute(int n_threads,
                                       const DiffusionParams& diffusion_params) = 0;
 
+    // Whether x/timesteps/context/y may carry several independent conditions stacked
+    // along the batch dim, so cond/uncond can share a single forward pass.
+    virtual bool supports_batched_conditions() const {
+        return false;
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors) {
         get_param_tensors(tensors, prefix);
     }
@@ -294,15 +294,27 @@ namespace Qwen {
             return mod_results;
         }
 
+        // the img and txt modulation before it is split, [N, 6*hidden_size] each
+        std::pair<ggml_tensor*, ggml_tensor*> project_modulation(GGMLRunnerContext* ctx, ggml_tensor* t_emb) {
+            auto img_mod_1 = std::dynamic_pointer_cast<Linear>(blocks["img_mod.1"]);
+            auto txt_mod_1 = std::dynamic_pointer_cast<Linear>(blocks["txt_mod.1"]);
+
+            auto t_act = ggml_silu(ctx->ggml_ctx, t_emb);
+            return {img_mod_1->forward(ctx, t_act), txt_mod_1->forward(ctx, t_act)};
+        }
+
         virtual std::pair<ggml_tensor*, ggml_tensor*> forward(GGMLRunnerContext* ctx,
                                                               ggml_tensor* img,
                                                               ggml_tensor* txt,
                                                               ggml_tensor* t_emb,
                                                               ggml_tensor* pe,
-                                                              ggml_tensor* modulate_index = nullptr) {
+                                                              ggml_tensor* modulate_index = nullptr,
+                                                              ggml_tensor* img_mod_params = nullptr,
+                                                              ggml_tensor* txt_mod_params = nullptr) {
             // img: [N, n_img_token, hidden_size]
             // txt: [N, n_txt_token, hidden_size]
             // pe: [n_img_token + n_txt_token, d_head/2, 2, 2]
+            // img_mod_params, txt_mod_params: nullptr, or this block's modulation from a ModulationCache row, [1, 6*hidden_size]
             // return: ([N, n_img_token, hidden_size], [N, n_txt_token, hidden_size])
 
             auto img_mod_1 = std::dynamic_pointer_cast<Linear>(blocks["img_mod.1"]);
@@ -317,16 +329,19 @@ namespace Qwen {
 
             auto attn = std::dynamic_pointer_cast<QwenImageAttention>(blocks["attn"]);
 
-            auto img_mod_params    = ggml_silu(ctx->ggml_ctx, t_emb);
-            img_mod_params         = img_mod_1->forward(ctx, img_mod_params);
+            if (img_mod_params == nullptr) {
+                img_mod_params = ggml_silu(ctx->ggml_ctx, t_emb);
+                img_mod_params = img_mod_1->forward(ctx, img_mod_params);
+            }
             auto img_mod_param_vec = get_mod_params_vec(ctx->ggml_ctx, img_mod_params, modulate_index);
 
-            if (zero_cond_t) {
-                t_emb = ggml_ext_chunk(ctx->ggml_ctx, t_emb, 2, 1)[0];
+            if (txt_mod_params == nullptr) {
+                if (zero_cond_t) {
+                    t_emb = ggml_ext_chunk(ctx->ggml_ctx, t_emb, 2, 1)[0];
+                }
+                txt_mod_params = ggml_silu(ctx->ggml_ctx, t_emb);
+                txt_mod_params = txt_mod_1->forward(ctx, txt_mod_params);
             }
-
-            auto txt_mod_params    = ggml_silu(ctx->ggml_ctx, t_emb);
-            txt_mod_params         = txt_mod_1->forward(ctx, txt_mod_params);
             auto txt_mod_param_vec = get_mod_params_vec(ctx->ggml_ctx, txt_mod_params);
 
             auto img_normed    = img_norm1->forward(ctx, img);
@@ -371,17 +386,26 @@ namespace Qwen {
             blocks["linear"] = std::shared_ptr<GGMLBlock>(new Linear(conditioning_embedding_dim, embedding_dim * 2, bias));
         }
 
+        // the scale and shift before they are split, [N, 2*embedding_dim]
+        ggml_tensor* project(GGMLRunnerContext* ctx, ggml_tensor* c) {
+            auto linear = std::dynamic_pointer_cast<Linear>(blocks["linear"]);
+            return linear->forward(ctx, ggml_silu(ctx->ggml_ctx, c));
+        }
+
         ggml_tensor* forward(GGMLRunnerContext* ctx,
                              ggml_tensor* x,
-                             ggml_tensor* c) {
+                             ggml_tensor* c,
+                             ggml_tensor* emb = nullptr) {
             // x: [N, n_token, hidden_size]
             // c: [N, hidden_size]
+            // emb: nullptr, or project(c) from a ModulationCache row, [1, 2*hidden_size]
             // return: [N, n_token, patch_size * patch_size * out_channels]
 
-            auto norm   = std::dynamic_pointer_cast<LayerNorm>(blocks["norm"]);
-            auto linear = std::dynamic_pointer_cast<Linear>(blocks["linear"]);
+            auto norm = std::dynamic_pointer_cast<LayerNorm>(blocks["norm"]);
 
-            auto emb   = linear->forward(ctx, ggml_silu(ctx->ggml_ctx, c));
+            if (emb == nullptr) {
+                emb = project(ctx, c);
+            }
             auto mods  = ggml_ext_chunk(ctx->ggml_ctx, emb, 2, 0);
             auto scale = mods[0];
             auto shift = mods[1];
@@ -421,12 +445,51 @@ namespace Qwen {
             blocks["proj_out"] = std::shared_ptr<GGMLBlock>(new Linear(inner_dim, config.patch_size * config.patch_size * config.out_channels));
         }
 
+        bool supports_modulation_cache() const {
+            // zero_cond_t mixes the modulation of t and of t = 0 per image token
+            return !config.zero_cond_t;
+        }
+
+        // floats in a ModulationCache row: the img and txt modulation of
+        // every block, then the scale and shift of norm_out
+        int64_t modulation_row_size() const {
+            int64_t inner_dim = config.num_attention_heads * config.attention_head_dim;
+            return (12 * static_cast<int64_t>(config.num_layers) + 2) * inner_dim;
+        }
+
+        // ModulationCache rows of every timestep, [N, modulation_row_size()]
+        ggml_tensor* forward_modulation(GGMLRunnerContext* ctx, ggml_tensor* timesteps) {
+            auto time_text_embed = std::dynamic_pointer_cast<QwenTimestepProjEmbeddings>(blocks["time_text_embed"]);
+            auto norm_out        = std::dynamic_pointer_cast<AdaLayerNormContinuous>(blocks["norm_out"]);
+
+            auto t_emb = time_text_embed->forward(ctx, timesteps);  // [N, inner_dim]
+
+            std::vector<ggml_tensor*> parts;
+            for (int i = 0; i < config.num_layers; i++) {
+                auto block   = std::dynamic_pointer_cast<QwenImageTransformerBlock>(blocks["transformer_blocks." + std::to_string(i)]);
+                auto img_txt = block->project_modulation(ctx, t_emb);
+                parts.push_back(img_txt.first);
+                parts.push_back(img_txt.second);
+            }
+            parts.push_back(norm_out->project(ctx, t_emb));
+            return ModulationCache::concat_rows(ctx->ggml_ctx, std::move(parts));
+        }
+
+        // the next size floats of a ModulationCache row, [1, size]
+        ggml_tensor* modulation_from_row(GGMLRunnerContext* ctx, ggml_tensor* row, int64_t* offset, int64_t size) {
+            const size_t element = ggml_element_size(row);
+            auto m               = ggml_view_2d(ctx->ggml_ctx, row, size, 1, size * element, *offset * element);
+            *offset += size;
+            return m;
+        }
+
         ggml_tensor* forward_orig(GGMLRunnerContext* ctx,
                                   ggml_tensor* x,
                                   ggml_tensor* timestep,
                                   ggml_tensor* context,
                                   ggml_tensor* pe,
-                                  ggml_tensor* modulate_index = nullptr) {
+                                  ggml_tensor* modulate_index = nullptr,
+                                  ggml_tensor* modulation_row = nullptr) {
             auto time_text_embed = std::dynamic_pointer_cast<QwenTimestepProjEmbeddings>(blocks["time_text_embed"]);
             auto txt_norm        = std::dynamic_pointer_cast<RMSNorm>(blocks["txt_norm"]);
             auto img_in          = std::dynamic_pointer_cast<Linear>(blocks["img_in"]);
@@ -434,10 +497,17 @@ namespace Qwen {
             auto norm_out        = std::dynamic_pointer_cast<AdaLayerNormContinuous>(blocks["norm_out"]);
             auto proj_out        = std::dynamic_pointer_cast<Linear>(blocks["proj_out"]);
 
-            auto t_emb = time_text_embed->forward(ctx, timestep);
-            if (config.zero_cond_t) {
-                auto t_emb_0 = time_text_embed->forward(ctx, ggml_ext_zeros_like(ctx->ggml_ctx, timestep));
-                t_emb        = ggml_concat(ctx->ggml_ctx, t_emb, t_emb_0, 1);
+            const int64_t inner_dim = config.num_attention_heads * config.attention_head_dim;
+            int64_t row_offset      = 0;
+
+            // the blocks and norm_out only read t_emb through their modulation
+            ggml_tensor* t_emb = nullptr;
+            if (modulation_row == nullptr) {
+                t_emb = time_text_embed->forward(ctx, timestep);
+                if (config.zero_cond_t) {
+                    auto t_emb_0 = time_text_embed->forward(ctx, ggml_ext_zeros_like(ctx->ggml_ctx, timestep));
+                    t_emb        = ggml_concat(ctx->ggml_ctx, t_emb, t_emb_0, 1);
+                }
             }
             auto img = img_in->forward(ctx, x);
             auto txt = txt_norm->forward(ctx, context);
@@ -449,18 +519,28 @@ namespace Qwen {
             for (int i = 0; i < config.num_layers; i++) {
                 auto block = std::dynamic_pointer_cast<QwenImageTransformerBlock>(blocks["transformer_blocks." + std::to_string(i)]);
 
-                auto result = block->forward(ctx, img, txt, t_emb, pe, modulate_index);
+                ggml_tensor* img_mod_params = nullptr;
+                ggml_tensor* txt_mod_params = nullptr;
+                if (modulation_row != nullptr) {
+                    img_mod_params = modulation_from_row(ctx, modulation_row, &row_offset, 6 * inner_dim);
+                    txt_mod_params = modulation_from_row(ctx, modulation_row, &row_offset, 6 * inner_dim);
+                }
+
+                auto result = block->forward(ctx, img, txt, t_emb, pe, modulate_index, img_mod_params, txt_mod_params);
                 img         = result.first;
                 txt         = result.second;
                 sd::ggml_graph_cut::mark_graph_cut(img, "qwen_image.transformer_blocks." + std::to_string(i), "img");
                 sd::ggml_graph_cut::mark_graph_cut(txt, "qwen_image.transformer_blocks." + std::to_string(i), "txt");
             }
 
-            if (config.zero_cond_t) {
-                t_emb = ggml_ext_chunk(ctx->ggml_ctx, t_emb, 2, 1)[0];
+            if (modulation_row != nullptr) {
+                img = norm_out->forward(ctx, img, nullptr, modulation_from_row(ctx, modulation_row, &row_offset, 2 * inner_dim));
+            } else {
+                if (config.zero_cond_t) {
+                    t_emb = ggml_ext_chunk(ctx->ggml_ctx, t_emb, 2, 1)[0];
+                }
+                img = norm_out->forward(ctx, img, t_emb);
             }
-
-            img = norm_out->forward(ctx, img, t_emb);
             img = proj_out->forward(ctx, img);
 
             return img;
@@ -472,7 +552,8 @@ namespace Qwen {
                              ggml_tensor* context,
                              ggml_tensor* pe,
                              std::vector<ggml_tensor*> ref_latents = {},
-                             ggml_tensor* modulate_index           = nullptr) {
+                             ggml_tensor* modulate_index           = nullptr,
+                             ggml_tensor* modulation_row           = nullptr) {
             // Forward pass of DiT.
             // x: [N, C, H, W]
             // timestep: [N,]
@@ -495,7 +576,7 @@ namespace Qwen {
                 }
             }
 
-            auto out = forward_orig(ctx, img, timestep, context, pe, modulate_index);  // [N, h_len*w_len, ph*pw*C]
+            auto out = forward_orig(ctx, img, timestep, context, pe, modulate_index, modulation_row);  // [N, h_len*w_len, ph*pw*C]
 
             if (out->ne[1] > img_tokens) {
                 out = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, out, 0, 2, 1, 3));  // [num_tokens, N, C * patch_size * patch_size]
@@ -513,7 +594,6 @@ namespace Qwen {
     public:
         QwenImageConfig config;
         QwenImageModel qwen_image;
-        std::vector<float> pe_vec;
         std::vector<float> modulate_index_vec;
         SDVersion version;
 
@@ -542,37 +622,45 @@ namespace Qwen {
                                  const sd::Tensor<float>& timesteps_tensor,
                                  const sd::Tensor<float>& context_tensor,
                                  const std::vector<sd::Tensor<float>>& ref_latents_tensor = {},
-                                 bool increase_ref_index                                  = false) {
+                                 bool increase_ref_index                                  = false,
+                                 float ref_position_scale                                 = 1.f,
+                                 const sd::Tensor<float>& modulation_row_tensor           = {}) {
             ggml_cgraph* gf        = new_graph_custom(QWEN_IMAGE_GRAPH_SIZE);
             ggml_tensor* x         = make_input(x_tensor);
             ggml_tensor* timesteps = make_input(timesteps_tensor);
             GGML_ASSERT(x->ne[3] == 1);
             GGML_ASSERT(!context_tensor.empty());
-            ggml_tensor* context = make_input(context_tensor);
+            ggml_tensor* context = make_constant_input(context_tensor);
             std::vector<ggml_tensor*> ref_latents;
             ref_latents.reserve(ref_latents_tensor.size());
             for (const auto& ref_latent_tensor : ref_latents_tensor) {
-                ref_latents.push_back(make_input(ref_latent_tensor));
+                ref_latents.push_back(make_constant_input(ref_latent_tensor));
             }
 
-            pe_vec      = Rope::gen_qwen_image_pe(static_cast<int>(x->ne[1]),
-                                                  static_cast<int>(x->ne[0]),
-                                                  config.patch_size,
-                                                  static_cast<int>(x->ne[3]),
-                                                  static_cast<int>(context->ne[1]),
-                                                  ref_latents,
-                                                  increase_ref_index,
-                                                  config.theta,
-                                                  circular_y_enabled,
-                                                  circular_x_enabled,
-                                                  config.axes_dim);
-            int pos_len = static_cast<int>(pe_vec.size() / config.axes_dim_sum / 2);
-            // LOG_DEBUG("pos_len %d", pos_len);
-            auto pe = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, 2, 2, config.axes_dim_sum / 2, pos_len);
-            // pe->data = pe_vec.data();
-            // print_ggml_tensor(pe, true, "pe");
-            // pe->data = nullptr;
-            set_backend_tensor_data(pe, pe_vec.data());
+            std::string pe_key = sd_format("%s:%" PRId64 ":%d%d%d:%g",
+                                           tensor_shape_key(x).c_str(),
+                                           context->ne[1],
+                                           increase_ref_index ? 1 : 0,
+                                           circular_y_enabled ? 1 : 0,
+                                           circular_x_enabled ? 1 : 0,
+                                           ref_position_scale);
+            for (ggml_tensor* ref_latent : ref_latents) {
+                pe_key += ":" + tensor_shape_key(ref_latent);
+            }
+            auto pe = make_positional_table(pe_key, 2, 2, config.axes_dim_sum / 2, [&]() {
+                return Rope::gen_qwen_image_pe(static_cast<int>(x->ne[1]),
+                                               static_cast<int>(x->ne[0]),
+                                               config.patch_size,
+                                               static_cast<int>(x->ne[3]),
+                                               static_cast<int>(context->ne[1]),
+                                               ref_latents,
+                                               increase_ref_index,
+                                               config.theta,
+                                               circular_y_enabled,
+                                               circular_x_enabled,
+                                               config.axes_dim,
+                                               ref_position_scale);
+            });
 
             ggml_tensor* modulate_index = nullptr;
             if (config.zero_cond_t) {
@@ -599,6 +687,8 @@ namespace Qwen {
                 set_backend_tensor_data(modulate_index, modulate_index_vec.data());
             }
 
+            ggml_tensor* modulation_row = make_optional_input(modulation_row_tensor);
+
             auto runner_ctx = get_context();
 
             ggml_tensor* out = qwen_image.forward(&runner_ctx,
@@ -607,7 +697,8 @@ namespace Qwen {
                                                   context,
                                                   pe,
                                                   ref_latents,
-                                                  modulate_index);
+                                                  modulate_index,
+                                                  modulation_row);
 
             ggml_build_forward_expand(gf, out);
 
@@ -619,28 +710,67 @@ namespace Qwen {
                                   const sd::Tensor<float>& timesteps,
                                   const sd::Tensor<float>& context,
                                   const std::vector<sd::Tensor<float>>& ref_latents = {},
-                                  bool increase_ref_index                           = false) {
+                                  bool increase_ref_index                           = false,
+                                  float ref_position_scale                          = 1.f,
+                                  const sd::Tensor<float>& modulation_row           = {}) {
             // x: [N, in_channels, h, w]
             // timesteps: [N, ]
             // context: [N, max_position, hidden_size]
             auto get_graph = [&]() -> ggml_cgraph* {
-                return build_graph(x, timesteps, context, ref_latents, increase_ref_index);
+                return build_graph(x, timesteps, context, ref_latents, increase_ref_index, ref_position_scale, modulation_row);
             };
 
             return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
         }
 
+        // Rows of a new ModulationCache group, one per listed timestep, in one
+        // graph; empty on failure.
+        sd::Tensor<float> compute_modulation_rows(int n_threads, const std::vector<float>& timesteps) {
+            sd::Tensor<float> timesteps_tensor({static_cast<int64_t>(timesteps.size())}, timesteps);
+            auto get_graph = [&]() -> ggml_cgraph* {
+                ggml_cgraph* gf  = new_graph_custom(QWEN_IMAGE_GRAPH_SIZE);
+                auto runner_ctx  = get_context();
+                ggml_tensor* out = qwen_image.forward_modulation(&runner_ctx, make_input(timesteps_tensor));
+                ggml_build_forward_expand(gf, out);
+                return gf;
+            };
+            return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false));
+        }
+
+        // This step's ModulationCache row; empty when the step graph computes
+        // its own modulation. Qwen-Image has no guidance embedding or pooled
+        // text vector, so one group covers every condition.
+        sd::Tensor<float> modulation_row_for(int n_threads,
+                                             ModulationCache* cache,
+                                             const sd::Tensor<float>& x,
+                                             const sd::Tensor<float>& timesteps) {
+            if (!qwen_image.supports_modulation_cache() || timesteps.numel() != 1 || (x.dim() >= 4 && x.shape()[3] != 1)) {
+                return {};
+            }
+            return cache->row_for(timesteps.data()[0], 0.0f, {}, qwen_image.modulation_row_size(), [&](const std::vector<float>& row_timesteps) {
+                return compute_modulation_rows(n_threads, row_timesteps);
+            });
+        }
+
         sd::Tensor<float> compute(int n_threads,
                                   const DiffusionParams& diffusion_params) override {
             GGML_ASSERT(diffusion_params.x != nullptr);
             GGML_ASSERT(diffusion_params.timesteps != nullptr);
             static const std::vector<sd::Tensor<float>> empty_ref_latents;
+            // callers without the modulation cache may leave the extra unset
+            const auto* extra = std::get_if<QwenImageDiffusionExtra>(&diffusion_params.extra);
+            sd::Tensor<float> modulation_row;
+            if (extra != nullptr && extra->modulation_cache != nullptr) {
+                modulation_row = modulation_row_for(n_threads, extra->modulation_cache, *diffusion_params.x, *diffusion_params.timesteps);
+            }
             return compute(n_threads,
                            *diffusion_params.x,
                            *diffusion_params.timesteps,
                            tensor_or_empty(diffusion_params.context),
                            diffusion_params.ref_latents ? *diffusion_params.ref_latents : empty_ref_latents,
-                           diffusion_params.increase_ref_index);
+                           diffusion_params.increase_ref_index,
+                           diffusion_params.ref_position_scale,
+                           modulation_row);
         }
 
         void test() {
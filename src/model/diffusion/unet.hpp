@@ -495,7 +495,8 @@ public:
                                          GGMLRunnerContext* ctx,
                                          ggml_tensor* x,
                                          ggml_tensor* context,
-                                         int timesteps) {
+                                         int timesteps,
+                                         int token_merge = 1) {
         if (config.version == VERSION_SVD) {
             auto block = std::dynamic_pointer_cast<SpatialVideoTransformer>(blocks[name]);
 
@@ -503,7 +504,7 @@ public:
         } else {
             auto block = std::dynamic_pointer_cast<SpatialTransformer>(blocks[name]);
 
-            return block->forward(ctx, x, context);
+            return block->forward(ctx, x, context, token_merge);
         }
     }
 
@@ -515,7 +516,9 @@ public:
                          ggml_tensor* y                     = nullptr,
                          int num_video_frames               = -1,
                          std::vector<ggml_tensor*> controls = {},
-                         float control_strength             = 0.f) {
+                         float control_strength             = 0.f,
+                         int token_merge                    = 1,
+                         int token_merge_max_downsample     = 1) {
         // x: [N, in_channels, h, w] or [N, in_channels/2, h, w]
         // timesteps: [N,]
         // context: [N, max_position, hidden_size] or [1, max_position, hidden_size]. for example, [N, 77, 768]
@@ -577,6 +580,11 @@ public:
         // input_blocks
         std::vector<ggml_tensor*> hs;
 
+        // token merging only on levels down to token_merge_max_downsample
+        auto level_token_merge = [&](int ds) {
+            return ds <= token_merge_max_downsample ? token_merge : 1;
+        };
+
         // input block 0
         auto h = input_blocks_0_0->forward(ctx, x);
         sd::ggml_graph_cut::mark_graph_cut(h, "unet.input_blocks.0", "h");
@@ -595,7 +603,7 @@ public:
                 h                = resblock_forward(name, ctx, h, emb, num_video_frames);  // [N, mult*model_channels, h, w]
                 if (std::find(attention_resolutions.begin(), attention_resolutions.end(), ds) != attention_resolutions.end()) {
                     std::string name = "input_blocks." + std::to_string(input_block_idx) + ".1";
-                    h                = attention_layer_forward(name, ctx, h, context, num_video_frames);  // [N, mult*model_channels, h, w]
+                    h                = attention_layer_forward(name, ctx, h, context, num_video_frames, level_token_merge(ds));  // [N, mult*model_channels, h, w]
                 }
                 sd::ggml_graph_cut::mark_graph_cut(h, "unet.input_blocks." + std::to_string(input_block_idx), "h");
                 hs.push_back(h);
@@ -655,7 +663,7 @@ public:
                 if (std::find(attention_resolutions.begin(), attention_resolutions.end(), ds) != attention_resolutions.end()) {
                     std::string name = "output_blocks." + std::to_string(output_block_idx) + ".1";
 
-                    h = attention_layer_forward(name, ctx, h, context, num_video_frames);
+                    h = attention_layer_forward(name, ctx, h, context, num_video_frames, level_token_merge(ds));
 
                     up_sample_idx++;
                 }
@@ -681,8 +689,7 @@ public:
         }
 
         // out
-        h = out_0->forward(ctx, h);
-        h = ggml_silu_inplace(ctx->ggml_ctx, h);
+        h = out_0->forward_silu(ctx, h);
         h = out_2->forward(ctx, h);
         ggml_set_name(h, "bench-end");
         return h;  // [N, out_channels, h, w]
@@ -708,6 +715,11 @@ struct UNetModelRunner : public DiffusionModelRunner {
         return "unet";
     }
 
+    bool supports_batched_conditions() const override {
+        // SVD uses the batch dim for video frames
+        return config.version != VERSION_SVD;
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors, const std::string& prefix) override {
         unet.get_param_tensors(tensors, prefix);
     }
@@ -719,7 +731,9 @@ struct UNetModelRunner : public DiffusionModelRunner {
                              const sd::Tensor<float>& y_tensor                     = {},
                              int num_video_frames                                  = -1,
                              const std::vector<sd::Tensor<float>>& controls_tensor = {},
-                             float control_strength                                = 0.f) {
+                             float control_strength                                = 0.f,
+                             int token_merge                                       = 1,
+                             int token_merge_max_downsample                        = 1) {
         ggml_cgraph* gf = new_graph_custom(UNET_GRAPH_SIZE);
 
         ggml_tensor* x         = make_input(x_tensor);
@@ -747,7 +761,9 @@ struct UNetModelRunner : public DiffusionModelRunner {
                                         y,
                                         num_video_frames,
                                         controls,
-                                        control_strength);
+                                        control_strength,
+                                        token_merge,
+                                        token_merge_max_downsample);
 
         ggml_build_forward_expand(gf, out);
 
@@ -762,17 +778,31 @@ struct UNetModelRunner : public DiffusionModelRunner {
                               const sd::Tensor<float>& y                     = {},
                               int num_video_frames                           = -1,
                               const std::vector<sd::Tensor<float>>& controls = {},
-                              float control_strength                         = 0.f) {
+                              float control_strength                         = 0.f,
+                              int token_merge                                = 1,
+                              int token_merge_max_downsample                 = 1) {
         // x: [N, in_channels, h, w]
         // timesteps: [N, ]
         // context: [N, max_position, hidden_size]([N, 77, 768]) or [1, max_position, hidden_size]
         // c_concat: [N, in_channels, h, w] or [1, in_channels, h, w]
         // y: [N, adm_in_channels] or [1, adm_in_channels]
         auto get_graph = [&]() -> ggml_cgraph* {
-            return build_graph(x, timesteps, context, c_concat, y, num_video_frames, controls, control_strength);
+            return build_graph(x, timesteps, context, c_concat, y, num_video_frames, controls, control_strength, token_merge, token_merge_max_downsample);
         };
 
-        return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
+        GraphReuse reuse;
+        reuse.add_input(x);
+        reuse.add_input(timesteps);
+        reuse.add_input(context);
+        reuse.add_input(c_concat);
+        reuse.add_input(y);
+        for (const auto& control : controls) {
+            reuse.add_input(control);
+        }
+        reuse.key += std::to_string(num_video_frames) + ":" + std::to_string(control_strength) + ":" +
+                     std::to_string(token_merge) + ":" + std::to_string(token_merge_max_downsample);
+
+        return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false, false, &reuse), x.dim());
     }
 
     sd::Tensor<float> compute(int n_threads,
@@ -789,7 +819,9 @@ struct UNetModelRunner : public DiffusionModelRunner {
                        tensor_or_empty(diffusion_params.y),
                        extra->num_video_frames,
                        extra->controls ? *extra->controls : empty_controls,
-                       extra->control_strength);
+                       extra->control_strength,
+                       extra->token_merge,
+                       extra->token_merge_max_downsample);
     }
 
     void test() {
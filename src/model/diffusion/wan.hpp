@@ -115,9 +115,12 @@ namespace WAN {
         virtual ggml_tensor* forward(GGMLRunnerContext* ctx,
                                      ggml_tensor* x,
                                      ggml_tensor* pe,
-                                     ggml_tensor* mask = nullptr) {
+                                     ggml_tensor* mask     = nullptr,
+                                     int64_t window_tokens = 0,
+                                     int64_t window_shift  = 0) {
             // x: [N, n_token, dim]
             // pe: [n_token, d_head/2, 2, 2]
+            // window_tokens, window_shift: see ggml_ext_window_attention, 0 for full attention
             // return [N, n_token, dim]
             int64_t N       = x->ne[2];
             int64_t n_token = x->ne[1];
@@ -137,9 +140,28 @@ namespace WAN {
 
             q = ggml_reshape_4d(ctx->ggml_ctx, q, head_dim, num_heads, n_token, N);  // [N, n_token, n_head, d_head]
             k = ggml_reshape_4d(ctx->ggml_ctx, k, head_dim, num_heads, n_token, N);  // [N, n_token, n_head, d_head]
-            v = ggml_reshape_4d(ctx->ggml_ctx, v, head_dim, num_heads, n_token, N);  // [N, n_token, n_head, d_head]
 
-            x = Rope::attention(ctx, q, k, v, pe, mask);  // [N, n_token, dim]
+            if (window_tokens > 0 && mask == nullptr) {
+                auto to_hidden = [&](ggml_tensor* t) {
+                    t = ggml_reshape_4d(ctx->ggml_ctx, t, head_dim, n_token, num_heads, N);      // [N, n_head, n_token, d_head]
+                    t = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, t, 0, 2, 1, 3));     // [N, n_token, n_head, d_head]
+                    return ggml_reshape_3d(ctx->ggml_ctx, t, head_dim * num_heads, n_token, N);  // [N, n_token, dim]
+                };
+                q = to_hidden(Rope::apply_rope(ctx->ggml_ctx, q, pe));
+                k = to_hidden(Rope::apply_rope(ctx->ggml_ctx, k, pe));
+                x = ggml_ext_window_attention(ctx->ggml_ctx,
+                                              ctx->backend,
+                                              q,
+                                              k,
+                                              v,
+                                              num_heads,
+                                              window_tokens,
+                                              window_shift,
+                                              ctx->flash_attn_enabled);  // [N, n_token, dim]
+            } else {
+                v = ggml_reshape_4d(ctx->ggml_ctx, v, head_dim, num_heads, n_token, N);  // [N, n_token, n_head, d_head]
+                x = Rope::attention(ctx, q, k, v, pe, mask);                              // [N, n_token, dim]
+            }
 
             x = o_proj->forward(ctx, x);  // [N, n_token, dim]
             return x;
@@ -333,7 +355,9 @@ namespace WAN {
                                      ggml_tensor* e,
                                      ggml_tensor* pe,
                                      ggml_tensor* context,
-                                     int64_t context_img_len = 257) {
+                                     int64_t context_img_len = 257,
+                                     int64_t window_tokens   = 0,
+                                     int64_t window_shift    = 0) {
             // x: [N, n_token, dim]
             // e: [N, 6, dim] or [N, T, 6, dim]
             // context: [N, context_img_len + context_txt_len, dim]
@@ -355,7 +379,7 @@ namespace WAN {
             auto y = norm1->forward(ctx, x);
             y      = ggml_add(ctx->ggml_ctx, y, modulate_mul(ctx->ggml_ctx, y, es[1]));
             y      = modulate_add(ctx->ggml_ctx, y, es[0]);
-            y      = self_attn->forward(ctx, y, pe);
+            y      = self_attn->forward(ctx, y, pe, nullptr, window_tokens, window_shift);
 
             x = ggml_add(ctx->ggml_ctx, x, modulate_mul(ctx->ggml_ctx, y, es[2]));
 
@@ -642,11 +666,13 @@ namespace WAN {
                                   ggml_tensor* clip_fea     = nullptr,
                                   ggml_tensor* vace_context = nullptr,
                                   float vace_strength       = 1.f,
-                                  int64_t N                 = 1) {
+                                  int64_t N                 = 1,
+                                  int attention_window      = 0) {
             // x: [N*C, T, H, W], C => in_dim
             // vace_context: [N*vace_in_dim, T, H, W]
             // timestep: [N,] or [T]
             // context: [N, L, text_dim]
+            // attention_window: latent frames per self-attention window, 0 for full attention
             // return: [N, t_len*h_len*w_len, out_dim*pt*ph*pw]
 
             GGML_ASSERT(N == 1);
@@ -663,7 +689,11 @@ namespace WAN {
             auto head = std::dynamic_pointer_cast<Head>(blocks["head"]);
 
             // patch_embedding
-            x = patch_embedding->forward(ctx, x);                                                    // [N*dim, t_len, h_len, w_len]
+            x = patch_embedding->forward(ctx, x);  // [N*dim, t_len, h_len, w_len]
+
+            int64_t frame_tokens  = x->ne[0] * x->ne[1];
+            int64_t window_frames = ggml_ext_attention_window_frames(x->ne[2], attention_window);
+
             x = ggml_reshape_3d(ctx->ggml_ctx, x, x->ne[0] * x->ne[1] * x->ne[2], x->ne[3] / N, N);  // [N, dim, t_len*h_len*w_len]
             x = ggml_ext_cont(ctx->ggml_ctx, ggml_ext_torch_permute(ctx->ggml_ctx, x, 1, 0, 2, 3));  // [N, t_len*h_len*w_len, dim]
 
@@ -714,7 +744,9 @@ namespace WAN {
             for (int i = 0; i < config.num_layers; i++) {
                 auto block = std::dynamic_pointer_cast<WanAttentionBlock>(blocks["blocks." + std::to_string(i)]);
 
-                x = block->forward(ctx, x, e0, pe, context, context_img_len);
+                // odd blocks shift the windows by half a window
+                int64_t window_shift = (i % 2) * (window_frames / 2) * frame_tokens;
+                x                    = block->forward(ctx, x, e0, pe, context, context_img_len, window_frames * frame_tokens, window_shift);
 
                 auto iter = config.vace_layers_mapping.find(i);
                 if (iter != config.vace_layers_mapping.end()) {
@@ -748,7 +780,8 @@ namespace WAN {
                              ggml_tensor* time_dim_concat = nullptr,
                              ggml_tensor* vace_context    = nullptr,
                              float vace_strength          = 1.f,
-                             int64_t N                    = 1) {
+                             int64_t N                    = 1,
+                             int attention_window         = 0) {
             // Forward pass of DiT.
             // x: [N*C, T, H, W]
             // timestep: [N,]
@@ -776,7 +809,7 @@ namespace WAN {
                 t_len           = ((x->ne[2] + (std::get<0>(config.patch_size) / 2)) / std::get<0>(config.patch_size));
             }
 
-            auto out = forward_orig(ctx, x, timestep, context, pe, clip_fea, vace_context, vace_strength, N);  // [N, t_len*h_len*w_len, pt*ph*pw*C]
+            auto out = forward_orig(ctx, x, timestep, context, pe, clip_fea, vace_context, vace_strength, N, attention_window);  // [N, t_len*h_len*w_len, pt*ph*pw*C]
 
             out = unpatchify(ctx->ggml_ctx, out, t_len, h_len, w_len);  // [N*C, (T+pad_t) + (T2+pad_t2), H + pad_h, W + pad_w]
 
@@ -795,7 +828,6 @@ namespace WAN {
         std::string desc = "wan";
         WanConfig config;
         Wan wan;
-        std::vector<float> pe_vec;
         SDVersion version;
 
         WanRunner(ggml_backend_t backend,
@@ -888,33 +920,29 @@ namespace WAN {
                                  const sd::Tensor<float>& c_concat_tensor        = {},
                                  const sd::Tensor<float>& time_dim_concat_tensor = {},
                                  const sd::Tensor<float>& vace_context_tensor    = {},
-                                 float vace_strength                             = 1.f) {
+                                 float vace_strength                             = 1.f,
+                                 int attention_window                            = 0) {
             ggml_cgraph* gf = new_graph_custom(WAN_GRAPH_SIZE);
 
             ggml_tensor* x               = make_input(x_tensor);
             ggml_tensor* timesteps       = make_input(timesteps_tensor);
-            ggml_tensor* context         = make_optional_input(context_tensor);
-            ggml_tensor* clip_fea        = make_optional_input(clip_fea_tensor);
+            ggml_tensor* context         = make_optional_constant_input(context_tensor);
+            ggml_tensor* clip_fea        = make_optional_constant_input(clip_fea_tensor);
             ggml_tensor* c_concat        = make_optional_input(c_concat_tensor);
             ggml_tensor* time_dim_concat = make_optional_input(time_dim_concat_tensor);
             ggml_tensor* vace_context    = make_optional_input(vace_context_tensor);
 
-            pe_vec      = Rope::gen_wan_pe(static_cast<int>(x->ne[2]),
-                                           static_cast<int>(x->ne[1]),
-                                           static_cast<int>(x->ne[0]),
-                                           std::get<0>(config.patch_size),
-                                           std::get<1>(config.patch_size),
-                                           std::get<2>(config.patch_size),
-                                           1,
-                                           config.theta,
-                                           config.axes_dim);
-            int pos_len = static_cast<int>(pe_vec.size() / config.axes_dim_sum / 2);
-            // LOG_DEBUG("pos_len %d", pos_len);
-            auto pe = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, 2, 2, config.axes_dim_sum / 2, pos_len);
-            // pe->data = pe_vec.data();
-            // print_ggml_tensor(pe);
-            // pe->data = nullptr;
-            set_backend_tensor_data(pe, pe_vec.data());
+            auto pe = make_positional_table(tensor_shape_key(x), 2, 2, config.axes_dim_sum / 2, [&]() {
+                return Rope::gen_wan_pe(static_cast<int>(x->ne[2]),
+                                        static_cast<int>(x->ne[1]),
+                                        static_cast<int>(x->ne[0]),
+                                        std::get<0>(config.patch_size),
+                                        std::get<1>(config.patch_size),
+                                        std::get<2>(config.patch_size),
+                                        1,
+                                        config.theta,
+                                        config.axes_dim);
+            });
 
             if (c_concat != nullptr) {
                 x = ggml_concat(compute_ctx, x, c_concat, 3);
@@ -930,7 +958,9 @@ namespace WAN {
                                            clip_fea,
                                            time_dim_concat,
                                            vace_context,
-                                           vace_strength);
+                                           vace_strength,
+                                           1,
+                                           attention_window);
 
             ggml_build_forward_expand(gf, out);
 
@@ -945,9 +975,10 @@ namespace WAN {
                                   const sd::Tensor<float>& c_concat        = {},
                                   const sd::Tensor<float>& time_dim_concat = {},
                                   const sd::Tensor<float>& vace_context    = {},
-                                  float vace_strength                      = 1.f) {
+                                  float vace_strength                      = 1.f,
+                                  int attention_window                     = 0) {
             auto get_graph = [&]() -> ggml_cgraph* {
-                return build_graph(x, timesteps, context, clip_fea, c_concat, time_dim_concat, vace_context, vace_strength);
+                return build_graph(x, timesteps, context, clip_fea, c_concat, time_dim_concat, vace_context, vace_strength, attention_window);
             };
 
             return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
@@ -966,7 +997,8 @@ namespace WAN {
                            tensor_or_empty(diffusion_params.c_concat),
                            sd::Tensor<float>(),
                            tensor_or_empty(extra->vace_context),
-                           extra->vace_strength);
+                           extra->vace_strength,
+                           extra->attention_window);
         }
 
         void test() {
@@ -548,7 +548,6 @@ namespace ZImage {
     public:
         ZImageConfig config;
         ZImageModel z_image;
-        std::vector<float> pe_vec;
         std::vector<float> timestep_vec;
         SDVersion version;
 
@@ -581,32 +580,36 @@ namespace ZImage {
             ggml_tensor* timesteps = make_input(timesteps_tensor);
             GGML_ASSERT(x->ne[3] == 1);
             GGML_ASSERT(!context_tensor.empty());
-            ggml_tensor* context = make_input(context_tensor);
+            ggml_tensor* context = make_constant_input(context_tensor);
             std::vector<ggml_tensor*> ref_latents;
             ref_latents.reserve(ref_latents_tensor.size());
             for (const auto& ref_latent_tensor : ref_latents_tensor) {
-                ref_latents.push_back(make_input(ref_latent_tensor));
+                ref_latents.push_back(make_constant_input(ref_latent_tensor));
             }
 
-            pe_vec      = Rope::gen_z_image_pe(static_cast<int>(x->ne[1]),
-                                               static_cast<int>(x->ne[0]),
-                                               config.patch_size,
-                                               static_cast<int>(x->ne[3]),
-                                               static_cast<int>(context->ne[1]),
-                                               SEQ_MULTI_OF,
-                                               ref_latents,
-                                               increase_ref_index,
-                                               config.theta,
-                                               circular_y_enabled,
-                                               circular_x_enabled,
-                                               config.axes_dim);
-            int pos_len = static_cast<int>(pe_vec.size() / config.axes_dim_sum / 2);
-            // LOG_DEBUG("pos_len %d", pos_len);
-            auto pe = ggml_new_tensor_4d(compute_ctx, GGML_TYPE_F32, 2, 2, config.axes_dim_sum / 2, pos_len);
-            // pe->data = pe_vec.data();
-            // print_ggml_tensor(pe, true, "pe");
-            // pe->data = nullptr;
-            set_backend_tensor_data(pe, pe_vec.data());
+            std::string pe_key = sd_format("%s:%" PRId64 ":%d%d%d",
+                                           tensor_shape_key(x).c_str(),
+                                           context->ne[1],
+                                           increase_ref_index ? 1 : 0,
+                                           circular_y_enabled ? 1 : 0,
+                                           circular_x_enabled ? 1 : 0);
+            for (ggml_tensor* ref_latent : ref_latents) {
+                pe_key += ":" + tensor_shape_key(ref_latent);
+            }
+            auto pe = make_positional_table(pe_key, 2, 2, config.axes_dim_sum / 2, [&]() {
+                return Rope::gen_z_image_pe(static_cast<int>(x->ne[1]),
+                                            static_cast<int>(x->ne[0]),
+                                            config.patch_size,
+                                            static_cast<int>(x->ne[3]),
+                                            static_cast<int>(context->ne[1]),
+                                            SEQ_MULTI_OF,
+                                            ref_latents,
+                                            increase_ref_index,
+                                            config.theta,
+                                            circular_y_enabled,
+                                            circular_x_enabled,
+                                            config.axes_dim);
+            });
             auto runner_ctx = get_context();
 
             ggml_tensor* out = z_image.forward(&runner_ctx,
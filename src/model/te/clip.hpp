@@ -538,7 +538,8 @@ struct CLIPTextModelRunner : public GGMLRunner {
             embeddings = ggml_concat(compute_ctx, token_embed_weight, custom_embeddings, 1);
         }
 
-        int n_tokens = static_cast<int>(input_ids->ne[0]);
+        // several n_token chunks in one input run as a batch, see forward
+        int n_tokens = static_cast<int>(std::min<int64_t>(input_ids->ne[0], model.n_token));
         attention_mask_vec.resize(n_tokens * n_tokens);
         for (int i0 = 0; i0 < n_tokens; i0++) {
             for (int i1 = 0; i1 < n_tokens; i1++) {
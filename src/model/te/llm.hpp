@@ -32,6 +32,24 @@
 namespace LLM {
     constexpr int LLM_GRAPH_SIZE = 65536;
 
+    // Attention keys/values of a constant prompt prefix (the system prompt of
+    // a chat template), kept as runner cache tensors between requests. A
+    // recording pass runs the full sequence and persists the K/V of the first
+    // prefix_len tokens per layer; a replay pass only feeds the tokens after
+    // the prefix and attends over the cached K/V in front of its own.
+    struct PrefixKVPlan {
+        int64_t prefix_len = 0;
+        bool record        = false;
+
+        static std::string k_name(int layer_index) {
+            return "llm.prefix_kv.k." + std::to_string(layer_index);
+        }
+
+        static std::string v_name(int layer_index) {
+            return "llm.prefix_kv.v." + std::to_string(layer_index);
+        }
+    };
+
     enum class LLMArch {
         QWEN2_5_VL,
         QWEN3,
@@ -984,7 +1002,9 @@ namespace LLM {
                              ggml_tensor* x,
                              ggml_tensor* input_pos,
                              ggml_tensor* attention_mask = nullptr,
-                             int rope_index              = 0) {
+                             int rope_index              = 0,
+                             const PrefixKVPlan* prefix  = nullptr,
+                             int layer_index             = 0) {
             // x: [N, n_token, hidden_size]
             int64_t n_token = x->ne[1];
             int64_t N       = x->ne[2];
@@ -1115,6 +1135,19 @@ namespace LLM {
                 k               = ggml_rope_multi(ctx->ggml_ctx, k, input_pos, nullptr, head_dim, sections, GGML_ROPE_TYPE_MROPE, 128000, 1000000.f, 1.f, 0.f, 1.f, 32.f, 1.f);
             }
 
+            if (prefix != nullptr && prefix->record) {
+                auto prefix_k = ggml_view_4d(ctx->ggml_ctx, k, k->ne[0], k->ne[1], prefix->prefix_len, N, k->nb[1], k->nb[2], k->nb[3], 0);
+                auto prefix_v = ggml_view_4d(ctx->ggml_ctx, v, v->ne[0], v->ne[1], prefix->prefix_len, N, v->nb[1], v->nb[2], v->nb[3], 0);
+                ctx->persist_cache_tensor(PrefixKVPlan::k_name(layer_index), ggml_cont(ctx->ggml_ctx, prefix_k));
+                ctx->persist_cache_tensor(PrefixKVPlan::v_name(layer_index), ggml_cont(ctx->ggml_ctx, prefix_v));
+            } else if (prefix != nullptr) {
+                auto prefix_k = ctx->load_cache_tensor(PrefixKVPlan::k_name(layer_index));
+                auto prefix_v = ctx->load_cache_tensor(PrefixKVPlan::v_name(layer_index));
+                GGML_ASSERT(prefix_k != nullptr && prefix_v != nullptr);
+                k = ggml_concat(ctx->ggml_ctx, prefix_k, k, 2);  // [N, prefix_len + n_token, num_kv_heads, head_dim]
+                v = ggml_concat(ctx->ggml_ctx, prefix_v, v, 2);
+            }
+
             q = ggml_cont(ctx->ggml_ctx, ggml_ext_torch_permute(ctx->ggml_ctx, q, 0, 2, 1, 3));  // [N, num_heads, n_token, head_dim]
             q = ggml_reshape_3d(ctx->ggml_ctx, q, q->ne[0], q->ne[1], q->ne[2] * q->ne[3]);      // [N*num_heads, n_token, head_dim]
 
@@ -1201,7 +1234,9 @@ namespace LLM {
                              ggml_tensor* x,
                              ggml_tensor* input_pos,
                              ggml_tensor* attention_mask         = nullptr,
-                             ggml_tensor* sliding_attention_mask = nullptr) {
+                             ggml_tensor* sliding_attention_mask = nullptr,
+                             const PrefixKVPlan* prefix          = nullptr,
+                             int layer_index                     = 0) {
             // x: [N, n_token, hidden_size]
             auto self_attn                                  = std::dynamic_pointer_cast<Attention>(blocks["self_attn"]);
             auto input_layernorm                            = std::dynamic_pointer_cast<LLMRMSNorm>(blocks["input_layernorm"]);
@@ -1223,7 +1258,7 @@ namespace LLM {
 
             auto residual = x;
             x             = input_layernorm->forward(ctx, x);
-            x             = self_attn->forward(ctx, x, input_pos, block_attention_mask, rope_index);
+            x             = self_attn->forward(ctx, x, input_pos, block_attention_mask, rope_index, prefix, layer_index);
             if (post_attention_norm != nullptr) {
                 x = post_attention_norm->forward(ctx, x);
             }
@@ -1275,7 +1310,8 @@ namespace LLM {
                                     ggml_tensor* attention_mask,
                                     std::set<int> out_layers,
                                     ggml_tensor* sliding_attention_mask = nullptr,
-                                    bool return_all_hidden_states       = false) {
+                                    bool return_all_hidden_states       = false,
+                                    const PrefixKVPlan* prefix          = nullptr) {
             auto norm = std::dynamic_pointer_cast<LLMRMSNorm>(blocks["norm"]);
             std::vector<ggml_tensor*> intermediate_outputs;
 
@@ -1286,11 +1322,20 @@ namespace LLM {
                 intermediate_outputs.push_back(x);
             }
 
+            // Conditioners that read intermediate hidden states only need the
+            // layers up to the deepest one they read; the rest (and any prefix
+            // K/V they would record) is left out of the graph.
+            int64_t n_run_layers = num_layers;
+            if (!return_all_hidden_states && !out_layers.empty() &&
+                *out_layers.begin() >= 1 && *out_layers.rbegin() <= num_layers) {
+                n_run_layers = *out_layers.rbegin();
+            }
+
             sd::ggml_graph_cut::mark_graph_cut(x, "llm.text.prelude", "x");
-            for (int i = 0; i < num_layers; i++) {
+            for (int i = 0; i < n_run_layers; i++) {
                 auto block = std::dynamic_pointer_cast<TransformerBlock>(blocks["layers." + std::to_string(i)]);
 
-                x = block->forward(ctx, x, input_pos, attention_mask, sliding_attention_mask);
+                x = block->forward(ctx, x, input_pos, attention_mask, sliding_attention_mask, prefix, i);
                 if (return_all_hidden_states || out_layers.size() > 1) {
                     x = ggml_cont(ctx->ggml_ctx, x);
                 }
@@ -1304,6 +1349,14 @@ namespace LLM {
                 }
             }
 
+            if (n_run_layers < num_layers) {
+                x = intermediate_outputs[0];
+                for (int i = 1; i < intermediate_outputs.size(); i++) {
+                    x = ggml_concat(ctx->ggml_ctx, x, intermediate_outputs[i], 0);
+                }
+                return x;
+            }
+
             auto normed_x = norm->forward(ctx, x);
             if (return_all_hidden_states) {
                 intermediate_outputs.push_back(normed_x);
@@ -1333,7 +1386,8 @@ namespace LLM {
                              ggml_tensor* sliding_attention_mask,
                              std::vector<std::pair<int, ggml_tensor*>> image_embeds,
                              std::set<int> out_layers,
-                             bool return_all_hidden_states = false) {
+                             bool return_all_hidden_states = false,
+                             const PrefixKVPlan* prefix    = nullptr) {
             // input_ids: [N, n_token]
             // return: [N, n_token, hidden_size]
             auto x = embed(ctx, input_ids);
@@ -1344,7 +1398,8 @@ namespace LLM {
                                   attention_mask,
                                   std::move(out_layers),
                                   sliding_attention_mask,
-                                  return_all_hidden_states);
+                                  return_all_hidden_states,
+                                  prefix);
         }
     };
 
@@ -1369,7 +1424,8 @@ namespace LLM {
                              ggml_tensor* sliding_attention_mask,
                              std::vector<std::pair<int, ggml_tensor*>> image_embeds,
                              std::set<int> out_layers,
-                             bool return_all_hidden_states = false) {
+                             bool return_all_hidden_states = false,
+                             const PrefixKVPlan* prefix    = nullptr) {
             // input_ids: [N, n_token]
             auto model = std::dynamic_pointer_cast<TextModel>(blocks["model"]);
 
@@ -1380,7 +1436,8 @@ namespace LLM {
                                     sliding_attention_mask,
                                     image_embeds,
                                     out_layers,
-                                    return_all_hidden_states);
+                                    return_all_hidden_states,
+                                    prefix);
             return x;
         }
 
@@ -1416,6 +1473,16 @@ namespace LLM {
         std::array<std::vector<int32_t>, 4> pos_embed_idx_data_;
         std::array<std::vector<float>, 4> pos_embed_weight_data_;
 
+        // Prefix the cached K/V (runner cache tensors) belong to, with the
+        // hidden states it produced, so a replay returns the full sequence.
+        struct PrefixCache {
+            std::vector<int32_t> tokens;
+            std::set<int> out_layers;
+            bool return_all_hidden_states = false;
+            sd::Tensor<float> hidden_states;
+        };
+        PrefixCache prefix_cache;
+
         static ggml_tensor* process_image_common(ggml_context* ctx,
                                                  ggml_tensor* image,
                                                  const LLMVisionConfig& vision_params) {
@@ -1643,6 +1710,7 @@ namespace LLM {
             }
             model = LLM(config, enable_vision, config.llama_cpp_style);
             model.init(params_ctx, tensor_storage_map, prefix);
+            keep_cache_on_runner_done = true;
         }
 
         std::string get_desc() override {
@@ -1660,7 +1728,8 @@ namespace LLM {
                              ggml_tensor* sliding_attention_mask,
                              std::vector<std::pair<int, ggml_tensor*>> image_embeds,
                              std::set<int> out_layers,
-                             bool return_all_hidden_states = false) {
+                             bool return_all_hidden_states = false,
+                             const PrefixKVPlan* prefix    = nullptr) {
             auto hidden_states = model.forward(ctx,
                                                input_ids,
                                                input_pos,
@@ -1668,7 +1737,8 @@ namespace LLM {
                                                sliding_attention_mask,
                                                image_embeds,
                                                out_layers,
-                                               return_all_hidden_states);  // [N, n_token, hidden_size]
+                                               return_all_hidden_states,
+                                               prefix);  // [N, n_token, hidden_size]
             return hidden_states;
         }
 
@@ -1687,7 +1757,8 @@ namespace LLM {
                                  const sd::Tensor<float>& attention_mask_tensor,
                                  const std::vector<std::pair<int, sd::Tensor<float>>>& image_embeds_tensor,
                                  std::set<int> out_layers,
-                                 bool return_all_hidden_states = false) {
+                                 bool return_all_hidden_states = false,
+                                 const PrefixKVPlan* prefix    = nullptr) {
             ggml_cgraph* gf        = new_graph_custom(LLM_GRAPH_SIZE);
             ggml_tensor* input_ids = make_input(input_ids_tensor);
             std::vector<std::pair<int, ggml_tensor*>> image_embeds;
@@ -1697,7 +1768,9 @@ namespace LLM {
                 image_embeds.emplace_back(idx, embed);
             }
 
-            int64_t n_tokens = input_ids->ne[0];
+            int64_t n_tokens   = input_ids->ne[0];
+            int64_t pos_offset = (prefix != nullptr && !prefix->record) ? prefix->prefix_len : 0;
+            int64_t n_kv       = n_tokens + pos_offset;
             if (config.arch == LLMArch::MISTRAL_SMALL_3_2 ||
                 config.arch == LLMArch::MINISTRAL_3_3B ||
                 config.arch == LLMArch::QWEN3 ||
@@ -1706,14 +1779,14 @@ namespace LLM {
                 config.arch == LLMArch::GPT_OSS_20B) {
                 input_pos_vec.resize(n_tokens);
                 for (int i = 0; i < n_tokens; ++i) {
-                    input_pos_vec[i] = i;
+                    input_pos_vec[i] = static_cast<int>(pos_offset + i);
                 }
             } else {
                 input_pos_vec.resize(n_tokens * 4);
                 for (int i = 0; i < n_tokens; ++i) {
-                    input_pos_vec[i]                = i;
-                    input_pos_vec[n_tokens + i]     = i;
-                    input_pos_vec[2 * n_tokens + i] = i;
+                    input_pos_vec[i]                = static_cast<int>(pos_offset + i);
+                    input_pos_vec[n_tokens + i]     = static_cast<int>(pos_offset + i);
+                    input_pos_vec[2 * n_tokens + i] = static_cast<int>(pos_offset + i);
                     input_pos_vec[3 * n_tokens + i] = 0;
                 }
             }
@@ -1728,21 +1801,22 @@ namespace LLM {
             if (!attention_mask_tensor.empty()) {
                 attention_mask = make_input(attention_mask_tensor);
             } else {
-                attention_mask_vec.resize(n_tokens * n_tokens);
-                for (int i0 = 0; i0 < n_tokens; i0++) {
+                attention_mask_vec.resize(n_kv * n_tokens);
+                for (int i0 = 0; i0 < n_kv; i0++) {
                     for (int i1 = 0; i1 < n_tokens; i1++) {
                         float value = 0.f;
-                        if (i0 > i1) {
+                        if (i0 > i1 + pos_offset) {
                             value = -INFINITY;
                         }
-                        attention_mask_vec[i1 * n_tokens + i0] = value;
+                        attention_mask_vec[i1 * n_kv + i0] = value;
                     }
                 }
-                attention_mask = ggml_new_tensor_2d(compute_ctx, GGML_TYPE_F32, n_tokens, n_tokens);
+                attention_mask = ggml_new_tensor_2d(compute_ctx, GGML_TYPE_F32, n_kv, n_tokens);
                 set_backend_tensor_data(attention_mask, attention_mask_vec.data());
             }
 
             if (config.arch == LLMArch::GEMMA3_12B || config.arch == LLMArch::GPT_OSS_20B) {
+                GGML_ASSERT(pos_offset == 0);
                 int sliding_window = 0;
                 for (int window : config.sliding_attention) {
                     sliding_window = std::max(sliding_window, window);
@@ -1774,7 +1848,8 @@ namespace LLM {
                                                  sliding_attention_mask,
                                                  image_embeds,
                                                  out_layers,
-                                                 return_all_hidden_states);
+                                                 return_all_hidden_states,
+                                                 prefix);
 
             ggml_build_forward_expand(gf, hidden_states);
 
@@ -1801,6 +1876,74 @@ namespace LLM {
                                                    input_ids.dim() + 1);
         }
 
+        // Sliding-window layers and attention sinks build their attention from
+        // the full token count, so those architectures always run uncached.
+        bool supports_prefix_cache() const {
+            return config.arch != LLMArch::GEMMA3_12B && config.arch != LLMArch::GPT_OSS_20B;
+        }
+
+        void clear_prefix_cache() {
+            prefix_cache = {};
+            free_cache_ctx_and_buffer();
+        }
+
+        // compute() for a text-only sequence whose first prefix_len tokens are
+        // a constant template prefix. The first call records the prefix K/V;
+        // later calls with the same prefix tokens only run the tokens after it.
+        sd::Tensor<float> compute_with_prefix_cache(const int n_threads,
+                                                    const sd::Tensor<int32_t>& input_ids,
+                                                    const sd::Tensor<float>& attention_mask,
+                                                    std::set<int> out_layers,
+                                                    int64_t prefix_len,
+                                                    bool return_all_hidden_states = false) {
+            int64_t n_tokens = input_ids.numel();
+            if (prefix_len <= 0 || prefix_len >= n_tokens || input_ids.dim() != 1 ||
+                !supports_prefix_cache() || can_attempt_graph_cut_segmented_compute()) {
+                return compute(n_threads, input_ids, attention_mask, {}, out_layers, return_all_hidden_states, false, true, true);
+            }
+
+            std::vector<int32_t> prefix_tokens(input_ids.data(), input_ids.data() + prefix_len);
+            PrefixKVPlan plan;
+            plan.prefix_len = prefix_len;
+            plan.record     = prefix_cache.tokens != prefix_tokens ||
+                          prefix_cache.out_layers != out_layers ||
+                          prefix_cache.return_all_hidden_states != return_all_hidden_states ||
+                          get_cache_tensor_by_name(PrefixKVPlan::k_name(0)) == nullptr;
+
+            if (!plan.record) {
+                sd::Tensor<int32_t> suffix_ids = sd::ops::slice(input_ids, 0, prefix_len, n_tokens);
+                sd::Tensor<float> suffix_mask;
+                if (!attention_mask.empty()) {
+                    suffix_mask = sd::ops::slice(attention_mask, 1, prefix_len, n_tokens);
+                }
+                auto get_graph = [&]() -> ggml_cgraph* {
+                    return build_graph(suffix_ids, suffix_mask, {}, out_layers, return_all_hidden_states, &plan);
+                };
+                auto suffix = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, true, true), 2);
+                if (suffix.empty()) {
+                    return {};
+                }
+                LOG_DEBUG("%s prefix KV cache hit, %lld of %lld tokens reused",
+                          get_desc().c_str(),
+                          (long long)prefix_len,
+                          (long long)n_tokens);
+                return sd::ops::concat(prefix_cache.hidden_states, suffix, 1);
+            }
+
+            prefix_cache   = {};
+            auto get_graph = [&]() -> ggml_cgraph* {
+                return build_graph(input_ids, attention_mask, {}, out_layers, return_all_hidden_states, &plan);
+            };
+            auto hidden_states = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, true, true), 2);
+            if (!hidden_states.empty()) {
+                prefix_cache.tokens                   = std::move(prefix_tokens);
+                prefix_cache.out_layers               = std::move(out_layers);
+                prefix_cache.return_all_hidden_states = return_all_hidden_states;
+                prefix_cache.hidden_states            = sd::ops::slice(hidden_states, 1, 0, prefix_len);
+            }
+            return hidden_states;
+        }
+
         int64_t get_num_image_tokens(int64_t t, int64_t h, int64_t w) {
             int64_t grid_t     = 1;
             int64_t grid_h     = h / config.vision.patch_size;
@@ -275,7 +275,8 @@ public:
                          ggml_tensor* past_bias                = nullptr,
                          ggml_tensor* attention_mask           = nullptr,
                          ggml_tensor* relative_position_bucket = nullptr,
-                         const std::string& graph_cut_prefix   = "") {
+                         const std::string& graph_cut_prefix   = "",
+                         const std::string& bias_cache_name    = "") {
         // x: [N, n_token, model_dim]
         for (int i = 0; i < num_layers; i++) {
             auto block = std::dynamic_pointer_cast<T5Block>(blocks["block." + std::to_string(i)]);
@@ -283,6 +284,9 @@ public:
             auto ret  = block->forward(ctx, x, past_bias, attention_mask, relative_position_bucket);
             x         = ret.first;
             past_bias = ret.second;
+            if (i == 0 && !bias_cache_name.empty() && relative_position_bucket != nullptr) {
+                ctx->persist_cache_tensor(bias_cache_name, past_bias);
+            }
             if (!graph_cut_prefix.empty()) {
                 sd::ggml_graph_cut::mark_graph_cut(x, graph_cut_prefix + ".block." + std::to_string(i), "x");
             }
@@ -316,7 +320,8 @@ public:
                          ggml_tensor* input_ids,
                          ggml_tensor* past_bias                = nullptr,
                          ggml_tensor* attention_mask           = nullptr,
-                         ggml_tensor* relative_position_bucket = nullptr) {
+                         ggml_tensor* relative_position_bucket = nullptr,
+                         const std::string& bias_cache_name    = "") {
         // input_ids: [N, n_token]
 
         auto shared  = std::dynamic_pointer_cast<Embedding>(blocks["shared"]);
@@ -324,7 +329,7 @@ public:
 
         auto x = shared->forward(ctx, input_ids);
         sd::ggml_graph_cut::mark_graph_cut(x, "t5.prelude", "x");
-        x = encoder->forward(ctx, x, past_bias, attention_mask, relative_position_bucket, "t5");
+        x = encoder->forward(ctx, x, past_bias, attention_mask, relative_position_bucket, "t5", bias_cache_name);
         return x;
     }
 };
@@ -332,7 +337,10 @@ public:
 struct T5Runner : public GGMLRunner {
     T5Config config;
     T5 model;
+    // The bucket table depends only on the sequence length, so it is rebuilt
+    // only when the length changes.
     std::vector<int> relative_position_bucket_vec;
+    int relative_position_bucket_len = 0;
 
     T5Runner(ggml_backend_t backend,
              const String2TensorStorage& tensor_storage_map,
@@ -343,6 +351,7 @@ struct T5Runner : public GGMLRunner {
           config(T5Config::detect_from_weights(tensor_storage_map, prefix, is_umt5)) {
         model = T5(config);
         model.init(params_ctx, tensor_storage_map, prefix);
+        keep_cache_on_runner_done = true;
     }
 
     std::string get_desc() override {
@@ -353,14 +362,32 @@ struct T5Runner : public GGMLRunner {
         model.get_param_tensors(tensors, prefix);
     }
 
+    // T5 shares the block 0 position bias [n_token, n_token, num_heads] with
+    // every later block and it only depends on the sequence length and the
+    // bias weights, so it is kept on the backend between encodes. UMT5 has a
+    // bias per block, which is too large to keep around.
+    bool supports_position_bias_cache() {
+        return config.relative_attention && !can_attempt_graph_cut_segmented_compute();
+    }
+
+    static std::string position_bias_cache_name(int64_t n_token) {
+        return "t5.position_bias." + std::to_string(n_token);
+    }
+
+    void clear_position_bias_cache() {
+        free_cache_ctx_and_buffer();
+    }
+
     ggml_tensor* forward(GGMLRunnerContext* ctx,
                          ggml_tensor* input_ids,
                          ggml_tensor* relative_position_bucket,
-                         ggml_tensor* attention_mask = nullptr) {
+                         ggml_tensor* attention_mask        = nullptr,
+                         ggml_tensor* past_bias             = nullptr,
+                         const std::string& bias_cache_name = "") {
         size_t N       = input_ids->ne[1];
         size_t n_token = input_ids->ne[0];
 
-        auto hidden_states = model.forward(ctx, input_ids, nullptr, attention_mask, relative_position_bucket);  // [N, n_token, model_dim]
+        auto hidden_states = model.forward(ctx, input_ids, past_bias, attention_mask, relative_position_bucket, bias_cache_name);  // [N, n_token, model_dim]
         return hidden_states;
     }
 
@@ -370,23 +397,22 @@ struct T5Runner : public GGMLRunner {
         ggml_tensor* input_ids      = make_input(input_ids_tensor);
         ggml_tensor* attention_mask = attention_mask_tensor.empty() ? nullptr : make_input(attention_mask_tensor);
 
-        relative_position_bucket_vec = compute_relative_position_bucket(static_cast<int>(input_ids->ne[0]), static_cast<int>(input_ids->ne[0]));
-
-        // for (int i = 0; i < relative_position_bucket_vec.size(); i++) {
-        //     if (i % 77 == 0) {
-        //         printf("\n");
-        //     }
-        //     printf("%d ", relative_position_bucket_vec[i]);
-        // }
+        int n_token                 = static_cast<int>(input_ids->ne[0]);
+        std::string bias_cache_name = supports_position_bias_cache() ? position_bias_cache_name(n_token) : "";
+        ggml_tensor* past_bias      = bias_cache_name.empty() ? nullptr : get_cache_tensor_by_name(bias_cache_name);
 
-        auto relative_position_bucket = ggml_new_tensor_2d(compute_ctx,
-                                                           GGML_TYPE_I32,
-                                                           input_ids->ne[0],
-                                                           input_ids->ne[0]);
-        set_backend_tensor_data(relative_position_bucket, relative_position_bucket_vec.data());
+        ggml_tensor* relative_position_bucket = nullptr;
+        if (past_bias == nullptr) {
+            if (relative_position_bucket_len != n_token) {
+                relative_position_bucket_vec = compute_relative_position_bucket(n_token, n_token);
+                relative_position_bucket_len = n_token;
+            }
+            relative_position_bucket = ggml_new_tensor_2d(compute_ctx, GGML_TYPE_I32, n_token, n_token);
+            set_backend_tensor_data(relative_position_bucket, relative_position_bucket_vec.data());
+        }
 
         auto runner_ctx            = get_context();
-        ggml_tensor* hidden_states = forward(&runner_ctx, input_ids, relative_position_bucket, attention_mask);
+        ggml_tensor* hidden_states = forward(&runner_ctx, input_ids, relative_position_bucket, attention_mask, past_bias, bias_cache_name);
 
         ggml_build_forward_expand(gf, hidden_states);
 
@@ -399,6 +425,12 @@ struct T5Runner : public GGMLRunner {
                               bool auto_free           = true,
                               bool free_compute_buffer = true,
                               bool free_compute_params = true) {
+        // Keep one sequence length at a time; a new length records its bias
+        // in place of the old one.
+        if (supports_position_bias_cache() &&
+            get_cache_tensor_by_name(position_bias_cache_name(input_ids.shape()[0])) == nullptr) {
+            free_cache_ctx_and_buffer();
+        }
         auto get_graph = [&]() -> ggml_cgraph* {
             return build_graph(input_ids, attention_mask);
         };
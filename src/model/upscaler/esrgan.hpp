@@ -227,6 +227,7 @@ public:
 struct ESRGAN : public GGMLRunner {
     ESRGANConfig config;
     std::unique_ptr<RRDBNet> rrdb_net;
+    int tile_batch_size = 0;  // 0 until fitted to the compute buffer of one tile
 
     ESRGAN(ggml_backend_t backend,
            const String2TensorStorage& tensor_storage_map      = {},
@@ -268,6 +269,53 @@ struct ESRGAN : public GGMLRunner {
         auto result    = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), x.dim());
         return result;
     }
+
+    // 1 until a first tile has sized the compute buffer, then as many tiles
+    // as fit in the free memory of the device
+    int next_tile_batch_size() {
+        constexpr int max_tile_batch_size = 16;
+        constexpr size_t safety_margin    = 512ull * 1024 * 1024;
+        if (can_attempt_graph_cut_segmented_compute() || get_compute_buffer_size() == 0) {
+            return 1;
+        }
+        if (tile_batch_size == 0) {
+            size_t tile_bytes = get_compute_buffer_size();
+            size_t free_bytes = get_runtime_free_memory();
+            tile_batch_size   = 1;
+            if (free_bytes > safety_margin) {
+                // the buffer of one tile is already allocated
+                size_t extra_tiles = (free_bytes - safety_margin) / tile_bytes;
+                tile_batch_size    = 1 + static_cast<int>(std::min<size_t>(extra_tiles, max_tile_batch_size - 1));
+            }
+            LOG_DEBUG("%s tile batch size: %d (%.2f MB compute buffer per tile)",
+                      get_desc().c_str(),
+                      tile_batch_size,
+                      tile_bytes / 1024.0 / 1024.0);
+        }
+        return tile_batch_size;
+    }
+
+    // Tiles stacked along dim 3 run as one graph; a batch that fails falls
+    // back to one tile per graph for the rest of the image.
+    sd::Tensor<float> compute_tiles(const int n_threads, const sd::Tensor<float>& input_tiles) {
+        auto output_tiles = compute(n_threads, input_tiles);
+        bool batched      = input_tiles.dim() == 4 && input_tiles.shape()[3] > 1;
+        if (output_tiles.empty() && batched) {
+            LOG_WARN("%s batch of %d tiles failed, processing tiles one at a time",
+                     get_desc().c_str(),
+                     static_cast<int>(input_tiles.shape()[3]));
+            tile_batch_size = 1;
+            free_compute_buffer();
+            for (const auto& input_tile : sd::ops::chunk(input_tiles, input_tiles.shape()[3], 3)) {
+                auto output_tile = compute(n_threads, input_tile);
+                if (output_tile.empty()) {
+                    return {};
+                }
+                output_tiles = output_tiles.empty() ? std::move(output_tile) : sd::ops::concat(output_tiles, output_tile, 3);
+            }
+        }
+        return output_tiles;
+    }
 };
 
 #endif  // __SD_MODEL_UPSCALER_ESRGAN_HPP__
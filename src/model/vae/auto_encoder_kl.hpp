@@ -38,13 +38,11 @@ public:
         auto conv2 = std::dynamic_pointer_cast<Conv2d>(blocks["conv2"]);
 
         auto h = x;
-        h      = norm1->forward(ctx, h);
-        h      = ggml_silu_inplace(ctx->ggml_ctx, h);  // swish
+        h      = norm1->forward_silu(ctx, h);  // swish
         h      = conv1->forward(ctx, h);
         // return h;
 
-        h = norm2->forward(ctx, h);
-        h = ggml_silu_inplace(ctx->ggml_ctx, h);  // swish
+        h = norm2->forward_silu(ctx, h);  // swish
         // dropout, skip for inference
         h = conv2->forward(ctx, h);
 
@@ -358,9 +356,8 @@ public:
         // sd::ggml_graph_cut::mark_graph_cut(h, "vae.encoder.mid", "h");
 
         // end
-        h = norm_out->forward(ctx, h);
-        h = ggml_silu_inplace(ctx->ggml_ctx, h);  // nonlinearity/swish
-        h = conv_out->forward(ctx, h);            // [N, z_channels*2, h, w]
+        h = norm_out->forward_silu(ctx, h);  // nonlinearity/swish
+        h = conv_out->forward(ctx, h);       // [N, z_channels*2, h, w]
         return h;
     }
 };
@@ -485,9 +482,8 @@ public:
             }
         }
 
-        h = norm_out->forward(ctx, h);
-        h = ggml_silu_inplace(ctx->ggml_ctx, h);  // nonlinearity/swish
-        h = conv_out->forward(ctx, h);            // [N, out_ch, h*8, w*8]
+        h = norm_out->forward_silu(ctx, h);  // nonlinearity/swish
+        h = conv_out->forward(ctx, h);       // [N, out_ch, h*8, w*8]
         return h;
     }
 };
@@ -661,8 +657,9 @@ public:
 
 struct AutoEncoderKL : public VAE {
     float scale_factor = 1.f;
-    float shift_factor = 0.f;
-    bool decode_only   = true;
+    float shift_factor     = 0.f;
+    bool decode_only       = true;
+    bool use_video_decoder = false;
     AutoEncoderKLModel ae;
 
     AutoEncoderKL(ggml_backend_t backend,
@@ -672,7 +669,7 @@ struct AutoEncoderKL : public VAE {
                   bool use_video_decoder                              = false,
                   SDVersion version                                   = VERSION_SD1,
                   std::shared_ptr<RunnerWeightManager> weight_manager = nullptr)
-        : VAE(version, backend, prefix, weight_manager), decode_only(decode_only) {
+        : VAE(version, backend, prefix, weight_manager), decode_only(decode_only), use_video_decoder(use_video_decoder) {
         if (sd_version_is_sd1(version) || sd_version_is_sd2(version)) {
             scale_factor = 0.18215f;
             shift_factor = 0.f;
@@ -720,10 +717,19 @@ struct AutoEncoderKL : public VAE {
         return "vae";
     }
 
+    bool supports_tile_batching() const override {
+        // the video decoder treats dim 3 as frames
+        return !use_video_decoder;
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors) override {
         ae.get_param_tensors(tensors, weight_prefix);
     }
 
+    std::vector<std::string> encoder_param_prefixes() const override {
+        return {weight_prefix + ".encoder.", weight_prefix + ".quant_conv."};
+    }
+
     ggml_cgraph* build_graph(const sd::Tensor<float>& z_tensor, bool decode_graph) {
         ggml_cgraph* gf = ggml_new_graph(compute_ctx);
         ggml_tensor* z  = make_input(z_tensor);
@@ -737,6 +743,10 @@ struct AutoEncoderKL : public VAE {
         return gf;
     }
 
+    ggml_cgraph* build_tile_graph(const sd::Tensor<float>& input, bool decode_graph) override {
+        return build_graph(input, decode_graph);
+    }
+
     sd::Tensor<float> _compute(const int n_threads,
                                const sd::Tensor<float>& z,
                                bool decode_graph) override {
@@ -551,6 +551,11 @@ namespace LTXVAE {
             auto mean_tensor = reshape_channel_broadcast(ctx->ggml_ctx, params["mean-of-means"]);
             return ggml_div(ctx->ggml_ctx, ggml_sub(ctx->ggml_ctx, x, mean_tensor), std_tensor);
         }
+
+        // "std-of-means" or "mean-of-means"
+        ggml_tensor* statistic(const std::string& name) {
+            return params[name];
+        }
     };
 
     struct DecoderConfig {
@@ -1204,6 +1209,11 @@ namespace LTXVAE {
             auto processor = std::dynamic_pointer_cast<PerChannelStatistics>(blocks["per_channel_statistics"]);
             return processor->un_normalize(ctx, x);
         }
+
+        ggml_tensor* latent_statistic(const std::string& name) {
+            auto processor = std::dynamic_pointer_cast<PerChannelStatistics>(blocks["per_channel_statistics"]);
+            return processor->statistic(name);
+        }
     };
 
 }  // namespace LTXVAE
@@ -1363,9 +1373,12 @@ struct LTXVideoVAE : public VAE {
         return gf;
     }
 
-    sd::Tensor<float> decode_temporal_tiled_streaming(const int n_threads,
-                                                      const sd::Tensor<float>& input,
-                                                      size_t expected_dim) {
+    // Decodes temporal tiles in order, passing each tile's frames to on_chunk
+    // as soon as it is computed.
+    bool decode_temporal_tiles(const int n_threads,
+                               const sd::Tensor<float>& input,
+                               size_t expected_dim,
+                               const std::function<bool(sd::Tensor<float> chunk)>& on_chunk) {
         const int64_t total_frames = input.shape()[2];
         TemporalTilePlan plan      = resolve_temporal_tile_plan(total_frames);
 
@@ -1378,7 +1391,6 @@ struct LTXVideoVAE : public VAE {
         free_cache_ctx_and_buffer();
         cache_tensor_map.clear();
 
-        sd::Tensor<float> output;
         for (int64_t start = 0; start < total_frames - plan.overlap; start += plan.stride) {
             const int64_t end       = std::min<int64_t>(total_frames, start + plan.frames);
             const int chunk_overlap = end < total_frames ? plan.overlap : 0;
@@ -1398,17 +1410,27 @@ struct LTXVideoVAE : public VAE {
             };
             auto chunk = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true),
                                                          expected_dim);
-            if (chunk.empty()) {
+            if (chunk.empty() || !on_chunk(std::move(chunk))) {
                 free_cache_ctx_and_buffer();
                 cache_tensor_map.clear();
-                return {};
+                return false;
             }
-            output = output.empty() ? std::move(chunk) : sd::ops::concat(output, chunk, 2);
         }
 
         free_cache_ctx_and_buffer();
         cache_tensor_map.clear();
-        return output;
+        return true;
+    }
+
+    sd::Tensor<float> decode_temporal_tiled_streaming(const int n_threads,
+                                                      const sd::Tensor<float>& input,
+                                                      size_t expected_dim) {
+        sd::Tensor<float> output;
+        bool ok = decode_temporal_tiles(n_threads, input, expected_dim, [&](sd::Tensor<float> chunk) {
+            output = output.empty() ? std::move(chunk) : sd::ops::concat(output, chunk, 2);
+            return true;
+        });
+        return ok ? std::move(output) : sd::Tensor<float>();
     }
 
     ggml_cgraph* build_latent_statistics_graph(const sd::Tensor<float>& z_tensor, bool normalize) {
@@ -1459,6 +1481,35 @@ struct LTXVideoVAE : public VAE {
         return result;
     }
 
+    bool decode_video_frames(int n_threads,
+                             const sd::Tensor<float>& x,
+                             sd_tiling_params_t tiling_params,
+                             bool circular_x,
+                             bool circular_y,
+                             const FramesFn& on_frames) override {
+        set_tiling_params(tiling_params);
+        // spatial tiles each run every temporal tile, so only an untiled
+        // decode can hand frames out per temporal tile
+        if (!temporal_tiling_enabled || tiling_params.enabled || x.dim() != 5 || x.shape()[2] <= 1) {
+            return VAE::decode_video_frames(n_threads, x, tiling_params, circular_x, circular_y, on_frames);
+        }
+
+        int64_t t0 = ggml_time_ms();
+        bool ok    = decode_temporal_tiles(n_threads, x, static_cast<size_t>(x.dim()), [&](sd::Tensor<float> chunk) {
+            if (scale_input) {
+                scale_tensor_to_0_1(&chunk);
+            }
+            return on_frames(chunk);
+        });
+        free_compute_buffer();
+        if (!ok) {
+            return false;
+        }
+        int64_t t1 = ggml_time_ms();
+        LOG_DEBUG("computing vae decode graph completed, taking %.2fs", (t1 - t0) * 1.0f / 1000);
+        return true;
+    }
+
     sd::Tensor<float> apply_latent_statistics(const int n_threads,
                                               const sd::Tensor<float>& z,
                                               bool normalize) {
@@ -1479,6 +1530,20 @@ struct LTXVideoVAE : public VAE {
         return apply_latent_statistics(n_threads, z, false);
     }
 
+    // The per-channel "std-of-means" or "mean-of-means" the latents are
+    // normalized with, copied to the host.
+    sd::Tensor<float> latent_statistic(const int n_threads, const std::string& name) {
+        auto get_graph = [&]() -> ggml_cgraph* {
+            ggml_cgraph* gf = new_graph_custom(16);
+            auto runner_ctx = get_context();
+            // scaled by one so the output is a node of the graph
+            ggml_tensor* out = ggml_scale(runner_ctx.ggml_ctx, vae.latent_statistic(name), 1.f);
+            ggml_build_forward_expand(gf, out);
+            return gf;
+        };
+        return take_or_empty(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false));
+    }
+
     int get_encoder_output_channels(int input_channels) override {
         SD_UNUSED(input_channels);
         return 256;
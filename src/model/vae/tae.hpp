@@ -464,7 +464,19 @@ public:
         blocks[std::to_string(index++)] = std::shared_ptr<GGMLBlock>(new Conv2d(channels[num_layers], out_channels * patch_size * patch_size, {3, 3}, {1, 1}, {1, 1}));
     }
 
+    int mem_block_count() const {
+        return num_layers * num_blocks;
+    }
+
     ggml_tensor* forward(GGMLRunnerContext* ctx, ggml_tensor* z) override {
+        return forward_chunk(ctx, z, nullptr, true);
+    }
+
+    // Decodes the frames of z following the frames another chunk decoded.
+    // mem_state holds, per MemBlock, the last frame that block saw in that
+    // chunk (nullptr for none) and gets this chunk's last frames, so decoding
+    // a video chunk by chunk gives the frames of a whole-video decode.
+    ggml_tensor* forward_chunk(GGMLRunnerContext* ctx, ggml_tensor* z, std::vector<ggml_tensor*>* mem_state, bool first_chunk) {
         auto first_conv = std::dynamic_pointer_cast<Conv2d>(blocks["1"]);
 
         // Clamp()
@@ -474,13 +486,24 @@ public:
                                 3.0f,
                                 true);
 
-        h         = first_conv->forward(ctx, h);
-        h         = ggml_relu_inplace(ctx->ggml_ctx, h);
-        int index = 3;
+        h             = first_conv->forward(ctx, h);
+        h             = ggml_relu_inplace(ctx->ggml_ctx, h);
+        int index     = 3;
+        int mem_index = 0;
         for (int i = 0; i < num_layers; i++) {
-            for (int j = 0; j < num_blocks; j++) {
-                auto mem = ggml_pad_ext(ctx->ggml_ctx, h, 0, 0, 0, 0, 0, 0, 1, 0);
-                mem      = ggml_view_4d(ctx->ggml_ctx, mem, h->ne[0], h->ne[1], h->ne[2], h->ne[3], h->nb[1], h->nb[2], h->nb[3], 0);
+            for (int j = 0; j < num_blocks; j++, mem_index++) {
+                ggml_tensor* mem = mem_state != nullptr ? (*mem_state)[mem_index] : nullptr;
+                if (mem == nullptr) {
+                    mem = ggml_pad_ext(ctx->ggml_ctx, h, 0, 0, 0, 0, 0, 0, 1, 0);
+                    mem = ggml_view_4d(ctx->ggml_ctx, mem, h->ne[0], h->ne[1], h->ne[2], h->ne[3], h->nb[1], h->nb[2], h->nb[3], 0);
+                } else if (h->ne[3] > 1) {
+                    auto head = ggml_view_4d(ctx->ggml_ctx, h, h->ne[0], h->ne[1], h->ne[2], h->ne[3] - 1, h->nb[1], h->nb[2], h->nb[3], 0);
+                    mem       = ggml_concat(ctx->ggml_ctx, mem, head, 3);
+                }
+                if (mem_state != nullptr) {
+                    auto last               = ggml_view_4d(ctx->ggml_ctx, h, h->ne[0], h->ne[1], h->ne[2], 1, h->nb[1], h->nb[2], h->nb[3], (h->ne[3] - 1) * h->nb[3]);
+                    (*mem_state)[mem_index] = ggml_cont(ctx->ggml_ctx, last);
+                }
                 if (is_wide) {
                     auto block = std::dynamic_pointer_cast<WideMemBlock>(blocks[std::to_string(index++)]);
                     h          = block->forward(ctx, h, mem);
@@ -504,8 +527,11 @@ public:
         if (patch_size > 1) {
             h = unpatchify(ctx->ggml_ctx, h, patch_size, 1);
         }
-        // shape(W, H, 3, (t_upscale - 1) + T) => shape(W, H, 3, T)
-        h = ggml_view_4d(ctx->ggml_ctx, h, h->ne[0], h->ne[1], h->ne[2], h->ne[3] - (t_upscale - 1), h->nb[1], h->nb[2], h->nb[3], (t_upscale - 1) * h->nb[3]);
+        // shape(W, H, 3, (t_upscale - 1) + T) => shape(W, H, 3, T); only the
+        // start of the video has the extra frames
+        if (first_chunk) {
+            h = ggml_view_4d(ctx->ggml_ctx, h, h->ne[0], h->ne[1], h->ne[2], h->ne[3] - (t_upscale - 1), h->nb[1], h->nb[2], h->nb[3], (t_upscale - 1) * h->nb[3]);
+        }
         return h;
     }
 };
@@ -540,13 +566,27 @@ public:
         }
     }
 
+    // frames are on dim 2 of the latent and the output, as chunked decoding
+    // needs
+    bool frames_on_dim2() const {
+        return sd_version_is_wan(version) || sd_version_is_ltxav(version);
+    }
+
+    int mem_block_count() {
+        return std::dynamic_pointer_cast<TinyVideoDecoder>(blocks["decoder"])->mem_block_count();
+    }
+
     ggml_tensor* decode(GGMLRunnerContext* ctx, ggml_tensor* z) {
+        return decode_chunk(ctx, z, nullptr, true);
+    }
+
+    ggml_tensor* decode_chunk(GGMLRunnerContext* ctx, ggml_tensor* z, std::vector<ggml_tensor*>* mem_state, bool first_chunk) {
         auto decoder = std::dynamic_pointer_cast<TinyVideoDecoder>(blocks["decoder"]);
         if (sd_version_is_wan(version) || sd_version_is_ltxav(version)) {
             // (W, H, C, T) -> (W, H, T, C)
             z = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, z, 0, 1, 3, 2));
         }
-        auto result = decoder->forward(ctx, z);
+        auto result = decoder->forward_chunk(ctx, z, mem_state, first_chunk);
         if (sd_version_is_wan(version) || sd_version_is_ltxav(version)) {
             // (W, H, T, C) -> (W, H, C, T)
             result = ggml_cont(ctx->ggml_ctx, ggml_permute(ctx->ggml_ctx, result, 0, 1, 3, 2));
@@ -644,6 +684,10 @@ struct TinyImageAutoEncoder : public VAE {
         return "taesd";
     }
 
+    bool supports_tile_batching() const override {
+        return true;
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors) override {
         taesd.get_param_tensors(tensors, weight_prefix);
     }
@@ -674,6 +718,10 @@ struct TinyImageAutoEncoder : public VAE {
         return gf;
     }
 
+    ggml_cgraph* build_tile_graph(const sd::Tensor<float>& input, bool decode_graph) override {
+        return build_graph(input, decode_graph);
+    }
+
     sd::Tensor<float> _compute(const int n_threads,
                                const sd::Tensor<float>& z_tensor,
                                bool decode_graph) override {
@@ -681,14 +729,22 @@ struct TinyImageAutoEncoder : public VAE {
             return build_graph(z_tensor, decode_graph);
         };
 
-        return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), z_tensor.dim());
+        GraphReuse reuse;
+        reuse.add_input(z_tensor);
+        reuse.key += decode_graph ? "decode" : "encode";
+
+        return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false, false, &reuse), z_tensor.dim());
     }
 };
 
 struct TinyVideoAutoEncoder : public VAE {
+    static constexpr int DEFAULT_TEMPORAL_TILE_FRAMES = 4;
+
     TAEHV taehv;
-    bool decode_only = false;
-    bool is_wide     = false;
+    bool decode_only             = false;
+    bool is_wide                 = false;
+    bool temporal_tiling_enabled = false;
+    int temporal_tile_frames     = DEFAULT_TEMPORAL_TILE_FRAMES;
 
     TinyVideoAutoEncoder(ggml_backend_t backend,
                          const String2TensorStorage& tensor_storage_map,
@@ -713,6 +769,27 @@ struct TinyVideoAutoEncoder : public VAE {
         return "taehv";
     }
 
+    void set_temporal_tiling_enabled(bool enabled) override {
+        temporal_tiling_enabled = enabled;
+    }
+
+    void set_tiling_params(const sd_tiling_params_t& params) override {
+        temporal_tiling_enabled = params.temporal_tiling;
+        temporal_tile_frames    = DEFAULT_TEMPORAL_TILE_FRAMES;
+
+        for (const auto& [key, value] : parse_key_value_args(params.extra_tiling_args, "TAEHV extra tiling arg")) {
+            int parsed = 0;
+            if (key != "temporal_tile_frames") {
+                continue;
+            }
+            if (!parse_strict_int(value, parsed)) {
+                LOG_WARN("ignoring invalid TAEHV extra tiling arg '%s=%s'", key.c_str(), value.c_str());
+            } else {
+                temporal_tile_frames = std::max(1, parsed);
+            }
+        }
+    }
+
     void get_param_tensors(std::map<std::string, ggml_tensor*>& tensors) override {
         taehv.get_param_tensors(tensors, weight_prefix);
     }
@@ -744,15 +821,112 @@ struct TinyVideoAutoEncoder : public VAE {
         return gf;
     }
 
+    std::string temporal_mem_cache_name(int mem_index) const {
+        return "taehv_temporal_mem:" + std::to_string(mem_index);
+    }
+
+    ggml_cgraph* build_temporal_chunk_graph(const sd::Tensor<float>& z_chunk, bool first_chunk) {
+        ggml_cgraph* gf = is_wide ? ggml_new_graph_custom(compute_ctx, 4096, false)
+                                  : ggml_new_graph(compute_ctx);
+        ggml_tensor* z  = make_input(z_chunk);
+
+        std::vector<ggml_tensor*> mem_state(taehv.mem_block_count(), nullptr);
+        if (!first_chunk) {
+            for (int i = 0; i < static_cast<int>(mem_state.size()); ++i) {
+                mem_state[i] = get_cache_tensor_by_name(temporal_mem_cache_name(i));
+            }
+        }
+
+        auto runner_ctx  = get_context();
+        ggml_tensor* out = taehv.decode_chunk(&runner_ctx, z, &mem_state, first_chunk);
+        for (int i = 0; i < static_cast<int>(mem_state.size()); ++i) {
+            cache(temporal_mem_cache_name(i), mem_state[i]);
+            ggml_build_forward_expand(gf, mem_state[i]);
+        }
+        ggml_build_forward_expand(gf, out);
+        return gf;
+    }
+
+    bool can_decode_temporal_chunks(const sd::Tensor<float>& z) const {
+        return temporal_tiling_enabled && taehv.frames_on_dim2() && z.dim() >= 4 && z.shape()[2] > temporal_tile_frames;
+    }
+
+    // Decodes temporal_tile_frames latent frames at a time and passes each
+    // chunk's frames to on_chunk as soon as it is computed. The MemBlocks
+    // only look one frame back, so carrying the last frame each saw makes
+    // the chunks exact, without overlap.
+    bool decode_temporal_chunks(const int n_threads,
+                                const sd::Tensor<float>& z,
+                                const std::function<bool(sd::Tensor<float> chunk)>& on_chunk) {
+        const int64_t total_frames = z.shape()[2];
+        LOG_DEBUG("TAEHV decoding %lld latent frames in chunks of %d",
+                  (long long)total_frames,
+                  temporal_tile_frames);
+
+        free_cache_ctx_and_buffer();
+        cache_tensor_map.clear();
+        for (int64_t start = 0; start < total_frames; start += temporal_tile_frames) {
+            const int64_t end = std::min<int64_t>(total_frames, start + temporal_tile_frames);
+            auto z_chunk      = sd::ops::slice(z, 2, start, end);
+            auto get_graph    = [&]() -> ggml_cgraph* {
+                return build_temporal_chunk_graph(z_chunk, start == 0);
+            };
+            auto chunk = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), z.dim());
+            if (chunk.empty() || !on_chunk(std::move(chunk))) {
+                free_cache_ctx_and_buffer();
+                cache_tensor_map.clear();
+                return false;
+            }
+        }
+        free_cache_ctx_and_buffer();
+        cache_tensor_map.clear();
+        return true;
+    }
+
     sd::Tensor<float> _compute(const int n_threads,
                                const sd::Tensor<float>& z_tensor,
                                bool decode_graph) override {
+        if (decode_graph && can_decode_temporal_chunks(z_tensor)) {
+            sd::Tensor<float> output;
+            bool ok = decode_temporal_chunks(n_threads, z_tensor, [&](sd::Tensor<float> chunk) {
+                output = output.empty() ? std::move(chunk) : sd::ops::concat(output, chunk, 2);
+                return true;
+            });
+            return ok ? std::move(output) : sd::Tensor<float>();
+        }
+
         auto get_graph = [&]() -> ggml_cgraph* {
             return build_graph(z_tensor, decode_graph);
         };
 
         return restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, false, false, false), z_tensor.dim());
     }
+
+    bool decode_video_frames(int n_threads,
+                             const sd::Tensor<float>& x,
+                             sd_tiling_params_t tiling_params,
+                             bool circular_x,
+                             bool circular_y,
+                             const FramesFn& on_frames) override {
+        set_tiling_params(tiling_params);
+        // spatial tiles each run every chunk, so only an untiled decode can
+        // hand frames out per chunk
+        if (tiling_params.enabled || !can_decode_temporal_chunks(x)) {
+            return VAE::decode_video_frames(n_threads, x, tiling_params, circular_x, circular_y, on_frames);
+        }
+
+        int64_t t0 = ggml_time_ms();
+        bool ok    = decode_temporal_chunks(n_threads, x, [&](sd::Tensor<float> chunk) {
+            return on_frames(chunk);
+        });
+        free_compute_buffer();
+        if (!ok) {
+            return false;
+        }
+        int64_t t1 = ggml_time_ms();
+        LOG_DEBUG("computing vae decode graph completed, taking %.2fs", (t1 - t0) * 1.0f / 1000);
+        return true;
+    }
 };
 
 #endif  // __SD_MODEL_VAE_TAE_HPP__
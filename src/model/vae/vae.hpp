@@ -10,10 +10,63 @@ protected:
     SDVersion version;
     std::string weight_prefix;
     bool scale_input                                      = true;
+    std::vector<std::shared_ptr<VAE>> tile_replicas;
+    bool tile_replicas_enabled                            = true;
+    int tile_batch_size                                   = 0;
+    bool f32_fallback_enabled                             = false;
     virtual sd::Tensor<float> _compute(const int n_threads,
                                        const sd::Tensor<float>& z,
                                        bool decode_graph) = 0;
 
+    // true when _compute takes image tiles stacked along dim 3 and returns
+    // them in the same order
+    virtual bool supports_tile_batching() const {
+        return false;
+    }
+
+    // the single graph _compute runs for `input`; needed by VAEs that
+    // support tile batching, used to measure tiles before running them
+    virtual ggml_cgraph* build_tile_graph(const sd::Tensor<float>& input, bool decode_graph) {
+        SD_UNUSED(input);
+        SD_UNUSED(decode_graph);
+        return nullptr;
+    }
+
+    static bool is_finite_tensor(const sd::Tensor<float>& tensor) {
+        for (int64_t i = 0; i < tensor.numel(); ++i) {
+            if (!std::isfinite(tensor[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // With the fallback enabled, an output of `input` holding NaN/Inf (half
+    // precision overflow) is computed again with f32 convolutions.
+    sd::Tensor<float> check_output(int n_threads,
+                                   const sd::Tensor<float>& input,
+                                   bool decode_graph,
+                                   sd::Tensor<float> output) {
+        if (!f32_fallback_enabled || conv_f32_enabled || output.empty() || is_finite_tensor(output)) {
+            return output;
+        }
+        LOG_WARN("%s %s produced NaN/Inf, running it again with f32 convolutions",
+                 get_desc().c_str(),
+                 decode_graph ? "decode" : "encode");
+        free_compute_buffer();
+        set_conv_f32_enabled(true);
+        auto f32_output = _compute(n_threads, input, decode_graph);
+        free_compute_buffer();
+        set_conv_f32_enabled(false);
+        if (f32_output.empty()) {
+            return output;
+        }
+        if (!is_finite_tensor(f32_output)) {
+            LOG_WARN("%s f32 %s still produced NaN/Inf", get_desc().c_str(), decode_graph ? "decode" : "encode");
+        }
+        return f32_output;
+    }
+
     static inline void scale_tensor_to_minus1_1(sd::Tensor<float>* tensor) {
         GGML_ASSERT(tensor != nullptr);
         for (int64_t i = 0; i < tensor->numel(); ++i) {
@@ -42,25 +95,203 @@ protected:
                                     bool decode_graph,
                                     const char* error_message,
                                     bool silent = false) {
-        auto on_processing = [&](const sd::Tensor<float>& input_tile) {
-            auto output_tile = _compute(n_threads, input_tile, decode_graph);
-            if (output_tile.empty()) {
+        // tiles are spread over this VAE and its replicas, one worker each;
+        // LoRAs applied to this VAE are not on the replicas. A memory probe
+        // only sees this thread, and the replicas need what this VAE needs.
+        std::vector<VAE*> runners = {this};
+        if (tile_replicas_enabled && weight_adapter == nullptr && sd_perf::current_memory_probe() == nullptr) {
+            for (const auto& replica : tile_replicas) {
+                replica->set_flash_attention_enabled(flash_attn_enabled);
+                replica->set_conv2d_direct_enabled(conv2d_direct_enabled);
+                replica->set_circular_axes(circular_x_enabled, circular_y_enabled);
+                replica->set_f32_fallback_enabled(f32_fallback_enabled);
+                runners.push_back(replica.get());
+            }
+            if (!silent && runners.size() > 1) {
+                LOG_DEBUG("%s processing tiles on %zu backends", get_desc().c_str(), runners.size());
+            }
+        }
+        for (VAE* runner : runners) {
+            runner->tile_batch_size = 0;
+        }
+
+        auto next_batch_size = [&](int worker) {
+            return runners[worker]->next_tile_batch_size(silent);
+        };
+        auto on_processing = [&](int worker, const sd::Tensor<float>& input_tiles) {
+            auto output_tiles = runners[worker]->compute_tiles(n_threads, input_tiles, decode_graph);
+            if (output_tiles.empty()) {
                 LOG_ERROR("%s", error_message);
-                return sd::Tensor<float>();
             }
-            return output_tile;
+            return output_tiles;
         };
-        return ::process_tiles_2d(input,
-                                  output_width,
-                                  output_height,
-                                  scale,
-                                  p_tile_size_x,
-                                  p_tile_size_y,
-                                  tile_overlap_factor,
-                                  circular_x,
-                                  circular_y,
-                                  on_processing,
-                                  silent);
+        auto output = ::process_tiles_2d_batched(input,
+                                                 output_width,
+                                                 output_height,
+                                                 scale,
+                                                 p_tile_size_x,
+                                                 p_tile_size_y,
+                                                 tile_overlap_factor,
+                                                 circular_x,
+                                                 circular_y,
+                                                 on_processing,
+                                                 next_batch_size,
+                                                 static_cast<int>(runners.size()),
+                                                 silent);
+        for (size_t i = 1; i < runners.size(); ++i) {
+            runners[i]->free_compute_buffer();
+        }
+        return output;
+    }
+
+    // 1 until a first tile has sized the compute buffer, then as many tiles
+    // as fit in the free memory of the device
+    int next_tile_batch_size(bool silent) {
+        if (!supports_tile_batching() || can_attempt_graph_cut_segmented_compute() || get_compute_buffer_size() == 0) {
+            return 1;
+        }
+        if (tile_batch_size == 0) {
+            tile_batch_size = fit_tile_batch_size(silent);
+        }
+        return tile_batch_size;
+    }
+
+    sd::Tensor<float> compute_tiles(int n_threads, const sd::Tensor<float>& input_tiles, bool decode_graph) {
+        auto output_tiles = _compute(n_threads, input_tiles, decode_graph);
+        bool batched      = input_tiles.dim() == 4 && input_tiles.shape()[3] > 1;
+        if (output_tiles.empty() && batched) {
+            LOG_WARN("%s batch of %" PRId64 " tiles failed, processing tiles one at a time",
+                     get_desc().c_str(),
+                     input_tiles.shape()[3]);
+            tile_batch_size = 1;
+            free_compute_buffer();
+            for (const auto& input_tile : sd::ops::chunk(input_tiles, input_tiles.shape()[3], 3)) {
+                auto output_tile = check_output(n_threads, input_tile, decode_graph, _compute(n_threads, input_tile, decode_graph));
+                if (output_tile.empty()) {
+                    return {};
+                }
+                output_tiles = output_tiles.empty() ? std::move(output_tile) : sd::ops::concat(output_tiles, output_tile, 3);
+            }
+        } else if (batched && f32_fallback_enabled && !is_finite_tensor(output_tiles)) {
+            // only the tiles of the batch that overflowed run again
+            auto input_chunks  = sd::ops::chunk(input_tiles, input_tiles.shape()[3], 3);
+            auto output_chunks = sd::ops::chunk(output_tiles, output_tiles.shape()[3], 3);
+            output_tiles       = {};
+            for (size_t i = 0; i < output_chunks.size(); ++i) {
+                auto output_tile = check_output(n_threads, input_chunks[i], decode_graph, std::move(output_chunks[i]));
+                output_tiles     = output_tiles.empty() ? std::move(output_tile) : sd::ops::concat(output_tiles, output_tile, 3);
+            }
+        } else {
+            output_tiles = check_output(n_threads, input_tiles, decode_graph, std::move(output_tiles));
+        }
+        return output_tiles;
+    }
+
+    int fit_tile_batch_size(bool silent) {
+        constexpr int max_tile_batch_size = 8;
+        constexpr size_t safety_margin    = 512ull * 1024 * 1024;
+        size_t tile_bytes                 = get_compute_buffer_size();
+        size_t free_bytes                 = get_runtime_free_memory();
+        if (tile_bytes == 0 || free_bytes <= safety_margin) {
+            return 1;
+        }
+        // the buffer of one tile is already allocated; activations grow
+        // linearly with the batch dim
+        size_t extra_tiles = (free_bytes - safety_margin) / tile_bytes;
+        int batch_size     = 1 + static_cast<int>(std::min<size_t>(extra_tiles, max_tile_batch_size - 1));
+        if (!silent) {
+            LOG_DEBUG("%s tile batch size: %d (%.2f MB compute buffer per tile)",
+                      get_desc().c_str(),
+                      batch_size,
+                      tile_bytes / 1024.0 / 1024.0);
+        }
+        return batch_size;
+    }
+
+    // Auto tiling: tiles only when the whole graph does not fit the budget
+    // (max_vram when set, else free device memory), with the largest tile
+    // that does. Tile memory is extrapolated from a probe tile by area, then
+    // checked by measuring the chosen tile. Leaves params as they are on the
+    // CPU, for VAEs without a single tile graph and with circular axes.
+    void fit_tiling_params(sd_tiling_params_t& params,
+                           const sd::Tensor<float>& input,
+                           bool decode_graph,
+                           bool circular_x,
+                           bool circular_y,
+                           bool silent) {
+        if (!params.auto_tile_size || !supports_tile_batching() || circular_x || circular_y) {
+            return;
+        }
+        constexpr size_t safety_margin = 512ull * 1024 * 1024;
+        constexpr int min_tile_size    = 4;
+        constexpr int probe_tile_size  = 32;
+        size_t budget                  = max_graph_vram_bytes;
+        if (budget == 0) {
+            size_t free_bytes = get_runtime_free_memory();
+            if (free_bytes == 0) {
+                return;
+            }
+            budget = free_bytes > safety_margin ? free_bytes - safety_margin : 0;
+        }
+
+        const int scale_factor = get_scale_factor();
+        const int input_scale  = decode_graph ? 1 : scale_factor;
+        int64_t latent_x       = input.shape()[0] / input_scale;
+        int64_t latent_y       = input.shape()[1] / input_scale;
+        auto measure_tile      = [&](int64_t tile_x, int64_t tile_y) {
+            std::vector<int64_t> shape = input.shape();
+            shape[0]                   = tile_x * input_scale;
+            shape[1]                   = tile_y * input_scale;
+            sd::Tensor<float> tile(shape);
+            return measure_compute_buffer([&]() -> ggml_cgraph* {
+                return build_tile_graph(tile, decode_graph);
+            });
+        };
+
+        size_t full_bytes = measure_tile(latent_x, latent_y);
+        if (full_bytes == 0) {
+            return;
+        }
+        if (full_bytes <= budget) {
+            params.enabled = false;
+            if (!silent) {
+                LOG_DEBUG("%s auto tiling: not needed (%.2f MB compute buffer, %.2f MB budget)",
+                          get_desc().c_str(),
+                          full_bytes / 1024.0 / 1024.0,
+                          budget / 1024.0 / 1024.0);
+            }
+            return;
+        }
+
+        int64_t probe_x   = std::min<int64_t>(probe_tile_size, latent_x);
+        int64_t probe_y   = std::min<int64_t>(probe_tile_size, latent_y);
+        double cell_bytes = static_cast<double>(measure_tile(probe_x, probe_y)) / (probe_x * probe_y);
+        double cells      = cell_bytes > 0 ? budget / cell_bytes : 0.0;
+        int64_t tile_x    = std::clamp<int64_t>(static_cast<int64_t>(std::sqrt(cells)), min_tile_size, std::max<int64_t>(latent_x, min_tile_size));
+        int64_t tile_y    = std::clamp<int64_t>(static_cast<int64_t>(cells / tile_x), min_tile_size, std::max<int64_t>(latent_y, min_tile_size));
+        size_t tile_bytes = measure_tile(tile_x, tile_y);
+        // fixed costs make the estimate optimistic for small budgets
+        for (int i = 0; i < 8 && tile_bytes > budget && (tile_x > min_tile_size || tile_y > min_tile_size); ++i) {
+            tile_x     = std::max<int64_t>(min_tile_size, tile_x * 7 / 8);
+            tile_y     = std::max<int64_t>(min_tile_size, tile_y * 7 / 8);
+            tile_bytes = measure_tile(tile_x, tile_y);
+        }
+
+        // encode scales requested sizes by its overlap factor, see encode()
+        const float size_factor = decode_graph ? 1.0f : 1.30539f;
+        params.enabled          = true;
+        params.tile_size_x      = std::max(min_tile_size, static_cast<int>(tile_x / size_factor));
+        params.tile_size_y      = std::max(min_tile_size, static_cast<int>(tile_y / size_factor));
+        params.rel_size_x       = 0.f;
+        params.rel_size_y       = 0.f;
+        if (!silent) {
+            LOG_DEBUG("%s auto tiling: %" PRId64 "x%" PRId64 " tiles (%.2f MB compute buffer, %.2f MB budget)",
+                      get_desc().c_str(),
+                      tile_x,
+                      tile_y,
+                      tile_bytes / 1024.0 / 1024.0,
+                      budget / 1024.0 / 1024.0);
+        }
     }
 
 public:
@@ -86,6 +317,37 @@ public:
 
     virtual int get_encoder_output_channels(int input_channels) = 0;
 
+    // Copies of this VAE on other backends, with their own weights. Tiled
+    // encode and decode then process tiles on all of them at once.
+    void set_tile_replicas(std::vector<std::shared_ptr<VAE>> replicas) {
+        tile_replicas = std::move(replicas);
+    }
+
+    size_t tile_replica_count() const {
+        return tile_replicas.size();
+    }
+
+    // whether this VAE or one of its replicas computes on `backend`
+    bool computes_on(ggml_backend_t backend) const {
+        if (runtime_backend == backend) {
+            return true;
+        }
+        for (const auto& replica : tile_replicas) {
+            if (replica->computes_on(backend)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void set_tile_replicas_enabled(bool enabled) {
+        tile_replicas_enabled = enabled;
+    }
+
+    void set_f32_fallback_enabled(bool enabled) {
+        f32_fallback_enabled = enabled;
+    }
+
     void get_tile_sizes(int& tile_size_x,
                         int& tile_size_y,
                         float& tile_overlap,
@@ -127,6 +389,7 @@ public:
             scale_tensor_to_minus1_1(&input);
         }
 
+        fit_tiling_params(tiling_params, input, false, circular_x, circular_y, false);
         if (tiling_params.enabled) {
             const int scale_factor = get_scale_factor();
             int64_t W              = input.shape()[0] / scale_factor;
@@ -148,7 +411,7 @@ public:
                                    false,
                                    "vae encode compute failed while processing a tile");
         } else {
-            output = _compute(n_threads, input, false);
+            output = check_output(n_threads, input, false, _compute(n_threads, input, false));
         }
 
         free_compute_buffer();
@@ -172,7 +435,11 @@ public:
         int64_t t0              = ggml_time_ms();
         sd::Tensor<float> input = x;
         sd::Tensor<float> output;
+        fit_tiling_params(tiling_params, input, true, circular_x, circular_y, silent);
         set_tiling_params(tiling_params);
+        for (const auto& replica : tile_replicas) {
+            replica->set_tiling_params(tiling_params);
+        }
 
         if (tiling_params.enabled) {
             const int scale_factor = get_scale_factor();
@@ -199,7 +466,7 @@ public:
                 "vae decode compute failed while processing a tile",
                 silent);
         } else {
-            output = _compute(n_threads, input, true);
+            output = check_output(n_threads, input, true, _compute(n_threads, input, true));
         }
 
         free_compute_buffer();
@@ -216,6 +483,21 @@ public:
         return std::move(output);
     }
 
+    using FramesFn = std::function<bool(const sd::Tensor<float>& frames)>;
+
+    // Decodes a video and hands its frames, scaled like decode() does, to
+    // on_frames in order. VAEs that decode in temporal tiles pass each tile
+    // on as it finishes; the others pass the whole video at once.
+    virtual bool decode_video_frames(int n_threads,
+                                     const sd::Tensor<float>& x,
+                                     sd_tiling_params_t tiling_params,
+                                     bool circular_x,
+                                     bool circular_y,
+                                     const FramesFn& on_frames) {
+        auto frames = decode(n_threads, x, tiling_params, true, circular_x, circular_y);
+        return !frames.empty() && on_frames(frames);
+    }
+
     virtual sd::Tensor<float> vae_output_to_latents(const sd::Tensor<float>& vae_output, std::shared_ptr<RNG> rng) = 0;
     virtual sd::Tensor<float> diffusion_to_vae_latents(const sd::Tensor<float>& latents)                           = 0;
     virtual sd::Tensor<float> vae_to_diffusion_latents(const sd::Tensor<float>& latents)                           = 0;
@@ -225,6 +507,11 @@ public:
     virtual void set_tiling_params(const sd_tiling_params_t& params) {
         set_temporal_tiling_enabled(params.temporal_tiling);
     };
+    // Name prefixes of the params only encoding uses, which txt2img never
+    // needs loaded.
+    virtual std::vector<std::string> encoder_param_prefixes() const {
+        return {weight_prefix + ".encoder."};
+    }
 };
 
 struct FakeVAE : public VAE {
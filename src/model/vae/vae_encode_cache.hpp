@@ -0,0 +1,140 @@
+#ifndef __SD_MODEL_VAE_VAE_ENCODE_CACHE_HPP__
+#define __SD_MODEL_VAE_VAE_ENCODE_CACHE_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "core/tensor.hpp"
+#include "core/util.h"
+#include "stable-diffusion.h"
+
+// LRU cache of VAE encoder outputs, so source images that come back across
+// requests (img2img with a new prompt, inpainting, edit references, video
+// first/last frames) skip the encoder. Entries hold the raw encoder output,
+// before latent sampling, so a hit still draws from the request's rng and
+// matches an uncached encode. One cache belongs to one context; the LoRA epoch
+// is part of the key, so VAE LoRAs never see stale latents.
+class VaeEncodeCache {
+public:
+    void set_budget_bytes(size_t budget_bytes) {
+        budget_bytes_ = budget_bytes;
+        evict_to_budget();
+    }
+
+    bool enabled() const {
+        return budget_bytes_ > 0;
+    }
+
+    static std::string make_key(const sd::Tensor<float>& x,
+                                const sd_tiling_params_t& tiling_params,
+                                bool circular_x,
+                                bool circular_y,
+                                uint64_t lora_epoch) {
+        std::string key = std::to_string(lora_epoch) + ":";
+        for (int64_t dim : x.shape()) {
+            key += std::to_string(dim) + "x";
+        }
+        key += sd_format(":%d%d%d:%dx%d:%g:%gx%g:%s:%d%d:%016llx",
+                         tiling_params.enabled ? 1 : 0,
+                         tiling_params.temporal_tiling ? 1 : 0,
+                         tiling_params.auto_tile_size ? 1 : 0,
+                         tiling_params.tile_size_x,
+                         tiling_params.tile_size_y,
+                         tiling_params.target_overlap,
+                         tiling_params.rel_size_x,
+                         tiling_params.rel_size_y,
+                         SAFE_STR(tiling_params.extra_tiling_args),
+                         circular_x ? 1 : 0,
+                         circular_y ? 1 : 0,
+                         (unsigned long long)content_hash(x));
+        return key;
+    }
+
+    bool get(const std::string& key, sd::Tensor<float>* output) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        *output = it->second->output;
+        return true;
+    }
+
+    void put(const std::string& key, const sd::Tensor<float>& output) {
+        size_t bytes = static_cast<size_t>(output.numel()) * sizeof(float) + key.size();
+        if (bytes > budget_bytes_) {
+            return;
+        }
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            used_bytes_ -= it->second->bytes;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+
+        entries_.push_front({key, output, bytes});
+        index_[key] = entries_.begin();
+        used_bytes_ += bytes;
+        evict_to_budget();
+    }
+
+    void clear() {
+        entries_.clear();
+        index_.clear();
+        used_bytes_ = 0;
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    size_t used_bytes() const {
+        return used_bytes_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        sd::Tensor<float> output;
+        size_t bytes = 0;
+    };
+
+    // FNV-1a over 64-bit words; a megapixel image is 12 MB of floats and
+    // hashing it byte by byte would cost a noticeable part of the encode.
+    static uint64_t content_hash(const sd::Tensor<float>& x) {
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(x.data());
+        size_t size               = static_cast<size_t>(x.numel()) * sizeof(float);
+        uint64_t hash             = 14695981039346656037ULL;
+        size_t i                  = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            hash ^= word;
+            hash *= 1099511628211ULL;
+        }
+        for (; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    void evict_to_budget() {
+        while (used_bytes_ > budget_bytes_ && !entries_.empty()) {
+            used_bytes_ -= entries_.back().bytes;
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+    }
+
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t budget_bytes_ = 0;
+    size_t used_bytes_   = 0;
+};
+
+#endif  // __SD_MODEL_VAE_VAE_ENCODE_CACHE_HPP__
@@ -13,6 +13,25 @@ namespace WAN {
 
     constexpr int CACHE_T = 2;
 
+    // The causal convs carry the last CACHE_T frames of their input on to
+    // the next latent frame. Those caches are what stays alive from one frame
+    // to the next, so they are kept in f16, or copied in f32 when the f32
+    // fallback runs; either way a cache never aliases a tensor of the frame
+    // that wrote it.
+    inline ggml_tensor* store_feat_cache(GGMLRunnerContext* ctx, ggml_tensor* x) {
+        if (ctx->conv_f32_enabled) {
+            return ggml_cont(ctx->ggml_ctx, x);
+        }
+        return ggml_cast(ctx->ggml_ctx, x, GGML_TYPE_F16);
+    }
+
+    inline ggml_tensor* load_feat_cache(GGMLRunnerContext* ctx, ggml_tensor* cache) {
+        if (cache == nullptr || cache->type == GGML_TYPE_F32) {
+            return cache;
+        }
+        return ggml_cast(ctx->ggml_ctx, cache, GGML_TYPE_F32);
+    }
+
     class CausalConv3d : public GGMLBlock {
     protected:
         int64_t in_channels;
@@ -190,7 +209,7 @@ namespace WAN {
                         if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {  // chunk_idx >= 2
                             // cache last frame of last two chunk
                             cache_x = ggml_concat(ctx->ggml_ctx,
-                                                  ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                                  load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                                   cache_x,
                                                   2);
                         }
@@ -201,9 +220,9 @@ namespace WAN {
                         if (chunk_idx == 1) {
                             x = time_conv->forward(ctx, x);
                         } else {
-                            x = time_conv->forward(ctx, x, feat_cache[idx]);
+                            x = time_conv->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
                         }
-                        feat_cache[idx] = cache_x;
+                        feat_cache[idx] = store_feat_cache(ctx, cache_x);
                         x               = ggml_reshape_4d(ctx->ggml_ctx, x, w * h, t, c, 2);                                   // (2, c, t, h*w)
                         x               = ggml_ext_cont(ctx->ggml_ctx, ggml_ext_torch_permute(ctx->ggml_ctx, x, 0, 3, 1, 2));  // (c, t, 2, h*w)
                         x               = ggml_reshape_4d(ctx->ggml_ctx, x, w, h, 2 * t, c);                                   // (c, t*2, h, w)
@@ -233,18 +252,18 @@ namespace WAN {
                 if (feat_cache.size() > 0) {
                     int idx = feat_idx;
                     if (feat_cache[idx] == nullptr) {
-                        feat_cache[idx] = x;
+                        feat_cache[idx] = store_feat_cache(ctx, x);
                         feat_idx += 1;
                     } else {
                         auto time_conv = std::dynamic_pointer_cast<CausalConv3d>(blocks["time_conv"]);
 
                         auto cache_x    = ggml_ext_slice(ctx->ggml_ctx, x, 2, -1, x->ne[2]);
                         x               = ggml_concat(ctx->ggml_ctx,
-                                                      ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                                      load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                                       x,
                                                       2);
                         x               = time_conv->forward(ctx, x);
-                        feat_cache[idx] = cache_x;
+                        feat_cache[idx] = store_feat_cache(ctx, cache_x);
                         feat_idx += 1;
                     }
                 }
@@ -410,26 +429,25 @@ namespace WAN {
                     auto layer = std::dynamic_pointer_cast<RMS_norm>(blocks["residual." + std::to_string(i)]);
                     x          = layer->forward(ctx, x);
                 } else if (i == 2 || i == 6) {  // CausalConv3d
-                    auto layer = std::dynamic_pointer_cast<CausalConv3d>(blocks["residual." + std::to_string(i)]);
+                    if (is_2D) {
+                        // no temporal padding, so no cache to carry
+                        auto layer = std::dynamic_pointer_cast<Conv2dBut3d>(blocks["residual." + std::to_string(i)]);
+
+                        x = layer->forward(ctx, x);
+                    } else if (feat_cache.size() > 0) {
+                        auto layer = std::dynamic_pointer_cast<CausalConv3d>(blocks["residual." + std::to_string(i)]);
 
-                    if (feat_cache.size() > 0) {
                         int idx      = feat_idx;
                         auto cache_x = ggml_ext_slice(ctx->ggml_ctx, x, 2, -CACHE_T, x->ne[2]);
                         if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {
                             // cache last frame of last two chunk
                             cache_x = ggml_concat(ctx->ggml_ctx,
-                                                  ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                                  load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                                   cache_x,
                                                   2);
                         }
-                        if (is_2D) {
-                            auto layer = std::dynamic_pointer_cast<Conv2dBut3d>(blocks["residual." + std::to_string(i)]);
-
-                            x = layer->forward(ctx, x);
-                        } else {
-                            x = layer->forward(ctx, x, feat_cache[idx]);
-                        }
-                        feat_cache[idx] = cache_x;
+                        x               = layer->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
+                        feat_cache[idx] = store_feat_cache(ctx, cache_x);
                         feat_idx += 1;
                     }
                 } else if (i == 1 || i == 4) {
@@ -735,13 +753,13 @@ namespace WAN {
                 if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {
                     // cache last frame of last two chunk
                     cache_x = ggml_concat(ctx->ggml_ctx,
-                                          ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                          load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                           cache_x,
                                           2);
                 }
 
-                x               = conv1->forward(ctx, x, feat_cache[idx]);
-                feat_cache[idx] = cache_x;
+                x               = conv1->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
+                feat_cache[idx] = store_feat_cache(ctx, cache_x);
                 feat_idx += 1;
             } else {
                 x = conv1->forward(ctx, x);
@@ -793,13 +811,13 @@ namespace WAN {
                 if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {
                     // cache last frame of last two chunk
                     cache_x = ggml_concat(ctx->ggml_ctx,
-                                          ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                          load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                           cache_x,
                                           2);
                 }
 
-                x               = head_2->forward(ctx, x, feat_cache[idx]);
-                feat_cache[idx] = cache_x;
+                x               = head_2->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
+                feat_cache[idx] = store_feat_cache(ctx, cache_x);
                 feat_idx += 1;
             } else {
                 x = head_2->forward(ctx, x);
@@ -924,13 +942,13 @@ namespace WAN {
                 if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {
                     // cache last frame of last two chunk
                     cache_x = ggml_concat(ctx->ggml_ctx,
-                                          ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                          load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                           cache_x,
                                           2);
                 }
 
-                x               = conv1->forward(ctx, x, feat_cache[idx]);
-                feat_cache[idx] = cache_x;
+                x               = conv1->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
+                feat_cache[idx] = store_feat_cache(ctx, cache_x);
                 feat_idx += 1;
             } else {
                 x = conv1->forward(ctx, x);
@@ -982,13 +1000,13 @@ namespace WAN {
                 if (cache_x->ne[2] < 2 && feat_cache[idx] != nullptr) {
                     // cache last frame of last two chunk
                     cache_x = ggml_concat(ctx->ggml_ctx,
-                                          ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2]),
+                                          load_feat_cache(ctx, ggml_ext_slice(ctx->ggml_ctx, feat_cache[idx], 2, -1, feat_cache[idx]->ne[2])),
                                           cache_x,
                                           2);
                 }
 
-                x               = head_2->forward(ctx, x, feat_cache[idx]);
-                feat_cache[idx] = cache_x;
+                x               = head_2->forward(ctx, x, load_feat_cache(ctx, feat_cache[idx]));
+                feat_cache[idx] = store_feat_cache(ctx, cache_x);
                 feat_idx += 1;
             } else {
                 x = head_2->forward(ctx, x);
@@ -1158,11 +1176,22 @@ namespace WAN {
         ggml_tensor* decode(GGMLRunnerContext* ctx,
                             ggml_tensor* z,
                             int64_t b = 1) {
+            clear_cache();
+            auto out = decode_chunk(ctx, z, 0, b);
+            clear_cache();
+            return out;
+        }
+
+        // Decodes the latent frames of z as frames first_frame onwards,
+        // continuing from the causal caches in _feat_map that the frames
+        // before first_frame left there.
+        ggml_tensor* decode_chunk(GGMLRunnerContext* ctx,
+                                  ggml_tensor* z,
+                                  int first_frame,
+                                  int64_t b = 1) {
             // z: [b*c, t, h, w]
             GGML_ASSERT(b == 1);
 
-            clear_cache();
-
             auto decoder = std::dynamic_pointer_cast<Decoder3d>(blocks["decoder"]);
             auto conv2   = std::dynamic_pointer_cast<CausalConv3d>(blocks["conv2"]);
 
@@ -1180,10 +1209,10 @@ namespace WAN {
                 _conv_idx = 0;
                 if (i == 0) {
                     auto in = ggml_ext_slice(ctx->ggml_ctx, x, 2, i, i + 1);  // [b*c, 1, h, w]
-                    out     = decoder->forward(ctx, in, b, _feat_map, _conv_idx, i);
+                    out     = decoder->forward(ctx, in, b, _feat_map, _conv_idx, first_frame + i);
                 } else {
                     auto in   = ggml_ext_slice(ctx->ggml_ctx, x, 2, i, i + 1);  // [b*c, 1, h, w]
-                    auto out_ = decoder->forward(ctx, in, b, _feat_map, _conv_idx, i);
+                    auto out_ = decoder->forward(ctx, in, b, _feat_map, _conv_idx, first_frame + i);
                     out       = ggml_concat(ctx->ggml_ctx, out, out_, 2);
                 }
             }
@@ -1191,29 +1220,6 @@ namespace WAN {
                 out = unpatchify(ctx->ggml_ctx, out, 2, b);
             }
             // sd::ggml_graph_cut::mark_graph_cut(out, "wan_vae.decode.final", "out");
-            clear_cache();
-            return out;
-        }
-
-        ggml_tensor* decode_partial(GGMLRunnerContext* ctx,
-                                    ggml_tensor* z,
-                                    int i,
-                                    int64_t b = 1) {
-            // z: [b*c, t, h, w]
-            GGML_ASSERT(b == 1);
-
-            auto decoder = std::dynamic_pointer_cast<Decoder3d>(blocks["decoder"]);
-            auto conv2   = std::dynamic_pointer_cast<CausalConv3d>(blocks["conv2"]);
-
-            auto x = conv2->forward(ctx, z);
-            // sd::ggml_graph_cut::mark_graph_cut(x, "wan_vae.decode_partial.prelude", "x");
-            auto in   = ggml_ext_slice(ctx->ggml_ctx, x, 2, i, i + 1);  // [b*c, 1, h, w]
-            _conv_idx = 0;
-            auto out  = decoder->forward(ctx, in, b, _feat_map, _conv_idx, i);
-            if (wan2_2) {
-                out = unpatchify(ctx->ggml_ctx, out, 2, b);
-            }
-            // sd::ggml_graph_cut::mark_graph_cut(out, "wan_vae.decode_partial.final", "out");
             return out;
         }
     };
@@ -1222,6 +1228,10 @@ namespace WAN {
         float scale_factor = 1.0f;
         bool decode_only   = true;
         WanVAE ae;
+        // latent frames per decode graph, 0 fits them to the memory budget
+        int temporal_chunk_frames = 0;
+        std::vector<int64_t> fitted_chunk_shape;
+        int fitted_chunk_frames = 0;
 
         WanVAERunner(ggml_backend_t backend,
                      const String2TensorStorage& tensor_storage_map      = {},
@@ -1254,6 +1264,29 @@ namespace WAN {
             ae.get_param_tensors(tensors, weight_prefix);
         }
 
+        void set_tiling_params(const sd_tiling_params_t& params) override {
+            VAE::set_tiling_params(params);
+            // free memory may have changed since the last decode
+            fitted_chunk_shape.clear();
+            fitted_chunk_frames   = 0;
+            temporal_chunk_frames = 0;
+            for (const auto& [key, value] : parse_key_value_args(params.extra_tiling_args, "Wan VAE extra tiling arg")) {
+                int parsed = 0;
+                if (key != "temporal_tile_frames") {
+                    continue;
+                }
+                if (!parse_strict_int(value, parsed) || parsed < 0) {
+                    LOG_WARN("ignoring invalid Wan VAE extra tiling arg '%s=%s'", key.c_str(), value.c_str());
+                } else {
+                    temporal_chunk_frames = parsed;
+                }
+            }
+        }
+
+        std::vector<std::string> encoder_param_prefixes() const override {
+            return {weight_prefix + ".encoder.", weight_prefix + ".conv1."};
+        }
+
         sd::Tensor<float> vae_output_to_latents(const sd::Tensor<float>& vae_output, std::shared_ptr<RNG> rng) override {
             SD_UNUSED(rng);
             return vae_output;
@@ -1324,87 +1357,158 @@ namespace WAN {
             return gf;
         }
 
-        ggml_cgraph* build_graph_partial(const sd::Tensor<float>& z_tensor, bool decode_graph, int i) {
-            ggml_cgraph* gf = new_graph_custom(20480);
+        std::string feat_cache_name(size_t feat_idx) const {
+            return "feat_idx:" + std::to_string(feat_idx);
+        }
 
-            ae.clear_cache();
+        ggml_cgraph* build_chunk_graph(const sd::Tensor<float>& z_chunk, int first_frame) {
+            ggml_cgraph* gf = new_graph_custom(10240 * z_chunk.shape()[2]);
 
-            for (size_t feat_idx = 0; feat_idx < ae._feat_map.size(); feat_idx++) {
-                auto feat_cache        = get_cache_tensor_by_name("feat_idx:" + std::to_string(feat_idx));
-                ae._feat_map[feat_idx] = feat_cache;
+            ae.clear_cache();
+            if (first_frame > 0) {
+                for (size_t feat_idx = 0; feat_idx < ae._feat_map.size(); feat_idx++) {
+                    ae._feat_map[feat_idx] = get_cache_tensor_by_name(feat_cache_name(feat_idx));
+                }
             }
 
-            ggml_tensor* z = make_input(z_tensor);
+            ggml_tensor* z = make_input(z_chunk);
 
             auto runner_ctx = get_context();
 
-            ggml_tensor* out = decode_graph ? ae.decode_partial(&runner_ctx, z, i) : ae.encode(&runner_ctx, z);
+            ggml_tensor* out = ae.decode_chunk(&runner_ctx, z, first_frame);
 
             for (size_t feat_idx = 0; feat_idx < ae._feat_map.size(); feat_idx++) {
                 ggml_tensor* feat_cache = ae._feat_map[feat_idx];
                 if (feat_cache != nullptr) {
-                    cache("feat_idx:" + std::to_string(feat_idx), feat_cache);
+                    cache(feat_cache_name(feat_idx), feat_cache);
                     ggml_build_forward_expand(gf, feat_cache);
                 }
             }
+            ae.clear_cache();
 
             ggml_build_forward_expand(gf, out);
 
             return gf;
         }
 
-        sd::Tensor<float> _compute(const int n_threads,
-                                   const sd::Tensor<float>& z,
-                                   bool decode_graph) override {
-            if (true) {
-                sd::Tensor<float> input;
-                if (z.dim() == 4) {
-                    input = z.unsqueeze(2);
+        // Latent frames per decode graph: all of them when the whole decode
+        // fits the budget (max_vram when set, else free device memory),
+        // otherwise the most that do, found by measuring the graphs. The CPU,
+        // whose free memory is not tracked, decodes in one graph.
+        int fit_decode_chunk_frames(const sd::Tensor<float>& z) {
+            const int64_t total_frames = z.shape()[2];
+            if (temporal_chunk_frames > 0) {
+                return static_cast<int>(std::min<int64_t>(temporal_chunk_frames, total_frames));
+            }
+            if (total_frames <= 1 || can_attempt_graph_cut_segmented_compute()) {
+                return static_cast<int>(total_frames);
+            }
+            if (fitted_chunk_frames > 0 && fitted_chunk_shape == z.shape()) {
+                return fitted_chunk_frames;
+            }
+
+            constexpr size_t safety_margin = 512ull * 1024 * 1024;
+            size_t budget                  = max_graph_vram_bytes;
+            if (budget == 0) {
+                size_t free_bytes = get_runtime_free_memory();
+                if (free_bytes == 0) {
+                    return static_cast<int>(total_frames);
                 }
-                auto get_graph = [&]() -> ggml_cgraph* {
-                    if (input.empty()) {
-                        return build_graph(z, decode_graph);
+                budget = free_bytes > safety_margin ? free_bytes - safety_margin : 0;
+            }
+            auto measure_frames = [&](int64_t frames) {
+                auto z_chunk = sd::ops::slice(z, 2, 0, frames);
+                return measure_compute_buffer([&]() -> ggml_cgraph* {
+                    return build_graph(z_chunk, true);
+                });
+            };
+
+            int64_t frames = total_frames;
+            size_t bytes   = measure_frames(total_frames);
+            if (bytes > budget) {
+                // the buffer grows with the frames of a graph, the first
+                // frame decoding to one output frame and the others to four
+                int64_t lo = 1;
+                int64_t hi = total_frames - 1;
+                frames     = 1;
+                while (lo <= hi) {
+                    int64_t mid      = (lo + hi) / 2;
+                    size_t mid_bytes = measure_frames(mid);
+                    if (mid_bytes <= budget) {
+                        frames = mid;
+                        bytes  = mid_bytes;
+                        lo     = mid + 1;
                     } else {
-                        return build_graph(input, decode_graph);
+                        hi = mid - 1;
                     }
-                };
-                auto result = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true),
-                                                              input.empty() ? z.dim() : input.dim());
-                if (!result.empty() && z.dim() == 4) {
-                    result.squeeze_(2);
                 }
-                return result;
-            } else {  // chunk 1 result is weird
-                ae.clear_cache();
-                int64_t t      = z.shape()[2];
-                int i          = 0;
-                auto get_graph = [&]() -> ggml_cgraph* {
-                    return build_graph_partial(z, decode_graph, i);
+            }
+            LOG_DEBUG("%s decoding %" PRId64 " latent frames in chunks of %" PRId64 " (%.2f MB compute buffer, %.2f MB budget)",
+                      get_desc().c_str(),
+                      total_frames,
+                      frames,
+                      bytes / 1024.0 / 1024.0,
+                      budget / 1024.0 / 1024.0);
+            fitted_chunk_shape  = z.shape();
+            fitted_chunk_frames = static_cast<int>(frames);
+            return fitted_chunk_frames;
+        }
+
+        // Decodes chunk_frames latent frames per graph, the causal caches of
+        // one chunk carried into the next through the runner cache, so the
+        // frames match a decode in one graph.
+        sd::Tensor<float> decode_in_chunks(const int n_threads,
+                                           const sd::Tensor<float>& z,
+                                           int chunk_frames) {
+            const int64_t total_frames = z.shape()[2];
+            sd::Tensor<float> output;
+
+            free_cache_ctx_and_buffer();
+            cache_tensor_map.clear();
+            for (int64_t start = 0; start < total_frames; start += chunk_frames) {
+                const int64_t end = std::min<int64_t>(total_frames, start + chunk_frames);
+                auto z_chunk      = sd::ops::slice(z, 2, start, end);
+                auto get_graph    = [&]() -> ggml_cgraph* {
+                    return build_chunk_graph(z_chunk, static_cast<int>(start));
                 };
-                auto out_opt = GGMLRunner::compute<float>(get_graph, n_threads, true, true, true);
-                if (!out_opt.has_value()) {
-                    return {};
-                }
-                sd::Tensor<float> out = std::move(*out_opt);
-                ae.clear_cache();
-                if (t == 1) {
-                    return out;
+                auto chunk = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true), z.dim());
+                if (chunk.empty()) {
+                    output = {};
+                    break;
                 }
+                output = output.empty() ? std::move(chunk) : sd::ops::concat(output, chunk, 2);
+            }
+            free_cache_ctx_and_buffer();
+            cache_tensor_map.clear();
+            return output;
+        }
 
-                sd::Tensor<float> output = std::move(out);
-
-                for (i = 1; i < t; i++) {
-                    auto chunk_opt = GGMLRunner::compute<float>(get_graph, n_threads, true, true, true);
-                    if (!chunk_opt.has_value()) {
-                        return {};
-                    }
-                    out = std::move(*chunk_opt);
-                    ae.clear_cache();
-                    output = sd::ops::concat(output, out, 2);
+        sd::Tensor<float> _compute(const int n_threads,
+                                   const sd::Tensor<float>& z,
+                                   bool decode_graph) override {
+            sd::Tensor<float> input;
+            if (z.dim() == 4) {
+                input = z.unsqueeze(2);
+            }
+            if (decode_graph && input.empty()) {
+                int chunk_frames = fit_decode_chunk_frames(z);
+                if (chunk_frames < z.shape()[2]) {
+                    return decode_in_chunks(n_threads, z, chunk_frames);
+                }
+            }
+            auto get_graph = [&]() -> ggml_cgraph* {
+                if (input.empty()) {
+                    return build_graph(z, decode_graph);
+                } else {
+                    return build_graph(input, decode_graph);
                 }
-                free_cache_ctx_and_buffer();
-                return output;
+            };
+            auto result = restore_trailing_singleton_dims(GGMLRunner::compute<float>(get_graph, n_threads, true, true, true),
+                                                          input.empty() ? z.dim() : input.dim());
+            if (!result.empty() && z.dim() == 4) {
+                result.squeeze_(2);
             }
+            return result;
         }
 
         void test() {
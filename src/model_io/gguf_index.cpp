@@ -0,0 +1,236 @@
+#include "gguf_index.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#include "core/util.h"
+
+static constexpr uint32_t GGUF_INDEX_VERSION = 1;
+
+struct GGUFIndexHeader {
+    char magic[4];  // "SDGI"
+    uint32_t version;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t n_tensors;
+    uint64_t n_buckets;  // power of two, at least twice n_tensors
+    uint64_t names_size;
+};
+
+struct GGUFIndexEntry {
+    uint64_t offset;
+    int64_t ne[SD_MAX_DIMS];
+    uint32_t name_offset;
+    uint32_t name_len;
+    uint32_t type;
+    uint32_t n_dims;
+};
+
+static_assert(sizeof(GGUFIndexHeader) % 8 == 0, "GGUF index header must keep entries 8-byte aligned");
+static_assert(sizeof(GGUFIndexEntry) % 8 == 0, "GGUF index entries must stay 8-byte aligned");
+
+static void set_error(std::string* error, const std::string& message) {
+    if (error != nullptr) {
+        *error = message;
+    }
+}
+
+static uint32_t name_hash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool get_file_stamp(const std::string& file_path, uint64_t* size, int64_t* mtime) {
+    std::error_code ec;
+    *size = static_cast<uint64_t>(std::filesystem::file_size(file_path, ec));
+    if (ec) {
+        return false;
+    }
+    *mtime = static_cast<int64_t>(std::filesystem::last_write_time(file_path, ec).time_since_epoch().count());
+    return !ec;
+}
+
+GGUFIndex::~GGUFIndex() = default;
+
+std::unique_ptr<GGUFIndex> GGUFIndex::open(const std::string& index_path, const std::string& file_path) {
+    uint64_t file_size = 0;
+    int64_t file_mtime = 0;
+    if (!file_exists(index_path) || !get_file_stamp(file_path, &file_size, &file_mtime)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<MmapWrapper> mapped = MmapWrapper::create(index_path);
+    if (!mapped || mapped->size() < sizeof(GGUFIndexHeader)) {
+        return nullptr;
+    }
+
+    const uint8_t* data           = mapped->data();
+    const GGUFIndexHeader* header = reinterpret_cast<const GGUFIndexHeader*>(data);
+    if (memcmp(header->magic, "SDGI", 4) != 0 || header->version != GGUF_INDEX_VERSION) {
+        return nullptr;
+    }
+    if (header->file_size != file_size || header->file_mtime != file_mtime) {
+        LOG_DEBUG("GGUF index '%s' is stale", index_path.c_str());
+        return nullptr;
+    }
+
+    uint64_t n_buckets = header->n_buckets;
+    if (n_buckets == 0 || (n_buckets & (n_buckets - 1)) != 0 || n_buckets <= header->n_tensors ||
+        header->n_tensors > UINT32_MAX || header->names_size > UINT32_MAX) {
+        return nullptr;
+    }
+    uint64_t expected_size = sizeof(GGUFIndexHeader) + header->n_tensors * sizeof(GGUFIndexEntry) +
+                             n_buckets * sizeof(uint32_t) + header->names_size;
+    if (mapped->size() != expected_size) {
+        return nullptr;
+    }
+
+    auto index      = std::unique_ptr<GGUFIndex>(new GGUFIndex());
+    index->header_  = header;
+    index->entries_ = reinterpret_cast<const GGUFIndexEntry*>(data + sizeof(GGUFIndexHeader));
+    index->table_   = reinterpret_cast<const uint32_t*>(index->entries_ + header->n_tensors);
+    index->names_   = reinterpret_cast<const char*>(index->table_ + n_buckets);
+
+    for (uint64_t i = 0; i < header->n_tensors; i++) {
+        const GGUFIndexEntry& entry = index->entries_[i];
+        if ((uint64_t)entry.name_offset + entry.name_len > header->names_size ||
+            entry.n_dims > SD_MAX_DIMS || entry.type >= GGML_TYPE_COUNT) {
+            return nullptr;
+        }
+    }
+    for (uint64_t i = 0; i < n_buckets; i++) {
+        if (index->table_[i] > header->n_tensors) {
+            return nullptr;
+        }
+    }
+
+    index->mapped_ = std::move(mapped);
+    return index;
+}
+
+size_t GGUFIndex::size() const {
+    return static_cast<size_t>(header_->n_tensors);
+}
+
+TensorStorage GGUFIndex::tensor(size_t i) const {
+    const GGUFIndexEntry& entry = entries_[i];
+    return TensorStorage(std::string(names_ + entry.name_offset, entry.name_len),
+                         static_cast<ggml_type>(entry.type),
+                         entry.ne,
+                         static_cast<int>(entry.n_dims),
+                         0,
+                         entry.offset);
+}
+
+bool GGUFIndex::find(const std::string& name, TensorStorage* tensor_storage) const {
+    uint64_t mask = header_->n_buckets - 1;
+    for (uint64_t slot = name_hash(name.data(), name.size()) & mask;; slot = (slot + 1) & mask) {
+        uint32_t entry_index = table_[slot];
+        if (entry_index == 0) {
+            return false;
+        }
+        const GGUFIndexEntry& entry = entries_[entry_index - 1];
+        if (entry.name_len == name.size() && memcmp(names_ + entry.name_offset, name.data(), name.size()) == 0) {
+            if (tensor_storage != nullptr) {
+                *tensor_storage = tensor(entry_index - 1);
+            }
+            return true;
+        }
+    }
+}
+
+std::string gguf_index_path(const std::string& index_dir, const std::string& file_path) {
+    std::error_code ec;
+    std::string absolute_path = std::filesystem::absolute(file_path, ec).string();
+    if (ec) {
+        absolute_path = file_path;
+    }
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (unsigned char c : absolute_path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return path_join(index_dir, sd_format("%016llx.sdidx", (unsigned long long)hash));
+}
+
+bool write_gguf_index(const std::string& index_path,
+                      const std::string& file_path,
+                      const std::vector<TensorStorage>& tensor_storages,
+                      std::string* error) {
+    GGUFIndexHeader header = {};
+    memcpy(header.magic, "SDGI", 4);
+    header.version = GGUF_INDEX_VERSION;
+    if (!get_file_stamp(file_path, &header.file_size, &header.file_mtime)) {
+        set_error(error, "failed to stat '" + file_path + "'");
+        return false;
+    }
+    header.n_tensors = tensor_storages.size();
+    header.n_buckets = 1;
+    while (header.n_buckets < 2 * header.n_tensors) {
+        header.n_buckets <<= 1;
+    }
+
+    std::vector<GGUFIndexEntry> entries(tensor_storages.size());
+    std::vector<uint32_t> table(header.n_buckets, 0);
+    std::string names;
+    uint64_t mask = header.n_buckets - 1;
+    for (size_t i = 0; i < tensor_storages.size(); i++) {
+        const TensorStorage& tensor_storage = tensor_storages[i];
+        GGUFIndexEntry& entry               = entries[i];
+        if (names.size() + tensor_storage.name.size() > UINT32_MAX) {
+            set_error(error, "too many tensor names for a GGUF index");
+            return false;
+        }
+        entry.offset      = tensor_storage.offset;
+        entry.name_offset = static_cast<uint32_t>(names.size());
+        entry.name_len    = static_cast<uint32_t>(tensor_storage.name.size());
+        entry.type        = static_cast<uint32_t>(tensor_storage.type);
+        entry.n_dims      = static_cast<uint32_t>(tensor_storage.n_dims);
+        for (int d = 0; d < SD_MAX_DIMS; d++) {
+            entry.ne[d] = tensor_storage.ne[d];
+        }
+        names += tensor_storage.name;
+
+        uint64_t slot = name_hash(tensor_storage.name.data(), tensor_storage.name.size()) & mask;
+        while (table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = static_cast<uint32_t>(i + 1);
+    }
+    header.names_size = names.size();
+
+    std::string tmp_path = index_path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            set_error(error, "failed to create '" + tmp_path + "'");
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(GGUFIndexEntry));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(uint32_t));
+        out.write(names.data(), names.size());
+        if (!out) {
+            set_error(error, "failed to write '" + tmp_path + "'");
+            out.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, index_path, ec);
+    if (ec) {
+        std::remove(tmp_path.c_str());
+        set_error(error, "failed to rename '" + tmp_path + "': " + ec.message());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef __SD_MODEL_IO_GGUF_INDEX_H__
+#define __SD_MODEL_IO_GGUF_INDEX_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensor_storage.h"
+
+class MmapWrapper;
+struct GGUFIndexHeader;
+struct GGUFIndexEntry;
+
+// Mapped side index of one GGUF file's tensor table. It is written after the
+// first full parse and holds fixed-size tensor entries, a hash table over the
+// names and the name bytes, so later starts list or look up tensors without
+// walking the KV section of a file that may sit on slow network storage. An
+// index only opens while the GGUF file keeps the size and mtime it was built
+// from.
+class GGUFIndex {
+public:
+    static std::unique_ptr<GGUFIndex> open(const std::string& index_path, const std::string& file_path);
+    ~GGUFIndex();
+
+    size_t size() const;
+    TensorStorage tensor(size_t i) const;
+    bool find(const std::string& name, TensorStorage* tensor_storage) const;
+
+private:
+    std::unique_ptr<MmapWrapper> mapped_;
+    const GGUFIndexHeader* header_ = nullptr;
+    const GGUFIndexEntry* entries_ = nullptr;
+    const uint32_t* table_         = nullptr;
+    const char* names_             = nullptr;
+};
+
+// Index file for `file_path` inside `index_dir`, named after a hash of the path.
+std::string gguf_index_path(const std::string& index_dir, const std::string& file_path);
+
+bool write_gguf_index(const std::string& index_path,
+                      const std::string& file_path,
+                      const std::vector<TensorStorage>& tensor_storages,
+                      std::string* error = nullptr);
+
+#endif  // __SD_MODEL_IO_GGUF_INDEX_H__
@@ -96,13 +96,24 @@ bool read_gguf_file(const std::string& file_path,
 
 bool write_gguf_file(const std::string& file_path,
                      const std::vector<TensorWriteInfo>& tensors,
-                     std::string* error) {
+                     std::string* error,
+                     const GGUFWriteOptions* options,
+                     const TensorWriteStream* stream) {
     gguf_context* gguf_ctx = gguf_init_empty();
     if (gguf_ctx == nullptr) {
         set_error(error, "gguf_init_empty failed");
         return false;
     }
 
+    if (options != nullptr) {
+        if (options->alignment != 0) {
+            gguf_set_val_u32(gguf_ctx, "general.alignment", options->alignment);
+        }
+        for (const auto& [key, value] : options->metadata) {
+            gguf_set_val_str(gguf_ctx, key.c_str(), value.c_str());
+        }
+    }
+
     for (const TensorWriteInfo& write_tensor : tensors) {
         ggml_tensor* tensor = write_tensor.tensor;
         if (tensor == nullptr) {
@@ -114,9 +125,27 @@ bool write_gguf_file(const std::string& file_path,
     }
 
     LOG_INFO("trying to save tensors to %s", file_path.c_str());
-    bool success = gguf_write_to_file(gguf_ctx, file_path.c_str(), false);
+    bool success = gguf_write_to_file(gguf_ctx, file_path.c_str(), stream != nullptr);
     if (!success) {
         set_error(error, "failed to write GGUF file '" + file_path + "'");
+    } else if (stream != nullptr) {
+        // the header ends padded to the alignment, and every tensor's data
+        // is padded to it in turn
+        const size_t alignment = gguf_get_alignment(gguf_ctx);
+        std::ofstream file(file_path, std::ios::binary | std::ios::app);
+        std::vector<char> padding(alignment, 0);
+        success = file.is_open() && write_tensor_stream(tensors, *stream, [&](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; ++i) {
+                          const ggml_tensor* tensor = tensors[i].tensor;
+                          const size_t nbytes       = ggml_nbytes(tensor);
+                          file.write((const char*)tensor->data, nbytes);
+                          file.write(padding.data(), GGML_PAD(nbytes, alignment) - nbytes);
+                      }
+                      return (bool)file;
+                  });
+        if (!success) {
+            set_error(error, "failed to write tensor data to '" + file_path + "'");
+        }
     }
     gguf_free(gguf_ctx);
     return success;
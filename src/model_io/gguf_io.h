@@ -1,7 +1,9 @@
 #ifndef __SD_MODEL_IO_GGUF_IO_H__
 #define __SD_MODEL_IO_GGUF_IO_H__
 
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "tensor_storage.h"
@@ -10,8 +12,17 @@ bool is_gguf_file(const std::string& file_path);
 bool read_gguf_file(const std::string& file_path,
                     std::vector<TensorStorage>& tensor_storages,
                     std::string* error = nullptr);
+struct GGUFWriteOptions {
+    uint32_t alignment = 0;  // tensor data alignment, 0 keeps the GGUF default
+    std::vector<std::pair<std::string, std::string>> metadata;
+};
+
+// With a stream, the tensors only need their type, shape and name up front;
+// their data is loaded from the stream while the file is written.
 bool write_gguf_file(const std::string& file_path,
                      const std::vector<TensorWriteInfo>& tensors,
-                     std::string* error = nullptr);
+                     std::string* error              = nullptr,
+                     const GGUFWriteOptions* options = nullptr,
+                     const TensorWriteStream* stream = nullptr);
 
 #endif  // __SD_MODEL_IO_GGUF_IO_H__
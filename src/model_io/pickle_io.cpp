@@ -1,8 +1,11 @@
 #include "pickle_io.h"
 
+#include <charconv>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -352,8 +355,14 @@ bool parse_pickle_uint32_object(const uint8_t* buffer, size_t buffer_size, uint3
     return pos < buffer_size && buffer[pos] == '.';
 }
 
+// The parser below only decodes value shapes; nothing here is a Python object.
+// Values are small handles: strings are views into the pickle buffer (or into
+// `PickleParser::arena` for the few that have to be built), and tuples, lists,
+// dicts, storages and tensors live in per-parse pools indexed by `index`.
+// Copying a value onto the stack or into the memo is therefore a trivial copy,
+// and lists and dicts are aliased the same way Python's memo aliases them.
 struct PickleStorageInfo {
-    std::string key;
+    std::string_view key;
     ggml_type type              = GGML_TYPE_COUNT;
     bool is_f64                 = false;
     bool is_i64                 = false;
@@ -362,8 +371,11 @@ struct PickleStorageInfo {
 };
 
 struct PickleTensorInfo {
-    TensorStorage tensor_storage;
-    int stride_n_dims = 0;
+    uint32_t storage        = 0;
+    uint64_t offset         = 0;
+    int n_dims              = 0;
+    int64_t ne[SD_MAX_DIMS] = {1, 1, 1, 1, 1};
+    int stride_n_dims       = 0;
     int64_t stride[SD_MAX_DIMS]{1, 1, 1, 1, 1};
 };
 
@@ -384,99 +396,74 @@ struct PickleValue {
     };
 
     Kind kind         = NONE;
-    int64_t int_value = 0;
-    bool bool_value   = false;
-    std::string str_value;
-    std::vector<PickleValue> items;
-    std::vector<std::pair<PickleValue, PickleValue>> dict_items;
-    PickleStorageInfo storage;
-    PickleTensorInfo tensor;
+    int64_t int_value = 0;  // INT value, BOOL value, or TUPLE length
+    std::string_view str_value;
+    uint32_t index = 0;  // TUPLE: first item in tuple_items; LIST/DICT: container; STORAGE/TENSOR: pool entry
 };
 
-static PickleValue make_mark_value() {
-    PickleValue value;
-    value.kind = PickleValue::MARK;
-    return value;
-}
-
-static PickleValue make_none_value() {
-    PickleValue value;
-    value.kind = PickleValue::NONE;
-    return value;
-}
-
-static PickleValue make_bool_value(bool b) {
-    PickleValue value;
-    value.kind       = PickleValue::BOOL;
-    value.bool_value = b;
-    return value;
-}
-
-static PickleValue make_int_value(int64_t x) {
-    PickleValue value;
-    value.kind      = PickleValue::INT;
-    value.int_value = x;
-    return value;
-}
+struct PickleParser {
+    std::vector<PickleValue> tuple_items;
+    std::vector<std::vector<PickleValue>> containers;  // dicts store keys and values interleaved
+    std::vector<PickleStorageInfo> storages;
+    std::vector<PickleTensorInfo> tensors;
+    std::deque<std::string> arena;  // strings that are not a slice of the buffer
 
-static PickleValue make_string_value(const std::string& s) {
-    PickleValue value;
-    value.kind      = PickleValue::STRING;
-    value.str_value = s;
-    return value;
-}
-
-static PickleValue make_global_value(const std::string& s) {
-    PickleValue value;
-    value.kind      = PickleValue::GLOBAL;
-    value.str_value = s;
-    return value;
-}
-
-static PickleValue make_tuple_value(std::vector<PickleValue> items) {
-    PickleValue value;
-    value.kind  = PickleValue::TUPLE;
-    value.items = std::move(items);
-    return value;
-}
+    std::string_view intern(std::string s) {
+        arena.push_back(std::move(s));
+        return arena.back();
+    }
 
-static PickleValue make_list_value() {
-    PickleValue value;
-    value.kind = PickleValue::LIST;
-    return value;
-}
+    PickleValue make_value(PickleValue::Kind kind, int64_t int_value = 0) {
+        PickleValue value;
+        value.kind      = kind;
+        value.int_value = int_value;
+        return value;
+    }
 
-static PickleValue make_dict_value(bool ordered) {
-    PickleValue value;
-    value.kind = ordered ? PickleValue::ORDERED_DICT : PickleValue::DICT;
-    return value;
-}
+    PickleValue make_string_value(std::string_view s, PickleValue::Kind kind = PickleValue::STRING) {
+        PickleValue value;
+        value.kind      = kind;
+        value.str_value = s;
+        return value;
+    }
 
-static PickleValue make_storage_value(const PickleStorageInfo& storage) {
-    PickleValue value;
-    value.kind    = PickleValue::STORAGE;
-    value.storage = storage;
-    return value;
-}
+    PickleValue make_tuple_value(const PickleValue* items, size_t n) {
+        PickleValue value;
+        value.kind      = PickleValue::TUPLE;
+        value.index     = (uint32_t)tuple_items.size();
+        value.int_value = (int64_t)n;
+        tuple_items.insert(tuple_items.end(), items, items + n);
+        return value;
+    }
 
-static PickleValue make_tensor_value(const PickleTensorInfo& tensor) {
-    PickleValue value;
-    value.kind   = PickleValue::TENSOR;
-    value.tensor = tensor;
-    return value;
-}
+    PickleValue make_container_value(PickleValue::Kind kind) {
+        PickleValue value;
+        value.kind  = kind;
+        value.index = (uint32_t)containers.size();
+        containers.emplace_back();
+        return value;
+    }
 
-static std::string pickle_value_to_string(const PickleValue& value) {
-    if (value.kind == PickleValue::STRING) {
-        return value.str_value;
+    const PickleValue* tuple_begin(const PickleValue& value) const {
+        return tuple_items.data() + value.index;
     }
-    if (value.kind == PickleValue::INT) {
-        return std::to_string(value.int_value);
+
+    std::string_view value_to_string(const PickleValue& value) {
+        if (value.kind == PickleValue::STRING) {
+            return value.str_value;
+        }
+        if (value.kind == PickleValue::INT) {
+            return intern(std::to_string(value.int_value));
+        }
+        return {};
     }
-    return "";
+};
+
+static bool is_dict_value(const PickleValue& value) {
+    return value.kind == PickleValue::DICT || value.kind == PickleValue::ORDERED_DICT;
 }
 
-static bool parse_storage_type(const std::string& global_name, PickleStorageInfo* storage) {
+static bool parse_storage_type(std::string_view global_name, PickleStorageInfo* storage) {
     if (global_name == "torch.FloatStorage") {
         storage->type               = GGML_TYPE_F32;
         storage->raw_element_nbytes = 4;
@@ -513,41 +500,69 @@ static bool parse_storage_type(const std::string& global_name, PickleStorageInfo
 }
 
 static bool tensor_is_contiguous(const PickleTensorInfo& tensor) {
-    if (tensor.tensor_storage.nelements() == 0) {
+    int64_t nelements = 1;
+    for (int i = 0; i < tensor.n_dims; i++) {
+        nelements *= tensor.ne[i];
+    }
+    if (nelements == 0) {
         return true;
     }
-    if (tensor.stride_n_dims != tensor.tensor_storage.n_dims) {
+    if (tensor.stride_n_dims != tensor.n_dims) {
         return false;
     }
 
     int64_t expected_stride = 1;
-    for (int i = tensor.tensor_storage.n_dims - 1; i >= 0; --i) {
+    for (int i = tensor.n_dims - 1; i >= 0; --i) {
         if (tensor.stride[i] != expected_stride) {
             return false;
         }
-        expected_stride *= tensor.tensor_storage.ne[i];
+        expected_stride *= tensor.ne[i];
     }
     return true;
 }
 
-static void collect_tensors_from_pickle_value(const PickleValue& value,
-                                              std::vector<TensorStorage>& tensor_storages) {
-    if (value.kind != PickleValue::DICT && value.kind != PickleValue::ORDERED_DICT) {
+static void collect_tensors_from_pickle_value(const PickleParser& parser,
+                                              const PickleValue& value,
+                                              std::vector<TensorStorage>& tensor_storages,
+                                              int depth = 0) {
+    // aliased dicts can form cycles, and state dicts are never nested deeply
+    if (!is_dict_value(value) || depth > 16) {
         return;
     }
 
-    for (const auto& item : value.dict_items) {
-        if (item.first.kind == PickleValue::STRING && item.second.kind == PickleValue::TENSOR) {
-            TensorStorage tensor_storage = item.second.tensor.tensor_storage;
-            tensor_storage.name          = item.first.str_value;
+    const std::vector<PickleValue>& items = parser.containers[value.index];
+    for (size_t i = 0; i + 1 < items.size(); i += 2) {
+        const PickleValue& key  = items[i];
+        const PickleValue& item = items[i + 1];
+        if (key.kind == PickleValue::STRING && item.kind == PickleValue::TENSOR) {
+            const PickleTensorInfo& tensor   = parser.tensors[item.index];
+            const PickleStorageInfo& storage = parser.storages[tensor.storage];
+
+            TensorStorage tensor_storage;
+            tensor_storage.name        = std::string(key.str_value);
+            tensor_storage.type        = storage.type;
+            tensor_storage.is_f64      = storage.is_f64;
+            tensor_storage.is_i64      = storage.is_i64;
+            tensor_storage.storage_key = std::string(storage.key);
+            tensor_storage.offset      = tensor.offset;
+            tensor_storage.n_dims      = tensor.n_dims;
+            for (int d = 0; d < tensor.n_dims; d++) {
+                tensor_storage.ne[d] = tensor.ne[d];
+            }
             tensor_storage.reverse_ne();
-            tensor_storages.push_back(tensor_storage);
-        } else if (item.second.kind == PickleValue::DICT || item.second.kind == PickleValue::ORDERED_DICT) {
-            collect_tensors_from_pickle_value(item.second, tensor_storages);
+            tensor_storages.push_back(std::move(tensor_storage));
+        } else if (is_dict_value(item)) {
+            collect_tensors_from_pickle_value(parser, item, tensor_storages, depth + 1);
         }
     }
 }
 
+static bool parse_decimal(const uint8_t* p, int len, int64_t* value) {
+    const char* begin             = (const char*)p;
+    std::from_chars_result result = std::from_chars(begin, begin + len, *value);
+    return result.ec == std::errc();
+}
+
 bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                                    size_t buffer_size,
                                    std::vector<TensorStorage>& tensor_storages,
@@ -560,8 +575,45 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
 
     const uint8_t* p   = buffer + 2;
     const uint8_t* end = buffer + buffer_size;
+    PickleParser parser;
     std::vector<PickleValue> stack;
-    std::unordered_map<int32_t, PickleValue> memo;
+    std::vector<PickleValue> memo;
+    std::vector<bool> memo_set;
+    size_t memo_entries = 0;  // MEMOIZE numbers entries by how many are stored
+
+    auto find_mark = [&]() -> int {
+        int mark_idx = (int)stack.size() - 1;
+        while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
+            --mark_idx;
+        }
+        return mark_idx;
+    };
+
+    // memo indices always come from earlier PUT opcodes, so bounding them by
+    // the buffer size keeps a corrupt index from growing the memo unbounded
+    auto memo_put = [&](int64_t memo_idx) -> bool {
+        if (stack.empty() || memo_idx < 0 || (uint64_t)memo_idx > buffer_size) {
+            return false;
+        }
+        if ((size_t)memo_idx >= memo.size()) {
+            memo.resize((size_t)memo_idx + 1);
+            memo_set.resize((size_t)memo_idx + 1, false);
+        }
+        if (!memo_set[(size_t)memo_idx]) {
+            memo_set[(size_t)memo_idx] = true;
+            memo_entries++;
+        }
+        memo[(size_t)memo_idx] = stack.back();
+        return true;
+    };
+
+    auto memo_get = [&](int64_t memo_idx) -> bool {
+        if (memo_idx < 0 || (size_t)memo_idx >= memo.size() || !memo_set[(size_t)memo_idx]) {
+            return false;
+        }
+        stack.push_back(memo[(size_t)memo_idx]);
+        return true;
+    };
 
     while (p < end) {
         uint8_t opcode = *p++;
@@ -572,7 +624,7 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                     return false;
                 }
                 size_t old_tensor_count = tensor_storages.size();
-                collect_tensors_from_pickle_value(stack.back(), tensor_storages);
+                collect_tensors_from_pickle_value(parser, stack.back(), tensor_storages);
                 if (tensor_storages.size() == old_tensor_count) {
                     set_error(error, "torch pickle does not contain a supported state_dict");
                     return false;
@@ -580,59 +632,55 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 return true;
             }
             case '}':  // EMPTY_DICT       = b'}'   # push empty dict
-                stack.push_back(make_dict_value(false));
+                stack.push_back(parser.make_container_value(PickleValue::DICT));
                 break;
             case ']':  // EMPTY_LIST       = b']'   # push empty list
-                stack.push_back(make_list_value());
+                stack.push_back(parser.make_container_value(PickleValue::LIST));
                 break;
             case 'l': {  // LIST             = b'l'   # build list from mark
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
+                int mark_idx = find_mark();
                 if (mark_idx < 0) {
                     set_error(error, "torch pickle list without mark");
                     return false;
                 }
-                std::vector<PickleValue> items(stack.begin() + mark_idx + 1, stack.end());
+                PickleValue list_value = parser.make_container_value(PickleValue::LIST);
+                parser.containers[list_value.index].assign(stack.begin() + mark_idx + 1, stack.end());
                 stack.erase(stack.begin() + mark_idx, stack.end());
-                PickleValue list_value = make_list_value();
-                list_value.items       = std::move(items);
-                stack.push_back(std::move(list_value));
+                stack.push_back(list_value);
             } break;
             case '(':  // MARK             = b'('   # push markobject
-                stack.push_back(make_mark_value());
+                stack.push_back(parser.make_value(PickleValue::MARK));
                 break;
             case ')':  // EMPTY_TUPLE      = b')'   # push empty tuple
-                stack.push_back(make_tuple_value({}));
+                stack.push_back(parser.make_tuple_value(nullptr, 0));
                 break;
             case 'N':  // NONE             = b'N'   # push None
-                stack.push_back(make_none_value());
+                stack.push_back(parser.make_value(PickleValue::NONE));
                 break;
             case 0x88:  // NEWTRUE          = b'\x88'  # push True
-                stack.push_back(make_bool_value(true));
+                stack.push_back(parser.make_value(PickleValue::BOOL, 1));
                 break;
             case 0x89:  // NEWFALSE         = b'\x89'  # push False
-                stack.push_back(make_bool_value(false));
+                stack.push_back(parser.make_value(PickleValue::BOOL, 0));
                 break;
             case 'K':  // BININT1          = b'K'   # push 1-byte unsigned int
                 if (p >= end) {
                     return false;
                 }
-                stack.push_back(make_int_value(*p++));
+                stack.push_back(parser.make_value(PickleValue::INT, *p++));
                 break;
             case 'M':  // BININT2          = b'M'   # push 2-byte unsigned int
                 if (p + 2 > end) {
                     return false;
                 }
-                stack.push_back(make_int_value(read_short(p)));
+                stack.push_back(parser.make_value(PickleValue::INT, read_short(p)));
                 p += 2;
                 break;
             case 'J':  // BININT           = b'J'   # push 4-byte signed int
                 if (p + 4 > end) {
                     return false;
                 }
-                stack.push_back(make_int_value(read_int(p)));
+                stack.push_back(parser.make_value(PickleValue::INT, read_int(p)));
                 p += 4;
                 break;
             case 'I': {  // INT              = b'I'   # push decimal integer line
@@ -640,27 +688,28 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if (len < 0) {
                     return false;
                 }
-                std::string s((const char*)p, len);
-                p += len + 1;
+                std::string_view s((const char*)p, len);
+                int64_t value = 0;
                 if (s == "01") {
-                    stack.push_back(make_bool_value(true));
+                    stack.push_back(parser.make_value(PickleValue::BOOL, 1));
                 } else if (s == "00") {
-                    stack.push_back(make_bool_value(false));
+                    stack.push_back(parser.make_value(PickleValue::BOOL, 0));
                 } else {
-                    stack.push_back(make_int_value(std::strtoll(s.c_str(), nullptr, 10)));
+                    parse_decimal(p, len, &value);
+                    stack.push_back(parser.make_value(PickleValue::INT, value));
                 }
+                p += len + 1;
             } break;
             case 'L': {  // LONG             = b'L'   # push decimal long integer line
                 int len = find_char(p, (int)(end - p), '\n');
                 if (len < 0) {
                     return false;
                 }
-                std::string s((const char*)p, len);
+                // from_chars stops at the trailing 'L' of Python 2 longs
+                int64_t value = 0;
+                parse_decimal(p, len, &value);
                 p += len + 1;
-                if (!s.empty() && s.back() == 'L') {
-                    s.pop_back();
-                }
-                stack.push_back(make_int_value(std::strtoll(s.c_str(), nullptr, 10)));
+                stack.push_back(parser.make_value(PickleValue::INT, value));
             } break;
             case 'F': {  // FLOAT            = b'F'   # push decimal float line
                 int len = find_char(p, (int)(end - p), '\n');
@@ -668,14 +717,14 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                     return false;
                 }
                 p += len + 1;
-                stack.push_back(make_none_value());
+                stack.push_back(parser.make_value(PickleValue::NONE));
             } break;
             case 'G':  // BINFLOAT         = b'G'   # push 8-byte binary float
                 if (p + 8 > end) {
                     return false;
                 }
                 p += 8;
-                stack.push_back(make_none_value());
+                stack.push_back(parser.make_value(PickleValue::NONE));
                 break;
             case 0x8A: {  // LONG1            = b'\x8a'  # push long integer; 1-byte length
                 if (p >= end) {
@@ -690,9 +739,11 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                     value |= (int64_t)p[i] << (i * 8);
                 }
                 p += n;
-                stack.push_back(make_int_value(value));
+                stack.push_back(parser.make_value(PickleValue::INT, value));
             } break;
-            case 'C': {  // SHORT_BINBYTES   = b'C'   # push bytes; length < 256
+            case 'C':     // SHORT_BINBYTES   = b'C'   # push bytes; length < 256
+            case 'U':     // SHORT_BINSTRING  = b'U'   # push string; length < 256
+            case 0x8C: {  // SHORT_BINUNICODE = b'\x8c'  # push UTF-8 string; length < 256
                 if (p >= end) {
                     return false;
                 }
@@ -700,21 +751,10 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if (p + len > end) {
                     return false;
                 }
-                stack.push_back(make_string_value(std::string((const char*)p, len)));
-                p += len;
-            } break;
-            case 'B': {  // BINBYTES         = b'B'   # push bytes; 4-byte length
-                if (p + 4 > end) {
-                    return false;
-                }
-                int32_t len = read_int(p);
-                p += 4;
-                if (len < 0 || p + len > end) {
-                    return false;
-                }
-                stack.push_back(make_string_value(std::string((const char*)p, len)));
+                stack.push_back(parser.make_string_value(std::string_view((const char*)p, len)));
                 p += len;
             } break;
+            case 'B':    // BINBYTES         = b'B'   # push bytes; 4-byte length
             case 'T':    // BINSTRING        = b'T'   # push string; 4-byte length
             case 'X': {  // BINUNICODE       = b'X'   # push UTF-8 string; 4-byte length
                 if (p + 4 > end) {
@@ -722,10 +762,10 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 }
                 int32_t len = read_int(p);
                 p += 4;
-                if (len < 0 || p + len > end) {
+                if (len < 0 || len > end - p) {
                     return false;
                 }
-                stack.push_back(make_string_value(std::string((const char*)p, len)));
+                stack.push_back(parser.make_string_value(std::string_view((const char*)p, len)));
                 p += len;
             } break;
             case 0x8D:    // BINUNICODE8      = b'\x8d'  # push UTF-8 string; 8-byte length
@@ -739,19 +779,7 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if (len > (uint64_t)(end - p)) {
                     return false;
                 }
-                stack.push_back(make_string_value(std::string((const char*)p, (size_t)len)));
-                p += len;
-            } break;
-            case 'U':     // SHORT_BINSTRING  = b'U'   # push string; length < 256
-            case 0x8C: {  // SHORT_BINUNICODE = b'\x8c'  # push UTF-8 string; length < 256
-                if (p >= end) {
-                    return false;
-                }
-                uint8_t len = *p++;
-                if (p + len > end) {
-                    return false;
-                }
-                stack.push_back(make_string_value(std::string((const char*)p, len)));
+                stack.push_back(parser.make_string_value(std::string_view((const char*)p, (size_t)len)));
                 p += len;
             } break;
             case 'S': {  // STRING           = b'S'   # push quoted string line
@@ -759,19 +787,19 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if (len < 0) {
                     return false;
                 }
-                std::string s((const char*)p, len);
+                std::string_view s((const char*)p, len);
                 p += len + 1;
                 if (s.size() >= 2 && (s[0] == '\'' || s[0] == '"') && s.back() == s[0]) {
                     s = s.substr(1, s.size() - 2);
                 }
-                stack.push_back(make_string_value(s));
+                stack.push_back(parser.make_string_value(s));
             } break;
             case 'V': {  // UNICODE          = b'V'   # push raw-unicode string line
                 int len = find_char(p, (int)(end - p), '\n');
                 if (len < 0) {
                     return false;
                 }
-                stack.push_back(make_string_value(std::string((const char*)p, len)));
+                stack.push_back(parser.make_string_value(std::string_view((const char*)p, len)));
                 p += len + 1;
             } break;
             case 'c': {  // GLOBAL           = b'c'   # push module/name global reference
@@ -779,62 +807,54 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if (len < 0) {
                     return false;
                 }
-                std::string module((const char*)p, len);
+                std::string global((const char*)p, len);
                 p += len + 1;
                 len = find_char(p, (int)(end - p), '\n');
                 if (len < 0) {
                     return false;
                 }
-                std::string name((const char*)p, len);
+                global += '.';
+                global.append((const char*)p, len);
                 p += len + 1;
-                stack.push_back(make_global_value(module + "." + name));
+                stack.push_back(parser.make_string_value(parser.intern(std::move(global)), PickleValue::GLOBAL));
             } break;
             case 0x93: {  // STACK_GLOBAL     = b'\x93'  # build global from module/name strings
                 if (stack.size() < 2 || stack[stack.size() - 2].kind != PickleValue::STRING ||
                     stack.back().kind != PickleValue::STRING) {
                     return false;
                 }
-                std::string name = stack.back().str_value;
-                stack.pop_back();
-                std::string module = stack.back().str_value;
-                stack.pop_back();
-                stack.push_back(make_global_value(module + "." + name));
+                std::string global(stack[stack.size() - 2].str_value);
+                global += '.';
+                global += stack.back().str_value;
+                stack.resize(stack.size() - 2);
+                stack.push_back(parser.make_string_value(parser.intern(std::move(global)), PickleValue::GLOBAL));
             } break;
             case 'h':  // BINGET           = b'h'   # read memo index, 1-byte arg
-                if (p >= end || !memo.count(*p)) {
+                if (p >= end || !memo_get(*p++)) {
                     return false;
                 }
-                stack.push_back(memo[*p++]);
                 break;
-            case 'j': {  // LONG_BINGET      = b'j'   # read memo index, 4-byte arg
-                if (p + 4 > end) {
-                    return false;
-                }
-                int32_t memo_idx = read_int(p);
-                if (!memo.count(memo_idx)) {
+            case 'j':  // LONG_BINGET      = b'j'   # read memo index, 4-byte arg
+                if (p + 4 > end || !memo_get(read_int(p))) {
                     return false;
                 }
-                stack.push_back(memo[memo_idx]);
                 p += 4;
-            } break;
+                break;
             case 'q':  // BINPUT           = b'q'   # write memo index, 1-byte arg
-                if (p >= end || stack.empty()) {
+                if (p >= end || !memo_put(*p++)) {
                     return false;
                 }
-                memo[*p++] = stack.back();
                 break;
             case 'r':  // LONG_BINPUT      = b'r'   # write memo index, 4-byte arg
-                if (p + 4 > end || stack.empty()) {
+                if (p + 4 > end || !memo_put(read_int(p))) {
                     return false;
                 }
-                memo[read_int(p)] = stack.back();
                 p += 4;
                 break;
             case 0x94:  // MEMOIZE          = b'\x94'  # store top of stack in memo
-                if (stack.empty()) {
+                if (!memo_put((int64_t)memo_entries)) {
                     return false;
                 }
-                memo[(int32_t)memo.size()] = stack.back();
                 break;
             case 0x95:  // FRAME            = b'\x95'  # indicate the beginning of a new frame
                 if (p + 8 > end) {
@@ -849,10 +869,7 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 stack.pop_back();
                 break;
             case '1': {  // POP_MARK         = b'1'   # discard stack through topmost mark
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
+                int mark_idx = find_mark();
                 if (mark_idx < 0) {
                     return false;
                 }
@@ -865,32 +882,27 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 stack.push_back(stack.back());
                 break;
             case 0x8F:  // EMPTY_SET        = b'\x8f'  # push empty set
-                stack.push_back(make_list_value());
+                stack.push_back(parser.make_container_value(PickleValue::LIST));
                 break;
-            case 0x90: {  // ADDITEMS         = b'\x90'  # add mark-delimited items to set
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
+            case 0x90:   // ADDITEMS         = b'\x90'  # add mark-delimited items to set
+            case 'e': {  // APPENDS          = b'e'   # extend list with mark-delimited items
+                int mark_idx = find_mark();
                 if (mark_idx <= 0 || stack[mark_idx - 1].kind != PickleValue::LIST) {
                     return false;
                 }
-                PickleValue& set_value = stack[mark_idx - 1];
-                set_value.items.insert(set_value.items.end(), stack.begin() + mark_idx + 1, stack.end());
+                std::vector<PickleValue>& items = parser.containers[stack[mark_idx - 1].index];
+                items.insert(items.end(), stack.begin() + mark_idx + 1, stack.end());
                 stack.erase(stack.begin() + mark_idx, stack.end());
             } break;
             case 0x91: {  // FROZENSET        = b'\x91'  # build frozenset from mark
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
+                int mark_idx = find_mark();
                 if (mark_idx < 0) {
                     return false;
                 }
-                PickleValue set_value = make_list_value();
-                set_value.items.insert(set_value.items.end(), stack.begin() + mark_idx + 1, stack.end());
+                PickleValue set_value = parser.make_container_value(PickleValue::LIST);
+                parser.containers[set_value.index].assign(stack.begin() + mark_idx + 1, stack.end());
                 stack.erase(stack.begin() + mark_idx, stack.end());
-                stack.push_back(std::move(set_value));
+                stack.push_back(set_value);
             } break;
             case 0x85:    // TUPLE1           = b'\x85'  # build 1-tuple from stack
             case 0x86:    // TUPLE2           = b'\x86'  # build 2-tuple from stack
@@ -899,21 +911,18 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 if ((int)stack.size() < tuple_size) {
                     return false;
                 }
-                std::vector<PickleValue> items(stack.end() - tuple_size, stack.end());
-                stack.erase(stack.end() - tuple_size, stack.end());
-                stack.push_back(make_tuple_value(std::move(items)));
+                PickleValue tuple_value = parser.make_tuple_value(stack.data() + stack.size() - tuple_size, tuple_size);
+                stack.resize(stack.size() - tuple_size);
+                stack.push_back(tuple_value);
             } break;
             case 't': {  // TUPLE            = b't'   # build tuple from mark
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
+                int mark_idx = find_mark();
                 if (mark_idx < 0) {
                     return false;
                 }
-                std::vector<PickleValue> items(stack.begin() + mark_idx + 1, stack.end());
+                PickleValue tuple_value = parser.make_tuple_value(stack.data() + mark_idx + 1, stack.size() - mark_idx - 1);
                 stack.erase(stack.begin() + mark_idx, stack.end());
-                stack.push_back(make_tuple_value(std::move(items)));
+                stack.push_back(tuple_value);
             } break;
             case 'Q': {  // BINPERSID        = b'Q'   # persistent id from stack
                 if (stack.empty()) {
@@ -921,74 +930,84 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 }
                 PickleValue pid = stack.back();
                 stack.pop_back();
-                if (pid.kind != PickleValue::TUPLE || pid.items.size() < 5 || pid.items[0].kind != PickleValue::STRING ||
-                    pid.items[1].kind != PickleValue::GLOBAL || pid.items[4].kind != PickleValue::INT ||
-                    pid.items[0].str_value != "storage") {
+                if (pid.kind != PickleValue::TUPLE || pid.int_value < 5) {
+                    return false;
+                }
+                const PickleValue* items = parser.tuple_begin(pid);
+                if (items[0].kind != PickleValue::STRING || items[1].kind != PickleValue::GLOBAL ||
+                    items[4].kind != PickleValue::INT || items[0].str_value != "storage") {
                     return false;
                 }
 
                 PickleStorageInfo storage;
-                storage.key = pickle_value_to_string(pid.items[2]);
-                if (storage.key.empty() || !parse_storage_type(pid.items[1].str_value, &storage)) {
+                storage.key = parser.value_to_string(items[2]);
+                if (storage.key.empty() || !parse_storage_type(items[1].str_value, &storage)) {
                     return false;
                 }
-                storage.nbytes              = (uint64_t)pid.items[4].int_value * storage.raw_element_nbytes;
-                storage_nbytes[storage.key] = storage.nbytes;
-                stack.push_back(make_storage_value(storage));
+                storage.nbytes                           = (uint64_t)items[4].int_value * storage.raw_element_nbytes;
+                storage_nbytes[std::string(storage.key)] = storage.nbytes;
+
+                PickleValue storage_value = parser.make_value(PickleValue::STORAGE);
+                storage_value.index       = (uint32_t)parser.storages.size();
+                parser.storages.push_back(storage);
+                stack.push_back(storage_value);
             } break;
             case 'R': {  // REDUCE           = b'R'   # apply callable to args
                 if (stack.size() < 2) {
                     return false;
                 }
-                PickleValue args = stack.back();
-                stack.pop_back();
-                PickleValue callable = stack.back();
-                stack.pop_back();
+                PickleValue args     = stack[stack.size() - 1];
+                PickleValue callable = stack[stack.size() - 2];
+                stack.resize(stack.size() - 2);
                 if (callable.kind != PickleValue::GLOBAL || args.kind != PickleValue::TUPLE) {
-                    stack.push_back(make_none_value());
+                    stack.push_back(parser.make_value(PickleValue::NONE));
                     break;
                 }
 
-                if (callable.str_value == "collections.OrderedDict" && args.items.empty()) {
-                    stack.push_back(make_dict_value(true));
+                if (callable.str_value == "collections.OrderedDict" && args.int_value == 0) {
+                    stack.push_back(parser.make_container_value(PickleValue::ORDERED_DICT));
                     break;
                 }
 
+                const PickleValue* items = parser.tuple_begin(args);
                 if ((callable.str_value == "torch._utils._rebuild_tensor_v2" || callable.str_value == "torch._utils._rebuild_tensor") &&
-                    args.items.size() >= 4 && args.items[0].kind == PickleValue::STORAGE &&
-                    args.items[1].kind == PickleValue::INT && args.items[2].kind == PickleValue::TUPLE &&
-                    args.items[3].kind == PickleValue::TUPLE) {
+                    args.int_value >= 4 && items[0].kind == PickleValue::STORAGE &&
+                    items[1].kind == PickleValue::INT && items[2].kind == PickleValue::TUPLE &&
+                    items[3].kind == PickleValue::TUPLE) {
+                    const PickleStorageInfo& storage = parser.storages[items[0].index];
                     PickleTensorInfo tensor;
-                    tensor.tensor_storage.type        = args.items[0].storage.type;
-                    tensor.tensor_storage.is_f64      = args.items[0].storage.is_f64;
-                    tensor.tensor_storage.is_i64      = args.items[0].storage.is_i64;
-                    tensor.tensor_storage.storage_key = args.items[0].storage.key;
-                    tensor.tensor_storage.offset      = (uint64_t)args.items[1].int_value * args.items[0].storage.raw_element_nbytes;
+                    tensor.storage = items[0].index;
+                    tensor.offset  = (uint64_t)items[1].int_value * storage.raw_element_nbytes;
 
-                    for (const auto& item : args.items[2].items) {
-                        if (item.kind != PickleValue::INT || tensor.tensor_storage.n_dims >= SD_MAX_DIMS) {
+                    const PickleValue* shape = parser.tuple_begin(items[2]);
+                    for (int64_t i = 0; i < items[2].int_value; i++) {
+                        if (shape[i].kind != PickleValue::INT || tensor.n_dims >= SD_MAX_DIMS) {
                             return false;
                         }
-                        tensor.tensor_storage.ne[tensor.tensor_storage.n_dims++] = item.int_value;
+                        tensor.ne[tensor.n_dims++] = shape[i].int_value;
                     }
 
-                    for (const auto& item : args.items[3].items) {
-                        if (item.kind != PickleValue::INT || tensor.stride_n_dims >= SD_MAX_DIMS) {
+                    const PickleValue* stride = parser.tuple_begin(items[3]);
+                    for (int64_t i = 0; i < items[3].int_value; i++) {
+                        if (stride[i].kind != PickleValue::INT || tensor.stride_n_dims >= SD_MAX_DIMS) {
                             return false;
                         }
-                        tensor.stride[tensor.stride_n_dims++] = item.int_value;
+                        tensor.stride[tensor.stride_n_dims++] = stride[i].int_value;
                     }
 
                     if (!tensor_is_contiguous(tensor)) {
                         return false;
                     }
-                    stack.push_back(make_tensor_value(tensor));
+                    PickleValue tensor_value = parser.make_value(PickleValue::TENSOR);
+                    tensor_value.index       = (uint32_t)parser.tensors.size();
+                    parser.tensors.push_back(tensor);
+                    stack.push_back(tensor_value);
                     break;
                 }
 
                 // Non-tensor checkpoint metadata can use REDUCE for arbitrary
                 // Python objects. Do not execute it; keep stack shape only.
-                stack.push_back(make_none_value());
+                stack.push_back(parser.make_value(PickleValue::NONE));
                 break;
             }
             case 'b':  // BUILD            = b'b'   # build object state
@@ -998,58 +1017,30 @@ bool parse_torch_state_dict_pickle(const uint8_t* buffer,
                 stack.pop_back();
                 break;
             case 'u': {  // SETITEMS         = b'u'   # add mark-delimited items to dict
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
-                if (mark_idx <= 0) {
+                int mark_idx = find_mark();
+                if (mark_idx <= 0 || !is_dict_value(stack[mark_idx - 1])) {
                     return false;
                 }
-                PickleValue& dict = stack[mark_idx - 1];
-                if (dict.kind != PickleValue::DICT && dict.kind != PickleValue::ORDERED_DICT) {
-                    return false;
-                }
-                for (int i = mark_idx + 1; i + 1 < (int)stack.size(); i += 2) {
-                    dict.dict_items.emplace_back(stack[i], stack[i + 1]);
-                }
+                std::vector<PickleValue>& items = parser.containers[stack[mark_idx - 1].index];
+                size_t n_pairs                  = (stack.size() - mark_idx - 1) / 2;
+                items.insert(items.end(), stack.begin() + mark_idx + 1, stack.begin() + mark_idx + 1 + 2 * n_pairs);
                 stack.erase(stack.begin() + mark_idx, stack.end());
             } break;
             case 's': {  // SETITEM          = b's'   # add key/value to dict
-                if (stack.size() < 3) {
+                if (stack.size() < 3 || !is_dict_value(stack[stack.size() - 3])) {
                     return false;
                 }
-                PickleValue value = stack.back();
-                stack.pop_back();
-                PickleValue key = stack.back();
-                stack.pop_back();
-                PickleValue& dict = stack.back();
-                if (dict.kind != PickleValue::DICT && dict.kind != PickleValue::ORDERED_DICT) {
-                    return false;
-                }
-                dict.dict_items.emplace_back(key, value);
-            } break;
-            case 'e': {  // APPENDS          = b'e'   # extend list with mark-delimited items
-                int mark_idx = (int)stack.size() - 1;
-                while (mark_idx >= 0 && stack[mark_idx].kind != PickleValue::MARK) {
-                    --mark_idx;
-                }
-                if (mark_idx <= 0 || stack[mark_idx - 1].kind != PickleValue::LIST) {
-                    return false;
-                }
-                PickleValue& list_value = stack[mark_idx - 1];
-                list_value.items.insert(list_value.items.end(), stack.begin() + mark_idx + 1, stack.end());
-                stack.erase(stack.begin() + mark_idx, stack.end());
+                std::vector<PickleValue>& items = parser.containers[stack[stack.size() - 3].index];
+                items.push_back(stack[stack.size() - 2]);
+                items.push_back(stack[stack.size() - 1]);
+                stack.resize(stack.size() - 2);
             } break;
             case 'a': {  // APPEND           = b'a'   # append item to list
-                if (stack.size() < 2) {
+                if (stack.size() < 2 || stack[stack.size() - 2].kind != PickleValue::LIST) {
                     return false;
                 }
-                PickleValue item = stack.back();
+                parser.containers[stack[stack.size() - 2].index].push_back(stack.back());
                 stack.pop_back();
-                if (stack.back().kind != PickleValue::LIST) {
-                    return false;
-                }
-                stack.back().items.push_back(item);
             } break;
             default:
                 set_error(error,
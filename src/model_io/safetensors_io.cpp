@@ -83,10 +83,10 @@ static ggml_type safetensors_dtype_to_ggml_type(const std::string& dtype) {
     return ttype;
 }
 
-// https://huggingface.co/docs/safetensors/index
-bool read_safetensors_file(const std::string& file_path,
-                           std::vector<TensorStorage>& tensor_storages,
-                           std::string* error) {
+static bool read_safetensors_header(const std::string& file_path,
+                                    nlohmann::json& header_,
+                                    size_t& header_size_,
+                                    std::string* error) {
     std::ifstream file(file_path, std::ios::binary);
     if (!file.is_open()) {
         set_error(error, "failed to open '" + file_path + "'");
@@ -127,7 +127,6 @@ bool read_safetensors_file(const std::string& file_path,
         return false;
     }
 
-    nlohmann::json header_;
     try {
         header_ = nlohmann::json::parse(header_buf.data());
     } catch (const std::exception&) {
@@ -135,6 +134,19 @@ bool read_safetensors_file(const std::string& file_path,
         return false;
     }
 
+    return true;
+}
+
+// https://huggingface.co/docs/safetensors/index
+bool read_safetensors_file(const std::string& file_path,
+                           std::vector<TensorStorage>& tensor_storages,
+                           std::string* error) {
+    nlohmann::json header_;
+    size_t header_size_ = 0;
+    if (!read_safetensors_header(file_path, header_, header_size_, error)) {
+        return false;
+    }
+
     tensor_storages.clear();
     for (auto& item : header_.items()) {
         std::string name           = item.key();
@@ -223,6 +235,27 @@ bool read_safetensors_file(const std::string& file_path,
     return true;
 }
 
+bool read_safetensors_metadata(const std::string& file_path,
+                               std::vector<std::pair<std::string, std::string>>& metadata,
+                               std::string* error) {
+    nlohmann::json header_;
+    size_t header_size_ = 0;
+    if (!read_safetensors_header(file_path, header_, header_size_, error)) {
+        return false;
+    }
+    metadata.clear();
+    auto it = header_.find("__metadata__");
+    if (it == header_.end() || !it->is_object()) {
+        return true;
+    }
+    for (auto& item : it->items()) {
+        if (item.value().is_string()) {
+            metadata.emplace_back(item.key(), item.value().get<std::string>());
+        }
+    }
+    return true;
+}
+
 static bool ggml_type_to_safetensors_dtype(ggml_type type, std::string* dtype) {
     switch (type) {
         case GGML_TYPE_F16:
@@ -244,8 +277,17 @@ static bool ggml_type_to_safetensors_dtype(ggml_type type, std::string* dtype) {
 
 bool write_safetensors_file(const std::string& file_path,
                             const std::vector<TensorWriteInfo>& tensors,
-                            std::string* error) {
+                            std::string* error,
+                            const TensorWriteStream* stream,
+                            const std::vector<std::pair<std::string, std::string>>* metadata) {
     nlohmann::ordered_json header = nlohmann::ordered_json::object();
+    if (metadata != nullptr && !metadata->empty()) {
+        nlohmann::ordered_json metadata_json = nlohmann::ordered_json::object();
+        for (const auto& [key, value] : *metadata) {
+            metadata_json[key] = value;
+        }
+        header["__metadata__"] = metadata_json;
+    }
 
     uint64_t data_offset = 0;
     for (const TensorWriteInfo& write_tensor : tensors) {
@@ -300,17 +342,28 @@ bool write_safetensors_file(const std::string& file_path,
         return false;
     }
 
-    for (const TensorWriteInfo& write_tensor : tensors) {
-        ggml_tensor* tensor        = write_tensor.tensor;
-        const std::string name     = ggml_get_name(tensor);
-        const size_t tensor_nbytes = ggml_nbytes(tensor);
-        file.write((const char*)tensor->data, tensor_nbytes);
-        if (!file) {
-            set_error(error,
-                      "failed to write tensor '" + name + "' to '" + file_path + "'");
+    auto write_batch = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ggml_tensor* tensor        = tensors[i].tensor;
+            const std::string name     = ggml_get_name(tensor);
+            const size_t tensor_nbytes = ggml_nbytes(tensor);
+            file.write((const char*)tensor->data, tensor_nbytes);
+            if (!file) {
+                set_error(error,
+                          "failed to write tensor '" + name + "' to '" + file_path + "'");
+                return false;
+            }
+        }
+        return true;
+    };
+    if (stream != nullptr) {
+        if (!write_tensor_stream(tensors, *stream, write_batch)) {
+            if (error != nullptr && error->empty()) {
+                set_error(error, "failed to load tensor data for '" + file_path + "'");
+            }
             return false;
         }
+        return true;
     }
-
-    return true;
+    return write_batch(0, tensors.size());
 }
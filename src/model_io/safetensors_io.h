@@ -2,6 +2,7 @@
 #define __SD_MODEL_IO_SAFETENSORS_IO_H__
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "tensor_storage.h"
@@ -10,8 +11,15 @@ bool is_safetensors_file(const std::string& file_path);
 bool read_safetensors_file(const std::string& file_path,
                            std::vector<TensorStorage>& tensor_storages,
                            std::string* error = nullptr);
+// The string entries of the header's __metadata__ object.
+bool read_safetensors_metadata(const std::string& file_path,
+                               std::vector<std::pair<std::string, std::string>>& metadata,
+                               std::string* error = nullptr);
+// metadata, when given, is written as the header's __metadata__ object.
 bool write_safetensors_file(const std::string& file_path,
                             const std::vector<TensorWriteInfo>& tensors,
-                            std::string* error = nullptr);
+                            std::string* error                                               = nullptr,
+                            const TensorWriteStream* stream                                  = nullptr,
+                            const std::vector<std::pair<std::string, std::string>>* metadata = nullptr);
 
 #endif  // __SD_MODEL_IO_SAFETENSORS_IO_H__
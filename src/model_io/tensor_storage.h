@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -129,4 +130,41 @@ struct TensorWriteInfo {
 
 typedef std::function<bool(const TensorStorage&, ggml_tensor**)> on_new_tensor_cb_t;
 
+// Tensor data handed to a writer batch by batch, so a file can be written
+// without holding all of it. load(begin, end) sets the data of the tensors
+// [begin, end); batch_bytes bounds a batch unless one tensor is larger. The
+// data of a batch has to stay valid until the batch after it is loaded.
+struct TensorWriteStream {
+    size_t batch_bytes = 0;
+    std::function<bool(size_t begin, size_t end)> load;
+};
+
+// Loads the batches of stream in order and runs write_batch on each one,
+// writing a batch while the next one loads.
+inline bool write_tensor_stream(const std::vector<TensorWriteInfo>& tensors,
+                                const TensorWriteStream& stream,
+                                const std::function<bool(size_t begin, size_t end)>& write_batch) {
+    std::future<bool> pending_write;
+    size_t begin = 0;
+    while (begin < tensors.size()) {
+        size_t end   = begin;
+        size_t bytes = 0;
+        while (end < tensors.size() &&
+               (end == begin || bytes + ggml_nbytes(tensors[end].tensor) <= stream.batch_bytes)) {
+            bytes += ggml_nbytes(tensors[end].tensor);
+            ++end;
+        }
+        bool loaded = stream.load(begin, end);
+        if (pending_write.valid() && !pending_write.get()) {
+            return false;
+        }
+        if (!loaded) {
+            return false;
+        }
+        pending_write = std::async(std::launch::async, write_batch, begin, end);
+        begin         = end;
+    }
+    return !pending_write.valid() || pending_write.get();
+}
+
 #endif  // __SD_TENSOR_STORAGE_H__
@@ -2,10 +2,12 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "binary_io.h"
 #include "pickle_io.h"
 
 #include "zip.h"
@@ -25,14 +27,23 @@ bool is_torch_zip_file(const std::string& file_path) {
     return true;
 }
 
-static bool find_zip_entry(zip_t* zip, const std::string& entry_name, int* index, uint64_t* size) {
+struct ZipEntryInfo {
+    int index              = -1;
+    uint64_t size          = 0;
+    uint64_t comp_size     = 0;
+    uint64_t header_offset = 0;
+};
+
+static bool find_zip_entry(zip_t* zip, const std::string& entry_name, ZipEntryInfo* info) {
     size_t n = zip_entries_total(zip);
     for (size_t i = 0; i < n; ++i) {
         zip_entry_openbyindex(zip, i);
         std::string name = zip_entry_name(zip);
         if (name == entry_name) {
-            *index = (int)i;
-            *size  = zip_entry_size(zip);
+            info->index         = (int)i;
+            info->size          = zip_entry_size(zip);
+            info->comp_size     = zip_entry_comp_size(zip);
+            info->header_offset = zip_entry_header_offset(zip);
             zip_entry_close(zip);
             return true;
         }
@@ -41,9 +52,38 @@ static bool find_zip_entry(zip_t* zip, const std::string& entry_name, int* index
     return false;
 }
 
+// torch.save writes tensor storages uncompressed, so their bytes usually sit
+// verbatim in the archive. Returns the file offset of such a STORED entry's
+// data so it can be read (or mmapped) like a safetensors tensor.
+static bool get_stored_entry_data_offset(std::ifstream& file, const ZipEntryInfo& info, uint64_t* data_offset) {
+    if (!file.is_open() || info.comp_size != info.size) {
+        return false;
+    }
+
+    uint8_t header[30];
+    file.clear();
+    file.seekg(info.header_offset);
+    file.read((char*)header, sizeof(header));
+    if (!file || (uint32_t)model_io::read_int(header) != 0x04034b50) {
+        return false;
+    }
+
+    uint16_t flags       = model_io::read_short(header + 6);
+    uint16_t method      = model_io::read_short(header + 8);
+    uint16_t name_length = model_io::read_short(header + 26);
+    uint16_t extra_size  = model_io::read_short(header + 28);
+    if (method != 0 || (flags & 0x1) != 0) {
+        return false;
+    }
+
+    *data_offset = info.header_offset + sizeof(header) + name_length + extra_size;
+    return true;
+}
+
 static bool parse_zip_data_pkl(const uint8_t* buffer,
                                size_t buffer_size,
                                zip_t* zip,
+                               std::ifstream& file,
                                const std::string& dir,
                                std::vector<TensorStorage>& tensor_storages,
                                std::string* error) {
@@ -63,12 +103,12 @@ static bool parse_zip_data_pkl(const uint8_t* buffer,
         }
 
         const std::string entry_name = dir + "data/" + tensor_storage.storage_key;
-        int zip_index                = -1;
-        uint64_t entry_size          = 0;
-        if (!find_zip_entry(zip, entry_name, &zip_index, &entry_size)) {
+        ZipEntryInfo entry;
+        if (!find_zip_entry(zip, entry_name, &entry)) {
             set_error(error, "storage entry '" + entry_name + "' was not found");
             return false;
         }
+        uint64_t entry_size = entry.size;
 
         auto it_storage_size = storage_nbytes.find(tensor_storage.storage_key);
         if (it_storage_size != storage_nbytes.end() && entry_size < it_storage_size->second) {
@@ -82,7 +122,12 @@ static bool parse_zip_data_pkl(const uint8_t* buffer,
             return false;
         }
 
-        tensor_storage.index_in_zip = zip_index;
+        uint64_t data_offset = 0;
+        if (get_stored_entry_data_offset(file, entry, &data_offset)) {
+            tensor_storage.offset += data_offset;
+        } else {
+            tensor_storage.index_in_zip = entry.index;
+        }
         tensor_storage.storage_key.clear();
         tensor_storages.push_back(tensor_storage);
     }
@@ -99,6 +144,8 @@ bool read_torch_zip_file(const std::string& file_path,
         return false;
     }
 
+    std::ifstream file(file_path, std::ios::binary);
+
     tensor_storages.clear();
     bool success        = true;
     bool found_data_pkl = false;
@@ -117,7 +164,7 @@ bool read_torch_zip_file(const std::string& file_path,
             if (pkl_data == nullptr || pkl_size == 0) {
                 set_error(error, "failed to read '" + name + "' from '" + file_path + "'");
                 success = false;
-            } else if (!parse_zip_data_pkl((const uint8_t*)pkl_data, pkl_size, zip, dir, tensor_storages, error)) {
+            } else if (!parse_zip_data_pkl((const uint8_t*)pkl_data, pkl_size, zip, file, dir, tensor_storages, error)) {
                 success = false;
             }
 
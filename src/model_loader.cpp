@@ -2,9 +2,10 @@
 #include <atomic>
 #include <chrono>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdlib>
-#include <fstream>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <regex>
@@ -14,7 +15,14 @@
 #include <unordered_map>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "core/util.h"
+#include "model_io/gguf_index.h"
 #include "model_io/gguf_io.h"
 #include "model_io/safetensors_io.h"
 #include "model_io/torch_legacy_io.h"
@@ -23,6 +31,7 @@
 #include "stable-diffusion.h"
 
 #include "core/ggml_extend_backend.h"
+#include "core/memory_timeline.h"
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
 #include "ggml.h"
@@ -151,13 +160,77 @@ void i64_to_i32_vec(int64_t* src, int32_t* dst, int64_t n) {
     }
 }
 
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SD_HAVE_F16C_KERNEL 1
+// Built for F16C regardless of the target flags and picked at run time, since
+// the library is usually not compiled with -mf16c.
+__attribute__((target("avx,f16c"))) static void fp16_to_fp32_row_f16c(const ggml_fp16_t* src, float* dst, int64_t n) {
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+    for (; i < n; ++i) {
+        dst[i] = ggml_fp16_to_fp32(src[i]);
+    }
+}
+#endif
+
+static void fp16_to_fp32_row(const ggml_fp16_t* src, float* dst, int64_t n) {
+#if defined(SD_HAVE_F16C_KERNEL)
+    static const bool has_f16c = __builtin_cpu_supports("f16c");
+    if (has_f16c) {
+        fp16_to_fp32_row_f16c(src, dst, n);
+        return;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    int64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t half = vreinterpret_f16_u16(vld1_u16(reinterpret_cast<const uint16_t*>(src + i)));
+        vst1q_f32(dst + i, vcvt_f32_f16(half));
+    }
+    if (i < n) {
+        ggml_fp16_to_fp32_row(src + i, dst + i, n - i);
+    }
+    return;
+#endif
+    ggml_fp16_to_fp32_row(src, dst, n);
+}
+
+// bf16 is the upper half of an f32, so this loop is a widen and shift that
+// compilers vectorize on their own.
+static void bf16_to_fp32_row(const ggml_bf16_t* src, float* dst, int64_t n) {
+    const uint16_t* bits = reinterpret_cast<const uint16_t*>(src);
+    for (int64_t i = 0; i < n; ++i) {
+        uint32_t value = static_cast<uint32_t>(bits[i]) << 16;
+        memcpy(dst + i, &value, sizeof(value));
+    }
+}
+
+static void to_fp32_row(const void* src, ggml_type src_type, float* dst, int64_t n) {
+    if (src_type == GGML_TYPE_F16) {
+        fp16_to_fp32_row((const ggml_fp16_t*)src, dst, n);
+        return;
+    }
+    if (src_type == GGML_TYPE_BF16) {
+        bf16_to_fp32_row((const ggml_bf16_t*)src, dst, n);
+        return;
+    }
+    auto qtype = ggml_get_type_traits(src_type);
+    if (qtype->to_float == nullptr) {
+        throw std::runtime_error(sd_format("type %s unsupported for integer quantization: no dequantization available",
+                                           ggml_type_name(src_type)));
+    }
+    qtype->to_float(src, dst, n);
+}
+
 void convert_tensor(void* src,
                     ggml_type src_type,
                     void* dst,
                     ggml_type dst_type,
-                    int nrows,
-                    int n_per_row) {
-    int n = nrows * n_per_row;
+                    int64_t nrows,
+                    int64_t n_per_row) {
+    int64_t n = nrows * n_per_row;
     if (src_type == dst_type) {
         size_t nbytes = n * ggml_type_size(src_type) / ggml_blck_size(src_type);
         memcpy(((char*)dst), ((char*)src), nbytes);
@@ -170,28 +243,14 @@ void convert_tensor(void* src,
             ggml_quantize_chunk(dst_type, (float*)src, dst, 0, nrows, n_per_row, im);
         }
     } else if (dst_type == GGML_TYPE_F32) {
-        if (src_type == GGML_TYPE_F16) {
-            ggml_fp16_to_fp32_row((ggml_fp16_t*)src, (float*)dst, n);
-        } else {
-            auto qtype = ggml_get_type_traits(src_type);
-            if (qtype->to_float == nullptr) {
-                throw std::runtime_error(sd_format("type %s unsupported for integer quantization: no dequantization available",
-                                                   ggml_type_name(src_type)));
-            }
-            qtype->to_float(src, (float*)dst, n);
-        }
+        to_fp32_row(src, src_type, (float*)dst, n);
     } else {
         // src_type == GGML_TYPE_F16 => dst_type is quantized
         // src_type is quantized => dst_type == GGML_TYPE_F16 or dst_type is quantized
-        auto qtype = ggml_get_type_traits(src_type);
-        if (qtype->to_float == nullptr) {
-            throw std::runtime_error(sd_format("type %s unsupported for integer quantization: no dequantization available",
-                                               ggml_type_name(src_type)));
-        }
         std::vector<char> buf;
         buf.resize(sizeof(float) * n);
         char* src_data_f32 = buf.data();
-        qtype->to_float(src, (float*)src_data_f32, n);
+        to_fp32_row(src, src_type, (float*)src_data_f32, n);
         if (dst_type == GGML_TYPE_F16) {
             ggml_fp32_to_fp16_row((float*)src_data_f32, (ggml_fp16_t*)dst, n);
         } else {
@@ -202,6 +261,45 @@ void convert_tensor(void* src,
     }
 }
 
+// Per worker page-locked buffer that disk streamed tensors are read into
+// before the upload, so they copy to the device by DMA. Larger tensors are
+// uploaded from pageable memory.
+static const size_t STREAM_STAGING_BYTES = 64ull * 1024 * 1024;
+
+// Type conversion of one large tensor, split into row chunks that every load
+// worker can pick up, so a huge embedding does not convert on a single core.
+struct ConvertJob {
+    const char* src        = nullptr;
+    ggml_type src_type     = GGML_TYPE_F32;
+    char* dst              = nullptr;
+    ggml_type dst_type     = GGML_TYPE_F32;
+    int64_t nrows          = 0;
+    int64_t n_per_row      = 0;
+    int64_t rows_per_chunk = 0;
+    std::atomic<int64_t> next_row{0};
+    std::atomic<int64_t> done_rows{0};
+
+    // Converts the next chunk; false once every chunk has been taken.
+    bool run_chunk() {
+        int64_t row = next_row.fetch_add(rows_per_chunk);
+        if (row >= nrows) {
+            return false;
+        }
+        int64_t rows = std::min(rows_per_chunk, nrows - row);
+        convert_tensor((void*)(src + row * ggml_row_size(src_type, n_per_row)),
+                       src_type,
+                       dst + row * ggml_row_size(dst_type, n_per_row),
+                       dst_type,
+                       rows,
+                       n_per_row);
+        done_rows.fetch_add(rows);
+        return true;
+    }
+
+    bool all_taken() const { return next_row.load() >= nrows; }
+    bool done() const { return done_rows.load() >= nrows; }
+};
+
 /*================================================= ModelLoader ==================================================*/
 
 ModelLoader::ModelLoader()
@@ -284,9 +382,26 @@ bool ModelLoader::init_from_gguf_file(const std::string& file_path, const std::s
 
     std::vector<TensorStorage> tensor_storages;
     std::string error;
-    if (!read_gguf_file(file_path, tensor_storages, &error)) {
-        LOG_ERROR("%s", error.c_str());
-        return false;
+    std::string index_path;
+    std::unique_ptr<GGUFIndex> index;
+    if (!index_dir_.empty()) {
+        index_path = gguf_index_path(index_dir_, file_path);
+        index      = GGUFIndex::open(index_path, file_path);
+    }
+    if (index) {
+        LOG_DEBUG("using GGUF index '%s'", index_path.c_str());
+        tensor_storages.reserve(index->size());
+        for (size_t i = 0; i < index->size(); i++) {
+            tensor_storages.push_back(index->tensor(i));
+        }
+    } else {
+        if (!read_gguf_file(file_path, tensor_storages, &error)) {
+            LOG_ERROR("%s", error.c_str());
+            return false;
+        }
+        if (!index_path.empty() && !write_gguf_index(index_path, file_path, tensor_storages, &error)) {
+            LOG_DEBUG("%s", error.c_str());
+        }
     }
 
     size_t file_index = add_file_path(file_path);
@@ -383,16 +498,24 @@ bool ModelLoader::init_from_torch_zip_file(const std::string& file_path, const s
 
     size_t file_index = add_file_path(file_path);
 
+    size_t stored_tensors = 0;
     for (auto& tensor_storage : tensor_storages) {
         if (!starts_with(tensor_storage.name, prefix)) {
             tensor_storage.name = prefix + tensor_storage.name;
         }
         tensor_storage.file_index = file_index;
+        if (tensor_storage.index_in_zip < 0) {
+            stored_tensors++;
+        }
 
         add_tensor_storage(tensor_storage);
 
         // LOG_DEBUG("%s", tensor_storage.to_string().c_str());
     }
+    LOG_DEBUG("%zu/%zu tensors are stored uncompressed in '%s'",
+              stored_tensors,
+              tensor_storages.size(),
+              file_path.c_str());
 
     return true;
 }
@@ -656,17 +779,31 @@ std::map<ggml_type, uint32_t> ModelLoader::get_wtype_stat() {
     return wtype_stat;
 }
 
-std::map<ggml_type, uint32_t> ModelLoader::get_conditioner_wtype_stat() {
+static bool is_conditioner_tensor(const std::string& name) {
+    return name.find("text_encoders") != std::string::npos ||
+           name.find("cond_stage_model") != std::string::npos ||
+           name.find("te.text_model.") != std::string::npos ||
+           name.find("conditioner") != std::string::npos;
+}
+
+static bool is_diffusion_model_tensor(const std::string& name) {
+    return name.find("model.diffusion_model.") != std::string::npos || name.find("unet.") != std::string::npos;
+}
+
+static bool is_vae_tensor(const std::string& name) {
+    return name.find("vae.") != std::string::npos ||
+           name.find("first_stage_model") != std::string::npos;
+}
+
+static bool is_control_net_tensor(const std::string& name) {
+    return name.find("control_model.") != std::string::npos;
+}
+
+static std::map<ggml_type, uint32_t> wtype_stat_of(const String2TensorStorage& tensor_storage_map,
+                                                   bool (*filter)(const std::string&)) {
     std::map<ggml_type, uint32_t> wtype_stat;
     for (auto& [name, tensor_storage] : tensor_storage_map) {
-        if (is_unused_tensor(tensor_storage.name)) {
-            continue;
-        }
-
-        if ((tensor_storage.name.find("text_encoders") == std::string::npos &&
-             tensor_storage.name.find("cond_stage_model") == std::string::npos &&
-             tensor_storage.name.find("te.text_model.") == std::string::npos &&
-             tensor_storage.name.find("conditioner") == std::string::npos)) {
+        if (is_unused_tensor(tensor_storage.name) || !filter(tensor_storage.name)) {
             continue;
         }
 
@@ -680,47 +817,60 @@ std::map<ggml_type, uint32_t> ModelLoader::get_conditioner_wtype_stat() {
     return wtype_stat;
 }
 
-std::map<ggml_type, uint32_t> ModelLoader::get_diffusion_model_wtype_stat() {
-    std::map<ggml_type, uint32_t> wtype_stat;
+// Bytes the params take once loaded, in the type they are converted to.
+static uint64_t params_bytes_of(const String2TensorStorage& tensor_storage_map,
+                                bool (*filter)(const std::string&)) {
+    uint64_t bytes = 0;
     for (auto& [name, tensor_storage] : tensor_storage_map) {
-        if (is_unused_tensor(tensor_storage.name)) {
+        if (is_unused_tensor(tensor_storage.name) || !filter(tensor_storage.name)) {
             continue;
         }
+        ggml_type type = tensor_storage.expected_type != GGML_TYPE_COUNT ? tensor_storage.expected_type : tensor_storage.type;
+        bytes += static_cast<uint64_t>(tensor_storage.nelements()) * ggml_type_size(type) / ggml_blck_size(type);
+    }
+    return bytes;
+}
 
-        if (tensor_storage.name.find("model.diffusion_model.") == std::string::npos && tensor_storage.name.find("unet.") == std::string::npos) {
-            continue;
-        }
+std::map<ggml_type, uint32_t> ModelLoader::get_conditioner_wtype_stat() {
+    return wtype_stat_of(tensor_storage_map, is_conditioner_tensor);
+}
 
-        auto iter = wtype_stat.find(tensor_storage.type);
-        if (iter != wtype_stat.end()) {
-            iter->second++;
-        } else {
-            wtype_stat[tensor_storage.type] = 1;
-        }
-    }
-    return wtype_stat;
+std::map<ggml_type, uint32_t> ModelLoader::get_diffusion_model_wtype_stat() {
+    return wtype_stat_of(tensor_storage_map, is_diffusion_model_tensor);
 }
 
 std::map<ggml_type, uint32_t> ModelLoader::get_vae_wtype_stat() {
-    std::map<ggml_type, uint32_t> wtype_stat;
-    for (auto& [name, tensor_storage] : tensor_storage_map) {
-        if (is_unused_tensor(tensor_storage.name)) {
-            continue;
-        }
+    return wtype_stat_of(tensor_storage_map, is_vae_tensor);
+}
 
-        if (tensor_storage.name.find("vae.") == std::string::npos &&
-            tensor_storage.name.find("first_stage_model") == std::string::npos) {
-            continue;
-        }
+uint64_t ModelLoader::get_conditioner_params_bytes() {
+    return params_bytes_of(tensor_storage_map, is_conditioner_tensor);
+}
 
-        auto iter = wtype_stat.find(tensor_storage.type);
-        if (iter != wtype_stat.end()) {
-            iter->second++;
-        } else {
-            wtype_stat[tensor_storage.type] = 1;
+uint64_t ModelLoader::get_diffusion_model_params_bytes() {
+    return params_bytes_of(tensor_storage_map, is_diffusion_model_tensor);
+}
+
+uint64_t ModelLoader::get_vae_params_bytes() {
+    return params_bytes_of(tensor_storage_map, is_vae_tensor);
+}
+
+uint64_t ModelLoader::get_control_net_params_bytes() {
+    return params_bytes_of(tensor_storage_map, is_control_net_tensor);
+}
+
+ggml_type parse_ggml_type_name(const std::string& type_name) {
+    if (type_name == "f32") {
+        return GGML_TYPE_F32;
+    }
+    ggml_type tensor_type = GGML_TYPE_COUNT;
+    for (size_t i = 0; i < GGML_TYPE_COUNT; i++) {
+        auto trait = ggml_get_type_traits((ggml_type)i);
+        if (trait->to_float && trait->type_size && type_name == trait->type_name) {
+            tensor_type = (ggml_type)i;
         }
     }
-    return wtype_stat;
+    return tensor_type;
 }
 
 TensorTypeRules parse_tensor_type_rules(const std::string& tensor_type_rules) {
@@ -736,19 +886,7 @@ TensorTypeRules parse_tensor_type_rules(const std::string& tensor_type_rules) {
         std::string tensor_pattern = item.substr(0, pos);
         std::string type_name      = item.substr(pos + 1);
 
-        ggml_type tensor_type = GGML_TYPE_COUNT;
-
-        if (type_name == "f32") {
-            tensor_type = GGML_TYPE_F32;
-        } else {
-            for (size_t i = 0; i < GGML_TYPE_COUNT; i++) {
-                auto trait = ggml_get_type_traits((ggml_type)i);
-                if (trait->to_float && trait->type_size && type_name == trait->type_name) {
-                    tensor_type = (ggml_type)i;
-                }
-            }
-        }
-
+        ggml_type tensor_type = parse_ggml_type_name(type_name);
         if (tensor_type != GGML_TYPE_COUNT) {
             result.emplace_back(tensor_pattern, tensor_type);
         } else {
@@ -818,7 +956,9 @@ void ModelLoader::process_model_files(bool enable_mmap, bool writable_mmap) {
         fdata.is_zip        = is_zip;
         fdata.tensors       = std::move(file_tensors);
 
-        if (enable_mmap && !is_zip) {
+        // uncompressed zip entries were resolved to plain file offsets, so
+        // archives can be mapped too; only deflated entries go through zip
+        if (enable_mmap) {
             LOG_DEBUG("using mmap for I/O");
             std::unique_ptr<MmapWrapper> mmapped = MmapWrapper::create(file_path, writable_mmap);
             if (mmapped) {
@@ -885,7 +1025,8 @@ std::vector<MmapTensorStore> ModelLoader::mmap_tensors(std::map<std::string, ggm
             if (dst_tensor == nullptr)
                 continue;
 
-            if (tensor_storage.is_f8_e4m3 ||
+            if (tensor_storage.index_in_zip >= 0 ||
+                tensor_storage.is_f8_e4m3 ||
                 tensor_storage.is_f8_e5m2 ||
                 tensor_storage.is_f64 ||
                 tensor_storage.is_i64 ||
@@ -933,9 +1074,58 @@ std::vector<MmapTensorStore> ModelLoader::mmap_tensors(std::map<std::string, ggm
     return result;
 }
 
+std::shared_ptr<struct ggml_backend_buffer> ModelLoader::map_to_device(const void* data,
+                                                                     ggml_backend_dev_t dev,
+                                                                     void** device_data) {
+    if (data == nullptr || dev == nullptr) {
+        return nullptr;
+    }
+    for (auto& fdata : file_data) {
+        if (!fdata.mmbuffer) {
+            continue;
+        }
+        const uint8_t* base = static_cast<const uint8_t*>(ggml_backend_buffer_get_base(fdata.mmbuffer.get()));
+        size_t size         = ggml_backend_buffer_get_size(fdata.mmbuffer.get());
+        const uint8_t* ptr  = static_cast<const uint8_t*>(data);
+        if (ptr < base || ptr >= base + size) {
+            continue;
+        }
+
+        auto it = fdata.device_mmbuffers.find(dev);
+        if (it == fdata.device_mmbuffers.end()) {
+            size_t max_tensor_size = 0;
+            for (const auto& tensor_storage : fdata.tensors) {
+                max_tensor_size = std::max(max_tensor_size, static_cast<size_t>(tensor_storage.nbytes()));
+            }
+            ggml_backend_buffer_t buffer = ggml_backend_dev_buffer_from_host_ptr(dev,
+                                                                                 const_cast<uint8_t*>(base),
+                                                                                 size,
+                                                                                 max_tensor_size);
+            std::shared_ptr<struct ggml_backend_buffer> device_buffer;
+            if (buffer != nullptr) {
+                ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                device_buffer = std::shared_ptr<struct ggml_backend_buffer>(buffer, ggml_backend_buffer_free);
+                LOG_INFO("mapped '%s' into %s without a copy", fdata.path.c_str(), ggml_backend_dev_name(dev));
+            } else {
+                LOG_DEBUG("%s cannot map '%s', params are copied", ggml_backend_dev_name(dev), fdata.path.c_str());
+            }
+            it = fdata.device_mmbuffers.emplace(dev, std::move(device_buffer)).first;
+        }
+        if (!it->second) {
+            return nullptr;
+        }
+        uint8_t* device_base = static_cast<uint8_t*>(ggml_backend_buffer_get_base(it->second.get()));
+        *device_data         = device_base + (ptr - base);
+        return it->second;
+    }
+    return nullptr;
+}
+
 bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                                bool enable_mmap,
-                               const std::set<std::string>* target_tensor_names) {
+                               const std::set<std::string>* target_tensor_names,
+                               bool release_page_cache,
+                               bool show_progress) {
     process_model_files(enable_mmap, false);
 
     std::atomic<int64_t> read_time_ms(0);
@@ -1001,8 +1191,21 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
         bool is_zip = fdata.is_zip;
 
         std::shared_ptr<MmapWrapper> mmapped = fdata.mmapped;
+        std::unique_ptr<PositionalFileReader> reader;
+        if (!mmapped) {
+            reader = PositionalFileReader::create(file_path);
+            if (!reader) {
+                LOG_ERROR("failed to open '%s'", file_path.c_str());
+                success = false;
+                break;
+            }
+        }
 
-        int n_threads = is_zip ? 1 : std::min(num_threads_to_use, (int)tensors_to_process.size());
+        // every worker opens its own zip handle, so deflated entries are
+        // decompressed in parallel, one entry per worker at a time. Workers
+        // beyond the tensor count only take conversion chunks, which keeps
+        // all of them busy when a few large tensors are quantized.
+        int n_threads = num_threads_to_use;
         if (n_threads < 1) {
             n_threads = 1;
         }
@@ -1013,9 +1216,58 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
         std::vector<std::thread> workers;
         std::mutex rpc_backend_mutex;
 
+        std::mutex convert_mutex;
+        std::condition_variable convert_cv;
+        std::deque<std::shared_ptr<ConvertJob>> convert_jobs;
+        std::atomic<int> tensors_in_flight(0);
+
+        // runs one chunk of the oldest shared conversion; false when none is left
+        auto help_convert = [&]() -> bool {
+            std::shared_ptr<ConvertJob> job;
+            {
+                std::lock_guard<std::mutex> lock(convert_mutex);
+                while (!convert_jobs.empty() && convert_jobs.front()->all_taken()) {
+                    convert_jobs.pop_front();
+                }
+                if (convert_jobs.empty()) {
+                    return false;
+                }
+                job = convert_jobs.front();
+            }
+            if (job->run_chunk() && job->done()) {
+                { std::lock_guard<std::mutex> lock(convert_mutex); }
+                convert_cv.notify_all();
+            }
+            return true;
+        };
+
+        auto convert_rows = [&](void* src, ggml_type src_type, void* dst, ggml_type dst_type, int64_t nrows, int64_t n_per_row) {
+            const int64_t rows_per_chunk = std::max<int64_t>(1, (1 << 20) / n_per_row);
+            if (n_threads < 2 || nrows < 2 * rows_per_chunk) {
+                convert_tensor(src, src_type, dst, dst_type, nrows, n_per_row);
+                return;
+            }
+            auto job            = std::make_shared<ConvertJob>();
+            job->src            = (const char*)src;
+            job->src_type       = src_type;
+            job->dst            = (char*)dst;
+            job->dst_type       = dst_type;
+            job->nrows          = nrows;
+            job->n_per_row      = n_per_row;
+            job->rows_per_chunk = rows_per_chunk;
+            {
+                std::lock_guard<std::mutex> lock(convert_mutex);
+                convert_jobs.push_back(job);
+            }
+            convert_cv.notify_all();
+            while (job->run_chunk()) {
+            }
+            std::unique_lock<std::mutex> lock(convert_mutex);
+            convert_cv.wait(lock, [&]() { return job->done(); });
+        };
+
         for (int i = 0; i < n_threads; ++i) {
             workers.emplace_back([&, file_path, is_zip]() {
-                std::ifstream file;
                 zip_t* zip = nullptr;
                 if (is_zip) {
                     zip = zip_open(file_path.c_str(), 0, 'r');
@@ -1024,28 +1276,76 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                         failed = true;
                         return;
                     }
-                } else if (!mmapped) {
-                    file.open(file_path, std::ios::binary);
-                    if (!file.is_open()) {
-                        LOG_ERROR("failed to open '%s'", file_path.c_str());
-                        failed = true;
-                        return;
-                    }
                 }
 
                 std::vector<uint8_t> read_buffer;
                 std::vector<uint8_t> convert_buffer;
+                std::shared_ptr<ggml_backend_buffer> staging_buffer;
+                ggml_backend_dev_t staging_dev = nullptr;
+
+                // null when the tensor is too large or its device has no pinned host memory
+                auto staging_data = [&](ggml_tensor* tensor, size_t n) -> char* {
+                    if (!release_page_cache || n > STREAM_STAGING_BYTES) {
+                        return nullptr;
+                    }
+                    ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(tensor->buffer));
+                    if (dev == nullptr) {
+                        return nullptr;
+                    }
+                    if (staging_dev != dev) {
+                        staging_buffer.reset();
+                        staging_dev                          = dev;
+                        ggml_backend_buffer_type_t host_buft = ggml_backend_dev_host_buffer_type(dev);
+                        ggml_backend_buffer_t buffer         = host_buft != nullptr ? ggml_backend_buft_alloc_buffer(host_buft, STREAM_STAGING_BYTES) : nullptr;
+                        if (buffer != nullptr) {
+                            sd_perf::trace_buffer(buffer, sd_perf::BufferKind::STAGING, "model loader");
+                            staging_buffer.reset(buffer, [](ggml_backend_buffer_t buffer) {
+                                sd_perf::untrace_buffer(buffer);
+                                ggml_backend_buffer_free(buffer);
+                            });
+                        }
+                    }
+                    return staging_buffer ? (char*)ggml_backend_buffer_get_base(staging_buffer.get()) : nullptr;
+                };
 
                 while (true) {
                     int64_t t0, t1;
+                    while (!failed && help_convert()) {
+                    }
+                    tensors_in_flight++;
                     size_t idx = tensor_idx.fetch_add(1);
                     if (idx >= tensors_to_process.size() || failed) {
+                        tensors_in_flight--;
+                        // keep taking chunks until no worker can publish another conversion
+                        while (!failed) {
+                            if (help_convert()) {
+                                continue;
+                            }
+                            std::unique_lock<std::mutex> lock(convert_mutex);
+                            if (tensors_in_flight.load() == 0) {
+                                break;
+                            }
+                            convert_cv.wait_for(lock, std::chrono::milliseconds(1));
+                        }
                         break;
                     }
+                    struct InFlightGuard {
+                        std::atomic<int>& count;
+                        ~InFlightGuard() { count--; }
+                    } in_flight_guard{tensors_in_flight};
 
                     const TensorStorage& tensor_storage = *tensors_to_process[idx];
                     ggml_tensor* dst_tensor             = nullptr;
 
+                    // keep about one read per worker queued ahead, so the
+                    // disk stays busy while this thread converts and uploads
+                    if (reader && idx + n_threads < tensors_to_process.size()) {
+                        const TensorStorage& next_storage = *tensors_to_process[idx + n_threads];
+                        if (next_storage.index_in_zip < 0) {
+                            reader->prefetch(next_storage.offset, next_storage.nbytes_to_read());
+                        }
+                    }
+
                     t0 = ggml_time_ms();
 
                     if (!on_new_tensor_cb(tensor_storage, &dst_tensor)) {
@@ -1074,7 +1374,7 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                     size_t nbytes_to_read = tensor_storage.nbytes_to_read();
 
                     auto read_data = [&](char* buf, size_t n) {
-                        if (zip != nullptr) {
+                        if (tensor_storage.index_in_zip >= 0) {
                             zip_entry_openbyindex(zip, tensor_storage.index_in_zip);
                             size_t entry_size = zip_entry_size(zip);
                             if (entry_size != n) {
@@ -1093,13 +1393,9 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                                 LOG_ERROR("read tensor data failed: '%s'", file_path.c_str());
                                 failed = true;
                             }
-                        } else {
-                            file.seekg(tensor_storage.offset);
-                            file.read(buf, n);
-                            if (!file) {
-                                LOG_ERROR("read tensor data failed: '%s'", file_path.c_str());
-                                failed = true;
-                            }
+                        } else if (!reader->read(buf, n, tensor_storage.offset)) {
+                            LOG_ERROR("read tensor data failed: '%s'", file_path.c_str());
+                            failed = true;
                         }
                     };
 
@@ -1123,18 +1419,34 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                             convert_buf = (char*)dst_tensor->data;
                         }
                     } else {
-                        read_buffer.resize(std::max(tensor_storage.nbytes(), tensor_storage.nbytes_to_read()));
-                        read_buf   = (char*)read_buffer.data();
+                        size_t read_size = std::max(tensor_storage.nbytes(), tensor_storage.nbytes_to_read());
+                        if (tensor_storage.type == dst_tensor->type) {
+                            read_buf = staging_data(dst_tensor, read_size);
+                        }
+                        if (read_buf == nullptr) {
+                            read_buffer.resize(read_size);
+                            read_buf = (char*)read_buffer.data();
+                        }
                         target_buf = read_buf;
 
                         if (tensor_storage.type != dst_tensor->type) {
-                            convert_buffer.resize(ggml_nbytes(dst_tensor));
-                            convert_buf = (char*)convert_buffer.data();
+                            convert_buf = staging_data(dst_tensor, ggml_nbytes(dst_tensor));
+                            if (convert_buf == nullptr) {
+                                convert_buffer.resize(ggml_nbytes(dst_tensor));
+                                convert_buf = (char*)convert_buffer.data();
+                            }
                         }
                     }
 
                     t0 = ggml_time_ms();
                     read_data(read_buf, nbytes_to_read);
+                    if (release_page_cache && tensor_storage.index_in_zip < 0) {
+                        if (mmapped) {
+                            mmapped->release(tensor_storage.offset, nbytes_to_read);
+                        } else {
+                            reader->release(tensor_storage.offset, nbytes_to_read);
+                        }
+                    }
                     t1 = ggml_time_ms();
                     read_time_ms.fetch_add(t1 - t0);
 
@@ -1154,12 +1466,12 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                             failed = true;
                             return;
                         }
-                        convert_tensor((void*)target_buf,
-                                       tensor_storage.type,
-                                       convert_buf,
-                                       dst_tensor->type,
-                                       (int)tensor_storage.nelements() / (int)tensor_storage.ne[0],
-                                       (int)tensor_storage.ne[0]);
+                        convert_rows((void*)target_buf,
+                                     tensor_storage.type,
+                                     convert_buf,
+                                     dst_tensor->type,
+                                     tensor_storage.nelements() / tensor_storage.ne[0],
+                                     tensor_storage.ne[0]);
                     } else {
                         convert_buf = read_buf;
                     }
@@ -1200,7 +1512,7 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
             }
             size_t curr_num       = total_tensors_processed + current_idx;
             float elapsed_seconds = (ggml_time_ms() - t_start) / 1000.0f;
-            if (total_tensors_to_process > 0) {
+            if (show_progress && total_tensors_to_process > 0) {
                 pretty_bytes_progress(static_cast<int>(curr_num),
                                       static_cast<int>(total_tensors_to_process),
                                       bytes_processed.load(),
@@ -1218,18 +1530,21 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
             break;
         }
         total_tensors_processed += tensors_to_process.size();
-        if (total_tensors_to_process > 0) {
+        if (show_progress && total_tensors_to_process > 0) {
             pretty_bytes_progress(static_cast<int>(total_tensors_processed),
                                   static_cast<int>(total_tensors_to_process),
                                   bytes_processed.load(),
                                   (ggml_time_ms() - t_start) / 1000.0f);
         }
-        if (total_tensors_processed < total_tensors_to_process && total_tensors_to_process > 0) {
+        if (show_progress && total_tensors_processed < total_tensors_to_process && total_tensors_to_process > 0) {
             printf("\n");
         }
     }
 
     int64_t end_time = ggml_time_ms();
+    if (!show_progress) {
+        return success;
+    }
     LOG_INFO("loading tensors completed, taking %.2fs (read: %.2fs, memcpy: %.2fs, convert: %.2fs, copy_to_backend: %.2fs)",
              (end_time - start_time) / 1000.f,
              (read_time_ms.load() / (float)last_n_threads) / 1000.f,
@@ -1239,6 +1554,136 @@ bool ModelLoader::load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
     return success;
 }
 
+void ModelLoader::prefetch_tensor_data(const std::set<std::string>& tensor_names) {
+    if (!model_files_processed || tensor_names.empty()) {
+        return;
+    }
+    for (const auto& fdata : file_data) {
+        if (fdata.is_zip) {
+            continue;
+        }
+        // tensors are stored back to back, so neighbouring ranges become one hint
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        for (const TensorStorage& tensor_storage : fdata.tensors) {
+            if (tensor_names.find(tensor_storage.name) == tensor_names.end()) {
+                continue;
+            }
+            uint64_t begin = tensor_storage.offset;
+            uint64_t end   = begin + tensor_storage.nbytes_to_read();
+            if (!ranges.empty() && begin <= ranges.back().second && begin >= ranges.back().first) {
+                ranges.back().second = std::max(ranges.back().second, end);
+            } else {
+                ranges.emplace_back(begin, end);
+            }
+        }
+        if (ranges.empty()) {
+            continue;
+        }
+        std::unique_ptr<PositionalFileReader> reader;
+        if (!fdata.mmapped) {
+            reader = PositionalFileReader::create(fdata.path);
+            if (!reader) {
+                continue;
+            }
+        }
+        for (const auto& [begin, end] : ranges) {
+            if (fdata.mmapped) {
+                fdata.mmapped->prefetch(begin, end - begin);
+            } else {
+                reader->prefetch(begin, end - begin);
+            }
+        }
+    }
+}
+
+uint64_t ModelLoader::prefault_tensor_data(const std::vector<std::string>& tensor_names,
+                                          int n_threads,
+                                          const std::atomic<bool>* stop) {
+    if (!model_files_processed || tensor_names.empty()) {
+        return 0;
+    }
+    std::unordered_map<std::string, std::pair<const MmapWrapper*, const TensorStorage*>> mapped_tensors;
+    for (const auto& fdata : file_data) {
+        if (fdata.is_zip || !fdata.mmapped) {
+            continue;
+        }
+        for (const TensorStorage& tensor_storage : fdata.tensors) {
+            mapped_tensors[tensor_storage.name] = {fdata.mmapped.get(), &tensor_storage};
+        }
+    }
+
+    struct Range {
+        const MmapWrapper* mmapped;
+        uint64_t begin;
+        uint64_t end;
+    };
+    // tensors that follow each other in the file become one range
+    std::vector<Range> ranges;
+    for (const std::string& name : tensor_names) {
+        auto it = mapped_tensors.find(name);
+        if (it == mapped_tensors.end()) {
+            continue;
+        }
+        const auto& [mmapped, tensor_storage] = it->second;
+        uint64_t begin                        = tensor_storage->offset;
+        uint64_t end                          = begin + tensor_storage->nbytes_to_read();
+        if (!ranges.empty() && ranges.back().mmapped == mmapped && begin <= ranges.back().end && begin >= ranges.back().begin) {
+            ranges.back().end = std::max(ranges.back().end, end);
+        } else {
+            ranges.push_back({mmapped, begin, end});
+        }
+    }
+
+    // chunks small enough that the threads stay close to the load order
+    constexpr uint64_t CHUNK_BYTES = 8ull * 1024 * 1024;
+    std::vector<Range> chunks;
+    uint64_t total_bytes = 0;
+    for (const Range& range : ranges) {
+        for (uint64_t begin = range.begin; begin < range.end; begin += CHUNK_BYTES) {
+            chunks.push_back({range.mmapped, begin, std::min(range.end, begin + CHUNK_BYTES)});
+        }
+        total_bytes += range.end - range.begin;
+    }
+    if (total_bytes == 0) {
+        return 0;
+    }
+
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<uint64_t> done_bytes(0);
+    std::atomic<int> reported_tenths(0);
+    int64_t start_time = ggml_time_ms();
+    auto worker        = [&]() {
+        while (stop == nullptr || !stop->load()) {
+            size_t index = next_chunk.fetch_add(1);
+            if (index >= chunks.size()) {
+                return;
+            }
+            const Range& chunk = chunks[index];
+            chunk.mmapped->populate(chunk.begin, chunk.end - chunk.begin);
+            uint64_t done = done_bytes.fetch_add(chunk.end - chunk.begin) + chunk.end - chunk.begin;
+            int tenths    = static_cast<int>(done * 10 / total_bytes);
+            int reported  = reported_tenths.load();
+            while (tenths > reported && !reported_tenths.compare_exchange_weak(reported, tenths)) {
+            }
+            if (tenths > reported) {
+                double seconds = std::max<int64_t>(1, ggml_time_ms() - start_time) / 1000.0;
+                LOG_INFO("prefaulted %d%% of mapped weights (%.1f MB/s)", tenths * 10, done / 1024.0 / 1024.0 / seconds);
+            }
+        }
+    };
+
+    n_threads = std::max(1, std::min<int>(n_threads, static_cast<int>(chunks.size())));
+    std::vector<std::thread> workers;
+    for (int i = 1; i < n_threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    return done_bytes.load();
+}
+
 bool ModelLoader::load_float_tensor(const std::string& name,
                                     std::vector<float>& data,
                                     int n_threads,
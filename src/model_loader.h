@@ -1,24 +1,49 @@
 #ifndef __MODEL_LOADER_H__
 #define __MODEL_LOADER_H__
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "model.h"
 
+// GGML_TYPE_COUNT when type_name is not a ggml type name
+// (f32, f16, q8_0, q4_K, ...).
+ggml_type parse_ggml_type_name(const std::string& type_name);
 TensorTypeRules parse_tensor_type_rules(const std::string& tensor_type_rules);
+// Converts nrows rows of n_per_row values from src_type to dst_type.
+void convert_tensor(void* src,
+                    ggml_type src_type,
+                    void* dst,
+                    ggml_type dst_type,
+                    int64_t nrows,
+                    int64_t n_per_row);
 
 class MmapWrapper;
+class ModelLoader;
+
+// Writes every tensor of `model_loader` to a GGUF file under its converted
+// name and in the type it will be loaded as, so a later start can map the file
+// without renaming or converting anything. Tensors under skip_prefixes are
+// left out. Defined in convert.cpp.
+bool write_model_cache(ModelLoader& model_loader,
+                       const std::string& file_path,
+                       const std::vector<std::pair<std::string, std::string>>& metadata,
+                       const std::vector<std::string>& skip_prefixes = {});
 
 struct ModelFileData {
     std::string path;
     std::vector<TensorStorage> tensors;
     std::shared_ptr<MmapWrapper> mmapped;
     std::shared_ptr<struct ggml_backend_buffer> mmbuffer;
+    // the mapping wrapped as a buffer of each device that reads host memory
+    // directly; null entries record devices that refused it
+    std::map<ggml_backend_dev_t, std::shared_ptr<struct ggml_backend_buffer>> device_mmbuffers;
     bool is_zip;
 };
 
@@ -35,6 +60,7 @@ protected:
     bool model_files_processed = false;
     String2TensorStorage tensor_storage_map;
     int n_threads_;
+    std::string index_dir_;
 
     size_t add_file_path(const std::string& file_path);
     void add_tensor_storage(const TensorStorage& tensor_storage);
@@ -58,17 +84,47 @@ public:
     std::map<ggml_type, uint32_t> get_conditioner_wtype_stat();
     std::map<ggml_type, uint32_t> get_diffusion_model_wtype_stat();
     std::map<ggml_type, uint32_t> get_vae_wtype_stat();
+    uint64_t get_conditioner_params_bytes();
+    uint64_t get_diffusion_model_params_bytes();
+    uint64_t get_vae_params_bytes();
+    uint64_t get_control_net_params_bytes();
     String2TensorStorage& get_tensor_storage_map() { return tensor_storage_map; }
     const String2TensorStorage& get_tensor_storage_map() const { return tensor_storage_map; }
+    std::string get_file_path(size_t file_index) const {
+        return file_index < file_paths_.size() ? file_paths_[file_index] : "";
+    }
     void set_n_threads(int n_threads);
+    // Directory for GGUF side indexes (see GGUFIndex); empty disables them.
+    void set_index_dir(const std::string& index_dir) { index_dir_ = index_dir; }
     void set_wtype_override(ggml_type wtype, std::string tensor_type_rules = "");
     void process_model_files(bool enable_mmap = false, bool writable_mmap = true);
     std::vector<MmapTensorStore> mmap_tensors(std::map<std::string, ggml_tensor*>& tensors,
                                               std::set<std::string> ignore_tensors = {},
                                               bool writable                        = true);
+    // Wraps the mapped file holding `data` (placed by mmap_tensors) as a
+    // buffer of `dev`, for devices that read host memory in place. Returns
+    // the buffer and sets *device_data to the device address of `data`, or
+    // returns nullptr when `data` is not mapped or the device refuses it.
+    std::shared_ptr<struct ggml_backend_buffer> map_to_device(const void* data,
+                                                              ggml_backend_dev_t dev,
+                                                              void** device_data);
+    // release_page_cache drops the file pages of every tensor once it is
+    // copied out, for params that are read from disk again on every use.
+    // show_progress off leaves progress reporting to callers that load in
+    // several calls.
     bool load_tensors(on_new_tensor_cb_t on_new_tensor_cb,
                       bool use_mmap                                    = false,
-                      const std::set<std::string>* target_tensor_names = nullptr);
+                      const std::set<std::string>* target_tensor_names = nullptr,
+                      bool release_page_cache                          = false,
+                      bool show_progress                               = true);
+    // Queues background reads of the named tensors into the page cache.
+    void prefetch_tensor_data(const std::set<std::string>& tensor_names);
+    // Faults the mapped data of the named tensors in, in the given order, on
+    // n_threads threads; tensors of zip or unmapped files are skipped. Stops
+    // early once stop is set and returns the bytes faulted in.
+    uint64_t prefault_tensor_data(const std::vector<std::string>& tensor_names,
+                                  int n_threads,
+                                  const std::atomic<bool>* stop = nullptr);
     bool load_tensors(std::map<std::string, ggml_tensor*>& tensors,
                       std::set<std::string> ignore_tensors = {},
                       bool use_mmap                        = false);
@@ -1,14 +1,35 @@
 #include "model_manager.h"
 
 #include <algorithm>
+#include <cctype>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <mutex>
 #include <unordered_set>
 
+#include "core/compute_arena.h"
 #include "core/ggml_extend_backend.h"
+#include "core/host_memory.h"
+#include "core/memory_timeline.h"
+#include "core/perf_stats.h"
 #include "core/util.h"
 #include "model/adapter/lora.hpp"
+#include "name_conversion.h"
+
+// The model a tensor belongs to, for the memory timeline:
+// "model.diffusion_model" for "model.diffusion_model.input_blocks.0.0.weight".
+static std::string tensor_owner(const ggml_tensor* tensor) {
+    std::string name = tensor != nullptr ? ggml_get_name(tensor) : "";
+    size_t dot       = name.find('.');
+    if (dot != std::string::npos) {
+        size_t second = name.find('.', dot + 1);
+        if (second != std::string::npos) {
+            name.resize(second);
+        }
+    }
+    return name;
+}
 
 static size_t aligned_offset(const void* buffer, size_t offset, size_t alignment) {
     GGML_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
@@ -37,6 +58,79 @@ static std::string lora_id(const ModelManager::LoraSpec& lora) {
     return lora.is_high_noise ? "|high_noise|" + lora.path : lora.path;
 }
 
+static std::string lora_set_key(const std::vector<ModelManager::LoraSpec>& loras, SDVersion version) {
+    std::string key = std::to_string(static_cast<int>(version));
+    for (const auto& lora : loras) {
+        key += "\n" + lora_id(lora) + "|" + sd_format("%a", lora.multiplier) + "|" + lora.tensor_name_prefix_filter;
+    }
+    return key;
+}
+
+static bool lora_specs_reweighted(const std::vector<ModelManager::LoraSpec>& lhs,
+                                  const std::vector<ModelManager::LoraSpec>& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (lhs[i].path != rhs[i].path ||
+            lhs[i].is_high_noise != rhs[i].is_high_noise ||
+            lhs[i].tensor_name_prefix_filter != rhs[i].tensor_name_prefix_filter) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ggml's extra CPU buffer types (repack, AMX, ...) in the order the CPU
+// backend prefers them.
+static const std::vector<ggml_backend_buffer_type_t>& cpu_extra_buffer_types() {
+    static const std::vector<ggml_backend_buffer_type_t> bufts = []() {
+        std::vector<ggml_backend_buffer_type_t> result;
+        ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (dev == nullptr) {
+            return result;
+        }
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+        auto get_extra_bufts   = (ggml_backend_dev_get_extra_bufts_t)ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+        if (get_extra_bufts == nullptr) {
+            return result;
+        }
+        for (ggml_backend_buffer_type_t* buft = get_extra_bufts(dev); buft != nullptr && *buft != nullptr; ++buft) {
+            result.push_back(*buft);
+        }
+        return result;
+    }();
+    return bufts;
+}
+
+// Asks the CPU device whether a matmul with `weight` held in `buft` runs,
+// which is where the repack kernels check the type and the row count.
+static bool cpu_buffer_type_supports_matmul(ggml_backend_buffer_type_t buft, const ggml_tensor* weight) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_init_params params;
+    params.mem_size   = 3 * ggml_tensor_overhead();
+    params.mem_buffer = nullptr;
+    params.no_alloc   = true;
+    ggml_context* ctx = ggml_init(params);
+    if (dev == nullptr || ctx == nullptr) {
+        if (ctx != nullptr) {
+            ggml_free(ctx);
+        }
+        return false;
+    }
+    ggml_tensor* w               = ggml_dup_tensor(ctx, weight);
+    ggml_tensor* x               = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, weight->ne[0], 1);
+    ggml_tensor* op              = ggml_mul_mat(ctx, w, x);
+    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, 0);
+    w->buffer                    = buffer;
+    bool supported               = buffer != nullptr && ggml_backend_dev_supports_op(dev, op);
+    if (buffer != nullptr) {
+        ggml_backend_buffer_free(buffer);
+    }
+    ggml_free(ctx);
+    return supported;
+}
+
 static bool backend_supports_host_buffer(ggml_backend_t backend) {
     if (backend == nullptr) {
         return false;
@@ -53,15 +147,134 @@ static bool backend_supports_host_buffer(ggml_backend_t backend) {
     return props.caps.buffer_from_host_ptr;
 }
 
+// Devices that share system memory with the host: wrapping a mapped file as
+// one of their buffers lets them read params where they are, with no upload.
+static bool backend_maps_host_memory(ggml_backend_t backend) {
+    if (backend == nullptr || sd_backend_is_cpu(backend) || !backend_supports_host_buffer(backend)) {
+        return false;
+    }
+    ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+    if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_IGPU) {
+        return true;
+    }
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    return reg != nullptr && strcmp(ggml_backend_reg_name(reg), "Metal") == 0;
+}
+
+// Params backend buffers loaded by one context, reused by every other context
+// in the process that needs the same tensor of the same file, in the same type
+// and buffer type. Entries only hold weak references: the buffer is freed when
+// the last context using it releases its storage block.
+class SharedParamsRegistry {
+public:
+    static SharedParamsRegistry& instance() {
+        static SharedParamsRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<ggml_backend_buffer> find(const std::string& key, size_t* offset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return nullptr;
+        }
+        std::shared_ptr<ggml_backend_buffer> buffer = it->second.buffer.lock();
+        if (buffer == nullptr) {
+            entries_.erase(it);
+            return nullptr;
+        }
+        *offset = it->second.offset;
+        return buffer;
+    }
+
+    void publish(const std::string& key, const std::shared_ptr<ggml_backend_buffer>& buffer, size_t offset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[key];
+        if (!entry.buffer.expired()) {
+            return;
+        }
+        entry.buffer = buffer;
+        entry.offset = offset;
+    }
+
+private:
+    struct Entry {
+        std::weak_ptr<ggml_backend_buffer> buffer;
+        size_t offset = 0;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+};
+
+// Orders digit runs by value so "blocks.10." sorts after "blocks.9.", which
+// keeps the tensors of one block together in forward order.
+static bool natural_less(const std::string& lhs, const std::string& rhs) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < lhs.size() && j < rhs.size()) {
+        if (isdigit(static_cast<unsigned char>(lhs[i])) && isdigit(static_cast<unsigned char>(rhs[j]))) {
+            size_t lhs_end = i;
+            size_t rhs_end = j;
+            while (lhs_end < lhs.size() && isdigit(static_cast<unsigned char>(lhs[lhs_end]))) {
+                lhs_end++;
+            }
+            while (rhs_end < rhs.size() && isdigit(static_cast<unsigned char>(rhs[rhs_end]))) {
+                rhs_end++;
+            }
+            while (i + 1 < lhs_end && lhs[i] == '0') {
+                i++;
+            }
+            while (j + 1 < rhs_end && rhs[j] == '0') {
+                j++;
+            }
+            if (lhs_end - i != rhs_end - j) {
+                return lhs_end - i < rhs_end - j;
+            }
+            int cmp = lhs.compare(i, lhs_end - i, rhs, j, rhs_end - j);
+            if (cmp != 0) {
+                return cmp < 0;
+            }
+            i = lhs_end;
+            j = rhs_end;
+            continue;
+        }
+        if (lhs[i] != rhs[j]) {
+            return lhs[i] < rhs[j];
+        }
+        i++;
+        j++;
+    }
+    return i == lhs.size() && j < rhs.size();
+}
+
+// Generation order: text encoders run first, then the diffusion model (and
+// anything attached to it), then the VAE decodes.
+static int background_load_rank(const std::string& desc) {
+    if (desc == "Conditioner model" || desc == "CLIP vision") {
+        return 0;
+    }
+    if (desc.find("VAE") != std::string::npos) {
+        return 2;
+    }
+    return 1;
+}
+
 ModelManager::~ModelManager() {
+    stop_mmap_prefault();
+    finish_prefetch();
+    stop_background_load();
     release_all();
 }
 
 void ModelManager::set_common_ignore_tensors(std::set<std::string> ignore_tensors) {
     common_ignore_tensors_ = std::move(ignore_tensors);
+    residency_epoch_++;
 }
 
 void ModelManager::set_loras(std::vector<LoraSpec> loras, SDVersion version) {
+    // resetting frees params storage the background load may be filling
+    std::lock_guard<std::mutex> lock(state_mutex_);
     if (loras.empty() && loras_.empty()) {
         lora_version_ = version;
         return;
@@ -70,12 +283,63 @@ void ModelManager::set_loras(std::vector<LoraSpec> loras, SDVersion version) {
         return;
     }
 
+    // with the same LoRAs at new multipliers, merged params stay and
+    // apply_loras_to_params adds only the multiplier deltas
+    bool reweight = !loras_.empty() && lora_version_ == version &&
+                    lora_specs_reweighted(loras_, loras) && !has_merged_mmap_quantized_params();
     loras_        = std::move(loras);
     lora_version_ = version;
+    lora_set_key_ = lora_set_key(loras_, version);
     current_lora_epoch_++;
+    if (!loras_.empty()) {
+        // merges must not land in the mapped file pages a device reads in
+        // place, so idle zero-copy params are staged again as copies
+        for (auto it = compute_staging_blocks_.begin(); it != compute_staging_blocks_.end();) {
+            ComputeStagingBlock* block = it->get();
+            bool idle = std::all_of(block->staged_tensors.begin(),
+                                    block->staged_tensors.end(),
+                                    [](const std::pair<TensorState*, ggml_tensor*>& pair) {
+                                        return pair.first == nullptr || pair.first->active_prepare_count == 0;
+                                    });
+            if (!block->mapped_buffers.empty() && idle) {
+                free_compute_staging_block(*block);
+                it = compute_staging_blocks_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (reweight) {
+        return;
+    }
+    lora_set_epoch_ = current_lora_epoch_;
     reset_lora_applied_params();
 }
 
+bool ModelManager::has_merged_mmap_quantized_params() const {
+    // quantized tensors are re-read before re-weighting, which from a
+    // private mapping would return the merged pages instead of the file
+    for (const auto& block : params_storage_blocks_) {
+        if (block->mmap_tensor_stores.empty()) {
+            continue;
+        }
+        for (const TensorState* state : block->states) {
+            if (state != nullptr && state->tensor != nullptr && state->applied_lora_epoch != UINT64_MAX &&
+                state->tensor->type != GGML_TYPE_F32 && state->tensor->type != GGML_TYPE_F16) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ModelManager::set_max_lora_cache_bytes(size_t max_lora_cache_bytes) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    max_lora_cache_bytes_ = max_lora_cache_bytes;
+    while (lora_cache_bytes_ > max_lora_cache_bytes_ && evict_merged_lora_set(nullptr)) {
+    }
+}
+
 std::set<std::string> ModelManager::tensor_names() const {
     std::set<std::string> names;
     for (const auto& state : tensor_states_) {
@@ -141,7 +405,8 @@ bool ModelManager::register_param_tensors(const std::string& desc,
 
     for (auto& state : new_states) {
         TensorState* registered_state                  = state.get();
-        tensor_states_by_name_[registered_state->name] = registered_state;
+        tensor_states_by_name_[registered_state->name]     = registered_state;
+        tensor_states_by_tensor_[registered_state->tensor] = registered_state;
         tensor_states_.push_back(std::move(state));
     }
     return true;
@@ -151,13 +416,192 @@ bool ModelManager::load_all_params_eagerly() {
     std::vector<TensorState*> all_states;
     all_states.reserve(tensor_states_.size());
     for (const auto& s : tensor_states_) {
-        if (s != nullptr) {
+        if (s != nullptr && !is_lazy(*s)) {
             all_states.push_back(s.get());
         }
     }
     return load_tensors_to_params_backend(all_states);
 }
 
+std::vector<TensorState*> ModelManager::background_load_states() const {
+    std::vector<TensorState*> states;
+    states.reserve(tensor_states_.size());
+    for (const auto& s : tensor_states_) {
+        // disk-resident params are dropped after every use, loading them ahead only wastes memory
+        if (s != nullptr && s->residency_mode == ResidencyMode::ParamBackend && !is_lazy(*s)) {
+            states.push_back(s.get());
+        }
+    }
+    std::stable_sort(states.begin(), states.end(), [](const TensorState* lhs, const TensorState* rhs) {
+        int lhs_rank = background_load_rank(lhs->desc);
+        int rhs_rank = background_load_rank(rhs->desc);
+        if (lhs_rank != rhs_rank) {
+            return lhs_rank < rhs_rank;
+        }
+        return natural_less(lhs->name, rhs->name);
+    });
+    return states;
+}
+
+void ModelManager::start_background_load() {
+    if (background_load_thread_.joinable()) {
+        return;
+    }
+    stop_background_load_.store(false);
+    background_load_thread_ = std::thread(&ModelManager::background_load, this, background_load_states());
+}
+
+void ModelManager::start_mmap_prefault(int n_threads) {
+    if (!enable_mmap_ || n_threads <= 0 || mmap_prefault_thread_.joinable()) {
+        return;
+    }
+    std::vector<std::string> names;
+    for (const TensorState* state : background_load_states()) {
+        names.push_back(state->name);
+    }
+    stop_mmap_prefault_.store(false);
+    mmap_prefault_thread_ = std::thread([this, n_threads, names = std::move(names)]() {
+        int64_t t0     = ggml_time_ms();
+        uint64_t bytes = model_loader_.prefault_tensor_data(names, n_threads, &stop_mmap_prefault_);
+        if (stop_mmap_prefault_.load()) {
+            return;
+        }
+        LOG_INFO("model manager mmap prefault finished (%.2f MB, %d threads) in %.2fs",
+                 bytes / (1024.f * 1024.f),
+                 n_threads,
+                 (ggml_time_ms() - t0) / 1000.f);
+    });
+}
+
+void ModelManager::stop_mmap_prefault() {
+    stop_mmap_prefault_.store(true);
+    if (mmap_prefault_thread_.joinable()) {
+        mmap_prefault_thread_.join();
+    }
+}
+
+bool ModelManager::load_in_chunks(const std::vector<TensorState*>& states,
+                                  const std::atomic<bool>* stop,
+                                  size_t* loaded_bytes) {
+    // small chunks keep state_mutex_ free often enough that a prepare_params
+    // waits for at most one chunk before loading its own tensors
+    constexpr size_t chunk_bytes_target = 64 * 1024 * 1024;
+
+    size_t begin = 0;
+    while (begin < states.size()) {
+        if (stop != nullptr && stop->load()) {
+            return false;
+        }
+        size_t end         = begin;
+        size_t chunk_bytes = 0;
+        while (end < states.size() && (end == begin || chunk_bytes < chunk_bytes_target)) {
+            if (states[end]->tensor != nullptr) {
+                chunk_bytes += ggml_nbytes(states[end]->tensor);
+            }
+            end++;
+        }
+        std::vector<TensorState*> chunk(states.begin() + begin, states.begin() + end);
+        {
+            std::lock_guard<std::mutex> lock(state_mutex_);
+            if (!load_tensors_to_params_backend(chunk)) {
+                return false;
+            }
+        }
+        if (loaded_bytes != nullptr) {
+            *loaded_bytes += chunk_bytes;
+        }
+        begin = end;
+    }
+    return true;
+}
+
+void ModelManager::background_load(std::vector<TensorState*> states) {
+    int64_t t0          = ggml_time_ms();
+    size_t loaded_bytes = 0;
+    if (!load_in_chunks(states, &stop_background_load_, &loaded_bytes)) {
+        if (!stop_background_load_.load()) {
+            LOG_WARN("model manager background load failed, remaining params are loaded on first use");
+        }
+        return;
+    }
+    LOG_INFO("model manager background load finished (%.2f MB, %zu tensors) in %.2fs",
+             loaded_bytes / (1024.f * 1024.f),
+             states.size(),
+             (ggml_time_ms() - t0) / 1000.f);
+}
+
+void ModelManager::evict_params(bool params_backend) {
+    stop_background_load();
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    release_compute_staging_blocks(false);
+    if (params_backend) {
+        release_params_storage_blocks(false, nullptr, true);
+    }
+}
+
+void ModelManager::evict_params(const std::vector<ggml_tensor*>& tensors) {
+    if (tensors.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states) || required_states.empty()) {
+        return;
+    }
+    std::unordered_set<TensorState*> target_states(required_states.begin(), required_states.end());
+    release_compute_staging_blocks(false, &target_states);
+    release_params_storage_blocks(false, &target_states, true);
+}
+
+uint64_t ModelManager::unloaded_params_bytes(const std::vector<ggml_tensor*>& tensors) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states)) {
+        return 0;
+    }
+    uint64_t bytes = 0;
+    for (TensorState* state : required_states) {
+        if (state != nullptr && state->tensor != nullptr && !state->loaded_to_params_backend && !should_ignore(*state)) {
+            bytes += ggml_nbytes(state->tensor);
+        }
+    }
+    return bytes;
+}
+
+void ModelManager::get_params_memory(uint64_t* ram_bytes, uint64_t* vram_bytes) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    uint64_t ram  = 0;
+    uint64_t vram = 0;
+    auto add      = [&](ggml_backend_buffer_t buffer) {
+        if (buffer == nullptr) {
+            return;
+        }
+        // repacked CPU buffers are not host-readable, but live in RAM all the same
+        ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(buffer));
+        if (ggml_backend_buffer_is_host(buffer) ||
+            (dev != nullptr && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU)) {
+            ram += ggml_backend_buffer_get_size(buffer);
+        } else {
+            vram += ggml_backend_buffer_get_size(buffer);
+        }
+    };
+    for (const auto& block : params_storage_blocks_) {
+        add(block->buffer);
+    }
+    for (const auto& block : compute_staging_blocks_) {
+        add(block->buffer);
+    }
+    *ram_bytes  = ram;
+    *vram_bytes = vram;
+}
+
+void ModelManager::stop_background_load() {
+    stop_background_load_.store(true);
+    if (background_load_thread_.joinable()) {
+        background_load_thread_.join();
+    }
+}
+
 bool ModelManager::validate_registered_tensors() {
     bool ok = true;
     for (const auto& state : tensor_states_) {
@@ -213,9 +657,31 @@ bool ModelManager::load_tensors_to_params_backend(const std::vector<TensorState*
             need_alloc.push_back(state);
         }
     }
-
-    if (!alloc_params_buffers(need_alloc, created_storage_blocks) ||
-        !load_tensors(need_load)) {
+    attach_shared_params(need_alloc);
+    need_load.erase(std::remove_if(need_load.begin(),
+                                   need_load.end(),
+                                   [](TensorState* state) { return state->loaded_to_params_backend; }),
+                    need_load.end());
+
+    bool ok = alloc_params_buffers(need_alloc, created_storage_blocks);
+    if (ok) {
+        // tensors a recent LoRA set changed come back merged from the cache
+        // instead of being read from disk and merged again
+        if (const MergedLoraSet* merged_set = find_merged_lora_set(false)) {
+            need_load.erase(std::remove_if(need_load.begin(),
+                                           need_load.end(),
+                                           [&](TensorState* state) {
+                                               if (!restore_merged_lora_tensor(*merged_set, state)) {
+                                                   return false;
+                                               }
+                                               state->loaded_to_params_backend = true;
+                                               return true;
+                                           }),
+                            need_load.end());
+        }
+        ok = load_tensors(need_load);
+    }
+    if (!ok) {
         for (ParamsStorageBlock* block : created_storage_blocks) {
             if (block != nullptr) {
                 free_params_storage_block(*block);
@@ -224,19 +690,25 @@ bool ModelManager::load_tensors_to_params_backend(const std::vector<TensorState*
         }
         return false;
     }
+    uint64_t loaded_bytes = 0;
+    for (TensorState* state : need_load) {
+        loaded_bytes += ggml_nbytes(state->tensor);
+    }
+    sd_perf::add_loaded_bytes(loaded_bytes);
+    publish_shared_params(created_storage_blocks);
     for (ParamsStorageBlock* block : created_storage_blocks) {
         if (block != nullptr && block->buffer != nullptr) {
             LOG_DEBUG("model manager prepared params backend buffer (%6.2f MB, %zu tensors, %s)",
                       ggml_backend_buffer_get_size(block->buffer) / (1024.f * 1024.f),
                       block->states.size(),
-                      ggml_backend_buffer_is_host(block->buffer) ? "RAM" : "VRAM");
+                      block->pinned ? "pinned RAM" : (ggml_backend_buffer_is_host(block->buffer) ? "RAM" : "VRAM"));
         }
     }
 
     return true;
 }
 
-bool ModelManager::stage_tensors_to_compute_backend(const std::vector<TensorState*>& states) {
+bool ModelManager::stage_tensors_to_compute_backend(const std::vector<TensorState*>& states, bool synchronize) {
     std::map<ggml_backend_t, std::vector<TensorState*>> states_by_compute_backend;
     for (TensorState* state : states) {
         if (state == nullptr || should_ignore(*state) || is_optional_missing_tensor(state->name)) {
@@ -285,31 +757,86 @@ bool ModelManager::stage_tensors_to_compute_backend(const std::vector<TensorStat
             staged_tensors.push_back({state, staging_tensor});
         }
 
-        ggml_backend_buffer_t compute_buffer = ggml_backend_alloc_ctx_tensors(staging_ctx, compute_backend);
-        if (compute_buffer == nullptr) {
-            LOG_ERROR("model manager alloc compute params backend buffer failed, num_tensors = %zu",
-                      staged_tensors.size());
-            ggml_free(staging_ctx);
-            return false;
+        // Mapped params on a device sharing host memory are pointed at the
+        // mapping wrapped as a device buffer. The staging tensor keeps the host
+        // placement to restore, and already having data keeps it out of the
+        // copy buffer below.
+        std::vector<std::shared_ptr<ggml_backend_buffer>> mapped_buffers;
+        size_t mapped_bytes = 0;
+        size_t num_copied   = staged_tensors.size();
+        if (loras_.empty() && backend_maps_host_memory(compute_backend)) {
+            ggml_backend_dev_t dev = ggml_backend_get_device(compute_backend);
+            for (auto& staged_tensor : staged_tensors) {
+                ggml_tensor* managed_tensor = staged_tensor.first->tensor;
+                ggml_tensor* staging_tensor = staged_tensor.second;
+                if (managed_tensor->extra != nullptr) {
+                    continue;
+                }
+                void* device_data = nullptr;
+                auto buffer       = model_loader_.map_to_device(managed_tensor->data, dev, &device_data);
+                if (!buffer) {
+                    continue;
+                }
+                staging_tensor->buffer = managed_tensor->buffer;
+                staging_tensor->data   = managed_tensor->data;
+                managed_tensor->buffer = buffer.get();
+                managed_tensor->data   = device_data;
+                mapped_bytes += ggml_nbytes(managed_tensor);
+                num_copied--;
+                if (std::find(mapped_buffers.begin(), mapped_buffers.end(), buffer) == mapped_buffers.end()) {
+                    mapped_buffers.push_back(std::move(buffer));
+                }
+            }
+        }
+
+        ggml_backend_buffer_t compute_buffer = nullptr;
+        if (num_copied > 0) {
+            compute_buffer = ggml_backend_alloc_ctx_tensors(staging_ctx, compute_backend);
+            if (compute_buffer == nullptr) {
+                LOG_ERROR("model manager alloc compute params backend buffer failed, num_tensors = %zu",
+                          num_copied);
+                for (auto& staged_tensor : staged_tensors) {
+                    ggml_tensor* managed_tensor = staged_tensor.first->tensor;
+                    ggml_tensor* staging_tensor = staged_tensor.second;
+                    if (staging_tensor->data != nullptr) {
+                        managed_tensor->buffer = staging_tensor->buffer;
+                        managed_tensor->data   = staging_tensor->data;
+                    }
+                }
+                ggml_free(staging_ctx);
+                return false;
+            }
+            ggml_backend_buffer_set_usage(compute_buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+            sd_perf::trace_buffer(compute_buffer, sd_perf::BufferKind::STAGING, tensor_owner(states.front()->tensor));
         }
-        ggml_backend_buffer_set_usage(compute_buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
 
         for (auto& staged_tensor : staged_tensors) {
             TensorState* state          = staged_tensor.first;
             ggml_tensor* managed_tensor = state->tensor;
             ggml_tensor* staging_tensor = staged_tensor.second;
+            if (staging_tensor->buffer != compute_buffer) {
+                continue;
+            }
             ggml_backend_tensor_copy(managed_tensor, staging_tensor);
             std::swap(managed_tensor->buffer, staging_tensor->buffer);
             std::swap(managed_tensor->data, staging_tensor->data);
             std::swap(managed_tensor->extra, staging_tensor->extra);
         }
-        ggml_backend_synchronize(compute_backend);
+        if (compute_buffer != nullptr) {
+            sd_perf::add_uploaded_bytes(ggml_backend_buffer_get_size(compute_buffer));
+        }
+        // ggml_backend_tensor_copy blocks the calling thread until the upload is
+        // done; a prefetch must not also wait for the graph computing on the backend
+        if (synchronize) {
+            ggml_backend_synchronize(compute_backend);
+        }
 
         auto block             = std::make_unique<ComputeStagingBlock>();
         block->compute_backend = compute_backend;
         block->buffer          = compute_buffer;
         block->staging_ctx     = staging_ctx;
         block->staged_tensors  = std::move(staged_tensors);
+        block->mapped_buffers  = std::move(mapped_buffers);
         for (auto& staged_tensor : block->staged_tensors) {
             TensorState* state               = staged_tensor.first;
             state->staged_to_compute_backend = true;
@@ -317,8 +844,9 @@ bool ModelManager::stage_tensors_to_compute_backend(const std::vector<TensorStat
         compute_staging_blocks_.push_back(std::move(block));
 
         int64_t t1 = ggml_time_ms();
-        LOG_DEBUG("model manager staged compute params (%6.2f MB, %zu tensors) to %s, taking %.2fs",
-                  ggml_backend_buffer_get_size(compute_buffer) / (1024.f * 1024.f),
+        LOG_DEBUG("model manager staged compute params (%6.2f MB copied, %6.2f MB mapped, %zu tensors) to %s, taking %.2fs",
+                  (compute_buffer != nullptr ? ggml_backend_buffer_get_size(compute_buffer) : 0) / (1024.f * 1024.f),
+                  mapped_bytes / (1024.f * 1024.f),
                   states.size(),
                   ggml_backend_name(compute_backend),
                   (t1 - t0) * 1.0f / 1000);
@@ -332,12 +860,19 @@ bool ModelManager::apply_loras_to_params(const std::vector<TensorState*>& states
         return true;
     }
 
+    // Tensors are grouped by the multipliers already merged into them: zeros
+    // for base weights, the previous multipliers for tensors merged before a
+    // set_loras call that only re-weighted the same LoRAs. Each LoRA then adds
+    // just the difference to its new multiplier.
     struct LoraApplyGroup {
         std::map<std::string, ggml_tensor*> model_tensors;
         std::vector<TensorState*> states;
     };
 
-    std::map<ggml_backend_t, LoraApplyGroup> groups;
+    std::map<std::pair<ggml_backend_t, std::vector<float>>, LoraApplyGroup> groups;
+    std::vector<TensorState*> need_reload;
+    const std::vector<float> base_multipliers(loras_.size(), 0.0f);
+    const MergedLoraSet* merged_set = find_merged_lora_set(false);
     for (TensorState* state : states) {
         if (state == nullptr || state->tensor == nullptr ||
             should_ignore(*state) || is_optional_missing_tensor(state->name)) {
@@ -354,7 +889,23 @@ bool ModelManager::apply_loras_to_params(const std::vector<TensorState*>& states
             LOG_ERROR("model manager lora target tensor '%s' is not prepared", state->name.c_str());
             return false;
         }
-        LoraApplyGroup& group            = groups[state->compute_backend];
+        if (merged_set != nullptr && merged_set->covered.count(state->name) > 0) {
+            if (!restore_merged_lora_tensor(*merged_set, state)) {
+                mark_lora_applied(state, current_lora_multipliers());
+            }
+            continue;
+        }
+        const std::vector<float>* applied = &base_multipliers;
+        if (state->applied_lora_epoch != UINT64_MAX && state->applied_lora_epoch >= lora_set_epoch_) {
+            if (state->tensor->type != GGML_TYPE_F32 && state->tensor->type != GGML_TYPE_F16) {
+                // re-merging into quantized weights would compound rounding
+                // error, so these start over from the base weights
+                need_reload.push_back(state);
+            } else {
+                applied = &state->applied_lora_multipliers;
+            }
+        }
+        LoraApplyGroup& group            = groups[{state->compute_backend, *applied}];
         group.model_tensors[state->name] = state->tensor;
         group.states.push_back(state);
     }
@@ -362,13 +913,25 @@ bool ModelManager::apply_loras_to_params(const std::vector<TensorState*>& states
     if (groups.empty()) {
         return true;
     }
+    if (!need_reload.empty()) {
+        LOG_DEBUG("reloading %zu quantized lora target tensors before re-weighting", need_reload.size());
+        if (!load_tensors(need_reload)) {
+            return false;
+        }
+    }
 
     std::set<std::string> all_tensor_names = tensor_names();
     for (auto& group_pair : groups) {
-        ggml_backend_t compute_backend = group_pair.first;
+        ggml_backend_t compute_backend = group_pair.first.first;
+        std::vector<float> multipliers = group_pair.first.second;
         LoraApplyGroup& group          = group_pair.second;
-        for (const LoraSpec& lora_spec : loras_) {
-            if (group.model_tensors.empty()) {
+        bool from_base                 = multipliers == base_multipliers;
+        std::set<std::string> patched;
+        bool complete = true;
+        for (size_t i = 0; i < loras_.size(); ++i) {
+            const LoraSpec& lora_spec = loras_[i];
+            float delta               = lora_spec.multiplier - multipliers[i];
+            if (group.model_tensors.empty() || delta == 0.0f) {
                 continue;
             }
 
@@ -391,6 +954,7 @@ bool ModelManager::apply_loras_to_params(const std::vector<TensorState*>& states
                 if (lora_spec.required) {
                     return false;
                 }
+                complete = false;
                 continue;
             }
             if (lora->lora_tensors.empty()) {
@@ -398,22 +962,42 @@ bool ModelManager::apply_loras_to_params(const std::vector<TensorState*>& states
                     LOG_ERROR("required lora has no tensors: %s", lora_spec.path.c_str());
                     return false;
                 }
+                multipliers[i] = lora_spec.multiplier;
                 continue;
             }
-            lora->multiplier = lora_spec.multiplier;
+            lora->multiplier = delta;
             lora->apply(group.model_tensors, all_tensor_names, lora_version_, n_threads_, false);
+            patched.insert(lora->patched_tensors.begin(), lora->patched_tensors.end());
             lora->release_loaded_tensors();
+            multipliers[i] = lora_spec.multiplier;
+        }
+        if (complete && from_base) {
+            store_merged_lora_tensors(group.states, patched);
         }
 
         for (TensorState* state : group.states) {
             if (state != nullptr) {
-                state->applied_lora_epoch = current_lora_epoch_;
+                mark_lora_applied(state, multipliers);
             }
         }
     }
     return true;
 }
 
+std::vector<float> ModelManager::current_lora_multipliers() const {
+    std::vector<float> multipliers;
+    multipliers.reserve(loras_.size());
+    for (const LoraSpec& lora_spec : loras_) {
+        multipliers.push_back(lora_spec.multiplier);
+    }
+    return multipliers;
+}
+
+void ModelManager::mark_lora_applied(TensorState* state, const std::vector<float>& multipliers) {
+    state->applied_lora_epoch       = current_lora_epoch_;
+    state->applied_lora_multipliers = multipliers;
+}
+
 void ModelManager::reset_lora_applied_params() {
     release_compute_staging_blocks(true);
     release_params_storage_blocks(true);
@@ -422,6 +1006,82 @@ void ModelManager::reset_lora_applied_params() {
     }
 }
 
+ModelManager::MergedLoraSet* ModelManager::find_merged_lora_set(bool create) {
+    if (max_lora_cache_bytes_ == 0 || loras_.empty()) {
+        return nullptr;
+    }
+    for (auto& merged_set : merged_lora_sets_) {
+        if (merged_set->key == lora_set_key_) {
+            merged_set->last_used = ++lora_cache_tick_;
+            return merged_set.get();
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    auto merged_set       = std::make_unique<MergedLoraSet>();
+    merged_set->key       = lora_set_key_;
+    merged_set->last_used = ++lora_cache_tick_;
+    merged_lora_sets_.push_back(std::move(merged_set));
+    return merged_lora_sets_.back().get();
+}
+
+bool ModelManager::restore_merged_lora_tensor(const MergedLoraSet& merged_set, TensorState* state) {
+    auto it = merged_set.merged.find(state->name);
+    if (it == merged_set.merged.end() || it->second.size() != ggml_nbytes(state->tensor)) {
+        return false;
+    }
+    ggml_backend_tensor_set(state->tensor, it->second.data(), 0, it->second.size());
+    mark_lora_applied(state, current_lora_multipliers());
+    return true;
+}
+
+void ModelManager::store_merged_lora_tensors(const std::vector<TensorState*>& states,
+                                             const std::set<std::string>& patched) {
+    MergedLoraSet* merged_set = find_merged_lora_set(true);
+    if (merged_set == nullptr || merged_set->oversized) {
+        return;
+    }
+    for (TensorState* state : states) {
+        if (patched.count(state->name) > 0 && merged_set->merged.count(state->name) == 0) {
+            size_t nbytes = ggml_nbytes(state->tensor);
+            while (lora_cache_bytes_ + nbytes > max_lora_cache_bytes_ && evict_merged_lora_set(merged_set)) {
+            }
+            if (lora_cache_bytes_ + nbytes > max_lora_cache_bytes_) {
+                LOG_DEBUG("merged weights of the current lora set exceed the lora cache, not caching them");
+                lora_cache_bytes_ -= merged_set->bytes;
+                merged_set->merged.clear();
+                merged_set->covered.clear();
+                merged_set->bytes     = 0;
+                merged_set->oversized = true;
+                return;
+            }
+            std::vector<uint8_t> data(nbytes);
+            ggml_backend_tensor_get(state->tensor, data.data(), 0, nbytes);
+            merged_set->merged[state->name] = std::move(data);
+            merged_set->bytes += nbytes;
+            lora_cache_bytes_ += nbytes;
+        }
+        merged_set->covered.insert(state->name);
+    }
+}
+
+bool ModelManager::evict_merged_lora_set(const MergedLoraSet* keep) {
+    auto lru = merged_lora_sets_.end();
+    for (auto it = merged_lora_sets_.begin(); it != merged_lora_sets_.end(); ++it) {
+        if (it->get() != keep && (lru == merged_lora_sets_.end() || (*it)->last_used < (*lru)->last_used)) {
+            lru = it;
+        }
+    }
+    if (lru == merged_lora_sets_.end()) {
+        return false;
+    }
+    LOG_DEBUG("evicting merged weights of a lora set (%.2f MB)", (*lru)->bytes / (1024.f * 1024.f));
+    lora_cache_bytes_ -= (*lru)->bytes;
+    merged_lora_sets_.erase(lru);
+    return true;
+}
+
 bool ModelManager::should_ignore(const TensorState& state) const {
     for (const auto& ignore_prefix : common_ignore_tensors_) {
         if (starts_with(state.name, ignore_prefix)) {
@@ -431,6 +1091,15 @@ bool ModelManager::should_ignore(const TensorState& state) const {
     return false;
 }
 
+bool ModelManager::is_lazy(const TensorState& state) const {
+    for (const auto& lazy_prefix : lazy_tensors_) {
+        if (starts_with(state.name, lazy_prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool ModelManager::is_optional_missing_tensor(const std::string& name) const {
     return name.find("cond_stage_model.transformer.text_model.encoder.layers.23") != std::string::npos ||
            name.find("alphas_cumprod") != std::string::npos;
@@ -506,6 +1175,9 @@ bool ModelManager::can_mmap_storage(const TensorState& state) const {
     if (!enable_mmap_ || state.residency_mode != ResidencyMode::ParamBackend) {
         return false;
     }
+    if (repack_buffer_type_for(state) != nullptr) {
+        return false;
+    }
     if (state.compute_backend == nullptr || state.params_backend == nullptr) {
         return false;
     }
@@ -517,20 +1189,26 @@ bool ModelManager::can_mmap_storage(const TensorState& state) const {
 bool ModelManager::alloc_params_buffers(const std::vector<TensorState*>& states,
                                         std::vector<ParamsStorageBlock*>& created_storage_blocks) {
     std::map<std::pair<ggml_backend_buffer_type_t, int>, std::vector<TensorState*>> states_by_buffer_type;
+    std::set<ggml_backend_buffer_type_t> pinned_bufts;
     for (TensorState* state : states) {
         if (state == nullptr || state->tensor == nullptr) {
             continue;
         }
-        ggml_backend_buffer_type_t params_buft = params_buffer_type_for(*state);
+        bool pinned                            = false;
+        ggml_backend_buffer_type_t params_buft = params_buffer_type_for(*state, &pinned);
         if (params_buft == nullptr) {
             return false;
         }
+        if (pinned) {
+            pinned_bufts.insert(params_buft);
+        }
         states_by_buffer_type[{params_buft, static_cast<int>(state->residency_mode)}].push_back(state);
     }
 
     for (const auto& pair : states_by_buffer_type) {
         ggml_backend_buffer_type_t params_buft  = pair.first.first;
         const std::vector<TensorState*>& states = pair.second;
+        const bool pinned_buft                  = pinned_bufts.find(params_buft) != pinned_bufts.end();
         size_t alignment                        = ggml_backend_buft_get_alignment(params_buft);
         size_t max_size                         = ggml_backend_buft_get_max_size(params_buft);
 
@@ -539,13 +1217,39 @@ bool ModelManager::alloc_params_buffers(const std::vector<TensorState*>& states,
                 return true;
             }
 
-            ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(params_buft, chunk_size);
+            ggml_backend_buffer_type_t chunk_buft = params_buft;
+            bool pinned                           = pinned_buft;
+            auto use_pageable_buffer              = [&]() {
+                chunk_buft             = ggml_backend_get_default_buffer_type(chunk.front()->params_backend);
+                pinned                 = false;
+                size_t chunk_alignment = ggml_backend_buft_get_alignment(chunk_buft);
+                chunk_size             = 0;
+                for (TensorState* state : chunk) {
+                    chunk_size += GGML_PAD(ggml_backend_buft_get_alloc_size(chunk_buft, state->tensor), chunk_alignment);
+                }
+            };
+            if (pinned && pinned_bytes_ + chunk_size > max_pinned_bytes_) {
+                use_pageable_buffer();
+            }
+
+            ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(chunk_buft, chunk_size);
+            if (buffer == nullptr && pinned) {
+                LOG_WARN("model manager alloc pinned params buffer failed, size = %.2fMB; using pageable memory",
+                         chunk_size / (1024.0 * 1024.0));
+                use_pageable_buffer();
+                buffer = ggml_backend_buft_alloc_buffer(chunk_buft, chunk_size);
+            }
             if (buffer == nullptr) {
                 LOG_ERROR("model manager alloc params backend buffer failed, size = %.2fMB",
                           chunk_size / (1024.0 * 1024.0));
                 return false;
             }
             ggml_backend_buffer_set_usage(buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+            // placed before the loader first touches it
+            ggml_backend_dev_t buffer_dev = ggml_backend_buft_get_device(chunk_buft);
+            if (!pinned && buffer_dev != nullptr && ggml_backend_dev_type(buffer_dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+                sd::advise_host_params(ggml_backend_buffer_get_base(buffer), ggml_backend_buffer_get_size(buffer));
+            }
 
             std::vector<ggml_tensor*> initialized_tensors;
             void* base    = ggml_backend_buffer_get_base(buffer);
@@ -574,9 +1278,14 @@ bool ModelManager::alloc_params_buffers(const std::vector<TensorState*>& states,
             }
 
             auto block              = std::make_unique<ParamsStorageBlock>();
+            sd_perf::trace_buffer(buffer, sd_perf::BufferKind::PARAMS, tensor_owner(chunk.front()->tensor));
             block->buffer           = buffer;
+            block->pinned           = pinned;
             block->states           = chunk;
             ParamsStorageBlock* raw = block.get();
+            if (pinned) {
+                pinned_bytes_ += ggml_backend_buffer_get_size(buffer);
+            }
             params_storage_blocks_.push_back(std::move(block));
             created_storage_blocks.push_back(raw);
 
@@ -660,7 +1369,14 @@ bool ModelManager::load_tensors(const std::vector<TensorState*>& states) {
         return true;
     };
 
-    if (!model_loader_.load_tensors(on_new_tensor_cb, enable_mmap_, &target_tensor_names)) {
+    // disk resident params are read again on every use; keeping their pages
+    // cached would grow the host footprint to the whole file
+    bool from_disk = std::all_of(states_by_name.begin(),
+                                 states_by_name.end(),
+                                 [](const std::pair<const std::string, TensorState*>& pair) {
+                                     return pair.second->residency_mode == ResidencyMode::Disk;
+                                 });
+    if (!model_loader_.load_tensors(on_new_tensor_cb, enable_mmap_, &target_tensor_names, from_disk)) {
         LOG_ERROR("model manager load tensors failed");
         return false;
     }
@@ -683,13 +1399,201 @@ bool ModelManager::load_tensors(const std::vector<TensorState*>& states) {
     return true;
 }
 
-ggml_backend_buffer_type_t ModelManager::params_buffer_type_for(const TensorState& state) const {
+bool ModelManager::load_unregistered_tensors(const std::map<std::string, ggml_tensor*>& tensors) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    std::set<std::string> target_tensor_names;
+    for (const auto& [name, tensor] : tensors) {
+        if (tensor == nullptr || is_optional_missing_tensor(name)) {
+            continue;
+        }
+        bool ignored = false;
+        for (const auto& ignore_prefix : common_ignore_tensors_) {
+            if (starts_with(name, ignore_prefix)) {
+                ignored = true;
+                break;
+            }
+        }
+        if (!ignored) {
+            target_tensor_names.insert(name);
+        }
+    }
+    if (target_tensor_names.empty()) {
+        return true;
+    }
+
+    std::set<std::string> loaded_names;
+    std::mutex loaded_names_mutex;
+    auto on_new_tensor_cb = [&](const TensorStorage& tensor_storage, ggml_tensor** dst_tensor) -> bool {
+        const std::string& name = tensor_storage.name;
+        *dst_tensor             = nullptr;
+        if (target_tensor_names.find(name) == target_tensor_names.end()) {
+            return true;
+        }
+
+        ggml_tensor* tensor = tensors.at(name);
+        if (tensor->ne[0] != tensor_storage.ne[0] ||
+            tensor->ne[1] != tensor_storage.ne[1] ||
+            tensor->ne[2] != tensor_storage.ne[2] ||
+            tensor->ne[3] != tensor_storage.ne[3]) {
+            LOG_ERROR(
+                "model manager tensor '%s' has wrong shape in model file: got [%d, %d, %d, %d], expected [%d, %d, %d, %d]",
+                name.c_str(),
+                (int)tensor_storage.ne[0], (int)tensor_storage.ne[1], (int)tensor_storage.ne[2], (int)tensor_storage.ne[3],
+                (int)tensor->ne[0], (int)tensor->ne[1], (int)tensor->ne[2], (int)tensor->ne[3]);
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loaded_names_mutex);
+            loaded_names.insert(name);
+        }
+        *dst_tensor = tensor;
+        return true;
+    };
+
+    if (!model_loader_.load_tensors(on_new_tensor_cb, enable_mmap_, &target_tensor_names)) {
+        LOG_ERROR("model manager load tensors failed");
+        return false;
+    }
+
+    bool missing = false;
+    for (const std::string& name : target_tensor_names) {
+        if (loaded_names.find(name) == loaded_names.end()) {
+            LOG_ERROR("model manager tensor '%s' was not loaded", name.c_str());
+            missing = true;
+        }
+    }
+    return !missing;
+}
+
+bool ModelManager::shared_params_key(const TensorState& state,
+                                     ggml_backend_buffer_type_t buft,
+                                     std::string& key) const {
+    // immediate LoRAs may be merged into the params in place
+    if (!loras_.empty() || state.residency_mode != ResidencyMode::ParamBackend ||
+        state.tensor == nullptr || buft == nullptr) {
+        return false;
+    }
+    std::string buft_key = std::string(ggml_type_name(state.tensor->type)) + '\n' +
+                           std::to_string(reinterpret_cast<uintptr_t>(buft));
+    if (!text_encoder_share_key_.empty() && is_cond_stage_model_name(state.name)) {
+        // the key stands for the file, the shape guards against a mismatched encoder
+        std::string shape;
+        for (int i = 0; i < GGML_MAX_DIMS; ++i) {
+            shape += std::to_string(state.tensor->ne[i]) + ',';
+        }
+        key = "text encoder " + text_encoder_share_key_ + '\n' + state.name + '\n' + shape + '\n' + buft_key;
+        return true;
+    }
+    const auto& tensor_storage_map = model_loader_.get_tensor_storage_map();
+    auto it                        = tensor_storage_map.find(state.name);
+    if (it == tensor_storage_map.end()) {
+        return false;
+    }
+    std::string file_path = model_loader_.get_file_path(it->second.file_index);
+    if (file_path.empty()) {
+        return false;
+    }
+    key = file_path + '\n' + state.name + '\n' + buft_key;
+    return true;
+}
+
+void ModelManager::attach_shared_params(std::vector<TensorState*>& states) {
+    std::map<ggml_backend_buffer_t, ParamsStorageBlock*> attached_blocks;
+    std::vector<TensorState*> remaining;
+    remaining.reserve(states.size());
+    size_t attached_count = 0;
+    for (TensorState* state : states) {
+        if (state->params_backend == nullptr) {
+            remaining.push_back(state);
+            continue;
+        }
+        std::shared_ptr<ggml_backend_buffer> buffer;
+        size_t offset = 0;
+        ggml_backend_buffer_type_t bufts[2] = {params_buffer_type_for(*state),
+                                               ggml_backend_get_default_buffer_type(state->params_backend)};
+        for (ggml_backend_buffer_type_t buft : bufts) {
+            std::string key;
+            if (shared_params_key(*state, buft, key)) {
+                buffer = SharedParamsRegistry::instance().find(key, &offset);
+            }
+            if (buffer != nullptr) {
+                break;
+            }
+        }
+        if (buffer == nullptr) {
+            remaining.push_back(state);
+            continue;
+        }
+
+        char* base = static_cast<char*>(ggml_backend_buffer_get_base(buffer.get()));
+        if (ggml_backend_tensor_alloc(buffer.get(), state->tensor, base + offset) != GGML_STATUS_SUCCESS) {
+            remaining.push_back(state);
+            continue;
+        }
+        ParamsStorageBlock*& block = attached_blocks[buffer.get()];
+        if (block == nullptr) {
+            auto new_block           = std::make_unique<ParamsStorageBlock>();
+            new_block->buffer        = buffer.get();
+            new_block->shared_buffer = buffer;
+            block                    = new_block.get();
+            params_storage_blocks_.push_back(std::move(new_block));
+        }
+        block->states.push_back(state);
+        state->loaded_to_params_backend = true;
+        attached_count++;
+    }
+    if (attached_count > 0) {
+        LOG_DEBUG("model manager reused %zu params tensors loaded by another context", attached_count);
+    }
+    states.swap(remaining);
+}
+
+void ModelManager::publish_shared_params(const std::vector<ParamsStorageBlock*>& blocks) {
+    for (ParamsStorageBlock* block : blocks) {
+        if (block == nullptr || block->buffer == nullptr || block->shared_buffer != nullptr) {
+            continue;
+        }
+        ggml_backend_buffer_type_t buft = ggml_backend_buffer_get_type(block->buffer);
+        std::vector<std::string> keys;
+        keys.reserve(block->states.size());
+        for (TensorState* state : block->states) {
+            std::string key;
+            if (!shared_params_key(*state, buft, key)) {
+                break;
+            }
+            keys.push_back(std::move(key));
+        }
+        if (keys.size() != block->states.size()) {
+            continue;
+        }
+
+        // the last context holding the buffer unbooks it
+        block->shared_buffer = std::shared_ptr<ggml_backend_buffer>(block->buffer, [](ggml_backend_buffer_t buffer) {
+            sd_perf::untrace_buffer(buffer);
+            ggml_backend_buffer_free(buffer);
+        });
+        char* base           = static_cast<char*>(ggml_backend_buffer_get_base(block->buffer));
+        for (size_t i = 0; i < keys.size(); ++i) {
+            size_t offset = static_cast<char*>(block->states[i]->tensor->data) - base;
+            SharedParamsRegistry::instance().publish(keys[i], block->shared_buffer, offset);
+        }
+    }
+}
+
+ggml_backend_buffer_type_t ModelManager::params_buffer_type_for(const TensorState& state, bool* pinned) const {
+    if (pinned != nullptr) {
+        *pinned = false;
+    }
     if (state.params_backend == nullptr) {
         LOG_ERROR("model manager params backend is null for tensor '%s'", state.name.c_str());
         return nullptr;
     }
-    ggml_backend_buffer_type_t params_buft = nullptr;
-    if (state.compute_backend != nullptr && state.params_backend != state.compute_backend) {
+    ggml_backend_buffer_type_t params_buft = repack_buffer_type_for(state);
+    if (params_buft != nullptr) {
+        return params_buft;
+    }
+    if (max_pinned_bytes_ > 0 && state.compute_backend != nullptr && state.params_backend != state.compute_backend) {
         ggml_backend_dev_t compute_dev = ggml_backend_get_device(state.compute_backend);
         if (compute_dev != nullptr) {
             params_buft = ggml_backend_dev_host_buffer_type(compute_dev);
@@ -697,11 +1601,35 @@ ggml_backend_buffer_type_t ModelManager::params_buffer_type_for(const TensorStat
     }
     if (params_buft == nullptr) {
         params_buft = ggml_backend_get_default_buffer_type(state.params_backend);
+    } else if (pinned != nullptr) {
+        *pinned = params_buft != ggml_backend_get_default_buffer_type(state.params_backend);
     }
     return params_buft;
 }
 
+// Only 2D quantized weights of modules that run where their params live, on
+// the CPU. Embedding tables are left out: they are read by get_rows, which
+// the repacked layouts do not support.
+ggml_backend_buffer_type_t ModelManager::repack_buffer_type_for(const TensorState& state) const {
+    if (!cpu_repack_ || state.tensor == nullptr || state.residency_mode != ResidencyMode::ParamBackend ||
+        state.params_backend != state.compute_backend || !sd_backend_is_cpu(state.compute_backend)) {
+        return nullptr;
+    }
+    const ggml_tensor* tensor = state.tensor;
+    if (!ggml_is_quantized(tensor->type) || ggml_n_dims(tensor) != 2 || !ends_with(state.name, ".weight") ||
+        contains(state.name, "embed") || contains(state.name, "token") || ends_with(state.name, "shared.weight")) {
+        return nullptr;
+    }
+    for (ggml_backend_buffer_type_t buft : cpu_extra_buffer_types()) {
+        if (cpu_buffer_type_supports_matmul(buft, tensor)) {
+            return buft;
+        }
+    }
+    return nullptr;
+}
+
 void ModelManager::free_compute_staging_block(ComputeStagingBlock& block) {
+    residency_epoch_++;
     for (auto& staged_tensor : block.staged_tensors) {
         TensorState* state          = staged_tensor.first;
         ggml_tensor* staging_tensor = staged_tensor.second;
@@ -725,6 +1653,7 @@ void ModelManager::free_compute_staging_block(ComputeStagingBlock& block) {
                   ggml_backend_buffer_get_size(block.buffer) / (1024.f * 1024.f),
                   block.staged_tensors.size(),
                   block.compute_backend != nullptr ? ggml_backend_name(block.compute_backend) : "unknown");
+        sd_perf::untrace_buffer(block.buffer);
         ggml_backend_buffer_free(block.buffer);
         block.buffer = nullptr;
     }
@@ -733,6 +1662,7 @@ void ModelManager::free_compute_staging_block(ComputeStagingBlock& block) {
         block.staging_ctx = nullptr;
     }
     block.staged_tensors.clear();
+    block.mapped_buffers.clear();
 }
 
 void ModelManager::release_compute_staging_blocks(bool force,
@@ -766,12 +1696,22 @@ void ModelManager::release_compute_staging_blocks(bool force,
 }
 
 void ModelManager::free_params_storage_block(ParamsStorageBlock& block) {
+    residency_epoch_++;
     if (block.buffer != nullptr) {
         LOG_DEBUG("model manager releasing params backend buffer (%6.2f MB, %zu tensors, %s)",
                   ggml_backend_buffer_get_size(block.buffer) / (1024.f * 1024.f),
                   block.states.size(),
-                  ggml_backend_buffer_is_host(block.buffer) ? "RAM" : "VRAM");
-        ggml_backend_buffer_free(block.buffer);
+                  block.pinned ? "pinned RAM" : (ggml_backend_buffer_is_host(block.buffer) ? "RAM" : "VRAM"));
+        if (block.pinned) {
+            pinned_bytes_ -= std::min(pinned_bytes_, ggml_backend_buffer_get_size(block.buffer));
+            block.pinned = false;
+        }
+        if (block.shared_buffer != nullptr) {
+            block.shared_buffer.reset();
+        } else {
+            sd_perf::untrace_buffer(block.buffer);
+            ggml_backend_buffer_free(block.buffer);
+        }
         block.buffer = nullptr;
     }
     block.mmap_tensor_stores.clear();
@@ -791,14 +1731,15 @@ void ModelManager::free_params_storage_block(ParamsStorageBlock& block) {
 }
 
 void ModelManager::release_params_storage_blocks(bool force,
-                                                 const std::unordered_set<TensorState*>* target_states) {
+                                                 const std::unordered_set<TensorState*>* target_states,
+                                                 bool any_residency) {
     for (auto it = params_storage_blocks_.begin(); it != params_storage_blocks_.end();) {
         ParamsStorageBlock* block = it->get();
         bool can_release          = force;
         if (!can_release) {
             can_release = std::all_of(block->states.begin(),
                                       block->states.end(),
-                                      [target_states](TensorState* state) {
+                                      [target_states, any_residency](TensorState* state) {
                                           if (state == nullptr) {
                                               return true;
                                           }
@@ -808,7 +1749,7 @@ void ModelManager::release_params_storage_blocks(bool force,
                                           }
                                           return state->active_prepare_count == 0 &&
                                                  !state->staged_to_compute_backend &&
-                                                 state->residency_mode == ResidencyMode::Disk;
+                                                 (any_residency || state->residency_mode == ResidencyMode::Disk);
                                       });
         }
 
@@ -833,6 +1774,8 @@ void ModelManager::erase_params_storage_block(ParamsStorageBlock* block) {
 }
 
 void ModelManager::release_all() {
+    prefetched_states_.clear();
+    residency_epoch_++;
     for (auto& state : tensor_states_) {
         state->active_prepare_count = 0;
         state->applied_lora_epoch   = UINT64_MAX;
@@ -845,10 +1788,19 @@ bool ModelManager::resolve_required_tensor_states(const std::vector<ggml_tensor*
                                                   std::vector<TensorState*>& required_states) const {
     required_states.clear();
     std::unordered_set<TensorState*> seen;
+    seen.reserve(tensors.size());
+    required_states.reserve(tensors.size());
     for (ggml_tensor* tensor : tensors) {
         if (tensor == nullptr) {
             continue;
         }
+        auto tensor_it = tensor_states_by_tensor_.find(tensor);
+        if (tensor_it != tensor_states_by_tensor_.end()) {
+            if (seen.insert(tensor_it->second).second) {
+                required_states.push_back(tensor_it->second);
+            }
+            continue;
+        }
         const char* raw_name = ggml_get_name(tensor);
         if (raw_name == nullptr || raw_name[0] == '\0') {
             LOG_ERROR("model manager unnamed tensor is not registered");
@@ -875,6 +1827,20 @@ bool ModelManager::prepare_params(const std::vector<ggml_tensor*>& tensors) {
     if (tensors.empty()) {
         return true;
     }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+
+    // Steady-state steps of a resident model hand in the same params every
+    // compute; they only need their prepare counts.
+    if (residency_epoch_ == last_prepared_residency_epoch_ &&
+        current_lora_epoch_ == last_prepared_lora_epoch_ &&
+        tensors == last_prepared_tensors_) {
+        for (TensorState* state : last_prepared_states_) {
+            if (prefetched_states_.empty() || prefetched_states_.erase(state) == 0) {
+                state->active_prepare_count++;
+            }
+        }
+        return true;
+    }
 
     std::vector<TensorState*> required_states;
     if (!resolve_required_tensor_states(tensors, required_states)) {
@@ -901,11 +1867,192 @@ bool ModelManager::prepare_params(const std::vector<ggml_tensor*>& tensors) {
         if (state == nullptr) {
             continue;
         }
-        state->active_prepare_count++;
+        // a prefetched state already holds the count this prepare needs
+        if (prefetched_states_.erase(state) == 0) {
+            state->active_prepare_count++;
+        }
+    }
+    last_prepared_residency_epoch_ = residency_epoch_;
+    last_prepared_lora_epoch_      = current_lora_epoch_;
+    last_prepared_tensors_         = tensors;
+    last_prepared_states_          = std::move(required_states);
+    return true;
+}
+
+bool ModelManager::prefetch_params(const std::vector<ggml_tensor*>& tensors) {
+    if (tensors.empty()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states)) {
+        return false;
+    }
+
+    // LoRA merging runs a graph on the compute backend, so it stays in prepare_params
+    if (!load_tensors_to_params_backend(required_states) ||
+        !stage_tensors_to_compute_backend(required_states, false)) {
+        return false;
+    }
+
+    for (TensorState* state : required_states) {
+        if (state != nullptr && prefetched_states_.insert(state).second) {
+            state->active_prepare_count++;
+        }
+    }
+    return true;
+}
+
+void ModelManager::release_prefetched_params(const std::vector<ggml_tensor*>& tensors) {
+    if (tensors.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states)) {
+        return;
+    }
+    std::vector<TensorState*> unused_states;
+    for (TensorState* state : required_states) {
+        if (state != nullptr && prefetched_states_.erase(state) > 0) {
+            unused_states.push_back(state);
+        }
+    }
+    finish_compute_backend_usage(unused_states);
+}
+
+void ModelManager::advise_params(const std::vector<ggml_tensor*>& tensors) {
+    if (tensors.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states)) {
+        return;
+    }
+    std::set<std::string> names;
+    for (TensorState* state : required_states) {
+        if (state != nullptr && !state->loaded_to_params_backend) {
+            names.insert(state->name);
+        }
+    }
+    model_loader_.prefetch_tensor_data(names);
+}
+
+bool ModelManager::prepare_host_params(const std::vector<ggml_tensor*>& tensors) {
+    if (tensors.empty()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+
+    // LoRAs are merged into the staged copies, the host params keep the base weights
+    if (!loras_.empty()) {
+        return false;
+    }
+    std::vector<TensorState*> required_states;
+    if (!resolve_required_tensor_states(tensors, required_states)) {
+        return false;
+    }
+    for (TensorState* state : required_states) {
+        if (state != nullptr && (state->staged_to_compute_backend || !sd_backend_is_cpu(state->params_backend))) {
+            return false;
+        }
+    }
+    if (!load_tensors_to_params_backend(required_states)) {
+        return false;
+    }
+    for (TensorState* state : required_states) {
+        if (state != nullptr && (state->tensor->buffer == nullptr || !ggml_backend_buffer_is_host(state->tensor->buffer))) {
+            return false;
+        }
+    }
+    for (TensorState* state : required_states) {
+        if (state != nullptr) {
+            state->active_prepare_count++;
+        }
     }
     return true;
 }
 
+std::shared_ptr<sd::ComputeArena> ModelManager::compute_arena(ggml_backend_buffer_type* buft) {
+    if (!shared_compute_buffer_ || buft == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(compute_arenas_mutex_);
+    std::shared_ptr<sd::ComputeArena>& arena = compute_arenas_[buft];
+    if (arena == nullptr) {
+        arena = std::make_shared<sd::ComputeArena>(buft);
+    }
+    return arena;
+}
+
+size_t ModelManager::release_idle_memory() {
+    size_t released = 0;
+    {
+        std::lock_guard<std::mutex> lock(compute_arenas_mutex_);
+        for (auto& pair : compute_arenas_) {
+            released += pair.second->trim();
+        }
+    }
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    auto staged_bytes = [this]() {
+        size_t bytes = 0;
+        for (const auto& block : compute_staging_blocks_) {
+            if (block->buffer != nullptr) {
+                bytes += ggml_backend_buffer_get_size(block->buffer);
+            }
+        }
+        return bytes;
+    };
+    size_t staged_before = staged_bytes();
+    release_compute_staging_blocks(false);
+    released += staged_before - staged_bytes();
+    return released;
+}
+
+void ModelManager::start_prefetch(std::vector<ggml_tensor*> tensors, bool stage) {
+    finish_prefetch();
+    if (tensors.empty()) {
+        return;
+    }
+    prefetch_tensors_ = std::move(tensors);
+    prefetch_thread_  = std::thread([this, stage, thread_callbacks = sd_current_thread_callbacks()]() {
+        ScopedThreadCallbacks callback_scope(thread_callbacks);
+        int64_t t0 = ggml_time_ms();
+        bool ok    = true;
+        if (stage) {
+            ok = prefetch_params(prefetch_tensors_);
+        } else {
+            std::vector<TensorState*> required_states;
+            {
+                std::lock_guard<std::mutex> lock(state_mutex_);
+                ok = resolve_required_tensor_states(prefetch_tensors_, required_states);
+            }
+            ok = ok && load_in_chunks(required_states, nullptr, nullptr);
+        }
+        if (!ok) {
+            LOG_WARN("model manager prefetch failed, params are staged on first use");
+            return;
+        }
+        LOG_DEBUG("model manager prefetched %zu tensors in %.2fs",
+                  prefetch_tensors_.size(),
+                  (ggml_time_ms() - t0) / 1000.f);
+    });
+}
+
+void ModelManager::finish_prefetch() {
+    if (prefetch_thread_.joinable()) {
+        prefetch_thread_.join();
+    }
+    if (!prefetch_tensors_.empty()) {
+        release_prefetched_params(prefetch_tensors_);
+        prefetch_tensors_.clear();
+    }
+}
+
 void ModelManager::finish_compute_backend_usage(const std::vector<TensorState*>& states) {
     if (states.empty()) {
         return;
@@ -927,6 +2074,7 @@ void ModelManager::release_compute_backend_params(const std::vector<ggml_tensor*
     if (tensors.empty()) {
         return;
     }
+    std::lock_guard<std::mutex> lock(state_mutex_);
     std::vector<TensorState*> required_states;
     if (!resolve_required_tensor_states(tensors, required_states)) {
         return;
@@ -938,6 +2086,7 @@ void ModelManager::release_params_backend_params(const std::vector<ggml_tensor*>
     if (tensors.empty()) {
         return;
     }
+    std::lock_guard<std::mutex> lock(state_mutex_);
     std::vector<TensorState*> required_states;
     if (!resolve_required_tensor_states(tensors, required_states)) {
         return;
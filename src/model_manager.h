@@ -1,11 +1,15 @@
 #ifndef __MODEL_MANAGER_H__
 #define __MODEL_MANAGER_H__
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -25,6 +29,7 @@ public:
         bool is_high_noise = false;
         std::string tensor_name_prefix_filter;
         bool required = false;
+        std::vector<float> image_multipliers;  // per generated image, runtime LoRAs of the diffusion model only
     };
 
 private:
@@ -43,10 +48,13 @@ private:
         bool loaded_to_params_backend  = false;
         bool staged_to_compute_backend = false;
         uint64_t applied_lora_epoch    = UINT64_MAX;
+        std::vector<float> applied_lora_multipliers;  // per loras_ entry, valid while applied_lora_epoch >= lora_set_epoch_
     };
 
     struct ParamsStorageBlock {
         ggml_backend_buffer_t buffer = nullptr;
+        bool pinned                  = false;  // page-locked host buffer of the compute device
+        std::shared_ptr<ggml_backend_buffer> shared_buffer;  // set once other contexts may use `buffer`
         std::vector<MmapTensorStore> mmap_tensor_stores;
         std::vector<TensorState*> states;
     };
@@ -56,27 +64,79 @@ private:
         ggml_backend_buffer_t buffer   = nullptr;
         ggml_context* staging_ctx      = nullptr;
         std::vector<std::pair<TensorState*, ggml_tensor*>> staged_tensors;
+        std::vector<std::shared_ptr<ggml_backend_buffer>> mapped_buffers;  // mapped files the device reads in place
+    };
+
+    // Host copy of what one LoRA set (specs plus model version) left in the
+    // params, so switching back to a recent set restores bytes instead of
+    // loading and merging its LoRA files again.
+    struct MergedLoraSet {
+        std::string key;
+        std::map<std::string, std::vector<uint8_t>> merged;  // tensors some LoRA of the set changed
+        std::unordered_set<std::string> covered;             // tensors merged with the set, changed or not
+        size_t bytes       = 0;
+        uint64_t last_used = 0;
+        bool oversized     = false;  // does not fit the budget; kept only so it is not retried
     };
 
     ModelLoader model_loader_;
     std::vector<std::unique_ptr<TensorState>> tensor_states_;
-    std::map<std::string, TensorState*> tensor_states_by_name_;
+    std::unordered_map<std::string, TensorState*> tensor_states_by_name_;
+    std::unordered_map<const ggml_tensor*, TensorState*> tensor_states_by_tensor_;  // graph params resolve by pointer, no name hashing
     std::vector<std::unique_ptr<ParamsStorageBlock>> params_storage_blocks_;
     std::vector<std::unique_ptr<ComputeStagingBlock>> compute_staging_blocks_;
+    std::unordered_set<TensorState*> prefetched_states_;  // staged ahead, holding one active_prepare_count each
+    std::mutex state_mutex_;                              // prefetch_params runs beside the compute thread
     std::set<std::string> common_ignore_tensors_;
+    std::set<std::string> lazy_tensors_;
+    std::string text_encoder_share_key_;
     std::vector<LoraSpec> loras_;
     SDVersion lora_version_      = VERSION_COUNT;
     uint64_t current_lora_epoch_ = 0;
+    uint64_t lora_set_epoch_     = 0;  // epoch the current LoRA files and filters were set at
     int n_threads_               = 0;
     bool enable_mmap_            = false;
     bool writable_mmap_          = false;
+    size_t max_pinned_bytes_     = SIZE_MAX;
+    bool cpu_repack_             = false;
+    bool shared_compute_buffer_  = false;
+    size_t pinned_bytes_         = 0;
+    std::map<ggml_backend_buffer_type_t, std::shared_ptr<sd::ComputeArena>> compute_arenas_;
+    std::mutex compute_arenas_mutex_;  // runners on preview and encode threads lease too
+    std::vector<std::unique_ptr<MergedLoraSet>> merged_lora_sets_;
+    std::string lora_set_key_;
+    size_t max_lora_cache_bytes_ = 0;
+    size_t lora_cache_bytes_     = 0;
+    uint64_t lora_cache_tick_    = 0;
+    std::thread background_load_thread_;
+    std::atomic<bool> stop_background_load_{false};
+    std::thread prefetch_thread_;
+    std::thread mmap_prefault_thread_;
+    std::atomic<bool> stop_mmap_prefault_{false};
+    std::vector<ggml_tensor*> prefetch_tensors_;
+    // Bumped whenever params may have left a backend or lost their merged
+    // LoRAs. While it and the LoRA epoch stay put, the tensors of the last
+    // prepare_params are still loaded, staged and merged.
+    uint64_t residency_epoch_               = 0;
+    uint64_t last_prepared_residency_epoch_ = UINT64_MAX;
+    uint64_t last_prepared_lora_epoch_      = UINT64_MAX;
+    std::vector<ggml_tensor*> last_prepared_tensors_;
+    std::vector<TensorState*> last_prepared_states_;
 
+    // Loads `states` to the params backend a chunk at a time; false when a
+    // chunk fails or `stop` is set.
+    bool load_in_chunks(const std::vector<TensorState*>& states, const std::atomic<bool>* stop, size_t* loaded_bytes);
+    void background_load(std::vector<TensorState*> states);
+    void stop_background_load();
+    // params-backend-resident params in the order a generation uses them
+    std::vector<TensorState*> background_load_states() const;
     void finish_compute_backend_usage(const std::vector<TensorState*>& states);
     void release_all();
 
     bool resolve_required_tensor_states(const std::vector<ggml_tensor*>& tensors,
                                         std::vector<TensorState*>& required_states) const;
     bool should_ignore(const TensorState& state) const;
+    bool is_lazy(const TensorState& state) const;
     bool is_optional_missing_tensor(const std::string& name) const;
     bool validate_tensor(const TensorState& state) const;
 
@@ -88,17 +148,29 @@ private:
     bool alloc_params_buffers(const std::vector<TensorState*>& states,
                               std::vector<ParamsStorageBlock*>& created_storage_blocks);
     bool load_tensors(const std::vector<TensorState*>& states);
-    bool stage_tensors_to_compute_backend(const std::vector<TensorState*>& states);
+    bool shared_params_key(const TensorState& state, ggml_backend_buffer_type_t buft, std::string& key) const;
+    void attach_shared_params(std::vector<TensorState*>& states);
+    void publish_shared_params(const std::vector<ParamsStorageBlock*>& blocks);
+    bool stage_tensors_to_compute_backend(const std::vector<TensorState*>& states, bool synchronize = true);
 
-    ggml_backend_buffer_type_t params_buffer_type_for(const TensorState& state) const;
+    ggml_backend_buffer_type_t params_buffer_type_for(const TensorState& state, bool* pinned = nullptr) const;
+    ggml_backend_buffer_type_t repack_buffer_type_for(const TensorState& state) const;
     void release_compute_staging_blocks(bool force                                            = false,
                                         const std::unordered_set<TensorState*>* target_states = nullptr);
     void release_params_storage_blocks(bool force                                            = false,
-                                       const std::unordered_set<TensorState*>* target_states = nullptr);
+                                       const std::unordered_set<TensorState*>* target_states = nullptr,
+                                       bool any_residency                                    = false);
     void free_compute_staging_block(ComputeStagingBlock& block);
     void free_params_storage_block(ParamsStorageBlock& block);
     void erase_params_storage_block(ParamsStorageBlock* block);
     void reset_lora_applied_params();
+    bool has_merged_mmap_quantized_params() const;
+    std::vector<float> current_lora_multipliers() const;
+    void mark_lora_applied(TensorState* state, const std::vector<float>& multipliers);
+    MergedLoraSet* find_merged_lora_set(bool create);
+    bool restore_merged_lora_tensor(const MergedLoraSet& merged_set, TensorState* state);
+    void store_merged_lora_tensors(const std::vector<TensorState*>& states, const std::set<std::string>& patched);
+    bool evict_merged_lora_set(const MergedLoraSet* keep);
 
 public:
     ~ModelManager() override;
@@ -112,10 +184,36 @@ public:
     }
     void set_enable_mmap(bool enable_mmap) { enable_mmap_ = enable_mmap; }
     void set_writable_mmap(bool writable_mmap) { writable_mmap_ = writable_mmap; }
+    // Cap on page-locked host memory for params streamed to the compute device;
+    // blocks beyond it fall back to pageable memory of the params backend.
+    void set_max_pinned_bytes(size_t max_pinned_bytes) { max_pinned_bytes_ = max_pinned_bytes; }
+    size_t pinned_bytes() const { return pinned_bytes_; }
+    // Puts quantized matmul weights that are both held and run on the CPU
+    // into ggml's extra CPU buffer types, which repack them on upload. The
+    // repacked data cannot be read back, so LoRAs must apply at runtime.
+    void set_cpu_repack(bool cpu_repack) { cpu_repack_ = cpu_repack; }
+    // Gives the runners one compute buffer per buffer type, leased in turn,
+    // instead of a private one each that is reserved and freed per phase.
+    void set_shared_compute_buffer(bool shared_compute_buffer) { shared_compute_buffer_ = shared_compute_buffer; }
+    // Host RAM for the merged weights of recently used LoRA sets, evicted least
+    // recently used first; 0 disables the cache.
+    void set_max_lora_cache_bytes(size_t max_lora_cache_bytes);
     void set_common_ignore_tensors(std::set<std::string> ignore_tensors);
+    // Params under these name prefixes are left out of the eager and the
+    // background load, so they load on the first graph that uses them, e.g.
+    // a VAE encoder that txt2img never runs.
+    void set_lazy_tensors(std::set<std::string> lazy_tensors) { lazy_tensors_ = std::move(lazy_tensors); }
+    // Shares the text encoder params with the other contexts of the process
+    // that set the same key, by tensor name, type and shape instead of by
+    // file, so checkpoints that each embed the same encoders hold them once.
+    void set_text_encoder_share_key(std::string key) { text_encoder_share_key_ = std::move(key); }
     void set_loras(std::vector<LoraSpec> loras, SDVersion version);
 
     std::set<std::string> tensor_names() const;
+    // Reads tensors that are not registered here, e.g. the weights of a runner
+    // replica on another backend, from the model files. The tensors must
+    // already be allocated.
+    bool load_unregistered_tensors(const std::map<std::string, ggml_tensor*>& tensors);
 
     bool register_param_tensors(const std::string& desc,
                                 std::map<std::string, ggml_tensor*> tensors,
@@ -161,10 +259,46 @@ public:
 
     bool validate_registered_tensors();
     bool load_all_params_eagerly();
+    // Loads the params-backend-resident params on a worker thread in roughly the
+    // order a generation uses them (conditioner, diffusion model, VAE), while
+    // requests already run; prepare_params loads whatever it needs first itself.
+    void start_background_load();
+    // Faults the mapped weights of those params into the page cache on
+    // n_threads threads, in the same order, so the first loads copy from
+    // memory instead of waiting for the disk one page at a time.
+    void start_mmap_prefault(int n_threads);
+    void stop_mmap_prefault();
+
+    // Frees params no runner is using, compute backend copies first and, with
+    // `params_backend`, params backend storage as well; later use loads them again.
+    void evict_params(bool params_backend);
+    // Frees the params backend storage of `tensors` whatever their residency,
+    // once no runner uses them, so a different model can load into it.
+    void evict_params(const std::vector<ggml_tensor*>& tensors);
+    // Bytes still to be loaded to the params backend for `tensors`.
+    uint64_t unloaded_params_bytes(const std::vector<ggml_tensor*>& tensors);
+    void get_params_memory(uint64_t* ram_bytes, uint64_t* vram_bytes);
 
     bool prepare_params(const std::vector<ggml_tensor*>& tensors) override;
     void release_compute_backend_params(const std::vector<ggml_tensor*>& tensors) override;
     void release_params_backend_params(const std::vector<ggml_tensor*>& tensors) override;
+
+    bool supports_prefetch() const override { return true; }
+    bool prefetch_params(const std::vector<ggml_tensor*>& tensors) override;
+    void release_prefetched_params(const std::vector<ggml_tensor*>& tensors) override;
+    void advise_params(const std::vector<ggml_tensor*>& tensors) override;
+    bool prepare_host_params(const std::vector<ggml_tensor*>& tensors) override;
+    std::shared_ptr<sd::ComputeArena> compute_arena(ggml_backend_buffer_type* buft) override;
+    size_t release_idle_memory() override;
+
+    // prefetch_params on a worker thread, for params that are offloaded
+    // between uses (a text encoder kept in RAM while the diffusion model
+    // samples). finish_prefetch joins it and releases whatever no graph
+    // picked up, so the compute backend copies do not outlive their use.
+    // Without `stage` the params are only loaded to the params backend, for a
+    // model that runs next while another one still holds the compute backend.
+    void start_prefetch(std::vector<ggml_tensor*> tensors, bool stage = true);
+    void finish_prefetch();
 };
 
 #endif  // __MODEL_MANAGER_H__
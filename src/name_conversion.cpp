@@ -1,4 +1,6 @@
+#include <array>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -6,7 +8,7 @@
 #include "name_conversion.h"
 
 void replace_with_name_map(std::string& name, const std::vector<std::pair<std::string, std::string>>& name_map) {
-    for (auto kv : name_map) {
+    for (const auto& kv : name_map) {
         size_t pos = name.find(kv.first);
         if (pos != std::string::npos) {
             name.replace(pos, kv.first.size(), kv.second);
@@ -974,7 +976,7 @@ std::string convert_pmid_v2_name(const std::string& name) {
 }
 
 std::string convert_sep_to_dot(std::string name) {
-    const std::vector<std::string> protected_tokens = {
+    static const std::vector<std::string> protected_tokens = {
         "self_attn",
         "out_proj",
         "q_proj",
@@ -1150,22 +1152,22 @@ static std::string convert_esrgan_tensor_name(std::string name) {
     return name;
 }
 
-std::string convert_tensor_name(std::string name, SDVersion version) {
+static std::string convert_tensor_name_uncached(std::string name, SDVersion version) {
     if (version == VERSION_ESRGAN) {
         return convert_esrgan_tensor_name(std::move(name));
     }
 
-    bool is_lora                             = false;
-    bool is_lycoris_underline                = false;
-    bool is_underline                        = false;
-    std::vector<std::string> lora_prefix_vec = {
+    bool is_lora                                          = false;
+    bool is_lycoris_underline                             = false;
+    bool is_underline                                     = false;
+    static const std::vector<std::string> lora_prefix_vec = {
         "lora.lora.",
         "lora.lora_",
         "lora.lycoris_",
         "lora.lycoris.",
         "lora.",
     };
-    std::vector<std::string> underline_lora_prefix_vec = {
+    static const std::vector<std::string> underline_lora_prefix_vec = {
         "unet_",
         "te_",
         "te1_",
@@ -1192,7 +1194,7 @@ std::string convert_tensor_name(std::string name, SDVersion version) {
     }
     // preprocess lora tensor name
     if (is_lora) {
-        std::map<std::string, std::string> lora_suffix_map = {
+        static const std::map<std::string, std::string> lora_suffix_map = {
             {".lora_down.weight", ".weight.lora_down"},
             {".lora_mid.weight", ".weight.lora_mid"},
             {".lora_up.weight", ".weight.lora_up"},
@@ -1237,7 +1239,7 @@ std::string convert_tensor_name(std::string name, SDVersion version) {
             name.replace(pos, strlen(".processor"), "");
         }
 
-        std::vector<std::string> dit_prefix_vec = {
+        static const std::vector<std::string> dit_prefix_vec = {
             "transformer_blocks",
             "single_transformer_blocks",
         };
@@ -1255,29 +1257,36 @@ std::string convert_tensor_name(std::string name, SDVersion version) {
         }
     }
 
-    std::unordered_map<std::string, std::string> prefix_map = {
-        {"diffusion_model.", "model.diffusion_model."},
-        {"unet.", "model.diffusion_model."},
-        {"transformer.", "model.diffusion_model."},  // dit
-        {"vae.", "first_stage_model."},
-        {"text_encoder.", "cond_stage_model.transformer."},
-        {"te.", "cond_stage_model.transformer."},
-        {"text_encoder.2.", "cond_stage_model.1.transformer."},
-        {"conditioner.embedders.0.open_clip.", "cond_stage_model."},
-        // https://huggingface.co/stabilityai/stable-diffusion-xl-base-1.0
-        {"conditioner.embedders.0.", "cond_stage_model."},
-        {"conditioner.embedders.1.", "cond_stage_model.1."},
-        // {"te2.text_model.encoder.layers.", "cond_stage_model.1.model.transformer.resblocks."},
-        {"te2.", "cond_stage_model.1.transformer."},
-        {"te1.", "cond_stage_model.transformer."},
-        {"te3.", "text_encoders.t5xxl.transformer."},
-    };
+    // the first matching prefix wins, so both tables are built the same way to
+    // keep their iteration order identical
+    auto make_prefix_map = [](bool flux) {
+        std::unordered_map<std::string, std::string> prefix_map = {
+            {"diffusion_model.", "model.diffusion_model."},
+            {"unet.", "model.diffusion_model."},
+            {"transformer.", "model.diffusion_model."},  // dit
+            {"vae.", "first_stage_model."},
+            {"text_encoder.", "cond_stage_model.transformer."},
+            {"te.", "cond_stage_model.transformer."},
+            {"text_encoder.2.", "cond_stage_model.1.transformer."},
+            {"conditioner.embedders.0.open_clip.", "cond_stage_model."},
+            // https://huggingface.co/stabilityai/stable-diffusion-xl-base-1.0
+            {"conditioner.embedders.0.", "cond_stage_model."},
+            {"conditioner.embedders.1.", "cond_stage_model.1."},
+            // {"te2.text_model.encoder.layers.", "cond_stage_model.1.model.transformer.resblocks."},
+            {"te2.", "cond_stage_model.1.transformer."},
+            {"te1.", "cond_stage_model.transformer."},
+            {"te3.", "text_encoders.t5xxl.transformer."},
+        };
 
-    if (sd_version_is_flux(version)) {
-        prefix_map["te1."] = "text_encoders.clip_l.transformer.";
-    }
+        if (flux) {
+            prefix_map["te1."] = "text_encoders.clip_l.transformer.";
+        }
+        return prefix_map;
+    };
+    static const std::unordered_map<std::string, std::string> prefix_map      = make_prefix_map(false);
+    static const std::unordered_map<std::string, std::string> flux_prefix_map = make_prefix_map(true);
 
-    replace_with_prefix_map(name, prefix_map);
+    replace_with_prefix_map(name, sd_version_is_flux(version) ? flux_prefix_map : prefix_map);
 
     if ((sd_version_is_boogu_image(version) || sd_version_is_krea2(version)) && starts_with(name, "text_encoders.llm.visual.")) {
         name = convert_qwen3_vl_vision_name(std::move(name));
@@ -1346,3 +1355,30 @@ std::string convert_tensor_name(std::string name, SDVersion version) {
 
     return name;
 }
+
+// Conversion is a pure function of the name and the version, and the same
+// names come back whenever a model, LoRA or server context is loaded again, so
+// results are kept per version for the life of the process.
+std::string convert_tensor_name(std::string name, SDVersion version) {
+    static constexpr size_t MAX_CACHED_NAMES_PER_VERSION = 1 << 16;
+    static std::mutex cache_mutex;
+    static std::array<std::unordered_map<std::string, std::string>, VERSION_COUNT + 1> cache;
+
+    auto& version_cache = cache[(version >= 0 && version < VERSION_COUNT) ? version : VERSION_COUNT];
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = version_cache.find(name);
+        if (it != version_cache.end()) {
+            return it->second;
+        }
+    }
+
+    std::string converted = convert_tensor_name_uncached(name, version);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (version_cache.size() >= MAX_CACHED_NAMES_PER_VERSION) {
+        version_cache.clear();
+    }
+    version_cache.emplace(std::move(name), converted);
+    return converted;
+}
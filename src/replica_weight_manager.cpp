@@ -0,0 +1,103 @@
+#include "replica_weight_manager.h"
+
+#include "core/memory_timeline.h"
+#include "core/util.h"
+#include "model_manager.h"
+
+ReplicaWeightManager::ReplicaWeightManager(std::shared_ptr<ModelManager> source, ggml_backend_t backend)
+    : source_(std::move(source)), backend_(backend) {}
+
+ReplicaWeightManager::~ReplicaWeightManager() {
+    if (buffer_ != nullptr) {
+        sd_perf::untrace_buffer(buffer_);
+        ggml_backend_buffer_free(buffer_);
+        buffer_ = nullptr;
+    }
+}
+
+bool ReplicaWeightManager::load(std::map<std::string, ggml_tensor*> tensors) {
+    if (buffer_ != nullptr) {
+        return true;
+    }
+    if (source_ == nullptr || backend_ == nullptr) {
+        LOG_ERROR("replica weight manager has no model or backend");
+        return false;
+    }
+
+    ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend_);
+    size_t alignment                = ggml_backend_buft_get_alignment(buft);
+    size_t total_size               = 0;
+    for (auto& [name, tensor] : tensors) {
+        if (tensor == nullptr) {
+            continue;
+        }
+        ggml_set_name(tensor, name.c_str());
+        total_size += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, tensor), alignment);
+    }
+    if (total_size == 0) {
+        return true;
+    }
+    if (total_size > ggml_backend_buft_get_max_size(buft)) {
+        LOG_ERROR("replica weights (%.2f MB) exceed the largest buffer of %s",
+                  total_size / (1024.0 * 1024.0),
+                  ggml_backend_name(backend_));
+        return false;
+    }
+
+    buffer_ = ggml_backend_buft_alloc_buffer(buft, total_size + alignment);
+    if (buffer_ == nullptr) {
+        LOG_ERROR("alloc replica weights buffer failed, size = %.2fMB on %s",
+                  total_size / (1024.0 * 1024.0),
+                  ggml_backend_name(backend_));
+        return false;
+    }
+    ggml_backend_buffer_set_usage(buffer_, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+
+    char* base    = static_cast<char*>(ggml_backend_buffer_get_base(buffer_));
+    size_t offset = GGML_PAD(reinterpret_cast<uintptr_t>(base), alignment) - reinterpret_cast<uintptr_t>(base);
+    bool ok       = true;
+    for (auto& [name, tensor] : tensors) {
+        if (tensor == nullptr) {
+            continue;
+        }
+        if (ggml_backend_tensor_alloc(buffer_, tensor, base + offset) != GGML_STATUS_SUCCESS) {
+            LOG_ERROR("failed to place replica tensor '%s'", name.c_str());
+            ok = false;
+            break;
+        }
+        offset += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, tensor), alignment);
+    }
+    if (ok) {
+        ok = source_->load_unregistered_tensors(tensors);
+    }
+    if (!ok) {
+        for (auto& [name, tensor] : tensors) {
+            if (tensor != nullptr && tensor->buffer == buffer_) {
+                tensor->buffer = nullptr;
+                tensor->data   = nullptr;
+            }
+        }
+        ggml_backend_buffer_free(buffer_);
+        buffer_ = nullptr;
+        return false;
+    }
+    sd_perf::trace_buffer(buffer_, sd_perf::BufferKind::PARAMS, "replica");
+    LOG_DEBUG("replica weights loaded to %s (%.2f MB)",
+              ggml_backend_name(backend_),
+              ggml_backend_buffer_get_size(buffer_) / (1024.0 * 1024.0));
+    return true;
+}
+
+size_t ReplicaWeightManager::params_bytes() const {
+    return buffer_ != nullptr ? ggml_backend_buffer_get_size(buffer_) : 0;
+}
+
+bool ReplicaWeightManager::prepare_params(const std::vector<ggml_tensor*>& tensors) {
+    for (ggml_tensor* tensor : tensors) {
+        if (tensor != nullptr && tensor->buffer == nullptr) {
+            LOG_ERROR("replica tensor '%s' is not loaded", ggml_get_name(tensor));
+            return false;
+        }
+    }
+    return true;
+}
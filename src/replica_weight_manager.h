@@ -0,0 +1,39 @@
+#ifndef __REPLICA_WEIGHT_MANAGER_H__
+#define __REPLICA_WEIGHT_MANAGER_H__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ggml-backend.h"
+#include "weight_manager.h"
+
+class ModelManager;
+
+// Weights of a runner replica on another backend, e.g. a VAE copy that
+// processes tiles on a second GPU. load() reads them from the model files of
+// `source` into one weights buffer of the backend; they stay resident until
+// the manager is destroyed, so prepare_params has nothing left to do.
+class ReplicaWeightManager : public RunnerWeightManager {
+public:
+    ReplicaWeightManager(std::shared_ptr<ModelManager> source, ggml_backend_t backend);
+    ~ReplicaWeightManager() override;
+
+    ReplicaWeightManager(const ReplicaWeightManager&)            = delete;
+    ReplicaWeightManager& operator=(const ReplicaWeightManager&) = delete;
+
+    bool load(std::map<std::string, ggml_tensor*> tensors);
+    size_t params_bytes() const;
+
+    bool prepare_params(const std::vector<ggml_tensor*>& tensors) override;
+    void release_compute_backend_params(const std::vector<ggml_tensor*>& tensors) override {}
+    void release_params_backend_params(const std::vector<ggml_tensor*>& tensors) override {}
+
+private:
+    std::shared_ptr<ModelManager> source_;
+    ggml_backend_t backend_       = nullptr;
+    ggml_backend_buffer_t buffer_ = nullptr;
+};
+
+#endif  // __REPLICA_WEIGHT_MANAGER_H__
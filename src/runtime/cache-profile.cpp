@@ -0,0 +1,173 @@
+#include "runtime/cache-profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+
+#include "core/util.h"
+#include "json.hpp"
+#include "runtime/condition_cache_utils.hpp"
+
+namespace sd_sample {
+
+    static nlohmann::json read_profile_file(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            return nlohmann::json::object();
+        }
+        nlohmann::json root = nlohmann::json::parse(file, nullptr, false);
+        if (root.is_discarded() || !root.is_object()) {
+            LOG_WARN("ignoring malformed cache profile '%s'", path.c_str());
+            return nlohmann::json::object();
+        }
+        return root;
+    }
+
+    std::vector<int> plan_cache_profile_skips(const std::vector<float>& step_errors, float target_error) {
+        std::vector<int> mask(step_errors.size(), 0);
+        std::vector<size_t> order;
+        for (size_t i = 1; i < step_errors.size(); i++) {
+            if (step_errors[i] >= 0.0f) {
+                order.push_back(i);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return step_errors[a] < step_errors[b];
+        });
+
+        float total_error = 0.0f;
+        for (size_t i : order) {
+            if (total_error + step_errors[i] > target_error) {
+                break;
+            }
+            if (mask[i - 1] != 0 || (i + 1 < mask.size() && mask[i + 1] != 0)) {
+                continue;
+            }
+            mask[i] = 1;
+            total_error += step_errors[i];
+        }
+        return mask;
+    }
+
+    bool CacheProfileState::init(const std::string& profile_path,
+                                 const std::string& profile_key,
+                                 bool calibrate,
+                                 float profile_target_error,
+                                 size_t total_steps) {
+        path         = profile_path;
+        key          = profile_key;
+        calibrating  = calibrate;
+        target_error = profile_target_error;
+        step_errors.clear();
+        skip_mask.clear();
+        cache_diffs.clear();
+        anchor_condition    = nullptr;
+        current_step_index  = -1;
+        skip_current_step   = false;
+        total_steps_skipped = 0;
+
+        if (calibrating) {
+            step_errors.assign(total_steps, -1.0f);
+            return true;
+        }
+
+        nlohmann::json root = read_profile_file(path);
+        if (!root.contains("profiles") || !root["profiles"].contains(key)) {
+            LOG_WARN("cache profile '%s' has no entry for '%s', run with calibrate=1 first", path.c_str(), key.c_str());
+            return false;
+        }
+        const nlohmann::json& entry = root["profiles"][key];
+        if (!entry.contains("step_errors") || !entry["step_errors"].is_array()) {
+            LOG_WARN("cache profile '%s' entry '%s' is malformed", path.c_str(), key.c_str());
+            return false;
+        }
+        std::vector<float> errors;
+        for (const auto& value : entry["step_errors"]) {
+            errors.push_back(value.is_number() ? value.get<float>() : -1.0f);
+        }
+        if (errors.size() != total_steps) {
+            LOG_WARN("cache profile entry '%s' has %zu steps, this run has %zu", key.c_str(), errors.size(), total_steps);
+            return false;
+        }
+        skip_mask = plan_cache_profile_skips(errors, target_error);
+        return true;
+    }
+
+    bool CacheProfileState::save() const {
+        if (!calibrating || path.empty()) {
+            return false;
+        }
+        nlohmann::json root = read_profile_file(path);
+        if (!root.contains("profiles") || !root["profiles"].is_object()) {
+            root["profiles"] = nlohmann::json::object();
+        }
+        root["profiles"][key] = {{"step_errors", step_errors}};
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            LOG_WARN("failed to write cache profile '%s'", path.c_str());
+            return false;
+        }
+        file << root.dump(2) << "\n";
+
+        std::vector<int> mask = plan_cache_profile_skips(step_errors, target_error);
+        LOG_INFO("cache profile '%s' saved to '%s' (%d steps would be skipped at target error %.3f)",
+                 key.c_str(),
+                 path.c_str(),
+                 std::accumulate(mask.begin(), mask.end(), 0),
+                 target_error);
+        return true;
+    }
+
+    void CacheProfileState::begin_step(int step_index) {
+        if (step_index == current_step_index) {
+            return;
+        }
+        current_step_index = step_index;
+        skip_current_step  = !calibrating &&
+                            step_index >= 0 &&
+                            step_index < static_cast<int>(skip_mask.size()) &&
+                            skip_mask[step_index] != 0;
+        if (skip_current_step) {
+            total_steps_skipped++;
+        }
+    }
+
+    bool CacheProfileState::before_condition(const void* cond,
+                                             const sd::Tensor<float>& input,
+                                             sd::Tensor<float>* output) {
+        if (anchor_condition == nullptr) {
+            anchor_condition = cond;
+        }
+        if (!skip_current_step) {
+            return false;
+        }
+        auto it = cache_diffs.find(cond);
+        if (it == cache_diffs.end()) {
+            return false;
+        }
+        return sd::apply_condition_cache_diff(it->second, input, output);
+    }
+
+    void CacheProfileState::after_condition(const void* cond,
+                                            const sd::Tensor<float>& input,
+                                            const sd::Tensor<float>& output) {
+        std::vector<float>& diff = cache_diffs[cond];
+        if (calibrating && cond == anchor_condition && current_step_index >= 0 &&
+            current_step_index < static_cast<int>(step_errors.size()) &&
+            diff.size() == static_cast<size_t>(output.numel())) {
+            const float* in_data  = input.data();
+            const float* out_data = output.data();
+            double sum_error      = 0.0;
+            double sum_abs        = 0.0;
+            for (size_t i = 0; i < diff.size(); i++) {
+                sum_error += std::fabs(in_data[i] + diff[i] - out_data[i]);
+                sum_abs += std::fabs(out_data[i]);
+            }
+            step_errors[current_step_index] = static_cast<float>(sum_error / (sum_abs + 1e-6));
+        }
+        sd::store_condition_cache_diff(&diff, input, output);
+    }
+
+}  // namespace sd_sample
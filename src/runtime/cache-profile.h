@@ -0,0 +1,63 @@
+#ifndef __SD_RUNTIME_CACHE_PROFILE_H__
+#define __SD_RUNTIME_CACHE_PROFILE_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/tensor.hpp"
+
+namespace sd_sample {
+
+    // Step caching driven by a calibration profile instead of hand-tuned
+    // thresholds. A calibration run samples without skipping and records, for
+    // every step, the relative L1 error the step would have had if it had
+    // reused the previous step's output diff (the approximation EasyCache,
+    // UCache and CacheDIT make when they skip a step). The trajectory is saved
+    // under a (model, sampler, steps) key in a JSON profile file; later runs
+    // with the same key skip the most steps whose summed error stays under
+    // the target error.
+    struct CacheProfileState {
+        std::string path;
+        std::string key;
+        bool calibrating   = false;
+        float target_error = 0.05f;
+
+        // Calibration: error per step, -1 where it could not be measured.
+        std::vector<float> step_errors;
+        // Applying: 1 for steps that reuse the previous step's output diff.
+        std::vector<int> skip_mask;
+
+        std::unordered_map<const void*, std::vector<float>> cache_diffs;
+        const void* anchor_condition = nullptr;
+        int current_step_index       = -1;
+        bool skip_current_step       = false;
+        int total_steps_skipped      = 0;
+
+        // Loads the profile for key when not calibrating; false when there is
+        // nothing to apply, so the caller can fall back to the regular cache.
+        bool init(const std::string& profile_path,
+                  const std::string& profile_key,
+                  bool calibrate,
+                  float target_error,
+                  size_t total_steps);
+        // Writes the calibration trajectory into the profile file.
+        bool save() const;
+
+        void begin_step(int step_index);
+        bool before_condition(const void* cond, const sd::Tensor<float>& input, sd::Tensor<float>* output);
+        void after_condition(const void* cond, const sd::Tensor<float>& input, const sd::Tensor<float>& output);
+
+        bool is_step_skipped() const {
+            return skip_current_step;
+        }
+    };
+
+    // Picks the steps to skip: cheapest first while the summed error stays
+    // under target_error, never the first step and never two steps in a row,
+    // since the recorded error assumes the previous step was computed.
+    std::vector<int> plan_cache_profile_skips(const std::vector<float>& step_errors, float target_error);
+
+}  // namespace sd_sample
+
+#endif  // __SD_RUNTIME_CACHE_PROFILE_H__
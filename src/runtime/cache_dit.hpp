@@ -75,8 +75,9 @@ struct TaylorSeerState {
     }
 
     void update_derivatives(const float* Y, size_t size, int step) {
-        int order = n_derivatives + 1;
-        dY_prev   = dY_current;
+        // every order of dY_current is rewritten below, so the old prev
+        // buffers are reused instead of copying the current ones
+        dY_prev.swap(dY_current);
         dY_current[0].resize(size);
         for (size_t i = 0; i < size; i++) {
             dY_current[0][i] = Y[i];
@@ -290,6 +291,10 @@ struct CacheDitState {
         }
     }
 
+    static float residual_diff_from_sums(float sum_diff, float sum_abs) {
+        return sum_diff / (sum_abs + 1e-6f);
+    }
+
     static float calculate_residual_diff(const float* prev, const float* curr, size_t size) {
         if (size == 0)
             return 0.0f;
@@ -302,7 +307,29 @@ struct CacheDitState {
             sum_abs += std::fabs(prev[i]);
         }
 
-        return sum_diff / (sum_abs + 1e-6f);
+        return residual_diff_from_sums(sum_diff, sum_abs);
+    }
+
+    // prev kept in f16, converted a chunk at a time
+    static float calculate_residual_diff(const ggml_fp16_t* prev, const float* curr, size_t size) {
+        if (size == 0)
+            return 0.0f;
+
+        constexpr size_t CHUNK = 4096;
+        float prev_chunk[CHUNK];
+        float sum_diff = 0.0f;
+        float sum_abs  = 0.0f;
+
+        for (size_t begin = 0; begin < size; begin += CHUNK) {
+            size_t n = std::min(CHUNK, size - begin);
+            ggml_fp16_to_fp32_row(prev + begin, prev_chunk, static_cast<int64_t>(n));
+            for (size_t i = 0; i < n; i++) {
+                sum_diff += std::fabs(prev_chunk[i] - curr[begin + i]);
+                sum_abs += std::fabs(prev_chunk[i]);
+            }
+        }
+
+        return residual_diff_from_sums(sum_diff, sum_abs);
     }
 
     static float calculate_residual_diff(const std::vector<float>& prev, const std::vector<float>& curr) {
@@ -635,6 +662,91 @@ inline void parse_taylorseer_options(const std::string& opts, TaylorSeerConfig&
     cfg.skip_interval_steps = interval;
 }
 
+// Reuse of cond-pass double-block residuals in the uncond pass (Flux family),
+// set through the cfg_reuse_threshold and cfg_reuse_calibration_steps extra
+// sample args. The first calibration steps run both branches in full and
+// measure the residual diff between them per block; blocks whose mean diff
+// stays under the threshold then skip their uncond forward for the rest of
+// the generation. Experimental: the uncond branch drifts towards cond in
+// those blocks, which weakens guidance a little.
+struct CfgBlockReuseState {
+    float threshold       = 0.0f;
+    int calibration_steps = 2;
+
+    int measured_steps = 0;
+    bool disabled      = false;
+    std::vector<float> step_stats;
+    std::vector<double> diff_sums;
+    std::vector<bool> reuse_blocks;
+
+    bool enabled() const {
+        return threshold > 0.0f && !disabled;
+    }
+
+    bool calibrating() const {
+        return measured_steps < calibration_steps;
+    }
+
+    bool reusing() const {
+        return enabled() && !calibrating() &&
+               std::find(reuse_blocks.begin(), reuse_blocks.end(), true) != reuse_blocks.end();
+    }
+
+    // stats holds a (sum |r_uncond - r_cond|, sum |r_cond|) pair per block.
+    void record_measurement(const std::vector<float>& stats) {
+        if (stats.empty()) {
+            LOG_WARN("cfg block reuse: uncond residuals could not be measured, disabling");
+            disabled = true;
+            return;
+        }
+        size_t n_blocks = stats.size() / 2;
+        if (diff_sums.size() != n_blocks) {
+            diff_sums.assign(n_blocks, 0.0);
+        }
+        for (size_t i = 0; i < n_blocks; i++) {
+            diff_sums[i] += CacheDitState::residual_diff_from_sums(stats[i * 2], stats[i * 2 + 1]);
+        }
+        measured_steps++;
+        if (calibrating()) {
+            return;
+        }
+
+        reuse_blocks.assign(n_blocks, false);
+        int reused = 0;
+        for (size_t i = 0; i < n_blocks; i++) {
+            float mean_diff = static_cast<float>(diff_sums[i] / measured_steps);
+            if (stats[i * 2 + 1] > 0.0f && mean_diff < threshold) {
+                reuse_blocks[i] = true;
+                reused++;
+            }
+            LOG_DEBUG("cfg block reuse: double block %zu mean residual diff %.4f%s", i, mean_diff, reuse_blocks[i] ? " (reused)" : "");
+        }
+        LOG_INFO("cfg block reuse: %d/%zu double blocks reuse the cond pass in uncond", reused, n_blocks);
+    }
+
+    static CfgBlockReuseState parse_args(const char* extra_sample_args) {
+        CfgBlockReuseState state;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key == "cfg_reuse_threshold") {
+                float parsed = 0.0f;
+                if (!parse_strict_float(value, parsed) || parsed < 0.0f) {
+                    LOG_WARN("ignoring invalid cfg block reuse extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                state.threshold = parsed;
+            } else if (key == "cfg_reuse_calibration_steps") {
+                int parsed = 0;
+                if (!parse_strict_int(value, parsed) || parsed < 1) {
+                    LOG_WARN("ignoring invalid cfg block reuse extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                state.calibration_steps = parsed;
+            }
+        }
+        return state;
+    }
+};
+
 struct CacheDitConditionState {
     DBCacheConfig config;
     TaylorSeerConfig taylor_config;
@@ -652,10 +764,13 @@ struct CacheDitConditionState {
 
     const void* anchor_condition = nullptr;
 
+    // The diff is added back to the output and stays f32. The previous input
+    // only feeds the residual test of the anchor condition, so it is kept for
+    // that condition alone and in f16, which holds the relative L1 diff far
+    // below the thresholds in use.
     struct CacheEntry {
         std::vector<float> diff;
-        std::vector<float> prev_input;
-        std::vector<float> prev_output;
+        std::vector<ggml_fp16_t> prev_input;
         bool has_prev = false;
     };
     std::unordered_map<const void*, CacheEntry> cache_diffs;
@@ -775,22 +890,15 @@ struct CacheDitConditionState {
 
     void update_cache(const void* cond, const sd::Tensor<float>& input, const sd::Tensor<float>& output) {
         CacheEntry& entry = cache_diffs[cond];
-        if (!sd::store_condition_cache_diff(&entry.diff, input, output)) {
+        if (!sd::store_condition_cache_diff(&entry.diff, input, output) || cond != anchor_condition) {
             entry.prev_input.clear();
-            entry.prev_output.clear();
             entry.has_prev = false;
             return;
         }
 
-        size_t size              = static_cast<size_t>(output.numel());
-        const float* input_data  = input.data();
-        const float* output_data = output.data();
+        size_t size = static_cast<size_t>(input.numel());
         entry.prev_input.resize(size);
-        entry.prev_output.resize(size);
-        for (size_t i = 0; i < size; i++) {
-            entry.prev_input[i]  = input_data[i];
-            entry.prev_output[i] = output_data[i];
-        }
+        ggml_fp32_to_fp16_row(input.data(), entry.prev_input.data(), static_cast<int64_t>(size));
         entry.has_prev = true;
     }
 
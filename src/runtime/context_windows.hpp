@@ -0,0 +1,85 @@
+#ifndef __SD_RUNTIME_CONTEXT_WINDOWS_HPP__
+#define __SD_RUNTIME_CONTEXT_WINDOWS_HPP__
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "core/util.h"
+
+namespace sd::context_windows {
+
+    // Denoising over overlapping windows of latent frames for Wan video
+    // models, set through extra sample args: ctx_window (latent frames per
+    // forward pass, 0 = the whole clip) and ctx_overlap (frames neighbouring
+    // windows share, default a quarter window). Every step runs each window
+    // on its own and blends the overlaps, so the cost of one forward pass no
+    // longer grows with the clip length.
+    struct Params {
+        int frames  = 0;
+        int overlap = -1;
+
+        bool enabled_for(int64_t total_frames) const {
+            return frames > 0 && total_frames > frames;
+        }
+
+        int resolved_overlap() const {
+            int resolved = overlap < 0 ? frames / 4 : overlap;
+            return std::clamp(resolved, 0, frames - 1);
+        }
+
+        // [begin, end) frame ranges of total_frames, all windows the same
+        // size; the last one is shifted back to end at the last frame.
+        std::vector<std::pair<int64_t, int64_t>> windows(int64_t total_frames) const {
+            std::vector<std::pair<int64_t, int64_t>> result;
+            const int64_t stride = frames - resolved_overlap();
+            for (int64_t begin = 0;; begin += stride) {
+                if (begin + frames >= total_frames) {
+                    begin = std::max<int64_t>(0, total_frames - frames);
+                    result.push_back({begin, total_frames});
+                    break;
+                }
+                result.push_back({begin, begin + frames});
+            }
+            return result;
+        }
+
+        // Blend weight of frame i of a window of n frames: ramps up over the
+        // overlap at a side shared with another window, flat at the clip
+        // ends.
+        float weight(int64_t i, int64_t n, bool at_start, bool at_end) const {
+            const float ramp = static_cast<float>(resolved_overlap() + 1);
+            float w          = 1.0f;
+            if (!at_start && i < ramp - 1) {
+                w = (i + 1) / ramp;
+            }
+            if (!at_end && n - 1 - i < ramp - 1) {
+                w = std::min(w, (n - i) / ramp);
+            }
+            return w;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "ctx_window" && key != "ctx_overlap") {
+                continue;
+            }
+            int parsed_int = 0;
+            if (!parse_strict_int(value, parsed_int) || parsed_int < 0) {
+                LOG_WARN("ignoring invalid context window extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            if (key == "ctx_window") {
+                params.frames = parsed_int;
+            } else {
+                params.overlap = parsed_int;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::context_windows
+
+#endif  // __SD_RUNTIME_CONTEXT_WINDOWS_HPP__
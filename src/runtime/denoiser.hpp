@@ -1113,8 +1113,36 @@ struct SefiFlowDenoiser : public Flux2FlowDenoiser {
     }
 };
 
+// Samplers step on host tensors, since guidance, step caches, previews and
+// denoise masks read the denoised latent every step. Single-pass Euler
+// sampling without them keeps x on the backend instead, see
+// GGMLRunner::begin_resident_latent.
 typedef std::function<sd::guidance::GuiderOutput(const sd::Tensor<float>&, float, int)> denoise_cb_t;
 
+// Lets a sampler continue a checkpointed run: it starts at start_step (the
+// steps already taken) with the history it had then, and reports its state
+// after every step so the caller can take the next checkpoint. Only samplers
+// whose state is the latent, the RNG and at most the previous denoised output
+// take one; see sampler_supports_resume.
+struct SamplerResume {
+    int start_step = 0;
+    sd::Tensor<float> old_denoised;
+    std::function<void(int step, const sd::Tensor<float>& x, const sd::Tensor<float>& old_denoised)> on_step;
+};
+
+static int sampler_resume_start(const SamplerResume* resume) {
+    return resume != nullptr ? resume->start_step : 0;
+}
+
+static void sampler_resume_step(const SamplerResume* resume,
+                                int step,
+                                const sd::Tensor<float>& x,
+                                const sd::Tensor<float>& old_denoised = {}) {
+    if (resume != nullptr && resume->on_step) {
+        resume->on_step(step, x, old_denoised);
+    }
+}
+
 static std::pair<float, float> get_ancestral_step(float sigma_from,
                                                   float sigma_to,
                                                   float eta = 1.0f) {
@@ -1169,11 +1197,12 @@ static std::tuple<float, float, float> get_ancestral_step_flow(float sigma_from,
     return {sigma_down, sigma_up, alpha_scale};
 }
 
-static std::tuple<float, float, float> get_ancestral_step(float sigma_from,
-                                                          float sigma_to,
-                                                          float eta,
-                                                          bool is_flow_denoiser) {
-    if (is_flow_denoiser) {
+// Flow is fixed per sampler call: samplers that take it as a template
+// parameter are dispatched once in sample_k_diffusion, so their steps carry
+// no denoiser type branches and the non-flow noise term keeps x unscaled.
+template <bool Flow>
+static std::tuple<float, float, float> get_ancestral_step(float sigma_from, float sigma_to, float eta) {
+    if constexpr (Flow) {
         return get_ancestral_step_flow(sigma_from, sigma_to, eta);
     } else {
         auto [sigma_down, sigma_up] = get_ancestral_step(sigma_from, sigma_to, eta);
@@ -1181,14 +1210,28 @@ static std::tuple<float, float, float> get_ancestral_step(float sigma_from,
     }
 }
 
-static sd::Tensor<float> sample_euler_ancestral(denoise_cb_t model,
-                                                sd::Tensor<float> x,
-                                                const std::vector<float>& sigmas,
-                                                std::shared_ptr<RNG> rng = nullptr,
-                                                bool is_flow_denoiser    = false,
-                                                float eta                = 0.f) {
+// x = alpha_scale * x + sigma_up * noise
+template <bool Flow>
+static void add_ancestral_noise(sd::Tensor<float>* x, float alpha_scale, std::shared_ptr<RNG> rng, float sigma_up) {
+    sd::Tensor<float> noise = sd::Tensor<float>::randn_like(*x, rng);
+    if constexpr (Flow) {
+        sd::ops::axpby(x, alpha_scale, noise, sigma_up);
+    } else {
+        sd::ops::axpby(x, 1.0f, noise, sigma_up);
+    }
+}
+
+// Noisy is eta != 0. The step and its noise are one pass over x:
+// alpha_scale * lerp(x, denoised, w) + sigma_up * noise.
+template <bool Flow, bool Noisy>
+static sd::Tensor<float> sample_euler_ancestral_steps(denoise_cb_t model,
+                                                      sd::Tensor<float> x,
+                                                      const std::vector<float>& sigmas,
+                                                      std::shared_ptr<RNG> rng,
+                                                      float eta,
+                                                      const SamplerResume* resume) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         float sigma       = sigmas[i];
         float sigma_to    = sigmas[i + 1];
         auto denoised_opt = model(x, sigma, i + 1);
@@ -1197,25 +1240,40 @@ static sd::Tensor<float> sample_euler_ancestral(denoise_cb_t model,
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
         if (sigma_to == 0.f) {
-            x = denoised;
-        } else if (eta == 0.f) {
+            x = std::move(denoised);
+        } else if constexpr (!Noisy) {
             float sigma_ratio = sigma_to / sigma;
-            x                 = sigma_ratio * x + (1.0 - sigma_ratio) * denoised;
+            sd::ops::lerp(&x, denoised, 1.0f - sigma_ratio);
         } else {
-            auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step(sigma, sigma_to, eta, is_flow_denoiser);
-            float sigma_ratio                        = sigma_down / sigma;
-            x                                        = sigma_ratio * x + (1.0f - sigma_ratio) * denoised;
+            auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step<Flow>(sigma, sigma_to, eta);
+            float w                                  = 1.0f - sigma_down / sigma;
             if (sigma_up > 0.f) {
-                if (is_flow_denoiser) {
-                    x *= alpha_scale;
-                }
-                x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+                float alpha = Flow ? alpha_scale : 1.0f;
+                sd::ops::axpbypcz(&x, alpha * (1.0f - w), denoised, alpha * w, sd::Tensor<float>::randn_like(x, rng), sigma_up);
+            } else {
+                sd::ops::lerp(&x, denoised, w);
             }
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
 
+static sd::Tensor<float> sample_euler_ancestral(denoise_cb_t model,
+                                                sd::Tensor<float> x,
+                                                const std::vector<float>& sigmas,
+                                                std::shared_ptr<RNG> rng    = nullptr,
+                                                bool is_flow_denoiser       = false,
+                                                float eta                   = 0.f,
+                                                const SamplerResume* resume = nullptr) {
+    if (eta == 0.f) {
+        return is_flow_denoiser ? sample_euler_ancestral_steps<true, false>(model, std::move(x), sigmas, rng, eta, resume)
+                                : sample_euler_ancestral_steps<false, false>(model, std::move(x), sigmas, rng, eta, resume);
+    }
+    return is_flow_denoiser ? sample_euler_ancestral_steps<true, true>(model, std::move(x), sigmas, rng, eta, resume)
+                            : sample_euler_ancestral_steps<false, true>(model, std::move(x), sigmas, rng, eta, resume);
+}
+
 static sd::Tensor<float> sample_sefi_euler(SefiFlowDenoiser* sefi,
                                            denoise_cb_t model,
                                            sd::Tensor<float> x) {
@@ -1252,74 +1310,83 @@ static sd::Tensor<float> sample_sefi_euler(SefiFlowDenoiser* sefi,
 
 static sd::Tensor<float> sample_euler(denoise_cb_t model,
                                       sd::Tensor<float> x,
-                                      const std::vector<float>& sigmas) {
+                                      const std::vector<float>& sigmas,
+                                      const SamplerResume* resume = nullptr) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         float sigma       = sigmas[i];
         auto denoised_opt = model(x, sigma, i + 1);
         if (denoised_opt.pred.empty()) {
             return {};
         }
-        sd::Tensor<float> denoised = std::move(denoised_opt.pred);
-        sd::Tensor<float> d        = (x - denoised) / sigma;
-        x += d * (sigmas[i + 1] - sigma);
+        // x += (x - denoised) / sigma * dt
+        float ratio = (sigmas[i + 1] - sigma) / sigma;
+        sd::ops::axpby(&x, 1.0f + ratio, denoised_opt.pred, -ratio);
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
 
 static sd::Tensor<float> sample_heun(denoise_cb_t model,
                                      sd::Tensor<float> x,
-                                     const std::vector<float>& sigmas) {
+                                     const std::vector<float>& sigmas,
+                                     const SamplerResume* resume = nullptr) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], -(i + 1));
         if (denoised_opt.pred.empty()) {
             return {};
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
-        sd::Tensor<float> d        = (x - denoised) / sigmas[i];
         float dt                   = sigmas[i + 1] - sigmas[i];
         if (sigmas[i + 1] == 0) {
-            x += d * dt;
+            sd::ops::axpby(&x, 1.0f + dt / sigmas[i], denoised, -dt / sigmas[i]);
         } else {
-            sd::Tensor<float> x2 = x + d * dt;
-            auto denoised2_opt   = model(x2, sigmas[i + 1], i + 1);
+            sd::Tensor<float> d = x;
+            sd::ops::axpby(&d, 1.0f / sigmas[i], denoised, -1.0f / sigmas[i]);
+            sd::Tensor<float> x2 = x;
+            sd::ops::axpby(&x2, 1.0f, d, dt);
+            auto denoised2_opt = model(x2, sigmas[i + 1], i + 1);
             if (denoised2_opt.pred.empty()) {
                 return {};
             }
-            sd::Tensor<float> denoised2 = std::move(denoised2_opt.pred);
-            d                           = (d + (x2 - denoised2) / sigmas[i + 1]) / 2.0f;
-            x += d * dt;
+            // x += (d + (x2 - denoised2) / sigma_next) / 2 * dt
+            sd::ops::axpby(&x2, 1.0f, denoised2_opt.pred, -1.0f);
+            sd::ops::axpbypcz(&x, 1.0f, d, dt / 2.0f, x2, dt / (2.0f * sigmas[i + 1]));
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
 
 static sd::Tensor<float> sample_dpm2(denoise_cb_t model,
                                      sd::Tensor<float> x,
-                                     const std::vector<float>& sigmas) {
+                                     const std::vector<float>& sigmas,
+                                     const SamplerResume* resume = nullptr) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], -(i + 1));
         if (denoised_opt.pred.empty()) {
             return {};
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
-        sd::Tensor<float> d        = (x - denoised) / sigmas[i];
         if (sigmas[i + 1] == 0) {
-            x += d * (sigmas[i + 1] - sigmas[i]);
+            float ratio = (sigmas[i + 1] - sigmas[i]) / sigmas[i];
+            sd::ops::axpby(&x, 1.0f + ratio, denoised, -ratio);
         } else {
             float sigma_mid      = exp(0.5f * (log(sigmas[i]) + log(sigmas[i + 1])));
             float dt_1           = sigma_mid - sigmas[i];
             float dt_2           = sigmas[i + 1] - sigmas[i];
-            sd::Tensor<float> x2 = x + d * dt_1;
-            auto denoised2_opt   = model(x2, sigma_mid, i + 1);
+            sd::Tensor<float> x2 = x;
+            sd::ops::axpby(&x2, 1.0f + dt_1 / sigmas[i], denoised, -dt_1 / sigmas[i]);
+            auto denoised2_opt = model(x2, sigma_mid, i + 1);
             if (denoised2_opt.pred.empty()) {
                 return {};
             }
-            sd::Tensor<float> denoised2 = std::move(denoised2_opt.pred);
-            x += ((x2 - denoised2) / sigma_mid) * dt_2;
+            // x += (x2 - denoised2) / sigma_mid * dt_2
+            sd::ops::axpbypcz(&x, 1.0f, x2, dt_2 / sigma_mid, denoised2_opt.pred, -dt_2 / sigma_mid);
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
@@ -1328,12 +1395,13 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral(denoise_cb_t model,
                                                    sd::Tensor<float> x,
                                                    const std::vector<float>& sigmas,
                                                    std::shared_ptr<RNG> rng,
-                                                   float eta) {
+                                                   float eta,
+                                                   const SamplerResume* resume = nullptr) {
     auto t_fn     = [](float sigma) -> float { return -log(sigma); };
     auto sigma_fn = [](float t) -> float { return exp(-t); };
 
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], -(i + 1));
         if (denoised_opt.pred.empty()) {
             return {};
@@ -1342,25 +1410,26 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral(denoise_cb_t model,
         auto [sigma_down, sigma_up] = get_ancestral_step(sigmas[i], sigmas[i + 1], eta);
 
         if (sigma_down == 0) {
-            x = denoised;
+            x = std::move(denoised);
         } else {
             float t              = t_fn(sigmas[i]);
             float t_next         = t_fn(sigma_down);
             float h              = t_next - t;
             float s              = t + 0.5f * h;
             float sigma_s        = sigma_fn(s);
-            sd::Tensor<float> x2 = (sigma_s / sigma_fn(t)) * x - (exp(-h * 0.5f) - 1) * denoised;
-            auto denoised2_opt   = model(x2, sigma_s, i + 1);
+            sd::Tensor<float> x2 = x;
+            sd::ops::axpby(&x2, sigma_s / sigma_fn(t), denoised, -(exp(-h * 0.5f) - 1));
+            auto denoised2_opt = model(x2, sigma_s, i + 1);
             if (denoised2_opt.pred.empty()) {
                 return {};
             }
-            sd::Tensor<float> denoised2 = std::move(denoised2_opt.pred);
-            x                           = (sigma_fn(t_next) / sigma_fn(t)) * x - (exp(-h) - 1) * denoised2;
+            sd::ops::axpby(&x, sigma_fn(t_next) / sigma_fn(t), denoised2_opt.pred, -(exp(-h) - 1));
         }
 
         if (sigmas[i + 1] > 0) {
-            x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+            sd::ops::axpby(&x, 1.0f, sd::Tensor<float>::randn_like(x, rng), sigma_up);
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
@@ -1391,7 +1460,7 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral_flow(denoise_cb_t model,
             // = x + ((x - denoised) / sigma) * (         0 - sigma)
             // = x + ((x - denoised)        ) * -1
             // = x    -x + denoised
-            x = denoised;
+            x = std::move(denoised);
 
         } else {
             auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step_flow(sigma, sigma_to, eta);
@@ -1438,7 +1507,8 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral_flow(denoise_cb_t model,
                 sigma_s     = 1.0f / (exp_s + 1.0f);
 
                 float sigma_s_i_ratio = sigma_s / sigma;
-                sd::Tensor<float> u   = (x * sigma_s_i_ratio) + (denoised * (1.0f - sigma_s_i_ratio));
+                sd::Tensor<float> u   = x;
+                sd::ops::lerp(&u, denoised, 1.0f - sigma_s_i_ratio);
 
                 auto denoised2_opt = model(u, sigma_s, i + 1);
                 if (denoised2_opt.pred.empty()) {
@@ -1448,10 +1518,10 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral_flow(denoise_cb_t model,
             }
 
             float sigma_down_i_ratio = sigma_down / sigma;
-            x                        = (x * sigma_down_i_ratio) + (D_i * (1.0f - sigma_down_i_ratio));
+            sd::ops::lerp(&x, D_i, 1.0f - sigma_down_i_ratio);
 
             if (sigma_to > 0.0f && eta > 0.0f) {
-                x = alpha_scale * x + sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+                sd::ops::axpby(&x, alpha_scale, sd::Tensor<float>::randn_like(x, rng), sigma_up);
             }
         }
     }
@@ -1461,12 +1531,13 @@ static sd::Tensor<float> sample_dpmpp_2s_ancestral_flow(denoise_cb_t model,
 
 static sd::Tensor<float> sample_dpmpp_2m(denoise_cb_t model,
                                          sd::Tensor<float> x,
-                                         const std::vector<float>& sigmas) {
-    sd::Tensor<float> old_denoised = x;
+                                         const std::vector<float>& sigmas,
+                                         const SamplerResume* resume = nullptr) {
+    sd::Tensor<float> old_denoised = resume != nullptr && !resume->old_denoised.empty() ? resume->old_denoised : x;
     auto t_fn                      = [](float sigma) -> float { return -log(sigma); };
 
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], i + 1);
         if (denoised_opt.pred.empty()) {
             return {};
@@ -1479,26 +1550,28 @@ static sd::Tensor<float> sample_dpmpp_2m(denoise_cb_t model,
         float b                    = exp(-h) - 1.f;
 
         if (i == 0 || sigmas[i + 1] == 0) {
-            x = a * x - b * denoised;
+            sd::ops::axpby(&x, a, denoised, -b);
         } else {
-            float h_last                 = t - t_fn(sigmas[i - 1]);
-            float r                      = h_last / h;
-            sd::Tensor<float> denoised_d = (1.f + 1.f / (2.f * r)) * denoised - (1.f / (2.f * r)) * old_denoised;
-            x                            = a * x - b * denoised_d;
+            // denoised_d = (1 + 1 / 2r) * denoised - (1 / 2r) * old_denoised; x = a * x - b * denoised_d
+            float h_last = t - t_fn(sigmas[i - 1]);
+            float r      = h_last / h;
+            sd::ops::axpbypcz(&x, a, denoised, -b * (1.f + 1.f / (2.f * r)), old_denoised, b / (2.f * r));
         }
-        old_denoised = denoised;
+        old_denoised = std::move(denoised);
+        sampler_resume_step(resume, i + 1, x, old_denoised);
     }
     return x;
 }
 
 static sd::Tensor<float> sample_dpmpp_2m_v2(denoise_cb_t model,
                                             sd::Tensor<float> x,
-                                            const std::vector<float>& sigmas) {
-    sd::Tensor<float> old_denoised = x;
+                                            const std::vector<float>& sigmas,
+                                            const SamplerResume* resume = nullptr) {
+    sd::Tensor<float> old_denoised = resume != nullptr && !resume->old_denoised.empty() ? resume->old_denoised : x;
     auto t_fn                      = [](float sigma) -> float { return -log(sigma); };
 
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], i + 1);
         if (denoised_opt.pred.empty()) {
             return {};
@@ -1511,18 +1584,18 @@ static sd::Tensor<float> sample_dpmpp_2m_v2(denoise_cb_t model,
 
         if (i == 0 || sigmas[i + 1] == 0) {
             float b = exp(-h) - 1.f;
-            x       = a * x - b * denoised;
+            sd::ops::axpby(&x, a, denoised, -b);
         } else {
-            float h_last                 = t - t_fn(sigmas[i - 1]);
-            float h_min                  = std::min(h_last, h);
-            float h_max                  = std::max(h_last, h);
-            float r                      = h_max / h_min;
-            float h_d                    = (h_max + h_min) / 2.f;
-            float b                      = exp(-h_d) - 1.f;
-            sd::Tensor<float> denoised_d = (1.f + 1.f / (2.f * r)) * denoised - (1.f / (2.f * r)) * old_denoised;
-            x                            = a * x - b * denoised_d;
+            float h_last = t - t_fn(sigmas[i - 1]);
+            float h_min  = std::min(h_last, h);
+            float h_max  = std::max(h_last, h);
+            float r      = h_max / h_min;
+            float h_d    = (h_max + h_min) / 2.f;
+            float b      = exp(-h_d) - 1.f;
+            sd::ops::axpbypcz(&x, a, denoised, -b * (1.f + 1.f / (2.f * r)), old_denoised, b / (2.f * r));
         }
-        old_denoised = denoised;
+        old_denoised = std::move(denoised);
+        sampler_resume_step(resume, i + 1, x, old_denoised);
     }
     return x;
 }
@@ -1534,7 +1607,8 @@ static sd::Tensor<float> sample_lcm(denoise_cb_t model,
                                     const std::vector<float>& sigmas,
                                     std::shared_ptr<RNG> rng,
                                     bool is_flow_denoiser,
-                                    const SamplerExtraArgs& extra_sample_args) {
+                                    const SamplerExtraArgs& extra_sample_args,
+                                    const SamplerResume* resume = nullptr) {
     struct LCMSampleArgs {
         float noise_clip_std    = 0.0f;
         float noise_scale_start = 1.0f;
@@ -1575,16 +1649,13 @@ static sd::Tensor<float> sample_lcm(denoise_cb_t model,
     }
 
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         auto denoised_opt = model(x, sigmas[i], i + 1);
         if (denoised_opt.pred.empty()) {
             return {};
         }
         x = std::move(denoised_opt.pred);
         if (sigmas[i + 1] > 0) {
-            if (is_flow_denoiser) {
-                x *= (1 - sigmas[i + 1]);
-            }
             auto noise = sd::Tensor<float>::randn_like(x, rng);
             if (args.noise_clip_std > 0.0f && noise.numel() > 0) {
                 double mean = 0.0;
@@ -1605,8 +1676,9 @@ static sd::Tensor<float> sample_lcm(denoise_cb_t model,
             }
             float t           = steps > 1 ? static_cast<float>(i) / static_cast<float>(steps - 1) : 0.0f;
             float noise_scale = args.noise_scale_start + (args.noise_scale_end - args.noise_scale_start) * t;
-            x += noise * (sigmas[i + 1] * noise_scale);
+            sd::ops::axpby(&x, is_flow_denoiser ? 1 - sigmas[i + 1] : 1.0f, noise, sigmas[i + 1] * noise_scale);
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
@@ -1628,22 +1700,28 @@ static sd::Tensor<float> sample_ipndm(denoise_cb_t model,
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
 
-        sd::Tensor<float> d_cur = (x - denoised) / sigma;
-        int order               = std::min(max_order, i + 1);
-        float dt                = sigma_next - sigma;
+        sd::Tensor<float> d_cur = x;
+        sd::ops::axpby(&d_cur, 1.0f / sigma, denoised, -1.0f / sigma);
+        int order = std::min(max_order, i + 1);
+        float dt  = sigma_next - sigma;
 
         switch (order) {
             case 1:
-                x += d_cur * dt;
+                sd::ops::axpby(&x, 1.f, d_cur, dt);
                 break;
             case 2:
-                x += ((3.f * d_cur - hist.back()) / 2.f) * dt;
+                // x += (3 * d_cur - hist[-1]) / 2 * dt
+                sd::ops::axpbypcz(&x, 1.f, d_cur, 3.f * dt / 2.f, hist.back(), -dt / 2.f);
                 break;
             case 3:
-                x += ((23.f * d_cur - 16.f * hist[hist.size() - 1] + 5.f * hist[hist.size() - 2]) / 12.f) * dt;
+                // x += (23 * d_cur - 16 * hist[-1] + 5 * hist[-2]) / 12 * dt
+                sd::ops::axpbypcz(&x, 1.f, d_cur, 23.f * dt / 12.f, hist[hist.size() - 1], -16.f * dt / 12.f);
+                sd::ops::axpby(&x, 1.f, hist[hist.size() - 2], 5.f * dt / 12.f);
                 break;
             case 4:
-                x += ((55.f * d_cur - 59.f * hist[hist.size() - 1] + 37.f * hist[hist.size() - 2] - 9.f * hist[hist.size() - 3]) / 24.f) * dt;
+                // x += (55 * d_cur - 59 * hist[-1] + 37 * hist[-2] - 9 * hist[-3]) / 24 * dt
+                sd::ops::axpbypcz(&x, 1.f, d_cur, 55.f * dt / 24.f, hist[hist.size() - 1], -59.f * dt / 24.f);
+                sd::ops::axpbypcz(&x, 1.f, hist[hist.size() - 2], 37.f * dt / 24.f, hist[hist.size() - 3], -9.f * dt / 24.f);
                 break;
         }
 
@@ -1672,23 +1750,27 @@ static sd::Tensor<float> sample_ipndm_v(denoise_cb_t model,
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
 
-        sd::Tensor<float> d_cur = (x - denoised) / sigma;
-        int order               = std::min(max_order, i + 1);
-        float h_n               = t_next - sigma;
-        float h_n_1             = (i > 0) ? (sigma - sigmas[i - 1]) : h_n;
+        sd::Tensor<float> d_cur = x;
+        sd::ops::axpby(&d_cur, 1.0f / sigma, denoised, -1.0f / sigma);
+        int order   = std::min(max_order, i + 1);
+        float h_n   = t_next - sigma;
+        float h_n_1 = (i > 0) ? (sigma - sigmas[i - 1]) : h_n;
 
         switch (order) {
             case 1:
-                x += d_cur * h_n;
+                sd::ops::axpby(&x, 1.f, d_cur, h_n);
                 break;
             case 2:
-                x += (((2.f + (h_n / h_n_1)) * d_cur - (h_n / h_n_1) * hist.back()) / 2.f) * h_n;
+                // x += ((2 + h_n / h_n_1) * d_cur - (h_n / h_n_1) * hist[-1]) / 2 * h_n
+                sd::ops::axpbypcz(&x, 1.f, d_cur, (2.f + (h_n / h_n_1)) * h_n / 2.f, hist.back(), -(h_n / h_n_1) * h_n / 2.f);
                 break;
             case 3:
-                x += ((23.f * d_cur - 16.f * hist[hist.size() - 1] + 5.f * hist[hist.size() - 2]) / 12.f) * h_n;
+                sd::ops::axpbypcz(&x, 1.f, d_cur, 23.f * h_n / 12.f, hist[hist.size() - 1], -16.f * h_n / 12.f);
+                sd::ops::axpby(&x, 1.f, hist[hist.size() - 2], 5.f * h_n / 12.f);
                 break;
             case 4:
-                x += ((55.f * d_cur - 59.f * hist[hist.size() - 1] + 37.f * hist[hist.size() - 2] - 9.f * hist[hist.size() - 3]) / 24.f) * h_n;
+                sd::ops::axpbypcz(&x, 1.f, d_cur, 55.f * h_n / 24.f, hist[hist.size() - 1], -59.f * h_n / 24.f);
+                sd::ops::axpbypcz(&x, 1.f, hist[hist.size() - 2], 37.f * h_n / 24.f, hist[hist.size() - 3], -9.f * h_n / 24.f);
                 break;
         }
 
@@ -1700,11 +1782,11 @@ static sd::Tensor<float> sample_ipndm_v(denoise_cb_t model,
     return x;
 }
 
+template <bool Flow>
 static sd::Tensor<float> sample_res_multistep(denoise_cb_t model,
                                               sd::Tensor<float> x,
                                               const std::vector<float>& sigmas,
                                               std::shared_ptr<RNG> rng,
-                                              bool is_flow_denoiser,
                                               float eta) {
     sd::Tensor<float> old_denoised = x;
     bool have_old_sigma            = false;
@@ -1737,10 +1819,11 @@ static sd::Tensor<float> sample_res_multistep(denoise_cb_t model,
         float sigma_from = sigmas[i];
         float sigma_to   = sigmas[i + 1];
 
-        auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step(sigma_from, sigma_to, eta, is_flow_denoiser);
+        auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step<Flow>(sigma_from, sigma_to, eta);
 
         if (sigma_down == 0.0f || !have_old_sigma) {
-            x += ((x - denoised) / sigma_from) * (sigma_down - sigma_from);
+            float ratio = (sigma_down - sigma_from) / sigma_from;
+            sd::ops::axpby(&x, 1.0f + ratio, denoised, -ratio);
         } else {
             float t      = t_fn(sigma_from);
             float t_old  = t_fn(old_sigma_down);
@@ -1761,28 +1844,25 @@ static sd::Tensor<float> sample_res_multistep(denoise_cb_t model,
                 b2 = 0.0f;
             }
 
-            x = sigma_fn(h) * x + h * (b1 * denoised + b2 * old_denoised);
+            sd::ops::axpbypcz(&x, sigma_fn(h), denoised, h * b1, old_denoised, h * b2);
         }
 
         if (sigma_to > 0.0f && sigma_up > 0.0f) {
-            if (is_flow_denoiser) {
-                x *= alpha_scale;
-            }
-            x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+            add_ancestral_noise<Flow>(&x, alpha_scale, rng, sigma_up);
         }
 
-        old_denoised   = denoised;
+        old_denoised   = std::move(denoised);
         old_sigma_down = sigma_down;
         have_old_sigma = true;
     }
     return x;
 }
 
+template <bool Flow>
 static sd::Tensor<float> sample_res_2s(denoise_cb_t model,
                                        sd::Tensor<float> x,
                                        const std::vector<float>& sigmas,
                                        std::shared_ptr<RNG> rng,
-                                       bool is_flow_denoiser,
                                        float eta) {
     const float c2 = 0.5f;
     auto t_fn      = [](float sigma) -> float { return -logf(sigma); };
@@ -1811,11 +1891,10 @@ static sd::Tensor<float> sample_res_2s(denoise_cb_t model,
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
 
-        auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step(sigma_from, sigma_to, eta, is_flow_denoiser);
+        auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step<Flow>(sigma_from, sigma_to, eta);
 
-        sd::Tensor<float> x0 = x;
         if (sigma_down == 0.0f || sigma_from == 0.0f) {
-            x = denoised;
+            x = std::move(denoised);
         } else {
             float t      = t_fn(sigma_from);
             float t_next = t_fn(sigma_down);
@@ -1827,24 +1906,20 @@ static sd::Tensor<float> sample_res_2s(denoise_cb_t model,
             float b2       = phi2_val / c2;
             float b1       = phi1_val - b2;
 
-            float sigma_c2         = expf(-(t + h * c2));
-            sd::Tensor<float> eps1 = denoised - x0;
-            sd::Tensor<float> x2   = x0 + eps1 * (h * a21);
+            // eps_k = denoised_k - x0; x2 = x0 + h * a21 * eps1; x = x0 + h * (b1 * eps1 + b2 * eps2)
+            float sigma_c2       = expf(-(t + h * c2));
+            sd::Tensor<float> x2 = x;
+            sd::ops::axpby(&x2, 1.0f - h * a21, denoised, h * a21);
 
             auto denoised2_opt = model(x2, sigma_c2, i + 1);
             if (denoised2_opt.pred.empty()) {
                 return {};
             }
-            sd::Tensor<float> denoised2 = std::move(denoised2_opt.pred);
-            sd::Tensor<float> eps2      = denoised2 - x0;
-            x                           = x0 + h * (b1 * eps1 + b2 * eps2);
+            sd::ops::axpbypcz(&x, 1.0f - h * (b1 + b2), denoised, h * b1, denoised2_opt.pred, h * b2);
         }
 
         if (sigma_to > 0.0f && sigma_up > 0.0f) {
-            if (is_flow_denoiser) {
-                x *= alpha_scale;
-            }
-            x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+            add_ancestral_noise<Flow>(&x, alpha_scale, rng, sigma_up);
         }
     }
     return x;
@@ -1928,7 +2003,7 @@ static sd::Tensor<float> sample_er_sde(denoise_cb_t model,
             float r_alpha     = alpha_s > 0.0f ? alpha_t / alpha_s : 0.0f;
             float r           = scaled_s > 0.0f ? scaled_t / scaled_s : 0.0f;
 
-            x = r_alpha * r * x + alpha_t * (1.0f - r) * denoised;
+            sd::ops::axpby(&x, r_alpha * r, denoised, alpha_t * (1.0f - r));
 
             if (stage_used >= 2 && have_old_denoised) {
                 float dt               = er_lambda_t - er_lambda_s;
@@ -1954,20 +2029,21 @@ static sd::Tensor<float> sample_er_sde(denoise_cb_t model,
                 float denom_d = er_lambda_s - er_lambdas[i - 1];
                 if (std::fabs(denom_d) > 1e-12f) {
                     float coeff_d                = alpha_t * (dt + s * scaled_t);
-                    sd::Tensor<float> denoised_d = (denoised - old_denoised) / denom_d;
-                    x += coeff_d * denoised_d;
+                    sd::Tensor<float> denoised_d = denoised;
+                    sd::ops::axpby(&denoised_d, 1.0f / denom_d, old_denoised, -1.0f / denom_d);
+                    sd::ops::axpby(&x, 1.0f, denoised_d, coeff_d);
 
                     if (stage_used >= 3 && have_old_denoised_d) {
                         float denom_u = (er_lambda_s - er_lambdas[i - 2]) * 0.5f;
                         if (std::fabs(denom_u) > 1e-12f) {
                             s_u *= lambda_step_size;
-                            float coeff_u                = alpha_t * (0.5f * dt * dt + s_u * scaled_t);
-                            sd::Tensor<float> denoised_u = (denoised_d - old_denoised_d) / denom_u;
-                            x += coeff_u * denoised_u;
+                            // x += coeff_u * (denoised_d - old_denoised_d) / denom_u
+                            float coeff_u = alpha_t * (0.5f * dt * dt + s_u * scaled_t);
+                            sd::ops::axpbypcz(&x, 1.0f, denoised_d, coeff_u / denom_u, old_denoised_d, -coeff_u / denom_u);
                         }
                     }
 
-                    old_denoised_d      = denoised_d;
+                    old_denoised_d      = std::move(denoised_d);
                     have_old_denoised_d = true;
                 }
             }
@@ -1975,11 +2051,11 @@ static sd::Tensor<float> sample_er_sde(denoise_cb_t model,
             float noise_scale_sq = er_lambda_t * er_lambda_t - er_lambda_s * er_lambda_s * r * r;
             if (s_noise > 0.0f && noise_scale_sq > 0.0f) {
                 float noise_scale = alpha_t * std::sqrt(std::max(noise_scale_sq, 0.0f));
-                x += sd::Tensor<float>::randn_like(x, rng) * noise_scale;
+                sd::ops::axpby(&x, 1.0f, sd::Tensor<float>::randn_like(x, rng), noise_scale);
             }
         }
 
-        old_denoised      = denoised;
+        old_denoised      = std::move(denoised);
         have_old_denoised = true;
     }
     return x;
@@ -1989,7 +2065,8 @@ static sd::Tensor<float> sample_tcd(denoise_cb_t model,
                                     sd::Tensor<float> x,
                                     const std::vector<float>& sigmas,
                                     std::shared_ptr<RNG> rng,
-                                    float eta) {
+                                    float eta,
+                                    const SamplerResume* resume = nullptr) {
     float beta_start = 0.00085f;
     float beta_end   = 0.0120f;
     std::vector<double> alphas_cumprod(TIMESTEPS);
@@ -2021,7 +2098,7 @@ static sd::Tensor<float> sample_tcd(denoise_cb_t model,
     };
 
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         float sigma_to    = sigmas[i + 1];
         int prev_timestep = get_timestep_from_sigma(sigma_to);
         int timestep_s    = (int)floor((1 - eta) * prev_timestep);
@@ -2032,7 +2109,6 @@ static sd::Tensor<float> sample_tcd(denoise_cb_t model,
             return {};
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
-        sd::Tensor<float> d        = (x - denoised) / sigma;
 
         float alpha_prod_t      = 1.0f / (sigma * sigma + 1.0f);
         float beta_prod_t       = 1.0f - alpha_prod_t;
@@ -2040,33 +2116,37 @@ static sd::Tensor<float> sample_tcd(denoise_cb_t model,
         float alpha_prod_s      = static_cast<float>(alphas_cumprod[timestep_s]);
         float beta_prod_s       = 1.0f - alpha_prod_s;
 
-        x = std::sqrt(alpha_prod_s / alpha_prod_t_prev) * denoised +
-            std::sqrt(beta_prod_s / alpha_prod_t_prev) * d;
+        // d = (x - denoised) / sigma; x = sqrt(alpha_prod_s / alpha_prod_t_prev) * denoised + sqrt(beta_prod_s / alpha_prod_t_prev) * d
+        float d_scale = std::sqrt(beta_prod_s / alpha_prod_t_prev) / sigma;
+        sd::ops::axpby(&x, d_scale, denoised, std::sqrt(alpha_prod_s / alpha_prod_t_prev) - d_scale);
 
         if (eta > 0 && sigma_to > 0.0f) {
-            x = std::sqrt(alpha_prod_t_prev / alpha_prod_s) * x +
-                std::sqrt(1.0f / alpha_prod_t_prev - 1.0f / alpha_prod_s) * sd::Tensor<float>::randn_like(x, rng);
+            sd::ops::axpby(&x,
+                           std::sqrt(alpha_prod_t_prev / alpha_prod_s),
+                           sd::Tensor<float>::randn_like(x, rng),
+                           std::sqrt(1.0f / alpha_prod_t_prev - 1.0f / alpha_prod_s));
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
 
 static sd::Tensor<float> sample_euler_cfg_pp(denoise_cb_t model,
                                              sd::Tensor<float> x,
-                                             const std::vector<float>& sigmas) {
+                                             const std::vector<float>& sigmas,
+                                             const SamplerResume* resume = nullptr) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         float sigma       = sigmas[i];
         auto denoised_opt = model(x, sigma, i + 1);
         if (denoised_opt.pred.empty() || denoised_opt.pred_uncond.empty()) {
             return {};
         }
 
-        sd::Tensor<float> denoised        = std::move(denoised_opt.pred);
-        sd::Tensor<float> uncond_denoised = std::move(denoised_opt.pred_uncond);
-        sd::Tensor<float> d               = (x - uncond_denoised) / sigma;
-
-        x = denoised + d * sigmas[i + 1];
+        // x = denoised + (x - uncond_denoised) / sigma * sigma_next
+        float ratio = sigmas[i + 1] / sigma;
+        sd::ops::axpbypcz(&x, ratio, denoised_opt.pred, 1.0f, denoised_opt.pred_uncond, -ratio);
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
@@ -2075,36 +2155,36 @@ static sd::Tensor<float> sample_euler_ancestral_cfg_pp(denoise_cb_t model,
                                                        sd::Tensor<float> x,
                                                        const std::vector<float>& sigmas,
                                                        std::shared_ptr<RNG> rng,
-                                                       float eta) {
+                                                       float eta,
+                                                       const SamplerResume* resume = nullptr) {
     int steps = static_cast<int>(sigmas.size()) - 1;
-    for (int i = 0; i < steps; i++) {
+    for (int i = sampler_resume_start(resume); i < steps; i++) {
         float sigma       = sigmas[i];
         auto denoised_opt = model(x, sigma, i + 1);
         if (denoised_opt.pred.empty() || denoised_opt.pred_uncond.empty()) {
             return {};
         }
 
-        sd::Tensor<float> denoised        = std::move(denoised_opt.pred);
-        sd::Tensor<float> uncond_denoised = std::move(denoised_opt.pred_uncond);
-        sd::Tensor<float> d               = (x - uncond_denoised) / sigma;
-
         auto [sigma_down, sigma_up] = get_ancestral_step(sigmas[i], sigmas[i + 1], eta);
 
-        x = denoised + d * sigma_down;
+        // x = denoised + (x - uncond_denoised) / sigma * sigma_down
+        float ratio = sigma_down / sigma;
+        sd::ops::axpbypcz(&x, ratio, denoised_opt.pred, 1.0f, denoised_opt.pred_uncond, -ratio);
 
         if (sigmas[i + 1] > 0) {
-            x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+            sd::ops::axpby(&x, 1.0f, sd::Tensor<float>::randn_like(x, rng), sigma_up);
         }
+        sampler_resume_step(resume, i + 1, x);
     }
     return x;
 }
 
 // https://github.com/ToyotaResearchInstitute/gradient-estimation-sampler
+template <bool Flow>
 static sd::Tensor<float> sample_gradient_estimation(denoise_cb_t model,
                                                     sd::Tensor<float> x,
                                                     const std::vector<float>& sigmas,
                                                     std::shared_ptr<RNG> rng,
-                                                    bool is_flow_denoiser,
                                                     float eta,
                                                     const SamplerExtraArgs& extra_sample_args) {
     float ge_gamma = 2.0f;
@@ -2133,30 +2213,214 @@ static sd::Tensor<float> sample_gradient_estimation(denoise_cb_t model,
         }
         sd::Tensor<float> denoised = std::move(denoised_opt.pred);
         if (sigma_to == 0.f) {
-            x = denoised;
+            x = std::move(denoised);
         } else {
-            auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step(sigma, sigma_to, eta, is_flow_denoiser);
-            sd::Tensor<float> d                      = (x - denoised) / sigma;
-            float dt                                 = sigma_down - sigma;
+            auto [sigma_down, sigma_up, alpha_scale] = get_ancestral_step<Flow>(sigma, sigma_to, eta);
+            sd::Tensor<float> d                      = x;
+            sd::ops::axpby(&d, 1.0f / sigma, denoised, -1.0f / sigma);
+            float dt = sigma_down - sigma;
             if (has_old_d) {
-                sd::Tensor<float> d_bar = d * ge_gamma + old_d * (1.0f - ge_gamma);
-                x += d_bar * dt;
+                // x += (d * gamma + old_d * (1 - gamma)) * dt
+                sd::ops::axpbypcz(&x, 1.0f, d, ge_gamma * dt, old_d, (1.0f - ge_gamma) * dt);
             } else {
-                x += d * dt;
+                sd::ops::axpby(&x, 1.0f, d, dt);
             }
             old_d     = std::move(d);
             has_old_d = true;
             if (sigma_up > 0.f) {
-                if (is_flow_denoiser) {
-                    x *= alpha_scale;
-                }
-                x += sd::Tensor<float>::randn_like(x, rng) * sigma_up;
+                add_ancestral_noise<Flow>(&x, alpha_scale, rng, sigma_up);
             }
         }
     }
     return x;
 }
 
+// Heun with an embedded Euler error estimate, stepping in log sigma between
+// the first and the last nonzero sigma of the schedule, as in k-diffusion's
+// DPM-Solver adaptive. Step sizes follow the error against atol + rtol * |x|
+// instead of the schedule, which only gives the range and the first step.
+// max_nfe caps the model evaluations: once the remaining budget cannot reach
+// the end at the current step size, steps are stretched and always accepted.
+// Model calls report the schedule step their sigma falls in, so step-indexed
+// features (guidance ranges, step caches, progress) keep working.
+static sd::Tensor<float> sample_heun_adaptive(denoise_cb_t model,
+                                              sd::Tensor<float> x,
+                                              const std::vector<float>& sigmas,
+                                              const SamplerExtraArgs& extra_sample_args) {
+    float rtol  = 0.05f;
+    float atol  = 0.0078f;
+    int max_nfe = 0;
+    for (const auto& [key, value] : extra_sample_args) {
+        if (key == "adaptive_rtol" || key == "adaptive_atol") {
+            float parsed = 0.0f;
+            if (!parse_strict_float(value, parsed) || parsed <= 0.0f) {
+                LOG_WARN("ignoring invalid heun_adaptive extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            (key == "adaptive_rtol" ? rtol : atol) = parsed;
+        } else if (key == "max_nfe") {
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || parsed < 0) {
+                LOG_WARN("ignoring invalid heun_adaptive extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            max_nfe = parsed;
+        }
+    }
+
+    int steps = static_cast<int>(sigmas.size()) - 1;
+    int last  = steps;
+    while (last > 0 && sigmas[last] <= 0.0f) {
+        last--;
+    }
+    if (steps < 1 || sigmas[0] <= 0.0f) {
+        return x;
+    }
+    const bool to_zero = last < steps;
+    // the schedule step whose interval starts at or above sigma
+    auto schedule_step = [&](float sigma) {
+        int step = 1;
+        while (step < steps && sigmas[step] >= sigma) {
+            step++;
+        }
+        return step;
+    };
+
+    const float t_end = logf(sigmas[last]);
+    float t           = logf(sigmas[0]);
+    float h           = last > 0 ? t - logf(sigmas[1]) : 0.0f;
+    const float h_min = (t - t_end) * 1e-3f;
+    int nfe           = 0;
+    int accepted      = 0;
+    int rejected      = 0;
+    sd::Tensor<float> denoised;  // D(x, exp(t)), kept over rejected steps
+    while (t - t_end > h_min) {
+        h          = std::min(h, t - t_end);
+        bool force = h <= h_min;
+        if (max_nfe > 0) {
+            int attempts_left = (max_nfe - nfe - (to_zero ? 1 : 0) + (denoised.empty() ? 0 : 1)) / 2;
+            if (attempts_left < 1 && to_zero) {
+                break;
+            }
+            attempts_left = std::max(attempts_left, 1);
+            if (h * attempts_left < t - t_end) {
+                h     = (t - t_end) / attempts_left;
+                force = true;
+            }
+        }
+        const bool final_step  = t - h <= t_end + h_min;
+        const float sigma      = expf(t);
+        const float sigma_next = final_step ? sigmas[last] : expf(t - h);
+        const int step         = schedule_step(sigma);
+
+        if (denoised.empty()) {
+            auto denoised_opt = model(x, sigma, -step);
+            if (denoised_opt.pred.empty()) {
+                return {};
+            }
+            denoised = std::move(denoised_opt.pred);
+            nfe++;
+        }
+        float dt            = sigma_next - sigma;
+        sd::Tensor<float> d = x;
+        sd::ops::axpby(&d, 1.0f / sigma, denoised, -1.0f / sigma);
+        sd::Tensor<float> x_euler = x;
+        sd::ops::axpby(&x_euler, 1.0f, d, dt);
+        auto denoised2_opt = model(x_euler, sigma_next, step);
+        if (denoised2_opt.pred.empty()) {
+            return {};
+        }
+        nfe++;
+        // x_heun - x_euler = dt / 2 * (d2 - d), d2 = (x_euler - denoised2) / sigma_next
+        sd::Tensor<float> d2 = x_euler;
+        sd::ops::axpby(&d2, 1.0f / sigma_next, denoised2_opt.pred, -1.0f / sigma_next);
+        double err_sum   = 0.0;
+        const float* xp  = x.data();
+        const float* ep  = x_euler.data();
+        const float* dp  = d.data();
+        const float* d2p = d2.data();
+        const int64_t n  = x.numel();
+        for (int64_t k = 0; k < n; k++) {
+            float delta  = 0.5f * dt * (d2p[k] - dp[k]);
+            float x_heun = ep[k] + delta;
+            float scale  = atol + rtol * std::max(fabsf(xp[k]), fabsf(x_heun));
+            err_sum += static_cast<double>(delta / scale) * (delta / scale);
+        }
+        float err = n > 0 ? static_cast<float>(sqrt(err_sum / static_cast<double>(n))) : 0.0f;
+
+        if (err <= 1.0f || force) {
+            // x_heun = x + (d + d2) / 2 * dt
+            sd::ops::axpbypcz(&x, 1.0f, d, 0.5f * dt, d2, 0.5f * dt);
+            t        = final_step ? t_end : t - h;
+            denoised = {};
+            accepted++;
+        } else {
+            rejected++;
+        }
+        // error order 2 of the Euler estimate: h ~ err^(-1/2)
+        float factor = err > 0.0f ? 0.9f * powf(err, -0.5f) : 5.0f;
+        h *= std::min(std::max(factor, 0.2f), 5.0f);
+    }
+
+    if (to_zero) {
+        if (denoised.empty()) {
+            auto denoised_opt = model(x, expf(t), steps);
+            if (denoised_opt.pred.empty()) {
+                return {};
+            }
+            denoised = std::move(denoised_opt.pred);
+            nfe++;
+        }
+        x = std::move(denoised);
+    }
+    LOG_INFO("heun_adaptive: %d model evaluations, %d accepted and %d rejected steps (schedule has %d steps)",
+             nfe, accepted, rejected, steps);
+    return x;
+}
+
+static bool sampler_supports_resume(sample_method_t method, bool is_flow_denoiser) {
+    switch (method) {
+        case EULER_A_SAMPLE_METHOD:
+        case EULER_SAMPLE_METHOD:
+        case HEUN_SAMPLE_METHOD:
+        case DPM2_SAMPLE_METHOD:
+        case DPMPP2M_SAMPLE_METHOD:
+        case DPMPP2Mv2_SAMPLE_METHOD:
+        case LCM_SAMPLE_METHOD:
+        case DDIM_TRAILING_SAMPLE_METHOD:
+        case TCD_SAMPLE_METHOD:
+        case EULER_CFG_PP_SAMPLE_METHOD:
+        case EULER_A_CFG_PP_SAMPLE_METHOD:
+            return true;
+        case DPMPP2S_A_SAMPLE_METHOD:
+            return !is_flow_denoiser;
+        default:
+            return false;
+    }
+}
+
+// Whether the sampler draws latent-sized noise on its steps. Most only do
+// at eta above 0; LCM, Euler A CFG++ and the eps DPM++ 2S a always draw.
+static bool sampler_draws_noise(sample_method_t method, float eta, bool is_flow_denoiser) {
+    switch (method) {
+        case LCM_SAMPLE_METHOD:
+        case EULER_A_CFG_PP_SAMPLE_METHOD:
+            return true;
+        case DPMPP2S_A_SAMPLE_METHOD:
+            return !is_flow_denoiser || eta > 0.f;
+        case EULER_A_SAMPLE_METHOD:
+        case DDIM_TRAILING_SAMPLE_METHOD:
+        case TCD_SAMPLE_METHOD:
+        case RES_MULTISTEP_SAMPLE_METHOD:
+        case RES_2S_SAMPLE_METHOD:
+        case ER_SDE_SAMPLE_METHOD:
+        case EULER_GE_SAMPLE_METHOD:
+            return eta > 0.f;
+        default:
+            return false;
+    }
+}
+
 // k diffusion reverse ODE: dx = (x - D(x;\sigma)) / \sigma dt; \sigma(t) = t
 static sd::Tensor<float> sample_k_diffusion(sample_method_t method,
                                             denoise_cb_t model,
@@ -2166,7 +2430,8 @@ static sd::Tensor<float> sample_k_diffusion(sample_method_t method,
                                             float eta,
                                             bool is_flow_denoiser,
                                             const char* extra_sample_args,
-                                            std::shared_ptr<Denoiser> denoiser_for_dispatch = nullptr) {
+                                            std::shared_ptr<Denoiser> denoiser_for_dispatch = nullptr,
+                                            const SamplerResume* resume                     = nullptr) {
     if (denoiser_for_dispatch) {
         if (auto sefi = std::dynamic_pointer_cast<SefiFlowDenoiser>(denoiser_for_dispatch)) {
             return sample_sefi_euler(sefi.get(), model, std::move(x));
@@ -2175,45 +2440,50 @@ static sd::Tensor<float> sample_k_diffusion(sample_method_t method,
     SamplerExtraArgs extra_args = parse_key_value_args(extra_sample_args, "extra sample arg");
     switch (method) {
         case EULER_A_SAMPLE_METHOD:
-            return sample_euler_ancestral(model, std::move(x), sigmas, rng, is_flow_denoiser, eta);
+            return sample_euler_ancestral(model, std::move(x), sigmas, rng, is_flow_denoiser, eta, resume);
         case EULER_SAMPLE_METHOD:
-            return sample_euler(model, std::move(x), sigmas);
+            return sample_euler(model, std::move(x), sigmas, resume);
         case HEUN_SAMPLE_METHOD:
-            return sample_heun(model, std::move(x), sigmas);
+            return sample_heun(model, std::move(x), sigmas, resume);
         case DPM2_SAMPLE_METHOD:
-            return sample_dpm2(model, std::move(x), sigmas);
+            return sample_dpm2(model, std::move(x), sigmas, resume);
         case DPMPP2S_A_SAMPLE_METHOD:
             if (is_flow_denoiser)
                 return sample_dpmpp_2s_ancestral_flow(model, std::move(x), sigmas, rng, eta);
             else
-                return sample_dpmpp_2s_ancestral(model, std::move(x), sigmas, rng, eta);
+                return sample_dpmpp_2s_ancestral(model, std::move(x), sigmas, rng, eta, resume);
         case DPMPP2M_SAMPLE_METHOD:
-            return sample_dpmpp_2m(model, std::move(x), sigmas);
+            return sample_dpmpp_2m(model, std::move(x), sigmas, resume);
         case DPMPP2Mv2_SAMPLE_METHOD:
-            return sample_dpmpp_2m_v2(model, std::move(x), sigmas);
+            return sample_dpmpp_2m_v2(model, std::move(x), sigmas, resume);
         case LCM_SAMPLE_METHOD:
-            return sample_lcm(model, std::move(x), sigmas, rng, is_flow_denoiser, extra_args);
+            return sample_lcm(model, std::move(x), sigmas, rng, is_flow_denoiser, extra_args, resume);
         case IPNDM_SAMPLE_METHOD:
             return sample_ipndm(model, std::move(x), sigmas);
         case IPNDM_V_SAMPLE_METHOD:
             return sample_ipndm_v(model, std::move(x), sigmas);
         case RES_MULTISTEP_SAMPLE_METHOD:
-            return sample_res_multistep(model, std::move(x), sigmas, rng, is_flow_denoiser, eta);
+            return is_flow_denoiser ? sample_res_multistep<true>(model, std::move(x), sigmas, rng, eta)
+                                    : sample_res_multistep<false>(model, std::move(x), sigmas, rng, eta);
         case RES_2S_SAMPLE_METHOD:
-            return sample_res_2s(model, std::move(x), sigmas, rng, is_flow_denoiser, eta);
+            return is_flow_denoiser ? sample_res_2s<true>(model, std::move(x), sigmas, rng, eta)
+                                    : sample_res_2s<false>(model, std::move(x), sigmas, rng, eta);
         case ER_SDE_SAMPLE_METHOD:
             return sample_er_sde(model, std::move(x), sigmas, rng, is_flow_denoiser, eta);
         case DDIM_TRAILING_SAMPLE_METHOD:
             // DDIM is equivalent to Euler Ancestral with the Simple scheduler
-            return sample_euler_ancestral(model, std::move(x), sigmas, rng, is_flow_denoiser, eta);
+            return sample_euler_ancestral(model, std::move(x), sigmas, rng, is_flow_denoiser, eta, resume);
         case TCD_SAMPLE_METHOD:
-            return sample_tcd(model, std::move(x), sigmas, rng, eta);
+            return sample_tcd(model, std::move(x), sigmas, rng, eta, resume);
         case EULER_CFG_PP_SAMPLE_METHOD:
-            return sample_euler_cfg_pp(model, std::move(x), sigmas);
+            return sample_euler_cfg_pp(model, std::move(x), sigmas, resume);
         case EULER_A_CFG_PP_SAMPLE_METHOD:
-            return sample_euler_ancestral_cfg_pp(model, std::move(x), sigmas, rng, eta);
+            return sample_euler_ancestral_cfg_pp(model, std::move(x), sigmas, rng, eta, resume);
         case EULER_GE_SAMPLE_METHOD:
-            return sample_gradient_estimation(model, std::move(x), sigmas, rng, is_flow_denoiser, eta, extra_args);
+            return is_flow_denoiser ? sample_gradient_estimation<true>(model, std::move(x), sigmas, rng, eta, extra_args)
+                                    : sample_gradient_estimation<false>(model, std::move(x), sigmas, rng, eta, extra_args);
+        case HEUN_ADAPTIVE_SAMPLE_METHOD:
+            return sample_heun_adaptive(model, std::move(x), sigmas, extra_args);
         default:
             return {};
     }
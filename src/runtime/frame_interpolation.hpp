@@ -0,0 +1,74 @@
+#ifndef __SD_RUNTIME_FRAME_INTERPOLATION_HPP__
+#define __SD_RUNTIME_FRAME_INTERPOLATION_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "core/tensor.hpp"
+#include "core/util.h"
+
+namespace sd::frame_interpolation {
+
+    // Keyframe sampling for Wan videos, set through the extra sample arg
+    // frame_interp (1 = off): the clip is sampled with 1/frame_interp of its
+    // latent frames, keeping the first and the last, and the latent frames in
+    // between are blended from their sampled neighbours before the VAE
+    // decode. Sampling cost falls with the factor; fast motion ghosts where
+    // the blend stands in for frames the model never saw.
+    struct Params {
+        int factor = 1;
+
+        bool enabled() const {
+            return factor > 1;
+        }
+
+        int64_t sampled_frames(int64_t total_frames) const {
+            if (!enabled() || total_frames <= 2) {
+                return total_frames;
+            }
+            return (total_frames - 1 + factor - 1) / factor + 1;
+        }
+
+        // sampled: [W, H, T, C(, N)] with the sampled latent frames on dim 2;
+        // returns total_frames frames, each the linear blend of the two
+        // sampled frames around its position in the clip.
+        sd::Tensor<float> interpolate(const sd::Tensor<float>& sampled, int64_t total_frames) const {
+            const int64_t sampled_count = sampled.shape()[2];
+            if (sampled_count >= total_frames || sampled_count < 2) {
+                return sampled;
+            }
+            std::vector<int64_t> shape = sampled.shape();
+            shape[2]                   = total_frames;
+            sd::Tensor<float> result   = sd::zeros<float>(shape);
+            for (int64_t t = 0; t < total_frames; ++t) {
+                const double pos = static_cast<double>(t) * (sampled_count - 1) / (total_frames - 1);
+                const int64_t i0 = std::min<int64_t>(static_cast<int64_t>(std::floor(pos)), sampled_count - 2);
+                const float w    = static_cast<float>(pos - i0);
+                auto before      = sd::ops::slice(sampled, 2, i0, i0 + 1) * (1.0f - w);
+                auto after       = sd::ops::slice(sampled, 2, i0 + 1, i0 + 2) * w;
+                sd::ops::slice_assign(&result, 2, t, t + 1, before + after);
+            }
+            return result;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "frame_interp") {
+                continue;
+            }
+            int parsed_int = 0;
+            if (!parse_strict_int(value, parsed_int) || parsed_int < 1) {
+                LOG_WARN("ignoring invalid frame interpolation extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.factor = parsed_int;
+        }
+        return params;
+    }
+
+}  // namespace sd::frame_interpolation
+
+#endif  // __SD_RUNTIME_FRAME_INTERPOLATION_HPP__
@@ -0,0 +1,75 @@
+#include "runtime/generation-queue.h"
+
+namespace sd::generation {
+
+    GenerationQueue::~GenerationQueue() {
+        for (auto& job : close()) {
+            job(false);
+        }
+        join();
+    }
+
+    uint64_t GenerationQueue::submit(Job job) {
+        uint64_t id = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_) {
+                return 0;
+            }
+            id = next_id_++;
+            jobs_.emplace_back(id, std::move(job));
+            if (!thread_.joinable()) {
+                thread_ = std::thread(&GenerationQueue::worker_loop, this);
+            }
+        }
+        cv_.notify_one();
+        return id;
+    }
+
+    bool GenerationQueue::remove(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+            if (it->first == id) {
+                jobs_.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<GenerationQueue::Job> GenerationQueue::close() {
+        std::vector<Job> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            for (auto& [id, job] : jobs_) {
+                waiting.push_back(std::move(job));
+            }
+            jobs_.clear();
+        }
+        cv_.notify_all();
+        return waiting;
+    }
+
+    void GenerationQueue::join() {
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void GenerationQueue::worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return closed_ || !jobs_.empty(); });
+            if (closed_) {
+                return;
+            }
+            Job job = std::move(jobs_.front().second);
+            jobs_.pop_front();
+            lock.unlock();
+            job(true);
+            lock.lock();
+        }
+    }
+
+}  // namespace sd::generation
@@ -0,0 +1,53 @@
+#ifndef __SD_RUNTIME_GENERATION_QUEUE_H__
+#define __SD_RUNTIME_GENERATION_QUEUE_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sd::generation {
+
+    // Runs the async generations of one context on a thread of its own, one
+    // at a time in submission order. The thread starts with the first job.
+    class GenerationQueue {
+    public:
+        // called with true on the queue's thread, or with false by whoever
+        // closed the queue for a job that never started
+        using Job = std::function<void(bool started)>;
+
+        GenerationQueue() = default;
+        ~GenerationQueue();
+
+        GenerationQueue(const GenerationQueue&)            = delete;
+        GenerationQueue& operator=(const GenerationQueue&) = delete;
+
+        // 0 once the queue is closed.
+        uint64_t submit(Job job);
+        // Takes a job off the queue before it starts; false once it was
+        // started, or was never queued.
+        bool remove(uint64_t id);
+        // Starts no more jobs and hands back the ones still waiting, for the
+        // caller to drop.
+        std::vector<Job> close();
+        // Waits for the running job after close.
+        void join();
+
+    private:
+        void worker_loop();
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::thread thread_;
+        std::deque<std::pair<uint64_t, Job>> jobs_;
+        uint64_t next_id_ = 1;
+        bool closed_      = false;
+    };
+
+}  // namespace sd::generation
+
+#endif  // __SD_RUNTIME_GENERATION_QUEUE_H__
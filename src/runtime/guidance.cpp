@@ -52,6 +52,25 @@ namespace sd::guidance {
         return params;
     }
 
+    CfgTruncationParams parse_cfg_truncation_args(const char* extra_sample_args) {
+        CfgTruncationParams params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            float parsed = 0.0f;
+            if (key == "cfg_trunc_sigma" || key == "cfg_trunc_tol") {
+                if (!parse_strict_float(value, parsed) || parsed < 0.0f) {
+                    LOG_WARN("ignoring invalid CFG truncation extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                if (key == "cfg_trunc_sigma") {
+                    params.sigma = parsed;
+                } else {
+                    params.tolerance = parsed;
+                }
+            }
+        }
+        return params;
+    }
+
     bool parse_skip_layer_guidance_uncond_arg(const char* extra_sample_args) {
         bool uncond = false;
         for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
@@ -140,6 +159,42 @@ namespace sd::guidance {
         return guidance_schedule;
     }
 
+    CfgTruncation::CfgTruncation(CfgTruncationParams params)
+        : params_(params) {
+    }
+
+    bool CfgTruncation::is_enabled() const {
+        return params_.sigma > 0.0f || params_.tolerance > 0.0f;
+    }
+
+    bool CfgTruncation::skip_uncond(float sigma) {
+        if (!truncated_ && params_.sigma > 0.0f && sigma < params_.sigma) {
+            LOG_INFO("CFG truncated at sigma %.4f, later steps run without uncond", sigma);
+            truncated_ = true;
+        }
+        return truncated_;
+    }
+
+    void CfgTruncation::observe(const sd::Tensor<float>& pred_cond, const sd::Tensor<float>& pred_uncond) {
+        if (truncated_ || !(params_.tolerance > 0.0f) || pred_cond.numel() != pred_uncond.numel()) {
+            return;
+        }
+        const float* cond   = pred_cond.data();
+        const float* uncond = pred_uncond.data();
+        double diff_sq      = 0.0;
+        double cond_sq      = 0.0;
+        for (int64_t i = 0; i < pred_cond.numel(); ++i) {
+            double diff = static_cast<double>(cond[i]) - uncond[i];
+            diff_sq += diff * diff;
+            cond_sq += static_cast<double>(cond[i]) * cond[i];
+        }
+        double distance = std::sqrt(diff_sq / (cond_sq + 1e-12));
+        if (distance < params_.tolerance) {
+            LOG_INFO("CFG truncated, cond/uncond distance %.4f is under %.4f", distance, params_.tolerance);
+            truncated_ = true;
+        }
+    }
+
     ClassifierFreeGuidance::ClassifierFreeGuidance(float guidance_scale,
                                                    float image_guidance_scale)
         : guidance_scale_(guidance_scale),
@@ -25,7 +25,17 @@ namespace sd::guidance {
         float norm_threshold_smoothing = 0.0f;
     };
 
+    // Guidance-free tail steps: the uncond passes are dropped once sigma falls
+    // below cfg_trunc_sigma, or once the relative L2 distance between the cond
+    // and uncond predictions drops below cfg_trunc_tol. Truncation is final for
+    // the rest of the sampling, so late steps cost one forward pass.
+    struct CfgTruncationParams {
+        float sigma     = 0.0f;
+        float tolerance = 0.0f;
+    };
+
     AdaptiveProjectedGuidanceParams parse_adaptive_projected_guidance_args(const char* extra_sample_args);
+    CfgTruncationParams parse_cfg_truncation_args(const char* extra_sample_args);
     bool is_adaptive_projected_guidance_enabled(const AdaptiveProjectedGuidanceParams& params);
     bool parse_skip_layer_guidance_uncond_arg(const char* extra_sample_args);
     std::vector<float> parse_guidance_schedule(const char* extra_sample_args);
@@ -77,6 +87,19 @@ namespace sd::guidance {
                              std::optional<float> scale_override = std::nullopt) const override;
     };
 
+    class CfgTruncation {
+        CfgTruncationParams params_;
+        bool truncated_ = false;
+
+    public:
+        explicit CfgTruncation(CfgTruncationParams params);
+
+        bool is_enabled() const;
+        // True when the step at sigma runs without the uncond passes.
+        bool skip_uncond(float sigma);
+        void observe(const sd::Tensor<float>& pred_cond, const sd::Tensor<float>& pred_uncond);
+    };
+
     class SkipLayerGuidance : public BaseGuidance {
         std::vector<int> layers_;
         float scale_ = 0.0f;
@@ -0,0 +1,250 @@
+#ifndef __SD_RUNTIME_LATENCY_SLO_HPP__
+#define __SD_RUNTIME_LATENCY_SLO_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "core/util.h"
+#include "stable-diffusion.h"
+
+namespace sd::latency_slo {
+
+    // A latency target per request, set through the extra sample arg
+    // latency_ms (0 = off). Each generation of a context feeds its measured
+    // text encode, per-step and VAE decode times into an estimate; a request
+    // with a target is then planned against it. Knobs are given up in the
+    // order they cost quality: CFG truncation first, then the step cache of
+    // the model type, the tiny VAE decode when one is loaded for previews,
+    // and last the step count, down to latency_min_steps. latency_cache,
+    // latency_cfg_trunc and latency_tiny_vae (0/1) take knobs out of the
+    // plan. Requests run unchanged until a first generation was measured.
+    struct Params {
+        int target_ms    = 0;
+        int min_steps    = 0;  // 0: half the requested steps
+        bool allow_cache = true;
+        bool allow_trunc = true;
+        bool allow_tiny  = true;
+
+        bool enabled() const {
+            return target_ms > 0;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            int parsed = 0;
+            if (key == "latency_ms" || key == "latency_min_steps") {
+                if (!parse_strict_int(value, parsed) || parsed < 0) {
+                    LOG_WARN("ignoring invalid latency target extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                if (key == "latency_ms") {
+                    params.target_ms = parsed;
+                } else {
+                    params.min_steps = parsed;
+                }
+            } else if (key == "latency_cache" || key == "latency_cfg_trunc" || key == "latency_tiny_vae") {
+                if (!parse_strict_int(value, parsed) || (parsed != 0 && parsed != 1)) {
+                    LOG_WARN("ignoring invalid latency target extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                if (key == "latency_cache") {
+                    params.allow_cache = parsed == 1;
+                } else if (key == "latency_cfg_trunc") {
+                    params.allow_trunc = parsed == 1;
+                } else {
+                    params.allow_tiny = parsed == 1;
+                }
+            }
+        }
+        return params;
+    }
+
+    // the tolerance CFG truncation is planned with, see docs/performance.md
+    constexpr float CFG_TRUNC_TOLERANCE = 0.05f;
+
+    // What is known about a request before it runs.
+    struct Request {
+        int64_t pixels             = 0;  // of one output image
+        int batch_count            = 1;
+        int steps                  = 0;
+        float step_scale           = 1.f;  // steps that run, as a fraction: the strength of img2img
+        bool cfg                   = false;
+        bool unet                  = false;
+        bool dit                   = false;
+        bool cfg_truncated         = false;  // the request already truncates CFG
+        sd_cache_mode_t cache_mode = SD_CACHE_DISABLED;
+        bool has_tiny_vae          = false;
+    };
+
+    struct Plan {
+        int steps                  = 0;
+        sd_cache_mode_t cache_mode = SD_CACHE_DISABLED;
+        bool cfg_truncation        = false;
+        bool tiny_vae              = false;
+        double predicted_ms        = 0.0;
+    };
+
+    // What a finished sampling measured, from sd_perf::PerfRecorder.
+    struct Observation {
+        int64_t pixels             = 0;
+        bool cfg                   = false;
+        bool cfg_truncation        = false;
+        sd_cache_mode_t cache_mode = SD_CACHE_DISABLED;
+        int steps                  = 0;  // steps over all images, skipped ones included
+        int skipped_steps          = 0;
+        double text_encode_ms      = 0.0;
+        double sampling_ms         = 0.0;
+    };
+
+    // Online estimate of a context's timings. Step costs are kept per output
+    // size, since attention grows faster than the pixel count; a size not
+    // seen yet is scaled linearly from the closest one.
+    class Estimator {
+    public:
+        void observe(const Observation& obs) {
+            if (obs.pixels <= 0 || obs.steps <= 0 || obs.sampling_ms <= 0.0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            int computed = std::max(1, obs.steps - obs.skipped_steps);
+            double step  = obs.sampling_ms / computed;
+            if (obs.cfg && obs.cfg_truncation) {
+                // a truncated run mixes both costs; it only teaches the
+                // truncation how much it saved over the full CFG cost
+                auto it = step_ms_[1].find(obs.pixels);
+                if (it != step_ms_[1].end() && it->second.value > 0.0) {
+                    update(trunc_ratio_, std::min(1.0, step / it->second.value));
+                }
+            } else {
+                update(step_ms_[obs.cfg ? 1 : 0][obs.pixels], step);
+            }
+            if (obs.cache_mode != SD_CACHE_DISABLED) {
+                update(cache_ratio_[obs.cache_mode], static_cast<double>(computed) / obs.steps);
+            }
+            update(text_encode_ms_, obs.text_encode_ms);
+        }
+
+        // decodes are measured on their own, since sample_image_latents and
+        // decode_image_latents may run them apart
+        void observe_decode(int64_t pixels, bool tiny_vae, double ms) {
+            if (pixels <= 0 || ms <= 0.0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            update(decode_ms_per_mpix_[tiny_vae ? 1 : 0], ms / (pixels / 1e6));
+        }
+
+        // false until a generation with the same CFG setting was observed
+        bool plan(const Params& params, const Request& request, Plan* plan) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            double step_ms = step_cost(request.cfg, request.pixels);
+            if (step_ms <= 0.0 || request.steps <= 0) {
+                return false;
+            }
+            double megapixels = request.pixels * static_cast<double>(request.batch_count) / 1e6;
+            double decode_ms  = decode_ms_per_mpix_[0].value * megapixels;
+            double tiny_ms    = decode_ms_per_mpix_[1].value > 0.0 ? decode_ms_per_mpix_[1].value * megapixels : decode_ms * 0.1;
+
+            Plan candidate;
+            candidate.steps      = request.steps;
+            candidate.cache_mode = request.cache_mode;
+            auto predict         = [&](const Plan& p) {
+                double trunc     = p.cfg_truncation ? trunc_ratio(request.cfg) : 1.0;
+                double cache     = cache_ratio(p.cache_mode);
+                double run_steps = std::max(1.0, std::ceil(p.steps * static_cast<double>(request.step_scale))) * request.batch_count;
+                return text_encode_ms_.value + run_steps * cache * trunc * step_ms + (p.tiny_vae ? tiny_ms : decode_ms);
+            };
+            const double target    = params.target_ms;
+            candidate.predicted_ms = predict(candidate);
+
+            if (candidate.predicted_ms > target && params.allow_trunc && request.cfg && !request.cfg_truncated) {
+                candidate.cfg_truncation = true;
+                candidate.predicted_ms   = predict(candidate);
+            }
+            if (candidate.predicted_ms > target && params.allow_cache && candidate.cache_mode == SD_CACHE_DISABLED) {
+                sd_cache_mode_t mode = request.unet ? SD_CACHE_UCACHE : (request.dit ? SD_CACHE_EASYCACHE : SD_CACHE_DISABLED);
+                if (mode != SD_CACHE_DISABLED) {
+                    candidate.cache_mode   = mode;
+                    candidate.predicted_ms = predict(candidate);
+                }
+            }
+            if (candidate.predicted_ms > target && params.allow_tiny && request.has_tiny_vae) {
+                candidate.tiny_vae     = true;
+                candidate.predicted_ms = predict(candidate);
+            }
+            int min_steps = params.min_steps > 0 ? std::min(params.min_steps, request.steps) : std::max(1, request.steps / 2);
+            while (candidate.predicted_ms > target && candidate.steps > min_steps) {
+                candidate.steps--;
+                candidate.predicted_ms = predict(candidate);
+            }
+            *plan = candidate;
+            return true;
+        }
+
+    private:
+        struct Ema {
+            double value = 0.0;
+            int samples  = 0;
+        };
+
+        static void update(Ema& ema, double value) {
+            // the first samples carry more weight, so a warm-up run does
+            // not linger
+            double alpha = ema.samples < 4 ? 1.0 / (ema.samples + 1) : 0.25;
+            ema.value += alpha * (value - ema.value);
+            ema.samples++;
+        }
+
+        // with mutex_ held
+        double step_cost(bool cfg, int64_t pixels) const {
+            const std::map<int64_t, Ema>& costs = step_ms_[cfg ? 1 : 0];
+            auto exact                          = costs.find(pixels);
+            if (exact != costs.end()) {
+                return exact->second.value;
+            }
+            const Ema* closest   = nullptr;
+            int64_t closest_size = 0;
+            for (const auto& [size, ema] : costs) {
+                if (closest == nullptr || std::llabs(size - pixels) < std::llabs(closest_size - pixels)) {
+                    closest      = &ema;
+                    closest_size = size;
+                }
+            }
+            return closest != nullptr ? closest->value * pixels / static_cast<double>(closest_size) : 0.0;
+        }
+
+        double trunc_ratio(bool cfg) const {
+            if (!cfg) {
+                return 1.0;
+            }
+            // a third of the steps at half cost until measured
+            return trunc_ratio_.samples > 0 ? trunc_ratio_.value : 5.0 / 6.0;
+        }
+
+        double cache_ratio(sd_cache_mode_t mode) const {
+            if (mode == SD_CACHE_DISABLED) {
+                return 1.0;
+            }
+            auto it = cache_ratio_.find(mode);
+            // caches skip about a third of the steps at their defaults
+            return it != cache_ratio_.end() ? it->second.value : 2.0 / 3.0;
+        }
+
+        mutable std::mutex mutex_;
+        std::map<int64_t, Ema> step_ms_[2];  // by pixels, without and with CFG
+        std::map<sd_cache_mode_t, Ema> cache_ratio_;
+        Ema trunc_ratio_;
+        Ema text_encode_ms_;
+        Ema decode_ms_per_mpix_[2];  // full and tiny VAE
+    };
+
+}  // namespace sd::latency_slo
+
+#endif  // __SD_RUNTIME_LATENCY_SLO_HPP__
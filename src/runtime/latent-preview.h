@@ -314,56 +314,59 @@ void preview_latent_video(uint8_t* buffer, ggml_tensor* latents, const float (*l
     uint32_t unpatched_dim = dim / (patch_size * patch_size);
 
     for (uint32_t k = 0; k < frames; k++) {
-        for (uint32_t rgb_x = 0; rgb_x < rgb_width; rgb_x++) {
-            for (uint32_t rgb_y = 0; rgb_y < rgb_height; rgb_y++) {
-                int latent_x = rgb_x / patch_size;
-                int latent_y = rgb_y / patch_size;
+        // columns write disjoint pixels
+        sd::parallel_for(rgb_width, 16, [&](int64_t x_begin, int64_t x_end) {
+            for (uint32_t rgb_x = static_cast<uint32_t>(x_begin); rgb_x < static_cast<uint32_t>(x_end); rgb_x++) {
+                for (uint32_t rgb_y = 0; rgb_y < rgb_height; rgb_y++) {
+                    int latent_x = rgb_x / patch_size;
+                    int latent_y = rgb_y / patch_size;
 
-                int channel_offset = 0;
-                if (patch_size > 1) {
-                    channel_offset = ((rgb_y % patch_size) * patch_size + (rgb_x % patch_size));
-                }
+                    int channel_offset = 0;
+                    if (patch_size > 1) {
+                        channel_offset = ((rgb_y % patch_size) * patch_size + (rgb_x % patch_size));
+                    }
 
-                size_t latent_id = (latent_x * latents->nb[0] + latent_y * latents->nb[1] + k * latents->nb[2]);
+                    size_t latent_id = (latent_x * latents->nb[0] + latent_y * latents->nb[1] + k * latents->nb[2]);
 
-                // should be incremented by 1 for each pixel
-                size_t pixel_id = k * rgb_width * rgb_height + rgb_y * rgb_width + rgb_x;
+                    // should be incremented by 1 for each pixel
+                    size_t pixel_id = k * rgb_width * rgb_height + rgb_y * rgb_width + rgb_x;
 
-                float r = 0, g = 0, b = 0;
-                if (latent_rgb_proj != nullptr) {
-                    for (uint32_t d = 0; d < unpatched_dim; d++) {
-                        float value = *(float*)((char*)latents->data + latent_id + (d * patch_size * patch_size + channel_offset) * latents->nb[ggml_n_dims(latents) - 1]);
-                        r += value * latent_rgb_proj[d][0];
-                        g += value * latent_rgb_proj[d][1];
-                        b += value * latent_rgb_proj[d][2];
+                    float r = 0, g = 0, b = 0;
+                    if (latent_rgb_proj != nullptr) {
+                        for (uint32_t d = 0; d < unpatched_dim; d++) {
+                            float value = *(float*)((char*)latents->data + latent_id + (d * patch_size * patch_size + channel_offset) * latents->nb[ggml_n_dims(latents) - 1]);
+                            r += value * latent_rgb_proj[d][0];
+                            g += value * latent_rgb_proj[d][1];
+                            b += value * latent_rgb_proj[d][2];
+                        }
+                    } else {
+                        // interpret first 3 channels as RGB
+                        r = *(float*)((char*)latents->data + latent_id + 0 * latents->nb[ggml_n_dims(latents) - 1]);
+                        g = *(float*)((char*)latents->data + latent_id + 1 * latents->nb[ggml_n_dims(latents) - 1]);
+                        b = *(float*)((char*)latents->data + latent_id + 2 * latents->nb[ggml_n_dims(latents) - 1]);
                     }
-                } else {
-                    // interpret first 3 channels as RGB
-                    r = *(float*)((char*)latents->data + latent_id + 0 * latents->nb[ggml_n_dims(latents) - 1]);
-                    g = *(float*)((char*)latents->data + latent_id + 1 * latents->nb[ggml_n_dims(latents) - 1]);
-                    b = *(float*)((char*)latents->data + latent_id + 2 * latents->nb[ggml_n_dims(latents) - 1]);
-                }
-                if (latent_rgb_bias != nullptr) {
-                    // bias
-                    r += latent_rgb_bias[0];
-                    g += latent_rgb_bias[1];
-                    b += latent_rgb_bias[2];
-                }
-                // change range
-                r = r * .5f + .5f;
-                g = g * .5f + .5f;
-                b = b * .5f + .5f;
+                    if (latent_rgb_bias != nullptr) {
+                        // bias
+                        r += latent_rgb_bias[0];
+                        g += latent_rgb_bias[1];
+                        b += latent_rgb_bias[2];
+                    }
+                    // change range
+                    r = r * .5f + .5f;
+                    g = g * .5f + .5f;
+                    b = b * .5f + .5f;
 
-                // clamp rgb values to [0,1] range
-                r = r >= 0 ? r <= 1 ? r : 1 : 0;
-                g = g >= 0 ? g <= 1 ? g : 1 : 0;
-                b = b >= 0 ? b <= 1 ? b : 1 : 0;
+                    // clamp rgb values to [0,1] range
+                    r = r >= 0 ? r <= 1 ? r : 1 : 0;
+                    g = g >= 0 ? g <= 1 ? g : 1 : 0;
+                    b = b >= 0 ? b <= 1 ? b : 1 : 0;
 
-                buffer[pixel_id * 3 + 0] = (uint8_t)(r * 255);
-                buffer[pixel_id * 3 + 1] = (uint8_t)(g * 255);
-                buffer[pixel_id * 3 + 2] = (uint8_t)(b * 255);
+                    buffer[pixel_id * 3 + 0] = (uint8_t)(r * 255);
+                    buffer[pixel_id * 3 + 1] = (uint8_t)(g * 255);
+                    buffer[pixel_id * 3 + 2] = (uint8_t)(b * 255);
+                }
             }
-        }
+        });
     }
 }
 
@@ -383,50 +386,53 @@ void preview_latent_video(uint8_t* buffer, const sd::Tensor<float>& latents, con
     uint32_t unpatched_dim = dim / (patch_size * patch_size);
 
     for (uint32_t k = 0; k < frames; k++) {
-        for (uint32_t rgb_x = 0; rgb_x < rgb_width; rgb_x++) {
-            for (uint32_t rgb_y = 0; rgb_y < rgb_height; rgb_y++) {
-                uint32_t latent_x = rgb_x / patch_size;
-                uint32_t latent_y = rgb_y / patch_size;
+        // columns write disjoint pixels
+        sd::parallel_for(rgb_width, 16, [&](int64_t x_begin, int64_t x_end) {
+            for (uint32_t rgb_x = static_cast<uint32_t>(x_begin); rgb_x < static_cast<uint32_t>(x_end); rgb_x++) {
+                for (uint32_t rgb_y = 0; rgb_y < rgb_height; rgb_y++) {
+                    uint32_t latent_x = rgb_x / patch_size;
+                    uint32_t latent_y = rgb_y / patch_size;
 
-                uint32_t channel_offset = 0;
-                if (patch_size > 1) {
-                    channel_offset = ((rgb_y % patch_size) * patch_size + (rgb_x % patch_size));
-                }
+                    uint32_t channel_offset = 0;
+                    if (patch_size > 1) {
+                        channel_offset = ((rgb_y % patch_size) * patch_size + (rgb_x % patch_size));
+                    }
 
-                size_t pixel_id   = k * rgb_width * rgb_height + rgb_y * rgb_width + rgb_x;
-                auto latent_value = [&](uint32_t latent_channel) -> float {
-                    return is_video
-                               ? latents.values()[latent_x + latent_width * (latent_y + latent_height * (k + frames * latent_channel))]
-                               : latents.values()[latent_x + latent_width * (latent_y + latent_height * latent_channel)];
-                };
+                    size_t pixel_id   = k * rgb_width * rgb_height + rgb_y * rgb_width + rgb_x;
+                    auto latent_value = [&](uint32_t latent_channel) -> float {
+                        return is_video
+                                   ? latents.values()[latent_x + latent_width * (latent_y + latent_height * (k + frames * latent_channel))]
+                                   : latents.values()[latent_x + latent_width * (latent_y + latent_height * latent_channel)];
+                    };
 
-                float r = 0.f, g = 0.f, b = 0.f;
-                if (latent_rgb_proj != nullptr) {
-                    for (uint32_t d = 0; d < unpatched_dim; d++) {
-                        uint32_t latent_channel = d * patch_size * patch_size + channel_offset;
-                        float value             = latent_value(latent_channel);
-                        r += value * latent_rgb_proj[d][0];
-                        g += value * latent_rgb_proj[d][1];
-                        b += value * latent_rgb_proj[d][2];
+                    float r = 0.f, g = 0.f, b = 0.f;
+                    if (latent_rgb_proj != nullptr) {
+                        for (uint32_t d = 0; d < unpatched_dim; d++) {
+                            uint32_t latent_channel = d * patch_size * patch_size + channel_offset;
+                            float value             = latent_value(latent_channel);
+                            r += value * latent_rgb_proj[d][0];
+                            g += value * latent_rgb_proj[d][1];
+                            b += value * latent_rgb_proj[d][2];
+                        }
+                    } else {
+                        r = latent_value(0);
+                        g = latent_value(1);
+                        b = latent_value(2);
                     }
-                } else {
-                    r = latent_value(0);
-                    g = latent_value(1);
-                    b = latent_value(2);
-                }
-                if (latent_rgb_bias != nullptr) {
-                    r += latent_rgb_bias[0];
-                    g += latent_rgb_bias[1];
-                    b += latent_rgb_bias[2];
-                }
-                r = std::min(1.0f, std::max(0.0f, r * .5f + .5f));
-                g = std::min(1.0f, std::max(0.0f, g * .5f + .5f));
-                b = std::min(1.0f, std::max(0.0f, b * .5f + .5f));
+                    if (latent_rgb_bias != nullptr) {
+                        r += latent_rgb_bias[0];
+                        g += latent_rgb_bias[1];
+                        b += latent_rgb_bias[2];
+                    }
+                    r = std::min(1.0f, std::max(0.0f, r * .5f + .5f));
+                    g = std::min(1.0f, std::max(0.0f, g * .5f + .5f));
+                    b = std::min(1.0f, std::max(0.0f, b * .5f + .5f));
 
-                buffer[pixel_id * 3 + 0] = (uint8_t)(r * 255);
-                buffer[pixel_id * 3 + 1] = (uint8_t)(g * 255);
-                buffer[pixel_id * 3 + 2] = (uint8_t)(b * 255);
+                    buffer[pixel_id * 3 + 0] = (uint8_t)(r * 255);
+                    buffer[pixel_id * 3 + 1] = (uint8_t)(g * 255);
+                    buffer[pixel_id * 3 + 2] = (uint8_t)(b * 255);
+                }
             }
-        }
+        });
     }
 }
@@ -0,0 +1,39 @@
+#ifndef __SD_RUNTIME_MASKED_COMPUTE_HPP__
+#define __SD_RUNTIME_MASKED_COMPUTE_HPP__
+
+#include "core/util.h"
+
+namespace sd::masked_compute {
+
+    // Masked-token compute for DiT inpainting, set through the extra sample
+    // arg mask_border (context tokens kept around the mask, -1 = off). The
+    // latent outside the denoise mask is restored after every step, so the
+    // transformer only runs the image tokens within mask_border tokens of
+    // the mask; see MaskedTokenPlan.
+    struct Params {
+        int border = -1;
+
+        bool enabled() const {
+            return border >= 0;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "mask_border") {
+                continue;
+            }
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || parsed < -1) {
+                LOG_WARN("ignoring invalid masked compute extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.border = parsed;
+        }
+        return params;
+    }
+
+}  // namespace sd::masked_compute
+
+#endif  // __SD_RUNTIME_MASKED_COMPUTE_HPP__
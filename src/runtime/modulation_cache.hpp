@@ -0,0 +1,35 @@
+#ifndef __SD_RUNTIME_MODULATION_CACHE_HPP__
+#define __SD_RUNTIME_MODULATION_CACHE_HPP__
+
+#include "core/util.h"
+
+namespace sd::modulation_cache {
+
+    // Precomputed DiT modulation, set through the extra sample arg
+    // mod_cache=1. The block modulation of Flux, Qwen-Image and MMDiT only
+    // depends on the timestep, the guidance and the pooled text vector, so
+    // it is computed for every timestep of the schedule in one batched
+    // graph and each step reads its row; see ModulationCache.
+    struct Params {
+        bool enabled = false;
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "mod_cache") {
+                continue;
+            }
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || (parsed != 0 && parsed != 1)) {
+                LOG_WARN("ignoring invalid modulation cache extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.enabled = parsed == 1;
+        }
+        return params;
+    }
+
+}  // namespace sd::modulation_cache
+
+#endif  // __SD_RUNTIME_MODULATION_CACHE_HPP__
@@ -1,10 +1,13 @@
 #ifndef __SD_RUNTIME_PREPROCESSING_HPP__
 #define __SD_RUNTIME_PREPROCESSING_HPP__
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <vector>
 
 #include "core/ggml_extend.hpp"
+#include "core/task_pool.h"
 
 #define M_PI_ 3.14159265358979323846f
 
@@ -24,13 +27,10 @@ static inline void preprocessing_set_4d(sd::Tensor<float>& tensor, float value,
     tensor.values()[static_cast<size_t>(preprocessing_offset_4d(tensor, i0, i1, i2, i3))] = value;
 }
 
+// Clamped to [0, 1] with min/max rather than branches so the conversion
+// loops vectorize; NaN maps to 0.
 static inline uint8_t preprocessing_float_to_u8(float value) {
-    if (value <= 0.0f) {
-        return 0;
-    }
-    if (value >= 1.0f) {
-        return 255;
-    }
+    value = std::min(1.0f, std::max(0.0f, value));
     return static_cast<uint8_t>(value * 255.0f + 0.5f);
 }
 
@@ -45,52 +45,39 @@ static inline void preprocessing_tensor_frame_to_sd_image(const sd::Tensor<float
     const size_t pixels = static_cast<size_t>(width) * static_cast<size_t>(height);
     const float* src    = tensor.data();
 
+    // [W, H, C, T] frames are whole blocks; [W, H, T, C, N] frames are one
+    // plane out of every channel block.
+    size_t channel_stride  = pixels;
+    const float* frame_ptr = nullptr;
     if (shape.size() == 4) {
         GGML_ASSERT(frame_index >= 0 && frame_index < shape[3]);
-        const size_t frame_stride = pixels * static_cast<size_t>(channel);
-        const float* frame_ptr    = src + static_cast<size_t>(frame_index) * frame_stride;
+        frame_ptr = src + static_cast<size_t>(frame_index) * pixels * static_cast<size_t>(channel);
+    } else {
+        GGML_ASSERT(frame_index >= 0 && frame_index < shape[2]);
+        channel_stride = pixels * static_cast<size_t>(shape[2]);
+        frame_ptr      = src + static_cast<size_t>(frame_index) * pixels;
+    }
+
+    sd::tensor_parallel_for(static_cast<int64_t>(pixels), [&](int64_t begin, int64_t end) {
         if (channel == 3) {
             const float* c0 = frame_ptr;
-            const float* c1 = frame_ptr + pixels;
-            const float* c2 = frame_ptr + pixels * 2;
-            for (size_t i = 0; i < pixels; ++i) {
+            const float* c1 = frame_ptr + channel_stride;
+            const float* c2 = frame_ptr + channel_stride * 2;
+            for (int64_t i = begin; i < end; ++i) {
                 image_data[i * 3 + 0] = preprocessing_float_to_u8(c0[i]);
                 image_data[i * 3 + 1] = preprocessing_float_to_u8(c1[i]);
                 image_data[i * 3 + 2] = preprocessing_float_to_u8(c2[i]);
             }
             return;
         }
-
-        for (size_t i = 0; i < pixels; ++i) {
-            for (int c = 0; c < channel; ++c) {
-                image_data[i * static_cast<size_t>(channel) + static_cast<size_t>(c)] =
-                    preprocessing_float_to_u8(frame_ptr[i + pixels * static_cast<size_t>(c)]);
-            }
-        }
-        return;
-    }
-
-    GGML_ASSERT(frame_index >= 0 && frame_index < shape[2]);
-    const size_t channel_stride = pixels * static_cast<size_t>(shape[2]);
-    const float* frame_ptr      = src + static_cast<size_t>(frame_index) * pixels;
-    if (channel == 3) {
-        const float* c0 = frame_ptr;
-        const float* c1 = frame_ptr + channel_stride;
-        const float* c2 = frame_ptr + channel_stride * 2;
-        for (size_t i = 0; i < pixels; ++i) {
-            image_data[i * 3 + 0] = preprocessing_float_to_u8(c0[i]);
-            image_data[i * 3 + 1] = preprocessing_float_to_u8(c1[i]);
-            image_data[i * 3 + 2] = preprocessing_float_to_u8(c2[i]);
-        }
-        return;
-    }
-
-    for (size_t i = 0; i < pixels; ++i) {
         for (int c = 0; c < channel; ++c) {
-            image_data[i * static_cast<size_t>(channel) + static_cast<size_t>(c)] =
-                preprocessing_float_to_u8(frame_ptr[i + channel_stride * static_cast<size_t>(c)]);
+            const float* plane = frame_ptr + channel_stride * static_cast<size_t>(c);
+            for (int64_t i = begin; i < end; ++i) {
+                image_data[static_cast<size_t>(i) * static_cast<size_t>(channel) + static_cast<size_t>(c)] =
+                    preprocessing_float_to_u8(plane[i]);
+            }
         }
-    }
+    });
 }
 
 static inline sd::Tensor<float> sd_image_to_preprocessing_tensor(sd_image_t image) {
@@ -111,223 +98,263 @@ static inline void preprocessing_tensor_to_sd_image(const sd::Tensor<float>& ten
     preprocessing_tensor_frame_to_sd_image(tensor, 0, image_data);
 }
 
-static inline sd::Tensor<float> gaussian_kernel_tensor(int kernel_size) {
-    sd::Tensor<float> kernel({kernel_size, kernel_size, 1, 1});
-    int ks_mid   = kernel_size / 2;
-    float sigma  = 1.4f;
-    float normal = 1.f / (2.0f * M_PI_ * std::pow(sigma, 2.0f));
-    for (int y = 0; y < kernel_size; ++y) {
-        float gx = static_cast<float>(-ks_mid + y);
-        for (int x = 0; x < kernel_size; ++x) {
-            float gy = static_cast<float>(-ks_mid + x);
-            float k  = std::exp(-((gx * gx + gy * gy) / (2.0f * std::pow(sigma, 2.0f)))) * normal;
-            preprocessing_set_4d(kernel, k, x, y, 0, 0);
-        }
+// The canny kernels below work on single-channel row-major planes and run
+// row-parallel on the task pool. Every output row depends only on rows of the
+// previous stage, except for the final hysteresis pass.
+static constexpr int64_t CANNY_MIN_ROWS_PER_CHUNK = 16;
+
+// 1-D factor of the 5x5 gaussian (sigma 1.4); the 2-D kernel is
+// normal * g[x] * g[y], so the blur runs as a horizontal and a vertical pass.
+static inline void gaussian_kernel_1d(float g[5], float* normal) {
+    const float sigma = 1.4f;
+    for (int i = 0; i < 5; ++i) {
+        float d = static_cast<float>(i - 2);
+        g[i]    = std::exp(-(d * d) / (2.0f * sigma * sigma));
     }
-    return kernel;
+    *normal = 1.f / (2.0f * M_PI_ * sigma * sigma);
 }
 
-static inline sd::Tensor<float> convolve_tensor(const sd::Tensor<float>& input, const sd::Tensor<float>& kernel, int padding) {
-    GGML_ASSERT(input.dim() == 4);
-    GGML_ASSERT(kernel.dim() == 4);
-    GGML_ASSERT(input.shape()[3] == 1);
-    GGML_ASSERT(kernel.shape()[2] == 1);
-    GGML_ASSERT(kernel.shape()[3] == 1);
-
-    sd::Tensor<float> output(input.shape());
-    int64_t width    = input.shape()[0];
-    int64_t height   = input.shape()[1];
-    int64_t channels = input.shape()[2];
-    int64_t kernel_w = kernel.shape()[0];
-    int64_t kernel_h = kernel.shape()[1];
+static inline std::vector<float> grayscale_plane(sd_image_t image) {
+    const int64_t width  = image.width;
+    const int64_t height = image.height;
+    std::vector<float> gray(static_cast<size_t>(width * height));
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t y = y0; y < y1; ++y) {
+            const uint8_t* src = image.data + y * width * image.channel;
+            float* dst         = gray.data() + y * width;
+            for (int64_t x = 0; x < width; ++x) {
+                float r = src[x * image.channel + 0] / 255.f;
+                float g = src[x * image.channel + 1] / 255.f;
+                float b = src[x * image.channel + 2] / 255.f;
+                dst[x]  = 0.2989f * r + 0.5870f * g + 0.1140f * b;
+            }
+        }
+    });
+    return gray;
+}
 
-    for (int64_t c = 0; c < channels; ++c) {
-        for (int64_t y = 0; y < height; ++y) {
+// Zero-padded 5x5 gaussian blur; the result has a one pixel zero border
+// (width + 2 by height + 2) so the sobel pass reads it without bounds checks.
+static inline std::vector<float> gaussian_blur_padded(const std::vector<float>& src, int64_t width, int64_t height) {
+    float g[5];
+    float normal = 0.0f;
+    gaussian_kernel_1d(g, &normal);
+
+    std::vector<float> horizontal(src.size());
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t y = y0; y < y1; ++y) {
+            const float* in = src.data() + y * width;
+            float* out      = horizontal.data() + y * width;
             for (int64_t x = 0; x < width; ++x) {
+                if (x >= 2 && x + 2 < width) {
+                    out[x] = g[0] * in[x - 2] + g[1] * in[x - 1] + g[2] * in[x] + g[3] * in[x + 1] + g[4] * in[x + 2];
+                    continue;
+                }
                 float sum = 0.0f;
-                for (int64_t ky = 0; ky < kernel_h; ++ky) {
-                    int64_t iy = y + ky - padding;
-                    if (iy < 0 || iy >= height) {
-                        continue;
-                    }
-                    for (int64_t kx = 0; kx < kernel_w; ++kx) {
-                        int64_t ix = x + kx - padding;
-                        if (ix < 0 || ix >= width) {
-                            continue;
-                        }
-                        sum += preprocessing_get_4d(input, ix, iy, c, 0) * preprocessing_get_4d(kernel, kx, ky, 0, 0);
+                for (int64_t k = 0; k < 5; ++k) {
+                    int64_t ix = x + k - 2;
+                    if (ix >= 0 && ix < width) {
+                        sum += g[k] * in[ix];
                     }
                 }
-                preprocessing_set_4d(output, sum, x, y, c, 0);
+                out[x] = sum;
             }
         }
-    }
-    return output;
-}
-
-static inline sd::Tensor<float> grayscale_tensor(const sd::Tensor<float>& rgb_img) {
-    GGML_ASSERT(rgb_img.dim() == 4);
-    GGML_ASSERT(rgb_img.shape()[2] >= 3);
-    sd::Tensor<float> grayscale({rgb_img.shape()[0], rgb_img.shape()[1], 1, rgb_img.shape()[3]});
-    for (int64_t iy = 0; iy < rgb_img.shape()[1]; ++iy) {
-        for (int64_t ix = 0; ix < rgb_img.shape()[0]; ++ix) {
-            float r    = preprocessing_get_4d(rgb_img, ix, iy, 0, 0);
-            float g    = preprocessing_get_4d(rgb_img, ix, iy, 1, 0);
-            float b    = preprocessing_get_4d(rgb_img, ix, iy, 2, 0);
-            float gray = 0.2989f * r + 0.5870f * g + 0.1140f * b;
-            preprocessing_set_4d(grayscale, gray, ix, iy, 0, 0);
+    });
+
+    const int64_t padded_width = width + 2;
+    std::vector<float> blurred(static_cast<size_t>(padded_width * (height + 2)), 0.0f);
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t y = y0; y < y1; ++y) {
+            float* out = blurred.data() + (y + 1) * padded_width + 1;
+            for (int64_t k = 0; k < 5; ++k) {
+                int64_t iy = y + k - 2;
+                if (iy < 0 || iy >= height) {
+                    continue;
+                }
+                const float* in = horizontal.data() + iy * width;
+                const float w   = g[k];
+                for (int64_t x = 0; x < width; ++x) {
+                    out[x] += w * in[x];
+                }
+            }
+            for (int64_t x = 0; x < width; ++x) {
+                out[x] *= normal;
+            }
         }
-    }
-    return grayscale;
-}
-
-static inline sd::Tensor<float> tensor_hypot(const sd::Tensor<float>& x, const sd::Tensor<float>& y) {
-    sd::tensor_check_same_shape(x, y);
-    sd::Tensor<float> out(x.shape());
-    for (int64_t i = 0; i < out.numel(); ++i) {
-        out[i] = std::sqrt(x[i] * x[i] + y[i] * y[i]);
-    }
-    return out;
+    });
+    return blurred;
 }
 
-static inline sd::Tensor<float> tensor_arctan2(const sd::Tensor<float>& x, const sd::Tensor<float>& y) {
-    sd::tensor_check_same_shape(x, y);
-    sd::Tensor<float> out(x.shape());
-    for (int64_t i = 0; i < out.numel(); ++i) {
-        out[i] = std::atan2(y[i], x[i]);
-    }
-    return out;
+// Sobel gradient magnitude and direction (atan2(gy, gx)) of a zero-padded
+// plane; row_max receives the largest magnitude of every row.
+static inline void sobel_planes(const std::vector<float>& padded,
+                                int64_t width,
+                                int64_t height,
+                                std::vector<float>* magnitude,
+                                std::vector<float>* direction,
+                                std::vector<float>* row_max) {
+    const int64_t padded_width = width + 2;
+    magnitude->resize(static_cast<size_t>(width * height));
+    direction->resize(static_cast<size_t>(width * height));
+    row_max->assign(static_cast<size_t>(height), 0.0f);
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        std::vector<float> gx(static_cast<size_t>(width));
+        std::vector<float> gy(static_cast<size_t>(width));
+        for (int64_t y = y0; y < y1; ++y) {
+            const float* above = padded.data() + y * padded_width + 1;
+            const float* row   = above + padded_width;
+            const float* below = row + padded_width;
+            for (int64_t x = 0; x < width; ++x) {
+                // Summed left to right in kernel order, as the 3x3 convolution did.
+                gx[x] = -above[x - 1] + above[x + 1] - 2.0f * row[x - 1] + 2.0f * row[x + 1] - below[x - 1] + below[x + 1];
+                gy[x] = above[x - 1] + 2.0f * above[x] + above[x + 1] - below[x - 1] - 2.0f * below[x] - below[x + 1];
+            }
+            float* mag  = magnitude->data() + y * width;
+            float* dir  = direction->data() + y * width;
+            float max_v = -std::numeric_limits<float>::infinity();
+            for (int64_t x = 0; x < width; ++x) {
+                mag[x] = std::sqrt(gx[x] * gx[x] + gy[x] * gy[x]);
+                max_v  = std::max(max_v, mag[x]);
+            }
+            for (int64_t x = 0; x < width; ++x) {
+                dir[x] = std::atan2(gy[x], gx[x]);
+            }
+            (*row_max)[y] = max_v;
+        }
+    });
 }
 
-static inline void normalize_tensor(sd::Tensor<float>* g) {
-    GGML_ASSERT(g != nullptr);
-    if (g->empty()) {
-        return;
-    }
+static inline float plane_max(const std::vector<float>& row_max) {
     float max_value = -std::numeric_limits<float>::infinity();
-    for (int64_t i = 0; i < g->numel(); ++i) {
-        max_value = std::max(max_value, (*g)[i]);
-    }
-    if (max_value == 0.0f || !std::isfinite(max_value)) {
-        return;
+    for (float v : row_max) {
+        max_value = std::max(max_value, v);
     }
-    *g *= (1.0f / max_value);
+    return max_value;
 }
 
-static inline sd::Tensor<float> non_max_supression(const sd::Tensor<float>& G, const sd::Tensor<float>& D) {
-    GGML_ASSERT(G.shape() == D.shape());
-    sd::Tensor<float> result = sd::Tensor<float>::zeros(G.shape());
-    for (int64_t iy = 1; iy < result.shape()[1] - 1; ++iy) {
-        for (int64_t ix = 1; ix < result.shape()[0] - 1; ++ix) {
-            float angle = preprocessing_get_4d(D, ix, iy, 0, 0) * 180.0f / M_PI_;
-            angle       = angle < 0.0f ? angle + 180.0f : angle;
-            float q     = 1.0f;
-            float r     = 1.0f;
+// Non-maximum suppression of G scaled by `scale`, the angle bins kept as the
+// original implementation had them.
+static inline std::vector<float> non_max_supression(const std::vector<float>& G,
+                                                    const std::vector<float>& D,
+                                                    int64_t width,
+                                                    int64_t height,
+                                                    float scale,
+                                                    std::vector<float>* row_max) {
+    std::vector<float> result(G.size(), 0.0f);
+    row_max->assign(static_cast<size_t>(height), 0.0f);
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t iy = std::max<int64_t>(y0, 1); iy < std::min<int64_t>(y1, height - 1); ++iy) {
+            float max_v = 0.0f;
+            for (int64_t ix = 1; ix < width - 1; ++ix) {
+                const int64_t i = iy * width + ix;
+                float angle     = D[i] * 180.0f / M_PI_;
+                angle           = angle < 0.0f ? angle + 180.0f : angle;
+                float q         = 1.0f;
+                float r         = 1.0f;
+
+                if ((0 >= angle && angle < 22.5f) || (157.5f >= angle && angle <= 180.0f)) {
+                    q = G[i + width] * scale;
+                    r = G[i - width] * scale;
+                } else if (22.5f >= angle && angle < 67.5f) {
+                    q = G[i - width + 1] * scale;
+                    r = G[i + width - 1] * scale;
+                } else if (67.5f >= angle && angle < 112.5f) {
+                    q = G[i + 1] * scale;
+                    r = G[i - 1] * scale;
+                } else if (112.5f >= angle && angle < 157.5f) {
+                    q = G[i - width - 1] * scale;
+                    r = G[i + width + 1] * scale;
+                }
 
-            if ((0 >= angle && angle < 22.5f) || (157.5f >= angle && angle <= 180.0f)) {
-                q = preprocessing_get_4d(G, ix, iy + 1, 0, 0);
-                r = preprocessing_get_4d(G, ix, iy - 1, 0, 0);
-            } else if (22.5f >= angle && angle < 67.5f) {
-                q = preprocessing_get_4d(G, ix + 1, iy - 1, 0, 0);
-                r = preprocessing_get_4d(G, ix - 1, iy + 1, 0, 0);
-            } else if (67.5f >= angle && angle < 112.5f) {
-                q = preprocessing_get_4d(G, ix + 1, iy, 0, 0);
-                r = preprocessing_get_4d(G, ix - 1, iy, 0, 0);
-            } else if (112.5f >= angle && angle < 157.5f) {
-                q = preprocessing_get_4d(G, ix - 1, iy - 1, 0, 0);
-                r = preprocessing_get_4d(G, ix + 1, iy + 1, 0, 0);
+                float cur = G[i] * scale;
+                result[i] = (cur >= q && cur >= r) ? cur : 0.0f;
+                max_v     = std::max(max_v, result[i]);
             }
-
-            float cur = preprocessing_get_4d(G, ix, iy, 0, 0);
-            preprocessing_set_4d(result, (cur >= q && cur >= r) ? cur : 0.0f, ix, iy, 0, 0);
+            (*row_max)[iy] = max_v;
         }
-    }
+    });
     return result;
 }
 
-static inline void threshold_hystersis(sd::Tensor<float>* img, float high_threshold, float low_threshold, float weak, float strong) {
-    GGML_ASSERT(img != nullptr);
-    if (img->empty()) {
-        return;
-    }
-    float max_value = -std::numeric_limits<float>::infinity();
-    for (int64_t i = 0; i < img->numel(); ++i) {
-        max_value = std::max(max_value, (*img)[i]);
-    }
-
+static inline void threshold_hystersis(std::vector<float>* img,
+                                       int64_t width,
+                                       int64_t height,
+                                       float max_value,
+                                       float high_threshold,
+                                       float low_threshold,
+                                       float weak,
+                                       float strong) {
     float ht = max_value * high_threshold;
     float lt = ht * low_threshold;
-    for (int64_t i = 0; i < img->numel(); ++i) {
-        float img_v = (*img)[i];
-        if (img_v >= ht) {
-            (*img)[i] = strong;
-        } else if (img_v <= ht && img_v >= lt) {
-            (*img)[i] = weak;
-        }
-    }
-
-    for (int64_t iy = 0; iy < img->shape()[1]; ++iy) {
-        for (int64_t ix = 0; ix < img->shape()[0]; ++ix) {
-            if (!(ix >= 3 && ix <= img->shape()[0] - 3 && iy >= 3 && iy <= img->shape()[1] - 3)) {
-                preprocessing_set_4d(*img, 0.0f, ix, iy, 0, 0);
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t iy = y0; iy < y1; ++iy) {
+            float* row = img->data() + iy * width;
+            for (int64_t ix = 0; ix < width; ++ix) {
+                if (!(ix >= 3 && ix <= width - 3 && iy >= 3 && iy <= height - 3)) {
+                    row[ix] = 0.0f;
+                } else if (row[ix] >= ht) {
+                    row[ix] = strong;
+                } else if (row[ix] <= ht && row[ix] >= lt) {
+                    row[ix] = weak;
+                }
             }
         }
-    }
-
-    for (int64_t iy = 1; iy < img->shape()[1] - 1; ++iy) {
-        for (int64_t ix = 1; ix < img->shape()[0] - 1; ++ix) {
-            float imd_v = preprocessing_get_4d(*img, ix, iy, 0, 0);
-            if (imd_v == weak) {
+    });
+
+    // Serial on purpose: a weak pixel sees the already resolved pixels above
+    // and to its left, so the row order is part of the result.
+    float* data = img->data();
+    for (int64_t iy = 1; iy < height - 1; ++iy) {
+        for (int64_t ix = 1; ix < width - 1; ++ix) {
+            const int64_t i = iy * width + ix;
+            if (data[i] == weak) {
                 bool has_strong_neighbor =
-                    preprocessing_get_4d(*img, ix + 1, iy - 1, 0, 0) == strong ||
-                    preprocessing_get_4d(*img, ix + 1, iy, 0, 0) == strong ||
-                    preprocessing_get_4d(*img, ix, iy - 1, 0, 0) == strong ||
-                    preprocessing_get_4d(*img, ix, iy + 1, 0, 0) == strong ||
-                    preprocessing_get_4d(*img, ix - 1, iy - 1, 0, 0) == strong ||
-                    preprocessing_get_4d(*img, ix - 1, iy, 0, 0) == strong;
-                preprocessing_set_4d(*img, has_strong_neighbor ? strong : 0.0f, ix, iy, 0, 0);
+                    data[i - width + 1] == strong ||
+                    data[i + 1] == strong ||
+                    data[i - width] == strong ||
+                    data[i + width] == strong ||
+                    data[i - width - 1] == strong ||
+                    data[i - 1] == strong;
+                data[i] = has_strong_neighbor ? strong : 0.0f;
             }
         }
     }
 }
 
 bool preprocess_canny(sd_image_t img, float high_threshold, float low_threshold, float weak, float strong, bool inverse) {
-    float kX[9] = {
-        -1, 0, 1,
-        -2, 0, 2,
-        -1, 0, 1};
-
-    float kY[9] = {
-        1, 2, 1,
-        0, 0, 0,
-        -1, -2, -1};
-
-    sd::Tensor<float> gkernel = gaussian_kernel_tensor(5);
-    sd::Tensor<float> sf_kx({3, 3, 1, 1}, std::vector<float>(kX, kX + 9));
-    sd::Tensor<float> sf_ky({3, 3, 1, 1}, std::vector<float>(kY, kY + 9));
-
-    sd::Tensor<float> image      = sd_image_to_preprocessing_tensor(img);
-    sd::Tensor<float> image_gray = grayscale_tensor(image);
-    image_gray                   = convolve_tensor(image_gray, gkernel, 2);
-    sd::Tensor<float> iX         = convolve_tensor(image_gray, sf_kx, 1);
-    sd::Tensor<float> iY         = convolve_tensor(image_gray, sf_ky, 1);
-    sd::Tensor<float> G          = tensor_hypot(iX, iY);
-    normalize_tensor(&G);
-    sd::Tensor<float> theta = tensor_arctan2(iX, iY);
-    image_gray              = non_max_supression(G, theta);
-    threshold_hystersis(&image_gray, high_threshold, low_threshold, weak, strong);
-
-    for (uint32_t iy = 0; iy < img.height; ++iy) {
-        for (uint32_t ix = 0; ix < img.width; ++ix) {
-            float gray = preprocessing_get_4d(image_gray, ix, iy, 0, 0);
-            gray       = inverse ? 1.0f - gray : gray;
-            for (uint32_t c = 0; c < img.channel; ++c) {
-                preprocessing_set_4d(image, gray, ix, iy, c, 0);
+    if (img.data == nullptr || img.channel < 3 || img.width == 0 || img.height == 0) {
+        LOG_ERROR("canny preprocessing needs a non-empty RGB image");
+        return false;
+    }
+    sd::TaskPool::instance().reserve_threads(sd_get_num_physical_cores());
+
+    const int64_t width  = img.width;
+    const int64_t height = img.height;
+    std::vector<float> row_max;
+    std::vector<float> G;
+    std::vector<float> theta;
+    std::vector<float> blurred = gaussian_blur_padded(grayscale_plane(img), width, height);
+    sobel_planes(blurred, width, height, &G, &theta, &row_max);
+
+    float max_value          = plane_max(row_max);
+    float scale              = (max_value == 0.0f || !std::isfinite(max_value)) ? 1.0f : 1.0f / max_value;
+    std::vector<float> edges = non_max_supression(G, theta, width, height, scale, &row_max);
+    threshold_hystersis(&edges, width, height, plane_max(row_max), high_threshold, low_threshold, weak, strong);
+
+    sd::parallel_for(height, CANNY_MIN_ROWS_PER_CHUNK, [&](int64_t y0, int64_t y1) {
+        for (int64_t y = y0; y < y1; ++y) {
+            uint8_t* dst = img.data + y * width * img.channel;
+            for (int64_t x = 0; x < width; ++x) {
+                float gray    = edges[y * width + x];
+                gray          = inverse ? 1.0f - gray : gray;
+                uint8_t value = preprocessing_float_to_u8(gray);
+                for (uint32_t c = 0; c < img.channel; ++c) {
+                    dst[x * img.channel + c] = value;
+                }
             }
         }
-    }
-
-    preprocessing_tensor_to_sd_image(image, img.data);
+    });
     return true;
 }
 
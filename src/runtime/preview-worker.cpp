@@ -0,0 +1,59 @@
+#include "runtime/preview-worker.h"
+
+namespace sd_preview {
+
+    PreviewWorker::~PreviewWorker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_    = true;
+            pending_ = nullptr;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void PreviewWorker::submit(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending_) {
+                dropped_++;
+            }
+            pending_ = std::move(job);
+            if (!thread_.joinable()) {
+                thread_ = std::thread(&PreviewWorker::worker_loop, this);
+            }
+        }
+        cv_.notify_one();
+    }
+
+    uint64_t PreviewWorker::drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [this] { return !busy_ && !pending_; });
+        uint64_t dropped = dropped_;
+        dropped_         = 0;
+        return dropped;
+    }
+
+    void PreviewWorker::worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || pending_; });
+            if (stop_) {
+                return;
+            }
+            Job job  = std::move(pending_);
+            pending_ = nullptr;
+            busy_    = true;
+            lock.unlock();
+            job();
+            lock.lock();
+            busy_ = false;
+            if (!pending_) {
+                idle_cv_.notify_all();
+            }
+        }
+    }
+
+}  // namespace sd_preview
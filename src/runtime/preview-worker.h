@@ -0,0 +1,46 @@
+#ifndef __SD_RUNTIME_PREVIEW_WORKER_H__
+#define __SD_RUNTIME_PREVIEW_WORKER_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace sd_preview {
+
+    // Runs latent previews on a thread of its own so denoising steps never wait
+    // for them. At most one preview waits behind the running one: a newer
+    // request replaces it, so a worker that falls behind drops steps instead of
+    // queueing them.
+    class PreviewWorker {
+    public:
+        using Job = std::function<void()>;
+
+        PreviewWorker() = default;
+        ~PreviewWorker();
+
+        PreviewWorker(const PreviewWorker&)            = delete;
+        PreviewWorker& operator=(const PreviewWorker&) = delete;
+
+        void submit(Job job);
+        // Blocks until the running and the waiting preview are done. Returns
+        // how many previews were dropped since the last drain.
+        uint64_t drain();
+
+    private:
+        void worker_loop();
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::condition_variable idle_cv_;
+        std::thread thread_;
+        Job pending_;
+        bool busy_        = false;
+        bool stop_        = false;
+        uint64_t dropped_ = 0;
+    };
+
+}  // namespace sd_preview
+
+#endif  // __SD_RUNTIME_PREVIEW_WORKER_H__
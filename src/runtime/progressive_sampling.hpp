@@ -0,0 +1,87 @@
+#ifndef __SD_RUNTIME_PROGRESSIVE_SAMPLING_HPP__
+#define __SD_RUNTIME_PROGRESSIVE_SAMPLING_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "core/tensor.hpp"
+#include "core/util.h"
+
+namespace sd::progressive_sampling {
+
+    // Low resolution early steps for flow models, set through the extra
+    // sample args lowres_fraction (share of the steps, 0 = off) and
+    // lowres_factor (latent downscale, default 2). The first steps sample a
+    // latent downscaled by the factor, where every forward pass has 1/factor^2
+    // of the tokens. Their last denoised prediction is upscaled to the full
+    // latent and noised again to the sigma the schedule has reached, with the
+    // initial noise, and the remaining steps run at full resolution. High
+    // noise steps mostly settle the layout, so the fine detail still comes
+    // from the full resolution steps.
+    struct Params {
+        float fraction = 0.0f;
+        int factor     = 2;
+
+        bool enabled() const {
+            return fraction > 0.0f && factor > 1;
+        }
+
+        // steps of a steps-long schedule to sample at low resolution; at
+        // least the last one runs at full resolution
+        int lowres_steps(int steps) const {
+            if (!enabled() || steps < 2) {
+                return 0;
+            }
+            return std::clamp(static_cast<int>(std::lround(fraction * steps)), 0, steps - 1);
+        }
+
+        // latent: [W, H, C(, N)]; false when a side does not divide by the factor
+        bool can_downscale(const sd::Tensor<float>& latent) const {
+            return latent.dim() >= 2 &&
+                   latent.shape()[0] % factor == 0 && latent.shape()[1] % factor == 0 &&
+                   latent.shape()[0] / factor > 0 && latent.shape()[1] / factor > 0;
+        }
+
+        sd::Tensor<float> downscale(const sd::Tensor<float>& latent) const {
+            std::vector<int64_t> shape = latent.shape();
+            shape[0] /= factor;
+            shape[1] /= factor;
+            return sd::ops::interpolate(latent, shape, sd::ops::InterpolateMode::NearestAvg);
+        }
+
+        // the mean of factor^2 unit Gaussians, scaled back to unit variance
+        sd::Tensor<float> downscale_noise(const sd::Tensor<float>& noise) const {
+            return downscale(noise) * static_cast<float>(factor);
+        }
+
+        sd::Tensor<float> upscale(const sd::Tensor<float>& latent, const std::vector<int64_t>& shape) const {
+            return sd::ops::interpolate(latent, shape, sd::ops::InterpolateMode::Bicubic);
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key == "lowres_fraction") {
+                float parsed = 0.0f;
+                if (!parse_strict_float(value, parsed) || parsed < 0.0f || parsed >= 1.0f) {
+                    LOG_WARN("ignoring invalid progressive sampling extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                params.fraction = parsed;
+            } else if (key == "lowres_factor") {
+                int parsed = 0;
+                if (!parse_strict_int(value, parsed) || parsed < 1 || parsed > 4) {
+                    LOG_WARN("ignoring invalid progressive sampling extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                params.factor = parsed;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::progressive_sampling
+
+#endif  // __SD_RUNTIME_PROGRESSIVE_SAMPLING_HPP__
@@ -0,0 +1,35 @@
+#ifndef __SD_RUNTIME_PROVISIONAL_PREVIEW_HPP__
+#define __SD_RUNTIME_PROVISIONAL_PREVIEW_HPP__
+
+#include "core/util.h"
+
+namespace sd::provisional_preview {
+
+    // Provisional image of an image generation, set through the extra sample
+    // arg provisional_step (0 = off). At that step of the schedule the
+    // denoised prediction goes to the provisional callback, decoded with the
+    // preview decoder, and the client confirms by returning or cancels the
+    // generation before the remaining steps and the final VAE decode run.
+    struct Params {
+        int step = 0;
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "provisional_step") {
+                continue;
+            }
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || parsed < 0) {
+                LOG_WARN("ignoring invalid provisional preview extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.step = parsed;
+        }
+        return params;
+    }
+
+}  // namespace sd::provisional_preview
+
+#endif  // __SD_RUNTIME_PROVISIONAL_PREVIEW_HPP__
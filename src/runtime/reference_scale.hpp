@@ -0,0 +1,61 @@
+#ifndef __SD_RUNTIME_REFERENCE_SCALE_HPP__
+#define __SD_RUNTIME_REFERENCE_SCALE_HPP__
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/util.h"
+#include "model.h"
+
+namespace sd::reference_scale {
+
+    // Reference images encoded below their resolution, set through the extra
+    // sample arg ref_scale (side length factor in (0, 1], 1 = off). Edit
+    // models put every reference token into the sequence of each step, so a
+    // scale of 0.5 leaves a quarter of the reference tokens. The RoPE
+    // positions of the reference tokens are spread by 1/scale, so the
+    // smaller grid still covers the positions of the full size reference and
+    // lines up with the image tokens as before; only the detail the model
+    // can copy from the reference drops.
+    struct Params {
+        float scale = 1.0f;
+
+        bool enabled() const {
+            return scale < 1.0f;
+        }
+
+        // reference latent positions per token
+        float position_scale() const {
+            return enabled() ? 1.0f / scale : 1.0f;
+        }
+
+        // a side of size before VAE encoding, rounded to a multiple of factor
+        int scaled_size(double size, int factor) const {
+            int scaled = static_cast<int>(std::lround(size * scale / factor)) * factor;
+            return std::max(factor, scaled);
+        }
+    };
+
+    // Flux Kontext, Flux.2 and Qwen-Image Edit, whose RoPE tables take the scale
+    inline bool supports(SDVersion version) {
+        return sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_qwen_image(version);
+    }
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key == "ref_scale") {
+                float parsed = 0.0f;
+                if (!parse_strict_float(value, parsed) || parsed <= 0.0f || parsed > 1.0f) {
+                    LOG_WARN("ignoring invalid reference scale extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                params.scale = parsed;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::reference_scale
+
+#endif  // __SD_RUNTIME_REFERENCE_SCALE_HPP__
@@ -26,6 +26,10 @@ namespace sd_sample {
         return mode == SampleCacheMode::CACHEDIT;
     }
 
+    bool SampleCacheRuntime::profile_enabled() const {
+        return mode == SampleCacheMode::PROFILE;
+    }
+
     static bool has_valid_cache_percent_range(const sd_cache_params_t& cache_params) {
         if (cache_params.mode != SD_CACHE_EASYCACHE && cache_params.mode != SD_CACHE_UCACHE) {
             return true;
@@ -173,10 +177,42 @@ namespace sd_sample {
                  config.warmup_steps, config.stop_percent * 100.0f);
     }
 
+    static bool init_profile_runtime(SampleCacheRuntime& runtime,
+                                     const sd_cache_params_t& cache_params,
+                                     const std::vector<float>& sigmas,
+                                     const std::string& profile_key) {
+        if (cache_params.mode == SD_CACHE_SPECTRUM) {
+            LOG_WARN("cache profiles are not supported for Spectrum, using its own settings");
+            return false;
+        }
+
+        size_t total_steps = sigmas.size() > 0 ? sigmas.size() - 1 : 0;
+        if (!runtime.profile.init(cache_params.profile_path,
+                                  profile_key,
+                                  cache_params.profile_calibrate,
+                                  cache_params.profile_target_error,
+                                  total_steps)) {
+            return false;
+        }
+
+        runtime.mode = SampleCacheMode::PROFILE;
+        if (runtime.profile.calibrating) {
+            LOG_INFO("Cache profile calibration - sampling without skipping for '%s'", profile_key.c_str());
+        } else {
+            LOG_INFO("Cache profile enabled - '%s', target error: %.3f, planned skips: %d/%zu",
+                     profile_key.c_str(),
+                     cache_params.profile_target_error,
+                     static_cast<int>(std::count(runtime.profile.skip_mask.begin(), runtime.profile.skip_mask.end(), 1)),
+                     total_steps);
+        }
+        return true;
+    }
+
     SampleCacheRuntime init_sample_cache_runtime(SDVersion version,
                                                  const sd_cache_params_t* cache_params,
                                                  Denoiser* denoiser,
-                                                 const std::vector<float>& sigmas) {
+                                                 const std::vector<float>& sigmas,
+                                                 const std::string& profile_key) {
         SampleCacheRuntime runtime;
         if (cache_params == nullptr || cache_params->mode == SD_CACHE_DISABLED) {
             return runtime;
@@ -189,6 +225,11 @@ namespace sd_sample {
             return runtime;
         }
 
+        if (cache_params->profile_path != nullptr && strlen(cache_params->profile_path) > 0 &&
+            init_profile_runtime(runtime, *cache_params, sigmas, profile_key)) {
+            return runtime;
+        }
+
         switch (cache_params->mode) {
             case SD_CACHE_EASYCACHE:
                 init_easycache_runtime(runtime, version, *cache_params, denoiser);
@@ -227,6 +268,9 @@ namespace sd_sample {
             case SampleCacheMode::CACHEDIT:
                 runtime.cachedit.begin_step(step_index, sigma);
                 break;
+            case SampleCacheMode::PROFILE:
+                runtime.profile.begin_step(step_index);
+                break;
             case SampleCacheMode::NONE:
                 break;
         }
@@ -246,6 +290,8 @@ namespace sd_sample {
                 return runtime.ucache.before_condition(condition, input, output, sigma, step_index);
             case SampleCacheMode::CACHEDIT:
                 return runtime.cachedit.before_condition(condition, input, output, sigma, step_index);
+            case SampleCacheMode::PROFILE:
+                return runtime.profile.before_condition(condition, input, output);
             case SampleCacheMode::NONE:
                 return false;
         }
@@ -270,6 +316,9 @@ namespace sd_sample {
             case SampleCacheMode::CACHEDIT:
                 runtime.cachedit.after_condition(condition, input, output);
                 break;
+            case SampleCacheMode::PROFILE:
+                runtime.profile.after_condition(condition, input, output);
+                break;
             case SampleCacheMode::NONE:
                 break;
         }
@@ -283,6 +332,8 @@ namespace sd_sample {
                 return runtime.ucache.is_step_skipped();
             case SampleCacheMode::CACHEDIT:
                 return runtime.cachedit.is_step_skipped();
+            case SampleCacheMode::PROFILE:
+                return runtime.profile.is_step_skipped();
             case SampleCacheMode::NONE:
                 return false;
         }
@@ -290,6 +341,12 @@ namespace sd_sample {
         return false;
     }
 
+    void finish_sample_cache_runtime(const SampleCacheRuntime& runtime) {
+        if (runtime.profile_enabled() && runtime.profile.calibrating) {
+            runtime.profile.save();
+        }
+    }
+
     void log_sample_cache_summary(const SampleCacheRuntime& runtime, size_t total_steps) {
         if (runtime.easycache_enabled()) {
             if (runtime.easycache.total_steps_skipped > 0 && total_steps > 0) {
@@ -348,6 +405,12 @@ namespace sd_sample {
             }
         }
 
+        if (runtime.profile_enabled() && !runtime.profile.calibrating && total_steps > 0) {
+            LOG_INFO("Cache profile skipped %d/%zu steps",
+                     runtime.profile.total_steps_skipped,
+                     total_steps);
+        }
+
         if (runtime.spectrum_enabled && runtime.spectrum.total_steps_skipped > 0 && total_steps > 0) {
             double speedup = static_cast<double>(total_steps) /
                              static_cast<double>(total_steps - runtime.spectrum.total_steps_skipped);
@@ -358,4 +421,24 @@ namespace sd_sample {
         }
     }
 
+    int sample_cache_skipped_steps(const SampleCacheRuntime& runtime) {
+        int skipped = 0;
+        if (runtime.easycache_enabled()) {
+            skipped += runtime.easycache.total_steps_skipped;
+        }
+        if (runtime.ucache_enabled()) {
+            skipped += runtime.ucache.total_steps_skipped;
+        }
+        if (runtime.cachedit_enabled()) {
+            skipped += runtime.cachedit.total_steps_skipped;
+        }
+        if (runtime.profile_enabled()) {
+            skipped += runtime.profile.total_steps_skipped;
+        }
+        if (runtime.spectrum_enabled) {
+            skipped += runtime.spectrum.total_steps_skipped;
+        }
+        return skipped;
+    }
+
 }  // namespace sd_sample
@@ -1,11 +1,13 @@
 #ifndef __SD_RUNTIME_SAMPLE_CACHE_H__
 #define __SD_RUNTIME_SAMPLE_CACHE_H__
 
+#include <string>
 #include <vector>
 
 #include "core/tensor.hpp"
 #include "core/util.h"
 #include "model.h"
+#include "runtime/cache-profile.h"
 #include "runtime/cache_dit.hpp"
 #include "runtime/denoiser.hpp"
 #include "runtime/easycache.hpp"
@@ -19,6 +21,7 @@ namespace sd_sample {
         EASYCACHE,
         UCACHE,
         CACHEDIT,
+        PROFILE,
     };
 
     struct SampleCacheRuntime {
@@ -28,12 +31,14 @@ namespace sd_sample {
         UCacheState ucache;
         CacheDitConditionState cachedit;
         SpectrumState spectrum;
+        CacheProfileState profile;
 
         bool spectrum_enabled = false;
 
         bool easycache_enabled() const;
         bool ucache_enabled() const;
         bool cachedit_enabled() const;
+        bool profile_enabled() const;
     };
 
     struct SampleStepCacheDispatcher {
@@ -52,9 +57,13 @@ namespace sd_sample {
     SampleCacheRuntime init_sample_cache_runtime(SDVersion version,
                                                  const sd_cache_params_t* cache_params,
                                                  Denoiser* denoiser,
-                                                 const std::vector<float>& sigmas);
+                                                 const std::vector<float>& sigmas,
+                                                 const std::string& profile_key);
 
+    // Saves the calibration trajectory of a profile calibration run.
+    void finish_sample_cache_runtime(const SampleCacheRuntime& runtime);
     void log_sample_cache_summary(const SampleCacheRuntime& runtime, size_t total_steps);
+    int sample_cache_skipped_steps(const SampleCacheRuntime& runtime);
 
 }  // namespace sd_sample
 
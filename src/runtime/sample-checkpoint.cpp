@@ -0,0 +1,151 @@
+#include "runtime/sample-checkpoint.h"
+
+#include <cstring>
+
+namespace sd_sample {
+
+    // "SDCK", then the fields in declaration order in host byte order. Tensors
+    // are a u32 rank, the dims as i64 and the f32 data; byte strings are a u32
+    // length and the bytes.
+    static const char CHECKPOINT_MAGIC[4]     = {'S', 'D', 'C', 'K'};
+    static const uint32_t CHECKPOINT_VERSION  = 1;
+    static const uint32_t CHECKPOINT_MAX_RANK = 8;
+
+    template <typename T>
+    static void write_pod(std::vector<uint8_t>* out, const T& value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out->insert(out->end(), bytes, bytes + sizeof(T));
+    }
+
+    static void write_bytes(std::vector<uint8_t>* out, const std::vector<uint8_t>& bytes) {
+        write_pod(out, static_cast<uint32_t>(bytes.size()));
+        out->insert(out->end(), bytes.begin(), bytes.end());
+    }
+
+    static void write_tensor(std::vector<uint8_t>* out, const sd::Tensor<float>& tensor) {
+        write_pod(out, static_cast<uint32_t>(tensor.shape().size()));
+        for (int64_t dim : tensor.shape()) {
+            write_pod(out, dim);
+        }
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(tensor.data());
+        out->insert(out->end(), data, data + static_cast<size_t>(tensor.numel()) * sizeof(float));
+    }
+
+    struct CheckpointReader {
+        const uint8_t* data;
+        size_t size;
+        size_t offset = 0;
+
+        bool read_raw(void* dst, size_t n) {
+            if (n > size - offset) {
+                return false;
+            }
+            memcpy(dst, data + offset, n);
+            offset += n;
+            return true;
+        }
+
+        template <typename T>
+        bool read_pod(T* value) {
+            return read_raw(value, sizeof(T));
+        }
+
+        bool read_bytes(std::vector<uint8_t>* bytes) {
+            uint32_t n = 0;
+            if (!read_pod(&n) || n > size - offset) {
+                return false;
+            }
+            bytes->assign(data + offset, data + offset + n);
+            offset += n;
+            return true;
+        }
+
+        bool read_tensor(sd::Tensor<float>* tensor) {
+            uint32_t rank = 0;
+            if (!read_pod(&rank) || rank > CHECKPOINT_MAX_RANK) {
+                return false;
+            }
+            std::vector<int64_t> shape(rank);
+            size_t numel = rank > 0 ? 1 : 0;
+            for (uint32_t i = 0; i < rank; i++) {
+                if (!read_pod(&shape[i]) || shape[i] < 0 || static_cast<uint64_t>(shape[i]) > size - offset) {
+                    return false;
+                }
+                numel *= static_cast<size_t>(shape[i]);
+                if (numel > (size - offset) / sizeof(float)) {
+                    return false;
+                }
+            }
+            if (rank == 0) {
+                *tensor = {};
+                return true;
+            }
+            std::vector<float> values(numel);
+            if (!read_raw(values.data(), numel * sizeof(float))) {
+                return false;
+            }
+            *tensor = sd::Tensor<float>(std::move(shape), std::move(values));
+            return true;
+        }
+    };
+
+    uint64_t hash_sample_sigmas(const std::vector<float>& sigmas) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (float sigma : sigmas) {
+            uint32_t bits;
+            memcpy(&bits, &sigma, sizeof(bits));
+            hash ^= bits;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    std::vector<uint8_t> serialize_sample_checkpoint(const SampleCheckpoint& checkpoint) {
+        std::vector<uint8_t> out;
+        out.reserve(64 + static_cast<size_t>(checkpoint.x.numel() + checkpoint.old_denoised.numel()) * sizeof(float));
+        out.insert(out.end(), CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof(CHECKPOINT_MAGIC));
+        write_pod(&out, CHECKPOINT_VERSION);
+        write_pod(&out, static_cast<int32_t>(checkpoint.pass));
+        write_pod(&out, static_cast<int32_t>(checkpoint.method));
+        write_pod(&out, static_cast<int32_t>(checkpoint.step));
+        write_pod(&out, static_cast<int32_t>(checkpoint.steps));
+        write_pod(&out, checkpoint.seed);
+        write_pod(&out, checkpoint.sigmas_hash);
+        write_tensor(&out, checkpoint.x);
+        write_tensor(&out, checkpoint.old_denoised);
+        write_bytes(&out, checkpoint.rng_state);
+        write_bytes(&out, checkpoint.sampler_rng_state);
+        return out;
+    }
+
+    bool deserialize_sample_checkpoint(const uint8_t* data, size_t size, SampleCheckpoint* checkpoint) {
+        if (data == nullptr || size < sizeof(CHECKPOINT_MAGIC) || memcmp(data, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+            return false;
+        }
+        CheckpointReader reader{data, size, sizeof(CHECKPOINT_MAGIC)};
+        uint32_t version = 0;
+        int32_t pass     = 0;
+        int32_t method   = 0;
+        int32_t step     = 0;
+        int32_t steps    = 0;
+        if (!reader.read_pod(&version) || version != CHECKPOINT_VERSION ||
+            !reader.read_pod(&pass) ||
+            !reader.read_pod(&method) ||
+            !reader.read_pod(&step) ||
+            !reader.read_pod(&steps) ||
+            !reader.read_pod(&checkpoint->seed) ||
+            !reader.read_pod(&checkpoint->sigmas_hash) ||
+            !reader.read_tensor(&checkpoint->x) ||
+            !reader.read_tensor(&checkpoint->old_denoised) ||
+            !reader.read_bytes(&checkpoint->rng_state) ||
+            !reader.read_bytes(&checkpoint->sampler_rng_state)) {
+            return false;
+        }
+        checkpoint->pass   = pass;
+        checkpoint->method = method;
+        checkpoint->step   = step;
+        checkpoint->steps  = steps;
+        return reader.offset == size && !checkpoint->x.empty() && step > 0 && step <= steps;
+    }
+
+}  // namespace sd_sample
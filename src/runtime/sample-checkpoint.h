@@ -0,0 +1,37 @@
+#ifndef __SD_RUNTIME_SAMPLE_CHECKPOINT_H__
+#define __SD_RUNTIME_SAMPLE_CHECKPOINT_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "core/tensor.hpp"
+
+namespace sd_sample {
+
+    // Everything a sampling pass needs to continue from a completed step and
+    // end with the same latent as an uninterrupted run: the latent itself,
+    // the sampler's history and both generators. sigmas_hash and seed tie the
+    // snapshot to the request it came from, so resuming a different request
+    // is refused instead of producing garbage.
+    struct SampleCheckpoint {
+        int pass             = 0;  // index of the sampling pass within the request
+        int method           = 0;
+        int step             = 0;  // steps completed in this pass
+        int steps            = 0;
+        int64_t seed         = 0;
+        uint64_t sigmas_hash = 0;
+        sd::Tensor<float> x;
+        sd::Tensor<float> old_denoised;
+        std::vector<uint8_t> rng_state;
+        std::vector<uint8_t> sampler_rng_state;
+    };
+
+    uint64_t hash_sample_sigmas(const std::vector<float>& sigmas);
+
+    std::vector<uint8_t> serialize_sample_checkpoint(const SampleCheckpoint& checkpoint);
+    // False for data that is truncated or from another checkpoint version.
+    bool deserialize_sample_checkpoint(const uint8_t* data, size_t size, SampleCheckpoint* checkpoint);
+
+}  // namespace sd_sample
+
+#endif  // __SD_RUNTIME_SAMPLE_CHECKPOINT_H__
@@ -0,0 +1,123 @@
+#ifndef __SD_RUNTIME_SHARED_TRAJECTORY_HPP__
+#define __SD_RUNTIME_SHARED_TRAJECTORY_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "core/tensor.hpp"
+#include "core/util.h"
+#include "runtime/sample-checkpoint.h"
+
+namespace sd::shared_trajectory {
+
+    // Shared early steps for prompt variations, set through the extra sample
+    // arg shared_steps (0 = off). The first request of a seed, size and
+    // sampler setup samples as usual and keeps its sampling state after
+    // shared_steps steps; a later request that only changes the prompts
+    // starts from that state instead of from noise. The early steps lay out
+    // the image, so variants keep the composition of the first request and
+    // cost steps - shared_steps steps.
+    struct Params {
+        int steps = 0;
+
+        bool enabled() const {
+            return steps > 0;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "shared_steps") {
+                continue;
+            }
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || parsed < 0) {
+                LOG_WARN("ignoring invalid shared trajectory extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.steps = parsed;
+        }
+        return params;
+    }
+
+    // The last few recorded trajectories of one context, newest first. Keys
+    // cover everything the early steps depend on except the prompts.
+    class Cache {
+    public:
+        static constexpr size_t MAX_ENTRIES = 8;
+
+        // setup: the seed, sampler and guidance settings; tensors: the
+        // latent inputs (init latent, mask, control and reference images)
+        static std::string make_key(const std::string& setup, const std::vector<const sd::Tensor<float>*>& tensors) {
+            std::string key = setup;
+            for (const sd::Tensor<float>* tensor : tensors) {
+                if (tensor == nullptr || tensor->empty()) {
+                    key += ":-";
+                    continue;
+                }
+                key += ":";
+                for (int64_t dim : tensor->shape()) {
+                    key += std::to_string(dim) + "x";
+                }
+                key += sd_format("%016llx", (unsigned long long)content_hash(*tensor));
+            }
+            return key;
+        }
+
+        const sd_sample::SampleCheckpoint* find(const std::string& key) {
+            for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+                if (it->key == key) {
+                    entries_.splice(entries_.begin(), entries_, it);
+                    return &entries_.front().checkpoint;
+                }
+            }
+            return nullptr;
+        }
+
+        void put(const std::string& key, sd_sample::SampleCheckpoint checkpoint) {
+            entries_.remove_if([&](const Entry& entry) { return entry.key == key; });
+            entries_.push_front({key, std::move(checkpoint)});
+            while (entries_.size() > MAX_ENTRIES) {
+                entries_.pop_back();
+            }
+        }
+
+        void clear() {
+            entries_.clear();
+        }
+
+    private:
+        struct Entry {
+            std::string key;
+            sd_sample::SampleCheckpoint checkpoint;
+        };
+
+        // FNV-1a over 64-bit words
+        static uint64_t content_hash(const sd::Tensor<float>& x) {
+            const unsigned char* data = reinterpret_cast<const unsigned char*>(x.data());
+            size_t size               = static_cast<size_t>(x.numel()) * sizeof(float);
+            uint64_t hash             = 14695981039346656037ULL;
+            size_t i                  = 0;
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+                uint64_t word;
+                memcpy(&word, data + i, sizeof(word));
+                hash ^= word;
+                hash *= 1099511628211ULL;
+            }
+            for (; i < size; ++i) {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        std::list<Entry> entries_;
+    };
+
+}  // namespace sd::shared_trajectory
+
+#endif  // __SD_RUNTIME_SHARED_TRAJECTORY_HPP__
@@ -0,0 +1,74 @@
+#ifndef __SD_RUNTIME_TILED_DIFFUSION_HPP__
+#define __SD_RUNTIME_TILED_DIFFUSION_HPP__
+
+#include <algorithm>
+#include <cstdint>
+
+#include "core/util.h"
+
+namespace sd::tiled_diffusion {
+
+    // MultiDiffusion over overlapping spatial tiles of the latent, set
+    // through extra sample args: diffusion_tile (tile side in latent pixels,
+    // 0 = off), diffusion_tile_overlap (latent pixels neighbouring tiles
+    // share, default a quarter tile) and diffusion_tile_batch (tiles per
+    // forward pass, 0 = all). Every step runs the tiles as one latent batch
+    // with the condition repeated for each, then blends them back with the
+    // smootherstep ramps of the VAE tiling. Attention then spans one tile,
+    // so memory is bounded by the tile batch and the cost grows with the
+    // area instead of its square.
+    struct Params {
+        int tile    = 0;
+        int overlap = -1;
+        int batch   = 0;
+
+        // a latent with a side longer than the tile; a shorter side is
+        // covered by tiles of its full length
+        bool enabled_for(int64_t width, int64_t height) const {
+            return tile > 0 && (width > resolved_tile() || height > resolved_tile());
+        }
+
+        // rounded to the 8 latent pixels UNet downsampling needs
+        int resolved_tile() const {
+            return std::max(8, tile / 8 * 8);
+        }
+
+        int resolved_overlap() const {
+            int resolved = overlap < 0 ? resolved_tile() / 4 : overlap;
+            return std::clamp(resolved, 0, resolved_tile() / 2);
+        }
+
+        float overlap_factor() const {
+            return resolved_overlap() / static_cast<float>(resolved_tile());
+        }
+
+        int tiles_per_pass() const {
+            return batch > 0 ? batch : 1 << 20;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "diffusion_tile" && key != "diffusion_tile_overlap" && key != "diffusion_tile_batch") {
+                continue;
+            }
+            int parsed_int = 0;
+            if (!parse_strict_int(value, parsed_int) || parsed_int < 0) {
+                LOG_WARN("ignoring invalid tiled diffusion extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            if (key == "diffusion_tile") {
+                params.tile = parsed_int;
+            } else if (key == "diffusion_tile_overlap") {
+                params.overlap = parsed_int;
+            } else {
+                params.batch = parsed_int;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::tiled_diffusion
+
+#endif  // __SD_RUNTIME_TILED_DIFFUSION_HPP__
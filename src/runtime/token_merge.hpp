@@ -0,0 +1,71 @@
+#ifndef __SD_RUNTIME_TOKEN_MERGE_HPP__
+#define __SD_RUNTIME_TOKEN_MERGE_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "core/util.h"
+
+namespace sd::token_merge {
+
+    // Token merging for UNet self-attention, set through extra sample args:
+    // tome_ratio (share of key/value tokens merged), tome_sigma_min and
+    // tome_sigma_max (steps it applies to) and tome_max_downsample (deepest
+    // UNet level it applies to, 1 = full latent resolution only).
+    struct Params {
+        float ratio        = 0.0f;
+        float sigma_min    = 0.0f;
+        float sigma_max    = std::numeric_limits<float>::infinity();
+        int max_downsample = 2;
+
+        // Tokens are merged in 2x1 or 2x2 cells of the token grid, so the
+        // ratio rounds to 0.5 or 0.75; returns the cell size, 1 when off.
+        int factor() const {
+            if (!(ratio > 0.0f)) {
+                return 1;
+            }
+            float kept = std::max(1.0f - ratio, 0.25f);
+            int factor = 1 << static_cast<int>(std::lround(std::log2(1.0f / kept)));
+            return factor > 4 ? 4 : factor;
+        }
+
+        int factor_for_sigma(float sigma) const {
+            if (sigma < sigma_min || sigma > sigma_max) {
+                return 1;
+            }
+            return factor();
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            float parsed_float = 0.0f;
+            int parsed_int     = 0;
+            if (key == "tome_ratio" || key == "tome_sigma_min" || key == "tome_sigma_max") {
+                if (!parse_strict_float(value, parsed_float)) {
+                    LOG_WARN("ignoring invalid token merge extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                if (key == "tome_ratio") {
+                    params.ratio = parsed_float;
+                } else if (key == "tome_sigma_min") {
+                    params.sigma_min = parsed_float;
+                } else {
+                    params.sigma_max = parsed_float;
+                }
+            } else if (key == "tome_max_downsample") {
+                if (!parse_strict_int(value, parsed_int) || parsed_int < 1) {
+                    LOG_WARN("ignoring invalid token merge extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                    continue;
+                }
+                params.max_downsample = parsed_int;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::token_merge
+
+#endif  // __SD_RUNTIME_TOKEN_MERGE_HPP__
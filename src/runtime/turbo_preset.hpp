@@ -0,0 +1,175 @@
+#ifndef __SD_RUNTIME_TURBO_PRESET_HPP__
+#define __SD_RUNTIME_TURBO_PRESET_HPP__
+
+#include <cctype>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/util.h"
+#include "model_io/safetensors_io.h"
+#include "stable-diffusion.h"
+
+namespace sd::turbo_preset {
+
+    // Few-step settings for step-distilled weights, set through the extra
+    // sample arg turbo=1 or sd_apply_turbo_preset. LCM, TCD, Hyper-SD,
+    // Lightning and Turbo distillations are recognized by the file names and
+    // safetensors metadata of the LoRAs and model files, Flux schnell by its
+    // missing guidance embedding. The preset picks the sampler, scheduler and
+    // step count the distillation was trained for, and cfg 1, so no step
+    // runs an uncond pass.
+    struct Params {
+        bool enabled = false;
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "turbo") {
+                continue;
+            }
+            int parsed = 0;
+            if (!parse_strict_int(value, parsed) || (parsed != 0 && parsed != 1)) {
+                LOG_WARN("ignoring invalid turbo preset extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            params.enabled = parsed == 1;
+        }
+        return params;
+    }
+
+    enum class Kind {
+        NONE,
+        HYPER,
+        LIGHTNING,
+        TCD,
+        LCM,
+        TURBO,
+        SCHNELL,
+    };
+
+    struct Preset {
+        Kind kind                    = Kind::NONE;
+        const char* name             = "";
+        enum sample_method_t sampler = SAMPLE_METHOD_COUNT;
+        enum scheduler_t scheduler   = SCHEDULER_COUNT;
+        int sample_steps             = 0;
+
+        bool found() const {
+            return kind != Kind::NONE;
+        }
+    };
+
+    // step counts outside the range a distillation was trained for are
+    // replaced by its default
+    inline Preset preset_for(Kind kind, int steps) {
+        Preset preset;
+        switch (kind) {
+            case Kind::HYPER:
+                // trailing timesteps, as the Hyper-SD LoRAs are trained
+                preset = {kind, "hyper", DDIM_TRAILING_SAMPLE_METHOD, SIMPLE_SCHEDULER, 8};
+                break;
+            case Kind::LIGHTNING:
+                preset = {kind, "lightning", EULER_SAMPLE_METHOD, SGM_UNIFORM_SCHEDULER, 4};
+                break;
+            case Kind::TCD:
+                preset = {kind, "tcd", TCD_SAMPLE_METHOD, LCM_SCHEDULER, 4};
+                break;
+            case Kind::LCM:
+                preset = {kind, "lcm", LCM_SAMPLE_METHOD, LCM_SCHEDULER, 4};
+                break;
+            case Kind::TURBO:
+                preset = {kind, "turbo", EULER_A_SAMPLE_METHOD, SGM_UNIFORM_SCHEDULER, 4};
+                break;
+            case Kind::SCHNELL:
+                preset = {kind, "schnell", EULER_SAMPLE_METHOD, SCHEDULER_COUNT, 4};
+                break;
+            case Kind::NONE:
+                return preset;
+        }
+        if (steps >= 1 && steps <= 8) {
+            preset.sample_steps = steps;
+        }
+        return preset;
+    }
+
+    // lowercase alphanumeric runs of a file name or metadata value
+    inline std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> tokens;
+        std::string token;
+        for (char c : text) {
+            if (std::isalnum(static_cast<unsigned char>(c))) {
+                token += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            } else if (!token.empty()) {
+                tokens.push_back(std::move(token));
+                token.clear();
+            }
+        }
+        if (!token.empty()) {
+            tokens.push_back(std::move(token));
+        }
+        return tokens;
+    }
+
+    // "4step", "8steps" or "8 step"; 0 when the text names no step count
+    inline int detect_steps(const std::vector<std::string>& tokens) {
+        for (size_t i = 0; i < tokens.size(); i++) {
+            const std::string& token = tokens[i];
+            size_t digits            = 0;
+            while (digits < token.size() && std::isdigit(static_cast<unsigned char>(token[digits]))) {
+                digits++;
+            }
+            if (digits == 0 || digits > 2) {
+                continue;
+            }
+            std::string suffix = token.substr(digits);
+            if (suffix.empty() && i + 1 < tokens.size()) {
+                suffix = tokens[i + 1];
+            }
+            if (suffix == "step" || suffix == "steps") {
+                return std::stoi(token.substr(0, digits));
+            }
+        }
+        return 0;
+    }
+
+    inline Preset detect(const std::string& text) {
+        static const std::pair<const char*, Kind> keywords[] = {
+            {"hyper", Kind::HYPER},
+            {"lightning", Kind::LIGHTNING},
+            {"tcd", Kind::TCD},
+            {"lcm", Kind::LCM},
+            {"turbo", Kind::TURBO},
+            {"schnell", Kind::SCHNELL},
+        };
+        std::vector<std::string> tokens = tokenize(text);
+        for (const auto& [keyword, kind] : keywords) {
+            for (const std::string& token : tokens) {
+                if (starts_with(token, keyword)) {
+                    return preset_for(kind, detect_steps(tokens));
+                }
+            }
+        }
+        return {};
+    }
+
+    // the file name followed by the file's safetensors metadata values
+    inline std::string describe_file(const std::string& path) {
+        std::string text = path.substr(path.find_last_of("/\\") + 1);
+        std::vector<std::pair<std::string, std::string>> metadata;
+        if (ends_with(path, ".safetensors") && read_safetensors_metadata(path, metadata)) {
+            for (const auto& [key, value] : metadata) {
+                // the training config keys can name the base model, which
+                // is not what the file was distilled into
+                if (key == "modelspec.title" || key == "ss_output_name" || key == "name") {
+                    text += " " + value;
+                }
+            }
+        }
+        return text;
+    }
+
+}  // namespace sd::turbo_preset
+
+#endif  // __SD_RUNTIME_TURBO_PRESET_HPP__
@@ -0,0 +1,49 @@
+#ifndef __SD_RUNTIME_VIDEO_ATTENTION_HPP__
+#define __SD_RUNTIME_VIDEO_ATTENTION_HPP__
+
+#include <cstdlib>
+
+#include "core/util.h"
+
+namespace sd::video_attention {
+
+    // Windowed self-attention for Wan and LTX video models, set through extra
+    // sample args: vattn_window (latent frames per window, 0 = full attention)
+    // and vattn_dense_steps (first steps that keep full attention, they lay
+    // out the motion that windows only see in part).
+    struct Params {
+        int window      = 0;
+        int dense_steps = 0;
+
+        // step is 1-based, as passed to the denoiser
+        int window_for_step(int step) const {
+            if (window <= 0 || std::abs(step) <= dense_steps) {
+                return 0;
+            }
+            return window;
+        }
+    };
+
+    inline Params parse_args(const char* extra_sample_args) {
+        Params params;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "vattn_window" && key != "vattn_dense_steps") {
+                continue;
+            }
+            int parsed_int = 0;
+            if (!parse_strict_int(value, parsed_int) || parsed_int < 0) {
+                LOG_WARN("ignoring invalid video attention extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            if (key == "vattn_window") {
+                params.window = parsed_int;
+            } else {
+                params.dense_steps = parsed_int;
+            }
+        }
+        return params;
+    }
+
+}  // namespace sd::video_attention
+
+#endif  // __SD_RUNTIME_VIDEO_ATTENTION_HPP__
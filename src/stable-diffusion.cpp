@@ -1,24 +1,45 @@
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <random>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "core/attention_tuner.h"
+#include "core/backend_placement.h"
+#include "core/conv_tuner.h"
+#include "core/device_probe.h"
 #include "core/ggml_extend.hpp"
 #include "core/ggml_graph_cut.h"
+#include "core/host_memory.h"
+#include "core/memory_timeline.h"
+#include "core/op_profiler.h"
+#include "core/perf_stats.h"
 
 #include "core/rng.hpp"
 #include "core/rng_mt19937.hpp"
 #include "core/rng_philox.hpp"
+#include "core/task_pool.h"
 #include "core/util.h"
 #include "model_loader.h"
 #include "model_manager.h"
+#include "replica_weight_manager.h"
 #include "stable-diffusion.h"
 
+#include "conditioning/condition_cache.hpp"
+#include "conditioning/condition_file.hpp"
 #include "conditioning/conditioner.hpp"
 #include "extensions/generation_extension.h"
 #include "model/adapter/lora.hpp"
+#include "model/adapter/lora_cache.hpp"
 #include "model/diffusion/anima.hpp"
 #include "model/diffusion/boogu.hpp"
 #include "model/diffusion/control.hpp"
@@ -42,15 +63,32 @@
 #include "model/vae/ltx_audio_vae.hpp"
 #include "model/vae/ltx_vae.hpp"
 #include "model/vae/tae.hpp"
+#include "model/vae/vae_encode_cache.hpp"
 #include "model/vae/vae.hpp"
 #include "model/vae/wan_vae.hpp"
 #include "runtime/denoiser.hpp"
 #include "runtime/guidance.h"
 #include "runtime/sample-cache.h"
+#include "runtime/context_windows.hpp"
+#include "runtime/frame_interpolation.hpp"
+#include "runtime/latency_slo.hpp"
+#include "runtime/masked_compute.hpp"
+#include "runtime/modulation_cache.hpp"
+#include "runtime/progressive_sampling.hpp"
+#include "runtime/provisional_preview.hpp"
+#include "runtime/reference_scale.hpp"
+#include "runtime/sample-checkpoint.h"
+#include "runtime/shared_trajectory.hpp"
+#include "runtime/tiled_diffusion.hpp"
+#include "runtime/token_merge.hpp"
+#include "runtime/turbo_preset.hpp"
+#include "runtime/video_attention.hpp"
 #include "upscaler.h"
 
 #include "name_conversion.h"
 #include "runtime/latent-preview.h"
+#include "runtime/generation-queue.h"
+#include "runtime/preview-worker.h"
 
 const char* sd_vae_format_name(enum sd_vae_format_t format);
 static SDVersion sd_vae_format_to_version(enum sd_vae_format_t format, SDVersion fallback);
@@ -165,6 +203,219 @@ static float get_cache_reuse_threshold(const sd_cache_params_t& params) {
     return std::max(0.0f, reuse_threshold);
 }
 
+// Stacks one tensor per condition along batch_dim. All-empty parts yield an empty
+// output; a mix of empty/non-empty parts or mismatched shapes cannot be batched.
+static bool stack_condition_batch(const std::vector<const sd::Tensor<float>*>& parts,
+                                  size_t batch_dim,
+                                  sd::Tensor<float>* output) {
+    GGML_ASSERT(output != nullptr);
+    *output = {};
+    if (parts.empty() || parts[0]->empty()) {
+        for (const auto* part : parts) {
+            if (!part->empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<int64_t> part_shape;
+    for (const auto* part : parts) {
+        if (part->empty()) {
+            return false;
+        }
+        sd::Tensor<float> expanded = *part;
+        while (static_cast<size_t>(expanded.dim()) <= batch_dim) {
+            expanded.unsqueeze_(expanded.dim());
+        }
+        if (part_shape.empty()) {
+            part_shape = expanded.shape();
+        } else if (expanded.shape() != part_shape) {
+            return false;
+        }
+        *output = output->empty() ? std::move(expanded) : sd::ops::concat(*output, expanded, batch_dim);
+    }
+    return true;
+}
+
+struct BatchedConditionInputs {
+    int64_t count = 0;
+    sd::Tensor<float> context;
+    sd::Tensor<float> c_concat;
+    sd::Tensor<float> y;
+};
+
+// Every condition is repeated `repeat` times so it lines up with a batch of latents.
+static bool stack_batched_conditions(const std::vector<const SDCondition*>& conditions,
+                                     int64_t repeat,
+                                     BatchedConditionInputs* inputs) {
+    std::vector<const sd::Tensor<float>*> contexts;
+    std::vector<const sd::Tensor<float>*> c_concats;
+    std::vector<const sd::Tensor<float>*> ys;
+    for (const SDCondition* condition : conditions) {
+        for (int64_t i = 0; i < repeat; ++i) {
+            contexts.push_back(&condition->c_crossattn);
+            c_concats.push_back(&condition->c_concat);
+            ys.push_back(&condition->c_vector);
+        }
+    }
+    inputs->count = static_cast<int64_t>(conditions.size());
+    return stack_condition_batch(contexts, 2, &inputs->context) &&
+           stack_condition_batch(c_concats, 3, &inputs->c_concat) &&
+           stack_condition_batch(ys, 1, &inputs->y);
+}
+
+// Cache file for this set of model files and load options. Files are keyed by
+// path, size and modification time rather than content: hashing multi-GB
+// checkpoints would cost about as much as the load the cache skips.
+static std::string get_model_cache_path(const sd_ctx_params_t* sd_ctx_params) {
+    const std::pair<const char*, const char*> model_files[] = {
+        {"model", sd_ctx_params->model_path},
+        {"diffusion_model", sd_ctx_params->diffusion_model_path},
+        {"high_noise_diffusion_model", sd_ctx_params->high_noise_diffusion_model_path},
+        {"uncond_diffusion_model", sd_ctx_params->uncond_diffusion_model_path},
+        {"clip_l", sd_ctx_params->clip_l_path},
+        {"clip_g", sd_ctx_params->clip_g_path},
+        {"clip_vision", sd_ctx_params->clip_vision_path},
+        {"t5xxl", sd_ctx_params->t5xxl_path},
+        {"pulid_weights", sd_ctx_params->pulid_weights_path},
+        {"llm", sd_ctx_params->llm_path},
+        {"llm_vision", sd_ctx_params->llm_vision_path},
+        {"vae", sd_ctx_params->vae_path},
+        {"taesd", sd_ctx_params->taesd_path},
+        {"embeddings_connectors", sd_ctx_params->embeddings_connectors_path},
+        {"audio_vae", sd_ctx_params->audio_vae_path},
+        {"control_net", sd_ctx_params->control_net_path},
+    };
+
+    std::string key = "v1";
+    for (const auto& [role, path] : model_files) {
+        if (strlen(SAFE_STR(path)) == 0) {
+            continue;
+        }
+        std::error_code ec;
+        uintmax_t size  = std::filesystem::is_directory(path, ec) ? 0 : std::filesystem::file_size(path, ec);
+        long long mtime = static_cast<long long>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+        key += sd_format("|%s=%s:%llu:%lld", role, path, (unsigned long long)size, mtime);
+    }
+    key += sd_format("|wtype=%s|tensor_type_rules=%s",
+                     sd_type_name(sd_ctx_params->wtype),
+                     SAFE_STR(sd_ctx_params->tensor_type_rules));
+    if (sd_ctx_params->llm_cpu_q8_0) {
+        key += "|llm_cpu_q8_0";
+    }
+    if (sd_ctx_params->stream_q8_0) {
+        key += "|stream_q8_0";
+    }
+    if (sd_ctx_params->vae_decode_only) {
+        key += "|vae_decode_only";
+    }
+
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return path_join(sd_ctx_params->model_cache_dir, sd_format("%016llx.gguf", (unsigned long long)hash));
+}
+
+// The CPU backend quantizes the activations of a matmul to the vec dot
+// type of its weight, so q8_0 projections run the int8 dot kernels
+// instead of f16/f32 ones. Only float weights nothing else chose a type
+// for are converted; embeddings, norms and MoE experts keep theirs.
+static void quantize_llm_projections(ModelLoader& model_loader) {
+    static const char* projection_suffixes[] = {
+        ".self_attn.q_proj.weight",
+        ".self_attn.k_proj.weight",
+        ".self_attn.v_proj.weight",
+        ".self_attn.o_proj.weight",
+        ".mlp.gate_proj.weight",
+        ".mlp.up_proj.weight",
+        ".mlp.down_proj.weight",
+    };
+    int converted = 0;
+    for (auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+        if (!starts_with(name, "text_encoders.llm.model.layers.") ||
+            tensor_storage.expected_type != GGML_TYPE_COUNT ||
+            (tensor_storage.type != GGML_TYPE_F32 &&
+             tensor_storage.type != GGML_TYPE_F16 &&
+             tensor_storage.type != GGML_TYPE_BF16)) {
+            continue;
+        }
+        bool is_projection = false;
+        for (const char* suffix : projection_suffixes) {
+            if (ends_with(name, suffix)) {
+                is_projection = true;
+                break;
+            }
+        }
+        if (is_projection && model_loader.tensor_should_be_converted(tensor_storage, GGML_TYPE_Q8_0)) {
+            tensor_storage.expected_type = GGML_TYPE_Q8_0;
+            converted++;
+        }
+    }
+    if (converted > 0) {
+        LOG_INFO("llm text encoder: %d projection weights converted to q8_0 for the CPU backend", converted);
+    }
+}
+
+// Params kept in RAM for a GPU cross PCIe in their loaded type on every
+// compute. 2D float weights (the matmul and embedding weights) are held as
+// q8_0 instead, which every GPU backend multiplies directly, so about half
+// the bytes of an f16 model are uploaded per step.
+static void quantize_streamed_diffusion_weights(ModelLoader& model_loader) {
+    int converted  = 0;
+    uint64_t saved = 0;
+    for (auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+        if (!starts_with(name, "model.diffusion_model.") ||
+            !ends_with(name, ".weight") ||
+            tensor_storage.n_dims != 2 ||
+            tensor_storage.expected_type != GGML_TYPE_COUNT ||
+            (tensor_storage.type != GGML_TYPE_F32 &&
+             tensor_storage.type != GGML_TYPE_F16 &&
+             tensor_storage.type != GGML_TYPE_BF16)) {
+            continue;
+        }
+        if (model_loader.tensor_should_be_converted(tensor_storage, GGML_TYPE_Q8_0)) {
+            const int64_t q8_0_bytes     = tensor_storage.nelements() / ggml_blck_size(GGML_TYPE_Q8_0) * ggml_type_size(GGML_TYPE_Q8_0);
+            tensor_storage.expected_type = GGML_TYPE_Q8_0;
+            saved += tensor_storage.nbytes() - q8_0_bytes;
+            converted++;
+        }
+    }
+    if (converted > 0) {
+        LOG_INFO("diffusion model: %d weights kept as q8_0 for streaming, %.2f MB less to upload per pass",
+                 converted,
+                 saved / (1024.0 * 1024.0));
+    }
+}
+
+// ggml has no FP8 type, so FP8 weights used to be widened to f16 at load,
+// twice their stored size. 2D FP8 weights nothing else chose a type for are
+// held as q8_0 instead, about their stored size; their weight_scale tensors
+// are applied by the layers as before.
+static void keep_fp8_weights_compact(ModelLoader& model_loader) {
+    int converted  = 0;
+    uint64_t saved = 0;
+    for (auto& [name, tensor_storage] : model_loader.get_tensor_storage_map()) {
+        if (!(tensor_storage.is_f8_e4m3 || tensor_storage.is_f8_e5m2) ||
+            !ends_with(name, ".weight") ||
+            tensor_storage.n_dims != 2 ||
+            tensor_storage.expected_type != GGML_TYPE_COUNT) {
+            continue;
+        }
+        if (model_loader.tensor_should_be_converted(tensor_storage, GGML_TYPE_Q8_0)) {
+            const int64_t q8_0_bytes     = tensor_storage.nelements() / ggml_blck_size(GGML_TYPE_Q8_0) * ggml_type_size(GGML_TYPE_Q8_0);
+            tensor_storage.expected_type = GGML_TYPE_Q8_0;
+            saved += tensor_storage.nbytes() - q8_0_bytes;
+            converted++;
+        }
+    }
+    if (converted > 0) {
+        LOG_INFO("%d fp8 weights kept as q8_0 instead of f16, %.2f MB less memory", converted, saved / (1024.0 * 1024.0));
+    }
+}
+
 /*=============================================== StableDiffusionGGML ================================================*/
 
 static_assert(std::atomic<sd_cancel_mode_t>::is_always_lock_free,
@@ -177,8 +428,17 @@ public:
     SDVersion version;
     bool external_vae_is_invalid = false;
 
-    bool circular_x = false;
-    bool circular_y = false;
+    bool circular_x      = false;
+    bool circular_y      = false;
+    bool vae_decode_only = false;  // the VAE was built without its encoder
+    // how init built the VAE runners, kept for sd_ctx_set_vae and
+    // sd_ctx_set_taesd
+    SDVersion vae_version          = VERSION_COUNT;  // latent format of the VAE, see --vae-format
+    bool tae_preview_only          = false;          // the TAE only decodes previews
+    bool force_sdxl_vae_conv_scale = false;
+    bool vae_conv_direct           = false;
+    bool vae_flash_attn            = false;
+    bool vae_f32_fallback          = false;
 
     std::shared_ptr<RNG> rng         = std::make_shared<PhiloxRNG>();
     std::shared_ptr<RNG> sampler_rng = nullptr;
@@ -191,29 +451,86 @@ public:
     std::shared_ptr<DiffusionModelRunner> high_noise_diffusion_model;
     std::shared_ptr<VAE> first_stage_model;
     std::shared_ptr<VAE> preview_vae;
+    std::vector<std::shared_ptr<ReplicaWeightManager>> vae_replica_weights;  // VAE copies on --vae-tile-backends
+    std::vector<std::shared_ptr<ReplicaWeightManager>> pipeline_weights;     // diffusion model slices on --pipeline-backends
+    std::shared_ptr<DiffusionModelRunner> cfg_diffusion_model;               // diffusion model copy on --cfg-backend, runs the uncond passes
+    std::shared_ptr<ReplicaWeightManager> cfg_diffusion_weights;
+    bool cfg_diffusion_enabled = true;
     std::shared_ptr<LTXV::LTXAudioVAERunner> audio_vae_model;
     std::shared_ptr<ControlNet> control_net;
+    compute_buffer_retention_t compute_buffer_retention = COMPUTE_BUFFER_FREE;  // diffusion and ControlNet buffers between requests
+    std::vector<std::pair<int, int>> resolution_buckets;                        // txt2img sizes requests are padded up to
     std::vector<std::shared_ptr<GenerationExtension>> generation_extensions;
     std::vector<std::shared_ptr<LoraModel>> runtime_lora_models;
+    std::shared_ptr<MultiLoraAdapter> diffusion_lora_adapter;
     bool apply_lora_immediately = false;
+    std::string applied_lora_signature;
+    uint64_t lora_epoch = 0;
+    ConditionCache condition_cache;
+    std::unique_ptr<sd::condition_file::File> condition_file;  // precomputed conditions, looked up before the cache
+    ConditionVisionEmbedCache vision_embed_cache{&condition_cache, &lora_epoch};
+    // The prompts of a queued generation may be encoded on another thread
+    // while this context samples (prepare_image_conditions).
+    // conditioner_mutex serializes the text encoder and the condition cache;
+    // prepared_conditions holds the results until the generation that needs
+    // them takes them.
+    std::mutex conditioner_mutex;
+    std::mutex prepared_conditions_mutex;
+    std::unordered_map<std::string, SDCondition> prepared_conditions;
+    VaeEncodeCache vae_encode_cache;
+    sd::shared_trajectory::Cache shared_trajectories;
+    LoraModelCache lora_model_cache;
+    sd_perf::PerfRecorder perf_recorder;
+    sd_perf::MemoryProbe memory_probe;
+    sd::latency_slo::Estimator latency_estimator;  // timings latency_ms requests are planned with
+    SDCallbacks callbacks;                         // installed on the threads doing this context's work
 
     std::string taesd_path;
-    sd_tiling_params_t vae_tiling_params = {false, false, 0, 0, 0.5f, 0, 0, nullptr};
+    sd_tiling_params_t vae_tiling_params = {false, false, 0, 0, 0.5f, 0, 0, nullptr, false};
     bool enable_mmap                     = false;
     sd::ggml_graph_cut::MaxVramAssignment max_vram_assignment;
-    bool stream_layers = false;
-    bool eager_load    = false;
+    bool stream_layers        = false;
+    bool hybrid_cpu_segments  = false;
+    bool eager_load           = false;
+    bool background_load      = false;
+    bool batched_cfg          = false;
+    bool offload_text_encoder = false;
+    size_t max_pinned_bytes   = SIZE_MAX;
+    size_t lora_cache_bytes   = 0;
     std::string backend_spec;
     std::string params_backend_spec;
+    std::string cpu_threadpool_args;
 
     bool is_using_v_parameterization     = false;
     bool is_using_edm_v_parameterization = false;
+    sd::turbo_preset::Preset model_turbo_preset;
 
     std::shared_ptr<ModelManager> model_manager;
+    // VAE runners set with sd_ctx_set_vae and sd_ctx_set_taesd, each loaded
+    // into a model manager of its own. The runners the context was created
+    // with are kept so an empty path restores them.
+    std::shared_ptr<ModelManager> vae_swap_manager;
+    std::shared_ptr<ModelManager> preview_vae_swap_manager;
+    std::shared_ptr<VAE> context_first_stage_model;
+    std::shared_ptr<VAE> context_preview_vae;
+    // The LTX latent upsampler, kept loaded between generations when the
+    // upscaler has a backend of its own (sd_ctx_can_overlap_latent_upscale).
+    std::string ltx_upsampler_path;
+    std::shared_ptr<ModelManager> ltx_upsampler_manager;
+    std::unique_ptr<LTXVUpsampler::LatentUpsamplerRunner> ltx_upsampler;
+    // see load_ltx_latent_statistics
+    std::vector<float> ltx_latent_mean;
+    std::vector<float> ltx_latent_std;
 
     std::shared_ptr<Denoiser> denoiser = std::make_shared<CompVisDenoiser>();
     std::vector<float> file_alphas_cumprod;
 
+    // declared last so it joins before the VAEs its previews use are freed
+    sd_preview::PreviewWorker preview_worker;
+    // runs the async generations; free_sd_ctx closes it before the context
+    // goes away
+    sd::generation::GenerationQueue generation_queue;
+
     StableDiffusionGGML() = default;
 
     ~StableDiffusionGGML() = default;
@@ -280,6 +597,154 @@ public:
                                                      params_mem_size);
     }
 
+    std::shared_ptr<VAE> create_tae_runner(bool decode_only,
+                                           ggml_backend_t backend,
+                                           const String2TensorStorage& tensor_storage_map,
+                                           std::shared_ptr<RunnerWeightManager> weights) {
+        if (sd_version_uses_wan_vae(version) || sd_version_is_ltxav(version)) {
+            return std::make_shared<TinyVideoAutoEncoder>(backend,
+                                                          tensor_storage_map,
+                                                          "decoder",
+                                                          decode_only,
+                                                          version,
+                                                          weights);
+
+        } else {
+            auto model = std::make_shared<TinyImageAutoEncoder>(backend,
+                                                                tensor_storage_map,
+                                                                "decoder.layers",
+                                                                decode_only,
+                                                                version,
+                                                                weights);
+            return model;
+        }
+    }
+
+    std::shared_ptr<VAE> create_vae_runner(ggml_backend_t backend,
+                                           const String2TensorStorage& tensor_storage_map,
+                                           std::shared_ptr<RunnerWeightManager> weights,
+                                           bool sdxl_conv_scale) {
+        if (sd_version_is_ltxav(version)) {
+            return std::make_shared<LTXVideoVAE>(backend,
+                                                 tensor_storage_map,
+                                                 "first_stage_model",
+                                                 vae_decode_only,
+                                                 version,
+                                                 weights);
+        } else if (sd_version_uses_wan_vae(version)) {
+            return std::make_shared<WAN::WanVAERunner>(backend,
+                                                       tensor_storage_map,
+                                                       "first_stage_model",
+                                                       vae_decode_only,
+                                                       version,
+                                                       weights);
+        } else {
+            auto model = std::make_shared<AutoEncoderKL>(backend,
+                                                         tensor_storage_map,
+                                                         "first_stage_model",
+                                                         vae_decode_only,
+                                                         false,
+                                                         vae_version,
+                                                         weights);
+            if (sd_version_is_sdxl(version) && sdxl_conv_scale) {
+                float vae_conv_2d_scale = 1.f / 32.f;
+                LOG_WARN(
+                    "No valid VAE specified with --vae or --force-sdxl-vae-conv-scale flag set, "
+                    "using Conv2D scale %.3f",
+                    vae_conv_2d_scale);
+                model->set_conv2d_scale(vae_conv_2d_scale);
+            }
+            return model;
+        }
+    }
+
+    // Replaces the VAE, or with `tae` the TAE, by one loaded from path into a
+    // model manager of its own; the text encoders and the diffusion model
+    // stay loaded. The TAE takes the preview slot when the context only
+    // previews with a TAE and the VAE slot otherwise. An empty path restores
+    // the runner the context was created with. Must not run beside a
+    // generation of the context.
+    bool swap_vae(const std::string& path, bool tae) {
+        if (first_stage_model == nullptr || std::dynamic_pointer_cast<FakeVAE>(first_stage_model) != nullptr) {
+            LOG_ERROR("this model has no VAE to replace");
+            return false;
+        }
+        const bool preview                          = tae && tae_preview_only;
+        std::shared_ptr<VAE>& slot                  = preview ? preview_vae : first_stage_model;
+        std::shared_ptr<ModelManager>& slot_manager = preview ? preview_vae_swap_manager : vae_swap_manager;
+        std::shared_ptr<VAE>& context_runner        = preview ? context_preview_vae : context_first_stage_model;
+        if (slot_manager == nullptr) {
+            context_runner = slot;
+        }
+        if (path.empty()) {
+            if (slot_manager != nullptr) {
+                LOG_INFO("restoring the %s the context was created with", preview ? "preview TAE" : "VAE");
+                slot = context_runner;
+                slot_manager.reset();
+                vae_encode_cache.clear();
+                clear_ltx_latent_statistics();
+            }
+            return true;
+        }
+
+        int64_t t0   = ggml_time_ms();
+        auto manager = std::make_shared<ModelManager>();
+        manager->set_n_threads(n_threads);
+        manager->set_enable_mmap(enable_mmap);
+        manager->set_max_pinned_bytes(max_pinned_bytes);
+        ModelLoader& loader = manager->loader();
+        LOG_INFO("loading %s from '%s'", tae ? "tae" : "vae", path.c_str());
+        if (!loader.init_from_file_and_convert_name(path, tae ? "tae." : "vae.", version)) {
+            LOG_ERROR("loading %s from '%s' failed", tae ? "tae" : "vae", path.c_str());
+            return false;
+        }
+
+        ggml_backend_t backend      = backend_for(SDBackendModule::VAE);
+        const bool decode_only      = preview || vae_decode_only;
+        std::shared_ptr<VAE> runner = tae ? create_tae_runner(decode_only, backend, loader.get_tensor_storage_map(), manager)
+                                          : create_vae_runner(backend, loader.get_tensor_storage_map(), manager, force_sdxl_vae_conv_scale);
+
+        std::vector<std::string> encoder_prefixes = runner->encoder_param_prefixes();
+        if (decode_only) {
+            manager->set_common_ignore_tensors(std::set<std::string>(encoder_prefixes.begin(), encoder_prefixes.end()));
+        } else {
+            manager->set_lazy_tensors(std::set<std::string>(encoder_prefixes.begin(), encoder_prefixes.end()));
+        }
+        std::map<std::string, ggml_tensor*> tensors;
+        runner->get_param_tensors(tensors);
+        if (!manager->register_param_tensors(tae ? "TAE" : "VAE",
+                                             std::move(tensors),
+                                             backend_manager.params_backend_is_disk(SDBackendModule::VAE) ? ModelManager::ResidencyMode::Disk : ModelManager::ResidencyMode::ParamBackend,
+                                             backend,
+                                             params_backend_for(SDBackendModule::VAE)) ||
+            !manager->validate_registered_tensors()) {
+            LOG_ERROR("'%s' does not hold a %s for this model", path.c_str(), tae ? "tae" : "vae");
+            return false;
+        }
+
+        runner->set_max_graph_vram_bytes(max_graph_vram_bytes_for_module(SDBackendModule::VAE));
+        if (!preview) {
+            runner->set_f32_fallback_enabled(vae_f32_fallback);
+        }
+        if (vae_conv_direct) {
+            runner->set_conv2d_direct_enabled(true);
+        }
+        if (vae_flash_attn) {
+            runner->set_flash_attention_enabled(true);
+        }
+
+        // the context's own weights load again when it is restored
+        if (slot_manager == nullptr && slot != nullptr && model_manager != nullptr) {
+            model_manager->evict_params(param_tensor_list(*slot));
+        }
+        slot         = runner;
+        slot_manager = manager;
+        vae_encode_cache.clear();
+        clear_ltx_latent_statistics();
+        LOG_INFO("%s replaced in %.2fs", tae ? "tae" : "vae", (ggml_time_ms() - t0) * 1.0f / 1000);
+        return true;
+    }
+
     bool init_backend() {
         std::string error;
         if (!backend_manager.init(backend_spec.c_str(),
@@ -288,9 +753,90 @@ public:
             LOG_ERROR("backend config failed: %s", error.c_str());
             return false;
         }
+        SDCpuThreadpoolConfig threadpool_config;
+        threadpool_config.n_threads = n_threads;
+        if (!sd_parse_cpu_threadpool_args(cpu_threadpool_args.c_str(), &threadpool_config, &error)) {
+            LOG_ERROR("%s", error.c_str());
+            return false;
+        }
+        backend_manager.set_cpu_threadpool(threadpool_config);
+        if (offload_text_encoder && backend_manager.offload_params_to_cpu(SDBackendModule::TE)) {
+            LOG_INFO("text encoder params kept in RAM, staged to the compute backend only while encoding");
+        }
         return ensure_backend_pair(SDBackendModule::DIFFUSION);
     }
 
+    // Rates --hybrid-cpu-segments weighs streaming against host compute with,
+    // from the probe of the device behind `backend` and of the CPU.
+    bool probe_host_execution_rates(ggml_backend_t backend, sd::ggml_graph_cut::HostExecutionRates* rates) {
+        ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+        if (dev == nullptr) {
+            return false;
+        }
+        const std::string dev_name = ggml_backend_dev_name(dev);
+        bool found_device          = false;
+        bool found_host            = false;
+        for (const sd::device_probe::Device& device : sd::device_probe::probe(n_threads)) {
+            if (device.is_cpu && !found_host) {
+                rates->host_gflops = device.gflops;
+                found_host         = true;
+            } else if (device.name == dev_name) {
+                rates->upload_gbps   = device.upload_gbps;
+                rates->device_gflops = device.gflops;
+                found_device         = true;
+            }
+        }
+        return found_device && found_host && rates->upload_gbps > 0.0;
+    }
+
+    // Fills the backend specs and the --max-vram budgets from the module
+    // sizes and weight types and the probe of every device.
+    bool plan_auto_placement(ModelLoader& model_loader, bool use_control_net) {
+        // the type of most matmul weights; f32 tensors are the norms and
+        // biases, unless the whole module is f32
+        auto weight_type = [](const std::map<ggml_type, uint32_t>& stat) {
+            ggml_type type = stat.count(GGML_TYPE_F32) > 0 ? GGML_TYPE_F32 : GGML_TYPE_F16;
+            uint32_t count = 0;
+            for (const auto& [stat_type, stat_count] : stat) {
+                if (stat_type != GGML_TYPE_F32 && stat_count > count) {
+                    type  = stat_type;
+                    count = stat_count;
+                }
+            }
+            return type;
+        };
+        std::vector<sd::placement::ModuleDemand> demands;
+        demands.push_back(sd::placement::make_demand(SDBackendModule::DIFFUSION,
+                                                     model_loader.get_diffusion_model_params_bytes(),
+                                                     weight_type(model_loader.get_diffusion_model_wtype_stat())));
+        demands.push_back(sd::placement::make_demand(SDBackendModule::TE,
+                                                     model_loader.get_conditioner_params_bytes(),
+                                                     weight_type(model_loader.get_conditioner_wtype_stat())));
+        demands.push_back(sd::placement::make_demand(SDBackendModule::VAE,
+                                                     model_loader.get_vae_params_bytes(),
+                                                     weight_type(model_loader.get_vae_wtype_stat())));
+        if (use_control_net) {
+            demands.push_back(sd::placement::make_demand(SDBackendModule::CONTROL_NET, model_loader.get_control_net_params_bytes()));
+        }
+
+        std::vector<sd::placement::Device> devices = sd::device_probe::probe(n_threads);
+        sd::placement::Plan plan;
+        if (!sd::placement::plan(demands, devices, &plan)) {
+            LOG_ERROR("auto placement found no placement that fits the free memory");
+            return false;
+        }
+        LOG_INFO("auto placement:\n%s", sd::placement::plan_to_string(plan, devices).c_str());
+
+        backend_spec        = plan.backend_spec;
+        params_backend_spec = plan.params_backend_spec;
+        for (size_t d = 0; d < devices.size(); d++) {
+            if (plan.max_vram_bytes[d] > 0) {
+                max_vram_assignment.backend_gib[devices[d].name] = static_cast<float>(plan.max_vram_bytes[d] / (1024.0 * 1024.0 * 1024.0));
+            }
+        }
+        return true;
+    }
+
     std::shared_ptr<RNG> get_rng(rng_type_t rng_type) {
         if (rng_type == STD_DEFAULT_RNG) {
             return std::make_shared<STDDefaultRNG>();
@@ -343,12 +889,25 @@ public:
     }
 
     bool init(const sd_ctx_params_t* sd_ctx_params) {
-        n_threads           = sd_ctx_params->n_threads;
-        enable_mmap         = sd_ctx_params->enable_mmap;
-        stream_layers       = sd_ctx_params->stream_layers;
-        eager_load          = sd_ctx_params->eager_load;
+        n_threads            = sd_ctx_params->n_threads;
+        enable_mmap          = sd_ctx_params->enable_mmap;
+        stream_layers        = sd_ctx_params->stream_layers;
+        hybrid_cpu_segments  = sd_ctx_params->hybrid_cpu_segments;
+        eager_load           = sd_ctx_params->eager_load;
+        background_load      = sd_ctx_params->background_load;
+        batched_cfg          = sd_ctx_params->batched_cfg;
+        offload_text_encoder = sd_ctx_params->offload_text_encoder;
+        condition_cache.set_budget_bytes(static_cast<size_t>(std::max(0, sd_ctx_params->condition_cache_mb)) * 1024 * 1024);
+        vae_encode_cache.set_budget_bytes(static_cast<size_t>(std::max(0, sd_ctx_params->vae_encode_cache_mb)) * 1024 * 1024);
+        lora_model_cache.set_budget_bytes(static_cast<size_t>(std::max(0, sd_ctx_params->lora_model_cache_mb)) * 1024 * 1024);
+        max_pinned_bytes = sd_ctx_params->max_pinned_mb < 0 ? SIZE_MAX : static_cast<size_t>(sd_ctx_params->max_pinned_mb) * 1024 * 1024;
+        lora_cache_bytes = static_cast<size_t>(std::max(0, sd_ctx_params->lora_cache_mb)) * 1024 * 1024;
+        // before any backend computes or params buffer is touched
+        sd::set_host_memory_policy(sd_ctx_params->numa_placement, sd_ctx_params->huge_pages);
+        sd::TaskPool::instance().reserve_threads(n_threads);
         backend_spec        = SAFE_STR(sd_ctx_params->backend);
         params_backend_spec = SAFE_STR(sd_ctx_params->params_backend);
+        cpu_threadpool_args = SAFE_STR(sd_ctx_params->cpu_threadpool_args);
         max_vram_assignment.reset(0.f);
         {
             std::string error;
@@ -361,9 +920,17 @@ public:
         std::string rpc_servers_spec = SAFE_STR(sd_ctx_params->rpc_servers);
         add_rpc_devices(rpc_servers_spec);
 
+        // before this context allocates, so the free memory is what the
+        // devices have to offer; --auto-placement reuses the probe
+        if (strlen(SAFE_STR(sd_ctx_params->device_probe_cache)) > 0) {
+            sd::device_probe::set_cache_path(sd_ctx_params->device_probe_cache);
+            LOG_INFO("device probe:\n%s", sd::device_probe::to_string(sd::device_probe::probe(n_threads)).c_str());
+        }
+
         bool use_tae         = false;
         bool use_audio_vae   = false;
         bool use_control_net = false;
+        std::vector<std::pair<std::shared_ptr<VAE>, std::shared_ptr<ReplicaWeightManager>>> vae_tile_replicas;
 
         rng = get_rng(sd_ctx_params->rng_type);
         if (sd_ctx_params->sampler_rng_type != RNG_TYPE_COUNT && sd_ctx_params->sampler_rng_type != sd_ctx_params->rng_type) {
@@ -374,152 +941,223 @@ public:
 
         ggml_log_set(ggml_log_callback_default, nullptr);
 
-        if (!init_backend()) {
-            return false;
+        // With --auto-placement the backends are set up once the model files
+        // are indexed, since the plan needs the size of every module.
+        bool auto_placement = sd_ctx_params->auto_placement;
+        if (auto_placement && (!backend_spec.empty() || !params_backend_spec.empty() ||
+                               max_vram_assignment.default_gib != 0.f || !max_vram_assignment.backend_gib.empty())) {
+            LOG_WARN("--auto-placement is ignored with --backend, --params-backend or --max-vram");
+            auto_placement = false;
         }
-        {
+        auto setup_backends = [&]() -> bool {
+            if (!init_backend()) {
+                return false;
+            }
             std::string error;
             if (!max_vram_assignment.canonicalize_backend_keys(&error)) {
                 LOG_ERROR("%s", error.c_str());
                 return false;
             }
-        }
-        if (stream_layers && !backend_manager.params_backend_is_cpu(SDBackendModule::DIFFUSION)) {
-            LOG_WARN("--stream-layers has no effect unless diffusion params backend is cpu; ignoring");
-            stream_layers = false;
+            if (stream_layers && !backend_manager.params_backend_is_cpu(SDBackendModule::DIFFUSION)) {
+                LOG_WARN("--stream-layers has no effect unless diffusion params backend is cpu; ignoring");
+                stream_layers = false;
+            }
+            return true;
+        };
+        if (!auto_placement && !setup_backends()) {
+            return false;
         }
 
         model_manager = std::make_shared<ModelManager>();
         model_manager->set_n_threads(n_threads);
         model_manager->set_enable_mmap(enable_mmap);
+        model_manager->set_max_pinned_bytes(max_pinned_bytes);
+        model_manager->set_max_lora_cache_bytes(lora_cache_bytes);
+        model_manager->set_cpu_repack(sd_ctx_params->cpu_repack);
+        model_manager->set_shared_compute_buffer(sd_ctx_params->shared_compute_buffer);
+        if (sd_ctx_params->compute_buffer_retention < COMPUTE_BUFFER_RETENTION_COUNT) {
+            compute_buffer_retention = sd_ctx_params->compute_buffer_retention;
+        }
+        for (std::string part : split_string(SAFE_STR(sd_ctx_params->resolution_buckets), ',')) {
+            part       = trim(part);
+            int width  = 0;
+            int height = 0;
+            char tail  = 0;
+            if (part.empty()) {
+                continue;
+            }
+            if (sscanf(part.c_str(), "%dx%d%c", &width, &height, &tail) != 2 || width <= 0 || height <= 0) {
+                LOG_WARN("invalid resolution bucket '%s', ignoring it", part.c_str());
+                continue;
+            }
+            resolution_buckets.emplace_back(width, height);
+        }
         ModelLoader& model_loader = model_manager->loader();
-
-        if (strlen(SAFE_STR(sd_ctx_params->model_path)) > 0) {
-            LOG_INFO("loading model from '%s'", sd_ctx_params->model_path);
-            if (!model_loader.init_from_file(sd_ctx_params->model_path)) {
-                LOG_ERROR("init model loader from file failed: '%s'", sd_ctx_params->model_path);
+        model_loader.set_index_dir(SAFE_STR(sd_ctx_params->model_cache_dir));
+        sd::ggml_graph_cut::set_plan_cache_dir(SAFE_STR(sd_ctx_params->model_cache_dir));
+
+        std::string model_cache_path;
+        bool model_cache_hit      = false;
+        bool model_files_complete = true;
+        if (strlen(SAFE_STR(sd_ctx_params->model_cache_dir)) > 0) {
+            model_cache_path = get_model_cache_path(sd_ctx_params);
+            if (file_exists(model_cache_path)) {
+                LOG_INFO("loading model cache from '%s'", model_cache_path.c_str());
+                model_cache_hit = model_loader.init_from_file(model_cache_path);
+                if (!model_cache_hit) {
+                    LOG_WARN("model cache '%s' is unreadable, loading the model files instead", model_cache_path.c_str());
+                }
             }
         }
 
-        if (strlen(SAFE_STR(sd_ctx_params->diffusion_model_path)) > 0) {
-            LOG_INFO("loading diffusion model from '%s'", sd_ctx_params->diffusion_model_path);
-            if (!model_loader.init_from_file(sd_ctx_params->diffusion_model_path, "model.diffusion_model.")) {
-                LOG_WARN("loading diffusion model from '%s' failed", sd_ctx_params->diffusion_model_path);
+        if (model_cache_hit) {
+            // a cache is only written once every model file loaded
+            use_tae         = strlen(SAFE_STR(sd_ctx_params->taesd_path)) > 0;
+            use_audio_vae   = strlen(SAFE_STR(sd_ctx_params->audio_vae_path)) > 0;
+            use_control_net = strlen(SAFE_STR(sd_ctx_params->control_net_path)) > 0;
+        } else {
+            if (strlen(SAFE_STR(sd_ctx_params->model_path)) > 0) {
+                LOG_INFO("loading model from '%s'", sd_ctx_params->model_path);
+                if (!model_loader.init_from_file(sd_ctx_params->model_path)) {
+                    LOG_ERROR("init model loader from file failed: '%s'", sd_ctx_params->model_path);
+                    model_files_complete = false;
+                }
+            }
+
+            if (strlen(SAFE_STR(sd_ctx_params->diffusion_model_path)) > 0) {
+                LOG_INFO("loading diffusion model from '%s'", sd_ctx_params->diffusion_model_path);
+                if (!model_loader.init_from_file(sd_ctx_params->diffusion_model_path, "model.diffusion_model.")) {
+                    LOG_WARN("loading diffusion model from '%s' failed", sd_ctx_params->diffusion_model_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->high_noise_diffusion_model_path)) > 0) {
-            LOG_INFO("loading high noise diffusion model from '%s'", sd_ctx_params->high_noise_diffusion_model_path);
-            if (!model_loader.init_from_file(sd_ctx_params->high_noise_diffusion_model_path, "model.high_noise_diffusion_model.")) {
-                LOG_WARN("loading diffusion model from '%s' failed", sd_ctx_params->high_noise_diffusion_model_path);
+            if (strlen(SAFE_STR(sd_ctx_params->high_noise_diffusion_model_path)) > 0) {
+                LOG_INFO("loading high noise diffusion model from '%s'", sd_ctx_params->high_noise_diffusion_model_path);
+                if (!model_loader.init_from_file(sd_ctx_params->high_noise_diffusion_model_path, "model.high_noise_diffusion_model.")) {
+                    LOG_WARN("loading diffusion model from '%s' failed", sd_ctx_params->high_noise_diffusion_model_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->uncond_diffusion_model_path)) > 0) {
-            LOG_INFO("loading unconditional diffusion model from '%s'", sd_ctx_params->uncond_diffusion_model_path);
-            if (!model_loader.init_from_file(sd_ctx_params->uncond_diffusion_model_path, "model.diffusion_model.uncond.")) {
-                LOG_WARN("loading unconditional diffusion model from '%s' failed", sd_ctx_params->uncond_diffusion_model_path);
+            if (strlen(SAFE_STR(sd_ctx_params->uncond_diffusion_model_path)) > 0) {
+                LOG_INFO("loading unconditional diffusion model from '%s'", sd_ctx_params->uncond_diffusion_model_path);
+                if (!model_loader.init_from_file(sd_ctx_params->uncond_diffusion_model_path, "model.diffusion_model.uncond.")) {
+                    LOG_WARN("loading unconditional diffusion model from '%s' failed", sd_ctx_params->uncond_diffusion_model_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        bool is_unet = sd_version_is_unet(model_loader.get_sd_version());
+            bool is_unet = sd_version_is_unet(model_loader.get_sd_version());
 
-        if (strlen(SAFE_STR(sd_ctx_params->clip_l_path)) > 0) {
-            LOG_INFO("loading clip_l from '%s'", sd_ctx_params->clip_l_path);
-            std::string prefix = is_unet ? "cond_stage_model.transformer." : "text_encoders.clip_l.transformer.";
-            if (!model_loader.init_from_file(sd_ctx_params->clip_l_path, prefix)) {
-                LOG_WARN("loading clip_l from '%s' failed", sd_ctx_params->clip_l_path);
+            if (strlen(SAFE_STR(sd_ctx_params->clip_l_path)) > 0) {
+                LOG_INFO("loading clip_l from '%s'", sd_ctx_params->clip_l_path);
+                std::string prefix = is_unet ? "cond_stage_model.transformer." : "text_encoders.clip_l.transformer.";
+                if (!model_loader.init_from_file(sd_ctx_params->clip_l_path, prefix)) {
+                    LOG_WARN("loading clip_l from '%s' failed", sd_ctx_params->clip_l_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->clip_g_path)) > 0) {
-            LOG_INFO("loading clip_g from '%s'", sd_ctx_params->clip_g_path);
-            std::string prefix = is_unet ? "cond_stage_model.1.transformer." : "text_encoders.clip_g.transformer.";
-            if (!model_loader.init_from_file(sd_ctx_params->clip_g_path, prefix)) {
-                LOG_WARN("loading clip_g from '%s' failed", sd_ctx_params->clip_g_path);
+            if (strlen(SAFE_STR(sd_ctx_params->clip_g_path)) > 0) {
+                LOG_INFO("loading clip_g from '%s'", sd_ctx_params->clip_g_path);
+                std::string prefix = is_unet ? "cond_stage_model.1.transformer." : "text_encoders.clip_g.transformer.";
+                if (!model_loader.init_from_file(sd_ctx_params->clip_g_path, prefix)) {
+                    LOG_WARN("loading clip_g from '%s' failed", sd_ctx_params->clip_g_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->clip_vision_path)) > 0) {
-            LOG_INFO("loading clip_vision from '%s'", sd_ctx_params->clip_vision_path);
-            std::string prefix = "cond_stage_model.transformer.";
-            if (!model_loader.init_from_file(sd_ctx_params->clip_vision_path, prefix)) {
-                LOG_WARN("loading clip_vision from '%s' failed", sd_ctx_params->clip_vision_path);
+            if (strlen(SAFE_STR(sd_ctx_params->clip_vision_path)) > 0) {
+                LOG_INFO("loading clip_vision from '%s'", sd_ctx_params->clip_vision_path);
+                std::string prefix = "cond_stage_model.transformer.";
+                if (!model_loader.init_from_file(sd_ctx_params->clip_vision_path, prefix)) {
+                    LOG_WARN("loading clip_vision from '%s' failed", sd_ctx_params->clip_vision_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->t5xxl_path)) > 0) {
-            LOG_INFO("loading t5xxl from '%s'", sd_ctx_params->t5xxl_path);
-            if (!model_loader.init_from_file(sd_ctx_params->t5xxl_path, "text_encoders.t5xxl.transformer.")) {
-                LOG_WARN("loading t5xxl from '%s' failed", sd_ctx_params->t5xxl_path);
+            if (strlen(SAFE_STR(sd_ctx_params->t5xxl_path)) > 0) {
+                LOG_INFO("loading t5xxl from '%s'", sd_ctx_params->t5xxl_path);
+                if (!model_loader.init_from_file(sd_ctx_params->t5xxl_path, "text_encoders.t5xxl.transformer.")) {
+                    LOG_WARN("loading t5xxl from '%s' failed", sd_ctx_params->t5xxl_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->pulid_weights_path)) > 0) {
-            LOG_INFO("loading PuLID weights from '%s'", sd_ctx_params->pulid_weights_path);
-            if (!model_loader.init_from_file(sd_ctx_params->pulid_weights_path,
-                                             "model.diffusion_model.")) {
-                LOG_WARN("loading PuLID weights from '%s' failed", sd_ctx_params->pulid_weights_path);
+            if (strlen(SAFE_STR(sd_ctx_params->pulid_weights_path)) > 0) {
+                LOG_INFO("loading PuLID weights from '%s'", sd_ctx_params->pulid_weights_path);
+                if (!model_loader.init_from_file(sd_ctx_params->pulid_weights_path,
+                                                 "model.diffusion_model.")) {
+                    LOG_WARN("loading PuLID weights from '%s' failed", sd_ctx_params->pulid_weights_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->llm_path)) > 0) {
-            LOG_INFO("loading llm from '%s'", sd_ctx_params->llm_path);
-            if (!model_loader.init_from_file(sd_ctx_params->llm_path, "text_encoders.llm.")) {
-                LOG_WARN("loading llm from '%s' failed", sd_ctx_params->llm_path);
+            if (strlen(SAFE_STR(sd_ctx_params->llm_path)) > 0) {
+                LOG_INFO("loading llm from '%s'", sd_ctx_params->llm_path);
+                if (!model_loader.init_from_file(sd_ctx_params->llm_path, "text_encoders.llm.")) {
+                    LOG_WARN("loading llm from '%s' failed", sd_ctx_params->llm_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->llm_vision_path)) > 0) {
-            LOG_INFO("loading llm vision from '%s'", sd_ctx_params->llm_vision_path);
-            if (!model_loader.init_from_file(sd_ctx_params->llm_vision_path, "text_encoders.llm.visual.")) {
-                LOG_WARN("loading llm vision from '%s' failed", sd_ctx_params->llm_vision_path);
+            if (strlen(SAFE_STR(sd_ctx_params->llm_vision_path)) > 0) {
+                LOG_INFO("loading llm vision from '%s'", sd_ctx_params->llm_vision_path);
+                if (!model_loader.init_from_file(sd_ctx_params->llm_vision_path, "text_encoders.llm.visual.")) {
+                    LOG_WARN("loading llm vision from '%s' failed", sd_ctx_params->llm_vision_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->vae_path)) > 0) {
-            LOG_INFO("loading vae from '%s'", sd_ctx_params->vae_path);
-            if (!model_loader.init_from_file(sd_ctx_params->vae_path, "vae.")) {
-                LOG_WARN("loading vae from '%s' failed", sd_ctx_params->vae_path);
-                external_vae_is_invalid = true;
+            if (strlen(SAFE_STR(sd_ctx_params->vae_path)) > 0) {
+                LOG_INFO("loading vae from '%s'", sd_ctx_params->vae_path);
+                if (!model_loader.init_from_file(sd_ctx_params->vae_path, "vae.")) {
+                    LOG_WARN("loading vae from '%s' failed", sd_ctx_params->vae_path);
+                    model_files_complete = false;
+                    external_vae_is_invalid = true;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->taesd_path)) > 0) {
-            LOG_INFO("loading tae from '%s'", sd_ctx_params->taesd_path);
-            if (!model_loader.init_from_file(sd_ctx_params->taesd_path, "tae.")) {
-                LOG_WARN("loading tae from '%s' failed", sd_ctx_params->taesd_path);
-            } else {
-                use_tae = true;
+            if (strlen(SAFE_STR(sd_ctx_params->taesd_path)) > 0) {
+                LOG_INFO("loading tae from '%s'", sd_ctx_params->taesd_path);
+                if (!model_loader.init_from_file(sd_ctx_params->taesd_path, "tae.")) {
+                    LOG_WARN("loading tae from '%s' failed", sd_ctx_params->taesd_path);
+                    model_files_complete = false;
+                } else {
+                    use_tae = true;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->embeddings_connectors_path)) > 0) {
-            LOG_INFO("loading embeddings connectors from '%s'", sd_ctx_params->embeddings_connectors_path);
-            if (!model_loader.init_from_file(sd_ctx_params->embeddings_connectors_path)) {
-                LOG_WARN("loading embeddings connectors from '%s' failed", sd_ctx_params->embeddings_connectors_path);
+            if (strlen(SAFE_STR(sd_ctx_params->embeddings_connectors_path)) > 0) {
+                LOG_INFO("loading embeddings connectors from '%s'", sd_ctx_params->embeddings_connectors_path);
+                if (!model_loader.init_from_file(sd_ctx_params->embeddings_connectors_path)) {
+                    LOG_WARN("loading embeddings connectors from '%s' failed", sd_ctx_params->embeddings_connectors_path);
+                    model_files_complete = false;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->audio_vae_path)) > 0) {
-            LOG_INFO("loading LTX audio VAE from '%s'", sd_ctx_params->audio_vae_path);
-            if (!model_loader.init_from_file(sd_ctx_params->audio_vae_path)) {
-                LOG_WARN("loading LTX audio VAE weights from '%s' failed", sd_ctx_params->audio_vae_path);
-            } else {
-                use_audio_vae = true;
+            if (strlen(SAFE_STR(sd_ctx_params->audio_vae_path)) > 0) {
+                LOG_INFO("loading LTX audio VAE from '%s'", sd_ctx_params->audio_vae_path);
+                if (!model_loader.init_from_file(sd_ctx_params->audio_vae_path)) {
+                    LOG_WARN("loading LTX audio VAE weights from '%s' failed", sd_ctx_params->audio_vae_path);
+                    model_files_complete = false;
+                } else {
+                    use_audio_vae = true;
+                }
             }
-        }
 
-        if (strlen(SAFE_STR(sd_ctx_params->control_net_path)) > 0) {
-            if (!model_loader.init_from_file(sd_ctx_params->control_net_path)) {
-                LOG_ERROR("init control net model loader from file failed: '%s'", sd_ctx_params->control_net_path);
-                return false;
-            } else {
-                use_control_net = true;
+            if (strlen(SAFE_STR(sd_ctx_params->control_net_path)) > 0) {
+                if (!model_loader.init_from_file(sd_ctx_params->control_net_path)) {
+                    LOG_ERROR("init control net model loader from file failed: '%s'", sd_ctx_params->control_net_path);
+                    return false;
+                } else {
+                    use_control_net = true;
+                }
             }
-        }
 
-        model_loader.convert_tensors_name();
+            model_loader.convert_tensors_name();
+        }
 
         version = model_loader.get_sd_version();
         if (version == VERSION_COUNT) {
@@ -530,11 +1168,46 @@ public:
         auto& tensor_storage_map = model_loader.get_tensor_storage_map();
 
         LOG_INFO("Version: %s ", model_version_to_str[version]);
+        // distilled checkpoints name their distillation in the file name or
+        // metadata; Flux schnell is the Flux without a guidance embedding
+        model_turbo_preset = sd::turbo_preset::detect(sd::turbo_preset::describe_file(SAFE_STR(sd_ctx_params->model_path)) + " " +
+                                                      sd::turbo_preset::describe_file(SAFE_STR(sd_ctx_params->diffusion_model_path)));
+        if (!model_turbo_preset.found() && version == VERSION_FLUX) {
+            bool has_guidance = false;
+            for (const auto& [name, _] : tensor_storage_map) {
+                if (name.find("guidance_in.") != std::string::npos ||
+                    name.find("distilled_guidance_layer.") != std::string::npos) {
+                    has_guidance = true;
+                    break;
+                }
+            }
+            if (!has_guidance) {
+                model_turbo_preset = sd::turbo_preset::preset_for(sd::turbo_preset::Kind::SCHNELL, 0);
+            }
+        }
+        if (model_turbo_preset.found()) {
+            LOG_DEBUG("model looks step-distilled (%s)", model_turbo_preset.name);
+        }
         ggml_type wtype               = sd_type_to_ggml_type(sd_ctx_params->wtype);
         std::string tensor_type_rules = SAFE_STR(sd_ctx_params->tensor_type_rules);
         if (wtype != GGML_TYPE_COUNT || tensor_type_rules.size() > 0) {
             model_loader.set_wtype_override(wtype, tensor_type_rules);
         }
+        keep_fp8_weights_compact(model_loader);
+        if (auto_placement && (!plan_auto_placement(model_loader, use_control_net) || !setup_backends())) {
+            return false;
+        }
+        if (sd_ctx_params->stream_q8_0) {
+            if (backend_manager.params_backend_is_cpu(SDBackendModule::DIFFUSION) &&
+                !backend_manager.runtime_backend_is_cpu(SDBackendModule::DIFFUSION)) {
+                quantize_streamed_diffusion_weights(model_loader);
+            } else {
+                LOG_WARN("--stream-q8-0 only applies when the diffusion params are kept in RAM for a GPU; ignoring");
+            }
+        }
+        if (sd_ctx_params->llm_cpu_q8_0 && backend_manager.runtime_backend_is_cpu(SDBackendModule::TE)) {
+            quantize_llm_projections(model_loader);
+        }
 
         std::map<ggml_type, uint32_t> wtype_stat                 = model_loader.get_wtype_stat();
         std::map<ggml_type, uint32_t> conditioner_wtype_stat     = model_loader.get_conditioner_wtype_stat();
@@ -587,6 +1260,13 @@ public:
         } else {
             apply_lora_immediately = false;
         }
+        if (apply_lora_immediately && sd_ctx_params->cpu_repack) {
+            // repacked weights cannot be read back to merge a LoRA into them
+            if (sd_ctx_params->lora_apply_mode == LORA_APPLY_IMMEDIATELY) {
+                LOG_WARN("--cpu-repack applies LoRAs at runtime");
+            }
+            apply_lora_immediately = false;
+        }
 
         bool needs_writable_mmap = enable_mmap && apply_lora_immediately;
         model_manager->set_writable_mmap(needs_writable_mmap);
@@ -602,7 +1282,7 @@ public:
         size_t control_net_params_mem_size  = 0;
         size_t extension_params_mem_size    = 0;
 
-        bool tae_preview_only = sd_ctx_params->tae_preview_only;
+        tae_preview_only = sd_ctx_params->tae_preview_only;
         if (version == VERSION_SDXS_512_DS || version == VERSION_SDXS_09) {
             tae_preview_only = false;
             use_tae          = true;
@@ -612,6 +1292,9 @@ public:
             LOG_INFO("Using circular padding for convolutions");
         }
 
+        // Builds the diffusion model on a backend, so --cfg-backend can make a
+        // full copy of it.
+        std::function<std::shared_ptr<DiffusionModelRunner>(ggml_backend_t, std::shared_ptr<RunnerWeightManager>)> create_diffusion_model;
         {
             if (!ensure_backend_pair(SDBackendModule::TE) ||
                 !ensure_backend_pair(SDBackendModule::DIFFUSION)) {
@@ -622,10 +1305,13 @@ public:
                 cond_stage_model = std::make_shared<SD3CLIPEmbedder>(backend_for(SDBackendModule::TE),
                                                                      tensor_storage_map,
                                                                      model_manager);
-                diffusion_model  = std::make_shared<MMDiTRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                tensor_storage_map,
-                                                                "model.diffusion_model",
-                                                                model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<MMDiTRunner>(backend,
+                                                         tensor_storage_map,
+                                                         "model.diffusion_model",
+                                                         weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_pid(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -633,10 +1319,13 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Pid::PiDRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                   tensor_storage_map,
-                                                                   "model.diffusion_model.net",
-                                                                   model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Pid::PiDRunner>(backend,
+                                                            tensor_storage_map,
+                                                            "model.diffusion_model.net",
+                                                            weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_ideogram4(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -644,10 +1333,13 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Ideogram4::Ideogram4Runner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                               tensor_storage_map,
-                                                                               "model.diffusion_model",
-                                                                               model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Ideogram4::Ideogram4Runner>(backend,
+                                                                        tensor_storage_map,
+                                                                        "model.diffusion_model",
+                                                                        weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_krea2(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -655,10 +1347,13 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Krea2::Krea2Runner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                       tensor_storage_map,
-                                                                       "model.diffusion_model",
-                                                                       model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Krea2::Krea2Runner>(backend,
+                                                                tensor_storage_map,
+                                                                "model.diffusion_model",
+                                                                weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_flux(version)) {
                 bool is_chroma = false;
                 for (auto pair : tensor_storage_map) {
@@ -686,12 +1381,15 @@ public:
                                                                           tensor_storage_map,
                                                                           model_manager);
                 }
-                diffusion_model = std::make_shared<Flux::FluxRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                     tensor_storage_map,
-                                                                     "model.diffusion_model",
-                                                                     version,
-                                                                     sd_ctx_params->chroma_use_dit_mask,
-                                                                     model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Flux::FluxRunner>(backend,
+                                                              tensor_storage_map,
+                                                              "model.diffusion_model",
+                                                              version,
+                                                              sd_ctx_params->chroma_use_dit_mask,
+                                                              weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_flux2(version) || sd_version_is_sefi_image(version)) {
                 bool is_chroma   = false;
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
@@ -700,22 +1398,28 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Flux::FluxRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                     tensor_storage_map,
-                                                                     "model.diffusion_model",
-                                                                     version,
-                                                                     sd_ctx_params->chroma_use_dit_mask,
-                                                                     model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Flux::FluxRunner>(backend,
+                                                              tensor_storage_map,
+                                                              "model.diffusion_model",
+                                                              version,
+                                                              sd_ctx_params->chroma_use_dit_mask,
+                                                              weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_ltxav(version)) {
                 cond_stage_model = std::make_shared<LTXAVEmbedder>(backend_for(SDBackendModule::TE),
                                                                    tensor_storage_map,
                                                                    "text_encoders.llm",
                                                                    "text_embedding_projection",
                                                                    model_manager);
-                diffusion_model  = std::make_shared<LTXV::LTXAVRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                      tensor_storage_map,
-                                                                      "model.diffusion_model",
-                                                                      model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<LTXV::LTXAVRunner>(backend,
+                                                               tensor_storage_map,
+                                                               "model.diffusion_model",
+                                                               weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_wan(version)) {
                 cond_stage_model = std::make_shared<T5CLIPEmbedder>(backend_for(SDBackendModule::TE),
                                                                     tensor_storage_map,
@@ -723,11 +1427,14 @@ public:
                                                                     0,
                                                                     true,
                                                                     model_manager);
-                diffusion_model  = std::make_shared<WAN::WanRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                   tensor_storage_map,
-                                                                   "model.diffusion_model",
-                                                                   version,
-                                                                   model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<WAN::WanRunner>(backend,
+                                                            tensor_storage_map,
+                                                            "model.diffusion_model",
+                                                            version,
+                                                            weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
                 if (strlen(SAFE_STR(sd_ctx_params->high_noise_diffusion_model_path)) > 0) {
                     high_noise_diffusion_model = std::make_shared<WAN::WanRunner>(backend_for(SDBackendModule::DIFFUSION),
                                                                                   tensor_storage_map,
@@ -758,12 +1465,15 @@ public:
                                                                  "",
                                                                  true,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Qwen::QwenImageRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                          tensor_storage_map,
-                                                                          "model.diffusion_model",
-                                                                          version,
-                                                                          sd_ctx_params->qwen_image_zero_cond_t,
-                                                                          model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Qwen::QwenImageRunner>(backend,
+                                                                   tensor_storage_map,
+                                                                   "model.diffusion_model",
+                                                                   version,
+                                                                   sd_ctx_params->qwen_image_zero_cond_t,
+                                                                   weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_longcat(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -771,28 +1481,37 @@ public:
                                                                  "",
                                                                  true,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Flux::FluxRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                     tensor_storage_map,
-                                                                     "model.diffusion_model",
-                                                                     version,
-                                                                     sd_ctx_params->chroma_use_dit_mask,
-                                                                     model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Flux::FluxRunner>(backend,
+                                                              tensor_storage_map,
+                                                              "model.diffusion_model",
+                                                              version,
+                                                              sd_ctx_params->chroma_use_dit_mask,
+                                                              weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (version == VERSION_HIDREAM_O1) {
                 cond_stage_model = std::make_shared<HiDreamO1::HiDreamO1Conditioner>(backend_for(SDBackendModule::TE),
                                                                                      tensor_storage_map,
                                                                                      model_manager);
-                diffusion_model  = std::make_shared<HiDreamO1::HiDreamO1Runner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                               tensor_storage_map,
-                                                                               "model",
-                                                                               model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<HiDreamO1::HiDreamO1Runner>(backend,
+                                                                        tensor_storage_map,
+                                                                        "model",
+                                                                        weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_anima(version)) {
                 cond_stage_model = std::make_shared<AnimaConditioner>(backend_for(SDBackendModule::TE),
                                                                       tensor_storage_map,
                                                                       model_manager);
-                diffusion_model  = std::make_shared<Anima::AnimaRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                       tensor_storage_map,
-                                                                       "model.diffusion_model",
-                                                                       model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Anima::AnimaRunner>(backend,
+                                                                tensor_storage_map,
+                                                                "model.diffusion_model",
+                                                                weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_z_image(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -800,11 +1519,14 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<ZImage::ZImageRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                         tensor_storage_map,
-                                                                         "model.diffusion_model",
-                                                                         version,
-                                                                         model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<ZImage::ZImageRunner>(backend,
+                                                                  tensor_storage_map,
+                                                                  "model.diffusion_model",
+                                                                  version,
+                                                                  weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_boogu_image(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -812,11 +1534,14 @@ public:
                                                                  "",
                                                                  true,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Boogu::BooguImageRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                            tensor_storage_map,
-                                                                            "model.diffusion_model",
-                                                                            version,
-                                                                            model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Boogu::BooguImageRunner>(backend,
+                                                                     tensor_storage_map,
+                                                                     "model.diffusion_model",
+                                                                     version,
+                                                                     weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_ernie_image(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -824,10 +1549,13 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<ErnieImage::ErnieImageRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                                 tensor_storage_map,
-                                                                                 "model.diffusion_model",
-                                                                                 model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<ErnieImage::ErnieImageRunner>(backend,
+                                                                          tensor_storage_map,
+                                                                          "model.diffusion_model",
+                                                                          weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else if (sd_version_is_lens(version)) {
                 cond_stage_model = std::make_shared<LLMEmbedder>(backend_for(SDBackendModule::TE),
                                                                  tensor_storage_map,
@@ -835,10 +1563,13 @@ public:
                                                                  "",
                                                                  false,
                                                                  model_manager);
-                diffusion_model  = std::make_shared<Lens::LensRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                     tensor_storage_map,
-                                                                     "model.diffusion_model",
-                                                                     model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<Lens::LensRunner>(backend,
+                                                              tensor_storage_map,
+                                                              "model.diffusion_model",
+                                                              weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
             } else {  // SD1.x SD2.x SDXL
                 std::map<std::string, std::string> embbeding_map;
                 for (uint32_t i = 0; i < sd_ctx_params->embedding_count; i++) {
@@ -849,11 +1580,14 @@ public:
                                                                                        embbeding_map,
                                                                                        version,
                                                                                        model_manager);
-                diffusion_model  = std::make_shared<UNetModelRunner>(backend_for(SDBackendModule::DIFFUSION),
-                                                                    tensor_storage_map,
-                                                                    "model.diffusion_model",
-                                                                    version,
-                                                                    model_manager);
+                create_diffusion_model = [&](ggml_backend_t backend, std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<DiffusionModelRunner> {
+                    return std::make_shared<UNetModelRunner>(backend,
+                                                             tensor_storage_map,
+                                                             "model.diffusion_model",
+                                                             version,
+                                                             weights);
+                };
+                diffusion_model = create_diffusion_model(backend_for(SDBackendModule::DIFFUSION), model_manager);
                 if (sd_ctx_params->diffusion_conv_direct) {
                     LOG_INFO("Using Conv2d direct in the diffusion model");
                     diffusion_model->set_conv2d_direct_enabled(true);
@@ -861,6 +1595,11 @@ public:
             }
 
             cond_stage_model->set_max_graph_vram_bytes(max_graph_vram_bytes_for_module(SDBackendModule::TE));
+            cond_stage_model->set_vision_embed_cache(&vision_embed_cache);
+            if (sd_ctx_params->dynamic_text_length && sd_version_is_flux(version)) {
+                LOG_INFO("Using dynamic text length for the T5 prompt");
+                cond_stage_model->set_dynamic_text_length_enabled(true);
+            }
             if (!register_runner_params("Conditioner model",
                                         cond_stage_model,
                                         SDBackendModule::TE,
@@ -892,24 +1631,11 @@ public:
                 return false;
             }
 
-            auto create_tae = [&](bool decode_only) -> std::shared_ptr<VAE> {
-                if (sd_version_uses_wan_vae(version) || sd_version_is_ltxav(version)) {
-                    return std::make_shared<TinyVideoAutoEncoder>(backend_for(SDBackendModule::VAE),
-                                                                  tensor_storage_map,
-                                                                  "decoder",
-                                                                  decode_only,
-                                                                  version,
-                                                                  model_manager);
-
-                } else {
-                    auto model = std::make_shared<TinyImageAutoEncoder>(backend_for(SDBackendModule::VAE),
-                                                                        tensor_storage_map,
-                                                                        "decoder.layers",
-                                                                        decode_only,
-                                                                        version,
-                                                                        model_manager);
-                    return model;
-                }
+            vae_decode_only = sd_ctx_params->vae_decode_only;
+            auto create_tae = [&](bool decode_only,
+                                  ggml_backend_t backend,
+                                  std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<VAE> {
+                return create_tae_runner(decode_only, backend, tensor_storage_map, weights);
             };
 
             sd_vae_format_t vae_format = sd_ctx_params->vae_format;
@@ -917,45 +1643,17 @@ public:
                 LOG_WARN("invalid VAE format override, using auto");
                 vae_format = SD_VAE_FORMAT_AUTO;
             }
-            SDVersion vae_version = version;
+            vae_version = version;
             if (sd_version_is_pid(version) && vae_format != SD_VAE_FORMAT_AUTO) {
                 vae_version = sd_vae_format_to_version(vae_format, vae_version);
             }
+            force_sdxl_vae_conv_scale = sd_ctx_params->force_sdxl_vae_conv_scale;
 
-            auto create_vae = [&]() -> std::shared_ptr<VAE> {
-                if (sd_version_is_ltxav(version)) {
-                    return std::make_shared<LTXVideoVAE>(backend_for(SDBackendModule::VAE),
-                                                         tensor_storage_map,
-                                                         "first_stage_model",
-                                                         false,
-                                                         version,
-                                                         model_manager);
-                } else if (sd_version_uses_wan_vae(version)) {
-                    return std::make_shared<WAN::WanVAERunner>(backend_for(SDBackendModule::VAE),
-                                                               tensor_storage_map,
-                                                               "first_stage_model",
-                                                               false,
-                                                               version,
-                                                               model_manager);
-                } else {
-                    auto model = std::make_shared<AutoEncoderKL>(backend_for(SDBackendModule::VAE),
-                                                                 tensor_storage_map,
-                                                                 "first_stage_model",
-                                                                 false,
-                                                                 false,
-                                                                 vae_version,
-                                                                 model_manager);
-                    if (sd_version_is_sdxl(version) &&
-                        (strlen(SAFE_STR(sd_ctx_params->vae_path)) == 0 || sd_ctx_params->force_sdxl_vae_conv_scale || external_vae_is_invalid)) {
-                        float vae_conv_2d_scale = 1.f / 32.f;
-                        LOG_WARN(
-                            "No valid VAE specified with --vae or --force-sdxl-vae-conv-scale flag set, "
-                            "using Conv2D scale %.3f",
-                            vae_conv_2d_scale);
-                        model->set_conv2d_scale(vae_conv_2d_scale);
-                    }
-                    return model;
-                }
+            auto create_vae = [&](ggml_backend_t backend,
+                                  std::shared_ptr<RunnerWeightManager> weights) -> std::shared_ptr<VAE> {
+                bool sdxl_conv_scale = strlen(SAFE_STR(sd_ctx_params->vae_path)) == 0 ||
+                                       force_sdxl_vae_conv_scale || external_vae_is_invalid;
+                return create_vae_runner(backend, tensor_storage_map, weights, sdxl_conv_scale);
             };
 
             if (version == VERSION_CHROMA_RADIANCE || version == VERSION_HIDREAM_O1) {
@@ -971,7 +1669,7 @@ public:
                 }
             } else if (use_tae && !tae_preview_only) {
                 LOG_INFO("using TAE for encoding / decoding");
-                first_stage_model = create_tae(false);
+                first_stage_model = create_tae(vae_decode_only, backend_for(SDBackendModule::VAE), model_manager);
                 first_stage_model->set_max_graph_vram_bytes(max_graph_vram_bytes_for_module(SDBackendModule::VAE));
                 if (!register_runner_params("VAE",
                                             first_stage_model,
@@ -981,7 +1679,7 @@ public:
                 }
             } else {
                 LOG_INFO("using VAE for encoding / decoding");
-                first_stage_model = create_vae();
+                first_stage_model = create_vae(backend_for(SDBackendModule::VAE), model_manager);
                 first_stage_model->set_max_graph_vram_bytes(max_graph_vram_bytes_for_module(SDBackendModule::VAE));
                 if (!register_runner_params("VAE",
                                             first_stage_model,
@@ -991,7 +1689,7 @@ public:
                 }
                 if (use_tae && tae_preview_only) {
                     LOG_INFO("using TAE for preview");
-                    preview_vae = create_tae(true);
+                    preview_vae = create_tae(true, backend_for(SDBackendModule::VAE), model_manager);
                     preview_vae->set_max_graph_vram_bytes(max_graph_vram_bytes_for_module(SDBackendModule::VAE));
                     if (!register_runner_params("preview VAE",
                                                 preview_vae,
@@ -1002,20 +1700,50 @@ public:
                 }
             }
 
+            if (std::dynamic_pointer_cast<FakeVAE>(first_stage_model) == nullptr) {
+                std::set<ggml_backend_t> used_backends = {backend_for(SDBackendModule::VAE)};
+                for (std::string name : split_string(SAFE_STR(sd_ctx_params->vae_tile_backends), ',')) {
+                    name = trim(name);
+                    if (name.empty()) {
+                        continue;
+                    }
+                    ggml_backend_t backend = backend_manager.named_backend(name);
+                    if (backend == nullptr) {
+                        LOG_WARN("VAE tile backend '%s' is not available, skipping it", name.c_str());
+                        continue;
+                    }
+                    if (!used_backends.insert(backend).second) {
+                        continue;
+                    }
+                    auto weights = std::make_shared<ReplicaWeightManager>(model_manager, backend);
+                    auto replica = use_tae && !tae_preview_only ? create_tae(vae_decode_only, backend, weights) : create_vae(backend, weights);
+                    replica->set_max_graph_vram_bytes(max_vram_assignment.bytes_for_backend(backend));
+                    vae_tile_replicas.emplace_back(replica, weights);
+                }
+            }
+
             if (use_audio_vae) {
-                audio_vae_model = std::make_shared<LTXV::LTXAudioVAERunner>(backend_for(SDBackendModule::VAE),
+                if (!ensure_backend_pair(SDBackendModule::AUDIO_VAE)) {
+                    return false;
+                }
+                audio_vae_model = std::make_shared<LTXV::LTXAudioVAERunner>(backend_for(SDBackendModule::AUDIO_VAE),
                                                                             tensor_storage_map,
                                                                             "",
                                                                             model_manager);
                 if (!register_runner_params("LTX audio VAE",
                                             audio_vae_model,
-                                            SDBackendModule::VAE,
+                                            SDBackendModule::AUDIO_VAE,
                                             &vae_params_mem_size)) {
                     return false;
                 }
             }
 
-            if (sd_ctx_params->vae_conv_direct) {
+            vae_f32_fallback = sd_ctx_params->vae_f32_fallback;
+            vae_conv_direct  = sd_ctx_params->vae_conv_direct;
+            vae_flash_attn   = sd_ctx_params->flash_attn;
+            first_stage_model->set_f32_fallback_enabled(vae_f32_fallback);
+
+            if (vae_conv_direct) {
                 LOG_INFO("Using Conv2d direct in the vae model");
                 first_stage_model->set_conv2d_direct_enabled(true);
                 if (preview_vae) {
@@ -1104,6 +1832,16 @@ public:
                     high_noise_diffusion_model->set_flash_attention_enabled(true);
                 }
             }
+            if (strlen(SAFE_STR(sd_ctx_params->attn_tune_cache)) > 0) {
+                if (sd_ctx_params->flash_attn || sd_ctx_params->diffusion_flash_attn) {
+                    sd::attention_tuner::set_cache_path(sd_ctx_params->attn_tune_cache);
+                } else {
+                    LOG_WARN("attention tuning only applies with flash attention enabled");
+                }
+            }
+            if (strlen(SAFE_STR(sd_ctx_params->conv_tune_cache)) > 0) {
+                sd::conv_tuner::set_cache_path(sd_ctx_params->conv_tune_cache);
+            }
 
             diffusion_model->set_circular_axes(sd_ctx_params->circular_x, sd_ctx_params->circular_y);
             if (high_noise_diffusion_model) {
@@ -1122,9 +1860,19 @@ public:
         if (use_tae && !tae_preview_only) {
             ignore_tensors.insert("first_stage_model.");
         }
+        std::vector<std::string> vae_encoder_prefixes;
+        if (first_stage_model) {
+            vae_encoder_prefixes = first_stage_model->encoder_param_prefixes();
+        }
+        if (vae_decode_only) {
+            ignore_tensors.insert(vae_encoder_prefixes.begin(), vae_encoder_prefixes.end());
+        }
         for (auto& extension : generation_extensions) {
             extension->add_ignore_tensors(ignore_tensors);
         }
+        if (cond_stage_model) {
+            cond_stage_model->add_ignore_tensors(ignore_tensors);
+        }
         ignore_tensors.insert("model.diffusion_model.__x0__");
         ignore_tensors.insert("model.diffusion_model.__32x32__");
         ignore_tensors.insert("model.diffusion_model.__index_timestep_zero__");
@@ -1161,17 +1909,198 @@ public:
         }
 
         model_manager->set_common_ignore_tensors(ignore_tensors);
+        model_manager->set_text_encoder_share_key(SAFE_STR(sd_ctx_params->text_encoder_share_key));
+        std::set<std::string> lazy_tensors;
+        if (!vae_decode_only) {
+            // txt2img never runs the encoder, img2img loads it on its first encode
+            lazy_tensors.insert(vae_encoder_prefixes.begin(), vae_encoder_prefixes.end());
+        }
+        if (strlen(SAFE_STR(sd_ctx_params->condition_file)) > 0 && cond_stage_model) {
+            condition_file = std::make_unique<sd::condition_file::File>();
+            std::string error;
+            if (!condition_file->open(sd_ctx_params->condition_file, &error)) {
+                LOG_ERROR("%s", error.c_str());
+                return false;
+            }
+            if (condition_file->sd_version() != model_version_to_str[version]) {
+                LOG_ERROR("condition file '%s' was exported for %s, not %s",
+                          sd_ctx_params->condition_file,
+                          condition_file->sd_version().c_str(),
+                          model_version_to_str[version]);
+                return false;
+            }
+            LOG_INFO("using %zu precomputed conditions from '%s'", condition_file->size(), sd_ctx_params->condition_file);
+            // prompts the file has never run the text encoders, a miss loads them
+            std::map<std::string, ggml_tensor*> tensor_map;
+            cond_stage_model->get_param_tensors(tensor_map);
+            for (const auto& kv : tensor_map) {
+                lazy_tensors.insert(kv.first);
+            }
+        }
+        model_manager->set_lazy_tensors(std::move(lazy_tensors));
         if (!model_manager->validate_registered_tensors()) {
             LOG_ERROR("model metadata validation failed");
             return false;
         }
 
+        if (!model_cache_path.empty() && !model_cache_hit) {
+            if (!model_files_complete) {
+                LOG_WARN("some model files failed to load, not writing model cache");
+            } else {
+                write_model_cache(model_loader,
+                                  model_cache_path,
+                                  {{"sdcpp.model_cache.version", "1"},
+                                   {"sdcpp.model_cache.sd_version", model_version_to_str[version]}},
+                                  vae_decode_only ? vae_encoder_prefixes : std::vector<std::string>());
+            }
+        }
+
+        if (!vae_tile_replicas.empty()) {
+            std::vector<std::shared_ptr<VAE>> loaded_replicas;
+            for (auto& [replica, weights] : vae_tile_replicas) {
+                std::map<std::string, ggml_tensor*> tensors;
+                replica->get_param_tensors(tensors);
+                if (!weights->load(std::move(tensors))) {
+                    LOG_WARN("loading VAE replica weights failed, skipping it");
+                    continue;
+                }
+                loaded_replicas.push_back(replica);
+                vae_replica_weights.push_back(weights);
+            }
+            LOG_INFO("VAE tiles spread over %zu backends", loaded_replicas.size() + 1);
+            first_stage_model->set_tile_replicas(std::move(loaded_replicas));
+        }
+
+        std::vector<ggml_backend_t> pipeline_backends;
+        std::set<ggml_backend_t> pipeline_used_backends = {backend_for(SDBackendModule::DIFFUSION)};
+        for (std::string name : split_string(SAFE_STR(sd_ctx_params->pipeline_backends), ',')) {
+            name = trim(name);
+            if (name.empty()) {
+                continue;
+            }
+            ggml_backend_t backend = backend_manager.named_backend(name);
+            if (backend == nullptr) {
+                LOG_WARN("pipeline backend '%s' is not available, skipping it", name.c_str());
+                continue;
+            }
+            if (pipeline_used_backends.insert(backend).second) {
+                pipeline_backends.push_back(backend);
+            }
+        }
+        if (!pipeline_backends.empty() && sd_backend_is_cpu(backend_for(SDBackendModule::DIFFUSION))) {
+            LOG_WARN("pipeline backends need the diffusion model on a GPU backend, ignoring them");
+            pipeline_backends.clear();
+        }
+        if (!pipeline_backends.empty()) {
+            // stage params are loaded on first use, for the segments the stage runs
+            auto load_stage_params = [this](ggml_backend_t backend, std::map<std::string, ggml_tensor*> tensors) {
+                auto weights = std::make_shared<ReplicaWeightManager>(model_manager, backend);
+                if (!weights->load(std::move(tensors))) {
+                    return false;
+                }
+                pipeline_weights.push_back(weights);
+                return true;
+            };
+            for (const auto& model : {diffusion_model, high_noise_diffusion_model}) {
+                if (model) {
+                    model->set_pipeline_backends(pipeline_backends, load_stage_params);
+                }
+            }
+            LOG_INFO("diffusion model segments spread over %zu backends", pipeline_backends.size() + 1);
+        }
+
+        if (hybrid_cpu_segments && !stream_layers) {
+            LOG_WARN("--hybrid-cpu-segments has no effect without --stream-layers; ignoring");
+        } else if (hybrid_cpu_segments && !pipeline_backends.empty()) {
+            LOG_WARN("--hybrid-cpu-segments is ignored with pipeline backends");
+        } else if (hybrid_cpu_segments) {
+            ggml_backend_t cpu_backend = backend_manager.named_backend("CPU");
+            sd::ggml_graph_cut::HostExecutionRates rates;
+            if (cpu_backend == nullptr || !probe_host_execution_rates(backend_for(SDBackendModule::DIFFUSION), &rates)) {
+                LOG_WARN("no probe of the diffusion device and the CPU, --hybrid-cpu-segments is ignored");
+            } else {
+                for (const auto& model : {diffusion_model, high_noise_diffusion_model}) {
+                    if (model) {
+                        model->set_host_execution(cpu_backend, rates);
+                    }
+                }
+                LOG_INFO("streamed diffusion segments may compute on the CPU (%.1f GB/s upload)", rates.upload_gbps);
+            }
+        }
+
+        std::vector<float> tensor_split;
+        for (std::string part : split_string(SAFE_STR(sd_ctx_params->tensor_split), ',')) {
+            part        = trim(part);
+            char* end   = nullptr;
+            float value = strtof(part.c_str(), &end);
+            if (part.empty() || end == part.c_str() || *end != '\0') {
+                LOG_WARN("invalid tensor split '%s', ignoring it", SAFE_STR(sd_ctx_params->tensor_split));
+                tensor_split.clear();
+                break;
+            }
+            tensor_split.push_back(value);
+        }
+        if (!tensor_split.empty() && !pipeline_backends.empty()) {
+            LOG_WARN("tensor split and pipeline backends are exclusive, using the pipeline backends");
+        } else if (!tensor_split.empty()) {
+            ggml_backend_buffer_type_t split_buft = sd_backend_split_buffer_type(backend_for(SDBackendModule::DIFFUSION), tensor_split);
+            if (split_buft != nullptr) {
+                for (const auto& model : {diffusion_model, high_noise_diffusion_model}) {
+                    if (model) {
+                        model->set_tensor_split_buffer_type(split_buft);
+                    }
+                }
+                LOG_INFO("diffusion model matmuls split over %s", ggml_backend_buft_name(split_buft));
+            }
+        }
+
+        std::string cfg_backend_name = trim(SAFE_STR(sd_ctx_params->cfg_backend));
+        if (!cfg_backend_name.empty() && diffusion_model && create_diffusion_model) {
+            ggml_backend_t cfg_backend = backend_manager.named_backend(cfg_backend_name);
+            if (cfg_backend == nullptr) {
+                LOG_WARN("CFG backend '%s' is not available, ignoring it", cfg_backend_name.c_str());
+            } else if (cfg_backend == backend_for(SDBackendModule::DIFFUSION)) {
+                LOG_WARN("CFG backend '%s' is the diffusion backend, ignoring it", cfg_backend_name.c_str());
+            } else if (pipeline_used_backends.find(cfg_backend) != pipeline_used_backends.end()) {
+                LOG_WARN("CFG backend '%s' is also a pipeline backend, ignoring it", cfg_backend_name.c_str());
+            } else {
+                auto weights = std::make_shared<ReplicaWeightManager>(model_manager, cfg_backend);
+                auto replica = create_diffusion_model(cfg_backend, weights);
+                replica->set_max_graph_vram_bytes(max_vram_assignment.bytes_for_backend(cfg_backend));
+                if (sd_ctx_params->diffusion_conv_direct && std::dynamic_pointer_cast<UNetModelRunner>(replica) != nullptr) {
+                    replica->set_conv2d_direct_enabled(true);
+                }
+                if (sd_ctx_params->flash_attn || sd_ctx_params->diffusion_flash_attn) {
+                    replica->set_flash_attention_enabled(true);
+                }
+                replica->set_circular_axes(sd_ctx_params->circular_x, sd_ctx_params->circular_y);
+                std::map<std::string, ggml_tensor*> tensors;
+                replica->get_param_tensors(tensors);
+                if (!weights->load(std::move(tensors))) {
+                    LOG_WARN("loading the diffusion model copy on %s failed, running CFG passes on one backend",
+                             ggml_backend_name(cfg_backend));
+                } else {
+                    cfg_diffusion_model   = replica;
+                    cfg_diffusion_weights = weights;
+                    LOG_INFO("uncond passes run on %s (%.2f MB of weights)",
+                             ggml_backend_name(cfg_backend),
+                             weights->params_bytes() / (1024.0 * 1024.0));
+                }
+            }
+        }
+
+        if (enable_mmap && sd_ctx_params->mmap_prefault_threads > 0) {
+            model_manager->start_mmap_prefault(sd_ctx_params->mmap_prefault_threads);
+        }
         if (eager_load) {
             if (!model_manager->load_all_params_eagerly()) {
                 LOG_ERROR("model params eager load failed");
                 return false;
             }
             LOG_DEBUG("model metadata validated; weights pre-loaded to params backend");
+        } else if (background_load) {
+            model_manager->start_background_load();
+            LOG_DEBUG("model metadata validated; weights loading in the background");
         } else {
             LOG_DEBUG("model metadata validated; weights will be prepared lazily");
         }
@@ -1423,11 +2352,21 @@ public:
             return nullptr;
         }
 
-        lora->multiplier = lora_spec.multiplier;
+        set_lora_multipliers(*lora, lora_spec, module);
         return lora;
     }
 
+    static void set_lora_multipliers(LoraModel& lora, const ModelManager::LoraSpec& lora_spec, SDBackendModule module) {
+        lora.multiplier = lora_spec.multiplier;
+        lora.image_multipliers.clear();
+        if (module == SDBackendModule::DIFFUSION && !lora_spec.image_multipliers.empty()) {
+            lora.multiplier        = 1.0f;
+            lora.image_multipliers = lora_spec.image_multipliers;
+        }
+    }
+
     void clear_lora_adapters() {
+        diffusion_lora_adapter.reset();
         if (cond_stage_model) {
             cond_stage_model->set_weight_adapter(nullptr);
         }
@@ -1447,19 +2386,40 @@ public:
                                                                           SDBackendModule module,
                                                                           LoraModel::filter_t module_filter = nullptr) {
         std::vector<std::shared_ptr<LoraModel>> module_lora_models;
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
         for (const auto& lora_spec : loras) {
-            auto lora = load_lora_model(lora_spec, module, module_filter);
-            if (lora == nullptr) {
-                if (lora_spec.required) {
-                    LOG_ERROR("required lora load failed: %s", lora_spec.path.c_str());
+            std::string cache_key = LoraModelCache::make_key(lora_log_id(lora_spec),
+                                                             static_cast<int>(module),
+                                                             lora_spec.tensor_name_prefix_filter);
+            std::shared_ptr<LoraModel> lora;
+            if (lora_model_cache.enabled()) {
+                lora = lora_model_cache.get(cache_key);
+                if (perf != nullptr) {
+                    (lora != nullptr ? perf->lora_model_cache_hits : perf->lora_model_cache_misses)++;
+                }
+            }
+            if (lora != nullptr) {
+                set_lora_multipliers(*lora, lora_spec, module);
+            } else {
+                lora = load_lora_model(lora_spec, module, module_filter);
+                if (lora == nullptr) {
+                    if (lora_spec.required) {
+                        LOG_ERROR("required lora load failed: %s", lora_spec.path.c_str());
+                    }
+                    continue;
+                }
+                lora->preprocess_lora_tensors(model_tensor_names);
+                if (lora_model_cache.enabled()) {
+                    int evicted = lora_model_cache.put(cache_key, lora);
+                    if (perf != nullptr) {
+                        perf->lora_model_cache_evictions += evicted;
+                    }
                 }
-                continue;
             }
             if (lora->lora_tensors.empty()) {
                 continue;
             }
 
-            lora->preprocess_lora_tensors(model_tensor_names);
             runtime_lora_models.push_back(lora);
             module_lora_models.push_back(std::move(lora));
         }
@@ -1530,6 +2490,7 @@ public:
                                               lora_tensor_filter);
             if (!diffusion_lora_models.empty()) {
                 auto multi_lora_adapter = std::make_shared<MultiLoraAdapter>(diffusion_lora_models);
+                diffusion_lora_adapter  = multi_lora_adapter;
                 diffusion_model->set_weight_adapter(multi_lora_adapter);
                 if (high_noise_diffusion_model) {
                     high_noise_diffusion_model->set_weight_adapter(multi_lora_adapter);
@@ -1556,6 +2517,12 @@ public:
         }
     }
 
+    void set_lora_images(int first_image, int image_count) {
+        if (diffusion_lora_adapter) {
+            diffusion_lora_adapter->set_images(first_image, image_count);
+        }
+    }
+
     void lora_stat() {
         if (!runtime_lora_models.empty()) {
             LOG_INFO("runtime_lora_models:");
@@ -1565,7 +2532,9 @@ public:
         }
     }
 
-    void apply_loras(const sd_lora_t* loras, uint32_t lora_count) {
+    // `image_count` is the number of generated images per-image multipliers
+    // cover; 0 ignores them.
+    void apply_loras(const sd_lora_t* loras, uint32_t lora_count, int image_count = 0) {
         std::vector<ModelManager::LoraSpec> all_loras;
         all_loras.reserve(lora_count);
         for (uint32_t i = 0; i < lora_count; i++) {
@@ -1574,6 +2543,16 @@ public:
             lora_spec.path          = lora_id;
             lora_spec.multiplier    = loras[i].multiplier;
             lora_spec.is_high_noise = loras[i].is_high_noise;
+            if (loras[i].image_multipliers != nullptr && image_count > 0) {
+                if (apply_lora_immediately) {
+                    LOG_WARN("per-image multipliers of lora %s need the at_runtime lora apply mode, using %.2f for all images",
+                             lora_id.c_str(),
+                             loras[i].multiplier);
+                } else {
+                    lora_spec.image_multipliers.assign(loras[i].image_multipliers,
+                                                       loras[i].image_multipliers + image_count);
+                }
+            }
             all_loras.push_back(std::move(lora_spec));
             if (loras[i].is_high_noise) {
                 lora_id = "|high_noise|" + lora_id;
@@ -1585,18 +2564,328 @@ public:
             extension->collect_loras(all_loras);
         }
 
+        std::string lora_signature;
+        for (const auto& lora : all_loras) {
+            lora_signature += (lora.is_high_noise ? "|high_noise|" : "|") + lora.path + ":" + std::to_string(lora.multiplier);
+        }
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+        if (all_loras.empty() && lora_signature == applied_lora_signature) {
+            // nothing applied before or now; leaves the text encoder alone
+            // while prepare_image_conditions may be using it
+            return;
+        }
+        std::lock_guard<std::mutex> lock(conditioner_mutex);
+        if (lora_signature != applied_lora_signature) {
+            applied_lora_signature = std::move(lora_signature);
+            lora_epoch++;
+            if (cond_stage_model) {
+                cond_stage_model->weights_changed();
+            }
+            if (perf != nullptr && !all_loras.empty()) {
+                perf->lora_cache_misses++;
+            }
+        } else if (perf != nullptr && !all_loras.empty()) {
+            perf->lora_cache_hits++;
+        }
+
         int64_t t0 = ggml_time_ms();
         if (apply_lora_immediately) {
             apply_loras_immediately(all_loras);
         } else {
             apply_loras_at_runtime(all_loras);
         }
+        if (first_stage_model) {
+            // replicas hold the weights as loaded from the model files
+            first_stage_model->set_tile_replicas_enabled(!(apply_lora_immediately && !all_loras.empty()));
+        }
+        for (const auto& model : {diffusion_model, high_noise_diffusion_model}) {
+            if (model) {
+                model->set_pipeline_enabled(!(apply_lora_immediately && !all_loras.empty()));
+                model->set_tensor_split_enabled(!(apply_lora_immediately && !all_loras.empty()));
+            }
+        }
+        cfg_diffusion_enabled = !(apply_lora_immediately && !all_loras.empty());
         int64_t t1 = ggml_time_ms();
         if (!all_loras.empty()) {
             LOG_INFO("apply_loras completed, taking %.2fs", (t1 - t0) * 1.0f / 1000);
         }
     }
 
+    // With offload_text_encoder the text encoder params stay on the params
+    // backend and runner_done drops their compute backend copies after every
+    // encode, so the diffusion model has that memory while it samples. A
+    // generation stages them back ahead of its encode, while it prepares its
+    // latents; finish_conditioner_prefetch releases what the encode did not
+    // use, e.g. on a condition cache hit.
+    void prefetch_conditioner_params() {
+        if (!offload_text_encoder || cond_stage_model == nullptr || model_manager == nullptr || condition_file != nullptr ||
+            params_backend_for(SDBackendModule::TE) == backend_for(SDBackendModule::TE)) {
+            return;
+        }
+        {
+            // encoded while the previous generation sampled
+            std::lock_guard<std::mutex> lock(prepared_conditions_mutex);
+            if (!prepared_conditions.empty()) {
+                return;
+            }
+        }
+        std::map<std::string, ggml_tensor*> tensor_map;
+        cond_stage_model->get_param_tensors(tensor_map);
+        std::vector<ggml_tensor*> tensors;
+        tensors.reserve(tensor_map.size());
+        for (const auto& kv : tensor_map) {
+            tensors.push_back(kv.second);
+        }
+        model_manager->start_prefetch(std::move(tensors));
+    }
+
+    void finish_conditioner_prefetch() {
+        if (offload_text_encoder && model_manager != nullptr) {
+            model_manager->finish_prefetch();
+        }
+    }
+
+    template <typename Runner>
+    static std::vector<ggml_tensor*> param_tensor_list(Runner& runner) {
+        std::map<std::string, ggml_tensor*> tensor_map;
+        runner.get_param_tensors(tensor_map);
+        std::vector<ggml_tensor*> tensors;
+        tensors.reserve(tensor_map.size());
+        for (const auto& kv : tensor_map) {
+            tensors.push_back(kv.second);
+        }
+        return tensors;
+    }
+
+    // Wan2.2 switches from the high-noise to the low-noise model at
+    // moe_boundary. While the last high-noise steps run, the low-noise params
+    // are loaded in the background when they fit beside the high-noise ones,
+    // or else only read ahead from the file, and the high-noise params are
+    // evicted after the switch to make room. Returns whether they fit.
+    bool prefetch_moe_expert_params() {
+        if (model_manager == nullptr || diffusion_model == nullptr) {
+            return true;
+        }
+        std::vector<ggml_tensor*> tensors = param_tensor_list(*diffusion_model);
+        uint64_t bytes = model_manager->unloaded_params_bytes(tensors);
+        if (bytes == 0) {
+            return true;
+        }
+        ggml_backend_t params_backend = params_backend_for(SDBackendModule::DIFFUSION);
+        ggml_backend_dev_t dev        = params_backend != nullptr ? ggml_backend_get_device(params_backend) : nullptr;
+        size_t free_mem               = 0;
+        size_t total_mem              = 0;
+        if (dev != nullptr) {
+            ggml_backend_dev_memory(dev, &free_mem, &total_mem);
+        }
+        const uint64_t reserve = 512ull * 1024 * 1024;
+        bool fits              = free_mem > reserve && bytes <= free_mem - reserve;
+        LOG_DEBUG("%s %.2f MB of low noise params before moe_boundary",
+                  fits ? "loading" : "reading ahead",
+                  bytes / (1024.0 * 1024.0));
+        if (fits) {
+            model_manager->start_prefetch(std::move(tensors), false);
+        } else {
+            model_manager->advise_params(tensors);
+        }
+        return fits;
+    }
+
+    void finish_moe_switch(bool low_noise_fits) {
+        if (model_manager == nullptr) {
+            return;
+        }
+        model_manager->finish_prefetch();
+        if (!low_noise_fits && high_noise_diffusion_model != nullptr) {
+            model_manager->evict_params(param_tensor_list(*high_noise_diffusion_model));
+        }
+    }
+
+    bool take_prepared_condition(const ConditionerParams& condition_params, SDCondition* condition) {
+        std::lock_guard<std::mutex> lock(prepared_conditions_mutex);
+        if (prepared_conditions.empty() || !ConditionCache::is_cacheable(condition_params) ||
+            sd_perf::current_memory_probe() != nullptr) {
+            return false;
+        }
+        auto it = prepared_conditions.find(ConditionCache::make_key(condition_params, lora_epoch));
+        if (it == prepared_conditions.end()) {
+            return false;
+        }
+        *condition = std::move(it->second);
+        prepared_conditions.erase(it);
+        return true;
+    }
+
+    // Encodes the conditions another thread will ask for, for
+    // prepare_image_conditions. Called without conditioner_mutex held.
+    bool prepare_conditions(const std::vector<ConditionerParams>& params_list) {
+        const size_t max_prepared_conditions = 8;
+        std::lock_guard<std::mutex> lock(conditioner_mutex);
+        bool ok         = true;
+        auto conditions = encode_conditions(params_list);
+        for (size_t i = 0; i < params_list.size(); i++) {
+            if (conditions[i].empty()) {
+                ok = false;
+                break;
+            }
+            std::lock_guard<std::mutex> prepared_lock(prepared_conditions_mutex);
+            if (prepared_conditions.size() >= max_prepared_conditions) {
+                // left behind by generations that never ran
+                prepared_conditions.clear();
+            }
+            prepared_conditions[ConditionCache::make_key(params_list[i], lora_epoch)] = std::move(conditions[i]);
+        }
+        cond_stage_model->runner_done();
+        return ok;
+    }
+
+    // Encodes the conditions for export_image_conditions and writes them to
+    // path, a few prompts per encode.
+    bool export_conditions(const std::vector<ConditionerParams>& params_list, const std::string& path) {
+        const size_t batch_size = 8;
+        sd::condition_file::Writer writer;
+        std::string error;
+        if (!writer.open(path, &error)) {
+            LOG_ERROR("%s", error.c_str());
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(conditioner_mutex);
+        if (!applied_lora_signature.empty()) {
+            // the file is only looked up without LoRAs
+            LOG_ERROR("conditions cannot be exported while LoRAs are applied");
+            return false;
+        }
+        int reported_tenths = 0;
+        for (size_t begin = 0; begin < params_list.size(); begin += batch_size) {
+            size_t end = std::min(params_list.size(), begin + batch_size);
+            std::vector<ConditionerParams> batch(params_list.begin() + begin, params_list.begin() + end);
+            auto conditions = encode_conditions(batch);
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (conditions[i].empty()) {
+                    LOG_ERROR("encoding prompt '%s' failed", batch[i].text.c_str());
+                    cond_stage_model->runner_done();
+                    return false;
+                }
+                if (!writer.add(sd::condition_file::make_key(batch[i]), conditions[i], &error)) {
+                    LOG_ERROR("%s", error.c_str());
+                    cond_stage_model->runner_done();
+                    return false;
+                }
+            }
+            int tenths = static_cast<int>(end * 10 / params_list.size());
+            if (tenths > reported_tenths) {
+                reported_tenths = tenths;
+                LOG_INFO("encoded %zu/%zu conditions", end, params_list.size());
+            }
+        }
+        cond_stage_model->runner_done();
+        if (!writer.finish(model_version_to_str[version], &error)) {
+            LOG_ERROR("%s", error.c_str());
+            return false;
+        }
+        LOG_INFO("wrote %zu conditions to '%s'", writer.size(), path.c_str());
+        return true;
+    }
+
+    SDCondition get_learned_condition(const ConditionerParams& condition_params) {
+        SDCondition prepared;
+        if (take_prepared_condition(condition_params, &prepared)) {
+            LOG_DEBUG("using condition encoded while the previous generation sampled");
+            return prepared;
+        }
+        std::lock_guard<std::mutex> lock(conditioner_mutex);
+        sd_perf::ScopedMemoryPhase memory_phase("text encode");
+        return encode_condition(condition_params);
+    }
+
+    // Called with conditioner_mutex held.
+    SDCondition encode_condition(const ConditionerParams& condition_params) {
+        return encode_conditions({condition_params})[0];
+    }
+
+    // Called with conditioner_mutex held. The prompts the condition cache
+    // does not have are encoded together, in one graph per encoder where
+    // the conditioner supports it.
+    std::vector<SDCondition> encode_conditions(const std::vector<ConditionerParams>& params_list) {
+        std::vector<SDCondition> conditions(params_list.size());
+        std::vector<std::string> keys(params_list.size());
+        std::vector<ConditionerParams> missing_params;
+        std::vector<size_t> missing;
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+        // conditions encoded under a memory probe are zeros
+        const bool use_cache = condition_cache.enabled() && sd_perf::current_memory_probe() == nullptr;
+        // the file holds conditions encoded without LoRAs
+        const bool use_file = condition_file != nullptr && applied_lora_signature.empty() &&
+                              sd_perf::current_memory_probe() == nullptr;
+        for (size_t i = 0; i < params_list.size(); i++) {
+            if (use_file && ConditionCache::is_cacheable(params_list[i]) &&
+                condition_file->get(sd::condition_file::make_key(params_list[i]), &conditions[i])) {
+                LOG_DEBUG("condition file hit");
+                if (perf != nullptr) {
+                    perf->condition_cache_hits++;
+                }
+                continue;
+            }
+            if (use_cache && ConditionCache::is_cacheable(params_list[i])) {
+                keys[i] = ConditionCache::make_key(params_list[i], lora_epoch);
+                if (condition_cache.get(keys[i], &conditions[i])) {
+                    LOG_DEBUG("condition cache hit (%zu entries, %.2f MB)",
+                              condition_cache.size(),
+                              condition_cache.used_bytes() / 1024.f / 1024.f);
+                    if (perf != nullptr) {
+                        perf->condition_cache_hits++;
+                    }
+                    continue;
+                }
+                if (perf != nullptr) {
+                    perf->condition_cache_misses++;
+                }
+            }
+            missing_params.push_back(params_list[i]);
+            missing.push_back(i);
+        }
+        if (missing.empty()) {
+            return conditions;
+        }
+
+        auto encoded = missing.size() == 1
+                           ? std::vector<SDCondition>{cond_stage_model->get_learned_condition(n_threads, missing_params[0])}
+                           : cond_stage_model->get_learned_conditions(n_threads, missing_params);
+        for (size_t j = 0; j < missing.size() && j < encoded.size(); j++) {
+            size_t i      = missing[j];
+            conditions[i] = std::move(encoded[j]);
+            if (!keys[i].empty() && !conditions[i].empty()) {
+                condition_cache.put(keys[i], conditions[i]);
+            }
+        }
+        return conditions;
+    }
+
+    // get_learned_condition for several prompts at once.
+    std::vector<SDCondition> get_learned_conditions(const std::vector<ConditionerParams>& params_list) {
+        std::vector<SDCondition> conditions(params_list.size());
+        std::vector<ConditionerParams> missing_params;
+        std::vector<size_t> missing;
+        for (size_t i = 0; i < params_list.size(); i++) {
+            if (take_prepared_condition(params_list[i], &conditions[i])) {
+                LOG_DEBUG("using condition encoded while the previous generation sampled");
+                continue;
+            }
+            missing_params.push_back(params_list[i]);
+            missing.push_back(i);
+        }
+        if (missing.empty()) {
+            return conditions;
+        }
+
+        std::lock_guard<std::mutex> lock(conditioner_mutex);
+        auto encoded = encode_conditions(missing_params);
+        for (size_t j = 0; j < missing.size(); j++) {
+            conditions[missing[j]] = std::move(encoded[j]);
+        }
+        return conditions;
+    }
+
     void reset_generation_extensions() {
         for (auto& extension : generation_extensions) {
             extension->reset_runtime_condition();
@@ -1634,6 +2923,25 @@ public:
                 output = sd::zeros<float>({clip_vision->vision_model.hidden_size, 257});
             }
         } else {
+            std::string key;
+            sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+            if (condition_cache.enabled()) {
+                key = ConditionCache::make_clip_vision_key(image, return_pooled, clip_skip, lora_epoch);
+                SDCondition cached;
+                if (condition_cache.get(key, &cached)) {
+                    LOG_DEBUG("clip_vision cache hit (%zu entries, %.2f MB)",
+                              condition_cache.size(),
+                              condition_cache.used_bytes() / 1024.f / 1024.f);
+                    if (perf != nullptr) {
+                        perf->condition_cache_hits++;
+                    }
+                    return std::move(cached.c_vector);
+                }
+                if (perf != nullptr) {
+                    perf->condition_cache_misses++;
+                }
+            }
+
             auto pixel_values = clip_preprocess(image, clip_vision->vision_model.image_size, clip_vision->vision_model.image_size);
             auto output_opt   = clip_vision->compute(n_threads, pixel_values, return_pooled, clip_skip);
             if (output_opt.empty()) {
@@ -1641,6 +2949,11 @@ public:
                 return {};
             }
             output = std::move(output_opt);
+            if (!key.empty()) {
+                SDCondition cached;
+                cached.c_vector = output;
+                condition_cache.put(key, cached);
+            }
         }
         return output;
     }
@@ -1885,53 +3198,392 @@ public:
     };
 
     SamplePreviewContext prepare_sample_preview_context() {
+        if (sd_perf::current_memory_probe() != nullptr) {
+            return SamplePreviewContext{};
+        }
         return SamplePreviewContext{sd_get_preview_callback(),
                                     sd_get_preview_callback_data(),
                                     sd_get_preview_mode()};
     }
 
-    void report_sample_progress(int step, size_t total_steps, int64_t* last_progress_us) {
+    // Previews may run beside sampling only when they cannot contend with it:
+    // the projection is host math, and VAE previews need a backend that neither
+    // the diffusion model nor the ControlNet computes on.
+    bool preview_can_run_async(preview_t mode) {
+        if (mode == PREVIEW_PROJ) {
+            return true;
+        }
+        if (mode != PREVIEW_VAE && mode != PREVIEW_TAE) {
+            return false;
+        }
+        ggml_backend_t vae_backend = backend_manager.runtime_backend(SDBackendModule::VAE);
+        return vae_backend != nullptr &&
+               vae_backend != backend_manager.runtime_backend(SDBackendModule::DIFFUSION) &&
+               (control_net == nullptr || vae_backend != backend_manager.runtime_backend(SDBackendModule::CONTROL_NET));
+    }
+
+    // A ControlNet on a backend of its own can compute while the diffusion model
+    // does, see ensure_sample_controls.
+    // The VAE encodes the video inputs while the text encoder runs on its own
+    // backend; a memory probe only sees one thread.
+    bool conditioner_can_run_beside_vae() {
+        ggml_backend_t te_backend = backend_manager.runtime_backend(SDBackendModule::TE);
+        return cond_stage_model != nullptr &&
+               sd_perf::current_memory_probe() == nullptr &&
+               te_backend != nullptr &&
+               te_backend != backend_manager.runtime_backend(SDBackendModule::VAE);
+    }
+
+    // The audio VAE decodes beside the video VAE when no tile of the video
+    // shares its backend.
+    bool audio_vae_can_run_beside_vae() {
+        ggml_backend_t audio_backend = backend_manager.runtime_backend(SDBackendModule::AUDIO_VAE);
+        return audio_vae_model != nullptr &&
+               first_stage_model != nullptr &&
+               sd_perf::current_memory_probe() == nullptr &&
+               audio_backend != nullptr &&
+               !first_stage_model->computes_on(audio_backend);
+    }
+
+    bool control_net_can_run_async() {
+        ggml_backend_t control_backend = backend_manager.runtime_backend(SDBackendModule::CONTROL_NET);
+        return control_net != nullptr &&
+               sd_perf::current_memory_probe() == nullptr &&
+               control_backend != nullptr &&
+               control_backend != backend_manager.runtime_backend(SDBackendModule::DIFFUSION);
+    }
+
+    // Decodes latents with the preview decoder, the TAE when one is loaded,
+    // and hands the image to the provisional callback on this thread. Queued
+    // previews are drained first, they share the decoder.
+    void deliver_provisional_image(int step, int steps, const sd::Tensor<float>& latents) {
+        sd_provisional_cb_t callback = sd_get_provisional_callback();
+        if (callback == nullptr || sd_perf::current_memory_probe() != nullptr) {
+            return;
+        }
+        finish_async_previews();
+        preview_t mode = preview_vae ? PREVIEW_TAE : sd_get_preview_mode();
+        if (mode == PREVIEW_NONE) {
+            mode = PREVIEW_PROJ;
+        }
+        void* data = sd_get_provisional_callback_data();
+        preview_image(step,
+                      latents,
+                      version,
+                      mode,
+                      [&](int, int frame_count, sd_image_t* frames, bool, void*) {
+                          if (frame_count > 0) {
+                              callback(step, steps, &frames[0], data);
+                          }
+                      },
+                      nullptr,
+                      false);
+    }
+
+    void request_preview(int step,
+                         sd::Tensor<float> latents,
+                         const SamplePreviewContext& preview,
+                         bool async,
+                         bool is_noisy) {
+        if (!async) {
+            preview_image(step, latents, version, preview.mode, preview.callback, preview.data, is_noisy);
+            return;
+        }
+        preview_worker.submit([this, step, latents = std::move(latents), preview, is_noisy]() {
+            preview_image(step, latents, version, preview.mode, preview.callback, preview.data, is_noisy);
+        });
+    }
+
+    void finish_async_previews() {
+        uint64_t dropped = preview_worker.drain();
+        if (dropped > 0) {
+            LOG_DEBUG("skipped %" PRIu64 " previews while the preview worker was busy", dropped);
+        }
+    }
+
+    void report_sample_progress(int step, size_t total_steps, int64_t* last_progress_us, sd_step_timing_t* timing = nullptr) {
+        if (sd_perf::current_memory_probe() != nullptr) {
+            return;
+        }
         if (step > 0 || step == -(int)total_steps) {
             int64_t now        = ggml_time_us();
             int showstep       = std::abs(step);
             float step_seconds = last_progress_us != nullptr && *last_progress_us > 0
                                      ? (now - *last_progress_us) / 1000000.f
                                      : 0.f;
+            // the timing goes first, so a progress listener finds it current
+            if (sd_step_timing_cb_t timing_cb = sd_get_step_timing_callback(); timing_cb != nullptr && timing != nullptr) {
+                timing->step  = showstep;
+                timing->steps = (int)total_steps;
+                timing->time  = step_seconds;
+                timing_cb(timing, sd_get_step_timing_callback_data());
+            }
             pretty_progress(showstep, (int)total_steps, step_seconds);
             if (last_progress_us != nullptr) {
                 *last_progress_us = now;
             }
+            if (sd_perf::PerfRecorder* perf = sd_perf::current_recorder()) {
+                perf->sampling_steps++;
+            }
+        }
+    }
+
+    // One diffusion forward pass split over windows of latent frames (dim 2).
+    // The outputs are blended per frame with the window weights; c_concat is
+    // windowed along when it has the same frames.
+    sd::Tensor<float> compute_in_context_windows(DiffusionModelRunner* runner,
+                                                 const DiffusionParams& params,
+                                                 const sd::context_windows::Params& windows) {
+        const sd::Tensor<float>& x = *params.x;
+        const int64_t frames       = x.shape()[2];
+        const int64_t plane        = x.shape()[0] * x.shape()[1];
+        const int64_t outer        = x.numel() / (plane * frames);
+        sd::Tensor<float> output   = sd::Tensor<float>::zeros(x.shape());
+        std::vector<float> weight_sum(static_cast<size_t>(frames), 0.f);
+        for (const auto& [begin, end] : windows.windows(frames)) {
+            DiffusionParams window_params = params;
+            sd::Tensor<float> window_x    = sd::ops::slice(x, 2, begin, end);
+            sd::Tensor<float> window_concat;
+            window_params.x = &window_x;
+            if (params.c_concat != nullptr && params.c_concat->dim() > 2 && params.c_concat->shape()[2] == frames) {
+                window_concat          = sd::ops::slice(*params.c_concat, 2, begin, end);
+                window_params.c_concat = &window_concat;
+            }
+            sd::Tensor<float> window_out = runner->compute(n_threads, window_params);
+            if (window_out.empty() || window_out.numel() != window_x.numel()) {
+                return {};
+            }
+            const int64_t n = end - begin;
+            for (int64_t f = 0; f < n; f++) {
+                const float w = windows.weight(f, n, begin == 0, end == frames);
+                weight_sum[static_cast<size_t>(begin + f)] += w;
+                for (int64_t o = 0; o < outer; o++) {
+                    const float* src = window_out.data() + (o * n + f) * plane;
+                    float* dst       = output.data() + (o * frames + begin + f) * plane;
+                    for (int64_t i = 0; i < plane; i++) {
+                        dst[i] += w * src[i];
+                    }
+                }
+            }
         }
+        for (int64_t o = 0; o < outer; o++) {
+            for (int64_t f = 0; f < frames; f++) {
+                float* dst      = output.data() + (o * frames + f) * plane;
+                const float inv = 1.0f / weight_sum[static_cast<size_t>(f)];
+                for (int64_t i = 0; i < plane; i++) {
+                    dst[i] *= inv;
+                }
+            }
+        }
+        return output;
     }
 
+    // One diffusion forward pass split over overlapping spatial tiles of the
+    // latent (MultiDiffusion). The tiles of a pass are stacked along the
+    // batch dim with the condition and timestep repeated for each, and the
+    // outputs are blended with the VAE tiling ramps; c_concat is tiled along
+    // when it has the latent's size.
+    sd::Tensor<float> compute_in_spatial_tiles(DiffusionModelRunner* runner,
+                                               const DiffusionParams& params,
+                                               const sd::tiled_diffusion::Params& tiling) {
+        const sd::Tensor<float>& x = *params.x;
+        const int width            = static_cast<int>(x.shape()[0]);
+        const int height           = static_cast<int>(x.shape()[1]);
+        const int64_t channels     = x.shape()[2];
+
+        const sd::Tensor<float>* c_concat = params.c_concat;
+        if (c_concat != nullptr && (c_concat->dim() != 4 || c_concat->shape()[0] != width || c_concat->shape()[1] != height)) {
+            return runner->compute(n_threads, params);
+        }
+        const sd::Tensor<float> input = c_concat != nullptr ? sd::ops::concat(x, *c_concat, 2) : x;
+        const int tile                = tiling.resolved_tile();
+
+        auto on_tiles = [&](int, const sd::Tensor<float>& tiles) -> sd::Tensor<float> {
+            const int64_t n          = tiles.dim() > 3 ? tiles.shape()[3] : 1;
+            sd::Tensor<float> tile_x = c_concat != nullptr ? sd::ops::slice(tiles, 2, 0, channels) : tiles;
+            sd::Tensor<float> tile_concat_x;
+            sd::Tensor<float> tile_context;
+            sd::Tensor<float> tile_y;
+            sd::Tensor<float> tile_timesteps;
+            sd::Tensor<float> tile_guidance;
+            std::vector<const sd::Tensor<float>*> contexts(static_cast<size_t>(n), &tensor_or_empty(params.context));
+            std::vector<const sd::Tensor<float>*> ys(static_cast<size_t>(n), &tensor_or_empty(params.y));
+            std::vector<const sd::Tensor<float>*> timesteps(static_cast<size_t>(n), params.timesteps);
+            if (!stack_condition_batch(contexts, 2, &tile_context) ||
+                !stack_condition_batch(ys, 1, &tile_y) ||
+                !stack_condition_batch(timesteps, 0, &tile_timesteps)) {
+                LOG_ERROR("tiled diffusion could not repeat the condition for %" PRId64 " tiles", n);
+                return {};
+            }
+
+            DiffusionParams tile_params = params;
+            tile_params.x               = &tile_x;
+            tile_params.timesteps       = &tile_timesteps;
+            tile_params.context         = tile_context.empty() ? nullptr : &tile_context;
+            tile_params.y               = tile_y.empty() ? nullptr : &tile_y;
+            if (c_concat != nullptr) {
+                tile_concat_x        = sd::ops::slice(tiles, 2, channels, tiles.shape()[2]);
+                tile_params.c_concat = &tile_concat_x;
+            }
+            if (auto* flux_extra = std::get_if<FluxDiffusionExtra>(&tile_params.extra)) {
+                if (flux_extra->guidance != nullptr) {
+                    std::vector<const sd::Tensor<float>*> guidances(static_cast<size_t>(n), flux_extra->guidance);
+                    if (!stack_condition_batch(guidances, 0, &tile_guidance)) {
+                        return {};
+                    }
+                    flux_extra->guidance = &tile_guidance;
+                }
+                // these plans hold state for a single image sequence
+                flux_extra->cfg_reuse        = nullptr;
+                flux_extra->slg_prefix       = nullptr;
+                flux_extra->masked_tokens    = nullptr;
+                flux_extra->modulation_cache = nullptr;
+                flux_extra->ref_kv           = nullptr;
+            } else if (auto* skip_extra = std::get_if<SkipLayerDiffusionExtra>(&tile_params.extra)) {
+                skip_extra->slg_prefix       = nullptr;
+                skip_extra->modulation_cache = nullptr;
+            } else if (auto* qwen_extra = std::get_if<QwenImageDiffusionExtra>(&tile_params.extra)) {
+                qwen_extra->modulation_cache = nullptr;
+            }
+
+            if (diffusion_lora_adapter) {
+                diffusion_lora_adapter->set_batch_size(n);
+            }
+            sd::Tensor<float> tile_out = runner->compute(n_threads, tile_params);
+            if (diffusion_lora_adapter) {
+                diffusion_lora_adapter->set_batch_size(1);
+            }
+            if (tile_out.empty() || tile_out.numel() != tile_x.numel()) {
+                return {};
+            }
+            tile_out.reshape_(tile_x.shape());
+            return tile_out;
+        };
+        return process_tiles_2d_batched(input,
+                                        width,
+                                        height,
+                                        1,
+                                        tile,
+                                        tile,
+                                        tiling.overlap_factor(),
+                                        false,
+                                        false,
+                                        on_tiles,
+                                        [&](int) { return tiling.tiles_per_pass(); },
+                                        1,
+                                        true);
+    }
+
+    // ControlNet outputs for each condition at one step. The conditions run as
+    // one batch when their text conditions stack; the hint is the same for every
+    // condition and the runner caches its encoding.
     void compute_sample_controls(const sd::Tensor<float>& control_image,
                                  const sd::Tensor<float>& noised_input,
                                  const sd::Tensor<float>& timesteps_tensor,
-                                 const SDCondition& condition,
-                                 std::vector<sd::Tensor<float>>* controls) {
-        GGML_ASSERT(controls != nullptr);
-        controls->clear();
-        if (control_image.empty() || control_net == nullptr) {
-            return;
+                                 const std::vector<const SDCondition*>& conditions,
+                                 const std::vector<std::vector<sd::Tensor<float>>*>& controls) {
+        GGML_ASSERT(conditions.size() == controls.size());
+        for (auto* condition_controls : controls) {
+            condition_controls->clear();
         }
-
-        auto control_result = control_net->compute(n_threads,
-                                                   noised_input,
-                                                   control_image,
-                                                   timesteps_tensor,
-                                                   condition.c_crossattn,
-                                                   condition.c_vector);
-        if (!control_result.has_value()) {
-            LOG_ERROR("controlnet compute failed");
+        if (control_image.empty() || control_net == nullptr || conditions.empty()) {
             return;
         }
 
-        *controls = std::move(*control_result);
-    }
-
-    sd::Tensor<float> sample(const std::shared_ptr<DiffusionModelRunner>& work_diffusion_model,
-                             bool inverse_noise_scaling,
-                             const sd::Tensor<float>& init_latent,
+        if (conditions.size() > 1) {
+            BatchedConditionInputs batched_inputs;
+            sd::Tensor<float> batch_x;
+            sd::Tensor<float> batch_timesteps;
+            std::vector<const sd::Tensor<float>*> x_parts(conditions.size(), &noised_input);
+            std::vector<const sd::Tensor<float>*> timestep_parts(conditions.size(), &timesteps_tensor);
+            if (stack_batched_conditions(conditions, 1, &batched_inputs) &&
+                stack_condition_batch(x_parts, 3, &batch_x) &&
+                stack_condition_batch(timestep_parts, 0, &batch_timesteps)) {
+                auto control_result = control_net->compute(n_threads,
+                                                           batch_x,
+                                                           control_image,
+                                                           batch_timesteps,
+                                                           batched_inputs.context,
+                                                           batched_inputs.y);
+                if (!control_result.has_value()) {
+                    LOG_ERROR("controlnet compute failed");
+                    return;
+                }
+                for (const auto& control : *control_result) {
+                    std::vector<sd::Tensor<float>> parts = sd::ops::chunk(control, static_cast<int64_t>(conditions.size()), 3);
+                    for (size_t i = 0; i < conditions.size(); ++i) {
+                        controls[i]->push_back(std::move(parts[i]));
+                    }
+                }
+                return;
+            }
+        }
+
+        for (size_t i = 0; i < conditions.size(); ++i) {
+            auto control_result = control_net->compute(n_threads,
+                                                       noised_input,
+                                                       control_image,
+                                                       timesteps_tensor,
+                                                       conditions[i]->c_crossattn,
+                                                       conditions[i]->c_vector);
+            if (!control_result.has_value()) {
+                LOG_ERROR("controlnet compute failed");
+                return;
+            }
+            *controls[i] = std::move(*control_result);
+        }
+    }
+
+    // Whether cond/uncond/img_uncond can share one batched diffusion forward pass,
+    // which is required to sample several latents per call.
+    bool can_batch_conditions(const std::shared_ptr<DiffusionModelRunner>& work_diffusion_model,
+                              const SDCondition& cond,
+                              const SDCondition& uncond,
+                              const SDCondition& img_uncond,
+                              const sd::Tensor<float>& control_image,
+                              const std::vector<sd::Tensor<float>>& ref_latents,
+                              const sd_cache_params_t* cache_params) {
+        if (work_diffusion_model == nullptr || !work_diffusion_model->supports_batched_conditions()) {
+            return false;
+        }
+        if (!control_image.empty() || !ref_latents.empty() || !generation_extensions.empty()) {
+            return false;
+        }
+        if (!cond.c_ref_images.empty() || !uncond.c_ref_images.empty() || !img_uncond.c_ref_images.empty()) {
+            return false;
+        }
+        // easycache/ucache/cache-dit keep per-condition state, which sample()
+        // keeps per latent and row of the batch; spectrum works on the guided
+        // output. Calibration profiles replay one trajectory and cannot split.
+        if (cache_params != nullptr && cache_params->mode != SD_CACHE_DISABLED && cache_params->mode != SD_CACHE_SPECTRUM &&
+            cache_params->profile_path != nullptr && cache_params->profile_path[0] != '\0') {
+            return false;
+        }
+        std::vector<const SDCondition*> conditions = {&cond};
+        if (!uncond.empty()) {
+            conditions.push_back(&uncond);
+        }
+        if (!img_uncond.empty()) {
+            conditions.push_back(&img_uncond);
+        }
+        BatchedConditionInputs inputs;
+        return stack_batched_conditions(conditions, 1, &inputs);
+    }
+
+    // Checkpointing of one sampling pass: resume, when set, is the snapshot to
+    // continue from, and cb gets a new snapshot every interval steps.
+    struct SampleCheckpointSession {
+        int pass                                  = 0;
+        int64_t seed                              = 0;
+        const sd_sample::SampleCheckpoint* resume = nullptr;
+        sd_sample_checkpoint_cb_t cb              = nullptr;
+        void* cb_data                             = nullptr;
+        int interval                              = 0;
+    };
+
+    sd::Tensor<float> sample(const std::shared_ptr<DiffusionModelRunner>& work_diffusion_model,
+                             bool inverse_noise_scaling,
+                             const sd::Tensor<float>& init_latent,
                              sd::Tensor<float> noise,
                              const SDCondition& cond,
                              const SDCondition& uncond,
@@ -1953,7 +3605,11 @@ public:
                              int audio_length,
                              float frame_rate,
                              const sd_cache_params_t* cache_params,
-                             const sd::Tensor<float>& video_positions = {}) {
+                             const sd::Tensor<float>& video_positions     = {},
+                             const SampleCheckpointSession* checkpoint    = nullptr,
+                             const std::function<void(int step)>& on_step = {},
+                             sd::Tensor<float>* last_denoised             = nullptr,
+                             int provisional_step                         = 0) {
         struct RunnerDoneOnExit {
             GGMLRunner* runner = nullptr;
             ~RunnerDoneOnExit() {
@@ -1962,10 +3618,49 @@ public:
                 }
             }
         };
+        // step temporaries recycle their storage until sampling returns
+        sd::TensorPoolScope tensor_pool_scope;
+        // Graphs of one request size their compute buffers from the latent,
+        // the context and the control image.
+        std::string request_shape_key = sd::tensor_shape_to_string(noise.shape()) + "|" +
+                                        sd::tensor_shape_to_string(cond.c_crossattn.shape()) + "|" +
+                                        sd::tensor_shape_to_string(control_image.shape());
+        work_diffusion_model->begin_request_compute_buffer(compute_buffer_retention, request_shape_key);
+        if (!control_image.empty() && control_net != nullptr) {
+            control_net->begin_request_compute_buffer(compute_buffer_retention, request_shape_key);
+        }
         RunnerDoneOnExit sample_diffusion_runner_done{work_diffusion_model.get()};
 
         RunnerDoneOnExit sample_control_runner_done{!control_image.empty() && control_net != nullptr ? control_net.get() : nullptr};
 
+        // extra sample arg profile_trace=<file.json>: every op the sampling
+        // graphs run is timed, see sd_perf::OpProfiler
+        struct ProfileOnExit {
+            std::string path;
+            std::unique_ptr<sd_perf::OpProfiler> profiler;
+            std::optional<sd_perf::ScopedOpProfiler> scope;
+            ~ProfileOnExit() {
+                if (profiler != nullptr) {
+                    scope.reset();
+                    profiler->log_summary(20);
+                    profiler->write_chrome_trace(path);
+                }
+            }
+        } sample_profile;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "profile_trace" || sd_perf::current_memory_probe() != nullptr) {
+                continue;
+            }
+            if (value.empty()) {
+                LOG_WARN("ignoring invalid profiler extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            sample_profile.path     = value;
+            sample_profile.profiler = std::make_unique<sd_perf::OpProfiler>();
+            sample_profile.scope.emplace(sample_profile.profiler.get());
+            LOG_INFO("profiling the sampling graphs op by op into '%s'", value.c_str());
+        }
+
         std::vector<int> skip_layers(guidance.slg.layers, guidance.slg.layers + guidance.slg.layer_count);
         float cfg_scale     = guidance.txt_cfg;
         float img_cfg_scale = guidance.img_cfg;
@@ -1998,10 +3693,16 @@ public:
             LOG_DEBUG("using guidance schedule: %s", schedule_str.c_str());
         }
 
+        std::string cache_profile_key               = sd_format("%s:%s:%s:%zu",
+                                                                model_version_to_str[version],
+                                                                work_diffusion_model->get_desc().c_str(),
+                                                                sd_sample_method_name(method),
+                                                                sigmas.size() > 0 ? sigmas.size() - 1 : 0);
         sd_sample::SampleCacheRuntime cache_runtime = sd_sample::init_sample_cache_runtime(version,
                                                                                            cache_params,
                                                                                            denoiser.get(),
-                                                                                           sigmas);
+                                                                                           sigmas,
+                                                                                           cache_profile_key);
 
         bool needs_uncond_denoised = method == EULER_CFG_PP_SAMPLE_METHOD || method == EULER_A_CFG_PP_SAMPLE_METHOD;
         // Spectrum cache is not supported for CFG++ samplers
@@ -2023,6 +3724,127 @@ public:
         if (use_apg_guidance) {
             LOG_INFO("using Adaptive Projected Guidance (APG)");
         }
+        sd::guidance::CfgTruncation cfg_truncation(sd::guidance::parse_cfg_truncation_args(extra_sample_args));
+        // ControlNet outputs are kept for control_reuse_steps model evaluations;
+        // 1 runs the ControlNet on every evaluation.
+        int control_reuse_steps = 1;
+        // Reference token keys and values are recomputed every ref_kv_refresh
+        // model evaluations and reused in between; 0 or 1 computes them every time.
+        int ref_kv_refresh = 0;
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key == "control_reuse_steps" && (!parse_strict_int(value, control_reuse_steps) || control_reuse_steps < 1)) {
+                LOG_WARN("ignoring invalid ControlNet extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                control_reuse_steps = 1;
+            } else if (key == "ref_kv_refresh" && (!parse_strict_int(value, ref_kv_refresh) || ref_kv_refresh < 0)) {
+                LOG_WARN("ignoring invalid reference K/V extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                ref_kv_refresh = 0;
+            }
+        }
+        if (control_reuse_steps > 1 && !control_image.empty()) {
+            LOG_INFO("reusing ControlNet outputs for %d evaluations", control_reuse_steps);
+        }
+        // the reference latents were encoded at ref_scale, see prepare_image_generation_latents
+        const float ref_position_scale = sd::reference_scale::supports(version) ? sd::reference_scale::parse_args(extra_sample_args).position_scale() : 1.0f;
+        if (ref_kv_refresh > 1) {
+            if (!(sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_longcat(version) || sd_version_is_sefi_image(version))) {
+                LOG_WARN("reference K/V reuse is only supported for Flux-style models");
+                ref_kv_refresh = 0;
+            } else {
+                LOG_INFO("reusing reference image keys and values for %d evaluations", ref_kv_refresh);
+            }
+        }
+        const bool async_controls = !control_image.empty() && !uncond.empty() && control_net_can_run_async();
+        if (async_controls) {
+            LOG_INFO("running uncond ControlNet passes concurrently with the diffusion model");
+        }
+        struct SampleControls {
+            std::vector<sd::Tensor<float>> cond;
+            std::vector<sd::Tensor<float>> uncond;
+            int cond_eval   = -1;
+            int uncond_eval = -1;
+        } sample_controls;
+        int eval_index = -1;
+        sd::token_merge::Params token_merge = sd::token_merge::parse_args(extra_sample_args);
+        if (token_merge.factor() > 1) {
+            if (sd_version_is_unet(version) && version != VERSION_SVD) {
+                LOG_INFO("merging %d self-attention tokens into one for sigmas in [%g, %g]",
+                         token_merge.factor(),
+                         token_merge.sigma_min,
+                         token_merge.sigma_max);
+            } else {
+                LOG_WARN("token merging is only supported for SD1.x/SD2.x/SDXL UNet models");
+                token_merge.ratio = 0.0f;
+            }
+        }
+        sd::video_attention::Params video_attention = sd::video_attention::parse_args(extra_sample_args);
+        if (video_attention.window > 0) {
+            if (sd_version_is_wan(version) || sd_version_is_ltxav(version)) {
+                LOG_INFO("restricting video self-attention to windows of %d latent frames after %d full attention steps",
+                         video_attention.window,
+                         video_attention.dense_steps);
+            } else {
+                LOG_WARN("windowed video attention is only supported for Wan and LTX models");
+                video_attention.window = 0;
+            }
+        }
+        sd::context_windows::Params context_windows = sd::context_windows::parse_args(extra_sample_args);
+        if (context_windows.frames > 0) {
+            if (!sd_version_is_wan(version)) {
+                LOG_WARN("context windows are only supported for Wan models");
+                context_windows.frames = 0;
+            } else if (!vace_context.empty() || init_latent.dim() < 4) {
+                LOG_WARN("context windows do not support VACE, sampling the whole clip at once");
+                context_windows.frames = 0;
+            } else if (context_windows.enabled_for(init_latent.shape()[2])) {
+                LOG_INFO("denoising %" PRId64 " latent frames in windows of %d overlapping by %d",
+                         init_latent.shape()[2],
+                         context_windows.frames,
+                         context_windows.resolved_overlap());
+            }
+        }
+        CfgBlockReuseState cfg_block_reuse = CfgBlockReuseState::parse_args(extra_sample_args);
+        if (cfg_block_reuse.enabled()) {
+            if ((sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_longcat(version)) && !uncond.empty()) {
+                LOG_INFO("reusing cond double-block residuals in uncond where the measured diff stays under %g (%d calibration steps)",
+                         cfg_block_reuse.threshold,
+                         cfg_block_reuse.calibration_steps);
+            } else {
+                LOG_WARN("cfg block reuse is only supported for Flux models sampled with CFG");
+                cfg_block_reuse.threshold = 0.0f;
+            }
+        }
+        sd::masked_compute::Params masked_compute = sd::masked_compute::parse_args(extra_sample_args);
+        MaskedTokenPlan masked_tokens;
+        if (masked_compute.enabled()) {
+            if (!(sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_longcat(version) || sd_version_is_sefi_image(version)) ||
+                version == VERSION_CHROMA_RADIANCE) {
+                LOG_WARN("masked-token compute is only supported for Flux models");
+            } else if (denoise_mask.empty() || !ref_latents.empty()) {
+                LOG_WARN("masked-token compute needs an inpaint mask and no reference images, computing every token");
+            } else if (needs_uncond_denoised) {
+                // CFG++ steps from the uncond prediction, which the mask does not restore
+                LOG_WARN("masked-token compute is not supported for CFG++ samplers");
+            } else {
+                masked_tokens.mask   = &denoise_mask;
+                masked_tokens.border = masked_compute.border;
+                LOG_INFO("computing only the image tokens within %d tokens of the inpaint mask", masked_compute.border);
+            }
+        }
+        ModulationCache modulation_cache;
+        if (sd::modulation_cache::parse_args(extra_sample_args).enabled && sd_perf::current_memory_probe() == nullptr) {
+            if (!(sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_longcat(version) ||
+                  sd_version_is_qwen_image(version) || sd_version_is_sd3(version)) ||
+                version == VERSION_CHROMA_RADIANCE) {
+                LOG_WARN("the modulation cache is only supported for Flux, Qwen-Image and SD3 models");
+            } else {
+                // the timesteps the steps will pass the model, see prepare_sample_timesteps
+                for (float sigma : sigmas) {
+                    if (sigma > 0.0f) {
+                        modulation_cache.timesteps.push_back(prepare_sample_timesteps(sigma, shifted_timestep)[0]);
+                    }
+                }
+            }
+        }
         sd::guidance::ClassifierFreeGuidance classifier_free_guidance(cfg_scale, img_cfg_scale);
         sd::guidance::AdaptiveProjectedGuidance adaptive_projected_guidance(cfg_scale, img_cfg_scale, apg_params);
         const sd::guidance::BaseGuidance& primary_guidance = use_apg_guidance
@@ -2033,22 +3855,244 @@ public:
                                                             guidance.slg.layer_start,
                                                             guidance.slg.layer_end);
 
+        // init_latent/noise carry several latents along dim 3 when generate_image
+        // samples a whole batch at once, see can_batch_conditions().
+        const int64_t latent_batch = init_latent.dim() == 4 ? init_latent.shape()[3] : 1;
+        // MultiDiffusion over spatial tiles, see compute_in_spatial_tiles()
+        sd::tiled_diffusion::Params tiled_diffusion = sd::tiled_diffusion::parse_args(extra_sample_args);
+        if (tiled_diffusion.tile > 0) {
+            const bool has_ref_images = !ref_latents.empty() || !cond.c_ref_images.empty() || !uncond.c_ref_images.empty() || !img_uncond.c_ref_images.empty();
+            if (work_diffusion_model == nullptr || !work_diffusion_model->supports_batched_conditions()) {
+                LOG_WARN("tiled diffusion is only supported for UNet, SD3 and Flux models");
+                tiled_diffusion.tile = 0;
+            } else if (init_latent.dim() != 4 || latent_batch > 1 || circular_x || circular_y) {
+                LOG_WARN("tiled diffusion needs a single non-circular image latent, sampling the whole latent at once");
+                tiled_diffusion.tile = 0;
+            } else if (!control_image.empty() || has_ref_images || !generation_extensions.empty() ||
+                       masked_tokens.mask != nullptr || cfg_block_reuse.enabled() ||
+                       (cache_params != nullptr && cache_params->mode != SD_CACHE_DISABLED && cache_params->mode != SD_CACHE_SPECTRUM)) {
+                // each of these keeps per-image state or positions across the whole latent
+                LOG_WARN("tiled diffusion does not support ControlNets, reference images, extensions, masked compute, "
+                         "cfg block reuse or step caches, sampling the whole latent at once");
+                tiled_diffusion.tile = 0;
+            } else if (tiled_diffusion.enabled_for(init_latent.shape()[0], init_latent.shape()[1])) {
+                LOG_INFO("denoising the %" PRId64 "x%" PRId64 " latent in tiles of %d overlapping by %d, %s",
+                         init_latent.shape()[0],
+                         init_latent.shape()[1],
+                         tiled_diffusion.resolved_tile(),
+                         tiled_diffusion.resolved_overlap(),
+                         tiled_diffusion.batch > 0 ? sd_format("%d tiles per pass", tiled_diffusion.batch).c_str() : "all tiles in one pass");
+            }
+        }
+        const bool tiled_latent = tiled_diffusion.tile > 0 && tiled_diffusion.enabled_for(init_latent.shape()[0], init_latent.shape()[1]);
+        BatchedConditionInputs batched_inputs;
+        bool use_batched_conditions = false;
+        if (!tiled_latent && (latent_batch > 1 || (batched_cfg && !uncond.empty()))) {
+            std::vector<const SDCondition*> batch_conditions = {&cond};
+            if (!uncond.empty()) {
+                batch_conditions.push_back(&uncond);
+            }
+            if (!img_uncond.empty()) {
+                batch_conditions.push_back(&img_uncond);
+            }
+            use_batched_conditions = can_batch_conditions(work_diffusion_model,
+                                                          cond,
+                                                          uncond,
+                                                          img_uncond,
+                                                          control_image,
+                                                          ref_latents,
+                                                          cache_params) &&
+                                     stack_batched_conditions(batch_conditions, latent_batch, &batched_inputs);
+            if (latent_batch > 1 && (!use_batched_conditions || has_skiplayer)) {
+                LOG_ERROR("sampling %" PRId64 " latents at once is not supported for this model/condition setup", latent_batch);
+                return {};
+            }
+            if (use_batched_conditions) {
+                LOG_INFO("using batched sampling (%" PRId64 " conditions x %" PRId64 " latents per forward pass)",
+                         batched_inputs.count,
+                         latent_batch);
+            } else {
+                LOG_WARN("batched cfg is not supported for this model/condition setup, running conditions separately");
+            }
+        }
+        if (diffusion_lora_adapter) {
+            diffusion_lora_adapter->set_batch_size(use_batched_conditions ? batched_inputs.count * latent_batch : latent_batch);
+        }
+        // Batched latents keep a step cache each, see run_batched_conditions.
+        // Latent 0 uses cache_runtime, which also serves the unbatched passes.
+        // Per-image LoRA multipliers follow the row order, which skipped rows
+        // would shift, see can_cache_latent_batch().
+        const bool per_row_cache = use_batched_conditions &&
+                                   !(latent_batch > 1 && diffusion_lora_adapter && diffusion_lora_adapter->has_image_multipliers()) &&
+                                   (cache_runtime.mode == sd_sample::SampleCacheMode::EASYCACHE ||
+                                    cache_runtime.mode == sd_sample::SampleCacheMode::UCACHE ||
+                                    cache_runtime.mode == sd_sample::SampleCacheMode::CACHEDIT);
+        std::vector<sd_sample::SampleCacheRuntime> latent_cache_runtimes;
+        if (per_row_cache && latent_batch > 1) {
+            latent_cache_runtimes.assign(static_cast<size_t>(latent_batch - 1), cache_runtime);
+            LOG_INFO("step caching decides per latent, computing only the rows of the batch it cannot reuse");
+        }
+        // The uncond pass runs on the --cfg-backend copy while the cond pass
+        // runs here. Step caches, CFG block reuse, ControlNets and extensions
+        // share state between the passes of a step, so they keep them in turn.
+        const bool parallel_cfg = cfg_diffusion_model != nullptr &&
+                                  cfg_diffusion_enabled &&
+                                  diffusion_lora_adapter == nullptr &&
+                                  work_diffusion_model == diffusion_model &&
+                                  !uncond.empty() &&
+                                  img_uncond.empty() &&
+                                  !use_batched_conditions &&
+                                  control_image.empty() &&
+                                  generation_extensions.empty() &&
+                                  !cfg_block_reuse.enabled() &&
+                                  cache_runtime.mode == sd_sample::SampleCacheMode::NONE &&
+                                  !cache_runtime.spectrum_enabled;
+        if (parallel_cfg) {
+            LOG_INFO("running uncond passes on the CFG backend concurrently with the cond passes");
+            cfg_diffusion_model->begin_request_compute_buffer(compute_buffer_retention, request_shape_key);
+        }
+        RunnerDoneOnExit sample_cfg_runner_done{parallel_cfg ? cfg_diffusion_model.get() : nullptr};
+        auto preview_latents = [&](const sd::Tensor<float>& latents) -> sd::Tensor<float> {
+            return latent_batch > 1 ? sd::ops::slice(latents, 3, 0, 1) : latents;
+        };
+
         if (version == VERSION_HIDREAM_O1 && !noise.empty()) {
             noise *= eta;
         }
 
         int64_t last_progress_us     = ggml_time_us();
+        bool provisional_sent        = false;
         sd::Tensor<float> x_t        = !noise.empty()
                                            ? denoiser->noise_scaling(sigmas[0], noise, init_latent)
                                            : init_latent;
         sd::Tensor<float> denoised   = x_t;
         SamplePreviewContext preview = prepare_sample_preview_context();
+        const bool async_preview     = preview.callback != nullptr && preview_can_run_async(preview.mode);
+        struct PreviewDrain {
+            StableDiffusionGGML* sd;
+            ~PreviewDrain() {
+                sd->finish_async_previews();
+            }
+        } preview_drain{this};
+
+        // Only state that lives in the latent, the sampler history and the
+        // generators is checkpointed, so anything that carries its own state
+        // from step to step rules checkpoints out.
+        SamplerResume sampler_resume;
+        const SamplerResume* resume = nullptr;
+        if (checkpoint != nullptr && (checkpoint->resume != nullptr || (checkpoint->cb != nullptr && checkpoint->interval > 0))) {
+            const char* unsupported = nullptr;
+            if (!sampler_supports_resume(method, is_flow_denoiser) || std::dynamic_pointer_cast<SefiFlowDenoiser>(denoiser)) {
+                unsupported = "this sampler";
+            } else if (cache_runtime.mode != sd_sample::SampleCacheMode::NONE || cache_runtime.spectrum_enabled) {
+                unsupported = "step caching";
+            } else if (cfg_truncation.is_enabled() || cfg_block_reuse.enabled()) {
+                unsupported = "cfg truncation and cfg block reuse";
+            } else if (use_apg_guidance && apg_params.momentum != 0.0f) {
+                unsupported = "APG momentum";
+            }
+            if (unsupported != nullptr && checkpoint->resume != nullptr) {
+                LOG_ERROR("cannot resume sampling from a checkpoint with %s", unsupported);
+                return {};
+            }
+            if (unsupported != nullptr) {
+                LOG_WARN("sampling checkpoints are not supported with %s, disabling them", unsupported);
+            } else {
+                const uint64_t sigmas_hash = sd_sample::hash_sample_sigmas(sigmas);
+                if (checkpoint->resume != nullptr) {
+                    const sd_sample::SampleCheckpoint& saved = *checkpoint->resume;
+                    if (saved.method != method ||
+                        saved.steps != static_cast<int>(steps) ||
+                        saved.seed != checkpoint->seed ||
+                        saved.sigmas_hash != sigmas_hash ||
+                        saved.x.shape() != x_t.shape()) {
+                        LOG_ERROR("sampling checkpoint does not match this request");
+                        return {};
+                    }
+                    if (!rng->load_state(saved.rng_state) || !sampler_rng->load_state(saved.sampler_rng_state)) {
+                        LOG_ERROR("sampling checkpoint was taken with a different rng type");
+                        return {};
+                    }
+                    x_t                         = saved.x;
+                    sampler_resume.start_step   = saved.step;
+                    sampler_resume.old_denoised = saved.old_denoised;
+                    LOG_INFO("resuming sampling at step %d/%zu", saved.step, steps);
+                }
+                if (checkpoint->cb != nullptr && checkpoint->interval > 0) {
+                    sampler_resume.on_step = [&, sigmas_hash](int step, const sd::Tensor<float>& x, const sd::Tensor<float>& old_denoised) {
+                        if (step % checkpoint->interval != 0 || step >= static_cast<int>(steps)) {
+                            return;
+                        }
+                        sd_sample::SampleCheckpoint snapshot;
+                        snapshot.pass              = checkpoint->pass;
+                        snapshot.method            = method;
+                        snapshot.step              = step;
+                        snapshot.steps             = static_cast<int>(steps);
+                        snapshot.seed              = checkpoint->seed;
+                        snapshot.sigmas_hash       = sigmas_hash;
+                        snapshot.x                 = x;
+                        snapshot.old_denoised      = old_denoised;
+                        snapshot.rng_state         = rng->save_state();
+                        snapshot.sampler_rng_state = sampler_rng->save_state();
+                        std::vector<uint8_t> data  = sd_sample::serialize_sample_checkpoint(snapshot);
+                        checkpoint->cb(checkpoint->pass, step, static_cast<int>(steps), data.data(), data.size(), checkpoint->cb_data);
+                    };
+                }
+                resume = &sampler_resume;
+            }
+        }
+
+        // Without uncond passes or skip-layer guidance (guidance-distilled
+        // models, or cfg_scale 1) every guider returns the cond prediction,
+        // so such steps skip the guiders' copies and scale the output in place.
+        // Euler runs of such steps go further and append the step update to
+        // the model graph, keeping x on the backend; see resident_x below.
+        const bool single_pass = uncond.empty() && img_uncond.empty() && !has_skiplayer && !needs_uncond_denoised;
+        if (single_pass) {
+            LOG_DEBUG("single-pass sampling: one model call per step, no guidance");
+        }
+
+        // Set while the Euler steps below keep x on the diffusion backend,
+        // see GGMLRunner::begin_resident_latent.
+        struct ResidentSampling {
+            bool active      = false;
+            bool on_backend  = false;  // the host x is behind the backend copy
+            float sigma_next = 0.f;
+        } resident_sampling;
 
         auto denoise = [&](const sd::Tensor<float>& x, float sigma, int step) -> sd::guidance::GuiderOutput {
             if (get_cancel_flag() == SD_CANCEL_ALL) {
                 LOG_DEBUG("cancelling generation");
                 return {};
             }
+            sd_perf::set_memory_phase(sd_format("step %d", std::abs(step)));
+            if (on_step) {
+                on_step(step);
+            }
+
+            // where the step's time goes, see sd_set_step_timing_callback; the
+            // uncond pass and its ControlNet run on threads of their own
+            sd_step_timing_t step_timing = {};
+            std::atomic<int> step_computed_passes{0};
+            std::atomic<int> step_cached_passes{0};
+            std::atomic<int64_t> step_control_us{0};
+            sd_perf::PerfRecorder* step_perf = sd_perf::current_recorder();
+            uint64_t step_uploaded_start     = step_perf != nullptr ? step_perf->uploaded_bytes() : 0;
+            std::future<void> pending_uncond_controls;
+            auto preview_step = [&](const sd::Tensor<float>& latents, bool is_noisy) {
+                int64_t preview_start_us = ggml_time_us();
+                request_preview(step, preview_latents(latents), preview, async_preview, is_noisy);
+                step_timing.preview_ms += (ggml_time_us() - preview_start_us) / 1000.f;
+            };
+            auto report_step = [&](sd_step_cache_t cache) {
+                if (pending_uncond_controls.valid()) {
+                    pending_uncond_controls.wait();
+                }
+                step_timing.cache          = cache;
+                step_timing.control_net_ms = step_control_us.load() / 1000.f;
+                step_timing.streamed_bytes = step_perf != nullptr ? step_perf->uploaded_bytes() - step_uploaded_start : 0;
+                report_sample_progress(step, steps, &last_progress_us, &step_timing);
+            };
 
             if (step == 1 || step == -1) {
                 pretty_progress(0, (int)steps, 0);
@@ -2077,48 +4121,159 @@ public:
 
             sd::Tensor<float> timesteps_tensor({static_cast<int64_t>(timesteps_vec.size())}, timesteps_vec);
             sd::Tensor<float> guidance_tensor({1}, std::vector<float>{guidance.distilled_guidance});
-            sd::Tensor<float> noised_input = x * c_in;
+            sd::Tensor<float> noised_input = resident_sampling.on_backend ? sd::Tensor<float>() : x * c_in;
             if (!denoise_mask.empty() && (version == VERSION_WAN2_2_TI2V || sd_version_is_ltxav(version))) {
                 noised_input = noised_input * denoise_mask + init_latent * (1.0f - denoise_mask);
             }
 
+            // the end of a step once denoised holds the model's prediction
+            auto finish_denoised_step = [&]() -> sd::guidance::GuiderOutput {
+                if (cache_runtime.spectrum_enabled) {
+                    cache_runtime.spectrum.update(denoised);
+                }
+                if (!denoise_mask.empty()) {
+                    denoised = denoised * denoise_mask + init_latent * (1.0f - denoise_mask);
+                }
+                if (sd_should_preview_denoised() && preview.callback != nullptr) {
+                    preview_step(denoised, false);
+                }
+                if (provisional_step > 0 && std::abs(step) == provisional_step && !provisional_sent) {
+                    // the client confirms or cancels before the remaining steps
+                    provisional_sent = true;
+                    deliver_provisional_image(provisional_step, static_cast<int>(steps), preview_latents(denoised));
+                }
+                report_step(step_computed_passes.load() == 0 && step_cached_passes.load() > 0 ? SD_STEP_CACHED : SD_STEP_COMPUTED);
+                sd::guidance::GuiderOutput output;
+                output.pred = denoised;
+                return output;
+            };
+
             if (cache_runtime.spectrum_enabled && cache_runtime.spectrum.should_predict()) {
                 cache_runtime.spectrum.predict(&denoised);
                 if (!denoise_mask.empty()) {
                     denoised = denoised * denoise_mask + init_latent * (1.0f - denoise_mask);
                 }
                 if (sd_should_preview_denoised() && preview.callback != nullptr) {
-                    preview_image(step, denoised, version, preview.mode, preview.callback, preview.data, false);
+                    preview_step(denoised, false);
                 }
-                report_sample_progress(step, steps, &last_progress_us);
+                if (provisional_step > 0 && std::abs(step) == provisional_step && !provisional_sent) {
+                    provisional_sent = true;
+                    deliver_provisional_image(provisional_step, static_cast<int>(steps), preview_latents(denoised));
+                }
+                report_step(SD_STEP_PREDICTED);
                 sd::guidance::GuiderOutput output;
                 output.pred = denoised;
                 return output;
             }
 
             if (sd_should_preview_noisy() && preview.callback != nullptr) {
-                preview_image(step, noised_input, version, preview.mode, preview.callback, preview.data, true);
+                preview_step(noised_input, true);
             }
 
             sd::Tensor<float> cond_out;
             sd::Tensor<float> uncond_out;
             sd::Tensor<float> img_uncond_out;
             sd_sample::SampleStepCacheDispatcher step_cache(cache_runtime, step, sigma);
-            std::vector<sd::Tensor<float>> controls;
+            const int step_token_merge      = token_merge.factor_for_sigma(sigma);
+            const int step_attention_window = video_attention.window_for_step(step);
+            // batched latents share one forward pass over every condition, so they keep CFG
+            const bool skip_uncond = cfg_truncation.is_enabled() && latent_batch == 1 && cfg_truncation.skip_uncond(sigma);
+            CfgBlockReusePlan cfg_reuse_cond;
+            CfgBlockReusePlan cfg_reuse_uncond;
+            bool cfg_reuse_cond_recorded = false;
+            if (cfg_block_reuse.enabled() && (cfg_block_reuse.calibrating() || cfg_block_reuse.reusing())) {
+                cfg_reuse_cond.pass   = CfgBlockReusePlan::RECORD;
+                cfg_reuse_uncond.pass = cfg_block_reuse.calibrating() ? CfgBlockReusePlan::MEASURE : CfgBlockReusePlan::REUSE;
+                if (!cfg_block_reuse.calibrating()) {
+                    cfg_reuse_cond.blocks   = cfg_block_reuse.reuse_blocks;
+                    cfg_reuse_uncond.blocks = cfg_block_reuse.reuse_blocks;
+                }
+                cfg_reuse_uncond.stats = &cfg_block_reuse.step_stats;
+            }
+            eval_index++;
+            const RefKVCachePlan::Pass ref_kv_pass = ref_kv_refresh > 1 && eval_index % ref_kv_refresh != 0 ? RefKVCachePlan::REUSE
+                                                                                                           : RefKVCachePlan::RECORD;
             DiffusionParams diffusion_params;
-            diffusion_params.x                  = &noised_input;
+            diffusion_params.x                  = resident_sampling.on_backend ? &x : &noised_input;
             diffusion_params.timesteps          = &timesteps_tensor;
             diffusion_params.increase_ref_index = increase_ref_index;
+            diffusion_params.ref_position_scale = ref_position_scale;
+            if (resident_sampling.active) {
+                // sample_euler's x += (x - denoised) / sigma * dt, with
+                // denoised = c_skip * x + c_out * model(c_in * x)
+                float ratio = (resident_sampling.sigma_next - sigma) / sigma;
+                work_diffusion_model->arm_resident_latent_step(*diffusion_params.x,
+                                                               c_in,
+                                                               1.0f + ratio * (1.0f - c_skip),
+                                                               -ratio * c_out,
+                                                               resident_sampling.on_backend);
+            }
             sd::guidance::GuidanceInput step_guidance_input;
             step_guidance_input.step          = step;
             step_guidance_input.schedule_size = sigmas.size();
             bool is_skiplayer_step            = skip_layer_guidance.is_enabled_for_step(step_guidance_input);
 
-            compute_sample_controls(control_image,
-                                    noised_input,
-                                    timesteps_tensor,
-                                    cond,
-                                    &controls);
+            // the skip-layer pass starts from the cond pass's state at the first skipped layer
+            SkipLayerPrefixPlan slg_prefix_record;
+            SkipLayerPrefixPlan slg_prefix_resume;
+            bool slg_prefix_recorded = false;
+            if (is_skiplayer_step && slg_scale != 0.0f && !skip_layer_guidance.layers().empty()) {
+                const std::vector<int>& layers = skip_layer_guidance.layers();
+                slg_prefix_record.pass         = SkipLayerPrefixPlan::RECORD;
+                slg_prefix_record.first_layer  = *std::min_element(layers.begin(), layers.end());
+                slg_prefix_resume.pass         = SkipLayerPrefixPlan::RESUME;
+                slg_prefix_resume.first_layer  = slg_prefix_record.first_layer;
+            }
+
+            // Runs the ControlNet when a pass needs outputs it does not have yet;
+            // on the cond pass the uncond outputs are batched in as well, or, with
+            // the ControlNet on its own backend, computed on a thread while the
+            // diffusion model runs the cond pass. The next step's ControlNet
+            // input depends on this step's output, so steps cannot overlap.
+            auto ensure_sample_controls = [&](bool for_uncond) {
+                if (control_image.empty() || control_net == nullptr) {
+                    return;
+                }
+                if (pending_uncond_controls.valid()) {
+                    if (!for_uncond) {
+                        return;
+                    }
+                    pending_uncond_controls.get();
+                }
+                auto fresh = [&](int computed_eval) {
+                    return computed_eval >= 0 && eval_index - computed_eval < control_reuse_steps;
+                };
+                bool run_uncond  = !uncond.empty() && !skip_uncond;
+                bool need_cond   = !for_uncond && !fresh(sample_controls.cond_eval);
+                bool need_uncond = run_uncond && (for_uncond || need_cond) && !fresh(sample_controls.uncond_eval);
+                std::vector<const SDCondition*> conditions;
+                std::vector<std::vector<sd::Tensor<float>>*> outputs;
+                if (need_cond) {
+                    conditions.push_back(&cond);
+                    outputs.push_back(&sample_controls.cond);
+                    sample_controls.cond_eval = eval_index;
+                }
+                if (need_uncond) {
+                    sample_controls.uncond_eval = eval_index;
+                    if (need_cond && async_controls) {
+                        int64_t control_start_us = ggml_time_us();
+                        compute_sample_controls(control_image, noised_input, timesteps_tensor, conditions, outputs);
+                        step_control_us += ggml_time_us() - control_start_us;
+                        pending_uncond_controls = std::async(std::launch::async, [&, thread_callbacks = sd_current_thread_callbacks()]() {
+                            ScopedThreadCallbacks callback_scope(thread_callbacks);
+                            int64_t uncond_control_start_us = ggml_time_us();
+                            compute_sample_controls(control_image, noised_input, timesteps_tensor, {&uncond}, {&sample_controls.uncond});
+                            step_control_us += ggml_time_us() - uncond_control_start_us;
+                        });
+                        return;
+                    }
+                    conditions.push_back(&uncond);
+                    outputs.push_back(&sample_controls.uncond);
+                }
+                int64_t control_start_us = ggml_time_us();
+                compute_sample_controls(control_image, noised_input, timesteps_tensor, conditions, outputs);
+                step_control_us += ggml_time_us() - control_start_us;
+            };
 
             static const std::vector<sd::Tensor<float>> empty_ref_latents;
             bool uncond_without_ref_latents = !img_uncond.empty() &&
@@ -2128,57 +4283,144 @@ public:
             auto run_condition = [&](const SDCondition& condition,
                                      const sd::Tensor<float>* c_concat_override                 = nullptr,
                                      const std::vector<int>* local_skip_layers                  = nullptr,
-                                     const std::vector<sd::Tensor<float>>* ref_latents_override = nullptr) -> sd::Tensor<float> {
-                diffusion_params.context     = condition.c_crossattn.empty() ? nullptr : &condition.c_crossattn;
-                diffusion_params.c_concat    = c_concat_override != nullptr ? c_concat_override : (condition.c_concat.empty() ? nullptr : &condition.c_concat);
-                diffusion_params.y           = condition.c_vector.empty() ? nullptr : &condition.c_vector;
-                diffusion_params.ref_latents = ref_latents_override != nullptr ? ref_latents_override : (condition.c_ref_images.empty() ? &ref_latents : &condition.c_ref_images);
+                                     const std::vector<sd::Tensor<float>>* ref_latents_override = nullptr,
+                                     DiffusionModelRunner* model                                = nullptr) -> sd::Tensor<float> {
+                // a copy per call, so the uncond pass can run on the CFG backend
+                // while the cond pass runs here
+                DiffusionParams condition_params = diffusion_params;
+
+                condition_params.context     = condition.c_crossattn.empty() ? nullptr : &condition.c_crossattn;
+                condition_params.c_concat    = c_concat_override != nullptr ? c_concat_override : (condition.c_concat.empty() ? nullptr : &condition.c_concat);
+                condition_params.y           = condition.c_vector.empty() ? nullptr : &condition.c_vector;
+                condition_params.ref_latents = ref_latents_override != nullptr ? ref_latents_override : (condition.c_ref_images.empty() ? &ref_latents : &condition.c_ref_images);
+
+                DiffusionModelRunner* runner = model != nullptr ? model : work_diffusion_model.get();
+                // per-token timesteps (Wan2.2 TI2V masks) do not split by frame
+                const bool windowed = context_windows.enabled_for(x.shape()[2]) && timesteps_vec.size() == 1;
+                const bool tiled    = tiled_latent && !windowed && timesteps_vec.size() == 1;
+
+                // recorded on the plain cond pass, resumed by the skip-layer pass of the same inputs
+                const SkipLayerPrefixPlan* slg_prefix = nullptr;
+                if (slg_prefix_record.first_layer > 0 && &condition == &cond && model == nullptr && !windowed && !tiled &&
+                    ref_latents_override == nullptr) {
+                    if (local_skip_layers == nullptr && c_concat_override == nullptr) {
+                        slg_prefix = &slg_prefix_record;
+                    } else if (local_skip_layers == &skip_layer_guidance.layers() && slg_prefix_recorded) {
+                        slg_prefix = &slg_prefix_resume;
+                    }
+                }
+
+                // one cache per condition, the skip-layer passes compute their own
+                RefKVCachePlan ref_kv;
+                ref_kv.pass = ref_kv_pass;
+                ref_kv.slot = &condition == &uncond ? 1 : (&condition == &img_uncond ? 2 : 0);
 
                 if (sd_version_is_unet(version)) {
-                    diffusion_params.extra = UNetDiffusionExtra{-1, &controls, control_strength};
+                    condition_params.extra = UNetDiffusionExtra{-1,
+                                                                &condition == &uncond ? &sample_controls.uncond : &sample_controls.cond,
+                                                                control_strength,
+                                                                step_token_merge,
+                                                                token_merge.max_downsample};
                 } else if (sd_version_is_sd3(version)) {
-                    diffusion_params.extra = SkipLayerDiffusionExtra{local_skip_layers};
+                    condition_params.extra = SkipLayerDiffusionExtra{local_skip_layers,
+                                                                     slg_prefix,
+                                                                     modulation_cache.timesteps.empty() ? nullptr : &modulation_cache};
                 } else if (sd_version_is_flux(version) || sd_version_is_flux2(version) || sd_version_is_longcat(version) || sd_version_is_sefi_image(version)) {
-                    diffusion_params.extra = FluxDiffusionExtra{&guidance_tensor,
-                                                                local_skip_layers};
+                    const CfgBlockReusePlan* cfg_reuse = nullptr;
+                    if (cfg_block_reuse.enabled() && local_skip_layers == nullptr) {
+                        if (&condition != &uncond && &condition != &img_uncond) {
+                            cfg_reuse = &cfg_reuse_cond;
+                        } else if (&condition == &uncond && cfg_reuse_cond_recorded) {
+                            cfg_reuse = &cfg_reuse_uncond;
+                        }
+                    }
+                    condition_params.extra = FluxDiffusionExtra{&guidance_tensor,
+                                                                local_skip_layers,
+                                                                nullptr,
+                                                                1.0f,
+                                                                cfg_reuse,
+                                                                slg_prefix,
+                                                                masked_tokens.mask != nullptr ? &masked_tokens : nullptr,
+                                                                modulation_cache.timesteps.empty() ? nullptr : &modulation_cache,
+                                                                ref_kv_refresh > 1 && local_skip_layers == nullptr ? &ref_kv : nullptr};
                 } else if (sd_version_is_anima(version)) {
-                    diffusion_params.extra = AnimaDiffusionExtra{condition.c_t5_ids.empty() ? nullptr : &condition.c_t5_ids,
+                    condition_params.extra = AnimaDiffusionExtra{condition.c_t5_ids.empty() ? nullptr : &condition.c_t5_ids,
                                                                  condition.c_t5_weights.empty() ? nullptr : &condition.c_t5_weights};
                 } else if (sd_version_is_wan(version)) {
-                    diffusion_params.extra = WanDiffusionExtra{vace_context.empty() ? nullptr : &vace_context,
-                                                               vace_strength};
+                    condition_params.extra = WanDiffusionExtra{vace_context.empty() ? nullptr : &vace_context,
+                                                               vace_strength,
+                                                               step_attention_window};
                 } else if (version == VERSION_HIDREAM_O1) {
-                    diffusion_params.extra = HiDreamO1DiffusionExtra{
+                    condition_params.extra = HiDreamO1DiffusionExtra{
                         condition.c_input_ids.empty() ? nullptr : &condition.c_input_ids,
                         condition.c_position_ids.empty() ? nullptr : &condition.c_position_ids,
                         condition.c_token_types.empty() ? nullptr : &condition.c_token_types,
                         condition.c_vinput_mask.empty() ? nullptr : &condition.c_vinput_mask,
                         condition.c_image_embeds.empty() ? nullptr : &condition.c_image_embeds};
+                } else if (sd_version_is_qwen_image(version)) {
+                    condition_params.extra = QwenImageDiffusionExtra{modulation_cache.timesteps.empty() ? nullptr : &modulation_cache};
                 } else if (sd_version_is_ltxav(version)) {
-                    diffusion_params.extra = LTXAVDiffusionExtra{
+                    condition_params.extra = LTXAVDiffusionExtra{
                         nullptr,
                         audio_timesteps_tensor.empty() ? nullptr : &audio_timesteps_tensor,
                         audio_length,
                         frame_rate,
-                        video_positions.empty() ? nullptr : &video_positions};
+                        video_positions.empty() ? nullptr : &video_positions,
+                        step_attention_window};
                 } else {
-                    diffusion_params.extra = std::monostate{};
+                    condition_params.extra = std::monostate{};
                 }
 
                 sd::Tensor<float> cached_output;
                 if (step_cache.before_condition(&condition, noised_input, &cached_output)) {
+                    if (sd_perf::PerfRecorder* perf = sd_perf::current_recorder()) {
+                        perf->sample_cache_hits++;
+                    }
+                    step_cached_passes++;
                     return std::move(cached_output);
                 }
 
                 for (const auto& extension : generation_extensions) {
-                    extension->before_diffusion(diffusion_params, step);
+                    extension->before_diffusion(condition_params, step);
+                }
+                if (sd_version_is_unet(version)) {
+                    ensure_sample_controls(&condition == &uncond);
                 }
 
-                auto output_opt = work_diffusion_model->compute(n_threads, diffusion_params);
+                int64_t pass_start_us = ggml_time_us();
+                auto output_opt       = windowed ? compute_in_context_windows(runner, condition_params, context_windows)
+                                        : tiled  ? compute_in_spatial_tiles(runner, condition_params, tiled_diffusion)
+                                                 : runner->compute(n_threads, condition_params);
+                float pass_ms         = (ggml_time_us() - pass_start_us) / 1000.f;
+                if (&condition == &uncond) {
+                    step_timing.uncond_ms += pass_ms;
+                } else if (&condition == &img_uncond) {
+                    step_timing.img_uncond_ms += pass_ms;
+                } else if (local_skip_layers != nullptr) {
+                    step_timing.slg_ms += pass_ms;
+                } else {
+                    step_timing.cond_ms += pass_ms;
+                }
+                step_computed_passes++;
                 if (output_opt.empty()) {
+                    if (runner->resident_latent_stepped() || runner->resident_latent_step_skipped()) {
+                        return output_opt;
+                    }
                     LOG_ERROR("diffusion model compute failed");
                     return sd::Tensor<float>();
                 }
+                if (const auto* flux_extra = std::get_if<FluxDiffusionExtra>(&condition_params.extra);
+                    flux_extra != nullptr && flux_extra->cfg_reuse != nullptr) {
+                    if (flux_extra->cfg_reuse == &cfg_reuse_cond) {
+                        cfg_reuse_cond_recorded = true;
+                    } else if (cfg_reuse_uncond.pass == CfgBlockReusePlan::MEASURE) {
+                        cfg_block_reuse.record_measurement(cfg_block_reuse.step_stats);
+                    }
+                }
+
+                if (slg_prefix == &slg_prefix_record) {
+                    slg_prefix_recorded = true;
+                }
 
                 step_cache.after_condition(&condition, noised_input, output_opt);
                 return output_opt;
@@ -2197,19 +4439,199 @@ public:
                 }
             }
 
-            cond_out = run_condition(*positive_condition, c_concat_override);
-            if (cond_out.empty()) {
+            // Batched conditions share one forward pass over [cond, uncond(, img_uncond)]
+            // stacked along the batch dim, each repeated for every latent of the batch.
+            // With a step cache, each latent asks its own cache for every condition
+            // first, and only the rows it cannot serve go through the model.
+            auto run_batched_conditions = [&]() -> bool {
+                const int64_t count                            = batched_inputs.count;
+                std::vector<const SDCondition*> row_conditions = {&cond};
+                if (!uncond.empty()) {
+                    row_conditions.push_back(&uncond);
+                }
+                if (!img_uncond.empty()) {
+                    row_conditions.push_back(&img_uncond);
+                }
+                std::vector<sd::Tensor<float>> latent_inputs;
+                std::vector<sd::Tensor<float>> row_outputs(static_cast<size_t>(count * latent_batch));
+                std::vector<int64_t> compute_rows;
+                std::vector<sd_sample::SampleStepCacheDispatcher> latent_caches;
+                if (per_row_cache) {
+                    latent_caches.reserve(static_cast<size_t>(latent_batch));
+                    for (int64_t b = 0; b < latent_batch; ++b) {
+                        latent_inputs.push_back(latent_batch > 1 ? sd::ops::slice(noised_input, 3, b, b + 1) : noised_input);
+                        latent_caches.emplace_back(b == 0 ? cache_runtime : latent_cache_runtimes[static_cast<size_t>(b - 1)], step, sigma);
+                    }
+                    for (int64_t row = 0; row < count * latent_batch; ++row) {
+                        const int64_t b = row % latent_batch;
+                        if (latent_caches[static_cast<size_t>(b)].before_condition(row_conditions[static_cast<size_t>(row / latent_batch)],
+                                                                                   latent_inputs[static_cast<size_t>(b)],
+                                                                                   &row_outputs[static_cast<size_t>(row)])) {
+                            step_cached_passes++;
+                        } else {
+                            compute_rows.push_back(row);
+                        }
+                    }
+                }
+                const bool compact  = per_row_cache && static_cast<int64_t>(compute_rows.size()) < count * latent_batch;
+                const int64_t total = compact ? static_cast<int64_t>(compute_rows.size()) : count * latent_batch;
+
+                sd::Tensor<float> batch_x;
+                sd::Tensor<float> row_context;
+                sd::Tensor<float> row_c_concat;
+                sd::Tensor<float> row_y;
+                const sd::Tensor<float>* batch_context  = batched_inputs.context.empty() ? nullptr : &batched_inputs.context;
+                const sd::Tensor<float>* batch_c_concat = batched_inputs.c_concat.empty() ? nullptr : &batched_inputs.c_concat;
+                const sd::Tensor<float>* batch_y        = batched_inputs.y.empty() ? nullptr : &batched_inputs.y;
+                if (compact) {
+                    // the rows left to compute, in batch order
+                    auto select_rows = [&](const sd::Tensor<float>* rows, size_t dim, sd::Tensor<float>* out) {
+                        if (rows == nullptr) {
+                            return;
+                        }
+                        for (int64_t row : compute_rows) {
+                            sd::Tensor<float> part = sd::ops::slice(*rows, dim, row, row + 1);
+                            *out                   = out->empty() ? std::move(part) : sd::ops::concat(*out, part, dim);
+                        }
+                    };
+                    std::vector<const sd::Tensor<float>*> x_parts;
+                    for (int64_t row : compute_rows) {
+                        x_parts.push_back(&latent_inputs[static_cast<size_t>(row % latent_batch)]);
+                    }
+                    if (!x_parts.empty() && !stack_condition_batch(x_parts, 3, &batch_x)) {
+                        return false;
+                    }
+                    select_rows(batch_context, 2, &row_context);
+                    select_rows(batch_c_concat, 3, &row_c_concat);
+                    select_rows(batch_y, 1, &row_y);
+                    batch_context  = batch_context != nullptr ? &row_context : nullptr;
+                    batch_c_concat = batch_c_concat != nullptr ? &row_c_concat : nullptr;
+                    batch_y        = batch_y != nullptr ? &row_y : nullptr;
+                } else {
+                    std::vector<const sd::Tensor<float>*> x_parts(static_cast<size_t>(count), &noised_input);
+                    if (!stack_condition_batch(x_parts, 3, &batch_x)) {
+                        return false;
+                    }
+                }
+                sd::Tensor<float> batch_out;
+                if (total > 0) {
+                    sd::Tensor<float> batch_timesteps({total}, std::vector<float>(static_cast<size_t>(total), timesteps_vec[0]));
+                    sd::Tensor<float> batch_guidance({total}, std::vector<float>(static_cast<size_t>(total), guidance.distilled_guidance));
+
+                    DiffusionParams batch_params;
+                    batch_params.x                  = &batch_x;
+                    batch_params.timesteps          = &batch_timesteps;
+                    batch_params.context            = batch_context;
+                    batch_params.c_concat           = batch_c_concat;
+                    batch_params.y                  = batch_y;
+                    batch_params.ref_latents        = &empty_ref_latents;
+                    batch_params.increase_ref_index = increase_ref_index;
+                    batch_params.ref_position_scale = ref_position_scale;
+                    if (sd_version_is_unet(version)) {
+                        batch_params.extra = UNetDiffusionExtra{-1, nullptr, control_strength, step_token_merge, token_merge.max_downsample};
+                    } else if (sd_version_is_sd3(version)) {
+                        batch_params.extra = SkipLayerDiffusionExtra{nullptr};
+                    } else {
+                        batch_params.extra = FluxDiffusionExtra{&batch_guidance, nullptr};
+                    }
+
+                    if (compact && diffusion_lora_adapter) {
+                        diffusion_lora_adapter->set_batch_size(total);
+                    }
+                    int64_t pass_start_us = ggml_time_us();
+                    batch_out             = work_diffusion_model->compute(n_threads, batch_params);
+                    step_timing.cond_ms += (ggml_time_us() - pass_start_us) / 1000.f;
+                    step_timing.batched = true;
+                    step_computed_passes++;
+                    if (compact && diffusion_lora_adapter) {
+                        diffusion_lora_adapter->set_batch_size(count * latent_batch);
+                    }
+                    if (batch_out.empty()) {
+                        LOG_ERROR("diffusion model compute failed");
+                        return false;
+                    }
+                }
+                std::vector<sd::Tensor<float>> outputs;
+                if (per_row_cache) {
+                    std::vector<sd::Tensor<float>> computed;
+                    if (total > 0) {
+                        computed = sd::ops::chunk(batch_out, total, 3);
+                    }
+                    for (size_t i = 0; i < compute_rows.size(); ++i) {
+                        const int64_t row         = compute_rows[i];
+                        const int64_t b           = row % latent_batch;
+                        sd::Tensor<float>& output = row_outputs[static_cast<size_t>(row)];
+                        output                    = std::move(computed[i]);
+                        output.reshape_(latent_inputs[static_cast<size_t>(b)].shape());
+                        latent_caches[static_cast<size_t>(b)].after_condition(row_conditions[static_cast<size_t>(row / latent_batch)],
+                                                                              latent_inputs[static_cast<size_t>(b)],
+                                                                              output);
+                    }
+                    for (int64_t c = 0; c < count; ++c) {
+                        sd::Tensor<float> output = std::move(row_outputs[static_cast<size_t>(c * latent_batch)]);
+                        for (int64_t b = 1; b < latent_batch; ++b) {
+                            output = sd::ops::concat(output, row_outputs[static_cast<size_t>(c * latent_batch + b)], 3);
+                        }
+                        outputs.push_back(std::move(output));
+                    }
+                } else {
+                    outputs = sd::ops::chunk(batch_out, count, 3);
+                }
+                for (auto& output : outputs) {
+                    output.reshape_(noised_input.shape());
+                }
+                size_t output_index = 0;
+                cond_out            = std::move(outputs[output_index++]);
+                if (!uncond.empty()) {
+                    uncond_out = std::move(outputs[output_index++]);
+                }
+                if (!img_uncond.empty()) {
+                    img_uncond_out = std::move(outputs[output_index++]);
+                }
+                return true;
+            };
+
+            bool batched_step = use_batched_conditions &&
+                                timesteps_vec.size() == 1 &&
+                                !(is_skiplayer_step && slg_uncond) &&
+                                !skip_uncond;
+            if (latent_batch > 1 && !batched_step) {
+                LOG_ERROR("batched latents need a single shared timestep per step");
                 return {};
             }
-
-            if (!uncond.empty()) {
-                if (!step_cache.is_step_skipped()) {
-                    compute_sample_controls(control_image,
-                                            noised_input,
-                                            timesteps_tensor,
-                                            uncond,
-                                            &controls);
+            if (batched_step) {
+                if (!run_batched_conditions()) {
+                    return {};
+                }
+            } else {
+                std::future<sd::Tensor<float>> pending_uncond;
+                if (parallel_cfg && !skip_uncond) {
+                    const std::vector<int>* uncond_skip_layers = is_skiplayer_step && slg_uncond ? &skip_layer_guidance.layers() : nullptr;
+                    pending_uncond                             = std::async(std::launch::async, [&, uncond_skip_layers, thread_callbacks = sd_current_thread_callbacks()]() {
+                        ScopedThreadCallbacks callback_scope(thread_callbacks);
+                        return run_condition(uncond,
+                                             uncond.c_concat.empty() ? nullptr : &uncond.c_concat,
+                                             uncond_skip_layers,
+                                             nullptr,
+                                             cfg_diffusion_model.get());
+                    });
+                }
+                cond_out = run_condition(*positive_condition, c_concat_override);
+                if (pending_uncond.valid()) {
+                    uncond_out = pending_uncond.get();
+                    if (uncond_out.empty()) {
+                        return {};
+                    }
                 }
+                if (cond_out.empty()) {
+                    if (resident_sampling.active && work_diffusion_model->resident_latent_stepped()) {
+                        report_step(SD_STEP_COMPUTED);
+                    }
+                    return {};
+                }
+            }
+
+            if (!batched_step && !uncond.empty() && !skip_uncond && uncond_out.empty()) {
                 const std::vector<int>* uncond_skip_layers = nullptr;
                 if (is_skiplayer_step && slg_uncond) {
                     LOG_DEBUG("Skipping layers at uncond step %d\n", step);
@@ -2222,7 +4644,7 @@ public:
                     return {};
                 }
             }
-            if (!img_uncond.empty()) {
+            if (!batched_step && !img_uncond.empty() && !skip_uncond) {
                 img_uncond_out = run_condition(img_uncond,
                                                img_uncond.c_concat.empty() ? nullptr : &img_uncond.c_concat,
                                                nullptr,
@@ -2231,6 +4653,20 @@ public:
                     return {};
                 }
             }
+            if (single_pass && cond_out.shape() == x.shape()) {
+                denoised          = std::move(cond_out);
+                float* pred       = denoised.data();
+                const float* x_in = x.data();
+                const int64_t n   = denoised.numel();
+                for (int64_t i = 0; i < n; i++) {
+                    pred[i] = pred[i] * c_out + x_in[i] * c_skip;
+                }
+                return finish_denoised_step();
+            }
+
+            if (!uncond_out.empty()) {
+                cfg_truncation.observe(cond_out, uncond_out);
+            }
             sd::guidance::GuidanceInput guidance_input;
             guidance_input.step            = step;
             guidance_input.schedule_size   = sigmas.size();
@@ -2261,28 +4697,87 @@ public:
 
             denoised = guided.pred * c_out + x * c_skip;
             sd::guidance::GuiderOutput output;
-            output.pred = denoised;
             if (needs_uncond_denoised) {
                 const sd::Tensor<float>& base_uncond = !img_uncond_out.empty()
                                                            ? img_uncond_out
                                                            : (!uncond_out.empty() ? uncond_out : cond_out);
                 output.pred_uncond                   = base_uncond * c_out + x * c_skip;
             }
-            if (cache_runtime.spectrum_enabled) {
-                cache_runtime.spectrum.update(denoised);
-            }
-            if (!denoise_mask.empty()) {
-                denoised = denoised * denoise_mask + init_latent * (1.0f - denoise_mask);
-            }
-            if (sd_should_preview_denoised() && preview.callback != nullptr) {
-                preview_image(step, denoised, version, preview.mode, preview.callback, preview.data, false);
-            }
-            report_sample_progress(step, steps, &last_progress_us);
-            output.pred = denoised;
+            output.pred = finish_denoised_step().pred;
             return output;
         };
 
-        auto x0_opt = sample_k_diffusion(method, denoise, x_t, sigmas, sampler_rng, eta, is_flow_denoiser, extra_sample_args, denoiser);
+        // Single-pass Euler steps with nothing that reads or changes x on the
+        // host between them leave x on the diffusion backend, which applies
+        // each step at the end of the model graph. The first step that the
+        // graph does not take hands x back to the host sampler: once x has
+        // moved to the backend that step is not run, and the host redoes it
+        // from the synced x. A failed or cancelled step fails sampling, as it
+        // does on the host.
+        sd::Tensor<float> x0_opt;
+        bool sample_on_host = true;
+        SamplerResume backend_resume;
+        const bool euler_steps = method == EULER_SAMPLE_METHOD || (method == EULER_A_SAMPLE_METHOD && eta == 0.f);
+        const bool resident_x  = single_pass && euler_steps && resume == nullptr && last_denoised == nullptr &&
+                                 denoise_mask.empty() && preview.callback == nullptr && provisional_step <= 0 &&
+                                 cache_runtime.mode == sd_sample::SampleCacheMode::NONE && !cache_runtime.spectrum_enabled &&
+                                 generation_extensions.empty() && control_image.empty() && !tiled_latent &&
+                                 context_windows.frames == 0 && latent_batch == 1 && !use_batched_conditions &&
+                                 !sd_version_is_unet(version) && modulation_cache.timesteps.empty() && ref_kv_refresh <= 1 &&
+                                 !std::dynamic_pointer_cast<SefiFlowDenoiser>(denoiser);
+        if (resident_x && work_diffusion_model->begin_resident_latent(x_t)) {
+            LOG_DEBUG("keeping the latent on the diffusion backend between steps");
+            resident_sampling.active = true;
+            const int n_steps        = static_cast<int>(sigmas.size()) - 1;
+            int step                 = 0;
+            bool failed              = false;
+            for (; step < n_steps; step++) {
+                work_diffusion_model->reset_resident_latent_step();
+                resident_sampling.sigma_next = sigmas[step + 1];
+                auto denoised_opt            = denoise(x_t, sigmas[step], step + 1);
+                if (get_cancel_flag() == SD_CANCEL_ALL) {
+                    failed = true;
+                    break;
+                }
+                if (work_diffusion_model->resident_latent_stepped()) {
+                    resident_sampling.on_backend = true;
+                    continue;
+                }
+                if (work_diffusion_model->resident_latent_step_skipped()) {
+                    break;
+                }
+                if (denoised_opt.pred.empty()) {
+                    failed = true;
+                    break;
+                }
+                // x was still current for the step the graph did not take
+                float ratio = (sigmas[step + 1] - sigmas[step]) / sigmas[step];
+                sd::ops::axpby(&x_t, 1.0f + ratio, denoised_opt.pred, -ratio);
+                step++;
+                break;
+            }
+            sd::Tensor<float> x_backend = work_diffusion_model->end_resident_latent();
+            if (resident_sampling.on_backend) {
+                x_t = std::move(x_backend);
+            }
+            resident_sampling = ResidentSampling();
+            if (failed) {
+                sample_on_host = false;
+            } else if (step == n_steps) {
+                x0_opt         = std::move(x_t);
+                sample_on_host = false;
+            } else {
+                LOG_DEBUG("continuing on the host at step %d", step + 1);
+                backend_resume.start_step = step;
+                resume                    = &backend_resume;
+            }
+        }
+        if (sample_on_host) {
+            // deterministic samplers leave the generator to draw on demand
+            sampler_rng->set_prefetch(sampler_draws_noise(method, eta, is_flow_denoiser));
+            x0_opt = sample_k_diffusion(method, denoise, x_t, sigmas, sampler_rng, eta, is_flow_denoiser, extra_sample_args, denoiser, resume);
+            sampler_rng->set_prefetch(false);
+        }
         if (x0_opt.empty()) {
             LOG_ERROR("Diffusion model sampling failed");
             if (control_net) {
@@ -2292,21 +4787,41 @@ public:
             if (work_diffusion_model) {
                 work_diffusion_model->free_compute_buffer();
             }
+            if (parallel_cfg) {
+                cfg_diffusion_model->free_compute_buffer();
+            }
             return {};
         }
 
         auto x0 = std::move(x0_opt);
         sd_sample::log_sample_cache_summary(cache_runtime, steps);
+        if (!latent_cache_runtimes.empty()) {
+            int skipped = sd_sample::sample_cache_skipped_steps(cache_runtime);
+            for (const auto& runtime : latent_cache_runtimes) {
+                skipped += sd_sample::sample_cache_skipped_steps(runtime);
+            }
+            LOG_INFO("step caching reused %d of %" PRId64 " latent steps across the batch", skipped, static_cast<int64_t>(steps) * latent_batch);
+        }
+        sd_sample::finish_sample_cache_runtime(cache_runtime);
+        if (sd_perf::PerfRecorder* perf = sd_perf::current_recorder()) {
+            perf->sample_cache_skipped_steps += sd_sample::sample_cache_skipped_steps(cache_runtime);
+        }
         if (inverse_noise_scaling) {
             x0 = denoiser->inverse_noise_scaling(sigmas[sigmas.size() - 1], x0);
         }
+        if (last_denoised != nullptr) {
+            *last_denoised = std::move(denoised);
+        }
 
         if (control_net) {
             control_net->free_control_ctx();
-            control_net->free_compute_buffer();
+            control_net->end_request_compute_buffer();
         }
         if (work_diffusion_model) {
-            work_diffusion_model->free_compute_buffer();
+            work_diffusion_model->end_request_compute_buffer();
+        }
+        if (parallel_cfg) {
+            cfg_diffusion_model->end_request_compute_buffer();
         }
         return x0;
     }
@@ -2401,8 +4916,76 @@ public:
         return latent_frames_to_video_frames(video_frames_to_latent_frames(frames));
     }
 
-    sd::Tensor<float> encode_to_vae_latents(const sd::Tensor<float>& x) {
-        auto latents = first_stage_model->encode(n_threads, x, vae_tiling_params, circular_x, circular_y);
+    // Last rung of the out of memory ladder: when an untiled VAE call ran out
+    // of device memory, compute buffers the diffusion model and ControlNet
+    // keep between requests are freed and the call is retried in tiles.
+    bool tiled_vae_retry_params(const sd_tiling_params_t& tiling_params, const char* what, sd_tiling_params_t* tiled) {
+        if (tiling_params.enabled || !first_stage_model->last_compute_out_of_memory()) {
+            return false;
+        }
+        for (const auto& runner : {diffusion_model, high_noise_diffusion_model, cfg_diffusion_model}) {
+            if (runner) {
+                runner->release_retained_compute_buffer();
+            }
+        }
+        if (control_net) {
+            control_net->release_retained_compute_buffer();
+        }
+        *tiled                = tiling_params;
+        tiled->enabled        = true;
+        tiled->auto_tile_size = false;
+        sd_report_degradation(SD_DEGRADATION_TILED_VAE,
+                              first_stage_model->get_desc().c_str(),
+                              sd_format("%s did not fit, retrying in tiles", what).c_str());
+        return true;
+    }
+
+    sd::Tensor<float> vae_encode(const sd::Tensor<float>& x) {
+        if (vae_decode_only) {
+            LOG_ERROR("this needs the VAE encoder, which vae_decode_only left out");
+            return {};
+        }
+        sd_perf::ScopedMemoryPhase memory_phase("vae encode");
+        sd::Tensor<float> output = first_stage_model->encode(n_threads, x, vae_tiling_params, circular_x, circular_y);
+        sd_tiling_params_t tiled;
+        if (output.empty() && tiled_vae_retry_params(vae_tiling_params, "vae encode", &tiled)) {
+            output = first_stage_model->encode(n_threads, x, tiled, circular_x, circular_y);
+        }
+        return output;
+    }
+
+    sd::Tensor<float> run_vae_encoder(const sd::Tensor<float>& x, bool use_cache) {
+        if (!use_cache || !vae_encode_cache.enabled() || sd_perf::current_memory_probe() != nullptr) {
+            return vae_encode(x);
+        }
+
+        std::string key             = VaeEncodeCache::make_key(x, vae_tiling_params, circular_x, circular_y, lora_epoch);
+        sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+        sd::Tensor<float> output;
+        if (vae_encode_cache.get(key, &output)) {
+            LOG_DEBUG("vae encode cache hit (%zu entries, %.2f MB)",
+                      vae_encode_cache.size(),
+                      vae_encode_cache.used_bytes() / 1024.f / 1024.f);
+            if (perf != nullptr) {
+                perf->vae_encode_cache_hits++;
+            }
+            return output;
+        }
+        if (perf != nullptr) {
+            perf->vae_encode_cache_misses++;
+        }
+
+        output = vae_encode(x);
+        if (!output.empty()) {
+            vae_encode_cache.put(key, output);
+        }
+        return output;
+    }
+
+    // use_cache = false for images that were just generated (hires fix) and
+    // would only push reusable inputs out of the encode cache.
+    sd::Tensor<float> encode_to_vae_latents(const sd::Tensor<float>& x, bool use_cache = true) {
+        auto latents = run_vae_encoder(x, use_cache);
         if (latents.empty()) {
             return {};
         }
@@ -2410,8 +4993,8 @@ public:
         return latents;
     }
 
-    sd::Tensor<float> encode_first_stage(const sd::Tensor<float>& x) {
-        auto latents = encode_to_vae_latents(x);
+    sd::Tensor<float> encode_first_stage(const sd::Tensor<float>& x, bool use_cache = true) {
+        auto latents = encode_to_vae_latents(x, use_cache);
         if (latents.empty()) {
             return {};
         }
@@ -2422,30 +5005,93 @@ public:
     }
 
     sd::Tensor<float> decode_first_stage(const sd::Tensor<float>& x, bool decode_video = false) {
+        return decode_first_stage(x, vae_tiling_params, circular_x, circular_y, decode_video);
+    }
+
+    // Takes the VAE settings of the generation that sampled x, so the decode
+    // does not depend on what a later generation set on this context.
+    sd::Tensor<float> decode_first_stage(const sd::Tensor<float>& x,
+                                         const sd_tiling_params_t& tiling_params,
+                                         bool decode_circular_x,
+                                         bool decode_circular_y,
+                                         bool decode_video = false,
+                                         bool tiny_vae     = false) {
         if (sd_version_is_pid(version)) {
             return sd::ops::clamp((x + 1.f) * 0.5f, 0.0f, 1.0f);
         }
+        sd_perf::ScopedMemoryPhase memory_phase("vae decode");
+        if (tiny_vae && preview_vae) {
+            // the preview TAE, picked by a latency target
+            preview_vae->set_temporal_tiling_enabled(tiling_params.temporal_tiling);
+            auto tiny_latents = preview_vae->diffusion_to_vae_latents(x);
+            return preview_vae->decode(n_threads, tiny_latents, tiling_params, decode_video, decode_circular_x, decode_circular_y, true);
+        }
+        auto latents = first_stage_model->diffusion_to_vae_latents(x);
+        first_stage_model->set_temporal_tiling_enabled(tiling_params.temporal_tiling);
+        auto decoded = first_stage_model->decode(n_threads, latents, tiling_params, decode_video, decode_circular_x, decode_circular_y);
+        sd_tiling_params_t tiled;
+        if (decoded.empty() && tiled_vae_retry_params(tiling_params, "vae decode", &tiled)) {
+            decoded = first_stage_model->decode(n_threads, latents, tiled, decode_video, decode_circular_x, decode_circular_y);
+        }
+        return decoded;
+    }
+
+    bool decode_first_stage_video_frames(const sd::Tensor<float>& x, const VAE::FramesFn& on_frames) {
+        sd_perf::ScopedMemoryPhase memory_phase("vae decode");
         auto latents = first_stage_model->diffusion_to_vae_latents(x);
         first_stage_model->set_temporal_tiling_enabled(vae_tiling_params.temporal_tiling);
-        return first_stage_model->decode(n_threads, latents, vae_tiling_params, decode_video, circular_x, circular_y);
+        return first_stage_model->decode_video_frames(n_threads, latents, vae_tiling_params, circular_x, circular_y, on_frames);
     }
 
-    sd::Tensor<float> normalize_ltx_video_latents(const sd::Tensor<float>& x) {
+    // Copies the latent statistics of the LTX VAE to the host, once per VAE,
+    // so the latent upscale normalizes without the VAE backend.
+    bool load_ltx_latent_statistics() {
+        if (!ltx_latent_std.empty()) {
+            return true;
+        }
         auto ltx_vae = std::dynamic_pointer_cast<LTXVideoVAE>(first_stage_model);
         if (!ltx_vae) {
             LOG_ERROR("LTX latent normalization requires LTX video VAE");
-            return {};
+            return false;
         }
-        return ltx_vae->normalize_latents(n_threads, x);
-    }
+        sd::Tensor<float> mean  = ltx_vae->latent_statistic(n_threads, "mean-of-means");
+        sd::Tensor<float> scale = ltx_vae->latent_statistic(n_threads, "std-of-means");
+        if (mean.empty() || mean.numel() != scale.numel()) {
+            LOG_ERROR("reading the LTX latent statistics failed");
+            return false;
+        }
+        ltx_latent_mean.assign(mean.data(), mean.data() + mean.numel());
+        ltx_latent_std.assign(scale.data(), scale.data() + scale.numel());
+        return true;
+    }
 
-    sd::Tensor<float> un_normalize_ltx_video_latents(const sd::Tensor<float>& x) {
-        auto ltx_vae = std::dynamic_pointer_cast<LTXVideoVAE>(first_stage_model);
-        if (!ltx_vae) {
-            LOG_ERROR("LTX latent un-normalization requires LTX video VAE");
+    void clear_ltx_latent_statistics() {
+        ltx_latent_mean.clear();
+        ltx_latent_std.clear();
+    }
+
+    // The normalize_latents or un_normalize_latents of the LTX VAE on the
+    // host, with the statistics of load_ltx_latent_statistics.
+    sd::Tensor<float> apply_ltx_latent_statistics(const sd::Tensor<float>& x, bool normalize) const {
+        const int64_t channels = static_cast<int64_t>(ltx_latent_std.size());
+        if (x.dim() < 4 || x.shape()[3] != channels) {
+            LOG_ERROR("LTX latent statistics expect %lld channels", (long long)channels);
             return {};
         }
-        return ltx_vae->un_normalize_latents(n_threads, x);
+        const int64_t plane   = x.shape()[0] * x.shape()[1] * x.shape()[2];
+        sd::Tensor<float> out = x;
+        float* data           = out.data();
+        sd::parallel_for(out.numel() / plane, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t p = begin; p < end; p++) {
+                const float mean  = ltx_latent_mean[p % channels];
+                const float scale = ltx_latent_std[p % channels];
+                float* values     = data + p * plane;
+                for (int64_t i = 0; i < plane; i++) {
+                    values[i] = normalize ? (values[i] - mean) / scale : values[i] * scale + mean;
+                }
+            }
+        });
+        return out;
     }
 
     sd::Tensor<float> decode_ltx_audio_latent(const sd::Tensor<float>& audio_latent) {
@@ -2534,6 +5180,7 @@ const char* sample_method_to_str[] = {
     "euler_cfg_pp",
     "euler_a_cfg_pp",
     "euler_ge",
+    "heun_adaptive",
 };
 
 const char* sd_sample_method_name(enum sample_method_t sample_method) {
@@ -2638,6 +5285,64 @@ const char* lora_apply_mode_to_str[] = {
     "at_runtime",
 };
 
+const char* compute_buffer_retention_to_str[] = {
+    "free",
+    "keep",
+    "keep_same_shape",
+};
+
+const char* sd_compute_buffer_retention_name(enum compute_buffer_retention_t retention) {
+    if (retention < COMPUTE_BUFFER_RETENTION_COUNT) {
+        return compute_buffer_retention_to_str[retention];
+    }
+    return NONE_STR;
+}
+
+enum compute_buffer_retention_t str_to_compute_buffer_retention(const char* str) {
+    for (int i = 0; i < COMPUTE_BUFFER_RETENTION_COUNT; i++) {
+        if (!strcmp(str, compute_buffer_retention_to_str[i])) {
+            return (enum compute_buffer_retention_t)i;
+        }
+    }
+    return COMPUTE_BUFFER_RETENTION_COUNT;
+}
+
+const char* numa_placement_to_str[] = {
+    "none",
+    "distribute",
+    "isolate",
+    "numactl",
+};
+
+const char* sd_numa_placement_name(enum numa_placement_t placement) {
+    if (placement < NUMA_PLACEMENT_COUNT) {
+        return numa_placement_to_str[placement];
+    }
+    return NONE_STR;
+}
+
+enum numa_placement_t str_to_numa_placement(const char* str) {
+    for (int i = 0; i < NUMA_PLACEMENT_COUNT; i++) {
+        if (!strcmp(str, numa_placement_to_str[i])) {
+            return (enum numa_placement_t)i;
+        }
+    }
+    return NUMA_PLACEMENT_COUNT;
+}
+
+const char* degradation_to_str[] = {
+    "released_buffers",
+    "segmented_graph",
+    "tiled_vae",
+};
+
+const char* sd_degradation_name(enum sd_degradation_t degradation) {
+    if (degradation < SD_DEGRADATION_COUNT) {
+        return degradation_to_str[degradation];
+    }
+    return NONE_STR;
+}
+
 const char* sd_lora_apply_mode_name(enum lora_apply_mode_t mode) {
     if (mode < LORA_APPLY_MODE_COUNT) {
         return lora_apply_mode_to_str[mode];
@@ -2738,6 +5443,9 @@ void sd_cache_params_init(sd_cache_params_t* cache_params) {
     cache_params->spectrum_flex_window        = 0.50f;
     cache_params->spectrum_warmup_steps       = 4;
     cache_params->spectrum_stop_percent       = 0.9f;
+    cache_params->profile_path                = nullptr;
+    cache_params->profile_calibrate           = false;
+    cache_params->profile_target_error        = 0.05f;
 }
 
 void sd_hires_params_init(sd_hires_params_t* hires_params) {
@@ -2756,28 +5464,62 @@ void sd_hires_params_init(sd_hires_params_t* hires_params) {
 }
 
 void sd_ctx_params_init(sd_ctx_params_t* sd_ctx_params) {
-    *sd_ctx_params                      = {};
-    sd_ctx_params->n_threads            = sd_get_num_physical_cores();
-    sd_ctx_params->wtype                = SD_TYPE_COUNT;
-    sd_ctx_params->rng_type             = CUDA_RNG;
-    sd_ctx_params->sampler_rng_type     = RNG_TYPE_COUNT;
-    sd_ctx_params->prediction           = PREDICTION_COUNT;
-    sd_ctx_params->lora_apply_mode      = LORA_APPLY_AUTO;
-    sd_ctx_params->max_vram             = nullptr;
-    sd_ctx_params->stream_layers        = false;
-    sd_ctx_params->eager_load           = false;
-    sd_ctx_params->enable_mmap          = false;
-    sd_ctx_params->diffusion_flash_attn = false;
-    sd_ctx_params->circular_x           = false;
-    sd_ctx_params->circular_y           = false;
-    sd_ctx_params->chroma_use_dit_mask  = true;
-    sd_ctx_params->chroma_use_t5_mask   = false;
-    sd_ctx_params->chroma_t5_mask_pad   = 1;
-    sd_ctx_params->vae_format           = SD_VAE_FORMAT_AUTO;
-    sd_ctx_params->backend              = nullptr;
-    sd_ctx_params->params_backend       = nullptr;
-    sd_ctx_params->rpc_servers          = nullptr;
-    sd_ctx_params->pulid_weights_path   = nullptr;
+    *sd_ctx_params                          = {};
+    sd_ctx_params->n_threads                = sd_get_num_physical_cores();
+    sd_ctx_params->wtype                    = SD_TYPE_COUNT;
+    sd_ctx_params->rng_type                 = CUDA_RNG;
+    sd_ctx_params->sampler_rng_type         = RNG_TYPE_COUNT;
+    sd_ctx_params->prediction               = PREDICTION_COUNT;
+    sd_ctx_params->lora_apply_mode          = LORA_APPLY_AUTO;
+    sd_ctx_params->max_vram                 = nullptr;
+    sd_ctx_params->stream_layers            = false;
+    sd_ctx_params->hybrid_cpu_segments      = false;
+    sd_ctx_params->eager_load               = false;
+    sd_ctx_params->background_load          = false;
+    sd_ctx_params->mmap_prefault_threads    = 0;
+    sd_ctx_params->batched_cfg              = false;
+    sd_ctx_params->offload_text_encoder     = false;
+    sd_ctx_params->llm_cpu_q8_0             = false;
+    sd_ctx_params->stream_q8_0              = false;
+    sd_ctx_params->cpu_repack               = false;
+    sd_ctx_params->shared_compute_buffer    = false;
+    sd_ctx_params->compute_buffer_retention = COMPUTE_BUFFER_FREE;
+    sd_ctx_params->dynamic_text_length      = false;
+    sd_ctx_params->vae_f32_fallback         = true;
+    sd_ctx_params->vae_decode_only          = false;
+    sd_ctx_params->auto_placement           = false;
+    sd_ctx_params->condition_cache_mb       = 0;
+    sd_ctx_params->vae_encode_cache_mb      = 0;
+    sd_ctx_params->identity_cache_size      = 16;
+    sd_ctx_params->max_pinned_mb            = -1;
+    sd_ctx_params->numa_placement           = NUMA_PLACEMENT_NONE;
+    sd_ctx_params->huge_pages               = false;
+    sd_ctx_params->lora_cache_mb            = 0;
+    sd_ctx_params->lora_model_cache_mb      = 0;
+    sd_ctx_params->enable_mmap              = false;
+    sd_ctx_params->diffusion_flash_attn     = false;
+    sd_ctx_params->circular_x               = false;
+    sd_ctx_params->circular_y               = false;
+    sd_ctx_params->chroma_use_dit_mask      = true;
+    sd_ctx_params->chroma_use_t5_mask       = false;
+    sd_ctx_params->chroma_t5_mask_pad       = 1;
+    sd_ctx_params->vae_format               = SD_VAE_FORMAT_AUTO;
+    sd_ctx_params->backend                  = nullptr;
+    sd_ctx_params->params_backend           = nullptr;
+    sd_ctx_params->rpc_servers              = nullptr;
+    sd_ctx_params->vae_tile_backends        = nullptr;
+    sd_ctx_params->pipeline_backends        = nullptr;
+    sd_ctx_params->cfg_backend              = nullptr;
+    sd_ctx_params->tensor_split             = nullptr;
+    sd_ctx_params->pulid_weights_path       = nullptr;
+    sd_ctx_params->model_cache_dir          = nullptr;
+    sd_ctx_params->attn_tune_cache          = nullptr;
+    sd_ctx_params->conv_tune_cache          = nullptr;
+    sd_ctx_params->condition_file           = nullptr;
+    sd_ctx_params->device_probe_cache       = nullptr;
+    sd_ctx_params->resolution_buckets       = nullptr;
+    sd_ctx_params->text_encoder_share_key   = nullptr;
+    sd_ctx_params->cpu_threadpool_args      = nullptr;
 }
 
 char* sd_ctx_params_to_str(const sd_ctx_params_t* sd_ctx_params) {
@@ -2805,6 +5547,14 @@ char* sd_ctx_params_to_str(const sd_ctx_params_t* sd_ctx_params) {
              "photo_maker_path: %s\n"
              "pulid_weights_path: %s\n"
              "tensor_type_rules: %s\n"
+             "model_cache_dir: %s\n"
+             "attn_tune_cache: %s\n"
+             "conv_tune_cache: %s\n"
+             "condition_file: %s\n"
+             "device_probe_cache: %s\n"
+             "resolution_buckets: %s\n"
+             "text_encoder_share_key: %s\n"
+             "cpu_threadpool_args: %s\n"
              "n_threads: %d\n"
              "wtype: %s\n"
              "rng_type: %s\n"
@@ -2812,9 +5562,35 @@ char* sd_ctx_params_to_str(const sd_ctx_params_t* sd_ctx_params) {
              "prediction: %s\n"
              "max_vram: %s\n"
              "stream_layers: %s\n"
+             "hybrid_cpu_segments: %s\n"
              "eager_load: %s\n"
+             "background_load: %s\n"
+             "mmap_prefault_threads: %d\n"
+             "batched_cfg: %s\n"
+             "offload_text_encoder: %s\n"
+             "llm_cpu_q8_0: %s\n"
+             "stream_q8_0: %s\n"
+             "cpu_repack: %s\n"
+             "shared_compute_buffer: %s\n"
+             "compute_buffer_retention: %s\n"
+             "dynamic_text_length: %s\n"
+             "vae_f32_fallback: %s\n"
+             "vae_decode_only: %s\n"
+             "auto_placement: %s\n"
+             "condition_cache_mb: %d\n"
+             "vae_encode_cache_mb: %d\n"
+             "identity_cache_size: %d\n"
+             "max_pinned_mb: %d\n"
+             "numa_placement: %s\n"
+             "huge_pages: %s\n"
+             "lora_cache_mb: %d\n"
+             "lora_model_cache_mb: %d\n"
              "backend: %s\n"
              "params_backend: %s\n"
+             "vae_tile_backends: %s\n"
+             "pipeline_backends: %s\n"
+             "cfg_backend: %s\n"
+             "tensor_split: %s\n"
              "flash_attn: %s\n"
              "diffusion_flash_attn: %s\n"
              "circular_x: %s\n"
@@ -2841,6 +5617,14 @@ char* sd_ctx_params_to_str(const sd_ctx_params_t* sd_ctx_params) {
              SAFE_STR(sd_ctx_params->photo_maker_path),
              SAFE_STR(sd_ctx_params->pulid_weights_path),
              SAFE_STR(sd_ctx_params->tensor_type_rules),
+             SAFE_STR(sd_ctx_params->model_cache_dir),
+             SAFE_STR(sd_ctx_params->attn_tune_cache),
+             SAFE_STR(sd_ctx_params->conv_tune_cache),
+             SAFE_STR(sd_ctx_params->condition_file),
+             SAFE_STR(sd_ctx_params->device_probe_cache),
+             SAFE_STR(sd_ctx_params->resolution_buckets),
+             SAFE_STR(sd_ctx_params->text_encoder_share_key),
+             SAFE_STR(sd_ctx_params->cpu_threadpool_args),
              sd_ctx_params->n_threads,
              sd_type_name(sd_ctx_params->wtype),
              sd_rng_type_name(sd_ctx_params->rng_type),
@@ -2848,9 +5632,35 @@ char* sd_ctx_params_to_str(const sd_ctx_params_t* sd_ctx_params) {
              sd_prediction_name(sd_ctx_params->prediction),
              SAFE_STR(sd_ctx_params->max_vram),
              BOOL_STR(sd_ctx_params->stream_layers),
+             BOOL_STR(sd_ctx_params->hybrid_cpu_segments),
              BOOL_STR(sd_ctx_params->eager_load),
+             BOOL_STR(sd_ctx_params->background_load),
+             sd_ctx_params->mmap_prefault_threads,
+             BOOL_STR(sd_ctx_params->batched_cfg),
+             BOOL_STR(sd_ctx_params->offload_text_encoder),
+             BOOL_STR(sd_ctx_params->llm_cpu_q8_0),
+             BOOL_STR(sd_ctx_params->stream_q8_0),
+             BOOL_STR(sd_ctx_params->cpu_repack),
+             BOOL_STR(sd_ctx_params->shared_compute_buffer),
+             sd_compute_buffer_retention_name(sd_ctx_params->compute_buffer_retention),
+             BOOL_STR(sd_ctx_params->dynamic_text_length),
+             BOOL_STR(sd_ctx_params->vae_f32_fallback),
+             BOOL_STR(sd_ctx_params->vae_decode_only),
+             BOOL_STR(sd_ctx_params->auto_placement),
+             sd_ctx_params->condition_cache_mb,
+             sd_ctx_params->vae_encode_cache_mb,
+             sd_ctx_params->identity_cache_size,
+             sd_ctx_params->max_pinned_mb,
+             sd_numa_placement_name(sd_ctx_params->numa_placement),
+             BOOL_STR(sd_ctx_params->huge_pages),
+             sd_ctx_params->lora_cache_mb,
+             sd_ctx_params->lora_model_cache_mb,
              SAFE_STR(sd_ctx_params->backend),
              SAFE_STR(sd_ctx_params->params_backend),
+             SAFE_STR(sd_ctx_params->vae_tile_backends),
+             SAFE_STR(sd_ctx_params->pipeline_backends),
+             SAFE_STR(sd_ctx_params->cfg_backend),
+             SAFE_STR(sd_ctx_params->tensor_split),
              BOOL_STR(sd_ctx_params->flash_attn),
              BOOL_STR(sd_ctx_params->diffusion_flash_attn),
              BOOL_STR(sd_ctx_params->circular_x),
@@ -2933,10 +5743,11 @@ void sd_img_gen_params_init(sd_img_gen_params_t* sd_img_gen_params) {
     sd_img_gen_params->strength          = 0.75f;
     sd_img_gen_params->seed              = -1;
     sd_img_gen_params->batch_count       = 1;
+    sd_img_gen_params->latent_batch_size = 1;
     sd_img_gen_params->control_strength  = 0.9f;
-    sd_img_gen_params->pm_params         = {nullptr, 0, nullptr, 20.f};
+    sd_img_gen_params->pm_params         = {nullptr, 0, nullptr, 20.f, nullptr};
     sd_img_gen_params->pulid_params      = {nullptr, 1.0f};
-    sd_img_gen_params->vae_tiling_params = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr};
+    sd_img_gen_params->vae_tiling_params = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr, false};
     sd_cache_params_init(&sd_img_gen_params->cache);
     sd_hires_params_init(&sd_img_gen_params->hires);
 }
@@ -2960,12 +5771,13 @@ char* sd_img_gen_params_to_str(const sd_img_gen_params_t* sd_img_gen_params) {
              "seed: %" PRId64
              "\n"
              "batch_count: %d\n"
+             "latent_batch_size: %d\n"
              "ref_images_count: %d\n"
              "auto_resize_ref_image: %s\n"
              "increase_ref_index: %s\n"
              "control_strength: %.2f\n"
-             "photo maker: {style_strength = %.2f, id_images_count = %d, id_embed_path = %s}\n"
-             "VAE tiling: %s (temporal=%s, extra_tiling_args=%s)\n"
+             "photo maker: {style_strength = %.2f, id_images_count = %d, id_embed_path = %s, identity_path = %s}\n"
+             "VAE tiling: %s (auto=%s, temporal=%s, extra_tiling_args=%s)\n"
              "hires: {enabled=%s, upscaler=%s, model_path=%s, scale=%.2f, target=%dx%d, steps=%d, denoising_strength=%.2f}\n",
              SAFE_STR(sd_img_gen_params->prompt),
              SAFE_STR(sd_img_gen_params->negative_prompt),
@@ -2976,6 +5788,7 @@ char* sd_img_gen_params_to_str(const sd_img_gen_params_t* sd_img_gen_params) {
              sd_img_gen_params->strength,
              sd_img_gen_params->seed,
              sd_img_gen_params->batch_count,
+             sd_img_gen_params->latent_batch_size,
              sd_img_gen_params->ref_images_count,
              BOOL_STR(sd_img_gen_params->auto_resize_ref_image),
              BOOL_STR(sd_img_gen_params->increase_ref_index),
@@ -2983,7 +5796,9 @@ char* sd_img_gen_params_to_str(const sd_img_gen_params_t* sd_img_gen_params) {
              sd_img_gen_params->pm_params.style_strength,
              sd_img_gen_params->pm_params.id_images_count,
              SAFE_STR(sd_img_gen_params->pm_params.id_embed_path),
+             SAFE_STR(sd_img_gen_params->pm_params.identity_path),
              BOOL_STR(sd_img_gen_params->vae_tiling_params.enabled),
+             BOOL_STR(sd_img_gen_params->vae_tiling_params.auto_tile_size),
              BOOL_STR(sd_img_gen_params->vae_tiling_params.temporal_tiling),
              SAFE_STR(sd_img_gen_params->vae_tiling_params.extra_tiling_args),
              BOOL_STR(sd_img_gen_params->hires.enabled),
@@ -3023,7 +5838,7 @@ void sd_vid_gen_params_init(sd_vid_gen_params_t* sd_vid_gen_params) {
     sd_vid_gen_params->fps                                   = 16;
     sd_vid_gen_params->moe_boundary                          = 0.875f;
     sd_vid_gen_params->vace_strength                         = 1.f;
-    sd_vid_gen_params->vae_tiling_params                     = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr};
+    sd_vid_gen_params->vae_tiling_params                     = {false, false, 0, 0, 0.5f, 0.0f, 0.0f, nullptr, false};
     sd_vid_gen_params->hires.enabled                         = false;
     sd_vid_gen_params->hires.upscaler                        = SD_HIRES_UPSCALER_LATENT;
     sd_vid_gen_params->hires.scale                           = 2.f;
@@ -3034,6 +5849,7 @@ void sd_vid_gen_params_init(sd_vid_gen_params_t* sd_vid_gen_params) {
     sd_vid_gen_params->hires.upscale_tile_size               = 128;
     sd_vid_gen_params->hires.custom_sigmas                   = nullptr;
     sd_vid_gen_params->hires.custom_sigmas_count             = 0;
+    sd_vid_gen_params->checkpoint_interval                   = 5;
     sd_cache_params_init(&sd_vid_gen_params->cache);
 }
 
@@ -3072,12 +5888,69 @@ sd_ctx_t* new_sd_ctx(const sd_ctx_params_t* sd_ctx_params) {
 
 void free_sd_ctx(sd_ctx_t* sd_ctx) {
     if (sd_ctx->sd != nullptr) {
+        for (auto& job : sd_ctx->sd->generation_queue.close()) {
+            job(false);
+        }
+        sd_ctx->sd->generation_queue.join();
         delete sd_ctx->sd;
         sd_ctx->sd = nullptr;
     }
     free(sd_ctx);
 }
 
+SD_API void sd_ctx_set_log_callback(sd_ctx_t* sd_ctx, sd_log_cb_t cb, void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        sd_ctx->sd->callbacks.log      = cb;
+        sd_ctx->sd->callbacks.log_data = data;
+    }
+}
+
+SD_API void sd_ctx_set_progress_callback(sd_ctx_t* sd_ctx, sd_progress_cb_t cb, void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        sd_ctx->sd->callbacks.progress      = cb;
+        sd_ctx->sd->callbacks.progress_data = data;
+    }
+}
+
+SD_API void sd_ctx_set_preview_callback(sd_ctx_t* sd_ctx,
+                                        sd_preview_cb_t cb,
+                                        enum preview_t mode,
+                                        int interval,
+                                        bool denoised,
+                                        bool noisy,
+                                        void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        SDCallbacks& callbacks     = sd_ctx->sd->callbacks;
+        callbacks.preview          = cb;
+        callbacks.preview_data     = data;
+        callbacks.preview_mode     = mode;
+        callbacks.preview_interval = interval;
+        callbacks.preview_denoised = denoised;
+        callbacks.preview_noisy    = noisy;
+    }
+}
+
+SD_API void sd_ctx_set_provisional_callback(sd_ctx_t* sd_ctx, sd_provisional_cb_t cb, void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        sd_ctx->sd->callbacks.provisional      = cb;
+        sd_ctx->sd->callbacks.provisional_data = data;
+    }
+}
+
+SD_API void sd_ctx_set_step_timing_callback(sd_ctx_t* sd_ctx, sd_step_timing_cb_t cb, void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        sd_ctx->sd->callbacks.step_timing      = cb;
+        sd_ctx->sd->callbacks.step_timing_data = data;
+    }
+}
+
+SD_API void sd_ctx_set_degradation_callback(sd_ctx_t* sd_ctx, sd_degradation_cb_t cb, void* data) {
+    if (sd_ctx && sd_ctx->sd) {
+        sd_ctx->sd->callbacks.degradation      = cb;
+        sd_ctx->sd->callbacks.degradation_data = data;
+    }
+}
+
 SD_API void sd_cancel_generation(sd_ctx_t* sd_ctx, enum sd_cancel_mode_t mode) {
     if (sd_ctx && sd_ctx->sd) {
         if (mode < SD_CANCEL_ALL || mode > SD_CANCEL_RESET) {
@@ -3143,6 +6016,60 @@ SD_API bool sd_ctx_supports_video_generation(const sd_ctx_t* sd_ctx) {
     return sd_version_supports_video_generation(sd_ctx->sd->version);
 }
 
+SD_API bool sd_get_perf_stats(sd_ctx_t* sd_ctx, sd_perf_stats_t* stats) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || stats == nullptr) {
+        return false;
+    }
+    sd_ctx->sd->perf_recorder.export_stats(stats);
+    return true;
+}
+
+SD_API bool sd_get_params_memory(sd_ctx_t* sd_ctx, uint64_t* ram_bytes, uint64_t* vram_bytes) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_ctx->sd->model_manager == nullptr ||
+        ram_bytes == nullptr || vram_bytes == nullptr) {
+        return false;
+    }
+    sd_ctx->sd->model_manager->get_params_memory(ram_bytes, vram_bytes);
+    for (const auto& manager : {sd_ctx->sd->vae_swap_manager, sd_ctx->sd->preview_vae_swap_manager}) {
+        if (manager != nullptr) {
+            uint64_t swap_ram_bytes  = 0;
+            uint64_t swap_vram_bytes = 0;
+            manager->get_params_memory(&swap_ram_bytes, &swap_vram_bytes);
+            *ram_bytes += swap_ram_bytes;
+            *vram_bytes += swap_vram_bytes;
+        }
+    }
+    return true;
+}
+
+SD_API void sd_release_params(sd_ctx_t* sd_ctx, bool release_params_backend) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_ctx->sd->model_manager == nullptr) {
+        return;
+    }
+    sd_ctx->sd->model_manager->evict_params(release_params_backend);
+    for (const auto& manager : {sd_ctx->sd->vae_swap_manager, sd_ctx->sd->preview_vae_swap_manager}) {
+        if (manager != nullptr) {
+            manager->evict_params(release_params_backend);
+        }
+    }
+}
+
+SD_API bool sd_ctx_set_vae(sd_ctx_t* sd_ctx, const char* vae_path) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return false;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    return sd_ctx->sd->swap_vae(SAFE_STR(vae_path), false);
+}
+
+SD_API bool sd_ctx_set_taesd(sd_ctx_t* sd_ctx, const char* taesd_path) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return false;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    return sd_ctx->sd->swap_vae(SAFE_STR(taesd_path), true);
+}
+
 enum sample_method_t sd_get_default_sample_method(const sd_ctx_t* sd_ctx) {
     if (sd_ctx != nullptr && sd_ctx->sd != nullptr) {
         if (sd_version_is_pid(sd_ctx->sd->version)) {
@@ -3174,12 +6101,149 @@ enum scheduler_t sd_get_default_scheduler(const sd_ctx_t* sd_ctx, enum sample_me
     return DISCRETE_SCHEDULER;
 }
 
+// The first applied LoRA that names a step distillation wins over the model:
+// a distillation LoRA is what makes a base model few-step.
+static sd::turbo_preset::Preset find_turbo_preset(const sd_ctx_t* sd_ctx, const sd_lora_t* loras, uint32_t lora_count) {
+    for (uint32_t i = 0; loras != nullptr && i < lora_count; i++) {
+        if (loras[i].path == nullptr || loras[i].multiplier == 0.f || loras[i].is_high_noise) {
+            continue;
+        }
+        sd::turbo_preset::Preset preset = sd::turbo_preset::detect(sd::turbo_preset::describe_file(loras[i].path));
+        if (preset.found()) {
+            return preset;
+        }
+    }
+    if (sd_ctx != nullptr && sd_ctx->sd != nullptr) {
+        return sd_ctx->sd->model_turbo_preset;
+    }
+    return {};
+}
+
+bool sd_get_turbo_preset(const sd_ctx_t* sd_ctx, const sd_lora_t* loras, uint32_t lora_count, sd_turbo_preset_t* preset) {
+    sd::turbo_preset::Preset found = find_turbo_preset(sd_ctx, loras, lora_count);
+    if (!found.found()) {
+        return false;
+    }
+    if (preset != nullptr) {
+        preset->kind          = found.name;
+        preset->sample_method = found.sampler;
+        preset->scheduler     = found.scheduler;
+        preset->sample_steps  = found.sample_steps;
+        preset->cfg_scale     = 1.f;
+    }
+    return true;
+}
+
+bool sd_apply_turbo_preset(const sd_ctx_t* sd_ctx, const sd_lora_t* loras, uint32_t lora_count, sd_sample_params_t* sample_params) {
+    sd_turbo_preset_t preset;
+    if (sample_params == nullptr || !sd_get_turbo_preset(sd_ctx, loras, lora_count, &preset)) {
+        return false;
+    }
+    sample_params->sample_method      = preset.sample_method;
+    sample_params->scheduler          = preset.scheduler;
+    sample_params->sample_steps       = preset.sample_steps;
+    sample_params->guidance.txt_cfg   = preset.cfg_scale;
+    sample_params->guidance.img_cfg   = preset.cfg_scale;
+    sample_params->guidance.slg.scale = 0.f;
+    LOG_INFO("turbo preset (%s): %s sampler, %d steps, cfg %.1f",
+             preset.kind,
+             sd_sample_method_name(preset.sample_method),
+             preset.sample_steps,
+             preset.cfg_scale);
+    return true;
+}
+
+// sd_img_gen_params with the turbo preset applied when its extra sample args
+// ask for it; storage holds the adjusted copy
+static const sd_img_gen_params_t* resolve_turbo_preset(sd_ctx_t* sd_ctx,
+                                                       const sd_img_gen_params_t* sd_img_gen_params,
+                                                       sd_img_gen_params_t* storage) {
+    if (!sd::turbo_preset::parse_args(sd_img_gen_params->sample_params.extra_sample_args).enabled) {
+        return sd_img_gen_params;
+    }
+    *storage = *sd_img_gen_params;
+    if (!sd_apply_turbo_preset(sd_ctx, sd_img_gen_params->loras, sd_img_gen_params->lora_count, &storage->sample_params)) {
+        LOG_WARN("turbo=1 found no step-distilled model or LoRA, sampling with the given settings");
+        return sd_img_gen_params;
+    }
+    return storage;
+}
+
+// sd_img_gen_params planned against the latency_ms of its extra sample args,
+// see sd::latency_slo; storage holds the adjusted copy and extra_args its
+// extra sample args when CFG truncation is added
+static const sd_img_gen_params_t* resolve_latency_target(sd_ctx_t* sd_ctx,
+                                                         const sd_img_gen_params_t* sd_img_gen_params,
+                                                         sd_img_gen_params_t* storage,
+                                                         std::string* extra_args,
+                                                         bool* tiny_vae) {
+    *tiny_vae                               = false;
+    const sd_sample_params_t& sample_params = sd_img_gen_params->sample_params;
+    sd::latency_slo::Params params          = sd::latency_slo::parse_args(sample_params.extra_sample_args);
+    if (!params.enabled()) {
+        return sd_img_gen_params;
+    }
+    if (sd_img_gen_params->hires.enabled) {
+        LOG_WARN("latency_ms does not plan hires fix passes, sampling with the given settings");
+        return sd_img_gen_params;
+    }
+    sd::guidance::CfgTruncationParams cfg_truncation = sd::guidance::parse_cfg_truncation_args(sample_params.extra_sample_args);
+
+    sd::latency_slo::Request request;
+    request.pixels        = static_cast<int64_t>(sd_img_gen_params->width) * sd_img_gen_params->height;
+    request.batch_count   = std::max(1, sd_img_gen_params->batch_count);
+    request.steps         = sample_params.sample_steps;
+    request.step_scale    = sd_img_gen_params->init_image.data != nullptr || sd_img_gen_params->init_latent != nullptr
+                                ? std::clamp(sd_img_gen_params->strength, 0.f, 1.f)
+                                : 1.f;
+    request.cfg           = sample_params.guidance.txt_cfg != 1.f;
+    request.unet          = sd_version_is_unet(sd_ctx->sd->version);
+    request.dit           = sd_version_is_dit(sd_ctx->sd->version);
+    request.cfg_truncated = cfg_truncation.sigma > 0.f || cfg_truncation.tolerance > 0.f;
+    request.cache_mode    = sd_img_gen_params->cache.mode;
+    request.has_tiny_vae  = sd_ctx->sd->preview_vae != nullptr;
+
+    sd::latency_slo::Plan plan;
+    if (!sd_ctx->sd->latency_estimator.plan(params, request, &plan)) {
+        LOG_INFO("latency_ms %d: no timings measured yet, sampling with the given settings", params.target_ms);
+        return sd_img_gen_params;
+    }
+    LOG_INFO("latency_ms %d: %d steps, cache %s, %sCFG truncation, %s decode, predicted %.0f ms",
+             params.target_ms,
+             plan.steps,
+             plan.cache_mode == SD_CACHE_DISABLED ? "off" : (plan.cache_mode == SD_CACHE_UCACHE ? "ucache" : "easycache"),
+             plan.cfg_truncation ? "" : "no ",
+             plan.tiny_vae ? "tiny VAE" : "VAE",
+             plan.predicted_ms);
+    if (plan.predicted_ms > params.target_ms) {
+        LOG_WARN("latency_ms %d cannot be met with the allowed settings", params.target_ms);
+    }
+
+    *storage                            = *sd_img_gen_params;
+    storage->sample_params.sample_steps = plan.steps;
+    if (plan.cache_mode != request.cache_mode) {
+        sd_cache_params_init(&storage->cache);
+        storage->cache.mode = plan.cache_mode;
+    }
+    if (plan.cfg_truncation) {
+        *extra_args = SAFE_STR(sample_params.extra_sample_args);
+        *extra_args += sd_format("%scfg_trunc_tol=%g", extra_args->empty() ? "" : ",", sd::latency_slo::CFG_TRUNC_TOLERANCE);
+        storage->sample_params.extra_sample_args = extra_args->c_str();
+    }
+    *tiny_vae = plan.tiny_vae;
+    return storage;
+}
+
 static int64_t resolve_seed(int64_t seed) {
     if (seed >= 0) {
         return seed;
     }
-    srand((int)time(nullptr));
-    return rand();
+    // seeded once: reseeding from time() per call gave every job resolved
+    // within the same second the same seed
+    static std::mutex mutex;
+    static std::mt19937 generator(std::random_device{}());
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<int64_t>(generator() >> 1);
 }
 
 static enum sample_method_t resolve_sample_method(sd_ctx_t* sd_ctx, enum sample_method_t sample_method) {
@@ -3228,6 +6292,8 @@ struct GenerationRequest {
     std::string negative_prompt;
     int width                                = -1;
     int height                               = -1;
+    int crop_width                           = -1;  // size the latents are cropped back to after a bucketed sampling
+    int crop_height                          = -1;
     int clip_skip                            = -1;
     int vae_scale_factor                     = -1;
     int diffusion_model_down_factor          = -1;
@@ -3239,6 +6305,8 @@ struct GenerationRequest {
     bool has_ref_images                      = false;
     const sd_cache_params_t* cache_params    = nullptr;
     int batch_count                          = 1;
+    int latent_batch_size                    = 1;
+    std::vector<int64_t> seeds;
     int shifted_timestep                     = 0;
     float strength                           = 1.f;
     float control_strength                   = 0.f;
@@ -3264,6 +6332,10 @@ struct GenerationRequest {
         diffusion_model_down_factor = sd_ctx->sd->get_diffusion_model_down_factor();
         seed                        = sd_img_gen_params->seed;
         batch_count                 = sd_img_gen_params->batch_count;
+        latent_batch_size           = std::max(1, sd_img_gen_params->latent_batch_size);
+        if (sd_img_gen_params->seeds != nullptr && batch_count > 0) {
+            seeds.assign(sd_img_gen_params->seeds, sd_img_gen_params->seeds + batch_count);
+        }
         clip_skip                   = sd_img_gen_params->clip_skip;
         shifted_timestep            = sd_img_gen_params->sample_params.shifted_timestep;
         strength                    = sd_img_gen_params->strength;
@@ -3278,6 +6350,7 @@ struct GenerationRequest {
         hires                       = sd_img_gen_params->hires;
         cache_params                = &sd_img_gen_params->cache;
         resolve(sd_ctx);
+        snap_to_resolution_bucket(sd_ctx, sd_img_gen_params);
     }
 
     GenerationRequest(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params) {
@@ -3307,6 +6380,13 @@ struct GenerationRequest {
         }
     }
 
+    int64_t seed_for_image(int index) const {
+        if (index >= 0 && index < static_cast<int>(seeds.size())) {
+            return seeds[index];
+        }
+        return seed + index;
+    }
+
     void align_generation_request_size() {
         align_image_size(&width, &height, "generation request");
     }
@@ -3333,6 +6413,71 @@ struct GenerationRequest {
                  spatial_multiple);
     }
 
+    // Samples a txt2img request at the smallest configured bucket that holds
+    // it, so the diffusion graph, its compute buffer and the RoPE tables stay
+    // those of a size already seen. The latents are cropped back to the
+    // requested size around their center. Input images would have to be
+    // padded to the bucket, and the hires pass has its own target size, so
+    // those requests keep their size.
+    void snap_to_resolution_bucket(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+        const auto& buckets = sd_ctx->sd->resolution_buckets;
+        if (buckets.empty() || hires.enabled ||
+            sd_img_gen_params->init_image.data != nullptr ||
+            sd_img_gen_params->init_latent != nullptr ||
+            sd_img_gen_params->mask_image.data != nullptr ||
+            sd_img_gen_params->control_image.data != nullptr) {
+            return;
+        }
+        int bucket_width  = -1;
+        int bucket_height = -1;
+        for (const auto& bucket : buckets) {
+            int spatial_multiple = vae_scale_factor * diffusion_model_down_factor;
+            int candidate_width  = bucket.first + align_up_offset(bucket.first, spatial_multiple);
+            int candidate_height = bucket.second + align_up_offset(bucket.second, spatial_multiple);
+            if (candidate_width < width || candidate_height < height) {
+                continue;
+            }
+            if (candidate_width == width && candidate_height == height) {
+                return;
+            }
+            if (bucket_width < 0 ||
+                static_cast<int64_t>(candidate_width) * candidate_height <
+                    static_cast<int64_t>(bucket_width) * bucket_height) {
+                bucket_width  = candidate_width;
+                bucket_height = candidate_height;
+            }
+        }
+        if (bucket_width < 0) {
+            LOG_DEBUG("no resolution bucket holds %dx%d, sampling at the requested size", width, height);
+            return;
+        }
+        LOG_INFO("sampling %dx%d in the %dx%d resolution bucket", width, height, bucket_width, bucket_height);
+        crop_width  = width;
+        crop_height = height;
+        width       = bucket_width;
+        height      = bucket_height;
+    }
+
+    bool is_bucketed() const {
+        return crop_width > 0 && crop_height > 0 && (crop_width != width || crop_height != height);
+    }
+
+    // Cuts the requested size out of the center of a latent sampled in a
+    // resolution bucket.
+    sd::Tensor<float> crop_bucketed_latent(const sd::Tensor<float>& latent) const {
+        if (!is_bucketed() || latent.dim() < 2) {
+            return latent;
+        }
+        const int64_t latent_width  = latent.shape()[0];
+        const int64_t latent_height = latent.shape()[1];
+        const int64_t target_width  = latent_width * crop_width / width;
+        const int64_t target_height = latent_height * crop_height / height;
+        const int64_t x0            = (latent_width - target_width) / 2;
+        const int64_t y0            = (latent_height - target_height) / 2;
+        sd::Tensor<float> cropped   = sd::ops::slice(latent, 0, x0, x0 + target_width);
+        return sd::ops::slice(cropped, 1, y0, y0 + target_height);
+    }
+
     void resolve_hires() {
         if (!hires.enabled) {
             return;
@@ -3442,6 +6587,9 @@ struct GenerationRequest {
         align_generation_request_size();
         resolve_hires();
         seed = resolve_seed(seed);
+        for (int64_t& image_seed : seeds) {
+            image_seed = resolve_seed(image_seed);
+        }
 
         resolve_guidance(sd_ctx, &guidance, &use_uncond, &use_img_uncond, has_ref_images);
         if (sd_ctx->sd->high_noise_diffusion_model) {
@@ -3889,13 +7037,62 @@ struct ImageGenerationEmbeds {
 
 struct ConditionerRunnerDoneOnExit {
     Conditioner* conditioner = nullptr;
+    std::mutex* mutex        = nullptr;
     ~ConditionerRunnerDoneOnExit() {
-        if (conditioner != nullptr) {
+        if (conditioner == nullptr) {
+            return;
+        }
+        // a prepare_image_conditions on another thread frees the buffers
+        // itself when it is done
+        std::unique_lock<std::mutex> lock(*mutex, std::try_to_lock);
+        if (lock.owns_lock()) {
             conditioner->runner_done();
         }
     }
 };
 
+// extra sample arg memory_trace=<file.json>: every backend buffer booked or
+// freed during the generation is recorded, see sd_perf::MemoryTimeline
+struct MemoryTraceOnExit {
+    std::string path;
+    std::unique_ptr<sd_perf::MemoryTimeline> timeline;
+    std::optional<sd_perf::ScopedMemoryTimeline> scope;
+
+    explicit MemoryTraceOnExit(const char* extra_sample_args) {
+        for (const auto& [key, value] : parse_key_value_args(extra_sample_args, "extra sample arg")) {
+            if (key != "memory_trace") {
+                continue;
+            }
+            if (value.empty()) {
+                LOG_WARN("ignoring invalid memory trace extra sample arg '%s=%s'", key.c_str(), value.c_str());
+                continue;
+            }
+            path     = value;
+            timeline = std::make_unique<sd_perf::MemoryTimeline>();
+            sd_perf::set_memory_phase("prepare");
+            scope.emplace(timeline.get());
+            LOG_INFO("tracing backend buffers into '%s'", value.c_str());
+        }
+    }
+
+    ~MemoryTraceOnExit() {
+        if (timeline != nullptr) {
+            scope.reset();
+            sd_perf::set_memory_phase("");
+            timeline->log_summary();
+            timeline->write_json(path);
+        }
+    }
+};
+
+// The negative prompt of SDXL is zeroed out when it is empty, unless the
+// model uses EDM v-parameterization.
+static bool uncond_zero_out_masked(sd_ctx_t* sd_ctx, const GenerationRequest& request) {
+    return sd_version_is_sdxl(sd_ctx->sd->version) &&
+           request.negative_prompt.empty() &&
+           !sd_ctx->sd->is_using_edm_v_parameterization;
+}
+
 struct CircularAxesState {
     bool circular_x = false;
     bool circular_y = false;
@@ -3968,6 +7165,52 @@ public:
     ImageVaeAxesGuard& operator=(const ImageVaeAxesGuard&) = delete;
 };
 
+// A latent handed in through the API as a tensor of this context's latent
+// space; empty when it is from another model version, or when width and
+// height (both >= 0) are not its size.
+static sd::Tensor<float> sd_latent_to_tensor(sd_ctx_t* sd_ctx, const sd_latent_t& latent, int64_t width, int64_t height) {
+    const char* version = model_version_to_str[sd_ctx->sd->version];
+    if (latent.data == nullptr || latent.version == nullptr || strcmp(latent.version, version) != 0) {
+        LOG_ERROR("the latent is from a %s model, this context samples %s latents",
+                  latent.version != nullptr ? latent.version : "unknown",
+                  version);
+        return {};
+    }
+    if (latent.channels != static_cast<uint32_t>(sd_ctx->sd->get_latent_channel()) ||
+        (width >= 0 && (latent.width != width || latent.height != height))) {
+        LOG_ERROR("the latent is %ux%ux%u, expected %" PRId64 "x%" PRId64 "x%d",
+                  latent.width,
+                  latent.height,
+                  latent.channels,
+                  width >= 0 ? width : latent.width,
+                  height >= 0 ? height : latent.height,
+                  sd_ctx->sd->get_latent_channel());
+        return {};
+    }
+    sd::Tensor<float> tensor({latent.width, latent.height, latent.channels, 1});
+    memcpy(tensor.data(), latent.data, static_cast<size_t>(tensor.numel()) * sizeof(float));
+    return tensor;
+}
+
+static sd_latent_t tensor_to_sd_latent(sd_ctx_t* sd_ctx, const sd::Tensor<float>& tensor) {
+    sd_latent_t latent = {};
+    if (tensor.dim() != 4 || tensor.shape()[3] != 1) {
+        LOG_ERROR("only single image latents can be returned");
+        return latent;
+    }
+    latent.data = (float*)malloc(static_cast<size_t>(tensor.numel()) * sizeof(float));
+    if (latent.data == nullptr) {
+        return latent;
+    }
+    memcpy(latent.data, tensor.data(), static_cast<size_t>(tensor.numel()) * sizeof(float));
+    latent.width        = static_cast<uint32_t>(tensor.shape()[0]);
+    latent.height       = static_cast<uint32_t>(tensor.shape()[1]);
+    latent.channels     = static_cast<uint32_t>(tensor.shape()[2]);
+    latent.scale_factor = static_cast<uint32_t>(sd_ctx->sd->get_vae_scale_factor());
+    latent.version      = model_version_to_str[sd_ctx->sd->version];
+    return latent;
+}
+
 static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd_ctx_t* sd_ctx,
                                                                               const sd_img_gen_params_t* sd_img_gen_params,
                                                                               GenerationRequest* request,
@@ -3978,7 +7221,13 @@ static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd
     sd::Tensor<float> control_image_tensor;
     sd::Tensor<float> mask_image_tensor;
 
-    if (sd_img_gen_params->init_image.data != nullptr) {
+    const bool has_init_latent = sd_img_gen_params->init_latent != nullptr;
+    if (has_init_latent && sd_version_is_inpaint(sd_ctx->sd->version)) {
+        // the masked image these models are conditioned on needs the pixels
+        LOG_ERROR("inpainting models take an init image, not an init latent");
+        return std::nullopt;
+    }
+    if (sd_img_gen_params->init_image.data != nullptr || has_init_latent) {
         LOG_INFO("IMG2IMG");
 
         if (request->strength < 1.f) {
@@ -3993,7 +7242,9 @@ static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd
             plan->sample_steps = static_cast<int>(plan->sigmas.size() - 1);
         }
 
-        init_image_tensor = sd_image_to_tensor(sd_img_gen_params->init_image, request->width, request->height);
+        if (!has_init_latent) {
+            init_image_tensor = sd_image_to_tensor(sd_img_gen_params->init_image, request->width, request->height);
+        }
     }
 
     if (sd_img_gen_params->mask_image.data != nullptr) {
@@ -4024,7 +7275,15 @@ static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd
 
     sd::Tensor<float> init_latent;
     sd::Tensor<float> control_latent;
-    if (init_image_tensor.empty()) {
+    if (has_init_latent) {
+        init_latent = sd_latent_to_tensor(sd_ctx,
+                                          *sd_img_gen_params->init_latent,
+                                          request->width / request->vae_scale_factor,
+                                          request->height / request->vae_scale_factor);
+        if (init_latent.empty()) {
+            return std::nullopt;
+        }
+    } else if (init_image_tensor.empty()) {
         init_latent = sd_ctx->sd->generate_init_latent(request->width, request->height);
     } else {
         init_latent = sd_ctx->sd->encode_first_stage(init_image_tensor);
@@ -4058,21 +7317,39 @@ static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd
         LOG_INFO("EDIT mode");
     }
 
+    sd::reference_scale::Params ref_scale = sd::reference_scale::parse_args(sd_img_gen_params->sample_params.extra_sample_args);
+    if (ref_scale.enabled() && !ref_images.empty()) {
+        if (!sd::reference_scale::supports(sd_ctx->sd->version)) {
+            LOG_WARN("ref_scale is only supported for Flux Kontext, Flux.2 and Qwen-Image Edit, encoding references at full size");
+            ref_scale.scale = 1.0f;
+        } else {
+            LOG_INFO("encoding reference images at %.2fx their size", ref_scale.scale);
+        }
+    }
+
     std::vector<sd::Tensor<float>> ref_latents;
     for (size_t i = 0; i < ref_images.size(); i++) {
         if (sd_ctx->sd->version == VERSION_HIDREAM_O1) {
             continue;
         }
         sd::Tensor<float> ref_latent;
-        if (request->auto_resize_ref_image && !sd_version_is_pid(sd_ctx->sd->version)) {
+        const int ref_factor = sd_version_is_qwen_image(sd_ctx->sd->version) ? 32 : 16;
+        if (ref_scale.enabled() && !request->auto_resize_ref_image) {
+            auto scaled_ref_img = sd::ops::interpolate(ref_images[i],
+                                                       {ref_scale.scaled_size(static_cast<double>(ref_images[i].shape()[0]), ref_factor),
+                                                        ref_scale.scaled_size(static_cast<double>(ref_images[i].shape()[1]), ref_factor),
+                                                        3,
+                                                        1});
+            ref_latent          = sd_ctx->sd->encode_first_stage(scaled_ref_img);
+        } else if (request->auto_resize_ref_image && !sd_version_is_pid(sd_ctx->sd->version)) {
             LOG_DEBUG("auto resize ref images");
             int vae_image_size = std::min(1024 * 1024, request->width * request->height);
             double vae_width   = sqrt(vae_image_size * ref_images[i].shape()[0] / ref_images[i].shape()[1]);
             double vae_height  = vae_width * ref_images[i].shape()[1] / ref_images[i].shape()[0];
 
-            int factor = sd_version_is_qwen_image(sd_ctx->sd->version) ? 32 : 16;
-            vae_height = round(vae_height / factor) * factor;
-            vae_width  = round(vae_width / factor) * factor;
+            int factor = ref_factor;
+            vae_height = ref_scale.scaled_size(vae_height, factor);
+            vae_width  = ref_scale.scaled_size(vae_width, factor);
 
             auto resized_ref_img = sd::ops::interpolate(ref_images[i],
                                                         {static_cast<int>(vae_width), static_cast<int>(vae_height), 3, 1});
@@ -4165,6 +7442,7 @@ static std::optional<ImageGenerationLatents> prepare_image_generation_latents(sd
     if (sd_img_gen_params->init_image.data != nullptr || sd_img_gen_params->ref_images_count > 0) {
         int64_t t1 = ggml_time_ms();
         LOG_INFO("encode_first_stage completed, taking %.2fs", (t1 - prepare_start_ms) * 1.0f / 1000);
+        sd_perf::add_phase_ms(sd_perf::Phase::VAE_ENCODE, static_cast<double>(t1 - prepare_start_ms));
     }
 
     ImageGenerationLatents latents;
@@ -4191,7 +7469,7 @@ static std::optional<ImageGenerationEmbeds> prepare_image_generation_embeds(sd_c
                                                                             GenerationRequest* request,
                                                                             SamplePlan* plan,
                                                                             ImageGenerationLatents* latents) {
-    ConditionerRunnerDoneOnExit conditioner_runner_done{sd_ctx->sd->cond_stage_model.get()};
+    ConditionerRunnerDoneOnExit conditioner_runner_done{sd_ctx->sd->cond_stage_model.get(), &sd_ctx->sd->conditioner_mutex};
 
     ConditionerParams condition_params;
     condition_params.text       = request->prompt;
@@ -4206,8 +7484,16 @@ static std::optional<ImageGenerationEmbeds> prepare_image_generation_embeds(sd_c
                                               plan->total_steps);
     int64_t prepare_start_ms         = ggml_time_ms();
     condition_params.zero_out_masked = false;
-    auto cond                        = sd_ctx->sd->cond_stage_model->get_learned_condition(sd_ctx->sd->n_threads,
-                                                                                           condition_params);
+
+    // cond and uncond are encoded together
+    bool use_uncond               = request->use_uncond || request->use_high_noise_uncond;
+    bool encode_uncond            = use_uncond && !sd_version_is_ideogram4(sd_ctx->sd->version);
+    auto uncond_params            = condition_params;
+    uncond_params.text            = request->negative_prompt;
+    uncond_params.zero_out_masked = uncond_zero_out_masked(sd_ctx, *request);
+    auto conditions               = encode_uncond ? sd_ctx->sd->get_learned_conditions({condition_params, uncond_params})
+                                                  : sd_ctx->sd->get_learned_conditions({condition_params});
+    auto cond                     = std::move(conditions[0]);
     if (cond.c_concat.empty()) {
         cond.c_concat = latents->concat_latent;  // TODO: optimize
     }
@@ -4217,20 +7503,11 @@ static std::optional<ImageGenerationEmbeds> prepare_image_generation_embeds(sd_c
                                   sd_version_supports_ref_latent_img_cfg(sd_ctx->sd->version);
 
     SDCondition uncond;
-    if (request->use_uncond || request->use_high_noise_uncond) {
-        if (sd_version_is_ideogram4(sd_ctx->sd->version)) {
-            uncond.c_vector = sd::Tensor<float>::from_vector({1.0f});
+    if (use_uncond) {
+        if (encode_uncond) {
+            uncond = std::move(conditions[1]);
         } else {
-            bool zero_out_masked = false;
-            if (sd_version_is_sdxl(sd_ctx->sd->version) &&
-                request->negative_prompt.empty() &&
-                !sd_ctx->sd->is_using_edm_v_parameterization) {
-                zero_out_masked = true;
-            }
-            condition_params.text            = request->negative_prompt;
-            condition_params.zero_out_masked = zero_out_masked;
-            uncond                           = sd_ctx->sd->cond_stage_model->get_learned_condition(sd_ctx->sd->n_threads,
-                                                                                                   condition_params);
+            uncond.c_vector = sd::Tensor<float>::from_vector({1.0f});
         }
         if (uncond.c_concat.empty()) {
             uncond.c_concat = latents->concat_latent;  // TODO: optimize
@@ -4242,28 +7519,23 @@ static std::optional<ImageGenerationEmbeds> prepare_image_generation_embeds(sd_c
         if ((request->use_uncond || request->use_high_noise_uncond) && (latents->ref_images.empty() || !use_ref_latent_img_cfg)) {
             img_uncond = SDCondition(uncond.c_crossattn, uncond.c_vector, latents->img_uncond_concat_latent);
         } else {
-            bool zero_out_masked = false;
-            if (sd_version_is_sdxl(sd_ctx->sd->version) &&
-                request->negative_prompt.empty() &&
-                !sd_ctx->sd->is_using_edm_v_parameterization) {
-                zero_out_masked = true;
-            }
             condition_params.text            = request->negative_prompt;
-            condition_params.zero_out_masked = zero_out_masked;
+            condition_params.zero_out_masked = uncond_zero_out_masked(sd_ctx, *request);
             if (use_ref_latent_img_cfg) {
                 std::vector<sd::Tensor<float>> empty_ref_images;
                 condition_params.ref_images = &empty_ref_images;
             }
-            img_uncond = sd_ctx->sd->cond_stage_model->get_learned_condition(sd_ctx->sd->n_threads,
-                                                                             condition_params);
+            img_uncond = sd_ctx->sd->get_learned_condition(condition_params);
             if (img_uncond.c_concat.empty()) {
                 img_uncond.c_concat = latents->img_uncond_concat_latent;  // TODO: optimize
             }
         }
     }
+    sd_ctx->sd->finish_conditioner_prefetch();
 
     int64_t t1 = ggml_time_ms();
     LOG_INFO("get_learned_condition completed, taking %.2fs", (t1 - prepare_start_ms) * 1.0f / 1000);
+    sd_perf::add_phase_ms(sd_perf::Phase::TEXT_ENCODE, static_cast<double>(t1 - prepare_start_ms));
 
     ImageGenerationEmbeds embeds;
     embeds.img_uncond = std::move(img_uncond);
@@ -4273,25 +7545,43 @@ static std::optional<ImageGenerationEmbeds> prepare_image_generation_embeds(sd_c
     return embeds;
 }
 
-static sd_image_t* decode_image_outputs(sd_ctx_t* sd_ctx,
-                                        const GenerationRequest& request,
-                                        const std::vector<sd::Tensor<float>>& final_latents) {
+// Sampled image latents waiting for the VAE, with the settings to decode them.
+struct sd_image_latents_t {
+    int batch_count = 0;
+    std::vector<sd::Tensor<float>> latents;
+    sd_tiling_params_t vae_tiling_params = {};
+    bool circular_x                      = false;
+    bool circular_y                      = false;
+    bool tiny_vae                        = false;  // decode with the preview TAE, see sd::latency_slo
+    sd_image_cb_t image_cb               = nullptr;
+    void* image_cb_data                  = nullptr;
+};
+
+static sd_image_t* decode_image_outputs(sd_ctx_t* sd_ctx, const sd_image_latents_t& pending) {
+    const std::vector<sd::Tensor<float>>& final_latents = pending.latents;
+    const int batch_count                               = pending.batch_count;
     if (final_latents.empty()) {
         LOG_ERROR("no latent images to decode");
         return nullptr;
     }
-    if (final_latents.size() > static_cast<size_t>(request.batch_count)) {
-        LOG_ERROR("expected at most %d latents, got %zu", request.batch_count, final_latents.size());
+    if (final_latents.size() > static_cast<size_t>(batch_count)) {
+        LOG_ERROR("expected at most %d latents, got %zu", batch_count, final_latents.size());
         return nullptr;
     }
-    if (final_latents.size() < static_cast<size_t>(request.batch_count)) {
-        LOG_INFO("decoding %zu/%d latents", final_latents.size(), request.batch_count);
+    if (final_latents.size() < static_cast<size_t>(batch_count)) {
+        LOG_INFO("decoding %zu/%d latents", final_latents.size(), batch_count);
     } else {
         LOG_INFO("decoding %zu latents", final_latents.size());
     }
-    std::vector<sd::Tensor<float>> decoded_images;
-    int64_t t0     = ggml_time_ms();
-    bool cancelled = false;
+    // filled as the latents decode, so each image can be handed out at once
+    sd_image_t* result_images = (sd_image_t*)calloc(batch_count, sizeof(sd_image_t));
+    if (result_images == nullptr) {
+        return nullptr;
+    }
+    size_t decoded_count   = 0;
+    int64_t decoded_pixels = 0;
+    int64_t t0             = ggml_time_ms();
+    bool cancelled         = false;
 
     for (size_t i = 0; i < final_latents.size(); i++) {
         if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
@@ -4300,36 +7590,119 @@ static sd_image_t* decode_image_outputs(sd_ctx_t* sd_ctx,
             break;
         }
         int64_t t1              = ggml_time_ms();
-        sd::Tensor<float> image = sd_ctx->sd->decode_first_stage(final_latents[i]);
+        sd::Tensor<float> image = sd_ctx->sd->decode_first_stage(final_latents[i],
+                                                                 pending.vae_tiling_params,
+                                                                 pending.circular_x,
+                                                                 pending.circular_y,
+                                                                 false,
+                                                                 pending.tiny_vae);
         if (image.empty()) {
             LOG_ERROR("decode_first_stage failed for latent %" PRId64, i + 1);
+            free_sd_images(result_images, batch_count);
             return nullptr;
         }
-        decoded_images.push_back(std::move(image));
+        decoded_pixels += image.shape()[0] * image.shape()[1];
+        result_images[i] = tensor_to_sd_image(image);
+        decoded_count++;
         int64_t t2 = ggml_time_ms();
         LOG_INFO("latent %zu decoded, taking %.2fs", i + 1, (t2 - t1) * 1.0f / 1000);
+        if (pending.image_cb != nullptr && result_images[i].data != nullptr) {
+            pending.image_cb(static_cast<int>(i), &result_images[i], pending.image_cb_data);
+        }
     }
 
     int64_t t4 = ggml_time_ms();
     LOG_INFO("decode_first_stage completed, taking %.2fs", (t4 - t0) * 1.0f / 1000);
-    if (decoded_images.empty()) {
+    sd_perf::add_phase_ms(sd_perf::Phase::VAE_DECODE, static_cast<double>(t4 - t0));
+    if (decoded_count == 0) {
         LOG_ERROR(cancelled ? "cancelled before any latent images were decoded" : "no decoded images");
+        free_sd_images(result_images, batch_count);
         return nullptr;
     }
-
-    sd_image_t* result_images = (sd_image_t*)calloc(request.batch_count, sizeof(sd_image_t));
-    if (result_images == nullptr) {
-        return nullptr;
-    }
-    memset(result_images, 0, request.batch_count * sizeof(sd_image_t));
-
-    for (size_t i = 0; i < decoded_images.size(); i++) {
-        result_images[i] = tensor_to_sd_image(decoded_images[i]);
+    if (!cancelled) {
+        sd_ctx->sd->latency_estimator.observe_decode(decoded_pixels, pending.tiny_vae, static_cast<double>(t4 - t0));
     }
 
     return result_images;
 }
 
+// With VAE tiling on, a model hires upscale decodes, upscales and encodes
+// one latent tile at a time and blends the encoded tiles, so neither the
+// decoded image nor its upscaled copy is ever held whole. The target latent
+// has to be a whole multiple of the latent; returns that multiple, or 0 when
+// the full-image path applies.
+static int hires_fused_tile_scale(sd_ctx_t* sd_ctx, const sd::Tensor<float>& latent, const GenerationRequest& request) {
+    if (!sd_ctx->sd->vae_tiling_params.enabled || latent.dim() != 4 || sd_version_is_pid(sd_ctx->sd->version)) {
+        return 0;
+    }
+    const int64_t target_w = request.hires.target_width / request.vae_scale_factor;
+    const int64_t target_h = request.hires.target_height / request.vae_scale_factor;
+    const int64_t scale    = target_w / latent.shape()[0];
+    if (scale < 2 || target_w != latent.shape()[0] * scale || target_h != latent.shape()[1] * scale) {
+        return 0;
+    }
+    return static_cast<int>(scale);
+}
+
+static sd::Tensor<float> upscale_hires_latent_tiled(sd_ctx_t* sd_ctx,
+                                                    const sd::Tensor<float>& latent,
+                                                    const GenerationRequest& request,
+                                                    UpscalerGGML* upscaler,
+                                                    int scale) {
+    int tile_size_x    = 0;
+    int tile_size_y    = 0;
+    float tile_overlap = 0.f;
+    sd_ctx->sd->first_stage_model->get_tile_sizes(tile_size_x,
+                                                  tile_size_y,
+                                                  tile_overlap,
+                                                  sd_ctx->sd->vae_tiling_params,
+                                                  latent.shape()[0],
+                                                  latent.shape()[1]);
+    LOG_INFO("hires model upscale in %dx%d latent tiles, %" PRId64 "x%" PRId64 " -> %dx%d",
+             tile_size_x,
+             tile_size_y,
+             latent.shape()[0],
+             latent.shape()[1],
+             request.hires.target_width,
+             request.hires.target_height);
+
+    auto on_tile = [&](const sd::Tensor<float>& latent_tile) -> sd::Tensor<float> {
+        if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
+            return {};
+        }
+        sd::Tensor<float> decoded = sd_ctx->sd->decode_first_stage(latent_tile);
+        if (decoded.empty()) {
+            return {};
+        }
+        sd::Tensor<float> upscaled = upscaler->upscale_tensor(decoded);
+        if (upscaled.empty()) {
+            return {};
+        }
+        const int64_t tile_w = latent_tile.shape()[0] * scale * request.vae_scale_factor;
+        const int64_t tile_h = latent_tile.shape()[1] * scale * request.vae_scale_factor;
+        if (upscaled.shape()[0] != tile_w || upscaled.shape()[1] != tile_h) {
+            upscaled = sd::ops::interpolate(upscaled, {tile_w, tile_h, upscaled.shape()[2], upscaled.shape()[3]});
+        }
+        return sd_ctx->sd->encode_first_stage(upscaled, false);
+    };
+    sd::Tensor<float> upscaled_latent = process_tiles_2d(latent,
+                                                         static_cast<int>(latent.shape()[0] * scale),
+                                                         static_cast<int>(latent.shape()[1] * scale),
+                                                         scale,
+                                                         tile_size_x,
+                                                         tile_size_y,
+                                                         tile_overlap,
+                                                         sd_ctx->sd->circular_x,
+                                                         sd_ctx->sd->circular_y,
+                                                         on_tile);
+    // the diffusion model samples next and needs the memory
+    upscaler->free_compute_buffer();
+    if (upscaled_latent.empty()) {
+        LOG_ERROR("tiled hires model upscale failed");
+    }
+    return upscaled_latent;
+}
+
 static sd::Tensor<float> upscale_hires_latent(sd_ctx_t* sd_ctx,
                                               const sd::Tensor<float>& latent,
                                               const GenerationRequest& request,
@@ -4404,6 +7777,12 @@ static sd::Tensor<float> upscale_hires_latent(sd_ctx_t* sd_ctx,
             LOG_ERROR("hires model upscaler context is null");
             return {};
         }
+        if (request.hires.upscaler == SD_HIRES_UPSCALER_MODEL) {
+            const int fused_scale = hires_fused_tile_scale(sd_ctx, latent, request);
+            if (fused_scale > 0) {
+                return upscale_hires_latent_tiled(sd_ctx, latent, request, upscaler, fused_scale);
+            }
+        }
 
         sd::Tensor<float> decoded = sd_ctx->sd->decode_first_stage(latent);
         if (decoded.empty()) {
@@ -4419,6 +7798,8 @@ static sd::Tensor<float> upscale_hires_latent(sd_ctx_t* sd_ctx,
         sd::Tensor<float> upscaled_tensor;
         if (request.hires.upscaler == SD_HIRES_UPSCALER_MODEL) {
             upscaled_tensor = upscaler->upscale_tensor(decoded);
+            // the diffusion model samples next and needs the memory
+            upscaler->free_compute_buffer();
             if (upscaled_tensor.empty()) {
                 LOG_ERROR("hires model upscale failed");
                 return {};
@@ -4455,7 +7836,7 @@ static sd::Tensor<float> upscale_hires_latent(sd_ctx_t* sd_ctx,
             LOG_ERROR("cancelling hires latent encode");
             return {};
         }
-        sd::Tensor<float> upscaled_latent = sd_ctx->sd->encode_first_stage(upscaled_tensor);
+        sd::Tensor<float> upscaled_latent = sd_ctx->sd->encode_first_stage(upscaled_tensor, false);
         if (upscaled_latent.empty()) {
             LOG_ERROR("encode_first_stage failed after hires %s upscale",
                       sd_hires_upscaler_name(request.hires.upscaler));
@@ -4514,22 +7895,38 @@ static std::vector<float> make_hires_sigma_schedule(sd_ctx_t* sd_ctx,
                               sigmas.end());
 }
 
-SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
-    if (sd_ctx == nullptr || sd_img_gen_params == nullptr) {
-        return nullptr;
+// Per-image LoRA multipliers follow the row order of a latent batch, which
+// the per-latent step caches of sample() compact, so the two do not mix.
+static bool can_cache_latent_batch(const sd_img_gen_params_t* sd_img_gen_params, const sd_cache_params_t* cache_params) {
+    if (cache_params == nullptr || cache_params->mode == SD_CACHE_DISABLED || cache_params->mode == SD_CACHE_SPECTRUM) {
+        return true;
     }
+    for (uint32_t i = 0; i < sd_img_gen_params->lora_count; i++) {
+        if (sd_img_gen_params->loras[i].image_multipliers != nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    sd_ctx->sd->reset_cancel_flag();
-
-    int64_t t0                    = ggml_time_ms();
+// Everything generate_image does before the VAE decode.
+static bool sample_image_outputs(sd_ctx_t* sd_ctx,
+                                 const sd_img_gen_params_t* sd_img_gen_params,
+                                 sd_image_latents_t* pending) {
+    sd_img_gen_params_t turbo_params;
+    sd_img_gen_params = resolve_turbo_preset(sd_ctx, sd_img_gen_params, &turbo_params);
+    sd_img_gen_params_t latency_params;
+    std::string latency_extra_args;
+    sd_img_gen_params = resolve_latency_target(sd_ctx, sd_img_gen_params, &latency_params, &latency_extra_args, &pending->tiny_vae);
     sd_ctx->sd->vae_tiling_params = sd_img_gen_params->vae_tiling_params;
     GenerationRequest request(sd_ctx, sd_img_gen_params);
     LOG_INFO("generate_image %dx%d", request.width, request.height);
 
-    sd_ctx->sd->rng->manual_seed(request.seed);
-    sd_ctx->sd->sampler_rng->manual_seed(request.seed);
+    sd_ctx->sd->rng->manual_seed(request.seed_for_image(0));
+    sd_ctx->sd->sampler_rng->manual_seed(request.seed_for_image(0));
     sd_ctx->sd->set_flow_shift(sd_img_gen_params->sample_params.flow_shift);
-    sd_ctx->sd->apply_loras(sd_img_gen_params->loras, sd_img_gen_params->lora_count);
+    sd_ctx->sd->apply_loras(sd_img_gen_params->loras, sd_img_gen_params->lora_count, request.batch_count);
+    sd_ctx->sd->prefetch_conditioner_params();
 
     ImageVaeAxesGuard axes_guard(sd_ctx, sd_img_gen_params, request);
 
@@ -4539,7 +7936,8 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
                                                         &request,
                                                         &plan);
     if (!latents_opt.has_value()) {
-        return nullptr;
+        sd_ctx->sd->finish_conditioner_prefetch();
+        return false;
     }
     ImageGenerationLatents latents = std::move(*latents_opt);
 
@@ -4549,17 +7947,93 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
                                                       &plan,
                                                       &latents);
     if (!embeds_opt.has_value()) {
-        return nullptr;
+        return false;
     }
     ImageGenerationEmbeds embeds = std::move(*embeds_opt);
 
+    // Several latents of the batch can go through the sampler together, so the
+    // diffusion weights are read once per step for all of them.
+    int latent_batch_size = std::min(request.latent_batch_size, request.batch_count);
+    if (latent_batch_size > 1) {
+        bool can_batch_latents = request.guidance.slg.layer_count == 0 &&
+                                 can_cache_latent_batch(sd_img_gen_params, request.cache_params) &&
+                                 sd_ctx->sd->can_batch_conditions(sd_ctx->sd->diffusion_model,
+                                                                  embeds.cond,
+                                                                  embeds.uncond,
+                                                                  embeds.img_uncond,
+                                                                  latents.control_image,
+                                                                  latents.ref_latents,
+                                                                  request.cache_params);
+        if (!can_batch_latents) {
+            LOG_WARN("latent batching is not supported for this model/condition setup, sampling latents one at a time");
+            latent_batch_size = 1;
+        }
+    }
+
+    // With lowres_fraction the first steps sample a downscaled latent, see
+    // sd::progressive_sampling::Params.
+    sd::progressive_sampling::Params progressive = sd::progressive_sampling::parse_args(plan.extra_sample_args);
+    int lowres_steps                             = progressive.lowres_steps(static_cast<int>(plan.sigmas.size()) - 1);
+    if (lowres_steps > 0) {
+        if (!sd_ctx->sd->is_flow_denoiser() || std::dynamic_pointer_cast<SefiFlowDenoiser>(sd_ctx->sd->denoiser)) {
+            LOG_WARN("low resolution early steps need a flow model with a sigma schedule, sampling at full resolution");
+            lowres_steps = 0;
+        } else if (!latents.denoise_mask.empty() || !latents.control_image.empty() || !latents.ref_latents.empty()) {
+            LOG_WARN("low resolution early steps do not support masks, control or reference images, sampling at full resolution");
+            lowres_steps = 0;
+        } else if (!progressive.can_downscale(latents.init_latent)) {
+            LOG_WARN("latent size does not divide by lowres_factor %d, sampling at full resolution", progressive.factor);
+            lowres_steps = 0;
+        }
+    }
+    std::vector<float> full_res_sigmas = plan.sigmas;
+    if (lowres_steps > 0) {
+        full_res_sigmas.erase(full_res_sigmas.begin(), full_res_sigmas.begin() + lowres_steps);
+        LOG_INFO("sampling the first %d of %zu steps at 1/%d resolution",
+                 lowres_steps,
+                 plan.sigmas.size() - 1,
+                 progressive.factor);
+    }
+
+    // With shared_steps, prompt variations start from the state the first
+    // request of the same setup had after those steps, see
+    // sd::shared_trajectory::Params.
+    sd::shared_trajectory::Params shared_trajectory = sd::shared_trajectory::parse_args(plan.extra_sample_args);
+    if (shared_trajectory.enabled()) {
+        bool per_image_loras = false;
+        for (uint32_t i = 0; i < sd_img_gen_params->lora_count; i++) {
+            per_image_loras = per_image_loras || sd_img_gen_params->loras[i].image_multipliers != nullptr;
+        }
+        if (shared_trajectory.steps >= static_cast<int>(plan.sigmas.size()) - 1) {
+            LOG_WARN("shared_steps %d leaves no steps of the %zu to sample, not sharing the trajectory",
+                     shared_trajectory.steps,
+                     plan.sigmas.size() - 1);
+            shared_trajectory.steps = 0;
+        } else if (latent_batch_size > 1 || lowres_steps > 0 || per_image_loras ||
+                   (request.cache_params != nullptr && request.cache_params->mode != SD_CACHE_DISABLED)) {
+            LOG_WARN("shared trajectories need one latent per pass at full resolution, no per-image LoRAs and no step caching");
+            shared_trajectory.steps = 0;
+        }
+    }
+    // With provisional_step, the client sees a preview-decoded image at that
+    // step and may cancel before the rest runs, see sd::provisional_preview.
+    int provisional_step = sd::provisional_preview::parse_args(plan.extra_sample_args).step;
+    if (provisional_step >= static_cast<int>(plan.sigmas.size()) - 1) {
+        provisional_step = 0;
+    }
+    struct SharedTrajectoryRecord {
+        sd::shared_trajectory::Cache* cache = nullptr;
+        std::string key;
+        int step = 0;
+    };
+
     std::vector<sd::Tensor<float>> final_latents;
     int64_t denoise_start = ggml_time_ms();
-    for (int b = 0; b < request.batch_count; b++) {
+    for (int b = 0; b < request.batch_count; b += latent_batch_size) {
         sd_cancel_mode_t cancel = sd_ctx->sd->get_cancel_flag();
         if (cancel == SD_CANCEL_ALL) {
             LOG_ERROR("cancelling generation");
-            return nullptr;
+            return false;
         }
         if (cancel == SD_CANCEL_NEW_LATENTS) {
             LOG_INFO("cancelling new latent generation, returning %zu/%d completed latents",
@@ -4569,41 +8043,153 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
         }
 
         int64_t sampling_start = ggml_time_ms();
-        int64_t cur_seed       = request.seed + b;
-        LOG_INFO("generating image: %i/%i - seed %" PRId64, b + 1, request.batch_count, cur_seed);
-
-        sd_ctx->sd->rng->manual_seed(cur_seed);
+        int64_t cur_seed       = request.seed_for_image(b);
+        const int chunk_size   = std::min(latent_batch_size, request.batch_count - b);
+        if (chunk_size == 1) {
+            LOG_INFO("generating image: %i/%i - seed %" PRId64, b + 1, request.batch_count, cur_seed);
+        } else {
+            LOG_INFO("generating images: %i-%i/%i - seeds %" PRId64 "..%" PRId64,
+                     b + 1,
+                     b + chunk_size,
+                     request.batch_count,
+                     cur_seed,
+                     request.seed_for_image(b + chunk_size - 1));
+        }
+
+        // each latent keeps the initial noise of its own seed
+        sd::Tensor<float> init_latent = latents.init_latent;
+        sd::Tensor<float> noise;
+        for (int i = 0; i < chunk_size; i++) {
+            sd_ctx->sd->rng->manual_seed(request.seed_for_image(b + i));
+            sd::Tensor<float> latent_noise = sd::randn_like<float>(latents.init_latent, sd_ctx->sd->rng);
+            if (i == 0) {
+                noise = std::move(latent_noise);
+            } else {
+                noise       = sd::ops::concat(noise, latent_noise, 3);
+                init_latent = sd::ops::concat(init_latent, latents.init_latent, 3);
+            }
+        }
         sd_ctx->sd->sampler_rng->manual_seed(cur_seed);
-        sd::Tensor<float> noise = sd::randn_like<float>(latents.init_latent, sd_ctx->sd->rng);
-
-        sd::Tensor<float> x_0 = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
-                                                   true,
-                                                   latents.init_latent,
-                                                   std::move(noise),
-                                                   embeds.cond,
-                                                   embeds.uncond,
-                                                   embeds.img_uncond,
-                                                   latents.control_image,
-                                                   request.control_strength,
-                                                   request.guidance,
-                                                   plan.eta,
-                                                   request.shifted_timestep,
-                                                   plan.sample_method,
-                                                   sd_ctx->sd->is_flow_denoiser(),
-                                                   plan.extra_sample_args,
-                                                   plan.sigmas,
-                                                   latents.ref_latents,
-                                                   request.increase_ref_index,
-                                                   latents.denoise_mask,
-                                                   sd::Tensor<float>(),
-                                                   1.f,
-                                                   0,
-                                                   static_cast<float>(request.fps),
-                                                   request.cache_params);
-        int64_t sampling_end  = ggml_time_ms();
+        sd_ctx->sd->set_lora_images(b, chunk_size);
+
+        // the first request of a setup records its state at shared_steps,
+        // later ones resume from it
+        StableDiffusionGGML::SampleCheckpointSession trajectory_session;
+        SharedTrajectoryRecord trajectory_record;
+        if (shared_trajectory.enabled()) {
+            std::string setup = sd_format("%" PRId64 ":%s:%zu:%016llx:%g:%g:%g:%g:%d:%" PRIu64 ":%s",
+                                          cur_seed,
+                                          sd_sample_method_name(plan.sample_method),
+                                          plan.sigmas.size(),
+                                          (unsigned long long)sd_sample::hash_sample_sigmas(plan.sigmas),
+                                          request.guidance.txt_cfg,
+                                          request.guidance.img_cfg,
+                                          request.guidance.distilled_guidance,
+                                          request.guidance.slg.scale,
+                                          shared_trajectory.steps,
+                                          sd_ctx->sd->lora_epoch,
+                                          SAFE_STR(plan.extra_sample_args));
+            std::vector<const sd::Tensor<float>*> inputs = {&latents.init_latent, &latents.denoise_mask, &latents.control_image};
+            for (const auto& ref_latent : latents.ref_latents) {
+                inputs.push_back(&ref_latent);
+            }
+            trajectory_record.cache = &sd_ctx->sd->shared_trajectories;
+            trajectory_record.key   = sd::shared_trajectory::Cache::make_key(setup, inputs);
+            trajectory_record.step  = shared_trajectory.steps;
+            trajectory_session.seed = cur_seed;
+            if (const sd_sample::SampleCheckpoint* start = sd_ctx->sd->shared_trajectories.find(trajectory_record.key)) {
+                trajectory_session.resume = start;
+                LOG_INFO("branching from the shared trajectory at step %d", start->step);
+            } else {
+                trajectory_session.cb       = [](int, int step, int, const uint8_t* data, size_t size, void* user_data) {
+                    auto* record = static_cast<SharedTrajectoryRecord*>(user_data);
+                    sd_sample::SampleCheckpoint checkpoint;
+                    if (step == record->step && sd_sample::deserialize_sample_checkpoint(data, size, &checkpoint)) {
+                        record->cache->put(record->key, std::move(checkpoint));
+                    }
+                };
+                trajectory_session.cb_data  = &trajectory_record;
+                trajectory_session.interval = shared_trajectory.steps;
+            }
+        }
+
+        auto sample_latent = [&](const sd::Tensor<float>& sample_init,
+                                 sd::Tensor<float> sample_noise,
+                                 const std::vector<float>& sigmas,
+                                 bool inverse_noise_scaling,
+                                 sd::Tensor<float>* last_denoised,
+                                 const StableDiffusionGGML::SampleCheckpointSession* checkpoint,
+                                 int sample_provisional_step) {
+            return sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
+                                      inverse_noise_scaling,
+                                      sample_init,
+                                      std::move(sample_noise),
+                                      embeds.cond,
+                                      embeds.uncond,
+                                      embeds.img_uncond,
+                                      latents.control_image,
+                                      request.control_strength,
+                                      request.guidance,
+                                      plan.eta,
+                                      request.shifted_timestep,
+                                      plan.sample_method,
+                                      sd_ctx->sd->is_flow_denoiser(),
+                                      plan.extra_sample_args,
+                                      sigmas,
+                                      latents.ref_latents,
+                                      request.increase_ref_index,
+                                      latents.denoise_mask,
+                                      sd::Tensor<float>(),
+                                      1.f,
+                                      0,
+                                      static_cast<float>(request.fps),
+                                      request.cache_params,
+                                      {},
+                                      checkpoint,
+                                      {},
+                                      last_denoised,
+                                      sample_provisional_step);
+        };
+
+        sd::Tensor<float> x_0;
+        bool lowres_ok = true;
+        if (lowres_steps > 0) {
+            // the full resolution steps start from the upscaled prediction,
+            // noised to their first sigma with the initial noise
+            std::vector<float> lowres_sigmas(plan.sigmas.begin(), plan.sigmas.begin() + lowres_steps + 1);
+            sd::Tensor<float> lowres_denoised;
+            sd::Tensor<float> lowres_x = sample_latent(progressive.downscale(init_latent),
+                                                       progressive.downscale_noise(noise),
+                                                       lowres_sigmas,
+                                                       false,
+                                                       &lowres_denoised,
+                                                       nullptr,
+                                                       provisional_step <= lowres_steps ? provisional_step : 0);
+            lowres_ok                  = !lowres_x.empty() && !lowres_denoised.empty();
+            if (lowres_ok) {
+                init_latent = progressive.upscale(lowres_denoised, init_latent.shape());
+            }
+        }
+        if (lowres_ok) {
+            x_0 = sample_latent(init_latent,
+                                std::move(noise),
+                                full_res_sigmas,
+                                true,
+                                nullptr,
+                                shared_trajectory.enabled() ? &trajectory_session : nullptr,
+                                provisional_step > lowres_steps ? provisional_step - lowres_steps : 0);
+        }
+        int64_t sampling_end = ggml_time_ms();
+        sd_perf::add_phase_ms(sd_perf::Phase::SAMPLING, static_cast<double>(sampling_end - sampling_start));
         if (!x_0.empty()) {
             LOG_INFO("sampling completed, taking %.2fs", (sampling_end - sampling_start) * 1.0f / 1000);
-            final_latents.push_back(std::move(x_0));
+            if (chunk_size == 1) {
+                final_latents.push_back(std::move(x_0));
+            } else {
+                for (auto& latent : sd::ops::chunk(x_0, chunk_size, 3)) {
+                    final_latents.push_back(std::move(latent));
+                }
+            }
             continue;
         }
 
@@ -4611,7 +8197,7 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
                   b + 1,
                   request.batch_count,
                   (sampling_end - sampling_start) * 1.0f / 1000);
-        return nullptr;
+        return false;
     }
     int64_t denoise_end = ggml_time_ms();
     LOG_INFO("generating %zu latent images completed, taking %.2fs",
@@ -4619,13 +8205,18 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
              (denoise_end - denoise_start) * 1.0f / 1000);
     if (final_latents.empty()) {
         LOG_ERROR("no latent images generated");
-        return nullptr;
+        return false;
     }
-
+    if (request.is_bucketed()) {
+        for (auto& latent : final_latents) {
+            latent = request.crop_bucketed_latent(latent);
+        }
+    }
+
     if (request.hires.enabled && request.hires.target_width > 0) {
         if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
             LOG_ERROR("cancelling generation before hires fix");
-            return nullptr;
+            return false;
         }
         LOG_INFO("hires fix: upscaling to %dx%d", request.hires.target_width, request.hires.target_height);
 
@@ -4633,7 +8224,7 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
         if (request.hires.upscaler == SD_HIRES_UPSCALER_MODEL) {
             if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
                 LOG_ERROR("cancelling generation before hires model load");
-                return nullptr;
+                return false;
             }
             LOG_INFO("hires fix: loading model upscaler from '%s'", request.hires.model_path);
             hires_upscaler                    = std::make_unique<UpscalerGGML>(sd_ctx->sd->n_threads,
@@ -4646,7 +8237,7 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
             if (!hires_upscaler->load_from_file(request.hires.model_path,
                                                 sd_ctx->sd->n_threads)) {
                 LOG_ERROR("load hires model upscaler failed");
-                return nullptr;
+                return false;
             }
         }
 
@@ -4670,18 +8261,19 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
         for (int b = 0; b < (int)final_latents.size(); b++) {
             if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
                 LOG_ERROR("cancelling generation during hires fix");
-                return nullptr;
+                return false;
             }
-            int64_t cur_seed = request.seed + b;
+            int64_t cur_seed = request.seed_for_image(b);
             sd_ctx->sd->rng->manual_seed(cur_seed);
             sd_ctx->sd->sampler_rng->manual_seed(cur_seed);
+            sd_ctx->sd->set_lora_images(b, 1);
 
             sd::Tensor<float> upscaled = upscale_hires_latent(sd_ctx,
                                                               final_latents[b],
                                                               request,
                                                               hires_upscaler.get());
             if (upscaled.empty()) {
-                return nullptr;
+                return false;
             }
 
             sd::Tensor<float> noise = sd::randn_like<float>(upscaled, sd_ctx->sd->rng);
@@ -4722,6 +8314,7 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
                                                             static_cast<float>(request.fps),
                                                             request.cache_params);
             int64_t hires_sample_end   = ggml_time_ms();
+            sd_perf::add_phase_ms(sd_perf::Phase::SAMPLING, static_cast<double>(hires_sample_end - hires_sample_start));
             if (!x_0.empty()) {
                 LOG_INFO("hires sampling %d/%d completed, taking %.2fs",
                          b + 1,
@@ -4735,7 +8328,7 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
                       b + 1,
                       (int)final_latents.size(),
                       (hires_sample_end - hires_sample_start) * 1.0f / 1000);
-            return nullptr;
+            return false;
         }
         int64_t hires_denoise_end = ggml_time_ms();
         LOG_INFO("hires fix completed, taking %.2fs", (hires_denoise_end - hires_denoise_start) * 1.0f / 1000);
@@ -4743,7 +8336,47 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
         final_latents = std::move(hires_final_latents);
     }
 
-    auto result = decode_image_outputs(sd_ctx, request, final_latents);
+    sd_perf::PerfRecorder* perf = sd_perf::current_recorder();
+    if (perf != nullptr && !request.hires.enabled && lowres_steps == 0 && final_latents.size() == static_cast<size_t>(request.batch_count)) {
+        // a tick of the progress counts once for the latents sampled together
+        sd::guidance::CfgTruncationParams cfg_truncation = sd::guidance::parse_cfg_truncation_args(plan.extra_sample_args);
+        sd::latency_slo::Observation observation;
+        observation.pixels         = static_cast<int64_t>(sd_img_gen_params->width) * sd_img_gen_params->height;
+        observation.cfg            = sd_img_gen_params->sample_params.guidance.txt_cfg != 1.f;
+        observation.cfg_truncation = cfg_truncation.sigma > 0.f || cfg_truncation.tolerance > 0.f;
+        observation.cache_mode     = request.cache_params != nullptr ? request.cache_params->mode : SD_CACHE_DISABLED;
+        observation.steps          = perf->sampling_steps * latent_batch_size;
+        observation.skipped_steps  = perf->sample_cache_skipped_steps * latent_batch_size;
+        observation.text_encode_ms = perf->text_encode_ms;
+        observation.sampling_ms    = perf->sampling_ms;
+        sd_ctx->sd->latency_estimator.observe(observation);
+    }
+
+    pending->batch_count       = request.batch_count;
+    pending->latents           = std::move(final_latents);
+    pending->vae_tiling_params = sd_ctx->sd->vae_tiling_params;
+    pending->circular_x        = sd_ctx->sd->circular_x;
+    pending->circular_y        = sd_ctx->sd->circular_y;
+    pending->image_cb          = sd_img_gen_params->image_cb;
+    pending->image_cb_data     = sd_img_gen_params->image_cb_data;
+    return true;
+}
+
+// generate_image without clearing the cancel flag, which the async queue
+// clears before it marks a generation running
+static sd_image_t* run_image_generation(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_ctx->sd->perf_recorder.reset();
+    sd_perf::ScopedPerfRecorder perf_scope(&sd_ctx->sd->perf_recorder);
+    MemoryTraceOnExit memory_trace(sd_img_gen_params->sample_params.extra_sample_args);
+
+    int64_t t0 = ggml_time_ms();
+    sd_image_latents_t pending;
+    if (!sample_image_outputs(sd_ctx, sd_img_gen_params, &pending)) {
+        return nullptr;
+    }
+
+    auto result = decode_image_outputs(sd_ctx, pending);
     if (result == nullptr) {
         return nullptr;
     }
@@ -4752,9 +8385,226 @@ SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* s
 
     int64_t t1 = ggml_time_ms();
     LOG_INFO("generate_image completed in %.2fs", (t1 - t0) * 1.0f / 1000);
+    sd_ctx->sd->perf_recorder.total_ms = static_cast<double>(t1 - t0);
+    return result;
+}
+
+SD_API sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+    if (sd_ctx == nullptr || sd_img_gen_params == nullptr) {
+        return nullptr;
+    }
+    sd_ctx->sd->reset_cancel_flag();
+    return run_image_generation(sd_ctx, sd_img_gen_params);
+}
+
+SD_API bool sd_ctx_can_overlap_vae_decode(sd_ctx_t* sd_ctx) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_ctx->sd->first_stage_model == nullptr) {
+        return false;
+    }
+    // VAE previews would run on the VAE while it decodes
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    if (sd_get_preview_mode() == PREVIEW_VAE || sd_get_preview_mode() == PREVIEW_TAE) {
+        return false;
+    }
+    ggml_backend_t vae_backend = sd_ctx->sd->backend_for(SDBackendModule::VAE);
+    return vae_backend != nullptr &&
+           vae_backend != sd_ctx->sd->backend_for(SDBackendModule::DIFFUSION) &&
+           vae_backend != sd_ctx->sd->backend_for(SDBackendModule::TE);
+}
+
+SD_API bool sd_ctx_can_overlap_text_encode(sd_ctx_t* sd_ctx) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_ctx->sd->cond_stage_model == nullptr) {
+        return false;
+    }
+    ggml_backend_t te_backend = sd_ctx->sd->backend_for(SDBackendModule::TE);
+    return te_backend != nullptr &&
+           te_backend != sd_ctx->sd->backend_for(SDBackendModule::DIFFUSION) &&
+           te_backend != sd_ctx->sd->backend_for(SDBackendModule::VAE);
+}
+
+// The text conditions prepare_image_generation_embeds asks for, for
+// prepare_image_conditions and export_image_conditions. False for
+// generations with LoRAs or with reference, PhotoMaker or PuLID inputs.
+static bool text_condition_params(sd_ctx_t* sd_ctx,
+                                  const sd_img_gen_params_t* sd_img_gen_params,
+                                  const std::vector<sd::Tensor<float>>* empty_ref_images,
+                                  std::vector<ConditionerParams>* params_list) {
+    // these change what the conditioner sees, or need the generation's own
+    // extension and LoRA state
+    if (sd_img_gen_params->lora_count > 0 ||
+        sd_img_gen_params->ref_images_count > 0 ||
+        sd_img_gen_params->pm_params.id_images_count > 0 ||
+        strlen(SAFE_STR(sd_img_gen_params->pulid_params.id_embedding_path)) > 0) {
+        return false;
+    }
+
+    sd_img_gen_params_t turbo_params;
+    sd_img_gen_params = resolve_turbo_preset(sd_ctx, sd_img_gen_params, &turbo_params);
+    GenerationRequest request(sd_ctx, sd_img_gen_params);
+    ConditionerParams condition_params;
+    condition_params.text       = request.prompt;
+    condition_params.clip_skip  = request.clip_skip;
+    condition_params.width      = request.width;
+    condition_params.height     = request.height;
+    condition_params.ref_images = empty_ref_images;
+
+    params_list->push_back(condition_params);
+    bool use_uncond = request.use_uncond || request.use_high_noise_uncond;
+    if ((use_uncond && !sd_version_is_ideogram4(sd_ctx->sd->version)) || (!use_uncond && request.use_img_uncond)) {
+        condition_params.text            = request.negative_prompt;
+        condition_params.zero_out_masked = uncond_zero_out_masked(sd_ctx, request);
+        params_list->push_back(condition_params);
+    }
+    return true;
+}
+
+SD_API bool prepare_image_conditions(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_img_gen_params == nullptr ||
+        sd_ctx->sd->cond_stage_model == nullptr) {
+        return false;
+    }
+    std::vector<sd::Tensor<float>> empty_ref_images;
+    std::vector<ConditionerParams> params_list;
+    if (!text_condition_params(sd_ctx, sd_img_gen_params, &empty_ref_images, &params_list)) {
+        return false;
+    }
+
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    int64_t t0 = ggml_time_ms();
+    bool ok    = sd_ctx->sd->prepare_conditions(params_list);
+    LOG_DEBUG("prepare_image_conditions completed, taking %.2fs", (ggml_time_ms() - t0) * 1.0f / 1000);
+    return ok;
+}
+
+SD_API bool export_image_conditions(sd_ctx_t* sd_ctx,
+                                    const sd_img_gen_params_t* sd_img_gen_params,
+                                    int count,
+                                    const char* path) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_img_gen_params == nullptr || count <= 0 ||
+        sd_ctx->sd->cond_stage_model == nullptr || strlen(SAFE_STR(path)) == 0) {
+        return false;
+    }
+    std::vector<sd::Tensor<float>> empty_ref_images;
+    std::vector<ConditionerParams> params_list;
+    std::unordered_set<std::string> keys;
+    int skipped = 0;
+    for (int i = 0; i < count; i++) {
+        std::vector<ConditionerParams> generation_params;
+        if (!text_condition_params(sd_ctx, &sd_img_gen_params[i], &empty_ref_images, &generation_params)) {
+            skipped++;
+            continue;
+        }
+        for (ConditionerParams& condition_params : generation_params) {
+            if (keys.insert(sd::condition_file::make_key(condition_params)).second) {
+                params_list.push_back(std::move(condition_params));
+            }
+        }
+    }
+    if (skipped > 0) {
+        LOG_WARN("skipping %d generations with LoRAs or reference, PhotoMaker or PuLID inputs", skipped);
+    }
+
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    int64_t t0 = ggml_time_ms();
+    bool ok    = sd_ctx->sd->export_conditions(params_list, path);
+    LOG_INFO("export_image_conditions completed, taking %.2fs", (ggml_time_ms() - t0) * 1.0f / 1000);
+    return ok;
+}
+
+SD_API sd_image_latents_t* sample_image_latents(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+    if (sd_ctx == nullptr || sd_img_gen_params == nullptr) {
+        return nullptr;
+    }
+
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_ctx->sd->reset_cancel_flag();
+    sd_ctx->sd->perf_recorder.reset();
+    sd_perf::ScopedPerfRecorder perf_scope(&sd_ctx->sd->perf_recorder);
+    MemoryTraceOnExit memory_trace(sd_img_gen_params->sample_params.extra_sample_args);
+
+    int64_t t0   = ggml_time_ms();
+    auto pending = std::make_unique<sd_image_latents_t>();
+    if (!sample_image_outputs(sd_ctx, sd_img_gen_params, pending.get())) {
+        return nullptr;
+    }
+
+    int64_t t1 = ggml_time_ms();
+    LOG_INFO("sample_image_latents completed in %.2fs", (t1 - t0) * 1.0f / 1000);
+    sd_ctx->sd->perf_recorder.total_ms = static_cast<double>(t1 - t0);
+    return pending.release();
+}
+
+SD_API sd_image_t* decode_image_latents(sd_ctx_t* sd_ctx, const sd_image_latents_t* latents, int* num_images) {
+    if (num_images != nullptr) {
+        *num_images = 0;
+    }
+    if (sd_ctx == nullptr || latents == nullptr) {
+        return nullptr;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_image_t* result = decode_image_outputs(sd_ctx, *latents);
+    if (result != nullptr && num_images != nullptr) {
+        *num_images = latents->batch_count;
+    }
     return result;
 }
 
+SD_API void free_sd_image_latents(sd_image_latents_t* latents) {
+    delete latents;
+}
+
+SD_API sd_latent_t* generate_latents(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params, int* num_latents) {
+    if (num_latents != nullptr) {
+        *num_latents = 0;
+    }
+    sd_image_latents_t* pending = sample_image_latents(sd_ctx, sd_img_gen_params);
+    if (pending == nullptr) {
+        return nullptr;
+    }
+    sd_latent_t* latents = (sd_latent_t*)calloc(pending->batch_count, sizeof(sd_latent_t));
+    if (latents != nullptr) {
+        for (size_t i = 0; i < pending->latents.size(); i++) {
+            latents[i] = tensor_to_sd_latent(sd_ctx, pending->latents[i]);
+        }
+        if (num_latents != nullptr) {
+            *num_latents = pending->batch_count;
+        }
+    }
+    free_sd_image_latents(pending);
+    return latents;
+}
+
+SD_API sd_image_t* decode_latents(sd_ctx_t* sd_ctx, const sd_latent_t* latents, int num_latents) {
+    if (sd_ctx == nullptr || latents == nullptr || num_latents <= 0) {
+        return nullptr;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_ctx->sd->reset_cancel_flag();
+    sd_image_latents_t pending;
+    pending.batch_count       = num_latents;
+    pending.vae_tiling_params = sd_ctx->sd->vae_tiling_params;
+    pending.circular_x        = sd_ctx->sd->circular_x;
+    pending.circular_y        = sd_ctx->sd->circular_y;
+    for (int i = 0; i < num_latents && latents[i].data != nullptr; i++) {
+        sd::Tensor<float> latent = sd_latent_to_tensor(sd_ctx, latents[i], -1, -1);
+        if (latent.empty()) {
+            return nullptr;
+        }
+        pending.latents.push_back(std::move(latent));
+    }
+    return decode_image_outputs(sd_ctx, pending);
+}
+
+SD_API void free_sd_latents(sd_latent_t* latents, int num_latents) {
+    if (latents == nullptr) {
+        return;
+    }
+    for (int i = 0; i < num_latents; i++) {
+        free(latents[i].data);
+    }
+    free(latents);
+}
+
 static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd_ctx_t* sd_ctx,
                                                                               const sd_vid_gen_params_t* sd_vid_gen_params,
                                                                               GenerationRequest* request) {
@@ -4867,6 +8717,7 @@ static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd
 
             int64_t t2 = ggml_time_ms();
             LOG_INFO("encode_first_stage completed, taking %" PRId64 " ms", t2 - t1);
+            sd_perf::add_phase_ms(sd_perf::Phase::VAE_ENCODE, static_cast<double>(t2 - t1));
         }
     }
 
@@ -4926,6 +8777,7 @@ static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd
 
         int64_t t2 = ggml_time_ms();
         LOG_INFO("encode_first_stage completed, taking %" PRId64 " ms", t2 - t1);
+        sd_perf::add_phase_ms(sd_perf::Phase::VAE_ENCODE, static_cast<double>(t2 - t1));
 
         sd::Tensor<float> concat_mask = sd::zeros<float>({latents.concat_latent.shape()[0],
                                                           latents.concat_latent.shape()[1],
@@ -4971,6 +8823,7 @@ static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd
 
         int64_t t2 = ggml_time_ms();
         LOG_INFO("encode_first_stage completed, taking %" PRId64 " ms", t2 - t1);
+        sd_perf::add_phase_ms(sd_perf::Phase::VAE_ENCODE, static_cast<double>(t2 - t1));
     } else if (sd_ctx->sd->diffusion_model->get_desc() == "Wan2.1-VACE-1.3B" ||
                sd_ctx->sd->diffusion_model->get_desc() == "Wan2.x-VACE-14B") {
         LOG_INFO("VACE");
@@ -5045,6 +8898,7 @@ static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd
         latents.vace_context = sd::ops::concat(vace_context, mask_context, 3);  // [b, 2*c + vae_scale_factor*vae_scale_factor, t + 1 or t, h/vae_scale_factor, w/vae_scale_factor]
         int64_t t2           = ggml_time_ms();
         LOG_INFO("encode_first_stage completed, taking %" PRId64 " ms", t2 - t1);
+        sd_perf::add_phase_ms(sd_perf::Phase::VAE_ENCODE, static_cast<double>(t2 - t1));
     }
 
     if (latents.init_latent.empty()) {
@@ -5063,11 +8917,8 @@ static std::optional<ImageGenerationLatents> prepare_video_generation_latents(sd
     return latents;
 }
 
-static ImageGenerationEmbeds prepare_video_generation_embeds(sd_ctx_t* sd_ctx,
-                                                             const sd_vid_gen_params_t* sd_vid_gen_params,
-                                                             const GenerationRequest& request,
-                                                             const ImageGenerationLatents& latents) {
-    ConditionerRunnerDoneOnExit conditioner_runner_done{sd_ctx->sd->cond_stage_model.get()};
+static ImageGenerationEmbeds encode_video_generation_prompts(sd_ctx_t* sd_ctx, const GenerationRequest& request) {
+    ConditionerRunnerDoneOnExit conditioner_runner_done{sd_ctx->sd->cond_stage_model.get(), &sd_ctx->sd->conditioner_mutex};
 
     ImageGenerationEmbeds embeds;
     ConditionerParams condition_params;
@@ -5075,36 +8926,69 @@ static ImageGenerationEmbeds prepare_video_generation_embeds(sd_ctx_t* sd_ctx,
     condition_params.text            = request.prompt;
     condition_params.zero_out_masked = true;
 
+    embeds.cond = sd_ctx->sd->get_learned_condition(condition_params);
+    if (request.use_uncond) {
+        condition_params.text = request.negative_prompt;
+        embeds.uncond         = sd_ctx->sd->get_learned_condition(condition_params);
+    }
+    sd_ctx->sd->finish_conditioner_prefetch();
+    return embeds;
+}
+
+// The prompts of a video need none of its latents, so when the text encoder
+// and the VAE run on different backends the prompts are encoded while the
+// VAE encodes the init, end and control frames.
+static std::future<ImageGenerationEmbeds> start_video_generation_prompts(sd_ctx_t* sd_ctx,
+                                                                         const sd_vid_gen_params_t* sd_vid_gen_params,
+                                                                         const GenerationRequest& request) {
+    const bool has_vae_inputs = sd_vid_gen_params->init_image.data != nullptr ||
+                                sd_vid_gen_params->end_image.data != nullptr ||
+                                sd_vid_gen_params->control_frames_size > 0;
+    if (!has_vae_inputs || !sd_ctx->sd->conditioner_can_run_beside_vae()) {
+        return {};
+    }
+    LOG_DEBUG("encoding the prompts while the VAE encodes the video inputs");
+    return std::async(std::launch::async, [sd_ctx, request, thread_callbacks = sd_current_thread_callbacks()]() {
+        ScopedThreadCallbacks callback_scope(thread_callbacks);
+        return encode_video_generation_prompts(sd_ctx, request);
+    });
+}
+
+static ImageGenerationEmbeds prepare_video_generation_embeds(sd_ctx_t* sd_ctx,
+                                                             const GenerationRequest& request,
+                                                             const ImageGenerationLatents& latents,
+                                                             std::future<ImageGenerationEmbeds>* pending_prompts) {
     int64_t prepare_start_ms = ggml_time_ms();
-    embeds.cond              = sd_ctx->sd->cond_stage_model->get_learned_condition(sd_ctx->sd->n_threads,
-                                                                                   condition_params);
-    embeds.cond.c_concat     = latents.concat_latent;
-    embeds.cond.c_vector     = latents.clip_vision_output;
+    ImageGenerationEmbeds embeds;
+    if (pending_prompts != nullptr && pending_prompts->valid()) {
+        embeds = pending_prompts->get();
+    } else {
+        embeds = encode_video_generation_prompts(sd_ctx, request);
+    }
+    embeds.cond.c_concat = latents.concat_latent;
+    embeds.cond.c_vector = latents.clip_vision_output;
     if (request.use_uncond) {
-        condition_params.text  = request.negative_prompt;
-        embeds.uncond          = sd_ctx->sd->cond_stage_model->get_learned_condition(sd_ctx->sd->n_threads,
-                                                                                     condition_params);
         embeds.uncond.c_concat = latents.concat_latent;
         embeds.uncond.c_vector = latents.clip_vision_output;
     }
 
+    // only the part not hidden behind the VAE encode when the prompts ran
+    // beside it
     int64_t t1 = ggml_time_ms();
     LOG_INFO("get_learned_condition completed, taking %.2fs", (t1 - prepare_start_ms) * 1.0f / 1000);
+    sd_perf::add_phase_ms(sd_perf::Phase::TEXT_ENCODE, static_cast<double>(t1 - prepare_start_ms));
 
     return embeds;
 }
 
-static sd_image_t* decode_video_outputs(sd_ctx_t* sd_ctx,
-                                        const GenerationRequest& request,
-                                        const sd::Tensor<float>& final_latent,
-                                        int* num_frames_out) {
+static sd::Tensor<float> video_latent_to_decode(sd_ctx_t* sd_ctx, const sd::Tensor<float>& final_latent) {
     if (final_latent.empty()) {
         LOG_ERROR("no latent video to decode");
-        return nullptr;
+        return {};
     }
     if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
         LOG_ERROR("cancelling video decode");
-        return nullptr;
+        return {};
     }
     sd::Tensor<float> video_latent = final_latent;
     if (sd_version_is_ltxav(sd_ctx->sd->version) &&
@@ -5116,11 +9000,23 @@ static sd_image_t* decode_video_outputs(sd_ctx_t* sd_ctx,
               (int)video_latent.shape()[1],
               (int)video_latent.shape()[2],
               (int)video_latent.shape()[3]);
+    return video_latent;
+}
+
+static sd_image_t* decode_video_outputs(sd_ctx_t* sd_ctx,
+                                        const GenerationRequest& request,
+                                        const sd::Tensor<float>& final_latent,
+                                        int* num_frames_out) {
+    sd::Tensor<float> video_latent = video_latent_to_decode(sd_ctx, final_latent);
+    if (video_latent.empty()) {
+        return nullptr;
+    }
     // auto z = sd::load_tensor_from_file_as_tensor<float>("ltx_vae_z.bin");
     int64_t t4            = ggml_time_ms();
     sd::Tensor<float> vid = sd_ctx->sd->decode_first_stage(video_latent, true);
     int64_t t5            = ggml_time_ms();
     LOG_INFO("decode_first_stage completed, taking %.2fs", (t5 - t4) * 1.0f / 1000);
+    sd_perf::add_phase_ms(sd_perf::Phase::VAE_DECODE, static_cast<double>(t5 - t4));
     if (vid.empty()) {
         LOG_ERROR("decode_first_stage failed for video");
         return nullptr;
@@ -5150,6 +9046,128 @@ static sd_image_t* decode_video_outputs(sd_ctx_t* sd_ctx,
     return result_images;
 }
 
+// Hands decoded frames to frames_cb as the VAE finishes them instead of
+// collecting the whole video; frames past request.frames are dropped.
+static bool stream_video_outputs(sd_ctx_t* sd_ctx,
+                                 const GenerationRequest& request,
+                                 const sd::Tensor<float>& final_latent,
+                                 const sd_vid_gen_params_t* sd_vid_gen_params,
+                                 const std::function<const sd_audio_t*()>& get_audio,
+                                 int* num_frames_out) {
+    sd::Tensor<float> video_latent = video_latent_to_decode(sd_ctx, final_latent);
+    if (video_latent.empty()) {
+        return false;
+    }
+
+    int frame_count = 0;
+    bool all_frames = false;
+    bool stopped    = false;
+    int64_t t4      = ggml_time_ms();
+    bool ok         = sd_ctx->sd->decode_first_stage_video_frames(video_latent, [&](const sd::Tensor<float>& frames) {
+        int64_t count = frames.shape()[2];
+        if (request.frames > 0) {
+            count = std::min<int64_t>(count, request.frames - frame_count);
+        }
+        std::vector<sd_image_t> images(static_cast<size_t>(std::max<int64_t>(count, 0)));
+        for (int64_t i = 0; i < count; i++) {
+            images[i] = tensor_to_sd_image(frames, static_cast<int>(i));
+        }
+        bool keep = images.empty() || sd_vid_gen_params->frames_cb(frame_count,
+                                                                   static_cast<int>(images.size()),
+                                                                   images.data(),
+                                                                   get_audio(),
+                                                                   sd_vid_gen_params->frames_cb_data);
+        for (sd_image_t& image : images) {
+            free(image.data);
+        }
+        frame_count += static_cast<int>(images.size());
+        if (!keep || sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
+            stopped = true;
+            return false;
+        }
+        // the remaining temporal tiles would only be dropped
+        all_frames = request.frames > 0 && frame_count >= request.frames;
+        return !all_frames;
+    });
+    int64_t t5 = ggml_time_ms();
+    LOG_INFO("decode_first_stage completed, taking %.2fs", (t5 - t4) * 1.0f / 1000);
+    sd_perf::add_phase_ms(sd_perf::Phase::VAE_DECODE, static_cast<double>(t5 - t4));
+    if (num_frames_out != nullptr) {
+        *num_frames_out = frame_count;
+    }
+    if (stopped) {
+        LOG_ERROR("video decode stopped after %d frames", frame_count);
+        return false;
+    }
+    if (!ok && !all_frames) {
+        LOG_ERROR("decode_first_stage failed for video");
+        return false;
+    }
+    return true;
+}
+
+// Whether the latent upscale runs on a backend no other stage of a video
+// generation uses, so it can run beside them.
+static bool ltx_upscaler_has_own_backend(StableDiffusionGGML* sd) {
+    ggml_backend_t upscaler_backend = sd->backend_for(SDBackendModule::UPSCALER);
+    if (upscaler_backend == nullptr) {
+        return false;
+    }
+    for (SDBackendModule module : {SDBackendModule::DIFFUSION, SDBackendModule::TE, SDBackendModule::VAE, SDBackendModule::AUDIO_VAE}) {
+        if (sd->backend_for(module) == upscaler_backend) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool load_ltx_latent_upsampler(StableDiffusionGGML* sd, const char* model_path) {
+    auto upsampler_manager = std::make_shared<ModelManager>();
+    upsampler_manager->set_n_threads(sd->n_threads);
+    upsampler_manager->set_enable_mmap(sd->enable_mmap);
+    upsampler_manager->set_max_pinned_bytes(sd->max_pinned_bytes);
+    ModelLoader& model_loader = upsampler_manager->loader();
+    if (!model_loader.init_from_file(model_path)) {
+        LOG_ERROR("init LTX latent upsampler model loader from file failed: '%s'", model_path);
+        return false;
+    }
+
+    std::unique_ptr<LTXVUpsampler::LatentUpsamplerRunner> upsampler =
+        std::make_unique<LTXVUpsampler::LatentUpsamplerRunner>(sd->backend_for(SDBackendModule::UPSCALER),
+                                                               model_loader.get_tensor_storage_map(),
+                                                               upsampler_manager);
+    const size_t max_graph_vram_bytes = sd->max_graph_vram_bytes_for_module(SDBackendModule::UPSCALER);
+    upsampler->set_max_graph_vram_bytes(max_graph_vram_bytes);
+    if (upsampler->model == nullptr) {
+        LOG_ERROR("init LTX latent upsampler from metadata failed");
+        return false;
+    }
+
+    std::map<std::string, ggml_tensor*> tensors;
+    upsampler->get_param_tensors(tensors);
+    if (!upsampler_manager->register_param_tensors("LTX latent upsampler",
+                                                   std::move(tensors),
+                                                   ModelManager::ResidencyMode::ParamBackend,
+                                                   sd->backend_for(SDBackendModule::UPSCALER),
+                                                   sd->params_backend_for(SDBackendModule::UPSCALER)) ||
+        !upsampler_manager->validate_registered_tensors()) {
+        LOG_ERROR("register LTX latent upsampler tensors with model manager failed");
+        return false;
+    }
+    sd->ltx_upsampler_path    = model_path;
+    sd->ltx_upsampler_manager = std::move(upsampler_manager);
+    sd->ltx_upsampler         = std::move(upsampler);
+    return true;
+}
+
+static void free_ltx_latent_upsampler(StableDiffusionGGML* sd) {
+    sd->ltx_upsampler_manager.reset();
+    sd->ltx_upsampler.reset();
+    sd->ltx_upsampler_path.clear();
+}
+
+// Uses only the upscaler backend and the host once the latent statistics are
+// loaded, so it may run beside the other stages of another generation.
 static sd::Tensor<float> upscale_ltx_spatial_video_latent(sd_ctx_t* sd_ctx,
                                                           const char* model_path,
                                                           const sd::Tensor<float>& packed_latent,
@@ -5161,11 +9179,12 @@ static sd::Tensor<float> upscale_ltx_spatial_video_latent(sd_ctx_t* sd_ctx,
         LOG_ERROR("LTX latent spatial upscale requires a model path");
         return {};
     }
-    if (!sd_ctx->sd->ensure_backend_pair(SDBackendModule::UPSCALER)) {
+    StableDiffusionGGML* sd = sd_ctx->sd;
+    if (!sd->ensure_backend_pair(SDBackendModule::UPSCALER) || !sd->load_ltx_latent_statistics()) {
         return {};
     }
 
-    int latent_channels            = sd_ctx->sd->get_latent_channel();
+    int latent_channels            = sd->get_latent_channel();
     sd::Tensor<float> video_latent = packed_latent;
     sd::Tensor<float> audio_latent;
     if (packed_latent.shape()[3] > latent_channels) {
@@ -5179,53 +9198,31 @@ static sd::Tensor<float> upscale_ltx_spatial_video_latent(sd_ctx_t* sd_ctx,
              (int)video_latent.shape()[2],
              (int)video_latent.shape()[3]);
 
-    sd::Tensor<float> unnormalized = sd_ctx->sd->un_normalize_ltx_video_latents(video_latent);
+    sd::Tensor<float> unnormalized = sd->apply_ltx_latent_statistics(video_latent, false);
     if (unnormalized.empty()) {
         LOG_ERROR("LTX latent un-normalization failed before spatial upscale");
         return {};
     }
 
-    auto upsampler_manager = std::make_shared<ModelManager>();
-    upsampler_manager->set_n_threads(sd_ctx->sd->n_threads);
-    upsampler_manager->set_enable_mmap(sd_ctx->sd->enable_mmap);
-    ModelLoader& model_loader = upsampler_manager->loader();
-    if (!model_loader.init_from_file(model_path)) {
-        LOG_ERROR("init LTX latent upsampler model loader from file failed: '%s'", model_path);
-        return {};
-    }
-
-    std::unique_ptr<LTXVUpsampler::LatentUpsamplerRunner> upsampler =
-        std::make_unique<LTXVUpsampler::LatentUpsamplerRunner>(sd_ctx->sd->backend_for(SDBackendModule::UPSCALER),
-                                                               model_loader.get_tensor_storage_map(),
-                                                               upsampler_manager);
-    const size_t max_graph_vram_bytes = sd_ctx->sd->max_graph_vram_bytes_for_module(SDBackendModule::UPSCALER);
-    upsampler->set_max_graph_vram_bytes(max_graph_vram_bytes);
-    if (upsampler->model == nullptr) {
-        LOG_ERROR("init LTX latent upsampler from metadata failed");
-        return {};
+    // on a backend of its own the upsampler stays loaded for the next
+    // generation
+    const bool keep_loaded = ltx_upscaler_has_own_backend(sd);
+    if (sd->ltx_upsampler == nullptr || sd->ltx_upsampler_path != model_path) {
+        free_ltx_latent_upsampler(sd);
+        if (!load_ltx_latent_upsampler(sd, model_path)) {
+            return {};
+        }
     }
-
-    std::map<std::string, ggml_tensor*> tensors;
-    upsampler->get_param_tensors(tensors);
-    if (!upsampler_manager->register_param_tensors("LTX latent upsampler",
-                                                   std::move(tensors),
-                                                   ModelManager::ResidencyMode::ParamBackend,
-                                                   sd_ctx->sd->backend_for(SDBackendModule::UPSCALER),
-                                                   sd_ctx->sd->params_backend_for(SDBackendModule::UPSCALER)) ||
-        !upsampler_manager->validate_registered_tensors()) {
-        LOG_ERROR("register LTX latent upsampler tensors with model manager failed");
-        return {};
+    sd::Tensor<float> upscaled = sd->ltx_upsampler->compute(sd->n_threads, unnormalized);
+    if (!keep_loaded) {
+        free_ltx_latent_upsampler(sd);
     }
-
-    sd::Tensor<float> upscaled = upsampler->compute(sd_ctx->sd->n_threads, unnormalized);
-    upsampler_manager.reset();
-    upsampler.reset();
     if (upscaled.empty()) {
         LOG_ERROR("LTX latent spatial upscale failed");
         return {};
     }
 
-    upscaled = sd_ctx->sd->normalize_ltx_video_latents(upscaled);
+    upscaled = sd->apply_ltx_latent_statistics(upscaled, true);
     if (upscaled.empty()) {
         LOG_ERROR("LTX latent normalization failed after spatial upscale");
         return {};
@@ -5337,26 +9334,35 @@ static bool apply_ltxv_refine_image_conditioning(sd_ctx_t* sd_ctx,
     return true;
 }
 
-SD_API bool generate_video(sd_ctx_t* sd_ctx,
-                           const sd_vid_gen_params_t* sd_vid_gen_params,
-                           sd_image_t** frames_out,
-                           int* num_frames_out,
-                           sd_audio_t** audio_out) {
-    if (sd_ctx == nullptr || sd_vid_gen_params == nullptr) {
-        return false;
-    }
-    if (frames_out != nullptr) {
-        *frames_out = nullptr;
-    }
-    if (audio_out != nullptr) {
-        *audio_out = nullptr;
-    }
-
-    sd_ctx->sd->reset_cancel_flag();
+// A video generation between its stages, see sample_video_latents.
+struct sd_video_latents_t {
+    const sd_vid_gen_params_t* params;
+    GenerationRequest request;
+    GenerationRequest hires_request;  // of the refinement pass after a latent upscale
+    SamplePlan plan;
+    sd::frame_interpolation::Params frame_interpolation;
+    int output_frames = 0;
+    ImageGenerationLatents latents;
+    ImageGenerationEmbeds embeds;
+    bool latent_upscale_enabled = false;
+    sd::Tensor<float> final_latent;     // of the first pass
+    sd::Tensor<float> upscaled_latent;  // set by the upscale
+    // The generators and LoRAs as the first pass left them, restored for the
+    // refinement pass when another generation ran in between.
+    std::vector<uint8_t> rng_state;
+    std::vector<uint8_t> sampler_rng_state;
+    std::string lora_signature;
+    int64_t t0           = 0;
+    int64_t latent_start = 0;
+
+    sd_video_latents_t(const sd_vid_gen_params_t* params, GenerationRequest request, SamplePlan plan)
+        : params(params), request(request), hires_request(request), plan(std::move(plan)) {}
+};
 
-    if (num_frames_out != nullptr) {
-        *num_frames_out = 0;
-    }
+// Samples a video at its first resolution: up to the latent upscale for an
+// LTX latent upscale, up to the decode otherwise.
+static std::unique_ptr<sd_video_latents_t> sample_video_outputs(sd_ctx_t* sd_ctx,
+                                                               const sd_vid_gen_params_t* sd_vid_gen_params) {
     int64_t t0                    = ggml_time_ms();
     sd_ctx->sd->vae_tiling_params = sd_vid_gen_params->vae_tiling_params;
     GenerationRequest request(sd_ctx, sd_vid_gen_params);
@@ -5365,15 +9371,21 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
     if (latent_upscale_enabled) {
         if (!sd_version_is_ltxav(sd_ctx->sd->version)) {
             LOG_ERROR("LTX latent spatial upscale is only supported for LTX video models");
-            return false;
+            return nullptr;
         }
         if (request.hires.upscaler != SD_HIRES_UPSCALER_MODEL) {
             LOG_ERROR("LTX latent spatial upscale currently requires hires upscaler MODEL");
-            return false;
+            return nullptr;
         }
         if (strlen(SAFE_STR(request.hires.model_path)) == 0) {
             LOG_ERROR("LTX latent spatial upscale is enabled but hires model path was not provided");
-            return false;
+            return nullptr;
+        }
+        // readied here, so the upscale touches neither the backend table nor
+        // the VAE when it runs beside another generation
+        if (!sd_ctx->sd->ensure_backend_pair(SDBackendModule::UPSCALER) ||
+            !sd_ctx->sd->load_ltx_latent_statistics()) {
+            return nullptr;
         }
     }
 
@@ -5381,19 +9393,50 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
     sd_ctx->sd->sampler_rng->manual_seed(request.seed);
     sd_ctx->sd->set_flow_shift(sd_vid_gen_params->sample_params.flow_shift);
     sd_ctx->sd->apply_loras(sd_vid_gen_params->loras, sd_vid_gen_params->lora_count);
+    sd_ctx->sd->prefetch_conditioner_params();
     sd_ctx->sd->reset_generation_extensions();
 
     SamplePlan plan(sd_ctx, sd_vid_gen_params, request);
+
+    // With frame_interp the clip is sampled as keyframes and the latent
+    // frames in between are blended back in before the decode.
+    sd::frame_interpolation::Params frame_interpolation = sd::frame_interpolation::parse_args(plan.extra_sample_args);
+    const int output_frames                             = request.frames;
+    if (frame_interpolation.enabled()) {
+        if (!sd_version_is_wan(sd_ctx->sd->version)) {
+            LOG_WARN("latent frame interpolation is only supported for Wan models");
+            frame_interpolation.factor = 1;
+        } else if (sd_vid_gen_params->control_frames_size > 0) {
+            LOG_WARN("latent frame interpolation does not support VACE control frames, sampling every frame");
+            frame_interpolation.factor = 1;
+        } else {
+            const int latent_frames = sd_ctx->sd->video_frames_to_latent_frames(request.frames);
+            const int sampled       = static_cast<int>(frame_interpolation.sampled_frames(latent_frames));
+            if (sampled < latent_frames) {
+                LOG_INFO("sampling %d of %d latent frames, interpolating the rest", sampled, latent_frames);
+                request.frames = sd_ctx->sd->latent_frames_to_video_frames(sampled);
+            } else {
+                frame_interpolation.factor = 1;
+            }
+        }
+    }
+
+    auto pending_prompts   = start_video_generation_prompts(sd_ctx, sd_vid_gen_params, request);
     auto latent_inputs_opt = prepare_video_generation_latents(sd_ctx, sd_vid_gen_params, &request);
     if (!latent_inputs_opt.has_value()) {
-        return false;
+        if (pending_prompts.valid()) {
+            pending_prompts.wait();
+        } else {
+            sd_ctx->sd->finish_conditioner_prefetch();
+        }
+        return nullptr;
     }
     ImageGenerationLatents latents = std::move(*latent_inputs_opt);
 
     ImageGenerationEmbeds embeds = prepare_video_generation_embeds(sd_ctx,
-                                                                   sd_vid_gen_params,
                                                                    request,
-                                                                   latents);
+                                                                   latents,
+                                                                   &pending_prompts);
     if (latent_upscale_enabled) {
         LOG_INFO("generate_video %dx%dx%d -> LTX latent spatial upscale",
                  request.width,
@@ -5414,10 +9457,43 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
     sd::Tensor<float> x_t   = latents.init_latent;
     sd::Tensor<float> noise = sd::Tensor<float>::randn_like(x_t, sd_ctx->sd->rng);
 
-    if (plan.high_noise_sample_steps > 0) {
+    // Pass 0 is the high-noise pass, pass 1 the main one. A checkpoint of the
+    // main pass already holds the latent the high-noise pass produced, so
+    // resuming it skips that pass.
+    sd_sample::SampleCheckpoint resume_checkpoint;
+    const bool resuming = sd_vid_gen_params->resume_checkpoint != nullptr && sd_vid_gen_params->resume_checkpoint_size > 0;
+    if (resuming) {
+        if (!sd_sample::deserialize_sample_checkpoint(sd_vid_gen_params->resume_checkpoint,
+                                                      sd_vid_gen_params->resume_checkpoint_size,
+                                                      &resume_checkpoint)) {
+            LOG_ERROR("resume checkpoint is truncated or from another version");
+            return nullptr;
+        }
+        if (resume_checkpoint.pass < 0 || resume_checkpoint.pass > 1 ||
+            (resume_checkpoint.pass == 0 && plan.high_noise_sample_steps <= 0)) {
+            LOG_ERROR("resume checkpoint is from a sampling pass this request does not have");
+            return nullptr;
+        }
+    }
+    auto checkpoint_session = [&](int pass) {
+        StableDiffusionGGML::SampleCheckpointSession session;
+        session.pass     = pass;
+        session.seed     = request.seed;
+        session.resume   = resuming && resume_checkpoint.pass == pass ? &resume_checkpoint : nullptr;
+        session.cb       = sd_vid_gen_params->checkpoint_cb;
+        session.cb_data  = sd_vid_gen_params->checkpoint_cb_data;
+        session.interval = sd_vid_gen_params->checkpoint_interval;
+        return session;
+    };
+
+    if (plan.high_noise_sample_steps > 0 && resuming && resume_checkpoint.pass > 0) {
+        LOG_INFO("skipping sampling(high noise), resuming from a checkpoint of the main pass");
+        plan.sigmas = std::vector<float>(plan.sigmas.begin() + plan.high_noise_sample_steps, plan.sigmas.end());
+        noise       = {};
+    } else if (plan.high_noise_sample_steps > 0) {
         if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
             LOG_ERROR("cancelling generation before high-noise sampling");
-            return false;
+            return nullptr;
         }
         LOG_DEBUG("sample(high noise) %dx%dx%d", W, H, T);
 
@@ -5425,6 +9501,19 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
         std::vector<float> high_noise_sigmas(plan.sigmas.begin(), plan.sigmas.begin() + plan.high_noise_sample_steps + 1);
         plan.sigmas = std::vector<float>(plan.sigmas.begin() + plan.high_noise_sample_steps, plan.sigmas.end());
 
+        StableDiffusionGGML::SampleCheckpointSession high_noise_checkpoint = checkpoint_session(0);
+
+        // the low-noise params are readied during the last high-noise steps
+        const int moe_prefetch_tail_steps = 2;
+        bool moe_prefetch_started         = false;
+        bool low_noise_fits               = true;
+        auto on_high_noise_step           = [&](int step) {
+            if (!moe_prefetch_started && step > 0 && step + moe_prefetch_tail_steps > plan.high_noise_sample_steps) {
+                moe_prefetch_started = true;
+                low_noise_fits       = sd_ctx->sd->prefetch_moe_expert_params();
+            }
+        };
+
         sd::Tensor<float> x_t_sampled = sd_ctx->sd->sample(sd_ctx->sd->high_noise_diffusion_model,
                                                            false,
                                                            x_t,
@@ -5449,11 +9538,15 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                                                            latents.audio_length,
                                                            static_cast<float>(request.fps),
                                                            request.cache_params,
-                                                           latents.video_positions);
+                                                           latents.video_positions,
+                                                           &high_noise_checkpoint,
+                                                           on_high_noise_step);
         int64_t sampling_end          = ggml_time_ms();
+        sd_ctx->sd->finish_moe_switch(low_noise_fits);
+        sd_perf::add_phase_ms(sd_perf::Phase::SAMPLING, static_cast<double>(sampling_end - sampling_start));
         if (x_t_sampled.empty()) {
             LOG_ERROR("sampling(high noise) failed after %.2fs", (sampling_end - sampling_start) * 1.0f / 1000);
-            return false;
+            return nullptr;
         }
 
         x_t   = std::move(x_t_sampled);
@@ -5463,9 +9556,11 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
 
     if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
         LOG_ERROR("cancelling generation before sampling");
-        return false;
+        return nullptr;
     }
     LOG_DEBUG("sample %dx%dx%d", W, H, T);
+    StableDiffusionGGML::SampleCheckpointSession checkpoint = checkpoint_session(1);
+
     int64_t sampling_start         = ggml_time_ms();
     sd::Tensor<float> final_latent = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
                                                         true,
@@ -5491,33 +9586,96 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                                                         latents.audio_length,
                                                         static_cast<float>(request.fps),
                                                         request.cache_params,
-                                                        latents.video_positions);
+                                                        latents.video_positions,
+                                                        &checkpoint);
 
     int64_t sampling_end = ggml_time_ms();
+    sd_perf::add_phase_ms(sd_perf::Phase::SAMPLING, static_cast<double>(sampling_end - sampling_start));
     if (final_latent.empty()) {
         LOG_ERROR("sampling failed after %.2fs", (sampling_end - sampling_start) * 1.0f / 1000);
-        return false;
+        return nullptr;
     }
     LOG_INFO("sampling completed, taking %.2fs", (sampling_end - sampling_start) * 1.0f / 1000);
 
-    if (latent_upscale_enabled) {
+    auto pending                    = std::make_unique<sd_video_latents_t>(sd_vid_gen_params, std::move(request), std::move(plan));
+    pending->hires_request          = std::move(hires_request);
+    pending->frame_interpolation    = frame_interpolation;
+    pending->output_frames          = output_frames;
+    pending->latents                = std::move(latents);
+    pending->embeds                 = std::move(embeds);
+    pending->latent_upscale_enabled = latent_upscale_enabled;
+    pending->final_latent           = std::move(final_latent);
+    pending->rng_state              = sd_ctx->sd->rng->save_state();
+    if (sd_ctx->sd->sampler_rng != nullptr) {
+        pending->sampler_rng_state = sd_ctx->sd->sampler_rng->save_state();
+    }
+    pending->lora_signature = sd_ctx->sd->applied_lora_signature;
+    pending->t0             = t0;
+    pending->latent_start   = latent_start;
+    return pending;
+}
+
+static bool upscale_video_outputs(sd_ctx_t* sd_ctx, sd_video_latents_t* pending) {
+    if (pending->latent_upscale_enabled) {
         if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
             LOG_ERROR("cancelling generation before latent upscale");
             return false;
         }
         int64_t upscale_start             = ggml_time_ms();
         sd::Tensor<float> upscaled_latent = upscale_ltx_spatial_video_latent(sd_ctx,
-                                                                             request.hires.model_path,
-                                                                             final_latent,
-                                                                             latents.audio_length);
+                                                                             pending->request.hires.model_path,
+                                                                             pending->final_latent,
+                                                                             pending->latents.audio_length);
         int64_t upscale_end               = ggml_time_ms();
         if (upscaled_latent.empty()) {
             return false;
         }
         LOG_INFO("LTX latent spatial upscale completed, taking %.2fs",
                  (upscale_end - upscale_start) * 1.0f / 1000);
+        pending->upscaled_latent = std::move(upscaled_latent);
+    }
+    return true;
+}
+
+// The refinement pass after a latent upscale, then the decode.
+static bool finish_video_outputs(sd_ctx_t* sd_ctx,
+                                 sd_video_latents_t* pending,
+                                 sd_image_t** frames_out,
+                                 int* num_frames_out,
+                                 sd_audio_t** audio_out) {
+    if (frames_out != nullptr) {
+        *frames_out = nullptr;
+    }
+    if (num_frames_out != nullptr) {
+        *num_frames_out = 0;
+    }
+    if (audio_out != nullptr) {
+        *audio_out = nullptr;
+    }
+    const sd_vid_gen_params_t* sd_vid_gen_params = pending->params;
+    GenerationRequest& request                   = pending->request;
+    GenerationRequest& hires_request             = pending->hires_request;
+    SamplePlan& plan                             = pending->plan;
+    ImageGenerationLatents& latents              = pending->latents;
+    ImageGenerationEmbeds& embeds                = pending->embeds;
+    sd::Tensor<float>& final_latent              = pending->final_latent;
+    const bool latent_upscale_enabled            = pending->latent_upscale_enabled;
+    const auto& frame_interpolation              = pending->frame_interpolation;
+    const int output_frames                      = pending->output_frames;
+
+    // another generation may have sampled on this context since
+    sd_ctx->sd->vae_tiling_params = sd_vid_gen_params->vae_tiling_params;
+    sd_ctx->sd->set_flow_shift(sd_vid_gen_params->sample_params.flow_shift);
+    if (sd_ctx->sd->applied_lora_signature != pending->lora_signature) {
+        sd_ctx->sd->apply_loras(sd_vid_gen_params->loras, sd_vid_gen_params->lora_count);
+    }
+    sd_ctx->sd->rng->load_state(pending->rng_state);
+    if (sd_ctx->sd->sampler_rng != nullptr) {
+        sd_ctx->sd->sampler_rng->load_state(pending->sampler_rng_state);
+    }
 
-        x_t                        = std::move(upscaled_latent);
+    if (latent_upscale_enabled) {
+        sd::Tensor<float> x_t      = std::move(pending->upscaled_latent);
         hires_request.width        = static_cast<int>(x_t.shape()[0]) * hires_request.vae_scale_factor;
         hires_request.height       = static_cast<int>(x_t.shape()[1]) * hires_request.vae_scale_factor;
         int upscaled_latent_frames = static_cast<int>(x_t.shape()[2]);
@@ -5577,11 +9735,11 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                                                   &hires_video_positions)) {
             return false;
         }
-        noise = sd::Tensor<float>::randn_like(x_t, sd_ctx->sd->rng);
 
-        W                                   = hires_request.width / hires_request.vae_scale_factor;
-        H                                   = hires_request.height / hires_request.vae_scale_factor;
-        T                                   = static_cast<int>(x_t.shape()[2]);
+        sd::Tensor<float> noise             = sd::Tensor<float>::randn_like(x_t, sd_ctx->sd->rng);
+        int W                               = hires_request.width / hires_request.vae_scale_factor;
+        int H                               = hires_request.height / hires_request.vae_scale_factor;
+        int T                               = static_cast<int>(x_t.shape()[2]);
         sample_method_t hires_sample_method = plan.sample_method;
         int hires_scheduler_steps           = 0;
         std::vector<float> hires_sigma_sched =
@@ -5604,33 +9762,34 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                  hires_sigma_sched.size(),
                  request.hires.custom_sigmas_count > 0 ? ", custom_sigmas=true" : "");
 
-        sampling_start = ggml_time_ms();
-        final_latent   = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
-                                            true,
-                                            x_t,
-                                            std::move(noise),
-                                            embeds.cond,
-                                          hires_request.use_uncond ? embeds.uncond : SDCondition(),
-                                            embeds.img_uncond,
-                                            sd::Tensor<float>(),
-                                            0.f,
-                                            sd_vid_gen_params->sample_params.guidance,
-                                            hires_eta,
-                                            sd_vid_gen_params->sample_params.shifted_timestep,
-                                            hires_sample_method,
-                                            sd_ctx->sd->is_flow_denoiser(),
-                                            plan.extra_sample_args,
-                                            hires_sigma_sched,
-                                            std::vector<sd::Tensor<float>>{},
-                                            false,
-                                            hires_denoise_mask,
-                                            sd::Tensor<float>(),
-                                            hires_request.vace_strength,
-                                            latents.audio_length,
-                                            static_cast<float>(hires_request.fps),
-                                            hires_request.cache_params,
-                                            hires_video_positions);
-        sampling_end   = ggml_time_ms();
+        int64_t sampling_start = ggml_time_ms();
+        final_latent           = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
+                                                    true,
+                                                    x_t,
+                                                    std::move(noise),
+                                                    embeds.cond,
+                                                    hires_request.use_uncond ? embeds.uncond : SDCondition(),
+                                                    embeds.img_uncond,
+                                                    sd::Tensor<float>(),
+                                                    0.f,
+                                                    sd_vid_gen_params->sample_params.guidance,
+                                                    hires_eta,
+                                                    sd_vid_gen_params->sample_params.shifted_timestep,
+                                                    hires_sample_method,
+                                                    sd_ctx->sd->is_flow_denoiser(),
+                                                    plan.extra_sample_args,
+                                                    hires_sigma_sched,
+                                                    std::vector<sd::Tensor<float>>{},
+                                                    false,
+                                                    hires_denoise_mask,
+                                                    sd::Tensor<float>(),
+                                                    hires_request.vace_strength,
+                                                    latents.audio_length,
+                                                    static_cast<float>(hires_request.fps),
+                                                    hires_request.cache_params,
+                                                    hires_video_positions);
+        int64_t sampling_end   = ggml_time_ms();
+        sd_perf::add_phase_ms(sd_perf::Phase::SAMPLING, static_cast<double>(sampling_end - sampling_start));
         if (final_latent.empty()) {
             LOG_ERROR("sampling(latent upscale) failed after %.2fs",
                       (sampling_end - sampling_start) * 1.0f / 1000);
@@ -5640,10 +9799,38 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                  (sampling_end - sampling_start) * 1.0f / 1000);
     }
 
+    if (frame_interpolation.enabled()) {
+        request.frames = output_frames;
+        final_latent   = frame_interpolation.interpolate(final_latent,
+                                                         sd_ctx->sd->video_frames_to_latent_frames(output_frames));
+    }
+
     int64_t latent_end = ggml_time_ms();
-    LOG_INFO("generating latent video completed, taking %.2fs", (latent_end - latent_start) * 1.0f / 1000);
+    LOG_INFO("generating latent video completed, taking %.2fs", (latent_end - pending->latent_start) * 1.0f / 1000);
 
+    // The audio decode runs on a thread while the video decodes when the
+    // audio VAE has a backend of its own; the first streamed frames or the
+    // end of the video decode wait for it.
     sd_audio_t* generated_audio = nullptr;
+    bool audio_ready            = true;
+    std::future<sd::Tensor<float>> pending_waveform;
+    int64_t audio_latent_decode_start = 0;
+    auto finish_audio                 = [&](sd::Tensor<float> waveform) {
+        audio_ready = true;
+        if (!waveform.empty()) {
+            generated_audio = waveform_to_sd_audio(sd_ctx->sd, waveform);
+        } else {
+            LOG_WARN("LTX audio latent decode failed; continuing with silent video output");
+        }
+        int64_t audio_latent_decode_end = ggml_time_ms();
+        LOG_INFO("decoding audio latent completed, taking %.2fs", (audio_latent_decode_end - audio_latent_decode_start) * 1.0f / 1000);
+    };
+    auto get_audio = [&]() -> sd_audio_t* {
+        if (!audio_ready) {
+            finish_audio(pending_waveform.get());
+        }
+        return generated_audio;
+    };
     if (sd_version_is_ltxav(sd_ctx->sd->version) &&
         latents.audio_length > 0 &&
         sd_ctx->sd->audio_vae_model != nullptr) {
@@ -5651,7 +9838,7 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
             LOG_ERROR("cancelling generation before audio decode");
             return false;
         }
-        int64_t audio_latent_decode_start = ggml_time_ms();
+        audio_latent_decode_start = ggml_time_ms();
 
         auto audio_latent = unpack_ltxav_audio_latent(final_latent,
                                                       latents.audio_length,
@@ -5662,15 +9849,17 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
                       (int)audio_latent.shape()[1],
                       (int)audio_latent.shape()[2],
                       (int)audio_latent.shape()[3]);
-            auto waveform = sd_ctx->sd->decode_ltx_audio_latent(audio_latent);
-            if (!waveform.empty()) {
-                generated_audio = waveform_to_sd_audio(sd_ctx->sd, waveform);
+            if (sd_ctx->sd->audio_vae_can_run_beside_vae()) {
+                LOG_DEBUG("decoding audio while the video decodes");
+                audio_ready      = false;
+                pending_waveform = std::async(std::launch::async, [sd_ctx, audio_latent = std::move(audio_latent), thread_callbacks = sd_current_thread_callbacks()]() {
+                    ScopedThreadCallbacks callback_scope(thread_callbacks);
+                    return sd_ctx->sd->decode_ltx_audio_latent(audio_latent);
+                });
             } else {
-                LOG_WARN("LTX audio latent decode failed; continuing with silent video output");
+                finish_audio(sd_ctx->sd->decode_ltx_audio_latent(audio_latent));
             }
         }
-        int64_t audio_latent_decode_end = ggml_time_ms();
-        LOG_INFO("decoding audio latent completed, taking %.2fs", (audio_latent_decode_end - audio_latent_decode_start) * 1.0f / 1000);
     }
 
     if (latents.video_conditioning_frame_count > 0) {
@@ -5685,19 +9874,30 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
 
     if (sd_ctx->sd->get_cancel_flag() == SD_CANCEL_ALL) {
         LOG_ERROR("cancelling generation before video decode");
-        free_sd_audio(generated_audio);
+        free_sd_audio(get_audio());
         return false;
     }
-    auto result = decode_video_outputs(sd_ctx, latent_upscale_enabled ? hires_request : request, final_latent, num_frames_out);
-    if (result == nullptr) {
-        free_sd_audio(generated_audio);
-        return false;
+    sd_image_t* result                  = nullptr;
+    const GenerationRequest& out_request = latent_upscale_enabled ? hires_request : request;
+    if (sd_vid_gen_params->frames_cb != nullptr) {
+        if (!stream_video_outputs(sd_ctx, out_request, final_latent, sd_vid_gen_params, get_audio, num_frames_out)) {
+            free_sd_audio(get_audio());
+            return false;
+        }
+    } else {
+        result = decode_video_outputs(sd_ctx, out_request, final_latent, num_frames_out);
+        if (result == nullptr) {
+            free_sd_audio(get_audio());
+            return false;
+        }
     }
+    get_audio();
 
     sd_ctx->sd->lora_stat();
 
     int64_t t1 = ggml_time_ms();
-    LOG_INFO("generate_video completed in %.2fs", (t1 - t0) * 1.0f / 1000);
+    LOG_INFO("generate_video completed in %.2fs", (t1 - pending->t0) * 1.0f / 1000);
+    sd_ctx->sd->perf_recorder.total_ms = static_cast<double>(t1 - pending->t0);
     if (frames_out != nullptr) {
         *frames_out = result;
     }
@@ -5709,6 +9909,607 @@ SD_API bool generate_video(sd_ctx_t* sd_ctx,
     return true;
 }
 
+// generate_video without clearing the cancel flag, see run_image_generation
+static bool run_video_generation(sd_ctx_t* sd_ctx,
+                                 const sd_vid_gen_params_t* sd_vid_gen_params,
+                                 sd_image_t** frames_out,
+                                 int* num_frames_out,
+                                 sd_audio_t** audio_out) {
+    if (frames_out != nullptr) {
+        *frames_out = nullptr;
+    }
+    if (num_frames_out != nullptr) {
+        *num_frames_out = 0;
+    }
+    if (audio_out != nullptr) {
+        *audio_out = nullptr;
+    }
+
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_ctx->sd->perf_recorder.reset();
+    sd_perf::ScopedPerfRecorder perf_scope(&sd_ctx->sd->perf_recorder);
+    MemoryTraceOnExit memory_trace(sd_vid_gen_params->sample_params.extra_sample_args);
+
+    std::unique_ptr<sd_video_latents_t> pending = sample_video_outputs(sd_ctx, sd_vid_gen_params);
+    return pending != nullptr &&
+           upscale_video_outputs(sd_ctx, pending.get()) &&
+           finish_video_outputs(sd_ctx, pending.get(), frames_out, num_frames_out, audio_out);
+}
+
+SD_API bool generate_video(sd_ctx_t* sd_ctx,
+                           const sd_vid_gen_params_t* sd_vid_gen_params,
+                           sd_image_t** frames_out,
+                           int* num_frames_out,
+                           sd_audio_t** audio_out) {
+    if (sd_ctx == nullptr || sd_vid_gen_params == nullptr) {
+        return false;
+    }
+    sd_ctx->sd->reset_cancel_flag();
+    return run_video_generation(sd_ctx, sd_vid_gen_params, frames_out, num_frames_out, audio_out);
+}
+
+SD_API bool sd_ctx_can_overlap_latent_upscale(sd_ctx_t* sd_ctx) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || !sd_version_is_ltxav(sd_ctx->sd->version)) {
+        return false;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    return sd_ctx->sd->ensure_backend_pair(SDBackendModule::UPSCALER) && ltx_upscaler_has_own_backend(sd_ctx->sd);
+}
+
+SD_API sd_video_latents_t* sample_video_latents(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params) {
+    if (sd_ctx == nullptr || sd_vid_gen_params == nullptr) {
+        return nullptr;
+    }
+
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_ctx->sd->reset_cancel_flag();
+    sd_ctx->sd->perf_recorder.reset();
+    sd_perf::ScopedPerfRecorder perf_scope(&sd_ctx->sd->perf_recorder);
+    MemoryTraceOnExit memory_trace(sd_vid_gen_params->sample_params.extra_sample_args);
+    return sample_video_outputs(sd_ctx, sd_vid_gen_params).release();
+}
+
+SD_API bool upscale_video_latents(sd_ctx_t* sd_ctx, sd_video_latents_t* latents) {
+    if (sd_ctx == nullptr || latents == nullptr) {
+        return false;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    return upscale_video_outputs(sd_ctx, latents);
+}
+
+SD_API bool finish_video_latents(sd_ctx_t* sd_ctx,
+                                 sd_video_latents_t* latents,
+                                 sd_image_t** frames_out,
+                                 int* num_frames_out,
+                                 sd_audio_t** audio_out) {
+    if (sd_ctx == nullptr || latents == nullptr) {
+        return false;
+    }
+    ScopedThreadCallbacks callback_scope(&sd_ctx->sd->callbacks);
+    sd_perf::ScopedPerfRecorder perf_scope(&sd_ctx->sd->perf_recorder);
+    return finish_video_outputs(sd_ctx, latents, frames_out, num_frames_out, audio_out);
+}
+
+SD_API void free_sd_video_latents(sd_video_latents_t* latents) {
+    delete latents;
+}
+
+struct sd_generation_t {
+    sd_ctx_t* sd_ctx                = nullptr;
+    sd_generation_done_cb_t on_done = nullptr;
+    void* data                      = nullptr;
+    uint64_t queue_id               = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    sd_generation_state_t state = SD_GENERATION_QUEUED;
+    bool cancel_requested       = false;  // while running
+    bool finished               = false;  // on_done returned
+
+    sd_image_t* images = nullptr;
+    int num_images     = 0;
+    sd_audio_t* audio  = nullptr;
+};
+
+static void finish_generation(sd_generation_t* generation, sd_generation_state_t state) {
+    {
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        generation->state = state;
+    }
+    if (generation->on_done != nullptr) {
+        generation->on_done(generation, generation->data);
+    }
+    {
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        generation->finished = true;
+    }
+    generation->cv.notify_all();
+}
+
+// run fills in the results on the context's generation thread, with the
+// submitting thread's callback data, and returns whether it succeeded.
+static sd_generation_t* submit_generation(sd_ctx_t* sd_ctx,
+                                          sd_generation_done_cb_t on_done,
+                                          void* data,
+                                          std::function<bool(sd_generation_t*)> run) {
+    sd_generation_t* generation = new sd_generation_t();
+    generation->sd_ctx          = sd_ctx;
+    generation->on_done         = on_done;
+    generation->data            = data;
+
+    SDThreadCallbacks submitter = sd_current_thread_callbacks();
+    auto job                    = [generation, submitter, run = std::move(run)](bool started) {
+        sd_generation_state_t state = SD_GENERATION_CANCELLED;
+        {
+            std::lock_guard<std::mutex> lock(generation->mutex);
+            // a generation cancelled after the queue handed it out is still
+            // finished here
+            if (started && generation->state == SD_GENERATION_QUEUED) {
+                generation->sd_ctx->sd->reset_cancel_flag();
+                generation->state = SD_GENERATION_RUNNING;
+                state             = SD_GENERATION_RUNNING;
+            }
+        }
+        if (state == SD_GENERATION_RUNNING) {
+            ScopedThreadCallbacks callback_scope(submitter);
+            if (run(generation)) {
+                state = SD_GENERATION_DONE;
+            } else {
+                std::lock_guard<std::mutex> lock(generation->mutex);
+                state = generation->cancel_requested ? SD_GENERATION_CANCELLED : SD_GENERATION_FAILED;
+            }
+        }
+        finish_generation(generation, state);
+    };
+
+    uint64_t queue_id = 0;
+    {
+        // held until queue_id is set, so a cancel cannot miss it
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        queue_id             = sd_ctx->sd->generation_queue.submit(std::move(job));
+        generation->queue_id = queue_id;
+    }
+    if (queue_id == 0) {
+        delete generation;
+        return nullptr;
+    }
+    return generation;
+}
+
+SD_API sd_generation_t* sd_generate_image_async(sd_ctx_t* sd_ctx,
+                                                const sd_img_gen_params_t* sd_img_gen_params,
+                                                sd_generation_done_cb_t on_done,
+                                                void* data) {
+    if (sd_ctx == nullptr || sd_img_gen_params == nullptr) {
+        return nullptr;
+    }
+    return submit_generation(sd_ctx, on_done, data, [sd_img_gen_params](sd_generation_t* generation) {
+        generation->images     = run_image_generation(generation->sd_ctx, sd_img_gen_params);
+        generation->num_images = generation->images != nullptr ? sd_img_gen_params->batch_count : 0;
+        return generation->images != nullptr;
+    });
+}
+
+SD_API sd_generation_t* sd_generate_video_async(sd_ctx_t* sd_ctx,
+                                                const sd_vid_gen_params_t* sd_vid_gen_params,
+                                                sd_generation_done_cb_t on_done,
+                                                void* data) {
+    if (sd_ctx == nullptr || sd_vid_gen_params == nullptr) {
+        return nullptr;
+    }
+    return submit_generation(sd_ctx, on_done, data, [sd_vid_gen_params](sd_generation_t* generation) {
+        return run_video_generation(generation->sd_ctx,
+                                    sd_vid_gen_params,
+                                    &generation->images,
+                                    &generation->num_images,
+                                    &generation->audio);
+    });
+}
+
+SD_API enum sd_generation_state_t sd_generation_get_state(sd_generation_t* generation) {
+    if (generation == nullptr) {
+        return SD_GENERATION_FAILED;
+    }
+    std::lock_guard<std::mutex> lock(generation->mutex);
+    return generation->state;
+}
+
+SD_API bool sd_generation_wait(sd_generation_t* generation, int timeout_ms) {
+    if (generation == nullptr) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(generation->mutex);
+    auto finished = [generation] { return generation->finished; };
+    if (timeout_ms < 0) {
+        generation->cv.wait(lock, finished);
+        return true;
+    }
+    return generation->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished);
+}
+
+SD_API void sd_generation_cancel(sd_generation_t* generation, enum sd_cancel_mode_t mode) {
+    if (generation == nullptr) {
+        return;
+    }
+    bool dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        if (generation->state == SD_GENERATION_QUEUED && mode != SD_CANCEL_RESET) {
+            dropped           = generation->sd_ctx->sd->generation_queue.remove(generation->queue_id);
+            generation->state = SD_GENERATION_CANCELLED;
+        } else if (generation->state == SD_GENERATION_RUNNING) {
+            generation->cancel_requested = mode != SD_CANCEL_RESET;
+            sd_cancel_generation(generation->sd_ctx, mode);
+        }
+    }
+    if (dropped) {
+        finish_generation(generation, SD_GENERATION_CANCELLED);
+    }
+}
+
+SD_API sd_image_t* sd_generation_take_images(sd_generation_t* generation, int* num_images) {
+    if (num_images != nullptr) {
+        *num_images = 0;
+    }
+    if (generation == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(generation->mutex);
+    if (generation->state != SD_GENERATION_DONE) {
+        return nullptr;
+    }
+    sd_image_t* images = generation->images;
+    if (num_images != nullptr) {
+        *num_images = generation->num_images;
+    }
+    generation->images     = nullptr;
+    generation->num_images = 0;
+    return images;
+}
+
+SD_API sd_audio_t* sd_generation_take_audio(sd_generation_t* generation) {
+    if (generation == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(generation->mutex);
+    if (generation->state != SD_GENERATION_DONE) {
+        return nullptr;
+    }
+    sd_audio_t* audio = generation->audio;
+    generation->audio = nullptr;
+    return audio;
+}
+
+SD_API void sd_free_generation(sd_generation_t* generation) {
+    if (generation == nullptr) {
+        return;
+    }
+    sd_generation_cancel(generation, SD_CANCEL_ALL);
+    sd_generation_wait(generation, -1);
+    free_sd_images(generation->images, generation->num_images);
+    free_sd_audio(generation->audio);
+    delete generation;
+}
+
+// The first step of a sampling pass: a memory probe sees every graph the pass
+// builds in it.
+static std::vector<float> probe_sigmas(const std::vector<float>& sigmas) {
+    return std::vector<float>(sigmas.begin(), sigmas.begin() + std::min<size_t>(sigmas.size(), 2));
+}
+
+// sample_image_outputs and decode_image_outputs with one step per sampling
+// pass and a single latent to decode.
+static bool probe_image_generation(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params) {
+    sd_ctx->sd->vae_tiling_params = sd_img_gen_params->vae_tiling_params;
+    GenerationRequest request(sd_ctx, sd_img_gen_params);
+    sd_ctx->sd->set_flow_shift(sd_img_gen_params->sample_params.flow_shift);
+    ImageVaeAxesGuard axes_guard(sd_ctx, sd_img_gen_params, request);
+
+    SamplePlan plan(sd_ctx, sd_img_gen_params, request);
+    auto latents_opt = prepare_image_generation_latents(sd_ctx, sd_img_gen_params, &request, &plan);
+    if (!latents_opt.has_value()) {
+        return false;
+    }
+    ImageGenerationLatents latents = std::move(*latents_opt);
+    auto embeds_opt                = prepare_image_generation_embeds(sd_ctx, sd_img_gen_params, &request, &plan, &latents);
+    if (!embeds_opt.has_value()) {
+        return false;
+    }
+    ImageGenerationEmbeds embeds = std::move(*embeds_opt);
+
+    int latent_batch_size = std::min(request.latent_batch_size, request.batch_count);
+    if (latent_batch_size > 1 &&
+        (request.guidance.slg.layer_count > 0 ||
+         !can_cache_latent_batch(sd_img_gen_params, request.cache_params) ||
+         !sd_ctx->sd->can_batch_conditions(sd_ctx->sd->diffusion_model,
+                                           embeds.cond,
+                                           embeds.uncond,
+                                           embeds.img_uncond,
+                                           latents.control_image,
+                                           latents.ref_latents,
+                                           request.cache_params))) {
+        latent_batch_size = 1;
+    }
+    sd::Tensor<float> init_latent = latents.init_latent;
+    for (int i = 1; i < latent_batch_size; i++) {
+        init_latent = sd::ops::concat(init_latent, latents.init_latent, 3);
+    }
+    sd::Tensor<float> x_0 = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
+                                               true,
+                                               init_latent,
+                                               sd::Tensor<float>::zeros_like(init_latent),
+                                               embeds.cond,
+                                               embeds.uncond,
+                                               embeds.img_uncond,
+                                               latents.control_image,
+                                               request.control_strength,
+                                               request.guidance,
+                                               plan.eta,
+                                               request.shifted_timestep,
+                                               plan.sample_method,
+                                               sd_ctx->sd->is_flow_denoiser(),
+                                               plan.extra_sample_args,
+                                               probe_sigmas(plan.sigmas),
+                                               latents.ref_latents,
+                                               request.increase_ref_index,
+                                               latents.denoise_mask,
+                                               sd::Tensor<float>(),
+                                               1.f,
+                                               0,
+                                               static_cast<float>(request.fps),
+                                               request.cache_params);
+    if (x_0.empty()) {
+        return false;
+    }
+    sd::Tensor<float> latent = latent_batch_size > 1 ? sd::ops::chunk(x_0, latent_batch_size, 3)[0] : std::move(x_0);
+
+    if (request.hires.enabled && request.hires.target_width > 0) {
+        // the upscaler only sets the latent's values
+        sd::Tensor<float> upscaled = sd_ctx->sd->generate_init_latent(request.hires.target_width, request.hires.target_height);
+        sd::Tensor<float> hires_denoise_mask;
+        if (!latents.denoise_mask.empty()) {
+            std::vector<int64_t> mask_shape = latents.denoise_mask.shape();
+            mask_shape[0]                   = upscaled.shape()[0];
+            mask_shape[1]                   = upscaled.shape()[1];
+            hires_denoise_mask              = sd::ops::interpolate(latents.denoise_mask,
+                                                                   mask_shape,
+                                                                   sd::ops::InterpolateMode::NearestMax);
+        }
+        int hires_scheduler_steps = 0;
+        std::vector<float> hires_sigma_sched =
+            make_hires_sigma_schedule(sd_ctx,
+                                      request.hires,
+                                      sd_img_gen_params->sample_params,
+                                      plan.sample_method,
+                                      plan.sample_steps,
+                                      sd_ctx->sd->get_image_seq_len(request.hires.target_height, request.hires.target_width),
+                                      &hires_scheduler_steps);
+        latent = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
+                                    true,
+                                    upscaled,
+                                    sd::Tensor<float>::zeros_like(upscaled),
+                                    embeds.cond,
+                                    embeds.uncond,
+                                    embeds.img_uncond,
+                                    latents.control_image,
+                                    request.control_strength,
+                                    request.guidance,
+                                    plan.eta,
+                                    request.shifted_timestep,
+                                    plan.sample_method,
+                                    sd_ctx->sd->is_flow_denoiser(),
+                                    plan.extra_sample_args,
+                                    probe_sigmas(hires_sigma_sched),
+                                    latents.ref_latents,
+                                    request.increase_ref_index,
+                                    hires_denoise_mask,
+                                    sd::Tensor<float>(),
+                                    1.f,
+                                    0,
+                                    static_cast<float>(request.fps),
+                                    request.cache_params);
+        if (latent.empty()) {
+            return false;
+        }
+    }
+
+    return !sd_ctx->sd->decode_first_stage(latent).empty();
+}
+
+// generate_video with one step per sampling pass, without the LTX latent
+// upscale.
+static bool probe_video_generation(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params) {
+    sd_ctx->sd->vae_tiling_params = sd_vid_gen_params->vae_tiling_params;
+    GenerationRequest request(sd_ctx, sd_vid_gen_params);
+    sd_ctx->sd->set_flow_shift(sd_vid_gen_params->sample_params.flow_shift);
+    sd_ctx->sd->reset_generation_extensions();
+
+    SamplePlan plan(sd_ctx, sd_vid_gen_params, request);
+    auto latents_opt = prepare_video_generation_latents(sd_ctx, sd_vid_gen_params, &request);
+    if (!latents_opt.has_value()) {
+        return false;
+    }
+    ImageGenerationLatents latents = std::move(*latents_opt);
+    ImageGenerationEmbeds embeds   = prepare_video_generation_embeds(sd_ctx, request, latents, nullptr);
+
+    sd::Tensor<float> x_t   = latents.init_latent;
+    sd::Tensor<float> noise = sd::Tensor<float>::zeros_like(x_t);
+    if (plan.high_noise_sample_steps > 0) {
+        x_t = sd_ctx->sd->sample(sd_ctx->sd->high_noise_diffusion_model,
+                                 false,
+                                 x_t,
+                                 std::move(noise),
+                                 embeds.cond,
+                                 request.use_high_noise_uncond ? embeds.uncond : SDCondition(),
+                                 embeds.img_uncond,
+                                 sd::Tensor<float>(),
+                                 0.f,
+                                 request.high_noise_guidance,
+                                 plan.high_noise_eta,
+                                 request.shifted_timestep,
+                                 plan.high_noise_sample_method,
+                                 sd_ctx->sd->is_flow_denoiser(),
+                                 plan.high_noise_extra_sample_args,
+                                 probe_sigmas(plan.sigmas),
+                                 std::vector<sd::Tensor<float>>{},
+                                 false,
+                                 latents.denoise_mask,
+                                 latents.vace_context,
+                                 request.vace_strength,
+                                 latents.audio_length,
+                                 static_cast<float>(request.fps),
+                                 request.cache_params,
+                                 latents.video_positions);
+        if (x_t.empty()) {
+            return false;
+        }
+        plan.sigmas = std::vector<float>(plan.sigmas.begin() + plan.high_noise_sample_steps, plan.sigmas.end());
+        noise       = {};
+    }
+
+    sd::Tensor<float> final_latent = sd_ctx->sd->sample(sd_ctx->sd->diffusion_model,
+                                                        true,
+                                                        x_t,
+                                                        std::move(noise),
+                                                        embeds.cond,
+                                                        request.use_uncond ? embeds.uncond : SDCondition(),
+                                                        embeds.img_uncond,
+                                                        sd::Tensor<float>(),
+                                                        0.f,
+                                                        sd_vid_gen_params->sample_params.guidance,
+                                                        plan.eta,
+                                                        sd_vid_gen_params->sample_params.shifted_timestep,
+                                                        plan.sample_method,
+                                                        sd_ctx->sd->is_flow_denoiser(),
+                                                        plan.extra_sample_args,
+                                                        probe_sigmas(plan.sigmas),
+                                                        std::vector<sd::Tensor<float>>{},
+                                                        false,
+                                                        latents.denoise_mask,
+                                                        latents.vace_context,
+                                                        request.vace_strength,
+                                                        latents.audio_length,
+                                                        static_cast<float>(request.fps),
+                                                        request.cache_params,
+                                                        latents.video_positions);
+    if (final_latent.empty()) {
+        return false;
+    }
+
+    if (sd_version_is_ltxav(sd_ctx->sd->version) &&
+        latents.audio_length > 0 &&
+        sd_ctx->sd->audio_vae_model != nullptr) {
+        auto audio_latent = unpack_ltxav_audio_latent(final_latent,
+                                                      latents.audio_length,
+                                                      sd_ctx->sd->get_latent_channel());
+        if (!audio_latent.empty()) {
+            sd_ctx->sd->decode_ltx_audio_latent(audio_latent);
+        }
+    }
+    if (latents.video_conditioning_frame_count > 0) {
+        int64_t target_frames = latents.video_target_frame_count > 0 ? latents.video_target_frame_count
+                                                                     : final_latent.shape()[2] - latents.video_conditioning_frame_count;
+        final_latent          = sd::ops::slice(final_latent, 2, 0, target_frames);
+    }
+    if (latents.ref_image_num > 0) {
+        final_latent = sd::ops::slice(final_latent, 2, latents.ref_image_num, final_latent.shape()[2]);
+    }
+    sd::Tensor<float> video_latent = video_latent_to_decode(sd_ctx, final_latent);
+    return !video_latent.empty() && !sd_ctx->sd->decode_first_stage(video_latent, true).empty();
+}
+
+template <typename Fn>
+static bool run_memory_probe(sd_ctx_t* sd_ctx, Fn&& probe_generation, sd_memory_estimate_t* estimate) {
+    StableDiffusionGGML* sd                    = sd_ctx->sd;
+    const sd_tiling_params_t vae_tiling_params = sd->vae_tiling_params;
+    ScopedThreadCallbacks callback_scope(&sd->callbacks);
+    sd->memory_probe.reset();
+
+    int64_t t0 = ggml_time_ms();
+    bool ok    = false;
+    {
+        sd_perf::ScopedMemoryProbe probe_scope(&sd->memory_probe);
+        ok = probe_generation();
+    }
+    sd->vae_tiling_params = vae_tiling_params;
+    if (!ok) {
+        LOG_ERROR("memory estimate failed");
+        return false;
+    }
+    sd->memory_probe.export_estimate(estimate);
+    LOG_DEBUG("memory estimate: %.2f MB params, %.2f MB peak compute buffer, taking %.2fs",
+              estimate->params_bytes / 1024.0 / 1024.0,
+              estimate->peak_compute_buffer_bytes / 1024.0 / 1024.0,
+              (ggml_time_ms() - t0) * 1.0f / 1000);
+    return true;
+}
+
+SD_API bool sd_estimate_memory(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_gen_params, sd_memory_estimate_t* estimate) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_img_gen_params == nullptr || estimate == nullptr) {
+        return false;
+    }
+    // applying LoRAs and encoding identities would change state the next
+    // generation reuses
+    sd_img_gen_params_t params = *sd_img_gen_params;
+    params.loras               = nullptr;
+    params.lora_count          = 0;
+    params.pm_params           = {};
+    params.pulid_params        = {};
+    sd_cache_params_init(&params.cache);
+    return run_memory_probe(sd_ctx, [&]() { return probe_image_generation(sd_ctx, &params); }, estimate);
+}
+
+SD_API bool sd_estimate_video_memory(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* sd_vid_gen_params, sd_memory_estimate_t* estimate) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || sd_vid_gen_params == nullptr || estimate == nullptr) {
+        return false;
+    }
+    sd_vid_gen_params_t params = *sd_vid_gen_params;
+    params.loras               = nullptr;
+    params.lora_count          = 0;
+    sd_cache_params_init(&params.cache);
+    return run_memory_probe(sd_ctx, [&]() { return probe_video_generation(sd_ctx, &params); }, estimate);
+}
+
+SD_API bool sd_warmup(sd_ctx_t* sd_ctx, int width, int height) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || width <= 0 || height <= 0) {
+        return false;
+    }
+    int64_t t0 = ggml_time_ms();
+    bool ok    = false;
+    if (sd_ctx_supports_image_generation(sd_ctx)) {
+        sd_img_gen_params_t params;
+        sd_img_gen_params_init(&params);
+        params.prompt                     = "warmup";
+        params.width                      = width;
+        params.height                     = height;
+        params.seed                       = 42;
+        params.sample_params.sample_steps = 1;
+        sd_image_t* images                = generate_image(sd_ctx, &params);
+        ok                                = images != nullptr;
+        free_sd_images(images, params.batch_count);
+    } else if (sd_ctx_supports_video_generation(sd_ctx)) {
+        sd_vid_gen_params_t params;
+        sd_vid_gen_params_init(&params);
+        params.prompt                     = "warmup";
+        params.width                      = width;
+        params.height                     = height;
+        params.seed                       = 42;
+        params.video_frames               = 1;
+        params.sample_params.sample_steps = 2;
+        sd_image_t* frames                = nullptr;
+        int num_frames                    = 0;
+        ok                                = generate_video(sd_ctx, &params, &frames, &num_frames, nullptr);
+        free_sd_images(frames, num_frames);
+    }
+    if (!ok) {
+        LOG_WARN("warm-up at %dx%d failed", width, height);
+        return false;
+    }
+    int64_t t1 = ggml_time_ms();
+    LOG_INFO("warm-up at %dx%d completed, taking %.2fs", width, height, (t1 - t0) * 1.0f / 1000);
+    return true;
+}
+
 SD_API void free_sd_images(sd_image_t* result_images, int num_images) {
     if (result_images == nullptr) {
         return;
@@ -1,10 +1,15 @@
 #include "bpe_tokenizer.h"
 
 #include <algorithm>
+#include <climits>
+#include <queue>
 #include <sstream>
 
 #include "core/util.h"
+#include "ggml.h"
+#include "json.hpp"
 #include "tokenize_util.h"
+#include "vocab/vocab.h"
 
 std::vector<std::pair<int, std::u32string>> BPETokenizer::bytes_to_unicode() {
     std::vector<std::pair<int, std::u32string>> byte_unicode_pairs;
@@ -47,95 +52,169 @@ std::vector<std::u32string> BPETokenizer::split_utf32(const std::string& text, c
     return result;
 }
 
-static std::set<std::pair<std::u32string, std::u32string>> get_pairs(const std::vector<std::u32string>& subwords) {
-    std::set<std::pair<std::u32string, std::u32string>> pairs;
-    if (subwords.empty()) {
-        return pairs;
+std::vector<std::pair<std::string, int>> BPETokenizer::read_vocab(const std::string& vocab_str) {
+    std::vector<std::pair<std::string, int>> vocab;
+    if (read_bpe_vocab_blob(vocab_str, &vocab)) {
+        return vocab;
     }
+    vocab.clear();
 
-    std::u32string prev_subword = subwords[0];
-    for (int i = 1; i < static_cast<int>(subwords.size()); i++) {
-        std::u32string subword = subwords[i];
-        std::pair<std::u32string, std::u32string> pair(prev_subword, subword);
-        pairs.insert(pair);
-        prev_subword = subword;
+    nlohmann::json vocab_json;
+    try {
+        vocab_json = nlohmann::json::parse(vocab_str);
+    } catch (const nlohmann::json::parse_error&) {
+        GGML_ABORT("invalid vocab json str");
     }
-    return pairs;
+    for (const auto& [key, value] : vocab_json.items()) {
+        vocab.emplace_back(key, value.get<int>());
+    }
+    return vocab;
 }
 
-std::vector<std::u32string> BPETokenizer::bpe(const std::u32string& token) const {
-    std::vector<std::u32string> word;
+static uint64_t pack_symbol_pair(int left, int right) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(left)) << 32) | static_cast<uint32_t>(right);
+}
 
-    for (int i = 0; i < static_cast<int>(token.size()) - 1; i++) {
-        word.emplace_back(1, token[i]);
+int BPETokenizer::intern_symbol(const std::u32string& symbol) {
+    auto it = symbol_ids.find(symbol);
+    if (it != symbol_ids.end()) {
+        return it->second;
     }
-    word.push_back(token.substr(token.size() - 1) + utf8_to_utf32(end_of_word_suffix));
-
-    std::set<std::pair<std::u32string, std::u32string>> pairs = get_pairs(word);
+    int id = static_cast<int>(symbols.size());
+    symbols.push_back(symbol);
+    symbol_ids.emplace(symbol, id);
+    return id;
+}
 
-    if (pairs.empty()) {
-        return {token + utf8_to_utf32(end_of_word_suffix)};
+void BPETokenizer::build_merge_table() {
+    merge_table.reserve(bpe_ranks.size());
+    for (const auto& [pair, rank] : bpe_ranks) {
+        int left                                   = intern_symbol(pair.first);
+        int right                                  = intern_symbol(pair.second);
+        int merged                                 = intern_symbol(pair.first + pair.second);
+        merge_table[pack_symbol_pair(left, right)] = {rank, merged};
     }
+    decltype(bpe_ranks)().swap(bpe_ranks);
+}
 
-    while (true) {
-        auto min_pair_iter = std::min_element(pairs.begin(),
-                                              pairs.end(),
-                                              [&](const std::pair<std::u32string, std::u32string>& a,
-                                                  const std::pair<std::u32string, std::u32string>& b) {
-                                                  if (bpe_ranks.find(a) == bpe_ranks.end()) {
-                                                      return false;
-                                                  } else if (bpe_ranks.find(b) == bpe_ranks.end()) {
-                                                      return true;
-                                                  }
-                                                  return bpe_ranks.at(a) < bpe_ranks.at(b);
-                                              });
-
-        const std::pair<std::u32string, std::u32string>& bigram = *min_pair_iter;
+std::vector<std::u32string> BPETokenizer::bpe(const std::u32string& token) const {
+    if (token.empty()) {
+        return {};
+    }
 
-        if (bpe_ranks.find(bigram) == bpe_ranks.end()) {
-            break;
+    // Symbols of the word as a linked list over their start positions. Ids
+    // below zero are characters no merge knows about, kept in unknown.
+    const int dead_id = INT_MIN;
+    std::vector<std::u32string> unknown;
+    auto symbol_id = [&](const std::u32string& symbol) {
+        auto it = symbol_ids.find(symbol);
+        if (it != symbol_ids.end()) {
+            return it->second;
         }
+        unknown.push_back(symbol);
+        return -static_cast<int>(unknown.size());
+    };
 
-        std::u32string first  = bigram.first;
-        std::u32string second = bigram.second;
-        std::vector<std::u32string> new_word;
-        int32_t i = 0;
+    const int n = static_cast<int>(token.size());
+    std::vector<int> ids(n);
+    std::vector<int> prev(n);
+    std::vector<int> next(n);
+    for (int i = 0; i < n; i++) {
+        std::u32string symbol(1, token[i]);
+        if (i == n - 1) {
+            symbol += utf8_to_utf32(end_of_word_suffix);
+        }
+        ids[i]  = symbol_id(symbol);
+        prev[i] = i - 1;
+        next[i] = i + 1 < n ? i + 1 : -1;
+    }
 
-        while (i < static_cast<int32_t>(word.size())) {
-            auto it = std::find(word.begin() + i, word.end(), first);
-            if (it == word.end()) {
-                new_word.insert(new_word.end(), word.begin() + i, word.end());
-                break;
-            }
-            new_word.insert(new_word.end(), word.begin() + i, it);
-            i = static_cast<int32_t>(std::distance(word.begin(), it));
+    // Lowest rank first, leftmost first among equal ranks, which merges
+    // every occurrence of a pair left to right like the reference loop.
+    struct Candidate {
+        int rank;
+        int left;
+        int left_id;
+        int right_id;
+        int merged;
 
-            if (word[i] == first && i < static_cast<int32_t>(word.size()) - 1 && word[i + 1] == second) {
-                new_word.push_back(first + second);
-                i += 2;
-            } else {
-                new_word.push_back(word[i]);
-                i += 1;
-            }
+        bool operator>(const Candidate& other) const {
+            return rank != other.rank ? rank > other.rank : left > other.left;
         }
+    };
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+    auto push_pair = [&](int left) {
+        int right = left >= 0 ? next[left] : -1;
+        if (right < 0 || ids[left] < 0 || ids[right] < 0) {
+            return;
+        }
+        auto it = merge_table.find(pack_symbol_pair(ids[left], ids[right]));
+        if (it != merge_table.end()) {
+            queue.push({it->second.rank, left, ids[left], ids[right], it->second.merged});
+        }
+    };
+    for (int i = 0; i < n - 1; i++) {
+        push_pair(i);
+    }
 
-        word = new_word;
-
-        if (word.size() == 1) {
-            break;
+    while (!queue.empty()) {
+        Candidate candidate = queue.top();
+        queue.pop();
+        int left  = candidate.left;
+        int right = next[left];
+        if (ids[left] != candidate.left_id || right < 0 || ids[right] != candidate.right_id) {
+            continue;
+        }
+        ids[left]  = candidate.merged;
+        ids[right] = dead_id;
+        next[left] = next[right];
+        if (next[left] >= 0) {
+            prev[next[left]] = left;
         }
-        pairs = get_pairs(word);
+        push_pair(prev[left]);
+        push_pair(left);
     }
 
+    std::vector<std::u32string> word;
+    for (int i = 0; i >= 0; i = next[i]) {
+        word.push_back(ids[i] >= 0 ? symbols[ids[i]] : unknown[-ids[i] - 1]);
+    }
     return word;
 }
 
+void BPETokenizer::encode_word(const std::u32string& word, std::vector<int>* ids, std::vector<std::string>* strs) const {
+    for (const auto& bpe_str : bpe(word)) {
+        auto iter = encoder.find(bpe_str);
+        if (iter != encoder.end()) {
+            ids->push_back(iter->second);
+        } else if (byte_fallback) {
+            auto utf8_token_str = utf32_to_utf8(bpe_str);
+            for (int i = 0; i < utf8_token_str.length(); i++) {
+                unsigned char b = utf8_token_str[i];
+                char hex_buf[16];
+                snprintf(hex_buf, sizeof(hex_buf), "<0x%02X>", b);
+                iter = encoder.find(utf8_to_utf32(hex_buf));
+                ids->push_back(iter != encoder.end() ? iter->second : UNK_TOKEN_ID);
+                strs->push_back(hex_buf);
+            }
+            continue;
+        } else {
+            ids->push_back(UNK_TOKEN_ID);
+        }
+        strs->push_back(utf32_to_utf8(bpe_str));
+    }
+}
+
 std::vector<int> BPETokenizer::encode(const std::string& text, on_new_token_cb_t on_new_token_cb) {
     std::vector<int32_t> bpe_tokens;
     std::vector<std::string> token_strs;
 
+    if (merge_table.empty() && !bpe_ranks.empty()) {
+        build_merge_table();
+    }
+
     std::string normalized_text = normalize_before_split ? normalize(text) : text;
-    auto splited_texts          = split_with_special_tokens(normalized_text, special_tokens);
+    auto splited_texts          = split_special_tokens(normalized_text);
 
     for (auto& splited_text : splited_texts) {
         if (is_special_token(splited_text)) {
@@ -170,32 +249,24 @@ std::vector<int> BPETokenizer::encode(const std::string& text, on_new_token_cb_t
             } else {
                 utf32_token = utf8_to_utf32(token_str);
             }
-            auto bpe_strs = bpe(utf32_token);
-            for (auto bpe_str : bpe_strs) {
-                int token_id;
-                auto iter = encoder.find(bpe_str);
-                if (iter != encoder.end()) {
-                    token_id = iter->second;
-                } else {
-                    if (byte_fallback) {
-                        auto utf8_token_str = utf32_to_utf8(bpe_str);
-                        for (int i = 0; i < utf8_token_str.length(); i++) {
-                            unsigned char b = utf8_token_str[i];
-                            char hex_buf[16];
-                            snprintf(hex_buf, sizeof(hex_buf), "<0x%02X>", b);
-                            iter     = encoder.find(utf8_to_utf32(hex_buf));
-                            token_id = iter != encoder.end() ? iter->second : UNK_TOKEN_ID;
-                            bpe_tokens.push_back(token_id);
-                            token_strs.push_back(hex_buf);
-                        }
-                        continue;
-                    } else {
-                        token_id = UNK_TOKEN_ID;
-                    }
+
+            auto cached = word_cache_index.find(utf32_token);
+            if (cached == word_cache_index.end()) {
+                CachedWord word;
+                word.word = utf32_token;
+                encode_word(utf32_token, &word.ids, &word.strs);
+                word_cache.push_front(std::move(word));
+                cached = word_cache_index.emplace(utf32_token, word_cache.begin()).first;
+                if (word_cache.size() > word_cache_capacity) {
+                    word_cache_index.erase(word_cache.back().word);
+                    word_cache.pop_back();
                 }
-                bpe_tokens.push_back(token_id);
-                token_strs.push_back(utf32_to_utf8(bpe_str));
+            } else {
+                word_cache.splice(word_cache.begin(), word_cache, cached->second);
             }
+            const CachedWord& word = *cached->second;
+            bpe_tokens.insert(bpe_tokens.end(), word.ids.begin(), word.ids.end());
+            token_strs.insert(token_strs.end(), word.strs.begin(), word.strs.end());
         }
     }
 
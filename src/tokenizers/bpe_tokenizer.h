@@ -4,32 +4,71 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <list>
 #include <map>
 #include <regex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "tokenizer.h"
 
+struct U32StringPairHash {
+    size_t operator()(const std::pair<std::u32string, std::u32string>& pair) const {
+        size_t hash = std::hash<std::u32string>()(pair.first);
+        return hash ^ (std::hash<std::u32string>()(pair.second) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    }
+};
+
 class BPETokenizer : public Tokenizer {
 protected:
     std::map<int, std::u32string> byte_encoder;
     std::map<std::u32string, int> byte_decoder;
-    std::map<std::u32string, int> encoder;
-    std::map<int, std::u32string> decoder;
-    std::map<std::pair<std::u32string, std::u32string>, int> bpe_ranks;
+    std::unordered_map<std::u32string, int> encoder;
+    std::unordered_map<int, std::u32string> decoder;
+    // Filled by the subclasses while loading; turned into merge_table on the
+    // first encode and released.
+    std::unordered_map<std::pair<std::u32string, std::u32string>, int, U32StringPairHash> bpe_ranks;
     int encoder_len     = 0;
     int bpe_len         = 0;
     bool byte_level_bpe = true;
     bool byte_fallback  = false;
 
+    // Merges run over interned symbol ids: every string a merge reads or
+    // produces gets an id, and a merge is found by its packed (left, right)
+    // id pair.
+    struct Merge {
+        int rank;
+        int merged;
+    };
+    std::unordered_map<std::u32string, int> symbol_ids;
+    std::vector<std::u32string> symbols;
+    std::unordered_map<uint64_t, Merge> merge_table;
+
+    // LRU cache of encoded words, like the bpe() cache of GPT-2's encoder:
+    // prompts repeat most of their words, within a prompt and across a batch.
+    struct CachedWord {
+        std::u32string word;
+        std::vector<int> ids;
+        std::vector<std::string> strs;
+    };
+    std::list<CachedWord> word_cache;
+    std::unordered_map<std::u32string, std::list<CachedWord>::iterator> word_cache_index;
+    size_t word_cache_capacity = 8192;
+
 protected:
     static std::vector<std::pair<int, std::u32string>> bytes_to_unicode();
     static std::vector<std::u32string> split_utf32(const std::string& text, char32_t delimiter = U'\n');
+    // Token and id pairs from a pre-compiled vocab blob, or from a vocab.json
+    // string when one is supplied by the caller.
+    static std::vector<std::pair<std::string, int>> read_vocab(const std::string& vocab_str);
     virtual std::vector<std::string> token_split(const std::string& text) const;
+    void build_merge_table();
+    int intern_symbol(const std::u32string& symbol);
     std::vector<std::u32string> bpe(const std::u32string& token) const;
+    void encode_word(const std::u32string& word, std::vector<int>* ids, std::vector<std::string>* strs) const;
     std::string decode_token(int token_id) const override;
 
 public:
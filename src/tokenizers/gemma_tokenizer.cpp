@@ -1,8 +1,6 @@
 #include "gemma_tokenizer.h"
 
 #include "core/util.h"
-#include "ggml.h"
-#include "json.hpp"
 #include "vocab/vocab.h"
 
 std::string GemmaTokenizer::normalize(const std::string& text) const {
@@ -16,15 +14,9 @@ std::string GemmaTokenizer::normalize(const std::string& text) const {
 }
 
 void GemmaTokenizer::load_from_merges(const std::string& merges_utf8_str, const std::string& vocab_utf8_str) {
-    nlohmann::json vocab;
-    try {
-        vocab = nlohmann::json::parse(vocab_utf8_str);
-    } catch (const nlohmann::json::parse_error&) {
-        GGML_ABORT("invalid vocab json str");
-    }
-    for (const auto& [key, value] : vocab.items()) {
+    auto vocab = read_vocab(vocab_utf8_str);
+    for (const auto& [key, i] : vocab) {
         std::u32string token = utf8_to_utf32(key);
-        int i                = value;
         encoder[token]       = i;
         decoder[i]           = token;
     }
@@ -201,15 +193,9 @@ std::string Gemma2Tokenizer::normalize(const std::string& text) const {
 }
 
 void Gemma2Tokenizer::load_from_merges(const std::string& merges_utf8_str, const std::string& vocab_utf8_str) {
-    nlohmann::json vocab;
-    try {
-        vocab = nlohmann::json::parse(vocab_utf8_str);
-    } catch (const nlohmann::json::parse_error&) {
-        GGML_ABORT("invalid vocab json str");
-    }
-    for (const auto& [key, value] : vocab.items()) {
+    auto vocab = read_vocab(vocab_utf8_str);
+    for (const auto& [key, i] : vocab) {
         std::u32string token = utf8_to_utf32(key);
-        int i                = value;
         encoder[token]       = i;
         decoder[i]           = token;
     }
@@ -1,7 +1,6 @@
 #include "gpt_oss_tokenizer.h"
 
 #include "core/util.h"
-#include "json.hpp"
 #include "vocab/vocab.h"
 
 void GPTOSSTokenizer::load_from_merges(const std::string& merges_utf8_str, const std::string& vocab_utf8_str) {
@@ -11,15 +10,9 @@ void GPTOSSTokenizer::load_from_merges(const std::string& merges_utf8_str, const
         byte_decoder[pair.second] = pair.first;
     }
 
-    nlohmann::json vocab;
-    try {
-        vocab = nlohmann::json::parse(vocab_utf8_str);
-    } catch (const nlohmann::json::parse_error&) {
-        GGML_ABORT("invalid vocab json str");
-    }
-    for (const auto& [key, value] : vocab.items()) {
+    auto vocab = read_vocab(vocab_utf8_str);
+    for (const auto& [key, i] : vocab) {
         std::u32string token = utf8_to_utf32(key);
-        int i                = value;
         encoder[token]       = i;
         decoder[i]           = token;
     }
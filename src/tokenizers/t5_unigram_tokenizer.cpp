@@ -44,7 +44,20 @@ std::string MetaspacePreTokenizer::tokenize(const std::string& input) const {
     return tokens;
 }
 
-void T5UniGramTokenizer::InitializePieces(const std::string& json_str) {
+void T5UniGramTokenizer::InitializePieces(const std::string& json_str, std::vector<int>* sorted_ids) {
+    UnigramVocab vocab;
+    if (read_unigram_vocab_blob(json_str, &vocab)) {
+        if (vocab.unk_id >= 0) {
+            UNK_TOKEN_ID = vocab.unk_id;
+        }
+        replacement       = vocab.replacement;
+        add_prefix_space  = vocab.add_prefix_space;
+        pre_tokenizer     = MetaspacePreTokenizer(replacement, add_prefix_space);
+        piece_score_pairs = std::move(vocab.pieces);
+        *sorted_ids       = std::move(vocab.sorted_ids);
+        return;
+    }
+
     nlohmann::json data;
 
     try {
@@ -85,7 +98,7 @@ void T5UniGramTokenizer::InitializePieces(const std::string& json_str) {
     }
 }
 
-void T5UniGramTokenizer::BuildTrie(std::vector<std::pair<std::string, int>>* pieces) {
+void T5UniGramTokenizer::BuildTrie(std::vector<std::pair<std::string, int>>* pieces, bool sorted) {
     if (status_ != OK) {
         return;
     }
@@ -95,7 +108,9 @@ void T5UniGramTokenizer::BuildTrie(std::vector<std::pair<std::string, int>>* pie
         return;
     }
 
-    std::sort(pieces->begin(), pieces->end());
+    if (!sorted) {
+        std::sort(pieces->begin(), pieces->end());
+    }
 
     std::vector<const char*> key(pieces->size());
     std::vector<int> value(pieces->size());
@@ -244,26 +259,32 @@ T5UniGramTokenizer::T5UniGramTokenizer(bool is_umt5) {
         special_tokens.push_back("<s>");
     }
 
+    std::vector<int> sorted_ids;
     if (is_umt5) {
-        InitializePieces(load_umt5_tokenizer_json());
+        InitializePieces(load_umt5_tokenizer_json(), &sorted_ids);
     } else {
-        InitializePieces(load_t5_tokenizer_json());
+        InitializePieces(load_t5_tokenizer_json(), &sorted_ids);
     }
 
     min_score_ = FLT_MAX;
     max_score_ = FLT_MIN;
 
-    std::vector<std::pair<std::string, int>> pieces;
-    for (int i = 0; i < static_cast<int>(piece_score_pairs.size()); i++) {
-        const auto& sp = piece_score_pairs[i];
-
+    for (const auto& sp : piece_score_pairs) {
         min_score_ = std::min(min_score_, sp.second);
         max_score_ = std::max(max_score_, sp.second);
+    }
 
-        pieces.emplace_back(sp.first, i);
+    // The pre-compiled vocab carries the byte order of its pieces, so only a
+    // JSON vocab needs sorting before the trie is built.
+    std::vector<std::pair<std::string, int>> pieces;
+    pieces.reserve(piece_score_pairs.size());
+    const bool sorted = sorted_ids.size() == piece_score_pairs.size();
+    for (int i = 0; i < static_cast<int>(piece_score_pairs.size()); i++) {
+        int id = sorted ? sorted_ids[i] : i;
+        pieces.emplace_back(piece_score_pairs[id].first, id);
     }
 
-    BuildTrie(&pieces);
+    BuildTrie(&pieces, sorted);
 }
 
 T5UniGramTokenizer::~T5UniGramTokenizer() = default;
@@ -291,7 +312,7 @@ std::vector<int> T5UniGramTokenizer::encode(const std::string& input, on_new_tok
     std::vector<int32_t> tokens;
     std::vector<std::string> token_strs;
     std::string normalized = normalize(input);
-    auto splited_texts     = split_with_special_tokens(normalized, special_tokens);
+    auto splited_texts     = split_special_tokens(normalized);
     if (splited_texts.empty()) {
         splited_texts.push_back(normalized);  // for empty string
     }
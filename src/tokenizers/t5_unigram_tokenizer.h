@@ -46,8 +46,8 @@ protected:
     std::string replacement;
     bool add_prefix_space = true;
 
-    void InitializePieces(const std::string& json_str);
-    void BuildTrie(std::vector<std::pair<std::string, int>>* pieces);
+    void InitializePieces(const std::string& json_str, std::vector<int>* sorted_ids);
+    void BuildTrie(std::vector<std::pair<std::string, int>>* pieces, bool sorted = false);
     float GetScoreInlined(int id) const;
     bool IsUnusedInlined(int id) const;
     bool IsUserDefinedInlined(int id) const;
@@ -947,32 +947,122 @@ std::vector<std::string> token_split(const std::string& text) {
     return tokens;
 }
 
+SpecialTokenMatcher::SpecialTokenMatcher(const std::vector<std::string>& tokens)
+    : nodes_(1), token_count_(tokens.size()) {
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const std::string& token = tokens[i];
+        if (token.empty()) {
+            continue;
+        }
+        int32_t node = 0;
+        for (unsigned char c : token) {
+            int32_t next = child(node, c);
+            if (next == 0) {
+                next = static_cast<int32_t>(nodes_.size());
+                nodes_.emplace_back();
+                nodes_[next].depth = nodes_[node].depth + 1;
+                auto& children     = nodes_[node].children;
+                auto it            = std::lower_bound(children.begin(), children.end(), std::make_pair(c, int32_t(0)));
+                children.insert(it, {c, next});
+            }
+            node = next;
+        }
+        if (nodes_[node].token < 0) {
+            nodes_[node].token = static_cast<int32_t>(i);
+        }
+        max_len_ = std::max(max_len_, token.size());
+    }
+
+    // fail and output links, breadth first so a node's fail target is done
+    std::vector<int32_t> order = {0};
+    nodes_[0].output           = nodes_[0].token;
+    for (size_t i = 0; i < order.size(); ++i) {
+        int32_t node = order[i];
+        for (const auto& [c, next] : nodes_[node].children) {
+            nodes_[next].fail   = node == 0 ? 0 : step(nodes_[node].fail, c);
+            nodes_[next].output = nodes_[next].token >= 0 ? next : nodes_[nodes_[next].fail].output;
+            order.push_back(next);
+        }
+    }
+}
+
+int32_t SpecialTokenMatcher::child(int32_t node, uint8_t c) const {
+    const auto& children = nodes_[node].children;
+    auto it              = std::lower_bound(children.begin(), children.end(), std::make_pair(c, int32_t(0)));
+    return it != children.end() && it->first == c ? it->second : 0;
+}
+
+int32_t SpecialTokenMatcher::step(int32_t node, uint8_t c) const {
+    while (true) {
+        int32_t next = child(node, c);
+        if (next != 0 || node == 0) {
+            return next;
+        }
+        node = nodes_[node].fail;
+    }
+}
+
+bool SpecialTokenMatcher::find(const std::string& text, size_t pos, size_t& match_pos, size_t& match_len) const {
+    bool found       = false;
+    int32_t best_tok = -1;
+    int32_t node     = 0;
+    for (size_t i = pos; i < text.size(); ++i) {
+        // no token starting at or before match_pos can end past here
+        if (found && i >= match_pos + max_len_) {
+            break;
+        }
+        node = step(node, static_cast<uint8_t>(text[i]));
+        for (int32_t out = nodes_[node].output; out > 0; out = nodes_[nodes_[out].fail].output) {
+            const Node& hit = nodes_[out];
+            size_t start    = i + 1 - hit.depth;
+            if (!found || start < match_pos || (start == match_pos && hit.token < best_tok)) {
+                found     = true;
+                match_pos = start;
+                match_len = hit.depth;
+                best_tok  = hit.token;
+            }
+        }
+    }
+    return found;
+}
+
+bool SpecialTokenMatcher::contains(const std::string& token) const {
+    int32_t node = 0;
+    for (unsigned char c : token) {
+        node = child(node, c);
+        if (node == 0) {
+            return false;
+        }
+    }
+    return nodes_[node].token >= 0;
+}
+
 std::vector<std::string> split_with_special_tokens(
     const std::string& text,
     const std::vector<std::string>& special_tokens) {
+    return split_with_special_tokens(text, SpecialTokenMatcher(special_tokens));
+}
+
+std::vector<std::string> split_with_special_tokens(const std::string& text, const SpecialTokenMatcher& matcher) {
     std::vector<std::string> result;
     size_t pos      = 0;
     size_t text_len = text.size();
 
     while (pos < text_len) {
-        size_t next_pos = text_len;
-        std::string matched_token;
-
-        for (const auto& token : special_tokens) {
-            size_t token_pos = text.find(token, pos);
-            if (token_pos != std::string::npos && token_pos < next_pos) {
-                next_pos      = token_pos;
-                matched_token = token;
-            }
-        }
+        size_t next_pos  = text_len;
+        size_t match_len = 0;
+        bool matched     = matcher.find(text, pos, next_pos, match_len);
 
+        if (!matched) {
+            next_pos = text_len;
+        }
         if (next_pos > pos) {
             result.push_back(text.substr(pos, next_pos - pos));
         }
 
-        if (!matched_token.empty()) {
-            result.push_back(matched_token);
-            pos = next_pos + matched_token.size();
+        if (matched) {
+            result.push_back(text.substr(next_pos, match_len));
+            pos = next_pos + match_len;
         } else {
             break;
         }
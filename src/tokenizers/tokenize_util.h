@@ -1,10 +1,42 @@
 #ifndef __SD_TOKENIZERS_BPE_TOKENIZE_UTIL_H__
 #define __SD_TOKENIZERS_BPE_TOKENIZE_UTIL_H__
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
+// Aho-Corasick automaton over a list of special tokens, so a text is split in
+// one pass however many tokens there are (textual inversion embeddings add
+// one each) instead of one search per token.
+class SpecialTokenMatcher {
+public:
+    explicit SpecialTokenMatcher(const std::vector<std::string>& tokens);
+
+    size_t token_count() const { return token_count_; }
+    // The leftmost token starting at or after pos. Of tokens starting at the
+    // same byte the first listed wins. False when none is left.
+    bool find(const std::string& text, size_t pos, size_t& match_pos, size_t& match_len) const;
+    bool contains(const std::string& token) const;
+
+private:
+    struct Node {
+        std::vector<std::pair<uint8_t, int32_t>> children;  // sorted by byte
+        int32_t fail   = 0;
+        int32_t output = -1;  // nearest node on the fail chain, this one included, that ends a token
+        int32_t token  = -1;  // list index of the token ending here, the lowest of duplicates
+        int32_t depth  = 0;
+    };
+
+    int32_t child(int32_t node, uint8_t c) const;
+    int32_t step(int32_t node, uint8_t c) const;
+
+    std::vector<Node> nodes_;
+    size_t token_count_ = 0;
+    size_t max_len_     = 0;
+};
+
 std::vector<std::string> token_split(const std::string& text);
 std::vector<std::string> split_with_special_tokens(const std::string& text, const std::vector<std::string>& special_tokens);
+std::vector<std::string> split_with_special_tokens(const std::string& text, const SpecialTokenMatcher& matcher);
 
 #endif  // __SD_TOKENIZERS_BPE_TOKENIZE_UTIL_H__
\ No newline at end of file
@@ -5,12 +5,40 @@
 #include <regex>
 
 #include "core/util.h"
+#include "tokenize_util.h"
 
 void Tokenizer::add_special_token(const std::string& token) {
+    std::lock_guard<std::mutex> lock(special_token_matcher_mutex);
     special_tokens.push_back(token);
+    special_token_matcher.reset();
+}
+
+std::shared_ptr<const SpecialTokenMatcher> Tokenizer::current_special_token_matcher() const {
+    std::lock_guard<std::mutex> lock(special_token_matcher_mutex);
+    if (special_token_matcher != nullptr && special_token_matcher->token_count() == special_tokens.size()) {
+        return special_token_matcher;
+    }
+    return nullptr;
+}
+
+std::vector<std::string> Tokenizer::split_special_tokens(const std::string& text) {
+    std::shared_ptr<const SpecialTokenMatcher> matcher;
+    {
+        // tokenizers fill special_tokens directly in their constructors
+        std::lock_guard<std::mutex> lock(special_token_matcher_mutex);
+        if (special_token_matcher == nullptr || special_token_matcher->token_count() != special_tokens.size()) {
+            special_token_matcher = std::make_shared<SpecialTokenMatcher>(special_tokens);
+        }
+        matcher = special_token_matcher;
+    }
+    // the automaton is immutable, a replacement leaves this one alive
+    return split_with_special_tokens(text, *matcher);
 }
 
 bool Tokenizer::is_special_token(const std::string& token) const {
+    if (auto matcher = current_special_token_matcher()) {
+        return matcher->contains(token);
+    }
     for (const auto& special_token : special_tokens) {
         if (special_token == token) {
             return true;
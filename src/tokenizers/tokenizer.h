@@ -4,9 +4,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+class SpecialTokenMatcher;
+
 using on_new_token_cb_t = std::function<bool(std::string&, std::vector<int32_t>&)>;
 
 class Tokenizer {
@@ -20,6 +24,10 @@ protected:
 
     virtual std::string decode_token(int token_id) const = 0;
     virtual std::string normalize(const std::string& text) const;
+    // Text split around the special tokens, matched in one pass by an
+    // automaton built on first use and again after special_tokens changed.
+    // Safe to call from several threads at once.
+    std::vector<std::string> split_special_tokens(const std::string& text);
 
 public:
     std::string UNK_TOKEN;
@@ -49,6 +57,13 @@ public:
                     size_t max_length          = 100000000,
                     bool allow_overflow_expand = false);
     std::string decode(const std::vector<int>& tokens) const;
+
+private:
+    // The current automaton, or null when special_tokens changed since.
+    std::shared_ptr<const SpecialTokenMatcher> current_special_token_matcher() const;
+
+    mutable std::mutex special_token_matcher_mutex;  // guards special_token_matcher
+    std::shared_ptr<const SpecialTokenMatcher> special_token_matcher;
 };
 
 #endif  // __SD_TOKENIZERS_TOKENIZER_H__